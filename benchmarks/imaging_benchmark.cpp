@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "core/alloc_tracker.hpp"
+#include "core/file_utils.hpp"
+#include "core/math_util.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/image_util.hpp"
+#include "imaging/attenuation.hpp"
+#include "imaging/backscatter.hpp"
+#include "imaging/enhance.hpp"
+#include "imaging/guided_filter.hpp"
+#include "imaging/illuminant.hpp"
+#include "imaging/normalization.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+// Benchmarks for each stage of EnhanceUnderwater(), on the 3374 Sea-thru image from
+// test/resources/test_images_enhance, at full, 1/2 and 1/4 resolution and with 1, 2 and 4 OpenCV
+// threads. Run with:
+// ./imaging_benchmark --benchmark_out=results.json --benchmark_out_format=json
+//
+// Besides the time, each benchmark reports:
+//  - rel_error: L1 distance of the output from a reference implementation (exact, or without the
+//    shortcut that the fast version takes), relative to the L1 norm of the reference
+//  - fit_error: instead of rel_error for the optimizers, which have no exact reference
+//  - allocs: heap allocations per iteration on the benchmark thread, in a build with
+//    BM_ENABLE_ALLOC_TRACKING (OpenCV worker threads aren't counted)
+//
+// NOTE(milo): The error is computed once, outside of the timed loop. A faster kernel should keep
+// rel_error about where it is.
+
+static const char* kAllocStage = "imaging_benchmark";
+static const int kBackNumPx = 256;
+static const int kBackIters = 10;
+static const int kBetaNumPx = 256;
+static const int kBetaIters = 20;
+
+
+static std::string ResourcePath(const std::string& filename)
+{
+  return Join(BM_BENCHMARK_RESOURCES_DIR, filename);
+}
+
+
+// The image, range and the intermediate results that each stage needs, at 1/scale resolution.
+struct StageInputs final
+{
+  Image3f I;
+  Image1f range;
+  Image1f range2;     // Slightly different, so that cached guide statistics can't be reused.
+  Image1f intensity;
+  Image1b is_dark;
+  Vector3f B, beta_B, Jp, beta_Dp;
+  Image3f D;
+  Image3f il;
+  Vector12f beta_D;
+};
+
+
+static const StageInputs& GetStageInputs(int scale)
+{
+  static std::map<int, StageInputs> cache;
+  if (cache.count(scale) != 0) {
+    return cache.at(scale);
+  }
+
+  const Image3b raw = cv::imread(ResourcePath("test_images_enhance/images/3374_bluegreen.png"), cv::IMREAD_COLOR);
+  const Image1f depth = cv::imread(ResourcePath("test_images_enhance/depth/depth_3374.exr"), cv::IMREAD_ANYDEPTH);
+  CHECK(!raw.empty() && !depth.empty()) << "Could not load the benchmark images" << std::endl;
+
+  StageInputs& in = cache[scale];
+  const cv::Size size(raw.cols / scale, raw.rows / scale);
+  cv::resize(CastImage3bTo3f(raw), in.I, size, 0, 0, cv::INTER_AREA);
+  cv::resize(depth, in.range, size, 0, 0, cv::INTER_NEAREST);
+  in.range2 = in.range * 1.0001f;
+
+  cv::cvtColor(in.I, in.intensity, CV_BGR2GRAY);
+  FindDarkFast(in.intensity, in.range, kDarkPercentile, in.is_dark);
+
+  EUInfo info;
+  BackscatterInitialGuess(info);
+  EstimateBackscatter(in.I, in.range, in.is_dark, kBackNumPx, kBackIters, info.B, info.beta_B, info.Jp, info.beta_Dp);
+  in.B = info.B;
+  in.beta_B = info.beta_B;
+  in.Jp = info.Jp;
+  in.beta_Dp = info.beta_Dp;
+  RemoveBackscatter(in.I, in.range, in.B, in.beta_B, in.D);
+
+  in.il = EstimateIlluminantRangeGuided(in.D, in.range, NextEvenInt(in.D.cols / 3), 0.01, 8);
+  in.beta_D = BetaInitialGuess1();
+  EstimateBeta(in.range, in.il, kBetaNumPx, kBetaIters, in.beta_D);
+
+  return in;
+}
+
+
+static double RelativeError(const cv::Mat& out, const cv::Mat& reference)
+{
+  CHECK_EQ(out.size(), reference.size());
+  const double norm = cv::norm(reference, cv::NORM_L1);
+  return (norm > 0) ? cv::norm(out, reference, cv::NORM_L1) / norm : 0;
+}
+
+
+static uint64_t StageAllocs()
+{
+  for (const AllocStageCounts& counts : GetAllocStageCounts()) {
+    if (counts.name == kAllocStage) {
+      return counts.allocs;
+    }
+  }
+  return 0;
+}
+
+
+// Runs fn once per iteration with the OpenCV thread count from state.range(1), and adds the
+// allocation counter.
+template <typename Fn>
+static void RunStage(benchmark::State& state, const StageInputs& in, Fn fn)
+{
+  const int prev_threads = cv::getNumThreads();
+  cv::setNumThreads(static_cast<int>(state.range(1)));
+
+  const uint64_t allocs0 = StageAllocs();
+  for (auto _ : state) {
+    ScopedAllocStage stage(kAllocStage);
+    fn();
+  }
+  const uint64_t allocs = StageAllocs() - allocs0;
+
+  cv::setNumThreads(prev_threads);
+
+  state.SetItemsProcessed(state.iterations() * in.I.rows * in.I.cols);
+  if (AllocTrackingEnabled()) {
+    state.counters["allocs"] = benchmark::Counter(static_cast<double>(allocs), benchmark::Counter::kAvgIterations);
+  }
+}
+
+
+// Resolution divisor x OpenCV threads.
+static void ScalesAndThreads(benchmark::internal::Benchmark* b)
+{
+  for (const int scale : { 1, 2, 4 }) {
+    for (const int threads : { 1, 2, 4 }) {
+      b->Args({ scale, threads });
+    }
+  }
+  b->ArgNames({ "scale", "threads" })->Unit(benchmark::kMillisecond)->UseRealTime();
+}
+
+
+// Reference: the exact percentile of the valid intensities (FindDarkFast uses a histogram).
+static void BM_FindDarkFast(benchmark::State& state)
+{
+  const StageInputs& in = GetStageInputs(static_cast<int>(state.range(0)));
+
+  std::vector<float> valid;
+  for (int r = 0; r < in.intensity.rows; ++r) {
+    for (int c = 0; c < in.intensity.cols; ++c) {
+      if (in.range(r, c) > 0.1f) {
+        valid.emplace_back(in.intensity(r, c));
+      }
+    }
+  }
+  const size_t k = std::min(valid.size() - 1, (size_t)(kDarkPercentile * in.intensity.total()));
+  std::nth_element(valid.begin(), valid.begin() + k, valid.end());
+
+  Image1b mask;
+  const float threshold = FindDarkFast(in.intensity, in.range, kDarkPercentile, mask);
+  const double rel_error = std::fabs(threshold - valid.at(k)) / std::max(valid.at(k), 1e-6f);
+
+  RunStage(state, in, [&]() {
+    benchmark::DoNotOptimize(FindDarkFast(in.intensity, in.range, kDarkPercentile, mask));
+  });
+  state.counters["rel_error"] = rel_error;
+}
+BENCHMARK(BM_FindDarkFast)->Apply(ScalesAndThreads);
+
+
+// There's no exact reference, so this reports the fit error that EstimateBackscatter() returns.
+static void BM_EstimateBackscatter(benchmark::State& state)
+{
+  const StageInputs& in = GetStageInputs(static_cast<int>(state.range(0)));
+  EUInfo info;
+  float error = 0;
+
+  RunStage(state, in, [&]() {
+    BackscatterInitialGuess(info);
+    error = EstimateBackscatter(in.I, in.range, in.is_dark, kBackNumPx, kBackIters,
+                                info.B, info.beta_B, info.Jp, info.beta_Dp);
+  });
+  state.counters["fit_error"] = error;
+}
+BENCHMARK(BM_EstimateBackscatter)->Apply(ScalesAndThreads);
+
+
+// Reference: the same guided filter without subsampling (s = 1).
+static void BM_IlluminantRangeGuided(benchmark::State& state)
+{
+  const StageInputs& in = GetStageInputs(static_cast<int>(state.range(0)));
+  const int r = NextEvenInt(in.D.cols / 3);
+
+  GuidedFilter reference_filter;
+  Image3f reference;
+  EstimateIlluminantRangeGuided(in.D, in.range, r, 0.01, 1, reference_filter, reference);
+
+  GuidedFilter filter;
+  Image3f il;
+  EstimateIlluminantRangeGuided(in.D, in.range, r, 0.01, 8, filter, il);
+  const double rel_error = RelativeError(il, reference);
+
+  // Alternate between ranges, since every frame has a new one.
+  bool flip = false;
+  RunStage(state, in, [&]() {
+    flip = !flip;
+    EstimateIlluminantRangeGuided(in.D, flip ? in.range2 : in.range, r, 0.01, 8, filter, il);
+  });
+  state.counters["rel_error"] = rel_error;
+}
+BENCHMARK(BM_IlluminantRangeGuided)->Apply(ScalesAndThreads);
+
+
+// Reference: cv::GaussianBlur (the OPENCV backend).
+static void BM_IlluminantGaussianRecursive(benchmark::State& state)
+{
+  const StageInputs& in = GetStageInputs(static_cast<int>(state.range(0)));
+  const int ksize = 2 * (in.D.cols / 6) + 1;
+  const double sigma = ksize / 6.0;
+
+  const Image3f reference = EstimateIlluminantGaussian(in.D, ksize, ksize, sigma, sigma, GaussianBackend::OPENCV);
+  Image3f il = EstimateIlluminantGaussian(in.D, ksize, ksize, sigma, sigma, GaussianBackend::RECURSIVE);
+  const double rel_error = RelativeError(il, reference);
+
+  RunStage(state, in, [&]() {
+    il = EstimateIlluminantGaussian(in.D, ksize, ksize, sigma, sigma, GaussianBackend::RECURSIVE);
+  });
+  state.counters["rel_error"] = rel_error;
+}
+BENCHMARK(BM_IlluminantGaussianRecursive)->Apply(ScalesAndThreads);
+
+
+// There's no exact reference, so this reports the fit error that EstimateBeta() returns.
+static void BM_EstimateBeta(benchmark::State& state)
+{
+  const StageInputs& in = GetStageInputs(static_cast<int>(state.range(0)));
+  Vector12f X;
+  float error = 0;
+
+  RunStage(state, in, [&]() {
+    X = BetaInitialGuess1();
+    error = EstimateBeta(in.range, in.il, kBetaNumPx, kBetaIters, X);
+  });
+  state.counters["fit_error"] = error;
+}
+BENCHMARK(BM_EstimateBeta)->Apply(ScalesAndThreads);
+
+
+// Reference: the gain exp(beta_c(z) * z) evaluated at every pixel (CorrectAttenuation uses a table).
+static void BM_CorrectAttenuation(benchmark::State& state)
+{
+  const StageInputs& in = GetStageInputs(static_cast<int>(state.range(0)));
+  const Vector12f& X = in.beta_D;
+
+  double rmin, rmax;
+  cv::minMaxLoc(in.range, &rmin, &rmax);
+  Image3f reference(in.D.size());
+  for (int r = 0; r < in.D.rows; ++r) {
+    for (int c = 0; c < in.D.cols; ++c) {
+      const float z = (in.range(r, c) > 0) ? in.range(r, c) : (in.range(r, c) + (float)rmax);
+      for (int ch = 0; ch < 3; ++ch) {
+        const float beta_c = X(ch) * std::exp(X(3 + ch) * z) + X(6 + ch) * std::exp(X(9 + ch) * z);
+        reference(r, c)[ch] = in.D(r, c)[ch] * std::exp(beta_c * z);
+      }
+    }
+  }
+
+  Image3f out;
+  CorrectAttenuation(in.D, in.range, X, out);
+  const double rel_error = RelativeError(out, reference);
+
+  RunStage(state, in, [&]() {
+    CorrectAttenuation(in.D, in.range, X, out);
+  });
+  state.counters["rel_error"] = rel_error;
+}
+BENCHMARK(BM_CorrectAttenuation)->Apply(ScalesAndThreads);
+
+
+// Reference: the same steps with the full resolution image functions (ColorPipeline gets its
+// statistics from a downsampled image, and its gamma from a table).
+static void BM_ColorPipeline(benchmark::State& state)
+{
+  const StageInputs& in = GetStageInputs(static_cast<int>(state.range(0)));
+
+  ColorPipeline::Params params;
+  ColorPipeline pipeline(params);
+  const Image3f reference = LinearToGamma(Normalize(WhiteBalanceSimple(in.I)), params.output_gamma);
+
+  Image3f out = in.I.clone();
+  pipeline.Apply(out);
+  const double rel_error = RelativeError(out, reference);
+
+  RunStage(state, in, [&]() {
+    in.I.copyTo(out);
+    pipeline.Apply(out);
+  });
+  state.counters["rel_error"] = rel_error;
+}
+BENCHMARK(BM_ColorPipeline)->Apply(ScalesAndThreads);
+
+
+// All of the stages together, at the resolution from state.range(0) and with the model fit at
+// 1/state.range(2) of that. Reference: the work_scale = 1 output.
+static void BM_EnhanceUnderwater(benchmark::State& state)
+{
+  const StageInputs& in = GetStageInputs(static_cast<int>(state.range(0)));
+  const int work_scale = static_cast<int>(state.range(2));
+
+  EUBuffers buffers;
+  Image3f reference, out;
+  EnhanceUnderwater(in.I, in.range, kBackNumPx, kBackIters, kBetaNumPx, kBetaIters,
+                    BetaInitialGuess1(), reference, buffers, 1);
+  EnhanceUnderwater(in.I, in.range, kBackNumPx, kBackIters, kBetaNumPx, kBetaIters,
+                    BetaInitialGuess1(), out, buffers, work_scale);
+  const double rel_error = RelativeError(out, reference);
+
+  RunStage(state, in, [&]() {
+    EnhanceUnderwater(in.I, in.range, kBackNumPx, kBackIters, kBetaNumPx, kBetaIters,
+                      BetaInitialGuess1(), out, buffers, work_scale);
+  });
+  state.counters["rel_error"] = rel_error;
+}
+BENCHMARK(BM_EnhanceUnderwater)->Apply([](benchmark::internal::Benchmark* b) {
+  for (const int scale : { 1, 2 }) {
+    for (const int threads : { 1, 4 }) {
+      for (const int work_scale : { 1, 2, 4 }) {
+        b->Args({ scale, threads, work_scale });
+      }
+    }
+  }
+  b->ArgNames({ "scale", "threads", "work_scale" })->Unit(benchmark::kMillisecond)->UseRealTime();
+});
+
+
+int main(int argc, char** argv)
+{
+  google::InitGoogleLogging(argv[0]);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  if (!AllocTrackingEnabled()) {
+    LOG(WARNING) << "Built without BM_ENABLE_ALLOC_TRACKING, allocations won't be reported" << std::endl;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+
+  return 0;
+}
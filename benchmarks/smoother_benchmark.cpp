@@ -0,0 +1,152 @@
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include "core/eigen_types.hpp"
+#include "core/imu_measurement.hpp"
+#include "core/timestamp.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vio/fixed_lag_smoother.hpp"
+#include "vio/imu_manager.hpp"
+#include "vio/vo_result.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+// Benchmarks for the FixedLagSmoother on a synthetic dive, with the same window and keypose rate as
+// the vehicle. Run with:
+// ./smoother_benchmark --benchmark_out=results.json --benchmark_out_format=json
+//
+// NOTE(milo): The thread counts only make a difference in a build with BM_SMOOTHER_USE_TBB.
+
+static const double kKeyposeHz = 4.0;
+static const double kImuHz = 100.0;
+static const double kLagSec = 10.0;
+static const double kSpeed = 0.5;           // m/s, straight ahead (+z).
+static const int kNumLandmarks = 800;
+static const int kRandomSeed = 123;
+
+
+// Intrinsics and baseline of the farmsim_01 images (see config/shared/Farmsim.yaml).
+static StereoCamera FarmsimStereoRig()
+{
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  return StereoCamera(camera_model, 0.2);
+}
+
+
+// Everything the smoother sees for one keypose.
+struct SyntheticKeypose final
+{
+  VoResult::ConstPtr vo;
+  PimResult::ConstPtr pim;
+};
+
+
+// The camera moves forward through a box of landmarks at constant velocity, with perfect stereo
+// observations and IMU measurements (gravity only).
+static std::vector<SyntheticKeypose> MakeSyntheticDive(const StereoCamera& stereo_rig, int num_keyposes)
+{
+  std::mt19937 rng(kRandomSeed);
+  const double max_z = kSpeed * num_keyposes / kKeyposeHz + 10.0;
+  std::uniform_real_distribution<double> x_dist(-5.0, 5.0), y_dist(-3.0, 3.0), z_dist(1.0, max_z);
+
+  std::vector<Vector3d> t_world_lmks(kNumLandmarks);
+  for (Vector3d& t : t_world_lmks) {
+    t = Vector3d(x_dist(rng), y_dist(rng), z_dist(rng));
+  }
+
+  ImuManager::Params imu_params;
+  ImuManager imu_manager(imu_params, "smoother_benchmark_imu");
+  const Vector3d body_acc = -imu_params.n_gravity;
+
+  std::vector<SyntheticKeypose> out;
+  for (int k = 1; k <= num_keyposes; ++k) {
+    const seconds_t t_prev = (k - 1) / kKeyposeHz;
+    const seconds_t t = k / kKeyposeHz;
+
+    // NOTE(milo): Preintegrate() pops everything up to t, so each window starts with the one at t_prev.
+    const int imu_per_keypose = static_cast<int>(kImuHz / kKeyposeHz);
+    for (int j = (k == 1) ? 0 : 1; j <= imu_per_keypose; ++j) {
+      const seconds_t t_imu = t_prev + j / kImuHz;
+      imu_manager.Push(ImuMeasurement(ConvertToNanoseconds(t_imu), Vector3d::Zero(), body_acc));
+    }
+
+    VoResult::Ptr vo = std::make_shared<VoResult>(ConvertToNanoseconds(t), ConvertToNanoseconds(t_prev), k, k - 1);
+    vo->is_keyframe = true;
+    vo->lkf_T_cam.block<3, 1>(0, 3) = Vector3d(0, 0, kSpeed / kKeyposeHz);
+
+    const Vector3d world_t_cam(0, 0, kSpeed * t);
+    for (size_t i = 0; i < t_world_lmks.size(); ++i) {
+      const Vector3d p = t_world_lmks.at(i) - world_t_cam;
+      if (p.z() < 1.0 || p.z() > 12.0) {
+        continue;
+      }
+      const double u = stereo_rig.fx() * p.x() / p.z() + stereo_rig.cx();
+      const double v = stereo_rig.fy() * p.y() / p.z() + stereo_rig.cy();
+      if (u < 0 || v < 0 || u >= stereo_rig.Width() || v >= stereo_rig.Height()) {
+        continue;
+      }
+      const double disp = stereo_rig.fx() * stereo_rig.Baseline() / p.z();
+      vo->lmk_obs.emplace_back(i, k, cv::Point2f(u, v), disp, 1.0, 1.0);
+    }
+    CHECK(!vo->lmk_obs.empty());
+
+    SyntheticKeypose keypose;
+    keypose.vo = vo;
+    keypose.pim = std::make_shared<PimResult>(imu_manager.Preintegrate(t_prev, t));
+    CHECK(keypose.pim->timestamps_aligned);
+    out.emplace_back(keypose);
+  }
+
+  return out;
+}
+
+
+// One iteration runs 2x the window, so the second half is at the steady-state window size.
+static void BM_FixedLagSmootherWindow(benchmark::State& state)
+{
+  FixedLagSmoother::Params params;
+  params.stereo_rig = FarmsimStereoRig();
+  params.smoother_lag_sec = kLagSec;
+  params.num_threads = state.range(0);
+  params.extra_smoothing_iters = 2;
+
+  const int num_keyposes = static_cast<int>(2.0 * kLagSec * kKeyposeHz);
+  const std::vector<SyntheticKeypose> dive = MakeSyntheticDive(params.stereo_rig, num_keyposes);
+
+  FixedLagSmoother smoother(params);
+  double isam_update_ms = 0;
+
+  for (auto _ : state) {
+    smoother.Initialize(0.0, gtsam::Pose3::identity(), gtsam::Vector3(0, 0, kSpeed), ImuBias(), true);
+    for (const SyntheticKeypose& keypose : dive) {
+      benchmark::DoNotOptimize(smoother.Update(keypose.vo, keypose.pim));
+      isam_update_ms += smoother.GetUpdateStats().isam_update_ms;
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * num_keyposes);
+  state.counters["isam_update_ms"] = benchmark::Counter(
+      isam_update_ms / num_keyposes, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_FixedLagSmootherWindow)->Arg(1)->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+int main(int argc, char** argv)
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_minloglevel = 1;  // The smoother logs a lot of things that would swamp the benchmark output.
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+
+  return 0;
+}
@@ -0,0 +1,314 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "core/file_utils.hpp"
+#include "vision_core/cv_types.hpp"
+#include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/stereo_matcher.hpp"
+#include "stereo_matching/patchmatch.hpp"
+#include "stereo_matching/stereo_matching.hpp"
+#include "patchmatch_gpu/patchmatch_gpu.h"
+
+using namespace bm;
+using namespace core;
+
+// Runs every stereo backend (SGBM, CPU patchmatch, GPU patchmatch and SGM, and the sparse
+// StereoMatcher) on the same rectified pairs, so that they can be compared side by side. Run with:
+// ./stereo_benchmark --benchmark_out=results.json --benchmark_out_format=json
+//
+// The time per iteration is the latency of one pair, and items_per_second is the throughput in
+// pairs per second. Each benchmark also reports:
+//  - density: fraction of pixels (or keypoints, for the sparse matcher) with a disparity
+//  - bad1, bad3: fraction of those that are more than 1 or 3 px from the ground truth (only for
+//    pairs that have it)
+//
+// The pairs are farmsim_01 and caddy_32 from test/resources, and a synthetic pair with known
+// disparity (made by warping farmsim_01). Set BM_KITTI_STEREO_DIR to a KITTI 2015 training folder
+// (with image_2, image_3 and disp_occ_0) to add the first few of its pairs too.
+//
+// NOTE(milo): A disparity <= 0 means that a backend has no estimate for that pixel.
+
+static const int kMaxDisp = 128;
+static const int kNumKittiPairs = 5;
+
+
+struct StereoPair final
+{
+  std::string name;
+  Image1b left, right;
+  Image1f gt_disp;      // Empty if there's no ground truth, and <= 0 where it's unknown.
+};
+
+
+static std::string ResourcePath(const std::string& filename)
+{
+  return Join(BM_BENCHMARK_RESOURCES_DIR, filename);
+}
+
+
+static StereoPair LoadPair(const std::string& name, const std::string& left_path, const std::string& right_path)
+{
+  StereoPair pair;
+  pair.name = name;
+  pair.left = cv::imread(left_path, cv::IMREAD_GRAYSCALE);
+  pair.right = cv::imread(right_path, cv::IMREAD_GRAYSCALE);
+  CHECK(!pair.left.empty() && !pair.right.empty()) << "Could not load stereo pair: " << left_path << std::endl;
+  return pair;
+}
+
+
+// The right image of farmsim_01 is the texture, and the left image is warped from it with a known
+// disparity: a slanted background plane and a fronto-parallel box in front of it.
+static StereoPair MakeSyntheticPair()
+{
+  StereoPair pair;
+  pair.name = "synthetic_gt";
+  pair.right = cv::imread(ResourcePath("farmsim_01_right.png"), cv::IMREAD_GRAYSCALE);
+  CHECK(!pair.right.empty());
+
+  const int rows = pair.right.rows;
+  const int cols = pair.right.cols;
+  pair.gt_disp.create(rows, cols);
+  Image1f map_x(rows, cols), map_y(rows, cols);
+  const cv::Rect box(cols / 3, rows / 3, cols / 4, rows / 3);
+
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < cols; ++x) {
+      const float d = box.contains(cv::Point(x, y)) ? 60.0f : (8.0f + 24.0f * y / rows);
+      pair.gt_disp(y, x) = (x - d >= 0) ? d : 0.0f;
+      map_x(y, x) = x - d;
+      map_y(y, x) = y;
+    }
+  }
+
+  cv::remap(pair.right, pair.left, map_x, map_y, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+  return pair;
+}
+
+
+// KITTI stores disparity as uint16 * 256, with 0 for unknown.
+static std::vector<StereoPair> LoadKittiPairs(const std::string& folder)
+{
+  std::vector<StereoPair> out;
+  for (int i = 0; i < kNumKittiPairs; ++i) {
+    char frame[16];
+    snprintf(frame, sizeof(frame), "%06d_10.png", i);
+
+    StereoPair pair;
+    pair.name = std::string("kitti_") + std::to_string(i);
+    pair.left = cv::imread(Join(Join(folder, "image_2"), frame), cv::IMREAD_GRAYSCALE);
+    pair.right = cv::imread(Join(Join(folder, "image_3"), frame), cv::IMREAD_GRAYSCALE);
+    const cv::Mat disp16 = cv::imread(Join(Join(folder, "disp_occ_0"), frame), cv::IMREAD_ANYDEPTH);
+    if (pair.left.empty() || pair.right.empty() || disp16.empty()) {
+      LOG(WARNING) << "Missing KITTI frame " << frame << " in " << folder << std::endl;
+      break;
+    }
+    disp16.convertTo(pair.gt_disp, CV_32F, 1.0 / 256.0);
+    out.emplace_back(pair);
+  }
+  return out;
+}
+
+
+// Accumulates density and bad pixel rates over the disparities that a backend made.
+struct AccuracyStats final
+{
+  void Add(float disp, float gt)
+  {
+    ++num;
+    if (disp <= 0) {
+      return;
+    }
+    ++num_valid;
+    if (gt > 0) {
+      ++num_gt;
+      const float error = std::fabs(disp - gt);
+      num_bad1 += (error > 1.0f) ? 1 : 0;
+      num_bad3 += (error > 3.0f) ? 1 : 0;
+    }
+  }
+
+  void AddImage(const Image1f& disp, const Image1f& gt)
+  {
+    for (int y = 0; y < disp.rows; ++y) {
+      for (int x = 0; x < disp.cols; ++x) {
+        Add(disp(y, x), gt.empty() ? 0.0f : gt(y, x));
+      }
+    }
+  }
+
+  void Report(benchmark::State& state) const
+  {
+    state.counters["density"] = (num > 0) ? (double)num_valid / num : 0;
+    if (num_gt > 0) {
+      state.counters["bad1"] = (double)num_bad1 / num_gt;
+      state.counters["bad3"] = (double)num_bad3 / num_gt;
+    }
+  }
+
+  int64_t num = 0, num_valid = 0, num_gt = 0, num_bad1 = 0, num_bad3 = 0;
+};
+
+
+// Calls match once per iteration, and measures accuracy on the output of the first call.
+static void RunDense(benchmark::State& state,
+                     const StereoPair& pair,
+                     const std::function<void(const Image1b&, const Image1b&, Image1f&)>& match)
+{
+  Image1f disp;
+  match(pair.left, pair.right, disp);
+  AccuracyStats stats;
+  stats.AddImage(disp, pair.gt_disp);
+
+  for (auto _ : state) {
+    match(pair.left, pair.right, disp);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  stats.Report(state);
+}
+
+
+static void BM_Sgbm(benchmark::State& state, const StereoPair& pair)
+{
+  stereo::SgbmMatcher::Params params;
+  params.num_disp = kMaxDisp;
+  params.block_size = 5;
+  params.P1 = 8 * params.block_size * params.block_size;
+  params.P2 = 32 * params.block_size * params.block_size;
+  stereo::SgbmMatcher matcher(params);
+
+  RunDense(state, pair, [&](const Image1b& il, const Image1b& ir, Image1f& disp) {
+    matcher.Match(il, ir, disp);
+  });
+}
+
+
+static void BM_Patchmatch(benchmark::State& state, const StereoPair& pair)
+{
+  stereo::Patchmatch::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = kMaxDisp;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+  stereo::Patchmatch pm(params);
+
+  RunDense(state, pair, [&](const Image1b& il, const Image1b& ir, Image1f& disp) {
+    disp = pm.EstimateDisparity(il, ir);
+  });
+}
+
+
+static void BM_PatchmatchGpu(benchmark::State& state, const StereoPair& pair, bool use_sgm)
+{
+  pm::PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = kMaxDisp;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+  params.cost_alpha = 0.9;
+  params.patchmatch_iters = 3;
+  params.use_sgm = use_sgm;
+  pm::PatchmatchGpu matcher(params);
+  Image1f dispr;
+
+  RunDense(state, pair, [&](const Image1b& il, const Image1b& ir, Image1f& disp) {
+    matcher.Match(il, ir, disp, dispr);
+  });
+}
+
+
+// The keypoints are detected once, outside of the timed loop, like in the frontend (where they
+// come from tracking). Density and accuracy are over the keypoints.
+static void BM_StereoMatcherSparse(benchmark::State& state, const StereoPair& pair)
+{
+  ft::FeatureDetector::Params dparams;
+  ft::FeatureDetector detector(dparams);
+  VecPoint2f empty_kp, keypoints;
+  detector.Detect(pair.left, empty_kp, keypoints);
+
+  ft::StereoMatcher::Params mparams;
+  mparams.max_disp = kMaxDisp;
+  ft::StereoMatcher matcher(mparams);
+
+  std::vector<double> disps = matcher.MatchRectified(pair.left, pair.right, keypoints);
+  AccuracyStats stats;
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    const cv::Point p(std::lround(keypoints[i].x), std::lround(keypoints[i].y));
+    const bool has_gt = !pair.gt_disp.empty() && p.inside(cv::Rect(0, 0, pair.gt_disp.cols, pair.gt_disp.rows));
+    stats.Add(static_cast<float>(disps[i]), has_gt ? pair.gt_disp(p) : 0.0f);
+  }
+
+  for (auto _ : state) {
+    disps = matcher.MatchRectified(pair.left, pair.right, keypoints);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["keypoints"] = static_cast<double>(keypoints.size());
+  stats.Report(state);
+}
+
+
+int main(int argc, char** argv)
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_minloglevel = 1;
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+
+  // NOTE(milo): The benchmarks hold references to these, so they outlive RunSpecifiedBenchmarks().
+  static std::vector<StereoPair> pairs;
+  pairs.emplace_back(LoadPair("farmsim_01", ResourcePath("farmsim_01_left.png"), ResourcePath("farmsim_01_right.png")));
+  pairs.emplace_back(LoadPair("caddy_32", ResourcePath("caddy_32_left.jpg"), ResourcePath("caddy_32_right.jpg")));
+  pairs.emplace_back(MakeSyntheticPair());
+
+  const char* kitti_dir = std::getenv("BM_KITTI_STEREO_DIR");
+  if (kitti_dir != nullptr) {
+    for (const StereoPair& pair : LoadKittiPairs(kitti_dir)) {
+      pairs.emplace_back(pair);
+    }
+  }
+
+  const bool has_cuda = cv::cuda::getCudaEnabledDeviceCount() > 0;
+  if (!has_cuda) {
+    LOG(WARNING) << "No CUDA device, skipping the GPU backends" << std::endl;
+  }
+
+  for (const StereoPair& pair : pairs) {
+    const auto add = [&](const std::string& backend, std::function<void(benchmark::State&)> fn) {
+      benchmark::RegisterBenchmark((backend + "/" + pair.name).c_str(), fn)
+          ->Unit(benchmark::kMillisecond)->UseRealTime();
+    };
+    add("Sgbm", [&pair](benchmark::State& state) { BM_Sgbm(state, pair); });
+    add("Patchmatch", [&pair](benchmark::State& state) { BM_Patchmatch(state, pair); });
+    if (has_cuda) {
+      add("PatchmatchGpu", [&pair](benchmark::State& state) { BM_PatchmatchGpu(state, pair, false); });
+      add("SgmGpu", [&pair](benchmark::State& state) { BM_PatchmatchGpu(state, pair, true); });
+    }
+    add("StereoMatcherSparse", [&pair](benchmark::State& state) { BM_StereoMatcherSparse(state, pair); });
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+
+  return 0;
+}
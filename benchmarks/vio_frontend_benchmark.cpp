@@ -0,0 +1,338 @@
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "core/eigen_types.hpp"
+#include "core/file_utils.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/stereo_image.hpp"
+#include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/feature_tracker.hpp"
+#include "feature_tracking/stereo_matcher.hpp"
+#include "feature_tracking/stereo_tracker.hpp"
+#include "vio/optimize_odometry.hpp"
+#include "vio/stereo_frontend.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+using namespace vio;
+
+// Microbenchmarks for the hot paths of the stereo VIO frontend. Run with:
+// ./vio_frontend_benchmark --benchmark_out=results.json --benchmark_out_format=json
+//
+// NOTE(milo): Everything here is deterministic (fixed images and a fixed random seed), so results
+// can be compared from commit to commit.
+
+// Benchmarks that take an image argument use these.
+enum ImageSet { FARMSIM = 0, CADDY = 1 };
+
+static const int kSequenceLength = 8;     // Number of synthetic frames in a tracking sequence.
+static const int kRandomSeed = 123;
+
+
+static std::string ResourcePath(const std::string& filename)
+{
+  return Join(BM_BENCHMARK_RESOURCES_DIR, filename);
+}
+
+
+static void LoadStereoPair(ImageSet images, Image1b& left, Image1b& right)
+{
+  const std::string prefix = (images == ImageSet::FARMSIM) ? "farmsim_01" : "caddy_32";
+  const std::string ext = (images == ImageSet::FARMSIM) ? ".png" : ".jpg";
+  left = cv::imread(ResourcePath(prefix + "_left" + ext), cv::IMREAD_GRAYSCALE);
+  right = cv::imread(ResourcePath(prefix + "_right" + ext), cv::IMREAD_GRAYSCALE);
+  CHECK(!left.empty() && !right.empty()) << "Could not load benchmark images: " << prefix << std::endl;
+}
+
+
+// Intrinsics and baseline of the farmsim_01 images (see config/shared/Farmsim.yaml).
+static StereoCamera FarmsimStereoRig()
+{
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  return StereoCamera(camera_model, 0.2);
+}
+
+
+// Makes a short sequence of stereo pairs by translating the farmsim_01 pair a few pixels at a time,
+// moving back and forth so that the sequence can be looped without a big jump.
+static std::vector<std::pair<Image1b, Image1b>> MakeFarmsimSequence()
+{
+  Image1b left, right;
+  LoadStereoPair(ImageSet::FARMSIM, left, right);
+
+  std::vector<std::pair<Image1b, Image1b>> out;
+  for (int i = 0; i < kSequenceLength; ++i) {
+    const int shift_px = (i < kSequenceLength / 2) ? i : (kSequenceLength - i);
+    const cv::Mat M = (cv::Mat_<double>(2, 3) << 1, 0, shift_px, 0, 1, 0.5 * shift_px);
+    Image1b l, r;
+    cv::warpAffine(left, l, M, left.size());
+    cv::warpAffine(right, r, M, right.size());
+    out.emplace_back(l, r);
+  }
+
+  return out;
+}
+
+
+static void BM_FeatureDetectorDetect(benchmark::State& state)
+{
+  Image1b left, right;
+  LoadStereoPair(static_cast<ImageSet>(state.range(0)), left, right);
+
+  FeatureDetector::Params params;
+  FeatureDetector detector(params);
+
+  const VecPoint2f empty_kp;
+  VecPoint2f new_kp;
+
+  for (auto _ : state) {
+    new_kp.clear();
+    detector.Detect(left, empty_kp, new_kp);
+    benchmark::DoNotOptimize(new_kp.data());
+  }
+
+  state.counters["keypoints"] = new_kp.size();
+}
+BENCHMARK(BM_FeatureDetectorDetect)->Arg(ImageSet::FARMSIM)->Arg(ImageSet::CADDY)->Unit(benchmark::kMillisecond);
+
+
+static void BM_FeatureTrackerTrack(benchmark::State& state)
+{
+  Image1b left, right;
+  LoadStereoPair(static_cast<ImageSet>(state.range(0)), left, right);
+
+  FeatureDetector::Params dparams;
+  FeatureDetector detector(dparams);
+  VecPoint2f left_kp;
+  detector.Detect(left, VecPoint2f(), left_kp);
+
+  FeatureTracker::Params tparams;
+  FeatureTracker tracker(tparams);
+
+  VecPoint2f right_kp;
+  std::vector<uchar> status;
+  std::vector<float> error;
+
+  for (auto _ : state) {
+    right_kp.clear();
+    tracker.Track(left, right, left_kp, right_kp, status, error);
+    benchmark::DoNotOptimize(right_kp.data());
+  }
+
+  state.counters["keypoints"] = left_kp.size();
+}
+BENCHMARK(BM_FeatureTrackerTrack)->Arg(ImageSet::FARMSIM)->Arg(ImageSet::CADDY)->Unit(benchmark::kMillisecond);
+
+
+// Variants of the backward check in FeatureTracker::Track(), tracking into a copy of the image that
+// is shifted by a known amount. The counters show what each one gives up in accuracy.
+enum CheckVariant { FWD_BKW_ALL = 0, FWD_BKW_HIGH_ERROR = 1, FWD_BKW_COARSE = 2, NCC = 3 };
+
+static void BM_FeatureTrackerCheck(benchmark::State& state)
+{
+  Image1b left, right;
+  LoadStereoPair(ImageSet::FARMSIM, left, right);
+
+  const float kShiftX = 3.0f;
+  const float kShiftY = 1.5f;
+  const cv::Mat M = (cv::Mat_<double>(2, 3) << 1, 0, kShiftX, 0, 1, kShiftY);
+  Image1b shifted;
+  cv::warpAffine(left, shifted, M, left.size());
+
+  FeatureDetector::Params dparams;
+  FeatureDetector detector(dparams);
+  VecPoint2f left_kp;
+  detector.Detect(left, VecPoint2f(), left_kp);
+
+  FeatureTracker::Params tparams;
+  switch (static_cast<CheckVariant>(state.range(0))) {
+    case FWD_BKW_HIGH_ERROR:
+      tparams.fwd_bkw_min_error = 4.0;
+      break;
+    case FWD_BKW_COARSE:
+      tparams.fwd_bkw_level = 1;
+      break;
+    case NCC:
+      tparams.check_mode = FeatureTracker::CheckMode::NCC;
+      break;
+    default:
+      break;
+  }
+  FeatureTracker tracker(tparams);
+
+  ImagePyramid ref_pyramid, cur_pyramid;
+  tracker.BuildPyramid(left, ref_pyramid);
+  tracker.BuildPyramid(shifted, cur_pyramid);
+
+  VecPoint2f cur_kp;
+  std::vector<uchar> status;
+  std::vector<float> error;
+
+  for (auto _ : state) {
+    cur_kp.clear();
+    tracker.Track(ref_pyramid, cur_pyramid, left_kp, cur_kp, status, error, true, 2.0);
+    benchmark::DoNotOptimize(cur_kp.data());
+  }
+
+  int num_tracked = 0, num_bad = 0;
+  double sum_err = 0;
+  for (size_t i = 0; i < left_kp.size(); ++i) {
+    if (!status.at(i)) {
+      continue;
+    }
+    const cv::Point2f d = cur_kp.at(i) - (left_kp.at(i) + cv::Point2f(kShiftX, kShiftY));
+    const double err = std::sqrt(d.x*d.x + d.y*d.y);
+    sum_err += err;
+    num_bad += (err > 1.0) ? 1 : 0;
+    ++num_tracked;
+  }
+
+  state.counters["keypoints"] = left_kp.size();
+  state.counters["tracked"] = num_tracked;
+  state.counters["bad"] = num_bad;
+  state.counters["mean_err_px"] = (num_tracked > 0) ? (sum_err / num_tracked) : 0.0;
+}
+BENCHMARK(BM_FeatureTrackerCheck)
+    ->Arg(FWD_BKW_ALL)->Arg(FWD_BKW_HIGH_ERROR)->Arg(FWD_BKW_COARSE)->Arg(NCC)
+    ->Unit(benchmark::kMillisecond);
+
+
+static void BM_StereoMatcherMatchRectified(benchmark::State& state)
+{
+  Image1b left, right;
+  LoadStereoPair(static_cast<ImageSet>(state.range(0)), left, right);
+
+  FeatureDetector::Params dparams;
+  FeatureDetector detector(dparams);
+  VecPoint2f left_kp;
+  detector.Detect(left, VecPoint2f(), left_kp);
+
+  StereoMatcher::Params mparams;
+  StereoMatcher matcher(mparams);
+
+  for (auto _ : state) {
+    const std::vector<double> disps = matcher.MatchRectified(left, right, left_kp);
+    benchmark::DoNotOptimize(disps.data());
+  }
+
+  state.counters["keypoints"] = left_kp.size();
+}
+BENCHMARK(BM_StereoMatcherMatchRectified)->Arg(ImageSet::FARMSIM)->Arg(ImageSet::CADDY)->Unit(benchmark::kMillisecond);
+
+
+static void BM_StereoTrackerTrackAndTriangulate(benchmark::State& state)
+{
+  const std::vector<std::pair<Image1b, Image1b>> sequence = MakeFarmsimSequence();
+
+  StereoTracker::Params params;
+  StereoTracker tracker(params, FarmsimStereoRig());
+
+  uid_t camera_id = 0;
+  for (auto _ : state) {
+    const std::pair<Image1b, Image1b>& pair = sequence.at(camera_id % sequence.size());
+    const StereoImage1b stereo_pair(ConvertToNanoseconds(0.1 * camera_id), camera_id, pair.first, pair.second);
+    benchmark::DoNotOptimize(tracker.TrackAndTriangulate(stereo_pair, false));
+    ++camera_id;
+  }
+
+  state.counters["live_tracks"] = tracker.GetLiveTracks().size();
+}
+BENCHMARK(BM_StereoTrackerTrackAndTriangulate)->Unit(benchmark::kMillisecond);
+
+
+// Odometry between two views of random landmarks, with known motion and pixel noise.
+static void BM_OptimizeOdometryLM(benchmark::State& state)
+{
+  const int num_landmarks = static_cast<int>(state.range(0));
+  const StereoCamera stereo_rig = FarmsimStereoRig();
+
+  std::mt19937 rng(kRandomSeed);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  std::normal_distribution<double> pixel_noise(0.0, 1.0);
+
+  Matrix4d T_10_true = Matrix4d::Identity();
+  T_10_true.block<3, 3>(0, 0) = AngleAxisd(0.05, Vector3d(0.2, 1.0, 0.1).normalized()).toRotationMatrix();
+  T_10_true.block<3, 1>(0, 3) = Vector3d(0.1, -0.05, 0.3);
+
+  std::vector<Vector3d> P0_list;
+  std::vector<Vector2d> p1_obs_list;
+  std::vector<double> p1_sigma_list;
+
+  while (static_cast<int>(P0_list.size()) < num_landmarks) {
+    const Vector3d P0(4.0 * uniform(rng), 3.0 * uniform(rng), 8.0 + 4.0 * uniform(rng));
+    const Vector3d P1 = T_10_true.block<3, 3>(0, 0) * P0 + T_10_true.block<3, 1>(0, 3);
+    const Vector2d p1 = stereo_rig.LeftCamera().Project(P1);
+    if (p1.x() < 0 || p1.y() < 0 || p1.x() >= stereo_rig.Width() || p1.y() >= stereo_rig.Height()) {
+      continue;
+    }
+    P0_list.emplace_back(P0);
+    p1_obs_list.emplace_back(p1 + Vector2d(pixel_noise(rng), pixel_noise(rng)));
+    p1_sigma_list.emplace_back(1.0);
+  }
+
+  Matrix6d C_10;
+  double error = 0;
+  int iters = 0;
+
+  for (auto _ : state) {
+    Matrix4d T_10 = Matrix4d::Identity();
+    iters = OptimizeOdometryLM(P0_list, p1_obs_list, p1_sigma_list, stereo_rig,
+                               T_10, C_10, error, 20, 1e-3, 1e-6);
+    benchmark::DoNotOptimize(T_10.data());
+  }
+
+  state.counters["iters"] = iters;
+  state.counters["error"] = error;
+}
+BENCHMARK(BM_OptimizeOdometryLM)->Arg(50)->Arg(200)->Unit(benchmark::kMicrosecond);
+
+
+static void BM_StereoFrontendTrack(benchmark::State& state)
+{
+  const std::vector<std::pair<Image1b, Image1b>> sequence = MakeFarmsimSequence();
+
+  StereoFrontend::Params params;
+  params.stereo_rig = FarmsimStereoRig();
+  params.body_T_left = Matrix4d::Identity();
+  params.body_T_right = Matrix4d::Identity();
+  StereoFrontend frontend(params);
+
+  uid_t camera_id = 0;
+  int num_keyframes = 0;
+  for (auto _ : state) {
+    const std::pair<Image1b, Image1b>& pair = sequence.at(camera_id % sequence.size());
+    const StereoImage1b stereo_pair(ConvertToNanoseconds(0.1 * camera_id), camera_id, pair.first, pair.second);
+    const VoResult result = frontend.Track(stereo_pair);
+    num_keyframes += result.is_keyframe ? 1 : 0;
+    ++camera_id;
+  }
+
+  state.counters["keyframes"] = num_keyframes;
+}
+BENCHMARK(BM_StereoFrontendTrack)->Unit(benchmark::kMillisecond);
+
+
+int main(int argc, char** argv)
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_minloglevel = 1;  // The frontend logs every frame, which would swamp the benchmark output.
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+
+  return 0;
+}
@@ -31,6 +31,9 @@ public:
 
   FloatImage& operator=(const FloatImage& other);
 
+  //! Change the size, without reallocating if the pixels fit in the old buffer. Pixel values are undefined afterwards.
+  void resize(int widthArg, int heightArg);
+
   float get(int x, int y) const { return pixels[y*width + x]; }
   void set(int x, int y, float v) { pixels[y*width + x] = v; }
   
@@ -39,6 +42,10 @@ public:
   int getNumFloatImagePixels() const { return width*height; }
   const std::vector<float>& getFloatImagePixels() const { return pixels; }
 
+  //! Pointers to the first pixel of row y.
+  float* row(int y) { return &pixels[y*width]; }
+  const float* row(int y) const { return &pixels[y*width]; }
+
   //! TODO: Fix decimateAvg function. DO NOT USE!
   void decimateAvg();
 
@@ -47,6 +54,9 @@ public:
 
   void filterFactoredCentered(const std::vector<float>& fhoriz, const std::vector<float>& fvert);
 
+  //! Same as above, with a scratch buffer that is kept by the caller. Rows and columns are filtered in parallel.
+  void filterFactoredCentered(const std::vector<float>& fhoriz, const std::vector<float>& fvert, std::vector<float>& scratch);
+
   template<typename T>
   void copyToSketch(DualCoding::Sketch<T>& sketch) {
     for (int i = 0; i < getNumFloatImagePixels(); i++)
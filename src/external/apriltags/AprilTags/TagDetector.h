@@ -5,9 +5,12 @@
 
 #include "opencv2/opencv.hpp"
 
+#include "AprilTags/Edge.h"
 #include "AprilTags/TagDetection.h"
 #include "AprilTags/TagFamily.h"
 #include "AprilTags/FloatImage.h"
+#include "AprilTags/UnionFindSimple.h"
+#include "AprilTags/XYWeight.h"
 
 namespace AprilTags {
 
@@ -18,10 +21,41 @@ public:
 
 	//! Constructor
   // note: TagFamily is instantiated here from TagCodes
-	TagDetector(const TagCodes& tagCodes) : thisTagFamily(tagCodes) {}
+	TagDetector(const TagCodes& tagCodes) : thisTagFamily(tagCodes), quadDecimate(1) {}
+
+  //! Search for quads in an image that is this many times smaller (in each direction) than the input.
+  /*! Each pixel of the small image is the average of a decimate x decimate block. The quad
+   *  edges are then refined against the full resolution image, and the bits are decoded there,
+   *  so decimation mostly costs the smallest tags (their edges have to be ~decimate times longer
+   *  to survive segmentation). 1 = no decimation.
+   */
+  void setQuadDecimate(int decimate) { quadDecimate = std::max(1, decimate); }
+  int getQuadDecimate() const { return quadDecimate; }
 	
+  //! Detect tags in an 8-bit grayscale image.
+  /*! Most of the steps run in parallel (cv::parallel_for_), and the intermediate images are
+   *  kept between calls, so nothing big is reallocated while the image size stays the same. This
+   *  also means that a TagDetector can only be used by one thread at a time.
+   */
 	std::vector<TagDetection> extractTags(const cv::Mat& image);
-	
+
+private:
+  int quadDecimate;
+
+  FloatImage fimOrig;     //!< Full resolution input, in [0,1].
+  FloatImage fimSeg;      //!< Decimated (and/or blurred) image that quads are searched for in.
+  FloatImage fimTheta;    //!< Gradient direction of fimSeg.
+  FloatImage fimMag;      //!< Squared gradient magnitude of fimSeg.
+  std::vector<float> filterScratch;
+
+  std::vector< std::vector<Edge> > bandEdges;   //!< Edges found in each band of rows.
+  std::vector<Edge> edges;                      //!< All edges, sorted by cost.
+  std::vector<size_t> costOffsets;
+  std::vector<float> storage;                   //!< Theta and magnitude bounds of each cluster.
+  UnionFindSimple uf;
+
+  std::vector<int> clusterIndex;                //!< Cluster of each union-find representative (or -1).
+  std::vector< std::vector<XYWeight> > clusters;
 };
 
 } // namespace
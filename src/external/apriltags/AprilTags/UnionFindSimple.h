@@ -14,9 +14,17 @@ class UnionFindSimple {
   };
 
 public:
+  UnionFindSimple() : data() {}
+
   explicit UnionFindSimple(int maxId) : data(maxId) {
     init();
   };
+
+  //! Start over with maxId singleton sets. Doesn't reallocate if there were at least as many before.
+  void reset(int maxId) {
+    data.resize(maxId);
+    init();
+  }
   
   int getSetSize(int thisId) { return data[getRepresentative(thisId)].size; }
 
@@ -2,6 +2,8 @@
 #include "Gaussian.h"
 #include <iostream>
 
+#include "opencv2/core/utility.hpp"
+
 namespace AprilTags {
 
 FloatImage::FloatImage() : width(0), height(0), pixels() {}
@@ -21,6 +23,12 @@ FloatImage& FloatImage::operator=(const FloatImage& other) {
   return *this;
 }
 
+void FloatImage::resize(int widthArg, int heightArg) {
+  width = widthArg;
+  height = heightArg;
+  pixels.resize(widthArg*heightArg);
+}
+
 void FloatImage::decimateAvg() {
   int nWidth = width/2;
   int nHeight = height/2;
@@ -44,28 +52,38 @@ void FloatImage::normalize() {
 }
 
 void FloatImage::filterFactoredCentered(const std::vector<float>& fhoriz, const std::vector<float>& fvert) {
-  // do horizontal
-  std::vector<float> r(pixels);
+  std::vector<float> scratch;
+  filterFactoredCentered(fhoriz, fvert, scratch);
+}
+
+void FloatImage::filterFactoredCentered(const std::vector<float>& fhoriz, const std::vector<float>& fvert, std::vector<float>& scratch) {
+  // do horizontal (each row is independent)
+  scratch.resize(pixels.size());
+  std::vector<float>& r = scratch;
 
-  for (int y = 0; y < height; y++) {
-    Gaussian::convolveSymmetricCentered(pixels, y*width, width, fhoriz, r, y*width);
-  }
+  cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& rows) {
+    for (int y = rows.start; y < rows.end; y++) {
+      Gaussian::convolveSymmetricCentered(pixels, y*width, width, fhoriz, r, y*width);
+    }
+  });
 
-  // do vertical
-  std::vector<float> tmp(height); // column before convolution
-  std::vector<float> tmp2(height); // column after convolution
+  // do vertical (each column is independent)
+  cv::parallel_for_(cv::Range(0, width), [&](const cv::Range& cols) {
+    std::vector<float> tmp(height); // column before convolution
+    std::vector<float> tmp2(height); // column after convolution
 
-  for (int x = 0; x < width; x++) {
+    for (int x = cols.start; x < cols.end; x++) {
 
-    // copy the column out for locality
-    for (int y = 0; y < height; y++)
-      tmp[y] = r[y*width + x];
+      // copy the column out for locality
+      for (int y = 0; y < height; y++)
+        tmp[y] = r[y*width + x];
 
-    Gaussian::convolveSymmetricCentered(tmp, 0, height, fvert, tmp2, 0);
+      Gaussian::convolveSymmetricCentered(tmp, 0, height, fvert, tmp2, 0);
 
-    for (int y = 0; y < height; y++)
-      pixels[y*width + x] = tmp2[y];
-  }
+      for (int y = 0; y < height; y++)
+        pixels[y*width + x] = tmp2[y];
+    }
+  });
 }
 
 void FloatImage::printMinMax() const {
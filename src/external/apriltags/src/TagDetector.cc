@@ -1,12 +1,14 @@
 #include <algorithm>
 #include <cmath>
+#include <cfloat>
 #include <climits>
-#include <map>
 #include <vector>
 #include <iostream>
 
 #include <Eigen/Dense>
 
+#include "opencv2/core/utility.hpp"
+
 #include "AprilTags/Edge.h"
 #include "AprilTags/FloatImage.h"
 #include "AprilTags/Gaussian.h"
@@ -24,322 +26,404 @@
 
 #include "AprilTags/TagDetector.h"
 
-//#define DEBUG_APRIL
-
-#ifdef DEBUG_APRIL
-#include <opencv/cv.h>
-#include <opencv/highgui.h>
-#endif
-
 using namespace std;
 
 namespace AprilTags {
 
-  std::vector<TagDetection> TagDetector::extractTags(const cv::Mat& image) {
+namespace {
 
-    // convert to internal AprilTags image (todo: slow, change internally to OpenCV)
-    int width = image.cols;
-    int height = image.rows;
-    AprilTags::FloatImage fimOrig(width, height);
-    int i = 0;
-    for (int y=0; y<height; y++) {
-      for (int x=0; x<width; x++) {
-        fimOrig.set(x, y, image.data[i]/255.);
-        i++;
-      }
+//! Rows per band, for the edge extraction (each band collects its own edges).
+const int rowsPerBand = 16;
+
+//! Segment and quad lists are split into at most this many chunks for the parallel steps.
+const int maxChunks = 32;
+
+//! Calls fn(k) for each chunk k in [0, numChunks), in parallel.
+template <typename Fn>
+void parallelChunks(int numChunks, const Fn& fn) {
+  cv::parallel_for_(cv::Range(0, numChunks), [&](const cv::Range& range) {
+    for (int k = range.start; k < range.end; k++)
+      fn(k);
+  });
+}
+
+int numChunksFor(size_t n) {
+  return (int) std::max<size_t>(1, std::min<size_t>(maxChunks, n));
+}
+
+//! Bilinear interpolation, clamped to the image.
+float sampleBilinear(const FloatImage& im, float x, float y) {
+  x = std::min(std::max(x, 0.0f), (float)(im.getWidth() - 1));
+  y = std::min(std::max(y, 0.0f), (float)(im.getHeight() - 1));
+  const int x0 = std::min((int)x, im.getWidth() - 2);
+  const int y0 = std::min((int)y, im.getHeight() - 2);
+  const float ax = x - x0;
+  const float ay = y - y0;
+  return (1-ay) * ((1-ax)*im.get(x0, y0) + ax*im.get(x0+1, y0)) +
+         ay * ((1-ax)*im.get(x0, y0+1) + ax*im.get(x0+1, y0+1));
+}
+
+//! Snap the edges of a quad that was found in a decimated image to the full resolution image.
+/*! Each edge is sampled at several points. At each one, we look along the edge normal (within
+ *  +/- range pixels) for the black to white transition, and a line is fit to those points. The
+ *  corners are then the intersections of neighboring lines. Returns false (and leaves p alone)
+ *  if the lines don't intersect.
+ */
+bool refineQuadEdges(const FloatImage& im, float range, std::vector< std::pair<float,float> >& p) {
+  const float cx = 0.25f * (p[0].first + p[1].first + p[2].first + p[3].first);
+  const float cy = 0.25f * (p[0].second + p[1].second + p[2].second + p[3].second);
+
+  std::vector<GLine2D> lines(4);
+  std::vector<XYWeight> points;
+
+  for (int i = 0; i < 4; i++) {
+    const std::pair<float,float>& a = p[i];
+    const std::pair<float,float>& b = p[(i+1) % 4];
+    const float dx = b.first - a.first;
+    const float dy = b.second - a.second;
+    const float len = std::sqrt(dx*dx + dy*dy);
+    if (len < 1)
+      return false;
+
+    // Normal that points out of the quad, i.e from the black border to the white background.
+    float nx = -dy / len;
+    float ny = dx / len;
+    if (nx*(0.5f*(a.first + b.first) - cx) + ny*(0.5f*(a.second + b.second) - cy) < 0) {
+      nx = -nx;
+      ny = -ny;
     }
-    std::pair<int,int> opticalCenter(width/2, height/2);
 
-#ifdef DEBUG_APRIL
-#if 0
-  { // debug - write
-    int height_ = fimOrig.getHeight();
-    int width_  = fimOrig.getWidth();
-    cv::Mat image(height_, width_, CV_8UC3);
-    {
-      for (int y=0; y<height_; y++) {
-        for (int x=0; x<width_; x++) {
-          cv::Vec3b v;
-          //        float vf = fimMag.get(x,y);
-          float vf = fimOrig.get(x,y);
-          int val = (int)(vf * 255.);
-          if ((val & 0xffff00) != 0) {printf("problem... %i\n", val);}
-          for (int k=0; k<3; k++) {
-            v(k) = val;
-          }
-          image.at<cv::Vec3b>(y, x) = v;
-        }
+    const int nsamples = std::max(16, (int)(len / 8));
+    points.clear();
+    for (int s = 0; s < nsamples; s++) {
+      const float alpha = (1.0f + s) / (nsamples + 1);
+      const float x0 = a.first + alpha*dx;
+      const float y0 = a.second + alpha*dy;
+
+      // Weighted mean of where the gradient along the normal is the strongest (and the right way).
+      float Mn = 0, Mcount = 0;
+      for (float n = -range; n <= range; n += 0.25f) {
+        const float g1 = sampleBilinear(im, x0 + (n+1)*nx, y0 + (n+1)*ny);
+        const float g2 = sampleBilinear(im, x0 + (n-1)*nx, y0 + (n-1)*ny);
+        if (g1 < g2)
+          continue;
+        const float weight = (g2-g1)*(g2-g1);
+        Mn += weight*n;
+        Mcount += weight;
       }
+
+      if (Mcount <= 0)
+        continue;
+      const float n0 = Mn / Mcount;
+      points.push_back(XYWeight(x0 + n0*nx, y0 + n0*ny, Mcount));
     }
-    imwrite("out.bmp", image);
+
+    lines[i] = (points.size() >= 2) ? GLine2D::lsqFitXYW(points) : GLine2D(a, b);
   }
-#endif
-#if 0
-  FloatImage fimOrig = fimOrig_;
-  { // debug - read
-
-    cv::Mat image = cv::imread("test.bmp");
-    int height_ = fimOrig.getHeight();
-    int width_  = fimOrig.getWidth();
-    {
-      for (int y=0; y<height_; y++) {
-        for (int x=0; x<width_; x++) {
-          cv::Vec3b v = image.at<cv::Vec3b>(y,x);
-          float val = (float)v(0)/255.;
-          fimOrig.set(x,y,val);
-        }
-      }
-    }
+
+  // Corner i is where the edge coming into it meets the one leaving it.
+  std::vector< std::pair<float,float> > refined(4);
+  for (int i = 0; i < 4; i++) {
+    refined[i] = lines[(i+3) % 4].intersectionWith(lines[i]);
+    if (refined[i].first == -1)
+      return false;
   }
-#endif
-#endif
+
+  p = refined;
+  return true;
+}
+
+}
+
+  std::vector<TagDetection> TagDetector::extractTags(const cv::Mat& image) {
+    CV_Assert(image.type() == CV_8UC1);
+
+    // convert to internal AprilTags image
+    const int width = image.cols;
+    const int height = image.rows;
+    fimOrig.resize(width, height);
+    cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& rows) {
+      for (int y = rows.start; y < rows.end; y++) {
+        const unsigned char* src = image.ptr<unsigned char>(y);
+        float* dst = fimOrig.row(y);
+        for (int x = 0; x < width; x++)
+          dst[x] = src[x]/255.;
+      }
+    });
+    std::pair<int,int> opticalCenter(width/2, height/2);
 
   //================================================================
   // Step one: preprocess image (convert to grayscale) and low pass if necessary
 
-  FloatImage fim = fimOrig;
-  
-  //! Gaussian smoothing kernel applied to image (0 == no filter).
-  /*! Used when sampling bits. Filtering is a good idea in cases
-   * where A) a cheap camera is introducing artifical sharpening, B)
-   * the bayer pattern is creating artifcats, C) the sensor is very
-   * noisy and/or has hot/cold pixels. However, filtering makes it
-   * harder to decode very small tags. Reasonable values are 0, or
-   * [0.8, 1.5].
-   */
-  float sigma = 0;
+  // NOTE: Bits are sampled from fimOrig directly. This used to have a separate (optionally
+  // blurred) copy for the bits, but its smoothing kernel (sigma) was always 0.
 
   //! Gaussian smoothing kernel applied to image (0 == no filter).
   /*! Used when detecting the outline of the box. It is almost always
    * useful to have some filtering, since the loss of small details
-   * won't hurt. Recommended value = 0.8. The case where sigma ==
-   * segsigma has been optimized to avoid a redundant filter
-   * operation.
+   * won't hurt. Recommended value = 0.8. When the image is decimated,
+   * the block average is already a low pass, so this is skipped.
    */
   float segSigma = 0.8f;
 
-  if (sigma > 0) {
-    int filtsz = ((int) max(3.0f, 3*sigma)) | 1;
-    std::vector<float> filt = Gaussian::makeGaussianFilter(sigma, filtsz);
-    fim.filterFactoredCentered(filt, filt);
+  const int d = quadDecimate;
+  if (d > 1) {
+    // Average each d x d block.
+    const int ws = width / d;
+    const int hs = height / d;
+    fimSeg.resize(ws, hs);
+    const float scale = 1.0f / (255.0f * d * d);
+    cv::parallel_for_(cv::Range(0, hs), [&](const cv::Range& rows) {
+      for (int y = rows.start; y < rows.end; y++) {
+        float* dst = fimSeg.row(y);
+        std::fill(dst, dst + ws, 0.0f);
+        for (int k = 0; k < d; k++) {
+          const unsigned char* src = image.ptr<unsigned char>(d*y + k);
+          for (int x = 0; x < ws; x++)
+            for (int j = 0; j < d; j++)
+              dst[x] += src[d*x + j];
+        }
+        for (int x = 0; x < ws; x++)
+          dst[x] *= scale;
+      }
+    });
+  } else {
+    fimSeg = fimOrig;
+    if (segSigma > 0) {
+      int filtsz = ((int) max(3.0f, 3*segSigma)) | 1;
+      std::vector<float> filt = Gaussian::makeGaussianFilter(segSigma, filtsz);
+      fimSeg.filterFactoredCentered(filt, filt, filterScratch);
+    }
   }
 
+  const int ws = fimSeg.getWidth();
+  const int hs = fimSeg.getHeight();
+  if (ws < 3 || hs < 3)
+    return std::vector<TagDetection>();
+
   //================================================================
   // Step two: Compute the local gradient. We store the direction and magnitude.
   // This step is quite sensitve to noise, since a few bad theta estimates will
   // break up segments, causing us to miss Quads. It is useful to do a Gaussian
   // low pass on this step even if we don't want it for encoding.
 
-  FloatImage fimSeg;
-  if (segSigma > 0) {
-    if (segSigma == sigma) {
-      fimSeg = fim;
-    } else {
-      // blur anew
-      int filtsz = ((int) max(3.0f, 3*segSigma)) | 1;
-      std::vector<float> filt = Gaussian::makeGaussianFilter(segSigma, filtsz);
-      fimSeg = fimOrig;
-      fimSeg.filterFactoredCentered(filt, filt);
-    }
-  } else {
-    fimSeg = fimOrig;
-  }
+  fimTheta.resize(ws, hs);
+  fimMag.resize(ws, hs);
 
-  FloatImage fimTheta(fimSeg.getWidth(), fimSeg.getHeight());
-  FloatImage fimMag(fimSeg.getWidth(), fimSeg.getHeight());
-  
+  cv::parallel_for_(cv::Range(0, hs), [&](const cv::Range& rows) {
+    for (int y = rows.start; y < rows.end; y++) {
+      float* theta = fimTheta.row(y);
+      float* mag = fimMag.row(y);
 
-  #pragma omp parallel for
-  for (int y = 1; y < fimSeg.getHeight()-1; y++) {
-    for (int x = 1; x < fimSeg.getWidth()-1; x++) {
-      float Ix = fimSeg.get(x+1, y) - fimSeg.get(x-1, y);
-      float Iy = fimSeg.get(x, y+1) - fimSeg.get(x, y-1);
-
-      float mag = Ix*Ix + Iy*Iy;
-#if 0 // kaess: fast version, but maybe less accurate?
-      float theta = MathUtil::fast_atan2(Iy, Ix);
-#else
-      float theta = atan2(Iy, Ix);
-#endif
-      
-      fimTheta.set(x, y, theta);
-      fimMag.set(x, y, mag);
-    }
-  }
-
-#ifdef DEBUG_APRIL
-  int height_ = fimSeg.getHeight();
-  int width_  = fimSeg.getWidth();
-  cv::Mat image(height_, width_, CV_8UC3);
-  {
-    for (int y=0; y<height_; y++) {
-      for (int x=0; x<width_; x++) {
-        cv::Vec3b v;
-        //        float vf = fimMag.get(x,y);
-        float vf = fimOrig.get(x,y);
-        int val = (int)(vf * 255.);
-        if ((val & 0xffff00) != 0) {printf("problem... %i\n", val);}
-        for (int k=0; k<3; k++) {
-          v(k) = val;
-        }
-        image.at<cv::Vec3b>(y, x) = v;
+      // The border has no gradient.
+      if (y == 0 || y == hs-1) {
+        std::fill(theta, theta + ws, 0.0f);
+        std::fill(mag, mag + ws, 0.0f);
+        continue;
+      }
+      theta[0] = theta[ws-1] = 0;
+      mag[0] = mag[ws-1] = 0;
+
+      const float* above = fimSeg.row(y-1);
+      const float* here = fimSeg.row(y);
+      const float* below = fimSeg.row(y+1);
+      for (int x = 1; x < ws-1; x++) {
+        float Ix = here[x+1] - here[x-1];
+        float Iy = below[x] - above[x];
+        mag[x] = Ix*Ix + Iy*Iy;
+        theta[x] = atan2(Iy, Ix);
       }
     }
-  }
-#endif
+  });
 
   //================================================================
   // Step three. Extract edges by grouping pixels with similar
   // thetas together. This is a greedy algorithm: we start with
   // the most similar pixels.  We use 4-connectivity.
-  UnionFindSimple uf(fimSeg.getWidth()*fimSeg.getHeight());
-  
-  vector<Edge> edges(width*height*4);
-  size_t nEdges = 0;
+  uf.reset(ws*hs);
 
   // Bounds on the thetas assigned to this group. Note that because
   // theta is periodic, these are defined such that the average
   // value is contained *within* the interval.
-  { // limit scope of storage
-    /* Previously all this was on the stack, but this is 1.2MB for 320x240 images
-     * That's already a problem for OS X (default 512KB thread stack size),
-     * could be a problem elsewhere for bigger images... so store on heap */
-    vector<float> storage(width*height*4);  // do all the memory in one big block, exception safe
-    float * tmin = &storage[width*height*0];
-    float * tmax = &storage[width*height*1];
-    float * mmin = &storage[width*height*2];
-    float * mmax = &storage[width*height*3];
-                  
-    for (int y = 0; y+1 < height; y++) {
-      for (int x = 0; x+1 < width; x++) {
-                                  
+  // NOTE: These are only read for pixels that have an edge, and those are all written below, so
+  // the stale values from the last image don't need to be cleared.
+  storage.resize(ws*hs*4);
+  float * tmin = &storage[ws*hs*0];
+  float * tmax = &storage[ws*hs*1];
+  float * mmin = &storage[ws*hs*2];
+  float * mmax = &storage[ws*hs*3];
+
+  // Each band of rows finds its edges in parallel, into its own list.
+  const int numBands = (hs - 1 + rowsPerBand - 1) / rowsPerBand;
+  bandEdges.resize(numBands);
+  std::vector<size_t> bandNumEdges(numBands, 0);
+
+  parallelChunks(numBands, [&](int b) {
+    const int y0 = b * rowsPerBand;
+    const int y1 = std::min(hs - 1, y0 + rowsPerBand);
+    std::vector<Edge>& band = bandEdges[b];
+    if ((int)band.size() < 4 * ws * (y1 - y0))
+      band.resize(4 * ws * (y1 - y0));
+    size_t& nEdges = bandNumEdges[b];
+
+    for (int y = y0; y < y1; y++) {
+      for (int x = 0; x+1 < ws; x++) {
+
         float mag0 = fimMag.get(x,y);
         if (mag0 < Edge::minMag)
           continue;
-        mmax[y*width+x] = mag0;
-        mmin[y*width+x] = mag0;
-                                  
+        mmax[y*ws+x] = mag0;
+        mmin[y*ws+x] = mag0;
+
         float theta0 = fimTheta.get(x,y);
-        tmin[y*width+x] = theta0;
-        tmax[y*width+x] = theta0;
-                                  
-        // Calculates then adds edges to 'vector<Edge> edges'
-        Edge::calcEdges(theta0, x, y, fimTheta, fimMag, edges, nEdges);
-                                  
+        tmin[y*ws+x] = theta0;
+        tmax[y*ws+x] = theta0;
+
+        // Calculates then adds edges to this band's edges
+        Edge::calcEdges(theta0, x, y, fimTheta, fimMag, band, nEdges);
+
         // XXX Would 8 connectivity help for rotated tags?
         // Probably not much, so long as input filtering hasn't been disabled.
       }
     }
-                  
-    edges.resize(nEdges);
-    std::stable_sort(edges.begin(), edges.end());
-    Edge::mergeEdges(edges,uf,tmin,tmax,mmin,mmax);
+  });
+
+  // Costs are integers in [0, WEIGHT_SCALE], so a (stable) counting sort puts the edges in the
+  // same order as a std::stable_sort of all of them in row order would.
+  costOffsets.assign(Edge::WEIGHT_SCALE + 2, 0);
+  for (int b = 0; b < numBands; b++) {
+    for (size_t i = 0; i < bandNumEdges[b]; i++)
+      costOffsets[bandEdges[b][i].cost + 1]++;
   }
-          
+  for (int c = 0; c <= Edge::WEIGHT_SCALE; c++)
+    costOffsets[c+1] += costOffsets[c];
+
+  edges.resize(costOffsets[Edge::WEIGHT_SCALE + 1]);
+  for (int b = 0; b < numBands; b++) {
+    for (size_t i = 0; i < bandNumEdges[b]; i++) {
+      const Edge& e = bandEdges[b][i];
+      edges[costOffsets[e.cost]++] = e;
+    }
+  }
+
+  // NOTE: The merge is greedy (cheapest edge first), so it has to stay serial.
+  Edge::mergeEdges(edges,uf,tmin,tmax,mmin,mmax);
+
   //================================================================
   // Step four: Loop over the pixels again, collecting statistics for each cluster.
   // We will soon fit lines (segments) to these points.
 
-  map<int, vector<XYWeight> > clusters;
-  for (int y = 0; y+1 < fimSeg.getHeight(); y++) {
-    for (int x = 0; x+1 < fimSeg.getWidth(); x++) {
-      if (uf.getSetSize(y*fimSeg.getWidth()+x) < Segment::minimumSegmentSize)
+  // Clusters are numbered in order of their representative, which is the order that they came
+  // out of a std::map<int, ...> before.
+  clusterIndex.assign(ws*hs, -1);
+  for (int y = 0; y+1 < hs; y++) {
+    for (int x = 0; x+1 < ws; x++) {
+      if (uf.getSetSize(y*ws+x) >= Segment::minimumSegmentSize)
+        clusterIndex[uf.getRepresentative(y*ws+x)] = 0;
+    }
+  }
+
+  int numClusters = 0;
+  for (int rep = 0; rep < ws*hs; rep++) {
+    if (clusterIndex[rep] == 0)
+      clusterIndex[rep] = ++numClusters;
+  }
+
+  if ((int)clusters.size() < numClusters)
+    clusters.resize(numClusters);
+  for (int c = 0; c < numClusters; c++)
+    clusters[c].clear();
+
+  for (int y = 0; y+1 < hs; y++) {
+    for (int x = 0; x+1 < ws; x++) {
+      if (uf.getSetSize(y*ws+x) < Segment::minimumSegmentSize)
 	continue;
 
-      int rep = (int) uf.getRepresentative(y*fimSeg.getWidth()+x);
-     
-      map<int, vector<XYWeight> >::iterator it = clusters.find(rep);
-      if ( it == clusters.end() ) {
-	clusters[rep] = vector<XYWeight>();
-	it = clusters.find(rep);
-      }
-      vector<XYWeight> &points = it->second;
-      points.push_back(XYWeight(x,y,fimMag.get(x,y)));
+      int rep = (int) uf.getRepresentative(y*ws+x);
+      clusters[clusterIndex[rep] - 1].push_back(XYWeight(x,y,fimMag.get(x,y)));
     }
   }
 
   //================================================================
   // Step five: Loop over the clusters, fitting lines (which we call Segments).
-  std::vector<Segment> segments; //used in Step six
-  std::map<int, std::vector<XYWeight> >::const_iterator clustersItr;
-  for (clustersItr = clusters.begin(); clustersItr != clusters.end(); clustersItr++) {
-    std::vector<XYWeight> points = clustersItr->second;
-    GLineSegment2D gseg = GLineSegment2D::lsqFitXYW(points);
-
-    // filter short lines
-    float length = MathUtil::distance2D(gseg.getP0(), gseg.getP1());
-    if (length < Segment::minimumLineLength)
-      continue;
-
-    Segment seg;
-    float dy = gseg.getP1().second - gseg.getP0().second;
-    float dx = gseg.getP1().first - gseg.getP0().first;
-
-    float tmpTheta = std::atan2(dy,dx);
-
-    seg.setTheta(tmpTheta);
-    seg.setLength(length);
-
-    // We add an extra semantic to segments: the vector
-    // p1->p2 will have dark on the left, white on the right.
-    // To do this, we'll look at every gradient and each one
-    // will vote for which way they think the gradient should
-    // go. This is way more retentive than necessary: we
-    // could probably sample just one point!
-
-    float flip = 0, noflip = 0;
-    for (unsigned int i = 0; i < points.size(); i++) {
-      XYWeight xyw = points[i];
-      
-      float theta = fimTheta.get((int) xyw.x, (int) xyw.y);
-      float mag = fimMag.get((int) xyw.x, (int) xyw.y);
-
-      // err *should* be +M_PI/2 for the correct winding, but if we
-      // got the wrong winding, it'll be around -M_PI/2.
-      float err = MathUtil::mod2pi(theta - seg.getTheta());
-
-      if (err < 0)
-	noflip += mag;
-      else
-	flip += mag;
-    }
-
-    if (flip > noflip) {
-      float temp = seg.getTheta() + (float)M_PI;
-      seg.setTheta(temp);
-    }
+  // Each cluster is independent, so they're fit in parallel.
+  std::vector<Segment> fitted(numClusters);
+  std::vector<char> isLongEnough(numClusters, 0);
+
+  parallelChunks(numChunksFor(numClusters), [&](int k) {
+    const int numChunks = numChunksFor(numClusters);
+    for (int c = k * numClusters / numChunks; c < (k+1) * numClusters / numChunks; c++) {
+      const std::vector<XYWeight>& points = clusters[c];
+      GLineSegment2D gseg = GLineSegment2D::lsqFitXYW(points);
+
+      // filter short lines
+      float length = MathUtil::distance2D(gseg.getP0(), gseg.getP1());
+      if (length < Segment::minimumLineLength)
+        continue;
+
+      Segment& seg = fitted[c];
+      float dy = gseg.getP1().second - gseg.getP0().second;
+      float dx = gseg.getP1().first - gseg.getP0().first;
+
+      float tmpTheta = std::atan2(dy,dx);
+
+      seg.setTheta(tmpTheta);
+      seg.setLength(length);
+
+      // We add an extra semantic to segments: the vector
+      // p1->p2 will have dark on the left, white on the right.
+      // To do this, we'll look at every gradient and each one
+      // will vote for which way they think the gradient should
+      // go. This is way more retentive than necessary: we
+      // could probably sample just one point!
+
+      float flip = 0, noflip = 0;
+      for (unsigned int i = 0; i < points.size(); i++) {
+        const XYWeight& xyw = points[i];
+
+        float theta = fimTheta.get((int) xyw.x, (int) xyw.y);
+        float mag = fimMag.get((int) xyw.x, (int) xyw.y);
+
+        // err *should* be +M_PI/2 for the correct winding, but if we
+        // got the wrong winding, it'll be around -M_PI/2.
+        float err = MathUtil::mod2pi(theta - seg.getTheta());
+
+        if (err < 0)
+          noflip += mag;
+        else
+          flip += mag;
+      }
 
-    float dot = dx*std::cos(seg.getTheta()) + dy*std::sin(seg.getTheta());
-    if (dot > 0) {
-      seg.setX0(gseg.getP1().first); seg.setY0(gseg.getP1().second);
-      seg.setX1(gseg.getP0().first); seg.setY1(gseg.getP0().second);
-    }
-    else {
-      seg.setX0(gseg.getP0().first); seg.setY0(gseg.getP0().second);
-      seg.setX1(gseg.getP1().first); seg.setY1(gseg.getP1().second);
-    }
+      if (flip > noflip) {
+        float temp = seg.getTheta() + (float)M_PI;
+        seg.setTheta(temp);
+      }
 
-    segments.push_back(seg);
-  }
+      float dot = dx*std::cos(seg.getTheta()) + dy*std::sin(seg.getTheta());
+      if (dot > 0) {
+        seg.setX0(gseg.getP1().first); seg.setY0(gseg.getP1().second);
+        seg.setX1(gseg.getP0().first); seg.setY1(gseg.getP0().second);
+      }
+      else {
+        seg.setX0(gseg.getP0().first); seg.setY0(gseg.getP0().second);
+        seg.setX1(gseg.getP1().first); seg.setY1(gseg.getP1().second);
+      }
 
-#ifdef DEBUG_APRIL
-#if 0
-  {
-    for (vector<Segment>::iterator it = segments.begin(); it!=segments.end(); it++) {
-      long int r = random();
-      cv::line(image,
-               cv::Point2f(it->getX0(), it->getY0()),
-               cv::Point2f(it->getX1(), it->getY1()),
-               cv::Scalar(r%0xff,(r%0xff00)>>8,(r%0xff0000)>>16,0) );
+      isLongEnough[c] = 1;
     }
+  });
+
+  std::vector<Segment> segments; //used in Step six
+  segments.reserve(numClusters);
+  for (int c = 0; c < numClusters; c++) {
+    if (isLongEnough[c])
+      segments.push_back(fitted[c]);
   }
-#endif
-#endif
 
   // Step six: For each segment, find segments that begin where this segment ends.
   // (We will chain segments together next...) The gridder accelerates the search by
   // building (essentially) a 2D hash table.
-  Gridder<Segment> gridder(0,0,width,height,10);
+  Gridder<Segment> gridder(0,0,ws,hs,10);
   
   // add every segment to the hash table according to the position of the segment's
   // first point. Remember that the first point has a specific meaning due to our
@@ -348,192 +432,198 @@ namespace AprilTags {
     gridder.add(segments[i].getX0(), segments[i].getY0(), &segments[i]);
   }
   
-  // Now, find child segments that begin where each parent segment ends.
-  for (unsigned i = 0; i < segments.size(); i++) {
-    Segment &parentseg = segments[i];
-      
-    //compute length of the line segment
-    GLine2D parentLine(std::pair<float,float>(parentseg.getX0(), parentseg.getY0()),
-		       std::pair<float,float>(parentseg.getX1(), parentseg.getY1()));
-
-    Gridder<Segment>::iterator iter = gridder.find(parentseg.getX1(), parentseg.getY1(), 0.5f*parentseg.getLength());
-    while(iter.hasNext()) {
-      Segment &child = iter.next();
-      if (MathUtil::mod2pi(child.getTheta() - parentseg.getTheta()) > 0) {
-	continue;
-      }
+  // Now, find child segments that begin where each parent segment ends. The gridder is only read
+  // here, and each parent only changes its own children, so parents are done in parallel.
+  const int numSegments = (int)segments.size();
+  const int numSegmentChunks = numChunksFor(numSegments);
+  parallelChunks(numSegmentChunks, [&](int k) {
+    for (int i = k * numSegments / numSegmentChunks; i < (k+1) * numSegments / numSegmentChunks; i++) {
+      Segment &parentseg = segments[i];
+
+      //compute length of the line segment
+      GLine2D parentLine(std::pair<float,float>(parentseg.getX0(), parentseg.getY0()),
+                         std::pair<float,float>(parentseg.getX1(), parentseg.getY1()));
+
+      Gridder<Segment>::iterator iter = gridder.find(parentseg.getX1(), parentseg.getY1(), 0.5f*parentseg.getLength());
+      while(iter.hasNext()) {
+        Segment &child = iter.next();
+        if (MathUtil::mod2pi(child.getTheta() - parentseg.getTheta()) > 0) {
+          continue;
+        }
 
-      // compute intersection of points
-      GLine2D childLine(std::pair<float,float>(child.getX0(), child.getY0()),
-			std::pair<float,float>(child.getX1(), child.getY1()));
+        // compute intersection of points
+        GLine2D childLine(std::pair<float,float>(child.getX0(), child.getY0()),
+                          std::pair<float,float>(child.getX1(), child.getY1()));
 
-      std::pair<float,float> p = parentLine.intersectionWith(childLine);
-      if (p.first == -1) {
-	continue;
-      }
+        std::pair<float,float> p = parentLine.intersectionWith(childLine);
+        if (p.first == -1) {
+          continue;
+        }
 
-      float parentDist = MathUtil::distance2D(p, std::pair<float,float>(parentseg.getX1(),parentseg.getY1()));
-      float childDist = MathUtil::distance2D(p, std::pair<float,float>(child.getX0(),child.getY0()));
+        float parentDist = MathUtil::distance2D(p, std::pair<float,float>(parentseg.getX1(),parentseg.getY1()));
+        float childDist = MathUtil::distance2D(p, std::pair<float,float>(child.getX0(),child.getY0()));
 
-      if (max(parentDist,childDist) > parentseg.getLength()) {
-	// cout << "intersection too far" << endl;
-	continue;
-      }
+        if (max(parentDist,childDist) > parentseg.getLength()) {
+          // cout << "intersection too far" << endl;
+          continue;
+        }
 
-      // everything's OK, this child is a reasonable successor.
-      parentseg.children.push_back(&child);
+        // everything's OK, this child is a reasonable successor.
+        parentseg.children.push_back(&child);
+      }
     }
-  }
+  });
 
   //================================================================
   // Step seven: Search all connected segments to see if any form a loop of length 4.
-  // Add those to the quads list.
+  // Add those to the quads list. Each chunk of starting segments searches in parallel,
+  // and the quads are put back together in the order of their starting segment.
+  const std::pair<float,float> segCenter(ws/2, hs/2);
+  std::vector< std::vector<Quad> > chunkQuads(numSegmentChunks);
+  parallelChunks(numSegmentChunks, [&](int k) {
+    vector<Segment*> tmp(5);
+    for (int i = k * numSegments / numSegmentChunks; i < (k+1) * numSegments / numSegmentChunks; i++) {
+      tmp[0] = &segments[i];
+      Quad::search(fimSeg, tmp, segments[i], 0, chunkQuads[k], segCenter);
+    }
+  });
+
   vector<Quad> quads;
-  
-  vector<Segment*> tmp(5);
-  for (unsigned int i = 0; i < segments.size(); i++) {
-    tmp[0] = &segments[i];
-    Quad::search(fimOrig, tmp, segments[i], 0, quads, opticalCenter);
-  }
+  for (int k = 0; k < numSegmentChunks; k++)
+    quads.insert(quads.end(), chunkQuads[k].begin(), chunkQuads[k].end());
+
+  // Quads from a decimated image are scaled up, and their edges snapped to the full image.
+  if (d > 1) {
+    const int numQuads = (int)quads.size();
+    parallelChunks(numChunksFor(numQuads), [&](int k) {
+      const int numChunks = numChunksFor(numQuads);
+      for (int qi = k * numQuads / numChunks; qi < (k+1) * numQuads / numChunks; qi++) {
+        std::vector< std::pair<float,float> > p = quads[qi].quadPoints;
+        for (int i = 0; i < 4; i++) {
+          p[i].first = (p[i].first + 0.5f) * d - 0.5f;
+          p[i].second = (p[i].second + 0.5f) * d - 0.5f;
+        }
+        refineQuadEdges(fimOrig, (float)d, p);
 
-#ifdef DEBUG_APRIL
-  {
-    for (unsigned int qi = 0; qi < quads.size(); qi++ ) {
-      Quad &quad = quads[qi];
-      std::pair<float, float> p1 = quad.quadPoints[0];
-      std::pair<float, float> p2 = quad.quadPoints[1];
-      std::pair<float, float> p3 = quad.quadPoints[2];
-      std::pair<float, float> p4 = quad.quadPoints[3];
-      cv::line(image, cv::Point2f(p1.first, p1.second), cv::Point2f(p2.first, p2.second), cv::Scalar(0,0,255,0) );
-      cv::line(image, cv::Point2f(p2.first, p2.second), cv::Point2f(p3.first, p3.second), cv::Scalar(0,0,255,0) );
-      cv::line(image, cv::Point2f(p3.first, p3.second), cv::Point2f(p4.first, p4.second), cv::Scalar(0,0,255,0) );
-      cv::line(image, cv::Point2f(p4.first, p4.second), cv::Point2f(p1.first, p1.second), cv::Scalar(0,0,255,0) );
-
-      p1 = quad.interpolate(-1,-1);
-      p2 = quad.interpolate(-1,1);
-      p3 = quad.interpolate(1,1);
-      p4 = quad.interpolate(1,-1);
-      cv::circle(image, cv::Point2f(p1.first, p1.second), 3, cv::Scalar(0,255,0,0), 1);
-      cv::circle(image, cv::Point2f(p2.first, p2.second), 3, cv::Scalar(0,255,0,0), 1);
-      cv::circle(image, cv::Point2f(p3.first, p3.second), 3, cv::Scalar(0,255,0,0), 1);
-      cv::circle(image, cv::Point2f(p4.first, p4.second), 3, cv::Scalar(0,255,0,0), 1);
-    }
-    cv::imshow("debug_april", image);
+        Quad full(p, opticalCenter);
+        full.segments = quads[qi].segments;
+        full.observedPerimeter = quads[qi].observedPerimeter * d;
+        quads[qi] = full;
+      }
+    });
   }
-#endif
 
   //================================================================
   // Step eight. Decode the quads. For each quad, we first estimate a
   // threshold color to decide between 0 and 1. Then, we read off the
   // bits and see if they make sense.
 
-  std::vector<TagDetection> detections;
+  // Each quad is decoded independently, so they're done in parallel (and kept in order).
+  const int numQuads = (int)quads.size();
+  std::vector<TagDetection> decoded(numQuads);
+  std::vector<char> isDecoded(numQuads, 0);
 
-  for (unsigned int qi = 0; qi < quads.size(); qi++ ) {
-    Quad &quad = quads[qi];
-
-    // Find a threshold
-    GrayModel blackModel, whiteModel;
-    const int dd = 2 * thisTagFamily.blackBorder + thisTagFamily.dimension;
-
-    for (int iy = -1; iy <= dd; iy++) {
-      float y = (iy + 0.5f) / dd;
-      for (int ix = -1; ix <= dd; ix++) {
-	float x = (ix + 0.5f) / dd;
-	std::pair<float,float> pxy = quad.interpolate01(x, y);
-	int irx = (int) (pxy.first + 0.5);
-	int iry = (int) (pxy.second + 0.5);
-	if (irx < 0 || irx >= width || iry < 0 || iry >= height)
-	  continue;
-	float v = fim.get(irx, iry);
-	if (iy == -1 || iy == dd || ix == -1 || ix == dd)
-	  whiteModel.addObservation(x, y, v);
-	else if (iy == 0 || iy == (dd-1) || ix == 0 || ix == (dd-1))
-	  blackModel.addObservation(x, y, v);
-      }
-    }
+  parallelChunks(numChunksFor(numQuads), [&](int k) {
+    const int numChunks = numChunksFor(numQuads);
+    for (int qi = k * numQuads / numChunks; qi < (k+1) * numQuads / numChunks; qi++) {
+      Quad &quad = quads[qi];
 
-    bool bad = false;
-    unsigned long long tagCode = 0;
-    for ( int iy = thisTagFamily.dimension-1; iy >= 0; iy-- ) {
-      float y = (thisTagFamily.blackBorder + iy + 0.5f) / dd;
-      for (int ix = 0; ix < thisTagFamily.dimension; ix++ ) {
-	float x = (thisTagFamily.blackBorder + ix + 0.5f) / dd;
-	std::pair<float,float> pxy = quad.interpolate01(x, y);
-	int irx = (int) (pxy.first + 0.5);
-	int iry = (int) (pxy.second + 0.5);
-	if (irx < 0 || irx >= width || iry < 0 || iry >= height) {
-	  // cout << "*** bad:  irx=" << irx << "  iry=" << iry << endl;
-	  bad = true;
-	  continue;
-	}
-	float threshold = (blackModel.interpolate(x,y) + whiteModel.interpolate(x,y)) * 0.5f;
-	float v = fim.get(irx, iry);
-	tagCode = tagCode << 1;
-	if ( v > threshold)
-	  tagCode |= 1;
-#ifdef DEBUG_APRIL
-        {
-          if (v>threshold)
-            cv::circle(image, cv::Point2f(irx, iry), 1, cv::Scalar(0,0,255,0), 2);
-          else
-            cv::circle(image, cv::Point2f(irx, iry), 1, cv::Scalar(0,255,0,0), 2);
+      // Find a threshold
+      GrayModel blackModel, whiteModel;
+      const int dd = 2 * thisTagFamily.blackBorder + thisTagFamily.dimension;
+
+      for (int iy = -1; iy <= dd; iy++) {
+        float y = (iy + 0.5f) / dd;
+        for (int ix = -1; ix <= dd; ix++) {
+	  float x = (ix + 0.5f) / dd;
+	  std::pair<float,float> pxy = quad.interpolate01(x, y);
+	  int irx = (int) (pxy.first + 0.5);
+	  int iry = (int) (pxy.second + 0.5);
+	  if (irx < 0 || irx >= width || iry < 0 || iry >= height)
+	    continue;
+	  float v = fimOrig.get(irx, iry);
+	  if (iy == -1 || iy == dd || ix == -1 || ix == dd)
+	    whiteModel.addObservation(x, y, v);
+	  else if (iy == 0 || iy == (dd-1) || ix == 0 || ix == (dd-1))
+	    blackModel.addObservation(x, y, v);
         }
-#endif
       }
-    }
 
-    if ( !bad ) {
-      TagDetection thisTagDetection;
-      thisTagFamily.decode(thisTagDetection, tagCode);
-
-      // compute the homography (and rotate it appropriately)
-      thisTagDetection.homography = quad.homography.getH();
-      thisTagDetection.hxy = quad.homography.getCXY();
-
-      float c = std::cos(thisTagDetection.rotation*(float)M_PI/2);
-      float s = std::sin(thisTagDetection.rotation*(float)M_PI/2);
-      Eigen::Matrix3d R;
-      R.setZero();
-      R(0,0) = R(1,1) = c;
-      R(0,1) = -s;
-      R(1,0) = s;
-      R(2,2) = 1;
-      Eigen::Matrix3d tmp;
-      tmp = thisTagDetection.homography * R;
-      thisTagDetection.homography = tmp;
-
-      // Rotate points in detection according to decoded
-      // orientation.  Thus the order of the points in the
-      // detection object can be used to determine the
-      // orientation of the target.
-      std::pair<float,float> bottomLeft = thisTagDetection.interpolate(-1,-1);
-      int bestRot = -1;
-      float bestDist = FLT_MAX;
-      for ( int i=0; i<4; i++ ) {
-	float const dist = AprilTags::MathUtil::distance2D(bottomLeft, quad.quadPoints[i]);
-	if ( dist < bestDist ) {
-	  bestDist = dist;
-	  bestRot = i;
-	}
+      bool bad = false;
+      unsigned long long tagCode = 0;
+      for ( int iy = thisTagFamily.dimension-1; iy >= 0; iy-- ) {
+        float y = (thisTagFamily.blackBorder + iy + 0.5f) / dd;
+        for (int ix = 0; ix < thisTagFamily.dimension; ix++ ) {
+	  float x = (thisTagFamily.blackBorder + ix + 0.5f) / dd;
+	  std::pair<float,float> pxy = quad.interpolate01(x, y);
+	  int irx = (int) (pxy.first + 0.5);
+	  int iry = (int) (pxy.second + 0.5);
+	  if (irx < 0 || irx >= width || iry < 0 || iry >= height) {
+	    // cout << "*** bad:  irx=" << irx << "  iry=" << iry << endl;
+	    bad = true;
+	    continue;
+	  }
+	  float threshold = (blackModel.interpolate(x,y) + whiteModel.interpolate(x,y)) * 0.5f;
+	  float v = fimOrig.get(irx, iry);
+	  tagCode = tagCode << 1;
+	  if ( v > threshold)
+	    tagCode |= 1;
+        }
       }
 
-      for (int i=0; i< 4; i++)
-	thisTagDetection.p[i] = quad.quadPoints[(i+bestRot) % 4];
+      if ( !bad ) {
+        TagDetection thisTagDetection;
+        thisTagFamily.decode(thisTagDetection, tagCode);
+
+        // compute the homography (and rotate it appropriately)
+        thisTagDetection.homography = quad.homography.getH();
+        thisTagDetection.hxy = quad.homography.getCXY();
+
+        float c = std::cos(thisTagDetection.rotation*(float)M_PI/2);
+        float s = std::sin(thisTagDetection.rotation*(float)M_PI/2);
+        Eigen::Matrix3d R;
+        R.setZero();
+        R(0,0) = R(1,1) = c;
+        R(0,1) = -s;
+        R(1,0) = s;
+        R(2,2) = 1;
+        Eigen::Matrix3d tmp;
+        tmp = thisTagDetection.homography * R;
+        thisTagDetection.homography = tmp;
+
+        // Rotate points in detection according to decoded
+        // orientation.  Thus the order of the points in the
+        // detection object can be used to determine the
+        // orientation of the target.
+        std::pair<float,float> bottomLeft = thisTagDetection.interpolate(-1,-1);
+        int bestRot = -1;
+        float bestDist = FLT_MAX;
+        for ( int i=0; i<4; i++ ) {
+	  float const dist = AprilTags::MathUtil::distance2D(bottomLeft, quad.quadPoints[i]);
+	  if ( dist < bestDist ) {
+	    bestDist = dist;
+	    bestRot = i;
+	  }
+        }
+
+        for (int i=0; i< 4; i++)
+	  thisTagDetection.p[i] = quad.quadPoints[(i+bestRot) % 4];
 
-      if (thisTagDetection.good) {
-	thisTagDetection.cxy = quad.interpolate01(0.5f, 0.5f);
-	thisTagDetection.observedPerimeter = quad.observedPerimeter;
-	detections.push_back(thisTagDetection);
+        if (thisTagDetection.good) {
+	  thisTagDetection.cxy = quad.interpolate01(0.5f, 0.5f);
+	  thisTagDetection.observedPerimeter = quad.observedPerimeter;
+	  decoded[qi] = thisTagDetection;
+	  isDecoded[qi] = 1;
+        }
       }
     }
-  }
+  });
 
-#ifdef DEBUG_APRIL
-  {
-    cv::imshow("debug_april", image);
+  std::vector<TagDetection> detections;
+  for (int qi = 0; qi < numQuads; qi++) {
+    if (isDecoded[qi])
+      detections.push_back(decoded[qi]);
   }
-#endif
 
   //================================================================
   //Step nine: Some quads may be detected more than once, due to
@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "params/params_base.hpp"
+#include "core/path_util.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "core/timestamp.hpp"
+#include "lcm_util/decode_image.hpp"
+#include "lcm_util/image_subscriber.hpp"
+#include "lcm_util/keyframe_link.hpp"
+
+#include "vehicle/pose3_stamped_t.hpp"
+#include "vehicle/dense_keyframe_t.hpp"
+#include "vehicle/dense_keyframe_ack_t.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static const double kWaitForShutdownSec = 0.5;
+
+// Keyframes waiting to be compressed. Keyposes are at most a few Hz, so this only fills up if the
+// encoder really can't keep up, and then the oldest ones are dropped.
+static const size_t kMaxSizeEncodeQueue = 4;
+
+// Smoother poses are stamped with the image timestamp converted to seconds and back, so they can be
+// off from it by a little rounding.
+static const double kMaxPoseImageOffsetSec = 1e-3;
+
+
+// Ships keyframes (a compressed stereo pair, and the smoother pose for it) to dense mapping workers
+// (see dense_mapping_worker_lcm), so that dense stereo and meshing run on other computers instead of
+// next to the StateEstimator. Every vision keypose on channel_input_smoother_pose is paired with
+// the stereo pair that has its timestamp. Workers are found from their acks and heartbeats, and each
+// one gets its keyframes on channel_output_keyframes + "/" + its name. See KeyframeSender for the
+// flow control: keyframes are dropped instead of queued up when every worker is busy.
+class DenseKeyframeSenderLcm final {
+ public:
+  struct Params : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    std::string channel_input_stereo;
+    std::string channel_input_smoother_pose;
+    std::string channel_input_acks;
+    std::string channel_output_keyframes;
+
+    bool expect_shm_images = true;
+    int decode_scale = 1;             // Decode (and send) images at 1/decode_scale of their size.
+    int jpeg_quality = 90;
+    int max_buffered_images = 30;     // Images kept while waiting for the smoother to get to them.
+
+    // Keyframes taken in the same cell (of this size, in the world frame) go to the same worker while
+    // it has room, so that each worker maps its own area. Zero spreads them over all workers.
+    double affinity_cell_size = 10.0;
+
+    KeyframeLinkParams link_params;
+
+   private:
+    void LoadParams(const YamlParser& parser) override
+    {
+      channel_input_stereo = YamlToString(parser.GetNode("channel_input_stereo"));
+      channel_input_smoother_pose = YamlToString(parser.GetNode("channel_input_smoother_pose"));
+      channel_input_acks = YamlToString(parser.GetNode("channel_input_acks"));
+      channel_output_keyframes = YamlToString(parser.GetNode("channel_output_keyframes"));
+      parser.GetParam("expect_shm_images", &expect_shm_images);
+      parser.GetParam("decode_scale", &decode_scale);
+      parser.GetParam("jpeg_quality", &jpeg_quality);
+      parser.GetParam("max_buffered_images", &max_buffered_images);
+      parser.GetParam("affinity_cell_size", &affinity_cell_size);
+      CHECK_GT(max_buffered_images, 0);
+      CHECK_GE(affinity_cell_size, 0);
+      link_params = KeyframeLinkParams(parser.Subtree("KeyframeLink"));
+    }
+  };
+
+  // A keyframe that was paired with its images, waiting to be compressed.
+  struct Keyframe final
+  {
+    StereoImage1b stereo_pair{0, 0, Image1b(), Image1b()};
+    vehicle::pose3_t world_P_body;
+  };
+
+  // A compressed keyframe, kept by the sender until it's acked.
+  struct EncodedKeyframe final
+  {
+    timestamp_t timestamp = 0;
+    uid_t camera_id = 0;
+    vehicle::pose3_t world_P_body;
+    vehicle::image_t img_left;
+    vehicle::image_t img_right;
+  };
+
+  typedef KeyframeSender<EncodedKeyframe> Sender;
+
+  DenseKeyframeSenderLcm(const Params& params)
+      : params_(params),
+        sender_(params.link_params),
+        encode_queue_(kMaxSizeEncodeQueue, true, "keyframe_encode_queue"),
+        sub_(lcm_, params_.channel_input_stereo, params_.expect_shm_images, true)
+  {
+    if (!lcm_.good()) {
+      LOG(WARNING) << "Failed to initialize LCM" << std::endl;
+      return;
+    }
+
+    sub_.SetDecodeScale(params_.decode_scale);
+    sub_.RegisterCallback(std::bind(&DenseKeyframeSenderLcm::HandleStereo, this, std::placeholders::_1));
+    lcm_.subscribe(params_.channel_input_smoother_pose.c_str(), &DenseKeyframeSenderLcm::HandleSmootherPose, this);
+    lcm_.subscribe(params_.channel_input_acks.c_str(), &DenseKeyframeSenderLcm::HandleAck, this);
+
+    send_thread_ = std::thread(&DenseKeyframeSenderLcm::SendLoop, this);
+
+    LOG(INFO) << "Pairing images from " << params_.channel_input_stereo << " with keyposes from "
+              << params_.channel_input_smoother_pose << std::endl;
+    LOG(INFO) << "Will send keyframes on " << params_.channel_output_keyframes << "/<worker>" << std::endl;
+  }
+
+  ~DenseKeyframeSenderLcm()
+  {
+    is_shutdown_.store(true);
+    if (send_thread_.joinable()) {
+      send_thread_.join();
+    }
+  }
+
+  void Spin()
+  {
+    while (0 == lcm_.handle() && !is_shutdown_);
+  }
+
+  // Called on the subscriber's decode thread.
+  void HandleStereo(const StereoImage1b& stereo_pair)
+  {
+    std::lock_guard<std::mutex> lock(images_lock_);
+    images_.emplace_back(stereo_pair);
+    if ((int)images_.size() > params_.max_buffered_images) {
+      images_.pop_front();
+    }
+  }
+
+  // Keyposes that aren't from vision (or whose images were already dropped) have no images, and are
+  // skipped. Images older than a keypose will never be keyframes, so they're dropped.
+  void HandleSmootherPose(const lcm::ReceiveBuffer*,
+                          const std::string&,
+                          const vehicle::pose3_stamped_t* msg)
+  {
+    const double t_pose = ConvertToSeconds(static_cast<timestamp_t>(msg->header.timestamp));
+
+    Keyframe kf;
+    {
+      std::lock_guard<std::mutex> lock(images_lock_);
+      while (!images_.empty() && ConvertToSeconds(images_.front().timestamp) < (t_pose - kMaxPoseImageOffsetSec)) {
+        images_.pop_front();
+      }
+      if (images_.empty() || std::fabs(ConvertToSeconds(images_.front().timestamp) - t_pose) > kMaxPoseImageOffsetSec) {
+        return;
+      }
+      kf.stereo_pair = std::move(images_.front());
+      images_.pop_front();
+    }
+
+    kf.world_P_body = msg->pose;
+    encode_queue_.Push(std::move(kf));
+  }
+
+  void HandleAck(const lcm::ReceiveBuffer*,
+                 const std::string&,
+                 const vehicle::dense_keyframe_ack_t* msg)
+  {
+    sender_.HandleAck(msg->worker, msg->seq, msg->credits, NowSec());
+  }
+
+  void SendLoop()
+  {
+    // NOTE(milo): Wake up often enough to resend on time, even if no keyframes are coming in.
+    const double wait_sec = std::min(kWaitForShutdownSec, 0.25 * params_.link_params.retransmit_sec);
+    std::vector<Sender::Outgoing> resend;
+
+    while (!is_shutdown_) {
+      Keyframe kf;
+      if (encode_queue_.PopBlocking(kf, wait_sec)) {
+        Send(kf);
+      }
+
+      sender_.Retransmits(NowSec(), resend);
+      for (const Sender::Outgoing& out : resend) {
+        Publish(out);
+      }
+    }
+
+    LOG(INFO) << "Sent " << sender_.NumSent() << " keyframes (" << sender_.NumAcked() << " acked, "
+              << sender_.NumRetransmits() << " resends, " << sender_.NumLost() << " lost), and dropped "
+              << sender_.NumDropped() << " because every worker was busy" << std::endl;
+  }
+
+  void Send(const Keyframe& kf)
+  {
+    std::shared_ptr<EncodedKeyframe> encoded = std::make_shared<EncodedKeyframe>();
+    encoded->timestamp = kf.stereo_pair.timestamp;
+    encoded->camera_id = kf.stereo_pair.camera_id;
+    encoded->world_P_body = kf.world_P_body;
+    EncodeJPG(kf.stereo_pair.left_image, params_.jpeg_quality, encoded->img_left);
+    EncodeJPG(kf.stereo_pair.right_image, params_.jpeg_quality, encoded->img_right);
+
+    Sender::Outgoing out;
+    if (!sender_.Send(Affinity(kf.world_P_body), encoded, NowSec(), out)) {
+      LOG_EVERY_N(WARNING, 10) << "No dense mapping worker has room, dropped " << sender_.NumDropped()
+                               << " keyframes so far" << std::endl;
+      return;
+    }
+    Publish(out);
+  }
+
+  // NOTE(milo): LCM's publish() is threadsafe, so this doesn't need to run on the LCM thread.
+  void Publish(const Sender::Outgoing& out)
+  {
+    const EncodedKeyframe& kf = *out.item;
+    vehicle::dense_keyframe_t msg;
+    msg.header.timestamp = kf.timestamp;
+    msg.header.seq = kf.camera_id;
+    msg.header.frame_id = "body";
+    msg.seq = out.seq;
+    msg.worker = out.worker;
+    msg.world_P_body = kf.world_P_body;
+    msg.img_left = kf.img_left;
+    msg.img_right = kf.img_right;
+    lcm_.publish(params_.channel_output_keyframes + "/" + out.worker, &msg);
+  }
+
+ private:
+  size_t Affinity(const vehicle::pose3_t& world_P_body) const
+  {
+    if (params_.affinity_cell_size <= 0) {
+      return 0;
+    }
+
+    // NOTE(milo): Same hash as MeshMap::Vector3iHash.
+    const double s = params_.affinity_cell_size;
+    return static_cast<size_t>(std::floor(world_P_body.position.x / s)) * 73856093 ^
+           static_cast<size_t>(std::floor(world_P_body.position.y / s)) * 19349669 ^
+           static_cast<size_t>(std::floor(world_P_body.position.z / s)) * 83492791;
+  }
+
+  static double NowSec()
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+ private:
+  std::atomic_bool is_shutdown_{false};
+  Params params_;
+  Sender sender_;
+
+  // NOTE(milo): Declared before sub_, since its decode thread pushes to them until it's destroyed.
+  std::mutex images_lock_;
+  std::deque<StereoImage1b> images_;
+  ThreadsafeQueue<Keyframe> encode_queue_;
+
+  lcm::LCM lcm_;
+  ImageSubscriber sub_;
+  std::thread send_thread_;
+};
+
+
+int main(int argc, char const *argv[])
+{
+  // Set up glog.
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  CHECK_EQ(3ul, argc)
+      << "Requires (2) args: node_params_path and shared_params_path."
+      << "They should be relative to vehicle/config" << std::endl;
+
+  const std::string node_params_path = std::string(argv[1]);
+  const std::string shared_params_path = std::string(argv[2]);
+
+  DenseKeyframeSenderLcm::Params params(
+    config_path(node_params_path),
+    config_path(shared_params_path));
+
+  DenseKeyframeSenderLcm node(params);
+  node.Spin();
+
+  LOG(INFO) << "DONE" << std::endl;
+
+  return 0;
+}
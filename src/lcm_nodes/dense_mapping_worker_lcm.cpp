@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "params/params_base.hpp"
+#include "core/path_util.hpp"
+#include "core/se3.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "core/timestamp.hpp"
+#include "lcm_util/decode_image.hpp"
+#include "lcm_util/keyframe_link.hpp"
+#include "lcm_util/util_mesh_delta_t.hpp"
+#include "mesher/mesh_codec.hpp"
+#include "mesher/mesh_map.hpp"
+#include "patchmatch_gpu/patchmatch_gpu.h"
+#include "patchmatch_gpu/disparity_mesher_gpu.h"
+
+#include "vehicle/dense_keyframe_t.hpp"
+#include "vehicle/dense_keyframe_ack_t.hpp"
+#include "vehicle/mesh_delta_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+static const double kWaitForShutdownSec = 0.5;
+
+// Remembers this many keyframe seqs, to ignore resends of ones that are already queued or mapped.
+static const size_t kReceiverHistorySize = 256;
+
+
+// Runs the dense mapping stack (PatchmatchGpu, DisparityMesherGpu, and a MeshMap) on keyframes from a
+// dense_keyframe_sender_lcm, so that it can run on another computer (onboard or topside) than the
+// StateEstimator. More workers can be started with different worker_names to split up the work.
+//
+// Keyframes arrive on channel_input_keyframes + "/" + worker_name. Each one is acked on
+// channel_output_acks once it's queued, along with how many more fit (credits). While idle, the
+// worker sends heartbeats so that the sender knows that it's there. After each keyframe is fused
+// into the map, the changes to the whole map are published as a mesh_delta_t on
+// channel_output_mesh_delta + "/" + worker_name (in the world frame).
+class DenseMappingWorkerLcm final {
+ public:
+  struct Params : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    std::string worker_name;
+    std::string channel_input_keyframes;
+    std::string channel_output_acks;
+    std::string channel_output_mesh_delta;
+
+    int max_queue_size = 4;           // Keyframes waiting to be mapped (the credits in each ack).
+    double heartbeat_sec = 1.0;       // Send a heartbeat this often, so the sender knows we're alive.
+
+    std::string mesh_map_ply_path;    // Write the map here on shutdown (empty = don't).
+
+    StereoCamera stereo_rig;
+    Matrix4d body_T_cam_left = Matrix4d::Identity();
+    Matrix4d body_T_cam_right = Matrix4d::Identity();
+
+    pm::PatchmatchGpu::Params patchmatch_params;
+    pm::DisparityMesherGpu::Params disparity_mesher_params;
+    MeshMap::Params mesh_map_params;
+    MeshEncoder::Params encoder_params;
+
+   private:
+    void LoadParams(const YamlParser& parser) override
+    {
+      worker_name = YamlToString(parser.GetNode("worker_name"));
+      channel_input_keyframes = YamlToString(parser.GetNode("channel_input_keyframes"));
+      channel_output_acks = YamlToString(parser.GetNode("channel_output_acks"));
+      channel_output_mesh_delta = YamlToString(parser.GetNode("channel_output_mesh_delta"));
+      parser.GetParam("max_queue_size", &max_queue_size);
+      parser.GetParam("heartbeat_sec", &heartbeat_sec);
+      mesh_map_ply_path = YamlToString(parser.GetNode("mesh_map_ply_path"));
+      CHECK(!worker_name.empty());
+      CHECK_GT(max_queue_size, 0);
+      CHECK_GT(heartbeat_sec, 0);
+      YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_cam_left, body_T_cam_right);
+      patchmatch_params = pm::PatchmatchGpu::Params(parser.Subtree("PatchmatchGpu"));
+      disparity_mesher_params = pm::DisparityMesherGpu::Params(parser.Subtree("DisparityMesherGpu"));
+      mesh_map_params = MeshMap::Params(parser.Subtree("MeshMap"));
+      encoder_params = MeshEncoder::Params(parser.Subtree("MeshEncoder"));
+    }
+  };
+
+  DenseMappingWorkerLcm(const Params& params)
+      : params_(params),
+        receiver_(kReceiverHistorySize),
+        keyframe_queue_(params.max_queue_size, false, "dense_keyframe_queue"),
+        patchmatch_(params.patchmatch_params, params.stereo_rig),
+        disparity_mesher_(params.disparity_mesher_params, params.stereo_rig),
+        mesh_map_(params.mesh_map_params),
+        encoder_(params.encoder_params)
+  {
+    if (!lcm_.good()) {
+      LOG(WARNING) << "Failed to initialize LCM" << std::endl;
+      return;
+    }
+
+    const std::string channel_keyframes = params_.channel_input_keyframes + "/" + params_.worker_name;
+    lcm_.subscribe(channel_keyframes.c_str(), &DenseMappingWorkerLcm::HandleKeyframe, this);
+
+    mapping_thread_ = std::thread(&DenseMappingWorkerLcm::MappingLoop, this);
+
+    LOG(INFO) << "Worker " << params_.worker_name << " listening for keyframes on " << channel_keyframes << std::endl;
+    LOG(INFO) << "Will publish mesh deltas on: " << params_.channel_output_mesh_delta << "/" << params_.worker_name << std::endl;
+  }
+
+  ~DenseMappingWorkerLcm()
+  {
+    is_shutdown_.store(true);
+    if (mapping_thread_.joinable()) {
+      mapping_thread_.join();
+    }
+    if (!params_.mesh_map_ply_path.empty() && mesh_map_.WritePly(params_.mesh_map_ply_path)) {
+      LOG(INFO) << "Wrote mesh map with " << mesh_map_.NumVertices() << " vertices and "
+                << mesh_map_.NumTriangles() << " triangles to " << params_.mesh_map_ply_path << std::endl;
+    }
+  }
+
+  void Spin()
+  {
+    while (0 == lcm_.handle() && !is_shutdown_);
+  }
+
+  // Called from Spin(). Resends of a queued keyframe are acked again (the first ack was probably
+  // lost), and keyframes that don't fit aren't acked at all, so that they're sent again later.
+  void HandleKeyframe(const lcm::ReceiveBuffer*,
+                      const std::string&,
+                      const vehicle::dense_keyframe_t* msg)
+  {
+    if (msg->worker != params_.worker_name) {
+      return;
+    }
+
+    if ((int)keyframe_queue_.Size() >= params_.max_queue_size && !receiver_.Seen(msg->seq)) {
+      PublishAck(-1);
+      return;
+    }
+
+    if (receiver_.Accept(msg->seq)) {
+      keyframe_queue_.Push(*msg);
+    }
+    PublishAck(msg->seq);
+  }
+
+  void MappingLoop()
+  {
+    const double wait_sec = std::min(kWaitForShutdownSec, params_.heartbeat_sec);
+    auto last_heartbeat = std::chrono::steady_clock::now();
+
+    while (!is_shutdown_) {
+      vehicle::dense_keyframe_t kf;
+      if (keyframe_queue_.PopBlocking(kf, wait_sec)) {
+        MapKeyframe(kf);
+        PublishAck(-1);   // There's room for one more now.
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+      if (std::chrono::duration<double>(now - last_heartbeat).count() >= params_.heartbeat_sec) {
+        last_heartbeat = now;
+        PublishAck(-1);
+      }
+    }
+  }
+
+  void MapKeyframe(const vehicle::dense_keyframe_t& kf)
+  {
+    cv::Mat left, right;
+    DecodeJPG(kf.img_left, left);
+    DecodeJPG(kf.img_right, right);
+
+    // NOTE(milo): Both of these rescale the stereo rig to the images, so the sender can downsize them.
+    Image1f disp, dispr;
+    patchmatch_.Match(Image1b(left), Image1b(right), disp, dispr);
+
+    TriangleMesh mesh;
+    disparity_mesher_.Triangulate(disp, Image1b(), mesh);
+
+    const Quaterniond q(kf.world_P_body.orientation.w, kf.world_P_body.orientation.x,
+                        kf.world_P_body.orientation.y, kf.world_P_body.orientation.z);
+    const Vector3d t(kf.world_P_body.position.x, kf.world_P_body.position.y, kf.world_P_body.position.z);
+    const SE3 world_T_cam = SE3(q.normalized(), t) * SE3(params_.body_T_cam_left);
+    mesh_map_.Integrate(mesh, world_T_cam);
+
+    vehicle::mesh_delta_t delta_out;
+    delta_out.header.timestamp = kf.header.timestamp;
+    delta_out.header.seq = kf.header.seq;
+    delta_out.header.frame_id = "world";
+    pack_mesh_delta_t(encoder_.Encode(mesh_map_.GetMesh(true)), delta_out);
+    lcm_.publish(params_.channel_output_mesh_delta + "/" + params_.worker_name, &delta_out);
+
+    LOG_EVERY_N(INFO, 10) << "Mapped keyframe " << kf.seq << ", the map has " << mesh_map_.NumVertices()
+                          << " vertices and " << mesh_map_.NumTriangles() << " triangles" << std::endl;
+  }
+
+  // NOTE(milo): LCM's publish() is threadsafe, so acks can go out from either thread.
+  void PublishAck(int32_t seq)
+  {
+    vehicle::dense_keyframe_ack_t ack;
+    ack.header.timestamp = 0;
+    ack.header.seq = seq;
+    ack.header.frame_id = "";
+    ack.worker = params_.worker_name;
+    ack.seq = seq;
+    ack.credits = std::max(0, params_.max_queue_size - (int)keyframe_queue_.Size());
+    lcm_.publish(params_.channel_output_acks, &ack);
+  }
+
+ private:
+  std::atomic_bool is_shutdown_{false};
+  Params params_;
+
+  KeyframeReceiver receiver_;   // Only used on the LCM thread.
+  ThreadsafeQueue<vehicle::dense_keyframe_t> keyframe_queue_;
+
+  // Only used on the mapping thread.
+  pm::PatchmatchGpu patchmatch_;
+  pm::DisparityMesherGpu disparity_mesher_;
+  MeshMap mesh_map_;
+  MeshEncoder encoder_;
+
+  lcm::LCM lcm_;
+  std::thread mapping_thread_;
+};
+
+
+int main(int argc, char const *argv[])
+{
+  // Set up glog.
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  CHECK_EQ(3ul, argc)
+      << "Requires (2) args: node_params_path and shared_params_path."
+      << "They should be relative to vehicle/config" << std::endl;
+
+  const std::string node_params_path = std::string(argv[1]);
+  const std::string shared_params_path = std::string(argv[2]);
+
+  DenseMappingWorkerLcm::Params params(
+    config_path(node_params_path),
+    config_path(shared_params_path));
+
+  DenseMappingWorkerLcm node(params);
+  node.Spin();
+
+  LOG(INFO) << "DONE" << std::endl;
+
+  return 0;
+}
@@ -1,3 +1,10 @@
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include <glog/logging.h>
 
 #include <lcm/lcm-cpp.hpp>
@@ -5,21 +12,57 @@
 #include <opencv2/imgproc.hpp>
 
 #include "vision_core/image_util.hpp"
+#include "vision_core/debug_viewer.hpp"
+#include "vision_core/stereo_rectifier.hpp"
 #include "params/params_base.hpp"
 #include "core/path_util.hpp"
+#include "core/se3.hpp"
+#include "core/pose_history.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "core/timestamp.hpp"
 #include "lcm_util/decode_image.hpp"
 #include "lcm_util/util_mesh_t.hpp"
+#include "lcm_util/util_mesh_delta_t.hpp"
+#include "lcm_util/util_feature_tracks_t.hpp"
+#include "lcm_util/mmf_mesh.hpp"
 #include "lcm_util/image_subscriber.hpp"
+#include "lcm_util/debug_image_publisher.hpp"
 #include "mesher/object_mesher.hpp"
+#include "mesher/mesh_codec.hpp"
+#include "mesher/distance_map.hpp"
+#include "mesher/mesh_map.hpp"
+#include "mesher/mesh_decimation.hpp"
 
 #include "vehicle/stereo_image_t.hpp"
 #include "vehicle/mesh_stamped_t.hpp"
+#include "vehicle/mmf_mesh_stamped_t.hpp"
+#include "vehicle/mesh_delta_t.hpp"
+#include "vehicle/pose3_stamped_t.hpp"
+#include "vehicle/feature_tracks_t.hpp"
 
 using namespace bm;
 using namespace core;
 using namespace mesher;
 
 
+static const double kWaitForShutdownSec = 0.5;
+
+// Frames waiting for the mesher. Only the newest one is kept, so that a slow frame makes the mesher
+// skip ahead instead of falling further and further behind the camera.
+static const size_t kMaxSizeMesherMailbox = 1;
+
+// Meshes waiting to be published.
+static const size_t kMaxSizePublishQueue = 2;
+
+// With use_feature_tracks, images and tracks that are still waiting for their other half. They can
+// arrive in either order, but should only be a frame or two apart. The images hold buffers from the
+// subscriber's ImagePool, so keep this small.
+static const size_t kMaxUnpaired = 4;
+
+// Smoother keyposes kept for looking up the pose of each mesh (a few minutes' worth).
+static const size_t kPoseHistorySize = 1000;
+
+
 class ObjectMesherLcm final {
  public:
   struct Params : public ParamsBase
@@ -29,10 +72,69 @@ class ObjectMesherLcm final {
     std::string channel_input_stereo;
     std::string channel_output_mesh;
     bool visualize = true;
+
+    // Debug images (e.g feature tracks) are drawn on a DebugViewer thread. They can be shown in
+    // windows, and/or published as JPGs on channel_output_debug_images + "/" + the window name.
+    bool show_debug_windows = true;
+    bool publish_debug_images = false;
+    std::string channel_output_debug_images;
+    double debug_image_hz = 2.0;
+    int debug_image_jpeg_quality = 70;
+
+    // Publish meshes through a ring of memory-mapped slots, with only the metadata going over LCM
+    // (on channel_output_mmf_mesh). Meshes that don't fit in a slot go out on channel_output_mesh.
+    bool publish_mmf_mesh = false;
+    std::string channel_output_mmf_mesh;
+    std::string mmf_mesh_filename;
+    int mmf_mesh_slots = 4;
+    float mmf_mesh_slot_mb = 8.0;
+    bool mmf_float_vertices = false;   // Write float32 vertices (half the size) instead of doubles.
+
+    // Decimate every published mesh (on every channel) to at most this many triangles, with
+    // mesher::DecimateMesh(). The maps below still get the full mesh. Zero doesn't decimate.
+    int max_published_triangles = 0;
+
+    // Also publish each mesh as a compact delta against the previous one (on channel_output_mesh_delta),
+    // for forwarding over low-bandwidth links like the tether.
+    bool publish_mesh_delta = false;
+    std::string channel_output_mesh_delta;
+
+    // Fuse each mesh into a DistanceMap in the world frame, using the smoother pose (from
+    // channel_input_smoother_pose) interpolated at the mesh timestamp, or the newest one if the mesh
+    // is newer. Meshes are skipped if the nearest smoother pose is more than max_pose_age_sec away.
+    bool integrate_distance_map = false;
+    std::string channel_input_smoother_pose;
+    double max_pose_age_sec = 0.5;
+
+    // Also merge each mesh into a persistent MeshMap (with the same poses), and write it to
+    // mesh_map_ply_path on shutdown, and every mesh_map_export_every_sec if that's positive.
+    bool integrate_mesh_map = false;
+    std::string mesh_map_ply_path;
+    double mesh_map_export_every_sec = 0;
+
     bool expect_shm_images = true;
     int mesher_input_height = 480;    // Downsample images to have this height.
 
+    // Decode images at 1/decode_scale (1, 2, 4 or 8) of their size, which is much cheaper than
+    // decoding them at full size for the resize above. Can't be used with rectify_images.
+    int decode_scale = 1;
+
+    // Rectify raw images from the camera (calibrated in /shared/stereo_forward_raw) to match
+    // /shared/stereo_forward, right after they're decoded. Leave this off if the images on
+    // channel_input_stereo are already rectified.
+    bool rectify_images = false;
+    RawStereoCalibration raw_stereo_rig;
+
+    // Mesh the landmarks that the StateEstimator tracked (from channel_input_feature_tracks)
+    // instead of running a second tracker on the same images. Images are still needed for the
+    // foreground mask, and are only meshed once their tracks arrive.
+    bool use_feature_tracks = false;
+    std::string channel_input_feature_tracks;
+
     ObjectMesher::Params mesher_params;
+    MeshEncoder::Params encoder_params;
+    DistanceMap::Params distance_map_params;
+    MeshMap::Params mesh_map_params;
 
    private:
     void LoadParams(const YamlParser& parser) override
@@ -40,36 +142,283 @@ class ObjectMesherLcm final {
       channel_input_stereo = YamlToString(parser.GetNode("channel_input_stereo"));
       channel_output_mesh = YamlToString(parser.GetNode("channel_output_mesh"));
       parser.GetParam("visualize", &visualize);
+      parser.GetParam("show_debug_windows", &show_debug_windows);
+      parser.GetParam("publish_debug_images", &publish_debug_images);
+      channel_output_debug_images = YamlToString(parser.GetNode("channel_output_debug_images"));
+      parser.GetParam("debug_image_hz", &debug_image_hz);
+      parser.GetParam("debug_image_jpeg_quality", &debug_image_jpeg_quality);
+      parser.GetParam("publish_mmf_mesh", &publish_mmf_mesh);
+      channel_output_mmf_mesh = YamlToString(parser.GetNode("channel_output_mmf_mesh"));
+      mmf_mesh_filename = YamlToString(parser.GetNode("mmf_mesh_filename"));
+      parser.GetParam("mmf_mesh_slots", &mmf_mesh_slots);
+      parser.GetParam("mmf_mesh_slot_mb", &mmf_mesh_slot_mb);
+      parser.GetParam("mmf_float_vertices", &mmf_float_vertices);
+      parser.GetParam("max_published_triangles", &max_published_triangles);
+      parser.GetParam("publish_mesh_delta", &publish_mesh_delta);
+      channel_output_mesh_delta = YamlToString(parser.GetNode("channel_output_mesh_delta"));
+      parser.GetParam("integrate_distance_map", &integrate_distance_map);
+      channel_input_smoother_pose = YamlToString(parser.GetNode("channel_input_smoother_pose"));
+      parser.GetParam("max_pose_age_sec", &max_pose_age_sec);
+      parser.GetParam("integrate_mesh_map", &integrate_mesh_map);
+      mesh_map_ply_path = YamlToString(parser.GetNode("mesh_map_ply_path"));
+      parser.GetParam("mesh_map_export_every_sec", &mesh_map_export_every_sec);
       parser.GetParam("expect_shm_images", &expect_shm_images);
+      parser.GetParam("rectify_images", &rectify_images);
+      if (rectify_images) {
+        YamlToRawStereoRig(parser.GetNode("/shared/stereo_forward_raw"), raw_stereo_rig);
+      }
       parser.GetParam("mesher_input_height", &mesher_input_height);
+      parser.GetParam("decode_scale", &decode_scale);
+      CHECK(decode_scale == 1 || !rectify_images) << "Raw images are rectified at full size, use decode_scale: 1" << std::endl;
+      parser.GetParam("use_feature_tracks", &use_feature_tracks);
+      channel_input_feature_tracks = YamlToString(parser.GetNode("channel_input_feature_tracks"));
       mesher_params = ObjectMesher::Params(parser.Subtree("ObjectMesher"));
+      encoder_params = MeshEncoder::Params(parser.Subtree("MeshEncoder"));
+      distance_map_params = DistanceMap::Params(parser.Subtree("DistanceMap"));
+      if (integrate_mesh_map) {
+        mesh_map_params = MeshMap::Params(parser.Subtree("MeshMap"));
+      }
     }
   };
 
+  // A finished mesh, waiting for the publish thread.
+  struct MeshStamped final
+  {
+    timestamp_t timestamp = 0;
+    uid_t camera_id = 0;
+    TriangleMesh mesh;
+  };
+
+  // A frame waiting for the mesher, and the tracks for it (if use_feature_tracks).
+  struct MesherInput final
+  {
+    StereoImage1b stereo_pair{0, 0, Image1b(), Image1b()};
+    bool has_tracks = false;
+    LandmarkObservationBatch tracks;
+    cv::Size tracks_image_size;
+  };
+
+  // NOTE(milo): Images are decoded on the subscriber's thread, meshed on mesher_thread_, and
+  // published on publish_thread_, so the LCM thread only ever hands off messages. Otherwise, LCM's
+  // receive buffer fills up while a frame is being meshed.
   ObjectMesherLcm(const Params& params)
       : params_(params),
         mesher_(params.mesher_params),
-        sub_(lcm_, params_.channel_input_stereo, params_.expect_shm_images)
+        encoder_(params.encoder_params),
+        mesher_mailbox_(kMaxSizeMesherMailbox, true, "mesher_mailbox"),
+        publish_queue_(kMaxSizePublishQueue, true, "mesh_publish_queue"),
+        sub_(lcm_, params_.channel_input_stereo, params_.expect_shm_images, true),
+        pose_history_(kPoseHistorySize, 2.0 * params_.max_pose_age_sec)
   {
     if (!lcm_.good()) {
       LOG(WARNING) << "Failed to initialize LCM" << std::endl;
       return;
     }
 
+    DebugViewer::Instance().SetShowWindows(params_.show_debug_windows);
+    if (params_.publish_debug_images) {
+      debug_image_pub_.reset(new DebugImagePublisher(
+          lcm_, params_.channel_output_debug_images, params_.debug_image_hz, params_.debug_image_jpeg_quality));
+      DebugViewer::Instance().RegisterFrameCallback(std::bind(
+          &DebugImagePublisher::Publish, debug_image_pub_.get(), std::placeholders::_1, std::placeholders::_2));
+      LOG(INFO) << "Will publish debug images on: " << params_.channel_output_debug_images << "/*" << std::endl;
+    }
+
+    if (params_.publish_mmf_mesh) {
+      mmf_writer_.reset(new MmfMeshWriter(
+          params_.mmf_mesh_filename,
+          params_.mmf_mesh_slots,
+          static_cast<size_t>(params_.mmf_mesh_slot_mb * 1024.0f * 1024.0f),
+          params_.mmf_float_vertices));
+      LOG(INFO) << "Will publish memory-mapped meshes on: " << params_.channel_output_mmf_mesh << std::endl;
+    }
+
+    if (params_.publish_mesh_delta) {
+      CHECK(!params_.mesher_params.dense_completion)
+          << "Mesh deltas need landmark ids, which dense_completion meshes don't have" << std::endl;
+      LOG(INFO) << "Will publish mesh deltas on: " << params_.channel_output_mesh_delta << std::endl;
+    }
+
+    if (params_.integrate_distance_map) {
+      distance_map_.reset(new DistanceMap(params_.distance_map_params));
+    }
+
+    if (params_.integrate_mesh_map) {
+      mesh_map_.reset(new MeshMap(params_.mesh_map_params));
+      LOG(INFO) << "Will build a mesh map, and write it to: " << params_.mesh_map_ply_path << std::endl;
+    }
+
+    if (params_.integrate_distance_map || params_.integrate_mesh_map) {
+      lcm_.subscribe(params_.channel_input_smoother_pose.c_str(), &ObjectMesherLcm::HandleSmootherPose, this);
+      LOG(INFO) << "Will integrate meshes with poses from: " << params_.channel_input_smoother_pose << std::endl;
+    }
+
+    sub_.SetDecodeScale(params_.decode_scale);
+
+    if (params_.rectify_images) {
+      sub_.SetRectifier(std::make_shared<StereoRectifier>(params_.raw_stereo_rig, params_.mesher_params.stereo_rig));
+    }
+
+    if (params_.use_feature_tracks) {
+      lcm_.subscribe(params_.channel_input_feature_tracks.c_str(), &ObjectMesherLcm::HandleFeatureTracks, this);
+      LOG(INFO) << "Will mesh feature tracks from: " << params_.channel_input_feature_tracks << std::endl;
+    }
+
     sub_.RegisterCallback(std::bind(&ObjectMesherLcm::HandleStereo, this, std::placeholders::_1));
 
+    mesher_thread_ = std::thread(&ObjectMesherLcm::MesherLoop, this);
+    publish_thread_ = std::thread(&ObjectMesherLcm::PublishLoop, this);
+
     LOG(INFO) << "Listening for images on: " << params_.channel_input_stereo << std::endl;
     LOG(INFO) << "Will publish mesh on: " << params_.channel_output_mesh << std::endl;
   }
 
+  ~ObjectMesherLcm()
+  {
+    DebugViewer::Instance().ClearFrameCallbacks();
+    is_shutdown_.store(true);
+    if (mesher_thread_.joinable()) {
+      mesher_thread_.join();
+    }
+    if (publish_thread_.joinable()) {
+      publish_thread_.join();
+    }
+    if (mesh_map_) {
+      ExportMeshMap();
+    }
+  }
+
   void Spin()
   {
     while (0 == lcm_.handle() && !is_shutdown_);
   }
 
+  // NOTE(milo): LCM calls this from Spin(), but the poses are looked up on the mesher thread.
+  void HandleSmootherPose(const lcm::ReceiveBuffer*,
+                          const std::string&,
+                          const vehicle::pose3_stamped_t* msg)
+  {
+    const Quaterniond q(msg->pose.orientation.w, msg->pose.orientation.x,
+                        msg->pose.orientation.y, msg->pose.orientation.z);
+    const Vector3d t(msg->pose.position.x, msg->pose.position.y, msg->pose.position.z);
+    pose_history_.Add(static_cast<timestamp_t>(msg->header.timestamp), SE3(q.normalized(), t));
+  }
+
+  // Fuse a mesh into the distance map and/or mesh map, if there's a recent enough smoother pose.
+  void IntegrateMaps(const TriangleMesh& mesh, timestamp_t timestamp)
+  {
+    // Keyposes are at most 2 * max_pose_age_sec apart for an interpolated pose. A mesh is usually
+    // newer than the newest keypose though, so fall back to that one if it's recent enough.
+    SE3 world_T_body;
+    if (!pose_history_.Lookup(timestamp, world_T_body)) {
+      timestamp_t oldest, newest;
+      const bool has_recent = pose_history_.Span(oldest, newest) &&
+          std::fabs(ConvertToSeconds(timestamp) - ConvertToSeconds(newest)) <= params_.max_pose_age_sec &&
+          pose_history_.Lookup(newest, world_T_body);
+      if (!has_recent) {
+        LOG_EVERY_N(WARNING, 30) << "No recent smoother pose, not integrating mesh into the maps" << std::endl;
+        return;
+      }
+    }
+
+    const SE3 world_T_cam = world_T_body * SE3(params_.mesher_params.body_T_cam_left);
+    if (distance_map_) {
+      distance_map_->IntegrateAsync(mesh, world_T_cam);
+    }
+    if (mesh_map_) {
+      mesh_map_->Integrate(mesh, world_T_cam);
+    }
+  }
+
+  // NOTE(milo): The mesher thread waits on the map while it's being written, so this is done from
+  // the publish thread (or after both threads have stopped).
+  void ExportMeshMap()
+  {
+    if (mesh_map_->WritePly(params_.mesh_map_ply_path)) {
+      LOG(INFO) << "Wrote mesh map with " << mesh_map_->NumVertices() << " vertices and "
+                << mesh_map_->NumTriangles() << " triangles to " << params_.mesh_map_ply_path << std::endl;
+    }
+  }
+
+  // Called on the subscriber's decode thread. Replaces any frame that the mesher hasn't started on.
   void HandleStereo(const StereoImage1b& stereo_pair)
   {
+    if (!params_.use_feature_tracks) {
+      MesherInput input;
+      input.stereo_pair = stereo_pair;
+      mesher_mailbox_.Push(std::move(input));
+      return;
+    }
 
+    std::lock_guard<std::mutex> lock(unpaired_lock_);
+    unpaired_images_.emplace_back(stereo_pair);
+    if (unpaired_images_.size() > kMaxUnpaired) {
+      unpaired_images_.pop_front();
+    }
+    PairTracksWithImages();
+  }
+
+  // Called from Spin(). Decoding is just a copy, so this doesn't hold up the LCM thread.
+  void HandleFeatureTracks(const lcm::ReceiveBuffer*,
+                           const std::string&,
+                           const vehicle::feature_tracks_t* msg)
+  {
+    MesherInput input;
+    input.stereo_pair.timestamp = msg->header.timestamp;
+    input.stereo_pair.camera_id = static_cast<uid_t>(msg->header.seq);
+    input.has_tracks = true;
+    input.tracks_image_size = cv::Size(msg->width, msg->height);
+    decode_feature_tracks_t(*msg, input.tracks);
+
+    std::lock_guard<std::mutex> lock(unpaired_lock_);
+    unpaired_tracks_.emplace_back(std::move(input));
+    if (unpaired_tracks_.size() > kMaxUnpaired) {
+      unpaired_tracks_.pop_front();
+    }
+    PairTracksWithImages();
+  }
+
+  // Sends every image that has tracks (matched by timestamp) to the mesher. Anything older than a
+  // match will never get its other half, so it's dropped. Call with unpaired_lock_ held.
+  void PairTracksWithImages()
+  {
+    while (!unpaired_images_.empty() && !unpaired_tracks_.empty()) {
+      const timestamp_t t_image = unpaired_images_.front().timestamp;
+      const timestamp_t t_tracks = unpaired_tracks_.front().stereo_pair.timestamp;
+      if (t_image < t_tracks) {
+        unpaired_images_.pop_front();
+      } else if (t_tracks < t_image) {
+        unpaired_tracks_.pop_front();
+      } else {
+        MesherInput input = std::move(unpaired_tracks_.front());
+        input.stereo_pair = std::move(unpaired_images_.front());
+        unpaired_tracks_.pop_front();
+        unpaired_images_.pop_front();
+        mesher_mailbox_.Push(std::move(input));
+      }
+    }
+  }
+
+  void MesherLoop()
+  {
+    while (!is_shutdown_) {
+      MesherInput input;
+      if (!mesher_mailbox_.PopBlocking(input, kWaitForShutdownSec)) {
+        continue;
+      }
+
+      if (mesher_mailbox_.Dropped() > 0) {
+        LOG_EVERY_N(INFO, 30) << "Mesher has skipped " << mesher_mailbox_.Dropped()
+                              << " stale frames so far" << std::endl;
+      }
+
+      MeshStereo(input);
+    }
+  }
+
+  void MeshStereo(const MesherInput& input)
+  {
+    const StereoImage1b& stereo_pair = input.stereo_pair;
     TriangleMesh mesh;
 
     if (stereo_pair.left_image.rows > params_.mesher_input_height) {
@@ -79,14 +428,84 @@ class ObjectMesherLcm final {
       const cv::Size input_size(static_cast<int>(scale_factor * stereo_pair.left_image.cols), params_.mesher_input_height);
       cv::resize(stereo_pair.left_image, pair_downsized.left_image, input_size, 0, 0, cv::INTER_LINEAR);
       cv::resize(stereo_pair.right_image, pair_downsized.right_image, input_size, 0, 0, cv::INTER_LINEAR);
-      mesh = mesher_.ProcessStereo(std::move(pair_downsized), params_.visualize);
+      mesh = Process(pair_downsized, input);
     } else {
-      mesh = mesher_.ProcessStereo(std::move(stereo_pair), params_.visualize);
+      mesh = Process(stereo_pair, input);
+    }
+
+    if (distance_map_ || mesh_map_) {
+      IntegrateMaps(mesh, stereo_pair.timestamp);
+    }
+
+    MeshStamped out;
+    out.timestamp = stereo_pair.timestamp;
+    out.camera_id = stereo_pair.camera_id;
+    out.mesh = std::move(mesh);
+    publish_queue_.Push(std::move(out));
+  }
+
+  const TriangleMesh& Process(const StereoImage1b& stereo_pair, const MesherInput& input)
+  {
+    if (input.has_tracks) {
+      return mesher_.ProcessTracks(stereo_pair, input.tracks, input.tracks_image_size, params_.visualize);
+    }
+    return mesher_.ProcessStereo(stereo_pair, params_.visualize);
+  }
+
+  void PublishLoop()
+  {
+    while (!is_shutdown_) {
+      MeshStamped item;
+      if (publish_queue_.PopBlocking(item, kWaitForShutdownSec)) {
+        Publish(item);
+      }
+
+      if (mesh_map_ && params_.mesh_map_export_every_sec > 0) {
+        const auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - last_mesh_map_export_).count() >= params_.mesh_map_export_every_sec) {
+          last_mesh_map_export_ = now;
+          ExportMeshMap();
+        }
+      }
+    }
+  }
+
+  // NOTE(milo): LCM's publish() is threadsafe, so this doesn't need to run on the LCM thread.
+  void Publish(const MeshStamped& item)
+  {
+    TriangleMesh decimated;
+    const bool decimate = params_.max_published_triangles > 0 &&
+                          (int)item.mesh.triangles.size() > params_.max_published_triangles;
+    if (decimate) {
+      DecimateMesh(item.mesh, params_.max_published_triangles, decimated);
+    }
+    const TriangleMesh& mesh = decimate ? decimated : item.mesh;
+
+    if (params_.publish_mesh_delta) {
+      vehicle::mesh_delta_t delta_out;
+      delta_out.header.timestamp = item.timestamp;
+      delta_out.header.seq = item.camera_id;
+      delta_out.header.frame_id = "";
+      pack_mesh_delta_t(encoder_.Encode(mesh), delta_out);
+      lcm_.publish(params_.channel_output_mesh_delta.c_str(), &delta_out);
+    }
+
+    if (mmf_writer_) {
+      vehicle::mmf_mesh_stamped_t mmf_out;
+      mmf_out.header.timestamp = item.timestamp;
+      mmf_out.header.seq = item.camera_id;
+      mmf_out.header.frame_id = "";
+      if (mmf_writer_->Write(mesh.vertices, mesh.triangles, mmf_out)) {
+        lcm_.publish(params_.channel_output_mmf_mesh.c_str(), &mmf_out);
+        return;
+      }
+      LOG(WARNING) << "Mesh with " << mesh.vertices.size() << " vertices doesn't fit in a "
+                   << mmf_writer_->SlotBytes() << " byte slot, sending it over LCM" << std::endl;
     }
 
     vehicle::mesh_stamped_t out;
-    out.header.timestamp = stereo_pair.timestamp;
-    out.header.seq = stereo_pair.camera_id;
+    out.header.timestamp = item.timestamp;
+    out.header.seq = item.camera_id;
     pack_mesh_t(mesh.vertices, mesh.triangles, out.mesh);
     lcm_.publish(params_.channel_output_mesh.c_str(), &out);
   }
@@ -95,8 +514,27 @@ class ObjectMesherLcm final {
   std::atomic_bool is_shutdown_{false};
   Params params_;
   ObjectMesher mesher_;
+  MeshEncoder encoder_;
+
+  // NOTE(milo): Declared before sub_, since its decode thread pushes to them until it's destroyed.
+  ThreadsafeQueue<MesherInput> mesher_mailbox_;
+  ThreadsafeQueue<MeshStamped> publish_queue_;
+  std::mutex unpaired_lock_;
+  std::deque<StereoImage1b> unpaired_images_;
+  std::deque<MesherInput> unpaired_tracks_;
+
   lcm::LCM lcm_;
   ImageSubscriber sub_;
+  std::unique_ptr<MmfMeshWriter> mmf_writer_;
+  std::unique_ptr<DebugImagePublisher> debug_image_pub_;
+
+  std::thread mesher_thread_;
+  std::thread publish_thread_;
+
+  std::unique_ptr<DistanceMap> distance_map_;
+  std::unique_ptr<MeshMap> mesh_map_;
+  std::chrono::steady_clock::time_point last_mesh_map_export_ = std::chrono::steady_clock::now();
+  PoseHistory pose_history_;    // Smoother keyposes, written by the LCM thread.
 };
 
 
@@ -0,0 +1,566 @@
+#include <atomic>
+#include <csignal>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include <opencv2/imgproc.hpp>
+
+#include "params/params_base.hpp"
+#include "core/file_utils.hpp"
+#include "core/path_util.hpp"
+#include "core/publish_scheduler.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "core/timestamp.hpp"
+#include "vision_core/stereo_rectifier.hpp"
+#include "dataset/packed_log_recorder.hpp"
+#include "vio/state_estimator.hpp"
+#include "mesher/object_mesher.hpp"
+#include "lcm_util/image_subscriber.hpp"
+#include "lcm_util/util_pose3_t.hpp"
+#include "lcm_util/util_mesh_t.hpp"
+#include "lcm_util/util_imu_measurement_t.hpp"
+#include "lcm_util/util_depth_measurement_t.hpp"
+#include "lcm_util/util_range_measurement_t.hpp"
+
+#include "vehicle/pose3_stamped_t.hpp"
+#include "vehicle/mesh_stamped_t.hpp"
+#include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/imu_measurement_batch_t.hpp"
+#include "vehicle/depth_measurement_t.hpp"
+#include "vehicle/range_measurement_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+using namespace mesher;
+using namespace dataset;
+
+
+static const double kWaitForShutdownSec = 0.5;
+
+// How long Spin() waits for a message before checking for shutdown.
+static const int kHandleTimeoutMs = 100;
+
+// Frames waiting for the mesher (only the newest one is kept, like in ObjectMesherLcm).
+static const size_t kMaxSizeMesherMailbox = 1;
+
+// With mesher_use_feature_tracks, images and tracks that are still waiting for their other half.
+static const size_t kMaxUnpaired = 4;
+
+// Set by SIGINT/SIGTERM, so that the recorder can close its log before the process exits.
+static std::atomic_bool g_shutdown{false};
+
+static void HandleSignal(int)
+{
+  g_shutdown.store(true);
+}
+
+
+// Runs the StateEstimator, ObjectMesher and a PackedLogRecorder as components of one process,
+// instead of as StateEstimatorLcm, ObjectMesherLcm and RecorderLcm. Each stereo pair is decoded once
+// (by one ImageSubscriber), and every component gets the same image buffers. The estimator's feature
+// tracks go straight to the mesher, and its poses straight to the publisher. LCM is only used for
+// the sensors coming in and the poses and meshes going out.
+//
+// Each component's params are read from its standalone node's config file, so there's only one
+// copy of them to keep up to date.
+//
+// NOTE(milo): The camera driver still runs as its own process (it's tied to the camera's SDK), so
+// images arrive on channel_input_stereo as usual. Use shared memory images to avoid the JPEG round
+// trip on the way in.
+class PerceptionHostLcm final {
+ public:
+  struct Params : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    // Components to run in this process.
+    bool use_state_estimator = true;
+    bool use_object_mesher = true;
+    bool use_recorder = false;
+
+    // Config files (relative to vehicle/config) of the standalone nodes, for the StateEstimator and
+    // ObjectMesher subtrees. Loaded by LoadComponentParams().
+    std::string state_estimator_config;
+    std::string object_mesher_config;
+
+    std::string channel_input_stereo;
+    bool expect_shm_images = true;
+    bool rectify_images = false;
+    RawStereoCalibration raw_stereo_rig;
+
+    std::string channel_input_imu;
+    bool imu_batched = false;
+    std::string channel_input_imu_batch;
+    std::string channel_input_depth;
+    std::string channel_input_range;
+    std::string channel_initial_pose;
+
+    std::string channel_output_filter_pose;
+    std::string channel_output_smoother_pose;
+    std::string channel_output_mesh;
+    float filter_publish_hz = 50.0;
+    float smoother_publish_hz = 0.0;
+    float mesh_publish_hz = 0.0;
+
+    // Mesh the landmarks that the StateEstimator tracked, instead of running a second tracker.
+    bool mesher_use_feature_tracks = true;
+    int mesher_input_height = 480;
+
+    // Decoded (and rectified) images are recorded, so JPGs are stored losslessly too.
+    std::string recorder_output_folder;
+    PackedLogRecorderOptions recorder_options;
+
+    StateEstimator::Params state_estimator_params;
+    ObjectMesher::Params mesher_params;
+    TaskScheduler::Params scheduler_params;
+
+    // Read the component params from their own config files.
+    void LoadComponentParams(const std::string& shared_params_path)
+    {
+      if (use_state_estimator) {
+        const YamlParser parser(config_path(state_estimator_config), shared_params_path);
+        state_estimator_params = StateEstimator::Params(parser.Subtree("StateEstimator"));
+      }
+      if (use_object_mesher) {
+        const YamlParser parser(config_path(object_mesher_config), shared_params_path);
+        mesher_params = ObjectMesher::Params(parser.Subtree("ObjectMesher"));
+      }
+      CHECK(!use_object_mesher || !mesher_use_feature_tracks || use_state_estimator)
+          << "mesher_use_feature_tracks needs the StateEstimator component" << std::endl;
+    }
+
+   private:
+    void LoadParams(const YamlParser& parser) override
+    {
+      parser.GetParam("use_state_estimator", &use_state_estimator);
+      parser.GetParam("use_object_mesher", &use_object_mesher);
+      parser.GetParam("use_recorder", &use_recorder);
+      state_estimator_config = YamlToString(parser.GetNode("state_estimator_config"));
+      object_mesher_config = YamlToString(parser.GetNode("object_mesher_config"));
+
+      channel_input_stereo = YamlToString(parser.GetNode("channel_input_stereo"));
+      parser.GetParam("expect_shm_images", &expect_shm_images);
+      parser.GetParam("rectify_images", &rectify_images);
+      if (rectify_images) {
+        YamlToRawStereoRig(parser.GetNode("/shared/stereo_forward_raw"), raw_stereo_rig);
+      }
+
+      channel_input_imu = YamlToString(parser.GetNode("channel_input_imu"));
+      parser.GetParam("imu_batched", &imu_batched);
+      channel_input_imu_batch = YamlToString(parser.GetNode("channel_input_imu_batch"));
+      channel_input_depth = YamlToString(parser.GetNode("channel_input_depth"));
+      channel_input_range = YamlToString(parser.GetNode("channel_input_range"));
+      channel_initial_pose = YamlToString(parser.GetNode("channel_initial_pose"));
+
+      channel_output_filter_pose = YamlToString(parser.GetNode("channel_output_filter_pose"));
+      channel_output_smoother_pose = YamlToString(parser.GetNode("channel_output_smoother_pose"));
+      channel_output_mesh = YamlToString(parser.GetNode("channel_output_mesh"));
+      parser.GetParam("filter_publish_hz", &filter_publish_hz);
+      parser.GetParam("smoother_publish_hz", &smoother_publish_hz);
+      parser.GetParam("mesh_publish_hz", &mesh_publish_hz);
+
+      parser.GetParam("mesher_use_feature_tracks", &mesher_use_feature_tracks);
+      parser.GetParam("mesher_input_height", &mesher_input_height);
+
+      recorder_output_folder = YamlToString(parser.GetNode("recorder_output_folder"));
+      int chunk_mb = 64;
+      parser.GetParam("recorder_chunk_mb", &chunk_mb);
+      recorder_options.chunk_bytes = static_cast<size_t>(chunk_mb) << 20;
+      parser.GetParam("recorder_num_chunks", &recorder_options.num_chunks);
+      parser.GetParam("recorder_max_chunk_sec", &recorder_options.max_chunk_sec);
+      parser.GetParam("recorder_png_compression", &recorder_options.png_compression);
+      recorder_options.png_raw_images = true;
+
+      YamlToTaskScheduler(parser.GetNode("TaskScheduler"), scheduler_params);
+    }
+  };
+
+  // A frame waiting for the mesher, and the tracks for it (if mesher_use_feature_tracks).
+  struct MesherInput final
+  {
+    StereoImage1b stereo_pair{0, 0, Image1b(), Image1b()};
+    bool has_tracks = false;
+    LandmarkObservationBatch tracks;
+    cv::Size tracks_image_size;
+  };
+
+  struct MeshStamped final
+  {
+    timestamp_t timestamp = 0;
+    uid_t camera_id = 0;
+    TriangleMesh mesh;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(PerceptionHostLcm);
+
+  PerceptionHostLcm(const Params& params)
+      : params_(params),
+        mesher_mailbox_(kMaxSizeMesherMailbox, true, "host_mesher_mailbox"),
+        publisher_("PerceptionHostLcm publisher")
+  {
+    if (!lcm_.good()) {
+      LOG(WARNING) << "Failed to initialize LCM" << std::endl;
+      return;
+    }
+
+    image_sub_.reset(new ImageSubscriber(lcm_, params_.channel_input_stereo, params_.expect_shm_images, true));
+    if (params_.rectify_images) {
+      const StereoCamera& stereo_rig = params_.use_state_estimator ?
+          params_.state_estimator_params.stereo_rig : params_.mesher_params.stereo_rig;
+      image_sub_->SetRectifier(std::make_shared<StereoRectifier>(params_.raw_stereo_rig, stereo_rig));
+    }
+
+    if (params_.use_state_estimator) {
+      state_estimator_.reset(new StateEstimator(params_.state_estimator_params));
+      filter_channel_ = publisher_.AddChannel<StateStamped>(
+          "filter", params_.filter_publish_hz, std::bind(&PerceptionHostLcm::PublishFilter, this, std::placeholders::_1));
+      smoother_channel_ = publisher_.AddChannel<SmootherResult>(
+          "smoother", params_.smoother_publish_hz, std::bind(&PerceptionHostLcm::PublishSmoother, this, std::placeholders::_1));
+      state_estimator_->RegisterFilterResultCallback([this](const StateStamped& ss) {
+        publisher_.Update(filter_channel_, ss);
+      });
+      state_estimator_->RegisterSmootherResultCallback([this](const SmootherResult& result) {
+        publisher_.Update(smoother_channel_, result);
+      });
+      image_sub_->RegisterCallback([this](const StereoImage1b& stereo_pair) {
+        if (initialized_) {
+          state_estimator_->ReceiveStereo(stereo_pair);
+        }
+      });
+      LOG(INFO) << "Loaded StateEstimator component from " << params_.state_estimator_config << std::endl;
+    }
+
+    if (params_.use_object_mesher) {
+      mesher_.reset(new ObjectMesher(params_.mesher_params));
+      mesh_channel_ = publisher_.AddChannel<MeshStamped>(
+          "mesh", params_.mesh_publish_hz, std::bind(&PerceptionHostLcm::PublishMesh, this, std::placeholders::_1));
+      image_sub_->RegisterCallback(std::bind(&PerceptionHostLcm::HandleMesherStereo, this, std::placeholders::_1));
+      if (params_.mesher_use_feature_tracks && state_estimator_) {
+        state_estimator_->RegisterFeatureTracksCallback(std::bind(
+            &PerceptionHostLcm::HandleFeatureTracks, this, std::placeholders::_1, std::placeholders::_2));
+      }
+      mesher_thread_ = std::thread(&PerceptionHostLcm::MesherLoop, this);
+      LOG(INFO) << "Loaded ObjectMesher component from " << params_.object_mesher_config << std::endl;
+    }
+
+    if (params_.use_recorder) {
+      CHECK(mkdir(params_.recorder_output_folder, true))
+          << "Could not create folder: " << params_.recorder_output_folder << std::endl;
+      char stamp[32];
+      const std::time_t now = std::time(nullptr);
+      std::strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", std::localtime(&now));
+      const std::string log_path = Join(params_.recorder_output_folder, "recording_" + std::string(stamp) + ".bmlog");
+      recorder_.reset(new PackedLogRecorder(log_path, params_.recorder_options));
+      image_sub_->RegisterCallback([this](const StereoImage1b& stereo_pair) {
+        recorder_->RecordStereo(stereo_pair.timestamp, stereo_pair.left_image, stereo_pair.right_image);
+      });
+      LOG(INFO) << "Loaded recorder component, writing to " << log_path << std::endl;
+    }
+
+    publisher_.Start();
+
+    if (params_.imu_batched) {
+      lcm_.subscribe(params_.channel_input_imu_batch.c_str(), &PerceptionHostLcm::HandleImuBatch, this);
+    } else {
+      lcm_.subscribe(params_.channel_input_imu.c_str(), &PerceptionHostLcm::HandleImu, this);
+    }
+    lcm_.subscribe(params_.channel_input_depth.c_str(), &PerceptionHostLcm::HandleDepth, this);
+    lcm_.subscribe(params_.channel_input_range.c_str(), &PerceptionHostLcm::HandleRange, this);
+
+    if (state_estimator_) {
+      lcm_.subscribe(params_.channel_initial_pose.c_str(), &PerceptionHostLcm::HandleInitialPose, this);
+      LOG(INFO) << "Listening for initial pose on channel: " << params_.channel_initial_pose << std::endl;
+    }
+  }
+
+  // NOTE(milo): The image subscriber is destroyed first, so that nothing calls into the components
+  // while they're shutting down.
+  ~PerceptionHostLcm()
+  {
+    image_sub_.reset();
+    is_shutdown_.store(true);
+    if (mesher_thread_.joinable()) {
+      mesher_thread_.join();
+    }
+    if (state_estimator_ && initialized_) {
+      state_estimator_->Shutdown();
+    }
+    publisher_.Stop();
+    if (recorder_) {
+      recorder_->Close();
+    }
+  }
+
+  // Handles messages until SIGINT/SIGTERM.
+  void Spin()
+  {
+    while (!g_shutdown.load() && lcm_.handleTimeout(kHandleTimeoutMs) >= 0);
+  }
+
+ private:
+  void HandleInitialPose(const lcm::ReceiveBuffer*,
+                         const std::string&,
+                         const vehicle::pose3_stamped_t* msg)
+  {
+    if (initialized_) {
+      return;
+    }
+    if (msg->header.frame_id != "imu" && msg->header.frame_id != "body") {
+      LOG(WARNING) << "Received initial pose in wrong frame: " << msg->header.frame_id << std::endl;
+      return;
+    }
+
+    gtsam::Pose3 world_P_body = gtsam::Pose3::identity();
+    decode_pose3_t(msg->pose, world_P_body);
+    LOG(INFO) << "Received initial pose at t=" << msg->header.timestamp << "\n" << world_P_body << std::endl;
+
+    state_estimator_->Initialize(ConvertToSeconds(msg->header.timestamp), world_P_body);
+    initialized_.store(true);
+  }
+
+  void HandleImu(const lcm::ReceiveBuffer*,
+                 const std::string&,
+                 const vehicle::imu_measurement_t* msg)
+  {
+    ImuMeasurement data;
+    decode_imu_measurement_t(*msg, data);
+    if (recorder_) {
+      recorder_->RecordImu(data);
+    }
+    if (state_estimator_ && initialized_) {
+      state_estimator_->ReceiveImu(std::move(data));
+    }
+  }
+
+  void HandleImuBatch(const lcm::ReceiveBuffer*,
+                      const std::string&,
+                      const vehicle::imu_measurement_batch_t* msg)
+  {
+    if (msg->num_samples == 0) { return; }
+    decode_imu_measurement_batch_t(*msg, imu_batch_);
+    if (recorder_) {
+      for (const ImuMeasurement& data : imu_batch_) {
+        recorder_->RecordImu(data);
+      }
+    }
+    if (state_estimator_ && initialized_) {
+      state_estimator_->ReceiveImuBatch(imu_batch_.data(), imu_batch_.size());
+    }
+  }
+
+  void HandleDepth(const lcm::ReceiveBuffer*,
+                   const std::string&,
+                   const vehicle::depth_measurement_t* msg)
+  {
+    DepthMeasurement data(0, 0);
+    decode_depth_measurement_t(*msg, data);
+    if (recorder_) {
+      recorder_->RecordDepth(data);
+    }
+    if (state_estimator_ && initialized_) {
+      state_estimator_->ReceiveDepth(std::move(data));
+    }
+  }
+
+  void HandleRange(const lcm::ReceiveBuffer*,
+                   const std::string&,
+                   const vehicle::range_measurement_t* msg)
+  {
+    RangeMeasurement data(0, 0, Vector3d::Zero());
+    decode_range_measurement_t(*msg, data);
+    if (recorder_) {
+      recorder_->RecordRange(data);
+    }
+    if (state_estimator_ && initialized_) {
+      state_estimator_->ReceiveRange(std::move(data));
+    }
+  }
+
+  // Called on the subscriber's decode thread. The mesher shares the estimator's image buffers.
+  void HandleMesherStereo(const StereoImage1b& stereo_pair)
+  {
+    if (!params_.mesher_use_feature_tracks) {
+      MesherInput input;
+      input.stereo_pair = stereo_pair;
+      mesher_mailbox_.Push(std::move(input));
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(unpaired_lock_);
+    unpaired_images_.emplace_back(stereo_pair);
+    if (unpaired_images_.size() > kMaxUnpaired) {
+      unpaired_images_.pop_front();
+    }
+    PairTracksWithImages();
+  }
+
+  // Called on the estimator's frontend thread. Only the landmark observations are copied.
+  void HandleFeatureTracks(const VoResult& result, const cv::Size& image_size)
+  {
+    MesherInput input;
+    input.stereo_pair.timestamp = result.timestamp;
+    input.stereo_pair.camera_id = result.camera_id;
+    input.has_tracks = true;
+    input.tracks = result.lmk_obs;
+    input.tracks_image_size = image_size;
+
+    std::lock_guard<std::mutex> lock(unpaired_lock_);
+    unpaired_tracks_.emplace_back(std::move(input));
+    if (unpaired_tracks_.size() > kMaxUnpaired) {
+      unpaired_tracks_.pop_front();
+    }
+    PairTracksWithImages();
+  }
+
+  // Same as ObjectMesherLcm: sends every image that has tracks (matched by timestamp) to the mesher,
+  // and drops anything older than a match. Call with unpaired_lock_ held.
+  void PairTracksWithImages()
+  {
+    while (!unpaired_images_.empty() && !unpaired_tracks_.empty()) {
+      const timestamp_t t_image = unpaired_images_.front().timestamp;
+      const timestamp_t t_tracks = unpaired_tracks_.front().stereo_pair.timestamp;
+      if (t_image < t_tracks) {
+        unpaired_images_.pop_front();
+      } else if (t_tracks < t_image) {
+        unpaired_tracks_.pop_front();
+      } else {
+        MesherInput input = std::move(unpaired_tracks_.front());
+        input.stereo_pair = std::move(unpaired_images_.front());
+        unpaired_tracks_.pop_front();
+        unpaired_images_.pop_front();
+        mesher_mailbox_.Push(std::move(input));
+      }
+    }
+  }
+
+  void MesherLoop()
+  {
+    MesherInput input;
+    StereoImage1b downsized(0, 0, Image1b(), Image1b());
+
+    while (!is_shutdown_) {
+      if (!mesher_mailbox_.PopBlocking(input, kWaitForShutdownSec)) {
+        continue;
+      }
+
+      // NOTE(milo): The estimator needs the full size images, so the mesher downsizes its own copy
+      // here instead of decoding them smaller (like ObjectMesherLcm's decode_scale).
+      const StereoImage1b* stereo_pair = &input.stereo_pair;
+      if (input.stereo_pair.left_image.rows > params_.mesher_input_height) {
+        const double scale_factor = static_cast<double>(params_.mesher_input_height) / input.stereo_pair.left_image.rows;
+        const cv::Size input_size(static_cast<int>(scale_factor * input.stereo_pair.left_image.cols), params_.mesher_input_height);
+        downsized.timestamp = input.stereo_pair.timestamp;
+        downsized.camera_id = input.stereo_pair.camera_id;
+        cv::resize(input.stereo_pair.left_image, downsized.left_image, input_size, 0, 0, cv::INTER_LINEAR);
+        cv::resize(input.stereo_pair.right_image, downsized.right_image, input_size, 0, 0, cv::INTER_LINEAR);
+        stereo_pair = &downsized;
+      }
+
+      MeshStamped out;
+      out.timestamp = stereo_pair->timestamp;
+      out.camera_id = stereo_pair->camera_id;
+      out.mesh = input.has_tracks ?
+          mesher_->ProcessTracks(*stereo_pair, input.tracks, input.tracks_image_size, false) :
+          mesher_->ProcessStereo(*stereo_pair, false);
+      publisher_.Update(mesh_channel_, out);
+
+      // Let go of the subscriber's image buffers so that they can be reused.
+      input = MesherInput();
+    }
+  }
+
+  // The rest are called on the publisher thread.
+  void PublishFilter(const StateStamped& ss)
+  {
+    vehicle::pose3_stamped_t msg;
+    msg.header.timestamp = ConvertToNanoseconds(ss.timestamp);
+    msg.header.seq = -1;
+    msg.header.frame_id = "body";
+    pack_pose3_t(ss.state.q, ss.state.t, msg.pose);
+    lcm_.publish(params_.channel_output_filter_pose, &msg);
+  }
+
+  void PublishSmoother(const SmootherResult& result)
+  {
+    vehicle::pose3_stamped_t msg;
+    msg.header.timestamp = ConvertToNanoseconds(result.timestamp);
+    msg.header.seq = -1;
+    msg.header.frame_id = "body";
+    pack_pose3_t(result.world_P_body, msg.pose);
+    lcm_.publish(params_.channel_output_smoother_pose, &msg);
+  }
+
+  void PublishMesh(const MeshStamped& item)
+  {
+    vehicle::mesh_stamped_t out;
+    out.header.timestamp = item.timestamp;
+    out.header.seq = item.camera_id;
+    pack_mesh_t(item.mesh.vertices, item.mesh.triangles, out.mesh);
+    lcm_.publish(params_.channel_output_mesh.c_str(), &out);
+  }
+
+ private:
+  std::atomic_bool is_shutdown_{false};
+  std::atomic_bool initialized_{false};
+
+  Params params_;
+  lcm::LCM lcm_;
+
+  std::unique_ptr<StateEstimator> state_estimator_;   // Only if use_state_estimator.
+  std::unique_ptr<ObjectMesher> mesher_;              // Only if use_object_mesher.
+  std::unique_ptr<PackedLogRecorder> recorder_;       // Only if use_recorder.
+
+  ThreadsafeQueue<MesherInput> mesher_mailbox_;
+  std::mutex unpaired_lock_;
+  std::deque<StereoImage1b> unpaired_images_;
+  std::deque<MesherInput> unpaired_tracks_;
+  std::thread mesher_thread_;
+
+  PublishScheduler publisher_;
+  PublishScheduler::ChannelId filter_channel_ = 0;
+  PublishScheduler::ChannelId smoother_channel_ = 0;
+  PublishScheduler::ChannelId mesh_channel_ = 0;
+
+  ImuMeasurementVec imu_batch_;               // Reused by HandleImuBatch().
+
+  // NOTE(milo): Declared last, since its decode thread calls into everything above.
+  std::unique_ptr<ImageSubscriber> image_sub_;
+};
+
+
+int main(int argc, char const *argv[])
+{
+  // Set up glog.
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  CHECK_EQ(3ul, argc)
+      << "Requires (2) args: node_params_path and shared_params_path."
+      << "They should be relative to vehicle/config" << std::endl;
+
+  std::string node_params_path = std::string(argv[1]);
+  const std::string shared_params_path = config_path(std::string(argv[2]));
+
+  PerceptionHostLcm::Params params(config_path(node_params_path), shared_params_path);
+  params.LoadComponentParams(shared_params_path);
+
+  TaskScheduler::Configure(params.scheduler_params);
+
+  std::signal(SIGINT, HandleSignal);
+  std::signal(SIGTERM, HandleSignal);
+
+  PerceptionHostLcm node(params);
+  node.Spin();
+
+  LOG(INFO) << "DONE" << std::endl;
+
+  return 0;
+}
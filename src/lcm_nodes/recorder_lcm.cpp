@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <ctime>
+#include <memory>
+
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "params/params_base.hpp"
+#include "core/file_utils.hpp"
+#include "core/path_util.hpp"
+#include "dataset/packed_log_recorder.hpp"
+#include "lcm_util/decode_image.hpp"
+#include "lcm_util/util_imu_measurement_t.hpp"
+#include "lcm_util/util_depth_measurement_t.hpp"
+#include "lcm_util/util_range_measurement_t.hpp"
+
+#include "vehicle/stereo_image_t.hpp"
+#include "vehicle/mmf_stereo_image_t.hpp"
+#include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/imu_measurement_batch_t.hpp"
+#include "vehicle/depth_measurement_t.hpp"
+#include "vehicle/range_measurement_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+namespace ipc = boost::interprocess;
+
+
+// How long Spin() waits for a message before checking for shutdown.
+static const int kHandleTimeoutMs = 100;
+
+// Set by SIGINT/SIGTERM, so that the log gets its index before the process exits.
+static std::atomic_bool g_shutdown{false};
+
+static void HandleSignal(int)
+{
+  g_shutdown.store(true);
+}
+
+
+// Records the sensor channels that the StateEstimator and ObjectMesher use into a packed log (see
+// PackedLogRecorder), which can be played back with PackedLogDataset. Unlike lcm-logger, images on
+// the memory-mapped channels are recorded too, and the disk only sees large sequential writes.
+//
+// NOTE(milo): Every handler runs on the LCM thread, which only copies messages into the recorder's
+// chunks. Compression and disk writes happen on the recorder's writer thread.
+class RecorderLcm final {
+ public:
+  struct Params : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    // Logs are written to output_folder/recording_<local time>.bmlog.
+    std::string output_folder;
+
+    // Leave a channel empty to skip it.
+    std::string channel_input_stereo;
+    bool expect_shm_images = true;
+    std::string channel_input_imu;
+    bool imu_batched = false;
+    std::string channel_input_imu_batch;
+    std::string channel_input_depth;
+    std::string channel_input_range;
+
+    int chunk_mb = 64;
+    int num_chunks = 4;
+    double max_chunk_sec = 2.0;
+    bool png_raw_images = true;
+    int png_compression = 1;
+
+   private:
+    void LoadParams(const YamlParser& parser) override
+    {
+      output_folder = YamlToString(parser.GetNode("output_folder"));
+      channel_input_stereo = YamlToString(parser.GetNode("channel_input_stereo"));
+      parser.GetParam("expect_shm_images", &expect_shm_images);
+      channel_input_imu = YamlToString(parser.GetNode("channel_input_imu"));
+      parser.GetParam("imu_batched", &imu_batched);
+      channel_input_imu_batch = YamlToString(parser.GetNode("channel_input_imu_batch"));
+      channel_input_depth = YamlToString(parser.GetNode("channel_input_depth"));
+      channel_input_range = YamlToString(parser.GetNode("channel_input_range"));
+      parser.GetParam("chunk_mb", &chunk_mb);
+      parser.GetParam("num_chunks", &num_chunks);
+      parser.GetParam("max_chunk_sec", &max_chunk_sec);
+      parser.GetParam("png_raw_images", &png_raw_images);
+      parser.GetParam("png_compression", &png_compression);
+    }
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(RecorderLcm);
+
+  RecorderLcm(const Params& params) : params_(params)
+  {
+    if (!lcm_.good()) {
+      LOG(WARNING) << "Failed to initialize LCM" << std::endl;
+      return;
+    }
+
+    CHECK(mkdir(params_.output_folder, true)) << "Could not create folder: " << params_.output_folder << std::endl;
+
+    char stamp[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", std::localtime(&now));
+    const std::string log_path = Join(params_.output_folder, "recording_" + std::string(stamp) + ".bmlog");
+
+    PackedLogRecorderOptions options;
+    options.chunk_bytes = static_cast<size_t>(params_.chunk_mb) << 20;
+    options.num_chunks = params_.num_chunks;
+    options.max_chunk_sec = params_.max_chunk_sec;
+    options.png_raw_images = params_.png_raw_images;
+    options.png_compression = params_.png_compression;
+    recorder_.reset(new PackedLogRecorder(log_path, options));
+
+    if (!params_.channel_input_stereo.empty()) {
+      if (params_.expect_shm_images) {
+        lcm_.subscribe(params_.channel_input_stereo.c_str(), &RecorderLcm::HandleMmfStereo, this);
+      } else {
+        lcm_.subscribe(params_.channel_input_stereo.c_str(), &RecorderLcm::HandleStereo, this);
+      }
+    }
+    if (params_.imu_batched && !params_.channel_input_imu_batch.empty()) {
+      lcm_.subscribe(params_.channel_input_imu_batch.c_str(), &RecorderLcm::HandleImuBatch, this);
+    } else if (!params_.channel_input_imu.empty()) {
+      lcm_.subscribe(params_.channel_input_imu.c_str(), &RecorderLcm::HandleImu, this);
+    }
+    if (!params_.channel_input_depth.empty()) {
+      lcm_.subscribe(params_.channel_input_depth.c_str(), &RecorderLcm::HandleDepth, this);
+    }
+    if (!params_.channel_input_range.empty()) {
+      lcm_.subscribe(params_.channel_input_range.c_str(), &RecorderLcm::HandleRange, this);
+    }
+  }
+
+  // Handles messages until SIGINT/SIGTERM, then closes the log.
+  void Spin()
+  {
+    while (!g_shutdown.load() && lcm_.handleTimeout(kHandleTimeoutMs) >= 0);
+
+    if (recorder_) {
+      recorder_->Close();
+    }
+  }
+
+ private:
+  void HandleImu(const lcm::ReceiveBuffer*,
+                 const std::string&,
+                 const vehicle::imu_measurement_t* msg)
+  {
+    ImuMeasurement data;
+    decode_imu_measurement_t(*msg, data);
+    recorder_->RecordImu(data);
+  }
+
+  void HandleImuBatch(const lcm::ReceiveBuffer*,
+                      const std::string&,
+                      const vehicle::imu_measurement_batch_t* msg)
+  {
+    decode_imu_measurement_batch_t(*msg, imu_batch_);
+    for (const ImuMeasurement& data : imu_batch_) {
+      recorder_->RecordImu(data);
+    }
+  }
+
+  void HandleDepth(const lcm::ReceiveBuffer*,
+                   const std::string&,
+                   const vehicle::depth_measurement_t* msg)
+  {
+    DepthMeasurement data(0, 0);
+    decode_depth_measurement_t(*msg, data);
+    recorder_->RecordDepth(data);
+  }
+
+  void HandleRange(const lcm::ReceiveBuffer*,
+                   const std::string&,
+                   const vehicle::range_measurement_t* msg)
+  {
+    RangeMeasurement data(0, 0, Vector3d::Zero());
+    decode_range_measurement_t(*msg, data);
+    recorder_->RecordRange(data);
+  }
+
+  // JPGs are stored as they arrived, raw images are copied (and compressed by the recorder).
+  void HandleStereo(const lcm::ReceiveBuffer*,
+                    const std::string&,
+                    const vehicle::stereo_image_t* msg)
+  {
+    const vehicle::image_t& l = msg->img_left;
+    const vehicle::image_t& r = msg->img_right;
+
+    if (l.encoding == "jpg" && r.encoding == "jpg") {
+      recorder_->RecordStereoEncoded(msg->header.timestamp,
+                                     l.data.data(), std::min<size_t>(l.size, l.data.size()),
+                                     r.data.data(), std::min<size_t>(r.size, r.data.size()),
+                                     PackedImageEncoding::JPEG);
+      return;
+    }
+
+    if (l.encoding != "raw" || r.encoding != "raw" || !IsValidRaw(l) || !IsValidRaw(r)) {
+      LOG_EVERY_N(WARNING, 100) << "Skipping stereo_image_t with unsupported encoding: " << l.encoding << std::endl;
+      return;
+    }
+
+    const cv::Mat left(l.height, l.width, (l.channels == 3) ? CV_8UC3 : CV_8UC1, (void*)l.data.data());
+    const cv::Mat right(r.height, r.width, (r.channels == 3) ? CV_8UC3 : CV_8UC1, (void*)r.data.data());
+    recorder_->RecordStereo(msg->header.timestamp, left, right);
+  }
+
+  // The blocks in the memory-mapped file are copied out before this returns, like ImageSubscriber
+  // does. Raw images are read under their seqlock, and the pair is dropped if it was overwritten.
+  void HandleMmfStereo(const lcm::ReceiveBuffer*,
+                       const std::string&,
+                       const vehicle::mmf_stereo_image_t* msg)
+  {
+    const std::string& mm_filename = msg->img_left.mm_filename;
+    if (mapped_file_.get_name() != mm_filename) {
+      LOG(INFO) << "First message, opening MMF: " << mm_filename << std::endl;
+      mapped_file_ = ipc::file_mapping(mm_filename.c_str(), ipc::read_only);
+      mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_only);
+    }
+
+    const vehicle::mmf_image_t* meta[2] = { &msg->img_left, &msg->img_right };
+    const uint8_t* data[2] = { nullptr, nullptr };
+    for (int i = 0; i < 2; ++i) {
+      data[i] = MappedData(meta[i]->offset, meta[i]->size);
+      if (data[i] == nullptr) {
+        LOG(WARNING) << "Got an image data block outside of the memory-mapped file" << std::endl;
+        return;
+      }
+    }
+
+    if (meta[0]->encoding == "jpg" && meta[1]->encoding == "jpg") {
+      recorder_->RecordStereoEncoded(msg->header.timestamp,
+                                     data[0], meta[0]->size,
+                                     data[1], meta[1]->size,
+                                     PackedImageEncoding::JPEG);
+      return;
+    }
+
+    // NOTE(milo): DecodeReduced() copies into raw_[i] in place once it has the right size, so this
+    // doesn't allocate after the first pair.
+    for (int i = 0; i < 2; ++i) {
+      if (!DecodeReduced(*meta[i], data[i], 1, raw_[i])) {
+        LOG_EVERY_N(WARNING, 100) << "Memory-mapped image was overwritten while it was copied" << std::endl;
+        return;
+      }
+    }
+
+    recorder_->RecordStereo(msg->header.timestamp, raw_[0], raw_[1]);
+  }
+
+  static bool IsValidRaw(const vehicle::image_t& im)
+  {
+    const size_t bytes = static_cast<size_t>(im.height) * im.width * im.channels;
+    return (im.channels == 1 || im.channels == 3) && im.data.size() >= bytes;
+  }
+
+  const uint8_t* MappedData(int offset, int size) const
+  {
+    if (offset < 0 || size < 0 || static_cast<size_t>(offset) + size > mapped_region_.get_size()) {
+      return nullptr;
+    }
+    return static_cast<const uint8_t*>(mapped_region_.get_address()) + offset;
+  }
+
+ private:
+  Params params_;
+  lcm::LCM lcm_;
+  std::unique_ptr<PackedLogRecorder> recorder_;
+
+  ipc::file_mapping mapped_file_;
+  ipc::mapped_region mapped_region_;
+  cv::Mat raw_[2];
+  ImuMeasurementVec imu_batch_;
+};
+
+
+int main(int argc, char const *argv[])
+{
+  // Set up glog.
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  CHECK_EQ(3ul, argc)
+      << "Requires (2) args: node_params_path and shared_params_path."
+      << "They should be relative to vehicle/config" << std::endl;
+
+  std::string node_params_path = std::string(argv[1]);
+  const std::string shared_params_path = std::string(argv[2]);
+
+  RecorderLcm::Params params(
+    config_path(node_params_path),
+    config_path(shared_params_path));
+
+  std::signal(SIGINT, HandleSignal);
+  std::signal(SIGTERM, HandleSignal);
+
+  RecorderLcm node(params);
+  node.Spin();
+
+  LOG(INFO) << "DONE" << std::endl;
+
+  return 0;
+}
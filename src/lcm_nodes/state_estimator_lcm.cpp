@@ -2,14 +2,19 @@
 
 #include <lcm/lcm-cpp.hpp>
 
+#include <chrono>
+#include <memory>
+#include <thread>
 #include <utility>
 #include <unordered_map>
+#include <vector>
 
 #include <opencv2/highgui.hpp>
 
 #include "core/eigen_types.hpp"
 #include "core/macros.hpp"
 #include "params/params_base.hpp"
+#include "params/params_watcher.hpp"
 #include "vision_core/pinhole_camera.hpp"
 #include "vision_core/stereo_camera.hpp"
 #include "core/timer.hpp"
@@ -17,29 +22,46 @@
 #include "core/file_utils.hpp"
 #include "core/path_util.hpp"
 #include "vision_core/image_util.hpp"
-#include "core/data_subsampler.hpp"
+#include "vision_core/debug_viewer.hpp"
+#include "vision_core/stereo_rectifier.hpp"
+#include "core/profiler.hpp"
+#include "core/publish_scheduler.hpp"
+#include "core/startup_profile.hpp"
+#include "core/pipeline_latency.hpp"
 
 #include "dataset/dataset_util.hpp"
 
 #include "vio/state_estimator.hpp"
 #include "vio/visualizer_3d.hpp"
 #include "vio/smoother_result.hpp"
+#include "vio/estimator_checkpoint.hpp"
 
 #include "lcm_util/util_pose3_t.hpp"
 #include "lcm_util/util_imu_measurement_t.hpp"
 #include "lcm_util/util_depth_measurement_t.hpp"
 #include "lcm_util/util_range_measurement_t.hpp"
 #include "lcm_util/util_mag_measurement_t.hpp"
+#include "lcm_util/util_profiler_stats_t.hpp"
+#include "lcm_util/util_latency_stats_t.hpp"
+#include "lcm_util/util_feature_tracks_t.hpp"
 #include "lcm_util/image_subscriber.hpp"
+#include "lcm_util/debug_image_publisher.hpp"
+#include "lcm_util/viz_publisher.hpp"
 
 #include "feature_tracking/visualization_2d.hpp"
 
 #include "vehicle/pose3_stamped_t.hpp"
 #include "vehicle/stereo_image_t.hpp"
 #include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/imu_measurement_batch_t.hpp"
 #include "vehicle/range_measurement_t.hpp"
 #include "vehicle/depth_measurement_t.hpp"
 #include "vehicle/mag_measurement_t.hpp"
+#include "vehicle/profiler_stats_t.hpp"
+#include "vehicle/latency_stats_t.hpp"
+#include "vehicle/feature_tracks_t.hpp"
+#include "vehicle/pose_query_t.hpp"
+#include "vehicle/pose_query_result_t.hpp"
 
 using namespace bm;
 using namespace core;
@@ -59,9 +81,26 @@ class StateEstimatorLcm final {
     bool use_mag = true;
 
     std::string channel_input_stereo;
+    std::vector<std::string> channel_input_aux_stereo;  // One per StateEstimator aux_stereo_rigs.
     bool expect_shm_images = true;
 
+    // Handle the image channels on their own lcm::LCM instance and thread, so that copying and
+    // dispatching big image messages never holds up the IMU, depth, range and mag messages.
+    bool image_lcm_thread = true;
+
+    // Rectify raw images from the camera (calibrated in /shared/stereo_forward_raw) to match
+    // /shared/stereo_forward, right after they're decoded. Leave this off if the images on
+    // channel_input_stereo are already rectified. Aux rigs aren't rectified.
+    bool rectify_images = false;
+    RawStereoCalibration raw_stereo_rig;
+
     std::string channel_input_imu;
+
+    // Receive the IMU as imu_measurement_batch_t on channel_input_imu_batch (see ImuBatchPublisher),
+    // instead of one imu_measurement_t per sample on channel_input_imu.
+    bool imu_batched = false;
+    std::string channel_input_imu_batch;
+
     std::string channel_input_range;
     std::string channel_input_depth;
     std::string channel_input_mag;
@@ -69,12 +108,56 @@ class StateEstimatorLcm final {
 
     std::string channel_output_filter_pose;
     std::string channel_output_smoother_pose;
+    std::string channel_output_profiler_stats;
+    std::string channel_output_latency_stats;
+    std::string channel_output_feature_tracks;
+
+    // Publish the frontend's landmark observations for every stereo pair, so that the
+    // ObjectMesherLcm can mesh them instead of tracking the same images again.
+    bool publish_feature_tracks = false;
+
+    // Answer pose_query_t messages on channel_input_pose_query with the body pose at their
+    // timestamp (see StateEstimator::GetPose), on channel_output_pose_query_result.
+    bool serve_pose_queries = false;
+    std::string channel_input_pose_query;
+    std::string channel_output_pose_query_result;
 
     bool visualize = true;
+
+    // Stream keyposes, the body pose and their covariance to a topside lcm_viz_viewer, instead of
+    // (or as well as) drawing them here. Much cheaper than visualize, so it can stay on for missions.
+    bool publish_viz = false;
+    std::string channel_output_viz;
+
+    // Debug images (e.g feature tracks) are drawn on a DebugViewer thread. They can be shown in
+    // windows, and/or published as JPGs on channel_output_debug_images + "/" + the window name.
+    bool show_debug_windows = true;
+    bool publish_debug_images = false;
+    std::string channel_output_debug_images;
+    double debug_image_hz = 2.0;
+    int debug_image_jpeg_quality = 70;
+
+    // Outputs are published from their own thread (see PublishScheduler), at most this often. If a
+    // newer result arrives before the last one was published, only the newer one is. Zero publishes
+    // every smoother result.
     float filter_publish_hz = 50.0;
+    float smoother_publish_hz = 0.0;
+    float profiler_publish_hz = 1.0;
+
+    // Watch the params files, and apply changes to filter_publish_hz and the StateEstimator's
+    // tunables (see StateEstimator::Tunables) without restarting.
+    bool hot_reload_params = false;
+    double hot_reload_poll_sec = 1.0;
+
+    // Warm restart from StateEstimator/checkpoint_path if it was saved less than
+    // checkpoint_max_age_sec ago (wall clock), instead of waiting for an initial pose.
+    bool resume_from_checkpoint = false;
+    double checkpoint_max_age_sec = 30.0;
 
     StateEstimator::Params state_estimator_params;
     Visualizer3D::Params visualizer3d_params;
+    VizPublisher::Params viz_publisher_params;
+    TaskScheduler::Params scheduler_params;
 
    private:
     void LoadParams(const YamlParser& parser) override
@@ -86,9 +169,20 @@ class StateEstimatorLcm final {
       parser.GetParam("use_mag", &use_mag);
 
       channel_input_stereo = YamlToString(parser.GetNode("channel_input_stereo"));
+      const cv::FileNode& aux_channels = parser.GetNode("channel_input_aux_stereo");
+      for (cv::FileNodeIterator it = aux_channels.begin(); it != aux_channels.end(); ++it) {
+        channel_input_aux_stereo.emplace_back(YamlToString(*it));
+      }
       parser.GetParam("expect_shm_images", &expect_shm_images);
+      parser.GetParam("image_lcm_thread", &image_lcm_thread);
+      parser.GetParam("rectify_images", &rectify_images);
+      if (rectify_images) {
+        YamlToRawStereoRig(parser.GetNode("/shared/stereo_forward_raw"), raw_stereo_rig);
+      }
 
       channel_input_imu = YamlToString(parser.GetNode("channel_input_imu"));
+      parser.GetParam("imu_batched", &imu_batched);
+      channel_input_imu_batch = YamlToString(parser.GetNode("channel_input_imu_batch"));
       channel_input_depth = YamlToString(parser.GetNode("channel_input_depth"));
       channel_input_range = YamlToString(parser.GetNode("channel_input_range"));
       channel_input_mag = YamlToString(parser.GetNode("channel_input_mag"));
@@ -96,39 +190,191 @@ class StateEstimatorLcm final {
 
       channel_output_filter_pose = YamlToString(parser.GetNode("channel_output_filter_pose"));
       channel_output_smoother_pose = YamlToString(parser.GetNode("channel_output_smoother_pose"));
+      channel_output_profiler_stats = YamlToString(parser.GetNode("channel_output_profiler_stats"));
+      channel_output_latency_stats = YamlToString(parser.GetNode("channel_output_latency_stats"));
+      channel_output_feature_tracks = YamlToString(parser.GetNode("channel_output_feature_tracks"));
+      parser.GetParam("serve_pose_queries", &serve_pose_queries);
+      channel_input_pose_query = YamlToString(parser.GetNode("channel_input_pose_query"));
+      channel_output_pose_query_result = YamlToString(parser.GetNode("channel_output_pose_query_result"));
+      parser.GetParam("publish_feature_tracks", &publish_feature_tracks);
 
       parser.GetParam("visualize", &visualize);
+      parser.GetParam("publish_viz", &publish_viz);
+      channel_output_viz = YamlToString(parser.GetNode("channel_output_viz"));
+      parser.GetParam("show_debug_windows", &show_debug_windows);
+      parser.GetParam("publish_debug_images", &publish_debug_images);
+      channel_output_debug_images = YamlToString(parser.GetNode("channel_output_debug_images"));
+      parser.GetParam("debug_image_hz", &debug_image_hz);
+      parser.GetParam("debug_image_jpeg_quality", &debug_image_jpeg_quality);
       parser.GetParam("filter_publish_hz", &filter_publish_hz);
+      parser.GetParam("smoother_publish_hz", &smoother_publish_hz);
+      parser.GetParam("profiler_publish_hz", &profiler_publish_hz);
+      parser.GetParam("hot_reload_params", &hot_reload_params);
+      parser.GetParam("hot_reload_poll_sec", &hot_reload_poll_sec);
+      parser.GetParam("resume_from_checkpoint", &resume_from_checkpoint);
+      parser.GetParam("checkpoint_max_age_sec", &checkpoint_max_age_sec);
 
       state_estimator_params = StateEstimator::Params(parser.Subtree("StateEstimator"));
+      CHECK_EQ(channel_input_aux_stereo.size(), state_estimator_params.aux_stereo_rigs.size())
+          << "Need one channel_input_aux_stereo for each StateEstimator aux_stereo_rigs" << std::endl;
       visualizer3d_params = Visualizer3D::Params(parser.Subtree("Visualizer3D"));
+      viz_publisher_params = VizPublisher::Params(parser.Subtree("VizPublisher"));
+      YamlToTaskScheduler(parser.GetNode("TaskScheduler"), scheduler_params);
     }
   };
 
-  StateEstimatorLcm(const Params& params)
+  // The params filepaths are only needed for hot_reload_params.
+  StateEstimatorLcm(const Params& params,
+                    const std::string& params_filepath = "",
+                    const std::string& shared_params_filepath = "")
       : params_(params),
         state_estimator_(params.state_estimator_params),
         viz_(params.visualizer3d_params),
-        filter_subsampler_(params.filter_publish_hz),
-        image_sub_(lcm_, params_.channel_input_stereo, params_.expect_shm_images)
+        publisher_("StateEstimatorLcm publisher")
   {
     if (!lcm_.good()) {
       LOG(WARNING) << "Failed to initialize LCM" << std::endl;
       return;
     }
 
+    DebugViewer::Instance().SetShowWindows(params_.show_debug_windows);
+    if (params_.publish_debug_images) {
+      debug_image_pub_.reset(new DebugImagePublisher(
+          lcm_, params_.channel_output_debug_images, params_.debug_image_hz, params_.debug_image_jpeg_quality));
+      DebugViewer::Instance().RegisterFrameCallback(std::bind(
+          &DebugImagePublisher::Publish, debug_image_pub_.get(), std::placeholders::_1, std::placeholders::_2));
+      LOG(INFO) << "Will publish debug images on: " << params_.channel_output_debug_images << "/*" << std::endl;
+    }
+
+    if (params_.publish_viz) {
+      viz_pub_.reset(new VizPublisher(lcm_, params_.channel_output_viz, params_.viz_publisher_params));
+    }
+
+    filter_channel_ = publisher_.AddChannel<StateStamped>(
+        "filter", params_.filter_publish_hz, std::bind(&StateEstimatorLcm::PublishFilter, this, std::placeholders::_1));
+    smoother_channel_ = publisher_.AddChannel<SmootherResult>(
+        "smoother", params_.smoother_publish_hz, std::bind(&StateEstimatorLcm::PublishSmoother, this, std::placeholders::_1));
+    publisher_.AddPeriodic("stats", params_.profiler_publish_hz, [this]() {
+      PublishProfilerStats(last_filter_timestamp_);
+      PublishLatencyStats(last_filter_timestamp_);
+    });
+
     state_estimator_.RegisterSmootherResultCallback(std::bind(&StateEstimatorLcm::SmootherCallback, this, std::placeholders::_1));
     state_estimator_.RegisterFilterResultCallback(std::bind(&StateEstimatorLcm::FilterCallback, this, std::placeholders::_1));
+    if (params_.publish_feature_tracks) {
+      state_estimator_.RegisterFeatureTracksCallback(std::bind(
+          &StateEstimatorLcm::FeatureTracksCallback, this, std::placeholders::_1, std::placeholders::_2));
+      LOG(INFO) << "Publishing feature tracks on " << params_.channel_output_feature_tracks << std::endl;
+    }
+    if (params_.serve_pose_queries) {
+      lcm_.subscribe(params_.channel_input_pose_query.c_str(), &StateEstimatorLcm::HandlePoseQuery, this);
+      LOG(INFO) << "Answering pose queries from " << params_.channel_input_pose_query << " on "
+                << params_.channel_output_pose_query_result << std::endl;
+    }
 
     lcm_.subscribe(params_.channel_initial_pose.c_str(), &StateEstimatorLcm::InitializeLcm, this);
     LOG(INFO) << "Listening for initial pose on channel: " << params_.channel_initial_pose << std::endl;
 
     // Bind the image subscriber callback directly to the internal state estimator.
-    image_sub_.RegisterCallback(std::bind(&StateEstimator::ReceiveStereo, &state_estimator_, std::placeholders::_1));
+    // NOTE(milo): The subscriber starts a decode thread and maps the image file, so skip it (and
+    // the other disabled sensors) entirely instead of dropping messages in the handlers.
+    if (params_.use_stereo) {
+      if (params_.image_lcm_thread) {
+        image_lcm_.reset(new lcm::LCM());
+        CHECK(image_lcm_->good()) << "Failed to initialize the image LCM" << std::endl;
+      }
+      lcm::LCM& image_lcm = image_lcm_ ? *image_lcm_ : lcm_;
+
+      image_sub_.reset(new ImageSubscriber(image_lcm, params_.channel_input_stereo, params_.expect_shm_images, true));
+      if (params_.rectify_images) {
+        image_sub_->SetRectifier(std::make_shared<StereoRectifier>(
+            params_.raw_stereo_rig, params_.state_estimator_params.stereo_rig));
+      }
+      image_sub_->RegisterCallback(std::bind(&StateEstimator::ReceiveStereo, &state_estimator_, std::placeholders::_1));
+      LOG(INFO) << "Subscribed to " << params_.channel_input_stereo << std::endl;
+
+      for (size_t i = 0; i < params_.channel_input_aux_stereo.size(); ++i) {
+        const std::string& channel = params_.channel_input_aux_stereo.at(i);
+        aux_image_subs_.emplace_back(new ImageSubscriber(image_lcm, channel, params_.expect_shm_images, true));
+        aux_image_subs_.back()->RegisterCallback([this, i](const StereoImage1b& stereo_pair) {
+          state_estimator_.ReceiveAuxStereo(i, stereo_pair);
+        });
+        LOG(INFO) << "Subscribed to " << channel << " (aux stereo rig " << i << ")" << std::endl;
+      }
+
+      if (image_lcm_) {
+        image_lcm_thread_ = std::thread(&StateEstimatorLcm::ImageLcmLoop, this);
+      }
+    }
+
+    if (params_.hot_reload_params) {
+      CHECK(!params_filepath.empty()) << "hot_reload_params needs the params filepath" << std::endl;
+      params_watcher_.reset(new ParamsWatcher(
+          params_filepath, shared_params_filepath,
+          std::bind(&StateEstimatorLcm::ReloadParams, this, std::placeholders::_1),
+          params_.hot_reload_poll_sec));
+      LOG(INFO) << "Watching for params changes in " << params_filepath << std::endl;
+    }
+
+    if (params_.resume_from_checkpoint) {
+      MaybeResumeFromCheckpoint();
+    }
 
     while (!initialized_ && 0 == lcm_.handle());
   }
 
+  // The DebugViewer outlives this node, so stop it from calling into debug_image_pub_.
+  ~StateEstimatorLcm()
+  {
+    publisher_.Stop();
+    is_shutdown_.store(true);
+    if (image_lcm_thread_.joinable()) {
+      image_lcm_thread_.join();
+    }
+    DebugViewer::Instance().ClearFrameCallbacks();
+  }
+
+  // Handles the image channels (only if image_lcm_thread). The timeout is just so that it notices
+  // a shutdown.
+  void ImageLcmLoop()
+  {
+    LOG(INFO) << "Started up ImageLcmLoop() thread" << std::endl;
+    while (!is_shutdown_) {
+      if (image_lcm_->handleTimeout(kImageLcmTimeoutMs) < 0) {
+        LOG(WARNING) << "Image LCM failed to handle messages, exiting" << std::endl;
+        break;
+      }
+    }
+    LOG(INFO) << "ImageLcmLoop() exiting" << std::endl;
+  }
+
+  // Initializes from the checkpoint if there's a recent one. Otherwise, the node waits for an
+  // initial pose as usual.
+  void MaybeResumeFromCheckpoint()
+  {
+    const std::string& path = params_.state_estimator_params.checkpoint_path;
+    EstimatorCheckpoint checkpoint;
+    if (path.empty() || !ReadEstimatorCheckpoint(path, checkpoint)) {
+      LOG(INFO) << "No checkpoint to resume from at: " << path << std::endl;
+      return;
+    }
+
+    const double now_sec = std::chrono::duration<double>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    const double age_sec = now_sec - checkpoint.saved_unix_sec;
+    if (age_sec > params_.checkpoint_max_age_sec) {
+      LOG(WARNING) << "Checkpoint is too old to resume from (" << age_sec << " sec)" << std::endl;
+      return;
+    }
+
+    LOG(INFO) << "Resuming from checkpoint saved " << age_sec << " sec ago" << std::endl;
+    initialized_.store(true);
+
+    // NOTE(milo): Sensor timestamps are wall clock, and the smoother moves t0 up to its first data.
+    state_estimator_.Initialize(now_sec, checkpoint);
+    OnInitialized(checkpoint.smoother_result.world_P_body);
+  }
+
   void InitializeLcm(const lcm::ReceiveBuffer*,
                      const std::string&,
                      const vehicle::pose3_stamped_t* msg)
@@ -153,6 +399,13 @@ class StateEstimatorLcm final {
     LOG(INFO) << "Received initial pose at t=" << t0 << "\n" << world_P_body << std::endl;
 
     state_estimator_.Initialize(ConvertToSeconds(t0), world_P_body);
+    OnInitialized(world_P_body);
+  }
+
+  // Starts the visualizer and subscribes to sensor data once the StateEstimator is initialized.
+  void OnInitialized(const gtsam::Pose3& world_P_body)
+  {
+    publisher_.Start();
 
     if (params_.visualize) {
       LOG(INFO) << "Visualization is ON, setting viewer pose" << std::endl;
@@ -160,17 +413,32 @@ class StateEstimatorLcm final {
       viz_.UpdateBodyPose("T0_world_body", world_P_body.matrix());
       viz_.SetViewerPose(world_P_body.matrix());
     }
+    if (viz_pub_) {
+      viz_pub_->Start();
+    }
 
     LOG(INFO) << "Setting up sensor data subscriptions" << std::endl;
-    lcm_.subscribe(params_.channel_input_imu.c_str(), &StateEstimatorLcm::HandleImu, this);
-    lcm_.subscribe(params_.channel_input_range.c_str(), &StateEstimatorLcm::HandleRange, this);
-    lcm_.subscribe(params_.channel_input_depth.c_str(), &StateEstimatorLcm::HandleDepth, this);
-    lcm_.subscribe(params_.channel_input_mag.c_str(), &StateEstimatorLcm::HandleMag, this);
-    LOG(INFO) << "Subscribed to " << params_.channel_input_stereo << std::endl;
-    LOG(INFO) << "Subscribed to " << params_.channel_input_imu << std::endl;
-    LOG(INFO) << "Subscribed to " << params_.channel_input_range << std::endl;
-    LOG(INFO) << "Subscribed to " << params_.channel_input_depth << std::endl;
-    LOG(INFO) << "Subscribed to " << params_.channel_input_mag << std::endl;
+    if (params_.use_imu && params_.imu_batched) {
+      lcm_.subscribe(params_.channel_input_imu_batch.c_str(), &StateEstimatorLcm::HandleImuBatch, this);
+      LOG(INFO) << "Subscribed to " << params_.channel_input_imu_batch << std::endl;
+    } else if (params_.use_imu) {
+      lcm_.subscribe(params_.channel_input_imu.c_str(), &StateEstimatorLcm::HandleImu, this);
+      LOG(INFO) << "Subscribed to " << params_.channel_input_imu << std::endl;
+    }
+    if (params_.use_range) {
+      lcm_.subscribe(params_.channel_input_range.c_str(), &StateEstimatorLcm::HandleRange, this);
+      LOG(INFO) << "Subscribed to " << params_.channel_input_range << std::endl;
+    }
+    if (params_.use_depth) {
+      lcm_.subscribe(params_.channel_input_depth.c_str(), &StateEstimatorLcm::HandleDepth, this);
+      LOG(INFO) << "Subscribed to " << params_.channel_input_depth << std::endl;
+    }
+    if (params_.use_mag) {
+      lcm_.subscribe(params_.channel_input_mag.c_str(), &StateEstimatorLcm::HandleMag, this);
+      LOG(INFO) << "Subscribed to " << params_.channel_input_mag << std::endl;
+    }
+
+    LOG(INFO) << state_estimator_.Startup().Summary() << std::endl;
   }
 
   // Blocks to keep this node alive.
@@ -181,6 +449,28 @@ class StateEstimatorLcm final {
     while (0 == lcm_.handle() && !is_shutdown_);
   }
 
+  // Called on the ParamsWatcher thread whenever the params files change. Only the tunables are
+  // read, and anything missing or invalid keeps its current value.
+  void ReloadParams(const ParamTree::ConstPtr& tree)
+  {
+    const YamlParser parser(tree);
+
+    float filter_publish_hz = 0;
+    if (parser.TryGetParam("filter_publish_hz", &filter_publish_hz)) {
+      if (filter_publish_hz > 0) {
+        publisher_.SetTargetHz(filter_channel_, filter_publish_hz);
+      } else {
+        LOG(WARNING) << "Ignoring filter_publish_hz=" << filter_publish_hz << ", must be > 0" << std::endl;
+      }
+    }
+
+    if (parser.HasParam("StateEstimator")) {
+      StateEstimator::Tunables tunables = state_estimator_.GetTunables();
+      tunables.Update(parser.Subtree("StateEstimator"));
+      state_estimator_.UpdateTunables(tunables);
+    }
+  }
+
   void HandleImu(const lcm::ReceiveBuffer*,
                  const std::string&,
                  const vehicle::imu_measurement_t* msg)
@@ -191,6 +481,15 @@ class StateEstimatorLcm final {
     state_estimator_.ReceiveImu(std::move(data));
   }
 
+  void HandleImuBatch(const lcm::ReceiveBuffer*,
+                      const std::string&,
+                      const vehicle::imu_measurement_batch_t* msg)
+  {
+    if (!params_.use_imu || msg->num_samples == 0) { return; }
+    decode_imu_measurement_batch_t(*msg, imu_batch_);
+    state_estimator_.ReceiveImuBatch(imu_batch_.data(), imu_batch_.size());
+  }
+
   void HandleDepth(const lcm::ReceiveBuffer*,
                    const std::string&,
                    const vehicle::depth_measurement_t* msg)
@@ -221,8 +520,13 @@ class StateEstimatorLcm final {
     state_estimator_.ReceiveMag(std::move(data));
   }
 
+  // NOTE(milo): Keyposes are still added to the visualizers here, since each one is a new keypose
+  // (rather than a newer version of the last one). Both visualizers just queue them up.
   void SmootherCallback(const SmootherResult& result)
   {
+    latency_stats_.Add("smoother", result.latency);
+    publisher_.Update(smoother_channel_, result);
+
     const core::uid_t cam_id = static_cast<core::uid_t>(result.keypose_id);
     const Matrix3d body_cov_pose = result.cov_pose.block<3, 3>(3, 3);
     const Matrix3d world_R_body = result.world_P_body.rotation().matrix();
@@ -231,7 +535,14 @@ class StateEstimatorLcm final {
     if (params_.visualize) {
       viz_.AddCameraPose(cam_id, Image1b(), result.world_P_body.matrix(), true, std::make_shared<Matrix3d>(world_cov_pose));
     }
+    if (viz_pub_) {
+      viz_pub_->AddOrUpdateKeypose(cam_id, result.world_P_body.matrix(), world_cov_pose);
+    }
+  }
 
+  // Called on the publisher thread.
+  void PublishSmoother(const SmootherResult& result)
+  {
     // Publish pose estimate to LCM.
     vehicle::pose3_stamped_t msg;
     msg.header.timestamp = ConvertToNanoseconds(result.timestamp);
@@ -242,18 +553,56 @@ class StateEstimatorLcm final {
     lcm_.publish(params_.channel_output_smoother_pose, &msg);
   }
 
+  void FeatureTracksCallback(const VoResult& result, const cv::Size& image_size)
+  {
+    // NOTE(milo): Stamped with the image timestamp (not converted), so that subscribers can pair
+    // the tracks with the stereo_image_t they came from.
+    vehicle::feature_tracks_t msg;
+    msg.header.timestamp = result.timestamp;
+    msg.header.seq = static_cast<int64_t>(result.camera_id);
+    msg.header.frame_id = "cam0";
+    pack_feature_tracks_t(result.lmk_obs, image_size.width, image_size.height, msg);
+
+    lcm_.publish(params_.channel_output_feature_tracks, &msg);
+  }
+
+  // NOTE(milo): GetPose() is lock-free, so answering on the LCM thread doesn't delay the IMU.
+  void HandlePoseQuery(const lcm::ReceiveBuffer*,
+                       const std::string&,
+                       const vehicle::pose_query_t* msg)
+  {
+    SE3 world_T_body;
+    const PoseSource source = state_estimator_.GetPose(static_cast<timestamp_t>(msg->header.timestamp), world_T_body);
+
+    vehicle::pose_query_result_t out;
+    out.header = msg->header;
+    out.source = static_cast<int8_t>(source);
+    pack_pose3_t(world_T_body.matrix(), out.pose);
+
+    lcm_.publish(params_.channel_output_pose_query_result, &out);
+  }
+
   void FilterCallback(const StateStamped& ss)
   {
-    // Limit the publishing rate to avoid overwhelming consumers.
-    if (!filter_subsampler_.ShouldSample(ss.timestamp)) {
-      return;
-    }
+    latency_stats_.Add("filter", ss.latency);
+    publisher_.Update(filter_channel_, ss);
+  }
 
-    if (params_.visualize) {
+  // Called on the publisher thread, at most filter_publish_hz.
+  void PublishFilter(const StateStamped& ss)
+  {
+    last_filter_timestamp_ = ss.timestamp;
+
+    if (params_.visualize || viz_pub_) {
       Matrix4d world_T_body = Matrix4d::Identity();
       world_T_body.block<3, 3>(0, 0) = ss.state.q.toRotationMatrix();
       world_T_body.block<3, 1>(0, 3) = ss.state.t;
-      viz_.UpdateBodyPose("body", world_T_body);
+      if (params_.visualize) {
+        viz_.UpdateBodyPose("body", world_T_body);
+      }
+      if (viz_pub_) {
+        viz_pub_->UpdateBodyPose(ConvertToNanoseconds(ss.timestamp), world_T_body);
+      }
     }
 
     // Publish pose estimate to LCM.
@@ -266,18 +615,70 @@ class StateEstimatorLcm final {
     lcm_.publish(params_.channel_output_filter_pose, &msg);
   }
 
+  // Publish latency percentiles for every MACRO_PROFILE_SCOPE span. Nothing is recorded (and
+  // nothing is published) unless the build has BM_ENABLE_PROFILING.
+  void PublishProfilerStats(seconds_t timestamp)
+  {
+    const std::vector<ProfileSummary> summaries = Profiler::Instance().Summarize();
+    if (summaries.empty()) {
+      return;
+    }
+
+    vehicle::profiler_stats_t msg;
+    msg.header.timestamp = ConvertToNanoseconds(timestamp);
+    msg.header.seq = -1;
+    msg.header.frame_id = "";
+    pack_profiler_stats_t(summaries, msg);
+
+    lcm_.publish(params_.channel_output_profiler_stats, &msg);
+  }
+
+  // Publish histograms of receive-to-output latency for each stage, since the last publish.
+  void PublishLatencyStats(seconds_t timestamp)
+  {
+    const std::vector<LatencyStageSummary> summaries = latency_stats_.Summarize();
+    if (summaries.empty()) {
+      return;
+    }
+
+    vehicle::latency_stats_t msg;
+    msg.header.timestamp = ConvertToNanoseconds(timestamp);
+    msg.header.seq = -1;
+    msg.header.frame_id = "";
+    pack_latency_stats_t(summaries, msg);
+
+    lcm_.publish(params_.channel_output_latency_stats, &msg);
+  }
+
  private:
   std::atomic_bool is_shutdown_{false};
   std::atomic_bool initialized_{false};
 
+  static constexpr int kImageLcmTimeoutMs = 100;
+
   Params params_;
-  lcm::LCM lcm_;
+  lcm::LCM lcm_;                              // Everything except images (if image_lcm_thread).
+  std::unique_ptr<lcm::LCM> image_lcm_;       // Only if use_stereo and image_lcm_thread.
   StateEstimator state_estimator_;
   Visualizer3D viz_;
 
-  DataSubsampler filter_subsampler_;
+  PipelineLatencyStats latency_stats_;
+  ImuMeasurementVec imu_batch_;               // Reused by HandleImuBatch().
+
+  std::unique_ptr<ImageSubscriber> image_sub_;   // Only if use_stereo is set.
+  std::unique_ptr<DebugImagePublisher> debug_image_pub_;
+  std::unique_ptr<VizPublisher> viz_pub_;     // Only if publish_viz is set.
+  std::vector<std::unique_ptr<ImageSubscriber>> aux_image_subs_;
+  std::thread image_lcm_thread_;
+
+  // Publishes the filter and smoother poses and the stats (see PublishFilter() and PublishSmoother()).
+  PublishScheduler publisher_;
+  PublishScheduler::ChannelId filter_channel_ = 0;
+  PublishScheduler::ChannelId smoother_channel_ = 0;
+  seconds_t last_filter_timestamp_ = 0;       // Only used on the publisher thread.
 
-  ImageSubscriber image_sub_;
+  // NOTE(milo): Declared last, so that it's stopped before anything its callback uses is destroyed.
+  std::unique_ptr<ParamsWatcher> params_watcher_;
 };
 
 
@@ -294,11 +695,20 @@ int main(int argc, char const *argv[])
   std::string node_params_path = std::string(argv[1]);
   const std::string shared_params_path = std::string(argv[2]);
 
-  StateEstimatorLcm::Params params(
-    config_path(node_params_path),
-    config_path(shared_params_path));
+  StartupProfile startup("StateEstimatorLcm");
+
+  const std::string params_filepath = config_path(node_params_path);
+  const std::string shared_params_filepath = config_path(shared_params_path);
+  StateEstimatorLcm::Params params;
+  startup.Time("params", [&]() { params = StateEstimatorLcm::Params(params_filepath, shared_params_filepath); });
+
+  TaskScheduler::Configure(params.scheduler_params);
+
+  // NOTE(milo): This blocks until the initial pose arrives.
+  StateEstimatorLcm node(params, params_filepath, shared_params_filepath);
+  startup.Mark("initialized");
+  LOG(INFO) << startup.Summary() << std::endl;
 
-  StateEstimatorLcm node(params);
   node.Spin();
 
   LOG(INFO) << "DONE" << std::endl;
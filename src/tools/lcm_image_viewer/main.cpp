@@ -1,4 +1,5 @@
-#include <fstream>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 
 #include <glog/logging.h>
@@ -10,6 +11,7 @@
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 
+#include "core/data_subsampler.hpp"
 #include "core/timestamp.hpp"
 #include "vehicle/image_t.hpp"
 #include "vehicle/stereo_image_t.hpp"
@@ -25,9 +27,32 @@ static const cv::Scalar kColorRed = cv::Scalar(0, 0, 255);
 static const double kTextScale = 0.8;
 
 
+// Shows stereo images from an LCM channel. For a preview over a slow link (or on a weak machine),
+// images can be decoded at 1/scale of their size, and frames above max_hz are dropped before they
+// are decoded. With use_opengl, the windows are drawn by OpenGL (if OpenCV was built with it), so
+// that scaling them up for display happens on the GPU.
 class LcmImageViewer final {
  public:
-  LcmImageViewer() {}
+  LcmImageViewer(int scale, double max_hz, bool use_opengl)
+      : scale_(scale),
+        max_hz_(max_hz),
+        subsampler_(max_hz > 0 ? max_hz : 1.0)
+  {
+    CHECK(scale == 1 || scale == 2 || scale == 4 || scale == 8) << "Scale must be 1, 2, 4 or 8" << std::endl;
+
+    int flags = cv::WINDOW_AUTOSIZE;
+    if (use_opengl) {
+      flags = cv::WINDOW_OPENGL | cv::WINDOW_NORMAL;
+    }
+    try {
+      cv::namedWindow("LEFT", flags);
+      cv::namedWindow("RIGHT", flags);
+    } catch (const cv::Exception& e) {
+      LOG(WARNING) << "Could not create OpenGL windows, falling back to normal ones: " << e.what() << std::endl;
+      cv::namedWindow("LEFT", cv::WINDOW_AUTOSIZE);
+      cv::namedWindow("RIGHT", cv::WINDOW_AUTOSIZE);
+    }
+  }
 
   void HandleMmfStereo(const lcm::ReceiveBuffer*,
                        const std::string&,
@@ -36,48 +61,35 @@ class LcmImageViewer final {
     CHECK_EQ(msg->img_left.mm_filename, msg->img_right.mm_filename)
         << "Expected same memory-mapped file names for left and right images" << std::endl;
 
+    if (!ShouldShow()) {
+      return;
+    }
+
     const std::string mm_filename = msg->img_left.mm_filename;
 
     if (mapped_file_.get_name() != mm_filename) {
       LOG(INFO) << "Opening memory-mapped file for the first time: " << mm_filename << std::endl;
       mapped_file_ = ipc::file_mapping(mm_filename.c_str(), ipc::read_only);
       mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_only);
-      fbuf_.open(mm_filename, std::ios_base::in | std::ios_base::binary);
     }
 
     CHECK_EQ(mm_filename, mapped_file_.get_name());
-    CHECK(fbuf_.is_open()) << "File buffer was not open" << std::endl;
 
-    // Read raw char buffers for both images.
-    const int offl = msg->img_left.offset;
-    const int szl = msg->img_left.size;
+    // Decode straight out of the mapped region, instead of copying each image out of the file first.
+    const uint8_t* left_data = RegionData(msg->img_left);
+    const uint8_t* right_data = RegionData(msg->img_right);
 
-    if (offl < 0 || szl <= 0) {
-      LOG(WARNING) << "Got a data buffer for the left image with negative offset or zero size" << std::endl;
+    if (left_data == nullptr || right_data == nullptr) {
+      LOG(WARNING) << "Got an image buffer that is empty or outside of the memory-mapped file" << std::endl;
       return;
     }
 
-    lbuf_.resize(szl);
-    fbuf_.pubseekpos(offl);
-    fbuf_.sgetn(&lbuf_[0], std::streamsize(szl));
-
-    const int offr = msg->img_right.offset;
-    const int szr = msg->img_right.size;
-
-    if (offr < 0 || szr <= 0) {
-      LOG(WARNING) << "Got a data buffer for the right image with negative offset or zero size" << std::endl;
+    if (!bm::DecodeReduced(msg->img_left, left_data, scale_, left_) ||
+        !bm::DecodeReduced(msg->img_right, right_data, scale_, right_)) {
+      LOG(WARNING) << "Problem decoding images, or they were overwritten while decoding" << std::endl;
       return;
     }
 
-    rbuf_.resize(szr);
-    fbuf_.pubseekpos(offr);
-    fbuf_.sgetn(&rbuf_[0], std::streamsize(szr));
-
-    // Decode the data into images.
-    // https://stackoverflow.com/questions/4254615/how-to-cast-vectorunsigned-char-to-char
-    bm::DecodeJPG(msg->img_left, reinterpret_cast<uint8_t*>(lbuf_.data()), left_);
-    bm::DecodeJPG(msg->img_right, reinterpret_cast<uint8_t*>(rbuf_.data()), right_);
-
     ShowImagePair(msg->header.timestamp);
   }
 
@@ -88,6 +100,10 @@ class LcmImageViewer final {
     CHECK_EQ(msg->img_left.encoding, msg->img_right.encoding)
         << "Left and right images have different encodings!" << std::endl;
 
+    if (!ShouldShow()) {
+      return;
+    }
+
     const std::string encoding = msg->img_left.encoding;
     const std::string format = msg->img_left.format;
 
@@ -109,6 +125,11 @@ class LcmImageViewer final {
         return;
       }
 
+      if (scale_ > 1) {
+        cv::resize(left_, left_, cv::Size(left_.cols / scale_, left_.rows / scale_), 0, 0, cv::INTER_AREA);
+        cv::resize(right_, right_, cv::Size(right_.cols / scale_, right_.rows / scale_), 0, 0, cv::INTER_AREA);
+      }
+
       ShowImagePair(msg->header.timestamp);
 
     } else {
@@ -133,19 +154,43 @@ class LcmImageViewer final {
 
     cv::imshow("LEFT", left_);
     cv::imshow("RIGHT", right_);
-    cv::waitKey(5);
+    cv::waitKey(1);
   }
 
  private:
+  // Drop frames above max_hz_ (by wall time, so that it also works for replayed logs).
+  bool ShouldShow()
+  {
+    if (max_hz_ <= 0) {
+      return true;
+    }
+    const double now = std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return subsampler_.ShouldSample(now);
+  }
+
+  // Pointer to an image in the mapped region, or nullptr if it doesn't fit inside it.
+  const uint8_t* RegionData(const vehicle::mmf_image_t& img) const
+  {
+    if (img.offset < 0 || img.size <= 0) {
+      return nullptr;
+    }
+    if (static_cast<size_t>(img.offset) + static_cast<size_t>(img.size) > mapped_region_.get_size()) {
+      return nullptr;
+    }
+    return static_cast<const uint8_t*>(mapped_region_.get_address()) + img.offset;
+  }
+
+ private:
+  int scale_;
+  double max_hz_;
+  core::DataSubsampler subsampler_;
+
   cv::Mat left_;
   cv::Mat right_;
 
   ipc::file_mapping mapped_file_;
   ipc::mapped_region mapped_region_;
-
-  // https://stackoverflow.com/questions/604431/c-reading-unsigned-char-from-file-stream
-  std::basic_filebuf<char> fbuf_;
-  std::vector<char> lbuf_, rbuf_;
 };
 
 
@@ -157,13 +202,23 @@ int main(int argc, char const *argv[])
 
   LOG(INFO) << "Starting lcm_image_viewer" << std::endl;
 
-  if (argc != 2) {
-    LOG(WARNING) << "Expected 1 argument, make sure to pass in the LCM channel name. Exiting." << std::endl;
+  if (argc < 2 || argc > 5) {
+    LOG(WARNING) << "Usage: lcm_image_viewer <channel> [scale=1|2|4|8] [max_hz=0 (all frames)] [opengl=0|1]. Exiting." << std::endl;
     return 0;
   }
 
   const std::string lcm_channel(argv[1]);
-  LOG(INFO) << "Listening on channel " << lcm_channel << std::endl;
+  const int scale = (argc > 2) ? std::atoi(argv[2]) : 1;
+  const double max_hz = (argc > 3) ? std::atof(argv[3]) : 0.0;
+  const bool use_opengl = (argc > 4) ? (std::atoi(argv[4]) != 0) : false;
+
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+    LOG(WARNING) << "Scale must be 1, 2, 4 or 8. Exiting." << std::endl;
+    return 0;
+  }
+
+  LOG(INFO) << "Listening on channel " << lcm_channel << " (scale=1/" << scale << " max_hz=" << max_hz
+            << " opengl=" << use_opengl << ")" << std::endl;
 
   lcm::LCM lcm;
 
@@ -172,7 +227,7 @@ int main(int argc, char const *argv[])
     return 1;
   }
 
-  LcmImageViewer viewer;
+  LcmImageViewer viewer(scale, max_hz, use_opengl);
 
   // lcm.subscribe(lcm_channel, &LcmImageViewer::HandleStereo, &viewer);
   lcm.subscribe(lcm_channel, &LcmImageViewer::HandleMmfStereo, &viewer);
@@ -0,0 +1,168 @@
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/eigen_types.hpp"
+#include "core/path_util.hpp"
+#include "core/uid.hpp"
+#include "params/params_base.hpp"
+#include "mesher/mesh_codec.hpp"
+#include "vio/visualizer_3d.hpp"
+
+#include "lcm_util/util_mesh_delta_t.hpp"
+#include "lcm_util/util_pose3_t.hpp"
+
+#include "vehicle/mesh_delta_t.hpp"
+#include "vehicle/viz_update_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// Draws what a StateEstimatorLcm (with publish_viz) and an ObjectMesherLcm (with publish_mesh_delta)
+// stream from the vehicle, in a Visualizer3D on the topside machine.
+class LcmVizViewer final {
+ public:
+  struct Params : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    std::string channel_input_viz;
+    std::string channel_input_mesh_delta;    // Leave empty to not draw the mesh.
+
+    Visualizer3D::Params visualizer3d_params;
+
+   private:
+    void LoadParams(const YamlParser& parser) override
+    {
+      channel_input_viz = YamlToString(parser.GetNode("channel_input_viz"));
+      channel_input_mesh_delta = YamlToString(parser.GetNode("channel_input_mesh_delta"));
+      visualizer3d_params = Visualizer3D::Params(parser.Subtree("Visualizer3D"));
+    }
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(LcmVizViewer)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(LcmVizViewer)
+
+  explicit LcmVizViewer(const Params& params) : viz_(params.visualizer3d_params) {}
+
+  void Start() { viz_.Start(); }
+
+  void HandleVizUpdate(const lcm::ReceiveBuffer*,
+                       const std::string&,
+                       const vehicle::viz_update_t* msg)
+  {
+    if (last_seq_ >= 0 && msg->header.seq != last_seq_ + 1) {
+      LOG(WARNING) << "Missed " << (msg->header.seq - last_seq_ - 1) << " viz updates, "
+                   << "they'll be filled in by the next full resend" << std::endl;
+    }
+    last_seq_ = msg->header.seq;
+
+    if (msg->has_body_pose) {
+      Matrix4d world_T_body;
+      decode_pose3_t(msg->world_T_body, world_T_body);
+      viz_.UpdateBodyPose("body", world_T_body);
+      if (!has_viewer_pose_) {
+        viz_.SetViewerPose(world_T_body);
+        has_viewer_pose_ = true;
+      }
+    }
+
+    for (int32_t i = 0; i < msg->num_keyposes; ++i) {
+      const uid_t keypose_id = static_cast<uid_t>(msg->keypose_ids[i]);
+      Matrix4d world_T_keypose;
+      decode_pose3_t(msg->world_T_keyposes[i], world_T_keypose);
+
+      // NOTE(milo): Keyposes that were already drawn (e.g resent, or moved by the smoother) can only
+      // be moved. Their covariance isn't redrawn.
+      if (keypose_ids_.count(keypose_id) != 0) {
+        viz_.UpdateCameraPose(keypose_id, world_T_keypose);
+        continue;
+      }
+
+      const std::vector<float>& c = msg->cov_position[i];
+      Cov3Ptr position_cov;
+      if (c[0] > 0 || c[3] > 0 || c[5] > 0) {
+        position_cov = std::make_shared<Matrix3d>();
+        *position_cov << c[0], c[1], c[2],
+                         c[1], c[3], c[4],
+                         c[2], c[4], c[5];
+      }
+      viz_.AddCameraPose(keypose_id, Image1b(), world_T_keypose, true, position_cov);
+      keypose_ids_.insert(keypose_id);
+    }
+
+    if (msg->num_landmarks > 0) {
+      std::vector<uid_t> lmk_ids(msg->num_landmarks);
+      std::vector<Vector3d> t_world_lmks(msg->num_landmarks);
+      for (int32_t i = 0; i < msg->num_landmarks; ++i) {
+        lmk_ids[i] = static_cast<uid_t>(msg->lmk_ids[i]);
+        t_world_lmks[i] = Vector3d(msg->t_world_lmks[i][0], msg->t_world_lmks[i][1], msg->t_world_lmks[i][2]);
+      }
+      viz_.AddOrUpdateLandmark(lmk_ids, t_world_lmks);
+    }
+  }
+
+  void HandleMeshDelta(const lcm::ReceiveBuffer*,
+                       const std::string&,
+                       const vehicle::mesh_delta_t* msg)
+  {
+    mesher::MeshDelta delta;
+    decode_mesh_delta_t(*msg, delta);
+    if (!mesh_decoder_.Apply(delta)) {
+      LOG_EVERY_N(WARNING, 10) << "Missed a mesh delta, waiting for the next full mesh" << std::endl;
+      return;
+    }
+    viz_.UpdateMesh(mesh_decoder_.Mesh().vertices, mesh_decoder_.Mesh().triangles);
+  }
+
+ private:
+  Visualizer3D viz_;
+
+  int64_t last_seq_ = -1;
+  bool has_viewer_pose_ = false;
+  std::unordered_set<uid_t> keypose_ids_;
+  mesher::MeshDecoder mesh_decoder_;
+};
+
+
+// Usage: lcm_viz_viewer <shared_params_path>, relative to vehicle/config (e.g shared/Farmsim.yaml).
+// The camera in the shared params is only used to draw frustums.
+int main(int argc, char const *argv[])
+{
+  // Set up glog.
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  CHECK_EQ(2ul, argc) << "Requires (1) arg: shared_params_path, relative to vehicle/config" << std::endl;
+
+  const LcmVizViewer::Params params(
+      tools_path("lcm_viz_viewer/config/LcmVizViewer.yaml"),
+      config_path(std::string(argv[1])));
+
+  lcm::LCM lcm;
+  if (!lcm.good()) {
+    LOG(WARNING) << "LCM could not be initialized. Exiting." << std::endl;
+    return 1;
+  }
+
+  LcmVizViewer viewer(params);
+  viewer.Start();
+
+  lcm.subscribe(params.channel_input_viz, &LcmVizViewer::HandleVizUpdate, &viewer);
+  LOG(INFO) << "Listening for viz updates on " << params.channel_input_viz << std::endl;
+
+  if (!params.channel_input_mesh_delta.empty()) {
+    lcm.subscribe(params.channel_input_mesh_delta, &LcmVizViewer::HandleMeshDelta, &viewer);
+    LOG(INFO) << "Listening for mesh deltas on " << params.channel_input_mesh_delta << std::endl;
+  }
+
+  // Keep running until we exit.
+  while (0 == lcm.handle());
+  return 0;
+}
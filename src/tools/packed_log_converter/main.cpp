@@ -0,0 +1,39 @@
+#include <glog/logging.h>
+
+#include "dataset/euroc_dataset.hpp"
+#include "dataset/packed_log.hpp"
+
+using namespace bm;
+
+
+// Converts a EuRoC folder (e.g one written by EurocDataWriter) to a packed log.
+// Usage: packed_log_converter <euroc_folder> <log_path> [png|jpeg|raw]
+int main(int argc, char const *argv[])
+{
+  // Set up glog.
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  if (argc < 3) {
+    LOG(FATAL) << "Usage: packed_log_converter <euroc_folder> <log_path> [png|jpeg|raw]" << std::endl;
+  }
+
+  const std::string euroc_folder(argv[1]);
+  const std::string log_path(argv[2]);
+  const std::string encoding_str = (argc > 3) ? std::string(argv[3]) : "png";
+
+  dataset::PackedImageEncoding encoding = dataset::PackedImageEncoding::PNG;
+  if (encoding_str == "jpeg") {
+    encoding = dataset::PackedImageEncoding::JPEG;
+  } else if (encoding_str == "raw") {
+    encoding = dataset::PackedImageEncoding::RAW;
+  } else if (encoding_str != "png") {
+    LOG(FATAL) << "Unknown image encoding: " << encoding_str << std::endl;
+  }
+
+  LOG(INFO) << "Converting " << euroc_folder << " to " << log_path << " (" << encoding_str << ")" << std::endl;
+  const dataset::EurocDataset dataset(euroc_folder);
+  dataset::ConvertToPackedLog(dataset, log_path, encoding);
+
+  return 0;
+}
@@ -0,0 +1,331 @@
+#include <glog/logging.h>
+
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "core/timer.hpp"
+#include "core/file_utils.hpp"
+#include "core/path_util.hpp"
+#include "core/profiler.hpp"
+#include "dataset/dataset_util.hpp"
+#include "dataset/trajectory_error.hpp"
+#include "vio/state_estimator.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// One dataset/config combination to evaluate.
+struct BatchEvalJob : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(BatchEvalJob);
+  std::string name;
+  dataset::Dataset dataset = dataset::Dataset::FARMSIM;
+  std::string folder;
+  std::string subfolder;
+  std::string state_estimator_config;   // Absolute, or relative to src/tools.
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    name = YamlToString(parser.GetNode("name"));
+    dataset = YamlToEnum<dataset::Dataset>(parser.GetNode("dataset"));
+    folder = YamlToString(parser.GetNode("folder"));
+    subfolder = YamlToString(parser.GetNode("subfolder"));
+    state_estimator_config = YamlToString(parser.GetNode("state_estimator_config"));
+  }
+};
+
+
+struct VioBatchEvalParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(VioBatchEvalParams);
+  std::string output_folder = "/tmp/vio_batch_eval";
+  int max_parallel_jobs = 4;
+  bool pin_cpus = true;
+  bool lockstep = true;
+  float playback_speed = -1.0;
+  int prefetch_threads = 1;
+  bool use_stereo = true;
+  bool use_imu = true;
+  bool use_depth = true;
+  bool use_range = true;
+  double rpe_delta_sec = 1.0;
+  double max_time_offset_sec = 0.05;
+  bool align_trajectory = true;
+  std::vector<BatchEvalJob> jobs;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    output_folder = YamlToString(parser.GetNode("output_folder"));
+    parser.GetParam("max_parallel_jobs", &max_parallel_jobs);
+    parser.GetParam("pin_cpus", &pin_cpus);
+    parser.GetParam("lockstep", &lockstep);
+    parser.GetParam("playback_speed", &playback_speed);
+    parser.GetParam("prefetch_threads", &prefetch_threads);
+    parser.GetParam("use_stereo", &use_stereo);
+    parser.GetParam("use_imu", &use_imu);
+    parser.GetParam("use_depth", &use_depth);
+    parser.GetParam("use_range", &use_range);
+    parser.GetParam("rpe_delta_sec", &rpe_delta_sec);
+    parser.GetParam("max_time_offset_sec", &max_time_offset_sec);
+    parser.GetParam("align_trajectory", &align_trajectory);
+
+    const cv::FileNode& jobs_node = parser.GetNode("jobs");
+    CHECK(jobs_node.isSeq()) << "jobs must be a YAML list" << std::endl;
+    for (cv::FileNodeIterator it = jobs_node.begin(); it != jobs_node.end(); ++it) {
+      jobs.emplace_back(BatchEvalJob(*it));
+    }
+  }
+};
+
+
+static std::string ResolveToolsPath(const std::string& path)
+{
+  return (!path.empty() && path.front() == '/') ? path : tools_path(path);
+}
+
+
+static void WriteTrajectoryError(std::ostream& out, const dataset::TrajectoryError& err)
+{
+  out << "{\"num_poses\":" << err.num_poses
+      << ",\"ate_rmse\":" << err.ate_rmse
+      << ",\"ate_mean\":" << err.ate_mean
+      << ",\"ate_max\":" << err.ate_max
+      << ",\"num_rpe_pairs\":" << err.num_rpe_pairs
+      << ",\"rpe_trans_rmse\":" << err.rpe_trans_rmse
+      << ",\"rpe_rot_rmse\":" << err.rpe_rot_rmse << "}";
+}
+
+
+// Pin this process (and every thread that it starts) to its share of the CPUs.
+static void PinToCpuSlot(int slot, int num_slots)
+{
+  const int num_cpus = static_cast<int>(std::thread::hardware_concurrency());
+  const int cpus_per_slot = std::max(1, num_cpus / num_slots);
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (int i = 0; i < cpus_per_slot; ++i) {
+    CPU_SET((slot * cpus_per_slot + i) % num_cpus, &cpus);
+  }
+
+  if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) != 0) {
+    LOG(WARNING) << "Could not pin job to CPU slot " << slot << std::endl;
+  }
+}
+
+
+// Runs one job to completion, and writes its results (as a JSON object) to result_path. This runs
+// in its own process, so that jobs can't share any global state (e.g the Profiler).
+static int RunJob(const VioBatchEvalParams& app_params,
+                  const BatchEvalJob& job,
+                  const std::string& result_path)
+{
+  std::string shared_params_path;
+  dataset::DataProvider dataset = dataset::GetDatasetByName(
+      job.dataset, job.folder, job.subfolder, shared_params_path);
+  dataset.SetImagePrefetch(app_params.prefetch_threads);
+
+  const std::vector<dataset::GroundtruthItem>& groundtruth_poses = dataset.GroundtruthPoses();
+  CHECK(!groundtruth_poses.empty()) << "No groundtruth poses found for job " << job.name << std::endl;
+
+  StateEstimator::Params params(ResolveToolsPath(job.state_estimator_config), shared_params_path);
+  params.lockstep = app_params.lockstep;
+  params.show_feature_tracks = false;   // Headless.
+  StateEstimator state_estimator(params);
+
+  // NOTE(milo): Each of these is only written by one thread (smoother or filter), and only read
+  // after the StateEstimator has shut down.
+  std::vector<dataset::GroundtruthItem> smoother_poses, filter_poses;
+
+  state_estimator.RegisterSmootherResultCallback([&smoother_poses](const SmootherResult& result)
+  {
+    smoother_poses.emplace_back(ConvertToNanoseconds(result.timestamp), result.world_P_body.matrix());
+  });
+
+  state_estimator.RegisterFilterResultCallback([&filter_poses](const StateStamped& ss)
+  {
+    Matrix4d world_T_body = Matrix4d::Identity();
+    world_T_body.block<3, 3>(0, 0) = ss.state.q.toRotationMatrix();
+    world_T_body.block<3, 1>(0, 3) = ss.state.t;
+    filter_poses.emplace_back(ConvertToNanoseconds(ss.timestamp), world_T_body);
+  });
+
+  if (app_params.use_stereo)
+    dataset.RegisterStereoCallback(std::bind(&StateEstimator::ReceiveStereo, &state_estimator, std::placeholders::_1));
+  if (app_params.use_imu)
+    dataset.RegisterImuCallback(std::bind(&StateEstimator::ReceiveImu, &state_estimator, std::placeholders::_1));
+  if (app_params.use_depth)
+    dataset.RegisterDepthCallback(std::bind(&StateEstimator::ReceiveDepth, &state_estimator, std::placeholders::_1));
+  if (app_params.use_range)
+    dataset.RegisterRangeCallback(std::bind(&StateEstimator::ReceiveRange, &state_estimator, std::placeholders::_1));
+
+  Timer timer(true);
+  state_estimator.Initialize(ConvertToSeconds(dataset.FirstTimestamp()), gtsam::Pose3(dataset.InitialPose()));
+  dataset.Playback(app_params.playback_speed, false);
+  state_estimator.BlockUntilFinished();
+  state_estimator.Shutdown();
+  const double wall_sec = timer.Elapsed().seconds();
+
+  // NOTE(milo): The filter can rewind when it syncs with the smoother, so its results aren't
+  // always in order. Sort both trajectories to be safe.
+  const auto by_time = [](const dataset::GroundtruthItem& a, const dataset::GroundtruthItem& b) {
+    return a.timestamp < b.timestamp;
+  };
+  std::stable_sort(smoother_poses.begin(), smoother_poses.end(), by_time);
+  std::stable_sort(filter_poses.begin(), filter_poses.end(), by_time);
+
+  const dataset::TrajectoryError smoother_err = dataset::ComputeTrajectoryError(
+      groundtruth_poses, smoother_poses, app_params.rpe_delta_sec,
+      app_params.max_time_offset_sec, app_params.align_trajectory);
+  const dataset::TrajectoryError filter_err = dataset::ComputeTrajectoryError(
+      groundtruth_poses, filter_poses, app_params.rpe_delta_sec,
+      app_params.max_time_offset_sec, app_params.align_trajectory);
+
+  const seconds_t data_sec = ConvertToSeconds(groundtruth_poses.back().timestamp) -
+                             ConvertToSeconds(dataset.FirstTimestamp());
+
+  std::ofstream out(result_path.c_str());
+  if (!out.is_open()) {
+    LOG(WARNING) << "Could not open result file: " << result_path << std::endl;
+    return 1;
+  }
+
+  out << "{\"name\":\"" << job.name << "\""
+      << ",\"folder\":\"" << job.folder << "\""
+      << ",\"state_estimator_config\":\"" << job.state_estimator_config << "\""
+      << ",\"wall_sec\":" << wall_sec
+      << ",\"data_sec\":" << data_sec
+      << ",\"smoother\":";
+  WriteTrajectoryError(out, smoother_err);
+  out << ",\"filter\":";
+  WriteTrajectoryError(out, filter_err);
+
+  // Per-stage latencies are only recorded in builds with BM_ENABLE_PROFILING.
+  out << ",\"stages\":[";
+  const std::vector<ProfileSummary> summaries = Profiler::Instance().Summarize();
+  for (size_t i = 0; i < summaries.size(); ++i) {
+    const ProfileSummary& s = summaries.at(i);
+    out << "{\"name\":\"" << s.name << "\",\"count\":" << s.count
+        << ",\"p50_ms\":" << s.p50_ms << ",\"p95_ms\":" << s.p95_ms
+        << ",\"p99_ms\":" << s.p99_ms << ",\"max_ms\":" << s.max_ms << "}"
+        << ((i + 1) < summaries.size() ? "," : "");
+  }
+  out << "]}";
+
+  out.close();
+  return out.fail() ? 1 : 0;
+}
+
+
+static std::string ReadFile(const std::string& path)
+{
+  std::ifstream in(path.c_str());
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+
+// Runs every job in its own process, at most max_parallel_jobs at a time, then writes all of the
+// job results into summary.json in the output folder.
+int main(int argc, char const *argv[])
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  const std::string config_path = (argc > 1) ? std::string(argv[1]) :
+      tools_path("vio_batch_eval/config/VioBatchEval.yaml");
+  const VioBatchEvalParams app_params(config_path);
+  CHECK(!app_params.jobs.empty()) << "No jobs in " << config_path << std::endl;
+  CHECK_GT(app_params.max_parallel_jobs, 0);
+
+  mkdir(app_params.output_folder, true);
+
+  std::vector<std::string> result_paths;
+  for (const BatchEvalJob& job : app_params.jobs) {
+    result_paths.emplace_back(Join(app_params.output_folder, job.name + ".json"));
+  }
+
+  std::unordered_map<pid_t, size_t> running;    // pid => job index
+  std::unordered_map<pid_t, int> running_slot;  // pid => cpu slot
+  std::vector<int> exit_codes(app_params.jobs.size(), -1);
+  std::vector<bool> slot_in_use(app_params.max_parallel_jobs, false);
+
+  size_t next_job = 0;
+  while (next_job < app_params.jobs.size() || !running.empty()) {
+    // Start jobs until all of the slots are full.
+    while (next_job < app_params.jobs.size() && (int)running.size() < app_params.max_parallel_jobs) {
+      const int slot = static_cast<int>(std::find(slot_in_use.begin(), slot_in_use.end(), false) - slot_in_use.begin());
+      const BatchEvalJob& job = app_params.jobs.at(next_job);
+
+      const pid_t pid = fork();
+      CHECK_GE(pid, 0) << "fork() failed" << std::endl;
+
+      if (pid == 0) {
+        if (app_params.pin_cpus) {
+          PinToCpuSlot(slot, app_params.max_parallel_jobs);
+        }
+        _exit(RunJob(app_params, job, result_paths.at(next_job)));
+      }
+
+      LOG(INFO) << "Started job " << job.name << " (pid=" << pid << " slot=" << slot << ")" << std::endl;
+      running.emplace(pid, next_job);
+      running_slot.emplace(pid, slot);
+      slot_in_use.at(slot) = true;
+      ++next_job;
+    }
+
+    // Wait for any job to finish.
+    int status = 0;
+    const pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0 || running.count(pid) == 0) {
+      continue;
+    }
+
+    const size_t job_idx = running.at(pid);
+    exit_codes.at(job_idx) = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    LOG(INFO) << "Finished job " << app_params.jobs.at(job_idx).name
+              << " (exit code " << exit_codes.at(job_idx) << ")" << std::endl;
+
+    slot_in_use.at(running_slot.at(pid)) = false;
+    running.erase(pid);
+    running_slot.erase(pid);
+  }
+
+  // Jobs that crashed (e.g CHECK failures) show up with ok=false and no results.
+  const std::string summary_path = Join(app_params.output_folder, "summary.json");
+  std::ofstream out(summary_path.c_str());
+  CHECK(out.is_open()) << "Could not open summary file: " << summary_path << std::endl;
+
+  int num_failed = 0;
+  out << "{\"config\":\"" << config_path << "\",\"jobs\":[\n";
+  for (size_t i = 0; i < app_params.jobs.size(); ++i) {
+    const bool ok = exit_codes.at(i) == 0 && Exists(result_paths.at(i));
+    num_failed += ok ? 0 : 1;
+    out << "{\"ok\":" << (ok ? "true" : "false")
+        << ",\"exit_code\":" << exit_codes.at(i)
+        << ",\"result\":" << (ok ? ReadFile(result_paths.at(i)) : "null") << "}"
+        << ((i + 1) < app_params.jobs.size() ? ",\n" : "\n");
+  }
+  out << "]}\n";
+  out.close();
+
+  LOG(INFO) << "Wrote " << summary_path << " (" << num_failed << " failed)" << std::endl;
+
+  return (num_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include <glog/logging.h>
+
+#include <fstream>
+#include <iomanip>
+
+#include "core/path_util.hpp"
+#include "params/params_base.hpp"
+#include "vio/batch_smoother.hpp"
+#include "vio/smoother_log.hpp"
+#include "vio/state_estimator.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+struct VioBatchReprocessParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(VioBatchReprocessParams);
+  std::string smoother_log_path;
+  std::string output_path = "/tmp/vio_batch_reprocess.csv";
+  std::string state_estimator_config;   // Absolute, or relative to src/tools.
+  std::string shared_config;            // Absolute, or relative to config/.
+  BatchSmoother::Params batch_smoother_params;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    smoother_log_path = YamlToString(parser.GetNode("smoother_log_path"));
+    output_path = YamlToString(parser.GetNode("output_path"));
+    state_estimator_config = YamlToString(parser.GetNode("state_estimator_config"));
+    shared_config = YamlToString(parser.GetNode("shared_config"));
+    batch_smoother_params = BatchSmoother::Params(parser.Subtree("BatchSmoother"));
+  }
+};
+
+
+static bool IsAbsolute(const std::string& path)
+{
+  return !path.empty() && path.front() == '/';
+}
+
+
+// Re-solves a dive from a smoother log as one batch problem, and writes out the trajectory.
+// Usage: vio_batch_reprocess [config_path]
+int main(int argc, char const *argv[])
+{
+  // Set up glog.
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  const std::string config_path = (argc > 1) ? std::string(argv[1]) :
+      tools_path("vio_batch_reprocess/config/VioBatchReprocess.yaml");
+  const VioBatchReprocessParams app_params(config_path);
+
+  const std::string se_config = IsAbsolute(app_params.state_estimator_config) ?
+      app_params.state_estimator_config : tools_path(app_params.state_estimator_config);
+  const std::string shared_config = IsAbsolute(app_params.shared_config) ?
+      app_params.shared_config : core::config_path(app_params.shared_config);
+  const StateEstimator::Params se_params(se_config, shared_config);
+
+  BatchSmoother::Params params = app_params.batch_smoother_params;
+  params.smoother_params = se_params.smoother_params;
+  params.imu_manager_params = se_params.imu_manager_params;
+  params.allowed_misalignment_imu = se_params.allowed_misalignment_imu;
+
+  SmootherLog log;
+  CHECK(ReadSmootherLog(app_params.smoother_log_path, log)) << "Could not read " << app_params.smoother_log_path << std::endl;
+  LOG(INFO) << "Read " << log.keyposes.size() << " keyposes and " << log.imu.size() << " IMU measurements" << std::endl;
+
+  BatchSmoother smoother(params);
+  smoother.Build(log);
+  const std::vector<SmootherResult> trajectory = smoother.Solve();
+
+  std::ofstream out(app_params.output_path.c_str());
+  CHECK(out.is_open()) << "Could not open file: " << app_params.output_path << std::endl;
+  out << "#timestamp [ns],p_x [m],p_y [m],p_z [m],q_w [],q_x [],q_y [],q_z [],v_x [m s^-1],v_y [m s^-1],v_z [m s^-1]\n";
+  out << std::setprecision(9);
+
+  for (const SmootherResult& r : trajectory) {
+    const gtsam::Point3& t = r.world_P_body.translation();
+    const gtsam::Quaternion q = r.world_P_body.rotation().toQuaternion();
+    out << ConvertToNanoseconds(r.timestamp) << ","
+        << t.x() << "," << t.y() << "," << t.z() << ","
+        << q.w() << "," << q.x() << "," << q.y() << "," << q.z() << ","
+        << r.world_v_body.x() << "," << r.world_v_body.y() << "," << r.world_v_body.z() << "\n";
+  }
+
+  const BatchSmoother::Stats& stats = smoother.GetStats();
+  LOG(INFO) << "Wrote " << trajectory.size() << " poses to " << app_params.output_path
+            << " (error " << stats.initial_error << " ==> " << stats.final_error << ")" << std::endl;
+
+  return 0;
+}
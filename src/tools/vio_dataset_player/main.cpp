@@ -2,6 +2,7 @@
 
 #include <lcm/lcm-cpp.hpp>
 
+#include <algorithm>
 #include <utility>
 #include <unordered_map>
 
@@ -12,10 +13,11 @@
 #include "params/params_base.hpp"
 #include "vision_core/pinhole_camera.hpp"
 #include "vision_core/stereo_camera.hpp"
-#include "core/timer.hpp"
 #include "core/uid.hpp"
 #include "core/file_utils.hpp"
 #include "core/path_util.hpp"
+#include "core/profiler.hpp"
+#include "core/publish_scheduler.hpp"
 #include "dataset/dataset_util.hpp"
 #include "vio/state_estimator.hpp"
 #include "vio/visualizer_3d.hpp"
@@ -43,7 +45,15 @@ struct VioDatasetPlayerParams : public ParamsBase
   bool pause = false;
   bool visualize = true;
   float playback_speed = 4.0;
+  double start_sec = 0.0;
+  double end_sec = 0.0;
+  int prefetch_threads = 0;
+  int prefetch_max_images = 16;
+  float prefetch_max_mb = 512.0;
   float filter_publish_hz = 50.0;
+  float smoother_publish_hz = 0.0;
+  std::string profiler_trace_path;
+  TaskScheduler::Params scheduler_params;
 
  private:
   void LoadParams(const YamlParser& parser) override
@@ -58,6 +68,15 @@ struct VioDatasetPlayerParams : public ParamsBase
     parser.GetParam("pause", &pause);
     parser.GetParam("visualize", &visualize);
     parser.GetParam("playback_speed", &playback_speed);
+    parser.GetParam("start_sec", &start_sec);
+    parser.GetParam("end_sec", &end_sec);
+    parser.GetParam("prefetch_threads", &prefetch_threads);
+    parser.GetParam("prefetch_max_images", &prefetch_max_images);
+    parser.GetParam("prefetch_max_mb", &prefetch_max_mb);
+    parser.GetParam("filter_publish_hz", &filter_publish_hz);
+    parser.GetParam("smoother_publish_hz", &smoother_publish_hz);
+    profiler_trace_path = YamlToString(parser.GetNode("profiler_trace_path"));
+    YamlToTaskScheduler(parser.GetNode("TaskScheduler"), scheduler_params);
   }
 };
 
@@ -73,12 +92,19 @@ void Run()
   VioDatasetPlayerParams app_params(
       tools_path("vio_dataset_player/config/VioDatasetPlayer.yaml"));
 
+  // NOTE(milo): Has to happen before anything below submits work to the scheduler.
+  TaskScheduler::Configure(app_params.scheduler_params);
+
   std::string shared_params_path;
   dataset::DataProvider dataset = dataset::GetDatasetByName(
       app_params.dataset, app_params.folder, app_params.subfolder, shared_params_path);
+  dataset.SetImagePrefetch(app_params.prefetch_threads,
+                           app_params.prefetch_max_images,
+                           app_params.prefetch_max_mb);
 
   const std::vector<dataset::GroundtruthItem>& groundtruth_poses = dataset.GroundtruthPoses();
-  CHECK(!groundtruth_poses.empty()) << "No groundtruth poses found" << std::endl;
+  // NOTE(milo): Field logs (LCM_LOG) don't have groundtruth, so they start from the identity.
+  LOG_IF(WARNING, groundtruth_poses.empty()) << "No groundtruth poses found" << std::endl;
 
   StateEstimator::Params params(
       tools_path("vio_dataset_player/config/StateEstimator.yaml"),
@@ -90,15 +116,11 @@ void Run()
       shared_params_path);
   Visualizer3D viz(viz_params);
 
-  SmootherResult::Callback smoother_callback = [&](const SmootherResult& result)
-  {
-    const core::uid_t cam_id = static_cast<core::uid_t>(result.keypose_id);
-    const Matrix3d body_cov_pose = result.cov_pose.block<3, 3>(3, 3);
-    const Matrix3d world_R_body = result.world_P_body.rotation().matrix();
-    const Matrix3d world_cov_pose = world_R_body * body_cov_pose * world_R_body.transpose();
-    viz.AddCameraPose(cam_id, Image1b(), result.world_P_body.matrix(), true, std::make_shared<Matrix3d>(world_cov_pose));
+  // Poses are published to LCM from the scheduler's thread, never inside the estimator's callbacks.
+  PublishScheduler publisher("VioDatasetPlayer publisher");
 
-    // Publish pose estimate to LCM.
+  SmootherResult::Callback publish_smoother = [&](const SmootherResult& result)
+  {
     vehicle::pose3_stamped_t msg;
     msg.header.timestamp = ConvertToNanoseconds(result.timestamp);
     msg.header.seq = -1;
@@ -108,20 +130,13 @@ void Run()
     lcm.publish("vio/smoother/world_P_body", &msg);
   };
 
-  Timer filter_publish_timer(true);
-  StateStamped::Callback filter_callback = [&](const StateStamped& ss)
+  StateStamped::Callback publish_filter = [&](const StateStamped& ss)
   {
-    // Limit the publishing rate to avoid overwhelming consumers.
-    if (filter_publish_timer.Elapsed().seconds() < (1.0 / app_params.filter_publish_hz)) {
-      return;
-    }
-
     Matrix4d world_T_body = Matrix4d::Identity();
     world_T_body.block<3, 3>(0, 0) = ss.state.q.toRotationMatrix();
     world_T_body.block<3, 1>(0, 3) = ss.state.t;
     viz.UpdateBodyPose("imu0", world_T_body);
 
-    // Publish pose estimate to LCM.
     vehicle::pose3_stamped_t msg;
     msg.header.timestamp = ConvertToNanoseconds(ss.timestamp);
     msg.header.seq = -1;
@@ -129,11 +144,33 @@ void Run()
     pack_pose3_t(ss.state.q, ss.state.t, msg.pose);
 
     lcm.publish("vio/filter/world_P_body", &msg);
-    filter_publish_timer.Reset();
   };
 
-  for (size_t i = 0; i < groundtruth_poses.size(); ++i) {
-    viz.AddGroundtruthPose(i, groundtruth_poses.at(i).world_T_body);
+  const PublishScheduler::ChannelId smoother_channel = publisher.AddChannel<SmootherResult>(
+      "smoother", app_params.smoother_publish_hz, publish_smoother);
+  const PublishScheduler::ChannelId filter_channel = publisher.AddChannel<StateStamped>(
+      "filter", app_params.filter_publish_hz, publish_filter);
+
+  // NOTE(milo): Every keypose goes to the visualizer (it just queues them up), only the latest is
+  // published.
+  SmootherResult::Callback smoother_callback = [&](const SmootherResult& result)
+  {
+    const core::uid_t cam_id = static_cast<core::uid_t>(result.keypose_id);
+    const Matrix3d body_cov_pose = result.cov_pose.block<3, 3>(3, 3);
+    const Matrix3d world_R_body = result.world_P_body.rotation().matrix();
+    const Matrix3d world_cov_pose = world_R_body * body_cov_pose * world_R_body.transpose();
+    viz.AddCameraPose(cam_id, Image1b(), result.world_P_body.matrix(), true, std::make_shared<Matrix3d>(world_cov_pose));
+
+    publisher.Update(smoother_channel, result);
+  };
+
+  StateStamped::Callback filter_callback = [&](const StateStamped& ss)
+  {
+    publisher.Update(filter_channel, ss);
+  };
+
+  for (const dataset::GroundtruthItem& item : groundtruth_poses) {
+    viz.AddGroundtruthPose(item.world_T_body);
   }
 
   state_estimator.RegisterSmootherResultCallback(smoother_callback);
@@ -148,20 +185,40 @@ void Run()
   if (app_params.use_range)
     dataset.RegisterRangeCallback(std::bind(&StateEstimator::ReceiveRange, &state_estimator, std::placeholders::_1));
 
-  gtsam::Pose3 P0_world_body(dataset.InitialPose());
-  state_estimator.Initialize(ConvertToSeconds(dataset.FirstTimestamp()), P0_world_body);
+  // Playback can start part way into the dataset, from the groundtruth pose there.
+  const timestamp_t t_first = dataset.FirstTimestamp();
+  const timestamp_t t_start = t_first + ConvertToNanoseconds(std::max(0.0, app_params.start_sec));
+  const timestamp_t t_end = (app_params.end_sec > 0) ? t_first + ConvertToNanoseconds(app_params.end_sec) : kMaxTimestamp;
+
+  Matrix4d world_T_body0 = dataset.InitialPose();
+  if (t_start > t_first) {
+    CHECK(dataset.GroundtruthPose(t_start, world_T_body0))
+        << "No groundtruth pose at start_sec=" << app_params.start_sec << std::endl;
+    LOG(INFO) << "Starting playback " << app_params.start_sec << " sec into the dataset" << std::endl;
+  }
+
+  gtsam::Pose3 P0_world_body(world_T_body0);
+  state_estimator.Initialize(ConvertToSeconds(t_start), P0_world_body);
 
   viz.Start();
+  publisher.Start();
   viz.UpdateBodyPose("T0_world_body", P0_world_body.matrix());
   viz.SetViewerPose(P0_world_body.matrix());
 
   if (app_params.pause) {
     viz.BlockUntilKeypress(); // Start playback with a keypress.
   }
-  dataset.Playback(app_params.playback_speed, false);
+  dataset.Playback(t_start, t_end, app_params.playback_speed, false);
 
   state_estimator.BlockUntilFinished();
   state_estimator.Shutdown();
+  publisher.Stop();
+
+#ifdef BM_ENABLE_PROFILING
+  if (Profiler::Instance().ExportChromeTrace(app_params.profiler_trace_path)) {
+    LOG(INFO) << "Wrote profiler trace to " << app_params.profiler_trace_path << std::endl;
+  }
+#endif
 
   LOG(INFO) << "DONE" << std::endl;
 }
@@ -0,0 +1,667 @@
+#include <glog/logging.h>
+
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "core/file_utils.hpp"
+#include "core/path_util.hpp"
+#include "dataset/dataset_util.hpp"
+#include "dataset/trajectory_error.hpp"
+#include "vio/state_estimator.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// A reference dataset that configs are scored on.
+struct TunerDataset : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(TunerDataset);
+  std::string name;
+  dataset::Dataset dataset = dataset::Dataset::FARMSIM;
+  std::string folder;
+  std::string subfolder;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    name = YamlToString(parser.GetNode("name"));
+    dataset = YamlToEnum<dataset::Dataset>(parser.GetNode("dataset"));
+    folder = YamlToString(parser.GetNode("folder"));
+    subfolder = YamlToString(parser.GetNode("subfolder"));
+  }
+};
+
+
+// One parameter to search over, by its path in the StateEstimator config.
+struct TunerParam : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(TunerParam);
+  std::string key;                    // e.g "StereoFrontend/StereoTracker/retrack_frames_k"
+  std::vector<std::string> values;    // Candidate values, written into the YAML as is.
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    key = YamlToString(parser.GetNode("key"));
+
+    const cv::FileNode& values_node = parser.GetNode("values");
+    CHECK(values_node.isSeq()) << "values must be a YAML list: " << key << std::endl;
+    for (cv::FileNodeIterator it = values_node.begin(); it != values_node.end(); ++it) {
+      std::stringstream ss;
+      if ((*it).isInt()) {
+        ss << (int)*it;
+      } else if ((*it).isReal()) {
+        ss << (double)*it;
+      } else {
+        ss << YamlToString(*it);
+      }
+      values.emplace_back(ss.str());
+    }
+    CHECK(!values.empty()) << "No candidate values for " << key << std::endl;
+  }
+};
+
+
+struct VioParamTunerParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(VioParamTunerParams);
+  std::string output_folder = "/tmp/vio_param_tuner";
+  std::string state_estimator_config;   // Absolute, or relative to src/tools.
+  int num_configs = 27;                 // Sampled at random (plus the base config).
+  int eta = 3;                          // Keep the best 1/eta of the configs after each rung.
+  int seed = 0;
+
+  // Target hardware profile: each job gets cpus_per_job CPUs (pinned), which should match the
+  // number of cores the vehicle's compute module gives the StateEstimator.
+  int cpus_per_job = 4;
+  int max_parallel_jobs = 4;
+  double latency_budget_ms = 50.0;      // p95 frontend latency (keyframes) that a config must meet.
+
+  float playback_speed = 1.0;           // Real-time, so that latency means what it does on the vehicle.
+  int prefetch_threads = 1;
+  bool use_imu = true;
+  bool use_depth = true;
+  bool use_range = true;
+  double rpe_delta_sec = 1.0;
+  double max_time_offset_sec = 0.05;
+  bool align_trajectory = true;
+
+  std::vector<TunerParam> search_space;
+  std::vector<TunerDataset> datasets;   // Rung i adds datasets[i], so put the cheapest one first.
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    output_folder = YamlToString(parser.GetNode("output_folder"));
+    state_estimator_config = YamlToString(parser.GetNode("state_estimator_config"));
+    parser.GetParam("num_configs", &num_configs);
+    parser.GetParam("eta", &eta);
+    parser.GetParam("seed", &seed);
+    parser.GetParam("cpus_per_job", &cpus_per_job);
+    parser.GetParam("max_parallel_jobs", &max_parallel_jobs);
+    parser.GetParam("latency_budget_ms", &latency_budget_ms);
+    parser.GetParam("playback_speed", &playback_speed);
+    parser.GetParam("prefetch_threads", &prefetch_threads);
+    parser.GetParam("use_imu", &use_imu);
+    parser.GetParam("use_depth", &use_depth);
+    parser.GetParam("use_range", &use_range);
+    parser.GetParam("rpe_delta_sec", &rpe_delta_sec);
+    parser.GetParam("max_time_offset_sec", &max_time_offset_sec);
+    parser.GetParam("align_trajectory", &align_trajectory);
+
+    const cv::FileNode& space_node = parser.GetNode("search_space");
+    CHECK(space_node.isSeq()) << "search_space must be a YAML list" << std::endl;
+    for (cv::FileNodeIterator it = space_node.begin(); it != space_node.end(); ++it) {
+      search_space.emplace_back(TunerParam(*it));
+    }
+
+    const cv::FileNode& datasets_node = parser.GetNode("datasets");
+    CHECK(datasets_node.isSeq()) << "datasets must be a YAML list" << std::endl;
+    for (cv::FileNodeIterator it = datasets_node.begin(); it != datasets_node.end(); ++it) {
+      datasets.emplace_back(TunerDataset(*it));
+    }
+
+    CHECK(!search_space.empty() && !datasets.empty()) << "Need a search space and datasets" << std::endl;
+    CHECK_GT(num_configs, 0);
+    CHECK_GE(eta, 2);
+    CHECK_GT(cpus_per_job, 0);
+    CHECK_GT(max_parallel_jobs, 0);
+  }
+};
+
+
+// A config is the index of a value for each parameter in the search space (-1 = the base value).
+typedef std::vector<int> Choice;
+
+
+// How a config did on one dataset.
+struct TunerScore final
+{
+  bool ok = false;
+  double ate_rmse = 0;
+  double p95_ms = 0;
+  int num_keyposes = 0;
+};
+
+
+// How a config did on all of the datasets that it was run on so far.
+struct TunerCandidate final
+{
+  Choice choice;
+  std::string config_path;
+  std::vector<TunerScore> scores;   // One per dataset, in rung order.
+
+  bool Ok() const
+  {
+    return !scores.empty() && std::all_of(scores.begin(), scores.end(),
+        [](const TunerScore& s) { return s.ok; });
+  }
+
+  // Mean ATE and worst p95 latency over the datasets, so that a config only meets the budget if it
+  // meets it everywhere.
+  double Ate() const
+  {
+    double sum = 0;
+    for (const TunerScore& s : scores) { sum += s.ate_rmse; }
+    return scores.empty() ? 0 : sum / scores.size();
+  }
+
+  double P95Ms() const
+  {
+    double worst = 0;
+    for (const TunerScore& s : scores) { worst = std::max(worst, s.p95_ms); }
+    return worst;
+  }
+};
+
+
+static std::string ResolveToolsPath(const std::string& path)
+{
+  return (!path.empty() && path.front() == '/') ? path : tools_path(path);
+}
+
+
+static std::string Trim(const std::string& s)
+{
+  const size_t begin = s.find_first_not_of(" \t");
+  const size_t end = s.find_last_not_of(" \t\r");
+  return (begin == std::string::npos) ? std::string() : s.substr(begin, end - begin + 1);
+}
+
+
+// Replaces the value at key_path (e.g "StereoFrontend/StereoTracker/retrack_frames_k") in the lines
+// of a YAML file, keeping its indentation and trailing comment. Nesting is found from indentation,
+// which is how every config in this repo is written (block style, no inline maps for params).
+// Returns false if the key isn't in the file.
+static bool SetYamlValue(std::vector<std::string>& lines,
+                         const std::string& key_path,
+                         const std::string& value)
+{
+  std::vector<std::pair<size_t, std::string>> parents;   // (indent, key) of enclosing maps.
+
+  for (std::string& line : lines) {
+    const std::string trimmed = Trim(line);
+    if (trimmed.empty() || trimmed.front() == '#' || trimmed.front() == '%' ||
+        trimmed.front() == '-' || trimmed == "---") {
+      continue;
+    }
+
+    const size_t colon = trimmed.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+
+    const size_t indent = line.find_first_not_of(' ');
+    while (!parents.empty() && parents.back().first >= indent) {
+      parents.pop_back();
+    }
+
+    const std::string key = Trim(trimmed.substr(0, colon));
+    std::string rest = trimmed.substr(colon + 1);
+    const size_t hash = rest.find('#');
+    const std::string comment = (hash == std::string::npos) ? "" : rest.substr(hash);
+    rest = Trim((hash == std::string::npos) ? rest : rest.substr(0, hash));
+
+    std::string path;
+    for (const auto& parent : parents) {
+      path += parent.second + "/";
+    }
+    path += key;
+
+    if (rest.empty()) {
+      parents.emplace_back(indent, key);
+    } else if (path == key_path) {
+      line = std::string(indent, ' ') + key + ": " + value + (comment.empty() ? "" : "  " + comment);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static std::vector<std::string> ReadLines(const std::string& path)
+{
+  std::ifstream in(path.c_str());
+  CHECK(in.is_open()) << "Could not open " << path << std::endl;
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(in, line)) {
+    lines.emplace_back(line);
+  }
+  return lines;
+}
+
+
+// Writes the base config with the chosen values substituted in. The output is a complete config
+// (not an overlay), so the best ones can be copied onto the vehicle as they are.
+static void WriteConfig(const VioParamTunerParams& app_params,
+                        const std::vector<std::string>& base_lines,
+                        const Choice& choice,
+                        const std::string& path)
+{
+  std::vector<std::string> lines = base_lines;
+  for (size_t i = 0; i < choice.size(); ++i) {
+    if (choice.at(i) < 0) {
+      continue;
+    }
+    const TunerParam& param = app_params.search_space.at(i);
+    CHECK(SetYamlValue(lines, param.key, param.values.at(choice.at(i))))
+        << "Param " << param.key << " isn't in " << app_params.state_estimator_config << std::endl;
+  }
+
+  std::ofstream out(path.c_str());
+  CHECK(out.is_open()) << "Could not open " << path << std::endl;
+  for (const std::string& line : lines) {
+    out << line << "\n";
+  }
+}
+
+
+static double Percentile(std::vector<double> values, double p)
+{
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values.at(std::min(values.size() - 1, (size_t)(p * values.size())));
+}
+
+
+// Pin this process (and every thread that it starts) to cpus_per_job CPUs of its own.
+static void PinToCpuSlot(int slot, int cpus_per_job)
+{
+  const int num_cpus = static_cast<int>(std::thread::hardware_concurrency());
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (int i = 0; i < cpus_per_job; ++i) {
+    CPU_SET((slot * cpus_per_job + i) % num_cpus, &cpus);
+  }
+
+  if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) != 0) {
+    LOG(WARNING) << "Could not pin job to CPU slot " << slot << std::endl;
+  }
+}
+
+
+// Runs one config on one dataset, and writes "ate_rmse p95_ms num_keyposes" to result_path. This
+// runs in its own process, like the jobs in vio_batch_eval.
+//
+// NOTE(milo): Latency is the frontend time (dequeued -> processed) of each keyframe, which comes
+// back with the smoother results. Keyframes are the slowest frames (they detect and stereo match
+// new features), so their p95 is the tail that matters for a budget, and this doesn't need a build
+// with BM_ENABLE_PROFILING.
+static int RunJob(const VioParamTunerParams& app_params,
+                  const TunerDataset& job,
+                  const std::string& config_path,
+                  const std::string& result_path)
+{
+  std::string shared_params_path;
+  dataset::DataProvider dataset = dataset::GetDatasetByName(
+      job.dataset, job.folder, job.subfolder, shared_params_path);
+  dataset.SetImagePrefetch(app_params.prefetch_threads);
+
+  const std::vector<dataset::GroundtruthItem>& groundtruth_poses = dataset.GroundtruthPoses();
+  CHECK(!groundtruth_poses.empty()) << "No groundtruth poses found for " << job.name << std::endl;
+
+  StateEstimator::Params params(config_path, shared_params_path);
+  params.lockstep = false;              // Lockstep would hide the latency that we're measuring.
+  params.show_feature_tracks = false;   // Headless.
+  StateEstimator state_estimator(params);
+
+  // NOTE(milo): Only written by the smoother thread, and only read after shutdown.
+  std::vector<dataset::GroundtruthItem> smoother_poses;
+  std::vector<double> frontend_ms;
+
+  state_estimator.RegisterSmootherResultCallback([&](const SmootherResult& result)
+  {
+    smoother_poses.emplace_back(ConvertToNanoseconds(result.timestamp), result.world_P_body.matrix());
+    if (result.latency.valid && result.latency.frontend_ms > 0) {
+      frontend_ms.emplace_back(result.latency.frontend_ms);
+    }
+  });
+
+  dataset.RegisterStereoCallback(std::bind(&StateEstimator::ReceiveStereo, &state_estimator, std::placeholders::_1));
+  if (app_params.use_imu)
+    dataset.RegisterImuCallback(std::bind(&StateEstimator::ReceiveImu, &state_estimator, std::placeholders::_1));
+  if (app_params.use_depth)
+    dataset.RegisterDepthCallback(std::bind(&StateEstimator::ReceiveDepth, &state_estimator, std::placeholders::_1));
+  if (app_params.use_range)
+    dataset.RegisterRangeCallback(std::bind(&StateEstimator::ReceiveRange, &state_estimator, std::placeholders::_1));
+
+  state_estimator.Initialize(ConvertToSeconds(dataset.FirstTimestamp()), gtsam::Pose3(dataset.InitialPose()));
+  dataset.Playback(app_params.playback_speed, false);
+  state_estimator.BlockUntilFinished();
+  state_estimator.Shutdown();
+
+  std::stable_sort(smoother_poses.begin(), smoother_poses.end(),
+      [](const dataset::GroundtruthItem& a, const dataset::GroundtruthItem& b) {
+    return a.timestamp < b.timestamp;
+  });
+
+  const dataset::TrajectoryError err = dataset::ComputeTrajectoryError(
+      groundtruth_poses, smoother_poses, app_params.rpe_delta_sec,
+      app_params.max_time_offset_sec, app_params.align_trajectory);
+
+  if (err.num_poses == 0) {
+    LOG(WARNING) << "No poses matched groundtruth for " << job.name << std::endl;
+    return 1;
+  }
+
+  std::ofstream out(result_path.c_str());
+  if (!out.is_open()) {
+    LOG(WARNING) << "Could not open result file: " << result_path << std::endl;
+    return 1;
+  }
+  out << err.ate_rmse << " " << Percentile(frontend_ms, 0.95) << " " << smoother_poses.size() << "\n";
+  out.close();
+  return out.fail() ? 1 : 0;
+}
+
+
+// Runs every candidate in "which" on dataset d (each in its own process, at most max_parallel_jobs
+// at a time), and appends their scores.
+static void RunRung(const VioParamTunerParams& app_params,
+                    size_t d,
+                    const std::vector<size_t>& which,
+                    std::vector<TunerCandidate>& candidates)
+{
+  const TunerDataset& job = app_params.datasets.at(d);
+
+  std::vector<std::string> result_paths;
+  for (size_t c : which) {
+    result_paths.emplace_back(Join(app_params.output_folder,
+        "results/config_" + std::to_string(c) + "_" + job.name + ".txt"));
+  }
+
+  std::unordered_map<pid_t, size_t> running;    // pid => index into which
+  std::unordered_map<pid_t, int> running_slot;  // pid => cpu slot
+  std::vector<bool> slot_in_use(app_params.max_parallel_jobs, false);
+  std::vector<int> exit_codes(which.size(), -1);
+
+  size_t next = 0;
+  while (next < which.size() || !running.empty()) {
+    while (next < which.size() && (int)running.size() < app_params.max_parallel_jobs) {
+      const int slot = static_cast<int>(std::find(slot_in_use.begin(), slot_in_use.end(), false) - slot_in_use.begin());
+      const TunerCandidate& candidate = candidates.at(which.at(next));
+
+      const pid_t pid = fork();
+      CHECK_GE(pid, 0) << "fork() failed" << std::endl;
+
+      if (pid == 0) {
+        PinToCpuSlot(slot, app_params.cpus_per_job);
+        _exit(RunJob(app_params, job, candidate.config_path, result_paths.at(next)));
+      }
+
+      running.emplace(pid, next);
+      running_slot.emplace(pid, slot);
+      slot_in_use.at(slot) = true;
+      ++next;
+    }
+
+    int status = 0;
+    const pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0 || running.count(pid) == 0) {
+      continue;
+    }
+
+    exit_codes.at(running.at(pid)) = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    slot_in_use.at(running_slot.at(pid)) = false;
+    running.erase(pid);
+    running_slot.erase(pid);
+  }
+
+  // Configs that crash (e.g CHECK failures) or lose track get a failed score, and are dropped.
+  for (size_t i = 0; i < which.size(); ++i) {
+    TunerScore score;
+    std::ifstream in(result_paths.at(i).c_str());
+    if (exit_codes.at(i) == 0 && in.is_open()) {
+      in >> score.ate_rmse >> score.p95_ms >> score.num_keyposes;
+      score.ok = !in.fail();
+    }
+    candidates.at(which.at(i)).scores.emplace_back(score);
+  }
+}
+
+
+// Non-dominated sorting on (ATE, p95 latency): rank 0 is the Pareto front, rank 1 is the front once
+// rank 0 is removed, and so on. Configs over the latency budget are ranked after all of the ones
+// within it, so that tuning spends its runs on configs that could be used.
+static std::vector<int> ParetoRanks(const VioParamTunerParams& app_params,
+                                    const std::vector<TunerCandidate>& candidates,
+                                    const std::vector<size_t>& which)
+{
+  const auto dominates = [&](size_t a, size_t b) {
+    const TunerCandidate& ca = candidates.at(a);
+    const TunerCandidate& cb = candidates.at(b);
+    const bool a_fits = ca.P95Ms() <= app_params.latency_budget_ms;
+    const bool b_fits = cb.P95Ms() <= app_params.latency_budget_ms;
+    if (a_fits != b_fits) {
+      return a_fits;
+    }
+    return ca.Ate() <= cb.Ate() && ca.P95Ms() <= cb.P95Ms() &&
+           (ca.Ate() < cb.Ate() || ca.P95Ms() < cb.P95Ms());
+  };
+
+  std::vector<int> ranks(which.size(), -1);
+  int rank = 0;
+  size_t num_ranked = 0;
+  while (num_ranked < which.size()) {
+    std::vector<size_t> front;
+    for (size_t i = 0; i < which.size(); ++i) {
+      if (ranks.at(i) >= 0) {
+        continue;
+      }
+      bool dominated = false;
+      for (size_t j = 0; j < which.size() && !dominated; ++j) {
+        dominated = (j != i) && ranks.at(j) < 0 && dominates(which.at(j), which.at(i));
+      }
+      if (!dominated) {
+        front.emplace_back(i);
+      }
+    }
+    for (size_t i : front) {
+      ranks.at(i) = rank;
+    }
+    num_ranked += front.size();
+    ++rank;
+  }
+
+  return ranks;
+}
+
+
+static void WriteCandidate(std::ostream& out,
+                           const VioParamTunerParams& app_params,
+                           const TunerCandidate& candidate,
+                           size_t index)
+{
+  out << "{\"config\":" << index
+      << ",\"path\":\"" << candidate.config_path << "\""
+      << ",\"ok\":" << (candidate.Ok() ? "true" : "false")
+      << ",\"num_datasets\":" << candidate.scores.size()
+      << ",\"ate_rmse\":" << candidate.Ate()
+      << ",\"p95_ms\":" << candidate.P95Ms()
+      << ",\"within_budget\":" << (candidate.P95Ms() <= app_params.latency_budget_ms ? "true" : "false")
+      << ",\"params\":{";
+  for (size_t i = 0; i < candidate.choice.size(); ++i) {
+    const TunerParam& param = app_params.search_space.at(i);
+    const int v = candidate.choice.at(i);
+    out << "\"" << param.key << "\":\"" << ((v < 0) ? "base" : param.values.at(v)) << "\""
+        << ((i + 1) < candidate.choice.size() ? "," : "");
+  }
+  out << "}}";
+}
+
+
+// Searches the parameters in the config's search_space with successive halving: every candidate is
+// run on the first dataset, the best 1/eta of them (by Pareto rank on ATE and p95 latency, then ATE)
+// go on to the next dataset, and so on. The Pareto front of the configs that survive every dataset
+// is copied into <output_folder>/pareto, and summary.json has the scores of every config.
+int main(int argc, char const *argv[])
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  const std::string config_path = (argc > 1) ? std::string(argv[1]) :
+      tools_path("vio_param_tuner/config/VioParamTuner.yaml");
+  const VioParamTunerParams app_params(config_path);
+
+  const int num_cpus = static_cast<int>(std::thread::hardware_concurrency());
+  CHECK_LE(app_params.cpus_per_job * app_params.max_parallel_jobs, num_cpus)
+      << "Jobs would share CPUs, which skews their latency" << std::endl;
+
+  mkdir(app_params.output_folder, true);
+  mkdir(Join(app_params.output_folder, "configs"), true);
+  mkdir(Join(app_params.output_folder, "results"), true);
+  mkdir(Join(app_params.output_folder, "pareto"), true);
+
+  const std::string base_path = ResolveToolsPath(app_params.state_estimator_config);
+  const std::vector<std::string> base_lines = ReadLines(base_path);
+
+  // The base config is always candidate 0, so that the tuned ones can be compared against it.
+  std::vector<TunerCandidate> candidates(1);
+  candidates.front().choice = Choice(app_params.search_space.size(), -1);
+
+  // Sample distinct configs. Duplicates are skipped, so a small search space can end up with fewer.
+  std::mt19937 rng(app_params.seed);
+  std::set<Choice> seen;
+  for (int attempt = 0; attempt < 100 * app_params.num_configs && (int)seen.size() < app_params.num_configs; ++attempt) {
+    Choice choice;
+    for (const TunerParam& param : app_params.search_space) {
+      choice.emplace_back(std::uniform_int_distribution<int>(0, (int)param.values.size() - 1)(rng));
+    }
+    if (seen.insert(choice).second) {
+      candidates.emplace_back();
+      candidates.back().choice = choice;
+    }
+  }
+
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    candidates.at(c).config_path = Join(app_params.output_folder, "configs/config_" + std::to_string(c) + ".yaml");
+    WriteConfig(app_params, base_lines, candidates.at(c).choice, candidates.at(c).config_path);
+  }
+
+  std::vector<size_t> survivors(candidates.size());
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    survivors.at(c) = c;
+  }
+
+  for (size_t d = 0; d < app_params.datasets.size(); ++d) {
+    LOG(INFO) << "Rung " << d << ": running " << survivors.size() << " configs on "
+              << app_params.datasets.at(d).name << std::endl;
+    RunRung(app_params, d, survivors, candidates);
+
+    survivors.erase(std::remove_if(survivors.begin(), survivors.end(),
+        [&](size_t c) { return !candidates.at(c).Ok(); }), survivors.end());
+    if (survivors.empty()) {
+      break;
+    }
+
+    const std::vector<int> ranks = ParetoRanks(app_params, candidates, survivors);
+    std::vector<size_t> order(survivors.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order.at(i) = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      if (ranks.at(a) != ranks.at(b)) {
+        return ranks.at(a) < ranks.at(b);
+      }
+      return candidates.at(survivors.at(a)).Ate() < candidates.at(survivors.at(b)).Ate();
+    });
+
+    // The last rung keeps everyone, so that the whole front is reported.
+    const bool last = (d + 1) == app_params.datasets.size();
+    const size_t keep = last ? order.size() :
+        std::max<size_t>(1, (order.size() + app_params.eta - 1) / app_params.eta);
+
+    std::vector<size_t> next;
+    for (size_t i = 0; i < keep; ++i) {
+      next.emplace_back(survivors.at(order.at(i)));
+    }
+    survivors = next;
+  }
+
+  CHECK(!survivors.empty()) << "Every config failed, check the datasets and base config" << std::endl;
+
+  // Copy the front into pareto/, ordered by ATE.
+  const std::vector<int> ranks = ParetoRanks(app_params, candidates, survivors);
+  std::vector<size_t> front;
+  for (size_t i = 0; i < survivors.size(); ++i) {
+    if (ranks.at(i) == 0) {
+      front.emplace_back(survivors.at(i));
+    }
+  }
+  std::sort(front.begin(), front.end(), [&](size_t a, size_t b) {
+    return candidates.at(a).Ate() < candidates.at(b).Ate();
+  });
+
+  for (size_t i = 0; i < front.size(); ++i) {
+    const TunerCandidate& candidate = candidates.at(front.at(i));
+    const std::string path = Join(app_params.output_folder, "pareto/" + std::to_string(i) + "_config_" +
+                                  std::to_string(front.at(i)) + ".yaml");
+    WriteConfig(app_params, base_lines, candidate.choice, path);
+    LOG(INFO) << "Pareto config " << front.at(i) << ": ATE=" << candidate.Ate()
+              << " p95_ms=" << candidate.P95Ms()
+              << ((candidate.P95Ms() <= app_params.latency_budget_ms) ? "" : " (over budget)") << std::endl;
+  }
+
+  const std::string summary_path = Join(app_params.output_folder, "summary.json");
+  std::ofstream out(summary_path.c_str());
+  CHECK(out.is_open()) << "Could not open summary file: " << summary_path << std::endl;
+
+  out << "{\"config\":\"" << config_path << "\""
+      << ",\"latency_budget_ms\":" << app_params.latency_budget_ms
+      << ",\"cpus_per_job\":" << app_params.cpus_per_job
+      << ",\"pareto\":[";
+  for (size_t i = 0; i < front.size(); ++i) {
+    out << front.at(i) << ((i + 1) < front.size() ? "," : "");
+  }
+  out << "],\"candidates\":[\n";
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    WriteCandidate(out, app_params, candidates.at(c), c);
+    out << ((c + 1) < candidates.size() ? ",\n" : "\n");
+  }
+  out << "]}\n";
+  out.close();
+
+  LOG(INFO) << "Wrote " << summary_path << " (" << front.size() << " Pareto configs)" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,184 @@
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/path_util.hpp"
+#include "core/timer.hpp"
+#include "params/params_base.hpp"
+#include "dataset/trajectory_error.hpp"
+#include "vio/state_estimator.hpp"
+#include "vio/synthetic_world.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+struct VioScalingBenchmarkParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(VioScalingBenchmarkParams);
+  std::string output_path = "/tmp/vio_scaling_benchmark.csv";
+  std::string state_estimator_config;   // Absolute, or relative to src/tools.
+  std::string shared_config;            // Absolute, or relative to config/.
+  std::vector<int> num_landmarks;
+  std::vector<double> smoother_lag_sec;
+  std::vector<double> keyframe_hz;
+  double rpe_delta_sec = 1.0;
+  double max_time_offset_sec = 0.05;
+  SyntheticWorld::Params world_params;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    output_path = YamlToString(parser.GetNode("output_path"));
+    state_estimator_config = YamlToString(parser.GetNode("state_estimator_config"));
+    shared_config = YamlToString(parser.GetNode("shared_config"));
+
+    const cv::FileNode& lmks_node = parser.GetNode("num_landmarks");
+    for (cv::FileNodeIterator it = lmks_node.begin(); it != lmks_node.end(); ++it) {
+      num_landmarks.emplace_back((int)*it);
+    }
+    const cv::FileNode& lag_node = parser.GetNode("smoother_lag_sec");
+    for (cv::FileNodeIterator it = lag_node.begin(); it != lag_node.end(); ++it) {
+      smoother_lag_sec.emplace_back((double)*it);
+    }
+    const cv::FileNode& hz_node = parser.GetNode("keyframe_hz");
+    for (cv::FileNodeIterator it = hz_node.begin(); it != hz_node.end(); ++it) {
+      keyframe_hz.emplace_back((double)*it);
+    }
+
+    parser.GetParam("rpe_delta_sec", &rpe_delta_sec);
+    parser.GetParam("max_time_offset_sec", &max_time_offset_sec);
+    world_params = SyntheticWorld::Params(parser.Subtree("SyntheticWorld"));
+
+    CHECK(!num_landmarks.empty() && !smoother_lag_sec.empty() && !keyframe_hz.empty())
+        << "Each sweep needs at least one value" << std::endl;
+  }
+};
+
+
+static bool IsAbsolute(const std::string& path)
+{
+  return !path.empty() && path.front() == '/';
+}
+
+
+static double Percentile(std::vector<double> values, double p)
+{
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values.at(std::min(values.size() - 1, (size_t)(p * values.size())));
+}
+
+
+// Runs the StateEstimator (in lockstep mode, without the frontend) on a synthetic world for every
+// combination of landmark count, smoother lag and keyframe rate, and writes how long each keypose
+// took to smooth, and how accurate the result was.
+// Usage: vio_scaling_benchmark [config_path]
+int main(int argc, char const *argv[])
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  const std::string config_path = (argc > 1) ? std::string(argv[1]) :
+      tools_path("vio_scaling_benchmark/config/VioScalingBenchmark.yaml");
+  const VioScalingBenchmarkParams app_params(config_path);
+
+  const std::string se_config = IsAbsolute(app_params.state_estimator_config) ?
+      app_params.state_estimator_config : tools_path(app_params.state_estimator_config);
+  const std::string shared_config = IsAbsolute(app_params.shared_config) ?
+      app_params.shared_config : core::config_path(app_params.shared_config);
+  const StateEstimator::Params se_params(se_config, shared_config);
+
+  std::ofstream out(app_params.output_path.c_str());
+  CHECK(out.is_open()) << "Could not open file: " << app_params.output_path << std::endl;
+  out << "num_landmarks,smoother_lag_sec,keyframe_hz,num_keyframes,p50_ms,p95_ms,max_ms,wall_sec,ate_rmse,rpe_trans_rmse\n";
+
+  for (const int num_landmarks : app_params.num_landmarks) {
+    for (const double lag_sec : app_params.smoother_lag_sec) {
+      for (const double keyframe_hz : app_params.keyframe_hz) {
+        StateEstimator::Params params = se_params;
+        params.lockstep = true;
+        params.show_feature_tracks = false;
+        params.use_keyframe_policy = false;
+        params.use_overload_controller = false;
+        params.estimate_imu_time_offset = false;
+        params.use_tags = false;
+        params.smoother_log_path = "";
+        params.checkpoint_path = "";
+        params.aux_stereo_rigs.clear();
+        params.smoother_params.aux_stereo_rigs.clear();
+        params.smoother_params.smoother_lag_sec = lag_sec;
+        params.smoother_params.max_keyposes_in_lag = 0;
+
+        // Don't time out on VO between keyframes, or IMU-only keyposes get mixed in.
+        params.max_sec_btw_keyposes = std::max(params.max_sec_btw_keyposes, 1.5 / keyframe_hz);
+
+        // The synthetic sensors are all at the body origin.
+        params.body_P_imu = gtsam::Pose3::identity();
+        params.smoother_params.body_P_imu = gtsam::Pose3::identity();
+        params.smoother_params.body_P_receiver = gtsam::Pose3::identity();
+        params.smoother_params.body_P_mag = gtsam::Pose3::identity();
+        params.filter_params.body_T_imu = Matrix4d::Identity();
+        params.filter_params.body_T_receiver = Matrix4d::Identity();
+
+        SyntheticWorld::Params world_params = app_params.world_params;
+        world_params.num_landmarks = num_landmarks;
+        world_params.keyframe_hz = keyframe_hz;
+        world_params.n_gravity = params.n_gravity;
+        world_params.mag_local_field = params.smoother_params.mag_local_field;
+        world_params.mag_scale_factor = params.smoother_params.mag_scale_factor;
+        const SyntheticWorld world(world_params, params.stereo_rig, params.body_P_cam.matrix());
+
+        StateEstimator state_estimator(params);
+
+        // NOTE(milo): Only written by the smoother thread, and only read after shutdown.
+        std::vector<dataset::GroundtruthItem> smoother_poses;
+        state_estimator.RegisterSmootherResultCallback([&smoother_poses](const SmootherResult& result)
+        {
+          smoother_poses.emplace_back(ConvertToNanoseconds(result.timestamp), result.world_P_body.matrix());
+        });
+
+        std::vector<double> receive_ms;
+        Timer timer(true);
+        world.Playback(state_estimator, [&receive_ms](size_t, double ms) { receive_ms.emplace_back(ms); });
+        state_estimator.BlockUntilFinished();
+        state_estimator.Shutdown();
+        const double wall_sec = timer.Elapsed().seconds();
+
+        std::vector<dataset::GroundtruthItem> groundtruth;
+        for (const SyntheticWorld::Keyframe& kf : world.Keyframes()) {
+          const seconds_t t = ConvertToSeconds(kf.timestamp - world.FirstTimestamp());
+          groundtruth.emplace_back(kf.timestamp, world.WorldTBody(t));
+        }
+
+        const auto by_time = [](const dataset::GroundtruthItem& a, const dataset::GroundtruthItem& b) {
+          return a.timestamp < b.timestamp;
+        };
+        std::stable_sort(smoother_poses.begin(), smoother_poses.end(), by_time);
+
+        // The estimator starts at the groundtruth pose, so don't align.
+        const dataset::TrajectoryError err = dataset::ComputeTrajectoryError(
+            groundtruth, smoother_poses, app_params.rpe_delta_sec, app_params.max_time_offset_sec, false);
+
+        out << num_landmarks << "," << lag_sec << "," << keyframe_hz << "," << receive_ms.size() << ","
+            << Percentile(receive_ms, 0.5) << "," << Percentile(receive_ms, 0.95) << ","
+            << Percentile(receive_ms, 1.0) << "," << wall_sec << ","
+            << err.ate_rmse << "," << err.rpe_trans_rmse << "\n";
+        out.flush();
+
+        LOG(INFO) << "landmarks=" << num_landmarks << " lag=" << lag_sec << "s keyframe_hz=" << keyframe_hz
+                  << ": p50=" << Percentile(receive_ms, 0.5) << "ms p95=" << Percentile(receive_ms, 0.95)
+                  << "ms ATE=" << err.ate_rmse << "m" << std::endl;
+      }
+    }
+  }
+
+  LOG(INFO) << "Wrote " << app_params.output_path << std::endl;
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+#include "core/path_util.hpp"
+#include "params/params_base.hpp"
+#include "vio/smoother_log.hpp"
+#include "vio/smoother_replay.hpp"
+#include "vio/state_estimator.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+struct VioSmootherReplayParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(VioSmootherReplayParams);
+  std::string smoother_log_path;
+  std::string output_path = "/tmp/vio_smoother_replay.csv";
+  std::string state_estimator_config;   // Absolute, or relative to src/tools.
+  std::string shared_config;            // Absolute, or relative to config/.
+  std::vector<double> smoother_lag_sec;
+  int repeats = 1;
+  int max_keyposes = 0;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    smoother_log_path = YamlToString(parser.GetNode("smoother_log_path"));
+    output_path = YamlToString(parser.GetNode("output_path"));
+    state_estimator_config = YamlToString(parser.GetNode("state_estimator_config"));
+    shared_config = YamlToString(parser.GetNode("shared_config"));
+
+    const cv::FileNode& lag_node = parser.GetNode("smoother_lag_sec");
+    for (cv::FileNodeIterator it = lag_node.begin(); it != lag_node.end(); ++it) {
+      smoother_lag_sec.emplace_back((double)*it);
+    }
+
+    parser.GetParam("repeats", &repeats);
+    parser.GetParam("max_keyposes", &max_keyposes);
+    CHECK_GE(repeats, 1);
+  }
+};
+
+
+static bool IsAbsolute(const std::string& path)
+{
+  return !path.empty() && path.front() == '/';
+}
+
+
+static double Percentile(std::vector<double> values, double p)
+{
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values.at(std::min(values.size() - 1, (size_t)(p * values.size())));
+}
+
+
+static void LogSummary(const std::string& name, const std::vector<double>& ms)
+{
+  LOG(INFO) << "  " << std::setw(16) << std::left << name
+            << " p50=" << Percentile(ms, 0.5) << "ms p95=" << Percentile(ms, 0.95)
+            << "ms max=" << Percentile(ms, 1.0) << "ms" << std::endl;
+}
+
+
+// Replays the FixedLagSmoother updates from a smoother log, for each smoother_lag_sec, and writes
+// how long each part of every update took.
+// Usage: vio_smoother_replay [config_path]
+int main(int argc, char const *argv[])
+{
+  // Set up glog.
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  const std::string config_path = (argc > 1) ? std::string(argv[1]) :
+      tools_path("vio_smoother_replay/config/VioSmootherReplay.yaml");
+  const VioSmootherReplayParams app_params(config_path);
+
+  const std::string se_config = IsAbsolute(app_params.state_estimator_config) ?
+      app_params.state_estimator_config : tools_path(app_params.state_estimator_config);
+  const std::string shared_config = IsAbsolute(app_params.shared_config) ?
+      app_params.shared_config : core::config_path(app_params.shared_config);
+  const StateEstimator::Params se_params(se_config, shared_config);
+
+  SmootherLog log;
+  CHECK(ReadSmootherLog(app_params.smoother_log_path, log)) << "Could not read " << app_params.smoother_log_path << std::endl;
+  LOG(INFO) << "Read " << log.keyposes.size() << " keyposes and " << log.imu.size() << " IMU measurements" << std::endl;
+
+  const SmootherReplay replay(log, se_params.imu_manager_params, se_params.allowed_misalignment_imu);
+
+  std::vector<double> lags = app_params.smoother_lag_sec;
+  if (lags.empty()) {
+    lags.emplace_back(se_params.smoother_params.smoother_lag_sec);
+  }
+
+  std::ofstream out(app_params.output_path.c_str());
+  CHECK(out.is_open()) << "Could not open file: " << app_params.output_path << std::endl;
+  out << "smoother_lag_sec,repeat,keypose_id,timestamp,isam_update_ms,extra_iters_ms,num_extra_iters,"
+         "estimate_ms,update_ms,covariance_ms,covariance_computed,num_factors,num_lmk_factors\n";
+  out << std::setprecision(9);
+
+  for (const double lag_sec : lags) {
+    FixedLagSmoother::Params params = se_params.smoother_params;
+    params.smoother_lag_sec = lag_sec;
+
+    for (int r = 0; r < app_params.repeats; ++r) {
+      const std::vector<SmootherReplay::KeyposeTiming> timings = replay.Run(params, app_params.max_keyposes);
+
+      std::vector<double> isam_ms, extra_ms, update_ms, cov_ms;
+      for (const SmootherReplay::KeyposeTiming& t : timings) {
+        out << lag_sec << "," << r << "," << t.keypose_id << "," << t.timestamp << ","
+            << t.isam_update_ms << "," << t.extra_iters_ms << "," << t.num_extra_iters << ","
+            << t.estimate_ms << "," << t.update_ms << "," << t.covariance_ms << ","
+            << t.covariance_computed << "," << t.num_factors << "," << t.num_lmk_factors << "\n";
+
+        isam_ms.emplace_back(t.isam_update_ms);
+        extra_ms.emplace_back(t.extra_iters_ms);
+        update_ms.emplace_back(t.update_ms);
+        if (t.covariance_computed) {
+          cov_ms.emplace_back(t.covariance_ms);
+        }
+      }
+      out.flush();
+
+      LOG(INFO) << "smoother_lag_sec=" << lag_sec << " repeat=" << r << ": " << timings.size() << " keyposes" << std::endl;
+      LogSummary("isam_update", isam_ms);
+      LogSummary("extra_iters", extra_ms);
+      LogSummary("update", update_ms);
+      LogSummary("covariance", cov_ms);
+    }
+  }
+
+  LOG(INFO) << "Wrote " << app_params.output_path << std::endl;
+  return 0;
+}
@@ -16,8 +16,13 @@ int main(int argc, char const *argv[])
   const char* path = std::getenv("BM_DATASETS_DIR");
   CHECK(path != nullptr) << "No environment variable $BM_DATASETS_DIR. Did you source setup.bash?" << std::endl;
 
+  // Optionally pass in a different params file, for example to publish over LCM without recording.
+  const std::string params_path = (argc > 1) ? std::string(argv[1]) :
+      core::tools_path("zed_recorder/config/ZedRecorder.yaml");
+  const ZedRecorder::Params params(params_path);
+
   const std::string datasets_path(core::Join(path, "zed_dataset"));
-  ZedRecorder zr(datasets_path);
+  ZedRecorder zr(params, datasets_path);
   zr.Run(true);
   return 0;
 }
@@ -1,4 +1,5 @@
 #include <opencv2/imgproc.hpp>
+#include <opencv2/cudaimgproc.hpp>
 
 #include "zed_recorder.hpp"
 #include "core/imu_measurement.hpp"
@@ -7,6 +8,8 @@
 #include "core/math_util.hpp"
 #include "dataset/euroc_data_writer.hpp"
 
+#include "vehicle/imu_measurement_t.hpp"
+
 namespace bm {
 namespace zed {
 
@@ -46,6 +49,27 @@ cv::Mat slMat2cvMat(sl::Mat& input) {
 }
 
 
+// Same as above, for an sl::Mat that was retrieved into device memory.
+cv::cuda::GpuMat slMat2GpuMat(sl::Mat& input) {
+  return cv::cuda::GpuMat(input.getHeight(),
+                          input.getWidth(),
+                          getOCVtype(input.getDataType()),
+                          input.getPtr<sl::uchar1>(sl::MEM::GPU),
+                          input.getStepBytes(sl::MEM::GPU));
+}
+
+
+static sl::RESOLUTION ParseResolution(const std::string& resolution)
+{
+  if (resolution == "VGA") { return sl::RESOLUTION::VGA; }
+  if (resolution == "HD720") { return sl::RESOLUTION::HD720; }
+  if (resolution == "HD1080") { return sl::RESOLUTION::HD1080; }
+  if (resolution == "HD2K") { return sl::RESOLUTION::HD2K; }
+  LOG(FATAL) << "Unknown ZED resolution: " << resolution << std::endl;
+  return sl::RESOLUTION::VGA;
+}
+
+
 // Function to display sensor parameters.
 void printSensorConfiguration(sl::SensorParameters& sp)
 {
@@ -61,11 +85,25 @@ void printSensorConfiguration(sl::SensorParameters& sp)
 }
 
 
-ZedRecorder::ZedRecorder(const std::string& output_folder)
-  : output_folder_(output_folder), shutdown_(false)
+ZedRecorder::ZedRecorder(const Params& params, const std::string& output_folder)
+  : params_(params),
+    output_folder_(output_folder),
+    shutdown_(false),
+    cam_sampler_(params.camera_rate_hz),
+    imu_sampler_(params.imu_rate_hz)
 {
   LOG(INFO) << "Constructed ZedRecorder" << std::endl;
-  LOG(INFO) << "Will save data in EuRoC format to: " << output_folder_ << std::endl;
+
+  if (params_.record_euroc) {
+    LOG(INFO) << "Will save data in EuRoC format to: " << output_folder_ << std::endl;
+  }
+
+  if (params_.publish_lcm) {
+    CHECK(lcm_.good()) << "Failed to initialize LCM" << std::endl;
+    LOG(INFO) << "Will publish stereo pairs on: " << params_.channel_output_stereo
+              << " (memory-mapped file " << params_.mmf_filename << ")" << std::endl;
+    LOG(INFO) << "Will publish IMU on: " << params_.channel_output_imu << std::endl;
+  }
 }
 
 
@@ -101,7 +139,8 @@ void ZedRecorder::CaptureLoop()
   initp.coordinate_system = sl::COORDINATE_SYSTEM::IMAGE; // RDF
   initp.sdk_verbose = true;
   initp.depth_mode = sl::DEPTH_MODE::NONE;
-  initp.camera_resolution = sl::RESOLUTION::VGA;
+  initp.camera_resolution = ParseResolution(params_.resolution);
+  initp.camera_fps = params_.camera_fps;
 
   sl::ERROR_CODE returned_state = zed.open(initp);
   if (returned_state != sl::ERROR_CODE::SUCCESS) {
@@ -166,11 +205,29 @@ void ZedRecorder::CaptureLoop()
 
   sl::SensorsData sensors_data;
 
-  dataset::EurocDataWriter writer(output_folder_);
+  // NOTE(milo): The MMF has room for exactly one pair at the camera resolution.
+  if (params_.publish_lcm) {
+    stereo_pub_.reset(new MmfStereoPublisher(
+        lcm_, params_.channel_output_stereo, "zed", params_.mmf_filename,
+        static_cast<int>(info.camera_resolution.height),
+        static_cast<int>(info.camera_resolution.width),
+        params_.publish_gray ? 1 : 3,
+        params_.mmf_num_slots, params_.mmf_encoding, params_.mmf_jpeg_quality));
+    if (params_.publish_imu_batches) {
+      imu_batch_pub_.reset(new ImuBatchPublisher(
+          lcm_, params_.channel_output_imu_batch, "zed",
+          params_.imu_batch_max_samples, params_.imu_batch_max_latency_sec));
+    }
+  }
+
+  std::unique_ptr<dataset::EurocDataWriter> writer;
+  if (params_.record_euroc) {
+    writer.reset(new dataset::EurocDataWriter(output_folder_));
+  }
 
   LOG(INFO) << "Recording in progress" << std::endl;
 
-  while (elapsed_sec < max_duration_sec_ && !shutdown_) {
+  while ((params_.max_duration_sec < 0 || elapsed_sec < params_.max_duration_sec) && !shutdown_) {
     // Depending on your camera model, different sensors are available.
     // They do not run at the same rate: therefore, to not miss any new samples we iterate as fast as possible
     // and compare timestamps to determine when a given sensor's data has been updated.
@@ -189,11 +246,17 @@ void ZedRecorder::CaptureLoop()
         if (imu_sampler_.ShouldSample(ConvertToSeconds(timestamp))) {
           const Vector3d angular_vel(DegToRad(sensors_data.imu.angular_velocity.x),
                                      DegToRad(sensors_data.imu.angular_velocity.y),
-                                     DegToRad(sensors_data.imu.angular_velocity.y));
+                                     DegToRad(sensors_data.imu.angular_velocity.z));
           const Vector3d linear_accel(sensors_data.imu.linear_acceleration.x,
                                       sensors_data.imu.linear_acceleration.y,
                                       sensors_data.imu.linear_acceleration.z);
-          writer.WriteImu(ImuMeasurement(timestamp, angular_vel, linear_accel));
+          const ImuMeasurement imu(timestamp, angular_vel, linear_accel);
+          if (writer) {
+            writer->WriteImu(imu);
+          }
+          if (params_.publish_lcm) {
+            PublishImu(imu);
+          }
         }
 
         // Check if Magnetometer data has been updated.
@@ -205,21 +268,29 @@ void ZedRecorder::CaptureLoop()
           std::cout << " - Barometer\n \t Atmospheric pressure:" << sensors_data.barometer.pressure << " [hPa]\n";
       }
 
-      // NOTE(milo): ZED returns a BGRA image, so we need to get the first 3 channels only.
       if (zed.grab() == sl::ERROR_CODE::SUCCESS) {
         const timestamp_t timestamp = zed.getTimestamp(sl::TIME_REFERENCE::IMAGE);
         if (cam_sampler_.ShouldSample(ConvertToSeconds(timestamp))) {
-          sl::Mat iml, imr;
-          zed.retrieveImage(iml, sl::VIEW::LEFT, sl::MEM::CPU);
-          zed.retrieveImage(imr, sl::VIEW::RIGHT, sl::MEM::CPU);
-          const cv::Mat iml_cv = slMat2cvMat(iml);
-          const cv::Mat imr_cv = slMat2cvMat(imr);
-          Image3b iml_cv_bgr, imr_cv_bgr;
-          cv::cvtColor(iml_cv, iml_cv_bgr, cv::COLOR_BGRA2BGR);
-          cv::cvtColor(imr_cv, imr_cv_bgr, cv::COLOR_BGRA2BGR);
-          const StereoImage3b stereo_pair(timestamp, camera_id_, iml_cv_bgr, imr_cv_bgr);
-          writer.WriteStereo(stereo_pair);
-          ++camera_id_;
+          // NOTE(milo): These are newly allocated for every pair, since the EuRoC writer holds onto
+          // them until they're saved.
+          Image3b left_bgr, right_bgr;
+          const bool ok = params_.use_gpu ? RetrieveStereoGpu(zed, timestamp, left_bgr, right_bgr)
+                                          : RetrieveStereo(zed, left_bgr, right_bgr);
+          if (ok) {
+            if (params_.publish_lcm) {
+              if (params_.publish_gray) {
+                stereo_pub_->Publish(timestamp, gray_[0], gray_[1]);
+              } else {
+                stereo_pub_->Publish(timestamp, left_bgr, right_bgr);
+              }
+            }
+            if (writer) {
+              writer->WriteStereo(StereoImage3b(timestamp, camera_id_, left_bgr, right_bgr));
+            }
+            ++camera_id_;
+          } else {
+            LOG(WARNING) << "Failed to retrieve stereo pair at " << timestamp << std::endl;
+          }
         }
       }
     }
@@ -228,10 +299,115 @@ void ZedRecorder::CaptureLoop()
         std::chrono::high_resolution_clock::now() - start_time).count();
   }
 
-  LOG(INFO) << "Finished collecting data" << std::endl;
+  if (writer) {
+    writer->Flush();
+    const dataset::EurocDataWriter::Stats stats = writer->GetStats();
+    LOG(INFO) << "Finished collecting data: wrote " << stats.written << " stereo pairs, dropped "
+              << stats.dropped << " (at most " << stats.max_queued << " were waiting to be saved)"
+              << std::endl;
+  }
+
+  if (imu_batch_pub_) {
+    imu_batch_pub_->Flush();
+    LOG(INFO) << "Published " << imu_batch_pub_->NumPublished() << " IMU batches" << std::endl;
+  }
+  if (stereo_pub_) {
+    LOG(INFO) << "Published " << stereo_pub_->NumPublished() << " stereo pairs" << std::endl;
+  }
   zed.close();
 }
 
 
+bool ZedRecorder::RetrieveStereo(sl::Camera& zed, Image3b& left_bgr, Image3b& right_bgr)
+{
+  Image3b* bgr[2] = { &left_bgr, &right_bgr };
+  const sl::VIEW views[2] = { sl::VIEW::LEFT, sl::VIEW::RIGHT };
+
+  for (int i = 0; i < 2; ++i) {
+    if (zed.retrieveImage(sl_images_[i], views[i], sl::MEM::CPU) != sl::ERROR_CODE::SUCCESS) {
+      return false;
+    }
+
+    // NOTE(milo): ZED returns a BGRA image, so we need to get the first 3 channels only.
+    const cv::Mat bgra = slMat2cvMat(sl_images_[i]);
+    if (NeedBgr()) {
+      cv::cvtColor(bgra, *bgr[i], cv::COLOR_BGRA2BGR);
+    }
+    if (NeedGray()) {
+      cv::cvtColor(bgra, gray_[i], cv::COLOR_BGRA2GRAY);
+    }
+  }
+
+  return true;
+}
+
+
+bool ZedRecorder::RetrieveStereoGpu(sl::Camera& zed,
+                                    timestamp_t timestamp,
+                                    Image3b& left_bgr,
+                                    Image3b& right_bgr)
+{
+  Image3b* bgr[2] = { &left_bgr, &right_bgr };
+  const sl::VIEW views[2] = { sl::VIEW::LEFT, sl::VIEW::RIGHT };
+  cv::cuda::GpuMat bgra[2];
+
+  // NOTE(milo): Without a CUDA stream argument, retrieveImage() only returns once the device images
+  // are ready, so they can be used on stream_ (or by the callbacks) right away.
+  for (int i = 0; i < 2; ++i) {
+    if (zed.retrieveImage(sl_images_[i], views[i], sl::MEM::GPU) != sl::ERROR_CODE::SUCCESS) {
+      return false;
+    }
+    bgra[i] = slMat2GpuMat(sl_images_[i]);
+  }
+
+  for (const GpuStereoCallback& f : gpu_callbacks_) {
+    f(timestamp, bgra[0], bgra[1]);
+  }
+
+  // Each image crosses to the host at most once, already converted. The gray images go through
+  // page-locked memory so that the downloads are truly asynchronous.
+  for (int i = 0; i < 2; ++i) {
+    if (NeedBgr()) {
+      cv::cuda::cvtColor(bgra[i], bgr_gpu_[i], cv::COLOR_BGRA2BGR, 0, stream_);
+      bgr_gpu_[i].download(*bgr[i], stream_);
+    }
+    if (NeedGray()) {
+      cv::cuda::cvtColor(bgra[i], gray_gpu_[i], cv::COLOR_BGRA2GRAY, 0, stream_);
+      gray_gpu_[i].download(gray_pinned_[i], stream_);
+    }
+  }
+
+  stream_.waitForCompletion();
+
+  if (NeedGray()) {
+    gray_[0] = gray_pinned_[0].createMatHeader();
+    gray_[1] = gray_pinned_[1].createMatHeader();
+  }
+
+  return true;
+}
+
+
+void ZedRecorder::PublishImu(const ImuMeasurement& imu)
+{
+  if (imu_batch_pub_) {
+    imu_batch_pub_->Push(imu);
+    return;
+  }
+
+  vehicle::imu_measurement_t msg;
+  msg.header.timestamp = static_cast<int64_t>(imu.timestamp);
+  msg.header.seq = imu_seq_++;
+  msg.header.frame_id = "zed";
+  msg.linear_acc.x = imu.a.x();
+  msg.linear_acc.y = imu.a.y();
+  msg.linear_acc.z = imu.a.z();
+  msg.angular_vel.x = imu.w.x();
+  msg.angular_vel.y = imu.w.y();
+  msg.angular_vel.z = imu.w.z();
+  lcm_.publish(params_.channel_output_imu, &msg);
+}
+
+
 }
 }
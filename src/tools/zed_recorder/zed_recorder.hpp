@@ -3,13 +3,27 @@
 #include <glog/logging.h>
 
 #include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
 #include <thread>
+#include <vector>
+
+#include <opencv2/core/cuda.hpp>
+
+#include <lcm/lcm-cpp.hpp>
 
 #include <sl/Camera.hpp>
 
+#include "core/macros.hpp"
 #include "core/timestamp.hpp"
 #include "core/data_subsampler.hpp"
+#include "core/imu_measurement.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "vision_core/cv_types.hpp"
+#include "lcm_util/mmf_stereo_publisher.hpp"
+#include "lcm_util/imu_batch_publisher.hpp"
 
 namespace sl {
 
@@ -44,10 +58,83 @@ struct TimestampHandler
 namespace bm {
 namespace zed {
 
+using namespace core;
+
+
+// Called with each stereo pair while it's still in device memory (BGRA, owned by the ZED SDK). The
+// images are only valid until the callback returns.
+typedef std::function<void(timestamp_t, const cv::cuda::GpuMat&, const cv::cuda::GpuMat&)> GpuStereoCallback;
+
 
 class ZedRecorder final {
  public:
-  ZedRecorder(const std::string& output_folder);
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    std::string resolution = "VGA";     // VGA, HD720, HD1080 or HD2K.
+    int camera_fps = 30;                // Frame rate that the camera runs at.
+    double camera_rate_hz = 30.0;       // Stereo pairs are subsampled to this rate.
+    double imu_rate_hz = 100.0;
+    double max_duration_sec = 120.0;    // Use -1 to run until Shutdown().
+
+    // Save everything to output_folder in EuRoC format.
+    bool record_euroc = true;
+
+    // Retrieve images into device memory (sl::MEM::GPU). GPU callbacks only run in this mode, and
+    // images only come back to the host if they're recorded or published.
+    bool use_gpu = false;
+
+    // Publish each pair as an mmf_stereo_image_t (raw images in a memory-mapped file), and the IMU
+    // as imu_measurement_t, so that this can be a live source for state_estimator_lcm.
+    bool publish_lcm = false;
+    bool publish_gray = true;           // Publish mono8 instead of bgr8 (VIO only needs gray).
+    std::string mmf_filename = "/dev/shm/zed_stereo.mmf";
+    int mmf_num_slots = 2;              // Pairs in the memory-mapped ring (see MmfStereoPublisher).
+    std::string mmf_encoding = "raw";   // Or "jpg", which is smaller but has to be decoded.
+    int mmf_jpeg_quality = 90;
+    std::string channel_output_stereo = "zed/stereo";
+    std::string channel_output_imu = "zed/imu";
+
+    // Publish the IMU in imu_measurement_batch_t messages on channel_output_imu_batch instead, with
+    // up to imu_batch_max_samples each, and none waiting more than imu_batch_max_latency_sec.
+    bool publish_imu_batches = false;
+    std::string channel_output_imu_batch = "zed/imu_batch";
+    int imu_batch_max_samples = 10;
+    double imu_batch_max_latency_sec = 0.02;
+
+   private:
+    void LoadParams(const YamlParser& parser) override
+    {
+      resolution = YamlToString(parser.GetNode("resolution"));
+      parser.GetParam("camera_fps", &camera_fps);
+      parser.GetParam("camera_rate_hz", &camera_rate_hz);
+      parser.GetParam("imu_rate_hz", &imu_rate_hz);
+      parser.GetParam("max_duration_sec", &max_duration_sec);
+      parser.GetParam("record_euroc", &record_euroc);
+      parser.GetParam("use_gpu", &use_gpu);
+      parser.GetParam("publish_lcm", &publish_lcm);
+      parser.GetParam("publish_gray", &publish_gray);
+      mmf_filename = YamlToString(parser.GetNode("mmf_filename"));
+      parser.GetParam("mmf_num_slots", &mmf_num_slots);
+      mmf_encoding = YamlToString(parser.GetNode("mmf_encoding"));
+      parser.GetParam("mmf_jpeg_quality", &mmf_jpeg_quality);
+      channel_output_stereo = YamlToString(parser.GetNode("channel_output_stereo"));
+      channel_output_imu = YamlToString(parser.GetNode("channel_output_imu"));
+      parser.GetParam("publish_imu_batches", &publish_imu_batches);
+      channel_output_imu_batch = YamlToString(parser.GetNode("channel_output_imu_batch"));
+      parser.GetParam("imu_batch_max_samples", &imu_batch_max_samples);
+      parser.GetParam("imu_batch_max_latency_sec", &imu_batch_max_latency_sec);
+    }
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(ZedRecorder);
+
+  ZedRecorder(const Params& params, const std::string& output_folder);
+
+  // Register a callback for pairs in device memory (e.g to feed PatchmatchGpu). Only called when
+  // use_gpu is on, from the capture thread, so register them all before Run().
+  void RegisterGpuCallback(GpuStereoCallback f) { gpu_callbacks_.emplace_back(f); }
 
   // Run the data acquisition and save to disk.
   void Run(bool blocking = true);
@@ -59,17 +146,42 @@ class ZedRecorder final {
   // Main worker.
   void CaptureLoop();
 
+  // Retrieves the latest pair, and makes only the host copies that are needed: bgr for recording
+  // (or publishing in color), and gray_ for publishing. Returns false if the ZED couldn't retrieve
+  // the images.
+  bool RetrieveStereo(sl::Camera& zed, Image3b& left_bgr, Image3b& right_bgr);
+  bool RetrieveStereoGpu(sl::Camera& zed, timestamp_t timestamp, Image3b& left_bgr, Image3b& right_bgr);
+
+  bool NeedBgr() const { return params_.record_euroc || (params_.publish_lcm && !params_.publish_gray); }
+  bool NeedGray() const { return params_.publish_lcm && params_.publish_gray; }
+
+  void PublishImu(const ImuMeasurement& imu);
+
  private:
+  Params params_;
   std::thread thread_;
   std::string output_folder_;
   std::atomic_bool shutdown_;
 
   uid_t camera_id_ = 0;
 
-  core::DataSubsampler cam_sampler_{30.0};
-  core::DataSubsampler imu_sampler_{100.0};
+  core::DataSubsampler cam_sampler_;
+  core::DataSubsampler imu_sampler_;
+
+  std::vector<GpuStereoCallback> gpu_callbacks_;
+
+  // Reused for every frame, so that nothing is allocated on the host or device after the first.
+  sl::Mat sl_images_[2];
+  cv::cuda::GpuMat bgr_gpu_[2];
+  cv::cuda::GpuMat gray_gpu_[2];
+  cv::cuda::HostMem gray_pinned_[2];
+  cv::cuda::Stream stream_;
+  cv::Mat gray_[2];         // With use_gpu, these point into gray_pinned_.
 
-  double max_duration_sec_ = 120;
+  lcm::LCM lcm_;
+  std::unique_ptr<MmfStereoPublisher> stereo_pub_;
+  std::unique_ptr<ImuBatchPublisher> imu_batch_pub_;   // Only if publish_imu_batches.
+  int64_t imu_seq_ = 0;
 };
 
 
@@ -0,0 +1,213 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include <glog/logging.h>
+
+#include "core/alloc_tracker.hpp"
+
+namespace bm {
+namespace core {
+
+static const int kMaxAllocStages = 256;     // Stage 0 is "Untagged".
+static const char* kUntaggedStage = "Untagged";
+
+
+// NOTE(milo): Only the atomics are touched from inside of malloc, and this table is all static
+// storage, so counting never allocates (or recurses).
+struct AllocStage final
+{
+  std::atomic<const char*> name;
+  std::atomic<uint64_t> allocs;
+  std::atomic<uint64_t> bytes;
+
+  // Only touched by ReportAllocStages().
+  uint64_t reported_allocs;
+  uint64_t reported_bytes;
+};
+
+static AllocStage g_stages[kMaxAllocStages];
+static std::atomic<int> g_num_stages{1};
+static std::mutex g_register_lock;
+
+// NOTE(milo): The initial-exec model keeps the first access on a thread from calling into the
+// dynamic loader (which can allocate, from inside of malloc).
+static thread_local int tl_stage __attribute__((tls_model("initial-exec"))) = 0;
+
+
+// Returns the index of a stage, registering it the first time. Names are compared by pointer first,
+// since they're string literals, but the same literal can have a different address in each library.
+static int FindOrAddStage(const char* name)
+{
+  const int n = g_num_stages.load(std::memory_order_acquire);
+  for (int i = 1; i < n; ++i) {
+    const char* stage_name = g_stages[i].name.load(std::memory_order_relaxed);
+    if (stage_name == name || std::strcmp(stage_name, name) == 0) {
+      return i;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(g_register_lock);
+  const int m = g_num_stages.load(std::memory_order_relaxed);
+  for (int i = n; i < m; ++i) {
+    if (std::strcmp(g_stages[i].name.load(std::memory_order_relaxed), name) == 0) {
+      return i;
+    }
+  }
+
+  if (m >= kMaxAllocStages) {
+    LOG_FIRST_N(WARNING, 1) << "Out of allocation stages, charging " << name << " to " << kUntaggedStage << std::endl;
+    return 0;
+  }
+
+  g_stages[m].name.store(name, std::memory_order_relaxed);
+  g_num_stages.store(m + 1, std::memory_order_release);
+  return m;
+}
+
+
+ScopedAllocStage::ScopedAllocStage(const char* name)
+    : prev_stage_(tl_stage)
+{
+  tl_stage = FindOrAddStage(name);
+}
+
+
+ScopedAllocStage::~ScopedAllocStage()
+{
+  tl_stage = prev_stage_;
+}
+
+
+std::vector<AllocStageCounts> GetAllocStageCounts()
+{
+  std::vector<AllocStageCounts> out;
+  if (!AllocTrackingEnabled()) {
+    return out;
+  }
+
+  const int n = g_num_stages.load(std::memory_order_acquire);
+  out.resize(n);
+  for (int i = 0; i < n; ++i) {
+    const char* name = g_stages[i].name.load(std::memory_order_relaxed);
+    out.at(i).name = (i == 0) ? kUntaggedStage : name;
+    out.at(i).allocs = g_stages[i].allocs.load(std::memory_order_relaxed);
+    out.at(i).bytes = g_stages[i].bytes.load(std::memory_order_relaxed);
+  }
+
+  return out;
+}
+
+
+void ReportAllocStages(StatsTracker& stats)
+{
+  if (!AllocTrackingEnabled()) {
+    return;
+  }
+
+  const int n = g_num_stages.load(std::memory_order_acquire);
+  for (int i = 0; i < n; ++i) {
+    AllocStage& stage = g_stages[i];
+    const uint64_t allocs = stage.allocs.load(std::memory_order_relaxed);
+    const uint64_t bytes = stage.bytes.load(std::memory_order_relaxed);
+    if (allocs == 0) {
+      continue;
+    }
+
+    const std::string name = (i == 0) ? kUntaggedStage : stage.name.load(std::memory_order_relaxed);
+    stats.Add(stats.Register("Allocs_" + name), static_cast<float>(allocs - stage.reported_allocs));
+    stats.Add(stats.Register("AllocBytes_" + name, "B"), static_cast<float>(bytes - stage.reported_bytes));
+    stage.reported_allocs = allocs;
+    stage.reported_bytes = bytes;
+  }
+}
+
+
+#ifdef BM_ENABLE_ALLOC_TRACKING
+
+bool AllocTrackingEnabled() { return true; }
+
+static inline void CountAlloc(size_t bytes)
+{
+  AllocStage& stage = g_stages[tl_stage];
+  stage.allocs.fetch_add(1, std::memory_order_relaxed);
+  stage.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+#else
+
+bool AllocTrackingEnabled() { return false; }
+
+#endif
+
+
+}
+}
+
+
+#ifdef BM_ENABLE_ALLOC_TRACKING
+
+// Replace the allocation functions for the whole process (operator new goes through malloc), and
+// forward to glibc's own. free() doesn't need to be hooked, since only allocations are counted.
+// NOTE(milo): This is glibc specific, like the rest of the Linux-only code here.
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size) __THROW
+{
+  bm::core::CountAlloc(size);
+  return __libc_malloc(size);
+}
+
+
+void* calloc(size_t n, size_t size) __THROW
+{
+  bm::core::CountAlloc(n * size);
+  return __libc_calloc(n, size);
+}
+
+
+void* realloc(void* ptr, size_t size) __THROW
+{
+  bm::core::CountAlloc(size);
+  return __libc_realloc(ptr, size);
+}
+
+
+void* memalign(size_t alignment, size_t size) __THROW
+{
+  bm::core::CountAlloc(size);
+  return __libc_memalign(alignment, size);
+}
+
+
+void* aligned_alloc(size_t alignment, size_t size) __THROW
+{
+  bm::core::CountAlloc(size);
+  return __libc_memalign(alignment, size);
+}
+
+
+int posix_memalign(void** out, size_t alignment, size_t size) __THROW
+{
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  bm::core::CountAlloc(size);
+  void* ptr = __libc_memalign(alignment, size);
+  if (ptr == nullptr) {
+    return ENOMEM;
+  }
+  *out = ptr;
+  return 0;
+}
+
+}
+
+#endif
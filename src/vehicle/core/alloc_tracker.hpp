@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/stats_tracker.hpp"
+
+// Charge heap allocations on this thread to a named stage, until the end of the enclosing scope.
+// Every MACRO_PROFILE_SCOPE is also a stage, so this is only needed for code that isn't profiled.
+// Stages nest, and an allocation is only charged to the innermost one. Build with
+// -DBM_ENABLE_ALLOC_TRACKING to turn this on; otherwise it compiles to nothing, and malloc isn't
+// hooked.
+// NOTE(milo): The name must be a string literal (it's stored as a pointer, not copied).
+#define MACRO_ALLOC_STAGE_CONCAT_INNER(a, b) a##b
+#define MACRO_ALLOC_STAGE_CONCAT(a, b) MACRO_ALLOC_STAGE_CONCAT_INNER(a, b)
+
+#ifdef BM_ENABLE_ALLOC_TRACKING
+#define MACRO_ALLOC_STAGE(name) \
+  ::bm::core::ScopedAllocStage MACRO_ALLOC_STAGE_CONCAT(alloc_stage_, __LINE__)(name)
+#else
+#define MACRO_ALLOC_STAGE(name)
+#endif
+
+namespace bm {
+namespace core {
+
+
+// Allocations (malloc, calloc, realloc, and aligned allocations, so also operator new, cv::Mat and
+// Eigen) charged to a stage since startup.
+struct AllocStageCounts final
+{
+  std::string name;
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+};
+
+
+// Whether this build hooks malloc (BM_ENABLE_ALLOC_TRACKING).
+bool AllocTrackingEnabled();
+
+// Counts for every stage that has been entered, and "Untagged" for allocations outside of any stage.
+std::vector<AllocStageCounts> GetAllocStageCounts();
+
+// Adds the allocations and bytes that each stage made since the last call to stats (as
+// "Allocs_<stage>" and "AllocBytes_<stage>"). They're printed with the rest of the tracker's stats
+// (see StatsTracker::StartReporter()). Call this once per frame, and always from the same thread.
+// Does nothing if tracking isn't enabled.
+void ReportAllocStages(StatsTracker& stats);
+
+
+// Makes name the calling thread's stage from construction to destruction. Use MACRO_ALLOC_STAGE
+// (or MACRO_PROFILE_SCOPE) instead of this.
+class ScopedAllocStage final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ScopedAllocStage)
+  MACRO_DELETE_COPY_CONSTRUCTORS(ScopedAllocStage)
+
+  explicit ScopedAllocStage(const char* name);
+  ~ScopedAllocStage();
+
+ private:
+  int prev_stage_;
+};
+
+
+}
+}
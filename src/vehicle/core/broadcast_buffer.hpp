@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/StdVector>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/notifier.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A timestamp-sorted ring buffer with one writer and any number of readers, for sending the same
+// measurements to several consumers (e.g the smoother and the filter). Each measurement is stored
+// once, and a push costs the same no matter how many readers there are (other than waking them).
+//
+// Each Reader keeps its own cursor into the buffer, and has the same interface as a
+// TimeIndexedDataManager, so a consumer doesn't know that it's sharing its data.
+//
+// NOTE(milo): Readers always drop their OLDEST items. If a reader falls more than its max_size
+// behind, the items that it skipped are counted in its Dropped(). This is the only drop policy
+// that doesn't need the writer to visit every reader.
+template <typename DataType>
+class BroadcastBuffer final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(BroadcastBuffer);
+  MACRO_DELETE_COPY_CONSTRUCTORS(BroadcastBuffer);
+
+  class Reader;
+
+  // The buffer must be bounded (capacity > 0). It should be at least as big as its biggest reader.
+  explicit BroadcastBuffer(size_t capacity, const std::string& name = "")
+      : capacity_(capacity), name_(name)
+  {
+    CHECK_GT(capacity_, 0ul) << "BroadcastBuffer must be bounded!\n  Buffer=" << name_ << std::endl;
+    data_.reserve(capacity_);
+    times_.reserve(capacity_);
+  }
+
+  ~BroadcastBuffer()
+  {
+    CHECK(readers_.empty()) << "BroadcastBuffer destroyed before its readers\n  Buffer=" << name_ << std::endl;
+  }
+
+  void Push(const DataType& item)
+  {
+    lock_.lock();
+    PushNoLock(item);
+    lock_.unlock();
+    NotifyReaders();
+  }
+
+  // Push N measurements (oldest first) under one lock, with one notification per reader at the end.
+  void PushBatch(const DataType* items, size_t N)
+  {
+    if (N == 0) {
+      return;
+    }
+    lock_.lock();
+    for (size_t i = 0; i < N; ++i) {
+      PushNoLock(items[i]);
+    }
+    lock_.unlock();
+    NotifyReaders();
+  }
+
+  size_t Capacity() const { return capacity_; }
+
+  // Total number of measurements pushed so far.
+  uint64_t NumPushed()
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    return head_;
+  }
+
+  // One consumer's view of the buffer. It starts with the next measurement that is pushed, and
+  // holds at most max_size of the most recent ones (capped at the buffer's capacity). A reader with
+  // a max_size of zero never holds anything, which is a cheap way to turn a consumer off.
+  // NOTE(milo): Only one thread should read from a Reader, and it must not outlive its buffer.
+  class Reader final {
+   public:
+    MACRO_DELETE_DEFAULT_CONSTRUCTOR(Reader);
+    MACRO_DELETE_COPY_CONSTRUCTORS(Reader);
+
+    explicit Reader(BroadcastBuffer& buffer, size_t max_size, const std::string& name = "")
+        : buffer_(buffer),
+          max_size_(std::min(max_size, buffer.capacity_)),
+          name_(name)
+    {
+      std::lock_guard<std::mutex> readers_lock(buffer_.readers_lock_);
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      cursor_ = buffer_.head_;
+      buffer_.readers_.emplace_back(this);
+    }
+
+    ~Reader()
+    {
+      std::lock_guard<std::mutex> readers_lock(buffer_.readers_lock_);
+      std::vector<Reader*>& readers = buffer_.readers_;
+      readers.erase(std::remove(readers.begin(), readers.end(), this), readers.end());
+    }
+
+    bool Empty() { return Size() == 0; }
+
+    size_t Size()
+    {
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      return (size_t)(buffer_.head_ - BeginNoLock());
+    }
+
+    // Get the oldest measurement (first in).
+    DataType Pop()
+    {
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      const uint64_t begin = BeginNoLock();
+      CHECK_GT(buffer_.head_, begin) << "Tried to pop from empty BroadcastBuffer::Reader!"
+          << "\n  Reader=" << name_ << std::endl;
+      cursor_ = begin + 1;
+      return buffer_.Item(begin);
+    }
+
+    // Get the newest measurement (last in), and discard everything else.
+    DataType PopNewest()
+    {
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      CHECK_GT(buffer_.head_, BeginNoLock()) << "Tried to pop from empty BroadcastBuffer::Reader!"
+          << "\n  Reader=" << name_ << std::endl;
+      cursor_ = buffer_.head_;
+      return buffer_.Item(buffer_.head_ - 1);
+    }
+
+    // Pop measurements and put them in "out" until the next item exceeds the timestamp.
+    void PopUntil(seconds_t timestamp, std::vector<DataType>& out)
+    {
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      const uint64_t begin = BeginNoLock();
+      const uint64_t end = UpperBound(begin, timestamp);
+      for (uint64_t s = begin; s < end; ++s) {
+        out.emplace_back(buffer_.Item(s));
+      }
+      cursor_ = end;
+    }
+
+    // Throw away measurements before (but NOT equal to) timestamp. If save_at_least_one is true,
+    // we don't pop the only remaining item, no matter what timestamp it has.
+    void DiscardBefore(seconds_t timestamp, bool save_at_least_one = false)
+    {
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      const uint64_t begin = BeginNoLock();
+      uint64_t first = LowerBound(begin, timestamp);
+      if (save_at_least_one && buffer_.head_ > begin && first == buffer_.head_) {
+        first = buffer_.head_ - 1;
+      }
+      cursor_ = first;
+    }
+
+    // Find the measurement closest in time to "timestamp" (see TimeIndexedDataManager::PopNearest).
+    std::shared_ptr<DataType> PopNearest(seconds_t timestamp, seconds_t allowed_misalignment)
+    {
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      const uint64_t begin = BeginNoLock();
+      const uint64_t head = buffer_.head_;
+      if (head == begin) {
+        return nullptr;
+      }
+
+      const uint64_t after = LowerBound(begin, timestamp);
+
+      // The nearest item is either the first one >= timestamp, or the one right before it.
+      uint64_t nearest = after;
+      if (after == head ||
+         (after > begin && (timestamp - buffer_.Time(after - 1)) < (buffer_.Time(after) - timestamp))) {
+        nearest = after - 1;
+      }
+
+      if (std::fabs(buffer_.Time(nearest) - timestamp) < allowed_misalignment) {
+        cursor_ = nearest + 1;
+        return std::make_shared<DataType>(buffer_.Item(nearest));
+      }
+
+      cursor_ = std::min(after, head - 1);
+      return nullptr;
+    }
+
+    // Call visitor(const DataType&) on every measurement with a timestamp in [t0, t1], oldest first,
+    // without removing anything. Returns the number of items visited.
+    // NOTE(milo): This holds the buffer's lock while visiting (blocking the writer), so keep it fast!
+    template <typename Visitor>
+    size_t ViewRange(seconds_t t0, seconds_t t1, Visitor visitor)
+    {
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      const uint64_t begin = BeginNoLock();
+      const uint64_t first = LowerBound(begin, t0);
+      const uint64_t end = UpperBound(begin, t1);
+      for (uint64_t s = first; s < end; ++s) {
+        visitor(static_cast<const DataType&>(buffer_.Item(s)));
+      }
+      return (end > first) ? (size_t)(end - first) : 0;
+    }
+
+    // Timestamp of the newest measurement. If empty, returns kMaxSeconds.
+    seconds_t Newest()
+    {
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      return (buffer_.head_ == BeginNoLock()) ? kMaxSeconds : buffer_.Time(buffer_.head_ - 1);
+    }
+
+    // Timestamp of the oldest measurement. If empty, returns kMinSeconds.
+    seconds_t Oldest()
+    {
+      std::lock_guard<std::mutex> lock(buffer_.lock_);
+      const uint64_t begin = BeginNoLock();
+      return (buffer_.head_ == begin) ? kMinSeconds : buffer_.Time(begin);
+    }
+
+    // Block until there is data, or until timeout_sec has elapsed (see ThreadsafeQueue).
+    bool WaitNonEmpty(double timeout_sec)
+    {
+      return notifier_.WaitFor([this]() { return !Empty(); }, timeout_sec);
+    }
+
+    // Notify an external Notifier whenever data is pushed (see DataManager).
+    void AttachNotifier(Notifier* notifier) { listener_ = notifier; }
+
+    // Number of items that this reader missed because it fell too far behind.
+    size_t Dropped() const { return dropped_.load(); }
+
+   private:
+    friend class BroadcastBuffer;
+
+    // Moves the cursor past anything that has fallen out of this reader's window, and returns it.
+    uint64_t BeginNoLock()
+    {
+      const uint64_t head = buffer_.head_;
+      const uint64_t oldest = (head > max_size_) ? (head - max_size_) : 0;
+      if (cursor_ < oldest) {
+        if (max_size_ > 0) {
+          dropped_.fetch_add((size_t)(oldest - cursor_));
+        }
+        cursor_ = oldest;
+      }
+      return cursor_;
+    }
+
+    // Sequence number of the first item in [begin, head) with time >= t.
+    uint64_t LowerBound(uint64_t begin, seconds_t t) const
+    {
+      uint64_t lo = begin, hi = buffer_.head_;
+      while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (buffer_.Time(mid) < t) { lo = mid + 1; } else { hi = mid; }
+      }
+      return lo;
+    }
+
+    // Sequence number of the first item in [begin, head) with time > t.
+    uint64_t UpperBound(uint64_t begin, seconds_t t) const
+    {
+      uint64_t lo = begin, hi = buffer_.head_;
+      while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (buffer_.Time(mid) <= t) { lo = mid + 1; } else { hi = mid; }
+      }
+      return lo;
+    }
+
+    void Notify()
+    {
+      notifier_.Notify();
+      if (listener_ != nullptr) {
+        listener_->Notify();
+      }
+    }
+
+   private:
+    BroadcastBuffer& buffer_;
+    size_t max_size_;
+    std::string name_;
+
+    uint64_t cursor_ = 0;           // Sequence number of this reader's next item.
+    std::atomic<size_t> dropped_{0};
+    Notifier notifier_;
+    Notifier* listener_ = nullptr;
+  };
+
+ private:
+  // Items are numbered by the order they were pushed in, and item s lives at s % capacity_.
+  const DataType& Item(uint64_t s) const { return data_.at(s % capacity_); }
+  seconds_t Time(uint64_t s) const { return times_.at(s % capacity_); }
+
+  void PushNoLock(const DataType& item)
+  {
+    const seconds_t timestamp = MaybeConvertToSeconds(item.timestamp);
+    CHECK(head_ == 0 || timestamp >= Time(head_ - 1))
+        << "Tried to add measurement out of order."
+        << "\n  timestamp=" << timestamp
+        << "\n  newest=" << Time(head_ - 1) << std::endl;
+
+    // NOTE(milo): Fill the ring up once, then overwrite, so that DataType needn't be default constructible.
+    if (data_.size() < capacity_) {
+      data_.emplace_back(item);
+      times_.emplace_back(timestamp);
+    } else {
+      data_.at(head_ % capacity_) = item;
+      times_.at(head_ % capacity_) = timestamp;
+    }
+    ++head_;
+  }
+
+  void NotifyReaders()
+  {
+    std::lock_guard<std::mutex> readers_lock(readers_lock_);
+    for (Reader* reader : readers_) {
+      if (reader->max_size_ > 0) {
+        reader->Notify();
+      }
+    }
+  }
+
+  seconds_t MaybeConvertToSeconds(timestamp_t t) const
+  {
+    return ConvertToSeconds(t);
+  }
+
+  // Let the compiler decide which of these functions to use, depending on whether the undelying
+  // DataType uses timestamp_t or seconds_t timestamps.
+  static seconds_t MaybeConvertToSeconds(seconds_t t)
+  {
+    return t;
+  }
+
+ private:
+  size_t capacity_;
+  std::string name_;
+
+  std::mutex lock_;
+  std::vector<DataType, Eigen::aligned_allocator<DataType>> data_;
+  std::vector<seconds_t> times_;  // Kept separate from data_ so that binary search is cache-friendly.
+  uint64_t head_ = 0;             // Sequence number of the next item to be pushed.
+
+  std::mutex readers_lock_;       // Never held at the same time as lock_ by the writer.
+  std::vector<Reader*> readers_;
+};
+
+
+}
+}
@@ -44,9 +44,48 @@ class DataManager {
   bool Empty() { return queue_.Empty(); }
   size_t Size() { return queue_.Size(); }
 
+  // Push N measurements (oldest first) under one lock. Use this when measurements arrive in bursts,
+  // so that the consumer isn't woken up (and the lock isn't taken) once per measurement.
+  void PushBatch(const DataType* items, size_t N)
+  {
+    if (N == 0) {
+      return;
+    }
+
+    lock_.lock();
+    seconds_t newest = Newest(false);
+    for (size_t i = 0; i < N; ++i) {
+      const seconds_t timestamp = MaybeConvertToSeconds(items[i].timestamp);
+      CHECK(newest == kMaxSeconds || timestamp >= newest)
+          << "Tried to add measurement out of order."
+          << "\n  timestamp=" << timestamp
+          << "\n  newest=" << newest << std::endl;
+      newest = timestamp;
+    }
+    queue_.PushBatch(items, N);
+    lock_.unlock();
+  }
+
+  // Block until there is data, or until timeout_sec has elapsed (see ThreadsafeQueue).
+  bool WaitNonEmpty(double timeout_sec) { return queue_.WaitNonEmpty(timeout_sec); }
+  bool PopBlocking(DataType& item, double timeout_sec) { return queue_.PopBlocking(item, timeout_sec); }
+
+  // Notify an external Notifier whenever data is pushed, so that a consumer can wait on several
+  // DataManagers (and queues) at once.
+  void AttachNotifier(Notifier* notifier) { queue_.AttachNotifier(notifier); }
+
   // Get the oldest measurement (first in) from the queue.
   DataType Pop() { return queue_.Pop(); }
 
+  // Copy of the oldest measurement, without removing it from the queue (which must not be empty).
+  DataType PeekOldest()
+  {
+    lock_.lock();
+    const DataType item = queue_.PeekFront();
+    lock_.unlock();
+    return item;
+  }
+
   // Get the newest measurement (last in) from the queue. This will discard all measurements except
   // the newest one.
   DataType PopNewest()
@@ -31,5 +31,12 @@ void DataSubsampler::Reset(seconds_t timestamp)
 }
 
 
+void DataSubsampler::SetTargetHz(double target_hz)
+{
+  CHECK_GT(target_hz, 0) << "Must specify a target_hz > 0" << std::endl;
+  dt_ = 1.0 / target_hz;
+}
+
+
 }
 }
@@ -20,6 +20,9 @@ class DataSubsampler final {
   // Reset the last timestamp to avoid throwing an "out of order" exception.
   void Reset(seconds_t timestamp);
 
+  // Change the sampling rate. Takes effect on the next call to ShouldSample().
+  void SetTargetHz(double target_hz);
+
  private:
   seconds_t dt_;
   seconds_t last_ = 0;
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Builds a FrameCache key from a name and the parameters that the product depends on, e.g
+// FrameCacheKey("ft::Pyramid", "left", winsize, max_level) => "ft::Pyramid/left/21/4".
+inline std::string FrameCacheKey(const std::string& name)
+{
+  return name;
+}
+
+template <typename Arg, typename... Args>
+std::string FrameCacheKey(const std::string& name, const Arg& arg, const Args&... args)
+{
+  std::ostringstream ss;
+  ss << name << "/" << arg;
+  return FrameCacheKey(ss.str(), args...);
+}
+
+
+// Products derived from one frame (e.g pyramids, gradients and masks of its images), computed the
+// first time that a consumer asks for them and shared with every consumer after that. Products
+// are immutable once computed, so any number of threads can read them without locks. Each one is
+// freed when the last copy of the frame (and the last shared_ptr to it) goes away.
+//
+// NOTE(milo): If two threads ask for the same product at once, one computes it and the other waits
+// for it, instead of both computing it. The lock is only held to look up the key, so a compute
+// function can ask for other products (e.g a mask from a gradient image).
+class FrameCache final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(FrameCache)
+
+  FrameCache() = default;
+
+  // Returns the product for key, calling compute(product) if nobody has yet. Every caller for a key
+  // has to ask for the same type.
+  template <typename T>
+  std::shared_ptr<const T> Get(const std::string& key, const std::function<void(T&)>& compute)
+  {
+    std::shared_ptr<std::promise<Value>> promise;
+    std::shared_future<Value> future;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = entries_.find(key);
+      if (it == entries_.end()) {
+        promise = std::make_shared<std::promise<Value>>();
+        it = entries_.emplace(key, Entry(typeid(T), promise->get_future().share())).first;
+      }
+      CHECK(it->second.type == std::type_index(typeid(T)))
+          << "FrameCache product " << key << " was requested with two different types" << std::endl;
+      future = it->second.value;
+    }
+
+    if (promise) {
+      try {
+        std::shared_ptr<T> product = std::make_shared<T>();
+        compute(*product);
+        promise->set_value(std::static_pointer_cast<const void>(std::shared_ptr<const T>(std::move(product))));
+      } catch (...) {
+        promise->set_exception(std::current_exception());
+      }
+    }
+
+    return std::static_pointer_cast<const T>(future.get());
+  }
+
+  // Was key computed already (or is it being computed)?
+  bool Contains(const std::string& key) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.count(key) > 0;
+  }
+
+  // Number of products.
+  size_t Size() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+ private:
+  typedef std::shared_ptr<const void> Value;
+
+  struct Entry final
+  {
+    Entry(const std::type_info& type, std::shared_future<Value> value)
+        : type(type), value(std::move(value)) {}
+
+    std::type_index type;
+    std::shared_future<Value> value;
+  };
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+
+}
+}
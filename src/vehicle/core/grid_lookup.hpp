@@ -1,6 +1,7 @@
 #pragma once
 
-#include <list>
+#include <algorithm>
+#include <cassert>
 #include <vector>
 
 #include "core/eigen_types.hpp"
@@ -9,69 +10,157 @@ namespace bm {
 namespace core {
 
 
+// A read-only view of a contiguous range of items.
+template <typename Scalar>
+class ConstSpan final {
+ public:
+  ConstSpan(const Scalar* begin, const Scalar* end) : begin_(begin), end_(end) {}
+
+  const Scalar* begin() const { return begin_; }
+  const Scalar* end() const { return end_; }
+  size_t size() const { return static_cast<size_t>(end_ - begin_); }
+  bool empty() const { return begin_ == end_; }
+  const Scalar& operator[](size_t i) const { return begin_[i]; }
+
+ private:
+  const Scalar* begin_;
+  const Scalar* end_;
+};
+
+
+// A grid of "buckets" that items can be looked up in, stored in compressed sparse row (CSR) form:
+// the items for all cells are in one array, sorted by cell (row-major), and offsets_ has where
+// each cell starts. The grid is built all at once, and queries return spans into it (no copies).
+//
+// NOTE(milo): Since cells are row-major, the items in a range of columns within a row are
+// contiguous, so a rectangular region is just one span per row.
 template <typename Scalar>
 class GridLookup final {
  public:
-  GridLookup(int rows, int cols) : rows_(rows), cols_(cols) {
+  typedef ConstSpan<Scalar> Span;
+
+  GridLookup(int rows, int cols) : rows_(rows), cols_(cols)
+  {
     assert(rows >= 1 && cols >= 1);
 
     // Preallocate all of the grid memory.
-    grid_.resize(rows);
-    for (int i = 0; i < rows; ++i) {
-      grid_.at(i).resize(cols);
-    }
+    offsets_.resize(rows * cols + 1, 0);
   }
 
-  // Mutable accessor.
-  std::list<Scalar>& GetCellMutable(int row, int col)
+  // Rebuild the grid, where items.at(i) goes in the cell cells.at(i).
+  // NOTE(milo): Cells are (x, y) = (col, row), like image coordinates.
+  void Build(const std::vector<Vector2i>& cells, const std::vector<Scalar>& items)
   {
-    assert(row >= 0 && row < rows_ && col >= 0 && col < cols_);
-    return grid_.at(row).at(col);
+    assert(cells.size() == items.size());
+    BuildImpl(cells, [&items](size_t i) { return items[i]; });
+  }
+
+  // Rebuild the grid, where the index i goes in the cell cells.at(i).
+  void Build(const std::vector<Vector2i>& cells)
+  {
+    BuildImpl(cells, [](size_t i) { return static_cast<Scalar>(i); });
   }
 
-  // Immutable accessor.
-  std::list<Scalar> GetCell(int row, int col) const
+  // Items in one cell.
+  Span GetCell(int row, int col) const
   {
     assert(row >= 0 && row < rows_ && col >= 0 && col < cols_);
-    return grid_.at(row).at(col);
+    return GetRowSpan(row, col, col);
   }
 
-  std::list<Scalar> GetRoi(const core::Box2i& roi) const
+  // Items in the cells [min_col, max_col] of a row, which are contiguous.
+  Span GetRowSpan(int row, int min_col, int max_col) const
   {
-    std::list<Scalar> out;  // Must support out.insert(item.begin(), item.end()).
+    assert(row >= 0 && row < rows_ && min_col >= 0 && max_col < cols_ && min_col <= max_col);
+    const Scalar* data = items_.data();
+    return Span(data + offsets_[row * cols_ + min_col], data + offsets_[row * cols_ + max_col + 1]);
+  }
 
+  // Calls fn(const Span&) for each row within an roi of cells. The roi is clipped to the grid.
+  template <typename Function>
+  void ForEachRowInRoi(const core::Box2i& roi, Function fn) const
+  {
     const Vector2i& cmin = roi.min();
     const Vector2i& cmax = roi.max();
     const int min_x = std::max(0, cmin.x());
-    const int max_x = std::min(cols_, cmax.x() + 1);
+    const int max_x = std::min(cols_ - 1, cmax.x());
     const int min_y = std::max(0, cmin.y());
-    const int max_y = std::min(rows_, cmax.y() + 1);
+    const int max_y = std::min(rows_ - 1, cmax.y());
 
-    for (int col = min_x; col < max_x; ++col) {
-      for (int row = min_y; row < max_y; ++row) {
-        const std::list<Scalar>& cell_item = GetCell(row, col);
-        out.insert(out.begin(), cell_item.begin(), cell_item.end());
-      }
+    if (min_x > max_x) {
+      return;
     }
 
-    return out;
+    for (int row = min_y; row <= max_y; ++row) {
+      fn(GetRowSpan(row, min_x, max_x));
+    }
   }
 
-  void Clear()
+  // Calls fn(const Scalar&) for each item within an roi of cells.
+  template <typename Function>
+  void ForEachInRoi(const core::Box2i& roi, Function fn) const
   {
-    for (int row = 0; row < rows_; ++row) {
-      for (int col = 0; col < cols_; ++col) {
-        grid_.at(row).at(col).clear();
+    ForEachRowInRoi(roi, [&fn](const Span& span) {
+      for (const Scalar& item : span) {
+        fn(item);
       }
-    }
+    });
+  }
+
+  // Number of items within an roi of cells.
+  size_t CountInRoi(const core::Box2i& roi) const
+  {
+    size_t count = 0;
+    ForEachRowInRoi(roi, [&count](const Span& span) { count += span.size(); });
+    return count;
+  }
+
+  // Copies the items within an roi of cells into out (cleared first).
+  void GetRoi(const core::Box2i& roi, std::vector<Scalar>& out) const
+  {
+    out.clear();
+    ForEachRowInRoi(roi, [&out](const Span& span) { out.insert(out.end(), span.begin(), span.end()); });
+  }
+
+  void Clear()
+  {
+    std::fill(offsets_.begin(), offsets_.end(), 0);
+    items_.clear();
   }
 
   int Rows() const { return rows_; }
   int Cols() const { return cols_; }
+  size_t Size() const { return items_.size(); }
+
+ private:
+  // Counting sort of the items by cell. Buffers are reused, so nothing is allocated after warmup.
+  template <typename GetItem>
+  void BuildImpl(const std::vector<Vector2i>& cells, GetItem get_item)
+  {
+    const int num_cells = rows_ * cols_;
+
+    std::fill(offsets_.begin(), offsets_.end(), 0);
+    for (const Vector2i& cell : cells) {
+      assert(cell.y() >= 0 && cell.y() < rows_ && cell.x() >= 0 && cell.x() < cols_);
+      ++offsets_[cell.y() * cols_ + cell.x() + 1];
+    }
+    for (int c = 0; c < num_cells; ++c) {
+      offsets_[c + 1] += offsets_[c];
+    }
+
+    cursor_.assign(offsets_.begin(), offsets_.end() - 1);
+    items_.resize(cells.size());
+    for (size_t i = 0; i < cells.size(); ++i) {
+      const Vector2i& cell = cells[i];
+      items_[cursor_[cell.y() * cols_ + cell.x()]++] = get_item(i);
+    }
+  }
 
  private:
   int rows_, cols_;
-  std::vector<std::vector<std::list<Scalar>>> grid_;
+  std::vector<Scalar> items_;     // All items, sorted by cell.
+  std::vector<int> offsets_;      // Items for cell c are [offsets_[c], offsets_[c + 1]).
+  std::vector<int> cursor_;       // Scratch for Build().
 };
 
 }
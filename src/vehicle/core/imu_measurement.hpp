@@ -2,6 +2,7 @@
 
 #include "core/macros.hpp"
 #include "core/eigen_types.hpp"
+#include "core/pipeline_latency.hpp"
 #include "core/timestamp.hpp"
 
 namespace bm {
@@ -22,6 +23,7 @@ struct ImuMeasurement final
   timestamp_t timestamp = kMinTimestamp;
   Vector3d w = Vector3d::Zero();
   Vector3d a = Vector3d::Zero();
+  LatencyTags latency;
 };
 
 
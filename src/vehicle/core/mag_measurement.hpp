@@ -16,6 +16,10 @@ struct MagMeasurement final {
 
   timestamp_t timestamp;
   Vector3d field;
+
+  // Covariance of the field, if this is an average of several samples (see SampleAverage). If zero,
+  // the smoother uses its own mag noise model.
+  Matrix3d cov = Matrix3d::Zero();
 };
 
 
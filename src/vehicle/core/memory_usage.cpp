@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <fstream>
+
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "core/memory_usage.hpp"
+#include "core/stats_tracker.hpp"
+
+namespace bm {
+namespace core {
+
+
+static const double kBytesPerMb = 1024.0 * 1024.0;
+
+
+double ResidentSetSizeMb()
+{
+  std::ifstream statm("/proc/self/statm");
+  long total_pages = 0;
+  long resident_pages = 0;
+  if (!(statm >> total_pages >> resident_pages)) {
+    return -1.0;
+  }
+
+  return static_cast<double>(resident_pages) * static_cast<double>(sysconf(_SC_PAGESIZE)) / kBytesPerMb;
+}
+
+
+MemoryRegistry& MemoryRegistry::Get()
+{
+  static MemoryRegistry registry;
+  return registry;
+}
+
+
+size_t MemoryRegistry::Register(const std::string& name, const BytesFunction& bytes)
+{
+  CHECK(bytes) << "No function for " << name;
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry entry;
+  entry.id = next_id_++;
+  entry.bytes_function = bytes;
+  entry.usage.name = name;
+  entries_.emplace_back(std::move(entry));
+  return entries_.back().id;
+}
+
+
+void MemoryRegistry::Unregister(size_t id)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                [id](const Entry& e) { return e.id == id; }), entries_.end());
+}
+
+
+size_t MemoryRegistry::Poll()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t total = 0;
+  for (Entry& e : entries_) {
+    e.usage.bytes = e.bytes_function();
+    e.usage.peak_bytes = std::max(e.usage.peak_bytes, e.usage.bytes);
+    total += e.usage.bytes;
+  }
+
+  LOG_IF(WARNING, budget_bytes_ > 0 && total > budget_bytes_)
+      << "Subsystems hold " << total / kBytesPerMb << " MB, over the budget of "
+      << budget_bytes_ / kBytesPerMb << " MB" << std::endl;
+
+  return total;
+}
+
+
+std::vector<SubsystemMemory> MemoryRegistry::Usage() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<SubsystemMemory> usage;
+  usage.reserve(entries_.size());
+  for (const Entry& e : entries_) {
+    usage.emplace_back(e.usage);
+  }
+  return usage;
+}
+
+
+void MemoryRegistry::SetBudget(size_t budget_bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_bytes_ = budget_bytes;
+}
+
+
+size_t MemoryRegistry::Budget() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return budget_bytes_;
+}
+
+
+double FitToMemoryBudget(size_t budget_bytes, std::vector<MemoryKnob>& knobs)
+{
+  double fixed_bytes = 0;
+  double scalable_bytes = 0;
+  for (MemoryKnob& k : knobs) {
+    CHECK_GE(k.min_capacity, 0) << k.name;
+    k.min_capacity = std::min(k.min_capacity, k.capacity);
+    fixed_bytes += static_cast<double>(k.min_capacity) * k.bytes_per_unit;
+    scalable_bytes += static_cast<double>(k.capacity - k.min_capacity) * k.bytes_per_unit;
+  }
+
+  const double budget = static_cast<double>(budget_bytes);
+  if (fixed_bytes + scalable_bytes <= budget) {
+    return 1.0;
+  }
+
+  double scale = 0;
+  if (fixed_bytes > budget) {
+    LOG(WARNING) << "Even the min capacities need " << fixed_bytes / kBytesPerMb
+                 << " MB, over the budget of " << budget / kBytesPerMb << " MB" << std::endl;
+  } else {
+    scale = (budget - fixed_bytes) / scalable_bytes;
+  }
+
+  for (MemoryKnob& k : knobs) {
+    const int capacity = k.min_capacity + static_cast<int>(scale * (k.capacity - k.min_capacity));
+    LOG_IF(INFO, capacity != k.capacity) << "Memory budget lowered " << k.name << " from "
+        << k.capacity << " to " << capacity << std::endl;
+    k.capacity = capacity;
+  }
+
+  return scale;
+}
+
+
+void ReportMemoryUsage(StatsTracker& stats)
+{
+  const size_t total = MemoryRegistry::Get().Poll();
+  for (const SubsystemMemory& m : MemoryRegistry::Get().Usage()) {
+    stats.Add(stats.Register("Memory_" + m.name, "MB"), m.bytes / kBytesPerMb);
+  }
+  stats.Add(stats.Register("MemoryTotal", "MB"), total / kBytesPerMb);
+}
+
+
+}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+class StatsTracker;
+
+
+// Resident set size of this process (MB), from /proc/self/statm. Returns -1 if it can't be read
+// (e.g not on Linux).
+double ResidentSetSizeMb();
+
+
+// Bytes held by one subsystem as of the last MemoryRegistry::Poll(), and the most it has held.
+struct SubsystemMemory final
+{
+  std::string name;
+  size_t bytes = 0;
+  size_t peak_bytes = 0;
+};
+
+
+// Subsystems that hold a lot of data in memory (queues, histories, caches) register a function here
+// that returns how many bytes they hold right now, so that usage can be reported per subsystem in one
+// place. The RSS only says that the process is too big, not which part of it grew.
+// NOTE(milo): The functions are called from whichever thread polls, so they have to be threadsafe
+// (e.g Size() of a threadsafe queue times the bytes per item).
+class MemoryRegistry final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(MemoryRegistry)
+
+  typedef std::function<size_t()> BytesFunction;
+
+  // One registry per process.
+  static MemoryRegistry& Get();
+
+  // Returns an id to pass to Unregister(). Names don't have to be unique.
+  size_t Register(const std::string& name, const BytesFunction& bytes);
+
+  // Must be called before whatever the function reads is destroyed.
+  void Unregister(size_t id);
+
+  // Call every function, and update the peaks. Returns the total bytes.
+  size_t Poll();
+
+  // Usage as of the last Poll(), in the order that subsystems were registered.
+  std::vector<SubsystemMemory> Usage() const;
+
+  // A budget for everything registered (zero = none). If a Poll() goes over it, a warning is logged,
+  // but nothing is freed, since only the subsystems know what is safe to drop (see FitToMemoryBudget).
+  void SetBudget(size_t budget_bytes);
+  size_t Budget() const;
+
+ private:
+  MemoryRegistry() = default;
+
+  struct Entry
+  {
+    size_t id;
+    BytesFunction bytes_function;
+    SubsystemMemory usage;
+  };
+
+  mutable std::mutex mutex_;
+  std::vector<Entry> entries_;
+  size_t next_id_ = 0;
+  size_t budget_bytes_ = 0;
+};
+
+
+// A capacity (the max size of a queue, the length of a history) that can be lowered to save memory.
+struct MemoryKnob final
+{
+  MemoryKnob(const std::string& name, int capacity, size_t bytes_per_unit, int min_capacity)
+      : name(name), capacity(capacity), bytes_per_unit(bytes_per_unit), min_capacity(min_capacity) {}
+
+  std::string name;
+  int capacity;             // Set to the capacity that fits the budget.
+  size_t bytes_per_unit;
+  int min_capacity;         // Never scaled below this (set it to capacity to keep it fixed).
+};
+
+
+// Scale every knob's capacity above its min_capacity by the same factor, so that all of them
+// together are at most budget_bytes when they're full. Capacities are only ever lowered. Returns
+// the factor, which is 1 if everything already fits, and 0 if even the min capacities don't fit (in
+// which case they're used anyway, with a warning).
+double FitToMemoryBudget(size_t budget_bytes, std::vector<MemoryKnob>& knobs);
+
+
+// Poll the MemoryRegistry, and add each subsystem's usage and the total to stats (MB).
+void ReportMemoryUsage(StatsTracker& stats);
+
+
+}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A condition variable that consumer threads can block on instead of sleep-polling. Queues call
+// Notify() whenever an item is pushed. Several queues can share one Notifier, which lets a consumer
+// sleep until ANY of its inputs has data.
+//
+// NOTE(milo): Notify() doesn't take a lock unless somebody is waiting, so it's cheap to call from
+// sensor callbacks.
+class Notifier final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(Notifier)
+
+  Notifier() = default;
+
+  // Wake up all waiting threads.
+  void Notify()
+  {
+    generation_.fetch_add(1);
+
+    // Pairs with the fence in WaitFor() so that a waiter can't miss this notification.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_waiters_.load() == 0) {
+      return;
+    }
+
+    mutex_.lock();
+    mutex_.unlock();
+    cv_.notify_all();
+  }
+
+  // Number of times Notify() has been called. Pass this to WaitForNotify() to find out about any
+  // notifications that happen after this point.
+  uint64_t Generation() const { return generation_.load(); }
+
+  // Block until pred() returns true, or until timeout_sec has elapsed. Returns pred().
+  template <typename Predicate>
+  bool WaitFor(Predicate pred, double timeout_sec)
+  {
+    if (pred()) {
+      return true;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_waiters_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    const bool result = cv_.wait_for(lock, std::chrono::duration<double>(timeout_sec), pred);
+
+    num_waiters_.fetch_sub(1);
+    return result;
+  }
+
+  // Block until Notify() has been called since "generation" (see Generation()), or until
+  // timeout_sec has elapsed. Returns whether there was a notification.
+  bool WaitForNotify(uint64_t generation, double timeout_sec)
+  {
+    return WaitFor([this, generation]() { return generation_.load() != generation; }, timeout_sec);
+  }
+
+ private:
+  std::atomic<uint64_t> generation_{0};
+  std::atomic<int> num_waiters_{0};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+
+}
+}
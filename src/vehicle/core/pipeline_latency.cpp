@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <limits>
+
+#include "core/pipeline_latency.hpp"
+
+namespace bm {
+namespace core {
+
+
+LatencyHistogram::LatencyHistogram()
+    : bin_counts_(BinUpperEdges().size(), 0) {}
+
+
+const std::vector<float>& LatencyHistogram::BinUpperEdges()
+{
+  static const std::vector<float> edges = {
+      0.1f, 0.2f, 0.5f, 1.0f, 2.0f, 5.0f, 10.0f, 20.0f, 50.0f, 100.0f, 200.0f, 500.0f,
+      1000.0f, 2000.0f, 5000.0f, std::numeric_limits<float>::max() };
+  return edges;
+}
+
+
+void LatencyHistogram::Add(float ms)
+{
+  const std::vector<float>& edges = BinUpperEdges();
+  const size_t bin = std::lower_bound(edges.begin(), edges.end() - 1, ms) - edges.begin();
+  ++bin_counts_.at(bin);
+  ++count_;
+  max_ = std::max(max_, ms);
+}
+
+
+float LatencyHistogram::Percentile(float p) const
+{
+  if (count_ == 0) {
+    return 0;
+  }
+
+  const std::vector<float>& edges = BinUpperEdges();
+  const float rank = p * static_cast<float>(count_);
+
+  int below = 0;
+  for (size_t i = 0; i < bin_counts_.size(); ++i) {
+    if (bin_counts_.at(i) == 0 || static_cast<float>(below + bin_counts_.at(i)) < rank) {
+      below += bin_counts_.at(i);
+      continue;
+    }
+
+    // NOTE(milo): The top bin is unbounded, so use the largest latency we've seen as its edge.
+    const float lower = (i == 0) ? 0.0f : edges.at(i - 1);
+    const float upper = std::min(edges.at(i), max_);
+    const float frac = (rank - static_cast<float>(below)) / static_cast<float>(bin_counts_.at(i));
+    return std::min(max_, lower + frac * std::max(0.0f, upper - lower));
+  }
+
+  return max_;
+}
+
+
+void PipelineLatencyStats::Add(const std::string& output, const PipelineLatency& latency)
+{
+  if (!latency.valid) {
+    return;
+  }
+
+  const std::pair<const char*, float> stages[] = {
+    { "decode", latency.decode_ms },
+    { "queue", latency.queue_ms },
+    { "frontend", latency.frontend_ms },
+    { "smoother", latency.smoother_ms },
+    { "filter", latency.filter_ms }
+  };
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& stage : stages) {
+    if (stage.second > 0) {
+      histograms_[output + "/" + stage.first].Add(stage.second);
+    }
+  }
+  histograms_[output + "/total"].Add(latency.total_ms);
+}
+
+
+std::vector<LatencyStageSummary> PipelineLatencyStats::Summarize(bool reset)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::vector<LatencyStageSummary> out;
+  for (const auto& it : histograms_) {
+    const LatencyHistogram& h = it.second;
+    LatencyStageSummary s;
+    s.name = it.first;
+    s.count = h.Count();
+    s.p50_ms = h.Percentile(0.50f);
+    s.p95_ms = h.Percentile(0.95f);
+    s.p99_ms = h.Percentile(0.99f);
+    s.max_ms = h.Max();
+    s.bin_counts = h.BinCounts();
+    out.emplace_back(std::move(s));
+  }
+
+  if (reset) {
+    histograms_.clear();
+  }
+
+  return out;
+}
+
+
+}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace bm {
+namespace core {
+
+
+// Nanoseconds on the steady clock. Only differences between two of these mean anything.
+typedef int64_t steady_ns_t;
+
+inline steady_ns_t SteadyNowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Milliseconds from t0 to t1, or zero if either wasn't recorded.
+inline float ElapsedMs(steady_ns_t t0, steady_ns_t t1)
+{
+  return (t0 == 0 || t1 == 0) ? 0.0f : static_cast<float>(t1 - t0) * 1e-6f;
+}
+
+
+// When a measurement passed through each stage of the pipeline (zero = hasn't happened). These use
+// the steady clock instead of the sensor timestamp, since sensor clocks aren't synced with ours.
+struct LatencyTags final
+{
+  steady_ns_t received = 0;     // Arrived in this process (e.g the LCM handler ran).
+  steady_ns_t decoded = 0;      // Ready to use (e.g images are decoded).
+  steady_ns_t dequeued = 0;     // A processing thread popped it from its queue.
+  steady_ns_t processed = 0;    // The processing thread is done with it (e.g the frontend).
+};
+
+
+// Where the time went between a measurement arriving and an estimate that used it. Stages that the
+// measurement didn't go through are zero.
+struct PipelineLatency final
+{
+  bool valid = false;       // False if the estimate didn't come from a tagged measurement.
+  float decode_ms = 0;
+  float queue_ms = 0;       // Waiting for the first processing thread (frontend or filter).
+  float frontend_ms = 0;
+  float smoother_ms = 0;    // Includes waiting in the smoother's queue.
+  float filter_ms = 0;
+  float total_ms = 0;
+};
+
+
+// Counts latencies in fixed, roughly logarithmic bins (see BinUpperEdges()).
+class LatencyHistogram final {
+ public:
+  LatencyHistogram();
+
+  void Add(float ms);
+
+  // Percentile p in [0, 1], interpolated within the bin that it falls in.
+  float Percentile(float p) const;
+
+  int Count() const { return count_; }
+  float Max() const { return max_; }
+  const std::vector<int>& BinCounts() const { return bin_counts_; }
+
+  // Upper edge (ms) of each bin. The last bin counts everything above the second to last edge.
+  static const std::vector<float>& BinUpperEdges();
+
+ private:
+  std::vector<int> bin_counts_;
+  int count_ = 0;
+  float max_ = 0;
+};
+
+
+struct LatencyStageSummary final
+{
+  std::string name;
+  int count = 0;
+  float p50_ms = 0;
+  float p95_ms = 0;
+  float p99_ms = 0;
+  float max_ms = 0;
+  std::vector<int> bin_counts;
+};
+
+
+// Keeps a LatencyHistogram for each stage of each output (e.g "filter/queue", "smoother/total").
+// Add() and Summarize() are threadsafe.
+class PipelineLatencyStats final {
+ public:
+  PipelineLatencyStats() = default;
+
+  // Adds each stage that has a latency, along with the total. Does nothing if !latency.valid.
+  void Add(const std::string& output, const PipelineLatency& latency);
+
+  // Summaries of everything added since the last Summarize(reset=true), sorted by name.
+  std::vector<LatencyStageSummary> Summarize(bool reset = true);
+
+ private:
+  std::mutex mutex_;
+  std::map<std::string, LatencyHistogram> histograms_;
+};
+
+
+}
+}
@@ -0,0 +1,160 @@
+#include <glog/logging.h>
+
+#include "core/pose_history.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A reader only fails this many times in a row if the writer keeps lapping it.
+static const int kMaxLookupAttempts = 16;
+
+
+PoseHistory::PoseHistory(size_t capacity, double max_gap_sec)
+    : capacity_(capacity),
+      max_gap_(ConvertToNanoseconds(max_gap_sec)),
+      slots_(new SeqLock<Sample>[capacity])
+{
+  CHECK_GE(capacity_, 2ul);
+  CHECK_GT(max_gap_sec, 0);
+}
+
+
+void PoseHistory::Add(timestamp_t timestamp, const SE3& world_T_body)
+{
+  const uint64_t begin = begin_.load(std::memory_order_relaxed);
+  uint64_t end = end_.load(std::memory_order_relaxed);
+
+  // Drop anything at or after this timestamp. Readers stop seeing it once end_ is stored.
+  Sample newest;
+  while (end > begin && slots_[(end - 1) % capacity_].Load(newest) && newest.timestamp >= timestamp) {
+    --end;
+  }
+  end_.store(end, std::memory_order_release);
+
+  // Forget the oldest sample before its slot gets overwritten.
+  if ((end - begin) >= capacity_) {
+    begin_.store(end + 1 - capacity_, std::memory_order_release);
+  }
+
+  Sample sample;
+  sample.index = end;
+  sample.timestamp = timestamp;
+  sample.world_T_body = world_T_body;
+  slots_[end % capacity_].Store(sample);
+
+  end_.store(end + 1, std::memory_order_release);
+}
+
+
+bool PoseHistory::Read(uint64_t i, Sample& out) const
+{
+  return slots_[i % capacity_].Load(out) && out.index == i;
+}
+
+
+bool PoseHistory::LowerBound(uint64_t begin, uint64_t end, timestamp_t timestamp, uint64_t& i) const
+{
+  Sample sample;
+  uint64_t lo = begin, hi = end;
+  while (lo < hi) {
+    const uint64_t mid = lo + (hi - lo) / 2;
+    if (!Read(mid, sample)) {
+      return false;
+    }
+    if (sample.timestamp < timestamp) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  i = lo;
+  return true;
+}
+
+
+bool PoseHistory::Lookup(timestamp_t timestamp, SE3& world_T_body) const
+{
+  for (int attempt = 0; attempt < kMaxLookupAttempts; ++attempt) {
+    const uint64_t begin = begin_.load(std::memory_order_acquire);
+    const uint64_t end = end_.load(std::memory_order_acquire);
+
+    uint64_t i = 0;
+    if (begin >= end) {
+      return false;
+    }
+    if (!LowerBound(begin, end, timestamp, i)) {
+      continue;
+    }
+    if (i == end) {
+      return false;
+    }
+
+    Sample after;
+    if (!Read(i, after)) {
+      continue;
+    }
+    if (after.timestamp == timestamp) {
+      world_T_body = after.world_T_body;
+      return true;
+    }
+    if (i == begin) {
+      return false;
+    }
+
+    Sample before;
+    // NOTE(milo): If the writer replaced poses during the search, the two might not bracket the
+    // timestamp anymore, so check instead of trusting the search.
+    if (!Read(i - 1, before) || before.timestamp >= timestamp || after.timestamp < timestamp) {
+      continue;
+    }
+    if ((after.timestamp - before.timestamp) > max_gap_) {
+      return false;
+    }
+
+    // Slerp the rotation, and lerp the translation.
+    const double s = static_cast<double>(timestamp - before.timestamp) /
+                     static_cast<double>(after.timestamp - before.timestamp);
+    const Quaterniond q0 = before.world_T_body.ToQuaternion();
+    const Quaterniond q1 = after.world_T_body.ToQuaternion();
+    world_T_body = SE3(q0.slerp(s, q1).normalized(),
+                       (1.0 - s) * before.world_T_body.translation() + s * after.world_T_body.translation());
+    return true;
+  }
+
+  return false;
+}
+
+
+bool PoseHistory::Span(timestamp_t& oldest, timestamp_t& newest) const
+{
+  for (int attempt = 0; attempt < kMaxLookupAttempts; ++attempt) {
+    const uint64_t begin = begin_.load(std::memory_order_acquire);
+    const uint64_t end = end_.load(std::memory_order_acquire);
+    if (begin >= end) {
+      return false;
+    }
+
+    Sample first, last;
+    if (Read(begin, first) && Read(end - 1, last)) {
+      oldest = first.timestamp;
+      newest = last.timestamp;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+size_t PoseHistory::Size() const
+{
+  const uint64_t begin = begin_.load(std::memory_order_acquire);
+  const uint64_t end = end_.load(std::memory_order_acquire);
+  return (end > begin) ? static_cast<size_t>(end - begin) : 0;
+}
+
+
+}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "core/macros.hpp"
+#include "core/se3.hpp"
+#include "core/seqlock.hpp"
+#include "core/timestamp.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Keeps the last "capacity" poses (e.g world_T_body) from ONE writer thread, so that any number of
+// reader threads can look up the pose at an arbitrary timestamp (e.g of an image) without keeping
+// their own buffers. Lookups are a binary search, and interpolate between the two poses around the
+// timestamp (slerp for rotation, lerp for translation).
+//
+// NOTE(milo): Neither side takes a lock. The poses are in a ring of SeqLock slots, and each slot
+// remembers which sample (counting from the first Add()) it holds, so a reader can tell when the
+// writer overwrote a slot halfway through a lookup. It retries in that case, which only happens if
+// it was descheduled for about "capacity" Add() calls.
+class PoseHistory final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(PoseHistory)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(PoseHistory)
+
+  // Don't interpolate across a gap larger than max_gap_sec between two poses.
+  PoseHistory(size_t capacity, double max_gap_sec);
+
+  // Add the pose at timestamp. Poses should be added in time order. A pose at or before the newest
+  // one replaces every pose from its timestamp onwards (e.g after a filter is rewound). Only call
+  // this from one thread at a time.
+  void Add(timestamp_t timestamp, const SE3& world_T_body);
+
+  // Find the pose at timestamp, interpolated from the poses before and after it. Returns false if
+  // timestamp is outside of the stored poses, or in a gap that is too large. Threadsafe.
+  bool Lookup(timestamp_t timestamp, SE3& world_T_body) const;
+
+  // Timestamps of the oldest and newest stored poses. Returns false if there aren't any.
+  bool Span(timestamp_t& oldest, timestamp_t& newest) const;
+
+  // Number of stored poses.
+  size_t Size() const;
+
+ private:
+  struct Sample final
+  {
+    uint64_t index = 0;       // Which sample this is (see begin_ and end_).
+    timestamp_t timestamp = 0;
+    SE3 world_T_body;
+  };
+
+  // Reads sample i into "out". Returns false if its slot was overwritten by a newer sample.
+  bool Read(uint64_t i, Sample& out) const;
+
+  // Finds the first sample in [begin, end) with a timestamp >= timestamp (i = end if there is none).
+  // Returns false if a slot was overwritten during the search.
+  bool LowerBound(uint64_t begin, uint64_t end, timestamp_t timestamp, uint64_t& i) const;
+
+ private:
+  size_t capacity_;
+  timestamp_t max_gap_;
+
+  std::unique_ptr<SeqLock<Sample>[]> slots_;
+
+  // Samples [begin_, end_) are stored, with sample i in slot i % capacity_.
+  std::atomic<uint64_t> begin_{0};
+  std::atomic<uint64_t> end_{0};
+};
+
+
+}
+}
@@ -0,0 +1,168 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
+
+#include <glog/logging.h>
+
+#include "core/profiler.hpp"
+
+namespace bm {
+namespace core {
+
+static const size_t kSpansPerThreadBuffer = 4096;   // Max spans buffered per thread between Collect().
+static const size_t kMaxHistorySpans = 200000;      // Max spans kept for trace export.
+static const size_t kSamplesPerName = 1000;         // Percentiles are over the latest N spans.
+
+// Each thread gets its own buffer and a small integer id for the trace.
+static thread_local SpscQueue<ProfileSpan>* tl_buffer = nullptr;
+static thread_local uint32_t tl_thread_id = 0;
+static thread_local uint32_t tl_depth = 0;
+static std::atomic<uint32_t> g_next_thread_id{0};
+
+
+Profiler& Profiler::Instance()
+{
+  static Profiler instance;
+  return instance;
+}
+
+
+uint64_t Profiler::NowNanoseconds()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+SpscQueue<ProfileSpan>* Profiler::ThreadBuffer()
+{
+  // NOTE(milo): Only the first span on each thread takes the lock.
+  if (tl_buffer == nullptr) {
+    lock_.lock();
+    buffers_.emplace_back(new SpscQueue<ProfileSpan>(kSpansPerThreadBuffer, true, "profiler"));
+    tl_buffer = buffers_.back().get();
+    tl_thread_id = g_next_thread_id.fetch_add(1);
+    lock_.unlock();
+  }
+  return tl_buffer;
+}
+
+
+void Profiler::Record(const ProfileSpan& span)
+{
+  SpscQueue<ProfileSpan>* buffer = ThreadBuffer();
+  ProfileSpan stamped = span;
+  stamped.thread_id = tl_thread_id;
+  buffer->Push(stamped);
+}
+
+
+void Profiler::CollectNoLock()
+{
+  ProfileSpan span;
+  for (const std::unique_ptr<SpscQueue<ProfileSpan>>& buffer : buffers_) {
+    while (buffer->PopIfNonEmpty(span)) {
+      history_.emplace_back(span);
+
+      if (durations_ms_.count(span.name) == 0) {
+        durations_ms_.emplace(span.name, StatsBuffer<float>(kSamplesPerName));
+      }
+      durations_ms_.at(span.name).Add(1e-6f * static_cast<float>(span.duration_ns));
+    }
+  }
+
+  while (history_.size() > kMaxHistorySpans) {
+    history_.pop_front();
+  }
+}
+
+
+void Profiler::Collect()
+{
+  lock_.lock();
+  CollectNoLock();
+  lock_.unlock();
+}
+
+
+std::vector<ProfileSummary> Profiler::Summarize()
+{
+  std::vector<ProfileSummary> out;
+
+  lock_.lock();
+  CollectNoLock();
+
+  for (const auto& item : durations_ms_) {
+    ProfileSummary summary;
+    summary.name = item.first;
+
+    float unused_min, unused_mean;
+    item.second.MinMaxMean(summary.count, unused_min, summary.max_ms, unused_mean);
+    item.second.Percentiles(summary.count, summary.p50_ms, summary.p95_ms, summary.p99_ms);
+    out.emplace_back(summary);
+  }
+  lock_.unlock();
+
+  return out;
+}
+
+
+bool Profiler::ExportChromeTrace(const std::string& filepath)
+{
+  std::ofstream out(filepath.c_str());
+  if (!out.is_open()) {
+    LOG(WARNING) << "Could not open trace file: " << filepath << std::endl;
+    return false;
+  }
+
+  lock_.lock();
+  CollectNoLock();
+
+  // https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+  // Complete events ("ph": "X") have their start and duration in microseconds.
+  out << "{\"traceEvents\":[\n";
+  for (size_t i = 0; i < history_.size(); ++i) {
+    const ProfileSpan& span = history_.at(i);
+    out << "{\"name\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":0"
+        << ",\"tid\":" << span.thread_id
+        << ",\"ts\":" << (1e-3 * static_cast<double>(span.start_ns))
+        << ",\"dur\":" << (1e-3 * static_cast<double>(span.duration_ns))
+        << ",\"args\":{\"depth\":" << span.depth << "}}"
+        << ((i + 1) < history_.size() ? ",\n" : "\n");
+  }
+  out << "]}\n";
+  lock_.unlock();
+
+  out.close();
+  return true;
+}
+
+
+void Profiler::Clear()
+{
+  lock_.lock();
+  CollectNoLock();
+  history_.clear();
+  durations_ms_.clear();
+  lock_.unlock();
+}
+
+
+ScopedProfile::ScopedProfile(const char* name)
+    : name_(name),
+      start_ns_(Profiler::NowNanoseconds()),
+      depth_(tl_depth++) {}
+
+
+ScopedProfile::~ScopedProfile()
+{
+  const uint64_t end_ns = Profiler::NowNanoseconds();
+  --tl_depth;
+
+  Profiler& profiler = Profiler::Instance();
+  profiler.Record(ProfileSpan(name_, start_ns_, end_ns - start_ns_, 0, depth_));
+}
+
+
+}
+}
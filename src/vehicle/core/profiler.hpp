@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "core/alloc_tracker.hpp"
+#include "core/macros.hpp"
+#include "core/spsc_queue.hpp"
+#include "core/stats_tracker.hpp"
+
+// Time the enclosing scope and record it with the global Profiler. Spans nest, so a span inside of
+// another span shows up as its child in the trace. Build with -DBM_ENABLE_PROFILING to turn these
+// on; otherwise they compile to nothing. Each scope is also an allocation stage (see
+// core/alloc_tracker.hpp), in a build with -DBM_ENABLE_ALLOC_TRACKING.
+// NOTE(milo): The name must be a string literal (it's stored as a pointer, not copied).
+#define MACRO_PROFILE_CONCAT_INNER(a, b) a##b
+#define MACRO_PROFILE_CONCAT(a, b) MACRO_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef BM_ENABLE_PROFILING
+#define MACRO_PROFILE_SCOPE(name) \
+  ::bm::core::ScopedProfile MACRO_PROFILE_CONCAT(profile_scope_, __LINE__)(name); \
+  MACRO_ALLOC_STAGE(name)
+#else
+#define MACRO_PROFILE_SCOPE(name) MACRO_ALLOC_STAGE(name)
+#endif
+
+namespace bm {
+namespace core {
+
+
+// A timed span of code on one thread.
+struct ProfileSpan final
+{
+  ProfileSpan() = default;
+
+  explicit ProfileSpan(const char* name,
+                       uint64_t start_ns,
+                       uint64_t duration_ns,
+                       uint32_t thread_id,
+                       uint32_t depth)
+      : name(name),
+        start_ns(start_ns),
+        duration_ns(duration_ns),
+        thread_id(thread_id),
+        depth(depth) {}
+
+  const char* name = "";
+  uint64_t start_ns = 0;
+  uint64_t duration_ns = 0;
+  uint32_t thread_id = 0;
+  uint32_t depth = 0;           // Nesting level, where 0 is an outermost span.
+};
+
+
+// Duration statistics for all recent spans with the same name.
+struct ProfileSummary final
+{
+  std::string name;
+  int count = 0;
+  float p50_ms = 0;
+  float p95_ms = 0;
+  float p99_ms = 0;
+  float max_ms = 0;
+};
+
+
+// Collects spans from every thread. Recording never blocks: each thread pushes into its own
+// lock-free buffer, and Collect() drains them later. If a thread records faster than the buffers
+// are collected, its oldest spans are dropped.
+class Profiler final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(Profiler)
+
+  static Profiler& Instance();
+
+  // Called by ScopedProfile when a span finishes. The span's thread_id is filled in here.
+  void Record(const ProfileSpan& span);
+
+  // Drain the per-thread buffers into the trace history and per-name stats.
+  void Collect();
+
+  // Collect(), then return p50/p95/p99/max durations for each span name.
+  std::vector<ProfileSummary> Summarize();
+
+  // Collect(), then write the trace history in the Chrome trace event format (load it in
+  // chrome://tracing or Perfetto). Returns whether the file was written.
+  bool ExportChromeTrace(const std::string& filepath);
+
+  // Throw away all collected spans and stats.
+  void Clear();
+
+  static uint64_t NowNanoseconds();
+
+ private:
+  Profiler() = default;
+
+  // Get (or create) the calling thread's span buffer.
+  SpscQueue<ProfileSpan>* ThreadBuffer();
+
+  void CollectNoLock();
+
+ private:
+  std::mutex lock_;
+  std::vector<std::unique_ptr<SpscQueue<ProfileSpan>>> buffers_;
+  std::deque<ProfileSpan> history_;
+  std::unordered_map<std::string, StatsBuffer<float>> durations_ms_;
+};
+
+
+// Records a span from construction to destruction. Use MACRO_PROFILE_SCOPE instead of this.
+class ScopedProfile final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ScopedProfile)
+  MACRO_DELETE_COPY_CONSTRUCTORS(ScopedProfile)
+
+  explicit ScopedProfile(const char* name);
+  ~ScopedProfile();
+
+ private:
+  const char* name_;
+  uint64_t start_ns_;
+  uint32_t depth_;
+};
+
+
+}
+}
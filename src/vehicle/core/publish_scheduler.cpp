@@ -0,0 +1,151 @@
+#include <algorithm>
+
+#include "core/publish_scheduler.hpp"
+
+namespace bm {
+namespace core {
+
+
+PublishScheduler::PublishScheduler(const std::string& name)
+    : name_(name) {}
+
+
+PublishScheduler::~PublishScheduler()
+{
+  Stop();
+}
+
+
+PublishScheduler::ChannelId PublishScheduler::AddPeriodic(const std::string& name,
+                                                          double target_hz,
+                                                          const std::function<void()>& publish)
+{
+  CHECK(!thread_.joinable()) << "Add channels before starting " << name_ << std::endl;
+  CHECK_GT(target_hz, 0.0) << "Periodic channel " << name << " needs a rate" << std::endl;
+  channels_.emplace_back(new PeriodicChannel(name, target_hz, publish));
+  return channels_.size() - 1;
+}
+
+
+void PublishScheduler::SetTargetHz(ChannelId id, double target_hz)
+{
+  Channel& channel = *channels_.at(id);
+  CHECK(channel.periodic ? (target_hz > 0.0) : (target_hz >= 0.0)) << "Channel " << channel.name << std::endl;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    channel.SetTargetHz(target_hz);
+  }
+  cv_.notify_one();
+}
+
+
+void PublishScheduler::Start()
+{
+  CHECK(!thread_.joinable()) << name_ << " was already started" << std::endl;
+
+  const Clock::time_point now = Clock::now();
+  for (const std::unique_ptr<Channel>& channel : channels_) {
+    channel->last_publish = now;
+  }
+
+  is_shutdown_ = false;
+  thread_ = std::thread(&PublishScheduler::PublishLoop, this);
+}
+
+
+void PublishScheduler::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_shutdown_ = true;
+  }
+  cv_.notify_one();
+
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+
+size_t PublishScheduler::NumPublished(ChannelId id) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return channels_.at(id)->num_published;
+}
+
+
+size_t PublishScheduler::NumCoalesced(ChannelId id) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return channels_.at(id)->num_coalesced;
+}
+
+
+void PublishScheduler::TakeDue(Clock::time_point now,
+                               bool flush,
+                               std::vector<Channel*>& due,
+                               Clock::time_point& next_due)
+{
+  due.clear();
+  next_due = Clock::time_point::max();
+
+  for (const std::unique_ptr<Channel>& channel : channels_) {
+    if (flush ? !channel->has_pending : (!channel->has_pending && !channel->periodic)) {
+      continue;
+    }
+
+    const Clock::time_point t = channel->last_publish + channel->period;
+    if (flush || t <= now) {
+      channel->Take();
+      channel->has_pending = false;
+      channel->last_publish = now;
+      ++channel->num_published;
+      due.emplace_back(channel.get());
+    } else {
+      next_due = std::min(next_due, t);
+    }
+  }
+}
+
+
+void PublishScheduler::PublishLoop()
+{
+  LOG(INFO) << "Started up " << name_ << " thread" << std::endl;
+
+  std::vector<Channel*> due;
+  Clock::time_point next_due;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!is_shutdown_) {
+    TakeDue(Clock::now(), false, due, next_due);
+
+    if (due.empty()) {
+      // NOTE(milo): Update() and SetTargetHz() wake this up, since either can make a channel due.
+      if (next_due == Clock::time_point::max()) {
+        cv_.wait(lock);
+      } else {
+        cv_.wait_until(lock, next_due);
+      }
+      continue;
+    }
+
+    lock.unlock();
+    for (Channel* channel : due) {
+      channel->Publish();
+    }
+    lock.lock();
+  }
+
+  TakeDue(Clock::now(), true, due, next_due);
+  lock.unlock();
+  for (Channel* channel : due) {
+    channel->Publish();
+  }
+
+  LOG(INFO) << "Shutdown " << name_ << " thread" << std::endl;
+}
+
+
+}
+}
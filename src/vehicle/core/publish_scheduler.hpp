@@ -0,0 +1,165 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Publishes the latest value of several outputs (e.g the filter state, smoother result and stats),
+// each at its own rate, from one dedicated thread. Producers just hand over their latest value with
+// Update(), which copies it and returns. If a channel gets several updates between two publishes,
+// only the latest one is published (they're "coalesced"), so a slow consumer (or a slow publish
+// function) never holds up the thread that produced the value.
+//
+// Periodic channels don't have a value, and call their publish function at their rate no matter
+// what (e.g to gather and publish stats).
+//
+// NOTE(milo): Rates are wall-clock, not data timestamps. Channels are added before Start(), and
+// Update() takes the channel's value type that it was added with.
+class PublishScheduler final {
+ public:
+  typedef size_t ChannelId;
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(PublishScheduler)
+
+  explicit PublishScheduler(const std::string& name = "PublishScheduler");
+
+  // Stops the thread (see Stop()).
+  ~PublishScheduler();
+
+  // Adds a channel that publishes the latest value passed to Update() at most target_hz times per
+  // second. Zero publishes every update that the thread gets to.
+  template <typename ValueType>
+  ChannelId AddChannel(const std::string& name, double target_hz, const std::function<void(const ValueType&)>& publish)
+  {
+    CHECK(!thread_.joinable()) << "Add channels before starting " << name_ << std::endl;
+    CHECK_GE(target_hz, 0.0) << "Channel " << name << std::endl;
+    channels_.emplace_back(new ValueChannel<ValueType>(name, target_hz, publish));
+    return channels_.size() - 1;
+  }
+
+  // Adds a channel that calls publish() target_hz times per second.
+  ChannelId AddPeriodic(const std::string& name, double target_hz, const std::function<void()>& publish);
+
+  // Hands over the latest value for a channel. Threadsafe, and doesn't wait on any publishing.
+  template <typename ValueType>
+  void Update(ChannelId id, const ValueType& value)
+  {
+    ValueChannel<ValueType>* channel = dynamic_cast<ValueChannel<ValueType>*>(channels_.at(id).get());
+    CHECK(channel != nullptr) << "Wrong value type for channel " << channels_.at(id)->name << std::endl;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (channel->pending) {
+        *channel->pending = value;
+      } else {
+        channel->pending.reset(new ValueType(value));
+      }
+      channel->num_coalesced += channel->has_pending ? 1 : 0;
+      channel->has_pending = true;
+    }
+    cv_.notify_one();
+  }
+
+  // Change a channel's rate (e.g from a params reload). Threadsafe.
+  void SetTargetHz(ChannelId id, double target_hz);
+
+  // Starts the publishing thread.
+  void Start();
+
+  // Publishes any updates that are still waiting (regardless of their rate), then stops the thread.
+  void Stop();
+
+  // Number of times a channel was published, and the number of updates that were replaced by a
+  // newer one before they could be published.
+  size_t NumPublished(ChannelId id) const;
+  size_t NumCoalesced(ChannelId id) const;
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Channel
+  {
+    Channel(const std::string& name, double target_hz, bool periodic)
+        : name(name), periodic(periodic) { SetTargetHz(target_hz); }
+
+    virtual ~Channel() = default;
+
+    void SetTargetHz(double target_hz)
+    {
+      period = std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>((target_hz > 0) ? (1.0 / target_hz) : 0.0));
+    }
+
+    // Called under the lock: moves the pending value out so that Publish() can use it unlocked.
+    virtual void Take() {}
+
+    // Called on the publishing thread, without the lock.
+    virtual void Publish() = 0;
+
+    std::string name;
+    bool periodic;
+    Clock::duration period;
+    Clock::time_point last_publish;
+    bool has_pending = false;
+    size_t num_published = 0;
+    size_t num_coalesced = 0;
+  };
+
+  struct PeriodicChannel final : public Channel
+  {
+    PeriodicChannel(const std::string& name, double target_hz, const std::function<void()>& publish)
+        : Channel(name, target_hz, true), publish(publish) {}
+
+    void Publish() override { publish(); }
+
+    std::function<void()> publish;
+  };
+
+  // NOTE(milo): The pending and published values swap places, so that Update() reuses the last
+  // published value's memory instead of allocating.
+  template <typename ValueType>
+  struct ValueChannel final : public Channel
+  {
+    ValueChannel(const std::string& name, double target_hz, const std::function<void(const ValueType&)>& publish)
+        : Channel(name, target_hz, false), publish(publish) {}
+
+    void Take() override { std::swap(pending, published); }
+    void Publish() override { publish(*published); }
+
+    std::function<void(const ValueType&)> publish;
+    std::unique_ptr<ValueType> pending;
+    std::unique_ptr<ValueType> published;
+  };
+
+  void PublishLoop();
+
+  // Takes every channel that's due (or every channel with a pending value if flush) and returns
+  // them. Otherwise sets next_due to when the next one will be. Called under the lock.
+  void TakeDue(Clock::time_point now, bool flush, std::vector<Channel*>& due, Clock::time_point& next_due);
+
+ private:
+  std::string name_;
+  std::vector<std::unique_ptr<Channel>> channels_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  bool is_shutdown_ = false;
+  std::thread thread_;
+};
+
+
+}
+}
@@ -9,6 +9,14 @@ namespace core {
 // NOTE(milo): All of the random functions rely on this generator to create noise.
 static std::default_random_engine _G;
 
+
+// NOTE(milo): Seeding the engine directly maps 0 and 1 to the same state, so go through a seed_seq.
+void SeedRandom(unsigned int seed)
+{
+  std::seed_seq seq{ seed };
+  _G.seed(seq);
+}
+
 // Return a random float in the range [a, b).
 float RandomUniformf(float a, float b)
 {
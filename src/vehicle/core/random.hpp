@@ -6,6 +6,10 @@ namespace bm {
 namespace core {
 
 
+// Reseed the generator behind all of the functions below, so that a sequence of random draws can
+// be repeated exactly (e.g for a synthetic dataset).
+void SeedRandom(unsigned int seed);
+
 // Return a random float in the range [a, b).
 float RandomUniformf(float a, float b);
 float RandomNormalf(float mu, float sigma);
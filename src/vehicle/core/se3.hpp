@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A rotation, stored as a 3x3 matrix. Everything is inline, so composing and applying rotations
+// compiles down to the 3x3 products (no quaternion round trips).
+class SO3 final {
+ public:
+  SO3() : R_(Matrix3d::Identity()) {}
+  explicit SO3(const Matrix3d& R) : R_(R) {}
+  explicit SO3(const Quaterniond& q) : R_(q.toRotationMatrix()) {}
+
+  static SO3 Identity() { return SO3(); }
+
+  const Matrix3d& matrix() const { return R_; }
+  Quaterniond ToQuaternion() const { return Quaterniond(R_); }
+
+  SO3 Inverse() const { return SO3(R_.transpose()); }
+  SO3 operator*(const SO3& rhs) const { return SO3(R_ * rhs.R_); }
+  Vector3d operator*(const Vector3d& v) const { return R_ * v; }
+
+  // Rotates v by the inverse, without forming it.
+  Vector3d InverseRotate(const Vector3d& v) const { return R_.transpose() * v; }
+
+ private:
+  Matrix3d R_;
+};
+
+
+// A rigid transform a_T_b (maps points in frame b into frame a), stored as a rotation and a
+// translation. This avoids the 4x4 products and general inverses of Matrix4d, and converts to and
+// from Matrix4d, Quaterniond and gtsam::Pose3 (see vio/se3_gtsam.hpp) by copying 12 numbers.
+//
+// NOTE(milo): Neither Matrix3d or Vector3d are fixed-size vectorizable, so this can go in STL
+// containers without an aligned allocator.
+class SE3 final {
+ public:
+  SE3() : R_(Matrix3d::Identity()), t_(Vector3d::Zero()) {}
+  SE3(const Matrix3d& R, const Vector3d& t) : R_(R), t_(t) {}
+  SE3(const SO3& R, const Vector3d& t) : R_(R.matrix()), t_(t) {}
+  SE3(const Quaterniond& q, const Vector3d& t) : R_(q.toRotationMatrix()), t_(t) {}
+
+  // Only reads the top 3x4 block (assumes the bottom row is [0 0 0 1]).
+  explicit SE3(const Matrix4d& T) : R_(T.block<3, 3>(0, 0)), t_(T.block<3, 1>(0, 3)) {}
+
+  static SE3 Identity() { return SE3(); }
+
+  const Matrix3d& rotation() const { return R_; }
+  const Vector3d& translation() const { return t_; }
+  Matrix3d& rotation() { return R_; }
+  Vector3d& translation() { return t_; }
+
+  SO3 so3() const { return SO3(R_); }
+  Quaterniond ToQuaternion() const { return Quaterniond(R_); }
+
+  Matrix4d matrix() const
+  {
+    Matrix4d T = Matrix4d::Identity();
+    T.block<3, 3>(0, 0) = R_;
+    T.block<3, 1>(0, 3) = t_;
+    return T;
+  }
+
+  SE3 Inverse() const
+  {
+    const Matrix3d Rt = R_.transpose();
+    return SE3(Rt, -(Rt * t_));
+  }
+
+  // a_T_b * b_T_c = a_T_c
+  SE3 operator*(const SE3& rhs) const { return SE3(R_ * rhs.R_, R_ * rhs.t_ + t_); }
+
+  // Maps a point in frame b to frame a.
+  Vector3d operator*(const Vector3d& b_t_p) const { return R_ * b_t_p + t_; }
+
+  // Maps a point in frame a to frame b, without forming the inverse.
+  Vector3d InverseTransform(const Vector3d& a_t_p) const { return R_.transpose() * (a_t_p - t_); }
+
+  // Only rotates (e.g for directions and velocities).
+  Vector3d Rotate(const Vector3d& v) const { return R_ * v; }
+
+  // Maps all of the points at once, as one 3x3 * 3xN product. "out" must not be "in".
+  void TransformPoints(const std::vector<Vector3d>& in, std::vector<Vector3d>& out) const
+  {
+    out.resize(in.size());
+    if (in.empty()) {
+      return;
+    }
+
+    // NOTE(milo): A std::vector<Vector3d> is N packed columns of 3 doubles.
+    const Eigen::Map<const Eigen::Matrix3Xd> P_in(in.front().data(), 3, in.size());
+    Eigen::Map<Eigen::Matrix3Xd> P_out(out.front().data(), 3, out.size());
+    P_out.noalias() = R_ * P_in;
+    P_out.colwise() += t_;
+  }
+
+  std::vector<Vector3d> TransformPoints(const std::vector<Vector3d>& in) const
+  {
+    std::vector<Vector3d> out;
+    TransformPoints(in, out);
+    return out;
+  }
+
+ private:
+  Matrix3d R_;
+  Vector3d t_;
+};
+
+
+}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Holds the latest value from ONE writer thread, for any number of reader threads. Neither side
+// takes a lock: the writer never waits, and a reader retries if the writer was halfway through
+// a Store() while it was copying. Use it to publish a small state (e.g the filter's) to readers
+// that only care about the newest one.
+//
+// NOTE(milo): This is a sequence lock. The sequence number is odd while a Store() is in progress,
+// and goes up by two for every completed one. T should be cheap to copy, since readers copy it.
+template <typename T>
+class SeqLock final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(SeqLock)
+
+  SeqLock() = default;
+
+  // Only call this from one thread at a time.
+  void Store(const T& value)
+  {
+    const uint64_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    value_ = value;
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  // Copy the latest value into "out". Returns false (and leaves "out" alone) if nothing has been
+  // stored yet. If "version" is given, it's set to the number of Store() calls that "out" reflects.
+  bool Load(T& out, uint64_t* version = nullptr) const
+  {
+    for (int attempt = 0; ; ++attempt) {
+      const uint64_t seq0 = seq_.load(std::memory_order_acquire);
+      if (seq0 == 0) {
+        return false;
+      }
+
+      if ((seq0 & 1) == 0) {
+        T copy = value_;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq_.load(std::memory_order_relaxed) == seq0) {
+          out = copy;
+          if (version != nullptr) {
+            *version = seq0 / 2;
+          }
+          return true;
+        }
+      }
+
+      // Only yield if the writer is being slow (e.g it got descheduled mid-Store).
+      if (attempt > 64) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Number of completed Store() calls.
+  uint64_t Version() const { return seq_.load(std::memory_order_acquire) / 2; }
+
+ private:
+  std::atomic<uint64_t> seq_{0};
+  T value_;
+};
+
+
+}
+}
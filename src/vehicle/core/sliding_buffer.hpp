@@ -1,5 +1,6 @@
 #pragma once
 
+#include <utility>
 #include <vector>
 #include <glog/logging.h>
 
@@ -39,6 +40,16 @@ class SlidingBuffer {
     ++num_added_;
   }
 
+  // Like Add(), but swaps the item into the buffer instead of copying it. Afterwards, "item" holds
+  // the oldest item that was pushed out (or a default item if the buffer wasn't full yet). This lets
+  // the caller reuse the memory owned by old items.
+  void Swap(Item& item)
+  {
+    std::swap(cbuffer_.at(head_index_), item);
+    head_index_ = (head_index_ + 1) % (int)cbuffer_.size();
+    ++num_added_;
+  }
+
   // Size of the circular buffer.
   size_t Size() const { return cbuffer_.size(); }
 
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "core/notifier.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Bounded single-producer/single-consumer queue backed by preallocated storage and atomics. It has
+// the same Push/Pop/PopIfNonEmpty interface and drop-oldest policy as ThreadsafeQueue, but neither
+// side ever takes a lock, so a sensor callback can't be blocked by a slow consumer thread.
+//
+// NOTE(milo): Each slot carries a sequence number (Vyukov-style). This lets the producer safely
+// claim and discard the oldest item when the queue is full, even while the consumer is popping.
+// Dropped items are counted (see Dropped()) instead of logged, since this runs on the hot path.
+//
+// NOTE(milo): There is no PeekFront()/PeekBack(), since a reference into the ring could be
+// overwritten by the producer at any time. Use ThreadsafeQueue if you need those.
+template <typename Item>
+class SpscQueue final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SpscQueue)
+  MACRO_DELETE_COPY_CONSTRUCTORS(SpscQueue)
+
+  // Construct the queue with a max size and drop policy. Unlike ThreadsafeQueue, the queue can't be
+  // unbounded, so max_queue_size must be nonzero.
+  SpscQueue(size_t max_queue_size,
+            bool drop_oldest_if_full = true,
+            const std::string& queue_name = "")
+      : max_queue_size_(max_queue_size),
+        drop_oldest_if_full_(drop_oldest_if_full),
+        queue_name_(queue_name)
+  {
+    CHECK_GT(max_queue_size, 0ul) << "SpscQueue must be bounded!"
+        << "\n  Queue=" << queue_name_ << std::endl;
+
+    // Round the number of slots up to a power of two so that indexing is a mask.
+    size_t num_slots = 1;
+    while (num_slots < max_queue_size) {
+      num_slots <<= 1;
+    }
+    mask_ = num_slots - 1;
+
+    cells_.reset(new Cell[num_slots]);
+    for (size_t i = 0; i < num_slots; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~SpscQueue()
+  {
+    size_t pos;
+    while (Item* ptr = Claim(pos)) {
+      ptr->~Item();
+      Release(pos);
+    }
+  }
+
+  // Push an item onto the queue. Only ONE thread may call this.
+  // NOTE(milo): If Item has a move constructor, this avoids a copy.
+  bool Push(Item item)
+  {
+    const size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+    while (true) {
+      if ((pos - dequeue_pos_.load(std::memory_order_acquire)) >= max_queue_size_.load(std::memory_order_relaxed)) {
+        if (!drop_oldest_if_full_) {
+          return false;
+        }
+        size_t drop_pos;
+        if (Item* ptr = Claim(drop_pos)) {
+          ptr->~Item();
+          Release(drop_pos);
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+        continue;
+      }
+
+      // The consumer may still be moving out of this slot (it was claimed, but not released yet).
+      if (cells_[pos & mask_].seq.load(std::memory_order_acquire) == pos) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+
+    Cell& cell = cells_[pos & mask_];
+    new (&cell.storage) Item(std::move(item));
+    cell.seq.store(pos + 1, std::memory_order_release);
+    enqueue_pos_.store(pos + 1, std::memory_order_release);
+
+    notifier_.Notify();
+    if (listener_ != nullptr) {
+      listener_->Notify();
+    }
+
+    return true;
+  }
+
+  // Pop the item at the front of the queue (oldest). Only use with a single consumer!
+  Item Pop()
+  {
+    CHECK_GT(Size(), 0ul) << "Tried to pop from empty SpscQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+
+    // NOTE(milo): If the producer is in the middle of replacing the oldest item, the queue can look
+    // empty for a moment. It's about to push, so wait for it.
+    size_t pos;
+    Item* ptr = nullptr;
+    while ((ptr = Claim(pos)) == nullptr) {
+      std::this_thread::yield();
+    }
+
+    Item item(std::move(*ptr));
+    ptr->~Item();
+    Release(pos);
+    return item;
+  }
+
+  // Pop the front item if there is one. Returns whether an item was popped.
+  bool PopIfNonEmpty(Item& item)
+  {
+    size_t pos;
+    Item* ptr = Claim(pos);
+    if (ptr == nullptr) {
+      return false;
+    }
+
+    item = std::move(*ptr);
+    ptr->~Item();
+    Release(pos);
+    return true;
+  }
+
+  // Block until the queue is nonempty, or until timeout_sec has elapsed. Returns whether the queue
+  // is nonempty.
+  bool WaitNonEmpty(double timeout_sec)
+  {
+    return notifier_.WaitFor([this]() { return !Empty(); }, timeout_sec);
+  }
+
+  // Block until an item can be popped, or until timeout_sec has elapsed. Returns false on timeout.
+  bool PopBlocking(Item& item, double timeout_sec)
+  {
+    return WaitNonEmpty(timeout_sec) && PopIfNonEmpty(item);
+  }
+
+  // Also notify an external Notifier whenever an item is pushed (see ThreadsafeQueue). The
+  // Notifier must outlive this queue.
+  void AttachNotifier(Notifier* notifier) { listener_ = notifier; }
+
+  // Return the current size of the queue. This is only a snapshot if the other thread is active.
+  size_t Size() const
+  {
+    const size_t dequeue_pos = dequeue_pos_.load(std::memory_order_acquire);
+    const size_t enqueue_pos = enqueue_pos_.load(std::memory_order_acquire);
+    return (enqueue_pos > dequeue_pos) ? (enqueue_pos - dequeue_pos) : 0;
+  }
+
+  bool Empty() const { return Size() == 0; }
+
+  // Number of items that have been dropped because the queue was full.
+  size_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  size_t Capacity() const { return max_queue_size_.load(std::memory_order_relaxed); }
+
+  // Change the max size of the queue while it's in use (e.g when params are reloaded). Any thread
+  // may call this. The storage is never reallocated, so the new size is clamped to [1, num slots],
+  // where num slots is the original max size rounded up to a power of two. If the queue shrinks
+  // below its current size, the next Push() drops the oldest items (or is rejected) as usual.
+  // Returns the max size that was set.
+  size_t SetCapacity(size_t max_queue_size)
+  {
+    const size_t clamped = std::max(1ul, std::min(max_queue_size, mask_ + 1));
+    LOG_IF(WARNING, clamped != max_queue_size) << "SpscQueue can only hold " << (mask_ + 1)
+        << " items, using a max size of " << clamped << "\n  Queue=" << queue_name_ << std::endl;
+    max_queue_size_.store(clamped, std::memory_order_relaxed);
+    return clamped;
+  }
+
+  const std::string& Name() const { return queue_name_; }
+
+ private:
+  struct Cell
+  {
+    std::atomic<size_t> seq;
+    typename std::aligned_storage<sizeof(Item), alignof(Item)>::type storage;
+  };
+
+  // Claim the slot at the front of the queue, or return nullptr if there isn't a filled one. The
+  // caller must destroy the item and then Release() the slot. Both the consumer and the producer
+  // (when dropping) claim from the front, hence the CAS.
+  Item* Claim(size_t& pos)
+  {
+    pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+    while (true) {
+      Cell& cell = cells_[pos & mask_];
+      const size_t seq = cell.seq.load(std::memory_order_acquire);
+
+      if (seq == (pos + 1)) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_acq_rel)) {
+          return reinterpret_cast<Item*>(&cell.storage);
+        }
+      } else if (seq <= pos) {
+        return nullptr;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Hand a claimed slot back to the producer.
+  void Release(size_t pos)
+  {
+    cells_[pos & mask_].seq.store(pos + mask_ + 1, std::memory_order_release);
+  }
+
+ private:
+  std::atomic<size_t> max_queue_size_;
+  bool drop_oldest_if_full_ = true;
+  std::string queue_name_;
+
+  size_t mask_ = 0;
+  std::unique_ptr<Cell[]> cells_;
+
+  // Keep the producer and consumer indices on separate cache lines.
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<size_t> dequeue_pos_{0};
+  alignas(64) std::atomic<size_t> dropped_{0};
+
+  Notifier notifier_;
+  Notifier* listener_ = nullptr;
+};
+
+
+}
+}
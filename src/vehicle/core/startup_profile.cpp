@@ -0,0 +1,63 @@
+#include <iomanip>
+#include <sstream>
+
+#include "core/startup_profile.hpp"
+
+namespace bm {
+namespace core {
+
+
+StartupProfile::StartupProfile(const std::string& name)
+    : name_(name),
+      t0_(SteadyNowNs()) {}
+
+
+void StartupProfile::Time(const std::string& phase, const std::function<void()>& fn)
+{
+  const steady_ns_t t0 = SteadyNowNs();
+  fn();
+  Add(phase, core::ElapsedMs(t0, SteadyNowNs()));
+}
+
+
+void StartupProfile::Mark(const std::string& phase)
+{
+  Add(phase, ElapsedMs());
+}
+
+
+void StartupProfile::Add(const std::string& phase, double ms)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  phases_.emplace_back(phase, ms);
+}
+
+
+double StartupProfile::ElapsedMs() const
+{
+  return core::ElapsedMs(t0_, SteadyNowNs());
+}
+
+
+std::vector<std::pair<std::string, double>> StartupProfile::Phases() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return phases_;
+}
+
+
+std::string StartupProfile::Summary() const
+{
+  std::stringstream ss;
+  ss << name_ << " startup:" << std::fixed << std::setprecision(1);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& phase : phases_) {
+    ss << " " << phase.first << "=" << phase.second << "ms";
+  }
+  return ss.str();
+}
+
+
+}
+}
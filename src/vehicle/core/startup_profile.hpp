@@ -0,0 +1,55 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/pipeline_latency.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Records how long each phase of starting up a component took (e.g loading params, constructing
+// subsystems, waiting for the first result), so that a slow startup can be broken down. Phases can
+// overlap (e.g subsystems that are constructed in parallel), so they don't add up to ElapsedMs().
+//
+// All of these are threadsafe.
+class StartupProfile final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(StartupProfile)
+
+  // Starts the clock that Mark() and ElapsedMs() measure from.
+  explicit StartupProfile(const std::string& name);
+
+  // Runs fn, and records how long it took as "phase".
+  void Time(const std::string& phase, const std::function<void()>& fn);
+
+  // Records "phase" as ending now, measured from when this profile was constructed.
+  void Mark(const std::string& phase);
+
+  void Add(const std::string& phase, double ms);
+
+  // Milliseconds since this profile was constructed.
+  double ElapsedMs() const;
+
+  // Phases (and how long they took in ms), in the order that they finished.
+  std::vector<std::pair<std::string, double>> Phases() const;
+
+  // One line with every phase, e.g "StateEstimator startup: frontend=120.5ms tags=20.1ms".
+  std::string Summary() const;
+
+ private:
+  std::string name_;
+  steady_ns_t t0_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::pair<std::string, double>> phases_;
+};
+
+
+}
+}
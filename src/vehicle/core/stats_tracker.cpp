@@ -1,3 +1,7 @@
+#include <cstdio>
+
+#include <glog/logging.h>
+
 #include "core/stats_tracker.hpp"
 
 namespace bm {
@@ -8,15 +12,151 @@ namespace core {
 // basic stats about them. For example, this is useful for profiling various functions and
 // tracking how their runtime changes online.
 StatsTracker::StatsTracker(const std::string& tracker_name, size_t k)
-  : tracker_name_(tracker_name), k_(k) {}
+  : tracker_name_(tracker_name), k_(k)
+{
+  CHECK_GT(k_, 0ul);
+}
 
 
-void StatsTracker::Add(const std::string& name, float value)
+StatsTracker::~StatsTracker()
+{
+  mutex_.lock();
+  is_shutdown_ = true;
+  mutex_.unlock();
+  shutdown_cv_.notify_all();
+
+  if (reporter_thread_.joinable()) {
+    reporter_thread_.join();
+  }
+}
+
+
+StatId StatsTracker::Register(const std::string& name, const std::string& units)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const auto it = ids_.find(name);
+  if (it != ids_.end()) {
+    if (!units.empty()) {
+      stats_[it->second]->units = units;
+    }
+    return it->second;
+  }
+
+  const StatId id = num_stats_.load(std::memory_order_relaxed);
+  CHECK_LT(id, kMaxStats) << "StatsTracker " << tracker_name_ << " is full" << std::endl;
+
+  stats_[id].reset(new Stat(name, units, k_));
+  for (size_t i = 0; i < k_; ++i) {
+    stats_[id]->values[i].store(0.0f, std::memory_order_relaxed);
+  }
+  ids_.emplace(name, id);
+  num_stats_.store(id + 1, std::memory_order_release);
+
+  return id;
+}
+
+
+void StatsTracker::Add(StatId id, float value)
+{
+  Stat& stat = *stats_[id];
+  const uint64_t i = stat.added.fetch_add(1, std::memory_order_relaxed);
+  stat.values[i % k_].store(value, std::memory_order_relaxed);
+}
+
+
+StatsSummary StatsTracker::Summarize(StatId id) const
+{
+  const Stat& stat = *stats_[id];
+  const uint64_t added = stat.added.load(std::memory_order_relaxed);
+
+  StatsSummary summary;
+  summary.N = static_cast<int>(std::min(static_cast<uint64_t>(k_), added));
+  if (summary.N == 0) {
+    return summary;
+  }
+
+  std::vector<float> values(summary.N);
+  for (int ago = 0; ago < summary.N; ++ago) {
+    values.at(ago) = stat.values[(added - 1 - ago) % k_].load(std::memory_order_relaxed);
+  }
+
+  float sum = 0;
+  for (const float v : values) {
+    sum += v;
+  }
+  summary.mean = sum / static_cast<float>(summary.N);
+
+  std::sort(values.begin(), values.end());
+  auto percentile = [&values](double p) {
+    return values.at(static_cast<int>(p * static_cast<double>(values.size() - 1) + 0.5));
+  };
+  summary.min = values.front();
+  summary.max = values.back();
+  summary.p50 = percentile(0.50);
+  summary.p95 = percentile(0.95);
+  summary.p99 = percentile(0.99);
+
+  return summary;
+}
+
+
+void StatsTracker::PrintLocked(StatId id, float print_interval_sec)
 {
-  if (stats_.count(name) == 0) {
-    stats_.emplace(name, StatsBuffer<float>(k_));
+  Stat& stat = *stats_[id];
+
+  // If a time interval was specified, only print if that interval has elapsed.
+  if (stat.print_timer.Elapsed().seconds() < print_interval_sec) {
+    return;
   }
-  stats_.at(name).Add(value);
+
+  const StatsSummary s = Summarize(id);
+  printf("[ %s/%s ] P50=%f %s P95=%f %s P99=%f %s MIN=%f MAX=%f MEAN=%f (N=%d)\n",
+      tracker_name_.c_str(), stat.name.c_str(), s.p50, stat.units.c_str(), s.p95, stat.units.c_str(),
+      s.p99, stat.units.c_str(), s.min, s.max, s.mean, s.N);
+  stat.print_timer.Reset();
+  stat.printed_added = stat.added.load(std::memory_order_relaxed);
+}
+
+
+void StatsTracker::PrintAll(float print_interval_sec)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const int n = num_stats_.load(std::memory_order_acquire);
+  for (int id = 0; id < n; ++id) {
+    const Stat& stat = *stats_[id];
+    if (stat.added.load(std::memory_order_relaxed) != stat.printed_added) {
+      PrintLocked(id, print_interval_sec);
+    }
+  }
+}
+
+
+void StatsTracker::StartReporter(float print_interval_sec)
+{
+  CHECK(!reporter_thread_.joinable()) << "StatsTracker reporter was already started" << std::endl;
+  reporter_thread_ = std::thread(&StatsTracker::ReporterLoop, this, print_interval_sec);
+}
+
+
+void StatsTracker::ReporterLoop(float print_interval_sec)
+{
+  const std::chrono::microseconds period(static_cast<int64_t>(1e6 * std::max(1e-3f, print_interval_sec)));
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!shutdown_cv_.wait_for(lock, period, [this]() { return is_shutdown_; })) {
+    // NOTE(milo): The wait already took print_interval_sec, so don't make PrintAll() check it again.
+    lock.unlock();
+    PrintAll(0);
+    lock.lock();
+  }
+}
+
+
+void StatsTracker::Add(const std::string& name, float value)
+{
+  Add(Register(name), value);
 }
 
 
@@ -24,24 +164,18 @@ void StatsTracker::Print(const std::string& name,
                          const std::string& units,
                          float print_interval_sec)
 {
+  std::lock_guard<std::mutex> lock(mutex_);
+
   // Can't print stats for nonexistent scalar.
-  if (stats_.count(name) == 0) {
+  const auto it = ids_.find(name);
+  if (it == ids_.end()) {
     return;
   }
 
-  if (timers_.count(name) == 0) {
-    timers_.emplace(name, Timer(true));
-  }
-
-  // If a time interval was specified, only print if that interval has elapsed.
-  if (timers_.at(name).Elapsed().seconds() >= print_interval_sec) {
-    int N;
-    float min, max, mean;
-    stats_.at(name).MinMaxMean(N, min, max, mean);
-    printf("[ %s/%s ] MIN=%f %s MAX=%f %s MEAN=%f %s (N=%d)\n",
-        tracker_name_.c_str(), name.c_str(), min, units.c_str(), max, units.c_str(), mean, units.c_str(), N);
-    timers_.at(name).Reset();
+  if (!units.empty()) {
+    stats_[it->second]->units = units;
   }
+  PrintLocked(it->second, print_interval_sec);
 }
 
 
@@ -1,6 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "core/macros.hpp"
 #include "core/timer.hpp"
@@ -32,18 +41,76 @@ class StatsBuffer : public SlidingBuffer<Item> {
 
     mean /= static_cast<Item>(N);
   }
+
+  // Returns the number of items, and the 50th/95th/99th percentile of item values in the buffer.
+  void Percentiles(int& N, Item& p50, Item& p95, Item& p99) const
+  {
+    N = static_cast<int>(std::min(this->Size(), this->Added()));
+
+    std::vector<Item> values(N);
+    for (int ago = 0; ago < N; ++ago) {
+      values.at(ago) = this->Get(ago);
+    }
+    std::sort(values.begin(), values.end());
+
+    auto percentile = [&values, N](double p) {
+      return (N == 0) ? Item(0) : values.at(static_cast<int>(p * static_cast<double>(N - 1) + 0.5));
+    };
+
+    p50 = percentile(0.50);
+    p95 = percentile(0.95);
+    p99 = percentile(0.99);
+  }
+};
+
+
+// Handle to a scalar in a StatsTracker (see StatsTracker::Register()).
+typedef int StatId;
+
+
+// Summary of the values that a StatsTracker has for one scalar.
+struct StatsSummary final
+{
+  int N = 0;
+  float min = 0, max = 0, mean = 0;
+  float p50 = 0, p95 = 0, p99 = 0;
 };
 
 
 // Stores the k latest scalar measurements for various named parameters so that we can print out
 // basic stats about them. For example, this is useful for profiling various functions and
 // tracking how their runtime changes online.
+//
+// Register each scalar once to get a StatId. Adding a value by id is lock-free and can be done from
+// any thread (e.g the frontend, smoother, and filter all add to the same tracker), so it's cheap
+// enough for hot loops. A reporter thread (see StartReporter()) prints whatever got new values.
+// The string versions of Add() and Print() still work, but look the name up under a lock.
 class StatsTracker final {
  public:
   MACRO_DELETE_COPY_CONSTRUCTORS(StatsTracker)
 
   StatsTracker(const std::string& tracker_name, size_t k);
 
+  // Stops the reporter thread (if it was started).
+  ~StatsTracker();
+
+  // Returns the id of a named scalar, registering it if needed (so the same name always gives the
+  // same id). Takes a lock, so do this once up front rather than every time.
+  StatId Register(const std::string& name, const std::string& units = "");
+
+  // Lock-free. If several threads add to the same id at once, each value still goes in its own slot.
+  void Add(StatId id, float value);
+
+  // Summary of the (up to k) latest values. Lock-free, but concurrent Add()s might not be in it yet.
+  StatsSummary Summarize(StatId id) const;
+
+  // Prints every scalar that got new values since it was last printed, if print_interval_sec has
+  // passed since then.
+  void PrintAll(float print_interval_sec = 0);
+
+  // Call PrintAll() from a thread every print_interval_sec.
+  void StartReporter(float print_interval_sec);
+
   void Add(const std::string& name,
            float value);
 
@@ -51,11 +118,43 @@ class StatsTracker final {
              const std::string& units = "",
              float print_interval_sec = 0);
 
+ private:
+  static constexpr int kMaxStats = 512;
+
+  struct Stat final
+  {
+    Stat(const std::string& name, const std::string& units, size_t k)
+        : name(name), units(units), values(new std::atomic<float>[k]) {}
+
+    std::string name;
+    std::string units;
+    std::unique_ptr<std::atomic<float>[]> values;   // Ring buffer of the last k values.
+    std::atomic<uint64_t> added{0};                 // Slot i % k gets the i-th value.
+
+    // Only touched when printing (under mutex_).
+    Timer print_timer{true};
+    uint64_t printed_added = 0;
+  };
+
+  // Caller must hold mutex_.
+  void PrintLocked(StatId id, float print_interval_sec);
+
+  void ReporterLoop(float print_interval_sec);
+
  private:
   std::string tracker_name_;
   size_t k_;
-  std::unordered_map<std::string, Timer> timers_;
-  std::unordered_map<std::string, StatsBuffer<float>> stats_;
+  std::mutex mutex_;
+
+  // NOTE(milo): Stats are never removed or moved, so Add() can get to one without a lock. The id is
+  // published after the Stat is constructed.
+  std::unique_ptr<Stat> stats_[kMaxStats];
+  std::atomic<int> num_stats_{0};
+  std::unordered_map<std::string, StatId> ids_;
+
+  bool is_shutdown_ = false;
+  std::condition_variable shutdown_cv_;
+  std::thread reporter_thread_;
 };
 
 
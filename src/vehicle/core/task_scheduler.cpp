@@ -0,0 +1,245 @@
+#include <algorithm>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <glog/logging.h>
+
+#include "core/task_scheduler.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Which scheduler (and which of its workers) the current thread belongs to, if any.
+static thread_local const TaskScheduler* tls_scheduler = nullptr;
+static thread_local int tls_worker_index = -1;
+
+
+static std::mutex instance_mutex;
+static std::unique_ptr<TaskScheduler> instance;
+static TaskScheduler::Params instance_params;
+
+
+static int NumAllowedCpus()
+{
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &cpus) == 0) {
+    return std::max(1, CPU_COUNT(&cpus));
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+TaskScheduler::TaskScheduler(const Params& params)
+{
+  const int num_threads = (params.num_threads > 0) ? params.num_threads : NumAllowedCpus();
+
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(new Worker());
+  }
+
+  // NOTE(milo): Start the threads after all of the workers exist, since they steal from each other.
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.at(i)->thread = std::thread(&TaskScheduler::WorkerLoop, this, i);
+
+    if (!params.cpus.empty()) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(params.cpus.at(i % params.cpus.size()), &cpus);
+      if (pthread_setaffinity_np(workers_.at(i)->thread.native_handle(), sizeof(cpu_set_t), &cpus) != 0) {
+        LOG(WARNING) << "Could not pin TaskScheduler worker " << i << " to cpu "
+                     << params.cpus.at(i % params.cpus.size()) << std::endl;
+      }
+    }
+  }
+
+  LOG(INFO) << "Started TaskScheduler with " << num_threads << " workers" << std::endl;
+}
+
+
+TaskScheduler::~TaskScheduler()
+{
+  mutex_.lock();
+  is_shutdown_ = true;
+  mutex_.unlock();
+  cv_work_.notify_all();
+
+  for (std::unique_ptr<Worker>& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+
+TaskScheduler& TaskScheduler::Instance()
+{
+  std::lock_guard<std::mutex> lock(instance_mutex);
+  if (!instance) {
+    instance.reset(new TaskScheduler(instance_params));
+  }
+  return *instance;
+}
+
+
+bool TaskScheduler::Configure(const Params& params)
+{
+  std::lock_guard<std::mutex> lock(instance_mutex);
+  if (instance) {
+    LOG(WARNING) << "TaskScheduler::Configure() called after the scheduler started, ignoring" << std::endl;
+    return false;
+  }
+  instance_params = params;
+  return true;
+}
+
+
+void TaskScheduler::Submit(TaskPriority priority, Task task)
+{
+  // Tasks submitted from a worker stay on its queue (other workers can still steal them).
+  const int index = (tls_scheduler == this) ?
+      tls_worker_index : static_cast<int>(next_worker_.fetch_add(1) % workers_.size());
+
+  Worker& worker = *workers_.at(index);
+  worker.mutex.lock();
+  worker.lanes[static_cast<int>(priority)].emplace_back(std::move(task));
+  worker.mutex.unlock();
+
+  mutex_.lock();
+  ++num_queued_;
+  mutex_.unlock();
+  cv_work_.notify_one();
+}
+
+
+bool TaskScheduler::TryTakeTask(int index, Task& task)
+{
+  const int num_workers = static_cast<int>(workers_.size());
+
+  for (int lane = 0; lane < kNumTaskPriorities; ++lane) {
+    for (int k = 0; k < num_workers; ++k) {
+      // Take the newest task from our own queue, or the oldest task from someone else's.
+      const int victim = (index + k) % num_workers;
+      Worker& worker = *workers_.at(victim);
+
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      std::deque<Task>& tasks = worker.lanes[lane];
+      if (tasks.empty()) {
+        continue;
+      }
+
+      if (k == 0) {
+        task = std::move(tasks.back());
+        tasks.pop_back();
+      } else {
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+void TaskScheduler::WorkerLoop(int index)
+{
+  tls_scheduler = this;
+  tls_worker_index = index;
+
+  while (true) {
+    Task task;
+    if (TryTakeTask(index, task)) {
+      mutex_.lock();
+      --num_queued_;
+      mutex_.unlock();
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_work_.wait(lock, [this]() { return is_shutdown_ || num_queued_ > 0; });
+
+    if (is_shutdown_ && num_queued_ <= 0) {
+      return;  // Shutdown, and nothing left to do.
+    }
+  }
+}
+
+
+// Shared between the caller of ParallelFor() and its helper tasks. Helpers that start after the
+// caller is done see that the batch is closed and exit without touching fn.
+struct ParallelForBatch final
+{
+  ParallelForBatch(int N, const std::function<void(int)>* fn) : N(N), fn(fn) {}
+
+  void Work()
+  {
+    for (int i = next.fetch_add(1); i < N; i = next.fetch_add(1)) {
+      (*fn)(i);
+    }
+  }
+
+  const int N;
+  const std::function<void(int)>* fn;
+  std::atomic<int> next{0};
+
+  std::mutex mutex;
+  std::condition_variable cv_done;
+  int active = 0;
+  bool closed = false;
+};
+
+
+void TaskScheduler::ParallelFor(TaskPriority priority,
+                                int N,
+                                const std::function<void(int)>& fn,
+                                int max_helpers)
+{
+  if (N <= 0) {
+    return;
+  }
+
+  // The caller does some of the work too, so only N-1 helpers can be useful.
+  const int num_helpers = std::min({ N - 1, NumThreads(), (max_helpers < 0) ? NumThreads() : max_helpers });
+
+  if (num_helpers <= 0) {
+    for (int i = 0; i < N; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::shared_ptr<ParallelForBatch> batch = std::make_shared<ParallelForBatch>(N, &fn);
+
+  for (int h = 0; h < num_helpers; ++h) {
+    Submit(priority, [batch]() {
+      {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if (batch->closed) {
+          return;
+        }
+        ++batch->active;
+      }
+
+      batch->Work();
+
+      std::lock_guard<std::mutex> lock(batch->mutex);
+      --batch->active;
+      batch->cv_done.notify_all();
+    });
+  }
+
+  batch->Work();
+
+  // NOTE(milo): Only wait for helpers that already started, since they reference fn. The rest might
+  // not get a worker for a while (e.g if this is called from inside of a task).
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->closed = true;
+  batch->cv_done.wait(lock, [&batch]() { return batch->active == 0; });
+}
+
+
+}
+}
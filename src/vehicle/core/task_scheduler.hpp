@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Tasks from a higher priority lane always run before tasks from a lower one (lower value = higher
+// priority), but a task that has started is never preempted.
+enum class TaskPriority { FILTER = 0, FRONTEND = 1, SMOOTHER = 2, MESHER = 3, VIZ = 4 };
+static const int kNumTaskPriorities = 5;
+
+
+// One pool of worker threads shared by the whole process, so that components that want to do
+// parallel work don't each start their own threads (and oversubscribe the CPU).
+//
+// Each worker has its own queue for each priority lane. Tasks submitted from a worker go to its own
+// queue, and idle workers steal from the other queues, highest priority lane first.
+//
+// NOTE(milo): Tasks shouldn't block for long (e.g wait on a sensor queue), since that ties up a
+// worker that other components are counting on.
+class TaskScheduler final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(TaskScheduler)
+  MACRO_DELETE_COPY_CONSTRUCTORS(TaskScheduler)
+
+  struct Params final
+  {
+    // If zero, uses one worker per CPU that this process is allowed to run on.
+    int num_threads = 0;
+
+    // If not empty, worker i is pinned to cpus[i % cpus.size()].
+    std::vector<int> cpus;
+  };
+
+  typedef std::function<void()> Task;
+
+  explicit TaskScheduler(const Params& params);
+
+  // Finishes any queued tasks and joins the workers.
+  ~TaskScheduler();
+
+  // The process-wide scheduler, which is started on first use.
+  static TaskScheduler& Instance();
+
+  // Set the params for Instance(). This has to be called before anything uses Instance(), and
+  // returns false (and does nothing) if it's too late.
+  static bool Configure(const Params& params);
+
+  // Queue a task to run on one of the workers.
+  void Submit(TaskPriority priority, Task task);
+
+  // Calls fn(i) for each i in [0, N), spread across the calling thread and at most max_helpers
+  // workers (all of them if max_helpers < 0). Blocks until every call has returned. Calls can happen
+  // in any order. This is safe to call from inside of a task.
+  void ParallelFor(TaskPriority priority,
+                   int N,
+                   const std::function<void(int)>& fn,
+                   int max_helpers = -1);
+
+  int NumThreads() const { return (int)workers_.size(); }
+
+ private:
+  struct Worker final
+  {
+    std::mutex mutex;
+    std::deque<Task> lanes[kNumTaskPriorities];
+    std::thread thread;
+  };
+
+  void WorkerLoop(int index);
+
+  // Take the highest priority task available to a worker, trying its own queue before the others.
+  bool TryTakeTask(int index, Task& task);
+
+ private:
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<unsigned> next_worker_{0};
+
+  // Workers sleep on this when there are no queued tasks anywhere.
+  std::mutex mutex_;
+  std::condition_variable cv_work_;
+  int num_queued_ = 0;
+  bool is_shutdown_ = false;
+};
+
+
+}
+}
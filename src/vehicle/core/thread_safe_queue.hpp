@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <mutex>
 #include <queue>
 #include <utility>
@@ -8,6 +9,8 @@
 
 #include <glog/logging.h>
 
+#include "core/notifier.hpp"
+
 namespace bm {
 namespace core {
 
@@ -32,7 +35,9 @@ class ThreadsafeQueue {
     lock_.lock();
     if (q_.size() >= max_queue_size_ && max_queue_size_ != 0) {
       if (drop_oldest_if_full_) {
-        LOG(WARNING) << "Dropping item from ThreadSafeQueue!"
+        // NOTE(milo): Count drops rather than logging each one, since this is on the sensor path.
+        const size_t num_dropped = ++dropped_;
+        LOG_IF(WARNING, num_dropped == 1) << "Dropping items from ThreadSafeQueue!"
             << "\n  Queue=" << queue_name_
             << "\n  Item=" << typeid(Item).name() << std::endl;
         q_.pop();
@@ -44,9 +49,47 @@ class ThreadsafeQueue {
       did_push = true;
     }
     lock_.unlock();
+
+    if (did_push) {
+      notifier_.Notify();
+      if (listener_ != nullptr) {
+        listener_->Notify();
+      }
+    }
     return did_push;
   }
 
+  // Push N items under one lock, with one notification at the end. Items are dropped the same way
+  // as Push() would drop them. Returns the number of items that were pushed.
+  size_t PushBatch(const Item* items, size_t N)
+  {
+    size_t num_pushed = 0;
+    lock_.lock();
+    for (size_t i = 0; i < N; ++i) {
+      if (q_.size() >= max_queue_size_ && max_queue_size_ != 0) {
+        if (!drop_oldest_if_full_) {
+          continue;
+        }
+        const size_t num_dropped = ++dropped_;
+        LOG_IF(WARNING, num_dropped == 1) << "Dropping items from ThreadSafeQueue!"
+            << "\n  Queue=" << queue_name_
+            << "\n  Item=" << typeid(Item).name() << std::endl;
+        q_.pop();
+      }
+      q_.push(items[i]);
+      ++num_pushed;
+    }
+    lock_.unlock();
+
+    if (num_pushed > 0) {
+      notifier_.Notify();
+      if (listener_ != nullptr) {
+        listener_->Notify();
+      }
+    }
+    return num_pushed;
+  }
+
   // Pop the item at the front of the queue (oldest).
   // NOTE(milo): This could cause problems if there are MULTIPLE things popping from the queue! Only
   // use with a single consumer!
@@ -77,6 +120,24 @@ class ThreadsafeQueue {
     return nonempty;
   }
 
+  // Block until the queue is nonempty, or until timeout_sec has elapsed. Returns whether the queue
+  // is nonempty.
+  bool WaitNonEmpty(double timeout_sec)
+  {
+    return notifier_.WaitFor([this]() { return !Empty(); }, timeout_sec);
+  }
+
+  // Block until an item can be popped, or until timeout_sec has elapsed. Returns false on timeout.
+  // With multiple consumers, this can also return false if another consumer got the item first.
+  bool PopBlocking(Item& item, double timeout_sec)
+  {
+    return WaitNonEmpty(timeout_sec) && PopIfNonEmpty(item);
+  }
+
+  // Also notify an external Notifier whenever an item is pushed. If several queues share a
+  // Notifier, a consumer can wait on all of them at once. The Notifier must outlive this queue.
+  void AttachNotifier(Notifier* notifier) { listener_ = notifier; }
+
   // Return the current size of the queue.
   size_t Size()
   {
@@ -88,6 +149,9 @@ class ThreadsafeQueue {
 
   bool Empty() { return Size() == 0; }
 
+  // Number of items that have been dropped because the queue was full.
+  size_t Dropped() const { return dropped_.load(); }
+
   const Item& PeekFront()
   {
     lock_.lock();
@@ -118,6 +182,10 @@ class ThreadsafeQueue {
   // http://eigen.tuxfamily.org/dox-devel/group__TopicStlContainers.html
   std::queue<Item, std::deque<Item, Eigen::aligned_allocator<Item>>> q_;
   std::mutex lock_;
+  std::atomic<size_t> dropped_{0};
+
+  Notifier notifier_;
+  Notifier* listener_ = nullptr;
 };
 
 }
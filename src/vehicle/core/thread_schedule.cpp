@@ -0,0 +1,64 @@
+#include <cerrno>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "core/thread_schedule.hpp"
+
+namespace bm {
+namespace core {
+
+
+bool ApplyThreadSchedule(const ThreadSchedule& schedule, const std::string& thread_name)
+{
+  bool ok = true;
+
+  if (schedule.cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(schedule.cpu, &cpus);
+    const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    if (err != 0) {
+      LOG(WARNING) << "Could not pin " << thread_name << " to cpu " << schedule.cpu
+                   << ": " << std::strerror(err) << std::endl;
+      ok = false;
+    }
+  }
+
+  if (schedule.fifo_priority > 0) {
+    sched_param param;
+    param.sched_priority = schedule.fifo_priority;
+    const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+      LOG(WARNING) << "Could not set SCHED_FIFO priority " << schedule.fifo_priority << " for "
+                   << thread_name << ": " << std::strerror(err) << std::endl;
+      ok = false;
+    }
+
+  // NOTE(milo): On Linux the nice value is per-thread when it's set on the thread id.
+  } else if (schedule.nice != 0) {
+    const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+    if (setpriority(PRIO_PROCESS, tid, schedule.nice) != 0) {
+      LOG(WARNING) << "Could not set nice " << schedule.nice << " for " << thread_name
+                   << ": " << std::strerror(errno) << std::endl;
+      ok = false;
+    }
+  }
+
+  if (ok && (schedule.cpu >= 0 || schedule.fifo_priority > 0 || schedule.nice != 0)) {
+    LOG(INFO) << "Scheduling for " << thread_name << ": cpu=" << schedule.cpu
+              << " fifo_priority=" << schedule.fifo_priority << " nice=" << schedule.nice << std::endl;
+  }
+
+  return ok;
+}
+
+
+}
+}
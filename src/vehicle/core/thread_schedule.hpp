@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// How the OS should schedule one of our threads. The defaults leave the thread alone.
+struct ThreadSchedule final
+{
+  // Pin the thread to this cpu (-1 = don't pin).
+  int cpu = -1;
+
+  // If in [1, 99], run with SCHED_FIFO at this priority. This needs CAP_SYS_NICE or an rtprio
+  // limit (see /etc/security/limits.conf). If 0, the thread keeps the normal scheduler.
+  int fifo_priority = 0;
+
+  // Nice value for a thread on the normal scheduler (-20 to 19, lower = more cpu time).
+  int nice = 0;
+};
+
+
+// Applies a ThreadSchedule to the CALLING thread, so call this at the top of the thread's function.
+// Anything that can't be applied (e.g not enough permissions) is logged and skipped. Returns false
+// if that happens.
+bool ApplyThreadSchedule(const ThreadSchedule& schedule, const std::string& thread_name);
+
+
+// Measures how long a thread takes to start handling data after it was signalled, which includes
+// the OS wakeup latency and any time spent finishing earlier work. Producers call Signal() when
+// they hand off data, and the consumer calls Take() when it starts on it.
+class WakeLatency final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(WakeLatency)
+
+  WakeLatency() = default;
+
+  // Only the first Signal() since the last Take() counts, since the consumer should have woken up
+  // for that one.
+  void Signal()
+  {
+    int64_t expected = 0;
+    signalled_ns_.compare_exchange_strong(expected, NowNs());
+  }
+
+  // Returns false if there wasn't a Signal() since the last Take().
+  bool Take(double& latency_ms)
+  {
+    const int64_t signalled_ns = signalled_ns_.exchange(0);
+    if (signalled_ns == 0) {
+      return false;
+    }
+    latency_ms = static_cast<double>(NowNs() - signalled_ns) * 1e-6;
+    return true;
+  }
+
+ private:
+  static int64_t NowNs()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+ private:
+  std::atomic<int64_t> signalled_ns_{0};
+};
+
+
+}
+}
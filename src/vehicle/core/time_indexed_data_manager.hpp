@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/StdVector>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/notifier.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A variant of DataManager that stores measurements in a contiguous, timestamp-sorted buffer
+// instead of a queue. Every lookup by time (PopUntil, DiscardBefore, PopNearest, ViewRange) is a
+// binary search under a single lock, rather than a linear scan of PeekFront() calls.
+//
+// NOTE(milo): Popped items are just skipped over (begin_ moves forward). Once the dead prefix is as
+// large as the queue, the buffer is compacted. This keeps Push() amortized O(1) and the memory
+// contiguous without needing a default constructor for DataType.
+template <typename DataType>
+class TimeIndexedDataManager final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(TimeIndexedDataManager);
+  MACRO_DELETE_COPY_CONSTRUCTORS(TimeIndexedDataManager);
+
+  // Unlike DataManager, the buffer must be bounded (max_queue_size > 0). If drop_old is true, the
+  // oldest item is discarded when the buffer is full. Otherwise, the new item is discarded.
+  TimeIndexedDataManager(size_t max_queue_size,
+                         bool drop_old,
+                         const std::string& queue_name = "")
+      : max_queue_size_(max_queue_size),
+        drop_old_(drop_old),
+        queue_name_(queue_name)
+  {
+    CHECK_GT(max_queue_size_, 0ul) << "TimeIndexedDataManager must be bounded!"
+        << "\n  Queue=" << queue_name_ << std::endl;
+    data_.reserve(2 * max_queue_size_);
+    times_.reserve(2 * max_queue_size_);
+  }
+
+  void Push(const DataType& item)
+  {
+    lock_.lock();
+    const bool did_push = PushNoLock(item);
+    lock_.unlock();
+
+    if (did_push) {
+      Notify();
+    }
+  }
+
+  // Push N measurements (oldest first) under one lock, with one notification at the end.
+  void PushBatch(const DataType* items, size_t N)
+  {
+    bool did_push = false;
+    lock_.lock();
+    for (size_t i = 0; i < N; ++i) {
+      did_push |= PushNoLock(items[i]);
+    }
+    lock_.unlock();
+
+    if (did_push) {
+      Notify();
+    }
+  }
+
+  bool Empty() { return Size() == 0; }
+
+  size_t Size()
+  {
+    lock_.lock();
+    const size_t N = SizeNoLock();
+    lock_.unlock();
+    return N;
+  }
+
+  // Get the oldest measurement (first in) from the buffer.
+  DataType Pop()
+  {
+    lock_.lock();
+    CHECK_GT(SizeNoLock(), 0ul) << "Tried to pop from empty TimeIndexedDataManager!"
+        << "\n  Queue=" << queue_name_ << std::endl;
+    DataType item = std::move(data_.at(begin_));
+    ++begin_;
+    lock_.unlock();
+    return item;
+  }
+
+  // Get the newest measurement (last in) from the buffer. This will discard all measurements except
+  // the newest one.
+  DataType PopNewest()
+  {
+    lock_.lock();
+    CHECK_GT(SizeNoLock(), 0ul) << "Tried to pop from empty TimeIndexedDataManager!"
+        << "\n  Queue=" << queue_name_ << std::endl;
+    DataType item = std::move(data_.back());
+    Clear();
+    lock_.unlock();
+    return item;
+  }
+
+  // Pop measurements and put them in "out" until the next item exceeds the timestamp.
+  void PopUntil(seconds_t timestamp, std::vector<DataType>& out)
+  {
+    lock_.lock();
+    const size_t end = UpperBound(timestamp);
+    for (size_t i = begin_; i < end; ++i) {
+      out.emplace_back(std::move(data_.at(i)));
+    }
+    begin_ = end;
+    lock_.unlock();
+  }
+
+  // Throw away measurements before (but NOT equal to) timestamp. If save_at_least_one is true,
+  // we don't pop the only remaining item, no matter what timestamp it has.
+  void DiscardBefore(seconds_t timestamp, bool save_at_least_one = false)
+  {
+    lock_.lock();
+    size_t first = LowerBound(timestamp);
+    if (save_at_least_one && SizeNoLock() > 0 && first == data_.size()) {
+      first = data_.size() - 1;
+    }
+    begin_ = first;
+    lock_.unlock();
+  }
+
+  // Find the measurement closest in time to "timestamp". If it is within allowed_misalignment,
+  // discard everything before it, pop it, and return it. Otherwise return nullptr and discard
+  // measurements before timestamp (keeping at least one, like DiscardBefore).
+  std::shared_ptr<DataType> PopNearest(seconds_t timestamp, seconds_t allowed_misalignment)
+  {
+    std::shared_ptr<DataType> out = nullptr;
+
+    lock_.lock();
+    const size_t after = LowerBound(timestamp);
+
+    // The nearest item is either the first one >= timestamp, or the one right before it.
+    size_t nearest = after;
+    if (after == data_.size() ||
+       (after > begin_ && (timestamp - times_.at(after - 1)) < (times_.at(after) - timestamp))) {
+      nearest = after - 1;
+    }
+
+    if (SizeNoLock() > 0 && std::fabs(times_.at(nearest) - timestamp) < allowed_misalignment) {
+      out = std::make_shared<DataType>(std::move(data_.at(nearest)));
+      begin_ = nearest + 1;
+    } else if (SizeNoLock() > 0) {
+      begin_ = std::min(after, data_.size() - 1);
+    }
+    lock_.unlock();
+
+    return out;
+  }
+
+  // Call visitor(const DataType&) on every measurement with a timestamp in [t0, t1], oldest first,
+  // without removing anything. Returns the number of items visited.
+  // NOTE(milo): This holds the lock while visiting, so keep the visitor fast!
+  template <typename Visitor>
+  size_t ViewRange(seconds_t t0, seconds_t t1, Visitor visitor)
+  {
+    lock_.lock();
+    const size_t first = LowerBound(t0);
+    const size_t end = UpperBound(t1);
+    for (size_t i = first; i < end; ++i) {
+      visitor(static_cast<const DataType&>(data_.at(i)));
+    }
+    lock_.unlock();
+    return (end > first) ? (end - first) : 0;
+  }
+
+  // Timestamp of the newest measurement in the buffer. If empty, returns kMaxSeconds.
+  seconds_t Newest()
+  {
+    lock_.lock();
+    const seconds_t t = (SizeNoLock() == 0) ? kMaxSeconds : times_.back();
+    lock_.unlock();
+    return t;
+  }
+
+  // Timestamp of the oldest measurement in the buffer. If empty, returns kMinSeconds.
+  seconds_t Oldest()
+  {
+    lock_.lock();
+    const seconds_t t = (SizeNoLock() == 0) ? kMinSeconds : times_.at(begin_);
+    lock_.unlock();
+    return t;
+  }
+
+  // Block until there is data, or until timeout_sec has elapsed (see ThreadsafeQueue).
+  bool WaitNonEmpty(double timeout_sec)
+  {
+    return notifier_.WaitFor([this]() { return !Empty(); }, timeout_sec);
+  }
+
+  // Notify an external Notifier whenever data is pushed (see DataManager).
+  void AttachNotifier(Notifier* notifier) { listener_ = notifier; }
+
+  // Number of items that have been dropped because the buffer was full.
+  size_t Dropped() const { return dropped_.load(); }
+
+ private:
+  size_t SizeNoLock() const { return data_.size() - begin_; }
+
+  // Returns false if the item was dropped.
+  bool PushNoLock(const DataType& item)
+  {
+    const seconds_t timestamp = MaybeConvertToSeconds(item.timestamp);
+    CHECK(SizeNoLock() == 0 || timestamp >= times_.back())
+        << "Tried to add measurement out of order."
+        << "\n  timestamp=" << timestamp
+        << "\n  newest=" << times_.back() << std::endl;
+
+    if (SizeNoLock() >= max_queue_size_) {
+      dropped_.fetch_add(1);
+      if (!drop_old_) {
+        return false;
+      }
+      ++begin_;
+    }
+
+    if (begin_ >= max_queue_size_) {
+      Compact();
+    }
+
+    data_.emplace_back(item);
+    times_.emplace_back(timestamp);
+    return true;
+  }
+
+  void Notify()
+  {
+    notifier_.Notify();
+    if (listener_ != nullptr) {
+      listener_->Notify();
+    }
+  }
+
+  // Index of the first live item with time >= t.
+  size_t LowerBound(seconds_t t) const
+  {
+    return std::lower_bound(times_.begin() + begin_, times_.end(), t) - times_.begin();
+  }
+
+  // Index of the first live item with time > t.
+  size_t UpperBound(seconds_t t) const
+  {
+    return std::upper_bound(times_.begin() + begin_, times_.end(), t) - times_.begin();
+  }
+
+  // Remove the dead prefix of the buffer.
+  void Compact()
+  {
+    data_.erase(data_.begin(), data_.begin() + begin_);
+    times_.erase(times_.begin(), times_.begin() + begin_);
+    begin_ = 0;
+  }
+
+  void Clear()
+  {
+    data_.clear();
+    times_.clear();
+    begin_ = 0;
+  }
+
+  seconds_t MaybeConvertToSeconds(timestamp_t t) const
+  {
+    return ConvertToSeconds(t);
+  }
+
+  // Let the compiler decide which of these functions to use, depending on whether the undelying
+  // DataType uses timestamp_t or seconds_t timestamps.
+  static seconds_t MaybeConvertToSeconds(seconds_t t)
+  {
+    return t;
+  }
+
+ private:
+  size_t max_queue_size_;
+  bool drop_old_;
+  std::string queue_name_;
+
+  std::mutex lock_;
+  std::vector<DataType, Eigen::aligned_allocator<DataType>> data_;
+  std::vector<seconds_t> times_;  // Kept separate from data_ so that binary search is cache-friendly.
+  size_t begin_ = 0;              // Index of the oldest live item.
+
+  std::atomic<size_t> dropped_{0};
+  Notifier notifier_;
+  Notifier* listener_ = nullptr;
+};
+
+
+}
+}
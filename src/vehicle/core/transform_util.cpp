@@ -45,19 +45,6 @@ Vector3d skewcoords(Matrix3d M)
   return skew;
 }
 
-// From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
-Matrix4d inverse_se3(Matrix4d T)
-{
-  Matrix4d Tinv = Matrix4d::Identity();
-  Matrix3d R;
-  Vector3d t;
-  t = T.block(0,3,3,1);
-  R = T.block(0,0,3,3);
-  Tinv.block(0,0,3,3) =  R.transpose();
-  Tinv.block(0,3,3,1) = -R.transpose() * t;
-  return Tinv;
-}
-
 // From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
 Matrix4d expmap_se3(Vector6d x)
 {
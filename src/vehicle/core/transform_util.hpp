@@ -2,6 +2,7 @@
 
 #include "core/axis3.hpp"
 #include "core/eigen_types.hpp"
+#include "core/se3.hpp"
 #include "vision_core/pinhole_camera.hpp"
 
 namespace bm {
@@ -16,8 +17,11 @@ Matrix3d fast_skewexp(Vector3d v);
 // From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
 Vector3d skewcoords(Matrix3d M);
 
-// From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
-Matrix4d inverse_se3(Matrix4d T);
+// Inverse of a rigid transform (transposes the rotation instead of a general 4x4 inverse).
+inline Matrix4d inverse_se3(const Matrix4d& T)
+{
+  return SE3(T).Inverse().matrix();
+}
 
 // From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
 Matrix4d expmap_se3(Vector6d x);
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <atomic>
+
+#include <glog/logging.h>
+
+#include "core/worker_pool.hpp"
+
+namespace bm {
+namespace core {
+
+
+WorkerPool::WorkerPool(int num_threads)
+{
+  CHECK_GE(num_threads, 0);
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&WorkerPool::WorkerLoop, this);
+  }
+}
+
+
+WorkerPool::~WorkerPool()
+{
+  mutex_.lock();
+  is_shutdown_ = true;
+  mutex_.unlock();
+  cv_work_.notify_all();
+
+  for (std::thread& t : threads_) {
+    t.join();
+  }
+}
+
+
+void WorkerPool::WorkerLoop()
+{
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_work_.wait(lock, [this]() { return is_shutdown_ || !tasks_.empty(); });
+
+    if (tasks_.empty()) {
+      return;  // Shutdown, and nothing left to do.
+    }
+
+    std::function<void()> task = std::move(tasks_.front());
+    tasks_.pop_front();
+    lock.unlock();
+
+    task();
+  }
+}
+
+
+void WorkerPool::ParallelFor(int N, const std::function<void(int)>& fn)
+{
+  if (N <= 0) {
+    return;
+  }
+
+  if (threads_.empty() || N == 1) {
+    for (int i = 0; i < N; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  // The caller and all of the helpers take indices from the same counter, so the batch finishes
+  // as soon as possible even if some calls take much longer than others.
+  std::atomic<int> next{0};
+  const auto work = [&]() {
+    for (int i = next.fetch_add(1); i < N; i = next.fetch_add(1)) {
+      fn(i);
+    }
+  };
+
+  // The caller does some of the work too, so only N-1 helpers can be useful.
+  int helpers_running = std::min(N - 1, (int)threads_.size());
+
+  mutex_.lock();
+  for (int h = 0; h < helpers_running; ++h) {
+    tasks_.emplace_back([&]() {
+      work();
+      mutex_.lock();
+      --helpers_running;
+      mutex_.unlock();
+      cv_done_.notify_all();
+    });
+  }
+  mutex_.unlock();
+  cv_work_.notify_all();
+
+  work();
+
+  // NOTE(milo): Have to wait for every helper to exit (not just for the last index to finish),
+  // since they all reference variables on this stack frame.
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_done_.wait(lock, [&]() { return helpers_running == 0; });
+}
+
+
+}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A small, fixed-size pool of threads for splitting up an independent batch of work.
+//
+// NOTE(milo): Don't call ParallelFor() from inside of a task on the same pool. If every worker is
+// blocked waiting on a nested batch, nothing will be left to run it.
+class WorkerPool final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(WorkerPool)
+  MACRO_DELETE_COPY_CONSTRUCTORS(WorkerPool)
+
+  // Starts num_threads workers. If num_threads is zero, ParallelFor() just runs everything on the
+  // calling thread.
+  explicit WorkerPool(int num_threads);
+
+  // Finishes any queued tasks and joins the workers.
+  ~WorkerPool();
+
+  // Calls fn(i) for each i in [0, N), spread across the workers AND the calling thread. Blocks
+  // until every call has returned. Calls can happen in any order.
+  void ParallelFor(int N, const std::function<void(int)>& fn);
+
+  int NumThreads() const { return (int)threads_.size(); }
+
+ private:
+  void WorkerLoop();
+
+ private:
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_work_;
+  std::condition_variable cv_done_;
+  std::deque<std::function<void()>> tasks_;
+  bool is_shutdown_ = false;
+};
+
+
+}
+}
@@ -1,6 +1,7 @@
 #include <glog/logging.h>
 
 #include "dataset/acfr_dataset.hpp"
+#include "dataset/image_manifest.hpp"
 #include "core/file_utils.hpp"
 
 namespace bm {
@@ -14,8 +15,8 @@ AcfrDataset::AcfrDataset(const std::string& toplevel_path)
   const std::string right_folder = Join(toplevel_path, "images/right");
 
   std::vector<std::string> left_imgs, right_imgs;
-  FilenamesInDirectory(left_folder, left_imgs, true);
-  FilenamesInDirectory(right_folder, right_imgs, true);
+  CachedFilenamesInDirectory(left_folder, left_imgs);
+  CachedFilenamesInDirectory(right_folder, right_imgs);
 
   CHECK_EQ(left_imgs.size(), left_imgs.size());
 
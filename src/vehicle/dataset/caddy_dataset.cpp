@@ -1,6 +1,7 @@
 #include <glog/logging.h>
 
 #include "dataset/caddy_dataset.hpp"
+#include "dataset/image_manifest.hpp"
 #include "core/file_utils.hpp"
 
 namespace bm {
@@ -15,8 +16,8 @@ CaddyDataset::CaddyDataset(const std::string& folder, const std::string& split_n
   const std::string pos_folder = Join(split_folder, "true_positives/raw");
 
   std::vector<std::string> all_imgs;
-  FilenamesInDirectory(neg_folder, all_imgs, false);
-  FilenamesInDirectory(pos_folder, all_imgs, false);
+  CachedFilenamesInDirectory(neg_folder, all_imgs);
+  CachedFilenamesInDirectory(pos_folder, all_imgs);
 
   std::vector<std::string> left_imgs, right_imgs;
 
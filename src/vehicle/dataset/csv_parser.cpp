@@ -0,0 +1,259 @@
+#include <cstdlib>
+#include <fstream>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "dataset/csv_parser.hpp"
+
+namespace bm {
+namespace dataset {
+
+namespace ipc = boost::interprocess;
+
+// Powers of ten that are exactly representable as a double.
+static const double kExactPowersOfTen[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+static const int kMaxExactPowerOfTen = 22;
+static const int kMaxExactDigits = 15;
+
+
+static inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+
+static inline void SkipSpaces(const char*& p, const char* end)
+{
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    ++p;
+  }
+}
+
+
+bool ParseCsvUint64(const char*& p, const char* end, uint64_t& out)
+{
+  const char* q = p;
+  SkipSpaces(q, end);
+  if (q == end || !IsDigit(*q)) {
+    return false;
+  }
+
+  uint64_t value = 0;
+  for (; q < end && IsDigit(*q); ++q) {
+    const uint64_t digit = static_cast<uint64_t>(*q - '0');
+    if (value > (UINT64_MAX - digit) / 10) {
+      return false;
+    }
+    value = 10 * value + digit;
+  }
+
+  out = value;
+  p = q;
+  return true;
+}
+
+
+// Hand a number that the fast path can't convert exactly to strtod (which is what std::stod uses).
+static bool ParseDoubleSlow(const char* begin, const char* end, double& out)
+{
+  const std::string token(begin, end);
+  char* token_end = nullptr;
+  out = std::strtod(token.c_str(), &token_end);
+  return token_end == token.c_str() + token.size();
+}
+
+
+bool ParseCsvDouble(const char*& p, const char* end, double& out)
+{
+  const char* q = p;
+  SkipSpaces(q, end);
+  const char* begin = q;
+
+  bool negative = false;
+  if (q < end && (*q == '-' || *q == '+')) {
+    negative = (*q == '-');
+    ++q;
+  }
+
+  // Mantissa, without leading zeros. Digits past what fits are only counted, which sends the number
+  // to the slow path.
+  uint64_t mantissa = 0;
+  int num_digits = 0;
+  int exp10 = 0;
+  bool any_digits = false;
+
+  for (; q < end && IsDigit(*q); ++q) {
+    any_digits = true;
+    if (mantissa == 0 && *q == '0') {
+      continue;
+    }
+    if (num_digits < 19) {
+      mantissa = 10 * mantissa + static_cast<uint64_t>(*q - '0');
+    } else {
+      ++exp10;
+    }
+    ++num_digits;
+  }
+  if (q < end && *q == '.') {
+    ++q;
+    for (; q < end && IsDigit(*q); ++q) {
+      any_digits = true;
+      if (mantissa == 0 && *q == '0') {
+        --exp10;
+        continue;
+      }
+      if (num_digits < 19) {
+        mantissa = 10 * mantissa + static_cast<uint64_t>(*q - '0');
+        --exp10;
+      }
+      ++num_digits;
+    }
+  }
+
+  // Anything else (nan, inf, hex) is left to strtod.
+  if (!any_digits) {
+    const char* token_end = q;
+    while (token_end < end && *token_end != ',' && *token_end != ' ' && *token_end != '\t') {
+      ++token_end;
+    }
+    if (token_end == begin || !ParseDoubleSlow(begin, token_end, out)) {
+      return false;
+    }
+    p = token_end;
+    return true;
+  }
+
+  if (q < end && (*q == 'e' || *q == 'E')) {
+    const char* e = q + 1;
+    bool exp_negative = false;
+    if (e < end && (*e == '-' || *e == '+')) {
+      exp_negative = (*e == '-');
+      ++e;
+    }
+    if (e < end && IsDigit(*e)) {
+      int exp_value = 0;
+      for (; e < end && IsDigit(*e); ++e) {
+        exp_value = std::min(10 * exp_value + (*e - '0'), 100000);
+      }
+      exp10 += exp_negative ? -exp_value : exp_value;
+      q = e;
+    }
+  }
+
+  // NOTE(milo): A mantissa with at most 15 digits and a power of ten up to 1e22 are both exact
+  // doubles, so one correctly rounded multiply or divide gives the correctly rounded result.
+  if (num_digits <= kMaxExactDigits && exp10 >= -kMaxExactPowerOfTen && exp10 <= kMaxExactPowerOfTen) {
+    double value = static_cast<double>(mantissa);
+    if (exp10 < 0) {
+      value /= kExactPowersOfTen[-exp10];
+    } else {
+      value *= kExactPowersOfTen[exp10];
+    }
+    out = negative ? -value : value;
+  } else if (mantissa == 0) {
+    out = negative ? -0.0 : 0.0;
+  } else if (!ParseDoubleSlow(begin, q, out)) {
+    return false;
+  }
+
+  p = q;
+  return true;
+}
+
+
+bool ParseCsvLine(const char* begin, const char* end, timestamp_t& timestamp, double* values, int num_values)
+{
+  const char* p = begin;
+  uint64_t t = 0;
+  if (!ParseCsvUint64(p, end, t)) {
+    return false;
+  }
+
+  for (int i = 0; i < num_values; ++i) {
+    SkipSpaces(p, end);
+    if (p == end || *p != ',') {
+      return false;
+    }
+    ++p;
+    if (!ParseCsvDouble(p, end, values[i])) {
+      return false;
+    }
+  }
+
+  // The last field has to end at a comma or the end of the line.
+  SkipSpaces(p, end);
+  if (p != end && *p != ',') {
+    return false;
+  }
+
+  timestamp = static_cast<timestamp_t>(t);
+  return true;
+}
+
+
+struct CsvFile::Mapping final
+{
+  explicit Mapping(const std::string& path)
+      : file(path.c_str(), ipc::read_only),
+        region(file, ipc::read_only) {}
+
+  ipc::file_mapping file;
+  ipc::mapped_region region;
+};
+
+
+CsvFile::CsvFile(const std::string& path)
+    : path_(path)
+{
+  std::ifstream fin(path.c_str(), std::ios::binary | std::ios::ate);
+  CHECK(fin.is_open()) << "Could not open file: " << path << std::endl;
+
+  // NOTE(milo): Boost can't map an empty file.
+  if (fin.tellg() > 0) {
+    mapping_.reset(new Mapping(path));
+  }
+}
+
+
+CsvFile::~CsvFile() = default;
+
+
+std::vector<std::pair<const char*, const char*>> CsvFile::Chunks(size_t skip_lines, int max_chunks) const
+{
+  std::vector<std::pair<const char*, const char*>> chunks;
+  if (!mapping_) {
+    return chunks;
+  }
+
+  const char* begin = static_cast<const char*>(mapping_->region.get_address());
+  const char* end = begin + mapping_->region.get_size();
+
+  for (size_t i = 0; i < skip_lines && begin < end; ++i) {
+    const char* eol = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+    begin = (eol != nullptr) ? eol + 1 : end;
+  }
+  if (begin == end) {
+    return chunks;
+  }
+
+  // Cut at the first line ending after each evenly spaced offset.
+  const size_t num_chunks = static_cast<size_t>(std::max(1, max_chunks));
+  const size_t target_size = std::max<size_t>(1, ((end - begin) + num_chunks - 1) / num_chunks);
+  const char* chunk_begin = begin;
+  while (chunk_begin < end) {
+    const char* cut = chunk_begin + std::min<size_t>(target_size, end - chunk_begin);
+    if (cut < end) {
+      const char* eol = static_cast<const char*>(std::memchr(cut, '\n', end - cut));
+      cut = (eol != nullptr) ? eol + 1 : end;
+    }
+    chunks.emplace_back(chunk_begin, cut);
+    chunk_begin = cut;
+  }
+
+  return chunks;
+}
+
+
+}
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "core/task_scheduler.hpp"
+#include "core/timestamp.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+
+// Parse an unsigned integer (or a decimal number) at p, and move p past it. Leading spaces are
+// skipped. Returns false (and leaves p where it was) if there's no number at p. ParseCsvDouble()
+// gives exactly the same result as std::stod, but only falls back to it for numbers that can't be
+// converted exactly with one multiply or divide (more than 15 significant digits, or a large
+// exponent).
+bool ParseCsvUint64(const char*& p, const char* end, uint64_t& out);
+bool ParseCsvDouble(const char*& p, const char* end, double& out);
+
+// Parse a "timestamp,v0,v1,..." line, with num_values numbers after the timestamp. Any fields after
+// those are ignored. Returns false if a field is missing or isn't a number.
+bool ParseCsvLine(const char* begin, const char* end, timestamp_t& timestamp, double* values, int num_values);
+
+
+// A read-only memory mapping of a CSV file.
+class CsvFile final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(CsvFile)
+  MACRO_DELETE_COPY_CONSTRUCTORS(CsvFile)
+
+  explicit CsvFile(const std::string& path);
+  ~CsvFile();
+
+  // Split the file (after its first skip_lines lines) into at most max_chunks ranges of whole
+  // lines, of about the same size.
+  std::vector<std::pair<const char*, const char*>> Chunks(size_t skip_lines, int max_chunks) const;
+
+  const std::string& Path() const { return path_; }
+
+ private:
+  struct Mapping;
+  std::unique_ptr<Mapping> mapping_;
+  std::string path_;
+};
+
+
+// Parse each line of a CSV file (after its first skip_lines lines) with parse_line, which should
+// append the line's item(s) to the vector it's given and return true:
+//
+//   bool parse_line(const char* begin, const char* end, std::vector<Item>& out)
+//
+// Lines don't include their line ending, and blank lines are skipped. The file is split into chunks
+// that are parsed on the shared TaskScheduler, and the items come back in file order. Dies (with
+// the offending line) if parse_line returns false.
+template <typename Item, typename ParseLine>
+std::vector<Item> ParseCsvFile(const std::string& path, size_t skip_lines, const ParseLine& parse_line)
+{
+  // NOTE(milo): Small files aren't worth splitting up.
+  static const size_t kMinChunkBytes = 1 << 20;
+
+  const CsvFile file(path);
+  TaskScheduler& scheduler = TaskScheduler::Instance();
+  const std::vector<std::pair<const char*, const char*>> chunks =
+      file.Chunks(skip_lines, std::max(1, 2 * scheduler.NumThreads()));
+
+  // Merge chunks back together until they're big enough.
+  std::vector<std::pair<const char*, const char*>> merged;
+  for (const auto& chunk : chunks) {
+    if (!merged.empty() && (size_t)(merged.back().second - merged.back().first) < kMinChunkBytes) {
+      merged.back().second = chunk.second;
+    } else {
+      merged.emplace_back(chunk);
+    }
+  }
+
+  // Datasets are loaded before anything else is running, so this takes the lowest priority lane.
+  std::vector<std::vector<Item>> parsed(merged.size());
+  scheduler.ParallelFor(TaskPriority::VIZ, (int)merged.size(), [&](int i) {
+    const char* p = merged.at(i).first;
+    const char* end = merged.at(i).second;
+    std::vector<Item>& out = parsed.at(i);
+    out.reserve((end - p) / 32);
+
+    while (p < end) {
+      const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      if (eol == nullptr) {
+        eol = end;
+      }
+      const char* line_end = eol;
+      while (line_end > p && (line_end[-1] == '\r' || line_end[-1] == ' ' || line_end[-1] == '\t')) {
+        --line_end;
+      }
+      if (line_end > p) {
+        CHECK(parse_line(p, line_end, out))
+            << "Could not parse line in " << file.Path() << ":\n  " << std::string(p, line_end) << std::endl;
+      }
+      p = eol + 1;
+    }
+  });
+
+  size_t total = 0;
+  for (const std::vector<Item>& items : parsed) {
+    total += items.size();
+  }
+
+  std::vector<Item> items;
+  items.reserve(total);
+  for (std::vector<Item>& chunk_items : parsed) {
+    items.insert(items.end(), chunk_items.begin(), chunk_items.end());
+    std::vector<Item>().swap(chunk_items);
+  }
+
+  return items;
+}
+
+
+}
+}
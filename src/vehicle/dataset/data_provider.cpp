@@ -1,8 +1,11 @@
+#include <algorithm>
+#include <limits>
 #include <thread>
 #include <glog/logging.h>
 #include <opencv2/highgui.hpp>
 
 #include "dataset/data_provider.hpp"
+#include "dataset/image_prefetcher.hpp"
 
 #include "core/file_utils.hpp"
 #include "vision_core/image_util.hpp"
@@ -16,6 +19,21 @@ static const double kMaxRange = 100.0;          // m
 static const double kMaxDepth = 20.0;           // m
 
 
+void ReadStereoImageFiles(const StereoDatasetItem& item, cv::Mat& left, cv::Mat& right, bool gray_only)
+{
+  if (!Exists(item.path_left)) {
+    throw std::runtime_error("ERROR: Left image filepath is invalid:\n  " + item.path_left);
+  }
+  if (!Exists(item.path_right)) {
+    throw std::runtime_error("ERROR: Right image filepath is invalid:\n  " + item.path_right);
+  }
+
+  const int flags = gray_only ? cv::IMREAD_GRAYSCALE : cv::IMREAD_ANYCOLOR;
+  left = cv::imread(item.path_left, flags);
+  right = cv::imread(item.path_right, flags);
+}
+
+
 timestamp_t DataProvider::NextTimestamp(timestamp_t& next_imu_time,
                                         timestamp_t& next_depth_time,
                                         timestamp_t& next_range_time,
@@ -108,20 +126,8 @@ bool DataProvider::Step(bool verbose)
     // Load the images and convert to grayscale if needed.
     timestamp_t timestamp = stereo_data.at(next_stereo_idx_).timestamp;
 
-    const std::string& path_left = stereo_data.at(next_stereo_idx_).path_left;
-    const std::string& path_right = stereo_data.at(next_stereo_idx_).path_right;
-
-    if (!Exists(path_left)) {
-      throw std::runtime_error("ERROR: Left image filepath is invalid:\n  " + path_left);
-    }
-    if (!Exists(path_right)) {
-      throw std::runtime_error("ERROR: Right image filepath is invalid:\n  " + path_right);
-    }
-
-    // NOTE(milo): Using non-const left/right images so that we can avoid copy them into the
-    // stereo image (use std::move instead to steal the underlying data).
-    const cv::Mat iml = cv::imread(path_left, cv::IMREAD_ANYCOLOR);
-    const cv::Mat imr = cv::imread(path_right, cv::IMREAD_ANYCOLOR);
+    cv::Mat iml, imr;
+    LoadStereoImages(next_stereo_idx_, iml, imr);
 
     if (iml.channels() > 1 && imr.channels() > 1) {
       const StereoImage3b stereo3b(timestamp, next_stereo_idx_, Image3b(iml), Image3b(imr));
@@ -145,6 +151,41 @@ bool DataProvider::Step(bool verbose)
 }
 
 
+void DataProvider::LoadStereoImages(size_t idx, cv::Mat& left, cv::Mat& right)
+{
+  // If nobody wants color images, decode straight to gray, so that Step() doesn't have to allocate
+  // a color image and then convert it.
+  const bool gray_only = stereo_callbacks_3b_.empty();
+
+  if (prefetch_threads_ <= 0) {
+    if (read_stereo_) {
+      read_stereo_(idx, left, right);
+    } else {
+      ReadStereoImageFiles(stereo_data.at(idx), left, right, gray_only);
+    }
+    return;
+  }
+
+  if (!prefetcher_) {
+    StereoReadFunction read = read_stereo_;
+
+    // The workers get their own copy of the items, in case this provider is copied or destroyed.
+    // NOTE(milo): Callbacks are all registered before playback, so gray_only won't change.
+    if (!read) {
+      const auto items = std::make_shared<const std::vector<StereoDatasetItem>>(stereo_data);
+      read = [items, gray_only](size_t i, cv::Mat& l, cv::Mat& r) {
+        ReadStereoImageFiles(items->at(i), l, r, gray_only);
+      };
+    }
+
+    prefetcher_ = std::make_shared<ImagePrefetcher>(
+        read, idx, stereo_data.size(), prefetch_threads_, prefetch_max_images_, prefetch_max_bytes_);
+  }
+
+  prefetcher_->Get(idx, left, right);
+}
+
+
 void DataProvider::StepUntil(DataSource source)
 {
   size_t* idx_ptr;
@@ -164,15 +205,20 @@ void DataProvider::StepUntil(DataSource source)
 }
 
 
-void DataProvider::PlaybackWorker(float speed, bool verbose)
+void DataProvider::PlaybackWorker(float speed, bool verbose, timestamp_t t_end)
 {
-  while (Step(verbose)) {
+  while (NextTimestamp().first <= t_end && Step(verbose)) {
     const timestamp_t next_time = NextTimestamp().first;
 
-    if (next_time == kMaxTimestamp) {
+    if (next_time == kMaxTimestamp || next_time > t_end) {
       break;
     }
 
+    // Go as fast as possible.
+    if (speed < 0) {
+      continue;
+    }
+
     const float ns_until_next = static_cast<float>(next_time - last_data_timestamp_) / speed;
 
     if (verbose) {
@@ -186,19 +232,64 @@ void DataProvider::PlaybackWorker(float speed, bool verbose)
 
 void DataProvider::Playback(float speed, bool verbose)
 {
-  CHECK_GT(speed, 0.01f) << "Cannot go slower than 1% speed" << std::endl;
+  CHECK(speed < 0 || speed > 0.01f) << "Cannot go slower than 1% speed" << std::endl;
+
+  std::thread worker(&DataProvider::PlaybackWorker, this, speed, verbose, kMaxTimestamp);
+  worker.join();
+}
+
+
+void DataProvider::Playback(timestamp_t t_start, timestamp_t t_end, float speed, bool verbose)
+{
+  CHECK(speed < 0 || speed > 0.01f) << "Cannot go slower than 1% speed" << std::endl;
+  CHECK_LE(t_start, t_end);
 
-  std::thread worker(&DataProvider::PlaybackWorker, this, speed, verbose);
+  Seek(t_start);
+  std::thread worker(&DataProvider::PlaybackWorker, this, speed, verbose, t_end);
   worker.join();
 }
 
 
+void DataProvider::SetImagePrefetch(int num_threads, int max_images, float max_mb)
+{
+  CHECK_GE(num_threads, 0);
+  CHECK_GT(max_images, 0);
+
+  prefetch_threads_ = num_threads;
+  prefetch_max_images_ = static_cast<size_t>(max_images);
+  prefetch_max_bytes_ = static_cast<size_t>(max_mb * 1e6f);
+  prefetcher_.reset();
+}
+
+
 void DataProvider::Reset()
 {
   last_data_timestamp_ = 0;
   next_stereo_idx_ = 0;
   next_imu_idx_ = 0;
   next_depth_idx_ = 0;
+  next_range_idx_ = 0;
+  prefetcher_.reset();
+}
+
+
+// Index of the first item at or after timestamp.
+template <typename T>
+static size_t LowerBoundTimestamp(const std::vector<T>& data, timestamp_t timestamp)
+{
+  return std::lower_bound(data.begin(), data.end(), timestamp,
+      [](const T& item, timestamp_t t) { return item.timestamp < t; }) - data.begin();
+}
+
+
+void DataProvider::Seek(timestamp_t timestamp)
+{
+  next_stereo_idx_ = LowerBoundTimestamp(stereo_data, timestamp);
+  next_imu_idx_ = LowerBoundTimestamp(imu_data, timestamp);
+  next_depth_idx_ = LowerBoundTimestamp(depth_data, timestamp);
+  next_range_idx_ = LowerBoundTimestamp(range_data, timestamp);
+  last_data_timestamp_ = timestamp;
+  prefetcher_.reset();
 }
 
 
@@ -214,6 +305,43 @@ Matrix4d DataProvider::InitialPose() const
 }
 
 
+bool DataProvider::GroundtruthPose(timestamp_t timestamp, Matrix4d& world_T_body, double max_gap_sec) const
+{
+  const size_t i1 = LowerBoundTimestamp(pose_data, timestamp);
+  if (i1 >= pose_data.size()) {
+    return false;
+  }
+
+  const GroundtruthItem& after = pose_data.at(i1);
+  if (after.timestamp == timestamp) {
+    world_T_body = after.world_T_body;
+    return true;
+  }
+
+  if (i1 == 0) {
+    return false;
+  }
+
+  const GroundtruthItem& before = pose_data.at(i1 - 1);
+  const timestamp_t max_gap = ConvertToNanoseconds(max_gap_sec);
+  if ((timestamp - before.timestamp) > max_gap || (after.timestamp - timestamp) > max_gap) {
+    return false;
+  }
+
+  // Slerp the rotation, and lerp the translation.
+  const double s = static_cast<double>(timestamp - before.timestamp) /
+                   static_cast<double>(after.timestamp - before.timestamp);
+  const Quaterniond q0(before.world_T_body.block<3, 3>(0, 0));
+  const Quaterniond q1(after.world_T_body.block<3, 3>(0, 0));
+
+  world_T_body = Matrix4d::Identity();
+  world_T_body.block<3, 3>(0, 0) = q0.slerp(s, q1).toRotationMatrix();
+  world_T_body.block<3, 1>(0, 3) = (1.0 - s) * before.world_T_body.block<3, 1>(0, 3) +
+                                   s * after.world_T_body.block<3, 1>(0, 3);
+  return true;
+}
+
+
 timestamp_t DataProvider::FirstTimestamp() const
 {
   CHECK(!(imu_data.empty() && stereo_data.empty() && depth_data.empty()));
@@ -233,31 +361,53 @@ timestamp_t DataProvider::FirstTimestamp() const
 
 void DataProvider::SanityCheck()
 {
+  // NOTE(milo): One pass over each stream checks both the values and the order.
+  double max_norm_acc = 0;
+  double max_norm_rot_rate = 0;
   for (size_t i = 0; i < imu_data.size(); ++i) {
-    const ImuMeasurement imu = imu_data.at(i);
-    CHECK_LT(imu.a.norm(), kMaxAcceleration)
+    const ImuMeasurement& imu = imu_data[i];
+    const double norm_acc = imu.a.norm();
+    const double norm_rot_rate = imu.w.norm();
+    CHECK_LT(norm_acc, kMaxAcceleration)
         << "Bad acceleration: #" << i << "\n" << imu.a.transpose() << std::endl;
-    CHECK_LT(imu.w.norm(), kMaxAngularVelocity)
+    CHECK_LT(norm_rot_rate, kMaxAngularVelocity)
         << "Bad angular velocity: #" << i << "\n" << imu.w.transpose() << std::endl;
+    CHECK(i == 0 || imu.timestamp > imu_data[i-1].timestamp)
+        << "IMU data is not in chronological order: #" << i << std::endl;
+    max_norm_acc = std::max(max_norm_acc, norm_acc);
+    max_norm_rot_rate = std::max(max_norm_rot_rate, norm_rot_rate);
   }
 
+  double min_depth = std::numeric_limits<double>::max();
+  double max_depth = 0;
   for (size_t i = 0; i < depth_data.size(); ++i) {
-    const DepthMeasurement data = depth_data.at(i);
+    const DepthMeasurement& data = depth_data[i];
     CHECK(data.depth <= kMaxDepth && data.depth >= 0)
       << "Bad depth: #" << i << "\n" << "Value: " << data.depth << std::endl;
+    CHECK(i == 0 || data.timestamp > depth_data[i-1].timestamp)
+        << "Depth data is not in chronological order: #" << i << std::endl;
+    min_depth = std::min(min_depth, data.depth);
+    max_depth = std::max(max_depth, data.depth);
   }
 
   for (size_t i = 0; i < range_data.size(); ++i) {
-    const RangeMeasurement data = range_data.at(i);
+    const RangeMeasurement& data = range_data[i];
     CHECK(data.range <= kMaxRange && data.range >= 0)
       << "Bad range: #" << i << "\n" << "Value: " << data.range << std::endl;
+    CHECK(i == 0 || data.timestamp >= range_data[i-1].timestamp)
+        << "Range data is not in chronological order: #" << i << std::endl;
   }
 
-  CHECK(TimestampsInOrder<ImuMeasurement>(imu_data, true));
-  CHECK(TimestampsInOrder<DepthMeasurement>(depth_data, true));
-  CHECK(TimestampsInOrder<RangeMeasurement>(range_data, false));
+  if (imu_data.size() > 1) {
+    const double total_sec = ConvertToSeconds(imu_data.back().timestamp - imu_data.front().timestamp);
+    LOG(INFO) << "IMU average (hz): " << (static_cast<double>(imu_data.size() - 1) / total_sec) << '\n'
+              << "Maximum measured rotation rate (rad/s): " << max_norm_rot_rate << '\n'
+              << "Maximum measured acceleration (m/s^2): " << max_norm_acc << std::endl;
+  }
+  if (!depth_data.empty()) {
+    LOG(INFO) << "Depth min=" << min_depth << " max=" << max_depth << std::endl;
+  }
 }
 
-
 }
 }
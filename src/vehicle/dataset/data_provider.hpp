@@ -4,6 +4,7 @@
 
 #include <string>
 #include <functional>
+#include <memory>
 #include <vector>
 
 #include "vision_core/cv_types.hpp"
@@ -19,6 +20,8 @@ namespace dataset {
 
 using namespace core;
 
+class ImagePrefetcher;
+
 // Any type of data that the dataset could contain.
 enum DataSource { STEREO, IMU, DEPTH, RANGE };
 inline std::string to_string(const DataSource& d)
@@ -44,6 +47,9 @@ typedef std::function<void(const ImuMeasurement&)> ImuCallback;
 typedef std::function<void(const DepthMeasurement&)> DepthCallback;
 typedef std::function<void(const RangeMeasurement&)> RangeCallback;
 
+// Reads the left and right images for stereo item idx.
+typedef std::function<void(size_t idx, cv::Mat& left, cv::Mat& right)> StereoReadFunction;
+
 
 // Represents a stereo image pair stored on disk.
 struct StereoDatasetItem
@@ -76,6 +82,11 @@ struct GroundtruthItem
 };
 
 
+// Read the images for a stereo item from disk. Throws std::runtime_error if either doesn't exist.
+// Pass gray_only to decode them straight to grayscale, instead of in their stored color.
+void ReadStereoImageFiles(const StereoDatasetItem& item, cv::Mat& left, cv::Mat& right, bool gray_only = false);
+
+
 template <typename T>
 bool TimestampsInOrder(const std::vector<T>& data, bool strictly_increasing = false)
 {
@@ -111,13 +122,33 @@ class DataProvider {
   // playback based on the factor "speed". If speed is < 0, returns data as fast as possible.
   void Playback(float speed = 1.0f, bool verbose = false);
 
+  // Seek() to t_start, then play back everything up to (and including) t_end, like Playback().
+  void Playback(timestamp_t t_start, timestamp_t t_end, float speed = 1.0f, bool verbose = false);
+
+  // Decode stereo images on num_threads worker threads, up to max_images ahead of playback, so that
+  // image reads overlap with the callbacks. Stops reading ahead once about max_mb of decoded images
+  // are buffered. Pass num_threads = 0 to read images synchronously in Step() (the default).
+  void SetImagePrefetch(int num_threads, int max_images = 16, float max_mb = 512.0f);
+
   // Start the dataset back over at the beginning.
   void Reset();
 
+  // Skip ahead (or back) so that the next data returned is the first at or after timestamp.
+  void Seek(timestamp_t timestamp);
+
   Matrix4d InitialPose() const;
+
+  // Groundtruth pose at timestamp, interpolated between the poses before and after it (e.g to
+  // initialize an estimator after a Seek()). Returns false if there isn't a pose on both sides of
+  // timestamp, within max_gap_sec of it.
+  bool GroundtruthPose(timestamp_t timestamp, Matrix4d& world_T_body, double max_gap_sec = 1.0) const;
   timestamp_t FirstTimestamp() const;
 
   const std::vector<GroundtruthItem>& GroundtruthPoses() const { return pose_data; }
+  const std::vector<StereoDatasetItem>& StereoItems() const { return stereo_data; }
+  const std::vector<ImuMeasurement>& ImuMeasurements() const { return imu_data; }
+  const std::vector<DepthMeasurement>& DepthMeasurements() const { return depth_data; }
+  const std::vector<RangeMeasurement>& RangeMeasurements() const { return range_data; }
 
   // Make sure numerical data is reasonable.
   void SanityCheck();
@@ -133,8 +164,8 @@ class DataProvider {
   // Does sanity-checking on input data. Should be called before playback.
   void Validate() const;
 
-  // Playback() runs this member function in its own thread.
-  void PlaybackWorker(float speed, bool verbose);
+  // Playback() runs this member function in its own thread. Stops after the data at t_end.
+  void PlaybackWorker(float speed, bool verbose, timestamp_t t_end);
 
   std::vector<StereoCallback1b> stereo_callbacks_1b_;
   std::vector<StereoCallback3b> stereo_callbacks_3b_;
@@ -142,6 +173,9 @@ class DataProvider {
   std::vector<DepthCallback> depth_callbacks_;
   std::vector<RangeCallback> range_callbacks_;
 
+  // Read the images for a stereo item, from the prefetcher if there is one.
+  void LoadStereoImages(size_t idx, cv::Mat& left, cv::Mat& right);
+
   // Timestamp of the last data item that was passed to a callback.
   timestamp_t last_data_timestamp_ = 0;
 
@@ -151,12 +185,24 @@ class DataProvider {
   size_t next_depth_idx_ = 0;
   size_t next_range_idx_ = 0;
 
+  int prefetch_threads_ = 0;
+  size_t prefetch_max_images_ = 0;
+  size_t prefetch_max_bytes_ = 0;
+
+  // NOTE(milo): Created lazily on the first stereo Step(), since datasets are copied around by
+  // value before playback (see GetDatasetByName).
+  std::shared_ptr<ImagePrefetcher> prefetcher_;
+
  protected:
   std::vector<StereoDatasetItem> stereo_data;
   std::vector<ImuMeasurement> imu_data;
   std::vector<GroundtruthItem> pose_data;
   std::vector<DepthMeasurement> depth_data;
   std::vector<RangeMeasurement> range_data;
+
+  // Datasets that don't store each image in its own file can set this to read images from
+  // somewhere else. It's also called from prefetch threads, so it has to be thread-safe.
+  StereoReadFunction read_stereo_;
 };
 
 }
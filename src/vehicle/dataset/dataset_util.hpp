@@ -7,6 +7,7 @@
 #include "dataset/himb_dataset.hpp"
 #include "dataset/caddy_dataset.hpp"
 #include "dataset/acfr_dataset.hpp"
+#include "dataset/lcm_log_dataset.hpp"
 
 #include "core/path_util.hpp"
 
@@ -22,7 +23,8 @@ enum Dataset
   CADDY = 1,
   HIMB = 2,
   ACFR = 3,
-  ZEDM = 4
+  ZEDM = 4,
+  LCM_LOG = 5
 };
 
 
@@ -58,6 +60,11 @@ inline DataProvider GetDatasetByName(Dataset code,
       dataset = dataset::EurocDataset(folder);
       shared_params_path = config_path("shared/ZEDMini.yaml");
       break;
+    case Dataset::LCM_LOG:
+      // The folder is the .lcm file, and the subfolder is the shared params file to use with it.
+      dataset = dataset::LcmLogDataset(folder);
+      shared_params_path = config_path("shared/" + subfolder);
+      break;
     default:
       LOG(FATAL) << "Unknown dataset type: " << code << std::endl;
       break;
@@ -1,5 +1,6 @@
+#include <algorithm>
+
 #include <glog/logging.h>
-#include <fstream>
 #include <opencv2/highgui.hpp>
 
 #include "core/file_utils.hpp"
@@ -10,9 +11,18 @@ namespace bm {
 namespace dataset {
 
 
-EurocDataWriter::EurocDataWriter(const std::string& folder)
-    : folder_(Join(folder, "mav0"))
+EurocDataWriter::EurocDataWriter(const std::string& folder,
+                                 ImageFormat format,
+                                 int png_compression,
+                                 int num_threads,
+                                 size_t max_queue_size)
+    : folder_(Join(folder, "mav0")),
+      format_(format),
+      max_queue_size_(max_queue_size)
 {
+  CHECK_GT(num_threads, 0) << "EurocDataWriter needs at least one encoder thread" << std::endl;
+  CHECK_GT(max_queue_size, 0);
+
   if (Exists(folder)) {
     LOG(WARNING) << "Dataset folder already exists, overwriting" << std::endl;
     rmdir(folder);
@@ -31,42 +41,186 @@ EurocDataWriter::EurocDataWriter(const std::string& folder)
   mkdir(right_folder_);
   mkdir(Join(left_folder_, "data"));
   mkdir(Join(right_folder_, "data"));
+
+  if (format_ == ImageFormat::PNG) {
+    extension_ = ".png";
+    if (png_compression >= 0) {
+      encode_params_ = { cv::IMWRITE_PNG_COMPRESSION, png_compression };
+    }
+  } else {
+    extension_ = ".ppm";
+    encode_params_ = { cv::IMWRITE_PXM_BINARY, 1 };
+  }
+
+  // NOTE(milo): EurocDataset skips the first line of each CSV, so these need a header.
+  imu_csv_.open(Join(imu_folder_, "data.csv"));
+  imu_csv_ << "#timestamp [ns],w_RS_S_x [rad s^-1],w_RS_S_y [rad s^-1],w_RS_S_z [rad s^-1],"
+              "a_RS_S_x [m s^-2],a_RS_S_y [m s^-2],a_RS_S_z [m s^-2]\n";
+  depth_csv_.open(Join(depth_folder_, "data.csv"));
+  depth_csv_ << "#timestamp [ns],depth [m]\n";
+  left_csv_.open(Join(left_folder_, "data.csv"));
+  left_csv_ << "#timestamp [ns],filename\n";
+  right_csv_.open(Join(right_folder_, "data.csv"));
+  right_csv_ << "#timestamp [ns],filename\n";
+
+  CHECK(imu_csv_.is_open() && depth_csv_.is_open() && left_csv_.is_open() && right_csv_.is_open())
+      << "Could not open the CSV files in " << folder_ << std::endl;
+
+  for (int i = 0; i < num_threads; ++i) {
+    encoders_.emplace_back(&EurocDataWriter::EncoderLoop, this);
+  }
 }
 
 
-void EurocDataWriter::WriteImu(const ImuMeasurement& data)
+EurocDataWriter::~EurocDataWriter()
 {
-  std::ofstream out;
-  out.open(Join(imu_folder_, "data.csv"), std::ios_base::app);
+  Flush();
+
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    stop_ = true;
+  }
+  cv_job_.notify_all();
+
+  for (std::thread& t : encoders_) {
+    t.join();
+  }
 
+  const Stats stats = GetStats();
+  LOG_IF(WARNING, stats.dropped > 0) << "EurocDataWriter dropped " << stats.dropped << " of "
+      << (stats.written + stats.dropped) << " stereo pairs" << std::endl;
+}
+
+
+void EurocDataWriter::WriteImu(const ImuMeasurement& data)
+{
   char buf[100];
   const int sz = std::snprintf(buf, 100, "%zu,%lf,%lf,%lf,%lf,%lf,%lf\n",
       data.timestamp, data.w.x(), data.w.y(), data.w.z(), data.a.x(), data.a.y(), data.a.z());
   CHECK(sz < 100) << "Buffer overflow! Need to allocate larger char[]" << std::endl;
 
-  out << std::string(buf);
-  out.close();
+  std::lock_guard<std::mutex> lock(sensor_mutex_);
+  imu_csv_.write(buf, sz);
+}
+
+
+void EurocDataWriter::WriteDepth(const DepthMeasurement& data)
+{
+  char buf[64];
+  const int sz = std::snprintf(buf, 64, "%zu,%lf\n", data.timestamp, data.depth);
+  CHECK(sz < 64) << "Buffer overflow! Need to allocate larger char[]" << std::endl;
+
+  std::lock_guard<std::mutex> lock(sensor_mutex_);
+  depth_csv_.write(buf, sz);
 }
 
 
-void EurocDataWriter::WriteStereo(const StereoImage3b& data)
+bool EurocDataWriter::WriteStereo(const StereoImage3b& data)
 {
-  std::ofstream ofl, ofr;
-  ofl.open(Join(left_folder_, "data.csv"), std::ios_base::app);
-  ofr.open(Join(right_folder_, "data.csv"), std::ios_base::app);
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if ((queue_.size() + in_flight_) >= max_queue_size_) {
+      LOG_IF(WARNING, stats_.dropped == 0) << "EurocDataWriter is falling behind, dropping "
+          "stereo pairs (see GetStats())" << std::endl;
+      ++stats_.dropped;
+      return false;
+    }
+
+    // NOTE(milo): Only pairs that were queued get a sequence number, so that CommitRows() never
+    // waits on a dropped one.
+    queue_.emplace_back(Job{ next_seq_++, data.timestamp, data.left_image, data.right_image });
+    stats_.max_queued = std::max(stats_.max_queued, queue_.size() + in_flight_);
+  }
+
+  cv_job_.notify_one();
+  return true;
+}
 
-  const std::string img_name = std::to_string(data.timestamp) + ".png";
-  const std::string data_img_name = Join("data", img_name);
 
-  cv::imwrite(Join(left_folder_, data_img_name), data.left_image);
-  cv::imwrite(Join(right_folder_, data_img_name), data.right_image);
+void EurocDataWriter::Flush()
+{
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    cv_done_.wait(lock, [this]() { return queue_.empty() && in_flight_ == 0; });
+  }
 
+  {
+    std::lock_guard<std::mutex> lock(sensor_mutex_);
+    imu_csv_.flush();
+    depth_csv_.flush();
+  }
+
+  std::lock_guard<std::mutex> lock(commit_mutex_);
+  left_csv_.flush();
+  right_csv_.flush();
+}
+
+
+EurocDataWriter::Stats EurocDataWriter::GetStats()
+{
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  Stats stats = stats_;
+  stats.queued = queue_.size() + in_flight_;
+  return stats;
+}
+
+
+void EurocDataWriter::EncoderLoop()
+{
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      cv_job_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      job = std::move(queue_.front());
+      queue_.pop_front();
+      ++in_flight_;
+    }
+
+    const std::string img_name = std::to_string(job.timestamp) + extension_;
+    const std::string data_img_name = Join("data", img_name);
+
+    const bool ok = cv::imwrite(Join(left_folder_, data_img_name), job.left, encode_params_) &&
+                    cv::imwrite(Join(right_folder_, data_img_name), job.right, encode_params_);
+    LOG_IF(ERROR, !ok) << "Failed to write stereo pair " << img_name << std::endl;
+
+    // Rows are committed even if a write failed, so that the ones after it aren't held up. A
+    // failed pair just doesn't get a row.
+    {
+      std::lock_guard<std::mutex> lock(commit_mutex_);
+      saved_.emplace(job.seq, std::make_pair(job.timestamp, ok));
+      CommitRows();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      --in_flight_;
+      if (ok) {
+        ++stats_.written;
+      }
+    }
+    cv_done_.notify_all();
+  }
+}
+
+
+void EurocDataWriter::CommitRows()
+{
   // NOTE(milo): Write metadata after image! That way we don't end up with data.csv pointing
   // to an image that doesn't exist on disk.
-  ofl << std::to_string(data.timestamp) << "," << img_name << std::endl;
-  ofr << std::to_string(data.timestamp) << "," << img_name << std::endl;
-  ofl.close();
-  ofr.close();
+  auto it = saved_.begin();
+  while (it != saved_.end() && it->first == next_commit_) {
+    if (it->second.second) {
+      const std::string stamp = std::to_string(it->second.first);
+      left_csv_ << stamp << "," << stamp << extension_ << "\n";
+      right_csv_ << stamp << "," << stamp << extension_ << "\n";
+    }
+    it = saved_.erase(it);
+    ++next_commit_;
+  }
 }
 
 
@@ -1,7 +1,17 @@
 #pragma once
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "core/macros.hpp"
 #include "core/imu_measurement.hpp"
 #include "core/depth_measurement.hpp"
 #include "vision_core/stereo_image.hpp"
@@ -11,15 +21,65 @@ namespace dataset {
 
 using namespace core;
 
-class EurocDataWriter {
+
+// Writes a dataset in the EuRoC MAV format. Stereo images are encoded and saved on a pool of
+// encoder threads, so that WriteStereo() returns right away (e.g on a thread that also polls the
+// IMU). If the encoders fall more than max_queue_size pairs behind, new pairs are dropped (and
+// counted) instead of blocking the caller.
+//
+// The CSV files are held open and only appended to. A camera row is written once both of its
+// images are on disk, in the order that the pairs were given to WriteStereo(), so data.csv never
+// points to a missing image.
+class EurocDataWriter final {
  public:
-  EurocDataWriter(const std::string& folder);
+  // Both are lossless. PPM is uncompressed, for when the disk is faster than the PNG encoders.
+  enum class ImageFormat { PNG, PPM };
+
+  struct Stats final
+  {
+    size_t written = 0;           // Stereo pairs saved.
+    size_t dropped = 0;           // Stereo pairs dropped because the queue was full.
+    size_t queued = 0;            // Stereo pairs waiting for (or being) encoded right now.
+    size_t max_queued = 0;        // The most pairs that have been waiting at once (lag).
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(EurocDataWriter);
+
+  EurocDataWriter(const std::string& folder,
+                  ImageFormat format = ImageFormat::PNG,
+                  int png_compression = -1,   // 0 to 9, or -1 for OpenCV's default.
+                  int num_threads = 2,
+                  size_t max_queue_size = 8);
+
+  // Saves everything that was queued, and closes the files.
+  ~EurocDataWriter();
 
   void WriteImu(const ImuMeasurement& data);
 
   void WriteDepth(const DepthMeasurement& data);
 
-  void WriteStereo(const StereoImage3b& data);
+  // Queues a stereo pair to be saved, and returns false if it was dropped.
+  // NOTE(milo): The images aren't copied, so the caller must not write into them afterwards.
+  bool WriteStereo(const StereoImage3b& data);
+
+  // Blocks until every queued pair is saved, and flushes all of the CSV files.
+  void Flush();
+
+  Stats GetStats();
+
+ private:
+  struct Job final
+  {
+    uint64_t seq;
+    timestamp_t timestamp;
+    Image3b left;
+    Image3b right;
+  };
+
+  void EncoderLoop();
+
+  // Appends the camera rows for every saved pair that is next in order (hold commit_mutex_).
+  void CommitRows();
 
  private:
   std::string folder_;
@@ -27,6 +87,35 @@ class EurocDataWriter {
   std::string depth_folder_;
   std::string left_folder_;
   std::string right_folder_;
+
+  ImageFormat format_;
+  std::string extension_;
+  std::vector<int> encode_params_;
+  size_t max_queue_size_;
+
+  // IMU and depth rows are written by the caller.
+  std::mutex sensor_mutex_;
+  std::ofstream imu_csv_;
+  std::ofstream depth_csv_;
+
+  // Stereo pairs waiting for an encoder.
+  std::mutex queue_mutex_;
+  std::condition_variable cv_job_;        // Notified when a job is queued, or on shutdown.
+  std::condition_variable cv_done_;       // Notified when a job finishes.
+  std::deque<Job> queue_;
+  size_t in_flight_ = 0;
+  uint64_t next_seq_ = 0;
+  bool stop_ = false;
+  Stats stats_;
+
+  // Saved pairs whose rows can't be written until the ones before them are.
+  std::mutex commit_mutex_;
+  std::map<uint64_t, std::pair<timestamp_t, bool>> saved_;   // Sequence number => (timestamp, ok).
+  uint64_t next_commit_ = 0;
+  std::ofstream left_csv_;
+  std::ofstream right_csv_;
+
+  std::vector<std::thread> encoders_;
 };
 
 }
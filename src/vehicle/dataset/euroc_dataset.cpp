@@ -1,9 +1,12 @@
-#include <fstream>
+#include <algorithm>
+#include <functional>
 
 #include <glog/logging.h>
 
 #include "dataset/euroc_dataset.hpp"
+#include "dataset/csv_parser.hpp"
 #include "core/file_utils.hpp"
+#include "core/task_scheduler.hpp"
 
 namespace bm {
 namespace dataset {
@@ -15,28 +18,9 @@ EurocDataset::EurocDataset(const std::string& toplevel_path) : DataProvider()
 
   const std::string cam0_path = Join(mav0_path, "cam0");
   const std::string cam1_path = Join(mav0_path, "cam1");
-  ParseStereo(cam0_path, cam1_path);
-
-  const std::string& imu_csv = Join(mav0_path, "imu0/data.csv");
-  if (Exists(imu_csv)) {
-    ParseImu(imu_csv);
-  } else {
-    LOG(WARNING) << "[MISSING DATA] No IMU measurements found!" << std::endl;
-  }
-
-  const std::string& pose_txt = Join(mav0_path, "imu0_poses.txt");
-  if (Exists(pose_txt)) {
-    ParseGroundtruth(pose_txt);
-  } else {
-    LOG(WARNING) << "[MISSING DATA] No groundtruth poses found!" << std::endl;
-  }
-
-  const std::string& depth_csv = Join(mav0_path, "depth0/data.csv");
-  if (Exists(depth_csv)) {
-    ParseDepth(depth_csv);
-  } else {
-    LOG(WARNING) << "[MISSING DATA] No depth measurements found!" << std::endl;
-  }
+  const std::string imu_csv = Join(mav0_path, "imu0/data.csv");
+  const std::string pose_txt = Join(mav0_path, "imu0_poses.txt");
+  const std::string depth_csv = Join(mav0_path, "depth0/data.csv");
 
   std::vector<std::string> range_csv_paths;
   if (Exists(Join(mav0_path, "aps0/data.csv"))) {
@@ -45,71 +29,65 @@ EurocDataset::EurocDataset(const std::string& toplevel_path) : DataProvider()
   if (Exists(Join(mav0_path, "aps1/data.csv"))) {
     range_csv_paths.emplace_back(Join(mav0_path, "aps1/data.csv"));
   }
-  if (!range_csv_paths.empty()) {
-    ParseRange(range_csv_paths);
-  } else {
-    LOG(WARNING) << "[MISSING DATA] No range measurements found!" << std::endl;
-  }
+
+  // NOTE(milo): Each stream goes into its own vector, so they can all be parsed at once (and each
+  // file is split up further inside of ParseCsvFile).
+  const std::vector<std::function<void()>> jobs = {
+    [&]() { ParseStereo(cam0_path, cam1_path); },
+    [&]() {
+      if (Exists(imu_csv)) {
+        ParseImu(imu_csv);
+      } else {
+        LOG(WARNING) << "[MISSING DATA] No IMU measurements found!" << std::endl;
+      }
+    },
+    [&]() {
+      if (Exists(pose_txt)) {
+        ParseGroundtruth(pose_txt);
+      } else {
+        LOG(WARNING) << "[MISSING DATA] No groundtruth poses found!" << std::endl;
+      }
+    },
+    [&]() {
+      if (Exists(depth_csv)) {
+        ParseDepth(depth_csv);
+      } else {
+        LOG(WARNING) << "[MISSING DATA] No depth measurements found!" << std::endl;
+      }
+    },
+    [&]() {
+      if (!range_csv_paths.empty()) {
+        ParseRange(range_csv_paths);
+      } else {
+        LOG(WARNING) << "[MISSING DATA] No range measurements found!" << std::endl;
+      }
+    }
+  };
+  TaskScheduler::Instance().ParallelFor(TaskPriority::VIZ, (int)jobs.size(), [&jobs](int i) { jobs.at(i)(); });
 
   SanityCheck();
 }
 
 
-// NOTE(milo): Adapted from KIMERA-VIO
 void EurocDataset::ParseImu(const std::string& data_csv_path)
 {
   // NOTE(milo): EuRoC IMU lines follow this format:
   // timestamp [ns],w_RS_S_x [rad s^-1],w_RS_S_y [rad s^-1],w_RS_S_z [rad s^-1],
   // a_RS_S_x [m s^-2],a_RS_S_y [m s^-2],a_RS_S_z [m s^-2]
-  std::ifstream fin(data_csv_path.c_str());
-  CHECK(fin.is_open()) << "Could not open file: " << data_csv_path << std::endl;
-
-  // Skip the first line, containing the header.
-  std::string line;
-  std::getline(fin, line);
-
-  size_t count = 0;
-  double max_norm_acc = 0;
-  double max_norm_rot_rate = 0;
-  timestamp_t prev_timestamp = 0;
-
-  // Read/store imu measurements, line by line.
-  while (std::getline(fin, line)) {
+  // Skip the first line, containing the header. Order is checked in SanityCheck().
+  imu_data = ParseCsvFile<ImuMeasurement>(data_csv_path, 1,
+      [](const char* begin, const char* end, std::vector<ImuMeasurement>& out)
+  {
     timestamp_t timestamp = 0;
-    Vector6d gyr_acc_data;
-    for (size_t i = 0; i < (gyr_acc_data.size() + 1ul); ++i) {
-      size_t idx = line.find_first_of(',');
-      if (i == 0) {
-        timestamp = std::stoll(line.substr(0, idx));
-      } else {
-        gyr_acc_data(i - 1) = std::stod(line.substr(0, idx));
-      }
-      line = line.substr(idx + 1);
-    }
-    if (prev_timestamp != 0) {
-      CHECK_GT(timestamp, prev_timestamp) << "Euroc IMU data is not in chronological order!";
+    double v[6];
+    if (!ParseCsvLine(begin, end, timestamp, v, 6)) {
+      return false;
     }
+    out.emplace_back(ImuMeasurement(timestamp, Vector3d(v[0], v[1], v[2]), Vector3d(v[3], v[4], v[5])));
+    return true;
+  });
 
-    const double norm_acc = gyr_acc_data.tail(3).norm();
-    max_norm_acc = std::max(max_norm_acc, norm_acc);
-
-    const double norm_rot_rate = gyr_acc_data.head(3).norm();
-    max_norm_rot_rate = std::max(max_norm_rot_rate, norm_rot_rate);
-
-    imu_data.emplace_back(ImuMeasurement(timestamp, gyr_acc_data.head(3), gyr_acc_data.tail(3)));
-
-    prev_timestamp = timestamp;
-    ++count;
-  }
-
-  fin.close();
-
-  const timestamp_t total_time = imu_data.back().timestamp - imu_data.front().timestamp;
-
-  LOG(INFO) << "IMU average (hz): "
-           << (1e9 * static_cast<double>(count) / static_cast<double>(total_time)) << '\n'
-           << "Maximum measured rotation rate (rad/s): " << max_norm_rot_rate << '\n'
-           << "Maximum measured acceleration (m/s^2): " << max_norm_acc;
+  LOG(INFO) << "Read in " << imu_data.size() << " IMU measurements" << std::endl;
 }
 
 
@@ -127,11 +105,14 @@ void EurocDataset::ParseStereo(const std::string& cam0_path, const std::string&
 
   for (size_t i = 0; i < N; ++i) {
     CHECK(left_stamps.at(i) == right_stamps.at(i)) << "Left/right timestamps don't match!\n";
-    CHECK(Exists(lf.at(i)));
-    CHECK(Exists(rf.at(i)));
-
     stereo_data.emplace_back(StereoDatasetItem(left_stamps.at(i), lf.at(i), rf.at(i)));
   }
+
+  // Checking that every image exists is a stat() per file, so spread those out too.
+  TaskScheduler::Instance().ParallelFor(TaskPriority::VIZ, (int)N, [&](int i) {
+    CHECK(Exists(lf.at(i))) << "Missing image: " << lf.at(i) << std::endl;
+    CHECK(Exists(rf.at(i))) << "Missing image: " << rf.at(i) << std::endl;
+  });
 }
 
 
@@ -143,146 +124,109 @@ void EurocDataset::ParseImageFolder(const std::string& cam_folder,
   CHECK(!cam_folder.empty());
 
   const std::string data_csv_path = Join(cam_folder, "data.csv");
-  std::ifstream fin(data_csv_path.c_str());
-  CHECK(fin.is_open()) << "Cannot open file: " << data_csv_path;
-
-  // Skip the first line, containing the header.
-  std::string item;
-  std::getline(fin, item);
-
-  // Read/store list of image names.
-  while (std::getline(fin, item)) {
-    // TODO(milo): We use the timestamp to get the image file here, not the image file...
-    size_t idx = item.find_first_of(',');
-    const timestamp_t timestamp = std::stoll(item.substr(0, idx));
-    const std::string image_filename = Join(cam_folder, "data/" + item.substr(0, idx) + ".png");
-
-    // NOTE(KIMERA): Strangely, on mac, it does not work if we use: item.substr(idx + 1).
-    output_timestamps.emplace_back(timestamp);
-    output_filenames.emplace_back(image_filename);
+  const std::string data_folder = Join(cam_folder, "data/");
+
+  // Skip the first line, containing the header, and read the list of image names. Trailing
+  // whitespace (the '\r' at the end of lines in the original EuRoC files) is already stripped.
+  // Fall back to <timestamp>.png if there's no filename.
+  typedef std::pair<timestamp_t, std::string> ImageItem;
+  const std::vector<ImageItem> items = ParseCsvFile<ImageItem>(data_csv_path, 1,
+      [&data_folder](const char* begin, const char* end, std::vector<ImageItem>& out)
+  {
+    const char* p = begin;
+    uint64_t timestamp = 0;
+    if (!ParseCsvUint64(p, end, timestamp)) {
+      return false;
+    }
+    const char* timestamp_end = p;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+      ++p;
+    }
+    if (p < end && *p != ',') {
+      return false;
+    }
+    const char* name = (p < end) ? p + 1 : end;
+    while (name < end && (*name == ' ' || *name == '\t')) {
+      ++name;
+    }
+    const std::string filename = (name < end) ? std::string(name, end) : std::string(begin, timestamp_end) + ".png";
+    out.emplace_back(timestamp, data_folder + filename);
+    return true;
+  });
+
+  output_timestamps.reserve(output_timestamps.size() + items.size());
+  output_filenames.reserve(output_filenames.size() + items.size());
+  for (const ImageItem& item : items) {
+    output_timestamps.emplace_back(item.first);
+    output_filenames.emplace_back(item.second);
   }
-
-  fin.close();
 }
 
 
 void EurocDataset::ParseGroundtruth(const std::string& gt_path)
 {
-  // Read in groundtruth poses.
+  // Read in groundtruth poses, which are "ns,qw,qx,qy,qz,tx,ty,tz" with no header.
   CHECK(Exists(gt_path)) << "Groundtruth pose file does not exist: " << gt_path << std::endl;
 
-  std::ifstream stream(gt_path.c_str());
-  std::string line;
-
-  while (std::getline(stream, line)) {
-    std::stringstream iss(line);
-
-    std::string ns, qw, qx, qy, qz, tx, ty, tz;
-    std::getline(iss, ns, ',');
-    std::getline(iss, qw, ',');
-    std::getline(iss, qx, ',');
-    std::getline(iss, qy, ',');
-    std::getline(iss, qz, ',');
-    std::getline(iss, tx, ',');
-    std::getline(iss, ty, ',');
-    std::getline(iss, tz, ',');
-
-    const Quaterniond q(std::stod(qw), std::stod(qx), std::stod(qy), std::stod(qz));
-    const Vector3d t(std::stod(tx), std::stod(ty), std::stod(tz));
+  pose_data = ParseCsvFile<GroundtruthItem>(gt_path, 0,
+      [](const char* begin, const char* end, std::vector<GroundtruthItem>& out)
+  {
+    timestamp_t timestamp = 0;
+    double v[7];
+    if (!ParseCsvLine(begin, end, timestamp, v, 7)) {
+      return false;
+    }
+    const Quaterniond q(v[0], v[1], v[2], v[3]);
+    const Vector3d t(v[4], v[5], v[6]);
 
     Matrix4d world_T_body = Matrix4d::Identity();
     world_T_body.block<3, 3>(0, 0) = q.normalized().toRotationMatrix();
     world_T_body.block<3, 1>(0, 3) = t;
 
-    const timestamp_t timestamp = std::stoull(ns);
-    pose_data.emplace_back(GroundtruthItem(timestamp, world_T_body));
-  }
+    out.emplace_back(GroundtruthItem(timestamp, world_T_body));
+    return true;
+  });
 
-  stream.close();
   LOG(INFO) << "Read in " << pose_data.size() << " groundtruth poses" << std::endl;
 }
 
 
 void EurocDataset::ParseDepth(const std::string& depth_csv_path)
 {
-  std::ifstream fin(depth_csv_path.c_str());
-  CHECK(fin.is_open()) << "Could not open file: " << depth_csv_path << std::endl;
-
-  // Skip the first line, containing the header.
-  std::string line;
-  std::getline(fin, line);
-
-  double min_depth = std::numeric_limits<double>::max();
-  double max_depth = std::numeric_limits<double>::min();
-  timestamp_t prev_timestamp = 0;
-
-  // Read/store imu measurements, line by line.
-  while (std::getline(fin, line)) {
-    int comma_idx = line.find_first_of(',');
-    const timestamp_t timestamp = std::stoll(line.substr(0, comma_idx));
-
-    line = line.substr(comma_idx + 1);
-    comma_idx = line.find_first_of(',');
-    const double depth = std::stod(line.substr(0, comma_idx));
-
-    CHECK_GT(timestamp, prev_timestamp) << "EuRoC depth data is not in chronological order!";
-
-    min_depth = std::min(min_depth, depth);
-    max_depth = std::max(max_depth, depth);
-
-    depth_data.emplace_back(DepthMeasurement(timestamp, depth));
-    prev_timestamp = timestamp;
-  }
-
-  fin.close();
+  // Skip the first line, containing the header. Order and values are checked in SanityCheck().
+  depth_data = ParseCsvFile<DepthMeasurement>(depth_csv_path, 1,
+      [](const char* begin, const char* end, std::vector<DepthMeasurement>& out)
+  {
+    timestamp_t timestamp = 0;
+    double depth = 0;
+    if (!ParseCsvLine(begin, end, timestamp, &depth, 1)) {
+      return false;
+    }
+    out.emplace_back(DepthMeasurement(timestamp, depth));
+    return true;
+  });
 
-  LOG(INFO) << "Read in " << depth_data.size() << " DEPTH measurements.\n"
-            << "  earliest=" << depth_data.front().timestamp
-            << "  latest=" << depth_data.back().timestamp << "\n"
-            << "  min=" << min_depth << " max=" << max_depth << std::endl;
+  LOG(INFO) << "Read in " << depth_data.size() << " DEPTH measurements" << std::endl;
 }
 
 
 static std::vector<RangeMeasurement> ParseRangeHelper(const std::string& range_csv_path)
 {
-  std::vector<RangeMeasurement> range_data;
-
-  std::ifstream fin(range_csv_path.c_str());
-  CHECK(fin.is_open()) << "Could not open file: " << range_csv_path << std::endl;
-
-  // Skip the first line, containing the header.
-  std::string line;
-  std::getline(fin, line);
-
-  double min_range = std::numeric_limits<double>::max();
-  double max_range = std::numeric_limits<double>::min();
-  timestamp_t prev_timestamp = 0;
-
-  // Read/store imu measurements, line by line.
-  while (std::getline(fin, line)) {
-    std::stringstream iss(line);
-
-    std::string ns, r, tx, ty, tz;
-    std::getline(iss, ns, ',');
-    std::getline(iss, r, ',');
-    std::getline(iss, tx, ',');
-    std::getline(iss, ty, ',');
-    std::getline(iss, tz, ',');
-
-    const timestamp_t timestamp = std::stoll(ns);
-    const double range = std::stod(r);
-    const Vector3d t(std::stod(tx), std::stod(ty), std::stod(tz));
-
-    CHECK_GT(timestamp, prev_timestamp) << "EuRoC range data is not in chronological order!";
-
-    min_range = std::min(min_range, range);
-    max_range = std::max(max_range, range);
-
-    range_data.emplace_back(RangeMeasurement(timestamp, range, t));
-    prev_timestamp = timestamp;
-  }
+  // Skip the first line, containing the header. Lines are "ns,range,tx,ty,tz".
+  std::vector<RangeMeasurement> range_data = ParseCsvFile<RangeMeasurement>(range_csv_path, 1,
+      [](const char* begin, const char* end, std::vector<RangeMeasurement>& out)
+  {
+    timestamp_t timestamp = 0;
+    double v[4];
+    if (!ParseCsvLine(begin, end, timestamp, v, 4)) {
+      return false;
+    }
+    out.emplace_back(RangeMeasurement(timestamp, v[0], Vector3d(v[1], v[2], v[3])));
+    return true;
+  });
 
-  fin.close();
+  CHECK(TimestampsInOrder(range_data, true))
+      << "EuRoC range data is not in chronological order: " << range_csv_path << std::endl;
   return range_data;
 }
 
@@ -296,15 +240,13 @@ void EurocDataset::ParseRange(const std::vector<std::string>& range_csv_paths)
     range_data.insert(range_data.end(), data.begin(), data.end());
   }
 
-  // Now sort by timestamp so that they're in order.
-  std::sort(range_data.begin(), range_data.end(),
-      [](const RangeMeasurement& a, const RangeMeasurement& b) { return (a.timestamp <= b.timestamp); });
+  // Now sort by timestamp so that they're in order. Measurements at the same time stay in the order
+  // of range_csv_paths.
+  std::stable_sort(range_data.begin(), range_data.end(),
+      [](const RangeMeasurement& a, const RangeMeasurement& b) { return a.timestamp < b.timestamp; });
 
-  LOG(INFO) << "Read in " << range_data.size() << " RANGE measurements.\n"
-            << "  earliest=" << range_data.front().timestamp
-            << "  latest=" << range_data.back().timestamp << "\n";
+  LOG(INFO) << "Read in " << range_data.size() << " RANGE measurements" << std::endl;
 }
 
-
 }
 }
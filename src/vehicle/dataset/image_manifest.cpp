@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <sys/stat.h>
+
+#include <glog/logging.h>
+
+#include "core/file_utils.hpp"
+#include "dataset/image_manifest.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+
+// Modification time of a directory (with nanoseconds, since a manifest written in the same second
+// as a change would otherwise look up to date). Returns false if it can't be read.
+static bool DirectoryMtime(const std::string& dir, int64_t& sec, int64_t& nsec)
+{
+  struct stat st;
+  if (::stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    return false;
+  }
+  sec = static_cast<int64_t>(st.st_mtim.tv_sec);
+  nsec = static_cast<int64_t>(st.st_mtim.tv_nsec);
+  return true;
+}
+
+
+static bool WriteManifest(const std::string& dir,
+                          const std::vector<std::string>& filenames,
+                          int64_t mtime_sec,
+                          int64_t mtime_nsec)
+{
+  const std::string path = ImageManifestPath(dir);
+  const std::string tmp_path = path + ".tmp";
+
+  ImageManifestHeader header = {};
+  std::memcpy(header.magic, kImageManifestMagic, sizeof(kImageManifestMagic));
+  header.version = kImageManifestVersion;
+  header.num_files = static_cast<uint32_t>(filenames.size());
+  header.dir_mtime_sec = mtime_sec;
+  header.dir_mtime_nsec = mtime_nsec;
+
+  {
+    std::ofstream out(tmp_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(ImageManifestHeader));
+
+    for (const std::string& filename : filenames) {
+      const size_t slash = filename.find_last_of('/');
+      const std::string name = (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+      CHECK_EQ(Join(dir, name), filename) << filename << " isn't in " << dir << std::endl;
+      const uint32_t length = static_cast<uint32_t>(name.size());
+      out.write(reinterpret_cast<const char*>(&length), sizeof(uint32_t));
+      out.write(name.data(), length);
+    }
+
+    if (!out.good()) {
+      out.close();
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+
+  // NOTE(milo): Rename so that a reader never sees a half-written manifest.
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+
+std::string ImageManifestPath(const std::string& dir)
+{
+  std::string trimmed = dir;
+  while (trimmed.size() > 1 && trimmed.back() == '/') {
+    trimmed.pop_back();
+  }
+  return trimmed + ".manifest";
+}
+
+
+bool ReadImageManifest(const std::string& dir, std::vector<std::string>& out)
+{
+  std::ifstream in(ImageManifestPath(dir), std::ios_base::in | std::ios_base::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+
+  ImageManifestHeader header;
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(ImageManifestHeader)) ||
+      std::memcmp(header.magic, kImageManifestMagic, sizeof(kImageManifestMagic)) != 0 ||
+      header.version != kImageManifestVersion) {
+    return false;
+  }
+
+  int64_t mtime_sec, mtime_nsec;
+  if (!DirectoryMtime(dir, mtime_sec, mtime_nsec) ||
+      mtime_sec != header.dir_mtime_sec ||
+      mtime_nsec != header.dir_mtime_nsec) {
+    return false;
+  }
+
+  // Read everything before appending, so that a truncated manifest leaves out alone.
+  std::vector<std::string> filenames(header.num_files);
+  std::string name;
+  for (std::string& filename : filenames) {
+    uint32_t length = 0;
+    if (!in.read(reinterpret_cast<char*>(&length), sizeof(uint32_t))) {
+      return false;
+    }
+    name.resize(length);
+    if (!in.read(&name[0], length)) {
+      return false;
+    }
+    filename = Join(dir, name);
+  }
+
+  out.insert(out.end(), filenames.begin(), filenames.end());
+  return true;
+}
+
+
+bool WriteImageManifest(const std::string& dir, const std::vector<std::string>& filenames)
+{
+  int64_t mtime_sec, mtime_nsec;
+  if (!DirectoryMtime(dir, mtime_sec, mtime_nsec)) {
+    return false;
+  }
+  return WriteManifest(dir, filenames, mtime_sec, mtime_nsec);
+}
+
+
+int CachedFilenamesInDirectory(const std::string& dir, std::vector<std::string>& out)
+{
+  const size_t num_before = out.size();
+  if (ReadImageManifest(dir, out)) {
+    LOG(INFO) << "Using image manifest for " << dir << std::endl;
+    return static_cast<int>(out.size() - num_before);
+  }
+
+  // NOTE(milo): Get the time before listing, so that a change made during the listing makes the
+  // manifest out of date (rather than being missed by it).
+  int64_t mtime_sec = 0, mtime_nsec = 0;
+  const bool has_mtime = DirectoryMtime(dir, mtime_sec, mtime_nsec);
+
+  std::vector<std::string> filenames;
+  FilenamesInDirectory(dir, filenames, true);
+
+  if (!has_mtime || !WriteManifest(dir, filenames, mtime_sec, mtime_nsec)) {
+    LOG(WARNING) << "Could not write image manifest " << ImageManifestPath(dir) << std::endl;
+  }
+
+  out.insert(out.end(), filenames.begin(), filenames.end());
+  return static_cast<int>(filenames.size());
+}
+
+
+}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bm {
+namespace dataset {
+
+
+// A cached listing of the images in a directory, so that datasets made of image folders (CADDY,
+// HIMB, ACFR) don't have to list and sort tens of thousands of files every time they're loaded
+// (which is slow on network storage and SD cards).
+//
+// The manifest is written next to the directory (<dir>.manifest), not inside it, since writing it
+// would change the directory's modification time. It stores that time, and is only used while it
+// still matches: adding, removing or renaming an image updates the directory, so the listing is
+// redone (and the manifest rewritten) the next time it's loaded.
+//
+// Layout:
+//   ImageManifestHeader
+//   For each file (sorted): uint32_t length, then the filename (relative to the directory)
+//
+// NOTE(milo): Numbers are stored in host byte order, like the PackedLog.
+static const char kImageManifestMagic[8] = { 'B', 'M', 'I', 'M', 'G', 'M', 'F', '\0' };
+static const uint32_t kImageManifestVersion = 1;
+
+
+struct ImageManifestHeader final
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t num_files;
+  int64_t dir_mtime_sec;    // Modification time of the directory when it was listed.
+  int64_t dir_mtime_nsec;
+};
+
+
+// Where the manifest for a directory goes.
+std::string ImageManifestPath(const std::string& dir);
+
+
+// Reads the sorted filenames (full paths, like FilenamesInDirectory) from the directory's manifest.
+// Returns false if there isn't one, or it's out of date or can't be read.
+bool ReadImageManifest(const std::string& dir, std::vector<std::string>& out);
+
+
+// Writes a manifest of the files in a directory. The filenames must be full paths in the directory,
+// as returned by FilenamesInDirectory. Returns false if it can't be written (e.g read-only storage).
+bool WriteImageManifest(const std::string& dir, const std::vector<std::string>& filenames);
+
+
+// Drop-in for FilenamesInDirectory(dir, out, true) that uses the directory's manifest if it's up to
+// date, and otherwise lists the directory and (tries to) write one. Appends to out like
+// FilenamesInDirectory, and returns the number of files found in dir.
+int CachedFilenamesInDirectory(const std::string& dir, std::vector<std::string>& out);
+
+
+}
+}
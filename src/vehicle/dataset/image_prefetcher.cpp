@@ -0,0 +1,128 @@
+#include <glog/logging.h>
+
+#include "dataset/image_prefetcher.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+ImagePrefetcher::ImagePrefetcher(const StereoReadFunction& read,
+                                 size_t start_idx,
+                                 size_t end_idx,
+                                 int num_threads,
+                                 size_t max_items,
+                                 size_t max_bytes)
+    : read_(read),
+      end_idx_(end_idx),
+      max_items_(max_items),
+      max_bytes_(max_bytes),
+      slots_(max_items),
+      next_load_idx_(start_idx),
+      next_get_idx_(start_idx)
+{
+  CHECK_GT(num_threads, 0);
+  CHECK_GT(max_items, 0ul);
+
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&ImagePrefetcher::Worker, this);
+  }
+}
+
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_load_.notify_all();
+
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+
+bool ImagePrefetcher::CanLoad() const
+{
+  if (next_load_idx_ >= end_idx_ || (next_load_idx_ - next_get_idx_) >= max_items_) {
+    return false;
+  }
+
+  // Always load the image that the consumer needs next, even if it goes over the budget.
+  return next_load_idx_ == next_get_idx_ || buffered_bytes_ < max_bytes_;
+}
+
+
+void ImagePrefetcher::Worker()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    cv_load_.wait(lock, [this]() { return stop_ || CanLoad(); });
+    if (stop_) {
+      return;
+    }
+
+    const size_t idx = next_load_idx_++;
+
+    // Decode without holding the lock, so that other workers can too.
+    lock.unlock();
+
+    cv::Mat left, right;
+    std::string error;
+    try {
+      read_(idx, left, right);
+    } catch (const std::exception& e) {
+      error = e.what();
+    }
+
+    lock.lock();
+
+    Slot& slot = slots_.at(idx % max_items_);
+    slot.left = std::move(left);
+    slot.right = std::move(right);
+    slot.error = std::move(error);
+    slot.bytes = slot.left.total() * slot.left.elemSize() + slot.right.total() * slot.right.elemSize();
+    slot.ready = true;
+    buffered_bytes_ += slot.bytes;
+
+    cv_ready_.notify_all();
+  }
+}
+
+
+void ImagePrefetcher::Get(size_t idx, cv::Mat& left, cv::Mat& right)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK_EQ(next_get_idx_, idx) << "ImagePrefetcher images must be retrieved in order" << std::endl;
+
+  Slot& slot = slots_.at(idx % max_items_);
+  cv_ready_.wait(lock, [&slot]() { return slot.ready; });
+
+  left = std::move(slot.left);
+  right = std::move(slot.right);
+  const std::string error = std::move(slot.error);
+
+  buffered_bytes_ -= slot.bytes;
+  slot = Slot();
+  ++next_get_idx_;
+
+  lock.unlock();
+  cv_load_.notify_all();
+
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+}
+
+
+size_t ImagePrefetcher::BufferedBytes()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return buffered_bytes_;
+}
+
+
+}
+}
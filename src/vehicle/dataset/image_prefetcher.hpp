@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+#include "dataset/data_provider.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// Reads stereo images (with a StereoReadFunction) on a pool of worker threads, ahead of when
+// they're needed. Images have to be retrieved in order, from start_idx up to end_idx. Workers stay
+// at most max_items ahead of the consumer, and stop reading ahead once roughly max_bytes of decoded
+// images are buffered (the image that the consumer is waiting on is always loaded).
+class ImagePrefetcher final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ImagePrefetcher);
+
+  // NOTE(milo): The read function is called from the worker threads, so it has to be thread-safe.
+  ImagePrefetcher(const StereoReadFunction& read,
+                  size_t start_idx,
+                  size_t end_idx,
+                  int num_threads,
+                  size_t max_items,
+                  size_t max_bytes);
+
+  ~ImagePrefetcher();
+
+  // Blocks until the images for item idx are decoded, and moves them into left and right. The
+  // idx must be the next one in order. Throws std::runtime_error if the images couldn't be read.
+  void Get(size_t idx, cv::Mat& left, cv::Mat& right);
+
+  // Number of decoded images that are buffered (for debugging).
+  size_t BufferedBytes();
+
+ private:
+  struct Slot final
+  {
+    bool ready = false;
+    cv::Mat left;
+    cv::Mat right;
+    std::string error;
+    size_t bytes = 0;
+  };
+
+  void Worker();
+
+  // Is a worker allowed to start decoding next_load_idx_ (call while holding mutex_)?
+  bool CanLoad() const;
+
+ private:
+  const StereoReadFunction read_;
+  const size_t end_idx_;
+  const size_t max_items_;
+  const size_t max_bytes_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_load_;     // Notified when a worker may be able to load.
+  std::condition_variable cv_ready_;    // Notified when an image finishes decoding.
+
+  std::vector<Slot> slots_;             // Ring buffer, item idx is in slots_[idx % max_items].
+  size_t next_load_idx_;
+  size_t next_get_idx_;
+  size_t buffered_bytes_ = 0;
+  bool stop_ = false;
+
+  std::vector<std::thread> workers_;
+};
+
+
+}
+}
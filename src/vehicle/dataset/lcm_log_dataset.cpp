@@ -0,0 +1,448 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <sys/stat.h>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <glog/logging.h>
+
+#include "core/file_utils.hpp"
+#include "core/task_scheduler.hpp"
+#include "dataset/lcm_log_dataset.hpp"
+#include "lcm_util/decode_image.hpp"
+#include "lcm_util/util_depth_measurement_t.hpp"
+#include "lcm_util/util_imu_measurement_t.hpp"
+#include "lcm_util/util_range_measurement_t.hpp"
+
+#include "vehicle/depth_measurement_t.hpp"
+#include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/range_measurement_t.hpp"
+#include "vehicle/stereo_image_t.hpp"
+
+namespace bm {
+namespace dataset {
+
+namespace ipc = boost::interprocess;
+
+// LCM event logs are a sequence of events, each with this (big-endian) header:
+//   uint32 magic, int64 event number, int64 utime, int32 channel length, int32 data length
+// followed by the channel name (not null-terminated), then the message data.
+static const uint32_t kLcmEventMagic = 0xEDA1DA01;
+static const size_t kLcmEventHeaderBytes = 28;
+
+static const char kIndexMagic[8] = { 'B', 'M', 'L', 'C', 'M', 'I', 'D', 'X' };
+static const uint32_t kIndexVersion = 1;
+
+// Every message type here starts with a header_t, right after its 8 byte hash.
+static const size_t kHeaderTimestampOffset = 8;
+
+
+static uint32_t ReadBigEndian32(const uint8_t* p)
+{
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+
+static uint64_t ReadBigEndian64(const uint8_t* p)
+{
+  return (static_cast<uint64_t>(ReadBigEndian32(p)) << 32) | ReadBigEndian32(p + 4);
+}
+
+
+// Keeps the log mapped for as long as any copy of the dataset (or a prefetcher) needs it.
+struct LcmLogMapping final
+{
+  explicit LcmLogMapping(const std::string& path)
+      : file(path.c_str(), ipc::read_only),
+        region(file, ipc::read_only) {}
+
+  const uint8_t* Data() const { return static_cast<const uint8_t*>(region.get_address()); }
+  size_t Size() const { return region.get_size(); }
+
+  ipc::file_mapping file;
+  ipc::mapped_region region;
+};
+
+
+// Identifies a version of the log, so that a stale index isn't used.
+struct LogVersion final
+{
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+};
+
+
+static LogVersion GetLogVersion(const std::string& log_path)
+{
+  struct stat st;
+  CHECK_EQ(0, stat(log_path.c_str(), &st)) << "Could not stat LCM log: " << log_path << std::endl;
+
+  LogVersion version;
+  version.size = static_cast<uint64_t>(st.st_size);
+  version.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000ll + st.st_mtim.tv_nsec;
+  return version;
+}
+
+
+static LcmLogIndex ScanLcmLog(const LcmLogMapping& mapping, const std::string& log_path)
+{
+  LcmLogIndex index;
+  const uint8_t* data = mapping.Data();
+  const size_t size = mapping.Size();
+
+  size_t pos = 0;
+  size_t skipped_bytes = 0;
+  size_t num_events = 0;
+
+  while (pos + kLcmEventHeaderBytes <= size) {
+    // Resync on the next magic if the log is corrupted here.
+    if (ReadBigEndian32(data + pos) != kLcmEventMagic) {
+      ++pos;
+      ++skipped_bytes;
+      continue;
+    }
+
+    const int64_t utime = static_cast<int64_t>(ReadBigEndian64(data + pos + 12));
+    const int32_t channel_len = static_cast<int32_t>(ReadBigEndian32(data + pos + 20));
+    const int32_t data_len = static_cast<int32_t>(ReadBigEndian32(data + pos + 24));
+
+    if (channel_len <= 0 || data_len < 0) {
+      ++pos;
+      ++skipped_bytes;
+      continue;
+    }
+
+    const size_t channel_pos = pos + kLcmEventHeaderBytes;
+    const size_t data_pos = channel_pos + static_cast<size_t>(channel_len);
+    if (data_pos + static_cast<size_t>(data_len) > size) {
+      LOG(WARNING) << "LCM log ends with a partial event, ignoring the last "
+                   << (size - pos) << " bytes: " << log_path << std::endl;
+      break;
+    }
+
+    LcmLogEvent event;
+    event.offset = data_pos;
+    event.size = static_cast<uint32_t>(data_len);
+    event.utime = utime;
+    index[std::string(reinterpret_cast<const char*>(data + channel_pos), channel_len)].emplace_back(event);
+
+    pos = data_pos + static_cast<size_t>(data_len);
+    ++num_events;
+  }
+
+  LOG_IF(WARNING, skipped_bytes > 0) << "Skipped " << skipped_bytes << " corrupted bytes in " << log_path << std::endl;
+  LOG(INFO) << "Indexed " << num_events << " events on " << index.size() << " channels" << std::endl;
+
+  return index;
+}
+
+
+static bool ReadIndexCache(const std::string& index_path, const LogVersion& version, LcmLogIndex& index)
+{
+  std::ifstream is(index_path, std::ios::in | std::ios::binary);
+  if (!is.is_open()) {
+    return false;
+  }
+
+  char magic[8];
+  uint32_t file_version = 0;
+  LogVersion log_version;
+  uint64_t num_channels = 0;
+  is.read(magic, sizeof(magic));
+  is.read(reinterpret_cast<char*>(&file_version), sizeof(file_version));
+  is.read(reinterpret_cast<char*>(&log_version.size), sizeof(log_version.size));
+  is.read(reinterpret_cast<char*>(&log_version.mtime_ns), sizeof(log_version.mtime_ns));
+  is.read(reinterpret_cast<char*>(&num_channels), sizeof(num_channels));
+
+  if (!is.good() || std::memcmp(magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+      file_version != kIndexVersion || log_version.size != version.size ||
+      log_version.mtime_ns != version.mtime_ns) {
+    return false;
+  }
+
+  index.clear();
+  for (uint64_t i = 0; i < num_channels; ++i) {
+    uint32_t name_len = 0;
+    uint64_t count = 0;
+    is.read(reinterpret_cast<char*>(&name_len), sizeof(name_len));
+    std::string name(name_len, '\0');
+    is.read(&name[0], name_len);
+    is.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!is.good() || count * sizeof(LcmLogEvent) > version.size) {
+      return false;
+    }
+
+    std::vector<LcmLogEvent>& events = index[name];
+    events.resize(count);
+    is.read(reinterpret_cast<char*>(events.data()), count * sizeof(LcmLogEvent));
+  }
+
+  return is.good();
+}
+
+
+// Writes to a temporary file first, so that a reader never sees half of an index.
+static void WriteIndexCache(const std::string& index_path, const LogVersion& version, const LcmLogIndex& index)
+{
+  const std::string tmp_path = index_path + ".tmp";
+  {
+    std::ofstream os(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!os.is_open()) {
+      LOG(WARNING) << "Could not write LCM log index (will re-index next time): " << index_path << std::endl;
+      return;
+    }
+
+    const uint64_t num_channels = index.size();
+    os.write(kIndexMagic, sizeof(kIndexMagic));
+    os.write(reinterpret_cast<const char*>(&kIndexVersion), sizeof(kIndexVersion));
+    os.write(reinterpret_cast<const char*>(&version.size), sizeof(version.size));
+    os.write(reinterpret_cast<const char*>(&version.mtime_ns), sizeof(version.mtime_ns));
+    os.write(reinterpret_cast<const char*>(&num_channels), sizeof(num_channels));
+
+    for (const auto& it : index) {
+      const uint32_t name_len = static_cast<uint32_t>(it.first.size());
+      const uint64_t count = it.second.size();
+      os.write(reinterpret_cast<const char*>(&name_len), sizeof(name_len));
+      os.write(it.first.data(), name_len);
+      os.write(reinterpret_cast<const char*>(&count), sizeof(count));
+      os.write(reinterpret_cast<const char*>(it.second.data()), count * sizeof(LcmLogEvent));
+    }
+
+    if (!os.good()) {
+      LOG(WARNING) << "Failed writing LCM log index: " << index_path << std::endl;
+      std::remove(tmp_path.c_str());
+      return;
+    }
+  }
+
+  if (std::rename(tmp_path.c_str(), index_path.c_str()) != 0) {
+    LOG(WARNING) << "Could not write LCM log index (will re-index next time): " << index_path << std::endl;
+    std::remove(tmp_path.c_str());
+  }
+}
+
+
+static LcmLogIndex IndexLcmLog(const LcmLogMapping& mapping, const std::string& log_path, bool use_cache)
+{
+  const std::string index_path = log_path + ".idx";
+  const LogVersion version = GetLogVersion(log_path);
+
+  LcmLogIndex index;
+  if (use_cache && ReadIndexCache(index_path, version, index)) {
+    LOG(INFO) << "Using cached index: " << index_path << std::endl;
+    return index;
+  }
+
+  index = ScanLcmLog(mapping, log_path);
+  if (use_cache) {
+    WriteIndexCache(index_path, version, index);
+  }
+
+  return index;
+}
+
+
+LcmLogIndex IndexLcmLog(const std::string& log_path, bool use_cache)
+{
+  CHECK(Exists(log_path)) << "LCM log does not exist: " << log_path << std::endl;
+  const LcmLogMapping mapping(log_path);
+  return IndexLcmLog(mapping, log_path, use_cache);
+}
+
+
+// Decodes every event on a channel (in parallel, keeping their order) with decode(msg), which
+// returns an Item. Events that don't decode as a Msg (e.g a different message type on the same
+// channel) are dropped.
+template <typename Msg, typename Item, typename DecodeFunction>
+static std::vector<Item> DecodeChannel(const LcmLogMapping& mapping,
+                                       const LcmLogIndex& index,
+                                       const std::string& channel,
+                                       const DecodeFunction& decode)
+{
+  std::vector<Item> items;
+  if (channel.empty()) {
+    return items;
+  }
+
+  const auto it = index.find(channel);
+  if (it == index.end()) {
+    LOG(WARNING) << "[MISSING DATA] No events on channel " << channel << std::endl;
+    return items;
+  }
+
+  const std::vector<LcmLogEvent>& events = it->second;
+  TaskScheduler& scheduler = TaskScheduler::Instance();
+  const size_t num_chunks = std::min(events.size(), static_cast<size_t>(4 * std::max(1, scheduler.NumThreads())));
+  std::vector<std::vector<Item>> chunks(num_chunks);
+
+  scheduler.ParallelFor(TaskPriority::VIZ, (int)num_chunks, [&](int c) {
+    const size_t begin = events.size() * c / num_chunks;
+    const size_t end = events.size() * (c + 1) / num_chunks;
+    std::vector<Item>& out = chunks.at(c);
+    out.reserve(end - begin);
+
+    Msg msg;
+    for (size_t i = begin; i < end; ++i) {
+      const LcmLogEvent& event = events.at(i);
+      if (msg.decode(mapping.Data() + event.offset, 0, static_cast<int>(event.size)) >= 0) {
+        out.emplace_back(decode(msg));
+      }
+    }
+  });
+
+  items.reserve(events.size());
+  for (const std::vector<Item>& chunk : chunks) {
+    items.insert(items.end(), chunk.begin(), chunk.end());
+  }
+
+  LOG_IF(WARNING, items.size() < events.size())
+      << "Dropped " << (events.size() - items.size()) << " of " << events.size()
+      << " messages on " << channel << " that didn't decode" << std::endl;
+
+  return items;
+}
+
+
+// Sorts by header timestamp, and drops repeated timestamps (e.g a republished message), since
+// playback needs IMU and depth to be strictly increasing.
+template <typename Item>
+static void SortByTimestamp(std::vector<Item>& items, bool drop_repeated, const std::string& channel)
+{
+  std::stable_sort(items.begin(), items.end(),
+      [](const Item& a, const Item& b) { return a.timestamp < b.timestamp; });
+
+  if (drop_repeated) {
+    const size_t n = items.size();
+    items.erase(std::unique(items.begin(), items.end(),
+        [](const Item& a, const Item& b) { return a.timestamp == b.timestamp; }), items.end());
+    LOG_IF(WARNING, items.size() < n) << "Dropped " << (n - items.size())
+        << " messages with repeated timestamps on " << channel << std::endl;
+  }
+}
+
+
+static cv::Mat DecodeLcmImage(const vehicle::image_t& im)
+{
+  if (im.encoding == "jpg") {
+    cv::Mat out;
+    DecodeJPG(im, out);
+    return out;
+  }
+
+  if (im.encoding == "raw") {
+    const int type = (im.channels == 3) ? CV_8UC3 : CV_8UC1;
+    const size_t bytes = static_cast<size_t>(im.height) * im.width * im.channels;
+    if (im.channels != 1 && im.channels != 3) {
+      throw std::runtime_error("ERROR: Unsupported number of image channels in LCM log");
+    }
+    if (bytes > im.data.size()) {
+      throw std::runtime_error("ERROR: Raw image in LCM log is truncated");
+    }
+    return cv::Mat(im.height, im.width, type, const_cast<uint8_t*>(im.data.data())).clone();
+  }
+
+  throw std::runtime_error("ERROR: Unsupported image encoding in LCM log: " + im.encoding);
+}
+
+
+LcmLogDataset::LcmLogDataset(const std::string& log_path,
+                             const LcmLogChannels& channels,
+                             int prefetch_threads) : DataProvider()
+{
+  CHECK(Exists(log_path)) << "LCM log does not exist: " << log_path << std::endl;
+
+  const auto mapping = std::make_shared<const LcmLogMapping>(log_path);
+  const LcmLogIndex index = IndexLcmLog(*mapping, log_path, true);
+
+  imu_data = DecodeChannel<vehicle::imu_measurement_t, ImuMeasurement>(*mapping, index, channels.imu,
+      [](const vehicle::imu_measurement_t& msg)
+  {
+    ImuMeasurement out;
+    decode_imu_measurement_t(msg, out);
+    return out;
+  });
+
+  depth_data = DecodeChannel<vehicle::depth_measurement_t, DepthMeasurement>(*mapping, index, channels.depth,
+      [](const vehicle::depth_measurement_t& msg)
+  {
+    DepthMeasurement out(0, 0.0);
+    decode_depth_measurement_t(msg, out);
+    return out;
+  });
+
+  range_data = DecodeChannel<vehicle::range_measurement_t, RangeMeasurement>(*mapping, index, channels.range,
+      [](const vehicle::range_measurement_t& msg)
+  {
+    RangeMeasurement out(0, 0.0, Vector3d::Zero());
+    decode_range_measurement_t(msg, out);
+    return out;
+  });
+
+  SortByTimestamp(imu_data, true, channels.imu);
+  SortByTimestamp(depth_data, true, channels.depth);
+  SortByTimestamp(range_data, false, channels.range);
+
+  // Stereo messages are only indexed here. The header timestamp is read straight out of the
+  // message, so the images aren't touched until playback.
+  const auto stereo_events = std::make_shared<std::vector<LcmLogEvent>>();
+  const auto it = channels.stereo.empty() ? index.end() : index.find(channels.stereo);
+  if (it != index.end()) {
+    const uint64_t hash = static_cast<uint64_t>(vehicle::stereo_image_t::getHash());
+    std::vector<std::pair<timestamp_t, LcmLogEvent>> stamped;
+    stamped.reserve(it->second.size());
+    for (const LcmLogEvent& event : it->second) {
+      const uint8_t* msg = mapping->Data() + event.offset;
+      if (event.size < kHeaderTimestampOffset + sizeof(int64_t) || ReadBigEndian64(msg) != hash) {
+        continue;
+      }
+      stamped.emplace_back(static_cast<timestamp_t>(ReadBigEndian64(msg + kHeaderTimestampOffset)), event);
+    }
+
+    LOG_IF(WARNING, stamped.size() < it->second.size())
+        << "Dropped " << (it->second.size() - stamped.size()) << " non-stereo_image_t messages on "
+        << channels.stereo << std::endl;
+
+    std::stable_sort(stamped.begin(), stamped.end(),
+        [](const std::pair<timestamp_t, LcmLogEvent>& a, const std::pair<timestamp_t, LcmLogEvent>& b)
+        { return a.first < b.first; });
+
+    stereo_data.reserve(stamped.size());
+    stereo_events->reserve(stamped.size());
+    for (const auto& item : stamped) {
+      stereo_data.emplace_back(item.first, log_path, log_path);
+      stereo_events->emplace_back(item.second);
+    }
+  } else if (!channels.stereo.empty()) {
+    LOG(WARNING) << "[MISSING DATA] No events on channel " << channels.stereo << std::endl;
+  }
+
+  // Images are decoded from the mapping, which is read-only, so this is thread-safe.
+  // NOTE(milo): Decoding the message copies the (compressed) image data out of the mapping.
+  read_stereo_ = [mapping, stereo_events](size_t idx, cv::Mat& left, cv::Mat& right)
+  {
+    const LcmLogEvent& event = stereo_events->at(idx);
+    vehicle::stereo_image_t msg;
+    if (msg.decode(mapping->Data() + event.offset, 0, static_cast<int>(event.size)) < 0) {
+      throw std::runtime_error("ERROR: Could not decode stereo_image_t from LCM log");
+    }
+    left = DecodeLcmImage(msg.img_left);
+    right = DecodeLcmImage(msg.img_right);
+  };
+
+  SetImagePrefetch(prefetch_threads);
+
+  LOG(INFO) << "Opened LCM log: " << log_path << "\n"
+            << "  imu=" << imu_data.size() << " depth=" << depth_data.size()
+            << " range=" << range_data.size() << " stereo=" << stereo_data.size() << std::endl;
+
+  SanityCheck();
+}
+
+
+}
+}
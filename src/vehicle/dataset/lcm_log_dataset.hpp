@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dataset/data_provider.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// Which channel each type of message is read from (the defaults match StateEstimatorLcm.yaml).
+// Leave a channel empty to skip that stream.
+struct LcmLogChannels final
+{
+  std::string stereo = "sim/auv/stereo";  // stereo_image_t
+  std::string imu = "sim/auv/imu";        // imu_measurement_t
+  std::string depth = "sim/auv/depth";    // depth_measurement_t
+  std::string range = "sim/auv/range";    // range_measurement_t
+};
+
+
+// Where an event's message is in an LCM log, and when it was logged.
+struct LcmLogEvent final
+{
+  uint64_t offset = 0;    // Of the message data, from the start of the log.
+  uint32_t size = 0;
+  uint32_t padding = 0;
+  int64_t utime = 0;      // Logger receive time (usec).
+};
+
+typedef std::map<std::string, std::vector<LcmLogEvent>> LcmLogIndex;
+
+
+// Indexes every event in an LCM log by channel. The index is cached next to the log, in
+// "<log_path>.idx", and used instead of scanning the log again as long as the log's size and
+// modification time haven't changed. If the log was cut off (e.g the logger was killed), the index
+// stops at the last complete event.
+LcmLogIndex IndexLcmLog(const std::string& log_path, bool use_cache = true);
+
+
+// Plays back an LCM event log (as written by lcm-logger), without converting it to a dataset
+// folder first. The log is memory-mapped, and only the messages on the channels in "channels" are
+// read. IMU, depth and range messages are small, so they're decoded when the log is opened. Stereo
+// images are decoded straight from the mapping when they're played back, on prefetch_threads
+// threads ahead of playback (see DataProvider::SetImagePrefetch).
+// NOTE(milo): Messages are timestamped by their header, not by when they were logged.
+class LcmLogDataset : public DataProvider {
+ public:
+  LcmLogDataset(const std::string& log_path,
+                const LcmLogChannels& channels = LcmLogChannels(),
+                int prefetch_threads = 2);
+};
+
+
+}
+}
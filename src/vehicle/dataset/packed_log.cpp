@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include <glog/logging.h>
+#include <opencv2/highgui.hpp>
+
+#include "dataset/data_provider.hpp"
+#include "dataset/packed_log.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+PackedLogWriter::PackedLogWriter(const std::string& path,
+                                 PackedImageEncoding encoding,
+                                 int jpeg_quality)
+    : out_(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc),
+      encoding_(encoding),
+      jpeg_quality_(jpeg_quality)
+{
+  CHECK(out_.is_open()) << "Could not open file: " << path << std::endl;
+
+  // Leave space for the header, which is written when the log is closed.
+  const PackedLogHeader empty = {};
+  out_.write(reinterpret_cast<const char*>(&empty), sizeof(PackedLogHeader));
+  offset_ = sizeof(PackedLogHeader);
+}
+
+
+PackedLogWriter::~PackedLogWriter()
+{
+  if (!closed_) {
+    Close();
+  }
+}
+
+
+void PackedLogWriter::WriteImu(const ImuMeasurement& data)
+{
+  PackedImu r;
+  r.timestamp = data.timestamp;
+  std::copy(data.w.data(), data.w.data() + 3, r.w);
+  std::copy(data.a.data(), data.a.data() + 3, r.a);
+  imu_.emplace_back(r);
+}
+
+
+void PackedLogWriter::WriteDepth(const DepthMeasurement& data)
+{
+  PackedDepth r;
+  r.timestamp = data.timestamp;
+  r.depth = data.depth;
+  depth_.emplace_back(r);
+}
+
+
+void PackedLogWriter::WriteRange(const RangeMeasurement& data)
+{
+  PackedRange r;
+  r.timestamp = data.timestamp;
+  r.range = data.range;
+  std::copy(data.point.data(), data.point.data() + 3, r.point);
+  range_.emplace_back(r);
+}
+
+
+void PackedLogWriter::WriteGroundtruth(timestamp_t timestamp, const Matrix4d& world_T_body)
+{
+  const Quaterniond q(world_T_body.block<3, 3>(0, 0));
+
+  PackedPose r;
+  r.timestamp = timestamp;
+  r.q[0] = q.w();
+  r.q[1] = q.x();
+  r.q[2] = q.y();
+  r.q[3] = q.z();
+  r.t[0] = world_T_body(0, 3);
+  r.t[1] = world_T_body(1, 3);
+  r.t[2] = world_T_body(2, 3);
+  poses_.emplace_back(r);
+}
+
+
+void PackedLogWriter::WriteStereo(timestamp_t timestamp, const cv::Mat& left, const cv::Mat& right)
+{
+  PackedStereo r;
+  r.timestamp = timestamp;
+  r.left = WriteImage(left);
+  r.right = WriteImage(right);
+  stereo_.emplace_back(r);
+}
+
+
+void PackedLogWriter::WriteStereoFiles(timestamp_t timestamp,
+                                       const std::string& path_left,
+                                       const std::string& path_right,
+                                       PackedImageEncoding encoding)
+{
+  CHECK_NE(encoding, PackedImageEncoding::RAW) << "Image files must be encoded" << std::endl;
+
+  PackedStereo r;
+  r.timestamp = timestamp;
+
+  for (int i = 0; i < 2; ++i) {
+    const std::string& path = (i == 0) ? path_left : path_right;
+    std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+    CHECK(in.is_open()) << "Could not open file: " << path << std::endl;
+
+    file_buf_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    const PackedImage image = WritePayload(file_buf_.data(), file_buf_.size(), encoding);
+
+    if (i == 0) {
+      r.left = image;
+    } else {
+      r.right = image;
+    }
+  }
+
+  stereo_.emplace_back(r);
+}
+
+
+uint64_t PackedLogWriter::WritePayloadBlock(const char* data, size_t size)
+{
+  return WritePayload(data, size, PackedImageEncoding::RAW).offset;
+}
+
+
+void PackedLogWriter::WriteStereoRecord(const PackedStereo& record)
+{
+  CHECK_LE(record.left.offset + record.left.size, offset_) << "Stereo record points past the end of the log" << std::endl;
+  CHECK_LE(record.right.offset + record.right.size, offset_) << "Stereo record points past the end of the log" << std::endl;
+  stereo_.emplace_back(record);
+}
+
+
+PackedImage PackedLogWriter::WriteImage(const cv::Mat& image)
+{
+  if (encoding_ == PackedImageEncoding::RAW) {
+    const cv::Mat continuous = image.isContinuous() ? image : image.clone();
+    PackedImage r = WritePayload(reinterpret_cast<const char*>(continuous.data),
+                                 continuous.total() * continuous.elemSize(),
+                                 PackedImageEncoding::RAW);
+    r.rows = image.rows;
+    r.cols = image.cols;
+    r.type = image.type();
+    return r;
+  }
+
+  if (encoding_ == PackedImageEncoding::JPEG) {
+    cv::imencode(".jpg", image, encode_buf_, { cv::IMWRITE_JPEG_QUALITY, jpeg_quality_ });
+  } else {
+    cv::imencode(".png", image, encode_buf_);
+  }
+
+  return WritePayload(reinterpret_cast<const char*>(encode_buf_.data()), encode_buf_.size(), encoding_);
+}
+
+
+PackedImage PackedLogWriter::WritePayload(const char* data, size_t size, PackedImageEncoding encoding)
+{
+  CHECK(!closed_) << "Can't write to a PackedLogWriter after Close()" << std::endl;
+
+  PackedImage r;
+  r.offset = offset_;
+  r.size = size;
+  r.rows = 0;
+  r.cols = 0;
+  r.type = 0;
+  r.encoding = encoding;
+
+  out_.write(data, size);
+  offset_ += size;
+
+  return r;
+}
+
+
+void PackedLogWriter::Pad()
+{
+  static const char zeros[8] = { 0 };
+  const size_t padding = (8 - (offset_ % 8)) % 8;
+  out_.write(zeros, padding);
+  offset_ += padding;
+}
+
+
+template <typename Record>
+PackedLogTable PackedLogWriter::WriteTable(std::vector<Record>& records)
+{
+  std::stable_sort(records.begin(), records.end(),
+      [](const Record& a, const Record& b) { return a.timestamp < b.timestamp; });
+
+  Pad();
+
+  PackedLogTable table;
+  table.offset = offset_;
+  table.count = records.size();
+  table.record_size = sizeof(Record);
+
+  out_.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+  offset_ += records.size() * sizeof(Record);
+
+  return table;
+}
+
+
+void PackedLogWriter::Close()
+{
+  CHECK(!closed_) << "PackedLogWriter was already closed" << std::endl;
+
+  PackedLogHeader header = {};
+  std::memcpy(header.magic, kPackedLogMagic, sizeof(kPackedLogMagic));
+  header.version = kPackedLogVersion;
+  header.num_streams = PACKED_NUM_STREAMS;
+  header.tables[PACKED_IMU] = WriteTable(imu_);
+  header.tables[PACKED_DEPTH] = WriteTable(depth_);
+  header.tables[PACKED_RANGE] = WriteTable(range_);
+  header.tables[PACKED_GROUNDTRUTH] = WriteTable(poses_);
+  header.tables[PACKED_STEREO] = WriteTable(stereo_);
+
+  out_.seekp(0);
+  out_.write(reinterpret_cast<const char*>(&header), sizeof(PackedLogHeader));
+  out_.close();
+  CHECK(!out_.fail()) << "Failed to write packed log" << std::endl;
+
+  closed_ = true;
+}
+
+
+static bool HasExtension(const std::string& path, const std::string& ext)
+{
+  return path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+
+void ConvertToPackedLog(const DataProvider& dataset,
+                        const std::string& log_path,
+                        PackedImageEncoding encoding)
+{
+  PackedLogWriter writer(log_path, encoding);
+
+  for (const ImuMeasurement& data : dataset.ImuMeasurements()) {
+    writer.WriteImu(data);
+  }
+  for (const DepthMeasurement& data : dataset.DepthMeasurements()) {
+    writer.WriteDepth(data);
+  }
+  for (const RangeMeasurement& data : dataset.RangeMeasurements()) {
+    writer.WriteRange(data);
+  }
+  for (const GroundtruthItem& item : dataset.GroundtruthPoses()) {
+    writer.WriteGroundtruth(item.timestamp, item.world_T_body);
+  }
+
+  const std::vector<StereoDatasetItem>& stereo_items = dataset.StereoItems();
+  for (size_t i = 0; i < stereo_items.size(); ++i) {
+    const StereoDatasetItem& item = stereo_items.at(i);
+
+    if (encoding == PackedImageEncoding::PNG &&
+        HasExtension(item.path_left, ".png") &&
+        HasExtension(item.path_right, ".png")) {
+      writer.WriteStereoFiles(item.timestamp, item.path_left, item.path_right, encoding);
+    } else {
+      cv::Mat left, right;
+      ReadStereoImageFiles(item, left, right);
+      writer.WriteStereo(item.timestamp, left, right);
+    }
+
+    if (i % 1000 == 0) {
+      LOG(INFO) << "Converted " << i << "/" << stereo_items.size() << " stereo pairs" << std::endl;
+    }
+  }
+
+  writer.Close();
+  LOG(INFO) << "Wrote packed log: " << log_path << std::endl;
+}
+
+
+}
+}
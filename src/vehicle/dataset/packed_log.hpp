@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/imu_measurement.hpp"
+#include "core/depth_measurement.hpp"
+#include "core/range_measurement.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace dataset {
+
+class DataProvider;
+
+using namespace core;
+
+// A single-file dataset format that is read by memory-mapping it (see PackedLogDataset).
+//
+// Layout:
+//   PackedLogHeader
+//   Image payloads, appended in chunks as stereo pairs are written
+//   One table of fixed-size records per stream, sorted by timestamp (pointed to by the header)
+//
+// All records are plain structs with 8-byte alignment, so the tables can be used in place. The
+// header is written last, so a log that wasn't closed has no valid magic and won't be opened.
+//
+// NOTE(milo): Numbers are stored in host byte order (little endian on everything we run on).
+static const char kPackedLogMagic[8] = { 'B', 'M', 'P', 'K', 'L', 'O', 'G', '\0' };
+static const uint32_t kPackedLogVersion = 1;
+
+enum PackedLogStream : uint32_t
+{
+  PACKED_IMU = 0,
+  PACKED_DEPTH = 1,
+  PACKED_RANGE = 2,
+  PACKED_GROUNDTRUTH = 3,
+  PACKED_STEREO = 4,
+  PACKED_NUM_STREAMS = 5
+};
+
+// How images are stored in the log.
+enum PackedImageEncoding : uint32_t
+{
+  RAW = 0,    // Pixels, with rows, cols and type in the PackedImage.
+  PNG = 1,
+  JPEG = 2
+};
+
+
+struct PackedLogTable final
+{
+  uint64_t offset;        // Byte offset of the first record in the file.
+  uint64_t count;         // Number of records.
+  uint64_t record_size;   // sizeof() the record, checked when opening.
+};
+
+
+struct PackedLogHeader final
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t num_streams;
+  PackedLogTable tables[PACKED_NUM_STREAMS];
+};
+
+
+struct PackedImu final
+{
+  uint64_t timestamp;
+  double w[3];
+  double a[3];
+};
+
+
+struct PackedDepth final
+{
+  uint64_t timestamp;
+  double depth;
+};
+
+
+struct PackedRange final
+{
+  uint64_t timestamp;
+  double range;
+  double point[3];
+};
+
+
+struct PackedPose final
+{
+  uint64_t timestamp;
+  double q[4];            // Rotation world_R_body as a quaternion (w, x, y, z).
+  double t[3];            // Translation world_t_body.
+};
+
+
+struct PackedImage final
+{
+  uint64_t offset;        // Byte offset of the payload in the file.
+  uint64_t size;          // Payload size in bytes.
+  int32_t rows;           // The size and cv type are only needed for RAW images (0 otherwise).
+  int32_t cols;
+  int32_t type;
+  uint32_t encoding;
+};
+
+
+struct PackedStereo final
+{
+  uint64_t timestamp;
+  PackedImage left;
+  PackedImage right;
+};
+
+static_assert(std::is_pod<PackedLogHeader>::value && sizeof(PackedLogHeader) % 8 == 0, "PackedLogHeader");
+static_assert(std::is_pod<PackedImu>::value && sizeof(PackedImu) % 8 == 0, "PackedImu");
+static_assert(std::is_pod<PackedDepth>::value && sizeof(PackedDepth) % 8 == 0, "PackedDepth");
+static_assert(std::is_pod<PackedRange>::value && sizeof(PackedRange) % 8 == 0, "PackedRange");
+static_assert(std::is_pod<PackedPose>::value && sizeof(PackedPose) % 8 == 0, "PackedPose");
+static_assert(std::is_pod<PackedStereo>::value && sizeof(PackedStereo) % 8 == 0, "PackedStereo");
+
+
+// Writes a packed log. Measurements can be written in any order, and are sorted by timestamp
+// (per stream) when the log is closed.
+class PackedLogWriter final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(PackedLogWriter);
+
+  // Images that are given to WriteStereo() are stored with encoding. The jpeg_quality is [0, 100].
+  PackedLogWriter(const std::string& path,
+                  PackedImageEncoding encoding = PackedImageEncoding::PNG,
+                  int jpeg_quality = 95);
+
+  // Closes the log if Close() wasn't called.
+  ~PackedLogWriter();
+
+  void WriteImu(const ImuMeasurement& data);
+  void WriteDepth(const DepthMeasurement& data);
+  void WriteRange(const RangeMeasurement& data);
+  void WriteGroundtruth(timestamp_t timestamp, const Matrix4d& world_T_body);
+
+  void WriteStereo(timestamp_t timestamp, const cv::Mat& left, const cv::Mat& right);
+
+  // Copies already encoded image files (e.g the PNGs in a EuRoC folder) into the log, without
+  // decoding them. The encoding should match the files.
+  void WriteStereoFiles(timestamp_t timestamp,
+                        const std::string& path_left,
+                        const std::string& path_right,
+                        PackedImageEncoding encoding);
+
+  // Appends a block of image payloads that the caller laid out itself (see PackedLogRecorder), and
+  // returns the block's offset in the file. Its images are then added with WriteStereoRecord().
+  uint64_t WritePayloadBlock(const char* data, size_t size);
+
+  // Adds a stereo pair whose images are already in the file.
+  void WriteStereoRecord(const PackedStereo& record);
+
+  // Writes the tables and header. Nothing else can be written after this.
+  void Close();
+
+ private:
+  PackedImage WriteImage(const cv::Mat& image);
+  PackedImage WritePayload(const char* data, size_t size, PackedImageEncoding encoding);
+
+  template <typename Record>
+  PackedLogTable WriteTable(std::vector<Record>& records);
+
+  void Pad();
+
+ private:
+  std::ofstream out_;
+  uint64_t offset_ = 0;
+  bool closed_ = false;
+
+  PackedImageEncoding encoding_;
+  int jpeg_quality_;
+  std::vector<uint8_t> encode_buf_;
+  std::vector<char> file_buf_;
+
+  std::vector<PackedImu> imu_;
+  std::vector<PackedDepth> depth_;
+  std::vector<PackedRange> range_;
+  std::vector<PackedPose> poses_;
+  std::vector<PackedStereo> stereo_;
+};
+
+
+// Converts a dataset to a packed log. If the images are already PNG files (e.g a folder written by
+// EurocDataWriter) and encoding is PNG, the files are copied as-is instead of re-encoded.
+void ConvertToPackedLog(const DataProvider& dataset,
+                        const std::string& log_path,
+                        PackedImageEncoding encoding = PackedImageEncoding::PNG);
+
+
+}
+}
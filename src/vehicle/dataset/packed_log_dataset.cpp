@@ -0,0 +1,133 @@
+#include <cstring>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <glog/logging.h>
+#include <opencv2/highgui.hpp>
+
+#include "core/file_utils.hpp"
+#include "dataset/packed_log_dataset.hpp"
+
+namespace bm {
+namespace dataset {
+
+namespace ipc = boost::interprocess;
+
+
+// Keeps the file mapped for as long as any copy of the dataset (or a prefetcher) needs it.
+struct PackedLogMapping final
+{
+  explicit PackedLogMapping(const std::string& path)
+      : file(path.c_str(), ipc::read_only),
+        region(file, ipc::read_only) {}
+
+  const char* Data() const { return static_cast<const char*>(region.get_address()); }
+  size_t Size() const { return region.get_size(); }
+
+  ipc::file_mapping file;
+  ipc::mapped_region region;
+};
+
+
+template <typename Record>
+static const Record* GetTable(const PackedLogMapping& mapping,
+                              const PackedLogHeader& header,
+                              PackedLogStream stream,
+                              size_t& count)
+{
+  const PackedLogTable& table = header.tables[stream];
+  CHECK_EQ(sizeof(Record), table.record_size) << "Packed log record size mismatch" << std::endl;
+  CHECK_LE(table.offset + table.count * table.record_size, mapping.Size()) << "Packed log is truncated" << std::endl;
+  CHECK_EQ(0ul, table.offset % 8) << "Packed log table is not aligned" << std::endl;
+
+  count = table.count;
+  return reinterpret_cast<const Record*>(mapping.Data() + table.offset);
+}
+
+
+static cv::Mat DecodePackedImage(const PackedLogMapping& mapping, const PackedImage& image)
+{
+  if (image.offset + image.size > mapping.Size()) {
+    throw std::runtime_error("ERROR: Packed log image is out of bounds");
+  }
+
+  // NOTE(milo): The mapping is read-only, so RAW images are copied out.
+  char* data = const_cast<char*>(mapping.Data() + image.offset);
+  if (image.encoding == PackedImageEncoding::RAW) {
+    return cv::Mat(image.rows, image.cols, image.type, data).clone();
+  }
+
+  const cv::Mat buf(1, static_cast<int>(image.size), CV_8UC1, data);
+  return cv::imdecode(buf, cv::IMREAD_ANYCOLOR);
+}
+
+
+PackedLogDataset::PackedLogDataset(const std::string& log_path) : DataProvider()
+{
+  CHECK(Exists(log_path)) << "Packed log does not exist: " << log_path << std::endl;
+
+  const auto mapping = std::make_shared<const PackedLogMapping>(log_path);
+  CHECK_GE(mapping->Size(), sizeof(PackedLogHeader)) << "Packed log is truncated" << std::endl;
+
+  PackedLogHeader header;
+  std::memcpy(&header, mapping->Data(), sizeof(PackedLogHeader));
+  CHECK(std::memcmp(header.magic, kPackedLogMagic, sizeof(kPackedLogMagic)) == 0)
+      << "Not a packed log (or it wasn't closed): " << log_path << std::endl;
+  CHECK_EQ(kPackedLogVersion, header.version) << "Unsupported packed log version" << std::endl;
+  CHECK_EQ(static_cast<uint32_t>(PACKED_NUM_STREAMS), header.num_streams);
+
+  size_t count = 0;
+
+  const PackedImu* imu = GetTable<PackedImu>(*mapping, header, PACKED_IMU, count);
+  imu_data.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    imu_data.emplace_back(imu[i].timestamp, Vector3d(imu[i].w), Vector3d(imu[i].a));
+  }
+
+  const PackedDepth* depth = GetTable<PackedDepth>(*mapping, header, PACKED_DEPTH, count);
+  depth_data.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    depth_data.emplace_back(depth[i].timestamp, depth[i].depth);
+  }
+
+  const PackedRange* range = GetTable<PackedRange>(*mapping, header, PACKED_RANGE, count);
+  range_data.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    range_data.emplace_back(range[i].timestamp, range[i].range, Vector3d(range[i].point));
+  }
+
+  const PackedPose* poses = GetTable<PackedPose>(*mapping, header, PACKED_GROUNDTRUTH, count);
+  pose_data.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    const Quaterniond q(poses[i].q[0], poses[i].q[1], poses[i].q[2], poses[i].q[3]);
+    Matrix4d world_T_body = Matrix4d::Identity();
+    world_T_body.block<3, 3>(0, 0) = q.normalized().toRotationMatrix();
+    world_T_body.block<3, 1>(0, 3) = Vector3d(poses[i].t);
+    pose_data.emplace_back(poses[i].timestamp, world_T_body);
+  }
+
+  const PackedStereo* stereo = GetTable<PackedStereo>(*mapping, header, PACKED_STEREO, count);
+  stereo_data.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    stereo_data.emplace_back(stereo[i].timestamp, log_path, log_path);
+  }
+
+  // Images are decoded from the mapping, which is read-only, so this is thread-safe.
+  read_stereo_ = [mapping, stereo](size_t idx, cv::Mat& left, cv::Mat& right)
+  {
+    left = DecodePackedImage(*mapping, stereo[idx].left);
+    right = DecodePackedImage(*mapping, stereo[idx].right);
+  };
+
+  LOG(INFO) << "Opened packed log: " << log_path << "\n"
+            << "  imu=" << imu_data.size() << " depth=" << depth_data.size()
+            << " range=" << range_data.size() << " poses=" << pose_data.size()
+            << " stereo=" << stereo_data.size() << std::endl;
+
+  SanityCheck();
+}
+
+
+}
+}
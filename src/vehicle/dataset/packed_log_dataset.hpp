@@ -0,0 +1,21 @@
+#pragma once
+
+#include <memory>
+
+#include "dataset/data_provider.hpp"
+#include "dataset/packed_log.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// Plays back a packed log (see packed_log.hpp). The file is memory-mapped, so opening it only
+// copies the measurement tables out, and images are decoded straight from the mapping.
+class PackedLogDataset : public DataProvider {
+ public:
+  PackedLogDataset(const std::string& log_path);
+};
+
+
+}
+}
@@ -0,0 +1,320 @@
+#include <cstring>
+
+#include <glog/logging.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "core/task_scheduler.hpp"
+#include "dataset/packed_log_recorder.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// Wait this long for a full chunk before checking for shutdown.
+static const double kWriterWaitSec = 0.1;
+
+
+void PackedLogRecorder::Chunk::Reset()
+{
+  used = 0;
+  images.clear();
+  stereo_timestamps.clear();
+  imu.clear();
+  depth.clear();
+  range.clear();
+  started = std::chrono::steady_clock::now();
+}
+
+
+PackedLogRecorder::PackedLogRecorder(const std::string& path, const PackedLogRecorderOptions& options)
+    : options_(options),
+      writer_(path),
+      free_chunks_(0, false, "packed_log_free_chunks"),
+      full_chunks_(0, false, "packed_log_full_chunks")
+{
+  CHECK_GE(options_.num_chunks, 2) << "Need at least 2 chunks, one to fill while the other is written" << std::endl;
+  CHECK_GT(options_.chunk_bytes, 0ul);
+
+  // NOTE(milo): All of the memory is allocated (and touched) here, so that recording doesn't page
+  // fault its way through fresh buffers during a dive.
+  for (int i = 0; i < options_.num_chunks; ++i) {
+    ChunkPtr chunk(new Chunk());
+    chunk->data.resize(options_.chunk_bytes);
+    chunk->Reset();
+    if (i == 0) {
+      current_ = std::move(chunk);
+    } else {
+      free_chunks_.Push(std::move(chunk));
+    }
+  }
+  out_buf_.reserve(options_.chunk_bytes);
+
+  writer_thread_ = std::thread(&PackedLogRecorder::WriterLoop, this);
+  LOG(INFO) << "Recording packed log: " << path << std::endl;
+}
+
+
+PackedLogRecorder::~PackedLogRecorder()
+{
+  if (!closed_) {
+    Close();
+  }
+}
+
+
+void PackedLogRecorder::RecordImu(const ImuMeasurement& data)
+{
+  MaybeHandOff();
+  current_->imu.emplace_back(data);
+}
+
+
+void PackedLogRecorder::RecordDepth(const DepthMeasurement& data)
+{
+  MaybeHandOff();
+  current_->depth.emplace_back(data);
+}
+
+
+void PackedLogRecorder::RecordRange(const RangeMeasurement& data)
+{
+  MaybeHandOff();
+  current_->range.emplace_back(data);
+}
+
+
+bool PackedLogRecorder::RecordStereo(timestamp_t timestamp, const cv::Mat& left, const cv::Mat& right)
+{
+  CHECK(!closed_) << "Can't record to a PackedLogRecorder after Close()" << std::endl;
+  MaybeHandOff();
+
+  const size_t left_size = left.total() * left.elemSize();
+  const size_t right_size = right.total() * right.elemSize();
+  if (!MakeRoom(left_size + right_size)) {
+    ++num_stereo_dropped_;
+    return false;
+  }
+
+  Chunk& chunk = *current_;
+  const cv::Mat* images[2] = { &left, &right };
+
+  for (int i = 0; i < 2; ++i) {
+    const cv::Mat& im = *images[i];
+
+    ChunkImage r;
+    r.offset = chunk.used;
+    r.size = im.total() * im.elemSize();
+    r.rows = im.rows;
+    r.cols = im.cols;
+    r.type = im.type();
+    r.encoding = PackedImageEncoding::RAW;
+
+    // Copies row by row if the image isn't continuous (e.g a ROI).
+    cv::Mat dst(im.rows, im.cols, im.type(), chunk.data.data() + chunk.used);
+    im.copyTo(dst);
+
+    chunk.used += r.size;
+    chunk.images.emplace_back(r);
+  }
+
+  chunk.stereo_timestamps.emplace_back(timestamp);
+  ++num_stereo_recorded_;
+  return true;
+}
+
+
+bool PackedLogRecorder::RecordStereoEncoded(timestamp_t timestamp,
+                                            const uint8_t* left, size_t left_size,
+                                            const uint8_t* right, size_t right_size,
+                                            PackedImageEncoding encoding)
+{
+  CHECK(!closed_) << "Can't record to a PackedLogRecorder after Close()" << std::endl;
+  CHECK_NE(encoding, PackedImageEncoding::RAW) << "Use RecordStereo() for raw images" << std::endl;
+  MaybeHandOff();
+
+  if (!MakeRoom(left_size + right_size)) {
+    ++num_stereo_dropped_;
+    return false;
+  }
+
+  Chunk& chunk = *current_;
+  const uint8_t* data[2] = { left, right };
+  const size_t sizes[2] = { left_size, right_size };
+
+  for (int i = 0; i < 2; ++i) {
+    ChunkImage r;
+    r.offset = chunk.used;
+    r.size = sizes[i];
+    r.encoding = encoding;
+
+    std::memcpy(chunk.data.data() + chunk.used, data[i], sizes[i]);
+    chunk.used += sizes[i];
+    chunk.images.emplace_back(r);
+  }
+
+  chunk.stereo_timestamps.emplace_back(timestamp);
+  ++num_stereo_recorded_;
+  return true;
+}
+
+
+bool PackedLogRecorder::MakeRoom(size_t size)
+{
+  if (current_->used + size <= options_.chunk_bytes) {
+    return true;
+  }
+
+  if (size > options_.chunk_bytes) {
+    LOG_IF(WARNING, num_stereo_dropped_ == 0) << "Stereo pair (" << size << " bytes) is bigger than a "
+        << "chunk, increase chunk_bytes" << std::endl;
+    return false;
+  }
+
+  HandOff();
+
+  if (current_->used != 0) {
+    LOG_IF(WARNING, num_stereo_dropped_ == 0) << "PackedLogRecorder is waiting for the disk, dropping "
+        << "stereo pairs" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+void PackedLogRecorder::MaybeHandOff()
+{
+  const double age_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - current_->started).count();
+  if (age_sec > options_.max_chunk_sec) {
+    HandOff();
+  }
+}
+
+
+void PackedLogRecorder::HandOff()
+{
+  ChunkPtr next;
+  if (!free_chunks_.PopIfNonEmpty(next)) {
+    return;
+  }
+
+  next->Reset();
+  full_chunks_.Push(std::move(current_));
+  current_ = std::move(next);
+}
+
+
+void PackedLogRecorder::WriterLoop()
+{
+  ChunkPtr chunk;
+  while (!is_shutdown_.load() || full_chunks_.Size() > 0) {
+    if (full_chunks_.PopBlocking(chunk, kWriterWaitSec)) {
+      WriteChunk(*chunk);
+      free_chunks_.Push(std::move(chunk));
+    }
+  }
+}
+
+
+void PackedLogRecorder::WriteChunk(Chunk& chunk)
+{
+  const size_t num_images = chunk.images.size();
+
+  // Compress the raw images in parallel (they're independent), each into its own buffer.
+  bool compress = false;
+  for (const ChunkImage& im : chunk.images) {
+    compress |= (options_.png_raw_images && im.encoding == PackedImageEncoding::RAW);
+  }
+
+  if (compress) {
+    png_bufs_.resize(num_images);
+    const std::vector<int> png_params = { cv::IMWRITE_PNG_COMPRESSION, options_.png_compression };
+
+    core::TaskScheduler::Instance().ParallelFor(core::TaskPriority::VIZ, static_cast<int>(num_images), [&](int i) {
+      const ChunkImage& im = chunk.images.at(i);
+      png_bufs_.at(i).clear();
+      if (im.encoding == PackedImageEncoding::RAW) {
+        const cv::Mat wrapped(im.rows, im.cols, im.type, chunk.data.data() + im.offset);
+        cv::imencode(".png", wrapped, png_bufs_.at(i), png_params);
+      }
+    });
+
+    // Lay the chunk out again with the PNGs in place of the raw images.
+    out_buf_.clear();
+    for (size_t i = 0; i < num_images; ++i) {
+      ChunkImage& im = chunk.images.at(i);
+      const size_t offset = out_buf_.size();
+      if (!png_bufs_.at(i).empty()) {
+        const char* png = reinterpret_cast<const char*>(png_bufs_.at(i).data());
+        out_buf_.insert(out_buf_.end(), png, png + png_bufs_.at(i).size());
+        im.size = png_bufs_.at(i).size();
+        im.rows = 0;
+        im.cols = 0;
+        im.type = 0;
+        im.encoding = PackedImageEncoding::PNG;
+      } else {
+        const char* data = chunk.data.data() + im.offset;
+        out_buf_.insert(out_buf_.end(), data, data + im.size);
+      }
+      im.offset = offset;
+    }
+  }
+
+  const char* block = compress ? out_buf_.data() : chunk.data.data();
+  const size_t block_size = compress ? out_buf_.size() : chunk.used;
+  const uint64_t base = writer_.WritePayloadBlock(block, block_size);
+  bytes_written_ += block_size;
+
+  for (size_t k = 0; k < chunk.stereo_timestamps.size(); ++k) {
+    PackedStereo r;
+    r.timestamp = chunk.stereo_timestamps.at(k);
+
+    for (int i = 0; i < 2; ++i) {
+      const ChunkImage& im = chunk.images.at(2*k + i);
+      PackedImage& out = (i == 0) ? r.left : r.right;
+      out.offset = base + im.offset;
+      out.size = im.size;
+      out.rows = im.rows;
+      out.cols = im.cols;
+      out.type = im.type;
+      out.encoding = im.encoding;
+    }
+
+    writer_.WriteStereoRecord(r);
+  }
+
+  for (const ImuMeasurement& data : chunk.imu) {
+    writer_.WriteImu(data);
+  }
+  for (const DepthMeasurement& data : chunk.depth) {
+    writer_.WriteDepth(data);
+  }
+  for (const RangeMeasurement& data : chunk.range) {
+    writer_.WriteRange(data);
+  }
+}
+
+
+void PackedLogRecorder::Close()
+{
+  CHECK(!closed_) << "PackedLogRecorder was already closed" << std::endl;
+
+  // Whatever is left in the current chunk goes to the writer, even though there's no free chunk to
+  // replace it with.
+  full_chunks_.Push(std::move(current_));
+
+  is_shutdown_.store(true);
+  if (writer_thread_.joinable()) {
+    writer_thread_.join();
+  }
+
+  writer_.Close();
+  closed_ = true;
+
+  LOG(INFO) << "Closed packed log: recorded " << num_stereo_recorded_ << " stereo pairs, dropped "
+      << num_stereo_dropped_ << ", wrote " << (bytes_written_.load() >> 20) << " MB of images" << std::endl;
+}
+
+
+}
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "dataset/packed_log.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+struct PackedLogRecorderOptions final
+{
+  size_t chunk_bytes = 64ul << 20;  // Size of each preallocated chunk buffer.
+  int num_chunks = 4;               // Chunks that can be filled or waiting for the disk at once.
+  double max_chunk_sec = 2.0;       // Hand a chunk to the writer after this long, even if it isn't full.
+
+  // Compress raw images losslessly (PNG) on the writer thread. Images that arrive encoded (e.g JPGs
+  // from the camera driver) are always stored as they are.
+  bool png_raw_images = true;
+  int png_compression = 1;          // [0, 9], 1 is the fastest level that still compresses well.
+};
+
+
+// Records measurements and stereo images into a packed log (see packed_log.hpp, and PackedLogDataset
+// to play it back) while they're being received, e.g by the RecorderLcm node.
+//
+// Images are copied into the current chunk, one of num_chunks buffers that are allocated up front.
+// Full chunks (or ones older than max_chunk_sec) go to a writer thread, which compresses their raw
+// images and appends the whole chunk to the file, so the disk sees large sequential writes. If the
+// writer falls behind and every chunk is waiting for the disk, stereo pairs are dropped (and
+// counted) instead of blocking the caller. Measurements are small, and are never dropped.
+//
+// NOTE(milo): The Record*() functions must all be called from the same thread. The log only gets
+// its index when it's closed, so a recorder that is killed leaves a log that can't be opened.
+class PackedLogRecorder final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(PackedLogRecorder);
+
+  PackedLogRecorder(const std::string& path,
+                    const PackedLogRecorderOptions& options = PackedLogRecorderOptions());
+
+  // Closes the log if Close() wasn't called.
+  ~PackedLogRecorder();
+
+  void RecordImu(const ImuMeasurement& data);
+  void RecordDepth(const DepthMeasurement& data);
+  void RecordRange(const RangeMeasurement& data);
+
+  // Copies a pair of raw images (any step and type). Returns false if the pair was dropped.
+  bool RecordStereo(timestamp_t timestamp, const cv::Mat& left, const cv::Mat& right);
+
+  // Copies a pair of images that are already encoded (e.g the JPG bytes from a stereo_image_t). They
+  // are stored as-is. Returns false if the pair was dropped.
+  bool RecordStereoEncoded(timestamp_t timestamp,
+                           const uint8_t* left, size_t left_size,
+                           const uint8_t* right, size_t right_size,
+                           PackedImageEncoding encoding);
+
+  // Waits for the writer to finish every chunk, and writes the index. Nothing else can be recorded
+  // after this.
+  void Close();
+
+  size_t NumStereoRecorded() const { return num_stereo_recorded_; }
+  size_t NumStereoDropped() const { return num_stereo_dropped_; }
+  uint64_t BytesWritten() const { return bytes_written_.load(); }
+
+ private:
+  // An image in a chunk's buffer.
+  struct ChunkImage final
+  {
+    size_t offset = 0;
+    size_t size = 0;
+    int32_t rows = 0;
+    int32_t cols = 0;
+    int32_t type = 0;
+    PackedImageEncoding encoding = PackedImageEncoding::RAW;
+  };
+
+  struct Chunk final
+  {
+    std::vector<char> data;               // Allocated once, at chunk_bytes.
+    size_t used = 0;
+    std::vector<ChunkImage> images;       // Left and right for each stereo pair.
+    std::vector<timestamp_t> stereo_timestamps;
+    std::vector<ImuMeasurement> imu;
+    std::vector<DepthMeasurement> depth;
+    std::vector<RangeMeasurement> range;
+    std::chrono::steady_clock::time_point started;
+
+    void Reset();
+  };
+
+  typedef std::unique_ptr<Chunk> ChunkPtr;
+
+  // Makes sure that the current chunk has room for size bytes, handing it to the writer if it's full
+  // and taking a free one. Returns false if there's no free chunk to take.
+  bool MakeRoom(size_t size);
+
+  // Hands the current chunk to the writer if it's older than max_chunk_sec.
+  void MaybeHandOff();
+  void HandOff();
+
+  void WriterLoop();
+  void WriteChunk(Chunk& chunk);
+
+ private:
+  PackedLogRecorderOptions options_;
+  PackedLogWriter writer_;      // Only used by the writer thread (and Close, after it has stopped).
+  bool closed_ = false;
+
+  ChunkPtr current_;
+  ThreadsafeQueue<ChunkPtr> free_chunks_;
+  ThreadsafeQueue<ChunkPtr> full_chunks_;
+
+  std::atomic_bool is_shutdown_{false};
+  std::thread writer_thread_;
+
+  // Used by the writer thread to compress a chunk, and to lay it out for one write.
+  std::vector<std::vector<uint8_t>> png_bufs_;
+  std::vector<char> out_buf_;
+
+  size_t num_stereo_recorded_ = 0;
+  size_t num_stereo_dropped_ = 0;
+  std::atomic<uint64_t> bytes_written_{0};
+};
+
+
+}
+}
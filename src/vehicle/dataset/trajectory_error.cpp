@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <utility>
+
+#include "core/transform_util.hpp"
+#include "dataset/trajectory_error.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// Returns the index of the pose nearest to time t, or -1 if there isn't one within max_offset_ns.
+static int NearestPoseIndex(const std::vector<GroundtruthItem>& poses,
+                            timestamp_t t,
+                            timestamp_t max_offset_ns)
+{
+  const auto it = std::lower_bound(poses.begin(), poses.end(), t,
+      [](const GroundtruthItem& item, timestamp_t t) { return item.timestamp < t; });
+
+  int best = -1;
+  timestamp_t best_offset = max_offset_ns;
+
+  if (it != poses.end() && (it->timestamp - t) <= best_offset) {
+    best = static_cast<int>(it - poses.begin());
+    best_offset = it->timestamp - t;
+  }
+  if (it != poses.begin() && (t - std::prev(it)->timestamp) <= best_offset) {
+    best = static_cast<int>(std::prev(it) - poses.begin());
+  }
+
+  return best;
+}
+
+
+TrajectoryError ComputeTrajectoryError(const std::vector<GroundtruthItem>& groundtruth,
+                                       const std::vector<GroundtruthItem>& estimate,
+                                       double rpe_delta_sec,
+                                       double max_time_offset_sec,
+                                       bool align)
+{
+  TrajectoryError out;
+
+  // Pairs of (estimate index, groundtruth index).
+  std::vector<std::pair<int, int>> matches;
+  const timestamp_t max_offset_ns = ConvertToNanoseconds(max_time_offset_sec);
+  for (size_t i = 0; i < estimate.size(); ++i) {
+    const int j = NearestPoseIndex(groundtruth, estimate.at(i).timestamp, max_offset_ns);
+    if (j >= 0) {
+      matches.emplace_back(static_cast<int>(i), j);
+    }
+  }
+
+  const int N = static_cast<int>(matches.size());
+  out.num_poses = N;
+  if (N == 0) {
+    return out;
+  }
+
+  //================================ ABSOLUTE TRAJECTORY ERROR =====================================
+  Matrix4d world_T_estimate = Matrix4d::Identity();
+  if (align && N >= 3) {
+    Eigen::Matrix<double, 3, Eigen::Dynamic> src(3, N), dst(3, N);
+    for (int k = 0; k < N; ++k) {
+      src.col(k) = estimate.at(matches.at(k).first).world_T_body.block<3, 1>(0, 3);
+      dst.col(k) = groundtruth.at(matches.at(k).second).world_T_body.block<3, 1>(0, 3);
+    }
+    world_T_estimate = Eigen::umeyama(src, dst, false);
+  }
+
+  double ate_sum_sq = 0;
+  double ate_sum = 0;
+  for (int k = 0; k < N; ++k) {
+    const Vector3d t_est = (world_T_estimate * estimate.at(matches.at(k).first).world_T_body).block<3, 1>(0, 3);
+    const Vector3d t_gt = groundtruth.at(matches.at(k).second).world_T_body.block<3, 1>(0, 3);
+    const double err = (t_est - t_gt).norm();
+    ate_sum_sq += err * err;
+    ate_sum += err;
+    out.ate_max = std::max(out.ate_max, err);
+  }
+  out.ate_rmse = std::sqrt(ate_sum_sq / static_cast<double>(N));
+  out.ate_mean = ate_sum / static_cast<double>(N);
+
+  //==================================== RELATIVE POSE ERROR =======================================
+  // NOTE(milo): RPE doesn't depend on the alignment, so use the unaligned estimate.
+  const timestamp_t rpe_delta_ns = ConvertToNanoseconds(rpe_delta_sec);
+  double rpe_trans_sum_sq = 0;
+  double rpe_rot_sum_sq = 0;
+
+  int k2 = 0;
+  for (int k1 = 0; k1 < N; ++k1) {
+    const timestamp_t t1 = estimate.at(matches.at(k1).first).timestamp;
+    k2 = std::max(k2, k1 + 1);
+    while (k2 < N && (estimate.at(matches.at(k2).first).timestamp - t1) < rpe_delta_ns) {
+      ++k2;
+    }
+    if (k2 >= N) {
+      break;
+    }
+
+    const Matrix4d gt_1_T_2 =
+        inverse_se3(groundtruth.at(matches.at(k1).second).world_T_body) *
+        groundtruth.at(matches.at(k2).second).world_T_body;
+    const Matrix4d est_1_T_2 =
+        inverse_se3(estimate.at(matches.at(k1).first).world_T_body) *
+        estimate.at(matches.at(k2).first).world_T_body;
+    const Matrix4d error = inverse_se3(gt_1_T_2) * est_1_T_2;
+
+    const double trans_err = error.block<3, 1>(0, 3).norm();
+    const double rot_err = Eigen::AngleAxisd(Matrix3d(error.block<3, 3>(0, 0))).angle();
+    rpe_trans_sum_sq += trans_err * trans_err;
+    rpe_rot_sum_sq += rot_err * rot_err;
+    ++out.num_rpe_pairs;
+  }
+
+  if (out.num_rpe_pairs > 0) {
+    out.rpe_trans_rmse = std::sqrt(rpe_trans_sum_sq / static_cast<double>(out.num_rpe_pairs));
+    out.rpe_rot_rmse = std::sqrt(rpe_rot_sum_sq / static_cast<double>(out.num_rpe_pairs));
+  }
+
+  return out;
+}
+
+
+}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+#include "dataset/data_provider.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// Accuracy of an estimated trajectory against groundtruth. Translation errors are in meters, and
+// rotation errors are in radians.
+struct TrajectoryError final
+{
+  int num_poses = 0;            // Estimated poses that were matched with a groundtruth pose.
+  double ate_rmse = 0;          // Absolute trajectory error (position only).
+  double ate_mean = 0;
+  double ate_max = 0;
+
+  int num_rpe_pairs = 0;        // Pairs of poses that are rpe_delta_sec apart.
+  double rpe_trans_rmse = 0;    // Relative pose error over rpe_delta_sec.
+  double rpe_rot_rmse = 0;
+};
+
+
+// Matches each estimated pose with the nearest groundtruth pose (within max_time_offset_sec), then
+// computes the absolute trajectory error (ATE) and relative pose error (RPE). If align is true, the
+// estimate is rigidly aligned to the groundtruth (no scale) before computing ATE.
+// NOTE(milo): Both trajectories must be sorted by timestamp.
+TrajectoryError ComputeTrajectoryError(const std::vector<GroundtruthItem>& groundtruth,
+                                       const std::vector<GroundtruthItem>& estimate,
+                                       double rpe_delta_sec = 1.0,
+                                       double max_time_offset_sec = 0.05,
+                                       bool align = true);
+
+
+}
+}
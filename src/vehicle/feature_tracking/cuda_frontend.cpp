@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "feature_tracking/cuda_frontend.hpp"
+#include "core/profiler.hpp"
+
+#ifdef BM_USE_CUDA_FRONTEND
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/cudaoptflow.hpp>
+
+#include "vision_core/gpu_memory_pool.hpp"
+#endif
+
+namespace bm {
+namespace ft {
+
+#ifdef BM_USE_CUDA_FRONTEND
+
+namespace cu = cv::cuda;
+
+// Device buffers are charged to these modules in the GpuMemoryPool.
+static const char* kGpuBudgetKlt = "CudaKlt";
+static const char* kGpuBudgetGftt = "CudaGftt";
+
+
+// Grow a 1xN buffer so that it can hold at least N elements. Returns the first N columns.
+static cu::GpuMat DeviceBuffer(cu::GpuMat& buf, int N, int type)
+{
+  if (buf.empty() || buf.cols < N || buf.type() != type) {
+    buf.create(1, std::max(N, 2 * buf.cols), type);
+  }
+  return buf.colRange(0, N);
+}
+
+
+static cv::Mat PinnedBuffer(cu::HostMem& buf, int N, int type)
+{
+  if (buf.empty() || buf.cols < N || buf.type() != type) {
+    buf.create(1, std::max(N, 2 * buf.cols), type);
+  }
+  return buf.createMatHeader().colRange(0, N);
+}
+
+
+struct CudaKlt::Impl final
+{
+  cv::Ptr<cu::SparsePyrLKOpticalFlow> klt;
+  cu::Stream stream;
+
+  cu::GpuMat d_ref_img, d_cur_img;
+  cu::GpuMat d_px_ref, d_px_cur, d_px_bkw, d_status, d_error;
+  cu::HostMem h_px_ref, h_px_cur, h_px_bkw, h_status, h_error;
+};
+
+
+CudaKlt::CudaKlt(int winsize, int max_level, int maxiters)
+    : impl_(new Impl())
+{
+  CHECK_GT(cu::getCudaEnabledDeviceCount(), 0) << "No CUDA device found for CudaKlt" << std::endl;
+  ScopedGpuBudget budget(kGpuBudgetKlt);
+  impl_->klt = cu::SparsePyrLKOpticalFlow::create(cv::Size(winsize, winsize), max_level, maxiters, false);
+}
+
+
+CudaKlt::~CudaKlt() = default;
+
+
+void CudaKlt::Track(const cv::Mat& ref_img,
+                    const cv::Mat& cur_img,
+                    const VecPoint2f& px_ref,
+                    VecPoint2f& px_cur,
+                    std::vector<uchar>& status,
+                    std::vector<float>& error,
+                    VecPoint2f* px_ref_bkw)
+{
+  MACRO_PROFILE_SCOPE("CudaKlt::Track");
+  ScopedGpuBudget budget(kGpuBudgetKlt);
+  const int N = (int)px_ref.size();
+  CHECK_GT(N, 0);
+
+  lock_.lock();
+  Impl& m = *impl_;
+
+  // Stage the keypoints in page-locked memory so that the copies can be async.
+  cv::Mat h_px_ref = PinnedBuffer(m.h_px_ref, N, CV_32FC2);
+  std::memcpy(h_px_ref.data, px_ref.data(), N * sizeof(cv::Point2f));
+
+  cu::GpuMat d_px_ref = DeviceBuffer(m.d_px_ref, N, CV_32FC2);
+  cu::GpuMat d_px_cur = DeviceBuffer(m.d_px_cur, N, CV_32FC2);
+  cu::GpuMat d_status = DeviceBuffer(m.d_status, N, CV_8UC1);
+  cu::GpuMat d_error = DeviceBuffer(m.d_error, N, CV_32FC1);
+
+  m.d_ref_img.upload(ref_img, m.stream);
+  m.d_cur_img.upload(cur_img, m.stream);
+  d_px_ref.upload(h_px_ref, m.stream);
+
+  m.klt->calc(m.d_ref_img, m.d_cur_img, d_px_ref, d_px_cur, d_status, d_error, m.stream);
+
+  cv::Mat h_px_cur = PinnedBuffer(m.h_px_cur, N, CV_32FC2);
+  d_px_cur.download(h_px_cur, m.stream);
+
+  // NOTE(milo): Like the CPU version, the status (and error) from the backward pass are output.
+  cv::Mat h_px_bkw;
+  if (px_ref_bkw != nullptr) {
+    cu::GpuMat d_px_bkw = DeviceBuffer(m.d_px_bkw, N, CV_32FC2);
+    m.klt->calc(m.d_cur_img, m.d_ref_img, d_px_cur, d_px_bkw, d_status, d_error, m.stream);
+    h_px_bkw = PinnedBuffer(m.h_px_bkw, N, CV_32FC2);
+    d_px_bkw.download(h_px_bkw, m.stream);
+  }
+
+  cv::Mat h_status = PinnedBuffer(m.h_status, N, CV_8UC1);
+  cv::Mat h_error = PinnedBuffer(m.h_error, N, CV_32FC1);
+  d_status.download(h_status, m.stream);
+  d_error.download(h_error, m.stream);
+
+  m.stream.waitForCompletion();
+
+  const cv::Point2f* cur_ptr = h_px_cur.ptr<cv::Point2f>();
+  px_cur.assign(cur_ptr, cur_ptr + N);
+  status.assign(h_status.ptr<uchar>(), h_status.ptr<uchar>() + N);
+  error.assign(h_error.ptr<float>(), h_error.ptr<float>() + N);
+
+  if (px_ref_bkw != nullptr) {
+    const cv::Point2f* bkw_ptr = h_px_bkw.ptr<cv::Point2f>();
+    px_ref_bkw->assign(bkw_ptr, bkw_ptr + N);
+  }
+
+  lock_.unlock();
+}
+
+
+struct CudaGftt::Impl final
+{
+  cv::Ptr<cu::CornersDetector> detector;
+  cu::Stream stream;
+
+  cu::GpuMat d_img, d_mask, d_corners;
+  cu::HostMem h_corners;
+};
+
+
+CudaGftt::CudaGftt(int max_corners,
+                   double quality_level,
+                   double min_distance,
+                   int block_size,
+                   bool use_harris,
+                   double k)
+    : impl_(new Impl())
+{
+  CHECK_GT(cu::getCudaEnabledDeviceCount(), 0) << "No CUDA device found for CudaGftt" << std::endl;
+  ScopedGpuBudget budget(kGpuBudgetGftt);
+  impl_->detector = cu::createGoodFeaturesToTrackDetector(
+      CV_8UC1, max_corners, quality_level, min_distance, block_size, use_harris, k);
+}
+
+
+CudaGftt::~CudaGftt() = default;
+
+
+void CudaGftt::Detect(const Image1b& img, const cv::Mat& mask, VecPoint2f& corners)
+{
+  MACRO_PROFILE_SCOPE("CudaGftt::Detect");
+  ScopedGpuBudget budget(kGpuBudgetGftt);
+  corners.clear();
+
+  lock_.lock();
+  Impl& m = *impl_;
+
+  m.d_img.upload(img, m.stream);
+  m.d_mask.upload(mask, m.stream);
+  m.detector->detect(m.d_img, m.d_corners, m.d_mask, m.stream);
+  m.stream.waitForCompletion();
+
+  // The detector sizes its output to the number of corners found.
+  const int N = m.d_corners.empty() ? 0 : m.d_corners.cols;
+  if (N > 0) {
+    cv::Mat h_corners = PinnedBuffer(m.h_corners, N, CV_32FC2);
+    m.d_corners.download(h_corners, m.stream);
+    m.stream.waitForCompletion();
+    const cv::Point2f* ptr = h_corners.ptr<cv::Point2f>();
+    corners.assign(ptr, ptr + N);
+  }
+
+  lock_.unlock();
+}
+
+#else
+
+struct CudaKlt::Impl final {};
+struct CudaGftt::Impl final {};
+
+
+CudaKlt::CudaKlt(int, int, int)
+{
+  LOG(FATAL) << "CudaKlt is unavailable, build with BM_USE_CUDA_FRONTEND" << std::endl;
+}
+
+
+CudaKlt::~CudaKlt() = default;
+
+
+void CudaKlt::Track(const cv::Mat&, const cv::Mat&, const VecPoint2f&, VecPoint2f&,
+                    std::vector<uchar>&, std::vector<float>&, VecPoint2f*)
+{
+  LOG(FATAL) << "CudaKlt is unavailable, build with BM_USE_CUDA_FRONTEND" << std::endl;
+}
+
+
+CudaGftt::CudaGftt(int, double, double, int, bool, double)
+{
+  LOG(FATAL) << "CudaGftt is unavailable, build with BM_USE_CUDA_FRONTEND" << std::endl;
+}
+
+
+CudaGftt::~CudaGftt() = default;
+
+
+void CudaGftt::Detect(const Image1b&, const cv::Mat&, VecPoint2f&)
+{
+  LOG(FATAL) << "CudaGftt is unavailable, build with BM_USE_CUDA_FRONTEND" << std::endl;
+}
+
+#endif
+
+
+}
+}
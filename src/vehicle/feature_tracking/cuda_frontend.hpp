@@ -0,0 +1,72 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+
+// GPU versions of the KLT tracker and GFTT detector, using OpenCV's CUDA modules. Device buffers and
+// page-locked host buffers for the keypoints are kept between calls, and only grow.
+//
+// NOTE(milo): These are only implemented when built with BM_USE_CUDA_FRONTEND. Otherwise,
+// constructing one is a fatal error (see FeatureTracker and FeatureDetector for the fallback).
+class CudaKlt final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(CudaKlt);
+  CudaKlt() = delete;
+
+  CudaKlt(int winsize, int max_level, int maxiters);
+  ~CudaKlt();
+
+  // Track px_ref from ref_img into cur_img, with the same outputs as cv::calcOpticalFlowPyrLK. If
+  // px_ref_bkw is given, the points are also tracked back into ref_img, and status is set from
+  // the backward pass (like FeatureTracker does on the CPU).
+  // NOTE(milo): Calls are serialized, since they share device buffers.
+  void Track(const cv::Mat& ref_img,
+             const cv::Mat& cur_img,
+             const VecPoint2f& px_ref,
+             VecPoint2f& px_cur,
+             std::vector<uchar>& status,
+             std::vector<float>& error,
+             VecPoint2f* px_ref_bkw);
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+  std::mutex lock_;
+};
+
+
+class CudaGftt final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(CudaGftt);
+  CudaGftt() = delete;
+
+  CudaGftt(int max_corners,
+           double quality_level,
+           double min_distance,
+           int block_size,
+           bool use_harris,
+           double k);
+  ~CudaGftt();
+
+  // Detect corners (strongest first) where the mask is nonzero.
+  void Detect(const Image1b& img, const cv::Mat& mask, VecPoint2f& corners);
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+  std::mutex lock_;
+};
+
+
+}
+}
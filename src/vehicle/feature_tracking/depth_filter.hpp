@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cmath>
+
+namespace bm {
+namespace ft {
+
+
+// A 1D Kalman filter on a landmark's disparity. For a rectified stereo pair, disparity = fx * B / depth,
+// so this is an inverse depth filter (scaled to pixels). Inverse depth is what the stereo matcher
+// measures with roughly constant noise, unlike depth, whose noise grows with the square of depth.
+//
+// The landmark is assumed to stay at about the same inverse depth between frames: Predict() adds
+// process noise for the camera's motion, and Update() fuses a new stereo match. Once the variance is
+// small, the tracker can skip re-matching the landmark for a few frames and use Disp() instead.
+struct DepthFilter final
+{
+  float disp = 0;                 // Filtered disparity (px).
+  float var = 0;                  // Its variance (px^2).
+  int frames_since_update = 0;    // Calls to Predict() since the last Update() or Init().
+
+  void Init(float measured_disp, float meas_var)
+  {
+    disp = measured_disp;
+    var = meas_var;
+    frames_since_update = 0;
+  }
+
+  // Grow the variance for one frame of (unknown) camera motion.
+  void Predict(float process_var)
+  {
+    var += process_var;
+    ++frames_since_update;
+  }
+
+  // Fuse a stereo match. A measurement that's more than gate_sigma standard deviations away means
+  // the prediction was wrong (e.g fast motion toward the landmark), so the filter restarts from it.
+  // Returns whether the measurement was consistent with the filter.
+  bool Update(float measured_disp, float meas_var, float gate_sigma)
+  {
+    const float innovation = measured_disp - disp;
+    const float innovation_var = var + meas_var;
+    frames_since_update = 0;
+
+    if (innovation * innovation > gate_sigma * gate_sigma * innovation_var) {
+      Init(measured_disp, meas_var);
+      return false;
+    }
+
+    const float gain = var / innovation_var;
+    disp += gain * innovation;
+    var *= (1.0f - gain);
+    return true;
+  }
+
+  float Stdev() const { return std::sqrt(var); }
+};
+
+
+}
+}
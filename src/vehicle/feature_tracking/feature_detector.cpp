@@ -1,9 +1,12 @@
+#include <algorithm>
+#include <cmath>
 #include <numeric>
 
 #include <opencv2/imgproc.hpp>
 #include <glog/logging.h>
 
 #include "feature_tracking/feature_detector.hpp"
+#include "core/profiler.hpp"
 #include "anms/anms.h"
 
 namespace bm {
@@ -34,14 +37,26 @@ static VecPoint2f CvKeyPointToPoint(const std::vector<cv::KeyPoint>& input)
 void FeatureDetector::Params::LoadParams(const YamlParser& parser)
 {
   parser.GetParam("max_features_per_frame", &max_features_per_frame);
+  anms_algorithm = YamlToEnum<AnmsAlgorithm>(parser.GetNode("anms_algorithm"));
+  parser.GetParam("anms_candidates_per_feature", &anms_candidates_per_feature);
   parser.GetParam("min_distance_btw_tracked_and_detected_features", &min_distance_btw_tracked_and_detected_features);
   parser.GetParam("gftt_quality_level", &gftt_quality_level);
   parser.GetParam("gftt_block_size", &gftt_block_size);
   parser.GetParam("gftt_use_harris_corner_detector", &gftt_use_harris_corner_detector);
+  parser.GetParam("grid_rows", &grid_rows);
+  parser.GetParam("grid_cols", &grid_cols);
+  parser.GetParam("grid_num_threads", &grid_num_threads);
+  parser.GetParam("use_gpu", &use_gpu);
+
+  CHECK_GE(grid_rows, 0);
+  CHECK_GE(grid_cols, 0);
+  CHECK_GE(grid_num_threads, 0);
+  CHECK_GE(anms_candidates_per_feature, 1);
 }
 
 
-FeatureDetector::FeatureDetector(const Params& params) : params_(params)
+FeatureDetector::FeatureDetector(const Params& params)
+    : params_(params)
 {
   if (params_.algorithm == FeatureAlgorithm::GFTT) {
     feature_detector_ = cv::GFTTDetector::create(
@@ -54,35 +69,270 @@ FeatureDetector::FeatureDetector(const Params& params) : params_(params)
   } else {
     throw std::runtime_error("Unsupported feature detection algorithm!");
   }
+
+#ifdef BM_USE_CUDA_FRONTEND
+  if (params_.use_gpu) {
+    gpu_detector_.reset(new CudaGftt(
+      params_.max_features_per_frame,
+      params_.gftt_quality_level,
+      params_.min_distance_btw_tracked_and_detected_features,
+      params_.gftt_block_size,
+      params_.gftt_use_harris_corner_detector,
+      params_.gftt_k));
+  }
+#else
+  LOG_IF(WARNING, params_.use_gpu) << "FeatureDetector: built without BM_USE_CUDA_FRONTEND, detecting on the CPU" << std::endl;
+  params_.use_gpu = false;
+#endif
 }
 
 
-// Adapted from Kimera-VIO
-static std::vector<cv::KeyPoint> ANMSRangeTree(std::vector<cv::KeyPoint>& keypoints,
-                                              int num_to_keep,
-                                              float tolerance,
-                                              int cols,
-                                              int rows)
+FeatureDetector::~FeatureDetector() = default;
+
+
+void FeatureDetector::SetMaxFeaturesPerFrame(int max_features_per_frame)
 {
-  if ((int)keypoints.size() <= num_to_keep) {
-    return keypoints;
+  CHECK_GT(max_features_per_frame, 0);
+  params_.max_features_per_frame = max_features_per_frame;
+
+  const cv::Ptr<cv::GFTTDetector> gftt = feature_detector_.dynamicCast<cv::GFTTDetector>();
+  if (gftt) {
+    gftt->setMaxFeatures(max_features_per_frame);
   }
+}
 
-  // Sorting keypoints by deacreasing order of strength.
-  std::vector<int> responses;
-  for (size_t i = 0; i < keypoints.size(); i++) {
-    responses.emplace_back(keypoints[i].response);
+
+void SuppressSsc(const std::vector<cv::KeyPoint>& keypoints,
+                 const std::vector<int>& sorted_idx,
+                 int num_to_keep,
+                 float tolerance,
+                 int cols,
+                 int rows,
+                 std::vector<uint8_t>& covered,
+                 std::vector<int>& keep)
+{
+  keep.clear();
+  if (num_to_keep <= 0) {
+    return;
   }
-  std::vector<int> idx(responses.size());
-  std::iota(std::begin(idx), std::end(idx), 0);
-  cv::sortIdx(responses, idx, cv::SortFlags::SORT_DESCENDING);
-  std::vector<cv::KeyPoint> keypoints_sorted;
+  if ((int)sorted_idx.size() <= num_to_keep) {
+    keep = sorted_idx;
+    return;
+  }
+
+  const int k_min = std::max(1, (int)std::round(num_to_keep * (1.0f - tolerance)));
+  const int k_max = std::max(num_to_keep, (int)std::round(num_to_keep * (1.0f + tolerance)));
+  keep.reserve(k_max + 1);
+
+  // Keeps each keypoint whose cell isn't covered yet, and covers the (2r + 1) x (2r + 1) cells
+  // around it. Stops after k_max + 1, since that's already too many for this width.
+  auto cover = [&](int width) -> int {
+    const int c = std::max(1, width / 2);
+    const int r = width / c;
+    const int grid_cols = cols / c + 1;
+    const int grid_rows = rows / c + 1;
+    const size_t num_cells = static_cast<size_t>(grid_cols) * grid_rows;
+    if (covered.size() < num_cells) {
+      covered.resize(num_cells);
+    }
+    std::fill(covered.begin(), covered.begin() + num_cells, 0);
+
+    keep.clear();
+    for (const int i : sorted_idx) {
+      const cv::Point2f& pt = keypoints[i].pt;
+      const int gx = std::min(std::max(0, (int)pt.x / c), grid_cols - 1);
+      const int gy = std::min(std::max(0, (int)pt.y / c), grid_rows - 1);
+      if (covered[gy * grid_cols + gx]) {
+        continue;
+      }
 
-  for (unsigned int i = 0; i < keypoints.size(); i++) {
-    keypoints_sorted.push_back(keypoints[idx[i]]);
+      keep.emplace_back(i);
+      if ((int)keep.size() > k_max) {
+        break;
+      }
+
+      const int x0 = std::max(0, gx - r);
+      const int x1 = std::min(grid_cols - 1, gx + r);
+      for (int y = std::max(0, gy - r); y <= std::min(grid_rows - 1, gy + r); ++y) {
+        std::fill(covered.begin() + y * grid_cols + x0, covered.begin() + y * grid_cols + x1 + 1, 1);
+      }
+    }
+
+    return (int)keep.size();
+  };
+
+  // Wider coverings keep fewer keypoints. If no width is within tolerance, fall back to the widest
+  // one that kept too many (its strongest num_to_keep), or else the narrowest one tried.
+  int low = 1;
+  int high = std::max(cols, rows);
+  int widest_too_many = -1;
+  int narrowest_too_few = -1;
+
+  while (low <= high) {
+    const int width = low + (high - low) / 2;
+    const int n = cover(width);
+    if (n > k_max) {
+      widest_too_many = width;
+      low = width + 1;
+    } else if (n < k_min) {
+      narrowest_too_few = width;
+      high = width - 1;
+    } else {
+      break;
+    }
   }
 
-  return anms::RangeTree(keypoints_sorted, num_to_keep, tolerance, cols, rows);
+  const int n = (int)keep.size();
+  if (n < k_min || n > k_max) {
+    cover(widest_too_many > 0 ? widest_too_many : narrowest_too_few);
+  }
+
+  if ((int)keep.size() > num_to_keep) {
+    keep.resize(num_to_keep);
+  }
+}
+
+
+const cv::Mat& FeatureDetector::TrackedMask(const cv::Size& size, const VecPoint2f& tracked_kp)
+{
+  // NOTE(milo): The static mask is rasterized once per image size, so this is just a copy.
+  const Image1b valid = static_mask_.Valid(size.height, size.width);
+  if (valid.empty()) {
+    mask_.create(size, CV_8U);
+    mask_.setTo(cv::Scalar(255));
+  } else {
+    valid.copyTo(mask_);
+  }
+  for (size_t i = 0; i < tracked_kp.size(); ++i) {
+    cv::circle(mask_, tracked_kp.at(i), params_.min_distance_btw_tracked_and_detected_features, cv::Scalar(0), CV_FILLED);
+  }
+  return mask_;
+}
+
+
+void FeatureDetector::Suppress(std::vector<cv::KeyPoint>& keypoints,
+                               int num_to_keep,
+                               bool is_sorted,
+                               int cols,
+                               int rows,
+                               VecPoint2f& new_kp)
+{
+  MACRO_PROFILE_SCOPE("FeatureDetector::Suppress");
+
+  const int N = (int)keypoints.size();
+  const int num_candidates = std::min(N, std::max(num_to_keep, num_to_keep * params_.anms_candidates_per_feature));
+
+  // Only the candidates have to be in order, so this is a partial sort by (float) response.
+  anms_idx_.resize(N);
+  std::iota(anms_idx_.begin(), anms_idx_.end(), 0);
+  if (!is_sorted) {
+    std::partial_sort(anms_idx_.begin(), anms_idx_.begin() + num_candidates, anms_idx_.end(),
+        [&keypoints](int a, int b) { return keypoints[a].response > keypoints[b].response; });
+  }
+  anms_idx_.resize(num_candidates);
+
+  new_kp.clear();
+  if (num_candidates <= num_to_keep) {
+    for (const int i : anms_idx_) {
+      new_kp.emplace_back(keypoints[i].pt);
+    }
+    return;
+  }
+
+  if (params_.anms_algorithm == AnmsAlgorithm::SSC) {
+    SuppressSsc(keypoints, anms_idx_, num_to_keep, 0.1f, cols, rows, anms_covered_, anms_keep_);
+    for (const int i : anms_keep_) {
+      new_kp.emplace_back(keypoints[i].pt);
+    }
+  } else {
+    // Adapted from Kimera-VIO.
+    std::vector<cv::KeyPoint> keypoints_sorted(num_candidates);
+    for (int i = 0; i < num_candidates; ++i) {
+      keypoints_sorted[i] = keypoints[anms_idx_[i]];
+    }
+    new_kp = CvKeyPointToPoint(anms::RangeTree(keypoints_sorted, num_to_keep, 0.1f, cols, rows));
+  }
+}
+
+
+void FeatureDetector::DetectGrid(const Image1b& img,
+                                 const cv::Mat& mask,
+                                 const VecPoint2f& tracked_kp,
+                                 VecPoint2f& new_kp)
+{
+  MACRO_PROFILE_SCOPE("FeatureDetector::DetectGrid");
+
+  const int grid_rows = params_.grid_rows;
+  const int grid_cols = params_.grid_cols;
+  const int num_cells = grid_rows * grid_cols;
+  const int target_per_cell = (params_.max_features_per_frame + num_cells - 1) / num_cells;
+  const int cell_w = (img.cols + grid_cols - 1) / grid_cols;
+  const int cell_h = (img.rows + grid_rows - 1) / grid_rows;
+
+  std::vector<int> cell_counts(num_cells, 0);
+  for (const cv::Point2f& kp : tracked_kp) {
+    const int gx = std::min(std::max(0, (int)kp.x / cell_w), grid_cols - 1);
+    const int gy = std::min(std::max(0, (int)kp.y / cell_h), grid_rows - 1);
+    ++cell_counts.at(gy * grid_cols + gx);
+  }
+
+  // Only cells that are short of features need to be detected. As tracking gets better, this
+  // (and the work) shrinks.
+  std::vector<int> cells_to_detect;
+  for (int c = 0; c < num_cells; ++c) {
+    if (cell_counts.at(c) < target_per_cell) {
+      cells_to_detect.emplace_back(c);
+    }
+  }
+
+  const cv::Rect image_rect(0, 0, img.cols, img.rows);
+  std::vector<VecPoint2f> cell_kp(cells_to_detect.size());
+
+  TaskScheduler::Instance().ParallelFor(TaskPriority::FRONTEND, (int)cells_to_detect.size(), [&](int i) {
+    const int c = cells_to_detect.at(i);
+    const cv::Rect roi = cv::Rect((c % grid_cols) * cell_w, (c / grid_cols) * cell_h, cell_w, cell_h) & image_rect;
+    if (roi.area() == 0) {
+      return;
+    }
+
+    // Cells under the vehicle body (or already full of tracks) can't have any new features.
+    if (!static_mask_.Empty() && cv::countNonZero(mask(roi)) == 0) {
+      return;
+    }
+
+    // NOTE(milo): The corners come back sorted from strongest to weakest, and min distance is
+    // enforced within the cell. Gradients at the cell edges still use the neighboring pixels.
+    VecPoint2f& out = cell_kp.at(i);
+    cv::goodFeaturesToTrack(img(roi), out, target_per_cell - cell_counts.at(c),
+        params_.gftt_quality_level,
+        params_.min_distance_btw_tracked_and_detected_features,
+        mask(roi),
+        params_.gftt_block_size,
+        params_.gftt_use_harris_corner_detector,
+        params_.gftt_k);
+
+    for (cv::Point2f& pt : out) {
+      pt.x += roi.x;
+      pt.y += roi.y;
+    }
+  }, params_.grid_num_threads);
+
+  // Take the strongest remaining corner from each cell in turn, so that the max_features_per_frame
+  // limit doesn't favor the first cells in the grid.
+  const size_t num_to_keep = std::max(0, params_.max_features_per_frame - (int)tracked_kp.size());
+
+  for (size_t rank = 0; new_kp.size() < num_to_keep; ++rank) {
+    bool any_left = false;
+    for (size_t i = 0; i < cell_kp.size() && new_kp.size() < num_to_keep; ++i) {
+      if (rank < cell_kp.at(i).size()) {
+        new_kp.emplace_back(cell_kp.at(i).at(rank));
+        any_left = true;
+      }
+    }
+    if (!any_left) {
+      break;
+    }
+  }
 }
 
 
@@ -90,23 +340,37 @@ void FeatureDetector::Detect(const Image1b& img,
                              const VecPoint2f& tracked_kp,
                              VecPoint2f& new_kp)
 {
+  MACRO_PROFILE_SCOPE("FeatureDetector::Detect");
   new_kp.clear();
 
   // Only detect keypoints that a minimum distance from existing tracked keypoints.
-  cv::Mat mask(img.size(), CV_8U, cv::Scalar(255));
-  for (size_t i = 0; i < tracked_kp.size(); ++i) {
-    cv::circle(mask, tracked_kp.at(i), params_.min_distance_btw_tracked_and_detected_features, cv::Scalar(0), CV_FILLED);
-  }
+  const cv::Mat& mask = TrackedMask(img.size(), tracked_kp);
 
-  std::vector<cv::KeyPoint> new_kp_cv;
-  feature_detector_->detect(img, new_kp_cv, mask);
+  if (params_.grid_rows > 0 && params_.grid_cols > 0) {
+    DetectGrid(img, mask, tracked_kp, new_kp);
 
-  // Apply non-maximal suppression to limit the number of new points that are detected.
-  // Supposedly, this function will achieve a more "even distribution" of features across the image.
-  const int num_to_keep = std::max(0, params_.max_features_per_frame - (int)tracked_kp.size());
+  } else {
+    // Apply non-maximal suppression to limit the number of new points that are detected.
+    // Supposedly, this function will achieve a more "even distribution" of features across the image.
+    const int num_to_keep = std::max(0, params_.max_features_per_frame - (int)tracked_kp.size());
+
+    detections_.clear();
 
-  new_kp_cv = ANMSRangeTree(new_kp_cv, num_to_keep, 0.1f, img.cols, img.rows);
-  new_kp = CvKeyPointToPoint(new_kp_cv);
+    if (gpu_detector_) {
+      VecPoint2f corners;
+      gpu_detector_->Detect(img, mask, corners);
+
+      // NOTE(milo): The GPU corners are already sorted from strongest to weakest, so they can skip
+      // the sort in Suppress().
+      for (size_t i = 0; i < corners.size(); ++i) {
+        detections_.emplace_back(corners.at(i), 1.0f, -1.0f, (float)(corners.size() - i));
+      }
+      Suppress(detections_, num_to_keep, true, img.cols, img.rows, new_kp);
+    } else {
+      feature_detector_->detect(img, detections_, mask);
+      Suppress(detections_, num_to_keep, false, img.cols, img.rows, new_kp);
+    }
+  }
 
   // Optionally do sub-pixel refinement on keypoint locations.
   // https://docs.opencv.org/master/dd/d1a/group__imgproc__feature.html#ga354e0d7c86d0d9da75de9b9701a9a87e
@@ -1,10 +1,17 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <vector>
+
 #include <opencv2/features2d.hpp>
 
 #include "core/macros.hpp"
+#include "core/task_scheduler.hpp"
 #include "params/params_base.hpp"
 #include "vision_core/cv_types.hpp"
+#include "vision_core/static_mask.hpp"
+#include "feature_tracking/cuda_frontend.hpp"
 
 namespace bm {
 namespace ft {
@@ -15,6 +22,26 @@ using namespace core;
 // Different options for the point detection algorithm.
 enum FeatureAlgorithm { FAST, ORB, GFTT, };
 
+// Adaptive non-maximal suppression, which limits new detections to max_features_per_frame.
+//  RANGE_TREE: anms::RangeTree (builds a range tree for every radius it tries)
+//  SSC: suppression via square covering, over an occupancy grid that is reused between frames
+enum AnmsAlgorithm { RANGE_TREE, SSC, };
+
+
+// Keeps up to num_to_keep of the keypoints in sorted_idx (indices into keypoints, strongest first),
+// spread out with suppression via square covering (Bailo et al. 2018). A binary search looks for
+// the covering width that keeps num_to_keep +/- tolerance keypoints. Each try rasterizes the kept
+// keypoints into a coarse occupancy grid, and stops as soon as it has kept too many. The indices of
+// the kept keypoints (strongest first) go into keep, and covered is only reallocated if it grows.
+void SuppressSsc(const std::vector<cv::KeyPoint>& keypoints,
+                 const std::vector<int>& sorted_idx,
+                 int num_to_keep,
+                 float tolerance,
+                 int cols,
+                 int rows,
+                 std::vector<uint8_t>& covered,
+                 std::vector<int>& keep);
+
 
 class FeatureDetector final {
  public:
@@ -27,6 +54,20 @@ class FeatureDetector final {
 
     int max_features_per_frame = 200;
 
+    AnmsAlgorithm anms_algorithm = AnmsAlgorithm::RANGE_TREE;
+
+    // Only the strongest (this * max_features_per_frame) detections are sorted and passed to ANMS.
+    int anms_candidates_per_feature = 8;
+
+    //========================== GRID BUCKETING ===========================
+    // If both are nonzero, the image is split into a grid_rows x grid_cols grid, and features are
+    // only detected in cells that have fewer than (max_features_per_frame / num_cells) tracked
+    // keypoints. Cells are detected in parallel, using up to grid_num_threads workers from the
+    // shared TaskScheduler.
+    int grid_rows = 0;
+    int grid_cols = 0;
+    int grid_num_threads = 2;
+
     //============================ GFTT ===================================
     int min_distance_btw_tracked_and_detected_features = 20;
     double gftt_quality_level = 0.01;
@@ -34,6 +75,10 @@ class FeatureDetector final {
     bool gftt_use_harris_corner_detector = false;
     double gftt_k = 0.04;
 
+    // Detect with CudaGftt (needs BM_USE_CUDA_FRONTEND, otherwise falls back to the CPU).
+    // NOTE(milo): Grid bucketing always runs on the CPU, since the cells are small.
+    bool use_gpu = false;
+
     //==================== SUBPIXEL CORNER ESTIMATION =====================
     // NOTE(milo): Subpixel refinement makes feature detection take ~20ms vs 2-5ms without.
     bool subpixel_corners = false;
@@ -51,13 +96,52 @@ class FeatureDetector final {
 
   // Construct with options.
   explicit FeatureDetector(const Params& params);
+  ~FeatureDetector();
 
   void Detect(const Image1b& img, const VecPoint2f& tracked_kp, VecPoint2f& new_kp);
 
+  // Change the feature limit while running (e.g to shed load). Takes effect on the next Detect().
+  // NOTE(milo): The GPU detector still finds up to the original limit, but only this many are kept.
+  void SetMaxFeaturesPerFrame(int max_features_per_frame);
+  int MaxFeaturesPerFrame() const { return params_.max_features_per_frame; }
+
+  // Never detect in the pixels that this blocks (e.g the camera's StaticMask from its StereoCamera).
+  // Grid cells that are entirely blocked are skipped. Don't call this during a Detect().
+  void SetStaticMask(const StaticMask& mask) { static_mask_ = mask; }
+
+ private:
+  // Blocks out a circle around each tracked keypoint, in a mask that is reused between frames. It
+  // starts out as a copy of the static mask (if there is one).
+  const cv::Mat& TrackedMask(const cv::Size& size, const VecPoint2f& tracked_kp);
+
+  // Sorts the strongest detections and keeps num_to_keep of them with anms_algorithm. If is_sorted,
+  // the keypoints are already strongest first (e.g from the GPU).
+  void Suppress(std::vector<cv::KeyPoint>& keypoints,
+                int num_to_keep,
+                bool is_sorted,
+                int cols,
+                int rows,
+                VecPoint2f& new_kp);
+
+  // Bucketed version of detection (see grid_rows and grid_cols). The mask blocks out tracked_kp.
+  void DetectGrid(const Image1b& img,
+                  const cv::Mat& mask,
+                  const VecPoint2f& tracked_kp,
+                  VecPoint2f& new_kp);
+
  private:
   Params params_;
 
   cv::Ptr<cv::Feature2D> feature_detector_;
+  std::unique_ptr<CudaGftt> gpu_detector_;  // Only set if params_.use_gpu.
+  StaticMask static_mask_;
+
+  // Reused between frames.
+  cv::Mat mask_;
+  std::vector<cv::KeyPoint> detections_;
+  std::vector<int> anms_idx_;
+  std::vector<int> anms_keep_;
+  std::vector<uint8_t> anms_covered_;
 };
 
 
@@ -1,7 +1,11 @@
+#include <algorithm>
+
 #include <glog/logging.h>
+#include <opencv2/imgproc.hpp>
 #include <opencv2/video/tracking.hpp>
 
 #include "feature_tracking/feature_tracker.hpp"
+#include "core/profiler.hpp"
 
 namespace bm {
 namespace ft {
@@ -13,6 +17,75 @@ void FeatureTracker::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("klt_epsilon", &klt_epsilon);
   parser.GetParam("klt_winsize", &klt_winsize);
   parser.GetParam("klt_max_level", &klt_max_level);
+  parser.GetParam("klt_guess_max_level", &klt_guess_max_level);
+  parser.GetParam("klt_guess_maxiters", &klt_guess_maxiters);
+  parser.GetParam("use_gpu", &use_gpu);
+
+  int check_mode_int = 0;
+  parser.GetParam("check_mode", &check_mode_int);
+  CHECK(check_mode_int == 0 || check_mode_int == 1) << "check_mode must be 0 (FWD_BKW) or 1 (NCC)" << std::endl;
+  check_mode = static_cast<CheckMode>(check_mode_int);
+  parser.GetParam("fwd_bkw_min_error", &fwd_bkw_min_error);
+  parser.GetParam("fwd_bkw_level", &fwd_bkw_level);
+  parser.GetParam("ncc_winsize", &ncc_winsize);
+  parser.GetParam("ncc_min", &ncc_min);
+
+  CHECK_GE(fwd_bkw_level, 0);
+  CHECK_GE(ncc_winsize, 3);
+  CHECK_GE(klt_guess_max_level, 0);
+  CHECK_GT(klt_guess_maxiters, 0);
+}
+
+
+FeatureTracker::FeatureTracker(const Params& params)
+    : params_(params)
+{
+#ifdef BM_USE_CUDA_FRONTEND
+  if (params_.use_gpu) {
+    gpu_klt_.reset(new CudaKlt(params_.klt_winsize, params_.klt_max_level, params_.klt_maxiters));
+  }
+#else
+  LOG_IF(WARNING, params_.use_gpu) << "FeatureTracker: built without BM_USE_CUDA_FRONTEND, tracking on the CPU" << std::endl;
+  params_.use_gpu = false;
+#endif
+}
+
+
+FeatureTracker::~FeatureTracker() = default;
+
+
+void FeatureTracker::SetMaxLevel(int klt_max_level)
+{
+  CHECK_GE(klt_max_level, 0);
+  params_.klt_max_level = klt_max_level;
+}
+
+
+void FeatureTracker::BuildPyramid(const Image1b& img, ImagePyramid& pyramid) const
+{
+  MACRO_PROFILE_SCOPE("FeatureTracker::BuildPyramid");
+  if (gpu_klt_) {
+    pyramid.resize(1);
+    img.copyTo(pyramid.at(0));
+    return;
+  }
+
+  const cv::Size2i klt_window_size(params_.klt_winsize, params_.klt_winsize);
+
+  // NOTE(milo): Don't let OpenCV alias the input image as the first level. Then the pyramid always
+  // owns its memory, and it's safe to build the next pyramid over top of it.
+  cv::buildOpticalFlowPyramid(img, pyramid, klt_window_size, params_.klt_max_level, true,
+                              cv::BORDER_REFLECT_101, cv::BORDER_CONSTANT, false);
+}
+
+
+std::shared_ptr<const ImagePyramid> FeatureTracker::CachedPyramid(const Image1b& img,
+                                                                  FrameCache& cache,
+                                                                  const std::string& image) const
+{
+  const std::string key = FrameCacheKey("ft::Pyramid", image, gpu_klt_ ? "gpu" : "cpu",
+                                        params_.klt_winsize, params_.klt_max_level);
+  return cache.Get<ImagePyramid>(key, [this, &img](ImagePyramid& pyramid) { BuildPyramid(img, pyramid); });
 }
 
 
@@ -23,8 +96,40 @@ void FeatureTracker::Track(const Image1b& ref_img,
                            std::vector<uchar>& status,
                            std::vector<float>& error,
                            bool bidirectional,
-                           float fwd_bkw_thresh_px)
+                           float fwd_bkw_thresh_px) const
 {
+  // The GPU tracker doesn't need CPU pyramids, so skip the copy into one.
+  if (gpu_klt_ && !px_ref.empty()) {
+    MACRO_PROFILE_SCOPE("FeatureTracker::Track");
+    status.clear();
+    error.clear();
+    VecPoint2f px_ref_bkw;
+    VecPoint2f* px_ref_bkw_ptr = bidirectional ? &px_ref_bkw : nullptr;
+    gpu_klt_->Track(ref_img, cur_img, px_ref, px_cur, status, error, px_ref_bkw_ptr);
+    CheckTracks(cur_img, px_ref, px_cur, px_ref_bkw_ptr, fwd_bkw_thresh_px, status);
+    return;
+  }
+
+  // Skip building pyramids if there's nothing to track (the overload below will warn about it).
+  ImagePyramid ref_pyramid, cur_pyramid;
+  if (!px_ref.empty()) {
+    BuildPyramid(ref_img, ref_pyramid);
+    BuildPyramid(cur_img, cur_pyramid);
+  }
+  Track(ref_pyramid, cur_pyramid, px_ref, px_cur, status, error, bidirectional, fwd_bkw_thresh_px);
+}
+
+
+void FeatureTracker::Track(const ImagePyramid& ref_pyramid,
+                           const ImagePyramid& cur_pyramid,
+                           const VecPoint2f& px_ref,
+                           VecPoint2f& px_cur,
+                           std::vector<uchar>& status,
+                           std::vector<float>& error,
+                           bool bidirectional,
+                           float fwd_bkw_thresh_px) const
+{
+  MACRO_PROFILE_SCOPE("FeatureTracker::Track");
   status.clear();
   error.clear();
 
@@ -33,49 +138,79 @@ void FeatureTracker::Track(const Image1b& ref_img,
     return;
   }
 
+  CHECK(!ref_pyramid.empty() && !cur_pyramid.empty()) << "Tried to track with an empty pyramid!" << std::endl;
+
+  // NOTE(milo): The first level of the pyramid is the full resolution image.
+  const cv::Mat& cur_img = cur_pyramid.at(0);
+
+  VecPoint2f px_ref_bkw;
+  VecPoint2f* px_ref_bkw_ptr = bidirectional ? &px_ref_bkw : nullptr;
+
+  if (gpu_klt_) {
+    gpu_klt_->Track(ref_pyramid.at(0), cur_img, px_ref, px_cur, status, error, px_ref_bkw_ptr);
+    CheckTracks(cur_img, px_ref, px_cur, px_ref_bkw_ptr, fwd_bkw_thresh_px, status);
+    return;
+  }
+
+  // If no initial guesses are provided for the optical flow, initialize px_cur to previous locations.
+  const bool has_guess = !px_cur.empty();
+  if (has_guess) {
+    CHECK_EQ(px_ref.size(), px_cur.size()) << "Need one initial guess per point" << std::endl;
+  } else {
+    px_cur = px_ref;
+  }
+
+  // The backward pass starts from the guesses too (see TrackBackward()).
+  const VecPoint2f px_guess = has_guess ? px_cur : VecPoint2f();
+
+  // NOTE(milo): Never use more levels than klt_max_level, since that might have been lowered to shed load.
+  const int max_level = has_guess ? std::min(params_.klt_guess_max_level, params_.klt_max_level) :
+                                    params_.klt_max_level;
+
   // Setup termination criteria for optical flow.
   const cv::TermCriteria kTerminationCriteria(
       cv::TermCriteria::COUNT + cv::TermCriteria::EPS,
-      params_.klt_maxiters,
+      has_guess ? params_.klt_guess_maxiters : params_.klt_maxiters,
       params_.klt_epsilon);
 
   const cv::Size2i klt_window_size(params_.klt_winsize, params_.klt_winsize);
 
-  // If no initial guesses are provided for the optical flow, nitialize px_cur to previous locations.
-  if (px_cur.empty()) {
-    px_cur = px_ref;
-  }
-
-  cv::calcOpticalFlowPyrLK(ref_img,
-                           cur_img,
+  cv::calcOpticalFlowPyrLK(ref_pyramid,
+                           cur_pyramid,
                            px_ref,
                            px_cur,
                            status,
                            error,
                            klt_window_size,
-                           params_.klt_max_level,
+                           max_level,
                            kTerminationCriteria,
-                           cv::OPTFLOW_USE_INITIAL_FLOW & cv::OPTFLOW_LK_GET_MIN_EIGENVALS,
+                           cv::OPTFLOW_USE_INITIAL_FLOW,
                            0.0001);
 
-  if (bidirectional) {
-    VecPoint2f px_ref_bkw;
-    cv::calcOpticalFlowPyrLK(cur_img,
-                            ref_img,
-                            px_cur,
-                            px_ref_bkw,
-                            status,
-                            error,
-                            klt_window_size,
-                            params_.klt_max_level,
-                            kTerminationCriteria,
-                            cv::OPTFLOW_USE_INITIAL_FLOW & cv::OPTFLOW_LK_GET_MIN_EIGENVALS,
-                            0.0001);
-
-    // Invalidate any points that could be tracked in reverse.
+  if (bidirectional && params_.check_mode == CheckMode::NCC) {
+    CheckNcc(ref_pyramid.at(0), cur_img, px_ref, px_cur, status);
+    px_ref_bkw_ptr = nullptr;
+  } else if (bidirectional) {
+    TrackBackward(ref_pyramid, cur_pyramid, px_ref, px_cur, px_guess, error, max_level,
+                  kTerminationCriteria, status, px_ref_bkw);
+  }
+
+  CheckTracks(cur_img, px_ref, px_cur, px_ref_bkw_ptr, fwd_bkw_thresh_px, status);
+}
+
+
+void FeatureTracker::CheckTracks(const cv::Mat& cur_img,
+                                 const VecPoint2f& px_ref,
+                                 const VecPoint2f& px_cur,
+                                 const VecPoint2f* px_ref_bkw,
+                                 float fwd_bkw_thresh_px,
+                                 std::vector<uchar>& status) const
+{
+  // Invalidate any points that could be tracked in reverse.
+  if (px_ref_bkw != nullptr) {
     for (size_t i = 0; i < px_ref.size(); ++i) {
       const cv::Point2f& ref = px_ref.at(i);
-      const cv::Point2f& ref_bkw = px_ref_bkw.at(i);
+      const cv::Point2f& ref_bkw = px_ref_bkw->at(i);
       const float dx = ref.x - ref_bkw.x;
       const float dy = ref.y - ref_bkw.y;
       if ((dx*dx + dy*dy) > fwd_bkw_thresh_px*fwd_bkw_thresh_px) {
@@ -93,5 +228,116 @@ void FeatureTracker::Track(const Image1b& ref_img,
   }
 }
 
+
+void FeatureTracker::TrackBackward(const ImagePyramid& ref_pyramid,
+                                   const ImagePyramid& cur_pyramid,
+                                   const VecPoint2f& px_ref,
+                                   const VecPoint2f& px_cur,
+                                   const VecPoint2f& px_guess,
+                                   const std::vector<float>& error,
+                                   int max_level,
+                                   const cv::TermCriteria& criteria,
+                                   std::vector<uchar>& status,
+                                   VecPoint2f& px_ref_bkw) const
+{
+  // NOTE(milo): BuildPyramid() stores each level followed by its derivatives, so level L starts at
+  // index 2*L, and the levels after it are a valid pyramid by themselves.
+  const int num_levels = (int)std::min(ref_pyramid.size(), cur_pyramid.size()) / 2;
+  const int level = std::max(0, std::min(params_.fwd_bkw_level, num_levels - 1));
+  const float scale = 1.0f / (float)(1 << level);
+
+  px_ref_bkw = px_ref;
+
+  std::vector<size_t> index;
+  VecPoint2f cur_sub, ref_bkw_sub;
+  for (size_t i = 0; i < px_cur.size(); ++i) {
+    if (status.at(i) == 0 || error.at(i) < params_.fwd_bkw_min_error) {
+      continue;
+    }
+    index.emplace_back(i);
+    cur_sub.emplace_back(scale * px_cur.at(i));
+
+    // With a guess, start from the opposite of the predicted motion. It doesn't start at px_ref, so
+    // a bad forward track can't be pulled back to where it started.
+    if (!px_guess.empty()) {
+      ref_bkw_sub.emplace_back(scale * (px_cur.at(i) - (px_guess.at(i) - px_ref.at(i))));
+    }
+  }
+
+  if (index.empty()) {
+    return;
+  }
+
+  std::vector<uchar> bkw_status;
+  std::vector<float> bkw_error;
+  const ImagePyramid cur_levels(cur_pyramid.begin() + 2*level, cur_pyramid.end());
+  const ImagePyramid ref_levels(ref_pyramid.begin() + 2*level, ref_pyramid.end());
+
+  cv::calcOpticalFlowPyrLK(level ? cur_levels : cur_pyramid,
+                           level ? ref_levels : ref_pyramid,
+                           cur_sub,
+                           ref_bkw_sub,
+                           bkw_status,
+                           bkw_error,
+                           cv::Size2i(params_.klt_winsize, params_.klt_winsize),
+                           std::max(0, max_level - level),
+                           criteria,
+                           px_guess.empty() ? 0 : cv::OPTFLOW_USE_INITIAL_FLOW,
+                           0.0001);
+
+  for (size_t j = 0; j < index.size(); ++j) {
+    const size_t i = index.at(j);
+    status.at(i) = bkw_status.at(j);
+    px_ref_bkw.at(i) = ref_bkw_sub.at(j) / scale;
+  }
+}
+
+
+// Normalized cross correlation of two patches of the same size (CV_32F).
+static float PatchNcc(const cv::Mat& a, const cv::Mat& b)
+{
+  const int N = a.rows * a.cols;
+  const float* pa = a.ptr<float>();
+  const float* pb = b.ptr<float>();
+
+  double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+  for (int i = 0; i < N; ++i) {
+    sa += pa[i];
+    sb += pb[i];
+    saa += pa[i] * pa[i];
+    sbb += pb[i] * pb[i];
+    sab += pa[i] * pb[i];
+  }
+
+  const double var_a = saa - sa * sa / N;
+  const double var_b = sbb - sb * sb / N;
+  if (var_a <= 1e-6 || var_b <= 1e-6) {
+    return 0.0f;
+  }
+  return (float)((sab - sa * sb / N) / std::sqrt(var_a * var_b));
+}
+
+
+void FeatureTracker::CheckNcc(const cv::Mat& ref_img,
+                              const cv::Mat& cur_img,
+                              const VecPoint2f& px_ref,
+                              const VecPoint2f& px_cur,
+                              std::vector<uchar>& status) const
+{
+  const cv::Size patch_size(params_.ncc_winsize, params_.ncc_winsize);
+  cv::Mat ref_patch, cur_patch;
+
+  for (size_t i = 0; i < px_cur.size(); ++i) {
+    if (status.at(i) == 0) {
+      continue;
+    }
+    cv::getRectSubPix(ref_img, patch_size, px_ref.at(i), ref_patch, CV_32F);
+    cv::getRectSubPix(cur_img, patch_size, px_cur.at(i), cur_patch, CV_32F);
+    if (PatchNcc(ref_patch, cur_patch) < params_.ncc_min) {
+      status.at(i) = 0;
+    }
+  }
+}
+
 }
 }
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "core/frame_cache.hpp"
 #include "core/macros.hpp"
 #include "params/params_base.hpp"
 #include "vision_core/cv_types.hpp"
+#include "feature_tracking/pyramid_frame.hpp"
+#include "feature_tracking/cuda_frontend.hpp"
 
 namespace bm {
 namespace ft {
@@ -14,6 +19,13 @@ using namespace core;
 
 class FeatureTracker final {
  public:
+  // How Track() checks points when bidirectional is set.
+  enum class CheckMode
+  {
+    FWD_BKW = 0,    // Track points back into the reference image, and check that they return.
+    NCC = 1         // Compare the patches around each reference point and tracked point instead.
+  };
+
   struct Params final : public ParamsBase
   {
     MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
@@ -23,6 +35,27 @@ class FeatureTracker final {
     int klt_winsize = 21;
     int klt_max_level = 4;
 
+    // When the caller predicts where the points will be (e.g from a rotation prior), the flow only
+    // has to correct the prediction, so fewer pyramid levels and iterations are used.
+    int klt_guess_max_level = 2;
+    int klt_guess_maxiters = 15;
+
+    // The backward pass costs as much as the forward one, so it can be cut down. With FWD_BKW, points
+    // whose forward error (mean absolute difference between patches) is under fwd_bkw_min_error
+    // skip it, and it can be run from a coarser pyramid level (fwd_bkw_level = 0 is full
+    // resolution), which loses some precision. NCC mode doesn't track backwards at all, and rejects
+    // points whose ncc_winsize patches have a normalized cross correlation under ncc_min.
+    CheckMode check_mode = CheckMode::FWD_BKW;
+    float fwd_bkw_min_error = 0.0;
+    int fwd_bkw_level = 0;
+    int ncc_winsize = 9;
+    float ncc_min = 0.8;
+
+    // Track on the GPU with CudaKlt (needs BM_USE_CUDA_FRONTEND, otherwise falls back to the CPU).
+    // NOTE(milo): The GPU tracker builds its own pyramids, and ignores klt_epsilon, klt_guess_*, and
+    // the check options (it always tracks every point backwards).
+    bool use_gpu = false;
+
    private:
     void LoadParams(const YamlParser& parser) override;
   };
@@ -32,11 +65,14 @@ class FeatureTracker final {
   FeatureTracker() = delete;
 
   // Construct with options.
-  explicit FeatureTracker(const Params& params) : params_(params) {}
+  explicit FeatureTracker(const Params& params);
+  ~FeatureTracker();
 
-  // Track points from ref_img to cur_img using Lucas-Kanade optical flow.
-  // If px_cur is provided, these locations are used as an initial guess for the flow.
-  // Otherwise, points are tracked from their reference locations.
+  // Track points from ref_img to cur_img using Lucas-Kanade optical flow. If bidirectional, points
+  // fail unless they pass the check in params (e.g come back within fwd_bkw_thresh_px of px_ref).
+  // If px_cur is provided, these locations are used as an initial guess for the flow, and it's
+  // tracked with klt_guess_max_level and klt_guess_maxiters. Otherwise, points are tracked from
+  // their reference locations.
   void Track(const Image1b& ref_img,
              const Image1b& cur_img,
              const VecPoint2f& px_ref,
@@ -44,10 +80,70 @@ class FeatureTracker final {
              std::vector<uchar>& status,
              std::vector<float>& error,
              bool bidirectional = false,
-             float fwd_bkw_thresh_px = 5.0);
+             float fwd_bkw_thresh_px = 5.0) const;
+
+  // Same as above, but with pyramids from BuildPyramid() instead of images. Use this to avoid
+  // rebuilding the pyramid for an image that is tracked against more than once.
+  void Track(const ImagePyramid& ref_pyramid,
+             const ImagePyramid& cur_pyramid,
+             const VecPoint2f& px_ref,
+             VecPoint2f& px_cur,
+             std::vector<uchar>& status,
+             std::vector<float>& error,
+             bool bidirectional = false,
+             float fwd_bkw_thresh_px = 5.0) const;
+
+  // Build the optical flow pyramid for an image, using the window size and levels in params.
+  // If pyramid already holds a pyramid for an image of the same size, its memory is reused.
+  // NOTE(milo): With use_gpu, only the full resolution image is stored (the GPU builds the rest).
+  void BuildPyramid(const Image1b& img, ImagePyramid& pyramid) const;
+
+  // Same as BuildPyramid(), but the pyramid is built once per frame (see StereoImage::cache) and
+  // shared with every tracker that has the same window size and levels. "image" tells the images
+  // of a frame apart (e.g "left"). The pyramid is read-only, so don't pass it to BuildPyramid().
+  std::shared_ptr<const ImagePyramid> CachedPyramid(const Image1b& img,
+                                                    FrameCache& cache,
+                                                    const std::string& image) const;
+
+  // Change the number of pyramid levels while running (e.g to shed load). Pyramids that were built
+  // with more levels still work, since tracking only uses the first klt_max_level of them.
+  // NOTE(milo): Not used by the GPU tracker, which was built with a fixed number of levels.
+  void SetMaxLevel(int klt_max_level);
+  int MaxLevel() const { return params_.klt_max_level; }
+
+ private:
+  // Set the status of points that fail the forward-backward check, or leave the image, to zero.
+  void CheckTracks(const cv::Mat& cur_img,
+                   const VecPoint2f& px_ref,
+                   const VecPoint2f& px_cur,
+                   const VecPoint2f* px_ref_bkw,
+                   float fwd_bkw_thresh_px,
+                   std::vector<uchar>& status) const;
+
+  // The backward pass of FWD_BKW mode, for points that pass the forward pass and have an error over
+  // fwd_bkw_min_error. Every other point gets its reference location in px_ref_bkw.
+  void TrackBackward(const ImagePyramid& ref_pyramid,
+                     const ImagePyramid& cur_pyramid,
+                     const VecPoint2f& px_ref,
+                     const VecPoint2f& px_cur,
+                     const VecPoint2f& px_guess,
+                     const std::vector<float>& error,
+                     int max_level,
+                     const cv::TermCriteria& criteria,
+                     std::vector<uchar>& status,
+                     VecPoint2f& px_ref_bkw) const;
+
+  // Set the status of points whose patches don't match (see ncc_min) to zero.
+  void CheckNcc(const cv::Mat& ref_img,
+                const cv::Mat& cur_img,
+                const VecPoint2f& px_ref,
+                const VecPoint2f& px_cur,
+                std::vector<uchar>& status) const;
 
  private:
   Params params_;
+
+  std::unique_ptr<CudaKlt> gpu_klt_;  // Only set if params_.use_gpu.
 };
 
 
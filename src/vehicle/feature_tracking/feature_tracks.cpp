@@ -0,0 +1,105 @@
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "feature_tracking/feature_tracks.hpp"
+
+namespace bm {
+namespace ft {
+
+
+FeatureTracks::FeatureTracks(size_t max_obs_per_track)
+    : max_obs_per_track_(max_obs_per_track)
+{
+  CHECK_GE(max_obs_per_track_, 2ul);
+}
+
+
+const VecLmkObs& FeatureTracks::Get(uid_t lmk_id) const
+{
+  CHECK(Has(lmk_id)) << "Landmark does not exist in FeatureTracks: " << lmk_id << std::endl;
+  return tracks_.at(index_.at(lmk_id)).observations;
+}
+
+
+DepthFilter& FeatureTracks::GetDepthFilter(uid_t lmk_id)
+{
+  CHECK(Has(lmk_id)) << "Landmark does not exist in FeatureTracks: " << lmk_id << std::endl;
+  return tracks_.at(index_.at(lmk_id)).depth;
+}
+
+
+const DepthFilter& FeatureTracks::GetDepthFilter(uid_t lmk_id) const
+{
+  CHECK(Has(lmk_id)) << "Landmark does not exist in FeatureTracks: " << lmk_id << std::endl;
+  return tracks_.at(index_.at(lmk_id)).depth;
+}
+
+
+void FeatureTracks::AddTrack(const LandmarkObservation& lmk_obs)
+{
+  CHECK_EQ(index_.count(lmk_obs.landmark_id), 0ul)
+      << "Newly initialized landmark should not exist in FeatureTracks" << std::endl;
+
+  // Recycle a dead slot if there is one, otherwise grow.
+  if (size_ == tracks_.size()) {
+    tracks_.emplace_back();
+    tracks_.back().observations.reserve(max_obs_per_track_);
+  }
+
+  Track& track = tracks_.at(size_);
+  track.lmk_id = lmk_obs.landmark_id;
+  track.observations.clear();
+  track.observations.emplace_back(lmk_obs);
+  track.depth = DepthFilter();
+
+  index_.emplace(lmk_obs.landmark_id, size_);
+  ++size_;
+}
+
+
+void FeatureTracks::AddObservation(const LandmarkObservation& lmk_obs)
+{
+  CHECK_GT(index_.count(lmk_obs.landmark_id), 0ul)
+      << "Tracked point should already exist in FeatureTracks!" << std::endl;
+
+  VecLmkObs& observations = tracks_.at(index_.at(lmk_obs.landmark_id)).observations;
+
+  // Throw away the oldest half of the window. This keeps the cost amortized O(1) per observation.
+  if (observations.size() >= max_obs_per_track_) {
+    observations.erase(observations.begin(), observations.begin() + max_obs_per_track_ / 2);
+  }
+
+  observations.emplace_back(lmk_obs);
+}
+
+
+bool FeatureTracks::Kill(uid_t lmk_id)
+{
+  const auto it = index_.find(lmk_id);
+  if (it == index_.end()) {
+    return false;
+  }
+  KillSlot(it->second);
+  return true;
+}
+
+
+void FeatureTracks::KillSlot(size_t slot)
+{
+  CHECK_LT(slot, size_);
+  index_.erase(tracks_.at(slot).lmk_id);
+
+  // Move the last live track into this slot. The killed track's memory ends up in the dead region.
+  const size_t last = size_ - 1;
+  if (slot != last) {
+    std::swap(tracks_.at(slot), tracks_.at(last));
+    index_.at(tracks_.at(slot).lmk_id) = slot;
+  }
+
+  --size_;
+}
+
+
+}
+}
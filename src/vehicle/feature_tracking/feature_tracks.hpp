@@ -0,0 +1,95 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+#include "vision_core/landmark_observation.hpp"
+#include "feature_tracking/depth_filter.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+typedef std::vector<LandmarkObservation> VecLmkObs;
+
+
+// Stores the observations of every live landmark. Tracks are packed into one contiguous array, so
+// iterating over them doesn't chase hash map nodes, and killing a track is O(1) (the last track is
+// swapped into its place). Killed tracks keep their observation memory, and get recycled for the
+// next new landmark, so after a few frames of warmup nothing gets allocated per frame.
+//
+// NOTE(milo): Each track keeps a bounded window of its most recent observations. When a track
+// fills up to max_obs_per_track, the oldest half is thrown away, so at least max_obs_per_track / 2
+// of the most recent observations are always available.
+class FeatureTracks final {
+ public:
+  struct Track final
+  {
+    uid_t lmk_id = 0;
+    VecLmkObs observations;      // Sorted in order of INCREASING camera_id.
+    DepthFilter depth;           // Reset by AddTrack() (see StereoTracker).
+  };
+
+  typedef std::vector<Track>::const_iterator const_iterator;
+
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(FeatureTracks);
+  MACRO_DELETE_COPY_CONSTRUCTORS(FeatureTracks);
+
+  explicit FeatureTracks(size_t max_obs_per_track);
+
+  size_t Size() const { return size_; }
+  bool Empty() const { return size_ == 0; }
+
+  bool Has(uid_t lmk_id) const { return index_.count(lmk_id) != 0; }
+
+  // Get the observations of a live landmark (it must exist).
+  const VecLmkObs& Get(uid_t lmk_id) const;
+
+  // The depth filter of a live landmark (it must exist).
+  DepthFilter& GetDepthFilter(uid_t lmk_id);
+  const DepthFilter& GetDepthFilter(uid_t lmk_id) const;
+
+  // Start a new track with its first observation. The landmark must not already exist.
+  void AddTrack(const LandmarkObservation& lmk_obs);
+
+  // Add the latest observation of an existing landmark.
+  void AddObservation(const LandmarkObservation& lmk_obs);
+
+  // Returns whether the landmark existed.
+  bool Kill(uid_t lmk_id);
+
+  // Kill every track for which pred(const Track&) returns true.
+  template <typename Predicate>
+  void KillIf(Predicate pred)
+  {
+    // NOTE(milo): Go backwards so that the track swapped into slot i has already been checked.
+    for (size_t i = size_; i > 0; --i) {
+      if (pred(static_cast<const Track&>(tracks_.at(i - 1)))) {
+        KillSlot(i - 1);
+      }
+    }
+  }
+
+  // Iterate over the live tracks (in no particular order).
+  const_iterator begin() const { return tracks_.begin(); }
+  const_iterator end() const { return tracks_.begin() + size_; }
+
+ private:
+  void KillSlot(size_t slot);
+
+ private:
+  size_t max_obs_per_track_;
+
+  // Slots [0, size_) hold live tracks. Slots after that are dead, but keep their memory for reuse.
+  std::vector<Track> tracks_;
+  size_t size_ = 0;
+
+  std::unordered_map<uid_t, size_t> index_;   // Maps landmark id to its slot in tracks_.
+};
+
+
+}
+}
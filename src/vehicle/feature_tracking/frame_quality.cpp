@@ -0,0 +1,87 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "feature_tracking/frame_quality.hpp"
+
+namespace bm {
+namespace ft {
+
+
+// Pixels at or above this intensity count as saturated.
+static const int kSaturatedIntensity = 250;
+
+
+FrameQuality EstimateFrameQuality(const Image1b& img, float dark_percentile)
+{
+  CHECK_EQ(CV_8UC1, img.type());
+  FrameQuality quality;
+  if (img.rows < 3 || img.cols < 3) {
+    return quality;
+  }
+
+  // NOTE(milo): One pass for everything. The gradient is a central difference, so the border
+  // pixels only go in the histogram.
+  int hist[256] = { 0 };
+  double gradient_sum = 0;
+
+  for (int r = 0; r < img.rows; ++r) {
+    const uint8_t* I = img.ptr<uint8_t>(r);
+    for (int c = 0; c < img.cols; ++c) {
+      ++hist[I[c]];
+    }
+
+    if (r == 0 || r == (img.rows - 1)) {
+      continue;
+    }
+
+    const uint8_t* I_up = img.ptr<uint8_t>(r - 1);
+    const uint8_t* I_down = img.ptr<uint8_t>(r + 1);
+    int row_sum = 0;
+    for (int c = 1; c < (img.cols - 1); ++c) {
+      const int dx = static_cast<int>(I[c + 1]) - static_cast<int>(I[c - 1]);
+      const int dy = static_cast<int>(I_down[c]) - static_cast<int>(I_up[c]);
+      row_sum += dx*dx + dy*dy;
+    }
+    gradient_sum += static_cast<double>(row_sum);
+  }
+
+  const int N = img.rows * img.cols;
+  const int N_grad = (img.rows - 2) * (img.cols - 2);
+  quality.gradient_energy = static_cast<float>(0.25 * gradient_sum / static_cast<double>(N_grad));
+
+  int N_saturated = 0;
+  for (int i = kSaturatedIntensity; i < 256; ++i) {
+    N_saturated += hist[i];
+  }
+  quality.saturated_fraction = static_cast<float>(N_saturated) / static_cast<float>(N);
+
+  // Same as FindDarkFast(): the threshold is the top of the bin where the cumulative count reaches
+  // the percentile.
+  const int N_desired = std::max(1, static_cast<int>(dark_percentile * N));
+  int bin = 0;
+  for (int N_dark = 0; bin < 255; ++bin) {
+    N_dark += hist[bin];
+    if (N_dark >= N_desired) {
+      break;
+    }
+  }
+  quality.haze = static_cast<float>(bin) / 255.0f;
+
+  return quality;
+}
+
+
+Image1b PyramidLevel(const ImagePyramid& pyramid, int level)
+{
+  CHECK(!pyramid.empty());
+
+  // With derivatives, cv::buildOpticalFlowPyramid() interleaves them after each level's image.
+  const int step = (pyramid.size() > 1 && pyramid.at(1).type() != CV_8UC1) ? 2 : 1;
+  const int num_levels = (static_cast<int>(pyramid.size()) + step - 1) / step;
+  return pyramid.at(step * std::min(std::max(0, level), num_levels - 1));
+}
+
+
+}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "vision_core/cv_types.hpp"
+#include "feature_tracking/pyramid_frame.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+
+// Cheap summary of whether an image is worth tracking. Computed on a coarse pyramid level, so that
+// it costs a tiny fraction of KLT and stereo matching.
+struct FrameQuality final
+{
+  float gradient_energy = 0;      // Mean squared intensity gradient (motion blur and murk lower it).
+  float saturated_fraction = 0;   // Fraction of pixels at (or near) 255.
+  float haze = 0;                 // Intensity of the darkest pixels in [0, 1] (backscatter raises it).
+};
+
+
+// Estimate the quality of a grayscale image. The haze is the intensity below which dark_percentile
+// of the pixels are, found with a histogram like imaging::FindDarkFast(). In clear water the
+// darkest pixels (shadows, background) are near black, while backscatter lifts all of them.
+FrameQuality EstimateFrameQuality(const Image1b& img, float dark_percentile = 0.01f);
+
+
+// The image at "level" of a pyramid from FeatureTracker::BuildPyramid() (with or without
+// derivatives). Returns the coarsest level if the pyramid doesn't have that many.
+Image1b PyramidLevel(const ImagePyramid& pyramid, int level);
+
+
+}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+namespace bm {
+namespace ft {
+
+
+// What the tracker knows about a frame when deciding whether it should be a keyframe.
+struct KeyframeCues final
+{
+  double sec_since_keyframe = 0;
+  int frames_since_keyframe = 0;
+  int num_tracked = 0;            // Landmarks tracked into this frame.
+  double track_overlap = 1.0;     // Fraction of the last keyframe's landmarks that are still tracked.
+  double median_parallax_px = 0;  // Median distance (px) that those landmarks moved since the keyframe.
+};
+
+
+}
+}
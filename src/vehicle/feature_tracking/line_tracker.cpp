@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "core/profiler.hpp"
+#include "core/task_scheduler.hpp"
+#include "feature_tracking/line_tracker.hpp"
+
+#ifdef BM_ENABLE_LINE_FEATURES
+#include <opencv2/imgproc.hpp>
+#include <opencv2/line_descriptor/descriptor.hpp>
+
+#include "core/math_util.hpp"
+#include "vision_core/line_segment.hpp"
+#include "vision_core/line_util.hpp"
+#endif
+
+namespace bm {
+namespace ft {
+
+
+void StereoLineTracker::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("max_lines_per_frame", &max_lines_per_frame);
+  parser.GetParam("min_line_length", &min_line_length);
+  parser.GetParam("min_line_dy", &min_line_dy);
+  parser.GetParam("detect_downsample", &detect_downsample);
+  parser.GetParam("stereo_max_depth", &stereo_max_depth);
+  parser.GetParam("stereo_min_depth", &stereo_min_depth);
+  parser.GetParam("stereo_max_desc_dist", &stereo_max_desc_dist);
+  parser.GetParam("stereo_max_angle_deg", &stereo_max_angle_deg);
+  parser.GetParam("track_max_desc_dist", &track_max_desc_dist);
+  parser.GetParam("track_max_px", &track_max_px);
+
+  CHECK_GT(max_lines_per_frame, 0);
+  CHECK_GE(detect_downsample, 1);
+  CHECK_GT(stereo_max_depth, stereo_min_depth);
+}
+
+
+#ifdef BM_ENABLE_LINE_FEATURES
+
+typedef std::vector<LineSegment2d, Eigen::aligned_allocator<LineSegment2d>> VecLineSegment2d;
+
+// Lines that weren't associated with the keyframe (and aren't new) don't get an id.
+static const uid_t kNoLineId = std::numeric_limits<uid_t>::max();
+
+
+// Detection state for one side of the stereo pair. Each side has its own detector and descriptor,
+// so that both can run at the same time.
+struct LineDetectorSide final
+{
+  cv::Ptr<ld::LSDDetector> lsd = ld::LSDDetector::createLSDDetector();
+  cv::Ptr<ld::BinaryDescriptor> lbd = ld::BinaryDescriptor::createBinaryDescriptor();
+
+  Image1b small;                        // Only used if detect_downsample > 1.
+  std::vector<ld::KeyLine> keylines;
+  cv::Mat desc;                         // One LBD descriptor per keyline (CV_8UC1, 32 bytes).
+  VecLineSegment2d segments;            // Keylines in full resolution pixels.
+};
+
+
+struct StereoLineTracker::Impl final
+{
+  Impl(const Params& params, const StereoCamera& stereo_rig)
+      : params(params), stereo_rig(stereo_rig) {}
+
+  void DetectSide(LineDetectorSide& side, const Image1b& image, size_t budget);
+  void StereoMatch();
+
+  Params params;
+  StereoCamera stereo_rig;
+
+  LineDetectorSide sides[2];
+  std::vector<uchar> right_used;
+
+  // Stereo matched lines from the last Detect(), in the left image.
+  VecLineSegment2d cur_segments;
+  std::vector<double> cur_disp_p0, cur_disp_p1;
+  cv::Mat cur_desc;
+
+  // Lines in the last keyframe that later frames are associated with.
+  bool has_keyframe = false;
+  VecLineSegment2d kf_segments;
+  std::vector<uid_t> kf_line_ids;
+  cv::Mat kf_desc;
+  uid_t next_line_id = 0;
+};
+
+
+void StereoLineTracker::Impl::DetectSide(LineDetectorSide& side, const Image1b& image, size_t budget)
+{
+  const int ds = params.detect_downsample;
+  const cv::Mat* im = &image;
+  if (ds > 1) {
+    cv::resize(image, side.small, cv::Size(image.cols / ds, image.rows / ds), 0, 0, cv::INTER_AREA);
+    im = &side.small;
+  }
+
+  side.keylines.clear();
+  side.lsd->detect(*im, side.keylines, 2, 1);
+
+  // Keep the longest lines, which have the most distinctive descriptors and are the least likely
+  // to be broken up differently in the next image.
+  const float min_length = static_cast<float>(params.min_line_length / ds);
+  side.keylines.erase(std::remove_if(side.keylines.begin(), side.keylines.end(),
+      [min_length](const ld::KeyLine& kl) { return kl.lineLength < min_length; }), side.keylines.end());
+
+  const size_t num_keep = std::min(budget, side.keylines.size());
+  std::partial_sort(side.keylines.begin(), side.keylines.begin() + num_keep, side.keylines.end(),
+      [](const ld::KeyLine& a, const ld::KeyLine& b) { return a.lineLength > b.lineLength; });
+  side.keylines.resize(num_keep);
+
+  for (size_t i = 0; i < side.keylines.size(); ++i) {
+    side.keylines[i].class_id = static_cast<int>(i);
+  }
+
+  side.desc.release();
+  if (!side.keylines.empty()) {
+    side.lbd->compute(*im, side.keylines, side.desc);
+  }
+  CHECK_EQ(side.desc.rows, (int)side.keylines.size());
+
+  side.segments.clear();
+  for (const ld::KeyLine& kl : side.keylines) {
+    side.segments.emplace_back(Vector2d(kl.startPointX, kl.startPointY) * ds,
+                               Vector2d(kl.endPointX, kl.endPointY) * ds);
+  }
+}
+
+
+void StereoLineTracker::Impl::StereoMatch()
+{
+  const LineDetectorSide& left = sides[0];
+  const LineDetectorSide& right = sides[1];
+
+  const double min_disp = stereo_rig.DepthToDisp(params.stereo_max_depth);
+  const double max_disp = stereo_rig.DepthToDisp(params.stereo_min_depth);
+  const double min_cos = std::cos(DegToRad(params.stereo_max_angle_deg));
+
+  cur_segments.clear();
+  cur_disp_p0.clear();
+  cur_disp_p1.clear();
+  cur_desc.create(0, left.desc.cols, left.desc.type());
+  right_used.assign(right.segments.size(), 0);
+
+  // Left lines are in order of length, so the longest ones get first pick of the right lines.
+  for (size_t i = 0; i < left.segments.size(); ++i) {
+    const LineSegment2d& l = left.segments[i];
+    const double l_ymin = std::min(l.p0.y(), l.p1.y());
+    const double l_ymax = std::max(l.p0.y(), l.p1.y());
+    if ((l_ymax - l_ymin) < params.min_line_dy) {
+      continue;
+    }
+    const Vector2d l_dir = (l.p1 - l.p0).normalized();
+
+    int best_j = -1;
+    int best_dist = params.stereo_max_desc_dist + 1;
+    double best_d0 = 0, best_d1 = 0;
+
+    for (size_t j = 0; j < right.segments.size(); ++j) {
+      const LineSegment2d& r = right.segments[j];
+      // NOTE(milo): LSD orients each segment by its gradient, so this also checks that both edges
+      // have the same polarity (e.g the left and right sides of a bright pipe can't match).
+      if (right_used[j] || l_dir.dot((r.p1 - r.p0).normalized()) < min_cos) {
+        continue;
+      }
+
+      // Both segments have to cover (at least half of) the same rows.
+      const double r_ymin = std::min(r.p0.y(), r.p1.y());
+      const double r_ymax = std::max(r.p0.y(), r.p1.y());
+      const double overlap = std::min(l_ymax, r_ymax) - std::max(l_ymin, r_ymin);
+      if (overlap < 0.5 * std::min(l_ymax - l_ymin, r_ymax - r_ymin)) {
+        continue;
+      }
+
+      const int dist = (int)cv::norm(left.desc.row(i), right.desc.row(j), cv::NORM_HAMMING);
+      if (dist >= best_dist) {
+        continue;
+      }
+
+      // Extend the right segment to the same rows as the left one, so that each endpoint has a
+      // disparity. The right line has to be to the left of the left line.
+      const LineSegment2d r_ext = ExtrapolateLineSegment(l, r);
+      if ((l.p0.x() + l.p1.x()) <= (r_ext.p0.x() + r_ext.p1.x())) {
+        continue;
+      }
+      double d0, d1;
+      ComputeEndpointDisparity(l, r_ext, d0, d1);
+      if (d0 < min_disp || d0 > max_disp || d1 < min_disp || d1 > max_disp) {
+        continue;
+      }
+
+      best_j = (int)j;
+      best_dist = dist;
+      best_d0 = d0;
+      best_d1 = d1;
+    }
+
+    if (best_j >= 0 && (int)cur_segments.size() < params.max_lines_per_frame) {
+      right_used[best_j] = 1;
+      cur_segments.emplace_back(l);
+      cur_disp_p0.emplace_back(best_d0);
+      cur_disp_p1.emplace_back(best_d1);
+      cur_desc.push_back(left.desc.row(i));
+    }
+  }
+}
+
+
+StereoLineTracker::StereoLineTracker(const Params& params, const StereoCamera& stereo_rig)
+    : impl_(new Impl(params, stereo_rig)) {}
+
+
+StereoLineTracker::~StereoLineTracker() = default;
+
+
+void StereoLineTracker::Detect(const StereoImage1b& stereo_pair)
+{
+  MACRO_PROFILE_SCOPE("StereoLineTracker::Detect");
+
+  // The right image keeps more candidates, since some of its lines won't have a match on the left.
+  const size_t budget = static_cast<size_t>(impl_->params.max_lines_per_frame);
+  TaskScheduler::Instance().ParallelFor(TaskPriority::FRONTEND, 2, [&](int i) {
+    impl_->DetectSide(impl_->sides[i], i == 0 ? stereo_pair.left_image : stereo_pair.right_image,
+                      i == 0 ? 2 * budget : 4 * budget);
+  }, 1);
+
+  impl_->StereoMatch();
+}
+
+
+void StereoLineTracker::Associate(uid_t camera_id, bool is_keyframe, VecLineObservation& line_obs)
+{
+  MACRO_PROFILE_SCOPE("StereoLineTracker::Associate");
+  Impl& d = *impl_;
+
+  const int N = (int)d.cur_segments.size();
+  const int K = d.has_keyframe ? (int)d.kf_segments.size() : 0;
+
+  // Mutual best matches between this frame and the keyframe, within the descriptor and motion gates.
+  std::vector<int> best_kf_for_cur(N, -1), best_dist_cur(N, INT_MAX);
+  std::vector<int> best_cur_for_kf(K, -1), best_dist_kf(K, INT_MAX);
+
+  for (int i = 0; i < N; ++i) {
+    const Vector2d mid = 0.5 * (d.cur_segments[i].p0 + d.cur_segments[i].p1);
+    for (int k = 0; k < K; ++k) {
+      const Vector2d kf_mid = 0.5 * (d.kf_segments[k].p0 + d.kf_segments[k].p1);
+      if ((mid - kf_mid).norm() > d.params.track_max_px) {
+        continue;
+      }
+      const int dist = (int)cv::norm(d.cur_desc.row(i), d.kf_desc.row(k), cv::NORM_HAMMING);
+      if (dist > d.params.track_max_desc_dist) {
+        continue;
+      }
+      if (dist < best_dist_cur[i]) {
+        best_dist_cur[i] = dist;
+        best_kf_for_cur[i] = k;
+      }
+      if (dist < best_dist_kf[k]) {
+        best_dist_kf[k] = dist;
+        best_cur_for_kf[k] = i;
+      }
+    }
+  }
+
+  std::vector<uid_t> line_ids(N, kNoLineId);
+  for (int i = 0; i < N; ++i) {
+    const int k = best_kf_for_cur[i];
+    if (k >= 0 && best_cur_for_kf[k] == i) {
+      line_ids[i] = d.kf_line_ids[k];
+    } else if (is_keyframe) {
+      line_ids[i] = d.next_line_id++;
+    }
+  }
+
+  for (int i = 0; i < N; ++i) {
+    if (line_ids[i] != kNoLineId) {
+      line_obs.emplace_back(line_ids[i], camera_id, d.cur_segments[i].p0, d.cur_segments[i].p1,
+                            d.cur_disp_p0[i], d.cur_disp_p1[i]);
+    }
+  }
+
+  if (is_keyframe) {
+    d.has_keyframe = true;
+    d.kf_segments = d.cur_segments;
+    d.kf_line_ids = line_ids;
+    d.cur_desc.copyTo(d.kf_desc);
+  }
+}
+
+
+#else
+
+struct StereoLineTracker::Impl final {};
+
+
+StereoLineTracker::StereoLineTracker(const Params&, const StereoCamera&)
+{
+  LOG(FATAL) << "StereoLineTracker is unavailable, build with BM_ENABLE_LINE_FEATURES" << std::endl;
+}
+
+
+StereoLineTracker::~StereoLineTracker() = default;
+
+
+void StereoLineTracker::Detect(const StereoImage1b&)
+{
+  LOG(FATAL) << "StereoLineTracker is unavailable, build with BM_ENABLE_LINE_FEATURES" << std::endl;
+}
+
+
+void StereoLineTracker::Associate(uid_t, bool, VecLineObservation&)
+{
+  LOG(FATAL) << "StereoLineTracker is unavailable, build with BM_ENABLE_LINE_FEATURES" << std::endl;
+}
+
+#endif
+
+
+void StereoLineTracker::Track(const StereoImage1b& stereo_pair,
+                              bool is_keyframe,
+                              VecLineObservation& line_obs)
+{
+  Detect(stereo_pair);
+  Associate(stereo_pair.camera_id, is_keyframe, line_obs);
+}
+
+
+}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+#include "params/params_base.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_image.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/line_observation.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+
+// Detects line segments (LSD) in each stereo pair, matches them across the stereo pair with LBD
+// descriptors, and associates them with the lines from the last keyframe. New line landmarks are
+// only created on keyframes, like points. Structure underwater (pipes, hull plates) often has many
+// more lines than corners, so lines can still be observed when there are few points.
+//
+// Detect() and Associate() are split so that detection can run on a different thread than point
+// tracking (see StereoFrontend), since it doesn't depend on the keyframe decision.
+//
+// NOTE(milo): Only implemented when built with BM_ENABLE_LINE_FEATURES, since it needs OpenCV's
+// line_descriptor module (contrib). Otherwise, constructing one is a fatal error.
+class StereoLineTracker final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int max_lines_per_frame = 40;         // The longest lines in the left image are kept.
+    double min_line_length = 30.0;        // px
+    double min_line_dy = 10.0;            // px, shorter vertical extents have unreliable disparity.
+    int detect_downsample = 1;            // Run LSD on images downsampled by this much (faster).
+
+    double stereo_max_depth = 30.0;
+    double stereo_min_depth = 0.5;
+    int stereo_max_desc_dist = 60;        // Hamming distance between LBD descriptors (256 bits).
+    double stereo_max_angle_deg = 10.0;   // Max angle between left and right segments.
+
+    int track_max_desc_dist = 50;         // Hamming distance to the keyframe's descriptor.
+    double track_max_px = 80.0;           // Max distance between midpoints since the keyframe.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(StereoLineTracker);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(StereoLineTracker);
+
+  StereoLineTracker(const Params& params, const StereoCamera& stereo_rig);
+  ~StereoLineTracker();
+
+  // Detects lines in both images (in parallel) and matches them across the stereo pair. Only the
+  // stereo matched lines are kept, up to max_lines_per_frame.
+  void Detect(const StereoImage1b& stereo_pair);
+
+  // Associates the lines from the last Detect() with the last keyframe's lines, and appends an
+  // observation for each one to line_obs. If is_keyframe, unassociated lines become new line
+  // landmarks, and this frame becomes the keyframe that later frames are associated with.
+  void Associate(uid_t camera_id, bool is_keyframe, VecLineObservation& line_obs);
+
+  // Equivalent to Detect() and then Associate().
+  void Track(const StereoImage1b& stereo_pair, bool is_keyframe, VecLineObservation& line_obs);
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+
+}
+}
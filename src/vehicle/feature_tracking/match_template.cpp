@@ -0,0 +1,178 @@
+#include <cmath>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "feature_tracking/match_template.hpp"
+
+namespace bm {
+namespace ft {
+
+
+// acc[dx] += (t - s[dx])^2 for every dx in [0, N).
+static inline void AccumulateSqDiff(uint8_t t, const uint8_t* s, int N, uint32_t* acc)
+{
+  int dx = 0;
+
+#if defined(__AVX2__)
+  const __m256i tv = _mm256_set1_epi16(t);
+  for (; dx + 16 <= N; dx += 16) {
+    const __m256i sv = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + dx)));
+    const __m256i d = _mm256_sub_epi16(sv, tv);
+
+    // NOTE(milo): d*d <= 255^2, which fits in an UNSIGNED 16-bit integer, so the low 16 bits of the
+    // product are exact as long as they're widened as unsigned.
+    const __m256i d2 = _mm256_mullo_epi16(d, d);
+    const __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d2));
+    const __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d2, 1));
+
+    __m256i* acc_lo = reinterpret_cast<__m256i*>(acc + dx);
+    __m256i* acc_hi = reinterpret_cast<__m256i*>(acc + dx + 8);
+    _mm256_storeu_si256(acc_lo, _mm256_add_epi32(_mm256_loadu_si256(acc_lo), lo));
+    _mm256_storeu_si256(acc_hi, _mm256_add_epi32(_mm256_loadu_si256(acc_hi), hi));
+  }
+#elif defined(__ARM_NEON)
+  const uint8x8_t tv = vdup_n_u8(t);
+  for (; dx + 8 <= N; dx += 8) {
+    const uint8x8_t d = vabd_u8(vld1_u8(s + dx), tv);
+    const uint16x8_t d2 = vmull_u8(d, d);
+    vst1q_u32(acc + dx, vaddw_u16(vld1q_u32(acc + dx), vget_low_u16(d2)));
+    vst1q_u32(acc + dx + 4, vaddw_u16(vld1q_u32(acc + dx + 4), vget_high_u16(d2)));
+  }
+#endif
+
+  for (; dx < N; ++dx) {
+    const int d = (int)s[dx] - (int)t;
+    acc[dx] += (uint32_t)(d * d);
+  }
+}
+
+
+// The matcher for templates of kRows x kCols, or of any size if both are zero. With a fixed size,
+// the template is copied into a buffer on the stack, and the loops over it have constant trip
+// counts, so the compiler fully unrolls them (and keeps the row pointers in registers).
+template <int kRows, int kCols>
+static float MatchTemplateImpl(const uint8_t* templ, int templ_step, int templ_rows, int templ_cols,
+                               const uint8_t* stripe, int stripe_step, int stripe_rows, int stripe_cols,
+                               MatchTemplateWorkspace& workspace,
+                               int& best_x, int& best_y)
+{
+  static_assert((kRows > 0) == (kCols > 0), "Specialize both template dimensions, or neither");
+  static const bool kFixed = kRows > 0;
+
+  const int R = kFixed ? kRows : templ_rows;
+  const int C = kFixed ? kCols : templ_cols;
+  CHECK(R == templ_rows && C == templ_cols) << "Template size doesn't match the kernel" << std::endl;
+
+  CHECK(stripe_rows >= R && stripe_cols >= C)
+      << "Stripe must be at least as large as the template" << std::endl;
+
+  uint8_t templ_buf[kFixed ? kRows : 1][kFixed ? kCols : 1];
+  if (kFixed) {
+    for (int r = 0; r < R; ++r) {
+      std::memcpy(templ_buf[r], templ + r * templ_step, C);
+    }
+    templ = &templ_buf[0][0];
+    templ_step = C;
+  }
+
+  const int num_dx = stripe_cols - C + 1;
+  const int num_dy = stripe_rows - R + 1;
+
+  workspace.ssd.assign(num_dx * num_dy, 0);
+  workspace.col_sq.resize(stripe_cols);
+
+  // Sum of squared differences for every offset. For each template pixel, accumulate its
+  // contribution to all of the horizontal offsets at once (contiguous, so it vectorizes).
+  for (int dy = 0; dy < num_dy; ++dy) {
+    uint32_t* ssd_row = &workspace.ssd[dy * num_dx];
+    for (int r = 0; r < R; ++r) {
+      const uint8_t* t_row = templ + r * templ_step;
+      const uint8_t* s_row = stripe + (dy + r) * stripe_step;
+      for (int c = 0; c < C; ++c) {
+        AccumulateSqDiff(t_row[c], s_row + c, num_dx, ssd_row);
+      }
+    }
+  }
+
+  // Sum of squared template pixels (the same for every offset).
+  double templ_sq = 0;
+  for (int r = 0; r < R; ++r) {
+    for (int c = 0; c < C; ++c) {
+      const double v = templ[r * templ_step + c];
+      templ_sq += v * v;
+    }
+  }
+
+  float best_cost = 2.0f;
+  best_x = 0;
+  best_y = 0;
+
+  for (int dy = 0; dy < num_dy; ++dy) {
+    // Sum of squared stripe pixels in each column of the window at this dy.
+    std::memset(workspace.col_sq.data(), 0, stripe_cols * sizeof(uint32_t));
+    for (int r = 0; r < R; ++r) {
+      const uint8_t* s_row = stripe + (dy + r) * stripe_step;
+      for (int x = 0; x < stripe_cols; ++x) {
+        workspace.col_sq[x] += (uint32_t)s_row[x] * (uint32_t)s_row[x];
+      }
+    }
+
+    // Slide the window horizontally to get the sum over each (templ_rows x templ_cols) window.
+    uint64_t window_sq = 0;
+    for (int x = 0; x < C; ++x) {
+      window_sq += workspace.col_sq[x];
+    }
+
+    for (int dx = 0; dx < num_dx; ++dx) {
+      if (dx > 0) {
+        window_sq += workspace.col_sq[dx + C - 1];
+        window_sq -= workspace.col_sq[dx - 1];
+      }
+
+      // Same normalization and clamping as cv::matchTemplate.
+      const double num = workspace.ssd[dy * num_dx + dx];
+      const double denom = std::sqrt(templ_sq * (double)window_sq);
+      const float cost = (num < denom) ? (float)(num / denom) : 1.0f;
+
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_x = dx;
+        best_y = dy;
+      }
+    }
+  }
+
+  return best_cost;
+}
+
+
+float MatchTemplateSqDiffNormed(const uint8_t* templ, int templ_step, int templ_rows, int templ_cols,
+                                const uint8_t* stripe, int stripe_step, int stripe_rows, int stripe_cols,
+                                MatchTemplateWorkspace& workspace,
+                                int& best_x, int& best_y)
+{
+  return MatchTemplateImpl<0, 0>(templ, templ_step, templ_rows, templ_cols,
+                                 stripe, stripe_step, stripe_rows, stripe_cols,
+                                 workspace, best_x, best_y);
+}
+
+
+MatchTemplateFn SelectMatchTemplateKernel(int templ_rows, int templ_cols)
+{
+  // The sizes that our configs use.
+  if (templ_rows == 11 && templ_cols == 31) { return &MatchTemplateImpl<11, 31>; }
+  if (templ_rows == 21 && templ_cols == 21) { return &MatchTemplateImpl<21, 21>; }
+  if (templ_rows == 31 && templ_cols == 31) { return &MatchTemplateImpl<31, 31>; }
+  return &MatchTemplateSqDiffNormed;
+}
+
+
+}
+}
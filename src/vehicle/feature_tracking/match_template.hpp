@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace bm {
+namespace ft {
+
+
+// Reusable scratch memory for MatchTemplateSqDiffNormed(), so that matching many keypoints
+// doesn't allocate anything after the first call.
+struct MatchTemplateWorkspace final
+{
+  std::vector<uint32_t> ssd;        // Sum of squared differences at each (dx, dy) offset.
+  std::vector<uint32_t> col_sq;     // Column sums of squared stripe pixels (over templ_rows).
+};
+
+
+// Equivalent to cv::matchTemplate(stripe, templ, result, CV_TM_SQDIFF_NORMED) followed by
+// cv::minMaxLoc(), but without allocating a result image. The inner loops use AVX2 or NEON when
+// the compiler has them enabled (-march=native), with a plain C++ fallback.
+//
+// Images are 8-bit, row-major, with a step (bytes per row) that may be larger than their width.
+// The stripe must be at least as large as the template in both dimensions. Returns the minimum
+// cost (in [0, 1], like OpenCV) and sets (best_x, best_y) to the top-left offset of the template
+// in the stripe. Ties go to the first location in row-major order (same as cv::minMaxLoc).
+float MatchTemplateSqDiffNormed(const uint8_t* templ, int templ_step, int templ_rows, int templ_cols,
+                                const uint8_t* stripe, int stripe_step, int stripe_rows, int stripe_cols,
+                                MatchTemplateWorkspace& workspace,
+                                int& best_x, int& best_y);
+
+
+typedef float (*MatchTemplateFn)(const uint8_t* templ, int templ_step, int templ_rows, int templ_cols,
+                                 const uint8_t* stripe, int stripe_step, int stripe_rows, int stripe_cols,
+                                 MatchTemplateWorkspace& workspace,
+                                 int& best_x, int& best_y);
+
+
+// Returns a MatchTemplateSqDiffNormed() that is compiled for templ_rows x templ_cols templates (with
+// the loops over the template fully unrolled), or MatchTemplateSqDiffNormed() itself if there isn't
+// one for that size. The returned function only accepts templates of that size.
+MatchTemplateFn SelectMatchTemplateKernel(int templ_rows, int templ_cols);
+
+
+}
+}
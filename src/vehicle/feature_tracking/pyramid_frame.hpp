@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/uid.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+// Output of cv::buildOpticalFlowPyramid (images, interleaved with their derivatives).
+typedef std::vector<cv::Mat> ImagePyramid;
+
+
+// An image along with its optical flow pyramid (see FeatureTracker::BuildPyramid). Storing these
+// together means the pyramid is built once per image, no matter how many times it's tracked
+// against (forward/backward, and from frames of different ages).
+struct PyramidFrame final
+{
+  Image1b image;
+  ImagePyramid pyramid;
+  uid_t camera_id = 0;
+
+  // Orientation of the camera, chained together from the rotation priors given to the tracker.
+  // The reference frame is arbitrary, so only the rotation between two frames is meaningful, and
+  // only if has_rotation_prior is set for every frame after the older one.
+  Matrix3d ref_R_cam = Matrix3d::Identity();
+  bool has_rotation_prior = false;    // Is ref_R_cam chained from the previous frame's?
+};
+
+
+}
+}
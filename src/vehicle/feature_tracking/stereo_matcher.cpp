@@ -1,8 +1,15 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
 #include <glog/logging.h>
 
 #include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/video/tracking.hpp"
 
 #include "feature_tracking/stereo_matcher.hpp"
+#include "feature_tracking/match_template.hpp"
+#include "core/profiler.hpp"
 
 namespace bm {
 namespace ft {
@@ -16,12 +23,66 @@ void StereoMatcher::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("max_matching_cost", &max_matching_cost);
   parser.GetParam("bidirectional", &bidirectional);
   parser.GetParam("subpixel_refinement", &subpixel_refinement);
+  parser.GetParam("prior_band_px", &prior_band_px);
+
+  int mode_int = 0;
+  parser.GetParam("mode", &mode_int);
+  CHECK(mode_int == 0 || mode_int == 1) << "StereoMatcher mode must be 0 (TEMPLATE) or 1 (KLT)" << std::endl;
+  mode = static_cast<Mode>(mode_int);
+  parser.GetParam("klt_winsize", &klt_winsize);
+  parser.GetParam("klt_max_level", &klt_max_level);
+  parser.GetParam("klt_maxiters", &klt_maxiters);
+  parser.GetParam("klt_max_dy", &klt_max_dy);
+  parser.GetParam("klt_init_disp", &klt_init_disp);
+
+  CHECK_GE(prior_band_px, 0);
+  CHECK_GE(klt_winsize, 3);
+  CHECK_GE(klt_max_level, 0);
+  CHECK_GT(klt_maxiters, 0);
+  CHECK_GE(klt_max_dy, 0);
+  CHECK_GE(klt_init_disp, 0);
 }
 
 
 double StereoMatcher::MatchRectified(const Image1b& left_rectified,
                                      const Image1b& right_rectified,
                                      const cv::Point2f& left_keypoint)
+{
+  if (params_.mode == Mode::KLT) {
+    return MatchRectified(left_rectified, right_rectified, VecPoint2f{ left_keypoint }).at(0);
+  }
+  return Match(left_rectified, right_rectified, left_keypoint, -1.0, -1);
+}
+
+
+double StereoMatcher::MatchRectifiedWithPrior(const Image1b& left_rectified,
+                                              const Image1b& right_rectified,
+                                              const cv::Point2f& left_keypoint,
+                                              double disp_prior)
+{
+  if (params_.mode == Mode::KLT) {
+    return MatchRectifiedWithPrior(left_rectified, right_rectified, VecPoint2f{ left_keypoint }, { disp_prior }).at(0);
+  }
+
+  if (disp_prior <= 0 || params_.prior_band_px <= 0) {
+    return Match(left_rectified, right_rectified, left_keypoint, -1.0, -1);
+  }
+
+  const double disp = Match(left_rectified, right_rectified, left_keypoint, disp_prior, params_.prior_band_px);
+  if (disp >= 0) {
+    return disp;
+  }
+
+  ++num_prior_fallbacks_;
+  return Match(left_rectified, right_rectified, left_keypoint, -1.0, -1);
+}
+
+
+double StereoMatcher::Match(const Image1b& left_rectified,
+                            const Image1b& right_rectified,
+                            const cv::Point2f& left_keypoint,
+                            double disp_prior,
+                            int band_px)
 {
   // Add +/- 1 extra pixel to the stripe to account for rectification error.
   const int stripe_rows = params_.templ_rows + 2;
@@ -65,28 +126,42 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
   if (stripe_corner_y < 0 || (stripe_corner_y + stripe_rows) >= right_rectified.rows) {
     return -1.0;
   }
-  int offset_stripe = 0;
-  int stripe_corner_x = rounded_lkp_x + (params_.templ_cols - 1) / 2 - params_.max_disp;
-  if (stripe_corner_x + params_.max_disp > right_rectified.cols - 1) {
-    offset_stripe = (stripe_corner_x + params_.max_disp) - (right_rectified.cols - 1);
-    stripe_corner_x -= offset_stripe;
-  }
-  if (stripe_corner_x < 0) {
-    stripe_corner_x = 0;
+  const bool use_band = band_px >= 0;
+  int stripe_corner_x = 0;
+  int stripe_cols = params_.max_disp;
+
+  if (use_band) {
+    // The patch center should match within +/- band_px of where the prior puts it.
+    const int half_cols = (params_.templ_cols - 1) / 2;
+    const int predicted_x = templ_topleft_x + half_cols - (int)std::round(disp_prior);
+    stripe_corner_x = std::max(0, predicted_x - band_px - half_cols);
+    const int stripe_end_x = std::min(right_rectified.cols - 1, predicted_x + band_px + half_cols + 1);
+    stripe_cols = stripe_end_x - stripe_corner_x;
+    if (stripe_cols < params_.templ_cols) {
+      return -1.0;
+    }
+  } else {
+    int offset_stripe = 0;
+    stripe_corner_x = rounded_lkp_x + (params_.templ_cols - 1) / 2 - params_.max_disp;
+    if (stripe_corner_x + params_.max_disp > right_rectified.cols - 1) {
+      offset_stripe = (stripe_corner_x + params_.max_disp) - (right_rectified.cols - 1);
+      stripe_corner_x -= offset_stripe;
+    }
+    if (stripe_corner_x < 0) {
+      stripe_corner_x = 0;
+    }
   }
 
-  cv::Rect stripe_rect = cv::Rect(stripe_corner_x, stripe_corner_y, params_.max_disp, stripe_rows);
+  cv::Rect stripe_rect = cv::Rect(stripe_corner_x, stripe_corner_y, stripe_cols, stripe_rows);
   cv::Mat stripe(right_rectified, stripe_rect);
 
-  cv::Mat result;
-  cv::matchTemplate(stripe, patch, result, CV_TM_SQDIFF_NORMED);
-
-  // Find the location of best match.
-  double minVal;
-  double maxVal;
   cv::Point minLoc;
-  cv::Point maxLoc;
-  cv::minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc, cv::Mat());
+  const double minVal = MatchPatch(patch, stripe, minLoc);
+
+  // A minimum on the edge of the band might just be the slope down to a better match outside of it.
+  if (use_band && (minLoc.x == 0 || minLoc.x == (stripe_cols - params_.templ_cols))) {
+    return -1.0;
+  }
 
   cv::Point matchLoc = minLoc;
   matchLoc.x += stripe_corner_x + (params_.templ_cols - 1) / 2 + offset_x;
@@ -107,6 +182,18 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
   const bool has_good_matching_score = minVal < params_.max_matching_cost;
   const bool match_is_to_the_left = left_keypoint.x >= match_px.x;
 
+  // Match the right patch back into the left image, and make sure that it ends up where it started.
+  // NOTE(milo): The right patch is centered where the LEFT patch center matched, so compare with the
+  // left patch center (not the keypoint, which can be offset from it near the image border).
+  if (params_.bidirectional && has_good_matching_score && match_is_to_the_left) {
+    const int right_patch_x = stripe_corner_x + minLoc.x;
+    const int right_patch_y = stripe_corner_y + minLoc.y;
+    const int left_center_x = templ_topleft_x + (params_.templ_cols - 1) / 2;
+    if (!CheckBackwardMatch(left_rectified, right_rectified, right_patch_x, right_patch_y, left_center_x)) {
+      return -1.0;
+    }
+  }
+
   if (has_good_matching_score && match_is_to_the_left) {
     const float disp = left_keypoint.x - match_px.x;
     return disp;
@@ -116,10 +203,59 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
 }
 
 
+double StereoMatcher::MatchPatch(const cv::Mat& patch, const cv::Mat& stripe, cv::Point& best_loc)
+{
+  // NOTE(milo): Same cost as cv::matchTemplate(CV_TM_SQDIFF_NORMED), but reuses workspace_ instead
+  // of allocating a result image for every keypoint.
+  return match_fn_(
+      patch.ptr<uint8_t>(), (int)patch.step, patch.rows, patch.cols,
+      stripe.ptr<uint8_t>(), (int)stripe.step, stripe.rows, stripe.cols,
+      workspace_, best_loc.x, best_loc.y);
+}
+
+
+bool StereoMatcher::CheckBackwardMatch(const Image1b& left_rectified,
+                                       const Image1b& right_rectified,
+                                       int right_patch_x,
+                                       int right_patch_y,
+                                       int left_center_x)
+{
+  const int stripe_rows = params_.templ_rows + 2;
+  const int stripe_corner_y = right_patch_y - 1;
+
+  // A matching point in the left image must be to the right of the right patch.
+  const int stripe_corner_x = right_patch_x;
+  const int stripe_cols = std::min(params_.max_disp, left_rectified.cols - stripe_corner_x);
+
+  // If the backward search doesn't fit in the image, there's no way to check the match.
+  if (stripe_corner_y < 0 || (stripe_corner_y + stripe_rows) >= left_rectified.rows ||
+      (right_patch_x + params_.templ_cols) > right_rectified.cols ||
+      stripe_cols < params_.templ_cols) {
+    return false;
+  }
+
+  const cv::Mat patch(right_rectified, cv::Rect(right_patch_x, right_patch_y, params_.templ_cols, params_.templ_rows));
+  const cv::Mat stripe(left_rectified, cv::Rect(stripe_corner_x, stripe_corner_y, stripe_cols, stripe_rows));
+
+  cv::Point loc;
+  MatchPatch(patch, stripe, loc);
+
+  const int back_center_x = stripe_corner_x + loc.x + (params_.templ_cols - 1) / 2;
+  return std::abs(back_center_x - left_center_x) <= 1;
+}
+
+
 std::vector<double> StereoMatcher::MatchRectified(const Image1b& left_rectified,
                                                   const Image1b& right_rectified,
                                                   const VecPoint2f& left_keypoints)
 {
+  MACRO_PROFILE_SCOPE("StereoMatcher::MatchRectified");
+  if (params_.mode == Mode::KLT) {
+    BuildKltPyramid(left_rectified, left_pyramid_);
+    BuildKltPyramid(right_rectified, right_pyramid_);
+    return MatchKlt(left_pyramid_, right_pyramid_, left_keypoints, std::vector<double>());
+  }
+
   std::vector<double> out(left_keypoints.size(), -1.0);
 
   for (size_t i = 0; i < left_keypoints.size(); ++i) {
@@ -130,5 +266,133 @@ std::vector<double> StereoMatcher::MatchRectified(const Image1b& left_rectified,
 }
 
 
+std::vector<double> StereoMatcher::MatchRectifiedWithPrior(const Image1b& left_rectified,
+                                                           const Image1b& right_rectified,
+                                                           const VecPoint2f& left_keypoints,
+                                                           const std::vector<double>& disp_priors)
+{
+  MACRO_PROFILE_SCOPE("StereoMatcher::MatchRectifiedWithPrior");
+  CHECK_EQ(left_keypoints.size(), disp_priors.size());
+  if (params_.mode == Mode::KLT) {
+    BuildKltPyramid(left_rectified, left_pyramid_);
+    BuildKltPyramid(right_rectified, right_pyramid_);
+    return MatchKlt(left_pyramid_, right_pyramid_, left_keypoints, disp_priors);
+  }
+
+  std::vector<double> out(left_keypoints.size(), -1.0);
+
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    out.at(i) = MatchRectifiedWithPrior(left_rectified, right_rectified, left_keypoints.at(i), disp_priors.at(i));
+  }
+
+  return out;
+}
+
+
+std::vector<double> StereoMatcher::MatchRectifiedWithPrior(const ImagePyramid& left_pyramid,
+                                                           const ImagePyramid& right_pyramid,
+                                                           const VecPoint2f& left_keypoints,
+                                                           const std::vector<double>& disp_priors)
+{
+  CHECK(!left_pyramid.empty() && !right_pyramid.empty());
+
+  if (params_.mode == Mode::TEMPLATE) {
+    return MatchRectifiedWithPrior(left_pyramid.at(0), right_pyramid.at(0), left_keypoints, disp_priors);
+  }
+
+  MACRO_PROFILE_SCOPE("StereoMatcher::MatchRectifiedWithPrior");
+  CHECK_EQ(left_keypoints.size(), disp_priors.size());
+
+  // NOTE(milo): Both pyramids have to come from the same place, so rebuild them together.
+  if (!IsUsableKltPyramid(left_pyramid) || !IsUsableKltPyramid(right_pyramid)) {
+    BuildKltPyramid(left_pyramid.at(0), left_pyramid_);
+    BuildKltPyramid(right_pyramid.at(0), right_pyramid_);
+    return MatchKlt(left_pyramid_, right_pyramid_, left_keypoints, disp_priors);
+  }
+
+  return MatchKlt(left_pyramid, right_pyramid, left_keypoints, disp_priors);
+}
+
+
+std::vector<double> StereoMatcher::MatchKlt(const ImagePyramid& left_pyramid,
+                                            const ImagePyramid& right_pyramid,
+                                            const VecPoint2f& left_keypoints,
+                                            const std::vector<double>& disp_priors)
+{
+  std::vector<double> out(left_keypoints.size(), -1.0);
+  if (left_keypoints.empty()) {
+    return out;
+  }
+
+  // Rectified, so the match should be on the same row, disp pixels to the left.
+  right_keypoints_.resize(left_keypoints.size());
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    const double prior = disp_priors.empty() ? 0.0 : disp_priors.at(i);
+    const double disp = (prior > 0) ? prior : params_.klt_init_disp;
+    right_keypoints_.at(i) = cv::Point2f(left_keypoints.at(i).x - disp, left_keypoints.at(i).y);
+  }
+
+  const cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, params_.klt_maxiters, 0.001);
+  const cv::Size winsize(params_.klt_winsize, params_.klt_winsize);
+
+  cv::calcOpticalFlowPyrLK(left_pyramid, right_pyramid, left_keypoints, right_keypoints_,
+                           status_, error_, winsize, params_.klt_max_level, criteria,
+                           cv::OPTFLOW_USE_INITIAL_FLOW);
+
+  if (params_.bidirectional) {
+    left_keypoints_bkw_ = left_keypoints;
+    cv::calcOpticalFlowPyrLK(right_pyramid, left_pyramid, right_keypoints_, left_keypoints_bkw_,
+                             status_bkw_, error_, winsize, params_.klt_max_level, criteria,
+                             cv::OPTFLOW_USE_INITIAL_FLOW);
+  }
+
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    const cv::Point2f& left_kp = left_keypoints.at(i);
+    const cv::Point2f& right_kp = right_keypoints_.at(i);
+    const double disp = left_kp.x - right_kp.x;
+
+    if (!status_.at(i) ||
+        std::fabs(right_kp.y - left_kp.y) > params_.klt_max_dy ||
+        disp <= 0 || disp > params_.max_disp) {
+      continue;
+    }
+
+    if (params_.bidirectional) {
+      const cv::Point2f d = left_keypoints_bkw_.at(i) - left_kp;
+      if (!status_bkw_.at(i) || (d.x*d.x + d.y*d.y) > 1.0) {
+        continue;
+      }
+    }
+
+    out.at(i) = disp;
+  }
+
+  return out;
+}
+
+
+void StereoMatcher::BuildKltPyramid(const cv::Mat& image, ImagePyramid& pyramid) const
+{
+  // NOTE(milo): Same options as FeatureTracker::BuildPyramid(), so that its pyramids are usable.
+  cv::buildOpticalFlowPyramid(image, pyramid, cv::Size(params_.klt_winsize, params_.klt_winsize),
+                              params_.klt_max_level, true, cv::BORDER_REFLECT_101, cv::BORDER_CONSTANT, false);
+}
+
+
+bool StereoMatcher::IsUsableKltPyramid(const ImagePyramid& pyramid) const
+{
+  // With derivatives, there's an image and a derivative image per level.
+  if (pyramid.size() < 2) {
+    return false;
+  }
+
+  // calcOpticalFlowPyrLK needs a border of at least the window size around each level.
+  cv::Size whole_size;
+  cv::Point offset;
+  pyramid.at(0).locateROI(whole_size, offset);
+  return offset.x >= params_.klt_winsize && offset.y >= params_.klt_winsize;
+}
+
+
 }
 }
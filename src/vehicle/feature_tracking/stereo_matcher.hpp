@@ -5,6 +5,8 @@
 #include "params/params_base.hpp"
 #include "core/macros.hpp"
 #include "vision_core/cv_types.hpp"
+#include "feature_tracking/match_template.hpp"
+#include "feature_tracking/pyramid_frame.hpp"
 
 namespace bm {
 namespace ft {
@@ -14,17 +16,42 @@ using namespace core;
 
 class StereoMatcher final {
  public:
+  // How left keypoints are found in the right image.
+  enum class Mode
+  {
+    TEMPLATE = 0,   // Search along the row for the best matching template (up to max_disp).
+    KLT = 1         // Track each keypoint into the right image with pyramidal Lucas-Kanade.
+  };
+
   struct Params final : public ParamsBase
   {
     MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
 
+    Mode mode = Mode::TEMPLATE;
+
     int templ_cols = 31;                // Width of patch
     int templ_rows = 11;                // Height of patch
     int max_disp = 128;                 // disp = fx * B / depth
     double max_matching_cost = 0.15;    // Maximum matching cost considered valid
-    bool bidirectional = false;
+    bool bidirectional = false;         // Reject matches that don't match back to the left patch.
     bool subpixel_refinement = false;
 
+    // When a disparity prior is given (e.g from a tracked landmark), only search within +/- this many
+    // pixels of it first. Zero always does the full max_disp search.
+    int prior_band_px = 8;
+
+    // KLT mode: much cheaper than a max_disp wide template search, and subpixel without any
+    // refinement. Tracking starts from the disparity prior (or klt_init_disp if there isn't one),
+    // and a match fails if it ends up more than klt_max_dy off of the keypoint's row. With
+    // bidirectional, the match is tracked back into the left image and has to land within a pixel.
+    // NOTE(milo): templ_*, max_matching_cost, subpixel_refinement and prior_band_px are only used in
+    // TEMPLATE mode, but max_disp still rejects matches.
+    int klt_winsize = 21;
+    int klt_max_level = 3;
+    int klt_maxiters = 20;
+    double klt_max_dy = 1.0;
+    double klt_init_disp = 0.0;
+
    private:
     void LoadParams(const YamlParser& parser) override;
   };
@@ -32,7 +59,10 @@ class StereoMatcher final {
   MACRO_DELETE_COPY_CONSTRUCTORS(StereoMatcher)
   MACRO_DELETE_DEFAULT_CONSTRUCTOR(StereoMatcher)
 
-  explicit StereoMatcher(const Params& params) : params_(params) {}
+  // Picks a matching kernel that is specialized for the template size, if there is one.
+  explicit StereoMatcher(const Params& params)
+      : params_(params),
+        match_fn_(SelectMatchTemplateKernel(params.templ_rows, params.templ_cols)) {}
 
   // Uses template-matching to find a left_keypoint in the right image (horizontal search).
   double MatchRectified(const Image1b& left_rectified,
@@ -40,12 +70,86 @@ class StereoMatcher final {
                         const cv::Point2f& left_keypoint);
 
   // Match a set of keypoints in the left image (calls member function above).
+  // NOTE(milo): All of the keypoints share the same scratch memory, so this doesn't allocate
+  // anything per keypoint.
   std::vector<double> MatchRectified(const Image1b& left_rectified,
                                      const Image1b& right_rectified,
                                      const VecPoint2f& left_keypoints);
 
+  // Like MatchRectified(), but searches a narrow band around disp_prior (see prior_band_px) first.
+  // Falls back to the full search if there's no good match in the band, or the best one is on its
+  // edge (so the true match is probably outside of it). A disp_prior <= 0 means there is no prior.
+  double MatchRectifiedWithPrior(const Image1b& left_rectified,
+                                 const Image1b& right_rectified,
+                                 const cv::Point2f& left_keypoint,
+                                 double disp_prior);
+
+  // Match a set of keypoints, each with its own disparity prior.
+  std::vector<double> MatchRectifiedWithPrior(const Image1b& left_rectified,
+                                              const Image1b& right_rectified,
+                                              const VecPoint2f& left_keypoints,
+                                              const std::vector<double>& disp_priors);
+
+  // Same as MatchRectifiedWithPrior(), but with the optical flow pyramids of the rectified images
+  // (see FeatureTracker::BuildPyramid), so that KLT mode can use the pyramids that the frame has
+  // cached already. Pairs of pyramids that were built with a smaller window than klt_winsize (or
+  // without derivatives) are rebuilt. TEMPLATE mode only uses the full resolution images.
+  std::vector<double> MatchRectifiedWithPrior(const ImagePyramid& left_pyramid,
+                                              const ImagePyramid& right_pyramid,
+                                              const VecPoint2f& left_keypoints,
+                                              const std::vector<double>& disp_priors);
+
+  // Number of prior searches so far that had to fall back to the full search.
+  int NumPriorFallbacks() const { return num_prior_fallbacks_; }
+
+  const Params& GetParams() const { return params_; }
+
+ private:
+  // Searches the full stripe if band_px < 0, or +/- band_px around disp_prior otherwise.
+  double Match(const Image1b& left_rectified,
+               const Image1b& right_rectified,
+               const cv::Point2f& left_keypoint,
+               double disp_prior,
+               int band_px);
+
+  // Find the best match for patch in stripe. Returns the cost and the top-left of the match.
+  double MatchPatch(const cv::Mat& patch, const cv::Mat& stripe, cv::Point& best_loc);
+
+  // Searches for the right patch (top-left corner given) in the left image, and returns whether it
+  // matches back to within a pixel of left_center_x.
+  bool CheckBackwardMatch(const Image1b& left_rectified,
+                          const Image1b& right_rectified,
+                          int right_patch_x,
+                          int right_patch_y,
+                          int left_center_x);
+
+  // Tracks the keypoints into the right image (KLT mode). A disparity prior <= 0 (or none at all)
+  // starts from klt_init_disp.
+  std::vector<double> MatchKlt(const ImagePyramid& left_pyramid,
+                               const ImagePyramid& right_pyramid,
+                               const VecPoint2f& left_keypoints,
+                               const std::vector<double>& disp_priors);
+
+  // Builds a pyramid for KLT mode, reusing the memory in pyramid.
+  void BuildKltPyramid(const cv::Mat& image, ImagePyramid& pyramid) const;
+
+  // Can calcOpticalFlowPyrLK use this pyramid with klt_winsize?
+  bool IsUsableKltPyramid(const ImagePyramid& pyramid) const;
+
  private:
   Params params_;
+  MatchTemplateFn match_fn_;
+  MatchTemplateWorkspace workspace_;
+  int num_prior_fallbacks_ = 0;
+
+  // KLT mode scratch memory.
+  ImagePyramid left_pyramid_;
+  ImagePyramid right_pyramid_;
+  VecPoint2f right_keypoints_;
+  VecPoint2f left_keypoints_bkw_;
+  std::vector<uchar> status_;
+  std::vector<uchar> status_bkw_;
+  std::vector<float> error_;
 };
 
 }
@@ -1,9 +1,13 @@
+#include <algorithm>
+#include <cmath>
+
 #include <glog/logging.h>
 
 #include <opencv2/imgproc.hpp>
 
 #include "vision_core/image_util.hpp"
 #include "core/math_util.hpp"
+#include "core/profiler.hpp"
 #include "feature_tracking/visualization_2d.hpp"
 #include "feature_tracking/stereo_tracker.hpp"
 
@@ -21,186 +25,638 @@ void StereoTracker::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("stereo_max_depth", &stereo_max_depth);
   parser.GetParam("stereo_min_depth", &stereo_min_depth);
   parser.GetParam("retrack_frames_k", &retrack_frames_k);
+  parser.GetParam("klt_num_threads", &klt_num_threads);
   parser.GetParam("trigger_keyframe_min_lmks", &trigger_keyframe_min_lmks);
   parser.GetParam("trigger_keyframe_k", &trigger_keyframe_k);
+  parser.GetParam("max_obs_per_track", &max_obs_per_track);
+  parser.GetParam("depth_filter_rematch_k", &depth_filter_rematch_k);
+  parser.GetParam("depth_filter_max_stdev_px", &depth_filter_max_stdev_px);
+  parser.GetParam("depth_filter_meas_stdev_px", &depth_filter_meas_stdev_px);
+  parser.GetParam("depth_filter_process_stdev_px", &depth_filter_process_stdev_px);
+  parser.GetParam("depth_filter_gate_sigma", &depth_filter_gate_sigma);
+  parser.GetParam("async_keyframe_detection", &async_keyframe_detection);
+  parser.GetParam("track_deadline_ms", &track_deadline_ms);
+  parser.GetParam("deadline_chunk_size", &deadline_chunk_size);
+  parser.GetParam("deadline_min_lmks", &deadline_min_lmks);
+  parser.GetParam("deadline_grid_cells", &deadline_grid_cells);
 
   CHECK(retrack_frames_k >= 1 && retrack_frames_k < 8);
+  CHECK_GE(max_obs_per_track, 2 * (trigger_keyframe_k + 1))
+      << "Tracks must keep enough observations to reach back to the previous keyframe" << std::endl;
+  CHECK_GE(klt_num_threads, 0);
+  CHECK_GE(depth_filter_rematch_k, 1);
+  CHECK_GT(depth_filter_meas_stdev_px, 0);
+  CHECK_GE(depth_filter_process_stdev_px, 0);
+  CHECK_GT(depth_filter_gate_sigma, 0);
+  CHECK_GE(track_deadline_ms, 0);
+  CHECK_GT(deadline_chunk_size, 0);
+  CHECK_GE(deadline_min_lmks, 0);
+  CHECK_GT(deadline_grid_cells, 0);
 }
 
 
-bool StereoTracker::TrackAndTriangulate(const StereoImage1b& stereo_pair, bool force_keyframe)
+StereoTracker::~StereoTracker()
 {
-  std::unordered_map<int, std::vector<uid_t>> live_lmk_ids_k_ago;
-  std::unordered_map<int, VecPoint2f> live_lmk_pts_k_ago;
-  for (int k = 0; k <= params_.retrack_frames_k; ++k) {
-    live_lmk_ids_k_ago.emplace(k, std::vector<uid_t>());
-    live_lmk_pts_k_ago.emplace(k, VecPoint2f());
-  }
+  WaitForKeyframeDetection();
+}
 
-  for (const auto& item : live_tracks_) {
-    const uid_t lmk_id = item.first;
 
-    // NOTE(milo): Observations are sorted in order of INCREASING camera_id, so the last
-    // observation is the most recent.
-    const VecLmkObs& observations = item.second;
-    CHECK(!observations.empty());
+FrameQuality StereoTracker::PrepareFrame(const StereoImage1b& stereo_pair, int level)
+{
+  MACRO_PROFILE_SCOPE("StereoTracker::PrepareFrame");
+  const std::shared_ptr<const ImagePyramid> pyramid =
+      tracker_.CachedPyramid(stereo_pair.left_image, *stereo_pair.cache, "left");
 
-    // This landmark was last seen "k" frames ago.
-    const int k = stereo_pair.camera_id - observations.back().camera_id;
-    if (k > params_.retrack_frames_k) {
-      continue;
-    }
+  return EstimateFrameQuality(PyramidLevel(*pyramid, level));
+}
 
-    live_lmk_ids_k_ago.at(k).emplace_back(lmk_id);
-    live_lmk_pts_k_ago.at(k).emplace_back(observations.back().pixel_location);
-  }
 
-  //======================== KANADE-LUCAS OPTICAL FLOW =========================
-  std::vector<uid_t> good_lmk_ids;
-  VecPoint2f good_lmk_pts;
+bool StereoTracker::TrackAndTriangulate(const StereoImage1b& stereo_pair,
+                                        bool force_keyframe,
+                                        const Matrix3d* prev_R_cur)
+{
+  MACRO_PROFILE_SCOPE("StereoTracker::TrackAndTriangulate");
+  Timer timer(true);
 
-  for (int k = 1; k <= params_.retrack_frames_k; ++k) {
-    if (live_lmk_pts_k_ago.at(k).empty()) {
-      continue;
-    }
+  // This image's bucket was emptied when the image before it fell out of the window.
+  const size_t frame = img_buffer_.Added();
+  AgeBucket& cur_bucket = AgeBucketAt(frame);
+  CHECK(!cur_bucket.in_window && cur_bucket.lmk_ids.empty());
+  cur_bucket.in_window = true;
+  cur_bucket.camera_id = stereo_pair.camera_id;
 
-    VecPoint2f live_lmk_pts_cur;
-    std::vector<uchar> status;
-    std::vector<float> error;
+  // The last keyframe's new landmarks (if it was detected async) get tracked into this image too.
+  MergeKeyframeDetection();
 
-    tracker_.Track(img_buffer_.Get(k-1),
-                   stereo_pair.left_image,
-                   live_lmk_pts_k_ago.at(k),
-                   live_lmk_pts_cur,
-                   status,
-                   error,
-                   true,
-                   params_.klt_fwd_bwd_tol);
+  for (int k = 0; k <= params_.retrack_frames_k; ++k) {
+    live_lmk_ids_k_ago_.at(k).clear();
+    live_lmk_pts_k_ago_.at(k).clear();
+    live_lmk_idx_k_ago_.at(k).clear();
+    live_lmk_pts_cur_.at(k).clear();
+  }
 
-    // Filter out unsuccessful KLT tracks.
-    std::vector<uid_t> good_lmk_ids_k = SubsetFromMaskCv<uid_t>(live_lmk_ids_k_ago.at(k), status);
-    VecPoint2f good_lmk_pts_k = SubsetFromMaskCv<cv::Point2f>(live_lmk_pts_cur, status);
-    good_lmk_ids.insert(good_lmk_ids.end(), good_lmk_ids_k.begin(), good_lmk_ids_k.end());
-    good_lmk_pts.insert(good_lmk_pts.end(), good_lmk_pts_k.begin(), good_lmk_pts_k.end());
+  // The landmarks last seen in the image that was tracked "k" images ago are in its bucket.
+  // NOTE(milo): Images can be missing between the buffered ones (dropped, or skipped by the caller),
+  // so buckets go by the order that images were tracked in, not by camera_id.
+  const int num_buffered = std::min((int)img_buffer_.Added(), params_.retrack_frames_k);
+
+  for (int k = 1; k <= num_buffered; ++k) {
+    AgeBucket& bucket = AgeBucketAt(frame - k);
+    CHECK_EQ(img_buffer_.Get(k - 1).camera_id, bucket.camera_id);
+    bucket.retracked.assign(bucket.lmk_ids.size(), 0);
+
+    live_lmk_ids_k_ago_.at(k) = bucket.lmk_ids;
+    live_lmk_pts_k_ago_.at(k) = bucket.lmk_pts;
+    for (size_t j = 0; j < bucket.lmk_ids.size(); ++j) {
+      live_lmk_idx_k_ago_.at(k).emplace_back(j);
+    }
   }
 
+  //======================== KANADE-LUCAS OPTICAL FLOW =========================
+  // Build the pyramid for this image once. It's shared by all of the batches below, and then saved
+  // in img_buffer_ for tracking from this image in the next retrack_frames_k images. It comes from
+  // the frame's cache, so PrepareFrame() (or another tracker with the same params) might have built
+  // it already.
+  cur_frame_.image = stereo_pair.left_image;
+  cur_frame_.pyramid = *tracker_.CachedPyramid(stereo_pair.left_image, *stereo_pair.cache, "left");
+  cur_frame_.camera_id = stereo_pair.camera_id;
+  cur_frame_.has_rotation_prior = (prev_R_cur != nullptr) && (num_buffered > 0);
+  cur_frame_.ref_R_cam = cur_frame_.has_rotation_prior ?
+      Matrix3d(img_buffer_.Head().ref_R_cam * (*prev_R_cur)) : Matrix3d::Identity();
+
+  good_lmk_ids_.clear();
+  good_lmk_pts_.clear();
+  good_lmk_src_.clear();
+  num_deadline_skipped_ = 0;
+
+  if (params_.track_deadline_ms <= 0) {
+    TrackBatches();
+  } else {
+    TrackBatchesWithDeadline(timer);
+  }
+
+  std::vector<uid_t>& good_lmk_ids = good_lmk_ids_;
+  VecPoint2f& good_lmk_pts = good_lmk_pts_;
+
   // Decide if a new keyframe should be initialized.
   // NOTE(milo): If this is the first image, we will have no tracks, triggering a keyframe,
   // causing new keypoints to be detected as desired.
-  const bool is_keyframe = force_keyframe ||
-                           ((int)good_lmk_ids.size() < params_.trigger_keyframe_min_lmks) ||
-                           (int)(stereo_pair.camera_id - prev_kf_id_) >= params_.trigger_keyframe_k;
+  const bool must_keyframe = force_keyframe ||
+                             ((int)good_lmk_ids.size() < params_.trigger_keyframe_min_lmks) ||
+                             (int)(stereo_pair.camera_id - prev_kf_id_) >= params_.trigger_keyframe_k;
+
+  const bool is_keyframe = must_keyframe ||
+      (keyframe_trigger_ && keyframe_trigger_(ComputeKeyframeCues(stereo_pair, good_lmk_ids, good_lmk_pts)));
+
+  const float meas_var = params_.depth_filter_meas_stdev_px * params_.depth_filter_meas_stdev_px;
 
   //===================== KEYFRAME FEATURE DETECTION ===========================
   // If this is a new keyframe, (maybe) detect new keypoints in the left image.
-  if (is_keyframe) {
+  if (is_keyframe && params_.async_keyframe_detection) {
+    StartKeyframeDetection(stereo_pair, good_lmk_pts);
+  } else if (is_keyframe) {
     VecPoint2f new_left_kps;
     detector_.Detect(stereo_pair.left_image, good_lmk_pts, new_left_kps);
 
-    // Assign new landmark IDs to the initialized keypoints.
-    std::vector<uid_t> new_lmk_ids(new_left_kps.size());
-    for (size_t i = 0; i < new_left_kps.size(); ++i) {
-      new_lmk_ids.at(i) = AllocateLandmarkId();
+    const std::vector<double> new_lmk_disps = MatchStereo(stereo_pair, new_left_kps, std::vector<double>(new_left_kps.size(), -1.0));
+
+    AddNewTracks(stereo_pair.camera_id, new_left_kps, new_lmk_disps);
+  }
+
+  if (is_keyframe) {
+    prev_kf_id_ = stereo_pair.camera_id;
+    prev_kf_timestamp_ = stereo_pair.timestamp;
+  }
+
+  //============================ STEREO MATCHING ===============================
+  // Predict each tracked landmark's depth filter forward, and only re-match the landmarks whose
+  // disparity isn't known well enough anymore (or that are due for a check).
+  const float process_var = params_.depth_filter_process_stdev_px * params_.depth_filter_process_stdev_px;
+  const float max_var = params_.depth_filter_max_stdev_px * params_.depth_filter_max_stdev_px;
+
+  match_idx_.clear();
+  match_pts_.clear();
+  match_disp_priors_.clear();
+
+  for (size_t i = 0; i < good_lmk_ids.size(); ++i) {
+    DepthFilter& depth = live_tracks_.GetDepthFilter(good_lmk_ids.at(i));
+    depth.Predict(process_var);
+    if (depth.var > max_var || depth.frames_since_update >= params_.depth_filter_rematch_k) {
+      match_idx_.emplace_back(i);
+      match_pts_.emplace_back(good_lmk_pts.at(i));
+      match_disp_priors_.emplace_back(depth.disp);
     }
+  }
 
-    const std::vector<double> new_lmk_disps = matcher_.MatchRectified(
-        stereo_pair.left_image, stereo_pair.right_image, new_left_kps);
+  // NOTE(milo): Tracked landmarks only search near their filtered disparity. The rotation prior
+  // doesn't change disparity, and the translation between frames is small compared to the depth (the
+  // matcher falls back to a full search if the prior is wrong).
+  const std::vector<double> matched_disps = MatchStereo(stereo_pair, match_pts_, match_disp_priors_);
 
-    for (size_t i = 0; i < new_lmk_ids.size(); ++i) {
-      const uid_t lmk_id = new_lmk_ids.at(i);
-      const cv::Point2f& pt = new_left_kps.at(i);
-      const double disp = new_lmk_disps.at(i);
+  CHECK_EQ(matched_disps.size(), match_idx_.size());
 
-      // NOTE(milo): For now, we consider a track invalid if we can't triangulate w/ stereo.
-      const double min_disp = stereo_rig_.DepthToDisp(params_.stereo_max_depth);
-      if (disp <= min_disp) {
-        continue;
-      }
+  // Landmarks that weren't re-matched keep their filtered disparity. A failed match loses the track
+  // for this frame, like before.
+  good_lmk_disps_.assign(good_lmk_ids.size(), 0.0);
+  for (size_t i = 0; i < good_lmk_ids.size(); ++i) {
+    good_lmk_disps_.at(i) = live_tracks_.GetDepthFilter(good_lmk_ids.at(i)).disp;
+  }
 
-      CHECK_EQ(live_tracks_.count(lmk_id), 0) << "Newly initialized landmark should not exist in live_tracks_" << std::endl;
+  const double min_disp = stereo_rig_.DepthToDisp(params_.stereo_max_depth);
 
-      // If this is a new landmark, add an empty vector of observations.
-      live_tracks_.emplace(lmk_id, VecLmkObs());
+  for (size_t j = 0; j < match_idx_.size(); ++j) {
+    const size_t i = match_idx_.at(j);
+    const double disp = matched_disps.at(j);
 
-      // Now insert the latest observation.
-      const LandmarkObservation lmk_obs(lmk_id, stereo_pair.camera_id, pt, disp, 0.0, 0.0);
-      live_tracks_.at(lmk_id).emplace_back(lmk_obs);
+    // NOTE(milo): For now, we consider a track invalid if we can't triangulate w/ stereo.
+    if (disp <= min_disp) {
+      good_lmk_disps_.at(i) = -1.0;
+      continue;
     }
 
-    prev_kf_id_ = stereo_pair.camera_id;
+    DepthFilter& depth = live_tracks_.GetDepthFilter(good_lmk_ids.at(i));
+    depth.Update(disp, meas_var, params_.depth_filter_gate_sigma);
+    good_lmk_disps_.at(i) = depth.disp;
   }
 
-  //============================ STEREO MATCHING ===============================
-  const std::vector<double> good_lmk_disps = matcher_.MatchRectified(
-      stereo_pair.left_image, stereo_pair.right_image, good_lmk_pts);
-
-  CHECK_EQ(good_lmk_disps.size(), good_lmk_ids.size());
+  num_stereo_matches_ = match_idx_.size();
 
   for (size_t i = 0; i < good_lmk_ids.size(); ++i) {
     const uid_t lmk_id = good_lmk_ids.at(i);
     const cv::Point2f& pt = good_lmk_pts.at(i);
-    const double disp = good_lmk_disps.at(i);
+    const double disp = good_lmk_disps_.at(i);
 
-    // NOTE(milo): For now, we consider a track invalid if we can't triangulate w/ stereo.
-    const double min_disp = stereo_rig_.DepthToDisp(params_.stereo_max_depth);
     if (disp <= min_disp) {
       continue;
     }
 
-    // If this is a new landmark, add an empty vector of observations.
-    CHECK_GT(live_tracks_.count(lmk_id), 0) << "Tracked point should already exist in live_tracks_!" << std::endl;
-
-    // Now insert the latest observation.
+    // Now insert the latest observation, with the filtered disparity.
     const LandmarkObservation lmk_obs(lmk_id, stereo_pair.camera_id, pt, disp, 0.0, 0.0);
-    live_tracks_.at(lmk_id).emplace_back(lmk_obs);
+    live_tracks_.AddObservation(lmk_obs);
+
+    // Move it from the bucket where it was last seen to this image's bucket.
+    const std::pair<int, size_t>& src = good_lmk_src_.at(i);
+    AgeBucketAt(frame - src.first).retracked.at(src.second) = 1;
+    cur_bucket.lmk_ids.emplace_back(lmk_id);
+    cur_bucket.lmk_pts.emplace_back(pt);
+  }
+
+  for (int k = 1; k <= num_buffered; ++k) {
+    AgeBucket& bucket = AgeBucketAt(frame - k);
+    size_t n = 0;
+    for (size_t j = 0; j < bucket.lmk_ids.size(); ++j) {
+      if (!bucket.retracked.at(j)) {
+        bucket.lmk_ids.at(n) = bucket.lmk_ids.at(j);
+        bucket.lmk_pts.at(n) = bucket.lmk_pts.at(j);
+        ++n;
+      }
+    }
+    bucket.lmk_ids.resize(n);
+    bucket.lmk_pts.resize(n);
+  }
+
+  // The landmarks observed in this image (tracked, and new if added inline) are in its bucket.
+  if (is_keyframe) {
+    num_lmks_prev_kf_ = (int)cur_bucket.lmk_ids.size();
   }
 
   //========================== GARBAGE COLLECTION ==============================
   // Check for any tracks that have haven't been seen in k images and kill them off.
   // Also kill off any landmarks that have way too many observations so that the memory needed to
   // store them doesn't blow up.
-  KillOffLostLandmarks(stereo_pair.camera_id);
-
-  // Housekeeping.
-  img_buffer_.Add(stereo_pair.left_image);
+  // NOTE(milo): Done after the current image goes into img_buffer_ (see KillOffLostLandmarks()).
+  img_buffer_.Swap(cur_frame_);
   prev_camera_id_ = stereo_pair.camera_id;
+  KillOffLostLandmarks();
 
   return is_keyframe;
 }
 
 
-void StereoTracker::KillOffLostLandmarks(uid_t cur_camera_id)
+void StereoTracker::TrackBatches()
 {
-  std::vector<uid_t> lmk_ids_to_kill;
+  // Each batch of points (grouped by the frame they were last seen in) is tracked independently,
+  // so the batches can run in parallel. Each one writes only to its own status/points.
+  TaskScheduler::Instance().ParallelFor(TaskPriority::FRONTEND, params_.retrack_frames_k, [&](int i) {
+    const int k = i + 1;
+    klt_status_.at(k).clear();
+    live_lmk_pts_cur_.at(k).clear();
+    if (live_lmk_pts_k_ago_.at(k).empty()) {
+      return;
+    }
 
-  for (const auto& item : live_tracks_) {
-    const uid_t lmk_id = item.first;
+    // If the rotation since that image is known, start KLT from where the rotation moves the points.
+    Matrix3d cur_R_ref;
+    if (RotationSince(k, cur_R_ref)) {
+      PredictFromRotation(cur_R_ref, live_lmk_pts_k_ago_.at(k), live_lmk_pts_cur_.at(k));
+    }
 
-    // NOTE(milo): Observations should be sorted in order of INCREASING camera_id.
-    const VecLmkObs& observations = item.second;
+    std::vector<float> error;
+    tracker_.Track(img_buffer_.Get(k-1).pyramid,
+                   cur_frame_.pyramid,
+                   live_lmk_pts_k_ago_.at(k),
+                   live_lmk_pts_cur_.at(k),
+                   klt_status_.at(k),
+                   error,
+                   true,
+                   params_.klt_fwd_bwd_tol);
+  }, params_.klt_num_threads);
 
-    // Should never have an landmark with no observations, this is a bug.
-    CHECK(!observations.empty());
+  // Points that drift onto the vehicle body are lost (they'd stick to it, instead of the scene).
+  const Image1b valid = stereo_rig_.LeftMask().Valid(cur_frame_.image.rows, cur_frame_.image.cols);
 
-    const int frames_since_last_seen = (int)cur_camera_id - observations.back().camera_id;
+  // NOTE(milo): Merge the batches in order of k, so that the output doesn't depend on threading.
+  for (int k = 1; k <= params_.retrack_frames_k; ++k) {
+    const std::vector<uchar>& status = klt_status_.at(k);
+    if (live_lmk_pts_k_ago_.at(k).empty()) {
+      continue;
+    }
+    CHECK_EQ(status.size(), live_lmk_ids_k_ago_.at(k).size());
 
-    // If this landmark hasn't been observed in retrack_frames_k, it won't be retracked, so kill.
-    if (frames_since_last_seen > params_.retrack_frames_k) {
-      lmk_ids_to_kill.emplace_back(lmk_id);
+    // Filter out unsuccessful KLT tracks.
+    for (size_t j = 0; j < status.size(); ++j) {
+      if (status.at(j) == 1 && NotBlocked(valid, live_lmk_pts_cur_.at(k).at(j))) {
+        good_lmk_ids_.emplace_back(live_lmk_ids_k_ago_.at(k).at(j));
+        good_lmk_pts_.emplace_back(live_lmk_pts_cur_.at(k).at(j));
+        good_lmk_src_.emplace_back(k, live_lmk_idx_k_ago_.at(k).at(j));
+      }
     }
   }
+}
+
+
+void StereoTracker::TrackBatchesWithDeadline(Timer& timer)
+{
+  PrioritizeLandmarks();
+
+  // Track the queue in chunks, highest priority first, until the deadline. Each chunk is split
+  // back into batches by k, like TrackBatches().
+  const size_t chunk_size = (size_t)std::max(1, params_.deadline_chunk_size);
+  size_t next = 0;
+
+  while (next < deadline_queue_.size()) {
+    const bool have_min_lmks = (int)good_lmk_ids_.size() >= params_.deadline_min_lmks;
+    if (have_min_lmks && timer.Elapsed().milliseconds() >= params_.track_deadline_ms) {
+      break;
+    }
 
-  for (const uid_t lmk_id : lmk_ids_to_kill) {
-    live_tracks_.erase(lmk_id);
+    for (int k = 1; k <= params_.retrack_frames_k; ++k) {
+      live_lmk_ids_k_ago_.at(k).clear();
+      live_lmk_pts_k_ago_.at(k).clear();
+      live_lmk_idx_k_ago_.at(k).clear();
+    }
+
+    const size_t end = std::min(deadline_queue_.size(), next + chunk_size);
+    for (; next < end; ++next) {
+      const QueuedLandmark& q = deadline_queue_.at(next);
+      live_lmk_ids_k_ago_.at(q.k).emplace_back(q.lmk_id);
+      live_lmk_pts_k_ago_.at(q.k).emplace_back(q.pt);
+      live_lmk_idx_k_ago_.at(q.k).emplace_back(q.idx);
+    }
+
+    TrackBatches();
+  }
+
+  num_deadline_skipped_ = deadline_queue_.size() - next;
+}
+
+
+void StereoTracker::PrioritizeLandmarks()
+{
+  deadline_queue_.clear();
+
+  const PinholeCamera& cam = stereo_rig_.LeftCamera();
+  const int cells = std::max(1, params_.deadline_grid_cells);
+  const int max_obs = params_.max_obs_per_track;
+
+  for (int k = 1; k <= params_.retrack_frames_k; ++k) {
+    for (size_t j = 0; j < live_lmk_ids_k_ago_.at(k).size(); ++j) {
+      QueuedLandmark q;
+      q.lmk_id = live_lmk_ids_k_ago_.at(k).at(j);
+      q.k = k;
+      q.idx = live_lmk_idx_k_ago_.at(k).at(j);
+      q.pt = live_lmk_pts_k_ago_.at(k).at(j);
+
+      const int cx = (cam.Width() > 0) ? std::max(0, std::min(cells - 1, (int)(q.pt.x * cells / cam.Width()))) : 0;
+      const int cy = (cam.Height() > 0) ? std::max(0, std::min(cells - 1, (int)(q.pt.y * cells / cam.Height()))) : 0;
+      q.cell = cy * cells + cx;
+
+      // NOTE(milo): Older tracks constrain odometry across more keyframes, and closer landmarks
+      // constrain translation better. Age dominates, disparity breaks ties.
+      const int age = std::min((int)live_tracks_.Get(q.lmk_id).size(), max_obs);
+      q.score = (double)age + std::min(1.0, live_tracks_.GetDepthFilter(q.lmk_id).disp / 100.0);
+
+      deadline_queue_.emplace_back(q);
+    }
+  }
+
+  // Rank landmarks within their grid cell, then take the best of every cell before the second best
+  // of any, so that a cut-off frame still covers the whole image.
+  std::sort(deadline_queue_.begin(), deadline_queue_.end(), [](const QueuedLandmark& a, const QueuedLandmark& b) {
+    if (a.cell != b.cell) { return a.cell < b.cell; }
+    if (a.score != b.score) { return a.score > b.score; }
+    return a.lmk_id < b.lmk_id;
+  });
+
+  for (size_t i = 0; i < deadline_queue_.size(); ++i) {
+    const bool same_cell = (i > 0) && (deadline_queue_.at(i - 1).cell == deadline_queue_.at(i).cell);
+    deadline_queue_.at(i).rank = same_cell ? deadline_queue_.at(i - 1).rank + 1 : 0;
+  }
+
+  std::stable_sort(deadline_queue_.begin(), deadline_queue_.end(), [](const QueuedLandmark& a, const QueuedLandmark& b) {
+    return a.rank < b.rank;
+  });
+}
+
+
+int StereoTracker::AddNewTracks(uid_t camera_id,
+                                const VecPoint2f& new_left_kps,
+                                const std::vector<double>& new_lmk_disps)
+{
+  CHECK_EQ(new_left_kps.size(), new_lmk_disps.size());
+  AgeBucket* bucket = FindAgeBucket(camera_id);
+  CHECK(bucket != nullptr) << "New tracks must start in the current or a buffered image" << std::endl;
+
+  const float meas_var = params_.depth_filter_meas_stdev_px * params_.depth_filter_meas_stdev_px;
+  const double min_disp = stereo_rig_.DepthToDisp(params_.stereo_max_depth);
+
+  int num_added = 0;
+  for (size_t i = 0; i < new_left_kps.size(); ++i) {
+    // Assign new landmark IDs to the initialized keypoints.
+    const uid_t lmk_id = AllocateLandmarkId();
+    const cv::Point2f& pt = new_left_kps.at(i);
+    const double disp = new_lmk_disps.at(i);
+
+    // NOTE(milo): For now, we consider a track invalid if we can't triangulate w/ stereo.
+    if (disp <= min_disp) {
+      continue;
+    }
+
+    // Start a new track with this as its first observation.
+    const LandmarkObservation lmk_obs(lmk_id, camera_id, pt, disp, 0.0, 0.0);
+    live_tracks_.AddTrack(lmk_obs);
+    live_tracks_.GetDepthFilter(lmk_id).Init(disp, meas_var);
+    bucket->lmk_ids.emplace_back(lmk_id);
+    bucket->lmk_pts.emplace_back(pt);
+    ++num_added;
+  }
+
+  return num_added;
+}
+
+
+std::vector<double> StereoTracker::MatchStereo(const StereoImage1b& stereo_pair,
+                                               const VecPoint2f& left_kps,
+                                               const std::vector<double>& disp_priors)
+{
+  std::vector<double> disps;
+
+  if (matcher_.GetParams().mode != StereoMatcher::Mode::KLT) {
+    disps = matcher_.MatchRectifiedWithPrior(stereo_pair.left_image, stereo_pair.right_image, left_kps, disp_priors);
+  } else {
+    // NOTE(milo): The left pyramid was already built for tracking (see cur_frame_).
+    const std::shared_ptr<const ImagePyramid> right_pyramid =
+        tracker_.CachedPyramid(stereo_pair.right_image, *stereo_pair.cache, "right");
+    disps = matcher_.MatchRectifiedWithPrior(cur_frame_.pyramid, *right_pyramid, left_kps, disp_priors);
+  }
+
+  RejectBlockedMatches(left_kps, stereo_pair.right_image.rows, stereo_pair.right_image.cols, disps);
+  return disps;
+}
+
+
+void StereoTracker::RejectBlockedMatches(const VecPoint2f& left_kps,
+                                         int rows,
+                                         int cols,
+                                         std::vector<double>& disps) const
+{
+  const Image1b valid = stereo_rig_.RightMask().Valid(rows, cols);
+  if (valid.empty()) {
+    return;
+  }
+
+  CHECK_EQ(left_kps.size(), disps.size());
+  for (size_t i = 0; i < disps.size(); ++i) {
+    const cv::Point2f pt_right(left_kps.at(i).x - (float)disps.at(i), left_kps.at(i).y);
+    if (disps.at(i) > 0 && !NotBlocked(valid, pt_right)) {
+      disps.at(i) = -1.0;
+    }
+  }
+}
+
+
+void StereoTracker::StartKeyframeDetection(const StereoImage1b& stereo_pair, const VecPoint2f& tracked_kps)
+{
+  {
+    std::lock_guard<std::mutex> lock(keyframe_mutex_);
+    CHECK(!keyframe_busy_ && !keyframe_pending_) << "Last keyframe detection wasn't merged yet" << std::endl;
+    keyframe_busy_ = true;
+  }
+
+  // The Mat headers are copied, not the pixels. Callers don't write to their input images.
+  const Image1b left_image = stereo_pair.left_image;
+  const Image1b right_image = stereo_pair.right_image;
+  const uid_t camera_id = stereo_pair.camera_id;
+
+  TaskScheduler::Instance().Submit(TaskPriority::FRONTEND, [this, left_image, right_image, camera_id, tracked_kps]() {
+    MACRO_PROFILE_SCOPE("StereoTracker::KeyframeDetection");
+    VecPoint2f new_left_kps;
+    detector_.Detect(left_image, tracked_kps, new_left_kps);
+    std::vector<double> new_lmk_disps = keyframe_matcher_.MatchRectified(left_image, right_image, new_left_kps);
+    RejectBlockedMatches(new_left_kps, right_image.rows, right_image.cols, new_lmk_disps);
+
+    std::lock_guard<std::mutex> lock(keyframe_mutex_);
+    keyframe_camera_id_ = camera_id;
+    keyframe_kps_.swap(new_left_kps);
+    keyframe_disps_.swap(new_lmk_disps);
+    keyframe_pending_ = true;
+    keyframe_busy_ = false;
+    keyframe_cv_.notify_all();
+  });
+}
+
+
+void StereoTracker::WaitForKeyframeDetection()
+{
+  std::unique_lock<std::mutex> lock(keyframe_mutex_);
+  keyframe_cv_.wait(lock, [this]() { return !keyframe_busy_; });
+}
+
+
+void StereoTracker::MergeKeyframeDetection()
+{
+  WaitForKeyframeDetection();
+  if (!keyframe_pending_) {
+    return;
+  }
+
+  // NOTE(milo): The keyframe is the last tracked image, and its tracked landmarks were already
+  // counted in num_lmks_prev_kf_.
+  const int num_added = AddNewTracks(keyframe_camera_id_, keyframe_kps_, keyframe_disps_);
+  if (keyframe_camera_id_ == prev_kf_id_) {
+    num_lmks_prev_kf_ += num_added;
+  }
+  keyframe_pending_ = false;
+}
+
+
+KeyframeCues StereoTracker::ComputeKeyframeCues(const StereoImage1b& stereo_pair,
+                                                const std::vector<uid_t>& lmk_ids,
+                                                const VecPoint2f& lmk_pts)
+{
+  KeyframeCues cues;
+  cues.sec_since_keyframe = ConvertToSeconds(stereo_pair.timestamp - prev_kf_timestamp_);
+  cues.frames_since_keyframe = (int)(stereo_pair.camera_id - prev_kf_id_);
+  cues.num_tracked = (int)lmk_ids.size();
+
+  parallax_px_.clear();
+  for (size_t i = 0; i < lmk_ids.size(); ++i) {
+    const VecLmkObs& observations = live_tracks_.Get(lmk_ids.at(i));
+
+    // NOTE(milo): Observations are sorted by camera_id, and the keyframe is usually recent.
+    for (auto it = observations.rbegin(); it != observations.rend() && it->camera_id >= prev_kf_id_; ++it) {
+      if (it->camera_id == prev_kf_id_) {
+        const cv::Point2f d = lmk_pts.at(i) - it->pixel_location;
+        parallax_px_.emplace_back(std::sqrt(d.x*d.x + d.y*d.y));
+        break;
+      }
+    }
+  }
+
+  cues.track_overlap = (num_lmks_prev_kf_ > 0) ?
+      std::min(1.0, (double)parallax_px_.size() / (double)num_lmks_prev_kf_) : 0.0;
+
+  if (!parallax_px_.empty()) {
+    std::nth_element(parallax_px_.begin(), parallax_px_.begin() + parallax_px_.size() / 2, parallax_px_.end());
+    cues.median_parallax_px = parallax_px_.at(parallax_px_.size() / 2);
+  }
+
+  return cues;
+}
+
+
+StereoTracker::AgeBucket* StereoTracker::FindAgeBucket(uid_t camera_id)
+{
+  for (AgeBucket& bucket : age_buckets_) {
+    if (bucket.in_window && bucket.camera_id == camera_id) {
+      return &bucket;
+    }
+  }
+  return nullptr;
+}
+
+
+void StereoTracker::KillOffLostLandmarks()
+{
+  // The ring slot after the current image's holds the image that just left img_buffer_ (or nothing,
+  // if the buffer isn't full yet). Its landmarks weren't seen since then, so they won't be
+  // retracked. Its slot is the next image's bucket.
+  AgeBucket& lost = AgeBucketAt(img_buffer_.Added());
+  for (const uid_t lmk_id : lost.lmk_ids) {
+    CHECK(live_tracks_.Kill(lmk_id)) << "Landmark in an AgeBucket isn't live: " << lmk_id << std::endl;
+  }
+  lost.lmk_ids.clear();
+  lost.lmk_pts.clear();
+  lost.in_window = false;
+}
+
+
+bool StereoTracker::RotationSince(int k, Matrix3d& cur_R_ref) const
+{
+  // Every image after the one from k images ago needs a prior, or the chain is broken.
+  if (!cur_frame_.has_rotation_prior) {
+    return false;
+  }
+  for (int j = 0; j < (k - 1); ++j) {
+    if (!img_buffer_.Get(j).has_rotation_prior) {
+      return false;
+    }
+  }
+
+  cur_R_ref = cur_frame_.ref_R_cam.transpose() * img_buffer_.Get(k - 1).ref_R_cam;
+  return true;
+}
+
+
+void StereoTracker::PredictFromRotation(const Matrix3d& cur_R_ref,
+                                        const VecPoint2f& px_ref,
+                                        VecPoint2f& px_cur) const
+{
+  // NOTE(milo): This ignores translation, which is what the infinite homography does. Over a few
+  // frames, rotation causes most of the image motion, and KLT corrects the rest.
+  const PinholeCamera& cam = stereo_rig_.LeftCamera();
+  const Matrix3d H = cam.K() * cur_R_ref * cam.Kinv();
+
+  px_cur.resize(px_ref.size());
+  for (size_t i = 0; i < px_ref.size(); ++i) {
+    const cv::Point2f& pt = px_ref.at(i);
+    const Vector3d h = H * Vector3d(pt.x, pt.y, 1.0);
+
+    // Points that rotate behind the camera keep their old location as the guess.
+    px_cur.at(i) = (h.z() > 1e-3) ? cv::Point2f(h.x() / h.z(), h.y() / h.z()) : pt;
   }
 }
 
 
 void StereoTracker::KillLandmark(uid_t lmk_id)
 {
-  if (live_tracks_.count(lmk_id) != 0) {
-    live_tracks_.erase(lmk_id);
+  if (!live_tracks_.Has(lmk_id)) {
+    return;
   }
+
+  AgeBucket* bucket = FindAgeBucket(live_tracks_.Get(lmk_id).back().camera_id);
+  CHECK(bucket != nullptr) << "Live landmark isn't in any AgeBucket: " << lmk_id << std::endl;
+
+  // NOTE(milo): Order within a bucket doesn't matter (this is never called mid-frame).
+  const auto it = std::find(bucket->lmk_ids.begin(), bucket->lmk_ids.end(), lmk_id);
+  CHECK(it != bucket->lmk_ids.end());
+  const size_t j = it - bucket->lmk_ids.begin();
+  bucket->lmk_ids.at(j) = bucket->lmk_ids.back();
+  bucket->lmk_pts.at(j) = bucket->lmk_pts.back();
+  bucket->lmk_ids.pop_back();
+  bucket->lmk_pts.pop_back();
+
+  live_tracks_.Kill(lmk_id);
 }
 
 
@@ -208,8 +664,8 @@ Image3b StereoTracker::VisualizeFeatureTracks() const
 {
   VecPoint2f ref_keypoints, cur_keypoints, untracked_ref, untracked_cur;
 
-  for (const auto& item : live_tracks_) {
-    const VecLmkObs& lmk_obs = item.second;
+  for (const FeatureTracks::Track& track : live_tracks_) {
+    const VecLmkObs& lmk_obs = track.observations;
 
     CHECK(!lmk_obs.empty()) << "Landmark should have one or more observations stored" << std::endl;
 
@@ -240,7 +696,7 @@ Image3b StereoTracker::VisualizeFeatureTracks() const
     }
   }
 
-  return DrawFeatureTracks(img_buffer_.Head(), ref_keypoints, cur_keypoints, untracked_ref, untracked_cur);
+  return DrawFeatureTracks(img_buffer_.Head().image, ref_keypoints, cur_keypoints, untracked_ref, untracked_cur);
 }
 
 
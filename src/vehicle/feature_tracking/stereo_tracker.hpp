@@ -1,17 +1,29 @@
 #pragma once
 
-#include <unordered_map>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include "core/macros.hpp"
 #include "params/params_base.hpp"
 #include "core/uid.hpp"
+#include "core/timestamp.hpp"
 #include "vision_core/cv_types.hpp"
 #include "vision_core/stereo_image.hpp"
 #include "vision_core/stereo_camera.hpp"
 #include "core/sliding_buffer.hpp"
+#include "core/task_scheduler.hpp"
+#include "core/timer.hpp"
 #include "vision_core/landmark_observation.hpp"
 #include "feature_tracking/feature_detector.hpp"
 #include "feature_tracking/feature_tracker.hpp"
+#include "feature_tracking/feature_tracks.hpp"
+#include "feature_tracking/frame_quality.hpp"
+#include "feature_tracking/keyframe_cues.hpp"
+#include "feature_tracking/pyramid_frame.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
 
 namespace bm {
@@ -19,12 +31,12 @@ namespace ft {
 
 using namespace core;
 
-typedef std::vector<LandmarkObservation> VecLmkObs;
-typedef std::unordered_map<uid_t, VecLmkObs> FeatureTracks;
-
 
 class StereoTracker final {
  public:
+  // Decides whether a frame should be a keyframe (see SetKeyframeTrigger()).
+  typedef std::function<bool(const KeyframeCues&)> KeyframeTrigger;
+
   // Parameters that control the frontend.
   struct Params final : public ParamsBase
   {
@@ -39,16 +51,50 @@ class StereoTracker final {
 
     double klt_fwd_bwd_tol = 2.0;
 
-    // Kill off a tracked landmark if it hasn't been observed in this many frames.
-    // If set to zero, this means that a track dies as soon as it isn't observed in the current frame.
-    int retrack_frames_k = 3; // Retrack points from the previous k frames.
+    // Kill off a tracked landmark if it hasn't been observed in this many tracked images (images that
+    // the caller skips don't count).
+    int retrack_frames_k = 3; // Retrack points from the previous k tracked images.
+
+    // Points last seen in different frames are tracked in parallel, using up to this many workers from
+    // the shared TaskScheduler. If zero, everything is tracked on the calling thread.
+    int klt_num_threads = 2;
 
     // Trigger a keyframe if we only have 0% of maximum keypoints.
     int trigger_keyframe_min_lmks = 10;
 
-    // Trigger a keyframe at least every k frames.
+    // Trigger a keyframe at least every k frames (even if there's a KeyframeTrigger).
     int trigger_keyframe_k = 10;
 
+    // Keep (at least half of) this many of the most recent observations for each landmark. Must be
+    // big enough to always reach back to the previous keyframe.
+    int max_obs_per_track = 32;
+
+    // Each landmark has an inverse depth filter (see DepthFilter), and is only stereo matched again
+    // once its stdev grows past depth_filter_max_stdev_px, or after depth_filter_rematch_k frames.
+    // With depth_filter_rematch_k = 1, every tracked landmark is matched in every frame.
+    int depth_filter_rematch_k = 1;
+    double depth_filter_max_stdev_px = 0.5;
+    double depth_filter_meas_stdev_px = 0.5;      // Noise of one stereo match.
+    double depth_filter_process_stdev_px = 0.2;   // How much disparity can change per frame.
+    double depth_filter_gate_sigma = 3.0;         // Restart the filter on a worse match than this.
+
+    // Detect and stereo match new keypoints for a keyframe on a TaskScheduler worker, instead of
+    // inline. The keyframe itself only has its tracked landmarks, and the new ones are added (with
+    // their observation in the keyframe) at the start of the next TrackAndTriangulate(), which then
+    // tracks them forward. Keyframes then take about as long as other frames.
+    bool async_keyframe_detection = false;
+
+    // Stop KLT once track_deadline_ms (zero = never) have passed since TrackAndTriangulate() started,
+    // so that a frame that arrives during CPU contention still gets a timely VO estimate. Leave room
+    // in the deadline for stereo matching and the pose solve. Landmarks are tracked in chunks of
+    // deadline_chunk_size, best first (see PrioritizeLandmarks()), and at least deadline_min_lmks are
+    // always tracked. Landmarks that get cut off can be retracked in the next frame if
+    // retrack_frames_k > 1 (otherwise they're lost).
+    double track_deadline_ms = 0.0;
+    int deadline_chunk_size = 50;
+    int deadline_min_lmks = 30;
+    int deadline_grid_cells = 4;      // Spread the best landmarks over a grid this many cells across.
+
    private:
     void LoadParams(const YamlParser& parser) override;
   };
@@ -60,11 +106,56 @@ class StereoTracker final {
         stereo_rig_(stereo_rig),
         detector_(params.detector_params),
         matcher_(params.matcher_params),
+        keyframe_matcher_(params.matcher_params),
         tracker_(params.tracker_params),
-        img_buffer_(params_.retrack_frames_k) {}
+        img_buffer_(params_.retrack_frames_k),
+        live_tracks_(params_.max_obs_per_track),
+        age_buckets_(params_.retrack_frames_k + 1),
+        live_lmk_ids_k_ago_(params_.retrack_frames_k + 1),
+        live_lmk_pts_k_ago_(params_.retrack_frames_k + 1),
+        live_lmk_idx_k_ago_(params_.retrack_frames_k + 1),
+        live_lmk_pts_cur_(params_.retrack_frames_k + 1),
+        klt_status_(params_.retrack_frames_k + 1)
+  {
+    // Nothing is detected under the vehicle body (see StereoCamera::LeftMask()).
+    detector_.SetStaticMask(stereo_rig_.LeftMask());
+  }
+
+  // Waits for an async keyframe detection that is still running.
+  ~StereoTracker();
+
+  // Returns whether a new keyframe was initialized. If prev_R_cur is given, it's the rotation of
+  // the left camera since the last image that was tracked, and it's used to predict where points
+  // will be in this image (so KLT searches less, see FeatureTracker::Params::klt_guess_max_level).
+  bool TrackAndTriangulate(const StereoImage1b& stereo_pair,
+                           bool force_keyframe,
+                           const Matrix3d* prev_R_cur = nullptr);
 
-  // Returns whether a new keyframe was initialized.
-  bool TrackAndTriangulate(const StereoImage1b& stereo_pair, bool force_keyframe);
+  // Builds the pyramid for the left image (which TrackAndTriangulate() then reuses, from the pair's
+  // FrameCache) and estimates its quality from pyramid "level". Lets a caller skip bad images before
+  // paying for tracking.
+  FrameQuality PrepareFrame(const StereoImage1b& stereo_pair, int level);
+
+  // Will TrackAndTriangulate() be forced to make this image a keyframe by trigger_keyframe_k? Lets
+  // a caller that skips images make sure not to skip this one.
+  bool KeyframeDue(uid_t camera_id) const
+  {
+    return (int)(camera_id - prev_kf_id_) >= params_.trigger_keyframe_k;
+  }
+
+  // By default, keyframes are triggered every trigger_keyframe_k frames. If a trigger is set, it
+  // decides instead (but trigger_keyframe_k and trigger_keyframe_min_lmks still force keyframes).
+  // It's called from TrackAndTriangulate().
+  void SetKeyframeTrigger(const KeyframeTrigger& trigger) { keyframe_trigger_ = trigger; }
+
+  // Trade tracking quality for speed while running (see FeatureDetector::SetMaxFeaturesPerFrame()
+  // and FeatureTracker::SetMaxLevel()). Call this from the thread that calls TrackAndTriangulate().
+  void SetTrackingEffort(int max_features_per_frame, int klt_max_level)
+  {
+    WaitForKeyframeDetection();
+    detector_.SetMaxFeaturesPerFrame(max_features_per_frame);
+    tracker_.SetMaxLevel(klt_max_level);
+  }
 
   // Draws current feature tracks:
   // BLUE = Newly detected feature
@@ -73,32 +164,157 @@ class StereoTracker final {
   Image3b VisualizeFeatureTracks() const;
 
   const FeatureTracks& GetLiveTracks() const { return live_tracks_; }
+
+  // Number of tracked landmarks that were stereo matched in the last TrackAndTriangulate() (the
+  // rest used their filtered disparity).
+  size_t NumStereoMatches() const { return num_stereo_matches_; }
+
+  // Number of landmarks that weren't tracked in the last TrackAndTriangulate(), because it ran out of
+  // time (see track_deadline_ms).
+  size_t NumSkippedByDeadline() const { return num_deadline_skipped_; }
+
   void KillLandmark(uid_t lmk_id);
 
  private:
   // Get the next available landmark uid_t.
+  // NOTE(milo): Allocated in 32 bits, so that they fit in a LandmarkObservation even after they wrap.
   uid_t AllocateLandmarkId() { return next_lmk_id_++; }
 
-  // Kill off any landmarks that haven't been seen in lost_point_lifespan frames.
-  // This should be called AFTER tracking points in to the current image so that the most recent
-  // observations are available.
-  void KillOffLostLandmarks(uid_t cur_camera_id);
+  // The live landmarks that were last seen in one tracked image, and where. Every live landmark is
+  // in exactly one bucket, so tracking reads its batches straight out of them, and killing lost
+  // landmarks only looks at the bucket that falls out of the window.
+  struct AgeBucket final
+  {
+    bool in_window = false;     // Holds the current or a buffered image.
+    uid_t camera_id = 0;
+    std::vector<uid_t> lmk_ids;
+    VecPoint2f lmk_pts;
+    std::vector<uchar> retracked; // Seen again in the current image (moved to its bucket).
+  };
+
+  // A landmark waiting to be tracked with a deadline.
+  struct QueuedLandmark final
+  {
+    uid_t lmk_id = 0;
+    int k = 0;                  // Last seen k tracked images ago.
+    size_t idx = 0;             // ... at this index in its AgeBucket.
+    cv::Point2f pt;             // ... at this pixel.
+    int cell = 0;
+    int rank = 0;               // Rank within its cell (0 = best).
+    double score = 0;
+  };
+
+  // The bucket of the "frame"th tracked image (counting from zero). It's a ring of
+  // retrack_frames_k + 1 buckets: the buffered images, and the current one.
+  AgeBucket& AgeBucketAt(size_t frame) { return age_buckets_.at(frame % age_buckets_.size()); }
+
+  // The bucket of a buffered (or the current) image, or nullptr if it's not in the window.
+  AgeBucket* FindAgeBucket(uid_t camera_id);
+
+  // KLT-tracks the landmarks in live_lmk_*_k_ago_ into cur_frame_, and appends the ones that were
+  // found to good_lmk_ids_ and good_lmk_pts_ (and where they came from to good_lmk_src_).
+  void TrackBatches();
+
+  // Same as TrackBatches(), but in priority order, and stops at the deadline (see track_deadline_ms).
+  void TrackBatchesWithDeadline(Timer& timer);
+
+  // Puts the landmarks in live_lmk_*_k_ago_ into deadline_queue_, best first. Landmarks are scored by
+  // track age, then disparity, and interleaved across a grid so that the first ones cover the image.
+  void PrioritizeLandmarks();
+
+  // Starts a track for each new keypoint in a keyframe that could be triangulated. Returns how many
+  // were added.
+  int AddNewTracks(uid_t camera_id, const VecPoint2f& new_left_kps, const std::vector<double>& new_lmk_disps);
+
+  // Stereo matches left keypoints (a disparity prior <= 0 means there isn't one). In KLT mode, this
+  // uses the frame's cached left and right pyramids.
+  std::vector<double> MatchStereo(const StereoImage1b& stereo_pair,
+                                  const VecPoint2f& left_kps,
+                                  const std::vector<double>& disp_priors);
+
+  // Invalidates (sets to -1) the disparities of left keypoints whose match lands on a pixel that the
+  // right camera's StaticMask blocks. The images are rows x cols.
+  void RejectBlockedMatches(const VecPoint2f& left_kps, int rows, int cols, std::vector<double>& disps) const;
+
+  // Detects and stereo matches new keypoints for a keyframe on a worker (see async_keyframe_detection).
+  void StartKeyframeDetection(const StereoImage1b& stereo_pair, const VecPoint2f& tracked_kps);
+
+  // Blocks until the async keyframe detection (if any) is done.
+  void WaitForKeyframeDetection();
+
+  // Adds the tracks from the last async keyframe detection, once it's done.
+  void MergeKeyframeDetection();
+
+  // Kill off any landmarks that weren't seen in any of the images in img_buffer_ (the bucket of the
+  // image that just fell out of it). This should be called AFTER tracking points in to the current
+  // image and adding it to the buffer.
+  void KillOffLostLandmarks();
+
+  // Rotation of the left camera from the image tracked k images ago to the current one, if a
+  // rotation prior was given for every image since then.
+  bool RotationSince(int k, Matrix3d& cur_R_ref) const;
+
+  // Predict where px_ref move to under a pure rotation of the camera.
+  void PredictFromRotation(const Matrix3d& cur_R_ref, const VecPoint2f& px_ref, VecPoint2f& px_cur) const;
+
+  // Compares the landmarks tracked into the current frame with the last keyframe.
+  KeyframeCues ComputeKeyframeCues(const StereoImage1b& stereo_pair,
+                                   const std::vector<uid_t>& lmk_ids,
+                                   const VecPoint2f& lmk_pts);
 
  private:
   Params params_;
   StereoCamera stereo_rig_;
 
-  uid_t next_lmk_id_ = 0;
+  uint32_t next_lmk_id_ = 0;
   uid_t prev_kf_id_ = 0;
   uid_t prev_camera_id_ = 0;
+  timestamp_t prev_kf_timestamp_ = 0;
+  int num_lmks_prev_kf_ = 0;              // Landmarks observed in the last keyframe.
+  size_t num_stereo_matches_ = 0;
+  size_t num_deadline_skipped_ = 0;
+  KeyframeTrigger keyframe_trigger_;
+  std::vector<float> parallax_px_;        // Scratch space for ComputeKeyframeCues().
 
   FeatureDetector detector_;
   StereoMatcher matcher_;
+  StereoMatcher keyframe_matcher_;        // Only used by async keyframe detection (matchers aren't threadsafe).
   FeatureTracker tracker_;
 
-  SlidingBuffer<Image1b> img_buffer_;
+  // The async keyframe detection. While it's running, only the worker touches detector_,
+  // keyframe_matcher_ and the keyframe_* results.
+  std::mutex keyframe_mutex_;
+  std::condition_variable keyframe_cv_;
+  bool keyframe_busy_ = false;
+  bool keyframe_pending_ = false;         // Are there results to merge?
+  uid_t keyframe_camera_id_ = 0;
+  VecPoint2f keyframe_kps_;
+  std::vector<double> keyframe_disps_;
+
+  // The last retrack_frames_k left images that were tracked. The current frame is built in cur_frame_ and then
+  // swapped into the buffer. Pyramids share their pixels with the FrameCache of the stereo pair that
+  // they came from, so they're never built over top of (see FeatureTracker::CachedPyramid).
+  SlidingBuffer<PyramidFrame> img_buffer_;
+  PyramidFrame cur_frame_;
 
   FeatureTracks live_tracks_;
+  std::vector<AgeBucket> age_buckets_;    // See AgeBucketAt().
+
+  // Scratch space for TrackAndTriangulate(), indexed by how many frames ago a landmark was last
+  // seen. These are cleared every frame but keep their capacity.
+  std::vector<std::vector<uid_t>> live_lmk_ids_k_ago_;
+  std::vector<VecPoint2f> live_lmk_pts_k_ago_;
+  std::vector<std::vector<size_t>> live_lmk_idx_k_ago_;   // Index in the AgeBucket.
+  std::vector<VecPoint2f> live_lmk_pts_cur_;
+  std::vector<std::vector<uchar>> klt_status_;
+  std::vector<uid_t> good_lmk_ids_;
+  VecPoint2f good_lmk_pts_;
+  std::vector<std::pair<int, size_t>> good_lmk_src_;      // (k, index in its AgeBucket)
+  std::vector<double> good_lmk_disps_;
+  std::vector<size_t> match_idx_;         // Indices into good_lmk_ids_ that get re-matched.
+  VecPoint2f match_pts_;
+  std::vector<double> match_disp_priors_;
+  std::vector<QueuedLandmark> deadline_queue_;
 };
 
 }
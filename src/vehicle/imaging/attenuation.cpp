@@ -1,6 +1,9 @@
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 
+#include <glog/logging.h>
 #include <opencv2/imgproc.hpp>
 
 #include "imaging/attenuation.hpp"
@@ -12,6 +15,10 @@ namespace imaging {
 
 static const float kBackgroundRange = 10.0f;
 
+// Entries in the attenuation gain table, from zero to the max range. The gain grows exponentially
+// with range, but the relative error of interpolating it is still under 1e-4 for 20m.
+static const int kGainLutSize = 4096;
+
 
 static float MaxDiagonal(const Matrix12f& H)
 {
@@ -32,33 +39,42 @@ static float RobustWeightCauchy(float residual)
 }
 
 
-float EstimateBeta(const Image1f& range,
-                   const Image3f illuminant,
-                   int num_px, int iters,
-                   Vector12f& X)
+std::vector<cv::Point> SampleBetaPixels(const Image1f& range, int num_px)
 {
-  const Image1b range_valid = (range > 1e-3);
-
   // Good as long as at least 25% of the image has valid (nonzero) range.
   const int px_per_row = std::sqrt(4*num_px);
-  const int stride_x = (range.cols - 10) / px_per_row;
-  const int stride_y = (range.rows - 10) / px_per_row;
+  const int stride_x = std::max(1, (range.cols - 10) / px_per_row);
+  const int stride_y = std::max(1, (range.rows - 10) / px_per_row);
 
   // Sample points from a uniform grid (and skip borders).
   std::vector<cv::Point> sample_px;
   for (int x = 5; x < (range.cols - 5); x += stride_x) {
     for (int y = 5; y < (range.rows - 5); y += stride_y) {
       const cv::Point px(x, y);
-      if (range_valid(px)) {
+      if (range(px) > 1e-3) {
         sample_px.emplace_back(px);
       }
     }
   }
 
-  // Limit to a small number of pixel locations (randomly sampled).
-  // TODO(milo): Avoid giant random shuffle.
-  std::random_shuffle(sample_px.begin(), sample_px.end());
-  sample_px.resize(std::min(num_px, static_cast<int>(sample_px.size())));
+  // Limit to a small number of pixel locations (randomly sampled). Only the first num_px need to
+  // be shuffled (partial Fisher-Yates).
+  const int num_samples = std::min(num_px, static_cast<int>(sample_px.size()));
+  for (int i = 0; i < num_samples; ++i) {
+    std::swap(sample_px.at(i), sample_px.at(i + std::rand() % (sample_px.size() - i)));
+  }
+  sample_px.resize(num_samples);
+
+  return sample_px;
+}
+
+
+float EstimateBeta(const Image1f& range,
+                   const Image3f illuminant,
+                   int num_px, int iters,
+                   Vector12f& X)
+{
+  const std::vector<cv::Point> sample_px = SampleBetaPixels(range, num_px);
 
   std::vector<float> ranges(sample_px.size());
   std::vector<Vector3f> illuminants(sample_px.size());
@@ -69,28 +85,37 @@ float EstimateBeta(const Image1f& range,
     illuminants.at(i) = Vector3f(illuminant(pt)[0], illuminant(pt)[1], illuminant(pt)[2]);
   }
 
-  Matrix12f H = Matrix12f::Zero();
-  Vector12f g = Vector12f::Zero();
+  return EstimateBeta(ranges, illuminants, iters, X);
+}
+
+
+float EstimateBeta(const std::vector<float>& ranges,
+                   const std::vector<Vector3f>& illuminants,
+                   int iters,
+                   Vector12f& X)
+{
+  CHECK_EQ(ranges.size(), illuminants.size());
 
   // Calculate the error if using current variable guess.
+  // NOTE(milo): The normal equations are 12x12 no matter how many pixels are sampled, so nothing
+  // here is allocated per iteration.
+  NormalEquations12 eqs;
   float err = 0;
-  float err_prev = std::numeric_limits<float>::max();
-  LinearizeBeta(ranges, illuminants, X, H, g, err);
+  LinearizeBeta(ranges, illuminants, X, eqs);
+  float err_prev = eqs.error;
 
-  float lambda = 1e-3 * MaxDiagonal(H);
+  float lambda = 1e-3 * MaxDiagonal(eqs.H);
   const float lambda_k_increase = 4.0;
   const float lambda_k_decrease = 3.0;
   const float step_size = 0.5f;
 
   for (int iter = 0; iter < iters; ++iter) {
     // Levenberg-Marquardt diagonal thing.
-    H.diagonal() += Vector12f::Constant(lambda);
+    // NOTE(milo): This adds to the damping from earlier iterations until the next linearization.
+    eqs.H.diagonal() += Vector12f::Constant(lambda);
 
-    // std::cout << "H:\n" << H << std::endl;
-    // std::cout << "g:\n" << g << std::endl;
-
-    Eigen::ColPivHouseholderQR<Matrix12f> solver(H);
-    const Vector12f dX = step_size * solver.solve(g);
+    Eigen::ColPivHouseholderQR<Matrix12f> solver(eqs.H);
+    const Vector12f dX = step_size * solver.solve(eqs.g);
 
     // Compute the error if we were to take the step dX.
     Vector12f X_test = (X + dX);
@@ -109,19 +134,20 @@ float EstimateBeta(const Image1f& range,
     // See: https://en.wikipedia.org/wiki/Levenberg%E2%80%93Marquardt_algorithm
     if (err > err_prev) {
       lambda *= lambda_k_increase;
-      printf("Error increased, lambda = %f\n", lambda);
+      // printf("Error increased, lambda = %f\n", lambda);
 
     // If error improves, decrease the damping factor (more like Gauss-Newton).
     // See: https://en.wikipedia.org/wiki/Levenberg%E2%80%93Marquardt_algorithm
     } else {
       lambda /= lambda_k_decrease;
-      printf("Error decreased, err = %f lambda = %f\n", err, lambda);
+      // printf("Error decreased, err = %f lambda = %f\n", err, lambda);
 
       // Gauss-Newton update: https://en.wikipedia.org/wiki/Gauss%E2%80%93Newton_algorithm.
       X = X_test;
 
       // Because we changed X, need to re-linearize the image formation model.
-      LinearizeBeta(ranges, illuminants, X, H, g, err_prev);
+      LinearizeBeta(ranges, illuminants, X, eqs);
+      err_prev = eqs.error;
     }
   }
 
@@ -135,20 +161,18 @@ float ComputeError(const std::vector<float>& ranges,
 {
   assert(ranges.size() == illuminants.size());
 
-  float error = 0.0f;
-  const int M = ranges.size();
+  const Vector3f a = X.block<3, 1>(0, 0);
+  const Vector3f b = X.block<3, 1>(3, 0);
+  const Vector3f c = X.block<3, 1>(6, 0);
+  const Vector3f d = X.block<3, 1>(9, 0);
 
-  for (int i = 0; i < ranges.size(); ++i) {
-    const float z = ranges.at(i);
+  // NOTE(milo): Weighting the error is misleading, and leads to wrong changes to lambda in LM.
+  const float error = AccumulateError(static_cast<int>(ranges.size()), [&](int i) {
+    const float z = ranges[i];
 
-    const Vector3f E = illuminants.at(i).cwiseMax(1e-3);
+    const Vector3f E = illuminants[i].cwiseMax(1e-3);
     const Vector3f log_E = E.array().log();
 
-    const Vector3f a = X.block<3, 1>(0, 0);
-    const Vector3f b = X.block<3, 1>(3, 0);
-    const Vector3f c = X.block<3, 1>(6, 0);
-    const Vector3f d = X.block<3, 1>(9, 0);
-
     const Vector3f exp_bz = (b * z).array().exp();
     const Vector3f exp_dz = (d * z).array().exp();
 
@@ -157,49 +181,32 @@ float ComputeError(const std::vector<float>& ranges,
 
     const Vector3f z_c = -log_E.array() * beta_c_inv.array();
 
-    // Difference between observed z and model-predicted z.
-    const Vector3f r_c = Vector3f::Constant(z) - z_c;
-
-    // Residual is the SSD of z errors.
-    const float r = r_c(0)*r_c(0) + r_c(1)*r_c(1) + r_c(2)*r_c(2);
-
-    // NOTE(milo): Weighting the error is misleading, and leads to wrong changes to lambda in LM.
-    error += r;
-  }
+    // Residual is the SSD of the difference between observed z and model-predicted z.
+    return (Vector3f::Constant(z) - z_c).squaredNorm();
+  });
 
-  return error / static_cast<float>(M);
+  return error / static_cast<float>(ranges.size());
 }
 
 
 void LinearizeBeta(const std::vector<float>& ranges,
-                   const std::vector<Vector3f> illuminants,
+                   const std::vector<Vector3f>& illuminants,
                    const Vector12f& X,
-                   Matrix12f& H,
-                   Vector12f& g,
-                   float& error)
+                   NormalEquations12& eqs)
 {
   assert(ranges.size() == illuminants.size());
 
-  error = 0.0f;
-  const int M = ranges.size();
-
-  // Initialize Jacobian w/ zeros.
-  Eigen::MatrixXf J = Eigen::MatrixXf::Zero(M, 12);
+  const Vector3f a = X.block<3, 1>(0, 0);
+  const Vector3f b = X.block<3, 1>(3, 0);
+  const Vector3f c = X.block<3, 1>(6, 0);
+  const Vector3f d = X.block<3, 1>(9, 0);
 
-  // Initialize residual error vector R.
-  Eigen::VectorXf R = Eigen::VectorXf::Zero(M);
+  AccumulateNormalEquations(static_cast<int>(ranges.size()), [&](int i, NormalEquations12& chunk) {
+    const float z = ranges[i];
 
-  for (int i = 0; i < ranges.size(); ++i) {
-    const float z = ranges.at(i);
-
-    const Vector3f E = illuminants.at(i).cwiseMax(1e-3);
+    const Vector3f E = illuminants[i].cwiseMax(1e-3);
     const Vector3f log_E = E.array().log();
 
-    const Vector3f a = X.block<3, 1>(0, 0);
-    const Vector3f b = X.block<3, 1>(3, 0);
-    const Vector3f c = X.block<3, 1>(6, 0);
-    const Vector3f d = X.block<3, 1>(9, 0);
-
     const Vector3f exp_bz = (b * z).array().exp();
     const Vector3f exp_dz = (d * z).array().exp();
 
@@ -214,88 +221,157 @@ void LinearizeBeta(const std::vector<float>& ranges,
     const Vector3f r_c = Vector3f::Constant(z) - z_c;
 
     // Residual is the SSD of z errors.
-    const float r = r_c(0)*r_c(0) + r_c(1)*r_c(1) + r_c(2)*r_c(2);
+    const float r = r_c.squaredNorm();
     const float weight = RobustWeightCauchy(r);
-    R(i) = weight * r;
 
     // NOTE(milo): Weighting the error is misleading, and leads to wrong changes to lambda in LM.
-    error += r;
+    chunk.error += r;
 
     // Outer chain-rule stuff that multiplies everything.
     const Vector3f outer = -2.0f * r_c.array() * log_E.array() * beta_c2_inv.array();
 
-    const Vector3f J_ac = outer.array() * exp_bz.array();
-    const Vector3f J_bc = outer.array() * z * a.array() * exp_bz.array();
-    const Vector3f J_cc = outer.array() * exp_dz.array();
-    const Vector3f J_dc = outer.array() * z * c.array() * exp_dz.array();
-
     Vector12f Ji;
-    Ji.block<3, 1>(0, 0) = J_ac;
-    Ji.block<3, 1>(3, 0) = J_bc;
-    Ji.block<3, 1>(6, 0) = J_cc;
-    Ji.block<3, 1>(9, 0) = J_dc;
-
-    J.row(i) = weight * Ji;
-  }
+    Ji.block<3, 1>(0, 0) = outer.array() * exp_bz.array();
+    Ji.block<3, 1>(3, 0) = outer.array() * z * a.array() * exp_bz.array();
+    Ji.block<3, 1>(6, 0) = outer.array() * exp_dz.array();
+    Ji.block<3, 1>(9, 0) = outer.array() * z * c.array() * exp_dz.array();
 
-  H = J.transpose() * J;
-  g = -J.transpose() * R;
+    chunk.Add(weight * Ji, weight * r);
+  }, eqs);
 
   // Normalize error by # of samples.
-  error /= static_cast<float>(M);
+  eqs.error /= static_cast<float>(ranges.size());
 }
 
 
-static Image1f MatExp(const Image1f& m)
+// Fills lut with the gain exp(beta_c(z) * z) for z = i * z_max / (kGainLutSize - 1), and returns
+// the scale from z to a (fractional) table index.
+static float BuildGainLut(const Vector12f& X, float z_max, std::vector<cv::Vec3f>& lut)
 {
-  Image1f out;
-  cv::exp(m, out);
-  return out;
+  const Vector3f a = X.block<3, 1>(0, 0);
+  const Vector3f b = X.block<3, 1>(3, 0);
+  const Vector3f c = X.block<3, 1>(6, 0);
+  const Vector3f d = X.block<3, 1>(9, 0);
+
+  lut.resize(kGainLutSize + 1);
+  const float dz = std::max(z_max, 1e-3f) / static_cast<float>(kGainLutSize - 1);
+  for (int i = 0; i <= kGainLutSize; ++i) {
+    const float z = i * dz;
+    for (int ch = 0; ch < 3; ++ch) {
+      const float beta_c = a(ch) * std::exp(b(ch) * z) + c(ch) * std::exp(d(ch) * z);
+      lut[i][ch] = std::exp(beta_c * z);
+    }
+  }
+
+  return 1.0f / dz;
+}
+
+
+// Interpolates the gain at z (which must be in [0, z_max]) from a table made by BuildGainLut().
+static inline cv::Vec3f LookupGain(const std::vector<cv::Vec3f>& lut, float z_to_index, float z)
+{
+  const float x = z * z_to_index;
+  const int i = std::min(static_cast<int>(x), kGainLutSize - 1);
+  const float t = x - i;
+  return lut[i] + t * (lut[i + 1] - lut[i]);
 }
 
 
-static Image1f SetMaxRangeWhereZero(const Image1f& range)
+// Undoes attenuation with the gains from a table, and also stores them in gain (if not null).
+static void CorrectAttenuationLut(const Image3f& bgr,
+                                  const Image1f& range,
+                                  const Vector12f& X,
+                                  std::vector<cv::Vec3f>& lut,
+                                  Image3f* gain,
+                                  Image3f& out)
 {
+  // Set the range to max wherever it's zero.
   double rmin, rmax;
-  cv::Point pmin, pmax;
-  cv::minMaxLoc(range, &rmin, &rmax, &pmin, &pmax);
+  cv::minMaxLoc(range, &rmin, &rmax);
+  const float z_default = static_cast<float>(rmax);
+  const float z_to_index = BuildGainLut(X, static_cast<float>(rmax), lut);
+
+  out.create(bgr.size());
+
+  cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range& rows) {
+    for (int r = rows.start; r < rows.end; ++r) {
+      const cv::Vec3f* D = bgr.ptr<cv::Vec3f>(r);
+      const float* Z = range.ptr<float>(r);
+      cv::Vec3f* J = out.ptr<cv::Vec3f>(r);
+      cv::Vec3f* G = (gain != nullptr) ? gain->ptr<cv::Vec3f>(r) : nullptr;
+
+      for (int col = 0; col < bgr.cols; ++col) {
+        const float z = (Z[col] > 0) ? Z[col] : (Z[col] + z_default);
+        const cv::Vec3f g = LookupGain(lut, z_to_index, std::max(0.0f, z));
+        J[col] = D[col].mul(g);
+        if (G != nullptr) {
+          G[col] = g;
+        }
+      }
+    }
+  });
+}
 
-  Image1f add_where_zero;
-  cv::threshold(range, add_where_zero, 0.0f, rmax, CV_THRESH_BINARY_INV);
-  return range + add_where_zero;
+
+void CorrectAttenuation(const Image3f& bgr, const Image1f& range, const Vector12f& X, Image3f& out)
+{
+  std::vector<cv::Vec3f> lut;
+  CorrectAttenuationLut(bgr, range, X, lut, nullptr, out);
 }
 
 
 Image3f CorrectAttenuation(const Image3f& bgr, const Image1f& range, const Vector12f& X)
 {
-  const Image1f& z = SetMaxRangeWhereZero(range);
+  Image3f out;
+  CorrectAttenuation(bgr, range, X, out);
+  return out;
+}
 
-  const float a_b = X(0);
-  const float a_g = X(1);
-  const float a_r = X(2);
 
-  const float b_b = X(3);
-  const float b_g = X(4);
-  const float b_r = X(5);
+bool AttenuationCorrector::SameRange(const Image1f& range) const
+{
+  if (range.size() != range_.size()) {
+    return false;
+  }
 
-  const float c_b = X(6);
-  const float c_g = X(7);
-  const float c_r = X(8);
+  for (int r = 0; r < range.rows; ++r) {
+    if (std::memcmp(range.ptr<float>(r), range_.ptr<float>(r), range.cols * sizeof(float)) != 0) {
+      return false;
+    }
+  }
 
-  const float d_b = X(9);
-  const float d_g = X(10);
-  const float d_r = X(11);
+  return true;
+}
 
-  Image1f beta_cz[3];
-  beta_cz[0] = z.mul(a_b * MatExp(z * b_b) + c_b * MatExp(z * d_b));
-  beta_cz[1] = z.mul(a_g * MatExp(z * b_g) + c_g * MatExp(z * d_g));
-  beta_cz[2] = z.mul(a_r * MatExp(z * b_r) + c_r * MatExp(z * d_r));
 
-  Image3f E;
-  cv::merge(beta_cz, 3, E);
-  cv::exp(E, E);
+void AttenuationCorrector::Correct(const Image3f& bgr,
+                                   const Image1f& range,
+                                   const Vector12f& X,
+                                   Image3f& out)
+{
+  last_call_cached_ = has_gain_ && X == X_ && SameRange(range);
+
+  if (!last_call_cached_) {
+    X_ = X;
+    range.copyTo(range_);
+    gain_.create(bgr.size());
+    CorrectAttenuationLut(bgr, range, X, lut_, &gain_, out);
+    has_gain_ = true;
+    return;
+  }
 
-  return bgr.mul(E);
+  // NOTE(milo): Treat each row as a flat array of floats, so that this loop vectorizes.
+  out.create(bgr.size());
+  cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range& rows) {
+    for (int r = rows.start; r < rows.end; ++r) {
+      const float* D = bgr.ptr<float>(r);
+      const float* G = gain_.ptr<float>(r);
+      float* J = out.ptr<float>(r);
+      for (int i = 0; i < 3 * bgr.cols; ++i) {
+        J[i] = D[i] * G[i];
+      }
+    }
+  });
 }
 
 }
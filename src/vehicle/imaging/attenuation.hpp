@@ -1,7 +1,11 @@
 #pragma once
 
+#include <vector>
+
+#include "core/macros.hpp"
 #include "core/eigen_types.hpp"
 #include "vision_core/cv_types.hpp"
+#include "imaging/normal_equations.hpp"
 
 namespace bm {
 namespace imaging {
@@ -41,22 +45,68 @@ float EstimateBeta(const Image1f& range,
                    Vector12f& X);
 
 
+// Same as above, on samples that were already picked with SampleBetaPixels().
+float EstimateBeta(const std::vector<float>& ranges,
+                   const std::vector<Vector3f>& illuminants,
+                   int iters,
+                   Vector12f& X);
+
+
+// Picks (up to) num_px random pixels with a valid range from a uniform grid over the image (minus a
+// small border). These are the pixels that EstimateBeta() fits to.
+std::vector<cv::Point> SampleBetaPixels(const Image1f& range, int num_px);
+
+
 // Compute the residual error of depth using current beta parameters.
 float ComputeError(const std::vector<float>& ranges,
                    const std::vector<Vector3f>& illuminants,
                    const Vector12f& X);
 
 
-// Compute the Jacobian of the underwater image formation model wrt model parameters.
+// Linearize the range-dependent attenuation model wrt its parameters X, and sum the normal
+// equations over the samples (in parallel). eqs.error is the mean error.
 void LinearizeBeta(const std::vector<float>& ranges,
-                   const std::vector<Vector3f> illuminants,
+                   const std::vector<Vector3f>& illuminants,
                    const Vector12f& X,
-                   Matrix12f& H,
-                   Vector12f& g,
-                   float& error);
+                   NormalEquations12& eqs);
+
 
+// Undo the direct attenuation of an image (with backscatter removed), using the range-dependent
+// attenuation coefficients X. The output buffer is reused if it's already the right size.
+void CorrectAttenuation(const Image3f& bgr, const Image1f& range, const Vector12f& X, Image3f& out);
 
 Image3f CorrectAttenuation(const Image3f& bgr, const Image1f& range, const Vector12f& X);
 
+
+// CorrectAttenuation() for video. The gain exp(beta_c(z) * z) only depends on the range, so it is
+// looked up from a table over [0, max range] instead of taking 9 exps per pixel. The per-pixel
+// gains are also kept, so while the range image and X stay the same (e.g frames between model
+// refits with a fixed range map), a correction is just one multiply per pixel.
+class AttenuationCorrector final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(AttenuationCorrector);
+
+  AttenuationCorrector() = default;
+
+  void Correct(const Image3f& bgr, const Image1f& range, const Vector12f& X, Image3f& out);
+
+  // Did the last call to Correct() reuse the gains from the one before?
+  bool LastCallWasCached() const { return last_call_cached_; }
+
+  // The per-pixel gains from the last call to Correct().
+  const Image3f& Gain() const { return gain_; }
+
+ private:
+  bool SameRange(const Image1f& range) const;
+
+ private:
+  bool has_gain_ = false;
+  bool last_call_cached_ = false;
+  Vector12f X_;
+  Image1f range_;
+  Image3f gain_;
+  std::vector<cv::Vec3f> lut_;
+};
+
 }
 }
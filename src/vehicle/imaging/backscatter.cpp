@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 
 #include <eigen3/Eigen/QR>
@@ -17,6 +19,12 @@ namespace imaging {
 // Range of background pixels (in meters).
 static const float kBackgroundRange = 20.0f;
 
+// Pixels with less range than this (in meters) are not used to find dark pixels.
+static const float kMinValidRange = 0.1f;
+
+// Number of intensity histogram bins in FindDarkFast().
+static const int kDarkHistBins = 4096;
+
 
 // Returns the max diagonal entry from a 12x12 matrix.
 static float MaxDiagonal(const Matrix12f& H)
@@ -43,85 +51,103 @@ float FindDarkFast(const Image1f& intensity, const Image1f& range, float percent
   const float N = static_cast<float>(intensity.rows * intensity.cols);
   const int N_desired = static_cast<int>(percentile * N);
 
-  float low = 0;
-  float high = 0.5;
-
-  const Image1b& range_valid_mask = (range > 0.1);
-
-  // Start by assuming a uniform distribution over intensity (i.e 10th percentile <= 0.1 intensity).
-  mask = (intensity <= 1.5*percentile & range_valid_mask);
-  int N_dark = cv::countNonZero(mask);
-  if (N_dark < N_desired) {
-    low = 1.5*percentile;
-  } else if (N_dark > N_desired) {
-    high = 1.5*percentile;
-  } else {
-    return 1.5*percentile;
+  // NOTE(milo): Instead of binary searching for the threshold (a full image pass per step), build a
+  // histogram of intensity once. 4096 bins gives +/- 0.025% intensity accuracy.
+  int hist[kDarkHistBins] = { 0 };
+  for (int r = 0; r < intensity.rows; ++r) {
+    const float* I = intensity.ptr<float>(r);
+    const float* Z = range.ptr<float>(r);
+    for (int c = 0; c < intensity.cols; ++c) {
+      if (Z[c] > kMinValidRange) {
+        const int bin = std::min(std::max(0, static_cast<int>(I[c] * kDarkHistBins)), kDarkHistBins - 1);
+        ++hist[bin];
+      }
+    }
   }
 
-  // Switch to binary search to refine threshold.
-  // 8-iters gives +/- 0.4% accuracy.
-  // 10-iters gives +/-0.1% accuracy.
-  for (int iter = 0; iter < 8; ++iter) {
-    float threshold = (high + low) / 2.0f;
-    mask = (intensity <= threshold & range_valid_mask);
-    N_dark = cv::countNonZero(mask);
-
-    if (N_dark < N_desired) {
-      low = threshold;
-    } else if (N_dark > N_desired) {
-      high = threshold;
-    } else {
-      return threshold;
+  // The threshold is the top of the bin where the cumulative count reaches N_desired.
+  int bin = 0;
+  for (int N_dark = 0; bin < (kDarkHistBins - 1); ++bin) {
+    N_dark += hist[bin];
+    if (N_dark >= N_desired) {
+      break;
     }
   }
+  const float threshold = static_cast<float>(bin + 1) / static_cast<float>(kDarkHistBins);
+
+  mask.create(intensity.size());
+  cv::parallel_for_(cv::Range(0, intensity.rows), [&](const cv::Range& rows) {
+    for (int r = rows.start; r < rows.end; ++r) {
+      const float* I = intensity.ptr<float>(r);
+      const float* Z = range.ptr<float>(r);
+      uint8_t* M = mask.ptr<uint8_t>(r);
+      for (int c = 0; c < intensity.cols; ++c) {
+        M[c] = (I[c] <= threshold && Z[c] > kMinValidRange) ? 255 : 0;
+      }
+    }
+  });
 
-  return (high + low) / 2.0f;
+  return threshold;
 }
 
 
-float EstimateBackscatter(const Image3f& bgr,
-                         const Image1f& range,
-                         const Image1b& dark_mask,
-                         int num_px, int iters,
-                         Vector3f& B, Vector3f& beta_B,
-                         Vector3f& Jp, Vector3f& beta_D)
+// Randomly sample up to num_px of the dark pixels in an image.
+static void SampleDarkPixels(const Image3f& bgr,
+                             const Image1f& range,
+                             const Image1b& dark_mask,
+                             int num_px,
+                             std::vector<Vector3f>& bgrs,
+                             std::vector<float>& ranges)
 {
   std::vector<cv::Point> dark_px;
   cv::findNonZero(dark_mask, dark_px);
 
-  // Limit to a small number of pixel locations (randomly sampled).
-  std::random_shuffle(dark_px.begin(), dark_px.end());
-  dark_px.resize(std::min(num_px, static_cast<int>(dark_px.size())));
+  // Limit to a small number of pixel locations (randomly sampled). Only the first num_px need to
+  // be shuffled (partial Fisher-Yates).
+  const int num_samples = std::min(num_px, static_cast<int>(dark_px.size()));
+  for (int i = 0; i < num_samples; ++i) {
+    std::swap(dark_px.at(i), dark_px.at(i + std::rand() % (dark_px.size() - i)));
+  }
+  dark_px.resize(num_samples);
 
-  std::vector<Vector3f> bgrs(dark_px.size());
-  std::vector<float> ranges(dark_px.size());
+  bgrs.resize(dark_px.size());
+  ranges.resize(dark_px.size());
 
   for (int i = 0; i < dark_px.size(); ++i) {
     const cv::Point& pt = dark_px.at(i);
     bgrs.at(i) = Vector3f(bgr(pt)(0), bgr(pt)(1), bgr(pt)(2));
     ranges.at(i) = range(pt);
   }
+}
 
-  // Initialize Jacobian w/ zeros.
-  Eigen::MatrixXf J = Eigen::MatrixXf::Zero(static_cast<int>(bgrs.size()), 12);
 
-  // Initialize residual error vector R.
-  Eigen::VectorXf R = Eigen::VectorXf::Zero(bgrs.size());
+float EstimateBackscatter(const Image3f& bgr,
+                         const Image1f& range,
+                         const Image1b& dark_mask,
+                         int num_px, int iters,
+                         Vector3f& B, Vector3f& beta_B,
+                         Vector3f& Jp, Vector3f& beta_D)
+{
+  std::vector<Vector3f> bgrs;
+  std::vector<float> ranges;
+  SampleDarkPixels(bgr, range, dark_mask, num_px, bgrs, ranges);
 
   // Optimization variables.
   Vector12f X;
 
   // Calculate the error if using current variable guess.
   float err;
-  float err_prev = std::numeric_limits<float>::max();
   X.block<3, 1>(0, 0) = B;
   X.block<3, 1>(3, 0) = beta_B;
   X.block<3, 1>(6, 0) = Jp;
   X.block<3, 1>(9, 0) = beta_D;
-  LinearizeImageFormation(bgrs, ranges, B, beta_B, Jp, beta_D, J, R, err_prev);
-  Matrix12f H = J.transpose() * J;
-  float lambda = 1e-3 * MaxDiagonal(H);
+
+  // NOTE(milo): The normal equations are 12x12 no matter how many pixels are sampled, so nothing
+  // here is allocated per iteration.
+  NormalEquations12 eqs;
+  LinearizeImageFormation(bgrs, ranges, X, eqs);
+  float err_prev = eqs.error;
+  float lambda = 1e-3 * MaxDiagonal(eqs.H);
 
   const float lambda_k_increase = 2.0;
   const float lambda_k_decrease = 3.0;
@@ -129,17 +155,15 @@ float EstimateBackscatter(const Image3f& bgr,
 
   for (int iter = 0; iter < iters; ++iter) {
     // http://ceres-solver.org/nnls_solving.html
-    Matrix12f H = J.transpose() * J;
-    const Vector12f g = -J.transpose() * R;
+    Matrix12f H = eqs.H;
 
     // Levenberg-Marquardt diagonal thing.
     H.diagonal() += Vector12f::Constant(lambda);
 
     Eigen::ColPivHouseholderQR<Matrix12f> solver(H);
-    const Vector12f dX = step_size * solver.solve(g);
+    const Vector12f dX = step_size * solver.solve(eqs.g);
 
     // Compute the error if we were to take the step dX.
-    // LinearizeImageFormation(bgrs, ranges, B, beta_B, Jp, beta_D, J, R, err);
     const Vector12f X_test = (X + dX).cwiseMax(0);
     err = ComputeImageFormationError(bgrs, ranges, X_test);
 
@@ -158,51 +182,70 @@ float EstimateBackscatter(const Image3f& bgr,
       // Gauss-Newton update: https://en.wikipedia.org/wiki/Gauss%E2%80%93Newton_algorithm.
       X = X_test;
 
-      // Pull individual vars out for next linearization.
-      B = X.block<3, 1>(0, 0);
-      beta_B = X.block<3, 1>(3, 0);
-      Jp = X.block<3, 1>(6, 0);
-      beta_D = X.block<3, 1>(9, 0);
-
       // Because we changed X, need to re-linearize the image formation model.
-      LinearizeImageFormation(bgrs, ranges, B, beta_B, Jp, beta_D, J, R, err_prev);
+      LinearizeImageFormation(bgrs, ranges, X, eqs);
+      err_prev = eqs.error;
     }
   }
 
+  // Pull individual vars out.
+  B = X.block<3, 1>(0, 0);
+  beta_B = X.block<3, 1>(3, 0);
+  Jp = X.block<3, 1>(6, 0);
+  beta_D = X.block<3, 1>(9, 0);
+
   return err_prev;
 }
 
 
+float ComputeBackscatterError(const Image3f& bgr,
+                              const Image1f& range,
+                              const Image1b& dark_mask,
+                              int num_px,
+                              const Vector3f& B, const Vector3f& beta_B,
+                              const Vector3f& Jp, const Vector3f& beta_D)
+{
+  std::vector<Vector3f> bgrs;
+  std::vector<float> ranges;
+  SampleDarkPixels(bgr, range, dark_mask, num_px, bgrs, ranges);
+
+  if (bgrs.empty()) {
+    return 0.0f;
+  }
+
+  Vector12f X;
+  X.block<3, 1>(0, 0) = B;
+  X.block<3, 1>(3, 0) = beta_B;
+  X.block<3, 1>(6, 0) = Jp;
+  X.block<3, 1>(9, 0) = beta_D;
+
+  return ComputeImageFormationError(bgrs, ranges, X);
+}
+
+
 float ComputeImageFormationError(const std::vector<Vector3f>& bgr,
                                 const std::vector<float>& ranges,
                                 const Vector12f& X)
 {
   assert(bgr.size() == ranges.size());
 
-  float error = 0.0f;
-
-  const Vector3f& B = X.block<3, 1>(0, 0);
-  const Vector3f& beta_B = X.block<3, 1>(3, 0);
-  const Vector3f& Jp = X.block<3, 1>(6, 0);
-  const Vector3f& beta_D = X.block<3, 1>(9, 0);
+  const Vector3f B = X.block<3, 1>(0, 0);
+  const Vector3f beta_B = X.block<3, 1>(3, 0);
+  const Vector3f Jp = X.block<3, 1>(6, 0);
+  const Vector3f beta_D = X.block<3, 1>(9, 0);
 
-  for (int i = 0; i < bgr.size(); ++i) {
+  const float error = AccumulateError(static_cast<int>(bgr.size()), [&](int i) {
     // Compute the residual BGR error.
-    const float z = ranges.at(i);
-    const Vector3f bgr_actual = bgr.at(i);
+    const float z = ranges[i];
+    const Vector3f& bgr_actual = bgr[i];
     const Vector3f atten_back = Vector3f::Ones() - Vector3f((-beta_B * z).array().exp());
 
     const Vector3f exp_beta_D = (-beta_D * z).array().exp();
     const Vector3f bgr_model = B.cwiseProduct(atten_back) + Jp.cwiseProduct(exp_beta_D);
 
-    const float r_b = (bgr_actual(0) - bgr_model(0));
-    const float r_g = (bgr_actual(1) - bgr_model(1));
-    const float r_r = (bgr_actual(2) - bgr_model(2));
-
     // Residual is the SSD of BGR error.
-    const float r = r_b*r_b + r_g*r_g + r_r*r_r;
-    error += r;
-  }
+    return (bgr_actual - bgr_model).squaredNorm();
+  });
 
   return error / static_cast<float>(bgr.size());
 }
@@ -210,67 +253,71 @@ float ComputeImageFormationError(const std::vector<Vector3f>& bgr,
 
 void LinearizeImageFormation(const std::vector<Vector3f>& bgr,
                              const std::vector<float>& ranges,
-                             Vector3f& B,
-                             Vector3f& beta_B,
-                             Vector3f& Jp,
-                             Vector3f& beta_D,
-                             Eigen::MatrixXf& J,
-                             Eigen::VectorXf& R,
-                             float& error)
+                             const Vector12f& X,
+                             NormalEquations12& eqs)
 {
-  // Jacobian should be m x 12, where m is the number of data points used.
-  assert(J.cols() == 12 && J.rows() == bgr.size());
   assert(bgr.size() == ranges.size());
-  assert(R.rows() == bgr.size());
 
-  error = 0.0f;
+  const Vector3f B = X.block<3, 1>(0, 0);
+  const Vector3f beta_B = X.block<3, 1>(3, 0);
+  const Vector3f Jp = X.block<3, 1>(6, 0);
+  const Vector3f beta_D = X.block<3, 1>(9, 0);
 
-  for (int i = 0; i < bgr.size(); ++i) {
+  AccumulateNormalEquations(static_cast<int>(bgr.size()), [&](int i, NormalEquations12& chunk) {
     // Compute the residual BGR error.
-    const float z = ranges.at(i);
-    const Vector3f bgr_actual = bgr.at(i);
-    const Vector3f atten_back = Vector3f::Ones() - Vector3f((-beta_B * z).array().exp());
+    const float z = ranges[i];
+    const Vector3f& bgr_actual = bgr[i];
+    const Vector3f exp_beta_B = (-beta_B * z).array().exp();
+    const Vector3f atten_back = Vector3f::Ones() - exp_beta_B;
 
     const Vector3f exp_beta_D = (-beta_D * z).array().exp();
     const Vector3f bgr_model = B.cwiseProduct(atten_back) + Jp.cwiseProduct(exp_beta_D);
 
-    const float r_b = (bgr_actual(0) - bgr_model(0));
-    const float r_g = (bgr_actual(1) - bgr_model(1));
-    const float r_r = (bgr_actual(2) - bgr_model(2));
+    const Vector3f r_c = bgr_actual - bgr_model;
 
     // Residual is the SSD of BGR error.
-    const float r = r_b*r_b + r_g*r_g + r_r*r_r;
+    const float r = r_c.squaredNorm();
     const float weight = RobustWeightCauchy(r);
-    R(i) = weight*r;
-    error += r;
-
-    const float J_Bb = -2.0f * r_b * atten_back(0);
-    const float J_Bg = -2.0f * r_g * atten_back(1);
-    const float J_Br = -2.0f * r_r * atten_back(2);
-
-    const Vector3f exp_beta_B = (-beta_B * z).array().exp();
-    const float J_beta_Bb = -2.0f * r_b * B(0) * z * exp_beta_B(0);
-    const float J_beta_Bg = -2.0f * r_g * B(1) * z * exp_beta_B(1);
-    const float J_beta_Br = -2.0f * r_r * B(2) * z * exp_beta_B(2);
+    chunk.error += r;
 
-    const float J_Jp_b = -2.0f * r_b * exp_beta_D(0);
-    const float J_Jp_g = -2.0f * r_g * exp_beta_D(1);
-    const float J_Jp_r = -2.0f * r_r * exp_beta_D(2);
+    Vector12f Ji;
+    Ji.block<3, 1>(0, 0) = -2.0f * r_c.cwiseProduct(atten_back);
+    Ji.block<3, 1>(3, 0) = -2.0f * z * r_c.cwiseProduct(B).cwiseProduct(exp_beta_B);
+    Ji.block<3, 1>(6, 0) = -2.0f * r_c.cwiseProduct(exp_beta_D);
+    Ji.block<3, 1>(9, 0) = 2.0f * z * r_c.cwiseProduct(Jp).cwiseProduct(exp_beta_D);
 
-    const float J_beta_Db = 2.0f * r_b * Jp(0) * z * exp_beta_D(0);
-    const float J_beta_Dg = 2.0f * r_g * Jp(1) * z * exp_beta_D(1);
-    const float J_beta_Dr = 2.0f * r_r * Jp(2) * z * exp_beta_D(2);
+    // NOTE(milo): All entries in the Jacobian have this outermost chain rule component.
+    chunk.Add(weight * Ji, weight * r);
+  }, eqs);
 
-    J.row(i) << J_Bb, J_Bg, J_Br,
-                J_beta_Bb, J_beta_Bg, J_beta_Br,
-                J_Jp_b, J_Jp_g, J_Jp_r,
-                J_beta_Db, J_beta_Dg, J_beta_Dr;
+  eqs.error /= static_cast<float>(bgr.size());
+}
 
-    // NOTE(milo): All entries in the Jacobian have this outermost chain rule component.
-    J.row(i) *= weight;
-  }
 
-  error /= static_cast<float>(bgr.size());
+void RemoveBackscatter(const Image3f& bgr,
+                       const Image1f& range,
+                       const Vector3f& B,
+                       const Vector3f& beta_B,
+                       Image3f& out)
+{
+  out.create(bgr.size());
+
+  cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range& rows) {
+    for (int r = rows.start; r < rows.end; ++r) {
+      const cv::Vec3f* I = bgr.ptr<cv::Vec3f>(r);
+      const float* Z = range.ptr<float>(r);
+      cv::Vec3f* D = out.ptr<cv::Vec3f>(r);
+
+      for (int c = 0; c < bgr.cols; ++c) {
+        // Set the range to max wherever it's zero.
+        const float z = (Z[c] > 1e-3f) ? Z[c] : (Z[c] + kBackgroundRange);
+        for (int ch = 0; ch < 3; ++ch) {
+          const float backscatter = B(ch) * (1.0f - std::exp(-beta_B(ch) * z));
+          D[c][ch] = std::max(0.0f, I[c][ch] - backscatter);  // Clamp nonnegative.
+        }
+      }
+    }
+  });
 }
 
 
@@ -279,32 +326,32 @@ Image3f RemoveBackscatter(const Image3f& bgr,
                           const Vector3f& B,
                           const Vector3f& beta_B)
 {
-  Image1f Ic[3];
-  cv::split(bgr, Ic);
-
-  // Set the range to max wherever it's zero.
-  Image1f range_default;
-  cv::threshold(range, range_default, 1e-3, kBackgroundRange, CV_THRESH_BINARY_INV);
-  Image1f range_nonzero = range + range_default;
-
-  Image1f exp_b, exp_g, exp_r;
-  cv::exp(-beta_B(0)*range_nonzero, exp_b);
-  cv::exp(-beta_B(1)*range_nonzero, exp_g);
-  cv::exp(-beta_B(2)*range_nonzero, exp_r);
-
-  exp_b = B(0) * (1.0f - exp_b);
-  exp_g = B(1) * (1.0f - exp_g);
-  exp_r = B(2) * (1.0f - exp_r);
-
-  Ic[0] = Ic[0] - exp_b;
-  Ic[1] = Ic[1] - exp_g;
-  Ic[2] = Ic[2] - exp_r;
+  Image3f out;
+  RemoveBackscatter(bgr, range, B, beta_B, out);
+  return out;
+}
 
-  Image3f out = Image3f(bgr.size(), 0);
-  cv::merge(Ic, 3, out);
-  out = cv::max(out, 0.0f);  // Clamp nonnegative.
 
-  return out;
+void ComputeBackscatter(const Image1f& range,
+                        const Vector3f& B,
+                        const Vector3f& beta_B,
+                        Image3f& out)
+{
+  out.create(range.size());
+
+  cv::parallel_for_(cv::Range(0, range.rows), [&](const cv::Range& rows) {
+    for (int r = rows.start; r < rows.end; ++r) {
+      const float* Z = range.ptr<float>(r);
+      cv::Vec3f* Bc = out.ptr<cv::Vec3f>(r);
+
+      for (int c = 0; c < range.cols; ++c) {
+        const float z = (Z[c] > 1e-3f) ? Z[c] : (Z[c] + kBackgroundRange);
+        for (int ch = 0; ch < 3; ++ch) {
+          Bc[c][ch] = B(ch) * (1.0f - std::exp(-beta_B(ch) * z));
+        }
+      }
+    }
+  });
 }
 
 }
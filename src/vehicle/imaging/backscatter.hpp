@@ -2,6 +2,7 @@
 
 #include "vision_core/cv_types.hpp"
 #include "core/eigen_types.hpp"
+#include "imaging/normal_equations.hpp"
 
 namespace bm {
 namespace imaging {
@@ -9,7 +10,7 @@ namespace imaging {
 using namespace core;
 
 // Find the percentile-darkest pixels in an image. Returns the intensity threshold at which this
-// percentile occurrs (approximately).
+// percentile occurrs (approximately). Intensity should be in [0, 1].
 float FindDarkFast(const Image1f& intensity, const Image1f& range, float percentile, Image1b& mask);
 
 
@@ -22,31 +23,50 @@ float EstimateBackscatter(const Image3f& bgr,
                          Vector3f& Jp, Vector3f& beta_D);
 
 
+// Compute the error of a set of formation model parameters on (a sample of) the dark pixels in an
+// image, without optimizing them. Uses the same error as EstimateBackscatter().
+float ComputeBackscatterError(const Image3f& bgr,
+                              const Image1f& range,
+                              const Image1b& dark_mask,
+                              int num_px,
+                              const Vector3f& B, const Vector3f& beta_B,
+                              const Vector3f& Jp, const Vector3f& beta_D);
+
+
 // Compute the residual error of an image given a set of formation model parameters.
 float ComputeImageFormationError(const std::vector<Vector3f>& bgr,
                                  const std::vector<float>& ranges,
                                  const Vector12f& X);
 
 
-// Compute the Jacobian of the underwater image formation model wrt model parameters.
+// Linearize the underwater image formation model wrt model parameters X = (B, beta_B, Jp, beta_D),
+// and sum the normal equations over the samples (in parallel). eqs.error is the mean error.
 void LinearizeImageFormation(const std::vector<Vector3f>& bgr,
                              const std::vector<float>& ranges,
-                             Vector3f& B,
-                             Vector3f& beta_B,
-                             Vector3f& Jp,
-                             Vector3f& beta_D,
-                             Eigen::MatrixXf& J,
-                             Eigen::VectorXf& R,
-                             float& error);
+                             const Vector12f& X,
+                             NormalEquations12& eqs);
 
 
 // Removes backscattering from an image using the estimation veiling light B and attenuation
-// coefficient of veiling light beta_B.
+// coefficient of veiling light beta_B. The output buffer is reused if it's already the right size.
+void RemoveBackscatter(const Image3f& bgr,
+                       const Image1f& range,
+                       const Vector3f& B,
+                       const Vector3f& beta_B,
+                       Image3f& out);
+
 Image3f RemoveBackscatter(const Image3f& bgr,
                           const Image1f& range,
                           const Vector3f& B,
                           const Vector3f& beta_B);
 
 
+// The backscatter B*(1 - exp(-beta_B*z)) that RemoveBackscatter() subtracts at each pixel.
+void ComputeBackscatter(const Image1f& range,
+                        const Vector3f& B,
+                        const Vector3f& beta_B,
+                        Image3f& out);
+
+
 }
 }
@@ -0,0 +1,92 @@
+#include "imaging/depth_cache.hpp"
+
+namespace bm {
+namespace imaging {
+
+
+DepthCache::DepthCache(size_t max_bytes, bool millimeters)
+    : max_bytes_(max_bytes),
+      millimeters_(millimeters) {}
+
+
+std::shared_ptr<const DepthMap> DepthCache::Get(const std::string& filepath)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = entries_.find(filepath);
+    if (it != entries_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.lru);
+      ++num_hits_;
+      return it->second.map;
+    }
+    ++num_misses_;
+  }
+
+  // NOTE(milo): Load without the lock, so that other threads can hit while a TIF is decoded.
+  const std::shared_ptr<const DepthMap> map = std::make_shared<const DepthMap>(LoadDepth(filepath, millimeters_));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = entries_.find(filepath);
+  if (it != entries_.end()) {
+    return it->second.map;
+  }
+
+  lru_.emplace_front(filepath);
+  entries_.emplace(filepath, Entry{ map, lru_.begin() });
+  bytes_ += map->Bytes();
+  Evict();
+
+  return map;
+}
+
+
+void DepthCache::Clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  lru_.clear();
+  bytes_ = 0;
+}
+
+
+size_t DepthCache::Size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+
+size_t DepthCache::Bytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_;
+}
+
+
+size_t DepthCache::NumHits() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_hits_;
+}
+
+
+size_t DepthCache::NumMisses() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_misses_;
+}
+
+
+void DepthCache::Evict()
+{
+  while (bytes_ > max_bytes_ && lru_.size() > 1) {
+    const auto it = entries_.find(lru_.back());
+    bytes_ -= it->second.map->Bytes();
+    entries_.erase(it);
+    lru_.pop_back();
+  }
+}
+
+
+}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "core/macros.hpp"
+#include "imaging/io.hpp"
+
+namespace bm {
+namespace imaging {
+
+
+// Keeps recently used range maps in memory, so that tools that go over the same images several
+// times (e.g enhancement tests and batch enhancement) decode each TIF once. Maps are evicted least
+// recently used first once they take up more than max_bytes. With millimeters, TIFs are stored as
+// 16-bit millimeters, so twice as many fit.
+//
+// NOTE(milo): Threadsafe. Maps are immutable once cached, and a map that's evicted stays alive for
+// as long as a caller still has it. Two threads that miss on the same path both load it, and the
+// first one to finish is kept.
+class DepthCache final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(DepthCache)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(DepthCache)
+
+  explicit DepthCache(size_t max_bytes, bool millimeters = false);
+
+  // Returns the range map for a file (see LoadDepth()), loading it if it isn't cached.
+  std::shared_ptr<const DepthMap> Get(const std::string& filepath);
+
+  // Range in meters (see DepthMap::Meters()).
+  Image1f GetMeters(const std::string& filepath) { return Get(filepath)->Meters(); }
+
+  void Clear();
+
+  size_t Size() const;
+  size_t Bytes() const;
+  size_t NumHits() const;
+  size_t NumMisses() const;
+
+ private:
+  struct Entry final
+  {
+    std::shared_ptr<const DepthMap> map;
+    std::list<std::string>::iterator lru;
+  };
+
+  // Evicts the least recently used maps until they fit in max_bytes (always keeps the newest one).
+  // Called under the lock.
+  void Evict();
+
+ private:
+  size_t max_bytes_;
+  bool millimeters_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<std::string> lru_;    // Most recently used first.
+  size_t bytes_ = 0;
+  size_t num_hits_ = 0;
+  size_t num_misses_ = 0;
+};
+
+
+}
+}
@@ -1,4 +1,6 @@
-#include <opencv2/highgui.hpp>
+#include <algorithm>
+
+#include <glog/logging.h>
 #include <opencv2/imgproc.hpp>
 
 #include "core/math_util.hpp"
@@ -13,59 +15,72 @@ namespace bm {
 namespace imaging {
 
 
-// TODO(milo): Optimize the OpenCV-heavy function calls here. Or maybe recompile OpenCV?
-// With OpenCV compiled properly on the Jetson, image operations should be faster.
-// EnhanceContrast() --> 3 ms
-// RemoveBackscatter() --> 3.5 ms
-// Estimateil() --> 1.7ms
-// EstimateBackscatter is really fast with -O3 compile option!
-EUInfo EnhanceUnderwater(const Image3f& I,
-                          const Image1f& range,
-                          int back_num_px,
-                          int back_opt_iters,
-                          int beta_num_px,
-                          int beta_opt_iters,
-                          Vector12f beta_D_guess,
-                          Image3f& out)
+void UnderwaterEnhancer::Params::LoadParams(const YamlParser& parser)
 {
-  EUInfo info;
-
-  // Find dark pixels.
-  Image1b is_dark;
-  const Image1f intensity = ComputeIntensity(I);
-  FindDarkFast(intensity, range, 0.01, is_dark);
-  cv::imshow("dark_mask", is_dark);
-
-  info.success_finddark = true;
+  parser.GetParam("back_num_px", &back_num_px);
+  parser.GetParam("back_opt_iters", &back_opt_iters);
+  parser.GetParam("beta_num_px", &beta_num_px);
+  parser.GetParam("beta_opt_iters", &beta_opt_iters);
+  parser.GetParam("warm_back_opt_iters", &warm_back_opt_iters);
+  parser.GetParam("warm_beta_opt_iters", &warm_beta_opt_iters);
+  parser.GetParam("refit_every_n_frames", &refit_every_n_frames);
+  parser.GetParam("refit_error_ratio", &refit_error_ratio);
+  parser.GetParam("work_scale", &work_scale);
+}
 
-  // Optimize image formation parameters to best match observed dark pixels.
-  Vector3f B, beta_B, Jp, beta_D;
 
-  // NOTE(milo): I set this initial guess based on the D5 3374 image from Sea-thru.
+// NOTE(milo): I set this initial guess based on the D5 3374 image from Sea-thru.
+void BackscatterInitialGuess(EUInfo& info)
+{
   info.B << 0.132, 0.115, 0.0559;
   info.beta_B << 0.358, 0.695, 1.11;
   info.Jp << 0.05, 0.05, 0.05;
   info.beta_Dp << 1.17, 1.23, 0.891;
+}
+
+
+// Fit the backscatter and attenuation models to an image, starting from the params in info. Leaves
+// the image with backscatter removed in buffers.D. If have_dark_mask, buffers.is_dark is already
+// up to date for this image.
+//
+// NOTE(milo): The per-pixel stages (finding dark pixels, removing backscatter, and correcting
+// attenuation) are single passes over the image, parallelized over rows, and write into buffers
+// that are reused between frames. The guided filter for the illuminant is the rest of the cost, and
+// it also keeps its buffers (see GuidedFilter).
+static void FitModel(const Image3f& I,
+                     const Image1f& range,
+                     int back_num_px,
+                     int back_opt_iters,
+                     int beta_num_px,
+                     int beta_opt_iters,
+                     bool have_dark_mask,
+                     EUInfo& info,
+                     EUBuffers& buffers)
+{
+  // Find dark pixels.
+  if (!have_dark_mask) {
+    cv::cvtColor(I, buffers.intensity, CV_BGR2GRAY);
+    FindDarkFast(buffers.intensity, range, kDarkPercentile, buffers.is_dark);
+  }
+
+  info.success_finddark = true;
 
+  // Optimize image formation parameters to best match observed dark pixels.
   info.error_backscatter = EstimateBackscatter(
-      I, range, is_dark, back_num_px, back_opt_iters,
+      I, range, buffers.is_dark, back_num_px, back_opt_iters,
       info.B, info.beta_B, info.Jp, info.beta_Dp);
 
   info.success_backscatter = (info.error_backscatter < 0.1f);
 
-  const Image3f D = RemoveBackscatter(I, range, info.B, info.beta_B);
-  cv::imshow("remove_scatter", D);
+  RemoveBackscatter(I, range, info.B, info.beta_B, buffers.D);
 
   // Tuned the guided filter params offline.
   const double eps = 0.01;
   const int s = 8;
-  const int r = core::NextEvenInt(D.cols / 3);
-  const Image3f il = EstimateIlluminantRangeGuided(D, range, r, eps, s);
+  const int r = core::NextEvenInt(buffers.D.cols / 3);
+  EstimateIlluminantRangeGuided(buffers.D, range, r, eps, s, buffers.guided_filter, buffers.il);
   info.success_illuminant = true;
 
-  cv::imshow("il", il);
-  info.beta_D = beta_D_guess;
-
   // a and c are nonnegative.
   info.beta_D.block<3, 1>(0, 0) = info.beta_D.block<3, 1>(0, 0).cwiseMax(0);
   info.beta_D.block<3, 1>(6, 0) = info.beta_D.block<3, 1>(6, 0).cwiseMax(0);
@@ -74,15 +89,197 @@ EUInfo EnhanceUnderwater(const Image3f& I,
   info.beta_D.block<3, 1>(3, 0) = info.beta_D.block<3, 1>(3, 0).cwiseMin(0);
   info.beta_D.block<3, 1>(9, 0) = info.beta_D.block<3, 1>(9, 0).cwiseMin(0);
 
-  info.error_attenuation = EstimateBeta(range, il, beta_num_px, beta_opt_iters, info.beta_D);
+  info.error_attenuation = EstimateBeta(range, buffers.il, beta_num_px, beta_opt_iters, info.beta_D);
   info.success_attenuation = (info.error_attenuation < 0.1f);
+}
+
+
+// Shrinks the image and range to 1/scale of their size, into buffers.I_small and buffers.range_small.
+// NOTE(milo): The range is subsampled (not averaged), so that missing range doesn't bleed into its
+// neighbors.
+static void Downsample(const Image3f& I, const Image1f& range, int scale, EUBuffers& buffers)
+{
+  const cv::Size size(I.cols / scale, I.rows / scale);
+  cv::resize(I, buffers.I_small, size, 0, 0, cv::INTER_AREA);
+  cv::resize(range, buffers.range_small, size, 0, 0, cv::INTER_NEAREST);
+}
+
+
+// Applies a model that was fit at 1/scale resolution (with buffers.D at that size) to the full
+// resolution image. The enhanced image is J = max(0, I - backscatter) * gain, which (since the gain
+// is positive) is the per-pixel affine map J = max(0, gain * I + offset), offset = -backscatter * gain.
+// Both fields are evaluated at low resolution, upsampled, and then guided filtered with the full
+// resolution range, so that they line up with its depth edges.
+static void ApplyModelUpsampled(const Image3f& I,
+                                const Image1f& range,
+                                int scale,
+                                const EUInfo& info,
+                                EUBuffers& buffers,
+                                Image3f& out)
+{
+  buffers.attenuation.Correct(buffers.D, buffers.range_small, info.beta_D, buffers.J_small);
+  const Image3f& gain = buffers.attenuation.Gain();
+
+  ComputeBackscatter(buffers.range_small, info.B, info.beta_B, buffers.backscatter);
+  cv::multiply(buffers.backscatter, gain, buffers.offset, -1.0);
+
+  cv::resize(gain, buffers.gain_full, I.size(), 0, 0, cv::INTER_LINEAR);
+  cv::resize(buffers.offset, buffers.offset_full, I.size(), 0, 0, cv::INTER_LINEAR);
+
+  // A window of a few low resolution pixels is enough, since the fields are already smooth. The
+  // guide statistics are kept between frames while the range doesn't change.
+  const int r = 2 * scale;
+  const double eps = 1e-4;
+  buffers.upsample_filter.SetGuide(range, r, eps, scale);
+  buffers.upsample_filter.Filter(buffers.gain_full, buffers.gain_smooth);
+  buffers.upsample_filter.Filter(buffers.offset_full, buffers.offset_smooth);
+
+  out.create(I.size());
+  cv::parallel_for_(cv::Range(0, I.rows), [&](const cv::Range& rows) {
+    for (int y = rows.start; y < rows.end; ++y) {
+      const float* Iy = I.ptr<float>(y);
+      const float* G = buffers.gain_smooth.ptr<float>(y);
+      const float* O = buffers.offset_smooth.ptr<float>(y);
+      float* J = out.ptr<float>(y);
+      for (int i = 0; i < 3 * I.cols; ++i) {
+        J[i] = std::max(0.0f, G[i] * Iy[i] + O[i]);
+      }
+    }
+  });
+}
+
+
+EUInfo EnhanceUnderwater(const Image3f& I,
+                          const Image1f& range,
+                          int back_num_px,
+                          int back_opt_iters,
+                          int beta_num_px,
+                          int beta_opt_iters,
+                          Vector12f beta_D_guess,
+                          Image3f& out,
+                          EUBuffers& buffers,
+                          int work_scale)
+{
+  CHECK_GE(work_scale, 1);
+
+  EUInfo info;
+  BackscatterInitialGuess(info);
+  info.beta_D = beta_D_guess;
+
+  if (work_scale > 1) {
+    Downsample(I, range, work_scale, buffers);
+    FitModel(buffers.I_small, buffers.range_small, back_num_px, back_opt_iters,
+             beta_num_px, beta_opt_iters, false, info, buffers);
+    ApplyModelUpsampled(I, range, work_scale, info, buffers, out);
+    return info;
+  }
+
+  FitModel(I, range, back_num_px, back_opt_iters, beta_num_px, beta_opt_iters, false, info, buffers);
 
   // Image3f J = D / il;
-  out = CorrectAttenuation(D, range, info.beta_D);
+  buffers.attenuation.Correct(buffers.D, range, info.beta_D, out);
   // out = CorrectColorApprox(out);
 
   return info;
 }
 
+
+EUInfo EnhanceUnderwater(const Image3f& I,
+                          const Image1f& range,
+                          int back_num_px,
+                          int back_opt_iters,
+                          int beta_num_px,
+                          int beta_opt_iters,
+                          Vector12f beta_D_guess,
+                          Image3f& out,
+                          int work_scale)
+{
+  EUBuffers buffers;
+  return EnhanceUnderwater(I, range, back_num_px, back_opt_iters, beta_num_px, beta_opt_iters,
+                           beta_D_guess, out, buffers, work_scale);
+}
+
+
+UnderwaterEnhancer::UnderwaterEnhancer(const Params& params)
+    : params_(params)
+{
+  CHECK_GE(params_.work_scale, 1);
+  BackscatterInitialGuess(info_);
+  info_.beta_D = BetaInitialGuess1();
+}
+
+
+const EUInfo& UnderwaterEnhancer::Enhance(const Image3f& I_full, const Image1f& range_full, Image3f& out)
+{
+  // Everything up to applying the model happens at the working resolution.
+  const bool reduced = params_.work_scale > 1;
+  if (reduced) {
+    Downsample(I_full, range_full, params_.work_scale, buffers_);
+  }
+  const Image3f& I = reduced ? buffers_.I_small : I_full;
+  const Image1f& range = reduced ? buffers_.range_small : range_full;
+
+  ++frames_since_fit_;
+  bool refit = !has_model_ ||
+      (params_.refit_every_n_frames > 0 && frames_since_fit_ >= params_.refit_every_n_frames);
+
+  // Check how well the current backscatter model explains the dark pixels in this frame.
+  bool have_dark_mask = false;
+  if (!refit && params_.refit_error_ratio > 0) {
+    cv::cvtColor(I, buffers_.intensity, CV_BGR2GRAY);
+    FindDarkFast(buffers_.intensity, range, kDarkPercentile, buffers_.is_dark);
+    have_dark_mask = true;
+
+    const float error = ComputeBackscatterError(
+        I, range, buffers_.is_dark, params_.back_num_px,
+        info_.B, info_.beta_B, info_.Jp, info_.beta_Dp);
+    refit = error > params_.refit_error_ratio * std::max(fit_error_backscatter_, 1e-6f);
+  }
+
+  if (refit) {
+    // Warm start from the last model (if it was any good), which needs fewer iterations.
+    const bool warm_back = has_model_ && info_.success_backscatter;
+    const bool warm_beta = has_model_ && info_.success_attenuation;
+
+    if (!warm_back) {
+      BackscatterInitialGuess(info_);
+    }
+    if (!warm_beta) {
+      info_.beta_D = BetaInitialGuess1();
+    }
+
+    FitModel(I, range,
+             params_.back_num_px, warm_back ? params_.warm_back_opt_iters : params_.back_opt_iters,
+             params_.beta_num_px, warm_beta ? params_.warm_beta_opt_iters : params_.beta_opt_iters,
+             have_dark_mask, info_, buffers_);
+
+    fit_error_backscatter_ = info_.error_backscatter;
+    frames_since_fit_ = 0;
+    has_model_ = true;
+
+  // Otherwise, just apply the current model.
+  } else {
+    RemoveBackscatter(I, range, info_.B, info_.beta_B, buffers_.D);
+  }
+
+  last_frame_refit_ = refit;
+
+  if (reduced) {
+    ApplyModelUpsampled(I_full, range_full, params_.work_scale, info_, buffers_, out);
+  } else {
+    buffers_.attenuation.Correct(buffers_.D, range, info_.beta_D, out);
+  }
+
+  return info_;
+}
+
+
+void UnderwaterEnhancer::Reset()
+{
+  has_model_ = false;
+  frames_since_fit_ = 0;
+}
+
+
 }
 }
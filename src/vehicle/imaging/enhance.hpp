@@ -1,8 +1,12 @@
 #pragma once
 
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
 #include "vision_core/cv_types.hpp"
 #include "vision_core/image_util.hpp"
 #include "core/eigen_types.hpp"
+#include "imaging/guided_filter.hpp"
+#include "imaging/attenuation.hpp"
 
 namespace bm {
 namespace imaging {
@@ -10,6 +14,10 @@ namespace imaging {
 using namespace core;
 
 
+// Fraction of pixels that are used to fit the backscatter model.
+static const float kDarkPercentile = 0.01f;
+
+
 struct EUInfo {
   bool success_finddark;
   bool success_backscatter;
@@ -27,6 +35,49 @@ struct EUInfo {
 };
 
 
+// Sets the backscatter model params in info to the default initial guess.
+void BackscatterInitialGuess(EUInfo& info);
+
+
+// Intermediate images used by EnhanceUnderwater(). Keep these around between calls, so that
+// nothing needs to be allocated while the image size stays the same.
+struct EUBuffers final {
+  Image1f intensity;
+  Image1b is_dark;
+  Image3f D;    // Image with backscatter removed.
+  Image3f il;   // Illuminant map.
+  GuidedFilter guided_filter;
+  AttenuationCorrector attenuation;
+
+  // Only used when working at reduced resolution (see ApplyModelUpsampled()).
+  Image3f I_small;
+  Image1f range_small;
+  Image3f J_small;
+  Image3f backscatter;
+  Image3f offset;
+  Image3f gain_full, offset_full;
+  cv::Mat gain_smooth, offset_smooth;
+  GuidedFilter upsample_filter;
+};
+
+
+// If work_scale > 1, the model is fit (and its correction fields evaluated) at 1/work_scale of the
+// image size, and only applied at full resolution. The backscatter and attenuation only depend on
+// the range, so they are smooth everywhere except at depth edges, which the guided upsampling of
+// the fields keeps. Use 4 or 8.
+EUInfo EnhanceUnderwater(const Image3f& bgr,
+                          const Image1f& range,
+                          int back_num_px,
+                          int back_opt_iters,
+                          int beta_num_px,
+                          int beta_opt_iters,
+                          Vector12f beta_D_guess,
+                          Image3f& out,
+                          EUBuffers& buffers,
+                          int work_scale = 1);
+
+
+// Same as above, with temporary buffers.
 EUInfo EnhanceUnderwater(const Image3f& bgr,
                           const Image1f& range,
                           int back_num_px,
@@ -34,7 +85,67 @@ EUInfo EnhanceUnderwater(const Image3f& bgr,
                           int beta_num_px,
                           int beta_opt_iters,
                           Vector12f beta_D_guess,
-                          Image3f& out);
+                          Image3f& out,
+                          int work_scale = 1);
+
+
+// Enhances a stream of images (e.g video) from the same water. Since water properties change
+// slowly, the image formation model is only re-fit every refit_every_n_frames, or when it stops
+// explaining the dark pixels in the image. Refits are warm-started from the previous model. Frames
+// in between just remove backscatter and correct attenuation with the current model.
+class UnderwaterEnhancer final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int back_num_px = 256;
+    int back_opt_iters = 10;
+    int beta_num_px = 256;
+    int beta_opt_iters = 20;
+
+    // Optimizer iterations when warm-starting from the previous frame's model.
+    int warm_back_opt_iters = 3;
+    int warm_beta_opt_iters = 5;
+
+    // Re-fit the model at least this often (0 = only on error).
+    int refit_every_n_frames = 30;
+
+    // Re-fit the model if its backscatter error grows by this factor since the last fit (0 = OFF).
+    float refit_error_ratio = 2.0;
+
+    // Fit and evaluate the model at 1/work_scale resolution (1 = full). See EnhanceUnderwater().
+    int work_scale = 1;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(UnderwaterEnhancer);
+  UnderwaterEnhancer() = delete;
+
+  explicit UnderwaterEnhancer(const Params& params);
+
+  // Enhance the next image, and return the model that was used.
+  const EUInfo& Enhance(const Image3f& bgr, const Image1f& range, Image3f& out);
+
+  // Did the last call to Enhance() re-fit the model?
+  bool LastFrameWasRefit() const { return last_frame_refit_; }
+
+  // Forget the current model, so that the next image is fit from the default initial guess.
+  void Reset();
+
+ private:
+  Params params_;
+  EUBuffers buffers_;
+  EUInfo info_;
+
+  bool has_model_ = false;
+  bool last_frame_refit_ = false;
+  int frames_since_fit_ = 0;
+  float fit_error_backscatter_ = 0;
+};
+
 
 }
 }
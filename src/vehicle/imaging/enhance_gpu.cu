@@ -0,0 +1,605 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include <opencv2/core/cuda_stream_accessor.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "core/math_util.hpp"
+#include "imaging/enhance_gpu.h"
+#include "imaging/backscatter.hpp"
+#include "imaging/attenuation.hpp"
+#include "vision_core/gpu_memory_pool.hpp"
+
+namespace bm {
+namespace imaging {
+
+
+// Same as in backscatter.cpp.
+static const float kBackgroundRange = 20.0f;
+static const int kMaxGuidedChannels = 4;
+
+// Device buffers are charged to these modules in the GpuMemoryPool.
+static const char* kGpuBudgetGuided = "GuidedFilterGpu";
+static const char* kGpuBudgetEnhancer = "UnderwaterEnhancerGpu";
+
+
+static float3 ToFloat3(const Vector3f& v)
+{
+  return make_float3(v(0), v(1), v(2));
+}
+
+
+// A CV_32FC(cn) image as a CV_32FC1 image with cn times as many columns.
+static cu::PtrStepSz<float> Flat(const cu::GpuMat& m)
+{
+  return cu::PtrStepSz<float>(m.rows, m.cols * m.channels(), (float*)m.data, m.step);
+}
+
+
+__global__
+void BackscatterRemoval(const cu::PtrStepSz<float3> bgr,
+                        const cu::PtrStepSz<float> range,
+                        float3 B, float3 beta_B,
+                        float background_range,
+                        cu::PtrStepSz<float3> out)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= bgr.cols || y >= bgr.rows) {
+    return;
+  }
+
+  const float Z = range(y, x);
+  const float z = (Z > 1e-3f) ? Z : (Z + background_range);
+  const float3 I = bgr(y, x);
+
+  out(y, x) = make_float3(fmaxf(0.0f, I.x - B.x * (1.0f - __expf(-beta_B.x * z))),
+                          fmaxf(0.0f, I.y - B.y * (1.0f - __expf(-beta_B.y * z))),
+                          fmaxf(0.0f, I.z - B.z * (1.0f - __expf(-beta_B.z * z))));
+}
+
+
+__device__ __forceinline__
+float AttenuationGain(float a, float b, float c, float d, float z)
+{
+  return __expf((a * __expf(b * z) + c * __expf(d * z)) * z);
+}
+
+
+__global__
+void AttenuationCorrection(const cu::PtrStepSz<float3> D,
+                           const cu::PtrStepSz<float> range,
+                           float3 a, float3 b, float3 c, float3 d,
+                           float z_default,
+                           cu::PtrStepSz<float3> out)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= D.cols || y >= D.rows) {
+    return;
+  }
+
+  const float Z = range(y, x);
+  const float z = fmaxf(0.0f, (Z > 0) ? Z : (Z + z_default));
+  const float3 Dp = D(y, x);
+
+  out(y, x) = make_float3(Dp.x * AttenuationGain(a.x, b.x, c.x, d.x, z),
+                          Dp.y * AttenuationGain(a.y, b.y, c.y, d.y, z),
+                          Dp.z * AttenuationGain(a.z, b.z, c.z, d.z, z));
+}
+
+
+// BORDER_REFLECT_101 (gfedcb|abcdefgh|gfedcba). Reflects more than once if the kernel is bigger
+// than the image, like cv::borderInterpolate().
+__device__ __forceinline__
+int Reflect101(int i, int n)
+{
+  if (n == 1) {
+    return 0;
+  }
+  while (i < 0 || i >= n) {
+    i = (i < 0) ? -i : (2*n - 2 - i);
+  }
+  return i;
+}
+
+
+__global__
+void BoxRows(const cu::PtrStepSz<float> src, cu::PtrStepSz<float> dst, int cn, int radius)
+{
+  const int gx = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (gx >= src.cols || y >= src.rows) {
+    return;
+  }
+
+  const int width = src.cols / cn;
+  const int x = gx / cn;
+  const int c = gx - x * cn;
+
+  float sum = 0;
+  for (int k = -radius; k <= radius; ++k) {
+    sum += src(y, Reflect101(x + k, width) * cn + c);
+  }
+  dst(y, gx) = sum / (2*radius + 1);
+}
+
+
+__global__
+void BoxCols(const cu::PtrStepSz<float> src, cu::PtrStepSz<float> dst, int cn, int radius)
+{
+  const int gx = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (gx >= src.cols || y >= src.rows) {
+    return;
+  }
+
+  float sum = 0;
+  for (int k = -radius; k <= radius; ++k) {
+    sum += src(Reflect101(y + k, src.rows), gx);
+  }
+  dst(y, gx) = sum / (2*radius + 1);
+}
+
+
+__global__
+void GatherPixels(const cu::PtrStepSz<float3> im, const int2* px, int num_px, float3* out)
+{
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+
+  if (i >= num_px) {
+    return;
+  }
+
+  out[i] = im(px[i].y, px[i].x);
+}
+
+
+// Nearest neighbor subsampling (like cv::INTER_NEAREST) of the guide into (I, I*I).
+static __global__
+void SubsampleGuide(const cu::PtrStepSz<float> I, cu::PtrStepSz<float2> I_II)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= I_II.cols || y >= I_II.rows) {
+    return;
+  }
+
+  const int sx = min(I.cols - 1, x * I.cols / I_II.cols);
+  const int sy = min(I.rows - 1, y * I.rows / I_II.rows);
+  const float v = I(sy, sx);
+  I_II(y, x) = make_float2(v, v*v);
+}
+
+
+static __global__
+void GuideInvVariance(const cu::PtrStepSz<float2> mean_I_II, float eps, cu::PtrStepSz<float> inv_var)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= inv_var.cols || y >= inv_var.rows) {
+    return;
+  }
+
+  const float2 m = mean_I_II(y, x);
+  inv_var(y, x) = 1.0f / (m.y - m.x*m.x + eps);
+}
+
+
+// Nearest neighbor subsampling of p into (p, I*p), where I is the already subsampled guide.
+static __global__
+void SubsamplePIp(const cu::PtrStepSz<float> p,
+                  const cu::PtrStepSz<float2> I_II,
+                  int cn,
+                  cu::PtrStepSz<float> p_Ip)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= I_II.cols || y >= I_II.rows) {
+    return;
+  }
+
+  const int width = p.cols / cn;
+  const int sx = min(width - 1, x * width / I_II.cols);
+  const int sy = min(p.rows - 1, y * p.rows / I_II.rows);
+  const float I = I_II(y, x).x;
+
+  for (int c = 0; c < cn; ++c) {
+    const float v = p(sy, sx*cn + c);
+    p_Ip(y, 2*cn*x + c) = v;
+    p_Ip(y, 2*cn*x + cn + c) = I * v;
+  }
+}
+
+
+// The linear model q = a*I + b for each window, stacked as (a, b).
+static __global__
+void GuidedCoefficients(const cu::PtrStepSz<float> mean_p_Ip,
+                        const cu::PtrStepSz<float2> mean_I_II,
+                        const cu::PtrStepSz<float> inv_var,
+                        int cn,
+                        cu::PtrStepSz<float> ab)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= inv_var.cols || y >= inv_var.rows) {
+    return;
+  }
+
+  const float mI = mean_I_II(y, x).x;
+  const float inv = inv_var(y, x);
+
+  for (int c = 0; c < cn; ++c) {
+    const float mean_p = mean_p_Ip(y, 2*cn*x + c);
+    const float cov_Ip = mean_p_Ip(y, 2*cn*x + cn + c) - mI*mean_p;
+    const float a = cov_Ip * inv;
+    ab(y, 2*cn*x + c) = a;
+    ab(y, 2*cn*x + cn + c) = mean_p - a*mI;
+  }
+}
+
+
+// Source coordinate and weight for bilinear upsampling, like cv::INTER_LINEAR (pixel centers are
+// aligned, and the border is replicated).
+__device__ __forceinline__
+void LinearCoord(int x, float scale, int n, int& x0, int& x1, float& w1)
+{
+  const float fx = (x + 0.5f) * scale - 0.5f;
+  x0 = static_cast<int>(floorf(fx));
+  w1 = fx - x0;
+  if (x0 < 0) {
+    x0 = 0;
+    w1 = 0;
+  }
+  if (x0 >= n - 1) {
+    x0 = n - 1;
+    w1 = 0;
+  }
+  x1 = min(x0 + 1, n - 1);
+}
+
+
+// q = scale * (a*I + b) at full resolution, with (a, b) upsampled on the fly.
+static __global__
+void GuidedOutput(const cu::PtrStepSz<float> mean_ab,
+                  const cu::PtrStepSz<float> I,
+                  int cn,
+                  float scale,
+                  cu::PtrStepSz<float> q)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= I.cols || y >= I.rows) {
+    return;
+  }
+
+  const int sub_cols = mean_ab.cols / (2*cn);
+  int x0, x1, y0, y1;
+  float wx, wy;
+  LinearCoord(x, static_cast<float>(sub_cols) / I.cols, sub_cols, x0, x1, wx);
+  LinearCoord(y, static_cast<float>(mean_ab.rows) / I.rows, mean_ab.rows, y0, y1, wy);
+
+  const float Ixy = I(y, x);
+
+  for (int c = 0; c < cn; ++c) {
+    float coeff[2];
+    for (int k = 0; k < 2; ++k) {
+      const int ch = k*cn + c;
+      const float top = (1.0f - wx) * mean_ab(y0, 2*cn*x0 + ch) + wx * mean_ab(y0, 2*cn*x1 + ch);
+      const float bot = (1.0f - wx) * mean_ab(y1, 2*cn*x0 + ch) + wx * mean_ab(y1, 2*cn*x1 + ch);
+      coeff[k] = (1.0f - wy) * top + wy * bot;
+    }
+    q(y, cn*x + c) = scale * (coeff[0] * Ixy + coeff[1]);
+  }
+}
+
+
+void RemoveBackscatter(const cu::GpuMat& bgr,
+                       const cu::GpuMat& range,
+                       const Vector3f& B,
+                       const Vector3f& beta_B,
+                       cu::GpuMat& out,
+                       cu::Stream& stream)
+{
+  CHECK_EQ(CV_32FC3, bgr.type());
+  CHECK_EQ(CV_32FC1, range.type());
+  CHECK(bgr.size() == range.size());
+
+  out.create(bgr.size(), CV_32FC3);
+
+  cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(bgr.cols, block.x), cu::device::divUp(bgr.rows, block.y));
+  BackscatterRemoval<<<grid, block, 0, cs>>>(
+      bgr, range, ToFloat3(B), ToFloat3(beta_B), kBackgroundRange, out);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void CorrectAttenuation(const cu::GpuMat& bgr,
+                        const cu::GpuMat& range,
+                        const Vector12f& X,
+                        float z_default,
+                        cu::GpuMat& out,
+                        cu::Stream& stream)
+{
+  CHECK_EQ(CV_32FC3, bgr.type());
+  CHECK_EQ(CV_32FC1, range.type());
+  CHECK(bgr.size() == range.size());
+
+  out.create(bgr.size(), CV_32FC3);
+
+  const float3 a = make_float3(X(0), X(1), X(2));
+  const float3 b = make_float3(X(3), X(4), X(5));
+  const float3 c = make_float3(X(6), X(7), X(8));
+  const float3 d = make_float3(X(9), X(10), X(11));
+
+  cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(bgr.cols, block.x), cu::device::divUp(bgr.rows, block.y));
+  AttenuationCorrection<<<grid, block, 0, cs>>>(bgr, range, a, b, c, d, z_default, out);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void GuidedFilterGpu::Box(const cu::GpuMat& src, cu::GpuMat& dst, cu::Stream& stream)
+{
+  box_tmp_.create(src.size(), src.type());
+  dst.create(src.size(), src.type());
+
+  const int cn = src.channels();
+  const cu::PtrStepSz<float> flat = Flat(src);
+
+  cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(flat.cols, block.x), cu::device::divUp(flat.rows, block.y));
+  BoxRows<<<grid, block, 0, cs>>>(flat, Flat(box_tmp_), cn, radius_);
+  BoxCols<<<grid, block, 0, cs>>>(Flat(box_tmp_), Flat(dst), cn, radius_);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void GuidedFilterGpu::SetGuide(const cu::GpuMat& I, int r, double eps, int s, cu::Stream& stream)
+{
+  ScopedGpuBudget budget(kGpuBudgetGuided);
+
+  CHECK(!I.empty()) << "Empty guide image" << std::endl;
+  CHECK_EQ(CV_32FC1, I.type());
+  CHECK_GE(s, 1) << "Subsampling factor must be at least 1" << std::endl;
+  CHECK(I.cols >= s && I.rows >= s) << "Guide is smaller than the subsampling factor" << std::endl;
+
+  radius_ = r / s;
+  eps_ = static_cast<float>(eps);
+  guide_ = I;
+
+  I_II_.create(I.rows / s, I.cols / s, CV_32FC2);
+  inv_var_I_.create(I_II_.size(), CV_32FC1);
+
+  cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(I_II_.cols, block.x), cu::device::divUp(I_II_.rows, block.y));
+  SubsampleGuide<<<grid, block, 0, cs>>>(I, I_II_);
+
+  Box(I_II_, mean_I_II_, stream);
+
+  GuideInvVariance<<<grid, block, 0, cs>>>(mean_I_II_, eps_, inv_var_I_);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void GuidedFilterGpu::Filter(const cu::GpuMat& p, cu::GpuMat& q, float scale, cu::Stream& stream)
+{
+  ScopedGpuBudget budget(kGpuBudgetGuided);
+
+  CHECK(!guide_.empty()) << "Call SetGuide() before Filter()" << std::endl;
+  CHECK_EQ(CV_32F, p.depth());
+  CHECK(p.size() == guide_.size()) << "p must be the same size as the guide" << std::endl;
+
+  const int cn = p.channels();
+  CHECK_LE(cn, kMaxGuidedChannels);
+
+  p_Ip_.create(I_II_.size(), CV_32FC(2 * cn));
+  ab_.create(I_II_.size(), CV_32FC(2 * cn));
+  q.create(guide_.size(), p.type());
+
+  cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(I_II_.cols, block.x), cu::device::divUp(I_II_.rows, block.y));
+
+  // Stack p and I*p, so that their means come from one box filter.
+  SubsamplePIp<<<grid, block, 0, cs>>>(Flat(p), I_II_, cn, Flat(p_Ip_));
+  Box(p_Ip_, mean_p_Ip_, stream);
+
+  GuidedCoefficients<<<grid, block, 0, cs>>>(Flat(mean_p_Ip_), mean_I_II_, inv_var_I_, cn, Flat(ab_));
+  Box(ab_, mean_ab_, stream);
+
+  const dim3 grid_full(cu::device::divUp(guide_.cols, block.x), cu::device::divUp(guide_.rows, block.y));
+  GuidedOutput<<<grid_full, block, 0, cs>>>(Flat(mean_ab_), guide_, cn, scale, Flat(q));
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+UnderwaterEnhancerGpu::UnderwaterEnhancerGpu(const UnderwaterEnhancer::Params& params)
+    : params_(params)
+{
+  BackscatterInitialGuess(info_);
+  info_.beta_D = BetaInitialGuess1();
+}
+
+
+void UnderwaterEnhancerGpu::FitAttenuation(const Image1f& range, int iters, cu::Stream& stream)
+{
+  // Tuned the guided filter params offline (same as EnhanceUnderwater()).
+  const double eps = 0.01;
+  const int s = 8;
+  const int r = core::NextEvenInt(D_.cols / 3);
+
+  // Akkaynak et al. multiply by a factor of 2 to get the illuminant map.
+  guided_filter_.SetGuide(range_, r, eps, s, stream);
+  guided_filter_.Filter(D_, il_, 2.0f, stream);
+  info_.success_illuminant = true;
+
+  // Only the sampled pixels of the illuminant come back to the host. The range is already there.
+  const std::vector<cv::Point> px = SampleBetaPixels(range, params_.beta_num_px);
+  const int num_px = static_cast<int>(px.size());
+
+  std::vector<float> ranges(num_px);
+  std::vector<Vector3f> illuminants(num_px);
+
+  if (num_px > 0) {
+    h_sample_px_.create(1, num_px, CV_32SC2);
+    h_sample_il_.create(1, num_px, CV_32FC3);
+    cv::Mat h_px = h_sample_px_.createMatHeader();
+    for (int i = 0; i < num_px; ++i) {
+      h_px.at<cv::Vec2i>(i) = cv::Vec2i(px.at(i).x, px.at(i).y);
+    }
+    sample_px_.upload(h_sample_px_, stream);
+    sample_il_.create(1, num_px, CV_32FC3);
+
+    cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+    GatherPixels<<<cu::device::divUp(num_px, 256), 256, 0, cs>>>(
+        il_, sample_px_.ptr<int2>(), num_px, sample_il_.ptr<float3>());
+    cudaSafeCall(cudaGetLastError());
+
+    sample_il_.download(h_sample_il_, stream);
+    stream.waitForCompletion();
+
+    const cv::Mat h_il = h_sample_il_.createMatHeader();
+    for (int i = 0; i < num_px; ++i) {
+      const cv::Vec3f& v = h_il.at<cv::Vec3f>(i);
+      ranges.at(i) = range(px.at(i));
+      illuminants.at(i) = Vector3f(v[0], v[1], v[2]);
+    }
+  }
+
+  // a and c are nonnegative.
+  info_.beta_D.block<3, 1>(0, 0) = info_.beta_D.block<3, 1>(0, 0).cwiseMax(0);
+  info_.beta_D.block<3, 1>(6, 0) = info_.beta_D.block<3, 1>(6, 0).cwiseMax(0);
+
+  // b and d are nonpositive.
+  info_.beta_D.block<3, 1>(3, 0) = info_.beta_D.block<3, 1>(3, 0).cwiseMin(0);
+  info_.beta_D.block<3, 1>(9, 0) = info_.beta_D.block<3, 1>(9, 0).cwiseMin(0);
+
+  info_.error_attenuation = EstimateBeta(ranges, illuminants, iters, info_.beta_D);
+  info_.success_attenuation = (info_.error_attenuation < 0.1f);
+}
+
+
+const EUInfo& UnderwaterEnhancerGpu::Enhance(const Image3f& I,
+                                             const Image1f& range,
+                                             cu::GpuMat& out,
+                                             cu::Stream& stream)
+{
+  ScopedGpuBudget budget(kGpuBudgetEnhancer);
+
+  CHECK(I.size() == range.size());
+
+  // Start the upload first, so that it overlaps with the dark pixel search below. The staging
+  // buffers can't be overwritten until the last frame's upload is done.
+  upload_done_.waitForCompletion();
+  h_bgr_.create(I.rows, I.cols, CV_32FC3);
+  h_range_.create(range.rows, range.cols, CV_32FC1);
+  I.copyTo(h_bgr_.createMatHeader());
+  range.copyTo(h_range_.createMatHeader());
+  bgr_.upload(h_bgr_, stream);
+  range_.upload(h_range_, stream);
+  upload_done_.record(stream);
+
+  ++frames_since_fit_;
+  bool refit = !has_model_ ||
+      (params_.refit_every_n_frames > 0 && frames_since_fit_ >= params_.refit_every_n_frames);
+
+  // Check how well the current backscatter model explains the dark pixels in this frame.
+  bool have_dark_mask = false;
+  if (!refit && params_.refit_error_ratio > 0) {
+    cv::cvtColor(I, intensity_, CV_BGR2GRAY);
+    FindDarkFast(intensity_, range, kDarkPercentile, is_dark_);
+    have_dark_mask = true;
+
+    const float error = ComputeBackscatterError(
+        I, range, is_dark_, params_.back_num_px,
+        info_.B, info_.beta_B, info_.Jp, info_.beta_Dp);
+    refit = error > params_.refit_error_ratio * std::max(fit_error_backscatter_, 1e-6f);
+  }
+
+  if (refit) {
+    // Warm start from the last model (if it was any good), which needs fewer iterations.
+    const bool warm_back = has_model_ && info_.success_backscatter;
+    const bool warm_beta = has_model_ && info_.success_attenuation;
+
+    if (!warm_back) {
+      BackscatterInitialGuess(info_);
+    }
+    if (!warm_beta) {
+      info_.beta_D = BetaInitialGuess1();
+    }
+
+    if (!have_dark_mask) {
+      cv::cvtColor(I, intensity_, CV_BGR2GRAY);
+      FindDarkFast(intensity_, range, kDarkPercentile, is_dark_);
+    }
+    info_.success_finddark = true;
+
+    info_.error_backscatter = EstimateBackscatter(
+        I, range, is_dark_, params_.back_num_px,
+        warm_back ? params_.warm_back_opt_iters : params_.back_opt_iters,
+        info_.B, info_.beta_B, info_.Jp, info_.beta_Dp);
+    info_.success_backscatter = (info_.error_backscatter < 0.1f);
+
+    RemoveBackscatter(bgr_, range_, info_.B, info_.beta_B, D_, stream);
+    FitAttenuation(range, warm_beta ? params_.warm_beta_opt_iters : params_.beta_opt_iters, stream);
+
+    fit_error_backscatter_ = info_.error_backscatter;
+    frames_since_fit_ = 0;
+    has_model_ = true;
+
+  // Otherwise, just apply the current model.
+  } else {
+    RemoveBackscatter(bgr_, range_, info_.B, info_.beta_B, D_, stream);
+  }
+
+  last_frame_refit_ = refit;
+
+  // Pixels with no range are put at the max range, like CorrectAttenuation().
+  double rmin, rmax;
+  cv::minMaxLoc(range, &rmin, &rmax);
+  CorrectAttenuation(D_, range_, info_.beta_D, static_cast<float>(rmax), out, stream);
+
+  return info_;
+}
+
+
+const EUInfo& UnderwaterEnhancerGpu::Enhance(const Image3f& I, const Image1f& range, Image3f& out)
+{
+  ScopedGpuBudget budget(kGpuBudgetEnhancer);
+
+  Enhance(I, range, out_, stream_);
+
+  h_out_.create(out_.rows, out_.cols, CV_32FC3);
+  out_.download(h_out_, stream_);
+  stream_.waitForCompletion();
+  h_out_.createMatHeader().copyTo(out);
+
+  return info_;
+}
+
+
+void UnderwaterEnhancerGpu::Reset()
+{
+  has_model_ = false;
+  frames_since_fit_ = 0;
+}
+
+
+}
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/core/cuda/common.hpp>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "vision_core/cv_types.hpp"
+#include "imaging/enhance.hpp"
+
+namespace bm {
+namespace imaging {
+
+namespace cu = cv::cuda;
+using namespace core;
+
+
+// One thread per pixel. Same model as RemoveBackscatter(): D = max(0, I - B*(1 - exp(-beta_B*z))),
+// where pixels with no range are put at background_range.
+__global__
+void BackscatterRemoval(const cu::PtrStepSz<float3> bgr,
+                        const cu::PtrStepSz<float> range,
+                        float3 B, float3 beta_B,
+                        float background_range,
+                        cu::PtrStepSz<float3> out);
+
+
+// One thread per pixel. Same model as CorrectAttenuation(): J = D * exp(beta_c(z) * z), with
+// beta_c(z) = a*exp(b*z) + c*exp(d*z). Pixels with no range are put at z_default.
+__global__
+void AttenuationCorrection(const cu::PtrStepSz<float3> D,
+                           const cu::PtrStepSz<float> range,
+                           float3 a, float3 b, float3 c, float3 d,
+                           float z_default,
+                           cu::PtrStepSz<float3> out);
+
+
+// Normalized box filter over one axis (kernel size 2*radius + 1, BORDER_REFLECT_101) of an image
+// with cn interleaved channels. src and dst are viewed as CV_32FC1, with cn times as many columns.
+// One thread per output element.
+__global__
+void BoxRows(const cu::PtrStepSz<float> src, cu::PtrStepSz<float> dst, int cn, int radius);
+
+__global__
+void BoxCols(const cu::PtrStepSz<float> src, cu::PtrStepSz<float> dst, int cn, int radius);
+
+
+// Copies px[i] of a CV_32FC3 image into out[i]. One thread per pixel.
+__global__
+void GatherPixels(const cu::PtrStepSz<float3> im, const int2* px, int num_px, float3* out);
+
+
+// Removes backscatter from a CV_32FC3 image (see RemoveBackscatter()) in stream.
+void RemoveBackscatter(const cu::GpuMat& bgr,
+                       const cu::GpuMat& range,
+                       const Vector3f& B,
+                       const Vector3f& beta_B,
+                       cu::GpuMat& out,
+                       cu::Stream& stream = cu::Stream::Null());
+
+
+// Undoes the direct attenuation of a CV_32FC3 image with backscatter removed (see
+// CorrectAttenuation()) in stream. The CPU version puts pixels with no range at the max range,
+// which would need a reduction (and a sync) here, so it's passed in as z_default instead.
+// NOTE(milo): The GPU has fast exps, so the 9 per pixel are cheaper than a gain table lookup.
+void CorrectAttenuation(const cu::GpuMat& bgr,
+                        const cu::GpuMat& range,
+                        const Vector12f& X,
+                        float z_default,
+                        cu::GpuMat& out,
+                        cu::Stream& stream = cu::Stream::Null());
+
+
+// The same fast guided filter as GuidedFilter, on the device. Every stage is one kernel (or two,
+// for each box filter), and the subsampled guide and its square, like (p, I*p) and (a, b), are
+// stacked so that each pair is one box filter. The upsampling of (a, b) is fused with the output,
+// so no full size intermediate image is needed. Nothing is allocated while the image size stays
+// the same.
+class GuidedFilterGpu final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(GuidedFilterGpu);
+
+  GuidedFilterGpu() = default;
+
+  // Sets a CV_32FC1 guide image, with the same r, eps and s as GuidedFilter::SetGuide(). The guide
+  // isn't copied, so it must not change until the last Filter() with it has run.
+  void SetGuide(const cu::GpuMat& I, int r, double eps, int s, cu::Stream& stream = cu::Stream::Null());
+
+  // Filters every channel of p (CV_32FC1 to CV_32FC4, same size as the guide) into q, and scales
+  // the result by scale.
+  void Filter(const cu::GpuMat& p, cu::GpuMat& q, float scale = 1.0f,
+              cu::Stream& stream = cu::Stream::Null());
+
+ private:
+  void Box(const cu::GpuMat& src, cu::GpuMat& dst, cu::Stream& stream);
+
+ private:
+  int radius_ = 0;
+  float eps_ = 0;
+
+  cu::GpuMat guide_;        // Full resolution (not a copy).
+  cu::GpuMat I_II_;         // Subsampled guide and its square, interleaved.
+  cu::GpuMat mean_I_II_;
+  cu::GpuMat inv_var_I_;    // 1 / (var(I) + eps)
+
+  cu::GpuMat p_Ip_;         // Subsampled p and I*p, interleaved (2 * channels).
+  cu::GpuMat mean_p_Ip_;
+  cu::GpuMat ab_;           // a and b, interleaved (2 * channels).
+  cu::GpuMat mean_ab_;
+
+  cu::GpuMat box_tmp_;
+};
+
+
+// UnderwaterEnhancer with the per-pixel stages on the GPU (removing backscatter, the guided filter
+// for the illuminant, and correcting attenuation). The model fits stay on the CPU, since they only
+// look at a few hundred sampled pixels: the backscatter fit uses the host image, and only the
+// sampled illuminant pixels are downloaded for the attenuation fit. When to re-fit is decided the
+// same way as UnderwaterEnhancer, and while the upload of a frame is in flight.
+class UnderwaterEnhancerGpu final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(UnderwaterEnhancerGpu);
+  UnderwaterEnhancerGpu() = delete;
+
+  explicit UnderwaterEnhancerGpu(const UnderwaterEnhancer::Params& params);
+
+  // Enhance the next image into out (on the device), and return the model that was used. Returns
+  // without waiting for stream, unless the model was re-fit.
+  const EUInfo& Enhance(const Image3f& bgr, const Image1f& range, cu::GpuMat& out, cu::Stream& stream);
+
+  // Blocking version, which downloads the enhanced image.
+  const EUInfo& Enhance(const Image3f& bgr, const Image1f& range, Image3f& out);
+
+  // Did the last call to Enhance() re-fit the model?
+  bool LastFrameWasRefit() const { return last_frame_refit_; }
+
+  // Forget the current model, so that the next image is fit from the default initial guess.
+  void Reset();
+
+ private:
+  // Fits the attenuation model to the illuminant of D_ (which has backscatter removed already).
+  void FitAttenuation(const Image1f& range, int iters, cu::Stream& stream);
+
+ private:
+  UnderwaterEnhancer::Params params_;
+  EUInfo info_;
+
+  bool has_model_ = false;
+  bool last_frame_refit_ = false;
+  int frames_since_fit_ = 0;
+  float fit_error_backscatter_ = 0;
+
+  Image1f intensity_;
+  Image1b is_dark_;
+
+  cu::GpuMat bgr_, range_, D_, il_, out_;
+  cu::GpuMat sample_px_, sample_il_;
+  cu::HostMem h_bgr_, h_range_, h_sample_px_, h_sample_il_, h_out_;
+  GuidedFilterGpu guided_filter_;
+  cu::Event upload_done_;
+  cu::Stream stream_;
+};
+
+
+}
+}
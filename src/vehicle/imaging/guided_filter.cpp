@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cstring>
+
+#include <glog/logging.h>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "imaging/guided_filter.hpp"
+
+namespace bm {
+namespace imaging {
+
+
+static const int kMaxBoxChannels = 8;
+
+// The vertical pass in BoxFilter() splits the columns into this many stripes.
+static const int kBoxColumnStripes = 8;
+
+
+static inline int Reflect101(int i, int n)
+{
+  return (i >= 0 && i < n) ? i : cv::borderInterpolate(i, n, cv::BORDER_REFLECT_101);
+}
+
+
+void BoxFilter(const cv::Mat& src,
+               int ksize,
+               cv::Mat& tmp,
+               std::vector<double>& col_sums,
+               cv::Mat& dst)
+{
+  CHECK_EQ(CV_32F, src.depth()) << "BoxFilter only supports float images" << std::endl;
+  CHECK(ksize > 0 && (ksize % 2) == 1) << "BoxFilter needs an odd ksize" << std::endl;
+  CHECK_LE(src.channels(), kMaxBoxChannels);
+  CHECK(&dst != &src && &dst != &tmp);
+
+  const int rows = src.rows;
+  const int cols = src.cols;
+  const int cn = src.channels();
+  const int width = cols * cn;
+  const int R = ksize / 2;
+
+  tmp.create(src.size(), src.type());
+  dst.create(src.size(), src.type());
+  col_sums.resize(width);
+
+  // Horizontal sums (not normalized yet). The sum for x + 1 is the sum for x, plus the pixel that
+  // enters the window and minus the one that leaves it.
+  cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range) {
+    double acc[kMaxBoxChannels];
+    for (int y = range.start; y < range.end; ++y) {
+      const float* s = src.ptr<float>(y);
+      float* h = tmp.ptr<float>(y);
+
+      std::fill(acc, acc + cn, 0.0);
+      for (int k = -R; k <= R; ++k) {
+        const float* sk = s + Reflect101(k, cols) * cn;
+        for (int c = 0; c < cn; ++c) { acc[c] += sk[c]; }
+      }
+
+      for (int x = 0; x < cols; ++x) {
+        float* hx = h + x * cn;
+        const float* add = s + Reflect101(x + R + 1, cols) * cn;
+        const float* sub = s + Reflect101(x - R, cols) * cn;
+        for (int c = 0; c < cn; ++c) {
+          hx[c] = static_cast<float>(acc[c]);
+          acc[c] += add[c] - sub[c];
+        }
+      }
+    }
+  });
+
+  // Vertical sums of the horizontal sums. Each stripe keeps a running sum for a range of columns
+  // (every channel of a pixel is a column here), so the inner loops are over contiguous memory.
+  const double scale = 1.0 / (ksize * ksize);
+  cv::parallel_for_(cv::Range(0, width), [&](const cv::Range& range) {
+    const int j0 = range.start;
+    const int j1 = range.end;
+    double* sum = col_sums.data();
+    std::fill(sum + j0, sum + j1, 0.0);
+    for (int k = -R; k <= R; ++k) {
+      const float* h = tmp.ptr<float>(Reflect101(k, rows));
+      for (int j = j0; j < j1; ++j) { sum[j] += h[j]; }
+    }
+
+    for (int y = 0; y < rows; ++y) {
+      float* d = dst.ptr<float>(y);
+      const float* add = tmp.ptr<float>(Reflect101(y + R + 1, rows));
+      const float* sub = tmp.ptr<float>(Reflect101(y - R, rows));
+      for (int j = j0; j < j1; ++j) {
+        d[j] = static_cast<float>(sum[j] * scale);
+        sum[j] += add[j] - sub[j];
+      }
+    }
+  }, kBoxColumnStripes);
+}
+
+
+bool GuidedFilter::SameGuide(const Image1f& I, int r, double eps, int s) const
+{
+  if (r != r_ || s != s_ || eps != eps_ || I.size() != guide_.size()) {
+    return false;
+  }
+
+  for (int y = 0; y < I.rows; ++y) {
+    if (std::memcmp(I.ptr<float>(y), guide_.ptr<float>(y), I.cols * sizeof(float)) != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void GuidedFilter::Box(const cv::Mat& src, cv::Mat& dst)
+{
+  imaging::BoxFilter(src, ksize_, box_tmp_, box_col_sums_, dst);
+}
+
+
+bool GuidedFilter::SetGuide(const Image1f& I, int r, double eps, int s)
+{
+  CHECK(!I.empty()) << "Empty guide image" << std::endl;
+  CHECK_GE(s, 1) << "Subsampling factor must be at least 1" << std::endl;
+
+  if (SameGuide(I, r, eps, s)) {
+    return false;
+  }
+
+  r_ = r;
+  eps_ = eps;
+  s_ = s;
+  ksize_ = 2 * (r / s) + 1;
+
+  I.copyTo(guide_);
+  cv::resize(guide_, I_, cv::Size(I.cols / s, I.rows / s), 0, 0, cv::INTER_NEAREST);
+  cv::multiply(I_, I_, II_);
+
+  Box(I_, mean_I_);
+  Box(II_, mean_II_);
+
+  inv_var_I_.create(I_.size());
+  cv::parallel_for_(cv::Range(0, I_.rows), [&](const cv::Range& rows) {
+    for (int y = rows.start; y < rows.end; ++y) {
+      const float* mI = mean_I_.ptr<float>(y);
+      const float* mII = mean_II_.ptr<float>(y);
+      float* inv = inv_var_I_.ptr<float>(y);
+      for (int x = 0; x < I_.cols; ++x) {
+        inv[x] = 1.0f / (mII[x] - mI[x]*mI[x] + static_cast<float>(eps));
+      }
+    }
+  });
+
+  return true;
+}
+
+
+void GuidedFilter::Filter(const cv::Mat& p, cv::Mat& q)
+{
+  CHECK(!guide_.empty()) << "Call SetGuide() before Filter()" << std::endl;
+  CHECK_EQ(CV_32F, p.depth());
+  CHECK(p.size() == guide_.size()) << "p must be the same size as the guide" << std::endl;
+
+  const int cn = p.channels();
+  CHECK_LE(2 * cn, kMaxBoxChannels);
+
+  cv::resize(p, p_, I_.size(), 0, 0, cv::INTER_NEAREST);
+
+  // Stack p and I*p, so that their means come from one box filter.
+  p_Ip_.create(I_.size(), CV_32FC(2 * cn));
+  cv::parallel_for_(cv::Range(0, I_.rows), [&](const cv::Range& rows) {
+    for (int y = rows.start; y < rows.end; ++y) {
+      const float* Iy = I_.ptr<float>(y);
+      const float* py = p_.ptr<float>(y);
+      float* out = p_Ip_.ptr<float>(y);
+      for (int x = 0; x < I_.cols; ++x) {
+        for (int c = 0; c < cn; ++c) {
+          out[2*cn*x + c] = py[cn*x + c];
+          out[2*cn*x + cn + c] = Iy[x] * py[cn*x + c];
+        }
+      }
+    }
+  });
+
+  Box(p_Ip_, mean_p_Ip_);
+
+  // The linear model q = a*I + b for each window, also stacked as (a, b).
+  ab_.create(I_.size(), CV_32FC(2 * cn));
+  cv::parallel_for_(cv::Range(0, I_.rows), [&](const cv::Range& rows) {
+    for (int y = rows.start; y < rows.end; ++y) {
+      const float* mI = mean_I_.ptr<float>(y);
+      const float* inv = inv_var_I_.ptr<float>(y);
+      const float* m = mean_p_Ip_.ptr<float>(y);
+      float* out = ab_.ptr<float>(y);
+      for (int x = 0; x < I_.cols; ++x) {
+        for (int c = 0; c < cn; ++c) {
+          const float mean_p = m[2*cn*x + c];
+          const float cov_Ip = m[2*cn*x + cn + c] - mI[x]*mean_p;
+          const float a = cov_Ip * inv[x];
+          out[2*cn*x + c] = a;
+          out[2*cn*x + cn + c] = mean_p - a*mI[x];
+        }
+      }
+    }
+  });
+
+  Box(ab_, mean_ab_);
+  cv::resize(mean_ab_, mean_ab_full_, guide_.size(), 0, 0, cv::INTER_LINEAR);
+
+  q.create(guide_.size(), p.type());
+  cv::parallel_for_(cv::Range(0, guide_.rows), [&](const cv::Range& rows) {
+    for (int y = rows.start; y < rows.end; ++y) {
+      const float* Iy = guide_.ptr<float>(y);
+      const float* ab = mean_ab_full_.ptr<float>(y);
+      float* qy = q.ptr<float>(y);
+      for (int x = 0; x < guide_.cols; ++x) {
+        for (int c = 0; c < cn; ++c) {
+          qy[cn*x + c] = ab[2*cn*x + c] * Iy[x] + ab[2*cn*x + cn + c];
+        }
+      }
+    }
+  });
+}
+
+
+}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace imaging {
+
+using namespace core;
+
+
+// Normalized ksize x ksize box filter of a CV_32F image with up to 8 channels. Same result as
+// cv::blur (BORDER_REFLECT_101), but computed as two running sums (a horizontal pass into tmp, then
+// a vertical one into dst), so the cost doesn't depend on ksize. Every channel of a pixel is summed
+// in the same pass. The horizontal pass is split over rows and the vertical pass over columns, and
+// both run with cv::parallel_for_. The buffers are only reallocated if the image size changes.
+// NOTE(milo): dst must not be the same Mat as src or tmp.
+void BoxFilter(const cv::Mat& src,
+               int ksize,
+               cv::Mat& tmp,
+               std::vector<double>& col_sums,
+               cv::Mat& dst);
+
+
+// A fast guided filter (He and Sun 2015) with a single channel guide, which keeps all of its
+// intermediate images between calls. This is the same filter as fastGuidedFilter() with a mono
+// guide, but:
+//  - the guide statistics are only recomputed if the guide or the filter params change
+//  - all channels of p are filtered at once, instead of one at a time
+//  - (p, I*p) and (a, b) are stacked into one image each, so each pair is one box filter
+//  - nothing is allocated while the image size stays the same
+class GuidedFilter final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(GuidedFilter);
+
+  GuidedFilter() = default;
+
+  // Sets the guide image, with the same r, eps and s as fastGuidedFilter(). Returns false if the
+  // guide and params are the same as last time, and the cached statistics were kept.
+  bool SetGuide(const Image1f& I, int r, double eps, int s);
+
+  // Filters every channel of p (CV_32FC1 to CV_32FC4, same size as the guide) into q.
+  void Filter(const cv::Mat& p, cv::Mat& q);
+
+ private:
+  bool SameGuide(const Image1f& I, int r, double eps, int s) const;
+  void Box(const cv::Mat& src, cv::Mat& dst);
+
+ private:
+  int r_ = -1;
+  int s_ = -1;
+  double eps_ = -1;
+  int ksize_ = 0;
+
+  Image1f guide_;           // Full resolution.
+  Image1f I_, II_;          // Subsampled guide, and its square.
+  Image1f mean_I_;
+  Image1f mean_II_;
+  Image1f inv_var_I_;       // 1 / (var(I) + eps)
+
+  cv::Mat p_;               // Subsampled p.
+  cv::Mat p_Ip_;            // p and I*p, interleaved (2 * channels).
+  cv::Mat mean_p_Ip_;
+  cv::Mat ab_;              // a and b, interleaved (2 * channels).
+  cv::Mat mean_ab_;
+  cv::Mat mean_ab_full_;    // mean_ab_ upsampled to the guide's size.
+
+  cv::Mat box_tmp_;
+  std::vector<double> box_col_sums_;
+};
+
+
+}
+}
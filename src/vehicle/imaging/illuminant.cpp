@@ -2,19 +2,35 @@
 
 #include "imaging/fast_guided_filter.hpp"
 #include "imaging/illuminant.hpp"
+#include "imaging/recursive_gaussian.hpp"
 
 namespace bm {
 namespace imaging {
 
 
+// Same as cv::getGaussianKernel() when sigma isn't given.
+static double SigmaFromKernelSize(int ksize, double sigma)
+{
+  return (sigma > 0) ? sigma : (0.3*((ksize - 1)*0.5 - 1) + 0.8);
+}
+
+
 Image3f EstimateIlluminantGaussian(const Image3f& bgr,
                                    int ksizeX,
                                    int ksizeY,
                                    double sigmaX,
-                                   double sigmaY)
+                                   double sigmaY,
+                                   GaussianBackend backend)
 {
   Image3f lsac;
-  cv::GaussianBlur(bgr, lsac, cv::Size(ksizeX, ksizeY), sigmaX, sigmaY, cv::BORDER_REPLICATE);
+  if (backend == GaussianBackend::RECURSIVE) {
+    // Like cv::GaussianBlur, sigmaY defaults to sigmaX.
+    const double sx = SigmaFromKernelSize(ksizeX, sigmaX);
+    const double sy = SigmaFromKernelSize(ksizeY, (sigmaY > 0) ? sigmaY : sigmaX);
+    RecursiveGaussian(bgr, sx, sy, lsac);
+  } else {
+    cv::GaussianBlur(bgr, lsac, cv::Size(ksizeX, ksizeY), sigmaX, sigmaY, cv::BORDER_REPLICATE);
+  }
 
   // Akkaynak et al. multiply by a factor of 2 to get the illuminant map.
   return 2.0f * lsac;
@@ -34,5 +50,21 @@ Image3f EstimateIlluminantRangeGuided(const Image3f& bgr,
 }
 
 
+void EstimateIlluminantRangeGuided(const Image3f& bgr,
+                                   const Image1f& range,
+                                   int r,
+                                   double eps,
+                                   int s,
+                                   GuidedFilter& filter,
+                                   Image3f& il)
+{
+  filter.SetGuide(range, r, eps, s);
+  filter.Filter(bgr, il);
+
+  // Akkaynak et al. multiply by a factor of 2 to get the illuminant map.
+  il *= 2.0f;
+}
+
+
 }
 }
@@ -1,17 +1,25 @@
 #pragma once
 
 #include "vision_core/cv_types.hpp"
+#include "imaging/guided_filter.hpp"
 
 namespace bm {
 namespace imaging {
 
 using namespace core;
 
+// How EstimateIlluminantGaussian() blurs the image. RECURSIVE costs the same per pixel for any
+// kernel size (see RecursiveGaussian()), and ignores ksize (the kernel isn't truncated).
+enum class GaussianBackend { OPENCV, RECURSIVE };
+
+
+// Sigmas <= 0 are computed from ksize, the same way as cv::GaussianBlur.
 Image3f EstimateIlluminantGaussian(const Image3f& bgr,
                                   int ksizeX,
                                   int ksizeY,
                                   double sigmaX,
-                                  double sigmaY);
+                                  double sigmaY,
+                                  GaussianBackend backend = GaussianBackend::OPENCV);
 
 
 Image3f EstimateIlluminantRangeGuided(const Image3f& bgr,
@@ -20,5 +28,16 @@ Image3f EstimateIlluminantRangeGuided(const Image3f& bgr,
                                       double eps,
                                       int s);
 
+
+// Same as above, but keeps the filter's buffers (and the range statistics, if the range image
+// hasn't changed) in filter between calls.
+void EstimateIlluminantRangeGuided(const Image3f& bgr,
+                                   const Image1f& range,
+                                   int r,
+                                   double eps,
+                                   int s,
+                                   GuidedFilter& filter,
+                                   Image3f& il);
+
 }
 }
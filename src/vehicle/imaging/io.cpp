@@ -1,9 +1,40 @@
+#include <cstring>
+#include <fstream>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <glog/logging.h>
 #include <opencv2/highgui.hpp>
+
 #include "imaging/io.hpp"
 
 namespace bm {
 namespace imaging {
 
+namespace ipc = boost::interprocess;
+
+
+// Keeps a raw range map mapped for as long as any DepthMap (or image header) from it needs it.
+struct DepthRawMapping final
+{
+  explicit DepthRawMapping(const std::string& path)
+      : file(path.c_str(), ipc::read_only),
+        region(file, ipc::copy_on_write) {}
+
+  char* Data() const { return static_cast<char*>(region.get_address()); }
+  size_t Size() const { return region.get_size(); }
+
+  ipc::file_mapping file;
+  ipc::mapped_region region;
+};
+
+
+static bool EndsWith(const std::string& s, const std::string& suffix)
+{
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
 
 Image1f LoadDepthTif(const std::string& filepath)
 {
@@ -11,5 +42,94 @@ Image1f LoadDepthTif(const std::string& filepath)
 }
 
 
+Image1w DepthToMillimeters(const Image1f& depth)
+{
+  // NOTE(milo): convertTo rounds and saturates, so negative (and NaN) ranges become zero (missing).
+  Image1w depth_mm;
+  depth.convertTo(depth_mm, CV_16UC1, 1000.0);
+  return depth_mm;
+}
+
+
+Image1f DepthFromMillimeters(const Image1w& depth_mm)
+{
+  Image1f depth;
+  depth_mm.convertTo(depth, CV_32FC1, 1e-3);
+  return depth;
+}
+
+
+Image1f DepthMap::Meters() const
+{
+  if (IsMillimeters()) {
+    return DepthFromMillimeters(depth);
+  }
+  return depth;
+}
+
+
+void SaveDepthRaw(const std::string& filepath, const Image1f& depth, bool millimeters)
+{
+  const cv::Mat pixels = millimeters ? cv::Mat(DepthToMillimeters(depth)) : cv::Mat(depth);
+  const cv::Mat continuous = pixels.isContinuous() ? pixels : pixels.clone();
+
+  DepthRawHeader header = {};
+  std::memcpy(header.magic, kDepthRawMagic, sizeof(kDepthRawMagic));
+  header.version = kDepthRawVersion;
+  header.rows = continuous.rows;
+  header.cols = continuous.cols;
+  header.type = continuous.type();
+
+  std::ofstream out(filepath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+  CHECK(out.is_open()) << "Could not open file: " << filepath << std::endl;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(DepthRawHeader));
+  out.write(reinterpret_cast<const char*>(continuous.data), continuous.total() * continuous.elemSize());
+  CHECK(out.good()) << "Could not write range map: " << filepath << std::endl;
+}
+
+
+DepthMap MapDepthRaw(const std::string& filepath)
+{
+  const auto mapping = std::make_shared<const DepthRawMapping>(filepath);
+  if (mapping->Size() < sizeof(DepthRawHeader)) {
+    throw std::runtime_error("ERROR: Raw range map is truncated: " + filepath);
+  }
+
+  DepthRawHeader header;
+  std::memcpy(&header, mapping->Data(), sizeof(DepthRawHeader));
+  if (std::memcmp(header.magic, kDepthRawMagic, sizeof(kDepthRawMagic)) != 0 ||
+      header.version != kDepthRawVersion ||
+      (header.type != CV_32FC1 && header.type != CV_16UC1) ||
+      header.rows < 0 || header.cols < 0) {
+    throw std::runtime_error("ERROR: Not a raw range map: " + filepath);
+  }
+
+  const size_t elem_size = (header.type == CV_32FC1) ? sizeof(float) : sizeof(uint16_t);
+  if (sizeof(DepthRawHeader) + static_cast<size_t>(header.rows) * header.cols * elem_size > mapping->Size()) {
+    throw std::runtime_error("ERROR: Raw range map is truncated: " + filepath);
+  }
+
+  DepthMap out;
+  out.depth = cv::Mat(header.rows, header.cols, header.type, mapping->Data() + sizeof(DepthRawHeader));
+  out.mapping = mapping;
+  return out;
+}
+
+
+DepthMap LoadDepth(const std::string& filepath, bool millimeters)
+{
+  if (EndsWith(filepath, kDepthRawExtension)) {
+    return MapDepthRaw(filepath);
+  }
+
+  const Image1f depth = LoadDepthTif(filepath);
+  CHECK(!depth.empty()) << "Could not load range map: " << filepath << std::endl;
+
+  DepthMap out;
+  out.depth = millimeters ? cv::Mat(DepthToMillimeters(depth)) : cv::Mat(depth);
+  return out;
+}
+
+
 }
 }
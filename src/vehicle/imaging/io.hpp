@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <string>
+
 #include "vision_core/cv_types.hpp"
 
 namespace bm {
@@ -10,5 +14,62 @@ using namespace core;
 // Load the depth maps from Sea-thru paper.
 Image1f LoadDepthTif(const std::string& filepath);
 
+
+// Range maps are stored as CV_32FC1 meters, or CV_16UC1 millimeters to halve their memory (up to
+// 65.535m, which is well past what the cameras can see underwater). Zero means missing in both.
+Image1w DepthToMillimeters(const Image1f& depth);
+Image1f DepthFromMillimeters(const Image1w& depth_mm);
+
+
+// A range map that was loaded from a file, in either storage format. If it was memory-mapped from a
+// raw file, the mapping stays open for as long as the DepthMap exists.
+struct DepthMap final
+{
+  cv::Mat depth;                          // CV_32FC1 meters or CV_16UC1 millimeters.
+  std::shared_ptr<const void> mapping;    // Non-null if depth points into a mapped file.
+
+  bool IsMillimeters() const { return depth.type() == CV_16UC1; }
+  size_t Bytes() const { return depth.total() * depth.elemSize(); }
+
+  // Range in meters. Converts a millimeter map, and otherwise doesn't copy.
+  // NOTE(milo): For a mapped map, the image is only valid while this DepthMap (or a copy) exists.
+  Image1f Meters() const;
+};
+
+
+// A raw range map that can be memory-mapped instead of decoded (for range maps that are precomputed
+// once and then read for every enhancement run).
+//
+// Layout:
+//   DepthRawHeader
+//   rows * cols pixels, row-major, in host byte order
+static const char kDepthRawMagic[8] = { 'B', 'M', 'R', 'A', 'N', 'G', 'E', '\0' };
+static const uint32_t kDepthRawVersion = 1;
+static const char kDepthRawExtension[] = ".bmrange";
+
+
+struct DepthRawHeader final
+{
+  char magic[8];
+  uint32_t version;
+  int32_t rows;
+  int32_t cols;
+  int32_t type;     // CV_32FC1 or CV_16UC1.
+};
+
+
+// Writes a range map in the raw format, as millimeters if millimeters is true.
+void SaveDepthRaw(const std::string& filepath, const Image1f& depth, bool millimeters = false);
+
+
+// Memory-maps a raw range map. Pages are copy-on-write, so the map can be modified without changing
+// the file. Throws std::runtime_error if the file isn't a valid raw range map.
+DepthMap MapDepthRaw(const std::string& filepath);
+
+
+// Loads a raw (see kDepthRawExtension) or TIF range map. A TIF is converted to millimeters if
+// millimeters is true. Raw maps are used in whichever format they were saved in.
+DepthMap LoadDepth(const std::string& filepath, bool millimeters = false);
+
 }
 }
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+
+#include <opencv2/core/utility.hpp>
+
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace imaging {
+
+using namespace core;
+
+
+// Samples are split into at most this many chunks, of at least kMinSamplesPerChunk each.
+static const int kMaxSampleChunks = 16;
+static const int kMinSamplesPerChunk = 64;
+
+
+// Gauss-Newton normal equations (H = J^T * J and g = -J^T * r), summed over samples.
+struct NormalEquations12 final
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  void SetZero()
+  {
+    H.setZero();
+    g.setZero();
+    error = 0;
+  }
+
+  // Adds one sample, with (weighted) Jacobian row J and residual r.
+  void Add(const Vector12f& J, float r)
+  {
+    H.noalias() += J * J.transpose();
+    g.noalias() -= J * r;
+  }
+
+  Matrix12f H;
+  Vector12f g;
+  float error;
+};
+
+
+// Calls fn(i, eqs) for each sample i in [0, N), with chunks of samples in parallel, and returns
+// their sum in eqs. Each chunk sums into its own NormalEquations12, and the chunks are added up in
+// order, so the result doesn't depend on how the chunks were scheduled. Nothing is allocated.
+template <typename Fn>
+void AccumulateNormalEquations(int N, const Fn& fn, NormalEquations12& eqs)
+{
+  const int num_chunks = std::max(1, std::min(kMaxSampleChunks, N / kMinSamplesPerChunk));
+  NormalEquations12 chunks[kMaxSampleChunks];
+
+  cv::parallel_for_(cv::Range(0, num_chunks), [&](const cv::Range& range) {
+    for (int k = range.start; k < range.end; ++k) {
+      NormalEquations12& chunk = chunks[k];
+      chunk.SetZero();
+      for (int i = k * N / num_chunks; i < (k + 1) * N / num_chunks; ++i) {
+        fn(i, chunk);
+      }
+    }
+  });
+
+  eqs.SetZero();
+  for (int k = 0; k < num_chunks; ++k) {
+    eqs.H += chunks[k].H;
+    eqs.g += chunks[k].g;
+    eqs.error += chunks[k].error;
+  }
+}
+
+
+// Same as above, for sums of a per-sample error: returns the sum of fn(i) over [0, N).
+template <typename Fn>
+float AccumulateError(int N, const Fn& fn)
+{
+  const int num_chunks = std::max(1, std::min(kMaxSampleChunks, N / kMinSamplesPerChunk));
+  float chunks[kMaxSampleChunks];
+
+  cv::parallel_for_(cv::Range(0, num_chunks), [&](const cv::Range& range) {
+    for (int k = range.start; k < range.end; ++k) {
+      chunks[k] = 0;
+      for (int i = k * N / num_chunks; i < (k + 1) * N / num_chunks; ++i) {
+        chunks[k] += fn(i);
+      }
+    }
+  });
+
+  float error = 0;
+  for (int k = 0; k < num_chunks; ++k) {
+    error += chunks[k];
+  }
+  return error;
+}
+
+
+}
+}
@@ -1,4 +1,8 @@
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <glog/logging.h>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 
@@ -202,5 +206,180 @@ Image1f Sharpen(const Image1f& gray)
   return sharpened;
 }
 
+
+constexpr int GammaLut::kSize;
+
+
+GammaLut::GammaLut(float gamma_power)
+    : gamma_power_(gamma_power),
+      table_(kSize + 1)
+{
+  for (int i = 0; i <= kSize; ++i) {
+    table_[i] = std::pow(static_cast<float>(i) / kSize, gamma_power);
+  }
+}
+
+
+void ColorPipeline::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("input_gamma", &input_gamma);
+  parser.GetParam("correct_color_ratio", &correct_color_ratio);
+  parser.GetParam("white_balance", &white_balance);
+  parser.GetParam("normalize", &normalize);
+  parser.GetParam("output_gamma", &output_gamma);
+  parser.GetParam("stats_downsample", &stats_downsample);
+}
+
+
+ColorPipeline::ColorPipeline(const Params& params)
+    : params_(params),
+      gamma_lut_(params.output_gamma)
+{
+  CHECK_GE(params_.stats_downsample, 1);
+  for (int i = 0; i < 256; ++i) {
+    decode_lut_[i] = std::pow(static_cast<float>(i) / 255.0f, params_.input_gamma);
+  }
+}
+
+
+void ColorPipeline::ComputeStats()
+{
+  scale_ = cv::Vec3f(1, 1, 1);
+  offset_ = cv::Vec3f(0, 0, 0);
+  vmin_ = 0;
+  inv_range_ = 1;
+
+  const auto apply_affine = [this](const cv::Vec3f& scale, const cv::Vec3f& offset) {
+    for (int r = 0; r < small_.rows; ++r) {
+      cv::Vec3f* v = small_.ptr<cv::Vec3f>(r);
+      for (int c = 0; c < small_.cols; ++c) {
+        for (int ch = 0; ch < 3; ++ch) {
+          v[c][ch] = v[c][ch] * scale[ch] + offset[ch];
+        }
+      }
+    }
+    for (int ch = 0; ch < 3; ++ch) {
+      offset_[ch] = offset_[ch] * scale[ch] + offset[ch];
+      scale_[ch] *= scale[ch];
+    }
+  };
+
+  if (params_.correct_color_ratio) {
+    const cv::Scalar mean = cv::mean(small_);
+    const cv::Vec3f scale((mean(0) > 0) ? (mean(1) / mean(0)) : 1,
+                          1,
+                          (mean(2) > 0) ? (mean(1) / mean(2)) : 1);
+    apply_affine(scale, cv::Vec3f(0, 0, 0));
+  }
+
+  if (params_.white_balance) {
+    cv::Vec3f vmin(FLT_MAX, FLT_MAX, FLT_MAX);
+    cv::Vec3f vmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int r = 0; r < small_.rows; ++r) {
+      const cv::Vec3f* v = small_.ptr<cv::Vec3f>(r);
+      for (int c = 0; c < small_.cols; ++c) {
+        for (int ch = 0; ch < 3; ++ch) {
+          vmin[ch] = std::min(vmin[ch], v[c][ch]);
+          vmax[ch] = std::max(vmax[ch], v[c][ch]);
+        }
+      }
+    }
+
+    // NOTE(milo): Same as WhiteBalanceSimple(), don't divide by zero for a monochrome channel.
+    cv::Vec3f scale, offset;
+    for (int ch = 0; ch < 3; ++ch) {
+      const float range = (vmax[ch] - vmin[ch]) > 0 ? (vmax[ch] - vmin[ch]) : 1;
+      scale[ch] = 1.0f / range;
+      offset[ch] = -vmin[ch] / range;
+    }
+    apply_affine(scale, offset);
+  }
+
+  if (params_.normalize) {
+    float vmin = FLT_MAX;
+    float vmax = -FLT_MAX;
+    for (int r = 0; r < small_.rows; ++r) {
+      const cv::Vec3f* v = small_.ptr<cv::Vec3f>(r);
+      for (int c = 0; c < small_.cols; ++c) {
+        const float V = std::max(v[c][0], std::max(v[c][1], v[c][2]));
+        vmin = std::min(vmin, V);
+        vmax = std::max(vmax, V);
+      }
+    }
+    vmin_ = vmin;
+    inv_range_ = (vmax - vmin) > 0 ? 1.0f / (vmax - vmin) : 1.0f;
+  }
+}
+
+
+void ColorPipeline::ApplyPixel(cv::Vec3f& v) const
+{
+  for (int ch = 0; ch < 3; ++ch) {
+    v[ch] = v[ch] * scale_[ch] + offset_[ch];
+  }
+
+  // Stretching V with the same H and S scales every channel by the same factor. Black pixels have
+  // no hue, so they become gray.
+  if (params_.normalize) {
+    const float V = std::max(v[0], std::max(v[1], v[2]));
+    const float V_new = (V - vmin_) * inv_range_;
+    if (V > 0) {
+      v *= (V_new / V);
+    } else {
+      v = cv::Vec3f(V_new, V_new, V_new);
+    }
+  }
+
+  if (params_.output_gamma != 1.0f) {
+    for (int ch = 0; ch < 3; ++ch) {
+      v[ch] = gamma_lut_(v[ch]);
+    }
+  }
+}
+
+
+void ColorPipeline::Apply(Image3f& bgr)
+{
+  cv::resize(bgr, small_, bgr.size() / params_.stats_downsample);
+  ComputeStats();
+
+  cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range& rows) {
+    for (int r = rows.start; r < rows.end; ++r) {
+      cv::Vec3f* v = bgr.ptr<cv::Vec3f>(r);
+      for (int c = 0; c < bgr.cols; ++c) {
+        ApplyPixel(v[c]);
+      }
+    }
+  });
+}
+
+
+void ColorPipeline::Apply(const Image3b& bgr, Image3f& out)
+{
+  // NOTE(milo): The statistics come from the downsampled 8-bit image, decoded afterwards.
+  cv::resize(bgr, small8_, bgr.size() / params_.stats_downsample);
+  small_.create(small8_.size());
+  for (int r = 0; r < small8_.rows; ++r) {
+    const cv::Vec3b* b = small8_.ptr<cv::Vec3b>(r);
+    cv::Vec3f* v = small_.ptr<cv::Vec3f>(r);
+    for (int c = 0; c < small8_.cols; ++c) {
+      v[c] = cv::Vec3f(decode_lut_[b[c][0]], decode_lut_[b[c][1]], decode_lut_[b[c][2]]);
+    }
+  }
+  ComputeStats();
+
+  out.create(bgr.size());
+  cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range& rows) {
+    for (int r = rows.start; r < rows.end; ++r) {
+      const cv::Vec3b* b = bgr.ptr<cv::Vec3b>(r);
+      cv::Vec3f* v = out.ptr<cv::Vec3f>(r);
+      for (int c = 0; c < bgr.cols; ++c) {
+        v[c] = cv::Vec3f(decode_lut_[b[c][0]], decode_lut_[b[c][1]], decode_lut_[b[c][2]]);
+        ApplyPixel(v[c]);
+      }
+    }
+  });
+}
+
 }
 }
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
 #include "vision_core/cv_types.hpp"
 #include "core/eigen_types.hpp"
 
@@ -44,5 +49,89 @@ Image3f NormalizeColorIlluminant(const Image3f bgr);
 Image1f Sharpen(const Image1f& gray);
 
 
+// pow(v, gamma_power) by table lookup, with linear interpolation between entries. Inputs are
+// clamped to [0, 1]. The error is largest in the first entry when gamma_power < 1 (about 0.006
+// for 0.4545), and is under 1e-4 everywhere else.
+class GammaLut final {
+ public:
+  static constexpr int kSize = 4096;
+
+  explicit GammaLut(float gamma_power);
+
+  inline float operator()(float v) const
+  {
+    const float x = std::min(std::max(v, 0.0f), 1.0f) * kSize;
+    const int i = std::min(static_cast<int>(x), kSize - 1);
+    return table_[i] + (x - i) * (table_[i + 1] - table_[i]);
+  }
+
+  float GammaPower() const { return gamma_power_; }
+
+ private:
+  float gamma_power_;
+  std::vector<float> table_;    // kSize + 1 entries, for v = i / kSize.
+};
+
+
+// Chains the color corrections above (CorrectColorRatio, WhiteBalanceSimple, Normalize and then
+// LinearToGamma, each optional) into one pass over the image, for live video. The statistics that
+// each stage needs (channel means, min/max) are computed on a downsampled copy of the image, with
+// the earlier stages applied to it. Then every stage is applied to each pixel at once, in place.
+//
+// NOTE(milo): The stages compose exactly, since the ratio and white balance corrections are a
+// per-channel affine map, and Normalize() only scales each pixel (stretching V in HSV with the
+// same H and S). Gamma uses a GammaLut, so the output is clamped to [0, 1].
+class ColorPipeline final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    float input_gamma = 1.0;          // 8-bit inputs are decoded as pow(v / 255, input_gamma).
+    bool correct_color_ratio = false; // Scale blue and red so that the mean color is gray.
+    bool white_balance = true;        // Stretch each channel to [0, 1].
+    bool normalize = true;            // Stretch the HSV value to [0, 1].
+    float output_gamma = 0.4545;      // Gamma correction at the end (1 = OFF).
+    int stats_downsample = 8;         // Statistics come from an image this much smaller.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(ColorPipeline);
+  ColorPipeline() = delete;
+
+  explicit ColorPipeline(const Params& params);
+
+  // Applies every stage to bgr, in place.
+  void Apply(Image3f& bgr);
+
+  // Same as above for an 8-bit image, which is decoded (with a 256 entry table) in the same pass.
+  void Apply(const Image3b& bgr, Image3f& out);
+
+ private:
+  // Fits the stages to the downsampled image in small_ (which they are also applied to).
+  void ComputeStats();
+
+  // Applies the stages to a pixel that has been decoded to float.
+  inline void ApplyPixel(cv::Vec3f& v) const;
+
+ private:
+  Params params_;
+  GammaLut gamma_lut_;
+  float decode_lut_[256];
+
+  Image3b small8_;
+  Image3f small_;
+
+  // The ratio and white balance stages, as v * scale + offset.
+  cv::Vec3f scale_, offset_;
+
+  // The normalize stage, as (V - vmin) * inv_range.
+  float vmin_ = 0;
+  float inv_range_ = 1;
+};
+
+
 }
 }
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <glog/logging.h>
+#include <opencv2/core/utility.hpp>
+
+#include "imaging/recursive_gaussian.hpp"
+
+namespace bm {
+namespace imaging {
+
+
+static const int kMaxRecursiveChannels = 4;
+
+// The vertical pass splits the columns into this many stripes.
+static const int kColumnStripes = 8;
+
+
+// Coefficients for w[n] = B*x[n] + a1*w[n-1] + a2*w[n-2] + a3*w[n-3] (and the same backwards), and
+// the Triggs-Sdika matrix that gives the backward pass's initial state for a replicated border.
+struct RecursiveCoeffs final {
+  double B, a1, a2, a3;
+  double M[9];
+};
+
+
+static RecursiveCoeffs YoungVanVliet(double sigma)
+{
+  const double q = (sigma >= 2.5) ? (0.98711*sigma - 0.96330) :
+                                    (3.97156 - 4.14554*std::sqrt(1.0 - 0.26891*sigma));
+  const double q2 = q*q;
+  const double q3 = q2*q;
+
+  const double b0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+  const double b1 = 2.44413*q + 2.85619*q2 + 1.26661*q3;
+  const double b2 = -(1.4281*q2 + 1.26661*q3);
+  const double b3 = 0.422205*q3;
+
+  RecursiveCoeffs k;
+  k.a1 = b1 / b0;
+  k.a2 = b2 / b0;
+  k.a3 = b3 / b0;
+  k.B = 1.0 - (k.a1 + k.a2 + k.a3);
+
+  const double a1 = k.a1, a2 = k.a2, a3 = k.a3;
+  const double s = 1.0 / ((1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) * (1.0 + a2 + (a1 - a3)*a3));
+  k.M[0] = s * (-a3*a1 + 1.0 - a3*a3 - a2);
+  k.M[1] = s * (a3 + a1) * (a2 + a3*a1);
+  k.M[2] = s * a3 * (a1 + a3*a2);
+  k.M[3] = s * (a1 + a3*a2);
+  k.M[4] = -s * (a2 - 1.0) * (a2 + a3*a1);
+  k.M[5] = -s * a3 * (a3*a1 + a3*a3 + a2 - 1.0);
+  k.M[6] = s * (a3*a1 + a2 + a1*a1 - a2*a2);
+  k.M[7] = s * (a1*a2 + a3*a2*a2 - a1*a3*a3 - a3*a3*a3 - a3*a2 + a3);
+  k.M[8] = s * a3 * (a1 + a3*a2);
+
+  return k;
+}
+
+
+// Given the last three outputs of the forward pass (w1 is the last one) and the last input, returns
+// the outputs of the backward pass at the last index (y1), and at the two (virtual) indices after
+// it. The forward pass is already in steady state past the border, since the input is constant.
+static inline void BackwardInit(const RecursiveCoeffs& k,
+                                double w1, double w2, double w3, double last,
+                                double& y1, double& y2, double& y3)
+{
+  const double d1 = k.B * (w1 - last);
+  const double d2 = k.B * (w2 - last);
+  const double d3 = k.B * (w3 - last);
+  y1 = k.M[0]*d1 + k.M[1]*d2 + k.M[2]*d3 + last;
+  y2 = k.M[3]*d1 + k.M[4]*d2 + k.M[5]*d3 + last;
+  y3 = k.M[6]*d1 + k.M[7]*d2 + k.M[8]*d3 + last;
+}
+
+
+// Filters each channel of a row (cols pixels with cn interleaved channels) in place.
+// NOTE(milo): Since the forward pass starts in steady state, w[0] = x[0], and the outputs before
+// the border are all x[0]. So clamping indices at 0 gives the exact virtual outputs.
+static void FilterRow(const RecursiveCoeffs& k, int cols, int cn, float* row)
+{
+  double w1[kMaxRecursiveChannels], w2[kMaxRecursiveChannels], w3[kMaxRecursiveChannels];
+  double last[kMaxRecursiveChannels];
+
+  for (int c = 0; c < cn; ++c) {
+    w1[c] = w2[c] = w3[c] = row[c];
+    last[c] = row[(cols - 1)*cn + c];
+  }
+
+  for (int x = 0; x < cols; ++x) {
+    float* px = row + x*cn;
+    for (int c = 0; c < cn; ++c) {
+      const double w = k.B*px[c] + k.a1*w1[c] + k.a2*w2[c] + k.a3*w3[c];
+      w3[c] = w2[c];
+      w2[c] = w1[c];
+      w1[c] = w;
+      px[c] = static_cast<float>(w);
+    }
+  }
+
+  // w1, w2 and w3 are the outputs at cols - 1, cols - 2 and cols - 3 (or clamped to 0) now.
+  double y1[kMaxRecursiveChannels], y2[kMaxRecursiveChannels], y3[kMaxRecursiveChannels];
+  for (int c = 0; c < cn; ++c) {
+    BackwardInit(k, w1[c], w2[c], w3[c], last[c], y1[c], y2[c], y3[c]);
+    row[(cols - 1)*cn + c] = static_cast<float>(y1[c]);
+  }
+
+  for (int x = cols - 2; x >= 0; --x) {
+    float* px = row + x*cn;
+    for (int c = 0; c < cn; ++c) {
+      const double y = k.B*px[c] + k.a1*y1[c] + k.a2*y2[c] + k.a3*y3[c];
+      y3[c] = y2[c];
+      y2[c] = y1[c];
+      y1[c] = y;
+      px[c] = static_cast<float>(y);
+    }
+  }
+}
+
+
+void RecursiveGaussian(const cv::Mat& src, double sigmaX, double sigmaY, cv::Mat& dst)
+{
+  CHECK_EQ(CV_32F, src.depth()) << "RecursiveGaussian only supports float images" << std::endl;
+  CHECK_LE(src.channels(), kMaxRecursiveChannels);
+  CHECK(sigmaX > 0 && sigmaY > 0) << "RecursiveGaussian needs a positive sigma" << std::endl;
+  CHECK(!src.empty());
+
+  const int rows = src.rows;
+  const int cols = src.cols;
+  const int cn = src.channels();
+  const int width = cols * cn;
+
+  src.copyTo(dst);
+
+  // Horizontal pass, in place.
+  const RecursiveCoeffs kx = YoungVanVliet(sigmaX);
+  cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range) {
+    for (int y = range.start; y < range.end; ++y) {
+      FilterRow(kx, cols, cn, dst.ptr<float>(y));
+    }
+  });
+
+  // Vertical pass, in place. Each stripe runs down (and back up) a range of columns, where every
+  // channel of a pixel is a column, so the inner loops are over contiguous memory. The states are
+  // just the rows that were already filtered.
+  const RecursiveCoeffs ky = YoungVanVliet(sigmaY);
+  cv::parallel_for_(cv::Range(0, width), [&](const cv::Range& range) {
+    const int j0 = range.start;
+    const int j1 = range.end;
+    const int n = j1 - j0;
+
+    // The last input row, and the backward outputs at the two virtual rows after the border.
+    std::vector<double> last(n), next1(n), next2(n);
+    const float* last_row = dst.ptr<float>(rows - 1);
+    for (int j = 0; j < n; ++j) { last[j] = last_row[j0 + j]; }
+
+    for (int y = 1; y < rows; ++y) {
+      float* d = dst.ptr<float>(y);
+      const float* p1 = dst.ptr<float>(y - 1);
+      const float* p2 = dst.ptr<float>(std::max(0, y - 2));
+      const float* p3 = dst.ptr<float>(std::max(0, y - 3));
+      for (int j = j0; j < j1; ++j) {
+        d[j] = static_cast<float>(ky.B*d[j] + ky.a1*p1[j] + ky.a2*p2[j] + ky.a3*p3[j]);
+      }
+    }
+
+    float* r1 = dst.ptr<float>(rows - 1);
+    const float* r2 = dst.ptr<float>(std::max(0, rows - 2));
+    const float* r3 = dst.ptr<float>(std::max(0, rows - 3));
+    for (int j = 0; j < n; ++j) {
+      double y1;
+      BackwardInit(ky, r1[j0 + j], r2[j0 + j], r3[j0 + j], last[j], y1, next1[j], next2[j]);
+      r1[j0 + j] = static_cast<float>(y1);
+    }
+
+    for (int y = rows - 2; y >= 0; --y) {
+      float* d = dst.ptr<float>(y);
+      const float* n1 = dst.ptr<float>(y + 1);
+      if (y + 3 < rows) {
+        const float* n2 = dst.ptr<float>(y + 2);
+        const float* n3 = dst.ptr<float>(y + 3);
+        for (int j = j0; j < j1; ++j) {
+          d[j] = static_cast<float>(ky.B*d[j] + ky.a1*n1[j] + ky.a2*n2[j] + ky.a3*n3[j]);
+        }
+      } else {
+        // Within two rows of the bottom, some of the states are the virtual rows.
+        for (int j = j0; j < j1; ++j) {
+          const double n2 = (y + 2 < rows) ? dst.ptr<float>(y + 2)[j] : next1[j - j0];
+          const double n3 = (y + 3 == rows) ? next1[j - j0] : next2[j - j0];
+          d[j] = static_cast<float>(ky.B*d[j] + ky.a1*n1[j] + ky.a2*n2 + ky.a3*n3);
+        }
+      }
+    }
+  }, kColumnStripes);
+}
+
+
+}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace imaging {
+
+using namespace core;
+
+
+// Gaussian blur of a CV_32F image with up to 4 channels, using the recursive (IIR) filter from
+// Young and van Vliet (1995), "Recursive implementation of the Gaussian filter". The cost per pixel
+// doesn't depend on sigma, so this is much faster than cv::GaussianBlur for big kernels. The border
+// is replicated (like BORDER_REPLICATE) exactly, with the initial conditions from Triggs and Sdika
+// (2006). The horizontal pass is split over rows, and the vertical pass over columns, which runs
+// over contiguous memory for every channel at once. Both run with cv::parallel_for_.
+//
+// NOTE(milo): The kernel isn't truncated, so this only matches cv::GaussianBlur when its ksize is
+// big enough (about 6 sigma). It's also a poor approximation of a Gaussian for sigma under ~1.
+void RecursiveGaussian(const cv::Mat& src, double sigmaX, double sigmaY, cv::Mat& dst);
+
+
+}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cctype>
+#include <string>
+#include <unordered_map>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/data_subsampler.hpp"
+#include "core/pipeline_latency.hpp"
+#include "lcm_util/decode_image.hpp"
+
+#include "vehicle/image_t.hpp"
+
+namespace bm {
+
+
+// Publishes DebugViewer images as JPGs, so that they can be watched (e.g with lcm_image_viewer)
+// from the surface instead of on the vehicle. Each window goes out on its own channel, which is
+// channel_prefix + "/" + the window name (lower case, with anything else replaced by "_").
+//
+// NOTE(milo): Register Publish() as a DebugViewer::FrameCallback. It's only called on the viewer's
+// render thread, so nothing here is locked.
+class DebugImagePublisher final {
+ public:
+  DebugImagePublisher(lcm::LCM& lcm, const std::string& channel_prefix, double max_hz, int jpeg_quality)
+      : lcm_(lcm),
+        channel_prefix_(channel_prefix),
+        max_hz_(max_hz),
+        jpeg_quality_(jpeg_quality) {}
+
+  void Publish(const std::string& window, const cv::Mat& image)
+  {
+    auto it = windows_.find(window);
+    if (it == windows_.end()) {
+      it = windows_.emplace(window, Window(ChannelName(window), max_hz_)).first;
+    }
+
+    const core::seconds_t now = 1e-9 * static_cast<double>(core::SteadyNowNs());
+    if (!it->second.subsampler.ShouldSample(now)) {
+      return;
+    }
+
+    EncodeJPG(image, jpeg_quality_, msg_);
+    lcm_.publish(it->second.channel, &msg_);
+  }
+
+ private:
+  struct Window final
+  {
+    Window(const std::string& channel, double max_hz) : channel(channel), subsampler(max_hz) {}
+
+    std::string channel;
+    core::DataSubsampler subsampler;
+  };
+
+  std::string ChannelName(const std::string& window) const
+  {
+    std::string name = window;
+    for (char& c : name) {
+      c = std::isalnum(static_cast<unsigned char>(c)) ? std::tolower(static_cast<unsigned char>(c)) : '_';
+    }
+    return channel_prefix_ + "/" + name;
+  }
+
+  lcm::LCM& lcm_;
+  std::string channel_prefix_;
+  double max_hz_;
+  int jpeg_quality_;
+
+  std::unordered_map<std::string, Window> windows_;
+  vehicle::image_t msg_;      // Reused, so that the JPG buffer isn't reallocated every time.
+};
+
+
+}
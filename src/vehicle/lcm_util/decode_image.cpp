@@ -1,3 +1,7 @@
+#include <atomic>
+#include <cstring>
+#include <vector>
+
 #include <glog/logging.h>
 
 #include <opencv2/imgproc.hpp>
@@ -56,4 +60,169 @@ void DecodeJPG(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, cv::Mat
 }
 
 
+cv::Size DecodedSize(int width, int height, int scale)
+{
+  return cv::Size((width + scale - 1) / scale, (height + scale - 1) / scale);
+}
+
+
+bool DecodeToGray(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, Image1b& out, int scale)
+{
+  CHECK(scale == 1 || scale == 2 || scale == 4 || scale == 8) << "Scale must be 1, 2, 4 or 8" << std::endl;
+
+  const bool is_color = msg.format == "rgb8" || msg.format == "bgr8";
+  const bool is_gray = msg.format == "mono8";
+  CHECK(is_color || is_gray) << "Unrecognized image format specifier: " << msg.format << std::endl;
+
+  if (msg.encoding == "jpg") {
+    int flags = cv::IMREAD_GRAYSCALE;
+    if (scale == 2) {
+      flags = cv::IMREAD_REDUCED_GRAYSCALE_2;
+    } else if (scale == 4) {
+      flags = cv::IMREAD_REDUCED_GRAYSCALE_4;
+    } else if (scale == 8) {
+      flags = cv::IMREAD_REDUCED_GRAYSCALE_8;
+    }
+    cv::Mat raw_data(1, msg.size, CV_8UC1, (void*)buf_data);
+    cv::imdecode(raw_data, flags, &out);
+    return !out.empty();
+  }
+
+  CHECK_EQ("raw", msg.encoding) << "Expected JPG or raw image" << std::endl;
+
+  const int channels = is_color ? 3 : 1;
+  const size_t pixel_bytes = static_cast<size_t>(msg.width) * msg.height * channels;
+  CHECK_GE(static_cast<size_t>(msg.size), kRawImageHeaderBytes + pixel_bytes)
+      << "Raw image buffer is too small for its dimensions" << std::endl;
+
+  // NOTE(milo): The generation counter is read through an atomic so that the pixel reads can't be
+  // reordered around it. The publisher must place each image at an 8-byte aligned offset.
+  const std::atomic<uint64_t>* generation = reinterpret_cast<const std::atomic<uint64_t>*>(buf_data);
+  const uint64_t gen_before = generation->load(std::memory_order_acquire);
+  if (gen_before & 1) {
+    return false;
+  }
+
+  // Wrap the pixels in place. There is exactly one pass over them: either a copy (mono8) or the
+  // color conversion (bgr8/rgb8) into an image that the caller owns. When scaling, the resize is
+  // that pass, and color images are converted after it (on fewer pixels).
+  const cv::Mat wrapped(msg.height, msg.width, is_color ? CV_8UC3 : CV_8UC1,
+                        (void*)(buf_data + kRawImageHeaderBytes));
+  const int to_gray = (msg.format == "rgb8") ? cv::COLOR_RGB2GRAY : cv::COLOR_BGR2GRAY;
+  if (scale > 1) {
+    const cv::Size size = DecodedSize(msg.width, msg.height, scale);
+    if (is_gray) {
+      cv::resize(wrapped, out, size, 0, 0, cv::INTER_AREA);
+    } else {
+      cv::Mat small;
+      cv::resize(wrapped, small, size, 0, 0, cv::INTER_AREA);
+      cv::cvtColor(small, out, to_gray);
+    }
+  } else if (is_gray) {
+    wrapped.copyTo(out);
+  } else {
+    cv::cvtColor(wrapped, out, to_gray);
+  }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return generation->load(std::memory_order_relaxed) == gen_before;
+}
+
+
+bool DecodeReduced(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, int scale, cv::Mat& out)
+{
+  CHECK(scale == 1 || scale == 2 || scale == 4 || scale == 8) << "Scale must be 1, 2, 4 or 8" << std::endl;
+
+  const bool is_color = msg.format == "rgb8" || msg.format == "bgr8";
+  const bool is_gray = msg.format == "mono8";
+  CHECK(is_color || is_gray) << "Unrecognized image format specifier: " << msg.format << std::endl;
+
+  if (msg.encoding == "jpg") {
+    int flags = is_color ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE;
+    if (scale == 2) {
+      flags = is_color ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_REDUCED_GRAYSCALE_2;
+    } else if (scale == 4) {
+      flags = is_color ? cv::IMREAD_REDUCED_COLOR_4 : cv::IMREAD_REDUCED_GRAYSCALE_4;
+    } else if (scale == 8) {
+      flags = is_color ? cv::IMREAD_REDUCED_COLOR_8 : cv::IMREAD_REDUCED_GRAYSCALE_8;
+    }
+    cv::Mat raw_data(1, msg.size, CV_8UC1, (void*)buf_data);
+    cv::imdecode(raw_data, flags, &out);
+    if (!out.empty() && msg.format == "rgb8") {
+      cv::cvtColor(out, out, cv::COLOR_RGB2BGR);
+    }
+    return !out.empty();
+  }
+
+  CHECK_EQ("raw", msg.encoding) << "Expected JPG or raw image" << std::endl;
+
+  const int channels = is_color ? 3 : 1;
+  const size_t pixel_bytes = static_cast<size_t>(msg.width) * msg.height * channels;
+  CHECK_GE(static_cast<size_t>(msg.size), kRawImageHeaderBytes + pixel_bytes)
+      << "Raw image buffer is too small for its dimensions" << std::endl;
+
+  const std::atomic<uint64_t>* generation = reinterpret_cast<const std::atomic<uint64_t>*>(buf_data);
+  const uint64_t gen_before = generation->load(std::memory_order_acquire);
+  if (gen_before & 1) {
+    return false;
+  }
+
+  // Nearest neighbor only reads the pixels that it keeps.
+  const cv::Mat wrapped(msg.height, msg.width, is_color ? CV_8UC3 : CV_8UC1,
+                        (void*)(buf_data + kRawImageHeaderBytes));
+  if (scale == 1) {
+    wrapped.copyTo(out);
+  } else {
+    cv::resize(wrapped, out, cv::Size(msg.width / scale, msg.height / scale), 0, 0, cv::INTER_NEAREST);
+  }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (generation->load(std::memory_order_relaxed) != gen_before) {
+    return false;
+  }
+
+  if (msg.format == "rgb8") {
+    cv::cvtColor(out, out, cv::COLOR_RGB2BGR);
+  }
+  return true;
+}
+
+
+void WriteRawImage(const cv::Mat& im, uint8_t* buf_data)
+{
+  CHECK(im.depth() == CV_8U) << "Raw images must be 8-bit" << std::endl;
+
+  std::atomic<uint64_t>* generation = reinterpret_cast<std::atomic<uint64_t>*>(buf_data);
+  const uint64_t gen = generation->load(std::memory_order_relaxed);
+
+  // Odd while writing, even again once the pixels are complete.
+  generation->store(gen + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  uint8_t* pixels = buf_data + kRawImageHeaderBytes;
+  const size_t row_bytes = im.cols * im.elemSize();
+  for (int r = 0; r < im.rows; ++r) {
+    std::memcpy(pixels + r * row_bytes, im.ptr<uint8_t>(r), row_bytes);
+  }
+
+  generation->store(gen + 2, std::memory_order_release);
+}
+
+
+void EncodeJPG(const cv::Mat& im, int quality, vehicle::image_t& msg)
+{
+  CHECK(im.type() == CV_8UC1 || im.type() == CV_8UC3) << "Can only encode mono8 or bgr8 images" << std::endl;
+
+  msg.width = im.cols;
+  msg.height = im.rows;
+  msg.channels = im.channels();
+  msg.format = im.channels() == 1 ? "mono8" : "bgr8";
+  msg.encoding = "jpg";
+
+  const std::vector<int> flags = { cv::IMWRITE_JPEG_QUALITY, quality };
+  cv::imencode(".jpg", im, msg.data, flags);
+  msg.size = static_cast<int32_t>(msg.data.size());
+}
+
+
 }
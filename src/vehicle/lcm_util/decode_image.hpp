@@ -1,16 +1,54 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include <opencv2/core/types.hpp>
 
+#include "vision_core/cv_types.hpp"
+
 #include "vehicle/image_t.hpp"
 #include "vehicle/mmf_image_t.hpp"
 
 namespace bm {
 
+// Images with the "raw" encoding in a memory-mapped file start with a uint64_t generation counter,
+// followed by height * width * channels bytes of pixels. The writer increments the counter before
+// and after writing the pixels (a seqlock), so it's odd while a write is in progress.
+static const size_t kRawImageHeaderBytes = 8;
+
 // https://stackoverflow.com/questions/14727267/opencv-read-jpeg-image-from-buffer
 void DecodeJPG(const vehicle::image_t& msg, cv::Mat& out);
 
 // Decodes a JPG image from a buffer of uint8_t data.
 void DecodeJPG(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, cv::Mat& out);
 
+// Decodes a "jpg" or "raw" image straight from a buffer (e.g a memory-mapped region) into a
+// grayscale image. JPGs are decoded directly to grayscale, so there is no color conversion. Raw
+// images are read under the seqlock described above. Returns false if the writer modified the
+// buffer while we were reading it, in which case "out" should be thrown away.
+//
+// With scale > 1 (2, 4 or 8), the image is decoded at 1/scale of its size (see DecodedSize). JPGs
+// are scaled while they're decoded (libjpeg's DCT scaling), which skips most of the decode work,
+// and raw images are area averaged.
+// NOTE(milo): If "out" is already the right size (e.g a buffer from an ImagePool), it's decoded into
+// in place, so it must not be shared with anyone. Otherwise it's newly allocated.
+bool DecodeToGray(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, Image1b& out, int scale = 1);
+
+// Size of a width x height image decoded at 1/scale. Rounds up, like libjpeg does.
+cv::Size DecodedSize(int width, int height, int scale);
+
+// Decodes a "jpg" or "raw" image at 1/scale of its size (scale is 1, 2, 4 or 8), keeping its color
+// (as bgr8), e.g for a preview. JPGs are scaled while they're decoded (libjpeg's DCT scaling), which
+// costs much less than decoding at full size. Raw images are read under the seqlock, and only the
+// pixels that are kept are read. Returns false if the image couldn't be decoded, or was overwritten.
+bool DecodeReduced(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, int scale, cv::Mat& out);
+
+// Writes an image into a "raw" encoded buffer (see kRawImageHeaderBytes). The buffer must have room
+// for kRawImageHeaderBytes + im.total() * im.elemSize() bytes. Used by memory-mapped publishers.
+void WriteRawImage(const cv::Mat& im, uint8_t* buf_data);
+
+// Encodes a mono8 or bgr8 image as a JPG (quality is 0-100), e.g to preview it over the tether.
+void EncodeJPG(const cv::Mat& im, int quality, vehicle::image_t& msg);
+
 }
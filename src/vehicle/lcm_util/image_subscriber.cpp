@@ -1,21 +1,44 @@
+#include <algorithm>
+
 #include <glog/logging.h>
 
+#include "core/task_scheduler.hpp"
 #include "lcm_util/image_subscriber.hpp"
 #include "lcm_util/decode_image.hpp"
 
-#include "vision_core/image_util.hpp"
-
 namespace bm {
 
 
-ImageSubscriber::ImageSubscriber(lcm::LCM& lcm, const std::string& channel, bool expect_shm)
-    : channel_(channel)
+// Wait this long for a new image before checking for shutdown.
+static const double kDecodeWaitSec = 0.1;
+
+// Enough for the images waiting in the StateEstimator's queue, and the ones that its frontend is
+// holding onto. If more than this are in use, images are allocated outside of the pool.
+static const size_t kImagePoolBuffers = 16;
+
+// With a rectifier, at most one raw pair is being decoded at a time.
+static const size_t kRawPoolBuffers = 2;
+
+
+ImageSubscriber::ImageSubscriber(lcm::LCM& lcm,
+                                 const std::string& channel,
+                                 bool expect_shm,
+                                 bool decode_async)
+    : channel_(channel),
+      decode_async_(decode_async),
+      image_pool_(kImagePoolBuffers, "image_pool_" + channel),
+      raw_pool_(kRawPoolBuffers, "raw_image_pool_" + channel),
+      decode_queue_(2, true, "image_decode_queue")
 {
   if (!lcm.good()) {
     LOG(WARNING) << "Failed to initialize LCM" << std::endl;
     return;
   }
 
+  if (decode_async_) {
+    decode_thread_ = std::thread(&ImageSubscriber::DecodeLoop, this);
+  }
+
   if (expect_shm) {
     lcm.subscribe(channel, &ImageSubscriber::HandleMmf, this);
   } else {
@@ -26,14 +49,41 @@ ImageSubscriber::ImageSubscriber(lcm::LCM& lcm, const std::string& channel, bool
 }
 
 
+ImageSubscriber::~ImageSubscriber()
+{
+  is_shutdown_.store(true);
+  if (decode_thread_.joinable()) {
+    decode_thread_.join();
+  }
+}
+
+
+void ImageSubscriber::SetRectifier(const std::shared_ptr<const core::StereoRectifier>& rectifier)
+{
+  CHECK(!rectifier || decode_scale_ == 1) << "Can't rectify images that are decoded at a reduced scale" << std::endl;
+  rectifier_ = rectifier;
+}
+
+
+void ImageSubscriber::SetDecodeScale(int scale)
+{
+  CHECK(scale == 1 || scale == 2 || scale == 4 || scale == 8) << "Decode scale must be 1, 2, 4 or 8" << std::endl;
+  CHECK(!rectifier_ || scale == 1) << "Can't rectify images that are decoded at a reduced scale" << std::endl;
+  decode_scale_ = scale;
+}
+
+
 void ImageSubscriber::HandleMmf(const lcm::ReceiveBuffer*,
                                 const std::string&,
                                 const vehicle::mmf_stereo_image_t* msg)
 {
-  const bool ok = IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width)
-               && IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width);
+  const bool ok = IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width, true)
+               && IsSupported(msg->img_right.encoding, msg->img_right.format, msg->img_right.height, msg->img_right.width, true);
   if (!ok) { return; }
 
+  CHECK_EQ(msg->img_left.mm_filename, msg->img_right.mm_filename)
+      << "Expected same memory-mapped file names for left and right images" << std::endl;
+
   const std::string mm_filename = msg->img_left.mm_filename;
 
   // Open the memory-mapped file if not already open.
@@ -41,70 +91,129 @@ void ImageSubscriber::HandleMmf(const lcm::ReceiveBuffer*,
     LOG(INFO) << "First message, opening MMF: " << mm_filename << std::endl;
     mapped_file_ = ipc::file_mapping(mm_filename.c_str(), ipc::read_only);
     mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_only);
-    fbuf_.open(mm_filename, std::ios_base::in | std::ios_base::binary);
   }
 
   CHECK_EQ(mm_filename, mapped_file_.get_name())
       << "Message mm_filename doesn't match previous. Did the publisher switch?" << std::endl;
-  CHECK(fbuf_.is_open()) << "File buffer not open, cannot read" << std::endl;
-
-  // Read raw char buffers for both images.
-  const int offl = msg->img_left.offset;
-  const int szl = msg->img_left.size;
 
-  if (offl < 0 || szl <= 0) {
-    LOG(WARNING) << "Got a data buffer for the left image with negative offset or zero size" << std::endl;
-    return;
+  DecodeJob job;
+  job.timestamp = msg->header.timestamp;
+  job.seq = msg->header.seq;
+  job.received = core::SteadyNowNs();
+  job.meta[0] = msg->img_left;
+  job.meta[1] = msg->img_right;
+
+  // Images are decoded directly out of the mapped region (no intermediate copies).
+  for (int i = 0; i < 2; ++i) {
+    job.mapped_data[i] = MappedData(job.meta[i].offset, job.meta[i].size);
+    if (job.mapped_data[i] == nullptr) {
+      LOG(WARNING) << "Got an image data block outside of the memory-mapped file" << std::endl;
+      return;
+    }
+
+    // NOTE(milo): Once we return, the publisher is free to overwrite the block. Raw images are
+    // protected by their generation counter, but a JPG has to be copied to decode it later. The
+    // compressed bytes are much smaller than the decoded image, so this is cheap.
+    if (decode_async_ && job.meta[i].encoding == "jpg") {
+      job.owned_data[i].assign(job.mapped_data[i], job.mapped_data[i] + job.meta[i].size);
+    }
   }
 
-  lbuf_.resize(szl);
-  fbuf_.pubseekpos(offl);
-  fbuf_.sgetn(&lbuf_[0], std::streamsize(szl));
+  Dispatch(job);
+}
 
-  const int offr = msg->img_right.offset;
-  const int szr = msg->img_right.size;
 
-  if (offr < 0 || szr <= 0) {
-    LOG(WARNING) << "Got a data buffer for the right image with negative offset or zero size" << std::endl;
-    return;
-  }
+void ImageSubscriber::Handle(const lcm::ReceiveBuffer*,
+                             const std::string&,
+                             const vehicle::stereo_image_t* msg)
+{
+  const bool ok = IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width, false)
+               && IsSupported(msg->img_right.encoding, msg->img_right.format, msg->img_right.height, msg->img_right.width, false);
+  if (!ok) { return; }
 
-  rbuf_.resize(szr);
-  fbuf_.pubseekpos(offr);
-  fbuf_.sgetn(&rbuf_[0], std::streamsize(szr));
+  DecodeJob job;
+  job.timestamp = msg->header.timestamp;
+  job.seq = msg->header.seq;
+  job.received = core::SteadyNowNs();
+
+  const vehicle::image_t* images[2] = { &msg->img_left, &msg->img_right };
+  for (int i = 0; i < 2; ++i) {
+    const vehicle::image_t& im = *images[i];
+    job.meta[i].width = im.width;
+    job.meta[i].height = im.height;
+    job.meta[i].channels = im.channels;
+    job.meta[i].format = im.format;
+    job.meta[i].encoding = im.encoding;
+    job.meta[i].offset = 0;
+    job.meta[i].size = std::min(im.size, static_cast<int>(im.data.size()));
+
+    // The LCM message is freed after this handler returns.
+    if (decode_async_) {
+      job.owned_data[i].assign(im.data.begin(), im.data.begin() + job.meta[i].size);
+    } else {
+      job.mapped_data[i] = im.data.data();
+    }
+  }
 
-  // https://stackoverflow.com/questions/4254615/how-to-cast-vectorunsigned-char-to-char
-  bm::DecodeJPG(msg->img_left, reinterpret_cast<uint8_t*>(lbuf_.data()), left_);
-  bm::DecodeJPG(msg->img_right, reinterpret_cast<uint8_t*>(rbuf_.data()), right_);
+  Dispatch(job);
+}
 
-  core::StereoImage1b out(
-      msg->header.timestamp,
-      msg->header.seq,
-      core::MaybeConvertToGray(std::move(left_)),
-      core::MaybeConvertToGray(std::move(right_)));
 
-  for (const StereoImage1bCallback& f : callbacks_1b_) {
-    f(out);
+void ImageSubscriber::Dispatch(DecodeJob& job)
+{
+  if (decode_async_) {
+    decode_queue_.Push(std::move(job));
+  } else {
+    Decode(job);
   }
 }
 
 
-void ImageSubscriber::Handle(const lcm::ReceiveBuffer*,
-                             const std::string&,
-                             const vehicle::stereo_image_t* msg)
+void ImageSubscriber::DecodeLoop()
 {
-  const bool ok = IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width)
-               && IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width);
-  if (!ok) { return; }
+  DecodeJob job;
+  while (!is_shutdown_.load()) {
+    if (decode_queue_.PopBlocking(job, kDecodeWaitSec)) {
+      Decode(job);
+    }
+  }
+}
+
 
-  bm::DecodeJPG(msg->img_left, left_);
-  bm::DecodeJPG(msg->img_right, right_);
+void ImageSubscriber::Decode(const DecodeJob& job)
+{
+  core::ImagePool& decode_pool = rectifier_ ? raw_pool_ : image_pool_;
+  const cv::Size sizes[2] = {
+    DecodedSize(job.meta[0].width, job.meta[0].height, decode_scale_),
+    DecodedSize(job.meta[1].width, job.meta[1].height, decode_scale_)
+  };
+  Image1b images[2] = {
+    decode_pool.Acquire(sizes[0].height, sizes[0].width),
+    decode_pool.Acquire(sizes[1].height, sizes[1].width)
+  };
+  bool ok[2] = { false, false };
+
+  // The right image is decoded (and rectified) by a scheduler worker while the left is decoded by
+  // the caller.
+  core::TaskScheduler::Instance().ParallelFor(core::TaskPriority::FRONTEND, 2, [&](int i) {
+    ok[i] = bm::DecodeToGray(job.meta[i], job.Data(i), images[i], decode_scale_);
+    if (ok[i] && rectifier_) {
+      const cv::Size& size = rectifier_->RectifiedSize();
+      Image1b rectified = image_pool_.Acquire(size.height, size.width);
+      rectifier_->Rectify(i, images[i], rectified);
+      images[i] = rectified;
+    }
+  }, 1);
+
+  if (!ok[0] || !ok[1]) {
+    LOG(WARNING) << "Failed to decode image or it was overwritten while reading, dropping (seq="
+                 << job.seq << ")" << std::endl;
+    return;
+  }
 
-  core::StereoImage1b out(
-      msg->header.timestamp,
-      msg->header.seq,
-      core::MaybeConvertToGray(std::move(left_)),
-      core::MaybeConvertToGray(std::move(right_)));
+  core::StereoImage1b out(job.timestamp, job.seq, std::move(images[0]), std::move(images[1]));
+  out.latency.received = job.received;
+  out.latency.decoded = core::SteadyNowNs();
 
   for (const StereoImage1bCallback& f : callbacks_1b_) {
     f(out);
@@ -114,9 +223,10 @@ void ImageSubscriber::Handle(const lcm::ReceiveBuffer*,
 
 bool ImageSubscriber::IsSupported(const std::string& encoding,
                                   const std::string& format,
-                                  int height, int width)
+                                  int height, int width,
+                                  bool allow_raw)
 {
-  if (encoding != "jpg") {
+  if (encoding != "jpg" && !(allow_raw && encoding == "raw")) {
     LOG(WARNING)
         << "Unsupported encoding:\n  " << encoding
         << "\nchannel:\n  " << channel_ << std::endl;
@@ -139,4 +249,15 @@ bool ImageSubscriber::IsSupported(const std::string& encoding,
   return true;
 }
 
+
+const uint8_t* ImageSubscriber::MappedData(int offset, int size) const
+{
+  if (offset < 0 || size <= 0 ||
+      (static_cast<size_t>(offset) + static_cast<size_t>(size)) > mapped_region_.get_size()) {
+    return nullptr;
+  }
+
+  return reinterpret_cast<const uint8_t*>(mapped_region_.get_address()) + offset;
+}
+
 }
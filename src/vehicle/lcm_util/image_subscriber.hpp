@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
 #include <vector>
-#include <fstream>
 #include <iostream>
 
 #include <opencv2/core/mat.hpp>
@@ -11,8 +14,12 @@
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 
+#include "core/pipeline_latency.hpp"
 #include "core/timestamp.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "vision_core/image_pool.hpp"
 #include "vision_core/stereo_image.hpp"
+#include "vision_core/stereo_rectifier.hpp"
 
 #include "vehicle/stereo_image_t.hpp"
 #include "vehicle/mmf_stereo_image_t.hpp"
@@ -30,14 +37,56 @@ class ImageSubscriber final {
  public:
   // Create an image subscriber that listens on "channel". If expect_shm is true, this subscriber
   // will expect to receive a memory-mapped image (mmf_stereo_image_t).
+  //
+  // If decode_async is true, images are decoded and passed to callbacks on a separate thread, so
+  // that the LCM thread can get back to handling other messages (e.g IMU) right away. If images
+  // arrive faster than they can be decoded, the oldest pending image is dropped.
   // NOTE(milo): An LCM handle must be passed in! Messages are only received if lcm.Spin() is
   // constantly called, which should happen in whatever process owns this ImageSubscriber.
-  ImageSubscriber(lcm::LCM& lcm, const std::string& channel, bool expect_shm = true);
+  ImageSubscriber(lcm::LCM& lcm,
+                  const std::string& channel,
+                  bool expect_shm = true,
+                  bool decode_async = false);
+
+  ~ImageSubscriber();
 
   // Register a callback function that will be called for each decoded image.
+  // NOTE(milo): With decode_async, callbacks are called from the decode thread, so register them
+  // all before LCM starts handling messages. The images are decoded into buffers from an ImagePool,
+  // which are reused once every callback (and whoever they passed the image to) lets go of them.
   void RegisterCallback(StereoImage1bCallback f) { callbacks_1b_.emplace_back(f); }
 
+  // Rectify raw images right after they're decoded (by the same worker, while they're still in
+  // cache), so that callbacks get rectified pairs. Set this before LCM starts handling messages.
+  void SetRectifier(const std::shared_ptr<const core::StereoRectifier>& rectifier);
+
+  // Decode images at 1/scale of their size (1, 2, 4 or 8), for consumers that would downsize them
+  // anyway. JPGs are scaled while they're decoded (see DecodeToGray), so this is much cheaper than a
+  // full size decode and a resize. Callbacks get the smaller images, so intrinsics have to be scaled
+  // to match (e.g PinholeCamera::Rescale, or by the image height like the ObjectMesher does). Not
+  // supported with a rectifier, which needs the full size raw image. Set this before LCM starts
+  // handling messages.
+  void SetDecodeScale(int scale);
+  int DecodeScale() const { return decode_scale_; }
+
  private:
+  // A stereo pair waiting to be decoded. Image data either points into the memory-mapped file, or
+  // is owned by the job (when it has to outlive the LCM message).
+  struct DecodeJob final
+  {
+    timestamp_t timestamp = 0;
+    uint32_t seq = 0;
+    core::steady_ns_t received = 0;   // When the LCM message was handled.
+    vehicle::mmf_image_t meta[2];
+    const uint8_t* mapped_data[2] = { nullptr, nullptr };
+    std::vector<uint8_t> owned_data[2];
+
+    const uint8_t* Data(int i) const
+    {
+      return owned_data[i].empty() ? mapped_data[i] : owned_data[i].data();
+    }
+  };
+
   void HandleMmf(const lcm::ReceiveBuffer*,
                 const std::string&,
                 const vehicle::mmf_stereo_image_t* msg);
@@ -46,24 +95,43 @@ class ImageSubscriber final {
               const std::string&,
               const vehicle::stereo_image_t* msg);
 
-  // Validates the image metadata to make sure it can be decoded.
+  // Either decodes the job now, or hands it off to the decode thread.
+  void Dispatch(DecodeJob& job);
+
+  // Decodes the left and right images in parallel and calls the callbacks.
+  void Decode(const DecodeJob& job);
+
+  void DecodeLoop();
+
+  // Validates the image metadata to make sure it can be decoded. The "raw" encoding is only valid
+  // for memory-mapped images.
   bool IsSupported(const std::string& encoding,
                    const std::string& format,
                    int height,
-                   int width);
+                   int width,
+                   bool allow_raw);
+
+  // Pointer to a block of the memory-mapped file, or nullptr if it's out of bounds.
+  const uint8_t* MappedData(int offset, int size) const;
 
  private:
   std::string channel_;
-
-  cv::Mat left_;
-  cv::Mat right_;
+  bool decode_async_;
 
   ipc::file_mapping mapped_file_;
   ipc::mapped_region mapped_region_;
 
-  // https://stackoverflow.com/questions/604431/c-reading-unsigned-char-from-file-stream
-  std::basic_filebuf<char> fbuf_;
-  std::vector<char> lbuf_, rbuf_;
+  core::ImagePool image_pool_;
+
+  // Only used with a rectifier. Raw images are released right after they're rectified.
+  std::shared_ptr<const core::StereoRectifier> rectifier_;
+  core::ImagePool raw_pool_;
+
+  int decode_scale_ = 1;
+
+  std::atomic_bool is_shutdown_{false};
+  core::ThreadsafeQueue<DecodeJob> decode_queue_;
+  std::thread decode_thread_;
 
   std::vector<StereoImage1bCallback> callbacks_1b_;
 };
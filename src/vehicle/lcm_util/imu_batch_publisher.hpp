@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include <glog/logging.h>
+
+#include "core/imu_measurement.hpp"
+#include "lcm_util/util_imu_measurement_t.hpp"
+
+#include "vehicle/imu_measurement_batch_t.hpp"
+
+namespace bm {
+
+
+// Collects IMU measurements and publishes them as imu_measurement_batch_t, once there are
+// max_samples of them, or the newest one is max_latency_sec (in measurement time) after the
+// oldest. So at a steady rate, no measurement waits more than about max_latency_sec to go out.
+//
+// NOTE(milo): The latency bound is only checked when a measurement is pushed. If the IMU stops,
+// call Flush() to send whatever is left. Not threadsafe, so push from one thread.
+class ImuBatchPublisher final {
+ public:
+  ImuBatchPublisher(lcm::LCM& lcm,
+                    const std::string& channel,
+                    const std::string& frame_id,
+                    int max_samples,
+                    double max_latency_sec)
+      : lcm_(lcm),
+        channel_(channel),
+        max_samples_(max_samples),
+        max_latency_ns_(ConvertToNanoseconds(max_latency_sec))
+  {
+    CHECK_GE(max_samples, 1);
+    CHECK(max_latency_sec >= 0 && max_latency_sec < 2.0) << "Batches have to span less than 2 sec" << std::endl;
+    msg_.header.frame_id = frame_id;
+    pending_.reserve(max_samples);
+  }
+
+  void Push(const ImuMeasurement& imu)
+  {
+    // Offsets from the first measurement can't be negative, so an out of order one starts a new batch.
+    if (!pending_.empty() && imu.timestamp < pending_.front().timestamp) {
+      Flush();
+    }
+
+    pending_.emplace_back(imu);
+    if ((int)pending_.size() >= max_samples_ ||
+        (imu.timestamp - pending_.front().timestamp) >= max_latency_ns_) {
+      Flush();
+    }
+  }
+
+  // Publishes the pending measurements now (if there are any).
+  void Flush()
+  {
+    if (pending_.empty()) {
+      return;
+    }
+    pack_imu_measurement_batch_t(pending_.data(), pending_.size(), msg_);
+    msg_.header.seq = seq_++;
+    lcm_.publish(channel_, &msg_);
+    pending_.clear();
+  }
+
+  // Number of batches published so far.
+  int64_t NumPublished() const { return seq_; }
+
+ private:
+  lcm::LCM& lcm_;
+  std::string channel_;
+  int max_samples_;
+  timestamp_t max_latency_ns_;
+
+  ImuMeasurementVec pending_;
+  vehicle::imu_measurement_batch_t msg_;    // Reused, so that its arrays aren't reallocated.
+  int64_t seq_ = 0;
+};
+
+
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+// Flow control for the keyframe link (see KeyframeSender).
+struct KeyframeLinkParams final : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(KeyframeLinkParams);
+
+  int max_in_flight = 4;            // Unacked keyframes per worker.
+  double retransmit_sec = 1.0;      // Resend a keyframe if it hasn't been acked in this long.
+  int max_retries = 3;              // Then give up on it, and stop sending to that worker until it acks again.
+  double worker_timeout_sec = 5.0;  // Workers that haven't acked or sent a heartbeat in this long get nothing.
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    parser.GetParam("max_in_flight", &max_in_flight);
+    parser.GetParam("retransmit_sec", &retransmit_sec);
+    parser.GetParam("max_retries", &max_retries);
+    parser.GetParam("worker_timeout_sec", &worker_timeout_sec);
+    CHECK_GT(max_in_flight, 0);
+    CHECK_GT(retransmit_sec, 0);
+    CHECK_GE(max_retries, 0);
+  }
+};
+
+
+// Hands out keyframes to a pool of workers (e.g dense mapping on other computers) over a transport
+// that can lose messages, like LCM (UDP). Each keyframe gets a seq, and is kept until the worker
+// that it was sent to acks it, or it has been resent max_retries times.
+//
+// Workers say how many more keyframes they can queue (credits) in every ack, and in heartbeats (acks
+// with a negative seq) while they're idle. A keyframe is only sent to a worker if its unacked
+// keyframes would still fit in both its credits and max_in_flight. If no worker has room, the
+// keyframe is dropped right away, so the sender never waits on (or buffers up for) a slow worker.
+// Workers are added the first time that they're heard from, so the pool can grow and shrink while
+// running.
+//
+// Keyframes with the same affinity key (e.g the spatial cell that the camera is in) go to the same
+// worker while it has room, so that each worker maps its own part of the world. Otherwise, the worker
+// with the most room gets it (and owns the key if nobody alive did).
+//
+// NOTE(milo): Time is passed in (seconds on any monotonic clock), so that this doesn't depend on the
+// transport or a clock. All methods are threadsafe.
+template <typename Item>
+class KeyframeSender final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(KeyframeSender)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(KeyframeSender)
+
+  typedef std::shared_ptr<const Item> ItemPtr;
+
+  // A keyframe to send (or resend) to a worker.
+  struct Outgoing final
+  {
+    std::string worker;
+    int32_t seq = 0;
+    ItemPtr item;
+  };
+
+  explicit KeyframeSender(const KeyframeLinkParams& params) : params_(params) {}
+
+  // A worker acked seq (or sent a heartbeat if seq < 0), and can queue credits more keyframes.
+  void HandleAck(const std::string& worker, int32_t seq, int credits, double now_sec)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Worker& w = workers_[worker];
+    w.credits = credits;
+    w.last_heard_sec = now_sec;
+
+    const auto it = pending_.find(seq);
+    if (seq >= 0 && it != pending_.end() && it->second.worker == worker) {
+      pending_.erase(it);
+      --w.in_flight;
+      ++num_acked_;
+    }
+  }
+
+  // Assigns a keyframe to a worker (see above). Returns false if no worker has room, in which case
+  // the keyframe is dropped.
+  bool Send(size_t affinity, const ItemPtr& item, double now_sec, Outgoing& out)
+  {
+    CHECK(item);
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const auto owner = owners_.find(affinity);
+    const bool has_owner = owner != owners_.end() && IsAlive(workers_.at(owner->second), now_sec);
+
+    std::string name;
+    if (has_owner && HasRoom(workers_.at(owner->second), now_sec)) {
+      name = owner->second;
+    } else {
+      int best_room = 0;
+      for (const auto& w : workers_) {
+        const int room = Room(w.second, now_sec);
+        if (room > best_room) {
+          best_room = room;
+          name = w.first;
+        }
+      }
+      if (name.empty()) {
+        ++num_dropped_;
+        return false;
+      }
+      if (!has_owner) {
+        owners_[affinity] = name;
+      }
+    }
+
+    ++workers_.at(name).in_flight;
+
+    const int32_t seq = next_seq_++;
+    pending_.emplace(seq, Pending{ name, item, now_sec, 0 });
+    ++num_sent_;
+
+    out.worker = name;
+    out.seq = seq;
+    out.item = item;
+    return true;
+  }
+
+  // Keyframes that are due to be resent. The ones that have been resent max_retries times are given
+  // up on instead, and their worker gets no more keyframes until it's heard from again.
+  void Retransmits(double now_sec, std::vector<Outgoing>& out)
+  {
+    out.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      Pending& p = it->second;
+      if ((now_sec - p.sent_sec) < params_.retransmit_sec) {
+        ++it;
+        continue;
+      }
+
+      Worker& w = workers_.at(p.worker);
+      if (p.retries >= params_.max_retries) {
+        LOG(WARNING) << "Worker " << p.worker << " never acked keyframe " << it->first << ", giving up on it" << std::endl;
+        w.credits = 0;
+        --w.in_flight;
+        ++num_lost_;
+        it = pending_.erase(it);
+        continue;
+      }
+
+      ++p.retries;
+      p.sent_sec = now_sec;
+      ++num_retransmits_;
+
+      Outgoing o;
+      o.worker = p.worker;
+      o.seq = it->first;
+      o.item = p.item;
+      out.emplace_back(std::move(o));
+      ++it;
+    }
+  }
+
+  // Workers that have been heard from within worker_timeout_sec.
+  size_t NumAliveWorkers(double now_sec) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t n = 0;
+    for (const auto& w : workers_) {
+      n += IsAlive(w.second, now_sec) ? 1 : 0;
+    }
+    return n;
+  }
+
+  size_t NumPending() const { std::lock_guard<std::mutex> lock(mutex_); return pending_.size(); }
+  size_t NumSent() const { std::lock_guard<std::mutex> lock(mutex_); return num_sent_; }
+  size_t NumAcked() const { std::lock_guard<std::mutex> lock(mutex_); return num_acked_; }
+  size_t NumDropped() const { std::lock_guard<std::mutex> lock(mutex_); return num_dropped_; }
+  size_t NumLost() const { std::lock_guard<std::mutex> lock(mutex_); return num_lost_; }
+  size_t NumRetransmits() const { std::lock_guard<std::mutex> lock(mutex_); return num_retransmits_; }
+
+ private:
+  struct Worker final
+  {
+    int credits = 0;              // Free slots in its queue, as of the last ack.
+    int in_flight = 0;            // Sent but not acked (so not queued yet), which will use up credits.
+    double last_heard_sec = 0;
+  };
+
+  struct Pending final
+  {
+    std::string worker;
+    ItemPtr item;
+    double sent_sec;
+    int retries;
+  };
+
+  bool IsAlive(const Worker& w, double now_sec) const
+  {
+    return (now_sec - w.last_heard_sec) <= params_.worker_timeout_sec;
+  }
+
+  int Room(const Worker& w, double now_sec) const
+  {
+    if (!IsAlive(w, now_sec)) {
+      return 0;
+    }
+    return std::max(0, std::min(w.credits, params_.max_in_flight) - w.in_flight);
+  }
+
+  bool HasRoom(const Worker& w, double now_sec) const { return Room(w, now_sec) > 0; }
+
+ private:
+  KeyframeLinkParams params_;
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Worker> workers_;   // Ordered, so ties always go to the same worker.
+  std::map<int32_t, Pending> pending_;
+  std::unordered_map<size_t, std::string> owners_;
+  int32_t next_seq_ = 0;
+
+  size_t num_sent_ = 0;
+  size_t num_acked_ = 0;
+  size_t num_dropped_ = 0;
+  size_t num_lost_ = 0;
+  size_t num_retransmits_ = 0;
+};
+
+
+// The worker's side of a KeyframeSender link. A keyframe can arrive more than once (if its ack was
+// lost, or was late), so the seqs that were recently accepted are remembered.
+class KeyframeReceiver final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(KeyframeReceiver)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(KeyframeReceiver)
+
+  // Remembers the last history_size seqs (should cover a few max_in_flight windows).
+  explicit KeyframeReceiver(size_t history_size) : history_size_(history_size) { CHECK_GT(history_size, 0ul); }
+
+  // Returns true the first time a seq is seen. Duplicates should still be acked, since the sender
+  // resends until an ack gets through. A keyframe that can't be queued shouldn't be passed in (or
+  // acked), so that its resend is accepted.
+  bool Accept(int32_t seq)
+  {
+    if (seen_.count(seq) > 0) {
+      ++num_duplicates_;
+      return false;
+    }
+
+    seen_.emplace(seq);
+    order_.emplace_back(seq);
+    if (order_.size() > history_size_) {
+      seen_.erase(order_.front());
+      order_.pop_front();
+    }
+    return true;
+  }
+
+  // Has seq been accepted (recently)?
+  bool Seen(int32_t seq) const { return seen_.count(seq) > 0; }
+
+  size_t NumDuplicates() const { return num_duplicates_; }
+
+ private:
+  size_t history_size_;
+  std::unordered_set<int32_t> seen_;
+  std::deque<int32_t> order_;
+  size_t num_duplicates_ = 0;
+};
+
+
+}
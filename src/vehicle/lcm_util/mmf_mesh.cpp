@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "lcm_util/mmf_mesh.hpp"
+
+namespace bm {
+
+
+size_t MmfMeshBytes(int num_vertices, int num_triangles, bool float_vertices)
+{
+  return kMeshSlotHeaderBytes +
+         3 * (float_vertices ? sizeof(float) : sizeof(double)) * static_cast<size_t>(num_vertices) +
+         3 * sizeof(int32_t) * static_cast<size_t>(num_triangles);
+}
+
+
+MmfMeshWriter::MmfMeshWriter(const std::string& mm_filename, int num_slots, size_t slot_bytes, bool float_vertices)
+    : mm_filename_(mm_filename),
+      num_slots_(num_slots),
+      slot_bytes_(8 * ((slot_bytes + 7) / 8)),    // Keeps every generation counter 8-byte aligned.
+      float_vertices_(float_vertices)
+{
+  CHECK_GT(num_slots_, 0) << "Need at least one slot" << std::endl;
+  CHECK_GT(slot_bytes_, kMeshSlotHeaderBytes) << "Slots are too small to hold a mesh" << std::endl;
+
+  const size_t file_bytes = slot_bytes_ * static_cast<size_t>(num_slots_);
+  CHECK_LE(file_bytes, static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+      << "Slot offsets have to fit in an int32_t" << std::endl;
+
+  // Size the file (zeros, so every generation counter starts at 0) before mapping it.
+  {
+    std::filebuf fbuf;
+    CHECK(fbuf.open(mm_filename_, std::ios_base::in | std::ios_base::out |
+                                  std::ios_base::trunc | std::ios_base::binary))
+        << "Failed to create memory-mapped file: " << mm_filename_ << std::endl;
+    fbuf.pubseekoff(file_bytes - 1, std::ios_base::beg);
+    fbuf.sputc(0);
+  }
+
+  mapped_file_ = ipc::file_mapping(mm_filename_.c_str(), ipc::read_write);
+  mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_write);
+
+  LOG(INFO) << "Opened mesh MMF " << mm_filename_ << " with " << num_slots_ << " slots of "
+            << slot_bytes_ << " bytes" << std::endl;
+}
+
+
+bool MmfMeshWriter::Write(const std::vector<core::Vector3d>& vertices,
+                          const std::vector<core::Vector3i>& triangles,
+                          vehicle::mmf_mesh_stamped_t& msg)
+{
+  const size_t bytes = MmfMeshBytes((int)vertices.size(), (int)triangles.size(), float_vertices_);
+  if (bytes > slot_bytes_) {
+    return false;
+  }
+
+  const int slot = next_slot_;
+  next_slot_ = (next_slot_ + 1) % num_slots_;
+
+  const size_t offset = slot_bytes_ * static_cast<size_t>(slot);
+  uint8_t* slot_data = reinterpret_cast<uint8_t*>(mapped_region_.get_address()) + offset;
+
+  std::atomic<uint64_t>* generation = reinterpret_cast<std::atomic<uint64_t>*>(slot_data);
+  const uint64_t gen = generation->load(std::memory_order_relaxed);
+
+  // Odd while writing, even again once the mesh is complete.
+  generation->store(gen + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  uint8_t* buf = slot_data + kMeshSlotHeaderBytes;
+  if (float_vertices_) {
+    float* v = reinterpret_cast<float*>(buf);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      v[3*i + 0] = static_cast<float>(vertices[i].x());
+      v[3*i + 1] = static_cast<float>(vertices[i].y());
+      v[3*i + 2] = static_cast<float>(vertices[i].z());
+    }
+    buf += 3 * sizeof(float) * vertices.size();
+  } else {
+    double* v = reinterpret_cast<double*>(buf);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      v[3*i + 0] = vertices[i].x();
+      v[3*i + 1] = vertices[i].y();
+      v[3*i + 2] = vertices[i].z();
+    }
+    buf += 3 * sizeof(double) * vertices.size();
+  }
+
+  int32_t* t = reinterpret_cast<int32_t*>(buf);
+  for (size_t i = 0; i < triangles.size(); ++i) {
+    t[3*i + 0] = triangles[i].x();
+    t[3*i + 1] = triangles[i].y();
+    t[3*i + 2] = triangles[i].z();
+  }
+
+  generation->store(gen + 2, std::memory_order_release);
+
+  msg.mm_filename = mm_filename_;
+  msg.slot = slot;
+  msg.offset = static_cast<int32_t>(offset);
+  msg.size = static_cast<int32_t>(bytes);
+  msg.generation = static_cast<int64_t>(gen + 2);
+  msg.num_vertices = static_cast<int32_t>(vertices.size());
+  msg.num_triangles = static_cast<int32_t>(triangles.size());
+  msg.float_vertices = float_vertices_;
+
+  return true;
+}
+
+
+// Copies 3 * num_vertices vertex coordinates and then 3 * num_triangles indices out of a slot, in
+// whichever precision the slot and the output have. Returns false if the slot was overwritten since
+// msg was published, or while they were being copied.
+template <typename Scalar>
+static bool CopyMmfMesh(const vehicle::mmf_mesh_stamped_t& msg,
+                        const uint8_t* slot_data,
+                        Scalar* vertices,
+                        int32_t* triangles)
+{
+  CHECK_GE(static_cast<size_t>(msg.size), MmfMeshBytes(msg.num_vertices, msg.num_triangles, msg.float_vertices))
+      << "Mesh slot is too small for its vertices and triangles" << std::endl;
+
+  // NOTE(milo): If the generation changed at all, the writer has reused this slot for a newer mesh.
+  const std::atomic<uint64_t>* generation = reinterpret_cast<const std::atomic<uint64_t>*>(slot_data);
+  if (generation->load(std::memory_order_acquire) != static_cast<uint64_t>(msg.generation)) {
+    return false;
+  }
+
+  const size_t num_coords = 3 * static_cast<size_t>(msg.num_vertices);
+  const uint8_t* buf = slot_data + kMeshSlotHeaderBytes;
+  if (msg.float_vertices) {
+    const float* v = reinterpret_cast<const float*>(buf);
+    std::copy(v, v + num_coords, vertices);
+    buf += sizeof(float) * num_coords;
+  } else {
+    const double* v = reinterpret_cast<const double*>(buf);
+    std::copy(v, v + num_coords, vertices);
+    buf += sizeof(double) * num_coords;
+  }
+
+  const int32_t* t = reinterpret_cast<const int32_t*>(buf);
+  std::copy(t, t + 3 * static_cast<size_t>(msg.num_triangles), triangles);
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return generation->load(std::memory_order_relaxed) == static_cast<uint64_t>(msg.generation);
+}
+
+
+// NOTE(milo): A std::vector<Vector3d> (or Vector3i) is packed columns of 3 scalars, so it can be
+// copied into like a flat array.
+bool ReadMmfMesh(const vehicle::mmf_mesh_stamped_t& msg,
+                 const uint8_t* slot_data,
+                 std::vector<core::Vector3d>& vertices,
+                 std::vector<core::Vector3i>& triangles)
+{
+  vertices.resize(msg.num_vertices);
+  triangles.resize(msg.num_triangles);
+  return CopyMmfMesh(msg, slot_data, reinterpret_cast<double*>(vertices.data()),
+                     reinterpret_cast<int32_t*>(triangles.data()));
+}
+
+
+bool ReadMmfMesh(const vehicle::mmf_mesh_stamped_t& msg,
+                 const uint8_t* slot_data,
+                 std::vector<float>& vertices,
+                 std::vector<int32_t>& triangles)
+{
+  vertices.resize(3 * msg.num_vertices);
+  triangles.resize(3 * msg.num_triangles);
+  return CopyMmfMesh(msg, slot_data, vertices.data(), triangles.data());
+}
+
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+
+#include "vehicle/mmf_mesh_stamped_t.hpp"
+
+namespace bm {
+
+namespace ipc = boost::interprocess;
+
+
+// Each slot starts with a uint64_t generation counter. Like raw images, it's a seqlock: the writer
+// makes it odd while writing, and even again once the mesh is complete.
+static const size_t kMeshSlotHeaderBytes = 8;
+
+// Number of slot bytes needed for a mesh (including the generation counter).
+size_t MmfMeshBytes(int num_vertices, int num_triangles, bool float_vertices = false);
+
+
+// Publishes meshes through a ring of fixed-size slots in a memory-mapped file, so that the LCM
+// message only carries metadata. A subscriber has until the ring wraps around (num_slots more
+// meshes) to read a slot before it's overwritten. With float_vertices, vertices are written as
+// float32, which halves their size (and the time to copy them in and out).
+class MmfMeshWriter final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(MmfMeshWriter)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(MmfMeshWriter)
+
+  // Creates (or truncates) mm_filename with room for num_slots slots of at least slot_bytes each.
+  MmfMeshWriter(const std::string& mm_filename, int num_slots, size_t slot_bytes, bool float_vertices = false);
+
+  // Writes a mesh into the next slot, and fills in everything in msg except the header. Returns
+  // false (and writes nothing) if the mesh doesn't fit in a slot.
+  bool Write(const std::vector<core::Vector3d>& vertices,
+             const std::vector<core::Vector3i>& triangles,
+             vehicle::mmf_mesh_stamped_t& msg);
+
+  size_t SlotBytes() const { return slot_bytes_; }
+
+ private:
+  std::string mm_filename_;
+  int num_slots_;
+  size_t slot_bytes_;
+  bool float_vertices_;
+  int next_slot_ = 0;
+
+  ipc::file_mapping mapped_file_;
+  ipc::mapped_region mapped_region_;
+};
+
+
+// Copies a mesh out of its slot (slot_data points to the start of the slot). Returns false if the
+// slot was overwritten since msg was published, or while we were reading it.
+bool ReadMmfMesh(const vehicle::mmf_mesh_stamped_t& msg,
+                 const uint8_t* slot_data,
+                 std::vector<core::Vector3d>& vertices,
+                 std::vector<core::Vector3i>& triangles);
+
+// Same as above, but into interleaved float32 vertices and flat indices (see mesher::TriangleMeshf),
+// which is a plain copy if the mesh was written with float_vertices.
+bool ReadMmfMesh(const vehicle::mmf_mesh_stamped_t& msg,
+                 const uint8_t* slot_data,
+                 std::vector<float>& vertices,
+                 std::vector<int32_t>& triangles);
+
+
+}
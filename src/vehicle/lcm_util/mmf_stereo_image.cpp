@@ -0,0 +1,124 @@
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include "lcm_util/decode_image.hpp"
+#include "lcm_util/mmf_stereo_image.hpp"
+
+namespace bm {
+
+
+// Writes N bytes after the block's generation counter, the same way as WriteRawImage().
+static void WriteBlockBytes(const uint8_t* bytes, size_t N, uint8_t* buf_data)
+{
+  std::atomic<uint64_t>* generation = reinterpret_cast<std::atomic<uint64_t>*>(buf_data);
+  const uint64_t gen = generation->load(std::memory_order_relaxed);
+
+  generation->store(gen + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(buf_data + kRawImageHeaderBytes, bytes, N);
+  generation->store(gen + 2, std::memory_order_release);
+}
+
+
+MmfStereoImageWriter::MmfStereoImageWriter(const std::string& mm_filename,
+                                           int height,
+                                           int width,
+                                           int channels,
+                                           int num_slots,
+                                           const std::string& encoding,
+                                           int jpeg_quality)
+    : mm_filename_(mm_filename),
+      height_(height),
+      width_(width),
+      channels_(channels),
+      num_slots_(num_slots),
+      encoding_(encoding),
+      jpeg_quality_(jpeg_quality)
+{
+  CHECK(height_ > 0 && width_ > 0) << "Zero image dimension" << std::endl;
+  CHECK(channels_ == 1 || channels_ == 3) << "Only mono8 and bgr8 images are supported" << std::endl;
+  CHECK_GE(num_slots_, 1);
+  CHECK(encoding_ == "raw" || encoding_ == "jpg") << "Only raw and jpg encodings are supported" << std::endl;
+
+  // Keeps every generation counter 8-byte aligned. A JPG is almost always smaller than the pixels,
+  // but noisy images at a high quality can come out a bit bigger.
+  const size_t pixel_bytes = static_cast<size_t>(height_) * width_ * channels_;
+  const size_t payload_bytes = (encoding_ == "raw") ? pixel_bytes : (pixel_bytes + pixel_bytes / 2 + 4096);
+  block_bytes_ = 8 * ((kRawImageHeaderBytes + payload_bytes + 7) / 8);
+
+  const size_t file_bytes = 2 * num_slots_ * block_bytes_;
+  CHECK_LE(file_bytes, static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+      << "Image offsets have to fit in an int32_t" << std::endl;
+
+  // Size the file (zeros, so all generation counters start at 0) before mapping it.
+  {
+    std::filebuf fbuf;
+    CHECK(fbuf.open(mm_filename_, std::ios_base::in | std::ios_base::out |
+                                  std::ios_base::trunc | std::ios_base::binary))
+        << "Failed to create memory-mapped file: " << mm_filename_ << std::endl;
+    fbuf.pubseekoff(file_bytes - 1, std::ios_base::beg);
+    fbuf.sputc(0);
+  }
+
+  mapped_file_ = ipc::file_mapping(mm_filename_.c_str(), ipc::read_write);
+  mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_write);
+
+  LOG(INFO) << "Opened stereo image MMF " << mm_filename_ << " for " << width_ << "x" << height_
+            << "x" << channels_ << " images (" << num_slots_ << " slots, " << encoding_ << ")" << std::endl;
+}
+
+
+bool MmfStereoImageWriter::Write(const cv::Mat& left,
+                                 const cv::Mat& right,
+                                 vehicle::mmf_stereo_image_t& msg)
+{
+  const size_t slot_offset = 2 * next_slot_ * block_bytes_;
+  next_slot_ = (next_slot_ + 1) % num_slots_;
+
+  return WriteImage(left, slot_offset, msg.img_left) &&
+         WriteImage(right, slot_offset + block_bytes_, msg.img_right);
+}
+
+
+bool MmfStereoImageWriter::WriteImage(const cv::Mat& im, size_t block_offset, vehicle::mmf_image_t& meta)
+{
+  CHECK(im.rows == height_ && im.cols == width_ && im.channels() == channels_)
+      << "Image doesn't match the size of the memory-mapped file" << std::endl;
+
+  uint8_t* block = reinterpret_cast<uint8_t*>(mapped_region_.get_address()) + block_offset;
+
+  meta.width = width_;
+  meta.height = height_;
+  meta.channels = channels_;
+  meta.format = (channels_ == 1) ? "mono8" : "bgr8";
+  meta.encoding = encoding_;
+  meta.mm_filename = mm_filename_;
+
+  if (encoding_ == "raw") {
+    WriteRawImage(im, block);
+    meta.offset = static_cast<int32_t>(block_offset);
+    meta.size = static_cast<int32_t>(block_bytes_);
+    return true;
+  }
+
+  const std::vector<int> flags = { cv::IMWRITE_JPEG_QUALITY, jpeg_quality_ };
+  cv::imencode(".jpg", im, jpg_buf_, flags);
+  if ((kRawImageHeaderBytes + jpg_buf_.size()) > block_bytes_) {
+    LOG(WARNING) << "JPG is too big for its block (" << jpg_buf_.size() << " bytes), dropping pair" << std::endl;
+    return false;
+  }
+
+  WriteBlockBytes(jpg_buf_.data(), jpg_buf_.size(), block);
+  meta.offset = static_cast<int32_t>(block_offset + kRawImageHeaderBytes);
+  meta.size = static_cast<int32_t>(jpg_buf_.size());
+  return true;
+}
+
+
+}
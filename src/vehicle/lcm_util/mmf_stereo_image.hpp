@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "core/macros.hpp"
+
+#include "vehicle/mmf_stereo_image_t.hpp"
+
+namespace bm {
+
+namespace ipc = boost::interprocess;
+
+
+// Publishes stereo pairs in a memory-mapped file, so that the LCM message only carries metadata.
+// The file is a ring of num_slots slots, each with one block for the left image and one for the
+// right, and each pair goes in the next slot. Every block starts with a generation counter (see
+// kRawImageHeaderBytes), which is odd while the block is being written.
+//
+// With the "raw" encoding, a subscriber that is still reading a block when it gets overwritten sees
+// the counter change, and drops the pair (see DecodeToGray). With "jpg", the compressed bytes follow
+// the counter, and subscribers copy them out as soon as the message arrives (see ImageSubscriber).
+// The ring gives them num_slots - 1 more pairs of time before that block is reused.
+class MmfStereoImageWriter final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(MmfStereoImageWriter)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(MmfStereoImageWriter)
+
+  // Creates (or truncates) mm_filename with room for num_slots pairs of 8-bit images with 1 (mono8)
+  // or 3 (bgr8) channels. Every pair written has to have this size.
+  MmfStereoImageWriter(const std::string& mm_filename,
+                       int height,
+                       int width,
+                       int channels,
+                       int num_slots = 1,
+                       const std::string& encoding = "raw",
+                       int jpeg_quality = 90);
+
+  // Writes the left and right images into the next slot, and fills in everything in msg except the
+  // header. The images can have any step (e.g a ROI or a page-locked buffer). Returns false if a JPG
+  // didn't fit in its block, in which case msg shouldn't be published.
+  bool Write(const cv::Mat& left, const cv::Mat& right, vehicle::mmf_stereo_image_t& msg);
+
+  int NumSlots() const { return num_slots_; }
+
+ private:
+  // Writes one image into its block, and the block's metadata.
+  bool WriteImage(const cv::Mat& im, size_t block_offset, vehicle::mmf_image_t& meta);
+
+ private:
+  std::string mm_filename_;
+  int height_;
+  int width_;
+  int channels_;
+  int num_slots_;
+  std::string encoding_;
+  int jpeg_quality_;
+  size_t block_bytes_;    // Generation counter + pixels (or JPG bytes), a multiple of 8 bytes.
+  int next_slot_ = 0;
+
+  std::vector<uint8_t> jpg_buf_;    // Reused for encoding.
+
+  ipc::file_mapping mapped_file_;
+  ipc::mapped_region mapped_region_;
+};
+
+
+}
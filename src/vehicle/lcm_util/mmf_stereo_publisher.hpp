@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "lcm_util/mmf_stereo_image.hpp"
+
+#include "vehicle/mmf_stereo_image_t.hpp"
+
+namespace bm {
+
+
+// Publishes stereo pairs for ImageSubscriber (with expect_shm), through a ring of slots in one
+// memory-mapped file (see MmfStereoImageWriter). The file and its mapping stay the same for the
+// life of the publisher, so subscribers only open it once. Use this instead of writing the file
+// from a camera driver directly, so that every producer follows the same protocol.
+//
+// NOTE(milo): Not threadsafe, so publish from one thread.
+class MmfStereoPublisher final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(MmfStereoPublisher)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(MmfStereoPublisher)
+
+  // See MmfStereoImageWriter for the image size, slots and encoding ("raw" or "jpg").
+  MmfStereoPublisher(lcm::LCM& lcm,
+                     const std::string& channel,
+                     const std::string& frame_id,
+                     const std::string& mm_filename,
+                     int height,
+                     int width,
+                     int channels,
+                     int num_slots = 2,
+                     const std::string& encoding = "raw",
+                     int jpeg_quality = 90)
+      : lcm_(lcm),
+        channel_(channel),
+        writer_(mm_filename, height, width, channels, num_slots, encoding, jpeg_quality)
+  {
+    msg_.header.frame_id = frame_id;
+  }
+
+  // Writes the pair into the next slot and publishes its metadata. Returns false if it couldn't be
+  // written (see MmfStereoImageWriter::Write), in which case nothing was published.
+  bool Publish(core::timestamp_t timestamp, const cv::Mat& left, const cv::Mat& right)
+  {
+    if (!writer_.Write(left, right, msg_)) {
+      return false;
+    }
+    msg_.header.timestamp = static_cast<int64_t>(timestamp);
+    msg_.header.seq = seq_++;
+    lcm_.publish(channel_, &msg_);
+    return true;
+  }
+
+  // Number of pairs published so far.
+  int64_t NumPublished() const { return seq_; }
+
+ private:
+  lcm::LCM& lcm_;
+  std::string channel_;
+  MmfStereoImageWriter writer_;
+  vehicle::mmf_stereo_image_t msg_;
+  int64_t seq_ = 0;
+};
+
+
+}
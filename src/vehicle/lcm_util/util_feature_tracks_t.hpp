@@ -0,0 +1,45 @@
+#pragma once
+
+#include "vision_core/landmark_observation.hpp"
+#include "vehicle/feature_tracks_t.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+inline void pack_feature_tracks_t(const LandmarkObservationBatch& lmk_obs,
+                                  int width,
+                                  int height,
+                                  vehicle::feature_tracks_t& msg)
+{
+  const size_t N = lmk_obs.Size();
+  msg.width = width;
+  msg.height = height;
+  msg.num_tracks = (int32_t)N;
+
+  msg.lmk_ids.resize(N);
+  msg.u.resize(N);
+  msg.v.resize(N);
+  msg.disparity.resize(N);
+
+  for (size_t i = 0; i < N; ++i) {
+    msg.lmk_ids[i] = (int32_t)lmk_obs.landmark_id[i];
+    msg.u[i] = lmk_obs.pixel_location[i].x;
+    msg.v[i] = lmk_obs.pixel_location[i].y;
+    msg.disparity[i] = lmk_obs.disparity[i];
+  }
+}
+
+
+inline void decode_feature_tracks_t(const vehicle::feature_tracks_t& msg, LandmarkObservationBatch& out)
+{
+  out.Clear();
+  out.Reserve(msg.num_tracks);
+  for (int32_t i = 0; i < msg.num_tracks; ++i) {
+    out.Add((uint32_t)msg.lmk_ids[i], cv::Point2f(msg.u[i], msg.v[i]), msg.disparity[i]);
+  }
+}
+
+
+}
@@ -1,14 +1,23 @@
 #pragma once
 
+#include <limits>
+#include <vector>
+
+#include <glog/logging.h>
+
 #include "core/imu_measurement.hpp"
 #include "lcm_util/util_vector3_t.hpp"
 #include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/imu_measurement_batch_t.hpp"
 
 namespace bm {
 
 using namespace core;
 
 
+typedef std::vector<ImuMeasurement, Eigen::aligned_allocator<ImuMeasurement>> ImuMeasurementVec;
+
+
 inline void decode_imu_measurement_t(const vehicle::imu_measurement_t& msg, ImuMeasurement& out)
 {
   out.timestamp = msg.header.timestamp;
@@ -17,4 +26,48 @@ inline void decode_imu_measurement_t(const vehicle::imu_measurement_t& msg, ImuM
 }
 
 
+// Packs N measurements (in time order) into one batch. They have to span less than ~2 sec, since
+// the offsets from the first one are 32-bit nanoseconds. The header seq and frame_id are left alone.
+inline void pack_imu_measurement_batch_t(const ImuMeasurement* imu, size_t N, vehicle::imu_measurement_batch_t& msg)
+{
+  CHECK_GT(N, 0ul);
+  const timestamp_t t0 = imu[0].timestamp;
+  msg.header.timestamp = static_cast<int64_t>(t0);
+  msg.num_samples = static_cast<int32_t>(N);
+  msg.num_coords = 3 * msg.num_samples;
+  msg.dt_ns.resize(N);
+  msg.linear_acc.resize(msg.num_coords);
+  msg.angular_vel.resize(msg.num_coords);
+
+  // NOTE(milo): The flat arrays are written through maps, so there's no vector3_t per sample.
+  Eigen::Map<Eigen::Matrix3Xd> linear_acc(msg.linear_acc.data(), 3, N);
+  Eigen::Map<Eigen::Matrix3Xd> angular_vel(msg.angular_vel.data(), 3, N);
+
+  for (size_t i = 0; i < N; ++i) {
+    const int64_t dt_ns = static_cast<int64_t>(imu[i].timestamp) - static_cast<int64_t>(t0);
+    CHECK(dt_ns >= 0 && dt_ns <= std::numeric_limits<int32_t>::max()) << "IMU batch spans too long" << std::endl;
+    msg.dt_ns[i] = static_cast<int32_t>(dt_ns);
+    linear_acc.col(i) = imu[i].a;
+    angular_vel.col(i) = imu[i].w;
+  }
+}
+
+
+// Decodes a batch into "out" (which is resized, so it can be reused between messages).
+inline void decode_imu_measurement_batch_t(const vehicle::imu_measurement_batch_t& msg, ImuMeasurementVec& out)
+{
+  CHECK_EQ(3 * msg.num_samples, msg.num_coords);
+  const Eigen::Map<const Eigen::Matrix3Xd> linear_acc(msg.linear_acc.data(), 3, msg.num_samples);
+  const Eigen::Map<const Eigen::Matrix3Xd> angular_vel(msg.angular_vel.data(), 3, msg.num_samples);
+
+  out.resize(msg.num_samples);
+  for (int32_t i = 0; i < msg.num_samples; ++i) {
+    ImuMeasurement& imu = out[i];
+    imu.timestamp = static_cast<timestamp_t>(msg.header.timestamp + msg.dt_ns[i]);
+    imu.a = linear_acc.col(i);
+    imu.w = angular_vel.col(i);
+    imu.latency = LatencyTags();
+  }
+}
+
 }
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+#include "core/pipeline_latency.hpp"
+#include "vehicle/latency_stats_t.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+inline void pack_latency_stats_t(const std::vector<LatencyStageSummary>& summaries,
+                                 vehicle::latency_stats_t& msg)
+{
+  const std::vector<float>& edges = LatencyHistogram::BinUpperEdges();
+  msg.num_bins = (int32_t)edges.size();
+  msg.bin_upper_ms = edges;
+
+  msg.num_stages = (int32_t)summaries.size();
+
+  msg.name.clear();
+  msg.count.clear();
+  msg.p50_ms.clear();
+  msg.p95_ms.clear();
+  msg.p99_ms.clear();
+  msg.max_ms.clear();
+  msg.bin_count.clear();
+
+  for (const LatencyStageSummary& s : summaries) {
+    msg.name.emplace_back(s.name);
+    msg.count.emplace_back(s.count);
+    msg.p50_ms.emplace_back(s.p50_ms);
+    msg.p95_ms.emplace_back(s.p95_ms);
+    msg.p99_ms.emplace_back(s.p99_ms);
+    msg.max_ms.emplace_back(s.max_ms);
+    msg.bin_count.emplace_back(s.bin_counts.begin(), s.bin_counts.end());
+  }
+}
+
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "mesher/mesh_codec.hpp"
+#include "vehicle/mesh_delta_t.hpp"
+#include "vehicle/vector3_t.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+inline void pack_mesh_delta_t(const mesher::MeshDelta& delta, vehicle::mesh_delta_t& msg)
+{
+  msg.seq = delta.seq;
+  msg.base_seq = delta.base_seq;
+
+  msg.bbox_min.x = delta.bbox_min.x();
+  msg.bbox_min.y = delta.bbox_min.y();
+  msg.bbox_min.z = delta.bbox_min.z();
+  msg.bbox_max.x = delta.bbox_max.x();
+  msg.bbox_max.y = delta.bbox_max.y();
+  msg.bbox_max.z = delta.bbox_max.z();
+
+  msg.num_removed_vertices = delta.num_removed_vertices;
+  msg.num_upserted_vertices = delta.num_upserted_vertices;
+  msg.num_removed_triangles = delta.num_removed_triangles;
+  msg.num_added_triangles = delta.num_added_triangles;
+
+  msg.size = (int32_t)delta.data.size();
+  msg.data = delta.data;
+}
+
+
+inline void decode_mesh_delta_t(const vehicle::mesh_delta_t& msg, mesher::MeshDelta& delta)
+{
+  delta.seq = msg.seq;
+  delta.base_seq = msg.base_seq;
+  delta.bbox_min = Vector3d(msg.bbox_min.x, msg.bbox_min.y, msg.bbox_min.z);
+  delta.bbox_max = Vector3d(msg.bbox_max.x, msg.bbox_max.y, msg.bbox_max.z);
+
+  delta.num_removed_vertices = msg.num_removed_vertices;
+  delta.num_upserted_vertices = msg.num_upserted_vertices;
+  delta.num_removed_triangles = msg.num_removed_triangles;
+  delta.num_added_triangles = msg.num_added_triangles;
+
+  delta.data = msg.data;
+}
+
+
+}
@@ -1,39 +1,73 @@
 #pragma once
 
+#include <vector>
+
+#include <glog/logging.h>
+
 #include "core/eigen_types.hpp"
 
 #include "vehicle/mesh_t.hpp"
-#include "vehicle/vector3_t.hpp"
 
 namespace bm {
 
 using namespace core;
 
 
-void pack_mesh_t(const std::vector<Vector3d>& vertices,
-                 const std::vector<Vector3i>& triangles,
-                 vehicle::mesh_t& msg)
+// NOTE(milo): A std::vector<Vector3d> (or Vector3i) is N packed columns of 3 scalars, the same
+// layout as the flat arrays in a mesh_t. Packing and decoding are one map-to-map copy each, instead
+// of building a struct for every vertex and triangle.
+inline void pack_mesh_t(const std::vector<Vector3d>& vertices,
+                        const std::vector<Vector3i>& triangles,
+                        vehicle::mesh_t& msg)
 {
   msg.num_vertices = (int32_t)vertices.size();
+  msg.num_vertex_coords = 3 * msg.num_vertices;
   msg.num_triangles = (int32_t)triangles.size();
+  msg.num_triangle_indices = 3 * msg.num_triangles;
 
-  msg.vertices.clear();
-  msg.triangles.clear();
+  msg.vertices.resize(msg.num_vertex_coords);
+  msg.triangles.resize(msg.num_triangle_indices);
 
-  for (size_t i = 0; i < vertices.size(); ++i) {
-    vehicle::vector3_t pt;
-    pt.x = vertices[i].x();
-    pt.y = vertices[i].y();
-    pt.z = vertices[i].z();
-    msg.vertices.emplace_back(std::move(pt));
+  if (!vertices.empty()) {
+    Eigen::Map<Eigen::Matrix3Xd>(msg.vertices.data(), 3, vertices.size()) =
+        Eigen::Map<const Eigen::Matrix3Xd>(vertices.front().data(), 3, vertices.size());
   }
+  if (!triangles.empty()) {
+    Eigen::Map<Eigen::Matrix3Xi>(msg.triangles.data(), 3, triangles.size()) =
+        Eigen::Map<const Eigen::Matrix3Xi>(triangles.front().data(), 3, triangles.size());
+  }
+}
+
+
+// Views of the vertices and triangles of a mesh_t (one per column), without copying them. They're
+// valid as long as msg is, and isn't resized.
+inline Eigen::Map<const Eigen::Matrix3Xd> view_mesh_t_vertices(const vehicle::mesh_t& msg)
+{
+  CHECK_EQ(3 * msg.num_vertices, msg.num_vertex_coords);
+  return Eigen::Map<const Eigen::Matrix3Xd>(msg.vertices.data(), 3, msg.num_vertices);
+}
 
-  for (size_t i = 0; i < triangles.size(); ++i) {
-    vehicle::mesh_triangle_t tri;
-    tri.vertex_indices[0] = triangles[i].x();
-    tri.vertex_indices[1] = triangles[i].y();
-    tri.vertex_indices[2] = triangles[i].z();
-    msg.triangles.emplace_back(std::move(tri));
+
+inline Eigen::Map<const Eigen::Matrix3Xi> view_mesh_t_triangles(const vehicle::mesh_t& msg)
+{
+  CHECK_EQ(3 * msg.num_triangles, msg.num_triangle_indices);
+  return Eigen::Map<const Eigen::Matrix3Xi>(msg.triangles.data(), 3, msg.num_triangles);
+}
+
+
+// Decodes into "vertices" and "triangles" (which are resized, so they can be reused between messages).
+inline void decode_mesh_t(const vehicle::mesh_t& msg,
+                          std::vector<Vector3d>& vertices,
+                          std::vector<Vector3i>& triangles)
+{
+  vertices.resize(msg.num_vertices);
+  triangles.resize(msg.num_triangles);
+
+  if (!vertices.empty()) {
+    Eigen::Map<Eigen::Matrix3Xd>(vertices.front().data(), 3, vertices.size()) = view_mesh_t_vertices(msg);
+  }
+  if (!triangles.empty()) {
+    Eigen::Map<Eigen::Matrix3Xi>(triangles.front().data(), 3, triangles.size()) = view_mesh_t_triangles(msg);
   }
 }
 
@@ -2,6 +2,7 @@
 
 #include <gtsam/geometry/Pose3.h>
 
+#include "core/eigen_types.hpp"
 #include "vehicle/pose3_t.hpp"
 
 namespace bm {
@@ -42,4 +43,27 @@ inline void decode_pose3_t(const vehicle::pose3_t& msg, gtsam::Pose3& pose)
 }
 
 
+inline void pack_pose3_t(const core::Matrix4d& T, vehicle::pose3_t& msg)
+{
+  msg.position.x = T(0, 3);
+  msg.position.y = T(1, 3);
+  msg.position.z = T(2, 3);
+
+  const core::Quaterniond q(core::Matrix3d(T.block<3, 3>(0, 0)));
+  msg.orientation.w = q.w();
+  msg.orientation.x = q.x();
+  msg.orientation.y = q.y();
+  msg.orientation.z = q.z();
+}
+
+
+inline void decode_pose3_t(const vehicle::pose3_t& msg, core::Matrix4d& T)
+{
+  const core::Quaterniond q(msg.orientation.w, msg.orientation.x, msg.orientation.y, msg.orientation.z);
+  T = core::Matrix4d::Identity();
+  T.block<3, 3>(0, 0) = q.normalized().toRotationMatrix();
+  T.block<3, 1>(0, 3) = core::Vector3d(msg.position.x, msg.position.y, msg.position.z);
+}
+
+
 }
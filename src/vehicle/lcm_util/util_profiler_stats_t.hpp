@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "core/profiler.hpp"
+#include "vehicle/profiler_stats_t.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+inline void pack_profiler_stats_t(const std::vector<ProfileSummary>& summaries,
+                                  vehicle::profiler_stats_t& msg)
+{
+  msg.num_spans = (int32_t)summaries.size();
+
+  msg.name.clear();
+  msg.count.clear();
+  msg.p50_ms.clear();
+  msg.p95_ms.clear();
+  msg.p99_ms.clear();
+  msg.max_ms.clear();
+
+  for (const ProfileSummary& s : summaries) {
+    msg.name.emplace_back(s.name);
+    msg.count.emplace_back(s.count);
+    msg.p50_ms.emplace_back(s.p50_ms);
+    msg.p95_ms.emplace_back(s.p95_ms);
+    msg.p99_ms.emplace_back(s.p99_ms);
+    msg.max_ms.emplace_back(s.max_ms);
+  }
+}
+
+
+}
@@ -14,4 +14,12 @@ inline void decode_vector3_t(const vehicle::vector3_t& msg, Vector3d& out)
 }
 
 
+inline void pack_vector3_t(const Vector3d& v, vehicle::vector3_t& msg)
+{
+  msg.x = v.x();
+  msg.y = v.y();
+  msg.z = v.z();
+}
+
+
 }
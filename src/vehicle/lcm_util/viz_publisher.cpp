@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <chrono>
+
+#include <glog/logging.h>
+
+#include "lcm_util/util_pose3_t.hpp"
+#include "lcm_util/viz_publisher.hpp"
+
+namespace bm {
+
+
+void VizPublisher::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("publish_hz", &publish_hz);
+  parser.GetParam("max_keyposes", &max_keyposes);
+  parser.GetParam("max_landmarks", &max_landmarks);
+  parser.GetParam("max_landmarks_per_msg", &max_landmarks_per_msg);
+  parser.GetParam("landmark_move_tolerance", &landmark_move_tolerance);
+  parser.GetParam("full_resend_interval", &full_resend_interval);
+}
+
+
+VizPublisher::VizPublisher(lcm::LCM& lcm, const std::string& channel, const Params& params)
+    : lcm_(lcm),
+      channel_(channel),
+      params_(params)
+{
+  CHECK_GT(params_.publish_hz, 0);
+  CHECK_GE(params_.max_keyposes, 0);
+  CHECK_GE(params_.max_landmarks, 0);
+  CHECK_GT(params_.max_landmarks_per_msg, 0);
+  msg_.header.frame_id = "world";
+}
+
+
+VizPublisher::~VizPublisher()
+{
+  shutdown_lock_.lock();
+  is_shutdown_ = true;
+  shutdown_lock_.unlock();
+  shutdown_cv_.notify_all();
+
+  if (publish_thread_.joinable()) {
+    publish_thread_.join();
+  }
+}
+
+
+void VizPublisher::Start()
+{
+  CHECK(!publish_thread_.joinable()) << "VizPublisher was already started" << std::endl;
+  publish_thread_ = std::thread(&VizPublisher::PublishLoop, this);
+  LOG(INFO) << "Publishing visualization on " << channel_ << " at " << params_.publish_hz << " hz" << std::endl;
+}
+
+
+void VizPublisher::AddOrUpdateKeypose(uid_t keypose_id, const Matrix4d& world_T_body, const Matrix3d& world_cov_position)
+{
+  Keypose keypose;
+  pack_pose3_t(world_T_body, keypose.world_T_body);
+  keypose.cov_position[0] = static_cast<float>(world_cov_position(0, 0));
+  keypose.cov_position[1] = static_cast<float>(world_cov_position(0, 1));
+  keypose.cov_position[2] = static_cast<float>(world_cov_position(0, 2));
+  keypose.cov_position[3] = static_cast<float>(world_cov_position(1, 1));
+  keypose.cov_position[4] = static_cast<float>(world_cov_position(1, 2));
+  keypose.cov_position[5] = static_cast<float>(world_cov_position(2, 2));
+
+  std::lock_guard<std::mutex> lock(mailbox_lock_);
+  pending_keyposes_[keypose_id] = keypose;
+}
+
+
+void VizPublisher::UpdateBodyPose(timestamp_t timestamp, const Matrix4d& world_T_body)
+{
+  vehicle::pose3_t pose;
+  pack_pose3_t(world_T_body, pose);
+
+  std::lock_guard<std::mutex> lock(mailbox_lock_);
+  pending_has_body_pose_ = true;
+  pending_body_timestamp_ = timestamp;
+  pending_world_T_body_ = pose;
+}
+
+
+void VizPublisher::AddOrUpdateLandmarks(const std::vector<uid_t>& lmk_ids, const std::vector<Vector3d>& t_world_lmks)
+{
+  CHECK_EQ(lmk_ids.size(), t_world_lmks.size());
+
+  std::lock_guard<std::mutex> lock(mailbox_lock_);
+  for (size_t i = 0; i < lmk_ids.size(); ++i) {
+    pending_lmks_[lmk_ids[i]] = t_world_lmks[i].cast<float>();
+  }
+}
+
+
+bool VizPublisher::Pack(vehicle::viz_update_t& msg)
+{
+  std::map<uid_t, Keypose> new_keyposes;
+  std::unordered_map<uid_t, Vector3f> new_lmks;
+  bool new_body_pose = false;
+
+  // Swap the mailboxes out so that producers can keep going while we pack.
+  mailbox_lock_.lock();
+  std::swap(new_keyposes, pending_keyposes_);
+  std::swap(new_lmks, pending_lmks_);
+  std::swap(new_body_pose, pending_has_body_pose_);
+  if (new_body_pose) {
+    body_timestamp_ = pending_body_timestamp_;
+    world_T_body_ = pending_world_T_body_;
+  }
+  mailbox_lock_.unlock();
+
+  if (new_body_pose) {
+    has_body_pose_ = true;
+    body_pose_dirty_ = true;
+  }
+
+  for (const auto& item : new_keyposes) {
+    keyposes_[item.first] = item.second;
+  }
+  while (keyposes_.size() > static_cast<size_t>(params_.max_keyposes)) {
+    keyposes_.erase(keyposes_.begin());
+  }
+
+  for (const auto& item : new_lmks) {
+    const auto it = lmks_.find(item.first);
+    if (it == lmks_.end()) {
+      Landmark lmk;
+      lmk.t_world = item.second;
+      lmks_.emplace(item.first, lmk);
+    } else {
+      Landmark& lmk = it->second;
+      lmk.t_world = item.second;
+      lmk.dirty |= (lmk.t_world - lmk.t_world_sent).norm() > params_.landmark_move_tolerance;
+    }
+  }
+  while (lmks_.size() > static_cast<size_t>(params_.max_landmarks)) {
+    lmks_.erase(lmks_.begin());
+  }
+
+  // NOTE(milo): Landmarks that don't fit in a full resend just go out in the next few messages.
+  if (params_.full_resend_interval > 0 && seq_ > 0 && (seq_ % params_.full_resend_interval) == 0) {
+    body_pose_dirty_ = has_body_pose_;
+    for (auto& item : keyposes_) {
+      item.second.dirty = true;
+    }
+    for (auto& item : lmks_) {
+      item.second.dirty = true;
+    }
+  }
+
+  msg.has_body_pose = body_pose_dirty_;
+  if (body_pose_dirty_) {
+    msg.world_T_body = world_T_body_;
+    body_pose_dirty_ = false;
+  }
+
+  msg.keypose_ids.clear();
+  msg.world_T_keyposes.clear();
+  msg.cov_position.clear();
+  for (auto& item : keyposes_) {
+    Keypose& keypose = item.second;
+    if (!keypose.dirty) {
+      continue;
+    }
+    msg.keypose_ids.emplace_back(static_cast<int64_t>(item.first));
+    msg.world_T_keyposes.emplace_back(keypose.world_T_body);
+    msg.cov_position.emplace_back(keypose.cov_position, keypose.cov_position + 6);
+    keypose.dirty = false;
+  }
+  msg.num_keyposes = static_cast<int32_t>(msg.keypose_ids.size());
+
+  msg.lmk_ids.clear();
+  msg.t_world_lmks.clear();
+  for (auto it = lmks_.rbegin(); it != lmks_.rend(); ++it) {
+    if ((int)msg.lmk_ids.size() >= params_.max_landmarks_per_msg) {
+      break;
+    }
+    Landmark& lmk = it->second;
+    if (!lmk.dirty) {
+      continue;
+    }
+    msg.lmk_ids.emplace_back(static_cast<int32_t>(it->first));
+    msg.t_world_lmks.emplace_back(std::vector<float>{ lmk.t_world.x(), lmk.t_world.y(), lmk.t_world.z() });
+    lmk.t_world_sent = lmk.t_world;
+    lmk.dirty = false;
+  }
+  msg.num_landmarks = static_cast<int32_t>(msg.lmk_ids.size());
+
+  if (!msg.has_body_pose && msg.num_keyposes == 0 && msg.num_landmarks == 0) {
+    return false;
+  }
+
+  msg.header.timestamp = static_cast<int64_t>(body_timestamp_);
+  msg.header.seq = seq_++;
+  return true;
+}
+
+
+void VizPublisher::PublishLoop()
+{
+  const std::chrono::microseconds period(static_cast<int64_t>(1e6 / params_.publish_hz));
+  std::chrono::steady_clock::time_point next_publish = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(shutdown_lock_);
+  while (!is_shutdown_) {
+    lock.unlock();
+    if (Pack(msg_)) {
+      lcm_.publish(channel_, &msg_);
+    }
+    lock.lock();
+
+    next_publish += period;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (next_publish < now) {
+      next_publish = now;
+    }
+    shutdown_cv_.wait_until(lock, next_publish, [this]() { return is_shutdown_; });
+  }
+
+  LOG(INFO) << "VizPublisher::PublishLoop() exiting" << std::endl;
+}
+
+
+}
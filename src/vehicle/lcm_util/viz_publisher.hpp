@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+
+#include "vehicle/viz_update_t.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+// Streams what a Visualizer3D would draw (keyposes with their position covariance, the body pose,
+// landmarks) as viz_update_t, so that it can be drawn topside (see lcm_viz_viewer) instead of on
+// the vehicle. Callers only copy their data into "latest value" mailboxes. A thread packs them at
+// publish_hz, with only what changed since the last message, and resends everything every
+// full_resend_interval messages in case one was lost.
+class VizPublisher final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    float publish_hz = 2.0;
+    int max_keyposes = 100;                 // Only keep (and resend) the newest keyposes.
+    int max_landmarks = 20000;              // Only keep (and resend) the newest landmarks, by id.
+    int max_landmarks_per_msg = 2000;       // The rest wait for the next message (newest first).
+    double landmark_move_tolerance = 0.02;  // Only resend a landmark if it moves more than this (m).
+    int full_resend_interval = 20;          // Resend everything every this many messages (0 = never).
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(VizPublisher)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(VizPublisher)
+
+  VizPublisher(lcm::LCM& lcm, const std::string& channel, const Params& params);
+
+  // Stops the publishing thread (if it was started).
+  ~VizPublisher();
+
+  // Starts the thread that publishes at publish_hz.
+  void Start();
+
+  // Adds a keypose, or moves it if it already exists. Pass Matrix3d::Zero() if the covariance is
+  // unknown.
+  void AddOrUpdateKeypose(uid_t keypose_id, const Matrix4d& world_T_body, const Matrix3d& world_cov_position);
+
+  void UpdateBodyPose(timestamp_t timestamp, const Matrix4d& world_T_body);
+
+  void AddOrUpdateLandmarks(const std::vector<uid_t>& lmk_ids, const std::vector<Vector3d>& t_world_lmks);
+
+  // Takes everything out of the mailboxes and packs the next message. Returns false if there was
+  // nothing to send. Only call this from one thread (it's what the publishing thread does).
+  bool Pack(vehicle::viz_update_t& msg);
+
+  // Number of messages published (or packed) so far.
+  int64_t NumPublished() const { return seq_; }
+
+ private:
+  struct Keypose final
+  {
+    vehicle::pose3_t world_T_body;
+    float cov_position[6];
+    bool dirty = true;
+  };
+
+  struct Landmark final
+  {
+    Vector3f t_world_sent;
+    Vector3f t_world;
+    bool dirty = true;
+  };
+
+  void PublishLoop();
+
+ private:
+  lcm::LCM& lcm_;
+  std::string channel_;
+  Params params_;
+
+  std::mutex mailbox_lock_;
+  std::map<uid_t, Keypose> pending_keyposes_;
+  std::unordered_map<uid_t, Vector3f> pending_lmks_;
+  bool pending_has_body_pose_ = false;
+  timestamp_t pending_body_timestamp_ = 0;
+  vehicle::pose3_t pending_world_T_body_;
+
+  // Only touched by Pack(): what the viewer should have after the last message.
+  std::map<uid_t, Keypose> keyposes_;
+  std::map<uid_t, Landmark> lmks_;
+  bool has_body_pose_ = false;
+  bool body_pose_dirty_ = false;
+  timestamp_t body_timestamp_ = 0;
+  vehicle::pose3_t world_T_body_;
+  std::atomic<int64_t> seq_{0};
+
+  bool is_shutdown_ = false;
+  std::condition_variable shutdown_cv_;
+  std::mutex shutdown_lock_;
+  std::thread publish_thread_;
+  vehicle::viz_update_t msg_;   // Reused, so that its arrays aren't reallocated.
+};
+
+
+}
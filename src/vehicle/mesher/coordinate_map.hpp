@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+
+// Flat hash table keyed by integer (x, y) coordinates, e.g pixels or grid cells. Both coordinates
+// are packed into one 64-bit key, and the table uses open addressing with linear probing (like the
+// EdgeWeightTable), so a lookup is one hash and usually one cache line. Clear() keeps the slots, so
+// a map that's refilled every frame doesn't allocate once it has grown.
+template <typename Data>
+class CoordinateMap final {
+ public:
+  CoordinateMap() { slots_.resize(kMinCapacity); }
+
+  // Adds the data at (x, y), unless there's already data there (then it's left as is). Returns the
+  // data at (x, y).
+  Data& Insert(int x, int y, const Data& data)
+  {
+    // Keep the load factor below 1/2 so that probe sequences stay short.
+    if (2 * (size_ + 1) > slots_.size()) {
+      Grow();
+    }
+
+    const uint64_t key = Key(x, y);
+    const size_t mask = slots_.size() - 1;
+
+    size_t i = Index(key);
+    for (; slots_[i].used; i = (i + 1) & mask) {
+      if (slots_[i].key == key) {
+        return slots_[i].data;
+      }
+    }
+
+    Slot& slot = slots_[i];
+    slot.key = key;
+    slot.data = data;
+    slot.used = true;
+    ++size_;
+
+    return slot.data;
+  }
+
+  Data& Insert(const Vector2i& coord, const Data& data)
+  {
+    return Insert(coord.x(), coord.y(), data);
+  }
+
+  // Returns a pointer to the data at (x, y), or nullptr if there isn't any.
+  Data* Find(int x, int y)
+  {
+    const uint64_t key = Key(x, y);
+    const size_t mask = slots_.size() - 1;
+
+    for (size_t i = Index(key); slots_[i].used; i = (i + 1) & mask) {
+      if (slots_[i].key == key) {
+        return &slots_[i].data;
+      }
+    }
+
+    return nullptr;
+  }
+
+  const Data* Find(int x, int y) const
+  {
+    return const_cast<CoordinateMap*>(this)->Find(x, y);
+  }
+
+  // Throws std::out_of_range if there's no data at (x, y), like std::unordered_map::at().
+  Data& At(int x, int y)
+  {
+    Data* data = Find(x, y);
+    if (data == nullptr) {
+      throw std::out_of_range("CoordinateMap::At");
+    }
+    return *data;
+  }
+
+  const Data& At(int x, int y) const
+  {
+    return const_cast<CoordinateMap*>(this)->At(x, y);
+  }
+
+  Data& At(const Vector2i& coord) { return At(coord.x(), coord.y()); }
+  const Data& At(const Vector2i& coord) const { return At(coord.x(), coord.y()); }
+
+  bool Contains(int x, int y) const { return Find(x, y) != nullptr; }
+
+  size_t Size() const { return size_; }
+
+  // Removes all of the data, but keeps the capacity.
+  void Clear()
+  {
+    for (Slot& slot : slots_) {
+      slot.used = false;
+    }
+    size_ = 0;
+  }
+
+  // Makes room for n items without growing.
+  void Reserve(size_t n)
+  {
+    while (2 * n > slots_.size()) {
+      Grow();
+    }
+  }
+
+ private:
+  struct Slot final
+  {
+    uint64_t key = 0;
+    Data data = Data();
+    bool used = false;
+  };
+
+  static constexpr size_t kMinCapacity = 64;
+
+  static uint64_t Key(int x, int y)
+  {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+  }
+
+  size_t Index(uint64_t key) const
+  {
+    // https://xorshift.di.unimi.it/splitmix64.c
+    uint64_t h = key;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h = h ^ (h >> 31);
+    return static_cast<size_t>(h) & (slots_.size() - 1);
+  }
+
+  void Grow()
+  {
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.resize(std::max(kMinCapacity, 2 * old.size()));
+
+    const size_t mask = slots_.size() - 1;
+    for (const Slot& slot : old) {
+      if (!slot.used) {
+        continue;
+      }
+      size_t i = Index(slot.key);
+      while (slots_[i].used) {
+        i = (i + 1) & mask;
+      }
+      slots_[i] = slot;
+    }
+  }
+
+ private:
+  std::vector<Slot> slots_;   // Capacity is always a power of 2.
+  size_t size_ = 0;
+};
+
+template <typename Data>
+constexpr size_t CoordinateMap<Data>::kMinCapacity;
+
+typedef std::unordered_map<int, CoordinateMap<int>> MultiCoordinateMap;
+
+
+}
+}
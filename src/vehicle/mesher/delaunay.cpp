@@ -0,0 +1,388 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "mesher/delaunay.hpp"
+
+namespace bm {
+namespace mesher {
+
+
+// Points closer than this (px) are considered duplicates.
+static const double kMinPointDist = 1e-3;
+
+
+// Positive if a, b, c are CCW.
+static double Orient(const Vector2d& a, const Vector2d& b, const Vector2d& c)
+{
+  return (b.x() - a.x()) * (c.y() - a.y()) - (b.y() - a.y()) * (c.x() - a.x());
+}
+
+
+// Positive if d is inside of the circumcircle of the CCW triangle a, b, c.
+static double InCircle(const Vector2d& a, const Vector2d& b, const Vector2d& c, const Vector2d& d)
+{
+  const Vector2d ad = a - d;
+  const Vector2d bd = b - d;
+  const Vector2d cd = c - d;
+  return ad.squaredNorm() * (bd.x() * cd.y() - cd.x() * bd.y()) -
+         bd.squaredNorm() * (ad.x() * cd.y() - cd.x() * ad.y()) +
+         cd.squaredNorm() * (ad.x() * bd.y() - bd.x() * ad.y());
+}
+
+
+IncrementalDelaunay::IncrementalDelaunay(double width, double height)
+{
+  CHECK(width > 0 && height > 0);
+
+  // Super triangle that encloses the image rectangle with a lot of margin.
+  const double M = 3.0 * std::max(width, height);
+  const Vector2d c(0.5 * width, 0.5 * height);
+  NewVertex(0, c + Vector2d(-2.0*M, -M));
+  NewVertex(0, c + Vector2d(2.0*M, -M));
+  NewVertex(0, c + Vector2d(0, 2.0*M));
+  last_tri_ = NewTriangle(0, 1, 2);
+}
+
+
+bool IncrementalDelaunay::Insert(uid_t lmk_id, const Vector2d& p)
+{
+  CHECK(!Has(lmk_id)) << "Landmark " << lmk_id << " is already in the triangulation" << std::endl;
+
+  const int t0 = Locate(p);
+  for (int i = 0; i < 3; ++i) {
+    if ((vertices_.at(triangles_.at(t0).v[i]).p - p).norm() < kMinPointDist) {
+      return false;
+    }
+  }
+
+  // Find all triangles whose circumcircle contains p (the "cavity").
+  ++visit_stamp_;
+  cavity_.clear();
+  cavity_.emplace_back(t0);
+  triangles_.at(t0).visit = visit_stamp_;
+
+  for (size_t k = 0; k < cavity_.size(); ++k) {
+    const Triangle& tri = triangles_.at(cavity_.at(k));
+    for (int i = 0; i < 3; ++i) {
+      const int nb = tri.n[i];
+      if (nb < 0 || triangles_.at(nb).visit == visit_stamp_) {
+        continue;
+      }
+      if (InCircumcircle(nb, p)) {
+        triangles_.at(nb).visit = visit_stamp_;
+        cavity_.emplace_back(nb);
+      }
+    }
+  }
+
+  boundary_.clear();
+  for (const int t : cavity_) {
+    const Triangle& tri = triangles_.at(t);
+    for (int i = 0; i < 3; ++i) {
+      const int nb = tri.n[i];
+      if (nb >= 0 && triangles_.at(nb).visit == visit_stamp_) {
+        continue;
+      }
+      const BoundaryEdge edge = { tri.v[(i+1) % 3], tri.v[(i+2) % 3], nb };
+
+      // NOTE(milo): With roundoff, the cavity might not be star-shaped from p (nearly collinear or
+      // cocircular points). Don't insert rather than make inverted triangles.
+      if (Orient(vertices_.at(edge.a).p, vertices_.at(edge.b).p, p) <= 0) {
+        return false;
+      }
+      boundary_.emplace_back(edge);
+    }
+  }
+
+  for (const int t : cavity_) {
+    KillTriangle(t);
+  }
+
+  // Connect p to every edge on the boundary of the cavity.
+  const int v = NewVertex(lmk_id, p);
+  new_tris_.clear();
+  for (const BoundaryEdge& edge : boundary_) {
+    new_tris_.emplace_back(NewTriangle(v, edge.a, edge.b));
+  }
+  LinkTriangles(new_tris_, boundary_);
+
+  last_tri_ = new_tris_.front();
+  return true;
+}
+
+
+void IncrementalDelaunay::Remove(uid_t lmk_id)
+{
+  if (!Has(lmk_id)) {
+    return;
+  }
+
+  const int v = lmk_to_vtx_.at(lmk_id);
+
+  // Walk CCW around v to get the polygon of its neighbors.
+  cavity_.clear();
+  boundary_.clear();
+  ring_.clear();
+
+  const int t0 = vertices_.at(v).tri;
+  int t = t0;
+  do {
+    const Triangle& tri = triangles_.at(t);
+    CHECK(tri.alive);
+    const int i = tri.v[0] == v ? 0 : (tri.v[1] == v ? 1 : 2);
+    CHECK_EQ(v, tri.v[i]);
+
+    const BoundaryEdge edge = { tri.v[(i+1) % 3], tri.v[(i+2) % 3], tri.n[i] };
+    boundary_.emplace_back(edge);
+    ring_.emplace_back(edge.a);
+    cavity_.emplace_back(t);
+
+    // The next triangle CCW shares the edge (v, edge.b).
+    t = tri.n[(i+1) % 3];
+    CHECK(t >= 0 && cavity_.size() <= triangles_.size()) << "Vertex is not enclosed" << std::endl;
+  } while (t != t0);
+
+  for (const int dead : cavity_) {
+    KillTriangle(dead);
+  }
+  free_vertices_.emplace_back(v);
+  lmk_to_vtx_.erase(lmk_id);
+
+  // Re-triangulate the hole by clipping off "Delaunay ears": convex corners whose circumcircle
+  // doesn't contain any other vertex of the hole.
+  new_tris_.clear();
+  while (ring_.size() > 3) {
+    const size_t K = ring_.size();
+    size_t ear = K;
+    size_t convex = K;
+
+    for (size_t j = 0; j < K && ear == K; ++j) {
+      const Vector2d& a = vertices_.at(ring_.at((j + K - 1) % K)).p;
+      const Vector2d& b = vertices_.at(ring_.at(j)).p;
+      const Vector2d& c = vertices_.at(ring_.at((j + 1) % K)).p;
+      if (Orient(a, b, c) <= 0) {
+        continue;
+      }
+      convex = std::min(convex, j);
+
+      bool empty = true;
+      for (size_t m = 0; m < K && empty; ++m) {
+        if (m == j || m == (j + K - 1) % K || m == (j + 1) % K) {
+          continue;
+        }
+        empty = InCircle(a, b, c, vertices_.at(ring_.at(m)).p) <= 0;
+      }
+      if (empty) {
+        ear = j;
+      }
+    }
+
+    // NOTE(milo): Only happens with roundoff, in which case any convex corner is close enough.
+    if (ear == K) {
+      ear = (convex < K) ? convex : 0;
+    }
+
+    new_tris_.emplace_back(NewTriangle(ring_.at((ear + K - 1) % K), ring_.at(ear), ring_.at((ear + 1) % K)));
+    ring_.erase(ring_.begin() + ear);
+  }
+  new_tris_.emplace_back(NewTriangle(ring_.at(0), ring_.at(1), ring_.at(2)));
+  LinkTriangles(new_tris_, boundary_);
+
+  last_tri_ = new_tris_.front();
+}
+
+
+bool IncrementalDelaunay::Move(uid_t lmk_id, const Vector2d& p)
+{
+  Remove(lmk_id);
+  return Insert(lmk_id, p);
+}
+
+
+const Vector2d& IncrementalDelaunay::Point(uid_t lmk_id) const
+{
+  return vertices_.at(lmk_to_vtx_.at(lmk_id)).p;
+}
+
+
+std::vector<uid_t> IncrementalDelaunay::LandmarkIds() const
+{
+  std::vector<uid_t> out;
+  out.reserve(lmk_to_vtx_.size());
+  for (const auto& item : lmk_to_vtx_) {
+    out.emplace_back(item.first);
+  }
+  return out;
+}
+
+
+void IncrementalDelaunay::GetTriangles(std::vector<LmkTriangle>& triangles) const
+{
+  triangles.clear();
+  for (const Triangle& tri : triangles_) {
+    if (!tri.alive || IsSuperVertex(tri.v[0]) || IsSuperVertex(tri.v[1]) || IsSuperVertex(tri.v[2])) {
+      continue;
+    }
+    triangles.emplace_back(LmkTriangle{{ vertices_.at(tri.v[0]).lmk_id,
+                                         vertices_.at(tri.v[1]).lmk_id,
+                                         vertices_.at(tri.v[2]).lmk_id }});
+  }
+}
+
+
+int IncrementalDelaunay::Locate(const Vector2d& p) const
+{
+  int t = (last_tri_ < (int)triangles_.size() && triangles_.at(last_tri_).alive) ? last_tri_ : -1;
+
+  // Walk towards p, crossing any edge that p is on the other side of.
+  for (size_t iter = 0; t >= 0 && iter < triangles_.size(); ++iter) {
+    const Triangle& tri = triangles_.at(t);
+    int next = t;
+    for (int i = 0; i < 3; ++i) {
+      if (Orient(vertices_.at(tri.v[(i+1) % 3]).p, vertices_.at(tri.v[(i+2) % 3]).p, p) < 0) {
+        next = tri.n[i];
+        break;
+      }
+    }
+    if (next == t) {
+      return t;
+    }
+    t = next;
+  }
+
+  // NOTE(milo): The walk can cycle if the triangulation isn't exactly Delaunay. Just search.
+  for (int k = 0; k < (int)triangles_.size(); ++k) {
+    const Triangle& tri = triangles_.at(k);
+    if (tri.alive &&
+        Orient(vertices_.at(tri.v[0]).p, vertices_.at(tri.v[1]).p, p) >= 0 &&
+        Orient(vertices_.at(tri.v[1]).p, vertices_.at(tri.v[2]).p, p) >= 0 &&
+        Orient(vertices_.at(tri.v[2]).p, vertices_.at(tri.v[0]).p, p) >= 0) {
+      return k;
+    }
+  }
+
+  LOG(FATAL) << "Point is outside of the triangulation: " << p.transpose() << std::endl;
+  return -1;
+}
+
+
+bool IncrementalDelaunay::InCircumcircle(int t, const Vector2d& p) const
+{
+  const Triangle& tri = triangles_.at(t);
+  return InCircle(vertices_.at(tri.v[0]).p, vertices_.at(tri.v[1]).p, vertices_.at(tri.v[2]).p, p) > 0;
+}
+
+
+int IncrementalDelaunay::NewVertex(uid_t lmk_id, const Vector2d& p)
+{
+  int v;
+  if (free_vertices_.empty()) {
+    v = (int)vertices_.size();
+    vertices_.emplace_back();
+  } else {
+    v = free_vertices_.back();
+    free_vertices_.pop_back();
+  }
+
+  Vertex& vtx = vertices_.at(v);
+  vtx.p = p;
+  vtx.lmk_id = lmk_id;
+  vtx.tri = -1;
+
+  // The three super triangle vertices aren't landmarks.
+  if (!IsSuperVertex(v)) {
+    lmk_to_vtx_[lmk_id] = v;
+  }
+
+  return v;
+}
+
+
+int IncrementalDelaunay::NewTriangle(int v0, int v1, int v2)
+{
+  int t;
+  if (free_triangles_.empty()) {
+    t = (int)triangles_.size();
+    triangles_.emplace_back();
+  } else {
+    t = free_triangles_.back();
+    free_triangles_.pop_back();
+  }
+
+  Triangle& tri = triangles_.at(t);
+  tri.v[0] = v0;
+  tri.v[1] = v1;
+  tri.v[2] = v2;
+  tri.n[0] = tri.n[1] = tri.n[2] = -1;
+  tri.alive = true;
+
+  vertices_.at(v0).tri = t;
+  vertices_.at(v1).tri = t;
+  vertices_.at(v2).tri = t;
+
+  return t;
+}
+
+
+void IncrementalDelaunay::KillTriangle(int t)
+{
+  triangles_.at(t).alive = false;
+  free_triangles_.emplace_back(t);
+}
+
+
+// Returns i such that the directed edge (a, b) is opposite of vertex i in the triangle, or -1.
+static int DirectedEdgeIndex(const int v[3], int a, int b)
+{
+  for (int i = 0; i < 3; ++i) {
+    if (v[(i+1) % 3] == a && v[(i+2) % 3] == b) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+void IncrementalDelaunay::LinkTriangles(const std::vector<int>& new_tris,
+                                        const std::vector<BoundaryEdge>& boundary)
+{
+  // NOTE(milo): Holes only have a handful of edges, so brute force matching is fastest.
+  for (const int t : new_tris) {
+    for (int i = 0; i < 3; ++i) {
+      const int a = triangles_.at(t).v[(i+1) % 3];
+      const int b = triangles_.at(t).v[(i+2) % 3];
+      int nb = -1;
+
+      bool on_boundary = false;
+      for (const BoundaryEdge& edge : boundary) {
+        if (edge.a == a && edge.b == b) {
+          on_boundary = true;
+          nb = edge.outer;
+          if (nb >= 0) {
+            Triangle& outer = triangles_.at(nb);
+            const int j = DirectedEdgeIndex(outer.v, b, a);
+            CHECK_GE(j, 0);
+            outer.n[j] = t;
+          }
+          break;
+        }
+      }
+
+      if (!on_boundary) {
+        for (const int t2 : new_tris) {
+          if (t2 != t && DirectedEdgeIndex(triangles_.at(t2).v, b, a) >= 0) {
+            nb = t2;
+            break;
+          }
+        }
+      }
+
+      triangles_.at(t).n[i] = nb;
+    }
+  }
+}
+
+
+}
+}
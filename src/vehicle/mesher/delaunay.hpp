@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+typedef std::array<uid_t, 3> LmkTriangle;
+
+
+// A 2D Delaunay triangulation of landmark points that can be updated in place. Points are inserted
+// with Bowyer-Watson (only the triangles whose circumcircle contains the new point are replaced),
+// and removed by re-triangulating the hole left around the point. The cost of an update only
+// depends on the local neighborhood of the point, not on the size of the triangulation.
+//
+// NOTE(milo): Like cv::Subdiv2D, an outer "super triangle" encloses the image rectangle, and any
+// triangles that touch it are not output. Points must be inside of the image rectangle.
+class IncrementalDelaunay final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(IncrementalDelaunay);
+  IncrementalDelaunay() = delete;
+
+  IncrementalDelaunay(double width, double height);
+
+  // Add a landmark at point p. Returns false (and does not add it) if another landmark is already
+  // at the same location, since duplicate points can't be triangulated.
+  bool Insert(uid_t lmk_id, const Vector2d& p);
+
+  // Remove a landmark, if it exists.
+  void Remove(uid_t lmk_id);
+
+  // Move a landmark to a new location (same as Remove() followed by Insert()).
+  bool Move(uid_t lmk_id, const Vector2d& p);
+
+  bool Has(uid_t lmk_id) const { return lmk_to_vtx_.count(lmk_id) != 0; }
+
+  // Location of a landmark in the triangulation.
+  const Vector2d& Point(uid_t lmk_id) const;
+
+  // Number of landmarks in the triangulation.
+  size_t Size() const { return lmk_to_vtx_.size(); }
+
+  // Returns the ids of all landmarks in the triangulation.
+  std::vector<uid_t> LandmarkIds() const;
+
+  // Returns all triangles (CCW in image coordinates) that don't touch the super triangle.
+  void GetTriangles(std::vector<LmkTriangle>& triangles) const;
+
+ private:
+  struct Vertex final
+  {
+    Vector2d p;
+    uid_t lmk_id = 0;
+    int tri = -1;   // One of the triangles that uses this vertex.
+  };
+
+  // Vertices are CCW. The neighbor n[i] is across the edge opposite of vertex v[i].
+  struct Triangle final
+  {
+    int v[3] = { -1, -1, -1 };
+    int n[3] = { -1, -1, -1 };
+    bool alive = false;
+    int visit = 0;  // Set to visit_stamp_ when added to the current cavity.
+  };
+
+  // A directed edge (a, b) on the boundary of a hole in the triangulation, as seen from inside of
+  // the hole. The triangle on the other side is "outer".
+  struct BoundaryEdge final
+  {
+    int a, b, outer;
+  };
+
+  bool IsSuperVertex(int v) const { return v < 3; }
+
+  // Returns a triangle that contains (or has on its boundary) the point p.
+  int Locate(const Vector2d& p) const;
+
+  bool InCircumcircle(int t, const Vector2d& p) const;
+
+  int NewVertex(uid_t lmk_id, const Vector2d& p);
+  int NewTriangle(int v0, int v1, int v2);
+  void KillTriangle(int t);
+
+  // Set the neighbors of newly created triangles that fill a hole with the given boundary.
+  void LinkTriangles(const std::vector<int>& new_tris, const std::vector<BoundaryEdge>& boundary);
+
+ private:
+  std::vector<Vertex> vertices_;
+  std::vector<Triangle> triangles_;
+  std::vector<int> free_vertices_;
+  std::vector<int> free_triangles_;
+  std::unordered_map<uid_t, int> lmk_to_vtx_;
+
+  int last_tri_ = 0;  // Hint for where to start looking for a point (updates are usually local).
+  int visit_stamp_ = 0;
+
+  // Scratch buffers, kept to avoid allocating on every update.
+  std::vector<int> cavity_;
+  std::vector<int> new_tris_;
+  std::vector<int> ring_;
+  std::vector<BoundaryEdge> boundary_;
+};
+
+
+}
+}
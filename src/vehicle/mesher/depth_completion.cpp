@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "core/profiler.hpp"
+#include "imaging/fast_guided_filter.hpp"
+#include "mesher/depth_completion.hpp"
+
+namespace bm {
+namespace mesher {
+
+
+void CompleteDisparity(const Image1b& iml,
+                       const Image1b& foreground_mask,
+                       const std::vector<cv::Point2f>& lmk_points,
+                       const std::vector<double>& lmk_disps,
+                       int downsize,
+                       int radius,
+                       double eps,
+                       int min_landmarks,
+                       Image1f& disp)
+{
+  MACRO_PROFILE_SCOPE("CompleteDisparity");
+  CHECK_EQ(lmk_points.size(), lmk_disps.size());
+  CHECK(downsize >= 1 && downsize <= 8) << "Use a downsize argument (int) between 1 and 8" << std::endl;
+  CHECK_GE(radius, 1);
+  CHECK(foreground_mask.empty() || foreground_mask.size() == iml.size());
+
+  const cv::Size size = iml.size() / downsize;
+  const float inv_downsize = 1.0f / static_cast<float>(downsize);
+
+  // Splat each landmark into the pixel that it falls in (averaging if a few land in the same one).
+  Image1f sparse(size, 0.0f);
+  Image1f weight(size, 0.0f);
+  for (size_t i = 0; i < lmk_points.size(); ++i) {
+    const int u = static_cast<int>(lmk_points[i].x * inv_downsize);
+    const int v = static_cast<int>(lmk_points[i].y * inv_downsize);
+    if (u < 0 || v < 0 || u >= size.width || v >= size.height || lmk_disps[i] <= 0) {
+      continue;
+    }
+    sparse(v, u) += static_cast<float>(lmk_disps[i]) * inv_downsize;
+    weight(v, u) += 1.0f;
+  }
+
+  Image1f guide;
+  cv::resize(iml, guide, size, 0, 0, cv::INTER_AREA);
+  guide.convertTo(guide, CV_32FC1, 1.0 / 255.0);
+
+  // NOTE(milo): One filter for both maps, so the guide statistics are only computed once.
+  const imaging::FastGuidedFilter filter(guide, radius, eps, 1);
+  const Image1f sparse_filtered = filter.filter(sparse, CV_32F);
+  const Image1f weight_filtered = filter.filter(weight, CV_32F);
+
+  // Number of landmarks in the box around each pixel, to tell where there's enough support.
+  Image1f support;
+  cv::boxFilter(weight, support, CV_32F, cv::Size(2*radius + 1, 2*radius + 1), cv::Point(-1, -1), false);
+
+  Image1b mask_small;
+  if (!foreground_mask.empty()) {
+    cv::resize(foreground_mask, mask_small, size, 0, 0, cv::INTER_NEAREST);
+  }
+
+  // The filtered weight can get close to zero (or negative) far from any landmark, so only divide
+  // where there's support.
+  const float min_support = static_cast<float>(std::max(1, min_landmarks));
+  disp.create(size);
+  for (int v = 0; v < size.height; ++v) {
+    for (int u = 0; u < size.width; ++u) {
+      const float w = weight_filtered(v, u);
+      const bool valid = support(v, u) >= min_support && w > 1e-6f &&
+                         (mask_small.empty() || mask_small(v, u) > 0);
+      disp(v, u) = valid ? std::max(0.0f, sparse_filtered(v, u) / w) : 0.0f;
+    }
+  }
+}
+
+
+static double DepthChange(const std::vector<Vector3d>& vertices, int i, int j)
+{
+  return (i < 0 || j < 0) ? std::numeric_limits<double>::max() : std::fabs(vertices[i].z() - vertices[j].z());
+}
+
+
+static void AddTriangle(TriangleMesh& mesh, int a, int b, int c, double edge_max_depth_change)
+{
+  if (a < 0 || b < 0 || c < 0) {
+    return;
+  }
+  if (DepthChange(mesh.vertices, a, b) > edge_max_depth_change ||
+      DepthChange(mesh.vertices, b, c) > edge_max_depth_change ||
+      DepthChange(mesh.vertices, a, c) > edge_max_depth_change) {
+    return;
+  }
+  mesh.triangles.emplace_back(a, b, c);
+}
+
+
+void MeshFromDisparity(const Image1f& disp,
+                       const StereoCamera& stereo_rig,
+                       int grid_step,
+                       double min_disp,
+                       double max_depth,
+                       double edge_max_depth_change,
+                       TriangleMesh& mesh)
+{
+  CHECK_GT(grid_step, 0);
+  CHECK_GT(min_disp, 0) << "min_disp must be positive to avoid dividing by zero" << std::endl;
+
+  mesh.vertices.clear();
+  mesh.triangles.clear();
+  mesh.vertex_ids.clear();
+
+  if (disp.empty()) {
+    return;
+  }
+
+  const PinholeCamera cam = stereo_rig.LeftCamera().Rescale(disp.rows, disp.cols);
+  const double fx_times_baseline = cam.fx() * stereo_rig.Baseline();
+
+  const int grid_cols = (disp.cols - 1) / grid_step + 1;
+  const int grid_rows = (disp.rows - 1) / grid_step + 1;
+
+  // Index of the vertex at each grid node (-1 if invalid).
+  std::vector<int> vertex_index(grid_rows * grid_cols, -1);
+  for (int gy = 0; gy < grid_rows; ++gy) {
+    for (int gx = 0; gx < grid_cols; ++gx) {
+      const int u = gx * grid_step;
+      const int v = gy * grid_step;
+      const double d = disp(v, u);
+      if (d <= min_disp || (fx_times_baseline / d) > max_depth) {
+        continue;
+      }
+      vertex_index[gy * grid_cols + gx] = (int)mesh.vertices.size();
+      mesh.vertices.emplace_back(cam.Backproject(Vector2d(u, v), fx_times_baseline / d));
+    }
+  }
+
+  for (int gy = 0; gy < (grid_rows - 1); ++gy) {
+    for (int gx = 0; gx < (grid_cols - 1); ++gx) {
+      // a - b
+      // | / |
+      // c - d
+      const int a = vertex_index[gy * grid_cols + gx];
+      const int b = vertex_index[gy * grid_cols + gx + 1];
+      const int c = vertex_index[(gy + 1) * grid_cols + gx];
+      const int d = vertex_index[(gy + 1) * grid_cols + gx + 1];
+
+      // Same as DisparityMesherGpu: split along the flatter diagonal.
+      if (DepthChange(mesh.vertices, b, c) <= DepthChange(mesh.vertices, a, d)) {
+        AddTriangle(mesh, a, b, c, edge_max_depth_change);
+        AddTriangle(mesh, b, d, c, edge_max_depth_change);
+      } else {
+        AddTriangle(mesh, a, b, d, edge_max_depth_change);
+        AddTriangle(mesh, a, d, c, edge_max_depth_change);
+      }
+    }
+  }
+}
+
+
+}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "mesher/triangle_mesh.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+
+// Densifies sparse landmark disparities into a disparity map at 1/downsize of the image size, with
+// the (downsized) left image as the guide. The landmarks are splatted into a sparse disparity map
+// and a weight map, and both are smoothed with the same guided filter (imaging::FastGuidedFilter),
+// so their ratio is a weighted average of nearby landmarks that follows the image edges. Pixels
+// with fewer than min_landmarks within radius (px, at the downsized resolution), or outside of the
+// foreground mask (if it isn't empty), get a disparity of zero.
+//
+// Landmark pixels and disparities are in the full size image, and the output disparity is in
+// downsized pixels.
+void CompleteDisparity(const Image1b& iml,
+                       const Image1b& foreground_mask,
+                       const std::vector<cv::Point2f>& lmk_points,
+                       const std::vector<double>& lmk_disps,
+                       int downsize,
+                       int radius,
+                       double eps,
+                       int min_landmarks,
+                       Image1f& disp);
+
+
+// Triangulates a dense disparity map on a regular grid (a vertex every grid_step pixels), in the
+// left camera frame. Each cell is split along the diagonal with the smaller depth change, and a
+// triangle is only added if its vertices have disparities above min_disp (and depths within
+// max_depth), and none of them differ in depth by more than edge_max_depth_change. The camera can
+// be at any resolution (it's rescaled to the disparity). This is the CPU version of
+// pm::DisparityMesherGpu.
+void MeshFromDisparity(const Image1f& disp,
+                       const StereoCamera& stereo_rig,
+                       int grid_step,
+                       double min_disp,
+                       double max_depth,
+                       double edge_max_depth_change,
+                       TriangleMesh& mesh);
+
+
+}
+}
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "mesher/distance_map.hpp"
+
+namespace bm {
+namespace mesher {
+
+
+constexpr int DistanceMap::kBlockSize;
+constexpr int DistanceMap::kVoxelsPerBlock;
+
+
+void DistanceMap::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("voxel_size", &voxel_size);
+  parser.GetParam("truncation_dist", &truncation_dist);
+  parser.GetParam("max_weight", &max_weight);
+  parser.GetParam("max_range", &max_range);
+  parser.GetParam("max_queue_size", &max_queue_size);
+}
+
+
+// Closest point to p on the triangle abc (from "Real-Time Collision Detection", Ericson 2005).
+static Vector3d ClosestPointOnTriangle(const Vector3d& p,
+                                       const Vector3d& a,
+                                       const Vector3d& b,
+                                       const Vector3d& c)
+{
+  const Vector3d ab = b - a;
+  const Vector3d ac = c - a;
+  const Vector3d ap = p - a;
+  const double d1 = ab.dot(ap);
+  const double d2 = ac.dot(ap);
+  if (d1 <= 0 && d2 <= 0) { return a; }
+
+  const Vector3d bp = p - b;
+  const double d3 = ab.dot(bp);
+  const double d4 = ac.dot(bp);
+  if (d3 >= 0 && d4 <= d3) { return b; }
+
+  const double vc = d1*d4 - d3*d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    return a + (d1 / (d1 - d3)) * ab;
+  }
+
+  const Vector3d cp = p - c;
+  const double d5 = ab.dot(cp);
+  const double d6 = ac.dot(cp);
+  if (d6 >= 0 && d5 <= d6) { return c; }
+
+  const double vb = d5*d2 - d1*d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    return a + (d2 / (d2 - d6)) * ac;
+  }
+
+  const double va = d3*d6 - d5*d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+    return b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+  }
+
+  // Inside of the face.
+  const double denom = 1.0 / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+
+DistanceMap::DistanceMap(const Params& params)
+    : params_(params),
+      queue_(params_.max_queue_size, true, "distance_map_queue")
+{
+  CHECK_GT(params_.voxel_size, 0) << "DistanceMap needs a positive voxel size" << std::endl;
+  CHECK_GT(params_.truncation_dist, params_.voxel_size)
+      << "The truncation distance should span at least one voxel" << std::endl;
+  voxel_size_inv_ = 1.0 / params_.voxel_size;
+
+  thread_ = std::thread(&DistanceMap::IntegrateLoop, this);
+}
+
+
+DistanceMap::~DistanceMap()
+{
+  is_shutdown_.store(true);
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+
+Vector3i DistanceMap::VoxelOf(const Vector3d& world_t_point) const
+{
+  return Vector3i((int)std::floor(world_t_point.x() * voxel_size_inv_),
+                  (int)std::floor(world_t_point.y() * voxel_size_inv_),
+                  (int)std::floor(world_t_point.z() * voxel_size_inv_));
+}
+
+
+// NOTE(milo): Arithmetic shifts floor negative voxel indices too, so block -1 has voxels -8 to -1.
+Vector3i DistanceMap::BlockOf(const Vector3i& voxel)
+{
+  return Vector3i(voxel.x() >> 3, voxel.y() >> 3, voxel.z() >> 3);
+}
+
+
+int DistanceMap::IndexInBlock(const Vector3i& voxel)
+{
+  static_assert(kBlockSize == 8, "BlockOf() and IndexInBlock() assume 8 voxels per side");
+  return (voxel.x() & 7) + kBlockSize * ((voxel.y() & 7) + kBlockSize * (voxel.z() & 7));
+}
+
+
+const DistanceMap::Voxel* DistanceMap::GetVoxel(const Vector3i& voxel) const
+{
+  const auto it = blocks_.find(BlockOf(voxel));
+  if (it == blocks_.end()) {
+    return nullptr;
+  }
+  const Voxel* v = &it->second.at(IndexInBlock(voxel));
+  return (v->weight > 0) ? v : nullptr;
+}
+
+
+void DistanceMap::IntegrateAsync(const TriangleMesh& mesh, const SE3& world_T_cam)
+{
+  queue_.Push(Job{mesh, world_T_cam});
+}
+
+
+void DistanceMap::Flush()
+{
+  std::unique_lock<std::mutex> lock(busy_lock_);
+  busy_cv_.wait(lock, [this]() { return !is_busy_ && queue_.Empty(); });
+}
+
+
+void DistanceMap::IntegrateLoop()
+{
+  while (!is_shutdown_.load()) {
+    if (!queue_.WaitNonEmpty(0.1)) {
+      continue;
+    }
+
+    // NOTE(milo): Pop while holding busy_lock_, so that Flush() never sees an empty queue while a
+    // mesh is still waiting to be integrated.
+    Job job;
+    {
+      std::lock_guard<std::mutex> lock(busy_lock_);
+      is_busy_ = queue_.PopIfNonEmpty(job);
+    }
+    if (!is_busy_) {
+      continue;
+    }
+
+    Integrate(job.mesh, job.world_T_cam);
+
+    {
+      std::lock_guard<std::mutex> lock(busy_lock_);
+      is_busy_ = false;
+    }
+    busy_cv_.notify_all();
+  }
+}
+
+
+void DistanceMap::Integrate(const TriangleMesh& mesh, const SE3& world_T_cam)
+{
+  const std::vector<Vector3d> world_t_vertices = world_T_cam.TransformPoints(mesh.vertices);
+  const Vector3d& world_t_cam = world_T_cam.translation();
+
+  const double trunc = params_.truncation_dist;
+  const double max_range_sq = params_.max_range * params_.max_range;
+
+  // The closest (signed) distance to this mesh for each voxel it passes near. Computing these
+  // doesn't need the map lock, so queries are only blocked for the fusion below.
+  std::unordered_map<Vector3i, float, BlockHash> observed;
+
+  for (const Vector3i& tri : mesh.triangles) {
+    if (mesh.vertices.at(tri(0)).squaredNorm() > max_range_sq ||
+        mesh.vertices.at(tri(1)).squaredNorm() > max_range_sq ||
+        mesh.vertices.at(tri(2)).squaredNorm() > max_range_sq) {
+      continue;
+    }
+
+    const Vector3d& a = world_t_vertices.at(tri(0));
+    const Vector3d& b = world_t_vertices.at(tri(1));
+    const Vector3d& c = world_t_vertices.at(tri(2));
+
+    // Flip the normal to point towards the camera, so that the side it saw is positive.
+    Vector3d normal = (b - a).cross(c - a);
+    const double normal_norm = normal.norm();
+    if (normal_norm < 1e-9) {
+      continue;
+    }
+    normal /= normal_norm;
+    if (normal.dot(world_t_cam - a) < 0) {
+      normal = -normal;
+    }
+
+    const Vector3i vmin = VoxelOf(a.cwiseMin(b).cwiseMin(c) - Vector3d::Constant(trunc));
+    const Vector3i vmax = VoxelOf(a.cwiseMax(b).cwiseMax(c) + Vector3d::Constant(trunc));
+
+    for (int x = vmin.x(); x <= vmax.x(); ++x) {
+      for (int y = vmin.y(); y <= vmax.y(); ++y) {
+        for (int z = vmin.z(); z <= vmax.z(); ++z) {
+          const Vector3d center = params_.voxel_size * Vector3d(x + 0.5, y + 0.5, z + 0.5);
+          const Vector3d closest = ClosestPointOnTriangle(center, a, b, c);
+          const Vector3d to_center = center - closest;
+          const double dist = to_center.norm();
+          if (dist > trunc) {
+            continue;
+          }
+
+          const float signed_dist = static_cast<float>((to_center.dot(normal) >= 0) ? dist : -dist);
+          const auto it = observed.emplace(Vector3i(x, y, z), signed_dist);
+          if (!it.second && std::fabs(signed_dist) < std::fabs(it.first->second)) {
+            it.first->second = signed_dist;
+          }
+        }
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(map_lock_);
+  for (const auto& item : observed) {
+    Block& block = blocks_[BlockOf(item.first)];
+    if (block.empty()) {
+      block.resize(kVoxelsPerBlock);
+    }
+
+    Voxel& v = block.at(IndexInBlock(item.first));
+    v.dist = (v.weight * v.dist + item.second) / (v.weight + 1.0f);
+    v.weight = std::min(v.weight + 1.0f, params_.max_weight);
+  }
+}
+
+
+bool DistanceMap::Distance(const Vector3d& world_t_point, double& dist) const
+{
+  std::lock_guard<std::mutex> lock(map_lock_);
+  const Voxel* v = GetVoxel(VoxelOf(world_t_point));
+  if (v == nullptr) {
+    return false;
+  }
+  dist = v->dist;
+  return true;
+}
+
+
+bool DistanceMap::IsSegmentFree(const Vector3d& a,
+                                const Vector3d& b,
+                                double clearance,
+                                bool unknown_is_free) const
+{
+  CHECK_LT(clearance, params_.truncation_dist)
+      << "Clearance must be less than the truncation distance, or every voxel near a surface "
+         "looks like a collision" << std::endl;
+
+  const Vector3d ab = b - a;
+  const int steps = std::max(1, (int)std::ceil(ab.norm() * voxel_size_inv_));
+
+  std::lock_guard<std::mutex> lock(map_lock_);
+  for (int i = 0; i <= steps; ++i) {
+    const Voxel* v = GetVoxel(VoxelOf(a + (static_cast<double>(i) / steps) * ab));
+    if (v == nullptr) {
+      if (!unknown_is_free) {
+        return false;
+      }
+    } else if (v->dist < clearance) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+size_t DistanceMap::NumBlocks() const
+{
+  std::lock_guard<std::mutex> lock(map_lock_);
+  return blocks_.size();
+}
+
+
+std::function<bool(const Vector3d&, const Vector3d&)> MakeCollisionChecker(const DistanceMap& map,
+                                                                           double clearance,
+                                                                           bool unknown_is_free)
+{
+  return [&map, clearance, unknown_is_free](const Vector3d& a, const Vector3d& b) {
+    return map.IsSegmentFree(a, b, clearance, unknown_is_free);
+  };
+}
+
+
+}
+}
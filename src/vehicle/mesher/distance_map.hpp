@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/se3.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "mesher/triangle_mesh.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+
+// A truncated signed distance field in the world frame, built up from TriangleMesh observations.
+// Space is split into blocks of kBlockSize^3 voxels, and only the blocks near a surface are stored
+// (in a hash map), so a query is a hash lookup and an array index.
+//
+// Each voxel within truncation_dist of a triangle stores the distance to the nearest one, fused
+// as a running weighted average over observations. The sign comes from which side of the triangle
+// the camera saw it from: positive in front of the surface, negative behind it.
+//
+// Meshes are integrated on a background thread, so that the mesher never waits on the map.
+class DistanceMap final {
+ public:
+  static constexpr int kBlockSize = 8;
+  static constexpr int kVoxelsPerBlock = kBlockSize * kBlockSize * kBlockSize;
+
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double voxel_size = 0.2;        // Side of a voxel (m).
+    double truncation_dist = 1.0;   // Distances are only stored this close to a surface (m).
+    float max_weight = 20.0;        // Caps the fusion weight, so that the map can still change.
+    double max_range = 20.0;        // Ignore triangles with a vertex farther from the camera (m).
+    int max_queue_size = 4;         // Meshes waiting to be integrated (the oldest are dropped).
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(DistanceMap)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(DistanceMap)
+
+  explicit DistanceMap(const Params& params);
+  ~DistanceMap();
+
+  // Queues a mesh (vertices in the camera frame) for the background thread to integrate.
+  void IntegrateAsync(const TriangleMesh& mesh, const SE3& world_T_cam);
+
+  // Integrates a mesh (vertices in the camera frame) on the calling thread.
+  void Integrate(const TriangleMesh& mesh, const SE3& world_T_cam);
+
+  // Blocks until every queued mesh has been integrated.
+  void Flush();
+
+  // Returns false if the voxel at world_t_point has never been near a surface. Otherwise, sets
+  // dist to its signed distance, which is within +/- truncation_dist.
+  bool Distance(const Vector3d& world_t_point, double& dist) const;
+
+  // Whether every point on the segment from a to b is at least clearance from a surface. Checks
+  // one point per voxel along it, under one lock.
+  bool IsSegmentFree(const Vector3d& a, const Vector3d& b, double clearance, bool unknown_is_free) const;
+
+  size_t NumBlocks() const;
+  const Params& GetParams() const { return params_; }
+
+ private:
+  struct Voxel final
+  {
+    float dist = 0;
+    float weight = 0;
+  };
+
+  typedef std::vector<Voxel> Block;
+
+  struct BlockHash final
+  {
+    size_t operator()(const Vector3i& b) const
+    {
+      // NOTE(milo): The primes from "Optimized Spatial Hashing for Collision Detection of
+      // Deformable Objects" (Teschner et al. 2003).
+      return static_cast<size_t>(b.x()) * 73856093 ^
+             static_cast<size_t>(b.y()) * 19349669 ^
+             static_cast<size_t>(b.z()) * 83492791;
+    }
+  };
+
+  typedef std::unordered_map<Vector3i, Block, BlockHash> BlockMap;
+
+  struct Job final
+  {
+    TriangleMesh mesh;
+    SE3 world_T_cam;
+  };
+
+  Vector3i VoxelOf(const Vector3d& world_t_point) const;
+  static Vector3i BlockOf(const Vector3i& voxel);
+  static int IndexInBlock(const Vector3i& voxel);
+
+  // Must hold map_lock_.
+  const Voxel* GetVoxel(const Vector3i& voxel) const;
+
+  void IntegrateLoop();
+
+ private:
+  Params params_;
+  double voxel_size_inv_;
+
+  mutable std::mutex map_lock_;
+  BlockMap blocks_;
+
+  ThreadsafeQueue<Job> queue_;
+  std::atomic_bool is_shutdown_{false};
+  std::thread thread_;
+
+  // Set while the background thread has a mesh out of the queue, for Flush().
+  std::mutex busy_lock_;
+  std::condition_variable busy_cv_;
+  bool is_busy_ = false;
+};
+
+
+// Checks edges against a DistanceMap, with a robot of radius clearance. Matches
+// rrt::CollisionChecker, which is true if the edge is free.
+std::function<bool(const Vector3d&, const Vector3d&)> MakeCollisionChecker(const DistanceMap& map,
+                                                                           double clearance,
+                                                                           bool unknown_is_free = true);
+
+
+}
+}
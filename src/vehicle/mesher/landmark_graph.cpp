@@ -1,5 +1,6 @@
+#include <algorithm>
+
 #include <glog/logging.h>
-#include <boost/graph/connected_components.hpp>
 
 #include "mesher/landmark_graph.hpp"
 
@@ -7,34 +8,198 @@ namespace bm {
 namespace mesher {
 
 
+constexpr size_t EdgeWeightTable::kMinCapacity;
+
+
+size_t EdgeWeightTable::Index(uid_t lo, uid_t hi) const
+{
+  // https://xorshift.di.unimi.it/splitmix64.c
+  uint64_t h = lo * 0x9e3779b97f4a7c15ull ^ hi;
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  h = h ^ (h >> 31);
+  return static_cast<size_t>(h) & (slots_.size() - 1);
+}
+
+
+float* EdgeWeightTable::Find(uid_t lmk1, uid_t lmk2)
+{
+  const uid_t lo = std::min(lmk1, lmk2);
+  const uid_t hi = std::max(lmk1, lmk2);
+  const size_t mask = slots_.size() - 1;
+
+  for (size_t i = Index(lo, hi); slots_[i].used; i = (i + 1) & mask) {
+    if (slots_[i].lo == lo && slots_[i].hi == hi) {
+      return &slots_[i].weight;
+    }
+  }
+
+  return nullptr;
+}
+
+
+float& EdgeWeightTable::FindOrInsert(uid_t lmk1, uid_t lmk2)
+{
+  // Keep the load factor below 1/2 so that probe sequences stay short.
+  if (2 * (size_ + 1) > slots_.size()) {
+    Grow();
+  }
+
+  const uid_t lo = std::min(lmk1, lmk2);
+  const uid_t hi = std::max(lmk1, lmk2);
+  const size_t mask = slots_.size() - 1;
+
+  size_t i = Index(lo, hi);
+  for (; slots_[i].used; i = (i + 1) & mask) {
+    if (slots_[i].lo == lo && slots_[i].hi == hi) {
+      return slots_[i].weight;
+    }
+  }
+
+  Slot& slot = slots_[i];
+  slot.lo = lo;
+  slot.hi = hi;
+  slot.weight = 0;
+  slot.used = true;
+  ++size_;
+
+  return slot.weight;
+}
+
+
+bool EdgeWeightTable::Erase(uid_t lmk1, uid_t lmk2)
+{
+  const uid_t lo = std::min(lmk1, lmk2);
+  const uid_t hi = std::max(lmk1, lmk2);
+  const size_t mask = slots_.size() - 1;
+
+  size_t i = Index(lo, hi);
+  for (; slots_[i].used; i = (i + 1) & mask) {
+    if (slots_[i].lo == lo && slots_[i].hi == hi) {
+      break;
+    }
+  }
+
+  if (!slots_[i].used) {
+    return false;
+  }
+
+  // NOTE(milo): Instead of leaving a tombstone, shift back any later items in the probe sequence
+  // that would no longer be reachable. This keeps lookups fast as edges come and go.
+  size_t hole = i;
+  for (size_t j = (i + 1) & mask; slots_[j].used; j = (j + 1) & mask) {
+    const size_t home = Index(slots_[j].lo, slots_[j].hi);
+
+    // Move j into the hole if its home slot is not (cyclically) between the hole and j.
+    const bool reachable = (hole <= j) ? (hole < home && home <= j) : (hole < home || home <= j);
+    if (!reachable) {
+      slots_[hole] = slots_[j];
+      hole = j;
+    }
+  }
+
+  slots_[hole] = Slot();
+  --size_;
+
+  return true;
+}
+
+
+void EdgeWeightTable::Reserve(size_t n)
+{
+  while (2 * n > slots_.size()) {
+    Grow();
+  }
+}
+
+
+void EdgeWeightTable::Grow()
+{
+  std::vector<Slot> old;
+  old.swap(slots_);
+  slots_.resize(std::max(kMinCapacity, 2 * old.size()));
+
+  const size_t mask = slots_.size() - 1;
+  for (const Slot& slot : old) {
+    if (!slot.used) {
+      continue;
+    }
+    size_t i = Index(slot.lo, slot.hi);
+    while (slots_[i].used) {
+      i = (i + 1) & mask;
+    }
+    slots_[i] = slot;
+  }
+}
+
+
 LandmarkGraph::LandmarkGraph() {}
 
 
 void LandmarkGraph::AddLandmark(uid_t lmk_id)
 {
-  if (lmk_to_vtx_.count(lmk_id) == 0) {
-    const Graph::vertex_descriptor v = boost::add_vertex(VertexIndex(lmk_id), g_);
-    lmk_to_vtx_.emplace(lmk_id, v);
+  if (lmk_to_vtx_.count(lmk_id) != 0) {
+    return;
+  }
+
+  int v;
+  if (free_vertices_.empty()) {
+    v = (int)vertices_.size();
+    vertices_.emplace_back();
+  } else {
+    v = free_vertices_.back();
+    free_vertices_.pop_back();
   }
+
+  Vertex& vtx = vertices_.at(v);
+  vtx.lmk_id = lmk_id;
+  vtx.neighbors.clear();
+  vtx.parent = v;
+  vtx.rank = 0;
+  vtx.alive = true;
+
+  lmk_to_vtx_.emplace(lmk_id, v);
+  clusters_dirty_ = true;
 }
 
 
 size_t LandmarkGraph::GraphSize() const
 {
-  return boost::num_vertices(g_);
+  return lmk_to_vtx_.size();
 }
 
 
-// https://stackoverflow.com/questions/29931231/boost-how-to-remove-all-the-out-edges-for-a-vertex
 void LandmarkGraph::RemoveLandmark(uid_t lmk_id)
 {
   CHECK_GT(lmk_to_vtx_.count(lmk_id), 0)
       << "Trying to RemoveLandmark() for lmk_id not in g_" << std::endl;
 
-  const Graph::vertex_descriptor v = lmk_to_vtx_.at(lmk_id);
-  boost::clear_vertex(v, g_);   // Clears all edges, but not the vertex.
-  boost::remove_vertex(v, g_);  // Then remove the vertex.
+  const int v = lmk_to_vtx_.at(lmk_id);
+  Vertex& vtx = vertices_.at(v);
+
+  for (const uid_t nb : vtx.neighbors) {
+    const float* weight = edges_.Find(lmk_id, nb);
+    CHECK(weight != nullptr);
+
+    // Removing a subgraph edge might split the cluster.
+    if (has_subgraph_min_weight_ && *weight >= subgraph_min_weight_) {
+      union_find_dirty_ = true;
+    }
+    edges_.Erase(lmk_id, nb);
+
+    std::vector<uid_t>& nb_neighbors = vertices_.at(lmk_to_vtx_.at(nb)).neighbors;
+    auto it = std::find(nb_neighbors.begin(), nb_neighbors.end(), lmk_id);
+    *it = nb_neighbors.back();
+    nb_neighbors.pop_back();
+  }
+
+  // NOTE(milo): If the vertex didn't have any subgraph edges, it's a cluster by itself, so no
+  // other vertex can have it as a union-find parent.
+  vtx.neighbors.clear();
+  vtx.alive = false;
+  free_vertices_.emplace_back(v);
   lmk_to_vtx_.erase(lmk_id);
+  clusters_dirty_ = true;
 }
 
 
@@ -44,86 +209,133 @@ void LandmarkGraph::UpdateEdge(uid_t lmk1,
                                float clamp_min,
                                float clamp_max)
 {
-  if (lmk_to_vtx_.count(lmk1) == 0) {
-    AddLandmark(lmk1);
-  }
-  if (lmk_to_vtx_.count(lmk2) == 0) {
-    AddLandmark(lmk2);
-  }
+  CHECK_NE(lmk1, lmk2) << "Can't add an edge from a landmark to itself" << std::endl;
 
-  const Graph::vertex_descriptor v1 = lmk_to_vtx_.at(lmk1);
-  const Graph::vertex_descriptor v2 = lmk_to_vtx_.at(lmk2);
+  AddLandmark(lmk1);
+  AddLandmark(lmk2);
 
-  std::pair<Graph::edge_descriptor, bool> edge = boost::edge(v1, v2, g_);
-  const bool edge_exists = edge.second;
+  const bool edge_exists = edges_.Find(lmk1, lmk2) != nullptr;
+  float& weight = edges_.FindOrInsert(lmk1, lmk2);
 
   if (!edge_exists) {
-    edge = boost::add_edge(v1, v2, EdgeWeight(0), g_);
+    vertices_.at(lmk_to_vtx_.at(lmk1)).neighbors.emplace_back(lmk2);
+    vertices_.at(lmk_to_vtx_.at(lmk2)).neighbors.emplace_back(lmk1);
   }
 
   // Otherwise add the increment to the edge weight.
-  // https://stackoverflow.com/questions/24366642/how-do-i-change-the-edge-weight-in-a-graph-using-the-boost-graph-library/24372985
-  const float weight = boost::get(edge_weight_t(), g_, edge.first);
-  const float new_weight = std::min(clamp_max, std::max(clamp_min, weight + increment));
-  boost::put(edge_weight_t(), g_, edge.first, new_weight);
-}
-
-// https://stackoverflow.com/questions/47909707/find-connected-components-using-boost-graph-library-with-the-vertex-and-edge-ty/47911251#47911251
-LmkClusters LandmarkGraph::GetClusters(float subgraph_min_weight)
-{
-  Subgraph subgraph;
-  std::unordered_map<uid_t, Subgraph::vertex_descriptor> lmk_id_to_vtx;
-  std::unordered_map<Subgraph::vertex_descriptor, uid_t> vtx_to_lmk_id;
-
-  const auto edge_bounds = boost::edges(g_);
-
-  VertexIndexMap lmk_id_map;
-
-  for (auto it = edge_bounds.first; it != edge_bounds.second; ++it) {
-    Graph::vertex_descriptor v1 = boost::source(*it, g_);
-    Graph::vertex_descriptor v2 = boost::target(*it, g_);
-    const uid_t lmk1 = boost::get(vertex_index_t(), g_, v1);
-    const uid_t lmk2 = boost::get(vertex_index_t(), g_, v2);
-
-    std::pair<Graph::edge_descriptor, bool> edge = boost::edge(v1, v2, g_);
-    const float weight = boost::get(edge_weight_t(), g_, edge.first);
-
-    if (weight >= subgraph_min_weight) {
-      if (lmk_id_to_vtx.count(lmk1) == 0) {
-        const Subgraph::vertex_descriptor v = boost::add_vertex(subgraph);
-        lmk_id_to_vtx.emplace(lmk1, v);
-        vtx_to_lmk_id.emplace(v, lmk1);
-      }
-      if (lmk_id_to_vtx.count(lmk2) == 0) {
-        const Subgraph::vertex_descriptor v = boost::add_vertex(subgraph);
-        lmk_id_to_vtx.emplace(lmk2, v);
-        vtx_to_lmk_id.emplace(v, lmk2);
-      }
-
-      const Subgraph::vertex_descriptor sv1 = lmk_id_to_vtx.at(lmk1);
-      const Subgraph::vertex_descriptor sv2 = lmk_id_to_vtx.at(lmk2);
-      boost::add_edge(sv1, sv2, subgraph);
+  const float old_weight = weight;
+  weight = std::min(clamp_max, std::max(clamp_min, weight + increment));
+
+  if (!has_subgraph_min_weight_) {
+    return;
+  }
+
+  const bool was_subgraph_edge = edge_exists && old_weight >= subgraph_min_weight_;
+  const bool is_subgraph_edge = weight >= subgraph_min_weight_;
+
+  if (!was_subgraph_edge && is_subgraph_edge && !union_find_dirty_) {
+    Union(lmk_to_vtx_.at(lmk1), lmk_to_vtx_.at(lmk2));
+  } else if (was_subgraph_edge && !is_subgraph_edge) {
+    union_find_dirty_ = true;
+  }
+}
+
+
+void LandmarkGraph::UpdateEdges(const std::vector<EdgeUpdate>& updates, float clamp_min, float clamp_max)
+{
+  // NOTE(milo): Usually most of the edges already exist, so this over-reserves by a little.
+  edges_.Reserve(edges_.Size() + updates.size());
+
+  for (const EdgeUpdate& u : updates) {
+    UpdateEdge(u.lmk1, u.lmk2, u.increment, clamp_min, clamp_max);
+  }
+}
+
+
+int LandmarkGraph::FindRoot(int v)
+{
+  // Path halving.
+  while (vertices_[v].parent != v) {
+    vertices_[v].parent = vertices_[vertices_[v].parent].parent;
+    v = vertices_[v].parent;
+  }
+  return v;
+}
+
+
+void LandmarkGraph::Union(int v1, int v2)
+{
+  int r1 = FindRoot(v1);
+  int r2 = FindRoot(v2);
+  if (r1 == r2) {
+    return;
+  }
+
+  // Union by rank.
+  if (vertices_[r1].rank < vertices_[r2].rank) {
+    std::swap(r1, r2);
+  }
+  vertices_[r2].parent = r1;
+  if (vertices_[r1].rank == vertices_[r2].rank) {
+    ++vertices_[r1].rank;
+  }
+
+  clusters_dirty_ = true;
+}
+
+
+void LandmarkGraph::RebuildClusters()
+{
+  for (size_t v = 0; v < vertices_.size(); ++v) {
+    vertices_[v].parent = (int)v;
+    vertices_[v].rank = 0;
+  }
+
+  for (const EdgeWeightTable::Slot& slot : edges_.Slots()) {
+    if (slot.used && slot.weight >= subgraph_min_weight_) {
+      Union(lmk_to_vtx_.at(slot.lo), lmk_to_vtx_.at(slot.hi));
     }
   }
 
-  std::vector<int> cluster_ids(boost::num_vertices(subgraph));
+  union_find_dirty_ = false;
+  clusters_dirty_ = true;
+}
 
-  // TODO(milo): incremental_components() is faster.
-  // NOTE(milo): The compiler errors from Boost Graph are just about impossible to understand!
-  // For some reason, boost::connected_components() will only work if the graph has a vertex index
-  // property. If not, the compiler complains about a reference to void.
-  // Next I realized that running boost::connected_components with a void* vertex_descriptor causes
-  // some weird hidden memory corrupting. Easier to just build a graph here from scratch.
-  const int num_comp = boost::connected_components(subgraph, &cluster_ids[0]);
 
-  LmkClusters out(num_comp);
+const LmkClusters& LandmarkGraph::GetClusters(float subgraph_min_weight)
+{
+  if (!has_subgraph_min_weight_ || subgraph_min_weight != subgraph_min_weight_) {
+    has_subgraph_min_weight_ = true;
+    subgraph_min_weight_ = subgraph_min_weight;
+    union_find_dirty_ = true;
+  }
 
-  for (uid_t v = 0; v < cluster_ids.size(); ++v) {
-    const uid_t lmk_id = vtx_to_lmk_id.at(v);
-    out.at(cluster_ids.at(v)).insert(lmk_id);
+  if (union_find_dirty_) {
+    RebuildClusters();
   }
 
-  return out;
+  if (!clusters_dirty_) {
+    return clusters_;
+  }
+
+  clusters_.clear();
+  std::vector<int> root_to_cluster(vertices_.size(), -1);
+
+  for (size_t v = 0; v < vertices_.size(); ++v) {
+    if (!vertices_[v].alive) {
+      continue;
+    }
+    const int root = FindRoot((int)v);
+    if (root_to_cluster[root] < 0) {
+      root_to_cluster[root] = (int)clusters_.size();
+      clusters_.emplace_back();
+    }
+    clusters_.at(root_to_cluster[root]).insert(vertices_[v].lmk_id);
+  }
+
+  clusters_dirty_ = false;
+
+  return clusters_;
 }
 
 
@@ -1,10 +1,9 @@
 #pragma once
 
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-#include <boost/graph/adjacency_list.hpp>
-
 #include "core/uid.hpp"
 
 namespace bm {
@@ -12,33 +11,59 @@ namespace mesher {
 
 using namespace core;
 
-typedef boost::edge_weight_t edge_weight_t;
-typedef boost::vertex_index_t vertex_index_t;
-typedef boost::vertex_name_t vertex_name_t;
-typedef boost::property<vertex_index_t, uid_t> VertexIndex;
-typedef boost::property<vertex_name_t, uid_t> VertexName;
-typedef boost::property<edge_weight_t, float> EdgeWeight;
-
-// https://cs.brown.edu/~jwicks/boost/libs/graph/doc/adjacency_list.html
-// Calling boost::remove_vertex() invalidates vertex ids! Have to use setS or listS to keep them stable.
-typedef boost::adjacency_list<boost::setS,
-                              boost::setS,
-                              boost::undirectedS,
-                              VertexIndex,
-                              EdgeWeight> Graph;
-
-typedef boost::adjacency_list<boost::vecS,
-                              boost::vecS,
-                              boost::undirectedS,
-                              VertexIndex> Subgraph;
-
-typedef boost::property_map<Graph, vertex_index_t>::type VertexIndexMap;
-typedef boost::property_map<Graph, edge_weight_t>::type EdgeWeightMap;
-
 typedef std::unordered_set<uid_t> LmkSet;
 typedef std::vector<LmkSet> LmkClusters;
 
 
+// Flat hash table of edge weights, keyed by (unordered) pairs of landmark ids. Uses open
+// addressing with linear probing, so a lookup is usually one or two cache lines.
+class EdgeWeightTable final {
+ public:
+  struct Slot final
+  {
+    uid_t lo = 0;
+    uid_t hi = 0;
+    float weight = 0;
+    bool used = false;
+  };
+
+  EdgeWeightTable() { slots_.resize(kMinCapacity); }
+
+  // Returns a pointer to the weight of the edge, or nullptr if it doesn't exist.
+  float* Find(uid_t lmk1, uid_t lmk2);
+
+  // Returns the weight of the edge, which is created with weight 0 if it doesn't exist.
+  float& FindOrInsert(uid_t lmk1, uid_t lmk2);
+
+  // Returns true if the edge existed.
+  bool Erase(uid_t lmk1, uid_t lmk2);
+
+  size_t Size() const { return size_; }
+
+  // Makes room for n edges without growing.
+  void Reserve(size_t n);
+
+  // For iterating over edges (skip any slots that aren't used).
+  const std::vector<Slot>& Slots() const { return slots_; }
+
+ private:
+  static constexpr size_t kMinCapacity = 64;
+
+  size_t Index(uid_t lo, uid_t hi) const;
+  void Grow();
+
+ private:
+  std::vector<Slot> slots_;   // Capacity is always a power of 2.
+  size_t size_ = 0;
+};
+
+
+// A graph of landmarks with weighted edges. Landmarks that are connected by edges with weight of
+// at least subgraph_min_weight are put in the same cluster.
+//
+// NOTE(milo): Clusters are tracked with a union-find, which handles edges being added in O(1).
+// Union-find can't split a cluster though, so if a subgraph edge is weakened or removed, the
+// union-find is rebuilt from the edge table the next time that clusters are needed.
 class LandmarkGraph final {
  public:
   LandmarkGraph();
@@ -57,8 +82,21 @@ class LandmarkGraph final {
                   float clamp_min,
                   float clamp_max);
 
-  // Finds connected components in the landmark graph and returns them.
-  LmkClusters GetClusters(float subgraph_min_weight);
+  struct EdgeUpdate final
+  {
+    uid_t lmk1;
+    uid_t lmk2;
+    float increment;
+  };
+
+  // Same as calling UpdateEdge() for each of the updates in order, but the edge table only grows
+  // once for the whole batch.
+  void UpdateEdges(const std::vector<EdgeUpdate>& updates, float clamp_min, float clamp_max);
+
+  // Returns the connected components of the subgraph with edges of weight >= subgraph_min_weight.
+  // Every landmark is in exactly one cluster, so unconnected landmarks are in a cluster by
+  // themselves. The result is cached until the clusters change.
+  const LmkClusters& GetClusters(float subgraph_min_weight);
 
   // Returns a set of ids for all the landmarks current in the graph.
   LmkSet GetLandmarkIds() const;
@@ -66,13 +104,34 @@ class LandmarkGraph final {
   size_t GraphSize() const;
 
  private:
-  void MaybeAddSubgraphEdge(uid_t lmk1, uid_t lmk2);
-  void MaybeRemoveSubgraphEdge(uid_t lmk1, uid_t lmk2);
+  struct Vertex final
+  {
+    uid_t lmk_id = 0;
+    std::vector<uid_t> neighbors;
+    int parent = -1;    // Union-find parent (itself if a root).
+    int rank = 0;
+    bool alive = false;
+  };
+
+  int FindRoot(int v);
+  void Union(int v1, int v2);
+
+  // Rebuild the union-find from all of the subgraph edges.
+  void RebuildClusters();
 
  private:
-  std::unordered_map<uid_t, Graph::vertex_descriptor> lmk_to_vtx_;
+  std::unordered_map<uid_t, int> lmk_to_vtx_;
+  std::vector<Vertex> vertices_;
+  std::vector<int> free_vertices_;
+
+  EdgeWeightTable edges_;
+
+  bool has_subgraph_min_weight_ = false;
+  float subgraph_min_weight_ = 0;
 
-  Graph g_;
+  bool union_find_dirty_ = true;  // Needs to be rebuilt (a subgraph edge was removed).
+  bool clusters_dirty_ = true;    // Union-find has changed since clusters_ was built.
+  LmkClusters clusters_;
 };
 
 
@@ -0,0 +1,368 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "mesher/mesh_codec.hpp"
+
+namespace bm {
+namespace mesher {
+
+
+void MeshEncoder::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("full_mesh_interval", &full_mesh_interval);
+  parser.GetParam("bbox_margin", &bbox_margin);
+  parser.GetParam("move_tolerance_steps", &move_tolerance_steps);
+}
+
+
+static void WriteVarint(uint64_t value, std::vector<uint8_t>& out)
+{
+  while (value >= 0x80) {
+    out.emplace_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.emplace_back(static_cast<uint8_t>(value));
+}
+
+
+static void WriteSignedVarint(int64_t value, std::vector<uint8_t>& out)
+{
+  // Zigzag, so that small negative numbers stay small.
+  WriteVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63), out);
+}
+
+
+// Reads the sections of MeshDelta::data. Every read fails (returns false) once we're out of bytes.
+class ByteReader final {
+ public:
+  explicit ByteReader(const std::vector<uint8_t>& data) : data_(data) {}
+
+  bool ReadVarint(uint64_t& value)
+  {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (pos_ >= data_.size()) {
+        return false;
+      }
+      const uint8_t byte = data_[pos_++];
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool ReadSignedVarint(int64_t& value)
+  {
+    uint64_t zigzag;
+    if (!ReadVarint(zigzag)) {
+      return false;
+    }
+    value = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+    return true;
+  }
+
+  bool ReadUint16(uint16_t& value)
+  {
+    if (pos_ + 2 > data_.size()) {
+      return false;
+    }
+    value = static_cast<uint16_t>(data_[pos_] | (data_[pos_ + 1] << 8));
+    pos_ += 2;
+    return true;
+  }
+
+  bool Done() const { return pos_ == data_.size(); }
+
+ private:
+  const std::vector<uint8_t>& data_;
+  size_t pos_ = 0;
+};
+
+
+static void WriteIds(const std::vector<uid_t>& sorted_ids, std::vector<uint8_t>& out)
+{
+  uid_t prev = 0;
+  for (const uid_t id : sorted_ids) {
+    WriteVarint(id - prev, out);
+    prev = id;
+  }
+}
+
+
+static bool ReadIds(ByteReader& reader, int n, std::vector<uid_t>& ids)
+{
+  ids.resize(n);
+  uid_t prev = 0;
+  for (int i = 0; i < n; ++i) {
+    uint64_t delta;
+    if (!reader.ReadVarint(delta)) {
+      return false;
+    }
+    ids[i] = prev + delta;
+    prev = ids[i];
+  }
+  return true;
+}
+
+
+static void WriteTriangles(const std::vector<TriangleKey>& sorted_triangles, std::vector<uint8_t>& out)
+{
+  uid_t prev = 0;
+  for (const TriangleKey& t : sorted_triangles) {
+    WriteVarint(t[0] - prev, out);
+    WriteSignedVarint(static_cast<int64_t>(t[1] - t[0]), out);
+    WriteSignedVarint(static_cast<int64_t>(t[2] - t[0]), out);
+    prev = t[0];
+  }
+}
+
+
+static bool ReadTriangles(ByteReader& reader, int n, std::vector<TriangleKey>& triangles)
+{
+  triangles.resize(n);
+  uid_t prev = 0;
+  for (int i = 0; i < n; ++i) {
+    uint64_t delta;
+    int64_t d1, d2;
+    if (!reader.ReadVarint(delta) || !reader.ReadSignedVarint(d1) || !reader.ReadSignedVarint(d2)) {
+      return false;
+    }
+    TriangleKey& t = triangles[i];
+    t[0] = prev + delta;
+    t[1] = t[0] + static_cast<uid_t>(d1);
+    t[2] = t[0] + static_cast<uid_t>(d2);
+    prev = t[0];
+  }
+  return true;
+}
+
+
+static TriangleKey MakeTriangleKey(uid_t a, uid_t b, uid_t c)
+{
+  // Rotate (don't sort) so that the winding order is the same.
+  if (a <= b && a <= c) {
+    return TriangleKey{{ a, b, c }};
+  } else if (b <= a && b <= c) {
+    return TriangleKey{{ b, c, a }};
+  }
+  return TriangleKey{{ c, a, b }};
+}
+
+
+static QuantizedVertex Quantize(const Vector3d& v, const Vector3d& bbox_min, const Vector3d& bbox_max)
+{
+  QuantizedVertex q;
+  for (int i = 0; i < 3; ++i) {
+    const double extent = std::max(1e-9, bbox_max(i) - bbox_min(i));
+    const double steps = std::round(65535.0 * (v(i) - bbox_min(i)) / extent);
+    q[i] = static_cast<uint16_t>(std::min(65535.0, std::max(0.0, steps)));
+  }
+  return q;
+}
+
+
+static Vector3d Dequantize(const QuantizedVertex& q, const Vector3d& bbox_min, const Vector3d& bbox_max)
+{
+  Vector3d v;
+  for (int i = 0; i < 3; ++i) {
+    v(i) = bbox_min(i) + (bbox_max(i) - bbox_min(i)) * static_cast<double>(q[i]) / 65535.0;
+  }
+  return v;
+}
+
+
+MeshDelta MeshEncoder::Encode(const TriangleMesh& mesh)
+{
+  CHECK_EQ(mesh.vertices.size(), mesh.vertex_ids.size())
+      << "MeshEncoder needs a landmark id for every vertex" << std::endl;
+
+  bool full_mesh = force_full_mesh_ || (frames_since_full_mesh_ + 1) >= params_.full_mesh_interval;
+
+  for (const Vector3d& v : mesh.vertices) {
+    if (full_mesh) {
+      break;
+    }
+    full_mesh = (v.array() < bbox_min_.array()).any() || (v.array() > bbox_max_.array()).any();
+  }
+
+  MeshDelta delta;
+  delta.seq = seq_;
+
+  if (full_mesh) {
+    delta.base_seq = -1;
+    bbox_min_ = Vector3d::Zero();
+    bbox_max_ = Vector3d::Zero();
+    if (!mesh.vertices.empty()) {
+      bbox_min_ = mesh.vertices.front();
+      bbox_max_ = mesh.vertices.front();
+      for (const Vector3d& v : mesh.vertices) {
+        bbox_min_ = bbox_min_.cwiseMin(v);
+        bbox_max_ = bbox_max_.cwiseMax(v);
+      }
+    }
+    bbox_min_ -= Vector3d::Constant(params_.bbox_margin);
+    bbox_max_ += Vector3d::Constant(params_.bbox_margin);
+
+    vertices_.clear();
+    triangles_.clear();
+    frames_since_full_mesh_ = 0;
+    force_full_mesh_ = false;
+  } else {
+    delta.base_seq = seq_ - 1;
+    ++frames_since_full_mesh_;
+  }
+
+  delta.bbox_min = bbox_min_;
+  delta.bbox_max = bbox_max_;
+  ++seq_;
+
+  //================================= VERTICES ===================================================
+  std::map<uid_t, QuantizedVertex> vertices;
+  for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+    vertices.emplace(mesh.vertex_ids.at(i), Quantize(mesh.vertices.at(i), bbox_min_, bbox_max_));
+  }
+
+  std::vector<uid_t> removed_vertices;
+  for (const auto& it : vertices_) {
+    if (vertices.count(it.first) == 0) {
+      removed_vertices.emplace_back(it.first);
+    }
+  }
+  for (const uid_t id : removed_vertices) {
+    vertices_.erase(id);
+  }
+
+  std::vector<uid_t> upserted_vertices;
+  for (const auto& it : vertices) {
+    const auto prev = vertices_.find(it.first);
+    bool moved = (prev == vertices_.end());
+    for (int i = 0; i < 3 && !moved; ++i) {
+      moved = std::abs((int)it.second[i] - (int)prev->second[i]) > params_.move_tolerance_steps;
+    }
+    if (moved) {
+      upserted_vertices.emplace_back(it.first);
+      vertices_[it.first] = it.second;
+    }
+  }
+
+  //================================= TRIANGLES ==================================================
+  std::set<TriangleKey> triangles;
+  for (const Vector3i& t : mesh.triangles) {
+    triangles.emplace(MakeTriangleKey(mesh.vertex_ids.at(t(0)),
+                                      mesh.vertex_ids.at(t(1)),
+                                      mesh.vertex_ids.at(t(2))));
+  }
+
+  std::vector<TriangleKey> removed_triangles, added_triangles;
+  std::set_difference(triangles_.begin(), triangles_.end(), triangles.begin(), triangles.end(),
+                      std::back_inserter(removed_triangles));
+  std::set_difference(triangles.begin(), triangles.end(), triangles_.begin(), triangles_.end(),
+                      std::back_inserter(added_triangles));
+  triangles_ = std::move(triangles);
+
+  //================================= ENCODE =====================================================
+  delta.num_removed_vertices = (int32_t)removed_vertices.size();
+  delta.num_upserted_vertices = (int32_t)upserted_vertices.size();
+  delta.num_removed_triangles = (int32_t)removed_triangles.size();
+  delta.num_added_triangles = (int32_t)added_triangles.size();
+
+  WriteIds(removed_vertices, delta.data);
+  WriteIds(upserted_vertices, delta.data);
+  for (const uid_t id : upserted_vertices) {
+    for (const uint16_t q : vertices_.at(id)) {
+      delta.data.emplace_back(static_cast<uint8_t>(q & 0xff));
+      delta.data.emplace_back(static_cast<uint8_t>(q >> 8));
+    }
+  }
+  WriteTriangles(removed_triangles, delta.data);
+  WriteTriangles(added_triangles, delta.data);
+
+  return delta;
+}
+
+
+bool MeshDecoder::Apply(const MeshDelta& delta)
+{
+  if (!delta.IsFullMesh() && (!has_mesh_ || delta.base_seq != seq_)) {
+    has_mesh_ = false;
+    return false;
+  }
+
+  // Parse everything before changing any state, in case the data is bad.
+  ByteReader reader(delta.data);
+  std::vector<uid_t> removed_vertices, upserted_vertices;
+  std::vector<QuantizedVertex> upserted_coords(delta.num_upserted_vertices);
+  std::vector<TriangleKey> removed_triangles, added_triangles;
+
+  bool ok = ReadIds(reader, delta.num_removed_vertices, removed_vertices) &&
+            ReadIds(reader, delta.num_upserted_vertices, upserted_vertices);
+  for (int i = 0; ok && i < delta.num_upserted_vertices; ++i) {
+    for (int j = 0; ok && j < 3; ++j) {
+      ok = reader.ReadUint16(upserted_coords[i][j]);
+    }
+  }
+  ok = ok && ReadTriangles(reader, delta.num_removed_triangles, removed_triangles) &&
+             ReadTriangles(reader, delta.num_added_triangles, added_triangles) &&
+             reader.Done();
+
+  if (!ok) {
+    LOG(WARNING) << "MeshDecoder got malformed data for seq=" << delta.seq << std::endl;
+    has_mesh_ = false;
+    return false;
+  }
+
+  if (delta.IsFullMesh()) {
+    vertices_.clear();
+    triangles_.clear();
+  }
+
+  has_mesh_ = true;
+  seq_ = delta.seq;
+  bbox_min_ = delta.bbox_min;
+  bbox_max_ = delta.bbox_max;
+
+  for (const uid_t id : removed_vertices) {
+    vertices_.erase(id);
+  }
+  for (size_t i = 0; i < upserted_vertices.size(); ++i) {
+    vertices_[upserted_vertices[i]] = upserted_coords[i];
+  }
+  for (const TriangleKey& t : removed_triangles) {
+    triangles_.erase(t);
+  }
+  for (const TriangleKey& t : added_triangles) {
+    triangles_.emplace(t);
+  }
+
+  // Rebuild the mesh, with vertices in id order.
+  mesh_.vertices.clear();
+  mesh_.vertex_ids.clear();
+  mesh_.triangles.clear();
+
+  std::map<uid_t, int> vertex_index;
+  for (const auto& it : vertices_) {
+    vertex_index.emplace(it.first, (int)mesh_.vertices.size());
+    mesh_.vertex_ids.emplace_back(it.first);
+    mesh_.vertices.emplace_back(Dequantize(it.second, bbox_min_, bbox_max_));
+  }
+
+  for (const TriangleKey& t : triangles_) {
+    const auto a = vertex_index.find(t[0]);
+    const auto b = vertex_index.find(t[1]);
+    const auto c = vertex_index.find(t[2]);
+    if (a == vertex_index.end() || b == vertex_index.end() || c == vertex_index.end()) {
+      continue;
+    }
+    mesh_.triangles.emplace_back(a->second, b->second, c->second);
+  }
+
+  return true;
+}
+
+
+}
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/uid.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "mesher/triangle_mesh.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+
+// Vertex coordinates as 16-bit steps across the bounding box of a full mesh.
+typedef std::array<uint16_t, 3> QuantizedVertex;
+
+// A triangle as the landmark ids of its vertices, rotated so that the smallest id is first (which
+// keeps the winding order).
+typedef std::array<uid_t, 3> TriangleKey;
+
+
+// The changes between two consecutive meshes (or a full mesh, if base_seq is -1). The data is four
+// varint-encoded sections, in this order:
+//  1. Removed vertex ids: sorted, each as the (unsigned) difference from the one before.
+//  2. Added or moved vertices: sorted ids like above, then 3 x uint16 little-endian coordinates for
+//     each vertex.
+//  3. Removed triangles: sorted, the first id as the difference from the previous triangle's first
+//     id, and the other two as signed (zigzag) differences from the first.
+//  4. Added triangles: same as above.
+struct MeshDelta final
+{
+  int32_t seq = 0;
+  int32_t base_seq = -1;
+  Vector3d bbox_min = Vector3d::Zero();
+  Vector3d bbox_max = Vector3d::Zero();
+
+  int32_t num_removed_vertices = 0;
+  int32_t num_upserted_vertices = 0;
+  int32_t num_removed_triangles = 0;
+  int32_t num_added_triangles = 0;
+
+  std::vector<uint8_t> data;
+
+  bool IsFullMesh() const { return base_seq < 0; }
+};
+
+
+// Encodes a stream of meshes (with vertex_ids) as MeshDeltas against the previous mesh. The decoder
+// has to see every delta since the last full mesh, so full meshes are sent periodically in case a
+// message gets lost.
+class MeshEncoder final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int full_mesh_interval = 30;      // Send a full mesh at least this often.
+    double bbox_margin = 2.0;         // Grow the bounding box by this much (m) on each side.
+    int move_tolerance_steps = 2;     // Only resend a vertex if it moves more than this many steps.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(MeshEncoder)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(MeshEncoder)
+
+  explicit MeshEncoder(const Params& params) : params_(params) {}
+
+  // Encodes the changes since the last mesh. Sends a full mesh if it's time for one, or a vertex
+  // has moved outside of the bounding box.
+  MeshDelta Encode(const TriangleMesh& mesh);
+
+  // Make the next Encode() send a full mesh.
+  void ForceFullMesh() { force_full_mesh_ = true; }
+
+ private:
+  Params params_;
+
+  int32_t seq_ = 0;
+  int frames_since_full_mesh_ = 0;
+  bool force_full_mesh_ = true;
+  Vector3d bbox_min_ = Vector3d::Zero();
+  Vector3d bbox_max_ = Vector3d::Zero();
+
+  // What the decoder has after the last delta.
+  std::map<uid_t, QuantizedVertex> vertices_;
+  std::set<TriangleKey> triangles_;
+};
+
+
+// Rebuilds meshes from a stream of MeshDeltas.
+class MeshDecoder final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(MeshDecoder)
+
+  MeshDecoder() = default;
+
+  // Applies a delta and rebuilds Mesh(). Returns false (and leaves Mesh() alone) if the delta is
+  // against a mesh we don't have, e.g because a message was lost. After that, nothing is applied
+  // until the next full mesh.
+  bool Apply(const MeshDelta& delta);
+
+  // Vertices are sorted by landmark id, and vertex_ids are filled in.
+  const TriangleMesh& Mesh() const { return mesh_; }
+
+ private:
+  bool has_mesh_ = false;
+  int32_t seq_ = 0;
+  Vector3d bbox_min_ = Vector3d::Zero();
+  Vector3d bbox_max_ = Vector3d::Zero();
+
+  std::map<uid_t, QuantizedVertex> vertices_;
+  std::set<TriangleKey> triangles_;
+
+  TriangleMesh mesh_;
+};
+
+
+}
+}
@@ -0,0 +1,161 @@
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <glog/logging.h>
+
+#include "mesher/mesh_decimation.hpp"
+
+namespace bm {
+namespace mesher {
+
+// Grows the cell size by this much until a decimated mesh fits in the budget, at most this many times.
+static const double kCellGrowth = 1.25;
+static const int kMaxDecimateTries = 32;
+
+// Cell coordinates and vertex indices are packed into 21 bits each.
+static const int kKeyBits = 21;
+static const uint64_t kKeyMask = (1ull << kKeyBits) - 1;
+
+
+// NOTE(milo): Cells that are a multiple of 2^21 apart get the same key. With a cell size that's
+// anywhere near the mesh's detail, no mesh is that big.
+static uint64_t CellKey(const Vector3d& v, double cell_size)
+{
+  const uint64_t x = static_cast<uint64_t>(static_cast<int64_t>(std::floor(v.x() / cell_size))) & kKeyMask;
+  const uint64_t y = static_cast<uint64_t>(static_cast<int64_t>(std::floor(v.y() / cell_size))) & kKeyMask;
+  const uint64_t z = static_cast<uint64_t>(static_cast<int64_t>(std::floor(v.z() / cell_size))) & kKeyMask;
+  return x | (y << kKeyBits) | (z << (2 * kKeyBits));
+}
+
+
+// Rotated so that the smallest index is first, which keeps the winding order.
+static uint64_t TriangleKey(int a, int b, int c)
+{
+  if (b < a && b < c) {
+    std::swap(a, b);
+    std::swap(b, c);
+  } else if (c < a && c < b) {
+    std::swap(a, c);
+    std::swap(b, c);
+  }
+  return static_cast<uint64_t>(a) | (static_cast<uint64_t>(b) << kKeyBits) |
+         (static_cast<uint64_t>(c) << (2 * kKeyBits));
+}
+
+
+void ClusterVertices(const TriangleMesh& mesh, double cell_size, TriangleMesh& out)
+{
+  CHECK_GT(cell_size, 0);
+  CHECK(mesh.vertex_ids.empty() || mesh.vertex_ids.size() == mesh.vertices.size());
+
+  const size_t N = mesh.vertices.size();
+  CHECK_LT(N, 1ul << kKeyBits) << "Too many vertices to cluster" << std::endl;
+
+  // Which cluster each vertex goes into, and the mean of each cluster.
+  std::unordered_map<uint64_t, int> cluster_of_cell;
+  cluster_of_cell.reserve(N);
+  std::vector<int> cluster(N);
+  std::vector<Vector3d> sums;
+  std::vector<int> counts;
+
+  for (size_t i = 0; i < N; ++i) {
+    const auto it = cluster_of_cell.emplace(CellKey(mesh.vertices[i], cell_size), (int)sums.size()).first;
+    if (it->second == (int)sums.size()) {
+      sums.emplace_back(Vector3d::Zero());
+      counts.emplace_back(0);
+    }
+    cluster[i] = it->second;
+    sums[it->second] += mesh.vertices[i];
+    ++counts[it->second];
+  }
+
+  // Triangles between three different clusters, once each.
+  std::unordered_set<uint64_t> seen;
+  seen.reserve(mesh.triangles.size());
+  std::vector<Vector3i> triangles;
+  std::vector<int> new_index(sums.size(), -1);
+
+  for (const Vector3i& t : mesh.triangles) {
+    const int a = cluster.at(t.x());
+    const int b = cluster.at(t.y());
+    const int c = cluster.at(t.z());
+    if (a == b || b == c || a == c || !seen.insert(TriangleKey(a, b, c)).second) {
+      continue;
+    }
+    triangles.emplace_back(a, b, c);
+    new_index[a] = new_index[b] = new_index[c] = 0;
+  }
+
+  // Only keep the clusters that are in a triangle.
+  out.vertices.clear();
+  for (size_t k = 0; k < sums.size(); ++k) {
+    if (new_index[k] >= 0) {
+      new_index[k] = (int)out.vertices.size();
+      out.vertices.emplace_back(sums[k] / counts[k]);
+    }
+  }
+
+  out.triangles.resize(triangles.size());
+  for (size_t j = 0; j < triangles.size(); ++j) {
+    const Vector3i& t = triangles[j];
+    out.triangles[j] = Vector3i(new_index[t.x()], new_index[t.y()], new_index[t.z()]);
+  }
+
+  // Each vertex keeps the id of the input vertex nearest to it, so ids stay unique.
+  out.vertex_ids.clear();
+  if (!mesh.vertex_ids.empty()) {
+    out.vertex_ids.resize(out.vertices.size());
+    std::vector<double> nearest(out.vertices.size(), std::numeric_limits<double>::max());
+    for (size_t i = 0; i < N; ++i) {
+      const int v = new_index[cluster[i]];
+      if (v < 0) {
+        continue;
+      }
+      const double d = (mesh.vertices[i] - out.vertices[v]).squaredNorm();
+      if (d < nearest[v]) {
+        nearest[v] = d;
+        out.vertex_ids[v] = mesh.vertex_ids[i];
+      }
+    }
+  }
+}
+
+
+double DecimateMesh(const TriangleMesh& mesh, int max_triangles, TriangleMesh& out)
+{
+  CHECK_GT(max_triangles, 0);
+
+  if ((int)mesh.triangles.size() <= max_triangles) {
+    out = mesh;
+    return 0;
+  }
+
+  // A flat mesh with cells of side s has about 2 triangles per s^2 of area.
+  double area = 0;
+  for (const Vector3i& t : mesh.triangles) {
+    const Vector3d& a = mesh.vertices.at(t.x());
+    area += 0.5 * (mesh.vertices.at(t.y()) - a).cross(mesh.vertices.at(t.z()) - a).norm();
+  }
+  double cell_size = std::sqrt(2.0 * area / max_triangles);
+  if (!(cell_size > 0)) {
+    cell_size = 1e-3;
+  }
+
+  for (int i = 0; i < kMaxDecimateTries; ++i) {
+    ClusterVertices(mesh, cell_size, out);
+    if ((int)out.triangles.size() <= max_triangles) {
+      return cell_size;
+    }
+    cell_size *= kCellGrowth;
+  }
+
+  LOG(WARNING) << "Couldn't decimate a mesh to " << max_triangles << " triangles, it has "
+               << out.triangles.size() << std::endl;
+  return cell_size / kCellGrowth;
+}
+
+
+}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "mesher/triangle_mesh.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+
+// Simplifies a mesh by vertex clustering: the vertices in each cube of a grid with side cell_size
+// are merged into one vertex at their mean, which keeps the landmark id (if any) of the vertex
+// nearest to it. Triangles that lose a corner, or that duplicate another one, are dropped, and so
+// are vertices that aren't in any triangle. It's one pass over the mesh, and the surface moves by
+// at most about cell_size.
+void ClusterVertices(const TriangleMesh& mesh, double cell_size, TriangleMesh& out);
+
+
+// Decimates a mesh to at most max_triangles with ClusterVertices(). The first cell size is the one
+// that the mesh's area needs for the budget (if it were flat), and it's grown until the result fits.
+// Returns the cell size that was used, or 0 if the mesh was already within the budget (then out is
+// a copy of it).
+double DecimateMesh(const TriangleMesh& mesh, int max_triangles, TriangleMesh& out);
+
+
+}
+}
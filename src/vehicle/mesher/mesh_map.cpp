@@ -0,0 +1,448 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "mesher/mesh_map.hpp"
+
+namespace bm {
+namespace mesher {
+
+
+constexpr uid_t MeshMap::kNoLandmarkId;
+
+
+void MeshMap::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("cell_size", &cell_size);
+  parser.GetParam("merge_dist", &merge_dist);
+  parser.GetParam("max_range", &max_range);
+  parser.GetParam("max_weight", &max_weight);
+  parser.GetParam("lod_dist", &lod_dist);
+  parser.GetParam("lod_voxel_size", &lod_voxel_size);
+  parser.GetParam("max_vertices", &max_vertices);
+}
+
+
+static const Vector3i kFreeTriangle(-1, -1, -1);
+
+
+// Triangles are deduplicated regardless of their winding.
+static Vector3i SortedTriangle(uint32_t a, uint32_t b, uint32_t c)
+{
+  int v[3] = { (int)a, (int)b, (int)c };
+  std::sort(v, v + 3);
+  return Vector3i(v[0], v[1], v[2]);
+}
+
+
+MeshMap::MeshMap(const Params& params)
+    : params_(params)
+{
+  CHECK_GT(params_.cell_size, 0) << "MeshMap needs a positive cell size" << std::endl;
+  CHECK_GT(params_.merge_dist, 0);
+  CHECK_GT(params_.lod_voxel_size, params_.merge_dist)
+      << "Decimated cells should be coarser than the merge distance" << std::endl;
+  CHECK_GE(params_.max_weight, 1.0f);
+  CHECK_GT(params_.max_vertices, 0);
+}
+
+
+Vector3i MeshMap::Quantize(const Vector3d& world_t_point, double size) const
+{
+  return Vector3i((int)std::floor(world_t_point.x() / size),
+                  (int)std::floor(world_t_point.y() / size),
+                  (int)std::floor(world_t_point.z() / size));
+}
+
+
+Vector3d MeshMap::CellCenter(const Vector3i& cell) const
+{
+  return params_.cell_size * Vector3d(cell.x() + 0.5, cell.y() + 0.5, cell.z() + 0.5);
+}
+
+
+uint32_t MeshMap::AddVertex(const Vector3d& world_t_vertex, bool has_lmk_id, uid_t lmk_id)
+{
+  // Find the vertex that this one is another observation of.
+  int existing = -1;
+  const Vector3i key = Quantize(world_t_vertex, params_.merge_dist);
+
+  if (has_lmk_id) {
+    const auto it = lmk_to_vertex_.find(lmk_id);
+    if (it != lmk_to_vertex_.end()) {
+      // NOTE(milo): Landmark ids are only unique among live tracks, so if the "same" landmark shows
+      // up far away, it's really a new one that reused the id.
+      if ((vertices_.at(it->second).world_t_vertex - world_t_vertex).norm() < params_.cell_size) {
+        existing = (int)it->second;
+      } else {
+        vertices_.at(it->second).has_lmk_id = false;
+        lmk_to_vertex_.erase(it);
+      }
+    }
+  } else {
+    const auto it = voxel_to_vertex_.find(key);
+    if (it != voxel_to_vertex_.end()) {
+      existing = (int)it->second;
+    }
+  }
+
+  if (existing >= 0) {
+    Vertex& v = vertices_.at(existing);
+    v.world_t_vertex = (v.weight * v.world_t_vertex + world_t_vertex) / (v.weight + 1.0f);
+    v.weight = std::min(v.weight + 1.0f, params_.max_weight);
+    return (uint32_t)existing;
+  }
+
+  uint32_t index;
+  if (!free_vertices_.empty()) {
+    index = free_vertices_.back();
+    free_vertices_.pop_back();
+  } else {
+    index = (uint32_t)vertices_.size();
+    vertices_.emplace_back();
+  }
+
+  Vertex& v = vertices_.at(index);
+  v.world_t_vertex = world_t_vertex;
+  v.weight = 1.0f;
+  v.has_lmk_id = has_lmk_id;
+  v.lmk_id = lmk_id;
+  v.key = key;
+  v.cell = Quantize(world_t_vertex, params_.cell_size);
+  v.triangles.clear();
+
+  if (has_lmk_id) {
+    lmk_to_vertex_[lmk_id] = index;
+  } else {
+    voxel_to_vertex_[key] = index;
+  }
+
+  Cell& cell = cells_[v.cell];
+  cell.vertices.emplace_back(index);
+  cell.decimated = false;
+
+  ++num_vertices_;
+  return index;
+}
+
+
+void MeshMap::RemoveVertex(uint32_t index)
+{
+  Vertex& v = vertices_.at(index);
+  CHECK_GT(v.weight, 0) << "Tried to remove a free vertex" << std::endl;
+
+  if (v.has_lmk_id) {
+    const auto it = lmk_to_vertex_.find(v.lmk_id);
+    if (it != lmk_to_vertex_.end() && it->second == index) {
+      lmk_to_vertex_.erase(it);
+    }
+  } else {
+    const auto it = voxel_to_vertex_.find(v.key);
+    if (it != voxel_to_vertex_.end() && it->second == index) {
+      voxel_to_vertex_.erase(it);
+    }
+  }
+
+  v.weight = 0;
+  v.has_lmk_id = false;
+  v.triangles.clear();
+  free_vertices_.emplace_back(index);
+  --num_vertices_;
+}
+
+
+void MeshMap::AddTriangle(uint32_t a, uint32_t b, uint32_t c)
+{
+  if (a == b || b == c || a == c) {
+    return;
+  }
+
+  const Vector3i sorted = SortedTriangle(a, b, c);
+  if (triangle_index_.count(sorted) != 0) {
+    return;
+  }
+
+  uint32_t index;
+  if (!free_triangles_.empty()) {
+    index = free_triangles_.back();
+    free_triangles_.pop_back();
+  } else {
+    index = (uint32_t)triangles_.size();
+    triangles_.emplace_back();
+  }
+
+  triangles_.at(index) = Vector3i((int)a, (int)b, (int)c);
+  triangle_index_.emplace(sorted, index);
+  vertices_.at(a).triangles.emplace_back(index);
+  vertices_.at(b).triangles.emplace_back(index);
+  vertices_.at(c).triangles.emplace_back(index);
+  ++num_triangles_;
+}
+
+
+void MeshMap::RemoveTriangle(uint32_t t, uint32_t skip_vertex)
+{
+  const Vector3i tri = triangles_.at(t);
+  triangle_index_.erase(SortedTriangle(tri(0), tri(1), tri(2)));
+
+  for (int j = 0; j < 3; ++j) {
+    if ((uint32_t)tri(j) == skip_vertex) {
+      continue;
+    }
+    std::vector<uint32_t>& adj = vertices_.at(tri(j)).triangles;
+    adj.erase(std::remove(adj.begin(), adj.end(), t), adj.end());
+  }
+
+  triangles_.at(t) = kFreeTriangle;
+  free_triangles_.emplace_back(t);
+  --num_triangles_;
+}
+
+
+void MeshMap::DecimateCell(const Vector3i& cell_key)
+{
+  Cell& cell = cells_.at(cell_key);
+
+  // The first vertex in each voxel represents all of them.
+  std::unordered_map<Vector3i, uint32_t, Vector3iHash> clusters;
+  std::vector<uint32_t> kept;
+
+  for (const uint32_t v : cell.vertices) {
+    const auto it = clusters.emplace(Quantize(vertices_.at(v).world_t_vertex, params_.lod_voxel_size), v);
+    if (it.second) {
+      kept.emplace_back(v);
+      continue;
+    }
+
+    const uint32_t rep = it.first->second;
+    Vertex& r = vertices_.at(rep);
+    const Vertex& other = vertices_.at(v);
+    r.world_t_vertex = (r.weight * r.world_t_vertex + other.weight * other.world_t_vertex) / (r.weight + other.weight);
+    r.weight = std::min(r.weight + other.weight, params_.max_weight);
+
+    // Move the triangles of the merged vertex onto the representative. Ones that become degenerate,
+    // or duplicate a triangle that the representative already has, are removed.
+    const std::vector<uint32_t> other_triangles = other.triangles;
+    for (const uint32_t t : other_triangles) {
+      Vector3i tri = triangles_.at(t);
+      RemoveTriangle(t, v);
+      for (int j = 0; j < 3; ++j) {
+        if ((uint32_t)tri(j) == v) {
+          tri(j) = (int)rep;
+        }
+      }
+      AddTriangle(tri(0), tri(1), tri(2));
+    }
+
+    RemoveVertex(v);
+  }
+
+  cell.vertices = std::move(kept);
+  cell.decimated = true;
+}
+
+
+void MeshMap::UpdateLod(const Vector3d& world_t_cam)
+{
+  std::vector<std::pair<double, Vector3i>> candidates;
+
+  for (const auto& item : cells_) {
+    if (item.second.decimated || item.second.vertices.empty()) {
+      continue;
+    }
+    const double dist = (CellCenter(item.first) - world_t_cam).norm();
+    if (dist > params_.lod_dist) {
+      DecimateCell(item.first);
+    } else {
+      candidates.emplace_back(dist, item.first);
+    }
+  }
+
+  if ((int)num_vertices_ <= params_.max_vertices) {
+    return;
+  }
+
+  // Over budget: decimate the farthest cells first, even if they're close.
+  std::sort(candidates.begin(), candidates.end(),
+      [](const std::pair<double, Vector3i>& a, const std::pair<double, Vector3i>& b) { return a.first > b.first; });
+
+  for (const auto& item : candidates) {
+    DecimateCell(item.second);
+    if ((int)num_vertices_ <= params_.max_vertices) {
+      return;
+    }
+  }
+
+  LOG_EVERY_N(WARNING, 30) << "MeshMap has " << num_vertices_ << " vertices after decimating every cell (max_vertices="
+                           << params_.max_vertices << "), try a bigger lod_voxel_size" << std::endl;
+}
+
+
+void MeshMap::Integrate(const TriangleMesh& mesh, const SE3& world_T_cam)
+{
+  const bool has_ids = mesh.vertex_ids.size() == mesh.vertices.size();
+  const double max_range_sq = params_.max_range * params_.max_range;
+
+  std::lock_guard<std::mutex> lock(lock_);
+
+  // Map vertex for each mesh vertex, or -1 if it's out of range.
+  std::vector<int>& index = scratch_index_;
+  index.assign(mesh.vertices.size(), -1);
+
+  for (const Vector3i& tri : mesh.triangles) {
+    if (mesh.vertices.at(tri(0)).squaredNorm() > max_range_sq ||
+        mesh.vertices.at(tri(1)).squaredNorm() > max_range_sq ||
+        mesh.vertices.at(tri(2)).squaredNorm() > max_range_sq) {
+      continue;
+    }
+
+    uint32_t v[3];
+    for (int j = 0; j < 3; ++j) {
+      const int i = tri(j);
+      if (index.at(i) < 0) {
+        const Vector3d world_t_vertex = world_T_cam * mesh.vertices.at(i);
+        index.at(i) = (int)AddVertex(world_t_vertex, has_ids, has_ids ? mesh.vertex_ids.at(i) : 0);
+      }
+      v[j] = (uint32_t)index.at(i);
+    }
+
+    AddTriangle(v[0], v[1], v[2]);
+  }
+
+  UpdateLod(world_T_cam.translation());
+}
+
+
+bool MeshMap::WritePly(const std::string& path, size_t chunk_size) const
+{
+  CHECK_GT(chunk_size, 0ul);
+
+  std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    LOG(WARNING) << "Could not open " << path << " to write the mesh map" << std::endl;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+
+  out << "ply\n"
+      << "format binary_little_endian 1.0\n"
+      << "element vertex " << num_vertices_ << "\n"
+      << "property float x\n"
+      << "property float y\n"
+      << "property float z\n"
+      << "element face " << num_triangles_ << "\n"
+      << "property list uchar int vertex_indices\n"
+      << "end_header\n";
+
+  // NOTE(milo): Free slots are skipped, so vertices get new (contiguous) indices in the file.
+  std::vector<int32_t> remap(vertices_.size(), -1);
+  std::vector<char> buf;
+
+  const size_t vertex_bytes = 3 * sizeof(float);
+  buf.reserve(chunk_size * vertex_bytes);
+  int32_t next = 0;
+  for (size_t i = 0; i < vertices_.size(); ++i) {
+    const Vertex& v = vertices_.at(i);
+    if (v.weight <= 0) {
+      continue;
+    }
+    remap.at(i) = next++;
+
+    const float xyz[3] = { (float)v.world_t_vertex.x(), (float)v.world_t_vertex.y(), (float)v.world_t_vertex.z() };
+    const char* bytes = reinterpret_cast<const char*>(xyz);
+    buf.insert(buf.end(), bytes, bytes + vertex_bytes);
+
+    if (buf.size() >= chunk_size * vertex_bytes) {
+      out.write(buf.data(), buf.size());
+      buf.clear();
+    }
+  }
+  out.write(buf.data(), buf.size());
+  buf.clear();
+
+  const size_t face_bytes = 1 + 3 * sizeof(int32_t);
+  buf.reserve(chunk_size * face_bytes);
+  for (const Vector3i& tri : triangles_) {
+    if (tri(0) < 0) {
+      continue;
+    }
+    char face[face_bytes];
+    face[0] = 3;
+    const int32_t ids[3] = { remap.at(tri(0)), remap.at(tri(1)), remap.at(tri(2)) };
+    std::memcpy(face + 1, ids, sizeof(ids));
+    buf.insert(buf.end(), face, face + face_bytes);
+
+    if (buf.size() >= chunk_size * face_bytes) {
+      out.write(buf.data(), buf.size());
+      buf.clear();
+    }
+  }
+  out.write(buf.data(), buf.size());
+
+  return out.good();
+}
+
+
+TriangleMesh MeshMap::GetMesh(bool slot_ids) const
+{
+  std::lock_guard<std::mutex> lock(lock_);
+
+  TriangleMesh mesh;
+  mesh.vertices.reserve(num_vertices_);
+  mesh.vertex_ids.reserve(num_vertices_);
+  mesh.triangles.reserve(num_triangles_);
+
+  std::vector<int> remap(vertices_.size(), -1);
+  for (size_t i = 0; i < vertices_.size(); ++i) {
+    const Vertex& v = vertices_.at(i);
+    if (v.weight <= 0) {
+      continue;
+    }
+    remap.at(i) = (int)mesh.vertices.size();
+    mesh.vertices.emplace_back(v.world_t_vertex);
+    if (slot_ids) {
+      mesh.vertex_ids.emplace_back(static_cast<uid_t>(i));
+    } else {
+      mesh.vertex_ids.emplace_back(v.has_lmk_id ? v.lmk_id : kNoLandmarkId);
+    }
+  }
+
+  for (const Vector3i& tri : triangles_) {
+    if (tri(0) >= 0) {
+      mesh.triangles.emplace_back(remap.at(tri(0)), remap.at(tri(1)), remap.at(tri(2)));
+    }
+  }
+
+  return mesh;
+}
+
+
+size_t MeshMap::NumVertices() const
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  return num_vertices_;
+}
+
+
+size_t MeshMap::NumTriangles() const
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  return num_triangles_;
+}
+
+
+size_t MeshMap::NumCells() const
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  return cells_.size();
+}
+
+
+}
+}
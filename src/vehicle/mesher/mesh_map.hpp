@@ -0,0 +1,149 @@
+#pragma once
+
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/se3.hpp"
+#include "core/uid.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "mesher/triangle_mesh.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+
+// A persistent triangle mesh of everything that the mesher has seen, in the world frame. Each
+// per-frame TriangleMesh (in the camera frame) is merged in with the smoother's pose for it:
+//  - Vertices with a landmark id (TriangleMesh::vertex_ids) are matched to the map vertex for that
+//    landmark, and their position is averaged over observations. Vertices without one are merged if
+//    they fall in the same voxel of size merge_dist.
+//  - Triangles are deduplicated by their (map) vertices, and only ever added.
+//
+// Vertices are also bucketed into big spatial cells (cell_size). Cells farther than lod_dist from the
+// camera, or the farthest cells whenever there are more than max_vertices, are decimated by vertex
+// clustering: all of the vertices in each lod_voxel_size voxel collapse into one, and triangles that
+// become degenerate go away. This keeps the memory bounded on long missions, while the area around
+// the vehicle keeps its detail.
+//
+// NOTE(milo): A vertex stays in the cell that it was created in, even if later observations move it
+// across a cell boundary. All methods are threadsafe.
+class MeshMap final {
+ public:
+  // The vertex_id of map vertices that don't have a landmark (see GetMesh()).
+  static constexpr uid_t kNoLandmarkId = std::numeric_limits<uid_t>::max();
+
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double cell_size = 4.0;         // Side of a spatial cell (m). Decimation is decided per cell.
+    double merge_dist = 0.05;       // Merge vertices without landmark ids that are this close (m).
+    double max_range = 20.0;        // Ignore triangles with a vertex farther from the camera (m).
+    float max_weight = 10.0;        // Caps the averaging weight of a vertex, so that it can still move.
+    double lod_dist = 30.0;         // Decimate cells whose center is farther from the camera (m).
+    double lod_voxel_size = 0.5;    // Decimated cells keep one vertex per voxel of this size (m).
+    int max_vertices = 500000;      // Decimate the farthest cells until there are fewer vertices.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(MeshMap)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(MeshMap)
+
+  explicit MeshMap(const Params& params);
+
+  // Merges a mesh (vertices in the camera frame) into the map, then decimates far cells.
+  void Integrate(const TriangleMesh& mesh, const SE3& world_T_cam);
+
+  // Writes the map to a binary (little endian) PLY file. Vertices and faces are written chunk_size
+  // at a time through a small buffer, so the map is never copied. Integrate() waits until it's done.
+  // Returns false if the file couldn't be written.
+  bool WritePly(const std::string& path, size_t chunk_size = 65536) const;
+
+  // Copies out the whole map (with vertex_ids for vertices that have a landmark). If slot_ids, the
+  // vertex_ids are the vertices' slots in the map instead, which every vertex has, and which don't
+  // change until it's removed. That's what a MeshEncoder needs for maps of dense meshes.
+  TriangleMesh GetMesh(bool slot_ids = false) const;
+
+  size_t NumVertices() const;
+  size_t NumTriangles() const;
+  size_t NumCells() const;
+  const Params& GetParams() const { return params_; }
+
+ private:
+  struct Vertex final
+  {
+    Vector3d world_t_vertex;
+    float weight = 0;                 // Zero if this slot is free.
+    bool has_lmk_id = false;
+    uid_t lmk_id = 0;
+    Vector3i key;                     // The merge voxel (if no landmark id), for removing it.
+    Vector3i cell;
+    std::vector<uint32_t> triangles;  // Triangles that use this vertex.
+  };
+
+  struct Cell final
+  {
+    std::vector<uint32_t> vertices;
+    bool decimated = false;           // Set by decimation, cleared when vertices are added.
+  };
+
+  struct Vector3iHash final
+  {
+    size_t operator()(const Vector3i& b) const
+    {
+      // NOTE(milo): Same hash as DistanceMap::BlockHash (Teschner et al. 2003).
+      return static_cast<size_t>(b.x()) * 73856093 ^
+             static_cast<size_t>(b.y()) * 19349669 ^
+             static_cast<size_t>(b.z()) * 83492791;
+    }
+  };
+
+  typedef std::unordered_map<Vector3i, Cell, Vector3iHash> CellMap;
+
+  Vector3i Quantize(const Vector3d& world_t_point, double size) const;
+  Vector3d CellCenter(const Vector3i& cell) const;
+
+  // The rest must hold lock_.
+  uint32_t AddVertex(const Vector3d& world_t_vertex, bool has_lmk_id, uid_t lmk_id);
+  void RemoveVertex(uint32_t v);
+  void AddTriangle(uint32_t a, uint32_t b, uint32_t c);
+  void RemoveTriangle(uint32_t t, uint32_t skip_vertex);
+
+  // Collapses the vertices of a cell by vertex clustering.
+  void DecimateCell(const Vector3i& cell_key);
+  void UpdateLod(const Vector3d& world_t_cam);
+
+ private:
+  Params params_;
+
+  mutable std::mutex lock_;
+
+  // Free vertex and triangle slots are reused, so that indices stay stable.
+  std::vector<Vertex> vertices_;
+  std::vector<uint32_t> free_vertices_;
+  std::vector<Vector3i> triangles_;   // (-1, -1, -1) if the slot is free.
+  std::vector<uint32_t> free_triangles_;
+  size_t num_vertices_ = 0;
+  size_t num_triangles_ = 0;
+
+  std::unordered_map<uid_t, uint32_t> lmk_to_vertex_;
+  std::unordered_map<Vector3i, uint32_t, Vector3iHash> voxel_to_vertex_;
+  std::unordered_map<Vector3i, uint32_t, Vector3iHash> triangle_index_;   // Sorted vertices -> slot.
+  CellMap cells_;
+
+  std::vector<int> scratch_index_;
+};
+
+
+}
+}
@@ -7,11 +7,7 @@ namespace mesher {
 void PopulateGrid(const std::vector<Vector2i>& grid_cells, GridLookup<uid_t>& grid)
 {
   // NOTE(milo): For grid cells, 'y' is the row direction and 'x' is the column direction (like image).
-  for (uid_t i = 0; i < grid_cells.size(); ++i) {
-    const int grid_row = grid_cells.at(i).y();
-    const int grid_col = grid_cells.at(i).x();
-    grid.GetCellMutable(grid_row, grid_col).emplace_back(i);
-  }
+  grid.Build(grid_cells);
 }
 
 
@@ -13,8 +13,8 @@ namespace mesher {
 using namespace core;
 
 
-// Insert a list of things into a grid. Each grid cell will contain a list of indices that mapped
-// to that location.
+// Rebuild a grid from a list of things. Each grid cell will contain the indices that mapped to
+// that location.
 void PopulateGrid(const std::vector<Vector2i>& grid_cells, GridLookup<uid_t>& grid);
 
 
@@ -1,14 +1,18 @@
+#include <algorithm>
+
 #include <glog/logging.h>
 
 #include <opencv2/imgproc.hpp>
-#include <opencv2/highgui.hpp>
 
 #include "core/math_util.hpp"
+#include "core/task_scheduler.hpp"
 #include "core/timer.hpp"
 #include "feature_tracking/visualization_2d.hpp"
+#include "mesher/depth_completion.hpp"
 #include "mesher/neighbor_grid.hpp"
 #include "mesher/object_mesher.hpp"
 #include "vision_core/color_mapping.hpp"
+#include "vision_core/debug_viewer.hpp"
 #include "vision_core/image_util.hpp"
 
 namespace bm {
@@ -27,6 +31,17 @@ void ObjectMesher::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("vertex_min_obs", &vertex_min_obs);
   parser.GetParam("min_obs_connect_edge", &min_obs_connect_edge);
   parser.GetParam("min_obs_disconnect_edge", &min_obs_disconnect_edge);
+  parser.GetParam("edge_score_max_motion", &edge_score_max_motion);
+  parser.TryGetParam("edge_num_samples", &edge_num_samples);
+  parser.TryGetParam("edge_num_threads", &edge_num_threads);
+  parser.GetParam("vertex_max_motion", &vertex_max_motion);
+
+  parser.GetParam("dense_completion", &dense_completion);
+  parser.GetParam("completion_downsize", &completion_downsize);
+  parser.GetParam("completion_radius", &completion_radius);
+  parser.GetParam("completion_eps", &completion_eps);
+  parser.GetParam("completion_min_landmarks", &completion_min_landmarks);
+  parser.GetParam("completion_grid_step", &completion_grid_step);
 
   YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_cam_left, body_T_cam_right);
 }
@@ -65,99 +80,72 @@ void EstimateForegroundMask(const Image1b& gray,
 }
 
 
-void DrawDelaunay(int k,
-                  Image3b& img,
-                  cv::Subdiv2D& subdiv,
-                  const CoordinateMap<int>& vertex_lookup,
-                  const CoordinateMap<double>& vertex_disps,
-                  double min_disp = 0.5,
-                  double max_disp = 32.0)
+// Draw the triangles, colored by the disparity along each edge.
+static void DrawTriangles(Image3b& img,
+                          const std::vector<LmkTriangle>& triangles,
+                          const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                          const std::unordered_map<uid_t, double>& lmk_disps,
+                          double min_disp = 0.5,
+                          double max_disp = 32.0)
 {
-  std::vector<cv::Vec6f> triangle_list;
-  subdiv.getTriangleList(triangle_list);
   std::vector<cv::Point> pt(3);
 
-  const cv::Size size = img.size();
-  cv::Rect rect(0,0, size.width, size.height);
-
-  // const double disp_range = max_disp - min_disp;
-
-  for (size_t i = 0; i < triangle_list.size(); ++i) {
-    const cv::Vec6f& t = triangle_list.at(i);
-    pt[0] = cv::Point(t[0], t[1]);
-    pt[1] = cv::Point(t[2], t[3]);
-    pt[2] = cv::Point(t[4], t[5]);
-
-    if (rect.contains(pt[0]) && rect.contains(pt[1]) && rect.contains(pt[2])) {
-      const int v0 = vertex_lookup.At((int)pt[0].x, (int)pt[0].y);
-      const int v1 = vertex_lookup.At((int)pt[1].x, (int)pt[1].y);
-      const int v2 = vertex_lookup.At((int)pt[2].x, (int)pt[2].y);
-
-      const std::vector<double> disps = {
-        0.5*vertex_disps.At(k, v0) + 0.5*vertex_disps.At(k, v1),
-        0.5*vertex_disps.At(k, v1) + 0.5*vertex_disps.At(k, v2),
-        0.5*vertex_disps.At(k, v2) + 0.5*vertex_disps.At(k, v0)
-      };
-
-      const std::vector<cv::Vec3b> colors = ColormapVector(
-          disps, min_disp, max_disp, cv::COLORMAP_PARULA);
-      cv::line(img, pt[0], pt[1], colors.at(0), 1, CV_AA, 0);
-	    cv::line(img, pt[1], pt[2], colors.at(1), 1, CV_AA, 0);
-	    cv::line(img, pt[2], pt[0], colors.at(2), 1, CV_AA, 0);
-    }
+  for (const LmkTriangle& t : triangles) {
+    pt[0] = lmk_points.at(t[0]);
+    pt[1] = lmk_points.at(t[1]);
+    pt[2] = lmk_points.at(t[2]);
+
+    const std::vector<double> disps = {
+      0.5*lmk_disps.at(t[0]) + 0.5*lmk_disps.at(t[1]),
+      0.5*lmk_disps.at(t[1]) + 0.5*lmk_disps.at(t[2]),
+      0.5*lmk_disps.at(t[2]) + 0.5*lmk_disps.at(t[0])
+    };
+
+    const std::vector<cv::Vec3b> colors = ColormapVector(
+        disps, min_disp, max_disp, cv::COLORMAP_PARULA);
+    cv::line(img, pt[0], pt[1], colors.at(0), 1, CV_AA, 0);
+    cv::line(img, pt[1], pt[2], colors.at(1), 1, CV_AA, 0);
+    cv::line(img, pt[2], pt[0], colors.at(2), 1, CV_AA, 0);
   }
 }
 
 
+// Add the triangles from one cluster to the mesh. Each landmark becomes one vertex, which is shared
+// by all of the triangles that use it.
 static void BuildTriangleMesh(TriangleMesh& mesh,
-                              int k,
-                              cv::Subdiv2D& subdiv,
-                              const CoordinateMap<int>& vertex_lookup,
-                              const CoordinateMap<double>& vertex_disps,
+                              const std::vector<LmkTriangle>& triangles,
+                              const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                              const std::unordered_map<uid_t, double>& lmk_disps,
                               const StereoCamera& stereo_rig,
-                              double scale_factor)
+                              double scale_factor,
+                              std::unordered_map<uid_t, int>& vertex_index)
 {
-  const size_t vertices_offset = mesh.vertices.size();
-
-  std::vector<cv::Vec6f> triangle_list;
-  subdiv.getTriangleList(triangle_list);
-
-  cv::Rect rect(0,0, scale_factor * (double)stereo_rig.Width(), scale_factor * (double)stereo_rig.Height());
-
-  size_t num_triangles_added = 0;
+  vertex_index.clear();
 
-  for (size_t i = 0; i < triangle_list.size(); ++i) {
-    const cv::Vec6f& t = triangle_list.at(i);
-
-    std::vector<cv::Point> pt(3);
-    pt[0] = cv::Point(t[0], t[1]);
-    pt[1] = cv::Point(t[2], t[3]);
-    pt[2] = cv::Point(t[4], t[5]);
-
-    if (!rect.contains(pt[0]) || !rect.contains(pt[1]) || !rect.contains(pt[2])) {
-      continue;
-    }
+  for (const LmkTriangle& t : triangles) {
+    Vector3i tri;
 
-    // Add all 3 vertices.
     for (size_t j = 0; j < 3; ++j) {
-      const int vidx = vertex_lookup.At((int)t[2*j], (int)t[2*j+1]);
-      const double disp = vertex_disps.At(k, vidx);
+      const auto it = vertex_index.find(t[j]);
+      if (it != vertex_index.end()) {
+        tri(j) = it->second;
+        continue;
+      }
 
       // NOTE(milo): Backproject pixels at the ORIGINAL image resolution, which requires us to
       // scale pixel locations and disparity.
+      const cv::Point2f& pt = lmk_points.at(t[j]);
       const Vector3d vert = stereo_rig.LeftCamera().Backproject(
-        Vector2d(t[2*j], t[2*j+1]) / scale_factor,
-        stereo_rig.DispToDepth(disp / scale_factor));
+        Vector2d(pt.x, pt.y) / scale_factor,
+        stereo_rig.DispToDepth(lmk_disps.at(t[j]) / scale_factor));
+
+      tri(j) = (int)mesh.vertices.size();
+      vertex_index.emplace(t[j], tri(j));
       mesh.vertices.emplace_back(vert);
+      mesh.vertex_ids.emplace_back(t[j]);
     }
 
-    // Create a new triangle in the mesh.
-    mesh.triangles.emplace_back(Vector3i(
-        vertices_offset + 3*num_triangles_added + 0,
-        vertices_offset + 3*num_triangles_added + 1,
-        vertices_offset + 3*num_triangles_added + 2));
-
-    ++num_triangles_added;
+    mesh.triangles.emplace_back(tri);
   }
 }
 
@@ -180,31 +168,208 @@ static void CountEdgePixels(const cv::Point2f& a,
 }
 
 
-TriangleMesh ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair, bool visualize)
+// Counts how many of num_samples evenly spaced points from a to b (both included) are foreground.
+// NOTE(milo): The sample coordinates are computed in one tight loop that the compiler vectorizes,
+// and then looked up in the mask. Unlike walking the line, the cost doesn't depend on its length.
+static int SampleEdgePixels(const cv::Point2f& a,
+                            const cv::Point2f& b,
+                            const Image1b& mask,
+                            int num_samples,
+                            std::vector<int>& offsets)
 {
-  const Image1b& iml = stereo_pair.left_image;
-  const int img_height = iml.rows;
+  offsets.resize(num_samples);
+
+  const float step = 1.0f / static_cast<float>(std::max(1, num_samples - 1));
+  const float dx = b.x - a.x;
+  const float dy = b.y - a.y;
+  const float max_x = static_cast<float>(mask.cols - 1);
+  const float max_y = static_cast<float>(mask.rows - 1);
+  const int row_step = static_cast<int>(mask.step1());
+
+  for (int i = 0; i < num_samples; ++i) {
+    const float t = step * static_cast<float>(i);
+    const float x = std::min(max_x, std::max(0.0f, a.x + t * dx)) + 0.5f;
+    const float y = std::min(max_y, std::max(0.0f, a.y + t * dy)) + 0.5f;
+    offsets[i] = static_cast<int>(y) * row_step + static_cast<int>(x);
+  }
+
+  const uint8_t* data = mask.ptr<uint8_t>(0);
+  int edge_sum = 0;
+  for (int i = 0; i < num_samples; ++i) {
+    edge_sum += data[offsets[i]] > 0 ? 1 : 0;
+  }
+
+  return edge_sum;
+}
+
+
+void ObjectMesher::ScoreEdges(const std::vector<LmkPair>& edges,
+                              const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                              const Image1b& mask,
+                              uid_t camera_id,
+                              std::vector<float>& fgd_percent)
+{
+  fgd_percent.resize(edges.size());
+
+  // NOTE(milo): The mask changes a little bit every frame, but if the endpoints of an edge haven't
+  // moved, the texture underneath it is (almost) the same. Walking the line is the expensive part.
+  std::vector<size_t> to_score;
+  for (size_t k = 0; k < edges.size(); ++k) {
+    const cv::Point2f& pt_lo = lmk_points.at(edges[k].first);
+    const cv::Point2f& pt_hi = lmk_points.at(edges[k].second);
+
+    auto it = edge_scores_.find(edges[k]);
+    if (it != edge_scores_.end() &&
+        cv::norm(it->second.pt_lo - pt_lo) <= params_.edge_score_max_motion &&
+        cv::norm(it->second.pt_hi - pt_hi) <= params_.edge_score_max_motion) {
+      it->second.camera_id = camera_id;
+      fgd_percent[k] = it->second.fgd_percent;
+    } else {
+      to_score.emplace_back(k);
+    }
+  }
+
+  // Each task scores a block of edges, since one edge is too little work to hand to a worker.
+  const int block_size = 64;
+  const int num_blocks = (int)((to_score.size() + block_size - 1) / block_size);
+
+  TaskScheduler::Instance().ParallelFor(TaskPriority::FRONTEND, num_blocks, [&](int b) {
+    std::vector<int> offsets;
+    const size_t end = std::min(to_score.size(), (size_t)(b + 1) * block_size);
+    for (size_t n = (size_t)b * block_size; n < end; ++n) {
+      const size_t k = to_score[n];
+      const cv::Point2f& pt_lo = lmk_points.at(edges[k].first);
+      const cv::Point2f& pt_hi = lmk_points.at(edges[k].second);
+
+      int edge_length = params_.edge_num_samples;
+      int edge_sum = 0;
+      if (params_.edge_num_samples > 0) {
+        edge_sum = SampleEdgePixels(pt_lo, pt_hi, mask, params_.edge_num_samples, offsets);
+      } else {
+        CountEdgePixels(pt_lo, pt_hi, mask, edge_sum, edge_length);
+      }
+      fgd_percent[k] = static_cast<float>(edge_sum) / static_cast<float>(edge_length);
+    }
+  }, params_.edge_num_threads);
+
+  for (const size_t k : to_score) {
+    edge_scores_[edges[k]] = EdgeScore{ lmk_points.at(edges[k].first),
+                                        lmk_points.at(edges[k].second),
+                                        fgd_percent[k], camera_id };
+  }
+}
+
 
-  const double scale_factor = static_cast<double>(img_height) / static_cast<double>(params_.stereo_rig.Height());
+void ObjectMesher::UpdateClusterMeshes(const LmkClusters& clusters,
+                                       const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                                       const cv::Size& image_size)
+{
+  // Points have to be inside of the rectangle that a triangulation was made for.
+  if (image_size != mesh_image_size_) {
+    cluster_meshes_.clear();
+    lmk_to_mesh_.clear();
+    mesh_image_size_ = image_size;
+  }
+
+  // There may be landmarks in the graph that we didn't observe in the current frame. In this
+  // case, skip them.
+  std::vector<std::pair<const LmkSet*, std::vector<uid_t>>> observed;
+  for (const LmkSet& cluster : clusters) {
+    if (cluster.size() < 3) {
+      continue;
+    }
+    std::vector<uid_t> members;
+    for (const uid_t lmk_id : cluster) {
+      if (lmk_points.count(lmk_id) != 0) {
+        members.emplace_back(lmk_id);
+      }
+    }
+    if (members.size() >= 3) {
+      observed.emplace_back(&cluster, std::move(members));
+    }
+  }
+
+  // Bigger clusters get first pick of the previous triangulations.
+  std::sort(observed.begin(), observed.end(),
+      [](const std::pair<const LmkSet*, std::vector<uid_t>>& a,
+         const std::pair<const LmkSet*, std::vector<uid_t>>& b) { return a.second.size() > b.second.size(); });
+
+  std::vector<std::unique_ptr<IncrementalDelaunay>> meshes;
+  std::vector<bool> claimed(cluster_meshes_.size(), false);
+
+  for (const auto& item : observed) {
+    const LmkSet& cluster = *item.first;
+    const std::vector<uid_t>& members = item.second;
+
+    // Reuse the (unclaimed) triangulation that has the most landmarks from this cluster.
+    std::unordered_map<size_t, size_t> votes;
+    for (const uid_t lmk_id : members) {
+      const auto it = lmk_to_mesh_.find(lmk_id);
+      if (it != lmk_to_mesh_.end() && !claimed.at(it->second)) {
+        ++votes[it->second];
+      }
+    }
+
+    size_t best = cluster_meshes_.size();
+    size_t best_votes = 0;
+    for (const auto& vote : votes) {
+      if (vote.second > best_votes) {
+        best = vote.first;
+        best_votes = vote.second;
+      }
+    }
 
+    std::unique_ptr<IncrementalDelaunay> mesh;
+    if (best < cluster_meshes_.size()) {
+      mesh = std::move(cluster_meshes_.at(best));
+      claimed.at(best) = true;
+    } else {
+      mesh.reset(new IncrementalDelaunay(image_size.width, image_size.height));
+    }
+
+    for (const uid_t lmk_id : mesh->LandmarkIds()) {
+      if (cluster.count(lmk_id) == 0 || lmk_points.count(lmk_id) == 0) {
+        mesh->Remove(lmk_id);
+      }
+    }
+
+    // NOTE(milo): Landmarks that have only moved a little keep their place in the triangulation,
+    // so small tracking jitter doesn't cost anything. Duplicate points aren't meshed.
+    for (const uid_t lmk_id : members) {
+      const cv::Point2f& pt = lmk_points.at(lmk_id);
+      const Vector2d p(pt.x, pt.y);
+      if (!mesh->Has(lmk_id)) {
+        mesh->Insert(lmk_id, p);
+      } else if ((mesh->Point(lmk_id) - p).norm() > params_.vertex_max_motion) {
+        mesh->Move(lmk_id, p);
+      }
+    }
+
+    meshes.emplace_back(std::move(mesh));
+  }
+
+  cluster_meshes_ = std::move(meshes);
+
+  lmk_to_mesh_.clear();
+  for (size_t k = 0; k < cluster_meshes_.size(); ++k) {
+    for (const uid_t lmk_id : cluster_meshes_.at(k)->LandmarkIds()) {
+      lmk_to_mesh_.emplace(lmk_id, k);
+    }
+  }
+}
+
+
+const TriangleMesh& ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair, bool visualize)
+{
   Timer timer(true);
   tracker_.TrackAndTriangulate(stereo_pair, false);
   // LOG(INFO) << "TrackAndTriangulate: " << timer.Tock().milliseconds() << std::endl;
 
   if (visualize) {
-    const Image3b& viz_tracks = tracker_.VisualizeFeatureTracks();
-    cv::imshow("Visual Navigation (Feature Tracking)", viz_tracks);
+    DebugViewer::Instance().Show("Visual Navigation (Feature Tracking)", tracker_.VisualizeFeatureTracks().clone());
   }
 
-  Image1b foreground_mask;
-  EstimateForegroundMask(iml, foreground_mask, params_.foreground_ksize, params_.foreground_min_gradient, 4);
-
-  if (visualize) cv::imshow("Foreground Mask", foreground_mask);
-
-  // Build a keypoint graph.
   std::vector<uid_t> lmk_ids;
-  std::vector<cv::Point2f> lmk_points_list;
-
   std::unordered_map<uid_t, cv::Point2f> lmk_points;
   std::unordered_map<uid_t, double> lmk_disps;
 
@@ -213,14 +378,14 @@ TriangleMesh ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair, bool
   // Delete any dead landmarks from the graph.
   const LmkSet graph_lmk_ids = graph_.GetLandmarkIds();
   for (uid_t lmk_id : graph_lmk_ids) {
-    if (live_tracks.count(lmk_id) == 0) {
+    if (!live_tracks.Has(lmk_id)) {
       graph_.RemoveLandmark(lmk_id);
     }
   }
 
-  for (auto it = live_tracks.begin(); it != live_tracks.end(); ++it) {
-    const uid_t lmk_id = it->first;
-    const LandmarkObservation& lmk_obs = it->second.back();
+  for (const FeatureTracks::Track& track : live_tracks) {
+    const uid_t lmk_id = track.lmk_id;
+    const LandmarkObservation& lmk_obs = track.observations.back();
 
     // Skip observations from previous frames.
     if (lmk_obs.camera_id < (stereo_pair.camera_id - params_.tracker_params.retrack_frames_k)) {
@@ -229,119 +394,228 @@ TriangleMesh ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair, bool
 
     // Only add vertex if it's been tracked for >= vertex_min_obs frames.
     // The initial detection counts as 1 observation.
-    if ((int)it->second.size() < params_.vertex_min_obs) {
+    if ((int)track.observations.size() < params_.vertex_min_obs) {
       continue;
     }
 
-    lmk_points_list.emplace_back(lmk_obs.pixel_location);
     lmk_points.emplace(lmk_id, lmk_obs.pixel_location);
     lmk_disps.emplace(lmk_id, lmk_obs.disparity);
     lmk_ids.emplace_back(lmk_id);
   }
 
+  return UpdateMesh(stereo_pair, lmk_ids, lmk_points, lmk_disps, visualize);
+}
+
+
+const TriangleMesh& ObjectMesher::ProcessTracks(const StereoImage1b& stereo_pair,
+                                                const LandmarkObservationBatch& tracks,
+                                                const cv::Size& tracks_image_size,
+                                                bool visualize)
+{
+  CHECK_GT(tracks_image_size.height, 0) << "Need the size of the image that the tracks came from" << std::endl;
+
+  // NOTE(milo): The tracks are usually from the full size image, but the mesher may be running on
+  // a downsized one. Pixel locations and disparities both scale with the image.
+  const float tracks_scale = static_cast<float>(stereo_pair.left_image.rows) /
+                             static_cast<float>(tracks_image_size.height);
+
+  std::vector<uid_t> lmk_ids;
+  std::unordered_map<uid_t, cv::Point2f> lmk_points;
+  std::unordered_map<uid_t, double> lmk_disps;
+
+  // Count how many frames in a row each landmark has been observed, since the batch only has the
+  // current observations.
+  std::unordered_map<uid_t, int> num_obs;
+  num_obs.reserve(tracks.Size());
+  for (size_t i = 0; i < tracks.Size(); ++i) {
+    const uid_t lmk_id = tracks.landmark_id[i];
+    const auto it = track_num_obs_.find(lmk_id);
+    num_obs.emplace(lmk_id, it != track_num_obs_.end() ? it->second + 1 : 1);
+  }
+  track_num_obs_ = std::move(num_obs);
+
+  // Delete any landmarks that weren't observed in this frame from the graph.
+  const LmkSet graph_lmk_ids = graph_.GetLandmarkIds();
+  for (uid_t lmk_id : graph_lmk_ids) {
+    if (track_num_obs_.count(lmk_id) == 0) {
+      graph_.RemoveLandmark(lmk_id);
+    }
+  }
+
+  for (size_t i = 0; i < tracks.Size(); ++i) {
+    const uid_t lmk_id = tracks.landmark_id[i];
+    if (track_num_obs_.at(lmk_id) < params_.vertex_min_obs) {
+      continue;
+    }
+    lmk_points.emplace(lmk_id, tracks.pixel_location[i] * tracks_scale);
+    lmk_disps.emplace(lmk_id, tracks.disparity[i] * tracks_scale);
+    lmk_ids.emplace_back(lmk_id);
+  }
+
+  return UpdateMesh(stereo_pair, lmk_ids, lmk_points, lmk_disps, visualize);
+}
+
+
+const TriangleMesh& ObjectMesher::UpdateMesh(const StereoImage1b& stereo_pair,
+                                             const std::vector<uid_t>& lmk_ids,
+                                             const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                                             const std::unordered_map<uid_t, double>& lmk_disps,
+                                             bool visualize)
+{
+  const Image1b& iml = stereo_pair.left_image;
+  const uid_t camera_id = stereo_pair.camera_id;
+  const double scale_factor = static_cast<double>(iml.rows) / static_cast<double>(params_.stereo_rig.Height());
+
+  const std::string mask_key = FrameCacheKey("mesher::ForegroundMask", "left",
+      params_.foreground_ksize, params_.foreground_min_gradient, 4);
+  const std::shared_ptr<const Image1b> mask_ptr = stereo_pair.cache->Get<Image1b>(mask_key, [&](Image1b& mask) {
+    EstimateForegroundMask(iml, mask, params_.foreground_ksize, params_.foreground_min_gradient, 4);
+  });
+  const Image1b& foreground_mask = *mask_ptr;
+
+  if (visualize) DebugViewer::Instance().Show("Foreground Mask", foreground_mask);
+
+  if (params_.dense_completion) {
+    return CompleteMesh(iml, foreground_mask, lmk_ids, lmk_points, lmk_disps, visualize);
+  }
+
+  // Build a keypoint graph.
+  std::vector<cv::Point2f> lmk_points_list;
+  lmk_points_list.reserve(lmk_ids.size());
+  for (const uid_t lmk_id : lmk_ids) {
+    lmk_points_list.emplace_back(lmk_points.at(lmk_id));
+  }
+
   // Map all of the features into the coarse grid so that we can find NNs.
-  lmk_grid_.Clear();
   const std::vector<Vector2i> lmk_cells = MapToGridCells(
       lmk_points_list,
       iml.rows, iml.cols,
       lmk_grid_.Rows(), lmk_grid_.Cols());
 
-  timer.Reset();
   PopulateGrid(lmk_cells, lmk_grid_);
 
+  // Find each pair of nearby landmarks once. Grid neighborhoods are symmetric, so (i, j) with j > i
+  // covers all of them.
+  std::vector<LmkPair> edges;
   for (size_t i = 0; i < lmk_ids.size(); ++i) {
     const uid_t lmk_i = lmk_ids.at(i);
     const Vector2i lmk_cell = lmk_cells.at(i);
     const core::Box2i roi(lmk_cell - Vector2i(1, 1), lmk_cell + Vector2i(1, 1));
-    const std::list<uid_t>& roi_indices = lmk_grid_.GetRoi(roi);
-
-    // Add a graph edge to all other landmarks nearby.
-    for (uid_t j : roi_indices) {
-      if (i == j) { continue; }
-
-      bool add_edge_ij = true;
 
+    lmk_grid_.ForEachInRoi(roi, [&](uid_t j) {
+      if (j <= i) { return; }
       const uid_t lmk_j = lmk_ids.at(j);
+      edges.emplace_back(std::min(lmk_i, lmk_j), std::max(lmk_i, lmk_j));
+    });
+  }
 
-      // Only add edge if the vertices are within some 3D distance from each other.
-      const double depth_i = params_.stereo_rig.DispToDepth(lmk_disps.at(lmk_i) / scale_factor);
-      const double depth_j = params_.stereo_rig.DispToDepth(lmk_disps.at(lmk_j) / scale_factor);
-      if (std::fabs(depth_i - depth_j) > params_.edge_max_depth_change) {
-        add_edge_ij = false;
-      }
-
-      // Only add an edge to the graph if it has texture (an object) underneath it.
-      int edge_length = 0;
-      int edge_sum = 0;
-      CountEdgePixels(lmk_points.at(lmk_i), lmk_points.at(lmk_j), foreground_mask, edge_sum, edge_length);
-      const float fgd_percent = static_cast<float>(edge_sum) / static_cast<float>(edge_length);
-      if (fgd_percent < params_.edge_min_foreground_percent) {
-        add_edge_ij = false;
-      }
-      // If we keep observing an edge, its observations will saturate at max_weight.
-      // If an edge is observed min_obs_connect_edge times in a row, then it's added to the subgraph.
-      // Then, if we don't observe for min_obs_disconnect_edge, the edge is deleted from the subgraph.
-      const float min_weight = 0.0f;
-      const float max_weight = params_.min_obs_connect_edge + params_.min_obs_disconnect_edge;
-      const float min_subgraph_weight = params_.min_obs_connect_edge;
-      graph_.UpdateEdge(lmk_i, lmk_j, add_edge_ij ? 1.0f : -1.0f, min_weight, max_weight);
+  // Only edges between vertices that are within some 3D distance of each other can be added, so
+  // only those need a foreground score.
+  std::vector<LmkPair> near_edges;
+  std::vector<int> near_index(edges.size(), -1);
+  for (size_t k = 0; k < edges.size(); ++k) {
+    const double depth_lo = params_.stereo_rig.DispToDepth(lmk_disps.at(edges[k].first) / scale_factor);
+    const double depth_hi = params_.stereo_rig.DispToDepth(lmk_disps.at(edges[k].second) / scale_factor);
+    if (std::fabs(depth_lo - depth_hi) <= params_.edge_max_depth_change) {
+      near_index[k] = (int)near_edges.size();
+      near_edges.emplace_back(edges[k]);
     }
   }
 
-  TriangleMesh mesh;
-
-  if (graph_.GraphSize() > 0) {
-    const LmkClusters clusters = graph_.GetClusters(params_.min_obs_connect_edge);
-
-    std::vector<cv::Subdiv2D> subdivs;
-
-    CoordinateMap<uid_t> vertex_id_to_lmk_id;
-    CoordinateMap<double> vertex_disps;
-    MultiCoordinateMap vertex_lookup;
-
-    size_t c = 0;
-    for (const LmkSet& cluster : clusters) {
-      if (cluster.size() < 3) {
-        continue;
-      }
+  // Only add an edge to the graph if it has texture (an object) underneath it.
+  std::vector<float> fgd_percent;
+  ScoreEdges(near_edges, lmk_points, foreground_mask, camera_id, fgd_percent);
+
+  // If we keep observing an edge, its observations will saturate at max_weight.
+  // If an edge is observed min_obs_connect_edge times in a row, then it's added to the subgraph.
+  // Then, if we don't observe for min_obs_disconnect_edge, the edge is deleted from the subgraph.
+  std::vector<LandmarkGraph::EdgeUpdate> updates(edges.size());
+  for (size_t k = 0; k < edges.size(); ++k) {
+    const bool add_edge = near_index[k] >= 0 &&
+                          fgd_percent[near_index[k]] >= params_.edge_min_foreground_percent;
+    updates[k] = LandmarkGraph::EdgeUpdate{ edges[k].first, edges[k].second, add_edge ? 1.0f : -1.0f };
+  }
 
-      subdivs.emplace_back(cv::Rect(0, 0, iml.cols, iml.rows));
+  const float min_weight = 0.0f;
+  const float max_weight = params_.min_obs_connect_edge + params_.min_obs_disconnect_edge;
+  graph_.UpdateEdges(updates, min_weight, max_weight);
 
-      for (const uid_t lmk_id : cluster) {
-        // There may be landmarks in the graph that we didn't observe in the current frame. In this
-        // case, skip them.
-        if (lmk_points.count(lmk_id) == 0) {
-          continue;
-        }
+  // Forget the scores of edges that weren't checked this frame.
+  for (auto it = edge_scores_.begin(); it != edge_scores_.end();) {
+    if (it->second.camera_id != camera_id) {
+      it = edge_scores_.erase(it);
+    } else {
+      ++it;
+    }
+  }
 
-        const cv::Point2f lmk_pt = lmk_points.at(lmk_id);
-        const int vertex_id = subdivs.back().insert(lmk_pt);
-        vertex_lookup[(int)c].Insert((int)lmk_pt.x, (int)lmk_pt.y, vertex_id);
-        vertex_id_to_lmk_id.Insert(c, vertex_id, lmk_id);
-        vertex_disps.Insert(c, vertex_id, lmk_disps.at(lmk_id));
-      }
+  // NOTE(milo): Clear the mesh but keep its buffers, since it's about the same size every frame.
+  mesh_.vertices.clear();
+  mesh_.triangles.clear();
+  mesh_.vertex_ids.clear();
 
-      ++c;
-    }
+  if (graph_.GraphSize() > 0) {
+    const LmkClusters& clusters = graph_.GetClusters(params_.min_obs_connect_edge);
+    UpdateClusterMeshes(clusters, lmk_points, iml.size());
 
     // Draw the output triangles.
     cv::Mat3b viz_triangles;
 
     if (visualize) cv::cvtColor(iml, viz_triangles, cv::COLOR_GRAY2BGR);
 
-    for (size_t k = 0; k < subdivs.size(); ++k) {
-      if (visualize) DrawDelaunay(k, viz_triangles, subdivs.at(k), vertex_lookup.at(k), vertex_disps);
-      BuildTriangleMesh(mesh, k, subdivs.at(k), vertex_lookup.at(k), vertex_disps, params_.stereo_rig, scale_factor);
+    std::vector<LmkTriangle> triangles;
+    std::unordered_map<uid_t, int> vertex_index;
+
+    for (const std::unique_ptr<IncrementalDelaunay>& cluster_mesh : cluster_meshes_) {
+      cluster_mesh->GetTriangles(triangles);
+      if (visualize) DrawTriangles(viz_triangles, triangles, lmk_points, lmk_disps);
+      BuildTriangleMesh(mesh_, triangles, lmk_points, lmk_disps, params_.stereo_rig, scale_factor, vertex_index);
     }
 
     if (visualize) {
-      cv::imshow("Obstacle Avoidance (Object Meshing)", viz_triangles);
+      DebugViewer::Instance().Show("Obstacle Avoidance (Object Meshing)", viz_triangles);
     }
   }
 
-  if (visualize) cv::waitKey(1);
+  return mesh_;
+}
+
+
+const TriangleMesh& ObjectMesher::CompleteMesh(const Image1b& iml,
+                                               const Image1b& foreground_mask,
+                                               const std::vector<uid_t>& lmk_ids,
+                                               const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                                               const std::unordered_map<uid_t, double>& lmk_disps,
+                                               bool visualize)
+{
+  std::vector<cv::Point2f> points;
+  std::vector<double> disps;
+  points.reserve(lmk_ids.size());
+  disps.reserve(lmk_ids.size());
+  for (const uid_t lmk_id : lmk_ids) {
+    points.emplace_back(lmk_points.at(lmk_id));
+    disps.emplace_back(lmk_disps.at(lmk_id));
+  }
+
+  Image1f disp;
+  CompleteDisparity(iml, foreground_mask, points, disps,
+                    params_.completion_downsize, params_.completion_radius, params_.completion_eps,
+                    params_.completion_min_landmarks, disp);
+
+  // Anything closer than the max depth has a disparity well above this.
+  const double min_disp = 1e-3;
+  MeshFromDisparity(disp, params_.stereo_rig, params_.completion_grid_step, min_disp,
+                    params_.tracker_params.stereo_max_depth, params_.edge_max_depth_change, mesh_);
+
+  if (visualize) {
+    Image1b disp8;
+    disp.convertTo(disp8, CV_8UC1, 255.0 * params_.completion_downsize / 32.0);
+    Image3b viz;
+    cv::applyColorMap(disp8, viz, cv::COLORMAP_PARULA);
+    DebugViewer::Instance().Show("Completed Disparity", viz);
+  }
 
-  return mesh;
+  return mesh_;
 }
 
 
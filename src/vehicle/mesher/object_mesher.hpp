@@ -1,6 +1,9 @@
 #pragma once
 
+#include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <opencv2/imgproc.hpp>
 
@@ -15,7 +18,9 @@
 #include "vision_core/landmark_observation.hpp"
 #include "feature_tracking/stereo_tracker.hpp"
 #include "mesher/triangle_mesh.hpp"
+#include "mesher/coordinate_map.hpp"
 #include "mesher/landmark_graph.hpp"
+#include "mesher/delaunay.hpp"
 
 namespace bm {
 namespace mesher {
@@ -24,41 +29,6 @@ using namespace core;
 using namespace ft;
 
 
-template <typename Data>
-class CoordinateMap final {
- public:
-  typedef std::unordered_map<int, std::unordered_map<int, Data>> MapType;
-
-  void Insert(int x, int y, const Data& data)
-  {
-    if (map_.count(x) == 0) {
-      map_.emplace(x, std::unordered_map<int, Data>());
-    }
-    map_.at(x).emplace(y, data);
-  }
-
-  void Insert(const Vector2i coord, const Data& data)
-  {
-    Insert(coord.x, coord.y, data);
-  }
-
-  Data At(int x, int y) const
-  {
-    return map_.at(x).at(y);
-  }
-
-  Data At(const Vector2i& coord) const
-  {
-    return At(coord.x, coord.y);
-  }
-
- private:
-  MapType map_;
-};
-
-typedef std::unordered_map<int, CoordinateMap<int>> MultiCoordinateMap;
-
-
 // Persist any data about tracked vertices here.
 struct VertexData final
 {
@@ -78,9 +48,6 @@ void EstimateForegroundMask(const Image1b& gray,
                             double min_grad = 35.0,
                             int downsize = 2);
 
-// Draw all triangles in the subdivision.
-void DrawDelaunay(Image3b& img, cv::Subdiv2D& subdiv, cv::Scalar color);
-
 
 class ObjectMesher final {
  public:
@@ -103,6 +70,28 @@ class ObjectMesher final {
     float min_obs_disconnect_edge = 3.0;
     int vertex_min_obs = 1;
 
+    // Reuse the foreground score of an edge if neither landmark has moved more than this (px).
+    float edge_score_max_motion = 1.0;
+
+    // Score an edge from this many evenly spaced points along it, instead of every pixel (if 0).
+    int edge_num_samples = 0;
+
+    // Workers that help with scoring edges (all of them if < 0).
+    int edge_num_threads = -1;
+
+    // Re-triangulate a landmark once it has moved more than this (px) from where it was inserted.
+    float vertex_max_motion = 2.0;
+
+    // Instead of triangulating the landmarks, densify their disparities with a guided filter (see
+    // CompleteDisparity) and mesh the result on a grid. Denser than the landmark mesh, and a lot
+    // cheaper than dense stereo (it runs at low resolution on the CPU). The mesh has no vertex_ids.
+    bool dense_completion = false;
+    int completion_downsize = 4;          // Densify at 1/downsize of the image size.
+    int completion_radius = 6;            // Guided filter radius (px, downsized).
+    double completion_eps = 0.01;         // Guided filter regularization (intensities are in [0, 1]).
+    int completion_min_landmarks = 2;     // Leave pixels with fewer landmarks in their radius empty.
+    int completion_grid_step = 2;         // Pixels (downsized) between mesh vertices.
+
     StereoCamera stereo_rig;
     Matrix4d body_T_cam_left = Matrix4d::Identity();
     Matrix4d body_T_cam_right = Matrix4d::Identity();
@@ -118,17 +107,89 @@ class ObjectMesher final {
         tracker_(params.tracker_params, params.stereo_rig),
         lmk_grid_(params_.lmk_grid_rows, params_.lmk_grid_cols) {}
 
-  TriangleMesh ProcessStereo(const StereoImage1b& stereo_pair, bool visualize = true);
+  // Track landmarks in a new stereo pair, and update the mesh. The returned mesh is valid until
+  // the next call (its buffers are reused).
+  const TriangleMesh& ProcessStereo(const StereoImage1b& stereo_pair, bool visualize = true);
+
+  // Update the mesh from landmarks that were tracked somewhere else (e.g by the StateEstimator's
+  // frontend), instead of running the tracker. The image is still needed for the foreground mask.
+  // The tracks are scaled from tracks_image_size to the size of the stereo pair. Don't mix calls
+  // to this and ProcessStereo(), since their landmark ids aren't the same.
+  const TriangleMesh& ProcessTracks(const StereoImage1b& stereo_pair,
+                                    const LandmarkObservationBatch& tracks,
+                                    const cv::Size& tracks_image_size,
+                                    bool visualize = true);
+
+ private:
+  struct EdgeScore final
+  {
+    cv::Point2f pt_lo, pt_hi;   // Locations of the lower and higher id landmarks.
+    float fgd_percent;
+    uid_t camera_id;            // Last frame that this edge was checked in.
+  };
+
+  typedef std::pair<uid_t, uid_t> LmkPair;
+
+  struct LmkPairHash final
+  {
+    size_t operator()(const LmkPair& p) const
+    {
+      return std::hash<uid_t>()(p.first) ^ (std::hash<uid_t>()(p.second) * 0x9e3779b97f4a7c15ull);
+    }
+  };
+
+  // Returns the fraction of pixels along each edge (lo, hi) that are foreground. Scores are cached
+  // for each landmark pair, and only recomputed once one of the landmarks moves. The edges that
+  // need a new score are split up across workers.
+  void ScoreEdges(const std::vector<LmkPair>& edges,
+                  const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                  const Image1b& mask,
+                  uid_t camera_id,
+                  std::vector<float>& fgd_percent);
+
+  // Shared by ProcessStereo() and ProcessTracks() once they have the landmarks for this frame.
+  // Landmark pixels and disparities are in the left image of stereo_pair.
+  const TriangleMesh& UpdateMesh(const StereoImage1b& stereo_pair,
+                                 const std::vector<uid_t>& lmk_ids,
+                                 const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                                 const std::unordered_map<uid_t, double>& lmk_disps,
+                                 bool visualize);
+
+  // The dense_completion version of UpdateMesh(), after the foreground mask.
+  const TriangleMesh& CompleteMesh(const Image1b& iml,
+                                   const Image1b& foreground_mask,
+                                   const std::vector<uid_t>& lmk_ids,
+                                   const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                                   const std::unordered_map<uid_t, double>& lmk_disps,
+                                   bool visualize);
+
+  // Match clusters to the triangulations from the previous frame, and only insert, remove, or move
+  // the landmarks that changed.
+  void UpdateClusterMeshes(const LmkClusters& clusters,
+                           const std::unordered_map<uid_t, cv::Point2f>& lmk_points,
+                           const cv::Size& image_size);
 
  private:
   Params params_;
   StereoTracker tracker_;
   GridLookup<uid_t> lmk_grid_;
 
+  // Number of frames in a row that each landmark has been passed to ProcessTracks().
+  std::unordered_map<uid_t, int> track_num_obs_;
+
   // Maps each landmark id to some data about it.
   std::unordered_map<uid_t, VertexData> vertex_data_;
 
   LandmarkGraph graph_;
+
+  std::unordered_map<LmkPair, EdgeScore, LmkPairHash> edge_scores_;
+
+  // One triangulation per cluster, and which one each landmark is in.
+  std::vector<std::unique_ptr<IncrementalDelaunay>> cluster_meshes_;
+  std::unordered_map<uid_t, size_t> lmk_to_mesh_;
+  cv::Size mesh_image_size_;
+
+  TriangleMesh mesh_;
 };
 
 
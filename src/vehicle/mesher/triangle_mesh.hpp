@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include "core/eigen_types.hpp"
+#include "core/uid.hpp"
 
 namespace bm {
 namespace mesher {
@@ -21,8 +23,44 @@ struct TriangleMesh
 
   std::vector<Vector3d> vertices;
   std::vector<Vector3i> triangles;
+
+  // The landmark that each vertex came from, if known (otherwise empty).
+  std::vector<uid_t> vertex_ids;
+};
+
+
+// A TriangleMesh with float32 vertices, interleaved (x0, y0, z0, x1, ...) like a GPU vertex buffer,
+// and flat int32 triangle indices. That's half the memory for vertices, and close enough for
+// consumers like planners (float32 is good to about 0.1 mm within 1 km of the origin).
+struct TriangleMeshf
+{
+  std::vector<float> vertices;        // 3 per vertex.
+  std::vector<int32_t> triangles;     // 3 per triangle.
+  std::vector<uid_t> vertex_ids;
+
+  size_t NumVertices() const { return vertices.size() / 3; }
+  size_t NumTriangles() const { return triangles.size() / 3; }
 };
 
 
+// NOTE(milo): A std::vector<Vector3d> (or Vector3i) is N packed columns of 3 scalars, so this is one
+// map-to-map copy for each buffer.
+inline void ToFloatMesh(const TriangleMesh& mesh, TriangleMeshf& out)
+{
+  out.vertices.resize(3 * mesh.vertices.size());
+  out.triangles.resize(3 * mesh.triangles.size());
+  out.vertex_ids = mesh.vertex_ids;
+
+  if (!mesh.vertices.empty()) {
+    Eigen::Map<Eigen::Matrix3Xf>(out.vertices.data(), 3, mesh.vertices.size()) =
+        Eigen::Map<const Eigen::Matrix3Xd>(mesh.vertices.front().data(), 3, mesh.vertices.size()).cast<float>();
+  }
+  if (!mesh.triangles.empty()) {
+    Eigen::Map<Eigen::Matrix3Xi>(out.triangles.data(), 3, mesh.triangles.size()) =
+        Eigen::Map<const Eigen::Matrix3Xi>(mesh.triangles.front().data(), 3, mesh.triangles.size());
+  }
+}
+
+
 }
 }
@@ -0,0 +1,93 @@
+#include <glog/logging.h>
+
+#include "params/param_tree.hpp"
+
+namespace bm {
+namespace core {
+
+
+ParamTree::ParamTree(const std::string& filepath, const std::string& shared_filepath)
+{
+  std::string error;
+  CHECK(Load(filepath, shared_filepath, error)) << error << std::endl;
+}
+
+
+ParamTree::Ptr ParamTree::TryLoad(const std::string& filepath,
+                                  const std::string& shared_filepath,
+                                  std::string& error)
+{
+  // NOTE(milo): make_shared can't use the private constructor.
+  Ptr tree(new ParamTree());
+  return tree->Load(filepath, shared_filepath, error) ? tree : nullptr;
+}
+
+
+cv::FileNode ParamTree::Find(const std::string& id) const
+{
+  const auto it = nodes_.find(id);
+  return (it != nodes_.end()) ? it->second : cv::FileNode();
+}
+
+
+bool ParamTree::Load(const std::string& filepath, const std::string& shared_filepath, std::string& error)
+{
+  if (filepath.empty()) {
+    error = "Empty filepath given to ParamTree!";
+    return false;
+  }
+
+  filepath_ = filepath;
+  shared_filepath_ = shared_filepath;
+
+  // Parse errors are thrown, rather than reported by isOpened().
+  try {
+    fs_.open(filepath, cv::FileStorage::READ);
+    if (!fs_.isOpened()) {
+      error = "Cannot open file in ParamTree: " + filepath + " (remember that the first line should be: %YAML:1.0)";
+      return false;
+    }
+
+    if (!shared_filepath.empty()) {
+      fs_shared_.open(shared_filepath, cv::FileStorage::READ);
+      if (!fs_shared_.isOpened()) {
+        error = "Cannot open file in ParamTree: " + shared_filepath + " (remember that the first line should be: %YAML:1.0)";
+        return false;
+      }
+    }
+  } catch (const cv::Exception& e) {
+    error = "Failed to parse params in ParamTree: " + std::string(e.what());
+    return false;
+  }
+
+  root_node_ = fs_.root();
+  Compile(root_node_, "");
+
+  if (!shared_filepath.empty()) {
+    shared_node_ = fs_shared_.root();
+    Compile(shared_node_, "/shared/");
+  }
+
+  return true;
+}
+
+
+void ParamTree::Compile(const cv::FileNode& node, const std::string& prefix)
+{
+  if (!node.isMap()) {
+    return;
+  }
+
+  for (cv::FileNodeIterator it = node.begin(); it != node.end(); ++it) {
+    const cv::FileNode child = *it;
+    const std::string id = prefix + child.name();
+
+    // NOTE(milo): Like cv::FileNode::operator[], the first of any duplicate keys wins.
+    nodes_.emplace(id, child);
+    Compile(child, id + "/");
+  }
+}
+
+
+}
+}
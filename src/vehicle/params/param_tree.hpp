@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <opencv2/core/persistence.hpp>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A params file (and optionally a shared params file) compiled into one table of every node that
+// can be reached through maps, keyed by its full id. For example, "StateEstimator/lockstep", or
+// "/shared/imu0/body_T_imu" for the shared file. A YamlParser made from a ParamTree looks up each
+// id with one hash lookup, instead of splitting the id at every '/' and searching each map by key.
+//
+// The tree owns the cv::FileStorage, so the nodes in it stay valid for as long as the tree does
+// (even after the file on disk changes). Sequences aren't descended into, since ids can't index them.
+class ParamTree final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ParamTree)
+  MACRO_SHARED_POINTER_TYPEDEFS(ParamTree)
+
+  // Compile the params file(s). CHECK-fails if a file can't be opened or parsed.
+  explicit ParamTree(const std::string& filepath,
+                     const std::string& shared_filepath = "");
+
+  // Same as above, but returns nullptr and sets "error" if a file can't be opened or parsed. Use
+  // this when reloading a file that might be halfway through being edited.
+  static Ptr TryLoad(const std::string& filepath,
+                     const std::string& shared_filepath,
+                     std::string& error);
+
+  // Returns the node at id, or an empty node (cv::FileNode::NONE) if there isn't one.
+  cv::FileNode Find(const std::string& id) const;
+
+  const cv::FileNode& Root() const { return root_node_; }
+  const cv::FileNode& SharedRoot() const { return shared_node_; }
+
+  const std::string& Filepath() const { return filepath_; }
+  const std::string& SharedFilepath() const { return shared_filepath_; }
+
+  // Number of nodes in the table.
+  size_t Size() const { return nodes_.size(); }
+
+ private:
+  ParamTree() = default;
+
+  // Opens and compiles the file(s). Returns false and sets "error" if that fails.
+  bool Load(const std::string& filepath, const std::string& shared_filepath, std::string& error);
+
+  // Adds every node under "node" to the table, with "prefix" in front of their names.
+  void Compile(const cv::FileNode& node, const std::string& prefix);
+
+ private:
+  cv::FileStorage fs_, fs_shared_;
+  cv::FileNode root_node_;
+  cv::FileNode shared_node_;
+  std::string filepath_, shared_filepath_;
+
+  std::unordered_map<std::string, cv::FileNode> nodes_;
+};
+
+
+}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Holds the latest version of a params struct, so that one thread can publish new params while
+// others keep reading. Readers get an immutable snapshot that stays valid even if a new version is
+// published while they're using it, and never see a half-written struct.
+//
+// Readers that cache values from a snapshot can check Version() (cheap) to find out when to call
+// Get() again.
+template <typename ParamsT>
+class ParamsSnapshot final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ParamsSnapshot)
+
+  typedef std::shared_ptr<const ParamsT> ConstPtr;
+
+  explicit ParamsSnapshot(const ParamsT& params)
+      : params_(std::make_shared<const ParamsT>(params)) {}
+
+  ConstPtr Get() const { return std::atomic_load(&params_); }
+
+  // Publish a new version of the params.
+  void Set(const ParamsT& params)
+  {
+    std::atomic_store(&params_, ConstPtr(std::make_shared<const ParamsT>(params)));
+    version_.fetch_add(1);
+  }
+
+  // Number of times Set() has been called.
+  uint64_t Version() const { return version_.load(); }
+
+ private:
+  ConstPtr params_;
+  std::atomic<uint64_t> version_{0};
+};
+
+
+}
+}
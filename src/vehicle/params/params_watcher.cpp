@@ -0,0 +1,94 @@
+#include <sys/stat.h>
+
+#include <glog/logging.h>
+
+#include "params/params_watcher.hpp"
+
+namespace bm {
+namespace core {
+
+
+ParamsWatcher::ParamsWatcher(const std::string& filepath,
+                             const std::string& shared_filepath,
+                             const Callback& callback,
+                             double poll_interval_sec)
+    : filepath_(filepath),
+      shared_filepath_(shared_filepath),
+      callback_(callback),
+      poll_interval_sec_(poll_interval_sec)
+{
+  CHECK(!filepath.empty()) << "Empty filepath given to ParamsWatcher!" << std::endl;
+  CHECK(callback_) << "ParamsWatcher needs a callback" << std::endl;
+  CHECK_GT(poll_interval_sec, 0);
+
+  stamp_ = Stamp(filepath_);
+  shared_stamp_ = Stamp(shared_filepath_);
+
+  watch_thread_ = std::thread(&ParamsWatcher::WatchLoop, this);
+}
+
+
+ParamsWatcher::~ParamsWatcher()
+{
+  is_shutdown_.store(true);
+  shutdown_notifier_.Notify();
+  if (watch_thread_.joinable()) {
+    watch_thread_.join();
+  }
+}
+
+
+ParamsWatcher::FileStamp ParamsWatcher::Stamp(const std::string& filepath)
+{
+  FileStamp stamp;
+
+  struct stat st;
+  if (filepath.empty() || ::stat(filepath.c_str(), &st) != 0) {
+    return stamp;
+  }
+
+  stamp.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000ll + st.st_mtim.tv_nsec;
+  stamp.size = static_cast<int64_t>(st.st_size);
+  return stamp;
+}
+
+
+void ParamsWatcher::WatchLoop()
+{
+  LOG(INFO) << "Started up ParamsWatcher thread for " << filepath_ << std::endl;
+
+  while (!is_shutdown_.load()) {
+    shutdown_notifier_.WaitFor([this]() { return is_shutdown_.load(); }, poll_interval_sec_);
+    if (is_shutdown_.load()) {
+      break;
+    }
+
+    const FileStamp stamp = Stamp(filepath_);
+    const FileStamp shared_stamp = Stamp(shared_filepath_);
+    if (stamp == stamp_ && shared_stamp == shared_stamp_) {
+      continue;
+    }
+
+    // NOTE(milo): Update the stamps even if the reload fails, so that a broken file isn't parsed
+    // (and warned about) on every poll. Fixing it will change the stamp again.
+    stamp_ = stamp;
+    shared_stamp_ = shared_stamp;
+
+    std::string error;
+    const ParamTree::ConstPtr tree = ParamTree::TryLoad(filepath_, shared_filepath_, error);
+    if (!tree) {
+      LOG(WARNING) << "ParamsWatcher: couldn't reload params, keeping the old ones:\n  " << error << std::endl;
+      continue;
+    }
+
+    LOG(INFO) << "ParamsWatcher: reloaded " << filepath_ << std::endl;
+    callback_(tree);
+    num_reloads_.fetch_add(1);
+  }
+
+  LOG(INFO) << "Shutdown ParamsWatcher thread" << std::endl;
+}
+
+
+}
+}
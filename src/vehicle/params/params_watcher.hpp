@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "core/macros.hpp"
+#include "core/notifier.hpp"
+#include "params/param_tree.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Watches a params file (and optionally a shared params file) and calls a callback with a freshly
+// compiled ParamTree whenever one of them changes on disk. This lets a running process pick up new
+// values for its tunables without restarting.
+//
+// NOTE(milo): Files are polled (mtime and size) instead of using inotify, since editors often
+// replace a file rather than writing to it, and a few reloads per second is plenty. A file that
+// fails to parse (e.g halfway through being saved) is skipped with a warning, and tried again the
+// next time it changes.
+class ParamsWatcher final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ParamsWatcher)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ParamsWatcher)
+
+  // Called on the watcher thread with the reloaded params.
+  typedef std::function<void(const ParamTree::ConstPtr&)> Callback;
+
+  // Starts watching right away. The files are assumed to be up to date when this is constructed,
+  // so the callback is only called once they change.
+  ParamsWatcher(const std::string& filepath,
+                const std::string& shared_filepath,
+                const Callback& callback,
+                double poll_interval_sec = 1.0);
+
+  // Stops the watcher thread (doesn't wait for a full poll interval).
+  ~ParamsWatcher();
+
+  // Number of times the callback was called.
+  size_t NumReloads() const { return num_reloads_.load(); }
+
+ private:
+  // Modification time and size of a file. Both are zero if it doesn't exist.
+  struct FileStamp final
+  {
+    int64_t mtime_ns = 0;
+    int64_t size = 0;
+
+    bool operator==(const FileStamp& other) const
+    {
+      return mtime_ns == other.mtime_ns && size == other.size;
+    }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+  };
+
+  static FileStamp Stamp(const std::string& filepath);
+
+  void WatchLoop();
+
+ private:
+  std::string filepath_, shared_filepath_;
+  Callback callback_;
+  double poll_interval_sec_;
+
+  FileStamp stamp_, shared_stamp_;
+
+  std::atomic_bool is_shutdown_{false};
+  std::atomic<size_t> num_reloads_{0};
+  Notifier shutdown_notifier_;
+  std::thread watch_thread_;
+};
+
+
+}
+}
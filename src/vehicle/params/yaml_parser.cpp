@@ -8,31 +8,26 @@ namespace core {
 // a shared_params.yaml file.
 YamlParser::YamlParser(const std::string& filepath,
                        const std::string& shared_filepath)
-    : filepath_(filepath),
-      shared_filepath_(shared_filepath)
-{
-  CHECK(!filepath.empty()) << "Empty filepath given to YamlParser!" << std::endl;
-  fs_.open(filepath, cv::FileStorage::READ);
-  CHECK(fs_.isOpened())
-      << "Cannot open file in YamlParser: " << filepath
-      << " (remember that the first line should be: %YAML:1.0)";
-  root_node_ = fs_.root();
+    : YamlParser(std::make_shared<ParamTree>(filepath, shared_filepath)) {}
 
-  if (shared_filepath.size() > 0) {
-    fs_shared_.open(shared_filepath, cv::FileStorage::READ);
-    CHECK(fs_shared_.isOpened())
-        << "Cannot open file in YamlParser: " << shared_filepath
-        << " (remember that the first line should be: %YAML:1.0)";
-    shared_node_ = fs_shared_.root();
-  }
-}
 
+// Construct from an already compiled param tree (e.g one that was just reloaded).
+YamlParser::YamlParser(const ParamTree::ConstPtr& tree)
+    : YamlParser(tree, "", cv::FileNode()) {}
 
-// Close OpenCV Filestorage IO on destruct.
-YamlParser::~YamlParser()
+
+// Construct a parser for the subtree of "tree" whose ids start with "prefix".
+YamlParser::YamlParser(const ParamTree::ConstPtr& tree,
+                       const std::string& prefix,
+                       const cv::FileNode& root_node)
+    : tree_(tree),
+      prefix_(prefix)
 {
-  fs_.release();
-  fs_shared_.release();
+  CHECK(tree_ != nullptr) << "Null ParamTree given to YamlParser!" << std::endl;
+  root_node_ = prefix.empty() ? tree_->Root() : root_node;
+  shared_node_ = tree_->SharedRoot();
+  filepath_ = tree_->Filepath();
+  shared_filepath_ = tree_->SharedFilepath();
 }
 
 
@@ -47,11 +42,27 @@ YamlParser::YamlParser(const cv::FileNode& root_node,
       shared_filepath_(shared_filepath) {}
 
 
+bool YamlParser::HasParam(const std::string& id) const
+{
+  return FindNode(id).type() != cv::FileNode::NONE;
+}
+
+
 // Get a YAML node relative to the root. This is used for constructing params that are a subtree.
 cv::FileNode YamlParser::GetNode(const std::string& id) const
 {
   std::string maybe_suffix;
-  if (CheckIfSharedId(id, maybe_suffix)) {
+  const bool is_shared = CheckIfSharedId(id, maybe_suffix);
+
+  if (tree_) {
+    CHECK(!id.empty()) << HelpfulError(id) << " GetParam: empty id given" << std::endl;
+    CHECK(!is_shared || !shared_node_.empty()) << HelpfulError(id) << " Was the parser constructed with a shared node?";
+    const cv::FileNode node = FindNode(id);
+    CHECK_NE(node.type(), cv::FileNode::NONE) << HelpfulError(id) << " GetParam: Missing id: " << id << std::endl;
+    return node;
+  }
+
+  if (is_shared) {
     CHECK(!shared_node_.empty()) << HelpfulError(id) << " Was the parser constructed with a shared node?";
     return GetNodeHelper(shared_node_, maybe_suffix);
   } else {
@@ -63,11 +74,48 @@ cv::FileNode YamlParser::GetNode(const std::string& id) const
 
 YamlParser YamlParser::Subtree(const std::string& id) const
 {
+  if (tree_) {
+    std::string maybe_suffix;
+    CHECK(!CheckIfSharedId(id, maybe_suffix)) << HelpfulError(id) << " Subtree: can't take a subtree of the shared params";
+    return YamlParser(tree_, prefix_ + id + "/", GetNode(id));
+  }
+
   // Pass in the filepath and shared_filepath for debugging purposes.
   return YamlParser(GetNode(id), shared_node_, filepath_, shared_filepath_);
 }
 
 
+cv::FileNode YamlParser::FindNode(const std::string& id) const
+{
+  std::string maybe_suffix;
+  const bool is_shared = CheckIfSharedId(id, maybe_suffix);
+
+  // Shared ids are always relative to the shared root, so they don't get the subtree prefix.
+  if (tree_) {
+    return tree_->Find(is_shared ? id : (prefix_ + id));
+  }
+
+  cv::FileNode node = is_shared ? shared_node_ : root_node_;
+  const std::string& relative_id = is_shared ? maybe_suffix : id;
+  if (node.empty() || relative_id.empty()) {
+    return cv::FileNode();
+  }
+
+  // Walk down one map per '/' in the id. Anything that isn't a map can't have children.
+  size_t start = 0;
+  while (node.isMap()) {
+    const size_t slash_idx = relative_id.find_first_of("/", start);
+    node = node[relative_id.substr(start, slash_idx - start)];
+    if (slash_idx == std::string::npos) {
+      return node;
+    }
+    start = slash_idx + 1;
+  }
+
+  return cv::FileNode();
+}
+
+
 // Recursively finds a node with "id", starting from the "root_node".
 cv::FileNode YamlParser::GetNodeHelper(const cv::FileNode& root_node, const std::string& id) const
 {
@@ -150,12 +198,36 @@ void YamlToCameraModel(const cv::FileNode& node, PinholeCamera& cam)
   CHECK(distort_node.isSeq() && distort_node.size() > 0)
       << "Expected distortion coefficients" << std::endl;
 
-  LOG_IF(WARNING, (double)distort_node[0] > 0) << "WARNING: distortion_coefficients are nonzero, but we don't handle undistortion yet" << std::endl;
+  LOG_IF(WARNING, (double)distort_node[0] > 0) << "WARNING: distortion_coefficients are nonzero, but this camera "
+      << "model is treated as rectified (see StereoRectifier for raw images)" << std::endl;
 
   cam = PinholeCamera(fx, fy, cx, cy, h, w);
 }
 
 
+void YamlToStaticMask(const cv::FileNode& node, StaticMask& mask)
+{
+  const cv::FileNode& blocked_node = node["blocked_regions"];
+  if (blocked_node.type() == cv::FileNode::NONE) {
+    mask = StaticMask();
+    return;
+  }
+
+  CHECK(blocked_node.isSeq() && blocked_node.size() % 4 == 0)
+      << "blocked_regions must contain (4) values per region: x, y, width, height" << std::endl;
+
+  int h, w;
+  node["image_height"] >> h;
+  node["image_width"] >> w;
+
+  std::vector<cv::Rect> blocked;
+  for (int i = 0; i < (int)blocked_node.size(); i += 4) {
+    blocked.emplace_back((int)blocked_node[i], (int)blocked_node[i + 1], (int)blocked_node[i + 2], (int)blocked_node[i + 3]);
+  }
+  mask = StaticMask(h, w, blocked);
+}
+
+
 void YamlToStereoRig(const cv::FileNode& node,
                       StereoCamera& stereo_rig,
                       Matrix4d& body_T_left,
@@ -175,6 +247,56 @@ void YamlToStereoRig(const cv::FileNode& node,
 
   const Matrix4d left_T_right = body_T_left.inverse() * body_T_right;
   stereo_rig = StereoCamera(cam_left, cam_right, Transform3d(left_T_right));
+
+  StaticMask mask_left, mask_right;
+  YamlToStaticMask(cam_left_node, mask_left);
+  YamlToStaticMask(cam_right_node, mask_right);
+  stereo_rig.SetStaticMasks(mask_left, mask_right);
+}
+
+
+static void YamlToRawCamera(const cv::FileNode& node, RawCameraCalibration& cam)
+{
+  CHECK(node.type() != cv::FileNode::NONE) << "Raw camera node not found" << std::endl;
+
+  node["image_height"] >> cam.height;
+  node["image_width"] >> cam.width;
+  CHECK_GT(cam.height, 0) << "Height must be > 0" << std::endl;
+  CHECK_GT(cam.width, 0) << "Width must be > 0" << std::endl;
+
+  const cv::FileNode& intrinsics_node = node["intrinsics"];
+  CHECK(intrinsics_node.isSeq() && intrinsics_node.size() == 4)
+      << "intrinsics must contain (4) values: fx, fy, cx, cy" << std::endl;
+  cam.K = Matrix3d::Identity();
+  cam.K(0, 0) = intrinsics_node[0];
+  cam.K(1, 1) = intrinsics_node[1];
+  cam.K(0, 2) = intrinsics_node[2];
+  cam.K(1, 2) = intrinsics_node[3];
+
+  const cv::FileNode& model_node = node["distortion_model"];
+  CHECK(model_node.type() == cv::FileNode::NONE || YamlToString(model_node) == "radial-tangential")
+      << "Only the radial-tangential distortion model is supported" << std::endl;
+
+  cam.distortion.clear();
+  const cv::FileNode& distort_node = node["distortion_coefficients"];
+  if (distort_node.type() != cv::FileNode::NONE) {
+    CHECK(distort_node.isSeq()) << "distortion_coefficients must be a sequence" << std::endl;
+    for (size_t i = 0; i < distort_node.size(); ++i) {
+      cam.distortion.emplace_back(static_cast<double>(distort_node[(int)i]));
+    }
+  }
+}
+
+
+void YamlToRawStereoRig(const cv::FileNode& node, RawStereoCalibration& raw)
+{
+  CHECK(node.type() != cv::FileNode::NONE) << "Raw stereo rig node not found" << std::endl;
+  YamlToRawCamera(node["camera_left"], raw.left);
+  YamlToRawCamera(node["camera_right"], raw.right);
+
+  const Matrix4d body_T_left = YamlToTransform(node["camera_left"]["body_T_cam"]);
+  const Matrix4d body_T_right = YamlToTransform(node["camera_right"]["body_T_cam"]);
+  raw.left_T_right = body_T_left.inverse() * body_T_right;
 }
 
 
@@ -192,5 +314,50 @@ Matrix4d YamlToTransform(const cv::FileNode& node)
 }
 
 
+void YamlToTaskScheduler(const cv::FileNode& node, TaskScheduler::Params& params)
+{
+  if (node.type() == cv::FileNode::NONE) {
+    return;
+  }
+
+  const cv::FileNode& num_threads_node = node["num_threads"];
+  if (num_threads_node.type() != cv::FileNode::NONE) {
+    num_threads_node >> params.num_threads;
+  }
+
+  const cv::FileNode& cpus_node = node["cpus"];
+  if (cpus_node.type() != cv::FileNode::NONE) {
+    CHECK(cpus_node.isSeq()) << "TaskScheduler cpus must be a sequence" << std::endl;
+    params.cpus.clear();
+    for (size_t i = 0; i < cpus_node.size(); ++i) {
+      params.cpus.emplace_back(static_cast<int>(cpus_node[(int)i]));
+    }
+  }
+}
+
+
+void YamlToThreadSchedule(const cv::FileNode& node, ThreadSchedule& schedule)
+{
+  if (node.type() == cv::FileNode::NONE) {
+    return;
+  }
+
+  if (node["cpu"].type() != cv::FileNode::NONE) {
+    node["cpu"] >> schedule.cpu;
+  }
+  if (node["fifo_priority"].type() != cv::FileNode::NONE) {
+    node["fifo_priority"] >> schedule.fifo_priority;
+  }
+  if (node["nice"].type() != cv::FileNode::NONE) {
+    node["nice"] >> schedule.nice;
+  }
+
+  CHECK(schedule.fifo_priority >= 0 && schedule.fifo_priority <= 99)
+      << "fifo_priority must be in [0, 99]" << std::endl;
+  CHECK(schedule.nice >= -20 && schedule.nice <= 19)
+      << "nice must be in [-20, 19]" << std::endl;
+}
+
+
 }
 }
@@ -9,8 +9,12 @@
 #include <opencv2/core/persistence.hpp>
 
 #include "core/eigen_types.hpp"
+#include "params/param_tree.hpp"
+#include "core/task_scheduler.hpp"
+#include "core/thread_schedule.hpp"
 #include "vision_core/pinhole_camera.hpp"
 #include "vision_core/stereo_camera.hpp"
+#include "vision_core/stereo_rectifier.hpp"
 
 namespace bm {
 namespace core {
@@ -33,6 +37,9 @@ static inline bool CheckIfSharedId(const std::string& id, std::string& suffix)
 
 
 // Class for parsing a YAML file, using OpenCV's FileStorage module.
+//
+// A parser made from filepath(s) or a ParamTree looks up ids in the compiled tree, which is much
+// faster for deeply nested ids. A parser made from YAML nodes walks down the nodes by key instead.
 class YamlParser {
  public:
   YamlParser() = default;
@@ -42,8 +49,8 @@ class YamlParser {
   YamlParser(const std::string& filepath,
              const std::string& shared_filepath = "");
 
-  // Close OpenCV Filestorage IO on destruct.
-  ~YamlParser();
+  // Construct from an already compiled param tree (e.g one that was just reloaded).
+  explicit YamlParser(const ParamTree::ConstPtr& tree);
 
   // Construct from a YAML node.
   YamlParser(const cv::FileNode& root_node,
@@ -52,28 +59,12 @@ class YamlParser {
              const std::string& shared_filepath = "");
 
   // Retrieve a param from the YAML hierarchy and pass it to output parameter.
+  // Any id prefixed with /shared/ is directed to the shared params.
   template <class ParamType>
   void GetParam(const std::string& id, ParamType* output) const
   {
     CHECK_NOTNULL(output);
-
-    // Any id request prefixed with /shared/ is directed to the shared params.
-    std::string maybe_suffix;
-    if (CheckIfSharedId(id, maybe_suffix)) {
-      CHECK(!shared_node_.empty())
-          << "GetParam: shared_node_ is empty. Was the parser constructed with a shared node?"
-          << "\n  id: " << id << std::endl;
-      const cv::FileNode& node = GetNodeHelper(shared_node_, maybe_suffix);
-      node >> *output;
-
-    // Anything else is directed to the root params.
-    } else {
-      CHECK(!root_node_.empty())
-          << "GetParam: root_node_ is empty. Was the parser constructed?"
-          << "\n  id: " << id << std::endl;
-      const cv::FileNode& node = GetNodeHelper(root_node_, id);
-      node >> *output;
-    }
+    GetNode(id) >> *output;
   }
 
   // Retrieve a YAML param and return it.
@@ -85,12 +76,37 @@ class YamlParser {
     return output;
   }
 
+  // Returns whether the param exists, without CHECK-failing if it doesn't.
+  bool HasParam(const std::string& id) const;
+
+  // Retrieve a param if it exists. Returns false (and leaves output alone) if it doesn't. Use this
+  // for optional params, or when reloading params that might be missing or halfway edited.
+  template <class ParamType>
+  bool TryGetParam(const std::string& id, ParamType* output) const
+  {
+    CHECK_NOTNULL(output);
+    const cv::FileNode& node = FindNode(id);
+    if (node.type() == cv::FileNode::NONE) {
+      return false;
+    }
+    node >> *output;
+    return true;
+  }
+
   // Get a YAML node relative to the root. This is used for constructing params that are a subtree.
   cv::FileNode GetNode(const std::string& id) const;
 
   YamlParser Subtree(const std::string& id) const;
 
  private:
+  // Construct a parser for the subtree of "tree" whose ids start with "prefix".
+  YamlParser(const ParamTree::ConstPtr& tree,
+             const std::string& prefix,
+             const cv::FileNode& root_node);
+
+  // Returns the node at id, or an empty node (cv::FileNode::NONE) if there isn't one.
+  cv::FileNode FindNode(const std::string& id) const;
+
   // Recursively finds a node with "id", starting from the "root_node".
   cv::FileNode GetNodeHelper(const cv::FileNode& root_node, const std::string& id) const;
 
@@ -98,7 +114,10 @@ class YamlParser {
   std::string HelpfulError(const std::string& id) const;
 
  private:
-  cv::FileStorage fs_, fs_shared_;
+  // NOTE(milo): The tree owns the cv::FileStorage, so it has to outlive any nodes taken from it.
+  ParamTree::ConstPtr tree_ = nullptr;
+  std::string prefix_;
+
   cv::FileNode root_node_;
   cv::FileNode shared_node_;
   std::string filepath_, shared_filepath_;
@@ -178,11 +197,31 @@ inline EnumT YamlToEnum(const cv::FileNode& node)
 void YamlToCameraModel(const cv::FileNode& node, PinholeCamera& cam);
 
 
-// Parse and return a StereoCamera as an output param.
+// Parse the optional blocked_regions of a camera ([x, y, width, height, ...] at its image_height
+// and image_width) as an output param. A camera without any is left unmasked.
+void YamlToStaticMask(const cv::FileNode& node, StaticMask& mask);
+
+
+// Parse and return a StereoCamera (with its static masks) as an output param.
 void YamlToStereoRig(const cv::FileNode& node,
                     StereoCamera& stereo_rig,
                     Matrix4d& body_T_left,
                     Matrix4d& body_T_right);
 
+
+// Parse the calibration of an unrectified stereo rig (same format as YamlToStereoRig(), but the
+// distortion_coefficients are kept) as an output param. See StereoRectifier.
+void YamlToRawStereoRig(const cv::FileNode& node, RawStereoCalibration& raw);
+
+
+// Parse TaskScheduler params (num_threads, cpus) as an output param. Anything that's missing keeps
+// its default value.
+void YamlToTaskScheduler(const cv::FileNode& node, TaskScheduler::Params& params);
+
+
+// Parse a ThreadSchedule (cpu, fifo_priority, nice) as an output param. Anything that's missing
+// keeps its default value.
+void YamlToThreadSchedule(const cv::FileNode& node, ThreadSchedule& schedule);
+
 }
 }
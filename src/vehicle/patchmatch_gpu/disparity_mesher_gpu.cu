@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <cfloat>
+
+#include <glog/logging.h>
+
+#include <opencv2/core/cuda_stream_accessor.hpp>
+#include <opencv2/cudaarithm.hpp>
+
+#include "patchmatch_gpu/disparity_mesher_gpu.h"
+#include "vision_core/gpu_memory_pool.hpp"
+
+namespace bm {
+namespace pm {
+
+// Device buffers are charged to this module in the GpuMemoryPool.
+static const char* kGpuBudget = "DisparityMesherGpu";
+
+
+void DisparityMesherGpu::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("grid_step", &grid_step);
+  parser.GetParam("min_disp", &min_disp);
+  parser.GetParam("max_depth", &max_depth);
+  parser.GetParam("edge_max_depth_change", &edge_max_depth_change);
+}
+
+
+__global__
+void GridVertices(const cu::PtrStepSz<float> disp,
+                  const cu::PtrStepSz<uchar> mask,
+                  cu::PtrStepSz<int> vertex_index,
+                  float3* vertices,
+                  int* counters,
+                  int grid_step,
+                  float fx, float fy, float cx, float cy, float fx_times_baseline,
+                  float min_disp, float max_depth)
+{
+  const int gx = blockIdx.x * blockDim.x + threadIdx.x;
+  const int gy = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (gx >= vertex_index.cols || gy >= vertex_index.rows) {
+    return;
+  }
+
+  const int u = gx * grid_step;
+  const int v = gy * grid_step;
+  const float d = disp(v, u);
+  const bool masked_out = mask.data != nullptr && mask(v, u) == 0;
+
+  if (masked_out || d <= min_disp || (fx_times_baseline / d) > max_depth) {
+    vertex_index(gy, gx) = -1;
+    return;
+  }
+
+  const float z = fx_times_baseline / d;
+  const int i = atomicAdd(&counters[0], 1);
+  vertices[i] = make_float3((u - cx) * z / fx, (v - cy) * z / fy, z);
+  vertex_index(gy, gx) = i;
+}
+
+
+__device__ __forceinline__
+float DepthChange(const float3* vertices, int i, int j)
+{
+  return (i < 0 || j < 0) ? FLT_MAX : fabsf(vertices[i].z - vertices[j].z);
+}
+
+
+__device__ __forceinline__
+void AddTriangle(const float3* vertices, int3* triangles, int* counters,
+                 int a, int b, int c, float edge_max_depth_change)
+{
+  if (a < 0 || b < 0 || c < 0) {
+    return;
+  }
+  if (DepthChange(vertices, a, b) > edge_max_depth_change ||
+      DepthChange(vertices, b, c) > edge_max_depth_change ||
+      DepthChange(vertices, a, c) > edge_max_depth_change) {
+    return;
+  }
+  const int i = atomicAdd(&counters[1], 1);
+  triangles[i] = make_int3(a, b, c);
+}
+
+
+__global__
+void GridTriangles(const cu::PtrStepSz<int> vertex_index,
+                   const float3* vertices,
+                   int3* triangles,
+                   int* counters,
+                   float edge_max_depth_change)
+{
+  const int gx = blockIdx.x * blockDim.x + threadIdx.x;
+  const int gy = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (gx >= (vertex_index.cols - 1) || gy >= (vertex_index.rows - 1)) {
+    return;
+  }
+
+  // a - b
+  // | / |
+  // c - d
+  const int a = vertex_index(gy, gx);
+  const int b = vertex_index(gy, gx + 1);
+  const int c = vertex_index(gy + 1, gx);
+  const int d = vertex_index(gy + 1, gx + 1);
+
+  // Splitting along the flatter diagonal keeps a cell on an edge from bridging the discontinuity.
+  if (DepthChange(vertices, b, c) <= DepthChange(vertices, a, d)) {
+    AddTriangle(vertices, triangles, counters, a, b, c, edge_max_depth_change);
+    AddTriangle(vertices, triangles, counters, b, d, c, edge_max_depth_change);
+  } else {
+    AddTriangle(vertices, triangles, counters, a, b, d, edge_max_depth_change);
+    AddTriangle(vertices, triangles, counters, a, d, c, edge_max_depth_change);
+  }
+}
+
+
+DisparityMesherGpu::DisparityMesherGpu(const Params& params, const StereoCamera& stereo_rig)
+    : params_(params),
+      stereo_rig_(stereo_rig)
+{
+  CHECK_GT(params_.grid_step, 0);
+  CHECK_GT(params_.min_disp, 0) << "min_disp must be positive to avoid dividing by zero" << std::endl;
+}
+
+
+void DisparityMesherGpu::Triangulate(const cu::GpuMat& disp,
+                                     const cu::GpuMat& mask,
+                                     cu::Stream& stream)
+{
+  ScopedGpuBudget budget(kGpuBudget);
+
+  CHECK_EQ(CV_32FC1, disp.type()) << "DisparityMesherGpu needs a float disparity" << std::endl;
+  CHECK(mask.empty() || (mask.type() == CV_8UC1 && mask.size() == disp.size()));
+
+  // The static mask is only uploaded again when the disparity size changes.
+  const cu::GpuMat* valid = &mask;
+  if (!stereo_rig_.LeftMask().Empty()) {
+    if (static_mask_.size() != disp.size()) {
+      static_mask_.upload(stereo_rig_.LeftMask().Valid(disp.rows, disp.cols));
+    }
+    if (mask.empty()) {
+      valid = &static_mask_;
+    } else {
+      cu::bitwise_and(mask, static_mask_, combined_mask_, cu::GpuMat(), stream);
+      valid = &combined_mask_;
+    }
+  }
+
+  const int step = params_.grid_step;
+  const int grid_cols = (disp.cols - 1) / step + 1;
+  const int grid_rows = (disp.rows - 1) / step + 1;
+  const int num_cells = (grid_cols - 1) * (grid_rows - 1);
+
+  // NOTE(milo): Every node and two triangles per cell fit, so the kernels never check for overflow.
+  // create() is a no-op if the size and type haven't changed.
+  vertex_index_.create(grid_rows, grid_cols, CV_32SC1);
+  vertices_.create(1, grid_rows * grid_cols, CV_32FC3);
+  triangles_.create(1, std::max(1, 2 * num_cells), CV_32SC3);
+  counters_.create(1, 2, CV_32SC1);
+  counters_.setTo(cv::Scalar(0), stream);
+
+  const PinholeCamera cam = stereo_rig_.LeftCamera().Rescale(disp.rows, disp.cols);
+  const float fx_times_baseline = cam.fx() * stereo_rig_.Baseline();
+
+  cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(grid_cols, block.x), cu::device::divUp(grid_rows, block.y));
+  GridVertices<<<grid, block, 0, cs>>>(
+      disp, valid->empty() ? cu::PtrStepSz<uchar>() : cu::PtrStepSz<uchar>(*valid),
+      vertex_index_, vertices_.ptr<float3>(), counters_.ptr<int>(), step,
+      cam.fx(), cam.fy(), cam.cx(), cam.cy(), fx_times_baseline,
+      params_.min_disp, params_.max_depth);
+  GridTriangles<<<grid, block, 0, cs>>>(
+      vertex_index_, vertices_.ptr<float3>(), triangles_.ptr<int3>(), counters_.ptr<int>(),
+      params_.edge_max_depth_change);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void DisparityMesherGpu::Download(mesher::TriangleMesh& mesh, cu::Stream& stream)
+{
+  h_counters_.create(1, 2, CV_32SC1);
+  counters_.download(h_counters_, stream);
+  stream.waitForCompletion();
+
+  const int num_vertices = h_counters_.createMatHeader().at<int>(0);
+  const int num_triangles = h_counters_.createMatHeader().at<int>(1);
+
+  mesh.vertices.resize(num_vertices);
+  mesh.triangles.resize(num_triangles);
+  mesh.vertex_ids.clear();
+
+  if (num_vertices == 0) {
+    mesh.triangles.clear();
+    return;
+  }
+
+  // Only download the part of each buffer that was used. The downloads go straight into the
+  // page-locked buffers, since their headers already have the right size.
+  h_vertices_.create(1, vertices_.cols, CV_32FC3);
+  h_triangles_.create(1, triangles_.cols, CV_32SC3);
+  cv::Mat h_vertices = h_vertices_.createMatHeader().colRange(0, num_vertices);
+  cv::Mat h_triangles = h_triangles_.createMatHeader().colRange(0, std::max(1, num_triangles));
+  vertices_.colRange(0, num_vertices).download(h_vertices, stream);
+  if (num_triangles > 0) {
+    triangles_.colRange(0, num_triangles).download(h_triangles, stream);
+  }
+  stream.waitForCompletion();
+
+  for (int i = 0; i < num_vertices; ++i) {
+    const cv::Vec3f& v = h_vertices.at<cv::Vec3f>(i);
+    mesh.vertices.at(i) = Vector3d(v[0], v[1], v[2]);
+  }
+  for (int i = 0; i < num_triangles; ++i) {
+    const cv::Vec3i& t = h_triangles.at<cv::Vec3i>(i);
+    mesh.triangles.at(i) = Vector3i(t[0], t[1], t[2]);
+  }
+}
+
+
+void DisparityMesherGpu::Triangulate(const Image1f& disp, const Image1b& mask, mesher::TriangleMesh& mesh)
+{
+  ScopedGpuBudget budget(kGpuBudget);
+
+  h_disp_.create(disp.rows, disp.cols, CV_32FC1);
+  disp.copyTo(h_disp_.createMatHeader());
+  disp_.upload(h_disp_, stream_);
+
+  if (mask.empty()) {
+    mask_.release();
+  } else {
+    h_mask_.create(mask.rows, mask.cols, CV_8UC1);
+    mask.copyTo(h_mask_.createMatHeader());
+    mask_.upload(h_mask_, stream_);
+  }
+
+  Triangulate(disp_, mask_, stream_);
+  Download(mesh, stream_);
+}
+
+
+}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/core/cuda/common.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "mesher/triangle_mesh.hpp"
+
+namespace bm {
+namespace pm {
+
+namespace cu = cv::cuda;
+using namespace core;
+
+
+// One thread per grid node (every grid_step pixels). Nodes with a valid disparity (and mask, if it
+// isn't empty) are backprojected into the left camera frame and appended to vertices. The index of
+// each node's vertex goes in vertex_index (-1 if invalid). counters[0] counts the vertices.
+__global__
+void GridVertices(const cu::PtrStepSz<float> disp,
+                  const cu::PtrStepSz<uchar> mask,
+                  cu::PtrStepSz<int> vertex_index,
+                  float3* vertices,
+                  int* counters,
+                  int grid_step,
+                  float fx, float fy, float cx, float cy, float fx_times_baseline,
+                  float min_disp, float max_depth);
+
+
+// One thread per grid cell. Each cell is split into two triangles along the diagonal with the
+// smaller depth change, and a triangle is only added if all of its vertices are valid and no two of
+// them differ in depth by more than edge_max_depth_change. counters[1] counts the triangles.
+__global__
+void GridTriangles(const cu::PtrStepSz<int> vertex_index,
+                   const float3* vertices,
+                   int3* triangles,
+                   int* counters,
+                   float edge_max_depth_change);
+
+
+// Turns a dense disparity map (e.g from PatchmatchGpu) into a triangle mesh on the GPU. The
+// disparity is sampled on a regular grid, so the mesh is decimated by grid_step in each direction,
+// and edges are broken at depth discontinuities (the same test as ObjectMesher's
+// edge_max_depth_change). Only the used part of the vertex and triangle buffers is downloaded.
+//
+// NOTE(milo): Vertices and triangles are compacted with atomics, so their order changes from run to
+// run (the mesh itself doesn't).
+class DisparityMesherGpu final {
+ public:
+  struct Params final : public ParamsBase {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int grid_step = 4;                    // Sample a vertex every this many pixels.
+    float min_disp = 1.0;                 // Disparities at or below this are invalid (px).
+    float max_depth = 20.0;               // Vertices farther than this are invalid (m).
+    float edge_max_depth_change = 1.0;    // Break edges with a bigger depth change (m).
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(DisparityMesherGpu);
+
+  // The stereo rig is rescaled to the size of each disparity map, so it can be at any resolution.
+  // Pixels that its left StaticMask blocks are never meshed.
+  DisparityMesherGpu(const Params& params, const StereoCamera& stereo_rig);
+
+  // Triangulates a CV_32FC1 disparity (left camera) that is already on the device. If mask isn't
+  // empty, only pixels where it's nonzero (CV_8UC1) are used. Returns without waiting for stream.
+  void Triangulate(const cu::GpuMat& disp,
+                   const cu::GpuMat& mask,
+                   cu::Stream& stream = cu::Stream::Null());
+
+  // Waits for the last Triangulate() in stream, and downloads its mesh (in the left camera frame).
+  void Download(mesher::TriangleMesh& mesh, cu::Stream& stream = cu::Stream::Null());
+
+  // Blocking version, which uploads the disparity (and mask) and downloads the mesh.
+  void Triangulate(const Image1f& disp, const Image1b& mask, mesher::TriangleMesh& mesh);
+
+ private:
+  Params params_;
+  StereoCamera stereo_rig_;
+
+  cu::GpuMat disp_, mask_, vertex_index_, vertices_, triangles_, counters_;
+  cu::GpuMat static_mask_, combined_mask_;  // The left StaticMask at the last disparity size.
+  cu::HostMem h_disp_, h_mask_, h_vertices_, h_triangles_, h_counters_;
+  cu::Stream stream_;
+};
+
+
+}
+}
@@ -1,12 +1,38 @@
-#include <opencv2/cudafilters.hpp>
+#include <cstring>
+#include <functional>
+
+#include <cuda_fp16.h>
+
+#include <glog/logging.h>
+
+#include <opencv2/core/cuda_stream_accessor.hpp>
 #include <opencv2/cudaimgproc.hpp>
 #include <opencv2/cudaarithm.hpp>
+#include <opencv2/cudawarping.hpp>
 
 #include "patchmatch_gpu/patchmatch_gpu.h"
+#include "stereo_matching/patchmatch.hpp"
+#include "vision_core/gpu_memory_pool.hpp"
 
 namespace bm {
 namespace pm {
 
+// Initial foreground noise (px) for a cold start from sparse matches, and for a level that was
+// upsampled from a coarser one (i.e about a pixel of error at the coarser level).
+static const float kSparseInitNoise = 32.0f;
+static const float kUpsampleNoise = 2.0f;
+
+// Shared memory budget for the tiled propagation kernels (the default per-block limit).
+static const size_t kMaxTileBytes = 48 * 1024;
+static const size_t kMaxCachedTextures = 32;
+
+// Pitched textures need their first row to be aligned to this (cudaDeviceProp::textureAlignment is
+// at most 512 bytes).
+static const size_t kTextureAlignment = 512;
+
+// Device buffers are charged to this module in the GpuMemoryPool.
+static const char* kGpuBudget = "PatchmatchGpu";
+
 
 void PatchmatchGpu::Params::LoadParams(const YamlParser& p)
 {
@@ -15,19 +41,33 @@ void PatchmatchGpu::Params::LoadParams(const YamlParser& p)
 }
 
 
+__device__ __forceinline__ float ToFloat(float v) { return v; }
+__device__ __forceinline__ float ToFloat(uchar v) { return __uint2float_rn(v); }
+__device__ __forceinline__ float ToFloat(__half v) { return __half2float(v); }
+
+__device__ __forceinline__ void Store(float v, float& out) { out = v; }
+__device__ __forceinline__ void Store(float v, __half& out) { out = __float2half(v); }
+
+
+// Normalized textures of 8-bit images (see TextureCache) read back in [0, 1].
+template <typename T> __device__ __forceinline__ float TextureScale();
+template <> __device__ __forceinline__ float TextureScale<float>() { return 1.0f; }
+template <> __device__ __forceinline__ float TextureScale<uchar>() { return 255.0f; }
+
+
 template <typename T>
 __device__ __forceinline__
-T GetSubpixel(const cu::PtrStepSz<T> im, float row, float col)
+float GetSubpixel(const cu::PtrStepSz<T> im, float row, float col)
 {
   const int row0 = __float2int_rd(row);
   const int row1 = __float2int_ru(row);
   const int col0 = __float2int_rd(col);
   const int col1 = __float2int_ru(col);
 
-  const float c00 = im(row0, col0);
-  const float c01 = im(row0, col1);
-  const float c10 = im(row1, col0);
-  const float c11 = im(row1, col1);
+  const float c00 = ToFloat(im(row0, col0));
+  const float c01 = ToFloat(im(row0, col1));
+  const float c10 = ToFloat(im(row1, col0));
+  const float c11 = ToFloat(im(row1, col1));
 
   const float trow = row - __int2float_rn(row0);
   const float tcol = col - __int2float_rn(col0);
@@ -42,11 +82,12 @@ T GetSubpixel(const cu::PtrStepSz<T> im, float row, float col)
 }
 
 
+template <typename TI, typename TG>
 __device__ __forceinline__
-static float L1GradientCost(const cu::PtrStepSz<float> Il,
-                            const cu::PtrStepSz<float> Ir,
-                            const cu::PtrStepSz<float> Gl,
-                            const cu::PtrStepSz<float> Gr,
+static float L1GradientCost(const cu::PtrStepSz<TI> Il,
+                            const cu::PtrStepSz<TI> Ir,
+                            const cu::PtrStepSz<TG> Gl,
+                            const cu::PtrStepSz<TG> Gr,
                             int yl, int xl,
                             float yr, float xr,
                             int ph, int pw,
@@ -61,68 +102,80 @@ static float L1GradientCost(const cu::PtrStepSz<float> Il,
       const float xri = xr - __int2float_rd(pw / 2) + __int2float_rd(col);
       const int yli = yl - ph / 2 + row;
       const int xli = xl - pw / 2 + col;
-      cost += alpha       * fabsf(Il(yli, xli) - GetSubpixel(Ir, yri, xri)) +
-              (1 - alpha) * fabsf(Gl(yli, xli) - GetSubpixel(Gr, yri, xri));
+      cost += alpha       * fabsf(ToFloat(Il(yli, xli)) - GetSubpixel(Ir, yri, xri)) +
+              (1 - alpha) * fabsf(ToFloat(Gl(yli, xli)) - GetSubpixel(Gr, yri, xri));
     }
   }
   return cost;
 }
 
 
+template <typename TI, typename TG>
 __device__ __forceinline__
-static float L1GradientCost3x3(const cu::PtrStepSz<float> Il,
-                              const cu::PtrStepSz<float> Ir,
-                              const cu::PtrStepSz<float> Gl,
-                              const cu::PtrStepSz<float> Gr,
-                              int yl, int xl,
-                              float yr, float xr,
-                              float alpha)
+static float CostTerm(const cu::PtrStepSz<TI> Il,
+                      const cu::PtrStepSz<TI> Ir,
+                      const cu::PtrStepSz<TG> Gl,
+                      const cu::PtrStepSz<TG> Gr,
+                      int yl, int xl,
+                      float yr, float xr,
+                      int dy, int dx,
+                      float alpha)
 {
-  float cost = 0;
-
-  // ROW 0
-  cost += alpha     * fabsf(Il(yl - 1, xl - 1) - GetSubpixel(Ir, yr - 1, xr - 1)) +
-          (1 - alpha) * fabsf(Gl(yl - 1, xl - 1) - GetSubpixel(Gr, yr - 1, xr - 1));
-
-  // cost += alpha     * fabsf(Il(yl - 1, xl) - GetSubpixel(Ir, yr - 1, xr)) +
-  //         (1 - alpha) * fabsf(Gl(yl - 1, xl) - GetSubpixel(Gr, yr - 1, xr));
-
-  cost += alpha     * fabsf(Il(yl - 1, xl + 1) - GetSubpixel(Ir, yr - 1, xr + 1)) +
-          (1 - alpha) * fabsf(Gl(yl - 1, xl + 1) - GetSubpixel(Gr, yr - 1, xr + 1));
-
-  // ROW 1
-  // cost += alpha     * fabsf(Il(yl, xl - 1) - GetSubpixel(Ir, yr, xr - 1)) +
-  //         (1 - alpha) * fabsf(Gl(yl, xl - 1) - GetSubpixel(Gr, yr, xr - 1));
-
-  cost += alpha     * fabsf(Il(yl, xl) - GetSubpixel(Ir, yr, xr)) +
-          (1 - alpha) * fabsf(Gl(yl, xl) - GetSubpixel(Gr, yr, xr));
-
-  // cost += alpha     * fabsf(Il(yl, xl + 1) - GetSubpixel(Ir, yr, xr + 1)) +
-  //         (1 - alpha) * fabsf(Gl(yl, xl + 1) - GetSubpixel(Gr, yr, xr + 1));
+  const float yri = yr + __int2float_rn(dy);
+  const float xri = xr + __int2float_rn(dx);
+  return alpha       * fabsf(ToFloat(Il(yl + dy, xl + dx)) - GetSubpixel(Ir, yri, xri)) +
+         (1 - alpha) * fabsf(ToFloat(Gl(yl + dy, xl + dx)) - GetSubpixel(Gr, yri, xri));
+}
 
-  // ROW 2
-  cost += alpha     * fabsf(Il(yl + 1, xl - 1) - GetSubpixel(Ir, yr + 1, xr - 1)) +
-          (1 - alpha) * fabsf(Gl(yl + 1, xl - 1) - GetSubpixel(Gr, yr + 1, xr - 1));
 
-  // cost += alpha     * fabsf(Il(yl + 1, xl) - GetSubpixel(Ir, yr + 1, xr)) +
-  //         (1 - alpha) * fabsf(Gl(yl + 1, xl) - GetSubpixel(Gr, yr + 1, xr));
+// A sparse 3x3 patch: the center and the four corners.
+template <typename TI, typename TG>
+__device__ __forceinline__
+static float L1GradientCost3x3(const cu::PtrStepSz<TI> Il,
+                               const cu::PtrStepSz<TI> Ir,
+                               const cu::PtrStepSz<TG> Gl,
+                               const cu::PtrStepSz<TG> Gr,
+                               int yl, int xl,
+                               float yr, float xr,
+                               float alpha)
+{
+  return CostTerm(Il, Ir, Gl, Gr, yl, xl, yr, xr, -1, -1, alpha) +
+         CostTerm(Il, Ir, Gl, Gr, yl, xl, yr, xr, -1,  1, alpha) +
+         CostTerm(Il, Ir, Gl, Gr, yl, xl, yr, xr,  0,  0, alpha) +
+         CostTerm(Il, Ir, Gl, Gr, yl, xl, yr, xr,  1, -1, alpha) +
+         CostTerm(Il, Ir, Gl, Gr, yl, xl, yr, xr,  1,  1, alpha);
+}
 
-  cost += alpha       * fabsf(Il(yl + 1, xl + 1) - GetSubpixel(Ir, yr + 1, xr + 1)) +
-          (1 - alpha) * fabsf(Gl(yl + 1, xl + 1) - GetSubpixel(Gr, yr + 1, xr + 1));
 
-  return cost;
+// A batch of pairs is stacked vertically (see PatchmatchGpu::MatchBatch), with one layer of the
+// grid (blockIdx.z) per pair. This is the part of a stacked image for this thread's pair, so that
+// kernels never read across pairs. It's the whole image when there's one pair.
+template <typename T>
+__device__ __forceinline__
+cu::PtrStepSz<T> PairView(const cu::PtrStepSz<T>& im)
+{
+  const int rows = im.rows / gridDim.z;
+  return cu::PtrStepSz<T>(rows, im.cols, const_cast<T*>(im.ptr(blockIdx.z * rows)), im.step);
 }
 
+
+template <typename TI, typename TG>
 __global__
-void PropagateRow(const cu::PtrStepSz<float> iml,
-                  const cu::PtrStepSz<float> imr,
-                  const cu::PtrStepSz<float> Gl,
-                  const cu::PtrStepSz<float> Gr,
+void PropagateRow(cu::PtrStepSz<TI> iml,
+                  cu::PtrStepSz<TI> imr,
+                  cu::PtrStepSz<TG> Gl,
+                  cu::PtrStepSz<TG> Gr,
                   cu::PtrStepSz<float> disp,
                   int direction,
                   int patch_size,
                   float alpha)
 {
+  iml = PairView(iml);
+  imr = PairView(imr);
+  Gl = PairView(Gl);
+  Gr = PairView(Gr);
+  disp = PairView(disp);
+
   assert(patch_size % 2 != 0);
   assert(direction == -1 || direction == 1);
 
@@ -172,16 +225,23 @@ void PropagateRow(const cu::PtrStepSz<float> iml,
 }
 
 
+template <typename TI, typename TG>
 __global__
-void PropagateCol(const cu::PtrStepSz<float> iml,
-                  const cu::PtrStepSz<float> imr,
-                  const cu::PtrStepSz<float> Gl,
-                  const cu::PtrStepSz<float> Gr,
+void PropagateCol(cu::PtrStepSz<TI> iml,
+                  cu::PtrStepSz<TI> imr,
+                  cu::PtrStepSz<TG> Gl,
+                  cu::PtrStepSz<TG> Gr,
                   cu::PtrStepSz<float> disp,
                   int direction,
                   int patch_size,
                   float alpha)
 {
+  iml = PairView(iml);
+  imr = PairView(imr);
+  Gl = PairView(Gl);
+  Gr = PairView(Gr);
+  disp = PairView(disp);
+
   assert(patch_size % 2 != 0);
   assert(direction == -1 || direction == 1);
 
@@ -230,16 +290,217 @@ void PropagateCol(const cu::PtrStepSz<float> iml,
 }
 
 
+template <typename TI, typename TG>
+__device__ __forceinline__
+static float TiledCostTerm(const TI* sIl,
+                           const TG* sGl,
+                           int pitch,
+                           int ly, int lx,
+                           cudaTextureObject_t imr_tex,
+                           cudaTextureObject_t Gr_tex,
+                           float yr, float xr,
+                           int dy, int dx,
+                           float alpha)
+{
+  // Texels are centered at +0.5, so this samples the same place as GetSubpixel.
+  const int i = (ly + dy) * pitch + (lx + dx);
+  const float u = xr + __int2float_rn(dx) + 0.5f;
+  const float v = yr + __int2float_rn(dy) + 0.5f;
+  return alpha       * fabsf(ToFloat(sIl[i]) - TextureScale<TI>() * tex2D<float>(imr_tex, u, v)) +
+         (1 - alpha) * fabsf(ToFloat(sGl[i]) - tex2D<float>(Gr_tex, u, v));
+}
+
+
+// Same pixels as L1GradientCost3x3, with (ly, lx) the location of the left pixel in the tile.
+template <typename TI, typename TG>
+__device__ __forceinline__
+static float L1GradientCost3x3Tiled(const TI* sIl,
+                                    const TG* sGl,
+                                    int pitch,
+                                    int ly, int lx,
+                                    cudaTextureObject_t imr_tex,
+                                    cudaTextureObject_t Gr_tex,
+                                    float yr, float xr,
+                                    float alpha)
+{
+  return TiledCostTerm(sIl, sGl, pitch, ly, lx, imr_tex, Gr_tex, yr, xr, -1, -1, alpha) +
+         TiledCostTerm(sIl, sGl, pitch, ly, lx, imr_tex, Gr_tex, yr, xr, -1,  1, alpha) +
+         TiledCostTerm(sIl, sGl, pitch, ly, lx, imr_tex, Gr_tex, yr, xr,  0,  0, alpha) +
+         TiledCostTerm(sIl, sGl, pitch, ly, lx, imr_tex, Gr_tex, yr, xr,  1, -1, alpha) +
+         TiledCostTerm(sIl, sGl, pitch, ly, lx, imr_tex, Gr_tex, yr, xr,  1,  1, alpha);
+}
+
+
+template <typename TI, typename TG>
+__global__
+void PropagateRowTiled(cu::PtrStepSz<TI> iml,
+                       cu::PtrStepSz<TG> Gl,
+                       cudaTextureObject_t imr_tex,
+                       cudaTextureObject_t Gr_tex,
+                       cu::PtrStepSz<float> disp,
+                       int direction,
+                       float alpha)
+{
+  // The textures are over the whole stack, so their rows are offset to this pair's.
+  iml = PairView(iml);
+  Gl = PairView(Gl);
+  disp = PairView(disp);
+  const int tex_row0 = blockIdx.z * iml.rows;
+
+  assert(direction == -1 || direction == 1);
+  const int patch_radius = 1;
+
+  // The tile is full rows [row0 - 1, row0 + blockDim.y] of Gl, followed by the same rows of iml
+  // (gradients first, since they're at least as wide).
+  extern __shared__ __align__(16) unsigned char tile_smem[];
+  const int pitch = iml.cols;
+  const int tile_rows = blockDim.y + 2;
+  TG* sGl = reinterpret_cast<TG*>(tile_smem);
+  TI* sIl = reinterpret_cast<TI*>(sGl + tile_rows * pitch);
+
+  // NOTE(milo): Every thread has to help load and reach the barrier, so skip invalid rows after.
+  const int row0 = blockIdx.y * blockDim.y;
+  const int nthreads = blockDim.x * blockDim.y;
+  for (int i = threadIdx.y * blockDim.x + threadIdx.x; i < tile_rows * pitch; i += nthreads) {
+    const int row = min(max(row0 - 1 + i / pitch, 0), iml.rows - 1);
+    const int col = i % pitch;
+    sIl[i] = iml(row, col);
+    sGl[i] = Gl(row, col);
+  }
+  __syncthreads();
+
+  const int tRow = row0 + threadIdx.y;
+  if (tRow < patch_radius || tRow > (iml.rows - patch_radius - 1)) {
+    return;
+  }
+
+  // Each thread get a "chunk" of a row.
+  const int tColChunk = blockIdx.x * blockDim.x + threadIdx.x;
+  const int chunkSize = iml.cols / blockDim.x;
+
+  const int minCol = max(tColChunk * chunkSize - 5, patch_radius);
+  const int maxCol = min((tColChunk + 1)*chunkSize + 5, iml.cols - patch_radius - 1);
+
+  if (minCol >= iml.cols) {
+    return;
+  }
+
+  const int start = (direction > 0) ? minCol : maxCol;
+  const int end = (direction > 0) ? maxCol : minCol;
+
+  const int ly = threadIdx.y + 1;
+  const float y = __int2float_rd(tRow + tex_row0);
+
+  for (int col = start; direction > 0 ? col < end : col > end; col += direction) {
+    const float x = __int2float_rd(col);
+    const float d0 = disp(tRow, col);
+    const float d1 = disp(tRow, col - direction);
+
+    const float cost0 = L1GradientCost3x3Tiled(
+        sIl, sGl, pitch, ly, col, imr_tex, Gr_tex, y, fmaxf(x - d0, patch_radius), alpha);
+
+    const float cost1 = L1GradientCost3x3Tiled(
+        sIl, sGl, pitch, ly, col, imr_tex, Gr_tex, y, fmaxf(x - d1, patch_radius), alpha);
+
+    if (cost1 < cost0) {
+      disp(tRow, col) = fminf(d1, x - patch_radius);
+    }
+  }
+}
+
+
+template <typename TI, typename TG>
 __global__
-void MaskBackground(const cu::PtrStepSz<float> iml,
-                    const cu::PtrStepSz<float> imr,
-                    const cu::PtrStepSz<float> Gl,
-                    const cu::PtrStepSz<float> Gr,
+void PropagateColTiled(cu::PtrStepSz<TI> iml,
+                       cu::PtrStepSz<TG> Gl,
+                       cudaTextureObject_t imr_tex,
+                       cudaTextureObject_t Gr_tex,
+                       cu::PtrStepSz<float> disp,
+                       int direction,
+                       float alpha)
+{
+  // The textures are over the whole stack, so their rows are offset to this pair's.
+  iml = PairView(iml);
+  Gl = PairView(Gl);
+  disp = PairView(disp);
+  const int tex_row0 = blockIdx.z * iml.rows;
+
+  assert(direction == -1 || direction == 1);
+  const int patch_radius = 1;
+
+  // The tile is full columns [col0 - 1, col0 + blockDim.x] of Gl, followed by the same of iml.
+  extern __shared__ __align__(16) unsigned char tile_smem[];
+  const int pitch = blockDim.x + 2;
+  TG* sGl = reinterpret_cast<TG*>(tile_smem);
+  TI* sIl = reinterpret_cast<TI*>(sGl + iml.rows * pitch);
+
+  const int col0 = blockIdx.x * blockDim.x;
+  const int nthreads = blockDim.x * blockDim.y;
+  for (int i = threadIdx.y * blockDim.x + threadIdx.x; i < iml.rows * pitch; i += nthreads) {
+    const int row = i / pitch;
+    const int col = min(max(col0 - 1 + i % pitch, 0), iml.cols - 1);
+    sIl[i] = iml(row, col);
+    sGl[i] = Gl(row, col);
+  }
+  __syncthreads();
+
+  const int tCol = col0 + threadIdx.x;
+  if (tCol < patch_radius || tCol > (iml.cols - patch_radius - 1)) {
+    return;
+  }
+
+  // Each thread get a "chunk" of a column.
+  const int tRowChunk = blockIdx.y * blockDim.y + threadIdx.y;
+  const int chunkSize = iml.rows / blockDim.y;
+
+  const int minRow = max(tRowChunk * chunkSize - 5, patch_radius);
+  const int maxRow = min((tRowChunk + 1)*chunkSize + 5, iml.rows - patch_radius - 1);
+
+  if (minRow >= iml.rows) {
+    return;
+  }
+
+  const int start = (direction > 0) ? minRow : maxRow;
+  const int end = (direction > 0) ? maxRow : minRow;
+
+  const int lx = threadIdx.x + 1;
+  const float x = __int2float_rd(tCol);
+
+  for (int row = start; direction > 0 ? row < end : row > end; row += direction) {
+    const float y = __int2float_rd(row + tex_row0);
+    const float d0 = disp(row, tCol);
+    const float d1 = disp(row - direction, tCol);
+
+    const float cost0 = L1GradientCost3x3Tiled(
+        sIl, sGl, pitch, row, lx, imr_tex, Gr_tex, y, fmaxf(x - d0, patch_radius), alpha);
+
+    const float cost1 = L1GradientCost3x3Tiled(
+        sIl, sGl, pitch, row, lx, imr_tex, Gr_tex, y, fmaxf(x - d1, patch_radius), alpha);
+
+    if (cost1 < cost0) {
+      disp(row, tCol) = fminf(d1, x - patch_radius);
+    }
+  }
+}
+
+
+template <typename TI, typename TG>
+__global__
+void MaskBackground(cu::PtrStepSz<TI> iml,
+                    cu::PtrStepSz<TI> imr,
+                    cu::PtrStepSz<TG> Gl,
+                    cu::PtrStepSz<TG> Gr,
                     cu::PtrStepSz<float> disp,
                     int patch_size,
                     float alpha,
                     float improve_factor)
 {
+  iml = PairView(iml);
+  imr = PairView(imr);
+  Gl = PairView(Gl);
+  Gr = PairView(Gr);
+  disp = PairView(disp);
+
   assert(patch_size % 2 != 0);
   const int patch_radius = patch_size / 2;
 
@@ -295,27 +556,345 @@ void MaskOcclusions(cu::PtrStepSz<float> displ,
 }
 
 
-void AddForegroundNoise(cu::GpuMat& disp, const cu::GpuMat& unit_noise, float scale, cu::GpuMat& mask)
+void AddForegroundNoise(cu::GpuMat& disp,
+                        const cu::GpuMat& unit_noise,
+                        float scale,
+                        cu::GpuMat& mask,
+                        cu::Stream& stream)
 {
-  cu::threshold(disp, mask, 0.0, 1.0, CV_THRESH_BINARY);
-  cu::scaleAdd(unit_noise, scale, disp, disp);
-  cu::multiply(disp, mask, disp);
-  cu::max(disp, 0, disp);
+  cu::threshold(disp, mask, 0.0, 1.0, CV_THRESH_BINARY, stream);
+  cu::scaleAdd(unit_noise, scale, disp, disp, stream);
+  cu::multiply(disp, mask, disp, 1.0, -1, stream);
+  cu::max(disp, 0, disp, stream);
 }
 
 
-void GradientMagnitude(const cu::GpuMat& im,
+void GradientMagnitude(const cv::Ptr<cu::Filter>& sobel_x,
+                       const cv::Ptr<cu::Filter>& sobel_y,
+                       const cu::GpuMat& im,
                        cu::GpuMat& Gx,
                        cu::GpuMat& Gy,
-                       cu::GpuMat& Gmag)
+                       cu::GpuMat& Gmag,
+                       cu::Stream& stream)
 {
   // Compute the image gradient.
-  cv::Ptr<cu::Filter> sobel_x = cu::createSobelFilter(CV_32FC1, CV_32FC1, 1, 0, 3);
-  cv::Ptr<cu::Filter> sobel_y = cu::createSobelFilter(CV_32FC1, CV_32FC1, 0, 1, 3);
+  sobel_x->apply(im, Gx, stream);
+  sobel_y->apply(im, Gy, stream);
+  cu::magnitude(Gx, Gy, Gmag, stream);
+}
+
+
+template <typename TI, typename TG>
+__global__
+void SobelMagnitude(const cu::PtrStepSz<TI> im,
+                    cu::PtrStepSz<TG> Gmag)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= im.cols || y >= im.rows) {
+    return;
+  }
+
+  // Same as cu::createSobelFilter(.., 3), which reflects the border (BORDER_REFLECT_101).
+  const int x0 = (x > 0) ? x - 1 : 1;
+  const int x2 = (x < im.cols - 1) ? x + 1 : im.cols - 2;
+  const int y0 = (y > 0) ? y - 1 : 1;
+  const int y2 = (y < im.rows - 1) ? y + 1 : im.rows - 2;
+
+  const float gx = (ToFloat(im(y0, x2)) + 2.0f * ToFloat(im(y, x2)) + ToFloat(im(y2, x2))) -
+                   (ToFloat(im(y0, x0)) + 2.0f * ToFloat(im(y, x0)) + ToFloat(im(y2, x0)));
+  const float gy = (ToFloat(im(y2, x0)) + 2.0f * ToFloat(im(y2, x)) + ToFloat(im(y2, x2))) -
+                   (ToFloat(im(y0, x0)) + 2.0f * ToFloat(im(y0, x)) + ToFloat(im(y0, x2)));
+
+  Store(sqrtf(gx * gx + gy * gy), Gmag(y, x));
+}
+
+
+void GradientMagnitudeHalf(const cu::GpuMat& im,
+                           cu::GpuMat& Gmag,
+                           cu::Stream& stream)
+{
+  CV_Assert(im.type() == CV_8UC1);
+  Gmag.create(im.size(), CV_16UC1);
+
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(im.cols, block.x), cu::device::divUp(im.rows, block.y));
+  SobelMagnitude<uchar, __half><<<grid, block, 0, cu::StreamAccessor::getStream(stream)>>>(im, Gmag);
+}
+
+
+// The kernels are instantiated for float images and gradients, and for the compact storage (8-bit
+// images and __half gradients in CV_16UC1 buffers).
+static bool IsCompact(const cu::GpuMat& im, const cu::GpuMat& G)
+{
+  if (im.type() == CV_8UC1 && G.type() == CV_16UC1) {
+    return true;
+  }
+  CV_Assert(im.type() == CV_32FC1 && G.type() == CV_32FC1);
+  return false;
+}
+
+
+TextureCache::~TextureCache()
+{
+  for (const Entry& e : entries_) {
+    cudaDestroyTextureObject(e.tex);
+  }
+}
+
+
+cudaTextureObject_t TextureCache::Get(const cu::GpuMat& im)
+{
+  CV_Assert(im.type() == CV_32FC1 || im.type() == CV_8UC1 || im.type() == CV_16UC1);
+
+  for (const Entry& e : entries_) {
+    if (e.data == im.data && e.step == im.step && e.rows == im.rows && e.cols == im.cols && e.type == im.type()) {
+      return e.tex;
+    }
+  }
+
+  // NOTE(milo): Buffers only get reallocated when the image size changes, so old textures are
+  // rarely evicted. Freeing the old buffer (cudaFree) already synchronized the device.
+  if (entries_.size() >= kMaxCachedTextures) {
+    cudaDestroyTextureObject(entries_.front().tex);
+    entries_.erase(entries_.begin());
+  }
+
+  cudaResourceDesc res;
+  std::memset(&res, 0, sizeof(res));
+  res.resType = cudaResourceTypePitch2D;
+  res.res.pitch2D.devPtr = im.data;
+  res.res.pitch2D.desc = (im.type() == CV_32FC1) ? cudaCreateChannelDesc<float>() :
+                         (im.type() == CV_8UC1) ? cudaCreateChannelDesc<uchar>() : cudaCreateChannelDescHalf();
+  res.res.pitch2D.width = im.cols;
+  res.res.pitch2D.height = im.rows;
+  res.res.pitch2D.pitchInBytes = im.step;
+
+  cudaTextureDesc desc;
+  std::memset(&desc, 0, sizeof(desc));
+  desc.addressMode[0] = cudaAddressModeClamp;
+  desc.addressMode[1] = cudaAddressModeClamp;
+  desc.filterMode = cudaFilterModeLinear;
+  // Linear filtering of 8-bit textures needs normalized reads.
+  desc.readMode = (im.type() == CV_8UC1) ? cudaReadModeNormalizedFloat : cudaReadModeElementType;
+  desc.normalizedCoords = 0;
+
+  Entry e;
+  e.data = im.data;
+  e.step = im.step;
+  e.rows = im.rows;
+  e.cols = im.cols;
+  e.type = im.type();
+  cudaSafeCall(cudaCreateTextureObject(&e.tex, &res, &desc, nullptr));
+  entries_.emplace_back(e);
+
+  return e.tex;
+}
+
+
+template <typename TI, typename TG>
+static void LaunchPropagateRow(const cu::GpuMat& iml,
+                               const cu::GpuMat& imr,
+                               const cu::GpuMat& Gl,
+                               const cu::GpuMat& Gr,
+                               cu::GpuMat& disp,
+                               int direction,
+                               float alpha,
+                               TextureCache* textures,
+                               int num_pairs,
+                               cudaStream_t cs)
+{
+  const int column_stripes = 16;
+
+  const int rows = iml.rows / num_pairs;
+
+  // As many rows per block as fit in shared memory (with a 1 row halo on each side).
+  const size_t pixel_bytes = sizeof(TI) + sizeof(TG);
+  const int tile_rows = std::min(16, (int)(kMaxTileBytes / (pixel_bytes * iml.cols)) - 2);
+
+  if (textures != nullptr && tile_rows >= 1) {
+    const dim3 block(column_stripes, tile_rows);
+    const dim3 grid(1, cu::device::divUp(rows, block.y), num_pairs);
+    const size_t smem = pixel_bytes * (tile_rows + 2) * iml.cols;
+    PropagateRowTiled<TI, TG><<<grid, block, smem, cs>>>(
+        iml, Gl, textures->Get(imr), textures->Get(Gr), disp, direction, alpha);
+  } else {
+    const dim3 block(column_stripes, 16);
+    const dim3 grid(cu::device::divUp(column_stripes, block.x), cu::device::divUp(rows, block.y), num_pairs);
+    PropagateRow<TI, TG><<<grid, block, 0, cs>>>(iml, imr, Gl, Gr, disp, direction, 3, alpha);
+  }
+}
+
+
+template <typename TI, typename TG>
+static void LaunchPropagateCol(const cu::GpuMat& iml,
+                               const cu::GpuMat& imr,
+                               const cu::GpuMat& Gl,
+                               const cu::GpuMat& Gr,
+                               cu::GpuMat& disp,
+                               int direction,
+                               float alpha,
+                               TextureCache* textures,
+                               int num_pairs,
+                               cudaStream_t cs)
+{
+  const int row_stripes = 16;
+
+  const int rows = iml.rows / num_pairs;
+
+  // As many columns per block as fit in shared memory (with a 1 column halo on each side).
+  const size_t pixel_bytes = sizeof(TI) + sizeof(TG);
+  const int tile_cols = std::min(16, (int)(kMaxTileBytes / (pixel_bytes * rows)) - 2);
+
+  if (textures != nullptr && tile_cols >= 1) {
+    const dim3 block(tile_cols, row_stripes);
+    const dim3 grid(cu::device::divUp(iml.cols, block.x), 1, num_pairs);
+    const size_t smem = pixel_bytes * (tile_cols + 2) * rows;
+    PropagateColTiled<TI, TG><<<grid, block, smem, cs>>>(
+        iml, Gl, textures->Get(imr), textures->Get(Gr), disp, direction, alpha);
+  } else {
+    const dim3 block(16, row_stripes);
+    const dim3 grid(cu::device::divUp(iml.cols, block.x), cu::device::divUp(row_stripes, block.y), num_pairs);
+    PropagateCol<TI, TG><<<grid, block, 0, cs>>>(iml, imr, Gl, Gr, disp, direction, 3, alpha);
+  }
+}
+
+
+void PropagateSweep(const cu::GpuMat& iml,
+                    const cu::GpuMat& imr,
+                    const cu::GpuMat& Gl,
+                    const cu::GpuMat& Gr,
+                    cu::GpuMat& disp,
+                    float alpha,
+                    TextureCache* textures,
+                    cu::Stream& stream,
+                    int num_pairs)
+{
+  CV_Assert(num_pairs >= 1 && (iml.rows % num_pairs) == 0);
+  cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+
+  if (IsCompact(iml, Gl)) {
+    LaunchPropagateRow<uchar, __half>(iml, imr, Gl, Gr, disp, 1, alpha, textures, num_pairs, cs);
+    LaunchPropagateCol<uchar, __half>(iml, imr, Gl, Gr, disp, 1, alpha, textures, num_pairs, cs);
+    LaunchPropagateRow<uchar, __half>(iml, imr, Gl, Gr, disp, -1, alpha, textures, num_pairs, cs);
+    LaunchPropagateCol<uchar, __half>(iml, imr, Gl, Gr, disp, -1, alpha, textures, num_pairs, cs);
+  } else {
+    LaunchPropagateRow<float, float>(iml, imr, Gl, Gr, disp, 1, alpha, textures, num_pairs, cs);
+    LaunchPropagateCol<float, float>(iml, imr, Gl, Gr, disp, 1, alpha, textures, num_pairs, cs);
+    LaunchPropagateRow<float, float>(iml, imr, Gl, Gr, disp, -1, alpha, textures, num_pairs, cs);
+    LaunchPropagateCol<float, float>(iml, imr, Gl, Gr, disp, -1, alpha, textures, num_pairs, cs);
+  }
+}
+
+
+// Copy an image into page-locked memory (only allocates if the size or type changes).
+static cv::Mat CopyToPinned(const cv::Mat& im, cu::HostMem& pinned)
+{
+  pinned.create(im.rows, im.cols, im.type());
+  cv::Mat header = pinned.createMatHeader();
+  im.copyTo(header);
+  return header;
+}
+
+
+// Zero everything outside of the bands (full-width rects), so that it stays background.
+static void ZeroOutsideBands(Image1f& disp, const std::vector<cv::Rect>& bands)
+{
+  int y = 0;
+  for (const cv::Rect& band : bands) {
+    disp.rowRange(y, band.y).setTo(0);
+    y = band.y + band.height;
+  }
+  disp.rowRange(y, disp.rows).setTo(0);
+}
+
+
+// Forward-warp a disparity image from the previous left camera into the current one. Where
+// several pixels land in the same place, the nearest one wins. Small holes are filled by dilation.
+static Image1f WarpDisparity(const Image1f& disp_prev,
+                             const PinholeCamera& cam,
+                             double baseline,
+                             const Transform3d& T_cur_prev)
+{
+  Image1f out(disp_prev.size(), 0.0f);
+  const double fb = cam.fx() * baseline;
+
+  for (int y = 0; y < disp_prev.rows; ++y) {
+    for (int x = 0; x < disp_prev.cols; ++x) {
+      const float d = disp_prev(y, x);
+      if (d <= 0) {
+        continue;
+      }
+      const Vector3d p_cur = T_cur_prev * cam.Backproject(Vector2d(x, y), fb / d);
+      if (p_cur.z() <= 0) {
+        continue;
+      }
+      const Vector2d uv = cam.Project(p_cur);
+      const int u = (int)std::round(uv.x());
+      const int v = (int)std::round(uv.y());
+      if (u < 0 || u >= out.cols || v < 0 || v >= out.rows) {
+        continue;
+      }
+      float& d_cur = out(v, u);
+      d_cur = std::max(d_cur, (float)(fb / p_cur.z()));
+    }
+  }
 
-  sobel_x->apply(im, Gx);
-  sobel_y->apply(im, Gy);
-  cu::magnitude(Gx, Gy, Gmag);
+  cv::dilate(out, out, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+  return out;
+}
+
+
+// Map a left disparity image into the right image (xr = xl - d), nearest point wins.
+static Image1f LeftToRightDisparity(const Image1f& displ)
+{
+  Image1f dispr(displ.size(), 0.0f);
+
+  for (int y = 0; y < displ.rows; ++y) {
+    for (int x = 0; x < displ.cols; ++x) {
+      const float d = displ(y, x);
+      const int xr = (int)std::round(x - d);
+      if (d <= 0 || xr < 0) {
+        continue;
+      }
+      float& dr = dispr(y, xr);
+      dr = std::max(dr, d);
+    }
+  }
+
+  cv::dilate(dispr, dispr, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+  return dispr;
+}
+
+
+constexpr size_t PatchmatchGpu::kMaxFramesInFlight;
+
+
+PatchmatchGpu::FrameSlot::FrameSlot()
+    : grad_l_done(cu::Event::DISABLE_TIMING),
+      grad_r_done(cu::Event::DISABLE_TIMING),
+      right_done(cu::Event::DISABLE_TIMING),
+      sobel_x_l(cu::createSobelFilter(CV_32FC1, CV_32FC1, 1, 0, 3)),
+      sobel_y_l(cu::createSobelFilter(CV_32FC1, CV_32FC1, 0, 1, 3)),
+      sobel_x_r(cu::createSobelFilter(CV_32FC1, CV_32FC1, 1, 0, 3)),
+      sobel_y_r(cu::createSobelFilter(CV_32FC1, CV_32FC1, 0, 1, 3))
+{
+}
+
+
+PatchmatchGpu::BatchState::BatchState()
+    : sobel_x(cu::createSobelFilter(CV_32FC1, CV_32FC1, 1, 0, 3)),
+      sobel_y(cu::createSobelFilter(CV_32FC1, CV_32FC1, 0, 1, 3))
+{
+}
+
+
+PatchmatchGpu::BatchState::~BatchState()
+{
+  if (graph != nullptr) {
+    cudaGraphExecDestroy(graph);
+  }
 }
 
 
@@ -324,7 +903,32 @@ PatchmatchGpu::PatchmatchGpu(const Params& params)
       detector_(params.detector_params),
       matcher_(params.matcher_params)
 {
+  CHECK_GE(params_.pyramid_levels, 1);
+  if (params_.use_sgm) {
+    for (FrameSlot& slot : slots_) {
+      slot.sgm_l.reset(new SgmGpu(params_.sgm_params));
+      slot.sgm_r.reset(new SgmGpu(params_.sgm_params));
+    }
+  }
+  LOG_IF(WARNING, params_.warm_start) << "PatchmatchGpu: warm_start needs a StereoCamera, ignoring it" << std::endl;
+  params_.warm_start = false;
+}
+
 
+PatchmatchGpu::PatchmatchGpu(const Params& params, const StereoCamera& stereo_rig)
+    : params_(params),
+      detector_(params.detector_params),
+      matcher_(params.matcher_params),
+      has_stereo_rig_(true),
+      stereo_rig_(stereo_rig)
+{
+  CHECK_GE(params_.pyramid_levels, 1);
+  if (params_.use_sgm) {
+    for (FrameSlot& slot : slots_) {
+      slot.sgm_l.reset(new SgmGpu(params_.sgm_params));
+      slot.sgm_r.reset(new SgmGpu(params_.sgm_params));
+    }
+  }
 }
 
 
@@ -333,91 +937,576 @@ void PatchmatchGpu::Match(const Image1b& iml,
                           Image1f& disp,
                           Image1f& dispr)
 {
-  disp = SparseInit(iml, imr, params_.init_dilate_factor);
+  const MatchResult& result = MatchAsync(iml, imr).get();
+  disp = result.disp;
+  dispr = result.dispr;
+}
 
-  // Only allocate the noise image once.
-  if (unit_noise_gpu_.empty()) {
+
+std::shared_future<PatchmatchGpu::MatchResult> PatchmatchGpu::MatchAsync(const Image1b& iml,
+                                                                         const Image1b& imr,
+                                                                         const Transform3d* T_cur_prev)
+{
+  ScopedGpuBudget budget(kGpuBudget);
+
+  // The noise image is shared by all slots, so wait for them before changing its size.
+  if (unit_noise_gpu_.size() != iml.size()) {
+    for (FrameSlot& slot : slots_) {
+      if (slot.in_flight.valid()) {
+        slot.in_flight.wait();
+      }
+    }
     Image1f tmp(iml.size(), 0);
     cv::RNG rng(123);
     rng.fill(tmp, cv::RNG::UNIFORM, -1, 1, true);
     unit_noise_gpu_.upload(tmp);
+    UpdateStaticMasks(iml.rows, iml.cols);
+  }
+
+  FrameSlot& slot = slots_.at(next_slot_);
+  next_slot_ = (next_slot_ + 1) % kMaxFramesInFlight;
+
+  // Wait for the last pair that used this slot before overwriting its buffers.
+  if (slot.in_flight.valid()) {
+    slot.in_flight.wait();
   }
 
-  tmp_.upload(iml);
-  tmp_.convertTo(iml_gpu_, CV_32FC1);
-  tmp_.upload(imr);
-  tmp_.convertTo(imr_gpu_, CV_32FC1);
+  CopyToPinned(iml, slot.h_iml);
+  CopyToPinned(imr, slot.h_imr);
+
+  slot.warm_start = !params_.use_sgm && params_.warm_start && T_cur_prev != nullptr && prev_result_.valid();
+  if (slot.warm_start) {
+    slot.T_cur_prev = *T_cur_prev;
+  }
 
-  GradientMagnitude(iml_gpu_, Gx_, Gy_, Gl_);
-  GradientMagnitude(imr_gpu_, Gx_, Gy_, Gr_);
+  slot.in_flight = std::async(std::launch::async, &PatchmatchGpu::MatchSlot, this,
+                              std::ref(slot), prev_result_).share();
+  prev_result_ = slot.in_flight;
+  return slot.in_flight;
+}
 
-  disp_gpu_.upload(disp);
-  Match(iml_gpu_, imr_gpu_, Gl_, Gr_, disp_gpu_);
 
-  cu::flip(iml_gpu_, iml_gpu_flip_, 1);
-  cu::flip(imr_gpu_, imr_gpu_flip_, 1);
-  cu::flip(Gl_, Gl_flip_, 1);
-  cu::flip(Gr_, Gr_flip_, 1);
+PatchmatchGpu::MatchResult PatchmatchGpu::MatchSlot(FrameSlot& s, std::shared_future<MatchResult> prev)
+{
+  // Runs on its own thread, so it needs its own scope.
+  ScopedGpuBudget budget(kGpuBudget);
 
-  Image1b iml_flip, imr_flip;
-  cv::flip(iml, iml_flip, 1);
-  cv::flip(imr, imr_flip, 1);
-  disp = SparseInit(imr_flip, iml_flip, params_.init_dilate_factor);
-  disp_gpu_r_.upload(disp);
-  Match(imr_gpu_flip_, iml_gpu_flip_, Gr_flip_, Gl_flip_, disp_gpu_r_);
-  cu::flip(disp_gpu_r_, disp_gpu_r_, 1);
+  if (params_.use_sgm) {
+    return MatchSlotSgm(s);
+  }
+
+  const Image1b iml = s.h_iml.createMatHeader();
+  const Image1b imr = s.h_imr.createMatHeader();
+
+  // Start the uploads and gradients for both images, then do the sparse init on the CPU while
+  // those run.
+  // With compact_storage, the 8-bit images are used as is, and the gradients are __half.
+  if (params_.compact_storage) {
+    s.iml.upload(s.h_iml, s.stream_l);
+    GradientMagnitudeHalf(s.iml, s.Gl, s.stream_l);
+  } else {
+    s.tmp_l.upload(s.h_iml, s.stream_l);
+    s.tmp_l.convertTo(s.iml, CV_32FC1, s.stream_l);
+    GradientMagnitude(s.sobel_x_l, s.sobel_y_l, s.iml, s.Gx_l, s.Gy_l, s.Gl, s.stream_l);
+  }
+  s.grad_l_done.record(s.stream_l);
+
+  if (params_.compact_storage) {
+    s.imr.upload(s.h_imr, s.stream_r);
+    GradientMagnitudeHalf(s.imr, s.Gr, s.stream_r);
+  } else {
+    s.tmp_r.upload(s.h_imr, s.stream_r);
+    s.tmp_r.convertTo(s.imr, CV_32FC1, s.stream_r);
+    GradientMagnitude(s.sobel_x_r, s.sobel_y_r, s.imr, s.Gx_r, s.Gy_r, s.Gr, s.stream_r);
+  }
+  s.grad_r_done.record(s.stream_r);
+
+  // Bands of rows with textured foreground (that isn't the vehicle). The rest of the image is never
+  // matched.
+  std::vector<cv::Rect> bands = static_bands_;
+  if (params_.foreground_tiles) {
+    Image1b mask;
+    stereo::ForegroundTextureMask(iml, mask, params_.foreground_ksize, params_.foreground_min_grad, params_.foreground_downsize);
+    if (!blocked_l_.empty()) {
+      mask.setTo(0, blocked_l_);
+    }
+    bands = stereo::TileRowBands(stereo::ForegroundTiles(mask, params_.tile_size, params_.tile_dilate), iml.cols);
+  }
 
+  // Warm start from the previous pair if possible. The right pass runs on flipped images, so its
+  // guess is flipped too.
+  Image1f init_l, init_r_flip;
+  float init_noise = kSparseInitNoise;
+  bool warm = false;
+
+  if (s.warm_start) {
+    const MatchResult& prev_result = prev.get();
+    if (prev_result.disp.size() == iml.size()) {
+      const PinholeCamera cam = stereo_rig_.LeftCamera().Rescale(iml.rows, iml.cols);
+      init_l = WarpDisparity(prev_result.disp, cam, stereo_rig_.Baseline(), s.T_cur_prev);
+      cv::flip(LeftToRightDisparity(init_l), init_r_flip, 1);
+      init_noise = params_.warm_start_noise;
+      warm = true;
+    }
+  }
+
+  if (!warm) {
+    init_l = SparseInit(iml, imr, params_.init_dilate_factor, blocked_l_);
+  }
+
+  // LEFT: Needs the right gradient before propagating.
+  ZeroOutsideBands(init_l, bands);
+  s.disp.upload(CopyToPinned(init_l, s.h_disp_init_l), s.stream_l);
+  s.stream_l.waitEvent(s.grad_r_done);
+  SolveBands(bands, s.iml, s.imr, s.Gl, s.Gr, s.disp, s.mask_l, s.pyr_l, s.textures, init_noise, s.stream_l);
+
+  // RIGHT: Match the flipped images, so that the kernels are the same. The sparse init for this
+  // pass runs on the CPU while the left pass propagates.
+  // NOTE(milo): flip() only moves elements, so it's exact for the __half gradients too (CV_16UC1).
+  s.stream_r.waitEvent(s.grad_l_done);
+  cu::flip(s.iml, s.iml_flip, 1, s.stream_r);
+  cu::flip(s.imr, s.imr_flip, 1, s.stream_r);
+  cu::flip(s.Gl, s.Gl_flip, 1, s.stream_r);
+  cu::flip(s.Gr, s.Gr_flip, 1, s.stream_r);
+
+  if (!warm) {
+    Image1b iml_flip, imr_flip;
+    cv::flip(iml, iml_flip, 1);
+    cv::flip(imr, imr_flip, 1);
+    init_r_flip = SparseInit(imr_flip, iml_flip, params_.init_dilate_factor, blocked_r_flip_);
+  }
+
+  // Flipping doesn't change the rows, so the bands are the same.
+  ZeroOutsideBands(init_r_flip, bands);
+  s.dispr_flip.upload(CopyToPinned(init_r_flip, s.h_disp_init_r), s.stream_r);
+  SolveBands(bands, s.imr_flip, s.iml_flip, s.Gr_flip, s.Gl_flip, s.dispr_flip, s.mask_r, s.pyr_r, s.textures, init_noise, s.stream_r);
+  cu::flip(s.dispr_flip, s.dispr, 1, s.stream_r);
+
+  return FinishSlot(s, iml.rows, iml.cols);
+}
+
+
+PatchmatchGpu::MatchResult PatchmatchGpu::MatchSlotSgm(FrameSlot& s)
+{
+  const int rows = s.h_iml.rows;
+  const int cols = s.h_iml.cols;
+
+  // The 8-bit uploads are the same as for patchmatch, but no gradients are needed.
+  s.tmp_l.upload(s.h_iml, s.stream_l);
+  s.grad_l_done.record(s.stream_l);
+  s.tmp_r.upload(s.h_imr, s.stream_r);
+  s.grad_r_done.record(s.stream_r);
+
+  // LEFT
+  s.stream_l.waitEvent(s.grad_r_done);
+  s.sgm_l->Match(s.tmp_l, s.tmp_r, s.disp, s.stream_l);
+
+  // RIGHT: Match the flipped images, like MatchSlot().
+  s.stream_r.waitEvent(s.grad_l_done);
+  cu::flip(s.tmp_l, s.tmp_l_flip, 1, s.stream_r);
+  cu::flip(s.tmp_r, s.tmp_r_flip, 1, s.stream_r);
+  s.sgm_r->Match(s.tmp_r_flip, s.tmp_l_flip, s.dispr_flip, s.stream_r);
+  cu::flip(s.dispr_flip, s.dispr, 1, s.stream_r);
+
+  return FinishSlot(s, rows, cols);
+}
+
+
+PatchmatchGpu::MatchResult PatchmatchGpu::FinishSlot(FrameSlot& s, int rows, int cols)
+{
+  s.h_dispr.create(rows, cols, CV_32FC1);
+  s.dispr.download(s.h_dispr, s.stream_r);
+  s.right_done.record(s.stream_r);
+
+  // Masking occlusions needs both passes.
+  s.stream_l.waitEvent(s.right_done);
   const dim3 block(16, 16);
-  const dim3 grid(cu::device::divUp(iml.cols, block.x), cu::device::divUp(iml.rows, block.y));
-  MaskOcclusions<<<grid, block>>>(disp_gpu_, disp_gpu_r_);
+  const dim3 grid(cu::device::divUp(cols, block.x), cu::device::divUp(rows, block.y));
+  MaskOcclusions<<<grid, block, 0, cu::StreamAccessor::getStream(s.stream_l)>>>(s.disp, s.dispr);
+
+  s.h_disp.create(rows, cols, CV_32FC1);
+  s.disp.download(s.h_disp, s.stream_l);
+
+  s.stream_l.waitForCompletion();
+  s.stream_r.waitForCompletion();
 
-  disp_gpu_.download(disp);
-  disp_gpu_r_.download(dispr);
+  // Copy out of the pinned buffers, since the slot will reuse them.
+  MatchResult result;
+  s.h_disp.createMatHeader().copyTo(result.disp);
+  s.h_dispr.createMatHeader().copyTo(result.dispr);
+
+  // Whatever was matched on the vehicle body is background.
+  if (!blocked_l_.empty()) {
+    result.disp.setTo(0, blocked_l_);
+  }
+  if (!blocked_r_.empty()) {
+    result.dispr.setTo(0, blocked_r_);
+  }
+  return result;
+}
+
+
+void PatchmatchGpu::UpdateStaticMasks(int rows, int cols)
+{
+  blocked_l_.release();
+  blocked_r_.release();
+  blocked_r_flip_.release();
+  static_bands_ = { cv::Rect(0, 0, cols, rows) };
+
+  const Image1b valid_l = stereo_rig_.LeftMask().Valid(rows, cols);
+  const Image1b valid_r = stereo_rig_.RightMask().Valid(rows, cols);
+  if (valid_l.empty() && valid_r.empty()) {
+    return;
+  }
+
+  if (!valid_l.empty()) {
+    cv::bitwise_not(valid_l, blocked_l_);
+  }
+  if (!valid_r.empty()) {
+    cv::bitwise_not(valid_r, blocked_r_);
+    cv::flip(blocked_r_, blocked_r_flip_, 1);
+  }
+
+  // NOTE(milo): Both passes use the same bands, so a row is matched if either image can see any of
+  // it. That's usually the vehicle frame across the top or bottom of both images.
+  static_bands_.clear();
+  for (int y = 0; y < rows; ++y) {
+    const bool any_valid = (valid_l.empty() || cv::countNonZero(valid_l.row(y)) > 0) ||
+                           (valid_r.empty() || cv::countNonZero(valid_r.row(y)) > 0);
+    if (!any_valid) {
+      continue;
+    }
+    if (!static_bands_.empty() && (static_bands_.back().y + static_bands_.back().height) == y) {
+      ++static_bands_.back().height;
+    } else {
+      static_bands_.emplace_back(0, y, cols, 1);
+    }
+  }
 }
 
 
-void PatchmatchGpu::Match(const cu::GpuMat& iml,
+void PatchmatchGpu::MatchBatch(const std::vector<Image1b>& imls,
+                               const std::vector<Image1b>& imrs,
+                               std::vector<Image1f>& disps,
+                               std::vector<Image1f>& disprs)
+{
+  ScopedGpuBudget budget(kGpuBudget);
+
+  CHECK_EQ(imls.size(), imrs.size());
+  CHECK(!params_.use_sgm) << "MatchBatch() only does patchmatch" << std::endl;
+
+  const int K = (int)imls.size();
+  disps.resize(K);
+  disprs.resize(K);
+  if (K == 0) {
+    return;
+  }
+
+  const int rows = imls.front().rows;
+  const int cols = imls.front().cols;
+  for (int k = 0; k < K; ++k) {
+    CHECK(imls.at(k).size() == imls.front().size() && imrs.at(k).size() == imls.front().size())
+        << "All of the pairs in a batch must be the same size" << std::endl;
+  }
+  CHECK_EQ(0, rows % (1 << (params_.pyramid_levels - 1)))
+      << "MatchBatch() needs the image height to be a multiple of 2^(pyramid_levels - 1)" << std::endl;
+
+  BatchState& b = batch_;
+
+  const cv::Vec3i size(rows, cols, K);
+  if (size != b.size) {
+    if (b.graph != nullptr) {
+      cudaSafeCall(cudaGraphExecDestroy(b.graph));
+      b.graph = nullptr;
+    }
+    b.size = size;
+    b.allocated = false;
+
+    Image1f tmp(K * rows, cols, 0.0f);
+    cv::RNG rng(123);
+    rng.fill(tmp, cv::RNG::UNIFORM, -1, 1, true);
+    b.unit_noise.upload(tmp);
+  }
+
+  // Stack the pairs, and do the sparse init for both passes (the right one on flipped images).
+  b.h_iml.create(K * rows, cols, CV_8UC1);
+  b.h_imr.create(K * rows, cols, CV_8UC1);
+  b.h_disp_init_l.create(K * rows, cols, CV_32FC1);
+  b.h_disp_init_r.create(K * rows, cols, CV_32FC1);
+  cv::Mat h_iml = b.h_iml.createMatHeader();
+  cv::Mat h_imr = b.h_imr.createMatHeader();
+  cv::Mat h_init_l = b.h_disp_init_l.createMatHeader();
+  cv::Mat h_init_r = b.h_disp_init_r.createMatHeader();
+
+  for (int k = 0; k < K; ++k) {
+    const cv::Range range(k * rows, (k + 1) * rows);
+    imls.at(k).copyTo(h_iml.rowRange(range));
+    imrs.at(k).copyTo(h_imr.rowRange(range));
+    SparseInit(imls.at(k), imrs.at(k), params_.init_dilate_factor).copyTo(h_init_l.rowRange(range));
+
+    Image1b iml_flip, imr_flip;
+    cv::flip(imls.at(k), iml_flip, 1);
+    cv::flip(imrs.at(k), imr_flip, 1);
+    SparseInit(imr_flip, iml_flip, params_.init_dilate_factor).copyTo(h_init_r.rowRange(range));
+  }
+
+  // Gradients are computed per pair (on ROIs of the stacked buffers), so that the filters don't
+  // mix pairs.
+  if (params_.compact_storage) {
+    b.iml.upload(b.h_iml, b.stream);
+    b.imr.upload(b.h_imr, b.stream);
+    b.Gl.create(b.iml.size(), CV_16UC1);
+    b.Gr.create(b.imr.size(), CV_16UC1);
+  } else {
+    b.tmp_l.upload(b.h_iml, b.stream);
+    b.tmp_r.upload(b.h_imr, b.stream);
+    b.tmp_l.convertTo(b.iml, CV_32FC1, b.stream);
+    b.tmp_r.convertTo(b.imr, CV_32FC1, b.stream);
+    for (cu::GpuMat* G : { &b.Gl, &b.Gr, &b.Gx, &b.Gy }) {
+      G->create(b.iml.size(), CV_32FC1);
+    }
+  }
+
+  for (int k = 0; k < K; ++k) {
+    const cv::Range range(k * rows, (k + 1) * rows);
+    cu::GpuMat Gl = b.Gl.rowRange(range);
+    cu::GpuMat Gr = b.Gr.rowRange(range);
+    if (params_.compact_storage) {
+      GradientMagnitudeHalf(b.iml.rowRange(range), Gl, b.stream);
+      GradientMagnitudeHalf(b.imr.rowRange(range), Gr, b.stream);
+    } else {
+      cu::GpuMat Gx = b.Gx.rowRange(range);
+      cu::GpuMat Gy = b.Gy.rowRange(range);
+      GradientMagnitude(b.sobel_x, b.sobel_y, b.iml.rowRange(range), Gx, Gy, Gl, b.stream);
+      GradientMagnitude(b.sobel_x, b.sobel_y, b.imr.rowRange(range), Gx, Gy, Gr, b.stream);
+    }
+  }
+
+  // Flipping horizontally keeps every pair in its own rows.
+  cu::flip(b.iml, b.iml_flip, 1, b.stream);
+  cu::flip(b.imr, b.imr_flip, 1, b.stream);
+  cu::flip(b.Gl, b.Gl_flip, 1, b.stream);
+  cu::flip(b.Gr, b.Gr_flip, 1, b.stream);
+  b.disp.upload(b.h_disp_init_l, b.stream);
+  b.dispr_flip.upload(b.h_disp_init_r, b.stream);
+
+  // NOTE(milo): Nothing can be allocated during a capture, so the first batch of each size runs
+  // directly (and allocates everything), and the next one is captured. Kernel arguments are baked
+  // into the graph, which is fine because the buffers (and textures) stay the same until the size
+  // changes.
+  cudaStream_t cs = cu::StreamAccessor::getStream(b.stream);
+  const bool capture = params_.batch_cuda_graph && b.allocated && !b.graph_failed && b.graph == nullptr;
+
+  if (params_.batch_cuda_graph && b.graph != nullptr) {
+    cudaSafeCall(cudaGraphLaunch(b.graph, cs));
+
+  } else if (capture) {
+    cudaGraph_t graph = nullptr;
+    bool ok = cudaStreamBeginCapture(cs, cudaStreamCaptureModeThreadLocal) == cudaSuccess;
+    if (ok) {
+      try {
+        PropagateBatch(b, K);
+      } catch (const cv::Exception&) {
+        ok = false;
+      }
+      ok = (cudaStreamEndCapture(cs, &graph) == cudaSuccess) && ok;
+    }
+    ok = ok && (cudaGraphInstantiate(&b.graph, graph, nullptr, nullptr, 0) == cudaSuccess);
+    if (graph != nullptr) {
+      cudaGraphDestroy(graph);
+    }
+
+    if (ok) {
+      cudaSafeCall(cudaGraphLaunch(b.graph, cs));
+    } else {
+      LOG(WARNING) << "PatchmatchGpu: couldn't capture MatchBatch() as a CUDA graph, launching the kernels instead" << std::endl;
+      cudaGetLastError();
+      b.graph = nullptr;
+      b.graph_failed = true;
+      PropagateBatch(b, K);
+    }
+
+  } else {
+    PropagateBatch(b, K);
+  }
+  b.allocated = true;
+
+  b.h_disp.create(K * rows, cols, CV_32FC1);
+  b.h_dispr.create(K * rows, cols, CV_32FC1);
+  b.disp.download(b.h_disp, b.stream);
+  b.dispr.download(b.h_dispr, b.stream);
+  b.stream.waitForCompletion();
+
+  const cv::Mat h_disp = b.h_disp.createMatHeader();
+  const cv::Mat h_dispr = b.h_dispr.createMatHeader();
+  for (int k = 0; k < K; ++k) {
+    const cv::Range range(k * rows, (k + 1) * rows);
+    h_disp.rowRange(range).copyTo(disps.at(k));
+    h_dispr.rowRange(range).copyTo(disprs.at(k));
+  }
+}
+
+
+void PatchmatchGpu::PropagateBatch(BatchState& b, int num_pairs)
+{
+  Solve(b.iml, b.imr, b.Gl, b.Gr, b.disp, b.mask_l, b.pyr_l, b.textures,
+        b.unit_noise, kSparseInitNoise, num_pairs, b.stream);
+  Solve(b.imr_flip, b.iml_flip, b.Gr_flip, b.Gl_flip, b.dispr_flip, b.mask_r, b.pyr_r, b.textures,
+        b.unit_noise, kSparseInitNoise, num_pairs, b.stream);
+  cu::flip(b.dispr_flip, b.dispr, 1, b.stream);
+
+  // Occlusions only compare pixels in the same row, so this doesn't need to know about the pairs.
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(b.disp.cols, block.x), cu::device::divUp(b.disp.rows, block.y));
+  MaskOcclusions<<<grid, block, 0, cu::StreamAccessor::getStream(b.stream)>>>(b.disp, b.dispr);
+}
+
+
+void PatchmatchGpu::Solve(const cu::GpuMat& iml,
                           const cu::GpuMat& imr,
                           const cu::GpuMat& Gl,
                           const cu::GpuMat& Gr,
-                          cu::GpuMat& disp)
+                          cu::GpuMat& disp,
+                          cu::GpuMat& mask,
+                          std::vector<PyramidLevel>& pyr,
+                          TextureCache& textures,
+                          const cu::GpuMat& unit_noise,
+                          float init_noise,
+                          int num_pairs,
+                          cu::Stream& stream)
 {
-  const int column_stripes = 16;
-  const int row_stripes = 16;
-  const dim3 row_block(column_stripes, 16);
-  const dim3 row_grid(cu::device::divUp(column_stripes, row_block.x),
-                      cu::device::divUp(iml.rows, row_block.y));
-  const dim3 col_block(16, row_stripes);
-  const dim3 col_grid(cu::device::divUp(iml.cols, row_block.x),
-                      cu::device::divUp(row_stripes, row_block.y));
-
-  for (int iter = 0; iter < params_.patchmatch_iters; ++iter) {
-    AddForegroundNoise(disp, unit_noise_gpu_, 32.0 / std::pow(2.0, (float)iter), mask_gpu_);
-    cudaDeviceSynchronize();
-    PropagateRow<<<row_grid, row_block>>>(iml, imr, Gl, Gr, disp, 1, 3, params_.cost_alpha);
-    cudaDeviceSynchronize();
-    PropagateCol<<<col_grid, col_block>>>(iml, imr, Gl, Gr, disp, 1, 3, params_.cost_alpha);
-    cudaDeviceSynchronize();
-    PropagateRow<<<row_grid, row_block>>>(iml, imr, Gl, Gr, disp, -1, 3, params_.cost_alpha);
-    cudaDeviceSynchronize();
-    PropagateCol<<<col_grid, col_block>>>(iml, imr, Gl, Gr, disp, -1, 3, params_.cost_alpha);
+  const int coarse_levels = params_.pyramid_levels - 1;
+  if (coarse_levels == 0) {
+    Propagate(iml, imr, Gl, Gr, disp, mask, textures, unit_noise, params_.patchmatch_iters, init_noise, num_pairs, stream);
+    return;
   }
 
-  const dim3 block(16, 16);
-  const dim3 grid(cu::device::divUp(iml.cols, block.x), cu::device::divUp(iml.rows, block.y));
-  MaskBackground<<<grid, block>>>(iml, imr, Gl, Gr, disp, 3, params_.cost_alpha, params_.cost_improve_factor);
+  // pyr.at(k) is at 1/2^(k+1) resolution. The gradients are downsampled along with the images.
+  // pyrDown() can't filter __half, so compact gradients are computed again from each level.
+  const bool compact = IsCompact(iml, Gl);
+  pyr.resize(coarse_levels);
+  for (int k = 0; k < coarse_levels; ++k) {
+    const PyramidLevel* finer = (k > 0) ? &pyr.at(k - 1) : nullptr;
+    PyramidLevel& level = pyr.at(k);
+    cu::pyrDown(finer ? finer->iml : iml, level.iml, stream);
+    cu::pyrDown(finer ? finer->imr : imr, level.imr, stream);
+    if (compact) {
+      GradientMagnitudeHalf(level.iml, level.Gl, stream);
+      GradientMagnitudeHalf(level.imr, level.Gr, stream);
+    } else {
+      cu::pyrDown(finer ? finer->Gl : Gl, level.Gl, stream);
+      cu::pyrDown(finer ? finer->Gr : Gr, level.Gr, stream);
+    }
+  }
+
+  // Disparity scales with resolution. Use nearest neighbor so that edges between the foreground
+  // and background (zero) don't get blended.
+  PyramidLevel& coarsest = pyr.back();
+  cu::resize(disp, coarsest.disp, coarsest.iml.size(), 0, 0, cv::INTER_NEAREST, stream);
+  cu::multiply(coarsest.disp, 1.0 / (double)(1 << coarse_levels), coarsest.disp, 1.0, -1, stream);
+
+  for (int k = coarse_levels - 1; k >= 0; --k) {
+    PyramidLevel& level = pyr.at(k);
+    const float level_noise = (k == coarse_levels - 1) ? init_noise / (float)(1 << coarse_levels) : kUpsampleNoise;
+    Propagate(level.iml, level.imr, level.Gl, level.Gr, level.disp, level.mask, textures, unit_noise,
+              params_.coarse_iters, level_noise, num_pairs, stream);
+
+    // Upsample as the initial guess for the next finer level.
+    cu::GpuMat& finer_disp = (k > 0) ? pyr.at(k - 1).disp : disp;
+    const cv::Size finer_size = (k > 0) ? pyr.at(k - 1).iml.size() : iml.size();
+    cu::resize(level.disp, finer_disp, finer_size, 0, 0, cv::INTER_NEAREST, stream);
+    cu::multiply(finer_disp, 2.0, finer_disp, 1.0, -1, stream);
+  }
+
+  Propagate(iml, imr, Gl, Gr, disp, mask, textures, unit_noise, params_.patchmatch_iters, kUpsampleNoise, num_pairs, stream);
+}
+
 
-  cudaDeviceSynchronize();
+void PatchmatchGpu::SolveBands(const std::vector<cv::Rect>& bands,
+                               const cu::GpuMat& iml,
+                               const cu::GpuMat& imr,
+                               const cu::GpuMat& Gl,
+                               const cu::GpuMat& Gr,
+                               cu::GpuMat& disp,
+                               cu::GpuMat& mask,
+                               std::vector<PyramidLevel>& pyr,
+                               TextureCache& textures,
+                               float init_noise,
+                               cu::Stream& stream)
+{
+  if (bands.size() == 1 && bands.front().size() == iml.size()) {
+    Solve(iml, imr, Gl, Gr, disp, mask, pyr, textures, unit_noise_gpu_, init_noise, 1, stream);
+    return;
+  }
+
+  // NOTE(milo): Use ROIs of one full-size mask, so that it isn't reallocated for every band.
+  mask.create(disp.size(), disp.type());
+
+  // Start each band on a row that textures (of imr and Gr) can point to.
+  size_t row_multiple = 1;
+  while ((row_multiple * imr.step) % kTextureAlignment != 0 || (row_multiple * Gr.step) % kTextureAlignment != 0) {
+    ++row_multiple;
+  }
+
+  for (const cv::Rect& b : bands) {
+    const int y0 = (b.y / (int)row_multiple) * (int)row_multiple;
+    const cv::Rect band(0, y0, b.width, b.y + b.height - y0);
+
+    cu::GpuMat disp_band = disp(band);
+    cu::GpuMat mask_band = mask(band);
+    Solve(iml(band), imr(band), Gl(band), Gr(band), disp_band, mask_band, pyr, textures, unit_noise_gpu_, init_noise, 1, stream);
+  }
+}
+
+
+void PatchmatchGpu::Propagate(const cu::GpuMat& iml,
+                              const cu::GpuMat& imr,
+                              const cu::GpuMat& Gl,
+                              const cu::GpuMat& Gr,
+                              cu::GpuMat& disp,
+                              cu::GpuMat& mask,
+                              TextureCache& textures,
+                              const cu::GpuMat& unit_noise_full,
+                              int iters,
+                              float init_noise,
+                              int num_pairs,
+                              cu::Stream& stream)
+{
+  // NOTE(milo): Kernels in the same stream run in order, so there's no need to synchronize the
+  // device between them (which would also stall the other streams).
+  cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+
+  // Coarser levels use the top-left corner of the noise image.
+  const cu::GpuMat unit_noise = unit_noise_full(cv::Rect(0, 0, iml.cols, iml.rows));
+
+  for (int iter = 0; iter < iters; ++iter) {
+    AddForegroundNoise(disp, unit_noise, init_noise / std::pow(2.0, (float)iter), mask, stream);
+    PropagateSweep(iml, imr, Gl, Gr, disp, params_.cost_alpha,
+                   params_.tiled_propagation ? &textures : nullptr, stream, num_pairs);
+  }
+
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(iml.cols, block.x), cu::device::divUp(iml.rows / num_pairs, block.y), num_pairs);
+  if (IsCompact(iml, Gl)) {
+    MaskBackground<uchar, __half><<<grid, block, 0, cs>>>(
+        iml, imr, Gl, Gr, disp, 3, params_.cost_alpha, params_.cost_improve_factor);
+  } else {
+    MaskBackground<float, float><<<grid, block, 0, cs>>>(
+        iml, imr, Gl, Gr, disp, 3, params_.cost_alpha, params_.cost_improve_factor);
+  }
 }
 
 
 Image1f PatchmatchGpu::SparseInit(const Image1b& iml,
                                   const Image1b& imr,
-                                  int dilate_factor)
+                                  int dilate_factor,
+                                  const Image1b& blocked)
 {
   VecPoint2f left_kp;
+  sparse_init_lock_.lock();
   detector_.Detect(iml, VecPoint2f(), left_kp);
-  const std::vector<double>& left_kp_disps = matcher_.MatchRectified(iml, imr, left_kp);
+  const std::vector<double> left_kp_disps = matcher_.MatchRectified(iml, imr, left_kp);
+  sparse_init_lock_.unlock();
 
   // Default to zero disparity (background).
   Image1f disps(iml.size(), 0.0f);
@@ -433,6 +1522,11 @@ Image1f PatchmatchGpu::SparseInit(const Image1b& iml,
     }
   }
 
+  // Keypoints on the vehicle body would spread its disparity into the scene.
+  if (!blocked.empty()) {
+    disps.setTo(0, blocked);
+  }
+
   const int dilate_size = (int)std::pow(2, dilate_factor) + 1;
   cv::Mat element = cv::getStructuringElement(
       cv::MORPH_RECT, cv::Size(2*dilate_size+1, 2*dilate_size+1), cv::Point(dilate_size, dilate_size));
@@ -2,15 +2,27 @@
 
 // #include <cuda_runtime.h>
 
+#include <array>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cuda_fp16.h>
+
 #include <opencv2/core/cuda.hpp>
 #include <opencv2/core/cuda/common.hpp>
+#include <opencv2/cudafilters.hpp>
 
 #include "core/macros.hpp"
+#include "core/eigen_types.hpp"
 #include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_camera.hpp"
 #include "params/params_base.hpp"
 #include "params/yaml_parser.hpp"
 #include "feature_tracking/feature_detector.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
+#include "patchmatch_gpu/sgm_gpu.h"
 
 namespace bm {
 namespace pm {
@@ -19,38 +31,72 @@ namespace cu = cv::cuda;
 using namespace core;
 
 
+// Bilinear interpolation (in float, whatever the storage type is).
 template <typename T>
 __device__ __forceinline__
-T GetSubpixel(const cu::PtrStepSz<T> im, float row, float col);
+float GetSubpixel(const cu::PtrStepSz<T> im, float row, float col);
 
 
+// The kernels below are templated on the image type TI and gradient type TG, so that the images
+// can be stored as float or uchar, and the gradients as float or __half (see compact_storage).
+// Costs are always computed in float, and disparity is always float.
+template <typename TI, typename TG>
 __global__
-void PropagateRow(const cu::PtrStepSz<float> iml,
-                  const cu::PtrStepSz<float> imr,
-                  const cu::PtrStepSz<float> Gl,
-                  const cu::PtrStepSz<float> Gr,
+void PropagateRow(const cu::PtrStepSz<TI> iml,
+                  const cu::PtrStepSz<TI> imr,
+                  const cu::PtrStepSz<TG> Gl,
+                  const cu::PtrStepSz<TG> Gr,
                   cu::PtrStepSz<float> disp,
                   int direction,
                   int patch_size,
                   float alpha);
 
 
+template <typename TI, typename TG>
 __global__
-void PropagateCol(const cu::PtrStepSz<float> iml,
-                  const cu::PtrStepSz<float> imr,
-                  const cu::PtrStepSz<float> Gl,
-                  const cu::PtrStepSz<float> Gr,
+void PropagateCol(const cu::PtrStepSz<TI> iml,
+                  const cu::PtrStepSz<TI> imr,
+                  const cu::PtrStepSz<TG> Gl,
+                  const cu::PtrStepSz<TG> Gr,
                   cu::PtrStepSz<float> disp,
                   int direction,
                   int patch_size,
                   float alpha);
 
 
+// Same as PropagateRow and PropagateCol (with 3x3 patches), but each block first stages its rows
+// (or columns) of iml and Gl, plus a 1px halo, in shared memory. The subpixel reads from imr and Gr
+// go through linear-filtered textures (see TextureCache). The dynamic shared memory size must be
+// (blockDim.y + 2) * iml.cols pixels for rows, and (blockDim.x + 2) * iml.rows for cols, at
+// sizeof(TI) + sizeof(TG) bytes per pixel.
+template <typename TI, typename TG>
+__global__
+void PropagateRowTiled(const cu::PtrStepSz<TI> iml,
+                       const cu::PtrStepSz<TG> Gl,
+                       cudaTextureObject_t imr_tex,
+                       cudaTextureObject_t Gr_tex,
+                       cu::PtrStepSz<float> disp,
+                       int direction,
+                       float alpha);
+
+
+template <typename TI, typename TG>
+__global__
+void PropagateColTiled(const cu::PtrStepSz<TI> iml,
+                       const cu::PtrStepSz<TG> Gl,
+                       cudaTextureObject_t imr_tex,
+                       cudaTextureObject_t Gr_tex,
+                       cu::PtrStepSz<float> disp,
+                       int direction,
+                       float alpha);
+
+
+template <typename TI, typename TG>
 __global__
-void MaskBackground(const cu::PtrStepSz<float> iml,
-                    const cu::PtrStepSz<float> imr,
-                    const cu::PtrStepSz<float> Gl,
-                    const cu::PtrStepSz<float> Gr,
+void MaskBackground(const cu::PtrStepSz<TI> iml,
+                    const cu::PtrStepSz<TI> imr,
+                    const cu::PtrStepSz<TG> Gl,
+                    const cu::PtrStepSz<TG> Gr,
                     cu::PtrStepSz<float> disp,
                     int patch_size,
                     float alpha,
@@ -65,13 +111,73 @@ void MaskOcclusions(cu::PtrStepSz<float> displ,
 void AddForegroundNoise(cu::GpuMat& disp,
                         const cu::GpuMat& unit_noise,
                         float scale,
-                        cu::GpuMat& mask);
+                        cu::GpuMat& mask,
+                        cu::Stream& stream = cu::Stream::Null());
 
 
-void GradientMagnitude(const cu::GpuMat& im,
+// Sobel filters aren't safe to share between streams, so the caller owns them (see MakeSobelFilters).
+void GradientMagnitude(const cv::Ptr<cu::Filter>& sobel_x,
+                       const cv::Ptr<cu::Filter>& sobel_y,
+                       const cu::GpuMat& im,
                        cu::GpuMat& Gx,
                        cu::GpuMat& Gy,
-                       cu::GpuMat& Gmag);
+                       cu::GpuMat& Gmag,
+                       cu::Stream& stream = cu::Stream::Null());
+
+
+// 3x3 Sobel gradient magnitude of an 8-bit image, stored as __half (in a CV_16UC1 GpuMat). This is
+// one kernel, and doesn't need the Gx and Gy buffers.
+template <typename TI, typename TG>
+__global__
+void SobelMagnitude(const cu::PtrStepSz<TI> im,
+                    cu::PtrStepSz<TG> Gmag);
+
+void GradientMagnitudeHalf(const cu::GpuMat& im,
+                           cu::GpuMat& Gmag,
+                           cu::Stream& stream = cu::Stream::Null());
+
+
+// Linear-filtered texture objects for GpuMats, so that kernels get hardware bilinear
+// interpolation (with 8-bit weights, so slightly coarser than GetSubpixel). A texture is created
+// the first time a buffer is seen, and reused until that buffer is reallocated. CV_32FC1 buffers
+// are float, CV_8UC1 are read normalized to [0, 1], and CV_16UC1 are read as __half.
+class TextureCache final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(TextureCache);
+  TextureCache() = default;
+  ~TextureCache();
+
+  cudaTextureObject_t Get(const cu::GpuMat& im);
+
+ private:
+  struct Entry final
+  {
+    const uchar* data;
+    size_t step;
+    int rows;
+    int cols;
+    int type;
+    cudaTextureObject_t tex;
+  };
+
+  std::vector<Entry> entries_;
+};
+
+
+// One forward and backward sweep of row and column propagation. If textures is given, the tiled
+// kernels are used (falling back to the others when a tile won't fit in shared memory). The images
+// and gradients are either all CV_32FC1, or CV_8UC1 images with __half (CV_16UC1) gradients.
+// The buffers can hold num_pairs pairs of the same size stacked vertically, which are propagated
+// independently, but with one launch per step for all of them.
+void PropagateSweep(const cu::GpuMat& iml,
+                    const cu::GpuMat& imr,
+                    const cu::GpuMat& Gl,
+                    const cu::GpuMat& Gr,
+                    cu::GpuMat& disp,
+                    float alpha,
+                    TextureCache* textures,
+                    cu::Stream& stream = cu::Stream::Null(),
+                    int num_pairs = 1);
 
 
 class PatchmatchGpu final {
@@ -87,40 +193,249 @@ class PatchmatchGpu final {
     int init_dilate_factor = 4;
     float cost_improve_factor = 0.8;
 
+    // If > 1, solve at 1/2^(pyramid_levels-1) resolution first (coarse_iters at each coarse level),
+    // and upsample each result as the initial guess for the next level. Then fewer patchmatch_iters
+    // are needed at full resolution.
+    int pyramid_levels = 1;
+    int coarse_iters = 3;
+
+    // Initialize from the previous disparity, warped into the current frame with the odometry
+    // pose, instead of from sparse matches (see MatchAsync). Needs a StereoCamera.
+    bool warm_start = false;
+    float warm_start_noise = 4.0;   // Initial noise (px), should cover the pose error.
+
+    // Use the shared memory + texture versions of the propagation kernels.
+    bool tiled_propagation = false;
+
+    // Keep the images as 8-bit and the gradients as __half on the device, instead of float. That's
+    // 3 bytes per pixel instead of 8 for the images, gradients and their tiles in shared memory.
+    // The disparity stays float (it goes through cudaarithm, and needs subpixel precision).
+    bool compact_storage = false;
+
+    // Capture the propagation of a MatchBatch() as a CUDA graph, and replay it for later batches
+    // of the same size (falls back to launching the kernels if the capture fails).
+    bool batch_cuda_graph = false;
+
+    // Match with semi-global matching (SgmGpu) instead of patchmatch, in the same frame slots and
+    // streams, so that the two can be compared through MatchAsync(). Skips the sparse init.
+    bool use_sgm = false;
+    SgmGpu::Params sgm_params;
+
+    // Only match the bands of rows with textured foreground (see stereo::ForegroundTiles and
+    // stereo::TileRowBands). Disparity is horizontal, so a band still sees the whole epipolar line.
+    // Everything outside of the bands is background (0).
+    bool foreground_tiles = false;
+    int tile_size = 32;
+    int tile_dilate = 1;
+    int foreground_ksize = 7;
+    double foreground_min_grad = 35.0;
+    int foreground_downsize = 2;
+
    private:
     void LoadParams(const YamlParser& p) override;
   };
 
+  // Left and right disparity images (with occlusions masked out of the left one).
+  struct MatchResult final
+  {
+    Image1f disp;
+    Image1f dispr;
+  };
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   MACRO_DELETE_COPY_CONSTRUCTORS(PatchmatchGpu);
 
   PatchmatchGpu(const Params& params);
 
+  // Needed for warm_start. The camera can be at any resolution (it's rescaled to the images). Its
+  // static masks (see StereoCamera::LeftMask()) are honored: rows that are blocked in both images
+  // are never matched, blocked pixels don't seed the sparse init, and their disparity is 0.
+  PatchmatchGpu(const Params& params, const StereoCamera& stereo_rig);
+
  public:
+  // Blocking version of MatchAsync().
   void Match(const Image1b& iml,
              const Image1b& imr,
              Image1f& disp,
              Image1f& dispr);
 
-  void Match(const cu::GpuMat& iml,
+  // Start matching a stereo pair and return right away. The images are copied into page-locked
+  // memory before returning, so the caller can reuse them. Up to kMaxFramesInFlight pairs can be
+  // matched at once (e.g the next pair uploads and sparse-inits while this one propagates). If all
+  // of the frame slots are busy, this blocks until the oldest one is done.
+  //
+  // If warm_start is enabled and T_cur_prev (the previous left camera pose in the current left
+  // camera frame) is given, the previous pair's disparity is used as the initial guess.
+  // NOTE(milo): Only call this from one thread.
+  std::shared_future<MatchResult> MatchAsync(const Image1b& iml,
+                                             const Image1b& imr,
+                                             const Transform3d* T_cur_prev = nullptr);
+
+  // Match K pairs (all the same size) at once, blocking until they're done. The pairs are stacked
+  // vertically on the device, and every propagation step is one launch over all of them (one grid
+  // layer per pair), so launch overhead is paid once per batch instead of once per pair. Good for
+  // offline reprocessing and multiple rigs. The sparse init is still per pair (on the CPU), and
+  // warm_start, foreground_tiles and the static masks are not used.
+  // NOTE(milo): With pyramid_levels > 1, the image height must be a multiple of
+  // 2^(pyramid_levels - 1), so that every level of the stack splits evenly into pairs. Downsampling
+  // blurs a row or two across the seams between pairs, where the kernels don't match anyway.
+  void MatchBatch(const std::vector<Image1b>& imls,
+                  const std::vector<Image1b>& imrs,
+                  std::vector<Image1f>& disps,
+                  std::vector<Image1f>& disprs);
+
+  // Sparse matches, dilated into an initial guess. Keypoints where blocked (CV_8UC1, nonzero =
+  // blocked) is set are skipped.
+  Image1f SparseInit(const Image1b& iml,
+                     const Image1b& imr,
+                     int dilate_factor,
+                     const Image1b& blocked = Image1b());
+
+  static constexpr size_t kMaxFramesInFlight = 2;
+
+ private:
+  // Everything that one in-flight stereo pair needs. The left and right passes run on their own
+  // streams, and only sync up (with events) where they need each other's outputs.
+  // Downsampled inputs for one pass at one coarse pyramid level.
+  struct PyramidLevel final
+  {
+    cu::GpuMat iml, imr, Gl, Gr, disp, mask;
+  };
+
+  struct FrameSlot final
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    FrameSlot();
+
+    cu::Stream stream_l, stream_r;
+    cu::Event grad_l_done, grad_r_done, right_done;
+    cv::Ptr<cu::Filter> sobel_x_l, sobel_y_l, sobel_x_r, sobel_y_r;
+
+    // Page-locked host buffers, so that uploads and downloads are async.
+    cu::HostMem h_iml, h_imr, h_disp_init_l, h_disp_init_r, h_disp, h_dispr;
+
+    // Pre-allocate these GpuMats to save on allocation time.
+    cu::GpuMat tmp_l, tmp_r, Gx_l, Gy_l, Gx_r, Gy_r, mask_l, mask_r;
+    cu::GpuMat iml, imr, Gl, Gr, disp;
+    cu::GpuMat iml_flip, imr_flip, Gl_flip, Gr_flip, dispr_flip, dispr;
+    std::vector<PyramidLevel> pyr_l, pyr_r;
+    TextureCache textures;
+
+    // Only used with use_sgm (one matcher per stream, since they each own a cost volume).
+    cu::GpuMat tmp_l_flip, tmp_r_flip;
+    std::unique_ptr<SgmGpu> sgm_l, sgm_r;
+
+    bool warm_start = false;
+    Transform3d T_cur_prev;
+
+    std::shared_future<MatchResult> in_flight;
+  };
+
+  // Buffers for MatchBatch(), which runs everything in one stream.
+  struct BatchState final
+  {
+    MACRO_DELETE_COPY_CONSTRUCTORS(BatchState);
+    BatchState();
+    ~BatchState();
+
+    cu::Stream stream;
+    cv::Ptr<cu::Filter> sobel_x, sobel_y;
+    cu::HostMem h_iml, h_imr, h_disp_init_l, h_disp_init_r, h_disp, h_dispr;
+    cu::GpuMat tmp_l, tmp_r, Gx, Gy, mask_l, mask_r, unit_noise;
+    cu::GpuMat iml, imr, Gl, Gr, disp;
+    cu::GpuMat iml_flip, imr_flip, Gl_flip, Gr_flip, dispr_flip, dispr;
+    std::vector<PyramidLevel> pyr_l, pyr_r;
+    TextureCache textures;
+
+    // The (rows, cols, K) that the buffers are allocated for, and the graph captured for them.
+    cv::Vec3i size = cv::Vec3i(0, 0, 0);
+    bool allocated = false;
+    bool graph_failed = false;
+    cudaGraphExec_t graph = nullptr;
+  };
+
+  // Runs on a worker thread, with the images already in slot.h_iml and slot.h_imr. If the slot
+  // is warm starting, it waits for prev (the pair before it).
+  MatchResult MatchSlot(FrameSlot& slot, std::shared_future<MatchResult> prev);
+
+  // Everything in MatchBatch() after the uploads: both passes and the occlusion mask.
+  void PropagateBatch(BatchState& b, int num_pairs);
+
+  // The use_sgm version of MatchSlot().
+  MatchResult MatchSlotSgm(FrameSlot& slot);
+
+  // Masks occlusions in slot.disp (with slot.dispr), then downloads both. Both streams must be
+  // done writing them. Pixels blocked by the static masks are set to 0.
+  MatchResult FinishSlot(FrameSlot& slot, int rows, int cols);
+
+  // Rasterizes the static masks for rows x cols images, and finds the bands of rows that aren't
+  // blocked in both images. No slot can be in flight.
+  void UpdateStaticMasks(int rows, int cols);
+
+  // Solve for disp (which holds the initial guess at full resolution) in stream, coarse-to-fine
+  // if pyramid_levels > 1. The initial noise (px) should reflect how good the guess is, and the
+  // top-left corner of unit_noise is used at each level. The buffers hold num_pairs stacked pairs.
+  void Solve(const cu::GpuMat& iml,
              const cu::GpuMat& imr,
              const cu::GpuMat& Gl,
              const cu::GpuMat& Gr,
-             cu::GpuMat& disp);
-
-  Image1f SparseInit(const Image1b& iml,
-                     const Image1b& imr,
-                     int dilate_factor);
+             cu::GpuMat& disp,
+             cu::GpuMat& mask,
+             std::vector<PyramidLevel>& pyr,
+             TextureCache& textures,
+             const cu::GpuMat& unit_noise,
+             float init_noise,
+             int num_pairs,
+             cu::Stream& stream);
+
+  // Solve() for each band of rows (ROIs of the same buffers), one after another in stream.
+  void SolveBands(const std::vector<cv::Rect>& bands,
+                  const cu::GpuMat& iml,
+                  const cu::GpuMat& imr,
+                  const cu::GpuMat& Gl,
+                  const cu::GpuMat& Gr,
+                  cu::GpuMat& disp,
+                  cu::GpuMat& mask,
+                  std::vector<PyramidLevel>& pyr,
+                  TextureCache& textures,
+                  float init_noise,
+                  cu::Stream& stream);
+
+  // Run patchmatch iterations on disp (which holds the initial guess) in stream. The foreground
+  // noise starts at init_noise (px) and halves every iteration.
+  void Propagate(const cu::GpuMat& iml,
+                 const cu::GpuMat& imr,
+                 const cu::GpuMat& Gl,
+                 const cu::GpuMat& Gr,
+                 cu::GpuMat& disp,
+                 cu::GpuMat& mask,
+                 TextureCache& textures,
+                 const cu::GpuMat& unit_noise,
+                 int iters,
+                 float init_noise,
+                 int num_pairs,
+                 cu::Stream& stream);
 
  private:
   Params params_;
 
   ft::FeatureDetector detector_;
   ft::StereoMatcher matcher_;
+  std::mutex sparse_init_lock_;   // SparseInit() can be called from multiple frame slots.
+
+  bool has_stereo_rig_ = false;
+  StereoCamera stereo_rig_;
+
+  // Read-only during matching, and only regenerated when the image size changes.
+  cu::GpuMat unit_noise_gpu_;
+  Image1b blocked_l_, blocked_r_, blocked_r_flip_;  // Nonzero = blocked (empty if nothing is).
+  std::vector<cv::Rect> static_bands_;              // Full-width bands of rows to match.
+
+  std::array<FrameSlot, kMaxFramesInFlight> slots_;
+  size_t next_slot_ = 0;
+  std::shared_future<MatchResult> prev_result_;
 
-  // Pre-allocate these GpuMats to save on allocation time.
-  cu::GpuMat mask_gpu_, unit_noise_gpu_;
-  cu::GpuMat iml_gpu_, imr_gpu_, Gx_, Gy_, Gl_, Gr_, disp_gpu_, tmp_;
-  cu::GpuMat iml_gpu_flip_, imr_gpu_flip_, Gl_flip_, Gr_flip_, disp_gpu_r_;
+  BatchState batch_;
 };
 
 }
@@ -0,0 +1,247 @@
+#include <glog/logging.h>
+
+#include <opencv2/core/cuda_stream_accessor.hpp>
+
+#include "patchmatch_gpu/sgm_gpu.h"
+#include "vision_core/gpu_memory_pool.hpp"
+
+namespace bm {
+namespace pm {
+
+static const int kMaxDisp = 128;
+static const int kCensusBits = 24;
+
+// Device buffers (mostly the cost volume) are charged to this module in the GpuMemoryPool.
+static const char* kGpuBudget = "SgmGpu";
+
+// Larger than any path cost, but small enough that adding a penalty doesn't overflow.
+static const int kLargeCost = 1 << 20;
+
+
+void SgmGpu::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("num_disp", &num_disp);
+  parser.GetParam("P1", &P1);
+  parser.GetParam("P2", &P2);
+  parser.GetParam("uniqueness_ratio", &uniqueness_ratio);
+}
+
+
+__global__
+void CensusTransform5x5(const cu::PtrStepSz<uchar> im,
+                        cu::PtrStepSz<int> census)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= im.cols || y >= im.rows) {
+    return;
+  }
+
+  if (x < 2 || y < 2 || x >= (im.cols - 2) || y >= (im.rows - 2)) {
+    census(y, x) = 0;
+    return;
+  }
+
+  const uchar center = im(y, x);
+  unsigned int mask = 0;
+  for (int dy = -2; dy <= 2; ++dy) {
+    for (int dx = -2; dx <= 2; ++dx) {
+      if (dx == 0 && dy == 0) {
+        continue;
+      }
+      mask = (mask << 1) | (im(y + dy, x + dx) < center ? 1 : 0);
+    }
+  }
+
+  census(y, x) = static_cast<int>(mask);
+}
+
+
+__global__
+void AggregatePath(const cu::PtrStepSz<int> census_l,
+                   const cu::PtrStepSz<int> census_r,
+                   cu::PtrStepSz<ushort> agg,
+                   int num_disp,
+                   bool vertical,
+                   int direction,
+                   int P1,
+                   int P2,
+                   bool accumulate)
+{
+  // Path costs at the previous pixel, with a sentinel on each side so that d - 1 and d + 1 are
+  // always valid. The minimum over disparities is reduced per warp, then over warps.
+  __shared__ int prev[kMaxDisp + 2];
+  __shared__ int warp_min[kMaxDisp / 32];
+
+  const int d = threadIdx.x;
+  const int line = blockIdx.x;
+  const int length = vertical ? census_l.rows : census_l.cols;
+  const int lane = d & 31;
+  const int warp = d >> 5;
+  const int num_warps = num_disp / 32;
+
+  if (d == 0) {
+    prev[0] = kLargeCost;
+    prev[num_disp + 1] = kLargeCost;
+  }
+
+  int prev_min = 0;
+
+  for (int i = 0; i < length; ++i) {
+    const int t = (direction > 0) ? i : (length - 1 - i);
+    const int x = vertical ? line : t;
+    const int y = vertical ? t : line;
+
+    const int cost = (x - d >= 0) ?
+        __popc(static_cast<unsigned int>(census_l(y, x) ^ census_r(y, x - d))) : kCensusBits;
+
+    // Lr(p, d) = C(p, d) + min(Lr(p-r, d), Lr(p-r, d+-1) + P1, min_k Lr(p-r, k) + P2) - min_k Lr(p-r, k)
+    int Lr = cost;
+    if (i > 0) {
+      const int best = min(min(prev[d + 1], min(prev[d], prev[d + 2]) + P1), prev_min + P2);
+      Lr = cost + best - prev_min;
+    }
+
+    // Everyone has to read prev before it's overwritten.
+    __syncthreads();
+    prev[d + 1] = Lr;
+
+    ushort& out = agg(y, x * num_disp + d);
+    out = accumulate ? static_cast<ushort>(out + Lr) : static_cast<ushort>(Lr);
+
+    int m = Lr;
+    for (int offset = 16; offset > 0; offset >>= 1) {
+      m = min(m, __shfl_down_sync(0xffffffff, m, offset));
+    }
+    if (lane == 0) {
+      warp_min[warp] = m;
+    }
+    __syncthreads();
+
+    prev_min = warp_min[0];
+    for (int w = 1; w < num_warps; ++w) {
+      prev_min = min(prev_min, warp_min[w]);
+    }
+  }
+}
+
+
+__global__
+void SelectDisparity(const cu::PtrStepSz<ushort> agg,
+                     cu::PtrStepSz<float> disp,
+                     int num_disp,
+                     float uniqueness_ratio)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= disp.cols || y >= disp.rows) {
+    return;
+  }
+
+  const ushort* costs = agg.ptr(y) + x * num_disp;
+
+  int best_d = 0;
+  int best = kLargeCost;
+  for (int d = 0; d < num_disp; ++d) {
+    if (costs[d] < best) {
+      best = costs[d];
+      best_d = d;
+    }
+  }
+
+  int second = kLargeCost;
+  for (int d = 0; d < num_disp; ++d) {
+    if (abs(d - best_d) > 1 && costs[d] < second) {
+      second = costs[d];
+    }
+  }
+
+  float value = 0;
+  if (uniqueness_ratio >= 1.0f || __int2float_rn(best) < uniqueness_ratio * __int2float_rn(second)) {
+    value = __int2float_rn(best_d);
+
+    // Fit a parabola through the best cost and its neighbors.
+    if (best_d > 0 && best_d < (num_disp - 1)) {
+      const float c0 = costs[best_d - 1];
+      const float c1 = best;
+      const float c2 = costs[best_d + 1];
+      const float denom = c0 - 2.0f*c1 + c2;
+      if (denom > 0) {
+        value += 0.5f * (c0 - c2) / denom;
+      }
+    }
+  }
+
+  disp(y, x) = value;
+}
+
+
+SgmGpu::SgmGpu(const Params& params)
+    : params_(params)
+{
+  CHECK(params_.num_disp > 0 && params_.num_disp <= kMaxDisp && (params_.num_disp % 32) == 0)
+      << "SgmGpu needs num_disp to be a multiple of 32, and at most " << kMaxDisp << std::endl;
+  CHECK_GE(params_.P2, params_.P1) << "P2 should be at least P1" << std::endl;
+}
+
+
+void SgmGpu::Match(const cu::GpuMat& iml,
+                   const cu::GpuMat& imr,
+                   cu::GpuMat& disp,
+                   cu::Stream& stream)
+{
+  ScopedGpuBudget budget(kGpuBudget);
+
+  CHECK_EQ(CV_8UC1, iml.type()) << "SgmGpu needs 8-bit grayscale images" << std::endl;
+  CHECK_EQ(CV_8UC1, imr.type()) << "SgmGpu needs 8-bit grayscale images" << std::endl;
+  CHECK(iml.size() == imr.size());
+
+  const int D = params_.num_disp;
+
+  // NOTE(milo): create() is a no-op if the size and type haven't changed.
+  census_l_.create(iml.size(), CV_32SC1);
+  census_r_.create(iml.size(), CV_32SC1);
+  agg_.create(iml.rows, iml.cols * D, CV_16UC1);
+  disp.create(iml.size(), CV_32FC1);
+
+  cudaStream_t cs = cu::StreamAccessor::getStream(stream);
+
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(iml.cols, block.x), cu::device::divUp(iml.rows, block.y));
+  CensusTransform5x5<<<grid, block, 0, cs>>>(iml, census_l_);
+  CensusTransform5x5<<<grid, block, 0, cs>>>(imr, census_r_);
+
+  // The first path overwrites the volume, so it doesn't need to be zeroed.
+  AggregatePath<<<iml.rows, D, 0, cs>>>(census_l_, census_r_, agg_, D, false, 1, params_.P1, params_.P2, false);
+  AggregatePath<<<iml.rows, D, 0, cs>>>(census_l_, census_r_, agg_, D, false, -1, params_.P1, params_.P2, true);
+  AggregatePath<<<iml.cols, D, 0, cs>>>(census_l_, census_r_, agg_, D, true, 1, params_.P1, params_.P2, true);
+  AggregatePath<<<iml.cols, D, 0, cs>>>(census_l_, census_r_, agg_, D, true, -1, params_.P1, params_.P2, true);
+
+  SelectDisparity<<<grid, block, 0, cs>>>(agg_, disp, D, params_.uniqueness_ratio);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void SgmGpu::Match(const Image1b& iml, const Image1b& imr, Image1f& disp)
+{
+  h_iml_.create(iml.rows, iml.cols, CV_8UC1);
+  h_imr_.create(imr.rows, imr.cols, CV_8UC1);
+  iml.copyTo(h_iml_.createMatHeader());
+  imr.copyTo(h_imr_.createMatHeader());
+
+  iml_.upload(h_iml_, stream_);
+  imr_.upload(h_imr_, stream_);
+  Match(iml_, imr_, disp_, stream_);
+
+  h_disp_.create(iml.rows, iml.cols, CV_32FC1);
+  disp_.download(h_disp_, stream_);
+  stream_.waitForCompletion();
+
+  h_disp_.createMatHeader().copyTo(disp);
+}
+
+
+}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/core/cuda/common.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+
+namespace bm {
+namespace pm {
+
+namespace cu = cv::cuda;
+using namespace core;
+
+
+// Census transform of an 8-bit image with a 5x5 window. Each pixel gets a 24-bit mask, one bit per
+// neighbor that is darker than the center. Pixels within 2px of the border are 0.
+__global__
+void CensusTransform5x5(const cu::PtrStepSz<uchar> im,
+                        cu::PtrStepSz<int> census);
+
+
+// Aggregates matching costs along one scanline direction per block (one thread per disparity),
+// and adds them into agg (rows x cols*num_disp, CV_16UC1). Horizontal paths run along rows, so
+// there is one block per row; vertical paths have one block per column. The matching cost is the
+// Hamming distance between the left census at x and the right census at x - d.
+__global__
+void AggregatePath(const cu::PtrStepSz<int> census_l,
+                   const cu::PtrStepSz<int> census_r,
+                   cu::PtrStepSz<ushort> agg,
+                   int num_disp,
+                   bool vertical,
+                   int direction,
+                   int P1,
+                   int P2,
+                   bool accumulate);
+
+
+// Winner-take-all over the aggregated costs, with parabolic subpixel refinement. Pixels where the
+// best cost isn't clearly better than the second best (outside of +/- 1px) are set to 0.
+__global__
+void SelectDisparity(const cu::PtrStepSz<ushort> agg,
+                     cu::PtrStepSz<float> disp,
+                     int num_disp,
+                     float uniqueness_ratio);
+
+
+// Semi-global matching on the GPU (Hirschmuller 2008), with census costs and 4 aggregation paths
+// (left, right, up and down). The census images and the aggregated cost volume are kept between
+// calls, so only the first pair of a given size allocates.
+//
+// NOTE(milo): The paths are the same as OpenCV's MODE_HH4 (see stereo::SgbmMatcher), but the cost
+// is census instead of Birchfield-Tomasi, so the penalties aren't interchangeable.
+class SgmGpu final {
+ public:
+  struct Params final : public ParamsBase {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int num_disp = 64;                // Multiple of 32, at most 128 (one block per scanline).
+    int P1 = 8;                       // Penalty for 1px disparity changes (census bits).
+    int P2 = 96;                      // Penalty for larger disparity changes.
+    float uniqueness_ratio = 0.95;    // Best cost must be < (this * second best), 1 to disable.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(SgmGpu);
+
+  explicit SgmGpu(const Params& params);
+
+  // Left disparity (CV_32FC1) from 8-bit images that are already on the device. Everything runs
+  // in stream, and this returns without waiting for it.
+  void Match(const cu::GpuMat& iml,
+             const cu::GpuMat& imr,
+             cu::GpuMat& disp,
+             cu::Stream& stream = cu::Stream::Null());
+
+  // Blocking version, which uploads and downloads the images.
+  void Match(const Image1b& iml, const Image1b& imr, Image1f& disp);
+
+ private:
+  Params params_;
+
+  cu::GpuMat iml_, imr_, census_l_, census_r_, agg_, disp_;
+  cu::HostMem h_iml_, h_imr_, h_disp_;
+  cu::Stream stream_;
+};
+
+
+}
+}
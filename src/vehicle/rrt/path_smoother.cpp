@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "core/timer.hpp"
+#include "rrt/path_smoother.hpp"
+
+namespace bm {
+namespace rrt {
+
+// A corner curve that hits something is shrunk by half, this many times, before the corner is left
+// sharp (and the vehicle has to stop there).
+static const int kMaxCornerTries = 4;
+
+// Waypoints that are closer than this to the line through their neighbors are dropped, and samples
+// that are closer than this to each other are merged.
+static const double kMinWaypointDist = 1e-6;
+
+
+void PathSmoother::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("max_shortcut_iters", &max_shortcut_iters);
+  parser.GetParam("shortcut_batch_size", &shortcut_batch_size);
+  parser.GetParam("min_shortcut_gain", &min_shortcut_gain);
+  parser.GetParam("seed", &seed);
+  parser.GetParam("max_corner_cut", &max_corner_cut);
+  parser.GetParam("max_speed", &max_speed);
+  parser.GetParam("max_accel", &max_accel);
+  parser.GetParam("sample_spacing", &sample_spacing);
+
+  CHECK_GE(shortcut_batch_size, 1);
+  CHECK_GE(max_corner_cut, 0);
+  CHECK_GT(max_speed, 0);
+  CHECK_GT(max_accel, 0);
+  CHECK_GT(sample_spacing, 0);
+}
+
+
+double PathLength(const VecVector3d& path)
+{
+  double length = 0;
+  for (size_t i = 1; i < path.size(); ++i) {
+    length += (path.at(i) - path.at(i - 1)).norm();
+  }
+  return length;
+}
+
+
+PathSmoother::PathSmoother(const Params& params)
+    : params_(params) {}
+
+
+SmoothResult PathSmoother::Smooth(const VecVector3d& path,
+                                  const BatchCollisionChecker& collision_checker,
+                                  double deadline_sec)
+{
+  CHECK_GE(path.size(), 2ul) << "A path needs a start and a goal" << std::endl;
+
+  const bool use_deadline = deadline_sec > 0;
+  const Clocktime deadline = std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(Seconds(deadline_sec));
+
+  std::default_random_engine rng(params_.seed);
+
+  SmoothResult result;
+  result.path = path;
+
+  // A straight segment can't get any shorter.
+  for (int iter = 0; iter < params_.max_shortcut_iters && result.path.size() > 2; ++iter) {
+    if (use_deadline && std::chrono::steady_clock::now() >= deadline) {
+      result.hit_deadline = true;
+      break;
+    }
+    ++result.shortcut_iters;
+    Shortcut(result.path, collision_checker, rng);
+  }
+
+  PruneWaypoints(result.path, collision_checker);
+
+  result.cost = PathLength(result.path);
+  result.trajectory = FitTrajectory(result.path, collision_checker);
+
+  return result;
+}
+
+
+// Returns the index of the segment of path that is s meters along it. arc.at(i) is the distance
+// along the path to path.at(i).
+static size_t SegmentAt(const std::vector<double>& arc, double s)
+{
+  const size_t i = std::upper_bound(arc.begin(), arc.end(), s) - arc.begin();
+  return std::min(std::max<size_t>(i, 1), arc.size() - 1) - 1;
+}
+
+
+static Vector3d PointAt(const VecVector3d& path, const std::vector<double>& arc, size_t i, double s)
+{
+  const double length = arc.at(i + 1) - arc.at(i);
+  const double t = (length > 0) ? std::min(1.0, std::max(0.0, (s - arc.at(i)) / length)) : 0;
+  return path.at(i) + t * (path.at(i + 1) - path.at(i));
+}
+
+
+double PathSmoother::Shortcut(VecVector3d& path,
+                              const BatchCollisionChecker& collision_checker,
+                              std::default_random_engine& rng) const
+{
+  std::vector<double> arc(path.size(), 0);
+  for (size_t i = 1; i < path.size(); ++i) {
+    arc.at(i) = arc.at(i - 1) + (path.at(i) - path.at(i - 1)).norm();
+  }
+
+  // A shortcut replaces the path between p0 (on segment i0) and p1 (on segment i1) with p0 -> p1.
+  struct Candidate
+  {
+    double s0, s1;
+    size_t i0, i1;
+    Vector3d p0, p1;
+    double gain;
+  };
+
+  std::vector<Candidate> candidates;
+  std::vector<Segment> segments;
+  std::uniform_real_distribution<double> uniform(0, arc.back());
+
+  for (int k = 0; k < params_.shortcut_batch_size; ++k) {
+    Candidate c;
+    c.s0 = uniform(rng);
+    c.s1 = uniform(rng);
+    if (c.s0 > c.s1) {
+      std::swap(c.s0, c.s1);
+    }
+
+    // Both points on the same segment can't cut anything.
+    c.i0 = SegmentAt(arc, c.s0);
+    c.i1 = SegmentAt(arc, c.s1);
+    if (c.i0 == c.i1) {
+      continue;
+    }
+
+    c.p0 = PointAt(path, arc, c.i0, c.s0);
+    c.p1 = PointAt(path, arc, c.i1, c.s1);
+    c.gain = (c.s1 - c.s0) - (c.p1 - c.p0).norm();
+    if (c.gain >= params_.min_shortcut_gain) {
+      candidates.emplace_back(c);
+      segments.emplace_back(c.p0, c.p1);
+    }
+  }
+
+  if (candidates.empty()) {
+    return 0;
+  }
+
+  std::vector<uint8_t> is_free;
+  collision_checker(segments, is_free);
+  CHECK_EQ(segments.size(), is_free.size());
+
+  // Take the free shortcuts with the biggest gains first, and skip the ones that overlap them.
+  std::vector<size_t> order;
+  for (size_t k = 0; k < candidates.size(); ++k) {
+    if (is_free.at(k)) {
+      order.emplace_back(k);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&candidates](size_t a, size_t b) {
+    return candidates.at(a).gain > candidates.at(b).gain;
+  });
+
+  std::vector<Candidate> taken;
+  for (const size_t k : order) {
+    const Candidate& c = candidates.at(k);
+    const bool overlaps = std::any_of(taken.begin(), taken.end(), [&c](const Candidate& t) {
+      return c.s0 < t.s1 && t.s0 < c.s1;
+    });
+    if (!overlaps) {
+      taken.emplace_back(c);
+    }
+  }
+
+  // NOTE(milo): Spliced back to front, so that the segment indices in front of each one are still
+  // valid. Two shortcuts can end and start on the same segment, but then the second one's p0 is
+  // after the first one's p1, so what's left of the segment between them is still on the path.
+  std::sort(taken.begin(), taken.end(), [](const Candidate& a, const Candidate& b) { return a.s0 > b.s0; });
+
+  double gain = 0;
+  for (const Candidate& c : taken) {
+    VecVector3d spliced(path.begin(), path.begin() + c.i0 + 1);
+    spliced.emplace_back(c.p0);
+    spliced.emplace_back(c.p1);
+    spliced.insert(spliced.end(), path.begin() + c.i1 + 1, path.end());
+    path = std::move(spliced);
+    gain += c.gain;
+  }
+
+  // Drop the waypoints that shortcuts left on a straight line (or on top of each other).
+  VecVector3d merged(1, path.front());
+  for (size_t i = 1; i + 1 < path.size(); ++i) {
+    const Vector3d& a = merged.back();
+    const Vector3d& w = path.at(i);
+    const Vector3d& b = path.at(i + 1);
+    if ((w - a).norm() + (b - w).norm() - (b - a).norm() > kMinWaypointDist) {
+      merged.emplace_back(w);
+    }
+  }
+  merged.emplace_back(path.back());
+  path = std::move(merged);
+
+  return gain;
+}
+
+
+void PathSmoother::PruneWaypoints(VecVector3d& path, const BatchCollisionChecker& collision_checker) const
+{
+  std::vector<Segment> segments;
+  std::vector<uint8_t> is_free;
+
+  // Each round checks every waypoint at once. Neighbors can't both be dropped in one round, since
+  // the segment that skips one of them ends at the other.
+  while (path.size() > 2) {
+    segments.clear();
+    for (size_t i = 1; i + 1 < path.size(); ++i) {
+      segments.emplace_back(path.at(i - 1), path.at(i + 1));
+    }
+    collision_checker(segments, is_free);
+    CHECK_EQ(segments.size(), is_free.size());
+
+    VecVector3d pruned(1, path.front());
+    bool prev_dropped = false;
+    for (size_t i = 1; i + 1 < path.size(); ++i) {
+      const bool drop = is_free.at(i - 1) && !prev_dropped;
+      if (!drop) {
+        pruned.emplace_back(path.at(i));
+      }
+      prev_dropped = drop;
+    }
+    pruned.emplace_back(path.back());
+
+    if (pruned.size() == path.size()) {
+      break;
+    }
+    path = std::move(pruned);
+  }
+}
+
+
+// The curve around corner path.at(i), from cut meters before it to cut meters after it.
+struct CornerCurve final
+{
+  CornerCurve(const VecVector3d& path, size_t i, double cut)
+      : q0(path.at(i) + cut * (path.at(i - 1) - path.at(i)).normalized()),
+        w(path.at(i)),
+        q1(path.at(i) + cut * (path.at(i + 1) - path.at(i)).normalized()) {}
+
+  Vector3d Point(double t) const { return (1 - t) * (1 - t) * q0 + 2 * t * (1 - t) * w + t * t * q1; }
+  Vector3d Derivative(double t) const { return 2 * (1 - t) * (w - q0) + 2 * t * (q1 - w); }
+  Vector3d SecondDerivative() const { return 2 * (q1 - 2 * w + q0); }
+
+  // Curvature (1/m) at t.
+  double Curvature(double t) const
+  {
+    const Vector3d d1 = Derivative(t);
+    const double speed = d1.norm();
+    if (speed < 1e-12) {
+      return std::numeric_limits<double>::infinity();
+    }
+    return d1.cross(SecondDerivative()).norm() / (speed * speed * speed);
+  }
+
+  // Enough samples that they're at most spacing apart (the curve is shorter than q0 -> w -> q1).
+  int NumSamples(double spacing) const
+  {
+    return std::max(2, (int)std::ceil(((w - q0).norm() + (q1 - w).norm()) / spacing));
+  }
+
+  Vector3d q0, w, q1;   // Bezier control points.
+};
+
+
+Trajectory PathSmoother::FitTrajectory(const VecVector3d& path,
+                                       const BatchCollisionChecker& collision_checker) const
+{
+  const size_t N = path.size();
+
+  // Each curve can use at most half of the segments on either side, so that they don't overlap.
+  std::vector<double> cut(N, 0);
+  std::vector<size_t> todo;
+  for (size_t i = 1; i + 1 < N; ++i) {
+    cut.at(i) = std::min(params_.max_corner_cut, 0.5 * std::min((path.at(i) - path.at(i - 1)).norm(),
+                                                                 (path.at(i + 1) - path.at(i)).norm()));
+    if (cut.at(i) > 0) {
+      todo.emplace_back(i);
+    }
+  }
+
+  // Check all of the curves at once, and shrink the ones that hit something.
+  std::vector<Segment> segments;
+  std::vector<size_t> owner;
+  std::vector<uint8_t> is_free;
+  for (int attempt = 0; attempt < kMaxCornerTries && !todo.empty(); ++attempt) {
+    segments.clear();
+    owner.clear();
+    for (const size_t i : todo) {
+      const CornerCurve curve(path, i, cut.at(i));
+      const int n = curve.NumSamples(params_.sample_spacing);
+      for (int k = 0; k < n; ++k) {
+        segments.emplace_back(curve.Point((double)k / n), curve.Point((double)(k + 1) / n));
+        owner.emplace_back(i);
+      }
+    }
+
+    collision_checker(segments, is_free);
+    CHECK_EQ(segments.size(), is_free.size());
+
+    std::vector<uint8_t> blocked(N, 0);
+    for (size_t k = 0; k < segments.size(); ++k) {
+      if (!is_free.at(k)) {
+        blocked.at(owner.at(k)) = 1;
+      }
+    }
+
+    std::vector<size_t> retry;
+    for (const size_t i : todo) {
+      if (blocked.at(i)) {
+        cut.at(i) *= 0.5;
+        retry.emplace_back(i);
+      }
+    }
+    todo = std::move(retry);
+  }
+  for (const size_t i : todo) {
+    cut.at(i) = 0;
+  }
+
+  // Sample the straight parts and the curves, with the curvature at each sample.
+  struct Sample
+  {
+    Vector3d position;
+    Vector3d tangent;
+    double kappa;
+    double s;
+  };
+
+  std::vector<Sample> samples;
+  const auto add = [&samples](const Vector3d& position, const Vector3d& tangent, double kappa) {
+    if (!samples.empty()) {
+      const double ds = (position - samples.back().position).norm();
+      if (ds < kMinWaypointDist) {
+        samples.back().kappa = std::max(samples.back().kappa, kappa);
+        return;
+      }
+      samples.push_back(Sample{ position, tangent, kappa, samples.back().s + ds });
+    } else {
+      samples.push_back(Sample{ position, tangent, kappa, 0 });
+    }
+  };
+
+  add(path.at(0), (path.at(1) - path.at(0)).normalized(), 0);
+  for (size_t i = 0; i + 1 < N; ++i) {
+    const Vector3d u = (path.at(i + 1) - path.at(i)).normalized();
+    const Vector3d a = path.at(i) + cut.at(i) * u;
+    const Vector3d b = path.at(i + 1) - cut.at(i + 1) * u;
+    const int n = std::max(1, (int)std::ceil((b - a).norm() / params_.sample_spacing));
+    for (int k = 1; k <= n; ++k) {
+      add(a + (b - a) * ((double)k / n), u, 0);
+    }
+
+    if (i + 2 < N) {
+      // A sharp corner has infinite curvature, so the vehicle stops there.
+      if (cut.at(i + 1) <= 0) {
+        add(path.at(i + 1), u, std::numeric_limits<double>::infinity());
+        continue;
+      }
+      const CornerCurve curve(path, i + 1, cut.at(i + 1));
+      const int m = curve.NumSamples(params_.sample_spacing);
+      for (int k = 1; k <= m; ++k) {
+        const double t = (double)k / m;
+        const Vector3d d1 = curve.Derivative(t);
+        add(curve.Point(t), (d1.norm() > 1e-12) ? Vector3d(d1.normalized()) : u, curve.Curvature(t));
+      }
+    }
+  }
+
+  // The fastest speeds within max_speed and the centripetal limit, then the tangential limit from
+  // rest at the start (forward) and to rest at the end (backward).
+  const double a_max = params_.max_accel;
+  std::vector<double> v(samples.size(), params_.max_speed);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    if (samples.at(i).kappa > 0) {
+      v.at(i) = std::min(v.at(i), std::sqrt(a_max / samples.at(i).kappa));
+    }
+  }
+  v.front() = 0;
+  v.back() = 0;
+  for (size_t i = 1; i < samples.size(); ++i) {
+    const double ds = samples.at(i).s - samples.at(i - 1).s;
+    v.at(i) = std::min(v.at(i), std::sqrt(v.at(i - 1) * v.at(i - 1) + 2 * a_max * ds));
+  }
+  for (size_t i = samples.size() - 1; i > 0; --i) {
+    const double ds = samples.at(i).s - samples.at(i - 1).s;
+    v.at(i - 1) = std::min(v.at(i - 1), std::sqrt(v.at(i) * v.at(i) + 2 * a_max * ds));
+  }
+
+  // Constant acceleration between samples. Between two stops, accelerate for half of the distance
+  // and brake for the other half.
+  Trajectory trajectory;
+  trajectory.reserve(samples.size());
+  double t = 0;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    if (i > 0) {
+      const double ds = samples.at(i).s - samples.at(i - 1).s;
+      const double v_sum = v.at(i - 1) + v.at(i);
+      t += (v_sum > 1e-9) ? 2 * ds / v_sum : 2 * std::sqrt(ds / a_max);
+    }
+    trajectory.emplace_back(t, samples.at(i).s, samples.at(i).position, v.at(i) * samples.at(i).tangent);
+  }
+
+  return trajectory;
+}
+
+
+}
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <random>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "rrt/rrt.hpp"
+
+namespace bm {
+namespace rrt {
+
+using namespace core;
+
+
+// A point along a smoothed path, with the speed that the vehicle should have there.
+struct TrajectoryPoint final
+{
+  TrajectoryPoint() = default;
+
+  explicit TrajectoryPoint(double t, double s, const Vector3d& position, const Vector3d& velocity)
+      : t(t), s(s), position(position), velocity(velocity) {}
+
+  double t = 0;         // Time since the start of the path (sec).
+  double s = 0;         // Distance along the path (m).
+  Vector3d position;
+  Vector3d velocity;    // m/s, along the path.
+};
+
+typedef std::vector<TrajectoryPoint> Trajectory;
+
+
+struct SmoothResult final
+{
+  VecVector3d path;         // Shortcut waypoints, from the start to the goal.
+  double cost = 0;          // Length of path (m).
+  Trajectory trajectory;    // The spline through path, sampled every sample_spacing.
+  int shortcut_iters = 0;   // Batches of shortcuts that were tried.
+  bool hit_deadline = false;
+};
+
+
+// Post-processes a planned path (e.g PlanResult::path). The path is shortened with randomized
+// shortcutting: each iteration picks a batch of random pairs of points along the path, checks the
+// straight segments between them in one call to the collision checker (so they're checked in
+// parallel if it has a pool, see MakeBatchCollisionChecker()), and splices in the free ones that
+// don't overlap. Once shortcutting is done, the waypoints that can be skipped are dropped (see
+// PruneWaypoints()). Then the corners are rounded (quadratic Bezier curves within max_corner_cut of
+// each corner, shrunk until they're collision-free) and the result is timed with the fastest speed
+// profile within max_speed and max_accel, starting and ending at rest.
+//
+// NOTE(milo): Shortcutting a path from a small tree is usually cheaper than growing a bigger tree
+// for the same path length, since RRT* only converges to the shortest path slowly.
+class PathSmoother final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int max_shortcut_iters = 100;       // Batches of shortcuts.
+    int shortcut_batch_size = 16;       // Shortcuts checked at once.
+    double min_shortcut_gain = 0.01;    // Shortcuts have to save this much length (m).
+    int seed = 0;                       // Shortcuts are repeatable for the same seed.
+
+    double max_corner_cut = 2.0;        // Corners start turning this far from the waypoint (m).
+    double max_speed = 1.0;             // m/s
+    double max_accel = 0.5;             // Limit on both the tangential and centripetal accel (m/s^2).
+    double sample_spacing = 0.25;       // Between trajectory points, and collision checks on curves (m).
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(PathSmoother)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(PathSmoother)
+
+  explicit PathSmoother(const Params& params);
+
+  // Shortcuts and smooths path, which must be collision-free. If deadline_sec > 0, shortcutting
+  // stops once that much time has passed, and the best path so far is smoothed. Every segment of
+  // the result path is free, and so is the trajectory (up to sample_spacing).
+  SmoothResult Smooth(const VecVector3d& path,
+                      const BatchCollisionChecker& collision_checker,
+                      double deadline_sec = 0);
+
+ private:
+  // Tries one batch of shortcuts on path, and returns the length that they saved.
+  double Shortcut(VecVector3d& path,
+                  const BatchCollisionChecker& collision_checker,
+                  std::default_random_engine& rng) const;
+
+  // Drops every waypoint that the path can skip (with a free segment between its neighbors). That
+  // gets rid of the small detours that are left after shortcutting, which would still need sharp
+  // turns, even though they're too short for a shortcut to be worth it.
+  void PruneWaypoints(VecVector3d& path, const BatchCollisionChecker& collision_checker) const;
+
+  // Rounds the corners of path, and times it.
+  Trajectory FitTrajectory(const VecVector3d& path, const BatchCollisionChecker& collision_checker) const;
+
+ private:
+  Params params_;
+};
+
+
+// Length of a path (m).
+double PathLength(const VecVector3d& path);
+
+
+}
+}
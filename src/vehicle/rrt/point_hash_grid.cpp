@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "rrt/point_hash_grid.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+PointHashGrid::PointHashGrid(double cell_size)
+{
+  Clear(cell_size);
+}
+
+
+void PointHashGrid::Clear()
+{
+  cells_.clear();
+  size_ = 0;
+  min_cell_ = Vector3i::Zero();
+  max_cell_ = Vector3i::Zero();
+}
+
+
+void PointHashGrid::Clear(double cell_size)
+{
+  CHECK_GT(cell_size, 0) << "PointHashGrid needs a positive cell size" << std::endl;
+  cell_size_ = cell_size;
+  Clear();
+}
+
+
+Vector3i PointHashGrid::CellOf(const Vector3d& point) const
+{
+  return Vector3i((int)std::floor(point.x() / cell_size_),
+                  (int)std::floor(point.y() / cell_size_),
+                  (int)std::floor(point.z() / cell_size_));
+}
+
+
+const PointHashGrid::Cell* PointHashGrid::GetCell(int x, int y, int z) const
+{
+  const auto it = cells_.find(Key(Vector3i(x, y, z)));
+  return (it == cells_.end()) ? nullptr : &it->second;
+}
+
+
+void PointHashGrid::Insert(const Vector3d& point, index_t index)
+{
+  const Vector3i cell = CellOf(point);
+  cells_[Key(cell)].emplace_back(point, index);
+
+  if (size_ == 0) {
+    min_cell_ = cell;
+    max_cell_ = cell;
+  } else {
+    min_cell_ = min_cell_.cwiseMin(cell);
+    max_cell_ = max_cell_.cwiseMax(cell);
+  }
+
+  ++size_;
+}
+
+
+PointHashGrid::index_t PointHashGrid::Nearest(const Vector3d& query_point) const
+{
+  CHECK_GE(size_, 1ul) << "Must have at least 1 point in the PointHashGrid" << std::endl;
+
+  const Vector3i qc = CellOf(query_point);
+
+  // Rings that can have points: from the first one that touches the occupied region, to the one
+  // that covers all of it.
+  const Vector3i to_min = min_cell_ - qc;
+  const Vector3i to_max = qc - max_cell_;
+  const int r_begin = std::max(0, std::max(to_min.maxCoeff(), to_max.maxCoeff()));
+  const int r_end = std::max(to_min.cwiseAbs().maxCoeff(), to_max.cwiseAbs().maxCoeff());
+
+  index_t best = 0;
+  double best_dist_sq = std::numeric_limits<double>::max();
+
+  const auto search_cell = [&](int x, int y, int z) {
+    const Cell* cell = GetCell(x, y, z);
+    if (cell == nullptr) {
+      return;
+    }
+    for (const Entry& e : *cell) {
+      const double d2 = (e.point - query_point).squaredNorm();
+      if (d2 < best_dist_sq) {
+        best_dist_sq = d2;
+        best = e.index;
+      }
+    }
+  };
+
+  for (int r = r_begin; r <= r_end; ++r) {
+    // Every point in ring r is at least (r - 1) cells away, since the query can be anywhere in its
+    // own cell.
+    const double ring_dist = (r - 1) * cell_size_;
+    if (ring_dist > 0 && ring_dist * ring_dist > best_dist_sq) {
+      break;
+    }
+
+    // Visit the cells at Chebyshev distance r from qc, clipped to the occupied region.
+    const int x0 = std::max(qc.x() - r, min_cell_.x()), x1 = std::min(qc.x() + r, max_cell_.x());
+    const int y0 = std::max(qc.y() - r, min_cell_.y()), y1 = std::min(qc.y() + r, max_cell_.y());
+    const int z0 = std::max(qc.z() - r, min_cell_.z()), z1 = std::min(qc.z() + r, max_cell_.z());
+
+    for (int x = x0; x <= x1; ++x) {
+      for (int y = y0; y <= y1; ++y) {
+        const bool on_side = (std::abs(x - qc.x()) == r || std::abs(y - qc.y()) == r);
+        if (on_side) {
+          for (int z = z0; z <= z1; ++z) {
+            search_cell(x, y, z);
+          }
+        } else {
+          // Only the top and bottom of the ring are at distance r.
+          if (qc.z() - r >= z0 && qc.z() - r <= z1) { search_cell(x, y, qc.z() - r); }
+          if (qc.z() + r >= z0 && qc.z() + r <= z1) { search_cell(x, y, qc.z() + r); }
+        }
+      }
+    }
+  }
+
+  return best;
+}
+
+
+size_t PointHashGrid::Nearby(const Vector3d& query_point, double radius, std::vector<index_t>& indices) const
+{
+  indices.clear();
+  if (size_ == 0) {
+    return 0;
+  }
+
+  const double radius_sq = radius * radius;
+  const Vector3i cmin = CellOf(query_point - Vector3d::Constant(radius)).cwiseMax(min_cell_);
+  const Vector3i cmax = CellOf(query_point + Vector3d::Constant(radius)).cwiseMin(max_cell_);
+
+  std::vector<IndexAndDist> found;
+  for (int x = cmin.x(); x <= cmax.x(); ++x) {
+    for (int y = cmin.y(); y <= cmax.y(); ++y) {
+      for (int z = cmin.z(); z <= cmax.z(); ++z) {
+        const Cell* cell = GetCell(x, y, z);
+        if (cell == nullptr) {
+          continue;
+        }
+        for (const Entry& e : *cell) {
+          const double d2 = (e.point - query_point).squaredNorm();
+          if (d2 <= radius_sq) {
+            found.emplace_back(e.index, d2);
+          }
+        }
+      }
+    }
+  }
+
+  std::sort(found.begin(), found.end(),
+      [](const IndexAndDist& a, const IndexAndDist& b) { return a.second < b.second; });
+
+  indices.resize(found.size());
+  for (size_t i = 0; i < found.size(); ++i) {
+    indices.at(i) = found.at(i).first;
+  }
+
+  return indices.size();
+}
+
+
+}
+}
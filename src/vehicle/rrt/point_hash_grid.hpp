@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace rrt {
+
+using namespace core;
+
+
+// A spatial index for points that only get added, e.g the nodes of an RRT. Space is split into
+// cubes of side cell_size, and only the occupied ones are stored (in a hash map). Inserts are O(1),
+// and a radius search only looks at the cells that overlap the sphere (27 of them if the radius
+// is the cell size). Nearest neighbor searches look at rings of cells around the query point,
+// clipped to the occupied region, until no closer point is possible.
+class PointHashGrid final {
+ public:
+  typedef size_t index_t;
+  typedef std::pair<index_t, double> IndexAndDist;
+
+  explicit PointHashGrid(double cell_size);
+
+  // Removes all points, and optionally changes the cell size.
+  void Clear();
+  void Clear(double cell_size);
+
+  void Insert(const Vector3d& point, index_t index);
+
+  size_t Size() const { return size_; }
+  double CellSize() const { return cell_size_; }
+
+  // Returns the index of the point nearest to query_point. The grid must not be empty.
+  index_t Nearest(const Vector3d& query_point) const;
+
+  // Points within radius of query_point (inclusive), sorted by increasing distance. Returns the
+  // number found.
+  size_t Nearby(const Vector3d& query_point, double radius, std::vector<index_t>& indices) const;
+
+ private:
+  struct Entry final
+  {
+    Entry(const Vector3d& point, index_t index) : point(point), index(index) {}
+    Vector3d point;
+    index_t index;
+  };
+
+  typedef std::vector<Entry> Cell;
+
+  Vector3i CellOf(const Vector3d& point) const;
+
+  // NOTE(milo): Packs 21 bits of each cell coordinate. Cells that are 2^21 apart share a key, which
+  // only costs extra distance checks (entries keep their points).
+  static uint64_t Key(const Vector3i& cell)
+  {
+    static const uint64_t kMask = (static_cast<uint64_t>(1) << 21) - 1;
+    return ((uint64_t)(cell.x() & kMask) << 42) |
+           ((uint64_t)(cell.y() & kMask) << 21) |
+           ((uint64_t)(cell.z() & kMask));
+  }
+
+  const Cell* GetCell(int x, int y, int z) const;
+
+ private:
+  double cell_size_;
+  size_t size_ = 0;
+  std::unordered_map<uint64_t, Cell> cells_;
+
+  // Bounds of the occupied cells, so that searches don't look at empty space.
+  Vector3i min_cell_ = Vector3i::Zero();
+  Vector3i max_cell_ = Vector3i::Zero();
+};
+
+
+}
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
 #include <utility>
 #include <glog/logging.h>
 
@@ -20,6 +24,29 @@ kdtree_t Tree::BuildKdTree() const
 }
 
 
+void Tree::SetIndexCellSize(double cell_size)
+{
+  grid_.Clear(cell_size);
+  for (size_t i = 0; i < points_.size(); ++i) {
+    grid_.Insert(points_.at(i), i);
+  }
+}
+
+
+size_t Tree::Nearby(const Vector3d& query_point,
+                    double radius,
+                    std::vector<index_t>& indices) const
+{
+  return grid_.Nearby(query_point, radius, indices);
+}
+
+
+Tree::index_t Tree::Nearest(const Vector3d& query_point) const
+{
+  return grid_.Nearest(query_point);
+}
+
+
 size_t Tree::Nearby(const kdtree_t& kdtree,
                     const Vector3d& query_point,
                     double radius,
@@ -54,18 +81,81 @@ Tree::index_t Tree::Nearest(const kdtree_t& kdtree,
 }
 
 
+void Tree::Reserve(size_t n)
+{
+  points_.reserve(n);
+  parents_.reserve(n);
+  costs_.reserve(n);
+  first_child_.reserve(n);
+  next_sibling_.reserve(n);
+}
+
+
 size_t Tree::AddNode(const Node& node)
 {
+  const size_t index = points_.size();
+  CHECK_LT(node.parent, (int)index) << "A node's parent has to be added before it" << std::endl;
+
   points_.emplace_back(node.point);
-  nodes_.emplace_back(node);
-  return (points_.size() - 1);
+  parents_.emplace_back(node.parent);
+  costs_.emplace_back(node.cost_so_far);
+  first_child_.emplace_back(-1);
+  next_sibling_.emplace_back(-1);
+  LinkChild(index, node.parent);
+
+  grid_.Insert(node.point, index);
+  return index;
 }
 
 
 void Tree::Rewire(size_t index, int new_parent, double new_cost_so_far)
 {
-  nodes_.at(index).parent = new_parent;
-  nodes_.at(index).cost_so_far = new_cost_so_far;
+  UnlinkChild(index, parents_.at(index));
+  parents_.at(index) = new_parent;
+  LinkChild(index, new_parent);
+
+  const double delta = new_cost_so_far - costs_.at(index);
+  costs_.at(index) = new_cost_so_far;
+
+  // NOTE(milo): Rewiring only lowers costs, so the new parent can't be in this subtree (its cost
+  // would have to be lower than its ancestor's). That keeps the tree acyclic.
+  subtree_.clear();
+  for (int c = first_child_.at(index); c >= 0; c = next_sibling_.at(c)) {
+    subtree_.emplace_back(c);
+  }
+  while (!subtree_.empty()) {
+    const int z = subtree_.back();
+    subtree_.pop_back();
+    costs_.at(z) += delta;
+    for (int c = first_child_.at(z); c >= 0; c = next_sibling_.at(c)) {
+      subtree_.emplace_back(c);
+    }
+  }
+}
+
+
+void Tree::LinkChild(size_t index, int parent)
+{
+  if (parent >= 0) {
+    next_sibling_.at(index) = first_child_.at(parent);
+    first_child_.at(parent) = (int)index;
+  }
+}
+
+
+void Tree::UnlinkChild(size_t index, int parent)
+{
+  if (parent < 0) {
+    return;
+  }
+
+  int* link = &first_child_.at(parent);
+  while (*link != (int)index) {
+    CHECK_GE(*link, 0) << "Node " << index << " isn't a child of node " << parent << std::endl;
+    link = &next_sibling_.at(*link);
+  }
+  *link = next_sibling_.at(index);
+  next_sibling_.at(index) = -1;
 }
 
 
@@ -92,57 +182,162 @@ bool ClipCollisionFree(const Vector3d& x0,
 }
 
 
-static std::pair<size_t, double> ChooseParent(const Tree& tree,
-                                              const CollisionChecker& collision_checker,
-                                              const std::vector<Tree::index_t>& Z_near,
-                                              const Tree::index_t& z_nearest,
-                                              const Vector3d& x_new)
+BatchCollisionChecker MakeBatchCollisionChecker(const CollisionChecker& collision_checker,
+                                                WorkerPool* pool)
 {
-  const Node n_nearest = tree.GetNode(z_nearest);
+  return [collision_checker, pool](const std::vector<Segment>& segments, std::vector<uint8_t>& is_free)
+  {
+    is_free.resize(segments.size());
+    const auto check = [&](int i) {
+      is_free[i] = collision_checker(segments[i].a, segments[i].b) ? 1 : 0;
+    };
+
+    if (pool != nullptr && segments.size() > 1) {
+      pool->ParallelFor((int)segments.size(), check);
+    } else {
+      for (size_t i = 0; i < segments.size(); ++i) {
+        check(i);
+      }
+    }
+  };
+}
 
-  Tree::index_t z_min = z_nearest;
-  double c_min = n_nearest.cost_so_far + (n_nearest.point - x_new).norm();
 
-  for (const Tree::index_t& z_near : Z_near) {
-    const Node n_near = tree.GetNode(z_near);
-    const double c = n_near.cost_so_far + (n_near.point - x_new).norm();
-    const bool is_collision_free = collision_checker(n_near.point, x_new);
+// The collision checks for the edges between x_new and each node in Z_near. Edges are checked
+// in batches, only when asked for, and at most once.
+// NOTE(milo): Every edge that an iteration checks ends at the new node, so nothing can be reused
+// across iterations. Within one, ChooseParent and Rewire would otherwise check the same edges (the
+// checker is assumed to be symmetric).
+class EdgeChecks final {
+ public:
+  EdgeChecks(const Tree& tree,
+             const BatchCollisionChecker& collision_checker,
+             const std::vector<Tree::index_t>& Z_near,
+             const Vector3d& x_new)
+      : tree_(tree),
+        collision_checker_(collision_checker),
+        Z_near_(Z_near),
+        x_new_(x_new),
+        state_(Z_near.size(), kUnknown) {}
+
+  // Checks the edges to Z_near.at(i) for each i in "which" that isn't checked yet.
+  void Check(const std::vector<size_t>& which)
+  {
+    segments_.clear();
+    pending_.clear();
+    for (const size_t i : which) {
+      if (state_.at(i) == kUnknown) {
+        segments_.emplace_back(tree_.GetPoint(Z_near_.at(i)), x_new_);
+        pending_.emplace_back(i);
+      }
+    }
 
-    if (is_collision_free && c < c_min) {
-      c_min = c;
-      z_min = z_near;
+    if (segments_.empty()) {
+      return;
     }
+
+    collision_checker_(segments_, is_free_);
+    CHECK_EQ(segments_.size(), is_free_.size());
+    for (size_t k = 0; k < pending_.size(); ++k) {
+      state_.at(pending_.at(k)) = is_free_.at(k) ? kFree : kBlocked;
+    }
+  }
+
+  bool IsFree(size_t i) const
+  {
+    CHECK(state_.at(i) != kUnknown) << "Edge hasn't been checked" << std::endl;
+    return state_.at(i) == kFree;
   }
 
-  return std::pair<size_t, double>(z_min, c_min);
+ private:
+  enum State : int8_t { kUnknown = -1, kBlocked = 0, kFree = 1 };
+
+  const Tree& tree_;
+  const BatchCollisionChecker& collision_checker_;
+  const std::vector<Tree::index_t>& Z_near_;
+  Vector3d x_new_;
+
+  std::vector<State> state_;
+  std::vector<Segment> segments_;
+  std::vector<size_t> pending_;
+  std::vector<uint8_t> is_free_;
+};
+
+
+// Checks candidate parents in order of cost, this many at a time, and stops at the first batch that
+// has a collision-free one. The first batch usually has one, so most of the edges to far away or
+// expensive near nodes are never checked.
+static const size_t kChooseParentBatchSize = 8;
+
+
+// Finds the cheapest near node that has a collision-free edge to x_new. Returns false if none do.
+static bool ChooseParent(const Tree& tree,
+                         EdgeChecks& edge_checks,
+                         const std::vector<Tree::index_t>& Z_near,
+                         const Vector3d& x_new,
+                         std::pair<size_t, double>& z_min)
+{
+  std::vector<std::pair<double, size_t>> candidates;
+  for (size_t i = 0; i < Z_near.size(); ++i) {
+    const Tree::index_t z_near = Z_near.at(i);
+    const double c = tree.GetCost(z_near) + (tree.GetPoint(z_near) - x_new).norm();
+    candidates.emplace_back(c, i);
+  }
+  std::sort(candidates.begin(), candidates.end());
+
+  std::vector<size_t> batch;
+  for (size_t begin = 0; begin < candidates.size(); begin += kChooseParentBatchSize) {
+    const size_t end = std::min(candidates.size(), begin + kChooseParentBatchSize);
+
+    batch.clear();
+    for (size_t k = begin; k < end; ++k) {
+      batch.emplace_back(candidates.at(k).second);
+    }
+    edge_checks.Check(batch);
+
+    for (size_t k = begin; k < end; ++k) {
+      if (edge_checks.IsFree(candidates.at(k).second)) {
+        z_min = std::pair<size_t, double>(Z_near.at(candidates.at(k).second), candidates.at(k).first);
+        return true;
+      }
+    }
+  }
+
+  return false;
 }
 
 
 static void Rewire(Tree& tree,
-                   const CollisionChecker& collision_checker,
+                   EdgeChecks& edge_checks,
                    const std::vector<Tree::index_t>& Z_near,
                    Tree::index_t z_min,
                    const Node& n_new,
                    Tree::index_t z_new)
 {
-  for (const Tree::index_t& z_near : Z_near) {
+  // Only check the edges that would reduce the cost to reach a near node.
+  std::vector<size_t> todo;
+  std::vector<double> costs_if_rewired;
+
+  for (size_t i = 0; i < Z_near.size(); ++i) {
     // The parent of n_new can't be rewired through it.
-    if (z_near == z_min) {
+    if (Z_near.at(i) == z_min) {
       continue;
     }
 
-    const Node& n_near = tree.GetNode(z_near);
-    const bool is_collision_free = collision_checker(n_new.point, n_near.point);
+    const Tree::index_t z_near = Z_near.at(i);
+    const double cost_if_rewired = n_new.cost_so_far + (n_new.point - tree.GetPoint(z_near)).norm();
 
-    if (!is_collision_free) {
-      continue;
+    if (cost_if_rewired < tree.GetCost(z_near)) {
+      todo.emplace_back(i);
+      costs_if_rewired.emplace_back(cost_if_rewired);
     }
+  }
 
-    const double cost_if_rewired = n_new.cost_so_far + (n_new.point - n_near.point).norm();
+  edge_checks.Check(todo);
 
-    // If rewiring reduces the cost to reach n_near, update its parent.
-    if (cost_if_rewired < n_near.cost_so_far) {
-      tree.Rewire(z_near, z_new, cost_if_rewired);
+  for (size_t k = 0; k < todo.size(); ++k) {
+    if (edge_checks.IsFree(todo.at(k))) {
+      tree.Rewire(Z_near.at(todo.at(k)), z_new, costs_if_rewired.at(k));
     }
   }
 }
@@ -156,36 +351,174 @@ void BuildTree(Tree& tree,
                double search_radius,
                int maxiters)
 {
+  BuildTree(tree, start, goal, sampler, MakeBatchCollisionChecker(collision_checker), search_radius, maxiters);
+}
+
+
+void BuildTree(Tree& tree,
+               const Vector3d& start,
+               const Vector3d& goal,
+               const PointSampler& sampler,
+               const BatchCollisionChecker& collision_checker,
+               double search_radius,
+               int maxiters)
+{
+  // NOTE(milo): The index is updated as nodes are added, instead of rebuilding a kd-tree over all
+  // of the nodes every iteration. A cell size of search_radius makes Nearby() look at 27 cells.
+  if (search_radius > 0 && tree.Size() == 0) {
+    tree.SetIndexCellSize(search_radius);
+  }
+
+  tree.Reserve(tree.Size() + 1 + std::max(0, maxiters));
   tree.AddNode(Node(start, -1, 0));
 
   for (int iter = 0; iter < maxiters; ++iter) {
-    const kdtree_t kdtree = tree.BuildKdTree();
+    Tree::index_t z_new;
+    ExtendTree(tree, sampler(), collision_checker, search_radius, z_new);
+  }
+}
 
-    // Get the node that is nearest to x_sample.
-    const Vector3d x_sample = sampler();
-    Tree::index_t z_nearest = tree.Nearest(kdtree, x_sample);
 
-    // Try to find an x_new such that travelling from NN to x_new is collision-free.
-    Vector3d x_new;
-    const bool valid = ClipCollisionFree(
-        tree.GetPoint(z_nearest), x_sample, kMinObstacleDist, kMaxLineDist, x_new);
+bool ExtendTree(Tree& tree,
+                const Vector3d& x_sample,
+                const BatchCollisionChecker& collision_checker,
+                double search_radius,
+                Tree::index_t& z_new)
+{
+  // Get the node that is nearest to x_sample.
+  Tree::index_t z_nearest = tree.Nearest(x_sample);
 
-    if (!valid) {
-      continue;
+  // Try to find an x_new such that travelling from NN to x_new is collision-free.
+  Vector3d x_new;
+  const bool valid = ClipCollisionFree(
+      tree.GetPoint(z_nearest), x_sample, kMinObstacleDist, kMaxLineDist, x_new);
+
+  if (!valid) {
+    return false;
+  }
+
+  // Get nodes that are nearby x_new. The nearest node is always a candidate parent, even if
+  // x_new was clipped to farther than search_radius from it.
+  std::vector<Tree::index_t> Z_near;
+  tree.Nearby(x_new, search_radius, Z_near);
+  if (std::find(Z_near.begin(), Z_near.end(), z_nearest) == Z_near.end()) {
+    Z_near.emplace_back(z_nearest);
+  }
+
+  // If x_new can't be reached from any of them, don't add it.
+  EdgeChecks edge_checks(tree, collision_checker, Z_near, x_new);
+  std::pair<size_t, double> z_min;
+  if (!ChooseParent(tree, edge_checks, Z_near, x_new, z_min)) {
+    return false;
+  }
+
+  // Insert the new node.
+  const Node n_new(x_new, z_min.first, z_min.second);
+  z_new = tree.AddNode(n_new);
+
+  Rewire(tree, edge_checks, Z_near, z_min.first, n_new, z_new);
+
+  return true;
+}
+
+
+static bool InBox(const Vector3d& x, const Vector3d& pmin, const Vector3d& pmax)
+{
+  return (x.array() >= pmin.array()).all() && (x.array() <= pmax.array()).all();
+}
+
+
+size_t RerootTree(Tree& tree,
+                  const Vector3d& root,
+                  const Vector3d& pmin,
+                  const Vector3d& pmax,
+                  const BatchCollisionChecker& collision_checker,
+                  double search_radius)
+{
+  const size_t N = tree.Size();
+  Tree rerooted(tree.IndexCellSize());
+  rerooted.Reserve(N + 1);
+  rerooted.AddNode(Node(root, -1, 0));
+
+  if (N == 0) {
+    tree = std::move(rerooted);
+    return 0;
+  }
+
+  // The edges that could stay in the tree. The new root is vertex N.
+  std::vector<Segment> segments;
+  std::vector<std::pair<size_t, size_t>> edges;
+  for (size_t i = 0; i < N; ++i) {
+    const int parent = tree.GetParent(i);
+    if (parent >= 0 && InBox(tree.GetPoint(i), pmin, pmax) && InBox(tree.GetPoint(parent), pmin, pmax)) {
+      segments.emplace_back(tree.GetPoint(parent), tree.GetPoint(i));
+      edges.emplace_back(parent, i);
     }
+  }
 
-    // Get nodes that are nearby x_new.
-    std::vector<Tree::index_t> Z_near;
-    tree.Nearby(kdtree, x_new, search_radius, Z_near);
+  std::vector<Tree::index_t> Z_near;
+  tree.Nearby(root, search_radius, Z_near);
+  if (Z_near.empty()) {
+    Z_near.emplace_back(tree.Nearest(root));
+  }
+  for (const Tree::index_t z : Z_near) {
+    if (InBox(tree.GetPoint(z), pmin, pmax)) {
+      segments.emplace_back(tree.GetPoint(z), root);
+      edges.emplace_back(z, N);
+    }
+  }
 
-    const std::pair<size_t, double>& z_min = ChooseParent(tree, collision_checker, Z_near, z_nearest, x_new);
+  std::vector<uint8_t> is_free;
+  collision_checker(segments, is_free);
+  CHECK_EQ(segments.size(), is_free.size());
+
+  // The checker is assumed to be symmetric, so edges can be used in either direction.
+  std::vector<std::vector<std::pair<size_t, double>>> adjacent(N + 1);
+  for (size_t k = 0; k < edges.size(); ++k) {
+    if (is_free.at(k)) {
+      const double length = (segments.at(k).b - segments.at(k).a).norm();
+      adjacent.at(edges.at(k).first).emplace_back(edges.at(k).second, length);
+      adjacent.at(edges.at(k).second).emplace_back(edges.at(k).first, length);
+    }
+  }
 
-    // Insert the new node.
-    const Node n_new(x_new, z_min.first, z_min.second);
-    const size_t z_new = tree.AddNode(n_new);
+  // Dijkstra from the root. Nodes are re-added in the order they're settled, so every parent is
+  // added before its children.
+  typedef std::pair<double, size_t> CostAndVertex;
+  std::priority_queue<CostAndVertex, std::vector<CostAndVertex>, std::greater<CostAndVertex>> queue;
+  std::vector<double> cost(N + 1, std::numeric_limits<double>::max());
+  std::vector<int> new_index(N + 1, -1);
+  std::vector<size_t> parent(N + 1, N);
+
+  cost.at(N) = 0;
+  new_index.at(N) = 0;
+  for (const auto& next : adjacent.at(N)) {
+    cost.at(next.first) = next.second;
+    queue.emplace(next.second, next.first);
+  }
 
-    Rewire(tree, collision_checker, Z_near, z_min.first, n_new, z_new);
+  while (!queue.empty()) {
+    const CostAndVertex top = queue.top();
+    queue.pop();
+    const size_t v = top.second;
+    if (new_index.at(v) >= 0 || top.first > cost.at(v)) {
+      continue;
+    }
+
+    new_index.at(v) = (int)rerooted.AddNode(Node(tree.GetPoint(v), new_index.at(parent.at(v)), cost.at(v)));
+
+    for (const auto& next : adjacent.at(v)) {
+      const double c = cost.at(v) + next.second;
+      if (new_index.at(next.first) < 0 && c < cost.at(next.first)) {
+        cost.at(next.first) = c;
+        parent.at(next.first) = v;
+        queue.emplace(c, next.first);
+      }
+    }
   }
+
+  tree = std::move(rerooted);
+  return tree.Size() - 1;
 }
 
 
@@ -4,7 +4,9 @@
 #include <nanoflann.hpp>
 
 #include "core/eigen_types.hpp"
+#include "core/worker_pool.hpp"
 #include "rrt/nanoflann_adaptor.hpp"
+#include "rrt/point_hash_grid.hpp"
 
 namespace bm {
 namespace rrt {
@@ -19,6 +21,24 @@ typedef std::pair<size_t, double> IndexAndDist;
 typedef std::function<Vector3d()> PointSampler;
 typedef std::function<bool(const Vector3d&, const Vector3d&)> CollisionChecker;
 
+// A straight line from a to b, to be checked for collisions.
+struct Segment
+{
+  Segment(const Vector3d& a, const Vector3d& b) : a(a), b(b) {}
+  Vector3d a;
+  Vector3d b;
+};
+
+// Checks a batch of segments at once, and sets is_free.at(i) to 1 if segments.at(i) is collision
+// free (0 otherwise). is_free is resized to match.
+typedef std::function<void(const std::vector<Segment>&, std::vector<uint8_t>&)> BatchCollisionChecker;
+
+// Wraps a CollisionChecker that checks one segment. If a pool is given, the segments in a batch
+// are checked in parallel on it (the checker must be threadsafe).
+BatchCollisionChecker MakeBatchCollisionChecker(const CollisionChecker& collision_checker,
+                                                WorkerPool* pool = nullptr);
+
+// One node of a Tree, to add it or to get a copy of it.
 struct Node
 {
 	Node() = default;
@@ -32,12 +52,36 @@ struct Node
 };
 
 
+// The nodes are stored as one array per field, so that the points are the kd-tree's data (instead
+// of a copy of them), and search loops only pull in the fields that they read. Each node also
+// links to its first child and its next sibling, so that a rewire can update the costs of the
+// subtree below it. Node costs are always exact (the length of the path from the root).
 class Tree {
  public:
 	typedef size_t index_t;
 
+	// The nodes are also kept in a PointHashGrid with cubes of side cell_size, which is the fastest
+	// when it's close to the radius used with Nearby().
+	explicit Tree(double cell_size = 5.0) : grid_(cell_size) {}
+
+	// Change the cell size of the index (re-inserts all of the nodes).
+	void SetIndexCellSize(double cell_size);
+
+	double IndexCellSize() const { return grid_.CellSize(); }
+
+	// Reserve space for n nodes (e.g the current size plus one per iteration that will extend it).
+	void Reserve(size_t n);
+
 	// Returns nearby neighbors within a spherical search radius. Note that returned
 	// neighbors are sorted by *increasing* distance, so the nearest neighbor is first.
+	size_t Nearby(const Vector3d& query_point,
+								double radius,
+								std::vector<index_t>& indices) const;
+
+	// Find the nearest node to query_point.
+	index_t Nearest(const Vector3d& query_point) const;
+
+	// Same as above, but against a kd-tree snapshot of the nodes (see BuildKdTree()).
 	size_t Nearby(const kdtree_t& kdtree,
 								const Vector3d& query_point,
 								double radius,
@@ -47,21 +91,44 @@ class Tree {
 	index_t Nearest(const kdtree_t& kdtree,
 							 		const Vector3d& query_point) const;
 
-	// Add a node to the tree and return its index.
+	// Add a node to the tree and return its index. Its parent (if any) must be in the tree already.
 	index_t AddNode(const Node& node);
 
-	Node GetNode(index_t index) const { return nodes_.at(index); }
+	// Give a node a new parent and cost. Every node below it gets the same change in cost.
 	void Rewire(index_t index, int new_parent, double new_cost_so_far);
 
-	Vector3d GetPoint(index_t index) const { return points_.at(index); }
+	Node GetNode(index_t index) const { return Node(points_.at(index), parents_.at(index), costs_.at(index)); }
+	const Vector3d& GetPoint(index_t index) const { return points_.at(index); }
+	int GetParent(index_t index) const { return parents_.at(index); }
+	double GetCost(index_t index) const { return costs_.at(index); }
+
+	// Children of a node, as a linked list: for (int c = FirstChild(z); c >= 0; c = NextSibling(c)).
+	int FirstChild(index_t index) const { return first_child_.at(index); }
+	int NextSibling(index_t index) const { return next_sibling_.at(index); }
+
+	// Every node's field at once, by node index.
+	const VecVector3d& Points() const { return points_; }
+	const std::vector<int>& Parents() const { return parents_; }
+	const std::vector<double>& Costs() const { return costs_; }
+
+	size_t Size() const { return points_.size(); }
 
 	// Rebuild a kd-tree data structure using the current points_. Note that this has to be
 	// recomputed every time we add or remove a node.
 	kdtree_t BuildKdTree() const;
 
  private:
+	void LinkChild(index_t index, int parent);
+	void UnlinkChild(index_t index, int parent);
+
 	VecVector3d points_;
-  std::vector<Node> nodes_;
+	std::vector<int> parents_;
+	std::vector<double> costs_;
+	std::vector<int> first_child_;	// -1 for a leaf.
+	std::vector<int> next_sibling_;	// -1 for the last child of a node.
+	PointHashGrid grid_;	// Updated by AddNode(), so it's always current.
+
+	std::vector<int> subtree_;	// Scratch space for Rewire().
 };
 
 
@@ -77,7 +144,7 @@ bool ClipCollisionFree(const Vector3d& x0,
 											 Vector3d& x_new);
 
 
-// Runs the RRT* algorithm.
+// Runs the RRT* algorithm. The tree's index is resized to search_radius.
 void BuildTree(Tree& tree,
 							 const Vector3d& start,
 							 const Vector3d& goal,
@@ -86,6 +153,42 @@ void BuildTree(Tree& tree,
 							 double search_radius,
 							 int maxiters);
 
+// Same as above, but all of the edges that an iteration needs are checked in batches. Each edge
+// between the new node and a near node is checked at most once, and only if it could lower a cost.
+// Every edge in the tree is collision-free.
+void BuildTree(Tree& tree,
+							 const Vector3d& start,
+							 const Vector3d& goal,
+							 const PointSampler& sampler,
+							 const BatchCollisionChecker& collision_checker,
+							 double search_radius,
+							 int maxiters);
+
+
+// One iteration of RRT*: adds a node towards x_sample with the cheapest collision-free parent near
+// it, and rewires the near nodes through it. Returns false if no node was added (none of the near
+// nodes can reach it).
+bool ExtendTree(Tree& tree,
+								const Vector3d& x_sample,
+								const BatchCollisionChecker& collision_checker,
+								double search_radius,
+								Tree::index_t& z_new);
+
+
+// Re-roots a tree at "root" (e.g the vehicle's position at the next replan), so that the next plan
+// can keep growing it instead of starting over. Every edge of the tree is checked again (e.g after
+// new obstacles were mapped), as well as the edges from the root to the nodes within search_radius
+// of it (or to the nearest node if none are). Nodes outside of the box [pmin, pmax], and nodes that
+// can't be reached from the root through free edges anymore, are removed. The others get the
+// cheapest parent through the remaining edges, with exact costs. The root is node 0 afterwards, and
+// node indices change. Returns the number of nodes that were kept (not counting the root).
+size_t RerootTree(Tree& tree,
+									const Vector3d& root,
+									const Vector3d& pmin,
+									const Vector3d& pmax,
+									const BatchCollisionChecker& collision_checker,
+									double search_radius);
+
 
 }
 }
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "rrt/rrt_planner.hpp"
+
+namespace bm {
+namespace rrt {
+
+// Check the deadline every this many iterations, instead of reading the clock every time.
+static const int kDeadlineCheckIters = 16;
+
+// Informed samples outside of the box are rejected. After this many in a row, fall back to box
+// sampling (e.g if the ellipsoid is much bigger than the box).
+static const int kMaxInformedTries = 8;
+
+
+void RrtPlanner::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("search_radius", &search_radius);
+  parser.GetParam("goal_radius", &goal_radius);
+  parser.GetParam("max_iters", &max_iters);
+  parser.GetParam("informed", &informed);
+  parser.GetParam("num_trees", &num_trees);
+  parser.GetParam("num_threads", &num_threads);
+  parser.GetParam("seed", &seed);
+  parser.GetParam("reuse_trees", &reuse_trees);
+}
+
+
+Vector3d SampleInformed(const Vector3d& start,
+                        const Vector3d& goal,
+                        double c_best,
+                        std::default_random_engine& rng)
+{
+  const double c_min = (goal - start).norm();
+  CHECK_GE(c_best, c_min) << "A path can't be shorter than the straight line" << std::endl;
+
+  // Rotation from the ellipsoid frame (x-axis from start to goal) to the world frame.
+  Matrix3d C = Matrix3d::Identity();
+  if (c_min > 0) {
+    C = Quaterniond::FromTwoVectors(Vector3d::UnitX(), goal - start).toRotationMatrix();
+  }
+
+  const double r1 = 0.5 * c_best;
+  const double r2 = 0.5 * std::sqrt(c_best * c_best - c_min * c_min);
+
+  // Uniform in the unit ball: a uniform direction, and a radius with density ~ r^2.
+  std::normal_distribution<double> normal(0, 1);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  Vector3d x_ball(normal(rng), normal(rng), normal(rng));
+  while (x_ball.squaredNorm() == 0) {
+    x_ball = Vector3d(normal(rng), normal(rng), normal(rng));
+  }
+  x_ball = x_ball.normalized() * std::cbrt(uniform(rng));
+
+  return C * Vector3d(r1 * x_ball.x(), r2 * x_ball.y(), r2 * x_ball.z()) + 0.5 * (start + goal);
+}
+
+
+static Vector3d SampleBox(const Vector3d& pmin, const Vector3d& pmax, std::default_random_engine& rng)
+{
+  std::uniform_real_distribution<double> ux(pmin.x(), pmax.x());
+  std::uniform_real_distribution<double> uy(pmin.y(), pmax.y());
+  std::uniform_real_distribution<double> uz(pmin.z(), pmax.z());
+  return Vector3d(ux(rng), uy(rng), uz(rng));
+}
+
+
+static bool InBox(const Vector3d& x, const Vector3d& pmin, const Vector3d& pmax)
+{
+  return (x.array() >= pmin.array()).all() && (x.array() <= pmax.array()).all();
+}
+
+
+// Cost of the path through the tree to node z, then to the goal. If path isn't null, it's set to
+// the points along the path, from the root to the goal.
+static double PathCost(const Tree& tree, Tree::index_t z, const Vector3d& goal, VecVector3d* path)
+{
+  if (path) {
+    path->clear();
+    path->emplace_back(goal);
+    for (int z_current = (int)z; z_current >= 0; z_current = tree.GetParent(z_current)) {
+      path->emplace_back(tree.GetPoint(z_current));
+    }
+    std::reverse(path->begin(), path->end());
+  }
+
+  return tree.GetCost(z) + (tree.GetPoint(z) - goal).norm();
+}
+
+
+RrtPlanner::RrtPlanner(const Params& params)
+    : params_(params),
+      trees_(params.num_trees, Tree(params.search_radius)),
+      best_cost_(std::numeric_limits<double>::max())
+{
+  CHECK_GE(params_.num_trees, 1);
+  CHECK_GT(params_.search_radius, 0);
+
+  if (params_.num_trees > 1) {
+    pool_.reset(new WorkerPool(params_.num_threads));
+  }
+}
+
+
+PlanResult RrtPlanner::Plan(const Vector3d& start,
+                            const Vector3d& goal,
+                            const Vector3d& pmin,
+                            const Vector3d& pmax,
+                            const BatchCollisionChecker& collision_checker,
+                            double deadline_sec)
+{
+  const bool use_deadline = deadline_sec > 0;
+  const Clocktime deadline = std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(Seconds(deadline_sec));
+
+  best_cost_.store(std::numeric_limits<double>::max());
+
+  std::vector<PlanResult> results(params_.num_trees);
+  const auto grow = [&](int i) {
+    results.at(i) = GrowTree(i, start, goal, pmin, pmax, collision_checker, deadline, use_deadline);
+  };
+
+  if (pool_) {
+    pool_->ParallelFor(params_.num_trees, grow);
+  } else {
+    grow(0);
+  }
+
+  // Merge the trees: keep the best path, and add up the work.
+  PlanResult best;
+  for (const PlanResult& r : results) {
+    best.iters += r.iters;
+    best.hit_deadline |= r.hit_deadline;
+    best.reused_nodes += r.reused_nodes;
+    if (r.found && r.cost < best.cost) {
+      const int iters = best.iters;
+      const bool hit_deadline = best.hit_deadline;
+      const int reused_nodes = best.reused_nodes;
+      best = r;
+      best.iters = iters;
+      best.hit_deadline = hit_deadline;
+      best.reused_nodes = reused_nodes;
+    }
+  }
+
+  return best;
+}
+
+
+void RrtPlanner::ResetTrees()
+{
+  for (Tree& tree : trees_) {
+    tree = Tree(params_.search_radius);
+  }
+}
+
+
+PlanResult RrtPlanner::GrowTree(int tree_index,
+                                const Vector3d& start,
+                                const Vector3d& goal,
+                                const Vector3d& pmin,
+                                const Vector3d& pmax,
+                                const BatchCollisionChecker& collision_checker,
+                                const Clocktime& deadline,
+                                bool use_deadline)
+{
+  PlanResult result;
+  result.tree_index = tree_index;
+
+  std::default_random_engine rng(params_.seed + tree_index);
+  Tree& tree = trees_.at(tree_index);
+
+  std::vector<Tree::index_t> goal_nodes;
+  std::vector<Segment> to_goal;
+  std::vector<uint8_t> is_free;
+  double local_best = std::numeric_limits<double>::max();
+
+  if (params_.reuse_trees && tree.Size() > 0) {
+    result.reused_nodes = (int)RerootTree(tree, start, pmin, pmax, collision_checker, params_.search_radius);
+
+    // The kept nodes near the goal (which may have moved too) can connect to it right away.
+    std::vector<Tree::index_t> near_goal;
+    tree.Nearby(goal, params_.goal_radius, near_goal);
+    to_goal.clear();
+    for (const Tree::index_t z : near_goal) {
+      to_goal.emplace_back(tree.GetPoint(z), goal);
+    }
+    if (!to_goal.empty()) {
+      collision_checker(to_goal, is_free);
+      for (size_t k = 0; k < near_goal.size(); ++k) {
+        if (is_free.at(k)) {
+          goal_nodes.emplace_back(near_goal.at(k));
+          local_best = std::min(local_best, PathCost(tree, near_goal.at(k), goal, nullptr));
+        }
+      }
+    }
+  } else {
+    tree = Tree(params_.search_radius);
+    tree.AddNode(Node(start, -1, 0));
+  }
+  tree.Reserve(tree.Size() + params_.max_iters);
+
+  for (int iter = 0; iter < params_.max_iters; ++iter) {
+    if (use_deadline && (iter % kDeadlineCheckIters) == 0 && std::chrono::steady_clock::now() >= deadline) {
+      result.hit_deadline = true;
+      break;
+    }
+
+    // Sample from the informed set if any tree has a path, otherwise from the whole box.
+    const double c_best = best_cost_.load();
+    bool sampled = false;
+    Vector3d x_sample;
+    if (params_.informed && c_best < std::numeric_limits<double>::max()) {
+      for (int k = 0; k < kMaxInformedTries && !sampled; ++k) {
+        x_sample = SampleInformed(start, goal, c_best, rng);
+        sampled = InBox(x_sample, pmin, pmax);
+      }
+    }
+    if (!sampled) {
+      x_sample = SampleBox(pmin, pmax, rng);
+    }
+
+    ++result.iters;
+
+    Tree::index_t z_new;
+    if (!ExtendTree(tree, x_sample, collision_checker, params_.search_radius, z_new)) {
+      continue;
+    }
+
+    // See if the new node can connect to the goal.
+    const Vector3d x_new = tree.GetPoint(z_new);
+    if ((x_new - goal).norm() <= params_.goal_radius) {
+      to_goal.assign(1, Segment(x_new, goal));
+      collision_checker(to_goal, is_free);
+      if (is_free.at(0)) {
+        goal_nodes.emplace_back(z_new);
+      }
+    }
+
+    // Rewiring can make any of the goal nodes cheaper, so look at all of them now and then.
+    const bool new_goal_node = !goal_nodes.empty() && goal_nodes.back() == z_new;
+    if (new_goal_node || (iter % kDeadlineCheckIters) == 0) {
+      for (const Tree::index_t z_goal : goal_nodes) {
+        local_best = std::min(local_best, PathCost(tree, z_goal, goal, nullptr));
+      }
+    }
+
+    // Share the best cost with the other trees.
+    double shared = best_cost_.load();
+    while (local_best < shared && !best_cost_.compare_exchange_weak(shared, local_best)) {}
+  }
+
+  // Pick the best path through this tree.
+  for (const Tree::index_t z_goal : goal_nodes) {
+    const double cost = PathCost(tree, z_goal, goal, nullptr);
+    if (cost < result.cost) {
+      result.found = true;
+      result.cost = cost;
+      PathCost(tree, z_goal, goal, &result.path);
+    }
+  }
+
+  return result;
+}
+
+
+}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <random>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/timer.hpp"
+#include "core/worker_pool.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "rrt/rrt.hpp"
+
+namespace bm {
+namespace rrt {
+
+using namespace core;
+
+
+// The best path that a planner found from start to goal.
+struct PlanResult final
+{
+  bool found = false;
+  double cost = std::numeric_limits<double>::max();   // Length of the path (m).
+  VecVector3d path;                                   // Starts at start and ends at goal.
+  int tree_index = -1;                                // Which tree the path is from.
+  int iters = 0;                                      // Iterations done, over all of the trees.
+  bool hit_deadline = false;                          // Stopped early because of the deadline.
+  int reused_nodes = 0;                               // Nodes kept from the last plan, over all of the trees.
+};
+
+
+// Samples uniformly from the prolate spheroid of points x where |x - start| + |x - goal| <= c_best,
+// which are the only samples that can shorten a path of length c_best ("Informed RRT*", Gammell et
+// al. 2014).
+Vector3d SampleInformed(const Vector3d& start,
+                        const Vector3d& goal,
+                        double c_best,
+                        std::default_random_engine& rng);
+
+
+// Plans a path with RRT*. Several independent trees can be grown at once (on a WorkerPool), and the
+// best path from any of them is returned. Once any tree reaches the goal, all of them switch to
+// informed sampling with the best cost so far. Planning stops after max_iters per tree, or at a
+// deadline, so that it can be used as an anytime planner in a fixed budget.
+class RrtPlanner final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double search_radius = 8.0;   // RRT* rewiring radius (m), also the tree's index cell size.
+    double goal_radius = 2.0;     // Nodes this close to the goal try to connect to it (m).
+    int max_iters = 5000;         // Per tree.
+    bool informed = true;         // Sample from the informed set once a path is found.
+    int num_trees = 1;            // Independent trees, grown in parallel.
+    int num_threads = 0;          // Workers, in addition to the calling thread.
+    int seed = 0;                 // Tree i uses seed + i, so plans are repeatable.
+    bool reuse_trees = false;     // Keep the trees between plans (see Plan()).
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(RrtPlanner)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(RrtPlanner)
+
+  explicit RrtPlanner(const Params& params);
+
+  // Plans from start to goal, with samples inside of the box [pmin, pmax]. If deadline_sec > 0,
+  // returns the best path so far once that much time has passed.
+  // NOTE(milo): With num_trees > 1, the collision checker is called from several threads at once.
+  // It must not run on the same WorkerPool as this planner (see WorkerPool::ParallelFor).
+  //
+  // With reuse_trees, each tree from the last plan is re-rooted at start (see RerootTree()), which
+  // drops the nodes that the collision checker (e.g with new obstacles) or the new box cut off, and
+  // then grows for another max_iters. Consecutive replans from a moving vehicle mostly keep their
+  // trees, so fewer iterations are needed for the same path quality.
+  PlanResult Plan(const Vector3d& start,
+                  const Vector3d& goal,
+                  const Vector3d& pmin,
+                  const Vector3d& pmax,
+                  const BatchCollisionChecker& collision_checker,
+                  double deadline_sec = 0);
+
+  // Forget the trees from the last plan (e.g if the goal moved far away).
+  void ResetTrees();
+
+ private:
+  // Grows (or re-roots and then grows) one tree, and fills in its best path.
+  PlanResult GrowTree(int tree_index,
+                      const Vector3d& start,
+                      const Vector3d& goal,
+                      const Vector3d& pmin,
+                      const Vector3d& pmax,
+                      const BatchCollisionChecker& collision_checker,
+                      const Clocktime& deadline,
+                      bool use_deadline);
+
+ private:
+  Params params_;
+  std::unique_ptr<WorkerPool> pool_;
+  std::vector<Tree> trees_;   // One per tree index, kept between plans if reuse_trees.
+
+  // The best path cost from any tree, shared so that they all sample from the smallest informed set.
+  std::atomic<double> best_cost_;
+};
+
+
+}
+}
@@ -49,6 +49,63 @@ void ForegroundTextureMask(const Image1b& gray,
 }
 
 
+std::vector<cv::Rect> ForegroundTiles(const Image1b& mask, int tile_size, int dilate_tiles)
+{
+  CHECK_GT(tile_size, 0);
+  CHECK_GE(dilate_tiles, 0);
+
+  const int grid_rows = (mask.rows + tile_size - 1) / tile_size;
+  const int grid_cols = (mask.cols + tile_size - 1) / tile_size;
+  const cv::Rect image_rect(0, 0, mask.cols, mask.rows);
+
+  Image1b occupied(grid_rows, grid_cols, (uchar)0);
+  for (int r = 0; r < grid_rows; ++r) {
+    for (int c = 0; c < grid_cols; ++c) {
+      const cv::Rect tile = cv::Rect(c * tile_size, r * tile_size, tile_size, tile_size) & image_rect;
+      occupied(r, c) = (cv::countNonZero(mask(tile)) > 0) ? 255 : 0;
+    }
+  }
+
+  if (dilate_tiles > 0) {
+    const int k = 2*dilate_tiles + 1;
+    cv::dilate(occupied, occupied, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(k, k)));
+  }
+
+  std::vector<cv::Rect> tiles;
+  for (int r = 0; r < grid_rows; ++r) {
+    for (int c = 0; c < grid_cols; ++c) {
+      if (occupied(r, c) > 0) {
+        tiles.emplace_back(cv::Rect(c * tile_size, r * tile_size, tile_size, tile_size) & image_rect);
+      }
+    }
+  }
+
+  return tiles;
+}
+
+
+std::vector<cv::Rect> TileRowBands(const std::vector<cv::Rect>& tiles, int image_cols)
+{
+  std::vector<std::pair<int, int>> ranges;
+  for (const cv::Rect& tile : tiles) {
+    ranges.emplace_back(tile.y, tile.y + tile.height);
+  }
+  std::sort(ranges.begin(), ranges.end());
+
+  std::vector<cv::Rect> bands;
+  for (const auto& range : ranges) {
+    const int band_end = bands.empty() ? -1 : (bands.back().y + bands.back().height);
+    if (range.first <= band_end) {
+      bands.back().height = std::max(band_end, range.second) - bands.back().y;
+    } else {
+      bands.emplace_back(0, range.first, image_cols, range.second - range.first);
+    }
+  }
+
+  return bands;
+}
+
+
 Image1f Patchmatch::Initialize(const Image1b& iml,
                                const Image1b& imr,
                                int downsample_factor)
@@ -78,7 +135,7 @@ Image1f Patchmatch::Initialize(const Image1b& iml,
   cv::dilate(disps, disps, element);
   cv::resize(disps, disps, disps.size() / downsample_factor, 0, 0, cv::INTER_NEAREST);
 
-  disps /= std::pow(2, downsample_factor);
+  disps /= (float)downsample_factor;
 
   // Diversify the initial disparity estimates so the propagate step has more options to choose from.
   // AddNoise(disps, 2.0*(float)downsample_factor, disps > 0);
@@ -360,5 +417,303 @@ void Patchmatch::RemoveBackground(const Image1b& iml,
 }
 
 
+constexpr int Patchmatch::kMaxPatchPixels;
+
+
+// Copy the patch centered at (x, y) into out (row-major).
+static inline void SamplePatch(const Image1f& im, int x, int y, int pw, int ph, float* out)
+{
+  for (int r = 0; r < ph; ++r) {
+    const float* row = im.ptr<float>(y - ph / 2 + r) + (x - pw / 2);
+    std::copy(row, row + pw, out + r * pw);
+  }
+}
+
+
+// Same as cv::getRectSubPix for a subpixel x and integer y, but into out (row-major).
+static inline void SamplePatchSubpixX(const Image1f& im, float x, int y, int pw, int ph, float* out)
+{
+  const int x0 = (int)std::floor(x);
+  const float t = x - (float)x0;
+
+  for (int r = 0; r < ph; ++r) {
+    const float* row = im.ptr<float>(y - ph / 2 + r) + (x0 - pw / 2);
+    float* o = out + r * pw;
+
+    // NOTE(milo): Don't touch the pixel to the right unless it's needed, since it could be past the
+    // edge of the image.
+    if (t == 0) {
+      std::copy(row, row + pw, o);
+    } else {
+      for (int c = 0; c < pw; ++c) {
+        o[c] = row[c] + t * (row[c + 1] - row[c]);
+      }
+    }
+  }
+}
+
+
+// Cost of matching the left patch (il, gl) to the right image at (xr, y).
+template <typename CostT>
+static inline float PatchCost(const CostT& cost,
+                              const float* il,
+                              const float* gl,
+                              const Image1f& imr,
+                              const Image1f& Gr,
+                              float xr, int y,
+                              int pw, int ph,
+                              float* ir,
+                              float* gr)
+{
+  SamplePatchSubpixX(imr, xr, y, pw, ph, ir);
+  SamplePatchSubpixX(Gr, xr, y, pw, ph, gr);
+  return cost(il, ir, gl, gr, pw * ph);
+}
+
+
+static void CheckRedBlackInputs(const Image1f& iml, const Image1f& disp, int patch_height, int patch_width)
+{
+  CHECK(patch_height % 2 != 0);
+  CHECK(patch_width % 2 != 0);
+  CHECK(patch_height >= 3 && patch_width >= 3) << "Red-black propagation needs patches of at least 3x3" << std::endl;
+  CHECK_LE(patch_height * patch_width, Patchmatch::kMaxPatchPixels);
+  CHECK_EQ(iml.size(), disp.size());
+}
+
+
+// The pixels that each task of the red-black engine updates, away from the image border (where
+// patches don't fit). Without tiles, each task is one row.
+static std::vector<cv::Rect> RedBlackTasks(int w, int h, int rx, int ry, const std::vector<cv::Rect>* tiles)
+{
+  const cv::Rect valid(rx, ry, w - 2*rx, h - 2*ry);
+  std::vector<cv::Rect> tasks;
+
+  if (tiles == nullptr) {
+    for (int y = valid.y; y < (valid.y + valid.height); ++y) {
+      tasks.emplace_back(valid.x, y, valid.width, 1);
+    }
+    return tasks;
+  }
+
+  for (const cv::Rect& tile : *tiles) {
+    const cv::Rect task = tile & valid;
+    if (task.area() > 0) {
+      tasks.emplace_back(task);
+    }
+  }
+  return tasks;
+}
+
+
+template <typename CostT>
+void Patchmatch::PropagateRedBlack(const Image1f& iml,
+                                   const Image1f& imr,
+                                   const Image1f& Gl,
+                                   const Image1f& Gr,
+                                   Image1f& disp,
+                                   const CostT& cost,
+                                   int patch_height,
+                                   int patch_width,
+                                   const std::vector<cv::Rect>* tiles)
+{
+  CheckRedBlackInputs(iml, disp, patch_height, patch_width);
+
+  const int rx = patch_width / 2;
+  const int ry = patch_height / 2;
+  const std::vector<cv::Rect> tasks = RedBlackTasks(iml.cols, iml.rows, rx, ry, tiles);
+
+  for (int color = 0; color < 2; ++color) {
+    TaskScheduler::Instance().ParallelFor(TaskPriority::MESHER, (int)tasks.size(), [&](int i) {
+      const cv::Rect& task = tasks.at(i);
+
+      float il[kMaxPatchPixels], gl[kMaxPatchPixels], ir[kMaxPatchPixels], gr[kMaxPatchPixels];
+
+      for (int y = task.y; y < (task.y + task.height); ++y) {
+        float* drow = disp.ptr<float>(y);
+        const float* dup = disp.ptr<float>(y - 1);
+        const float* ddown = disp.ptr<float>(y + 1);
+
+        // First pixel in this row where (x + y) % 2 == color.
+        for (int x = task.x + ((task.x + y + color) & 1); x < (task.x + task.width); x += 2) {
+          SamplePatch(iml, x, y, patch_width, patch_height, il);
+          SamplePatch(Gl, x, y, patch_width, patch_height, gl);
+
+          const float xf = (float)x;
+          float best_d = std::fmin(std::fmax(drow[x], 0), xf - rx);
+          float best_cost = PatchCost(cost, il, gl, imr, Gr, xf - best_d, y, patch_width, patch_height, ir, gr);
+
+          // All of the neighbors are the other color, so they don't change during this pass.
+          const float neighbors[4] = { drow[x - 1], drow[x + 1], dup[x], ddown[x] };
+
+          for (const float d : neighbors) {
+            if (d < 0 || d == best_d || (xf - d) < rx) {
+              continue;
+            }
+            const float c = PatchCost(cost, il, gl, imr, Gr, xf - d, y, patch_width, patch_height, ir, gr);
+            if (c < best_cost) {
+              best_cost = c;
+              best_d = d;
+            }
+          }
+
+          drow[x] = best_d;
+        }
+      }
+    }, std::max(0, params_.num_threads - 1));
+  }
+}
+
+
+template <typename CostT>
+void Patchmatch::RemoveBackgroundParallel(const Image1f& iml,
+                                          const Image1f& imr,
+                                          const Image1f& Gl,
+                                          const Image1f& Gr,
+                                          Image1f& disp,
+                                          const CostT& cost,
+                                          int patch_height,
+                                          int patch_width,
+                                          float win_by_factor,
+                                          const std::vector<cv::Rect>* tiles)
+{
+  CheckRedBlackInputs(iml, disp, patch_height, patch_width);
+
+  const int rx = patch_width / 2;
+  const int ry = patch_height / 2;
+  const std::vector<cv::Rect> tasks = RedBlackTasks(iml.cols, iml.rows, rx, ry, tiles);
+
+  // Every pixel only touches its own disparity, so the tasks are independent.
+  TaskScheduler::Instance().ParallelFor(TaskPriority::MESHER, (int)tasks.size(), [&](int i) {
+    const cv::Rect& task = tasks.at(i);
+
+    float il[kMaxPatchPixels], gl[kMaxPatchPixels], ir[kMaxPatchPixels], gr[kMaxPatchPixels];
+
+    for (int y = task.y; y < (task.y + task.height); ++y) {
+      float* drow = disp.ptr<float>(y);
+
+      for (int x = task.x; x < (task.x + task.width); ++x) {
+        SamplePatch(iml, x, y, patch_width, patch_height, il);
+        SamplePatch(Gl, x, y, patch_width, patch_height, gl);
+
+        const float xf = (float)x;
+        const float d0 = std::fmin(std::fmax(drow[x], 0), xf - rx);
+        const float cost_using_current = PatchCost(cost, il, gl, imr, Gr, xf - d0, y, patch_width, patch_height, ir, gr);
+        const float cost_no_disp = PatchCost(cost, il, gl, imr, Gr, xf, y, patch_width, patch_height, ir, gr);
+
+        if (cost_using_current > (cost_no_disp / win_by_factor)) {
+          drow[x] = 0;
+        }
+      }
+    }
+  }, std::max(0, params_.num_threads - 1));
+}
+
+
+#define PATCHMATCH_INSTANTIATE_COST(CostT) \
+  template void Patchmatch::PropagateRedBlack<CostT>( \
+      const Image1f&, const Image1f&, const Image1f&, const Image1f&, Image1f&, const CostT&, int, int, \
+      const std::vector<cv::Rect>*); \
+  template void Patchmatch::RemoveBackgroundParallel<CostT>( \
+      const Image1f&, const Image1f&, const Image1f&, const Image1f&, Image1f&, const CostT&, int, int, float, \
+      const std::vector<cv::Rect>*);
+
+PATCHMATCH_INSTANTIATE_COST(L1Cost)
+PATCHMATCH_INSTANTIATE_COST(L1GradientCost)
+
+#undef PATCHMATCH_INSTANTIATE_COST
+
+
+static void GradientMagnitude(const Image1b& im, Image1f& Dx, Image1f& Dy, Image1f& gmag)
+{
+  cv::Sobel(im, Dx, CV_32F, 1, 0, 3);
+  cv::Sobel(im, Dy, CV_32F, 0, 1, 3);
+  cv::magnitude(Dx, Dy, gmag);
+}
+
+
+Image1f Patchmatch::EstimateDisparity(const Image1b& iml,
+                                      const Image1b& imr)
+{
+  GradientMagnitude(iml, Dx_, Dy_, Gl_);
+  GradientMagnitude(imr, Dx_, Dy_, Gr_);
+
+  Image1b mask;
+  if (params_.foreground_tiles) {
+    ForegroundTextureMask(iml, mask, params_.foreground_ksize, params_.foreground_min_grad, params_.foreground_downsize);
+  }
+
+  return EstimateDisparity(iml, imr, Gl_, Gr_, mask);
+}
+
+
+Image1f Patchmatch::EstimateDisparity(const StereoImage1b& stereo_pair)
+{
+  FrameCache& cache = *stereo_pair.cache;
+
+  const std::shared_ptr<const Image1f> Gl = cache.Get<Image1f>(
+      FrameCacheKey("stereo::GradientMagnitude", "left"), [&stereo_pair](Image1f& gmag) {
+    Image1f Dx, Dy;
+    GradientMagnitude(stereo_pair.left_image, Dx, Dy, gmag);
+  });
+  const std::shared_ptr<const Image1f> Gr = cache.Get<Image1f>(
+      FrameCacheKey("stereo::GradientMagnitude", "right"), [&stereo_pair](Image1f& gmag) {
+    Image1f Dx, Dy;
+    GradientMagnitude(stereo_pair.right_image, Dx, Dy, gmag);
+  });
+
+  std::shared_ptr<const Image1b> mask = std::make_shared<Image1b>();
+  if (params_.foreground_tiles) {
+    const std::string key = FrameCacheKey("stereo::ForegroundTextureMask", "left", params_.foreground_ksize,
+                                          params_.foreground_min_grad, params_.foreground_downsize);
+    mask = cache.Get<Image1b>(key, [this, &stereo_pair](Image1b& m) {
+      ForegroundTextureMask(stereo_pair.left_image, m, params_.foreground_ksize,
+                            params_.foreground_min_grad, params_.foreground_downsize);
+    });
+  }
+
+  return EstimateDisparity(stereo_pair.left_image, stereo_pair.right_image, *Gl, *Gr, *mask);
+}
+
+
+Image1f Patchmatch::EstimateDisparity(const Image1b& iml,
+                                      const Image1b& imr,
+                                      const Image1f& Gl,
+                                      const Image1f& Gr,
+                                      const Image1b& foreground_mask)
+{
+  Image1f disp = Initialize(iml, imr, 1);
+
+  iml.convertTo(iml_f_, CV_32FC1);
+  imr.convertTo(imr_f_, CV_32FC1);
+
+  // Background tiles are never matched, so they stay at zero.
+  std::vector<cv::Rect> tiles;
+  if (params_.foreground_tiles) {
+    tiles = ForegroundTiles(foreground_mask, params_.tile_size, params_.tile_dilate);
+
+    Image1b in_tiles(iml.size(), (uchar)0);
+    for (const cv::Rect& tile : tiles) {
+      in_tiles(tile).setTo(255);
+    }
+    disp.setTo(0, in_tiles == 0);
+  }
+  const std::vector<cv::Rect>* tiles_ptr = params_.foreground_tiles ? &tiles : nullptr;
+
+  const L1GradientCost cost;
+  float noise = params_.init_noise;
+
+  for (int iter = 0; iter < params_.patchmatch_iters; ++iter) {
+    AddNoise(disp, noise, disp > 0);
+    PropagateRedBlack(iml_f_, imr_f_, Gl, Gr, disp, cost, params_.patch_size, params_.patch_size, tiles_ptr);
+    noise /= 4.0f;
+  }
+
+  RemoveBackgroundParallel(iml_f_, imr_f_, Gl, Gr, disp, cost,
+      params_.patch_size, params_.patch_size, params_.background_win_factor, tiles_ptr);
+
+  return disp;
+}
+
+
 }
 }
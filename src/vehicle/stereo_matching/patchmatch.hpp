@@ -1,9 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "core/macros.hpp"
+#include "core/task_scheduler.hpp"
 #include "params/params_base.hpp"
 #include "params/yaml_parser.hpp"
 #include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_image.hpp"
 
 #include "feature_tracking/feature_detector.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
@@ -18,6 +24,42 @@ typedef std::function<float(const Image1b&, const Image1b&)> CostFunctor;
 typedef std::function<float(const Image1b&, const Image1b&, const Image1f&, const Image1f&)> CostFunctor2;
 
 
+// Patch costs for the red-black engine (see Patchmatch::PropagateRedBlack). These are called with
+// n = patch_width * patch_height row-major pixels of the left image and gradient (il, gl), and of
+// the right image and gradient sampled at the candidate disparity (ir, gr).
+struct L1Cost final
+{
+  inline float operator()(const float* il, const float* ir, const float*, const float*, int n) const
+  {
+    float sum = 0;
+    for (int i = 0; i < n; ++i) {
+      sum += std::fabs(il[i] - ir[i]);
+    }
+    return sum / (float)n;
+  }
+};
+
+
+// https://www.microsoft.com/en-us/research/wp-content/uploads/2011/01/PatchMatchStereo_BMVC2011_6MB.pdf
+struct L1GradientCost final
+{
+  float alpha = 0.7;
+  float tau_color = 50.0;
+  float tau_grad = 20.0;
+
+  inline float operator()(const float* il, const float* ir, const float* gl, const float* gr, int n) const
+  {
+    float color = 0;
+    float grad = 0;
+    for (int i = 0; i < n; ++i) {
+      color += std::fabs(il[i] - ir[i]);
+      grad += std::fabs(gl[i] - gr[i]);
+    }
+    return alpha * std::min(color / (float)n, tau_color) + (1 - alpha) * std::min(grad / (float)n, tau_grad);
+  }
+};
+
+
 // Returns a binary mask where "1" indicates foreground and "0" indicates background.
 void ForegroundTextureMask(const Image1b& gray,
                           Image1b& mask,
@@ -26,6 +68,16 @@ void ForegroundTextureMask(const Image1b& gray,
                           int downsize = 2);
 
 
+// Splits the image into a grid of tile_size tiles, and returns the ones that have any foreground
+// in mask, plus dilate_tiles rings of tiles around them (so that patches near the edge of the
+// foreground still get matched). Tiles on the right and bottom edges can be smaller.
+std::vector<cv::Rect> ForegroundTiles(const Image1b& mask, int tile_size, int dilate_tiles = 1);
+
+
+// Merges tiles into full-width bands of rows, sorted from top to bottom and not overlapping.
+std::vector<cv::Rect> TileRowBands(const std::vector<cv::Rect>& tiles, int image_cols);
+
+
 class Patchmatch final {
  public:
   struct Params final : public ParamsBase {
@@ -34,6 +86,22 @@ class Patchmatch final {
     ft::FeatureDetector::Params detector_params;
     ft::StereoMatcher::Params matcher_params;
 
+    // Used by EstimateDisparity(), which runs the red-black engine.
+    int num_threads = 4;
+    int patchmatch_iters = 4;
+    int patch_size = 3;
+    float init_noise = 32.0;            // Foreground noise (px) before the first iteration, then / 4.
+    float background_win_factor = 1.5;  // See RemoveBackground().
+
+    // Only match the tiles with textured foreground (see ForegroundTextureMask and
+    // ForegroundTiles). The tiles are matched in parallel, and everything else is background (0).
+    bool foreground_tiles = false;
+    int tile_size = 32;
+    int tile_dilate = 1;
+    int foreground_ksize = 7;
+    double foreground_min_grad = 35.0;
+    int foreground_downsize = 2;
+
    private:
     void LoadParams(const YamlParser& p) override;
   };
@@ -45,9 +113,15 @@ class Patchmatch final {
         detector_(params.detector_params),
         matcher_(params.matcher_params) {}
 
+  // Sparse init, then patchmatch_iters of red-black propagation (with L1GradientCost), then
+  // background removal. Returns the left disparity at full resolution.
   Image1f EstimateDisparity(const Image1b& iml,
                             const Image1b& imr);
 
+  // Same as above, but the gradients and foreground mask come from the pair's FrameCache, so they're
+  // shared with anything else that uses them for this frame.
+  Image1f EstimateDisparity(const StereoImage1b& stereo_pair);
+
   Image1f Initialize(const Image1b& iml,
                      const Image1b& imr,
                      int downsample_factor);
@@ -73,11 +147,55 @@ class Patchmatch final {
                         int patch_width,
                         float win_by_factor = 2.0);
 
+  // Faster versions of Propagate() and RemoveBackground(), which take CV_32FC1 images. Pixels are
+  // updated in a red-black (checkerboard) order: each half-iteration only reads the disparity of
+  // pixels of the other color, so rows can be updated in parallel with the same result. Each pixel
+  // tries its 4 neighbors' disparities. Patches are sampled into stack buffers, so nothing is
+  // allocated, and the cost is inlined (explicitly instantiated for the costs above).
+  //
+  // If tiles are given, only the pixels inside of them are updated (one task per tile).
+  template <typename CostT>
+  void PropagateRedBlack(const Image1f& iml,
+                         const Image1f& imr,
+                         const Image1f& Gl,
+                         const Image1f& Gr,
+                         Image1f& disp,
+                         const CostT& cost,
+                         int patch_height,
+                         int patch_width,
+                         const std::vector<cv::Rect>* tiles = nullptr);
+
+  template <typename CostT>
+  void RemoveBackgroundParallel(const Image1f& iml,
+                                const Image1f& imr,
+                                const Image1f& Gl,
+                                const Image1f& Gr,
+                                Image1f& disp,
+                                const CostT& cost,
+                                int patch_height,
+                                int patch_width,
+                                float win_by_factor = 2.0,
+                                const std::vector<cv::Rect>* tiles = nullptr);
+
+  // Largest patch_height * patch_width that the red-black engine supports.
+  static constexpr int kMaxPatchPixels = 121;
+
  private:
   Params params_;
 
   ft::FeatureDetector detector_;
   ft::StereoMatcher matcher_;
+
+  // Shared by both versions of EstimateDisparity(), once they have the gradient magnitudes (Gl and
+  // Gr) and the foreground mask (only needed with foreground_tiles).
+  Image1f EstimateDisparity(const Image1b& iml,
+                            const Image1b& imr,
+                            const Image1f& Gl,
+                            const Image1f& Gr,
+                            const Image1b& foreground_mask);
+
+  // Pre-allocated inputs for EstimateDisparity().
+  Image1f iml_f_, imr_f_, Gl_, Gr_, Dx_, Dy_;
 };
 
 
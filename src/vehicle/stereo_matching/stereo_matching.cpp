@@ -1,43 +1,94 @@
+#include <memory>
+
+#include <glog/logging.h>
+
 #include "stereo_matching/stereo_matching.hpp"
 
 namespace bm {
 namespace stereo {
 
 
-// static const int kNumDisp = 64;
-// static const int kBlockSize = 3;
+void SgbmMatcher::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("num_disp", &num_disp);
+  parser.GetParam("block_size", &block_size);
+  mode = YamlToString(parser.GetNode("mode"));
+  parser.GetParam("P1", &P1);
+  parser.GetParam("P2", &P2);
+  parser.GetParam("uniqueness_ratio", &uniqueness_ratio);
+  parser.GetParam("speckle_window_size", &speckle_window_size);
+  parser.GetParam("speckle_range", &speckle_range);
+  parser.GetParam("disp12_max_diff", &disp12_max_diff);
+}
 
 
-Image1f EstimateDisparity(const Image1b& il,
-                          const Image1b& ir,
-                          int num_disp,
-                          int block_size)
+static int SgbmModeFromString(const std::string& mode)
 {
-  cv::Ptr<cv::StereoSGBM> sgbm = cv::StereoSGBM::create(0, num_disp, block_size);
+  if (mode == "SGBM") {
+    return cv::StereoSGBM::MODE_SGBM;
+  } else if (mode == "SGBM_3WAY") {
+    return cv::StereoSGBM::MODE_SGBM_3WAY;
+  } else if (mode == "HH") {
+    return cv::StereoSGBM::MODE_HH;
+  } else if (mode == "HH4") {
+    return cv::StereoSGBM::MODE_HH4;
+  }
+  LOG(FATAL) << "Unknown SGBM mode: " << mode << std::endl;
+  return cv::StereoSGBM::MODE_SGBM;
+}
 
-  const int channels = il.channels();
 
-  // sgbm->setP1(8*channels*block_size*block_size);
-  // sgbm->setP2(32*channels*block_size*block_size);
-  sgbm->setMinDisparity(0);
-  sgbm->setNumDisparities(num_disp);
-  // sgbm->setUniquenessRatio(10);
-  // sgbm->setSpeckleWindowSize(100);
-  // sgbm->setSpeckleRange(32);
-  // sgbm->setDisp12MaxDiff(1);
+SgbmMatcher::SgbmMatcher(const Params& params)
+    : params_(params)
+{
+  CHECK_EQ(0, params_.num_disp % 16) << "num_disp must be a multiple of 16" << std::endl;
+  CHECK_EQ(1, params_.block_size % 2) << "block_size must be odd" << std::endl;
+
+  sgbm_ = cv::StereoSGBM::create(0,
+                                 params_.num_disp,
+                                 params_.block_size,
+                                 params_.P1,
+                                 params_.P2,
+                                 params_.disp12_max_diff,
+                                 0,
+                                 params_.uniqueness_ratio,
+                                 params_.speckle_window_size,
+                                 params_.speckle_range,
+                                 SgbmModeFromString(params_.mode));
+}
 
-  sgbm->setMode(cv::StereoSGBM::MODE_SGBM);
 
-  cv::Mat disp;
-  sgbm->compute(il, ir, disp);
+void SgbmMatcher::Match(const Image1b& il, const Image1b& ir, Image1f& disp)
+{
+  // NOTE(milo): StereoSGBM keeps its cost buffers between calls too, as long as the size is the same.
+  sgbm_->compute(il, ir, disp16_);
 
   // https://docs.opencv.org/3.4/d2/d6e/classcv_1_1StereoMatcher.html
   // StereoSGBM outputs a 16-bit fixed-point disparity map. This is the disparity value multiplied
   // by 16, so we need to divide by 16 to get back to disparity in pixels.
-  Image1f dispf;
-  disp.convertTo(dispf, CV_32F, 1.0f / 16.0f);
+  disp16_.convertTo(disp, CV_32F, 1.0f / 16.0f);
+}
+
+
+Image1f EstimateDisparity(const Image1b& il,
+                          const Image1b& ir,
+                          int num_disp,
+                          int block_size)
+{
+  static thread_local std::unique_ptr<SgbmMatcher> matcher;
+
+  if (!matcher ||
+      matcher->GetParams().num_disp != num_disp ||
+      matcher->GetParams().block_size != block_size) {
+    SgbmMatcher::Params params;
+    params.num_disp = num_disp;
+    params.block_size = block_size;
+    matcher.reset(new SgbmMatcher(params));
+  }
 
-  return dispf;
+  Image1f disp;
+  matcher->Match(il, ir, disp);
+  return disp;
 }
 
 }
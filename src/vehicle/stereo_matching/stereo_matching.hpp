@@ -2,6 +2,9 @@
 
 #include <opencv2/calib3d.hpp>
 
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
 #include "vision_core/cv_types.hpp"
 
 namespace bm {
@@ -9,6 +12,52 @@ namespace stereo {
 
 using namespace core;
 
+
+// Dense disparity with OpenCV's semi-global block matching. The matcher and its output buffers
+// are kept between calls, so that a stream of same-size pairs doesn't reallocate them every frame.
+class SgbmMatcher final {
+ public:
+  struct Params final : public ParamsBase {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int num_disp = 64;
+    int block_size = 3;
+
+    // SGBM (5 paths), SGBM_3WAY (5 paths, faster), HH (8 paths, full-size buffers) or HH4 (4 paths).
+    std::string mode = "SGBM";
+
+    // Smoothness penalties for disparity changes of 1px and > 1px (0 means no penalty).
+    int P1 = 0;
+    int P2 = 0;
+
+    // These default to off, like cv::StereoSGBM::create().
+    int uniqueness_ratio = 0;
+    int speckle_window_size = 0;
+    int speckle_range = 0;
+    int disp12_max_diff = 0;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(SgbmMatcher);
+
+  explicit SgbmMatcher(const Params& params);
+
+  // Disparity of the left image in pixels (left images should be grayscale).
+  void Match(const Image1b& il, const Image1b& ir, Image1f& disp);
+
+  const Params& GetParams() const { return params_; }
+
+ private:
+  Params params_;
+  cv::Ptr<cv::StereoSGBM> sgbm_;
+  cv::Mat disp16_;
+};
+
+
+// Convenience version of SgbmMatcher::Match. Keeps a matcher per thread, and only makes a new
+// one when num_disp or block_size change.
 Image1f EstimateDisparity(const Image1b& il,
                           const Image1b& ir,
                           int num_disp = 64,
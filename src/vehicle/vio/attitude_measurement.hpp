@@ -28,6 +28,10 @@ struct AttitudeMeasurement final
   // IMU will measure the NEGATIVE of this vector, so flip the sign of IMU
   // measurements when constructing this measurement.
   Vector3d body_nG;
+
+  // Angular noise (rad) of body_nG, if this is an average of several samples. If zero, the smoother
+  // uses its own attitude noise model.
+  double sigma = 0.0;
 };
 
 
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <gtsam/geometry/Pose3.h>
+
+#include "vision_core/stereo_camera.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// A stereo rig besides the primary one (stereo_forward), e.g a downward facing pair. Each one gets
+// its own frontend, and the landmarks from its keyframes are added to the nearest smoother keypose.
+// Only the primary rig creates keyposes and visual odometry factors.
+struct AuxStereoRig final
+{
+  std::string name;                                         // Its node in the shared params.
+  StereoCamera stereo_rig;
+  gtsam::Pose3 body_P_cam = gtsam::Pose3::identity();       // Left camera.
+  gtsam::Pose3 body_P_right = gtsam::Pose3::identity();
+};
+
+typedef std::vector<AuxStereoRig> AuxStereoRigs;
+
+
+}
+}
@@ -0,0 +1,478 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/navigation/AttitudeFactor.h>
+#include <gtsam/navigation/CombinedImuFactor.h>
+#include <gtsam/nonlinear/DoglegOptimizer.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/sam/RangeFactor.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam_unstable/slam/PartialPosePriorFactor.h>
+
+#include "core/axis3.hpp"
+#include "core/timer.hpp"
+#include "vio/batch_smoother.hpp"
+#include "vio/mag_pose_factor.hpp"
+#include "vio/range_to_point_factor.hpp"
+
+namespace bm {
+namespace vio {
+
+static const double kSetSkewToZero = 0.0;
+static const int kTranslationStartIndex = 3;
+
+// Ranges from beacons closer than this (m) are from the same beacon.
+static const double kSameBeaconDist = 1e-3;
+
+typedef gtsam::RangeFactorWithTransform<gtsam::Pose3, gtsam::Point3> RangeFactor;
+typedef gtsam::MagPoseFactor<gtsam::Pose3> MagFactor;
+typedef gtsam::PartialPosePriorFactor<gtsam::Pose3> DepthFactor;
+
+typedef gtsam::noiseModel::Robust RobustModel;
+typedef gtsam::noiseModel::mEstimator::Cauchy mCauchy;
+
+
+// Returns the index of the beacon at world_t_beacon in beacon_points, and adds it if it isn't there.
+static uid_t BeaconId(const Vector3d& world_t_beacon, std::vector<Vector3d>& beacon_points)
+{
+  for (size_t i = 0; i < beacon_points.size(); ++i) {
+    if ((beacon_points.at(i) - world_t_beacon).norm() < kSameBeaconDist) {
+      return static_cast<uid_t>(i);
+    }
+  }
+
+  beacon_points.emplace_back(world_t_beacon);
+  return static_cast<uid_t>(beacon_points.size() - 1);
+}
+
+
+void BatchSmoother::Params::LoadParams(const YamlParser& parser)
+{
+  optimizer = YamlToEnum<Optimizer>(parser.GetNode("optimizer"));
+  parser.GetParam("max_iters", &max_iters);
+  parser.GetParam("rel_tol", &rel_tol);
+  parser.GetParam("abs_tol", &abs_tol);
+  parser.GetParam("chunk_keyposes", &chunk_keyposes);
+  parser.GetParam("chunk_overlap_keyposes", &chunk_overlap_keyposes);
+  parser.GetParam("final_full_solve", &final_full_solve);
+  parser.GetParam("num_threads", &num_threads);
+
+  CHECK_GE(chunk_keyposes, 0);
+  CHECK(chunk_keyposes == 0 || (chunk_overlap_keyposes >= 1 && chunk_overlap_keyposes < chunk_keyposes))
+      << "Chunks need to overlap by at least one keypose (and less than a whole chunk)" << std::endl;
+  CHECK_GE(num_threads, 0);
+}
+
+
+BatchSmoother::BatchSmoother(const Params& params)
+    : params_(params)
+{
+#ifdef BM_SMOOTHER_USE_TBB
+  arena_.reset((params_.num_threads > 0) ? new tbb::task_arena(params_.num_threads) : new tbb::task_arena());
+  LOG(INFO) << "BatchSmoother using " << arena_->max_concurrency() << " TBB threads" << std::endl;
+#else
+  LOG_IF(WARNING, params_.num_threads != 0) << "BatchSmoother num_threads is ignored (build with BM_SMOOTHER_USE_TBB)" << std::endl;
+#endif
+}
+
+
+void BatchSmoother::RunWithSolverThreads(const std::function<void()>& fn)
+{
+#ifdef BM_SMOOTHER_USE_TBB
+  arena_->execute(fn);
+#else
+  fn();
+#endif
+}
+
+
+void BatchSmoother::Build(const SmootherLog& log)
+{
+  CHECK(log.initialized) << "Smoother log doesn't have an initialization" << std::endl;
+
+  const FixedLagSmoother::Params& sp = params_.smoother_params;
+
+  keypose_ids_.clear();
+  keypose_times_.clear();
+  graph_ = gtsam::NonlinearFactorGraph();
+  values_.clear();
+  stats_ = Stats();
+
+  const gtsam::Cal3_S2Stereo::shared_ptr cal3_stereo(new gtsam::Cal3_S2Stereo(
+      sp.stereo_rig.fx(),
+      sp.stereo_rig.fy(),
+      kSetSkewToZero,
+      sp.stereo_rig.cx(),
+      sp.stereo_rig.cy(),
+      sp.stereo_rig.Baseline()));
+
+  gtsam::SmartStereoProjectionParams lmk_stereo_factor_params(gtsam::JACOBIAN_SVD, gtsam::ZERO_ON_DEGENERACY);
+  lmk_stereo_factor_params.setRetriangulationThreshold(sp.lmk_retriangulation_threshold);
+
+  Vector3d n_gravity_unit;
+  const Axis3 depth_axis = GetGravityAxis(sp.n_gravity, n_gravity_unit);
+  const double depth_sign = n_gravity_unit(depth_axis) >= 0 ? 1.0 : -1.0;
+
+  // Nominal position of each beacon, by id (with estimate_beacons).
+  std::vector<Vector3d> beacon_points;
+
+  // NOTE(milo): Each window is preintegrated from scratch, with the bias that the online smoother
+  // had at the start of it (like the StateEstimator does).
+  ImuManager::Params imu_manager_params = params_.imu_manager_params;
+  imu_manager_params.incremental = false;
+  ImuManager imu_manager(imu_manager_params, "batch_smoother_imu_manager");
+  size_t next_imu = 0;
+
+  //====================================== FIRST KEYPOSE ===========================================
+  const uid_t id0 = 0;
+  keypose_ids_.emplace_back(id0);
+  keypose_times_.emplace_back(log.t0);
+
+  graph_.addPrior<gtsam::Pose3>(gtsam::Symbol('X', id0), log.world_P_body0, sp.pose_prior_noise_model);
+  values_.insert(gtsam::Symbol('X', id0), log.world_P_body0);
+
+  if (log.imu_available) {
+    values_.insert(gtsam::Symbol('V', id0), log.world_v_body0);
+    values_.insert(gtsam::Symbol('B', id0), log.imu_bias0);
+    graph_.addPrior(gtsam::Symbol('V', id0), kZeroVelocity, sp.velocity_noise_model);
+    graph_.addPrior(gtsam::Symbol('B', id0), kZeroImuBias, sp.bias_prior_noise_model);
+  }
+
+  uid_t last_keypose_id = id0;
+  seconds_t last_keypose_time = log.t0;
+  bool last_has_imu_state = log.imu_available;
+  ImuBias last_imu_bias = log.imu_bias0;
+
+  // All observations of each landmark, oldest first. Ordered so that the graph is deterministic.
+  std::map<uid_t, std::vector<std::pair<uid_t, gtsam::StereoPoint2>>> lmk_tracks;
+
+  for (const SmootherLogKeypose& keypose : log.keyposes) {
+    CHECK_GT(keypose.keypose_id, last_keypose_id) << "Keyposes in the smoother log are out of order" << std::endl;
+
+    const gtsam::Symbol keypose_sym('X', keypose.keypose_id);
+    const gtsam::Symbol vel_sym('V', keypose.keypose_id);
+    const gtsam::Symbol bias_sym('B', keypose.keypose_id);
+    const gtsam::Symbol last_keypose_sym('X', last_keypose_id);
+    const gtsam::Symbol last_vel_sym('V', last_keypose_id);
+    const gtsam::Symbol last_bias_sym('B', last_keypose_id);
+
+    keypose_ids_.emplace_back(keypose.keypose_id);
+    keypose_times_.emplace_back(keypose.timestamp);
+    values_.insert(keypose_sym, keypose.world_P_body);
+
+    bool has_btw_factor = false;
+
+    //==================================== VISUAL ODOMETRY =========================================
+    if (keypose.vo) {
+      const VoResult& odom_result = *keypose.vo;
+      const bool odom_aligned = std::fabs(last_keypose_time - ConvertToSeconds(odom_result.timestamp_lkf)) < 0.01;
+
+      if (odom_aligned) {
+        const gtsam::Pose3 body_P_odom = sp.body_P_cam * gtsam::Pose3(odom_result.lkf_T_cam) * sp.body_P_cam.inverse();
+        const RobustModel::shared_ptr model = RobustModel::Create(mCauchy::Create(1.0), sp.frontend_vo_noise_model);
+        graph_.push_back(gtsam::BetweenFactor<gtsam::Pose3>(last_keypose_sym, keypose_sym, body_P_odom, model));
+        has_btw_factor = true;
+      }
+
+      if (sp.use_smart_stereo_factors) {
+        const LandmarkObservationBatch& lmk_obs = odom_result.lmk_obs;
+        for (size_t i = 0; i < lmk_obs.Size(); ++i) {
+          const float disp = lmk_obs.disparity[i];
+          if (disp < 0) {
+            continue;
+          }
+          const cv::Point2f& pt = lmk_obs.pixel_location[i];
+          lmk_tracks[lmk_obs.landmark_id[i]].emplace_back(keypose.keypose_id, gtsam::StereoPoint2(
+              pt.x, pt.x - disp, pt.y));
+        }
+      }
+    }
+
+    //================================= IMU PREINTEGRATION FACTOR ==================================
+    // Give the IMU manager everything up to (a bit past) this keypose, like it had online.
+    const seconds_t imu_until = keypose.timestamp + params_.allowed_misalignment_imu;
+    while (next_imu < log.imu.size() && ConvertToSeconds(log.imu.at(next_imu).timestamp) <= imu_until) {
+      imu_manager.Push(log.imu.at(next_imu++));
+    }
+
+    if (keypose.has_pim) {
+      imu_manager.ResetAndUpdateBias(last_imu_bias);
+      const PimResult pim_result = imu_manager.Preintegrate(
+          keypose.pim_from_time, keypose.timestamp, params_.allowed_misalignment_imu);
+
+      if (!pim_result.timestamps_aligned) {
+        LOG(WARNING) << "Could not preintegrate IMU again for keypose " << keypose.keypose_id << ", skipping it" << std::endl;
+      } else {
+        values_.insert(vel_sym, keypose.world_v_body);
+        values_.insert(bias_sym, keypose.imu_bias);
+
+        if (!last_has_imu_state) {
+          values_.insert(last_vel_sym, kZeroVelocity);
+          values_.insert(last_bias_sym, kZeroImuBias);
+          graph_.addPrior(last_vel_sym, kZeroVelocity, sp.velocity_noise_model);
+          graph_.addPrior(last_bias_sym, kZeroImuBias, sp.bias_drift_noise_model);
+        }
+
+        graph_.push_back(gtsam::CombinedImuFactor(
+            last_keypose_sym, last_vel_sym, keypose_sym, vel_sym, last_bias_sym, bias_sym, pim_result.pim));
+        graph_.push_back(gtsam::BetweenFactor<ImuBias>(
+            last_bias_sym, bias_sym, kZeroImuBias, sp.bias_drift_noise_model));
+
+        ++stats_.num_imu_factors;
+        has_btw_factor = true;
+      }
+    }
+
+    //===================================== ATTITUDE FACTOR ========================================
+    if (sp.use_attitude_factor && keypose.attitude) {
+      const gtsam::SharedNoiseModel model = (keypose.attitude->sigma > 0) ?
+          IsoModel::Sigma(2, keypose.attitude->sigma) : sp.attitude_noise_model;
+      graph_.push_back(gtsam::Pose3AttitudeFactor(
+          keypose_sym,
+          gtsam::Unit3(sp.n_gravity.normalized()),
+          model,
+          gtsam::Unit3(keypose.attitude->body_nG.normalized())));
+    }
+
+    //======================================= DEPTH FACTOR =========================================
+    if (keypose.depth) {
+      graph_.push_back(DepthFactor(
+          keypose_sym,
+          kTranslationStartIndex + depth_axis,
+          depth_sign * keypose.depth->depth,
+          sp.depth_sensor_noise_model));
+    }
+
+    //======================================= RANGE FACTOR =========================================
+    // Same as the FixedLagSmoother: unary factors, or one variable per beacon if they're estimated.
+    for (const RangeMeasurement& range_meas : keypose.ranges) {
+      if (!sp.estimate_beacons) {
+        graph_.push_back(gtsam::RangeToPointFactor(
+            keypose_sym, range_meas.point, range_meas.range, sp.range_noise_model, sp.body_P_receiver));
+        continue;
+      }
+
+      const gtsam::Symbol beacon_sym('R', BeaconId(range_meas.point, beacon_points));
+      if (!values_.exists(beacon_sym)) {
+        values_.insert(beacon_sym, range_meas.point);
+        graph_.addPrior(beacon_sym, range_meas.point, sp.beacon_noise_model);
+      }
+      graph_.push_back(RangeFactor(
+          keypose_sym, beacon_sym, range_meas.range, sp.range_noise_model, sp.body_P_receiver));
+    }
+
+    //================================== MAGNETOMETER FACTOR =======================================
+    if (keypose.mag) {
+      const gtsam::SharedNoiseModel model = keypose.mag->cov.isZero() ?
+          gtsam::SharedNoiseModel(sp.mag_noise_model) : gtsam::noiseModel::Gaussian::Covariance(keypose.mag->cov);
+      graph_.push_back(MagFactor(
+          keypose_sym,
+          keypose.mag->field,
+          sp.mag_scale_factor,
+          sp.mag_local_field,
+          sp.mag_sensor_bias,
+          model,
+          sp.body_P_mag));
+    }
+
+    //=============================== FACTOR GRAPH SAFETY CHECK ====================================
+    // Same no-motion fallback as the online smoother.
+    if (!has_btw_factor) {
+      const RobustModel::shared_ptr model = RobustModel::Create(
+          mCauchy::Create(1.0),
+          DiagModel::Sigmas((gtsam::Vector6() << 0.5, 0.5, 0.5, 5.0, 5.0, 5.0).finished()));
+      graph_.push_back(gtsam::BetweenFactor<gtsam::Pose3>(
+          last_keypose_sym, keypose_sym, gtsam::Pose3::identity(), model));
+    }
+
+    last_keypose_id = keypose.keypose_id;
+    last_keypose_time = keypose.timestamp;
+    last_has_imu_state = values_.exists(vel_sym);
+    last_imu_bias = keypose.imu_bias;
+  }
+
+  //=================================== STEREO SMART FACTORS =======================================
+  for (const auto& item : lmk_tracks) {
+    if ((int)item.second.size() < sp.lmk_min_track_length) {
+      continue;
+    }
+
+    SmartStereoFactor::shared_ptr factor(new SmartStereoFactor(
+        sp.lmk_stereo_factor_noise_model, lmk_stereo_factor_params, sp.body_P_cam));
+    for (const auto& obs : item.second) {
+      factor->add(obs.second, gtsam::Symbol('X', obs.first), cal3_stereo);
+    }
+    graph_.push_back(factor);
+    ++stats_.num_lmk_factors;
+  }
+
+  stats_.num_keyposes = static_cast<int>(keypose_ids_.size());
+  stats_.num_factors = static_cast<int>(graph_.size());
+
+  LOG(INFO) << "Built batch graph with " << stats_.num_keyposes << " keyposes, " << stats_.num_factors
+            << " factors (" << stats_.num_lmk_factors << " landmarks, " << stats_.num_imu_factors << " IMU)" << std::endl;
+}
+
+
+int BatchSmoother::Optimize(const gtsam::NonlinearFactorGraph& graph, gtsam::Values& values)
+{
+  int iterations = 0;
+
+  RunWithSolverThreads([&]() {
+    if (params_.optimizer == Optimizer::DOGLEG) {
+      gtsam::DoglegParams opt_params;
+      opt_params.maxIterations = params_.max_iters;
+      opt_params.relativeErrorTol = params_.rel_tol;
+      opt_params.absoluteErrorTol = params_.abs_tol;
+      gtsam::DoglegOptimizer optimizer(graph, values, opt_params);
+      values = optimizer.optimize();
+      iterations = static_cast<int>(optimizer.iterations());
+    } else {
+      gtsam::LevenbergMarquardtParams opt_params;
+      opt_params.maxIterations = params_.max_iters;
+      opt_params.relativeErrorTol = params_.rel_tol;
+      opt_params.absoluteErrorTol = params_.abs_tol;
+      gtsam::LevenbergMarquardtOptimizer optimizer(graph, values, opt_params);
+      values = optimizer.optimize();
+      iterations = static_cast<int>(optimizer.iterations());
+    }
+  });
+
+  return iterations;
+}
+
+
+void BatchSmoother::SolveChunks()
+{
+  const FixedLagSmoother::Params& sp = params_.smoother_params;
+  const size_t num_keyposes = keypose_ids_.size();
+  const size_t chunk = static_cast<size_t>(params_.chunk_keyposes);
+  const size_t overlap = static_cast<size_t>(params_.chunk_overlap_keyposes);
+  const gtsam::Values online = values_;
+
+  // The oldest and newest keypose (index into keypose_ids_) that each factor involves.
+  std::map<uid_t, size_t> keypose_index;
+  for (size_t i = 0; i < num_keyposes; ++i) {
+    keypose_index[keypose_ids_.at(i)] = i;
+  }
+
+  std::vector<std::pair<size_t, size_t>> factor_span(graph_.size());
+  for (size_t f = 0; f < graph_.size(); ++f) {
+    size_t lo = num_keyposes, hi = 0;
+    for (const gtsam::Key key : graph_.at(f)->keys()) {
+      // Beacon variables aren't tied to a keypose, so they're in every chunk that ranges them.
+      if (gtsam::Symbol(key).chr() == 'R') {
+        continue;
+      }
+      const size_t i = keypose_index.at(gtsam::Symbol(key).index());
+      lo = std::min(lo, i);
+      hi = std::max(hi, i);
+    }
+    factor_span.at(f) = std::make_pair(lo, hi);
+  }
+
+  for (size_t start = 0; start < num_keyposes; start += chunk) {
+    const size_t first = (start >= overlap) ? (start - overlap) : 0;
+    const size_t end = std::min(start + chunk, num_keyposes);
+
+    gtsam::NonlinearFactorGraph chunk_graph;
+    for (size_t f = 0; f < graph_.size(); ++f) {
+      if (factor_span.at(f).first >= first && factor_span.at(f).second < end) {
+        chunk_graph.push_back(graph_.at(f));
+      }
+    }
+
+    gtsam::Values chunk_values;
+    for (const gtsam::Key key : chunk_graph.keys()) {
+      chunk_values.insert(key, values_.at(key));
+    }
+
+    // Hold the start of the chunk where the last chunk put it.
+    if (first > 0) {
+      const uid_t anchor_id = keypose_ids_.at(first);
+      const gtsam::Symbol anchor_sym('X', anchor_id);
+      chunk_graph.addPrior(anchor_sym, values_.at<gtsam::Pose3>(anchor_sym), sp.pose_prior_noise_model);
+      if (chunk_values.exists(gtsam::Symbol('V', anchor_id))) {
+        const gtsam::Symbol vel_sym('V', anchor_id);
+        const gtsam::Symbol bias_sym('B', anchor_id);
+        chunk_graph.addPrior(vel_sym, values_.at<gtsam::Vector3>(vel_sym), sp.velocity_noise_model);
+        chunk_graph.addPrior(bias_sym, values_.at<ImuBias>(bias_sym), sp.bias_prior_noise_model);
+      }
+    }
+
+    // The online estimate for this chunk drifted along with the keyposes before it, so move it by
+    // however much the last chunk moved the keypose before this one.
+    if (start > 0) {
+      const gtsam::Symbol prev_sym('X', keypose_ids_.at(start - 1));
+      const gtsam::Pose3 correction = values_.at<gtsam::Pose3>(prev_sym) * online.at<gtsam::Pose3>(prev_sym).inverse();
+
+      for (size_t i = start; i < end; ++i) {
+        const gtsam::Symbol keypose_sym('X', keypose_ids_.at(i));
+        const gtsam::Symbol vel_sym('V', keypose_ids_.at(i));
+        if (chunk_values.exists(keypose_sym)) {
+          chunk_values.update(keypose_sym, correction * online.at<gtsam::Pose3>(keypose_sym));
+        }
+        if (chunk_values.exists(vel_sym)) {
+          chunk_values.update(vel_sym, gtsam::Vector3(correction.rotation() * online.at<gtsam::Vector3>(vel_sym)));
+        }
+      }
+    }
+
+    stats_.iterations = Optimize(chunk_graph, chunk_values);
+    values_.update(chunk_values);
+    ++stats_.num_chunks;
+
+    LOG(INFO) << "Solved chunk " << stats_.num_chunks << " (keyposes " << first << " to " << end - 1 << ", "
+              << chunk_graph.size() << " factors, " << stats_.iterations << " iters)" << std::endl;
+  }
+}
+
+
+std::vector<SmootherResult> BatchSmoother::Solve()
+{
+  CHECK(!keypose_ids_.empty()) << "Call Build() before Solve()" << std::endl;
+
+  Timer timer(true);
+  stats_.initial_error = graph_.error(values_);
+
+  if (params_.chunk_keyposes > 0) {
+    SolveChunks();
+  }
+
+  if (params_.chunk_keyposes == 0 || params_.final_full_solve) {
+    stats_.iterations = Optimize(graph_, values_);
+  }
+
+  stats_.final_error = graph_.error(values_);
+  stats_.solve_ms = timer.Elapsed().milliseconds();
+
+  LOG(INFO) << "Batch solve took " << stats_.solve_ms << " ms, error " << stats_.initial_error
+            << " ==> " << stats_.final_error << std::endl;
+
+  std::vector<SmootherResult> out;
+  for (size_t i = 0; i < keypose_ids_.size(); ++i) {
+    const uid_t id = keypose_ids_.at(i);
+    const gtsam::Symbol vel_sym('V', id);
+    const gtsam::Symbol bias_sym('B', id);
+    const bool has_imu_state = values_.exists(vel_sym);
+
+    out.emplace_back(
+        id,
+        keypose_times_.at(i),
+        values_.at<gtsam::Pose3>(gtsam::Symbol('X', id)),
+        has_imu_state,
+        has_imu_state ? values_.at<gtsam::Vector3>(vel_sym) : kZeroVelocity,
+        has_imu_state ? values_.at<ImuBias>(bias_sym) : kZeroImuBias,
+        Matrix6d::Zero(),
+        Matrix3d::Zero(),
+        Matrix6d::Zero());
+  }
+
+  return out;
+}
+
+
+}
+}
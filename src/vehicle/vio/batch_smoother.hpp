@@ -0,0 +1,116 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "vio/fixed_lag_smoother.hpp"
+#include "vio/imu_manager.hpp"
+#include "vio/smoother_log.hpp"
+#include "vio/smoother_result.hpp"
+
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Re-solves a whole dive from a smoother log (see SmootherLogWriter) as one batch problem, e.g for
+// post-dive reprocessing. The graph has the same factors as the FixedLagSmoother, except that
+// nothing is ever marginalized, and each landmark gets one smart factor with its whole track.
+class BatchSmoother final {
+ public:
+  enum class Optimizer { LEVENBERG_MARQUARDT = 0, DOGLEG = 1 };
+
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    // Noise models, extrinsics, and calibration are shared with the online smoother, and the IMU is
+    // preintegrated again with the same noise model. These aren't loaded from YAML, so that they can
+    // come from the StateEstimator::Params that made the log.
+    FixedLagSmoother::Params smoother_params;
+    ImuManager::Params imu_manager_params;
+    double allowed_misalignment_imu = 0.05;
+
+    Optimizer optimizer = Optimizer::LEVENBERG_MARQUARDT;
+    int max_iters = 100;
+    double rel_tol = 1e-5;
+    double abs_tol = 1e-5;
+
+    // If > 0, the dive is first solved in chunks of this many keyposes. Each chunk starts from the
+    // previous one's result (shifted onto the online estimate), and re-solves the last
+    // chunk_overlap_keyposes keyposes of the chunk before it. Factors that span more than the
+    // overlap are only used by the full solve.
+    int chunk_keyposes = 0;
+    int chunk_overlap_keyposes = 10;
+    bool final_full_solve = true;   // Always done if chunk_keyposes is zero.
+
+    // Threads for linearization and elimination (zero = all CPUs). Only used in a build with
+    // BM_SMOOTHER_USE_TBB.
+    int num_threads = 0;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  struct Stats final
+  {
+    int num_keyposes = 0;
+    int num_factors = 0;
+    int num_lmk_factors = 0;
+    int num_imu_factors = 0;
+    int num_chunks = 0;
+    int iterations = 0;             // In the full solve (or the last chunk, if there wasn't one).
+    double initial_error = 0;       // Of the full graph, with the online estimate.
+    double final_error = 0;
+    double solve_ms = 0;            // Everything, including the chunks.
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(BatchSmoother)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(BatchSmoother)
+
+  explicit BatchSmoother(const Params& params);
+
+  // Builds the graph (and initial values) for everything in the log, replacing anything from before.
+  void Build(const SmootherLog& log);
+
+  // Optimizes the graph, and returns the state at every keypose (without covariance).
+  std::vector<SmootherResult> Solve();
+
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  // Runs fn on the solver's num_threads threads.
+  void RunWithSolverThreads(const std::function<void()>& fn);
+
+  // Optimizes graph in place, starting from values. Returns the number of iterations.
+  int Optimize(const gtsam::NonlinearFactorGraph& graph, gtsam::Values& values);
+
+  // Solves in overlapping chunks of keyposes, updating values_.
+  void SolveChunks();
+
+ private:
+  Params params_;
+
+  std::vector<uid_t> keypose_ids_;
+  std::vector<seconds_t> keypose_times_;
+  gtsam::NonlinearFactorGraph graph_;
+  gtsam::Values values_;
+  Stats stats_;
+
+#ifdef BM_SMOOTHER_USE_TBB
+  std::unique_ptr<tbb::task_arena> arena_;
+#endif
+};
+
+
+}
+}
@@ -71,6 +71,35 @@ Points3 GetEllipsoidPoints(const Vector3d& scales_xyz,
 }
 
 
+Matrix3d EllipsoidTransformInWorld(const EllipsoidParameters& params)
+{
+  return EllipsoidRotationInWorld(params) * params.scales.asDiagonal();
+}
+
+
+CachedCovarianceEllipsoid::CachedCovarianceEllipsoid(double d, double rel_change_threshold)
+    : d_(d),
+      rel_change_threshold_(rel_change_threshold)
+{
+  CHECK_GT(d, 0) << "Must use a positive number of standard deviations" << std::endl;
+  CHECK_GE(rel_change_threshold, 0);
+}
+
+
+bool CachedCovarianceEllipsoid::Update(const Matrix3d& C)
+{
+  if (valid_ && (C - C_).norm() <= rel_change_threshold_ * C_.norm()) {
+    return false;
+  }
+
+  C_ = C;
+  world_A_sphere_ = EllipsoidTransformInWorld(ComputeCovarianceEllipsoid(C, d_));
+  valid_ = true;
+
+  return true;
+}
+
+
 CvPoints3 ToCvPoints3d(const Points3& points)
 {
   CvPoints3 out(points.size());
@@ -66,6 +66,38 @@ Points3 GetEllipsoidPoints(const Vector3d& scales_xyz,
                            const PrecomputedSpherePoints& sphere_points);
 
 
+// Returns the linear transform that maps the unit sphere onto the ellipsoid (centered at zero):
+// point_in_world = world_A_sphere * point_on_sphere, where world_A_sphere = world_R_ellipsoid * diag(scales).
+// Rendering the unit sphere with this transform avoids recomputing any points.
+Matrix3d EllipsoidTransformInWorld(const EllipsoidParameters& params);
+
+
+// Caches the unit sphere -> ellipsoid transform for a covariance matrix, and only redoes the
+// eigendecomposition when the covariance has changed enough to notice.
+class CachedCovarianceEllipsoid final {
+ public:
+  // The ellipsoid is at "d" standard deviations. It's recomputed when the covariance changes by more
+  // than rel_change_threshold (Frobenius norm of the change, relative to the cached covariance).
+  CachedCovarianceEllipsoid(double d, double rel_change_threshold);
+
+  // Returns true if the transform was recomputed.
+  bool Update(const Matrix3d& C);
+
+  // Has Update() been called yet?
+  bool Valid() const { return valid_; }
+
+  const Matrix3d& Transform() const { return world_A_sphere_; }
+
+ private:
+  double d_;
+  double rel_change_threshold_;
+
+  bool valid_ = false;
+  Matrix3d C_ = Matrix3d::Zero();
+  Matrix3d world_A_sphere_ = Matrix3d::Identity();
+};
+
+
 // Convert a vector of Vector3d's to cv::Point3d's.
 CvPoints3 ToCvPoints3d(const Points3& points);
 
@@ -0,0 +1,190 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include <glog/logging.h>
+
+#include "vio/estimator_checkpoint.hpp"
+
+namespace bm {
+namespace vio {
+
+// NOTE(milo): Like the smoother log, numbers are stored in host byte order, and matrices are column
+// major (Eigen's default).
+static const char kCheckpointMagic[8] = { 'B', 'M', 'C', 'K', 'P', 'T', '\0', '\0' };
+static const uint32_t kCheckpointVersion = 1;
+
+static const uint32_t kHasImuState = 1 << 0;
+static const uint32_t kHasFilterState = 1 << 1;
+
+
+struct PackedCheckpoint final
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  double saved_unix_sec;
+
+  // Smoother result: rotation as a quaternion (w, x, y, z), then translation, velocity, and IMU
+  // bias (accelerometer, gyroscope).
+  uint64_t keypose_id;
+  double smoother_timestamp;
+  double q[4];
+  double t[3];
+  double v[3];
+  double bias[6];
+  double cov_pose[36];
+  double cov_vel[9];
+  double cov_bias[36];
+
+  // Filter state.
+  double filter_timestamp;
+  double filter_t[3];
+  double filter_v[3];
+  double filter_a[3];
+  double filter_q[4];
+  double filter_w[3];
+  double filter_S[225];
+};
+
+static_assert(std::is_pod<PackedCheckpoint>::value && sizeof(PackedCheckpoint) % 8 == 0, "PackedCheckpoint");
+
+
+template <typename MatrixType>
+static void PackMatrix(const MatrixType& m, double* out)
+{
+  Eigen::Map<MatrixType>(out) = m;
+}
+
+
+template <typename MatrixType>
+static void UnpackMatrix(const double* in, MatrixType& m)
+{
+  m = Eigen::Map<const MatrixType>(in);
+}
+
+
+bool WriteEstimatorCheckpoint(const std::string& path, const EstimatorCheckpoint& checkpoint)
+{
+  const SmootherResult& r = checkpoint.smoother_result;
+  const State& s = checkpoint.filter_state.state;
+
+  PackedCheckpoint p = {};
+  std::memcpy(p.magic, kCheckpointMagic, sizeof(kCheckpointMagic));
+  p.version = kCheckpointVersion;
+  p.flags = (r.has_imu_state ? kHasImuState : 0) | (checkpoint.has_filter_state ? kHasFilterState : 0);
+  p.saved_unix_sec = checkpoint.saved_unix_sec;
+
+  const gtsam::Quaternion q = r.world_P_body.rotation().toQuaternion();
+  p.keypose_id = r.keypose_id;
+  p.smoother_timestamp = r.timestamp;
+  p.q[0] = q.w();
+  p.q[1] = q.x();
+  p.q[2] = q.y();
+  p.q[3] = q.z();
+  PackMatrix(Vector3d(r.world_P_body.translation()), p.t);
+  PackMatrix(Vector3d(r.world_v_body), p.v);
+  PackMatrix(Vector6d(r.imu_bias.vector()), p.bias);
+  PackMatrix(r.cov_pose, p.cov_pose);
+  PackMatrix(r.cov_vel, p.cov_vel);
+  PackMatrix(r.cov_bias, p.cov_bias);
+
+  if (checkpoint.has_filter_state) {
+    const Quaterniond qf = s.q.normalized();
+    p.filter_timestamp = checkpoint.filter_state.timestamp;
+    PackMatrix(s.t, p.filter_t);
+    PackMatrix(s.v, p.filter_v);
+    PackMatrix(s.a, p.filter_a);
+    p.filter_q[0] = qf.w();
+    p.filter_q[1] = qf.x();
+    p.filter_q[2] = qf.y();
+    p.filter_q[3] = qf.z();
+    PackMatrix(s.w, p.filter_w);
+    PackMatrix(s.S, p.filter_S);
+  }
+
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out.is_open()) {
+      LOG(WARNING) << "Could not open checkpoint file: " << tmp_path << std::endl;
+      return false;
+    }
+    out.write(reinterpret_cast<const char*>(&p), sizeof(PackedCheckpoint));
+    out.flush();
+    if (!out.good()) {
+      LOG(WARNING) << "Could not write checkpoint file: " << tmp_path << std::endl;
+      return false;
+    }
+  }
+
+  // NOTE(milo): rename() replaces the old checkpoint atomically (on the same filesystem).
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Could not move checkpoint into place: " << path << std::endl;
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+
+bool ReadEstimatorCheckpoint(const std::string& path, EstimatorCheckpoint& checkpoint)
+{
+  std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+
+  PackedCheckpoint p;
+  in.read(reinterpret_cast<char*>(&p), sizeof(PackedCheckpoint));
+  if (in.gcount() != (std::streamsize)sizeof(PackedCheckpoint) || in.peek() != std::ifstream::traits_type::eof()) {
+    LOG(WARNING) << "Checkpoint has the wrong size: " << path << std::endl;
+    return false;
+  }
+  if (std::memcmp(p.magic, kCheckpointMagic, sizeof(kCheckpointMagic)) != 0 || p.version != kCheckpointVersion) {
+    LOG(WARNING) << "Not a checkpoint (or an old version): " << path << std::endl;
+    return false;
+  }
+
+  checkpoint = EstimatorCheckpoint();
+  checkpoint.saved_unix_sec = p.saved_unix_sec;
+
+  SmootherResult& r = checkpoint.smoother_result;
+  Vector3d t, v;
+  Vector6d bias;
+  UnpackMatrix(p.t, t);
+  UnpackMatrix(p.v, v);
+  UnpackMatrix(p.bias, bias);
+
+  r.keypose_id = p.keypose_id;
+  r.cov_keypose_id = p.keypose_id;
+  r.timestamp = p.smoother_timestamp;
+  r.world_P_body = gtsam::Pose3(gtsam::Rot3::Quaternion(p.q[0], p.q[1], p.q[2], p.q[3]), t);
+  r.has_imu_state = (p.flags & kHasImuState) != 0;
+  r.world_v_body = v;
+  r.imu_bias = ImuBias(bias.head<3>(), bias.tail<3>());
+  UnpackMatrix(p.cov_pose, r.cov_pose);
+  UnpackMatrix(p.cov_vel, r.cov_vel);
+  UnpackMatrix(p.cov_bias, r.cov_bias);
+
+  checkpoint.has_filter_state = (p.flags & kHasFilterState) != 0;
+  if (checkpoint.has_filter_state) {
+    State& s = checkpoint.filter_state.state;
+    checkpoint.filter_state.timestamp = p.filter_timestamp;
+    UnpackMatrix(p.filter_t, s.t);
+    UnpackMatrix(p.filter_v, s.v);
+    UnpackMatrix(p.filter_a, s.a);
+    s.q = Quaterniond(p.filter_q[0], p.filter_q[1], p.filter_q[2], p.filter_q[3]);
+    UnpackMatrix(p.filter_w, s.w);
+    UnpackMatrix(p.filter_S, s.S);
+  }
+
+  return true;
+}
+
+
+}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+
+#include "core/eigen_types.hpp"
+#include "vio/smoother_result.hpp"
+#include "vio/state_ekf.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// What a StateEstimator needs to warm restart (e.g after the process crashed): the smoother's newest
+// keypose with its marginal covariances, and the newest filter state. On restart, these become
+// tight priors for the first keypose and the initial filter state, instead of the loose defaults
+// that take a long time to converge.
+//
+// NOTE(milo): The smoother's factor graph and the feature tracks aren't saved. Smart factors don't
+// have a stable binary form, and tracks are useless once a few frames have been missed. The
+// marginals of the newest keypose summarize everything the old window knew about it.
+struct EstimatorCheckpoint final
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  double saved_unix_sec = 0;      // Wall clock time when it was saved, to tell how stale it is.
+
+  SmootherResult smoother_result;
+
+  bool has_filter_state = false;
+  StateStamped filter_state;
+};
+
+
+// Writes a checkpoint to a temporary file next to path, then renames it over path. That way a
+// crash while writing never leaves a truncated checkpoint behind. Returns false if the file
+// couldn't be written.
+bool WriteEstimatorCheckpoint(const std::string& path, const EstimatorCheckpoint& checkpoint);
+
+// Returns false if the file doesn't exist or isn't a valid checkpoint (wrong magic, version, or size).
+bool ReadEstimatorCheckpoint(const std::string& path, EstimatorCheckpoint& checkpoint);
+
+
+}
+}
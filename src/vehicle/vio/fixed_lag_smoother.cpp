@@ -1,22 +1,39 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <unordered_set>
+
+#include <gtsam/config.h>
 #include <gtsam/navigation/NavState.h>
 #include <gtsam/navigation/AttitudeFactor.h>
 #include <gtsam/inference/Symbol.h>
 #include <gtsam/nonlinear/Values.h>
 #include <gtsam/sam/RangeFactor.h>
-#include <gtsam_unstable/slam/MagPoseFactor.h>
 #include <gtsam_unstable/slam/PartialPosePriorFactor.h>
 
 #include "core/transform_util.hpp"
+#include "core/profiler.hpp"
+#include "core/timer.hpp"
 #include "vio/fixed_lag_smoother.hpp"
+#include "vio/mag_pose_factor.hpp"
+#include "vio/landmark_budget.hpp"
+#include "vio/range_to_point_factor.hpp"
 #include "vio/vo_result.hpp"
 // #include "vio/single_axis_factor.hpp"
 
+#if defined(BM_SMOOTHER_USE_TBB) && !defined(GTSAM_USE_TBB)
+#error "BM_SMOOTHER_USE_TBB needs a GTSAM that was built with TBB (GTSAM_WITH_TBB=ON)"
+#endif
+
 namespace bm {
 namespace vio {
 
 static const double kSetSkewToZero = 0.0;
 static const int kTranslationStartIndex = 3;
 
+// Ranges from beacons closer than this (m) are from the same beacon (see BeaconId()).
+static const double kSameBeaconDist = 1e-3;
+
 typedef gtsam::RangeFactorWithTransform<gtsam::Pose3, gtsam::Point3> RangeFactor;
 typedef gtsam::MagPoseFactor<gtsam::Pose3> MagFactor;
 typedef gtsam::PartialPosePriorFactor<gtsam::Pose3> DepthFactor;
@@ -31,8 +48,36 @@ typedef gtsam::IncrementalFixedLagSmoother::KeyTimestampMap KeyTimestampMap;
 void FixedLagSmoother::Params::LoadParams(const YamlParser& p)
 {
   p.GetParam("extra_smoothing_iters", &extra_smoothing_iters);
+  p.GetParam("smoothing_convergence_rel_tol", &smoothing_convergence_rel_tol);
+  p.GetParam("smoothing_time_budget_ms", &smoothing_time_budget_ms);
   p.GetParam("use_smart_stereo_factors", &use_smart_stereo_factors);
+  p.GetParam("use_attitude_factor", &use_attitude_factor);
+  p.GetParam("max_lmks_per_keypose", &max_lmks_per_keypose);
+  p.GetParam("lmk_min_track_length", &lmk_min_track_length);
+  p.GetParam("lmk_parallax_weight", &lmk_parallax_weight);
+  p.GetParam("lmk_retriangulation_threshold", &lmk_retriangulation_threshold);
+  CHECK_GE(lmk_min_track_length, 2) << "Smart factors need at least 2 observations" << std::endl;
   p.GetParam("smoother_lag_sec", &smoother_lag_sec);
+  p.GetParam("max_keyposes_in_lag", &max_keyposes_in_lag);
+  CHECK(max_keyposes_in_lag == 0 || max_keyposes_in_lag >= 2) << "The window needs at least 2 keyposes" << std::endl;
+  p.GetParam("max_factor_slots_ratio", &max_factor_slots_ratio);
+  p.GetParam("find_unused_factor_slots", &find_unused_factor_slots);
+  p.GetParam("relinearize_threshold_pose", &relinearize_threshold_pose);
+  p.GetParam("relinearize_threshold_velocity", &relinearize_threshold_velocity);
+  p.GetParam("relinearize_threshold_bias", &relinearize_threshold_bias);
+  p.GetParam("relinearize_skip", &relinearize_skip);
+  CHECK(relinearize_threshold_pose >= 0 && relinearize_threshold_velocity >= 0 && relinearize_threshold_bias >= 0);
+  CHECK_GE(relinearize_skip, 1);
+  p.GetParam("cache_linearized_factors", &cache_linearized_factors);
+  p.GetParam("adaptive_relinearization", &adaptive_relinearization);
+  if (adaptive_relinearization) {
+    relinearization_policy_params = RelinearizationPolicy::Params(p.Subtree("RelinearizationPolicy"));
+  }
+  p.GetParam("num_threads", &num_threads);
+  CHECK_GE(num_threads, 0);
+  p.GetParam("defer_marginal_covariance", &defer_marginal_covariance);
+  p.GetParam("marginal_covariance_every_n", &marginal_covariance_every_n);
+  CHECK_GE(marginal_covariance_every_n, 1);
 
   pose_prior_noise_model = DiagModel::Sigmas(YamlToVector<gtsam::Vector6>(p.GetNode("pose_prior_noise_model")));
   frontend_vo_noise_model = DiagModel::Sigmas(YamlToVector<gtsam::Vector6>(p.GetNode("frontend_vo_noise_model")));
@@ -50,6 +95,7 @@ void FixedLagSmoother::Params::LoadParams(const YamlParser& p)
 
   range_noise_model = IsoModel::Sigma(1, p.GetParam<double>("range_noise_model_sigma"));
   beacon_noise_model = IsoModel::Sigma(3, p.GetParam<double>("beacon_noise_model_sigma"));
+  p.GetParam("estimate_beacons", &estimate_beacons);
 
   p.GetParam("/shared/mag0/scale_factor", &mag_scale_factor);
   YamlToVector<Vector3d>(p.GetNode("/shared/mag0/sensor_bias"), mag_sensor_bias);
@@ -58,6 +104,7 @@ void FixedLagSmoother::Params::LoadParams(const YamlParser& p)
   CHECK_NEAR(1.0, mag_local_field.norm(), 1e-3);
 
   mag_noise_model = IsoModel::Sigma(3, p.GetParam<double>("mag_noise_model_sigma"));
+  tag_pose_noise_model = DiagModel::Sigmas(YamlToVector<gtsam::Vector6>(p.GetNode("tag_pose_noise_model")));
 
   body_P_imu = gtsam::Pose3(YamlToTransform(p.GetNode("/shared/imu0/body_T_imu")));
   body_P_mag = gtsam::Pose3(YamlToTransform(p.GetNode("/shared/mag0/body_T_sensor")));
@@ -75,6 +122,12 @@ FixedLagSmoother::FixedLagSmoother(const Params& params)
     : params_(params),
       stereo_rig_(params.stereo_rig)
 {
+  if (params_.adaptive_relinearization) {
+    relinearization_policy_.reset(new RelinearizationPolicy(params_.relinearization_policy_params));
+  }
+  LOG_IF(WARNING, params_.cache_linearized_factors && params_.use_smart_stereo_factors)
+      << "FixedLagSmoother cache_linearized_factors doesn't work with smart factors" << std::endl;
+
   ResetSmoother();
 
   cal3_stereo_ = gtsam::Cal3_S2Stereo::shared_ptr(
@@ -86,8 +139,26 @@ FixedLagSmoother::FixedLagSmoother(const Params& params)
           stereo_rig_.cy(),
           stereo_rig_.Baseline()));
 
+  for (const AuxStereoRig& rig : params_.aux_stereo_rigs) {
+    aux_cal3_stereo_.emplace_back(new gtsam::Cal3_S2Stereo(
+        rig.stereo_rig.fx(),
+        rig.stereo_rig.fy(),
+        kSetSkewToZero,
+        rig.stereo_rig.cx(),
+        rig.stereo_rig.cy(),
+        rig.stereo_rig.Baseline()));
+  }
+
   // https://bitbucket.org/gtborg/gtsam/issues/420/problem-with-isam2-stereo-smart-factors-no
   lmk_stereo_factor_params_ = gtsam::SmartStereoProjectionParams(gtsam::JACOBIAN_SVD, gtsam::ZERO_ON_DEGENERACY);
+  lmk_stereo_factor_params_.setRetriangulationThreshold(params_.lmk_retriangulation_threshold);
+
+#ifdef BM_SMOOTHER_USE_TBB
+  arena_.reset((params_.num_threads > 0) ? new tbb::task_arena(params_.num_threads) : new tbb::task_arena());
+  LOG(INFO) << "FixedLagSmoother using " << arena_->max_concurrency() << " TBB threads" << std::endl;
+#else
+  LOG_IF(WARNING, params_.num_threads != 1) << "FixedLagSmoother num_threads is ignored (build with BM_SMOOTHER_USE_TBB)" << std::endl;
+#endif
 
   Vector3d n_gravity_unit;
   depth_axis_ = GetGravityAxis(params_.n_gravity, n_gravity_unit);
@@ -99,14 +170,100 @@ FixedLagSmoother::FixedLagSmoother(const Params& params)
 void FixedLagSmoother::ResetSmoother()
 {
   // If relinearizeThreshold is zero, the graph is always relinearized on update().
+  const double scale = relinearization_policy_ ? relinearization_policy_->Scale() : 1.0;
+  const double pose_threshold = scale * params_.relinearize_threshold_pose;
+  const double velocity_threshold = scale * params_.relinearize_threshold_velocity;
+  const double bias_threshold = scale * params_.relinearize_threshold_bias;
+
   gtsam::ISAM2Params smoother_params;
-  smoother_params.relinearizeThreshold = 0.0;
-  smoother_params.relinearizeSkip = 1;
+  if (pose_threshold == velocity_threshold && velocity_threshold == bias_threshold) {
+    smoother_params.relinearizeThreshold = pose_threshold;
+  } else {
+    // NOTE(milo): iSAM2 looks up the threshold by the symbol character of every variable, so every
+    // type of variable in the graph needs one (with its tangent space dimension).
+    gtsam::FastMap<char, gtsam::Vector> thresholds;
+    thresholds['X'] = gtsam::Vector::Constant(6, pose_threshold);
+    thresholds['V'] = gtsam::Vector::Constant(3, velocity_threshold);
+    thresholds['B'] = gtsam::Vector::Constant(6, bias_threshold);
+    thresholds['R'] = gtsam::Vector::Constant(3, pose_threshold);
+    smoother_params.relinearizeThreshold = thresholds;
+  }
+  smoother_params.relinearizeSkip = params_.relinearize_skip;
+  smoother_params.findUnusedFactorSlots = params_.find_unused_factor_slots;
 
   // NOTE(milo): This is needed for using smart factors!!!
   // See: https://github.com/borglab/gtsam/blob/d6b24294712db197096cd3ea75fbed3157aea096/gtsam_unstable/slam/tests/testSmartStereoFactor_iSAM2.cpp
-  smoother_params.cacheLinearizedFactors = false;
-  smoother_ = gtsam::IncrementalFixedLagSmoother(params_.smoother_lag_sec, smoother_params);
+  smoother_params.cacheLinearizedFactors = params_.cache_linearized_factors;
+
+  // Needed to check for convergence between extra smoothing iters (see Update()).
+  smoother_params.evaluateNonlinearError = (params_.smoothing_convergence_rel_tol > 0);
+  smoother_ = gtsam::IncrementalFixedLagSmoother(WindowLag(), smoother_params);
+}
+
+
+void FixedLagSmoother::RunWithSmootherThreads(const std::function<void()>& fn)
+{
+#ifdef BM_SMOOTHER_USE_TBB
+  arena_->execute(fn);
+#else
+  fn();
+#endif
+}
+
+
+void FixedLagSmoother::CompactSmoother()
+{
+  MACRO_PROFILE_SCOPE("FixedLagSmoother::CompactSmoother");
+
+  std::unordered_map<gtsam::FactorIndex, uid_t> lmk_id_for_factor;
+  for (const auto& item : lmk_tracks_) {
+    if (item.second.in_graph) {
+      lmk_id_for_factor[item.second.factor_index] = item.first;
+    }
+  }
+
+  // NOTE(milo): This includes the priors from marginalization (LinearContainerFactors), which keep
+  // their own linearization points.
+  const gtsam::NonlinearFactorGraph& old_factors = smoother_.getFactors();
+  const gtsam::Values values = smoother_.calculateEstimate();
+  const KeyTimestampMap timestamps = smoother_.timestamps();
+
+  gtsam::NonlinearFactorGraph factors;
+  std::map<size_t, uid_t> factor_lmk_ids;
+  for (size_t i = 0; i < old_factors.size(); ++i) {
+    if (!old_factors.at(i)) {
+      continue;
+    }
+    const auto it = lmk_id_for_factor.find(i);
+    if (it != lmk_id_for_factor.end()) {
+      factor_lmk_ids[factors.size()] = it->second;
+    }
+    factors.push_back(old_factors.at(i));
+  }
+
+  LOG(INFO) << "Compacting smoother from " << old_factors.size() << " to " << factors.size() << " factor slots" << std::endl;
+
+  ResetSmoother();
+  RunWithSmootherThreads([&]() { smoother_.update(factors, values, timestamps); });
+
+  const gtsam::FactorIndices& new_factor_indices = smoother_.getISAM2Result().newFactorsIndices;
+  for (const auto& it : factor_lmk_ids) {
+    lmk_tracks_.at(it.second).factor_index = new_factor_indices.at(it.first);
+  }
+}
+
+
+seconds_t FixedLagSmoother::WindowTime(uid_t keypose_id, seconds_t keypose_time) const
+{
+  return (params_.max_keyposes_in_lag > 0) ? static_cast<seconds_t>(keypose_id) : keypose_time;
+}
+
+
+double FixedLagSmoother::WindowLag() const
+{
+  // NOTE(milo): The smoother marginalizes keys with a time before (newest - lag), so a lag of N-1
+  // keeps N keyposes.
+  return (params_.max_keyposes_in_lag > 0) ? static_cast<double>(params_.max_keyposes_in_lag - 1) : params_.smoother_lag_sec;
 }
 
 
@@ -115,13 +272,47 @@ void FixedLagSmoother::Initialize(seconds_t timestamp,
                                   const gtsam::Vector3& world_v_body,
                                   const ImuBias& imu_bias,
                                   bool imu_available)
+{
+  InitializeWithPriors(timestamp, world_P_body, world_v_body, imu_bias, imu_available,
+                       params_.pose_prior_noise_model,
+                       kZeroVelocity, params_.velocity_noise_model,
+                       kZeroImuBias, params_.bias_prior_noise_model);
+}
+
+
+void FixedLagSmoother::Initialize(seconds_t timestamp, const SmootherResult& estimate)
+{
+  // NOTE(milo): Without an IMU state, the velocity and bias covariances were never computed.
+  const bool imu = estimate.has_imu_state;
+  InitializeWithPriors(timestamp, estimate.world_P_body, estimate.world_v_body, estimate.imu_bias, imu,
+                       GaussianModel::Covariance(estimate.cov_pose),
+                       estimate.world_v_body,
+                       imu ? GaussianModel::Covariance(estimate.cov_vel) : GaussianModel::shared_ptr(params_.velocity_noise_model),
+                       estimate.imu_bias,
+                       imu ? GaussianModel::Covariance(estimate.cov_bias) : GaussianModel::shared_ptr(params_.bias_prior_noise_model));
+}
+
+
+void FixedLagSmoother::InitializeWithPriors(seconds_t timestamp,
+                                            const gtsam::Pose3& world_P_body,
+                                            const gtsam::Vector3& world_v_body,
+                                            const ImuBias& imu_bias,
+                                            bool imu_available,
+                                            const GaussianModel::shared_ptr& pose_prior_noise_model,
+                                            const gtsam::Vector3& velocity_prior,
+                                            const GaussianModel::shared_ptr& velocity_prior_noise_model,
+                                            const ImuBias& bias_prior,
+                                            const GaussianModel::shared_ptr& bias_prior_noise_model)
 {
   ResetKeyposeId();
   ResetSmoother();
 
   // Clear out any members that store state.
-  lmk_to_factor_map_.clear();;
-  stereo_factors_.clear();
+  lmk_tracks_.clear();
+  keypose_times_.clear();
+  vo_keypose_ids_.clear();
+  beacon_points_.clear();
+  num_lmk_factors_ = 0;
 
   const uid_t id0 = GetNextKeyposeId();
   const gtsam::Symbol P0_sym('X', id0);
@@ -132,28 +323,31 @@ void FixedLagSmoother::Initialize(seconds_t timestamp,
   gtsam::Values new_values;
   KeyTimestampMap new_timestamps;
 
-  new_timestamps[P0_sym] = timestamp;
+  const seconds_t window_time = WindowTime(id0, timestamp);
+  new_timestamps[P0_sym] = window_time;
+  keypose_times_[id0] = window_time;
 
   result_ = SmootherResult(id0, timestamp, world_P_body, imu_available, world_v_body, imu_bias,
-      params_.pose_prior_noise_model->covariance(),
-      params_.velocity_noise_model->covariance(),
-      params_.bias_prior_noise_model->covariance());
+      pose_prior_noise_model->covariance(),
+      velocity_prior_noise_model->covariance(),
+      bias_prior_noise_model->covariance());
+  published_result_.Store(result_);
 
   // Prior and initial value for the first pose.
-  new_factors.addPrior<gtsam::Pose3>(P0_sym, world_P_body, params_.pose_prior_noise_model);
+  new_factors.addPrior<gtsam::Pose3>(P0_sym, world_P_body, pose_prior_noise_model);
   new_values.insert(P0_sym, world_P_body);
 
   // If IMU available, add inertial variables to the graph.
   if (imu_available) {
     new_values.insert(V0_sym, world_v_body);
     new_values.insert(B0_sym, imu_bias);
-    new_factors.addPrior(V0_sym, kZeroVelocity, params_.velocity_noise_model);
-    new_factors.addPrior(B0_sym, kZeroImuBias, params_.bias_prior_noise_model);
-    new_timestamps[V0_sym] = timestamp;
-    new_timestamps[B0_sym] = timestamp;
+    new_factors.addPrior(V0_sym, velocity_prior, velocity_prior_noise_model);
+    new_factors.addPrior(B0_sym, bias_prior, bias_prior_noise_model);
+    new_timestamps[V0_sym] = window_time;
+    new_timestamps[B0_sym] = window_time;
   }
 
-  smoother_.update(new_factors, new_values, new_timestamps);
+  RunWithSmootherThreads([&]() { smoother_.update(new_factors, new_values, new_timestamps); });
 }
 
 
@@ -166,6 +360,8 @@ void FixedLagSmoother::Initialize(seconds_t timestamp,
  * unavailable, then these variables will be initialized with a ZERO-VELOCITY, ZERO-BIAS prior.
  */
 static void AddImuFactors(uid_t keypose_id,
+                          seconds_t window_time,
+                          seconds_t last_window_time,
                           const PimResult& pim_result,
                           const SmootherResult& last_smoother_result,
                           bool predict_keypose_value,
@@ -181,7 +377,6 @@ static void AddImuFactors(uid_t keypose_id,
   const gtsam::Symbol bias_sym('B', keypose_id);
 
   const uid_t last_keypose_id = last_smoother_result.keypose_id;
-  const seconds_t last_keypose_time = last_smoother_result.timestamp;
   const gtsam::Symbol last_keypose_sym('X', last_keypose_id);
   const gtsam::Symbol last_vel_sym('V', last_keypose_id);
   const gtsam::Symbol last_bias_sym('B', last_keypose_id);
@@ -199,8 +394,8 @@ static void AddImuFactors(uid_t keypose_id,
   new_values.insert(vel_sym, pred_state.velocity());
   new_values.insert(bias_sym, last_smoother_result.imu_bias);
 
-  new_timestamps[vel_sym] = pim_result.to_time;
-  new_timestamps[bias_sym] = pim_result.to_time;
+  new_timestamps[vel_sym] = window_time;
+  new_timestamps[bias_sym] = window_time;
 
   // If IMU was unavailable at the last state, we initialize it here with a prior.
   // NOTE(milo): For now we assume zero velocity and zero acceleration for the first pose.
@@ -212,8 +407,8 @@ static void AddImuFactors(uid_t keypose_id,
     new_factors.addPrior(last_vel_sym, kZeroVelocity, params.velocity_noise_model);
     new_factors.addPrior(last_bias_sym, kZeroImuBias, params.bias_drift_noise_model);
 
-    new_timestamps[last_vel_sym] = last_keypose_time;
-    new_timestamps[last_bias_sym] = last_keypose_time;
+    new_timestamps[last_vel_sym] = last_window_time;
+    new_timestamps[last_bias_sym] = last_window_time;
   }
 
   const gtsam::CombinedImuFactor imu_factor(last_keypose_sym, last_vel_sym,
@@ -229,23 +424,265 @@ static void AddImuFactors(uid_t keypose_id,
 }
 
 
+SmartStereoFactor::shared_ptr FixedLagSmoother::MakeStereoFactor(const LandmarkTrack& track) const
+{
+  // NOTE(milo): Unfortunately, smart factors do not support robust error functions yet.
+  // https://groups.google.com/g/gtsam-users/c/qHXl9RLRxRs/m/6zWoA0wJBAAJ
+  const bool aux = track.rig > 0;
+  const gtsam::Pose3& body_P_cam = aux ? params_.aux_stereo_rigs.at(track.rig - 1).body_P_cam : params_.body_P_cam;
+  const gtsam::Cal3_S2Stereo::shared_ptr& cal3_stereo = aux ? aux_cal3_stereo_.at(track.rig - 1) : cal3_stereo_;
+
+  SmartStereoFactor::shared_ptr factor(new SmartStereoFactor(
+      params_.lmk_stereo_factor_noise_model, lmk_stereo_factor_params_, body_P_cam));
+
+  for (const auto& obs : track.obs) {
+    factor->add(obs.second, gtsam::Symbol('X', obs.first), cal3_stereo);
+  }
+
+  return factor;
+}
+
+
+// Each frontend numbers its landmarks from zero, so the rig goes in the top bits of the track id.
+static uid_t RigLandmarkId(size_t rig, uid_t landmark_id)
+{
+  return (static_cast<uid_t>(rig) << 56) | landmark_id;
+}
+
+
+void FixedLagSmoother::UpdateLandmarkFactors(uid_t keypose_id,
+                                             VoResult::ConstPtr maybe_vo_ptr,
+                                             const std::vector<VoResult::ConstPtr>& maybe_aux_vo,
+                                             gtsam::NonlinearFactorGraph& new_factors,
+                                             std::map<size_t, uid_t>& new_factor_lmk_ids,
+                                             gtsam::FactorIndices& factors_to_remove)
+{
+  // NOTE(milo): Update() has already dropped the keyposes that will be marginalized.
+  const uid_t oldest_keypose_id = keypose_times_.begin()->first;
+
+  // When several keyposes go into one update, a factor from an earlier one might not be in the
+  // graph yet. It's cleared out of new_factors instead (CommitUpdate() skips the empty slot).
+  std::unordered_map<uid_t, size_t> pending_slots;
+  for (const auto& item : new_factor_lmk_ids) {
+    pending_slots[item.second] = item.first;
+  }
+
+  const auto has_factor = [&](uid_t lmk_id, const LandmarkTrack& track) {
+    return track.in_graph || pending_slots.count(lmk_id) > 0;
+  };
+
+  const auto remove_factor = [&](uid_t lmk_id, LandmarkTrack& track) {
+    if (track.in_graph) {
+      factors_to_remove.emplace_back(track.factor_index);
+      track.in_graph = false;
+      --num_lmk_factors_;
+      ++stats_.num_lmk_factors_removed;
+    }
+    const auto it = pending_slots.find(lmk_id);
+    if (it != pending_slots.end()) {
+      new_factors.replace(it->second, nullptr);
+      new_factor_lmk_ids.erase(it->second);
+      pending_slots.erase(it);
+    }
+  };
+
+  // Drop observations from keyposes that are leaving the lag. A smart factor can't refer to them
+  // after this update, so it has to be rebuilt from the observations that are left.
+  std::vector<uid_t> lmks_to_rebuild;
+  for (auto it = lmk_tracks_.begin(); it != lmk_tracks_.end();) {
+    LandmarkTrack& track = it->second;
+
+    size_t num_old = 0;
+    while (num_old < track.obs.size() && track.obs.at(num_old).first < oldest_keypose_id) {
+      ++num_old;
+    }
+
+    if (num_old == 0) {
+      ++it;
+      continue;
+    }
+
+    track.obs.erase(track.obs.begin(), track.obs.begin() + num_old);
+    if (has_factor(it->first, track)) {
+      remove_factor(it->first, track);
+      if ((int)track.obs.size() >= params_.lmk_min_track_length) {
+        lmks_to_rebuild.emplace_back(it->first);
+      }
+    }
+
+    it = track.obs.empty() ? lmk_tracks_.erase(it) : std::next(it);
+  }
+
+  // Add the new observations, but only give a budget of them new factors.
+  // NOTE(milo): All of the rigs share one budget, so a rig that sees more texture gets more factors.
+  std::vector<LandmarkCandidate> candidates;
+  const auto add_observations = [&](size_t rig, const VoResult& vo) {
+    const LandmarkObservationBatch& lmk_obs = vo.lmk_obs;
+    for (size_t i = 0; i < lmk_obs.Size(); ++i) {
+      const float disp = lmk_obs.disparity[i];
+      if (disp < 0) {
+        LOG(WARNING) << "Skipped zero-disparity observation!" << std::endl;
+        continue;
+      }
+
+      const cv::Point2f& pt = lmk_obs.pixel_location[i];
+      const gtsam::StereoPoint2 stereo_point2(
+          pt.x,           // X-coord in left image
+          pt.x - disp,    // x-coord in right image
+          pt.y);          // y-coord in both images (rectified)
+
+      const uid_t lmk_id = RigLandmarkId(rig, lmk_obs.landmark_id[i]);
+      LandmarkTrack& track = lmk_tracks_[lmk_id];
+      track.rig = rig;
+      track.obs.emplace_back(keypose_id, stereo_point2);
+
+      // NOTE(milo): Parallax isn't rotation-compensated, so it's only a rough guide.
+      const gtsam::StereoPoint2& first = track.obs.front().second;
+      const double parallax_px = std::hypot(stereo_point2.uL() - first.uL(), stereo_point2.v() - first.v());
+      candidates.emplace_back(lmk_id, (int)track.obs.size(), parallax_px);
+    }
+  };
+
+  if (maybe_vo_ptr) {
+    add_observations(0, *maybe_vo_ptr);
+  }
+
+  CHECK_LE(maybe_aux_vo.size(), params_.aux_stereo_rigs.size()) << "Got VO from an unknown aux rig" << std::endl;
+  const size_t num_primary_observed = candidates.size();
+  for (size_t i = 0; i < maybe_aux_vo.size(); ++i) {
+    if (maybe_aux_vo.at(i)) {
+      add_observations(i + 1, *maybe_aux_vo.at(i));
+    }
+  }
+  stats_.num_lmk_observed = (int)candidates.size();
+  stats_.num_aux_lmk_observed = (int)(candidates.size() - num_primary_observed);
+
+  const std::vector<uid_t> selected = SelectLandmarks(
+      candidates,
+      params_.max_lmks_per_keypose,
+      params_.lmk_min_track_length,
+      params_.lmk_parallax_weight);
+
+  // Landmarks that weren't selected keep their old factor (without the new observation).
+  std::unordered_set<uid_t> rebuilt;
+  for (const uid_t lmk_id : selected) {
+    LandmarkTrack& track = lmk_tracks_.at(lmk_id);
+    remove_factor(lmk_id, track);
+    new_factor_lmk_ids[new_factors.size()] = lmk_id;
+    new_factors.push_back(MakeStereoFactor(track));
+    rebuilt.insert(lmk_id);
+  }
+
+  for (const uid_t lmk_id : lmks_to_rebuild) {
+    if (rebuilt.count(lmk_id) == 0) {
+      new_factor_lmk_ids[new_factors.size()] = lmk_id;
+      new_factors.push_back(MakeStereoFactor(lmk_tracks_.at(lmk_id)));
+    }
+  }
+
+  stats_.num_lmk_factors_added = (int)new_factor_lmk_ids.size();
+}
+
+
+// Returns true if the last iSAM2 update changed the graph error by a fraction less than rel_tol,
+// or didn't relinearize any variables. Always false if rel_tol is zero (convergence check is off).
+static bool SmoothingHasConverged(const gtsam::ISAM2Result& result, double rel_tol)
+{
+  if (rel_tol <= 0) {
+    return false;
+  }
+
+  if (result.variablesRelinearized == 0) {
+    return true;
+  }
+
+  if (!result.errorBefore || !result.errorAfter) {
+    return false;
+  }
+
+  const double error_before = *result.errorBefore;
+  const double error_after = *result.errorAfter;
+  return std::fabs(error_before - error_after) <= rel_tol * std::max(error_before, 1e-9);
+}
+
+
+uid_t FixedLagSmoother::BeaconId(const Vector3d& world_t_beacon)
+{
+  for (size_t i = 0; i < beacon_points_.size(); ++i) {
+    if ((beacon_points_.at(i) - world_t_beacon).norm() < kSameBeaconDist) {
+      return static_cast<uid_t>(i);
+    }
+  }
+
+  beacon_points_.emplace_back(world_t_beacon);
+  return static_cast<uid_t>(beacon_points_.size() - 1);
+}
+
+
 SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
                                         PimResult::ConstPtr maybe_pim_ptr,
                                         DepthMeasurement::ConstPtr maybe_depth_ptr,
                                         AttitudeMeasurement::ConstPtr maybe_attitude_ptr,
                                         const MultiRange& maybe_ranges,
-                                        MagMeasurement::ConstPtr maybe_mag_ptr)
+                                        MagMeasurement::ConstPtr maybe_mag_ptr,
+                                        TagPoseMeasurement::ConstPtr maybe_tag_pose_ptr,
+                                        const std::vector<VoResult::ConstPtr>& maybe_aux_vo)
+{
+  MACRO_PROFILE_SCOPE("FixedLagSmoother::Update");
+
+  KeyposeMeasurements keypose;
+  keypose.vo = maybe_vo_ptr;
+  keypose.pim = maybe_pim_ptr;
+  keypose.depth = maybe_depth_ptr;
+  keypose.attitude = maybe_attitude_ptr;
+  keypose.ranges = maybe_ranges;
+  keypose.mag = maybe_mag_ptr;
+  keypose.tag_pose = maybe_tag_pose_ptr;
+  keypose.aux_vo = maybe_aux_vo;
+
+  return UpdateBatch({ keypose }).back();
+}
+
+
+std::vector<SmootherResult> FixedLagSmoother::UpdateBatch(const std::vector<KeyposeMeasurements>& keyposes)
 {
+  MACRO_PROFILE_SCOPE("FixedLagSmoother::UpdateBatch");
+  CHECK(!keyposes.empty()) << "Need at least one keypose to update the smoother" << std::endl;
+
+  PendingUpdate pending;
+  pending.last = result_;
+  stats_ = UpdateStats();
+
+  for (const KeyposeMeasurements& keypose : keyposes) {
+    AddKeypose(keypose, pending);
+  }
+
+  return CommitUpdate(pending);
+}
+
+
+void FixedLagSmoother::AddKeypose(const KeyposeMeasurements& keypose, PendingUpdate& pending)
+{
+  const VoResult::ConstPtr& maybe_vo_ptr = keypose.vo;
+  const PimResult::ConstPtr& maybe_pim_ptr = keypose.pim;
+  const DepthMeasurement::ConstPtr& maybe_depth_ptr = keypose.depth;
+  const AttitudeMeasurement::ConstPtr& maybe_attitude_ptr = keypose.attitude;
+  const MultiRange& maybe_ranges = keypose.ranges;
+  const MagMeasurement::ConstPtr& maybe_mag_ptr = keypose.mag;
+  const TagPoseMeasurement::ConstPtr& maybe_tag_pose_ptr = keypose.tag_pose;
   CHECK(maybe_vo_ptr || maybe_pim_ptr) << "Must have either IMU or VO available" << std::endl;
 
-  gtsam::NonlinearFactorGraph new_factors;
-  gtsam::Values new_values;
-  KeyTimestampMap new_timestamps;
+  gtsam::NonlinearFactorGraph& new_factors = pending.new_factors;
+  gtsam::Values& new_values = pending.new_values;
+  KeyTimestampMap& new_timestamps = pending.new_timestamps;
 
   const uid_t keypose_id = GetNextKeyposeId();
   const seconds_t keypose_time = maybe_vo_ptr ? ConvertToSeconds(maybe_vo_ptr->timestamp) : maybe_pim_ptr->to_time;
-  const uid_t last_keypose_id = result_.keypose_id;
-  const seconds_t last_keypose_time = result_.timestamp;
+  const SmootherResult& last = pending.last;
+  const uid_t last_keypose_id = last.keypose_id;
+  const seconds_t last_keypose_time = last.timestamp;
+  const seconds_t window_time = WindowTime(keypose_id, keypose_time);
+  const seconds_t last_window_time = WindowTime(last_keypose_id, last_keypose_time);
 
   const gtsam::Symbol keypose_sym('X', keypose_id);
   const gtsam::Symbol vel_sym('V', keypose_id);
@@ -258,19 +695,13 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
   bool graph_has_vo_btw_factor = false;
   bool graph_has_imu_btw_factor = false;
 
-  new_timestamps[keypose_sym] = keypose_time;
-
-  // Needed for using ISAM2 with smart factors.
-  // gtsam::FastMap<gtsam::FactorIndex, gtsam::KeySet> factorNewAffectedKeys;
-
-  // Map: ISAM2 internal FactorIndex => lmk_id.
-  // std::map<gtsam::FactorIndex, uid_t> map_new_factor_to_lmk_id;
+  new_timestamps[keypose_sym] = window_time;
 
   //====================================== VISUAL ODOMETRY =========================================
   if (maybe_vo_ptr) {
     const VoResult& odom_result = *maybe_vo_ptr;
     CHECK(odom_result.is_keyframe) << "Smoother shouldn't receive a non-keyframe odometry result" << std::endl;
-    CHECK(odom_result.lmk_obs.size() > 0) << "Smoother shouln't receive a keyframe with no observations" << std::endl;
+    CHECK(!odom_result.lmk_obs.Empty()) << "Smoother shouln't receive a keyframe with no observations" << std::endl;
 
     // Check if the timestamp from the LAST VO keyframe is close to the last smoother result.
     // If so, the odometry measurement can be used in the graph. Allowing 100 ms offset for now.
@@ -280,7 +711,7 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
     if (odom_aligned) {
       // NOTE(milo): Must convert VO into BODY frame odometry!
       const gtsam::Pose3& body_P_odom = params_.body_P_cam * gtsam::Pose3(odom_result.lkf_T_cam) * params_.body_P_cam.inverse();
-      const gtsam::Pose3 world_P_body = result_.world_P_body * body_P_odom;
+      const gtsam::Pose3 world_P_body = last.world_P_body * body_P_odom;
       new_values.insert(keypose_sym, world_P_body);
 
       // Use a robust noise model to reduce the effect of bad VO estimates.
@@ -294,71 +725,70 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
     }
   }
 
+  // The smoother marginalizes keyposes older than this during the update.
+  keypose_times_[keypose_id] = window_time;
+  const seconds_t cutoff_time = window_time - WindowLag();
+  while (!keypose_times_.empty() && keypose_times_.begin()->second < cutoff_time) {
+    keypose_times_.erase(keypose_times_.begin());
+  }
+  while (!vo_keypose_ids_.empty() && keypose_times_.count(vo_keypose_ids_.begin()->second) == 0) {
+    vo_keypose_ids_.erase(vo_keypose_ids_.begin());
+  }
+
+  //======================================= RELOCALIZATION =========================================
+  // The frontend matched an older keyframe (e.g after vision was lost for a while). If its keypose
+  // is still in the window, tie this keypose to it, so that the drift since then is pulled out in
+  // this update instead of being carried along.
+  if (maybe_vo_ptr && maybe_vo_ptr->has_reloc) {
+    const VoResult& odom_result = *maybe_vo_ptr;
+    const auto it = vo_keypose_ids_.find(odom_result.reloc_timestamp_kf);
+    if (it != vo_keypose_ids_.end()) {
+      const gtsam::Pose3 body_P_reloc = params_.body_P_cam * gtsam::Pose3(odom_result.reloc_kf_T_cam) * params_.body_P_cam.inverse();
+      const RobustModel::shared_ptr model = RobustModel::Create(mCauchy::Create(1.0), params_.frontend_vo_noise_model);
+      new_factors.push_back(gtsam::BetweenFactor<gtsam::Pose3>(gtsam::Symbol('X', it->second), keypose_sym, body_P_reloc, model));
+      LOG(INFO) << "Relocalized keypose " << keypose_id << " against keypose " << it->second << std::endl;
+    }
+  }
+  if (maybe_vo_ptr) {
+    vo_keypose_ids_[maybe_vo_ptr->timestamp] = keypose_id;
+  }
+
   //===================================== STEREO SMART FACTORS ======================================
   // Even if visual odometry didn't line up with the previous keypose, we still want to add stereo
   // landmarks, since they could be observed in future keyframes.
-  // if (params_.use_smart_stereo_factors) {
-  //   for (const LandmarkObservation& lmk_obs : odom_result.lmk_obs) {
-  //     if (lmk_obs.disparity < 0) {
-  //       LOG(WARNING) << "Skipped zero-disparity observation!" << std::endl;
-  //       continue;
-  //     }
-
-  //     const uid_t lmk_id = lmk_obs.landmark_id;
-
-  //     // NEW SMART FACTOR: Creating smart stereo factor for the first time.
-  //     // NOTE(milo): Unfortunately, smart factors do not support robust error functions yet.
-  //     // https://groups.google.com/g/gtsam-users/c/qHXl9RLRxRs/m/6zWoA0wJBAAJ
-  //     if (stereo_factors_.count(lmk_id) == 0) {
-  //       stereo_factors_.emplace(lmk_id, new SmartStereoFactor(
-  //           params_.lmk_stereo_factor_noise_model, lmk_stereo_factor_params_, params_.body_P_cam));
-
-  //       // Indicate that the newest factor refers to lmk_id.
-  //       // NOTE(milo): Add the new factor to the graph. Order matters here!
-  //       map_new_factor_to_lmk_id[new_factors.size()] = lmk_id;
-  //       new_factors.push_back(stereo_factors_.at(lmk_id));
-
-  //     // UPDATE SMART FACTOR: An existing ISAM2 factor now affects the camera pose with the current key.
-  //     } else {
-  //       factorNewAffectedKeys[lmk_to_factor_map_.at(lmk_id)].insert(keypose_sym);
-  //     }
-
-  //     SmartStereoFactor::shared_ptr sfptr = stereo_factors_.at(lmk_id);
-  //     const gtsam::StereoPoint2 stereo_point2(
-  //         lmk_obs.pixel_location.x,                      // X-coord in left image
-  //         lmk_obs.pixel_location.x - lmk_obs.disparity,  // x-coord in right image
-  //         lmk_obs.pixel_location.y);                     // y-coord in both images (rectified)
-  //     sfptr->add(stereo_point2, keypose_sym, cal3_stereo_);
-  //   }
-  // }
+  if (params_.use_smart_stereo_factors) {
+    UpdateLandmarkFactors(keypose_id, maybe_vo_ptr, keypose.aux_vo, new_factors, pending.new_factor_lmk_ids, pending.factors_to_remove);
+  }
 
   //=================================== IMU PREINTEGRATION FACTOR ==================================
   if (maybe_pim_ptr) {
     const PimResult& pim_result = *maybe_pim_ptr;
     CHECK(pim_result.timestamps_aligned) << "Preintegrated IMU to/from timestamps not aligned" << std::endl;
 
-    AddImuFactors(keypose_id, pim_result, result_, true, new_values, new_factors, new_timestamps, params_);
-
-    new_timestamps[vel_sym] = keypose_time;
-    new_timestamps[bias_sym] = keypose_time;
+    AddImuFactors(keypose_id, window_time, last_window_time, pim_result, last, !graph_has_vo_btw_factor,
+                  new_values, new_factors, new_timestamps, params_);
 
     graph_has_imu_btw_factor = true;
   }
 
   //======================================= ATTITUDE FACTOR ========================================
-  // if (maybe_attitude_ptr) {
-  //   const Vector3d body_nG_unit = maybe_attitude_ptr->body_nG.normalized();
-  //   const Vector3d world_nG_unit = params_.n_gravity.normalized();
-
-  //   // NOTE(milo): GTSAM computes error as: nZ_.error(nRb * bRef_).
-  //   // So if we measure body_nG, we should plug it in for bRef_, and use the world_nG as nZ_.
-  //   const gtsam::Pose3AttitudeFactor attitude_factor(
-  //       keypose_sym,
-  //       gtsam::Unit3(world_nG_unit),
-  //       params_.attitude_noise_model,
-  //       gtsam::Unit3(body_nG_unit));
-  //   new_factors.push_back(attitude_factor);
-  // }
+  if (params_.use_attitude_factor && maybe_attitude_ptr) {
+    const Vector3d body_nG_unit = maybe_attitude_ptr->body_nG.normalized();
+    const Vector3d world_nG_unit = params_.n_gravity.normalized();
+
+    // An averaged measurement comes with its own (smaller) noise.
+    const gtsam::SharedNoiseModel model = (maybe_attitude_ptr->sigma > 0) ?
+        IsoModel::Sigma(2, maybe_attitude_ptr->sigma) : params_.attitude_noise_model;
+
+    // NOTE(milo): GTSAM computes error as: nZ_.error(nRb * bRef_).
+    // So if we measure body_nG, we should plug it in for bRef_, and use the world_nG as nZ_.
+    const gtsam::Pose3AttitudeFactor attitude_factor(
+        keypose_sym,
+        gtsam::Unit3(world_nG_unit),
+        model,
+        gtsam::Unit3(body_nG_unit));
+    new_factors.push_back(attitude_factor);
+  }
 
   //========================================= DEPTH FACTOR =========================================
   if (maybe_depth_ptr) {
@@ -377,45 +807,65 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
   }
 
   //========================================= RANGE FACTOR =========================================
-  if (!maybe_ranges.empty()) {
-    const size_t max_supported_beacons = 4;
-
-    const std::vector<char> beacon_chars = { 'f', 'g', 'h', 'i' };
-    CHECK_LE(maybe_ranges.size(), max_supported_beacons) << "Only support up to 4 beacons!" << std::endl;
-
-    for (size_t i = 0; i < std::min(maybe_ranges.size(), max_supported_beacons); ++i) {
-      const gtsam::Symbol beacon_sym(beacon_chars.at(i), keypose_id);
-      const RangeMeasurement& range_meas = maybe_ranges.at(i);
-      new_values.insert(beacon_sym, range_meas.point);
-      new_timestamps[beacon_sym] = keypose_time;
-      new_factors.addPrior(beacon_sym, range_meas.point, params_.beacon_noise_model);
-      new_factors.push_back(RangeFactor(
+  // Beacon positions are known, so each range is a unary factor on this keypose (no new variables).
+  // With estimate_beacons, each beacon has one variable instead, which all of its ranges share.
+  for (const RangeMeasurement& range_meas : maybe_ranges) {
+    if (!params_.estimate_beacons) {
+      new_factors.push_back(gtsam::RangeToPointFactor(
           keypose_sym,
-          beacon_sym,
+          range_meas.point,
           range_meas.range,
           params_.range_noise_model,
           params_.body_P_receiver));
+      continue;
+    }
+
+    const gtsam::Symbol beacon_sym('R', BeaconId(range_meas.point));
+
+    // A beacon that hasn't been ranged for a whole lag gets marginalized, so it starts over from its
+    // prior the next time.
+    if (!new_values.exists(beacon_sym) && !smoother_.getLinearizationPoint().exists(beacon_sym)) {
+      new_values.insert(beacon_sym, range_meas.point);
+      new_factors.addPrior(beacon_sym, range_meas.point, params_.beacon_noise_model);
     }
+    new_timestamps[beacon_sym] = window_time;
+
+    new_factors.push_back(RangeFactor(
+        keypose_sym,
+        beacon_sym,
+        range_meas.range,
+        params_.range_noise_model,
+        params_.body_P_receiver));
   }
 
   //==================================== MAGNETOMETER FACTOR =======================================
   if (maybe_mag_ptr) {
+    const gtsam::SharedNoiseModel model = maybe_mag_ptr->cov.isZero() ?
+        gtsam::SharedNoiseModel(params_.mag_noise_model) : gtsam::noiseModel::Gaussian::Covariance(maybe_mag_ptr->cov);
+
     new_factors.push_back(MagFactor(
       keypose_sym,
       maybe_mag_ptr->field,
       params_.mag_scale_factor,
       params_.mag_local_field,
       params_.mag_sensor_bias,
-      params_.mag_noise_model,
+      model,
       params_.body_P_mag));
   }
 
+  //======================================= TAG POSE FACTOR ========================================
+  if (maybe_tag_pose_ptr) {
+    // NOTE(milo): Robust, so that a misread (or moved) tag can't drag the whole window with it.
+    const RobustModel::shared_ptr model = RobustModel::Create(mCauchy::Create(1.0), params_.tag_pose_noise_model);
+    new_factors.addPrior<gtsam::Pose3>(keypose_sym, maybe_tag_pose_ptr->world_P_body, model);
+  }
+
   //================================= FACTOR GRAPH SAFETY CHECK ====================================
   if (!graph_has_vo_btw_factor && !graph_has_imu_btw_factor) {
     LOG(WARNING) << "Graph doesn't have a between factor from VO or IMU, so it is under-constrained!" << std::endl;
     LOG(WARNING) << "Assuming NO MOTION from previous keypose!" << std::endl;
     const gtsam::Pose3 body_P_odom = gtsam::Pose3::identity();
-    const gtsam::Pose3 world_P_body = result_.world_P_body * body_P_odom;
+    const gtsam::Pose3 world_P_body = last.world_P_body * body_P_odom;
     new_values.insert(keypose_sym, world_P_body);
 
     // Use a robust noise model so that this no-motion prior can be "switched off" later.
@@ -427,52 +877,186 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
         last_keypose_sym, keypose_sym, body_P_odom, model));
   }
 
-  //==================================== UPDATE FACTOR GRAPH =======================================
-  // gtsam::ISAM2UpdateParams update_params;
-  // update_params.newAffectedKeys = std::move(factorNewAffectedKeys);
-  // const gtsam::ISAM2Result& isam_result = smoother_.update(new_factors, new_values, update_params);
+  // The next keypose in this update starts from this one's initial guess.
+  SmootherResult guess;
+  guess.keypose_id = keypose_id;
+  guess.timestamp = keypose_time;
+  guess.world_P_body = new_values.at<gtsam::Pose3>(keypose_sym);
+  guess.has_imu_state = new_values.exists(vel_sym);
+  guess.world_v_body = guess.has_imu_state ? new_values.at<gtsam::Vector3>(vel_sym) : last.world_v_body;
+  guess.imu_bias = guess.has_imu_state ? new_values.at<ImuBias>(bias_sym) : last.imu_bias;
+  pending.last = guess;
+  pending.guesses.emplace_back(guess);
+  ++stats_.num_keyposes_added;
+}
 
-  // // Housekeeping: figure out what factor index has been assigned to each new factor.
-  // for (const auto &fct_to_lmk : map_new_factor_to_lmk_id) {
-  //   lmk_to_factor_map_[fct_to_lmk.second] = isam_result.newFactorsIndices.at(fct_to_lmk.first);
-  // }
 
-  smoother_.update(new_factors, new_values, new_timestamps);
+std::vector<SmootherResult> FixedLagSmoother::CommitUpdate(PendingUpdate& pending)
+{
+  // Smart factors that were replaced by a later keypose in this update left empty slots.
+  gtsam::NonlinearFactorGraph new_factors;
+  std::map<size_t, uid_t> new_factor_lmk_ids;
+  for (size_t i = 0; i < pending.new_factors.size(); ++i) {
+    if (!pending.new_factors.at(i)) {
+      continue;
+    }
+    const auto it = pending.new_factor_lmk_ids.find(i);
+    if (it != pending.new_factor_lmk_ids.end()) {
+      new_factor_lmk_ids[new_factors.size()] = it->second;
+    }
+    new_factors.push_back(pending.new_factors.at(i));
+  }
+  const gtsam::Values& new_values = pending.new_values;
+  const KeyTimestampMap& new_timestamps = pending.new_timestamps;
+  const gtsam::FactorIndices& factors_to_remove = pending.factors_to_remove;
+
+  //==================================== UPDATE FACTOR GRAPH =======================================
+  Timer timer(true);
+  RunWithSmootherThreads([&]() { smoother_.update(new_factors, new_values, new_timestamps, factors_to_remove); });
+  stats_.isam_update_ms = timer.Elapsed().milliseconds();
+  stats_.num_relinearized = static_cast<int>(smoother_.getISAM2Result().variablesRelinearized);
+
+  // Housekeeping: figure out what factor index has been assigned to each new smart factor.
+  const gtsam::FactorIndices& new_factor_indices = smoother_.getISAM2Result().newFactorsIndices;
+  for (const auto& it : new_factor_lmk_ids) {
+    LandmarkTrack& track = lmk_tracks_.at(it.second);
+    track.in_graph = true;
+    track.factor_index = new_factor_indices.at(it.first);
+  }
+  num_lmk_factors_ += static_cast<int>(new_factor_lmk_ids.size());
 
-  // (Optional) run the smoother a few more times to reduce error.
+  // (Optional) run the smoother a few more times to reduce error. Stop early if the last update
+  // barely changed anything, or if this update has used up its time budget.
   for (int i = 0; i < params_.extra_smoothing_iters; ++i) {
-    smoother_.update();
+    if (SmoothingHasConverged(smoother_.getISAM2Result(), params_.smoothing_convergence_rel_tol)) {
+      break;
+    }
+    if (params_.smoothing_time_budget_ms > 0 && timer.Elapsed().milliseconds() >= params_.smoothing_time_budget_ms) {
+      LOG(WARNING) << "Smoother hit its time budget after " << i << " extra iters" << std::endl;
+      break;
+    }
+    RunWithSmootherThreads([&]() { smoother_.update(); });
+    ++stats_.num_extra_iters;
+  }
+
+  // New relinearization thresholds can only be applied by rebuilding the smoother, which compacts it
+  // at the same time.
+  const bool rescaled = relinearization_policy_ && relinearization_policy_->Report(stats_.isam_update_ms);
+  stats_.relinearize_scale = relinearization_policy_ ? relinearization_policy_->Scale() : 1.0;
+
+  const size_t num_factors = smoother_.getFactors().nrFactors();
+  if (rescaled || (params_.max_factor_slots_ratio > 0 &&
+      smoother_.getFactors().size() > params_.max_factor_slots_ratio * std::max(num_factors, (size_t)1))) {
+    CompactSmoother();
+    stats_.compacted = true;
+  }
+
+  stats_.num_factors = static_cast<int>(num_factors);
+  stats_.num_lmk_factors = num_lmk_factors_;
+  stats_.total_update_ms = timer.Elapsed().milliseconds();
+
+  stats_.num_keyposes = static_cast<int>(keypose_times_.size());
+  stats_.num_values = static_cast<int>(smoother_.getLinearizationPoint().size());
+  stats_.num_factor_slots = static_cast<int>(smoother_.getFactors().size());
+  stats_.num_lmk_tracks = static_cast<int>(lmk_tracks_.size());
+  for (const auto& item : lmk_tracks_) {
+    stats_.num_lmk_track_obs += static_cast<int>(item.second.obs.size());
   }
 
   //================================ RETRIEVE VARIABLE ESTIMATES ===================================
   const gtsam::Values& estimate = smoother_.calculateEstimate();
 
+  // Keyposes before the newest one (when catching up) don't get a covariance. If a batch was longer
+  // than the lag, its oldest keyposes are already marginalized, and keep their initial guess.
+  std::vector<SmootherResult> results;
+  for (const SmootherResult& guess : pending.guesses) {
+    const gtsam::Symbol keypose_sym('X', guess.keypose_id);
+    const gtsam::Symbol vel_sym('V', guess.keypose_id);
+    const gtsam::Symbol bias_sym('B', guess.keypose_id);
+    const bool in_window = estimate.exists(keypose_sym);
+    results.emplace_back(SmootherResult(
+        guess.keypose_id,
+        guess.timestamp,
+        in_window ? estimate.at<gtsam::Pose3>(keypose_sym) : guess.world_P_body,
+        true,
+        (in_window && estimate.exists(vel_sym)) ? estimate.at<gtsam::Vector3>(vel_sym) : guess.world_v_body,
+        (in_window && estimate.exists(bias_sym)) ? estimate.at<ImuBias>(bias_sym) : guess.imu_bias,
+        result_.cov_pose,
+        result_.cov_vel,
+        result_.cov_bias));
+    results.back().cov_keypose_id = result_.cov_keypose_id;
+  }
+
+  // Carry over the last covariance. It's replaced below, unless covariance is deferred/skipped.
+  result_ = results.back();
+  published_result_.Store(result_);
+
+  if (!params_.defer_marginal_covariance) {
+    UpdateMarginalCovariance();
+    results.back() = result_;
+  }
+
+  return results;
+}
+
+
+void FixedLagSmoother::SetSmoothingBudget(int extra_smoothing_iters,
+                                          double smoothing_convergence_rel_tol,
+                                          double smoothing_time_budget_ms)
+{
+  CHECK_GE(extra_smoothing_iters, 0);
+  CHECK_GE(smoothing_convergence_rel_tol, 0);
+  CHECK_GE(smoothing_time_budget_ms, 0);
+
+  params_.extra_smoothing_iters = extra_smoothing_iters;
+  params_.smoothing_convergence_rel_tol = smoothing_convergence_rel_tol;
+  params_.smoothing_time_budget_ms = smoothing_time_budget_ms;
+}
+
+
+void FixedLagSmoother::SetMarginalCovarianceEveryN(int marginal_covariance_every_n)
+{
+  CHECK_GE(marginal_covariance_every_n, 1);
+  params_.marginal_covariance_every_n = marginal_covariance_every_n;
+}
+
+
+bool FixedLagSmoother::UpdateMarginalCovariance(bool force)
+{
+  MACRO_PROFILE_SCOPE("FixedLagSmoother::UpdateMarginalCovariance");
+  const SmootherResult& result = result_;
+
+  const bool up_to_date = (result.cov_keypose_id == result.keypose_id);
+  const bool too_soon = (result.keypose_id - result.cov_keypose_id) < (uid_t)params_.marginal_covariance_every_n;
+
+  // NOTE(milo): Results without velocity and bias variables come from Initialize(), and already
+  // have their (prior) covariance.
+  if (up_to_date || !result.has_imu_state || (too_soon && !force)) {
+    return false;
+  }
+
+  const gtsam::Symbol keypose_sym('X', result.keypose_id);
+  const gtsam::Symbol vel_sym('V', result.keypose_id);
+  const gtsam::Symbol bias_sym('B', result.keypose_id);
+
   const Matrix6d cov_pose = smoother_.marginalCovariance(keypose_sym).matrix();
   const Matrix3d cov_vel = smoother_.marginalCovariance(vel_sym).matrix();
   const Matrix6d cov_bias = smoother_.marginalCovariance(bias_sym).matrix();
 
-  result_lock_.lock();
-  result_ = SmootherResult(
-      keypose_id,
-      keypose_time,
-      estimate.at<gtsam::Pose3>(keypose_sym),
-      true,
-      estimate.at<gtsam::Vector3>(vel_sym),
-      estimate.at<ImuBias>(bias_sym),
-      cov_pose,
-      cov_vel,
-      cov_bias);
-  result_lock_.unlock();
-
-  return result_;
+  result_.cov_pose = cov_pose;
+  result_.cov_vel = cov_vel;
+  result_.cov_bias = cov_bias;
+  result_.cov_keypose_id = result_.keypose_id;
+  published_result_.Store(result_);
+
+  return true;
 }
 
 
-SmootherResult FixedLagSmoother::GetResult()
+SmootherResult FixedLagSmoother::GetResult() const
 {
-  result_lock_.lock();
-  const SmootherResult out = result_;
-  result_lock_.unlock();
+  SmootherResult out;
+  published_result_.Load(out);
   return out;
 }
 
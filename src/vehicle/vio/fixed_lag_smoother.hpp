@@ -1,6 +1,10 @@
 #pragma once
 
+#include <functional>
+#include <map>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "core/axis3.hpp"
 #include "core/depth_measurement.hpp"
@@ -8,14 +12,18 @@
 #include "core/imu_measurement.hpp"
 #include "core/macros.hpp"
 #include "core/mag_measurement.hpp"
+#include "core/seqlock.hpp"
 #include "core/range_measurement.hpp"
 #include "core/timestamp.hpp"
 #include "core/uid.hpp"
 #include "params/params_base.hpp"
 #include "vio/attitude_measurement.hpp"
+#include "vio/aux_stereo_rig.hpp"
 #include "vio/imu_manager.hpp"
 #include "vio/noise_model.hpp"
+#include "vio/relinearization_policy.hpp"
 #include "vio/smoother_result.hpp"
+#include "vio/tag_pose_measurement.hpp"
 #include "vio/vo_result.hpp"
 #include "vision_core/stereo_camera.hpp"
 
@@ -25,6 +33,10 @@
 #include <gtsam_unstable/slam/SmartStereoProjectionPoseFactor.h>
 #include <gtsam_unstable/nonlinear/IncrementalFixedLagSmoother.h>
 
+#ifdef BM_SMOOTHER_USE_TBB
+#include <tbb/task_arena.h>
+#endif
+
 namespace bm {
 namespace vio {
 
@@ -40,6 +52,20 @@ typedef std::unordered_map<uid_t, SmartStereoFactor::shared_ptr> SmartStereoFact
 typedef std::map<uid_t, gtsam::FactorIndex> LmkToFactorMap;
 
 
+// Stereo observations of a landmark from keyposes that are still inside of the smoother lag, oldest
+// first. If in_graph, the smoother has a smart factor (at factor_index) for some of them. Landmarks
+// are seen by one rig: 0 is the primary rig, and i + 1 is aux_stereo_rigs[i].
+struct LandmarkTrack final
+{
+  size_t rig = 0;
+  std::vector<std::pair<uid_t, gtsam::StereoPoint2>> obs;
+  bool in_graph = false;
+  gtsam::FactorIndex factor_index = 0;
+};
+
+typedef std::unordered_map<uid_t, LandmarkTrack> LandmarkTrackMap;
+
+
 class FixedLagSmoother final {
  public:
   struct Params final : public ParamsBase
@@ -47,9 +73,67 @@ class FixedLagSmoother final {
     MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
 
     int extra_smoothing_iters = 2;    // More smoothing iters --> better accuracy.
+
+    // Stop the extra smoothing iters early once an update changes the graph error by less than this
+    // fraction (or relinearizes nothing). If zero, all extra_smoothing_iters always run.
+    double smoothing_convergence_rel_tol = 0.0;
+
+    // No more extra smoothing iters are started once Update() has taken this long. Zero = no limit.
+    double smoothing_time_budget_ms = 0.0;
     double smoother_lag_sec = 10.0;   // Time window for optimization over the factor graph.
+
+    // If > 0, the window holds this many keyposes instead (smoother_lag_sec is ignored), so that its
+    // memory and per-update cost don't depend on the keypose rate.
+    int max_keyposes_in_lag = 0;
+
+    // Unless find_unused_factor_slots, iSAM2 never reuses the slots of removed factors, and smart
+    // factors are removed and re-added all the time. Once there are this many slots per live factor,
+    // the smoother is rebuilt from the live factors. Zero = never.
+    double max_factor_slots_ratio = 4.0;
+    bool find_unused_factor_slots = false;
+
+    // iSAM2 only relinearizes a variable once its change since the last linearization is bigger than
+    // the threshold for its type, and only checks every relinearize_skip updates. With zero
+    // thresholds, every variable is relinearized on every update. Beacons (with estimate_beacons) use
+    // the pose threshold.
+    double relinearize_threshold_pose = 0.0;      // rad and m (tangent space)
+    double relinearize_threshold_velocity = 0.0;  // m/s
+    double relinearize_threshold_bias = 0.0;
+    int relinearize_skip = 1;
+
+    // NOTE(milo): Smart factors don't work with cached linearized factors (see ResetSmoother()), so
+    // only turn this on without use_smart_stereo_factors.
+    bool cache_linearized_factors = false;
+
+    // Scale the relinearization thresholds up when iSAM2 updates are over budget, and back down when
+    // there's headroom (see vio/relinearization_policy.hpp).
+    bool adaptive_relinearization = false;
+    RelinearizationPolicy::Params relinearization_policy_params;
+
+    // Threads for iSAM2 linearization and elimination (zero = all CPUs). Only used in a build with
+    // BM_SMOOTHER_USE_TBB, otherwise GTSAM decides (serial, unless GTSAM itself was built with TBB).
+    int num_threads = 1;
     bool use_smart_stereo_factors = true;
 
+    // Constrain roll and pitch with the accelerometer's gravity direction, when the vehicle is close
+    // to unaccelerated over a keypose (see AttitudeMeasurement).
+    bool use_attitude_factor = false;
+
+    // Only this many landmarks (per keypose) get a new or updated smart factor, chosen by track
+    // length and parallax (see vio/landmark_budget.hpp). Zero = no limit.
+    int max_lmks_per_keypose = 40;
+    int lmk_min_track_length = 3;         // Keyposes, a landmark needs this many to get a factor.
+    double lmk_parallax_weight = 0.05;    // Score per pixel of parallax (vs. one keypose of track length).
+
+    // Smart factors keep their triangulated point until the camera poses move by more than this.
+    double lmk_retriangulation_threshold = 1e-3;
+
+    // Marginal covariances can cost as much as the iSAM2 update itself. If deferred, Update() returns
+    // right away with the last covariance, and UpdateMarginalCovariance() should be called after the
+    // result has been used. Covariances are only recomputed every N keyposes (1 means every one).
+    bool defer_marginal_covariance = false;
+    int marginal_covariance_every_n = 1;
+
     DiagModel::shared_ptr pose_prior_noise_model = DiagModel::Sigmas(
         (gtsam::Vector(6) << 0.1, 0.1, 0.1, 0.3, 0.3, 0.3).finished());
 
@@ -69,11 +153,19 @@ class FixedLagSmoother final {
     IsoModel::shared_ptr range_noise_model = IsoModel::Sigma(1, 0.5);
     IsoModel::shared_ptr beacon_noise_model = IsoModel::Sigma(3, 0.01);
 
+    // Ranges are to beacons at known points (one unary factor each). If the beacon positions are
+    // uncertain, this gives each beacon one variable, with a beacon_noise_model prior, instead.
+    bool estimate_beacons = false;
+
     double mag_scale_factor = 1.0;                  // Scales a unit field direction into field units (e.g, nT or uT).
     Vector3d mag_local_field = Vector3d(0, 0, 1);   // Direction (unit vector) of local magnetic field.
     Vector3d mag_sensor_bias = Vector3d::Zero();    // Additive bias of the magnetometer.
     IsoModel::shared_ptr mag_noise_model = IsoModel::Sigma(3, 1.0);
 
+    // Absolute pose from an AprilTag (see TagLocalizer), with a robust loss on top.
+    DiagModel::shared_ptr tag_pose_noise_model = DiagModel::Sigmas(
+        (gtsam::Vector(6) << 0.05, 0.05, 0.05, 0.1, 0.1, 0.1).finished());
+
     gtsam::Pose3 body_P_imu = gtsam::Pose3::identity();
     gtsam::Pose3 body_P_cam = gtsam::Pose3::identity();
     gtsam::Pose3 body_P_receiver = gtsam::Pose3::identity();
@@ -82,10 +174,52 @@ class FixedLagSmoother final {
 
     StereoCamera stereo_rig;
 
+    // Calibration of the other stereo rigs whose landmarks can be added to keyposes (see Update()).
+    // NOTE(milo): Not loaded from this params subtree, the StateEstimator sets these.
+    AuxStereoRigs aux_stereo_rigs;
+
    private:
     void LoadParams(const YamlParser& parser) override;
   };
 
+  // Factor counts and timing from the last Update().
+  struct UpdateStats final
+  {
+    int num_factors = 0;              // All factors in the smoother's graph.
+    int num_lmk_factors = 0;          // Smart stereo factors in the smoother's graph.
+    int num_lmk_observed = 0;         // Landmarks observed at the newest keypose.
+    int num_aux_lmk_observed = 0;     // ... and how many of them were from the aux rigs.
+    int num_lmk_factors_added = 0;    // Smart factors added (or rebuilt with new observations).
+    int num_lmk_factors_removed = 0;  // Smart factors removed (including ones that were rebuilt).
+    int num_extra_iters = 0;
+    int num_keyposes_added = 0;       // More than one if a backlog was added at once (see UpdateBatch()).
+    double isam_update_ms = 0;        // The first iSAM2 update, with all of the new factors.
+    int num_relinearized = 0;         // Variables that the first iSAM2 update relinearized.
+    double relinearize_scale = 1.0;   // See RelinearizationPolicy.
+    double total_update_ms = 0;       // Everything, including extra iters (but not covariance).
+
+    // Memory: these should stay flat once the window is full.
+    int num_keyposes = 0;             // Keyposes in the window.
+    int num_values = 0;               // Variables in the window.
+    int num_factor_slots = 0;         // Live and removed factors that iSAM2 is holding on to.
+    int num_lmk_tracks = 0;
+    int num_lmk_track_obs = 0;        // Stored observations, across all landmark tracks.
+    bool compacted = false;           // Whether the smoother was rebuilt to free up factor slots.
+  };
+
+  // Everything that Update() takes for one keypose.
+  struct KeyposeMeasurements final
+  {
+    VoResult::ConstPtr vo;
+    PimResult::ConstPtr pim;
+    DepthMeasurement::ConstPtr depth;
+    AttitudeMeasurement::ConstPtr attitude;
+    MultiRange ranges;
+    MagMeasurement::ConstPtr mag;
+    TagPoseMeasurement::ConstPtr tag_pose;
+    std::vector<VoResult::ConstPtr> aux_vo;
+  };
+
   // Construct with parameters.
   FixedLagSmoother(const Params& params);
 
@@ -103,6 +237,14 @@ class FixedLagSmoother final {
                   const ImuBias& imu_bias,
                   bool imu_available);
 
+  /**
+   * Initialize the smoother at timestamp from an earlier estimate (e.g a checkpoint from before a
+   * restart). Unlike the Initialize() above, the priors are centered on the estimated velocity and
+   * bias, and use its marginal covariances instead of the prior noise models, so the smoother
+   * doesn't have to re-converge. Also uses IMU if the estimate had an IMU state.
+   */
+  void Initialize(seconds_t timestamp, const SmootherResult& estimate);
+
   /**
    * Update the graph with a variety of measurements. A new keypose is added and constrained based
    * on the available sensor data. If VO is unavailable, a preintegrated IMU measurement is expected
@@ -112,8 +254,11 @@ class FixedLagSmoother final {
    * @param pim_result Preintegrated IMU measurement, timestamp alignment should be handled by user.
    * @param maybe_depth_ptr Barometer depth measurement.
    * @param maybe_attitude_ptr Measurement of the gravity vector in the body frame.
-   * @param maybe_ranges A flexible number of range measurements, depending on the number of beacons.
+   * @param maybe_ranges Range measurements, from any number of beacons.
    * @param maybe_mag_ptr Magnetometer measurement.
+   * @param maybe_tag_pose_ptr Absolute pose of the body from an AprilTag.
+   * @param maybe_aux_vo Keyframes from the aux stereo rigs that line up with this keypose, one
+   *                     (or nullptr) per rig. Only their landmarks are used, not their odometry.
    * @return Smoothed state estimate at the newly added keypose.
    */
   SmootherResult Update(VoResult::ConstPtr maybe_vo_ptr,
@@ -121,36 +266,149 @@ class FixedLagSmoother final {
                         DepthMeasurement::ConstPtr maybe_depth_ptr = nullptr,
                         AttitudeMeasurement::ConstPtr maybe_attitude_ptr = nullptr,
                         const MultiRange& maybe_ranges = MultiRange(),
-                        MagMeasurement::ConstPtr maybe_mag_ptr = nullptr);
+                        MagMeasurement::ConstPtr maybe_mag_ptr = nullptr,
+                        TagPoseMeasurement::ConstPtr maybe_tag_pose_ptr = nullptr,
+                        const std::vector<VoResult::ConstPtr>& maybe_aux_vo = std::vector<VoResult::ConstPtr>());
 
-  // Threadsafe access to the latest result.
-  SmootherResult GetResult();
+  /**
+   * Same as Update(), but adds several keyposes (oldest first) in one iSAM2 update, e.g to catch up
+   * when measurements have piled up. The extra smoothing iters run once for the whole batch, and
+   * only the newest keypose gets a marginal covariance (the others carry the last one over).
+   *
+   * @return Smoothed state estimate at each of the new keyposes, in the same order.
+   */
+  std::vector<SmootherResult> UpdateBatch(const std::vector<KeyposeMeasurements>& keyposes);
+
+  // Threadsafe access to the latest result. Never waits on the thread that is updating the smoother.
+  SmootherResult GetResult() const;
+
+  /**
+   * Compute the marginal covariance of the latest keypose and store it in the result. Does nothing
+   * if it's already up to date, or if fewer than marginal_covariance_every_n keyposes have been
+   * added since the last time (unless force is true). Returns whether the covariance was computed.
+   *
+   * NOTE(milo): This uses the underlying iSAM2 smoother, so call it from the same thread as Update().
+   */
+  bool UpdateMarginalCovariance(bool force = false);
+
+  // NOTE(milo): Not threadsafe, call this from the same thread as Update().
+  const UpdateStats& GetUpdateStats() const { return stats_; }
+
+  // Change how hard Update() works on extra smoothing iters (e.g when params are reloaded). Takes
+  // effect on the next Update(). If smoothing_convergence_rel_tol was zero on construction, the
+  // error isn't evaluated, so turning it on here only stops early when nothing was relinearized.
+  // NOTE(milo): Not threadsafe, call this from the same thread as Update().
+  void SetSmoothingBudget(int extra_smoothing_iters,
+                          double smoothing_convergence_rel_tol,
+                          double smoothing_time_budget_ms);
+
+  // Change how often marginal covariances are computed (see marginal_covariance_every_n), e.g to
+  // shed load. NOTE(milo): Not threadsafe, call this from the same thread as Update().
+  void SetMarginalCovarianceEveryN(int marginal_covariance_every_n);
 
  private:
   // A central place to allocate new "keypose" ids. They are called "keyposes" because they could
   // come from vision OR other data sources (e.g acoustic localization).
   void ResetKeyposeId() { next_kf_id_ = 0; }
+
+  // Starts a new graph with priors on the first pose (and velocity and bias, if imu_available).
+  void InitializeWithPriors(seconds_t timestamp,
+                            const gtsam::Pose3& world_P_body,
+                            const gtsam::Vector3& world_v_body,
+                            const ImuBias& imu_bias,
+                            bool imu_available,
+                            const GaussianModel::shared_ptr& pose_prior_noise_model,
+                            const gtsam::Vector3& velocity_prior,
+                            const GaussianModel::shared_ptr& velocity_prior_noise_model,
+                            const ImuBias& bias_prior,
+                            const GaussianModel::shared_ptr& bias_prior_noise_model);
+
   uid_t GetNextKeyposeId() { return next_kf_id_++; }
   uid_t GetPrevKeyposeId() { return next_kf_id_ - 1; }
 
+  // Factors and variables for the keyposes that go into the next iSAM2 update.
+  struct PendingUpdate final
+  {
+    gtsam::NonlinearFactorGraph new_factors;
+    gtsam::Values new_values;
+    gtsam::IncrementalFixedLagSmoother::KeyTimestampMap new_timestamps;
+
+    // NOTE(milo): IncrementalFixedLagSmoother doesn't let us tell iSAM2 that an existing smart
+    // factor now involves more keys, so smart factors that get a new observation are removed and
+    // re-added. Map: index in new_factors => lmk_id.
+    std::map<size_t, uid_t> new_factor_lmk_ids;
+    gtsam::FactorIndices factors_to_remove;
+
+    SmootherResult last;                  // The smoother's result, then the guess at each new keypose.
+    std::vector<SmootherResult> guesses;  // Initial guess at each new keypose (oldest first).
+  };
+
+  // Adds the factors and variables for one more keypose to pending.
+  void AddKeypose(const KeyposeMeasurements& keypose, PendingUpdate& pending);
+
+  // Updates the smoother with everything in pending, and returns the result at each new keypose.
+  std::vector<SmootherResult> CommitUpdate(PendingUpdate& pending);
+
   // Reinitialize the smoother, which clears any stored graph structure / factors.
   void ResetSmoother();
 
+  // Runs fn (which should update smoother_) on the smoother's num_threads threads.
+  void RunWithSmootherThreads(const std::function<void()>& fn);
+
+  // Rebuilds the smoother with only its live factors (and the current estimate), to get rid of the
+  // slots left behind by removed factors. This is also how new relinearization thresholds are applied.
+  void CompactSmoother();
+
+  // The "time" that the smoother marginalizes by, and the length of its window in those units. This
+  // is the keypose time, unless the window is bounded by keypose count (then it's the keypose id).
+  seconds_t WindowTime(uid_t keypose_id, seconds_t keypose_time) const;
+  double WindowLag() const;
+
+  // Adds the landmarks observed at a new keypose (by any rig) to their tracks, and drops observations
+  // from keyposes that are about to leave the lag. Smart factors that need to change are appended to
+  // new_factors (their ids to new_factor_lmk_ids), and their old versions to factors_to_remove (or
+  // cleared out of new_factors, if they were added for an earlier keypose in the same update).
+  void UpdateLandmarkFactors(uid_t keypose_id,
+                             VoResult::ConstPtr maybe_vo_ptr,
+                             const std::vector<VoResult::ConstPtr>& maybe_aux_vo,
+                             gtsam::NonlinearFactorGraph& new_factors,
+                             std::map<size_t, uid_t>& new_factor_lmk_ids,
+                             gtsam::FactorIndices& factors_to_remove);
+
+  // Makes a smart factor from all of the observations in a track.
+  SmartStereoFactor::shared_ptr MakeStereoFactor(const LandmarkTrack& track) const;
+
+  // Beacons are told apart by their (nominal) position. Returns the id of the one at world_t_beacon,
+  // and gives it a new id if it hasn't been seen before.
+  uid_t BeaconId(const Vector3d& world_t_beacon);
+
  private:
   Params params_;
   StereoCamera stereo_rig_;
 
   uid_t next_kf_id_ = 0;
 
-  std::mutex result_lock_;
+  // NOTE(milo): result_ is only touched by the thread that updates the smoother. Other threads read
+  // the copy in published_result_, which is updated after every change to result_.
   SmootherResult result_;
+  SeqLock<SmootherResult> published_result_;
   gtsam::IncrementalFixedLagSmoother smoother_;
+  std::unique_ptr<RelinearizationPolicy> relinearization_policy_;   // Only with adaptive_relinearization.
+
+#ifdef BM_SMOOTHER_USE_TBB
+  std::unique_ptr<tbb::task_arena> arena_;
+#endif
 
-  LmkToFactorMap lmk_to_factor_map_;
-  SmartStereoFactorMap stereo_factors_;
+  LandmarkTrackMap lmk_tracks_;
+  std::map<uid_t, seconds_t> keypose_times_;    // Window times of keyposes that haven't been marginalized yet.
+  std::map<timestamp_t, uid_t> vo_keypose_ids_; // Keyposes from VO keyframes (by image timestamp), also not marginalized yet.
+  std::vector<Vector3d> beacon_points_;         // Nominal position of each beacon, by id (with estimate_beacons).
+  int num_lmk_factors_ = 0;
+  UpdateStats stats_;
 
   gtsam::SmartProjectionParams lmk_stereo_factor_params_;
   gtsam::Cal3_S2Stereo::shared_ptr cal3_stereo_;
+  std::vector<gtsam::Cal3_S2Stereo::shared_ptr> aux_cal3_stereo_;   // One per aux rig.
 
   Axis3 depth_axis_ = Axis3::Y;
   double depth_sign_ = 1.0;
@@ -9,6 +9,7 @@ void ImuManager::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("max_queue_size", &max_queue_size);
   parser.GetParam("integration_error_sigma", &integration_error_sigma);
   parser.GetParam("use_2nd_order_coriolis", &use_2nd_order_coriolis);
+  parser.GetParam("incremental", &incremental);
 
   parser.GetParam("/shared/imu0/noise_model/accel_noise_sigma", &accel_noise_sigma);
   parser.GetParam("/shared/imu0/noise_model/gyro_noise_sigma", &gyro_noise_sigma);
@@ -50,6 +51,92 @@ ImuManager::ImuManager(const Params& params, const std::string& queue_name)
   // pim_params_.print();
 
   pim_ = PimC(boost::make_shared<PimC::Params>(pim_params_)); // Initialize with zero bias.
+  running_pim_ = pim_;
+  popped_.reserve(params_.max_queue_size);
+}
+
+
+// Integrate one measurement, assuming that it was constant since prev_time_sec (GTSAM's convention).
+static void IntegrateMeasurement(PimC& pim, const ImuMeasurement& imu, seconds_t& prev_time_sec)
+{
+  const seconds_t t = ConvertToSeconds(imu.timestamp);
+  const seconds_t dt = t - prev_time_sec;
+  CHECK(dt >= 0);
+  if (dt > 0) { pim.integrateMeasurement(imu.a, imu.w, dt); }
+  prev_time_sec = t;
+}
+
+
+// Linearly interpolate a pseudo-measurement at time t, where a.timestamp <= t <= b.timestamp.
+static ImuMeasurement InterpolateImu(const ImuMeasurement& a, const ImuMeasurement& b, seconds_t t)
+{
+  const seconds_t ta = ConvertToSeconds(a.timestamp);
+  const seconds_t tb = ConvertToSeconds(b.timestamp);
+  const double alpha = (tb > ta) ? (t - ta) / (tb - ta) : 0.0;
+
+  ImuMeasurement out(ConvertToNanoseconds(t), a.w + alpha * (b.w - a.w), a.a + alpha * (b.a - a.a));
+  out.latency = b.latency;
+  return out;
+}
+
+
+void ImuManager::Push(const ImuMeasurement& imu)
+{
+  running_lock_.lock();
+  DataManager<ImuMeasurement>::Push(imu);
+  if (params_.incremental) {
+    ExtendNoLock(imu);
+  }
+  running_lock_.unlock();
+}
+
+
+void ImuManager::PushBatch(const ImuMeasurement* imu, size_t N)
+{
+  running_lock_.lock();
+  DataManager<ImuMeasurement>::PushBatch(imu, N);
+  if (params_.incremental) {
+    for (size_t i = 0; i < N; ++i) {
+      ExtendNoLock(imu[i]);
+    }
+  }
+  running_lock_.unlock();
+}
+
+
+void ImuManager::ExtendNoLock(const ImuMeasurement& imu)
+{
+  if (!running_started_ || ConvertToSeconds(imu.timestamp) <= running_start_time_) {
+    return;
+  }
+
+  IntegrateMeasurement(running_pim_, imu, running_prev_time_);
+  running_history_.emplace_back(imu, running_pim_);
+
+  // If Preintegrate() isn't being called, stop until it is, rather than growing without bound.
+  if (running_history_.size() > (size_t)params_.max_queue_size) {
+    running_started_ = false;
+    running_history_.clear();
+  }
+}
+
+
+void ImuManager::RestartNoLock(seconds_t start_time)
+{
+  RunningPimHistory history;
+  history.swap(running_history_);
+
+  running_started_ = true;
+  running_start_time_ = start_time;
+  running_prev_time_ = start_time;
+  running_pim_.resetIntegrationAndSetBias(pim_.biasHat());
+
+  // Measurements after start_time belong to the next window.
+  for (const RunningPim& item : history) {
+    if (item.time > start_time) {
+      ExtendNoLock(item.imu);
+    }
+  }
 }
 
 
@@ -57,21 +144,42 @@ PimResult ImuManager::Preintegrate(seconds_t from_time,
                                    seconds_t to_time,
                                    seconds_t allowed_misalignment_sec)
 {
-  pim_.resetIntegration();
+  running_lock_.lock();
+  const PimResult result = PreintegrateNoLock(from_time, to_time, allowed_misalignment_sec);
 
+  // The next window starts where this one ended.
+  if (result.timestamps_aligned) {
+    last_to_time_ = to_time;
+    if (params_.incremental) {
+      RestartNoLock(to_time);
+    }
+  }
+  running_lock_.unlock();
+
+  return result;
+}
+
+
+PimResult ImuManager::PreintegrateNoLock(seconds_t from_time,
+                                         seconds_t to_time,
+                                         seconds_t allowed_misalignment_sec)
+{
   // If no measurements, return failure.
   if (Empty()) {
     LOG(WARNING) << "PimResult invalid: queue is empty" << std::endl;
     return std::move(PimResult(false, kMinSeconds, kMaxSeconds));
   }
 
+  // The previous window ended at exactly from_time, so there's no gap to check for at the start.
+  const bool continues_window = (from_time != kMinSeconds) && (from_time == last_to_time_);
+
   // Requesting a from_time that is too far before our earliest measurement.
-  if (Oldest() > (from_time + allowed_misalignment_sec) && (from_time != kMinSeconds)) {
+  if (!continues_window && Oldest() > (from_time + allowed_misalignment_sec) && (from_time != kMinSeconds)) {
     LOG(WARNING) << "PimResult invalid: Oldest() measurement way past from_time" << std::endl;
     return PimResult(false, kMinSeconds, kMaxSeconds);
   }
 
-  // Requesting a to_time that is too far after our newest measurement.
+  // Requesting a to_time that is too far after our newest measurement (it can't be interpolated).
   if (Newest() < (to_time - allowed_misalignment_sec) && (to_time != kMaxSeconds)) {
     LOG(WARNING) << "PimResult invalid: Newest() measurement way before to_time" << std::endl;
     return PimResult(false, kMinSeconds, kMaxSeconds);
@@ -82,52 +190,82 @@ PimResult ImuManager::Preintegrate(seconds_t from_time,
     DiscardBefore(from_time);
   }
 
+  // FAIL: No measurements near the window at all (leave the later ones for the next window).
+  if (Empty() || (Oldest() > (to_time + allowed_misalignment_sec) && to_time != kMaxSeconds)) {
+    LOG(WARNING) << "PimResult invalid: no measurements between from_time and to_time" << std::endl;
+    return PimResult(false, kMinSeconds, kMaxSeconds);
+  }
+
   ImuMeasurement imu = Pop();
   const seconds_t earliest_imu_sec = ConvertToSeconds(imu.timestamp);
 
   // FAIL: No measurement close to (specified) from_time.
   const seconds_t offset_from_sec = (from_time != kMinSeconds) ? std::fabs(earliest_imu_sec - from_time) : 0.0;
-  if (offset_from_sec > allowed_misalignment_sec) {
+  if (!continues_window && offset_from_sec > allowed_misalignment_sec) {
     LOG(WARNING) << "PimResult invalid: no measurements near from_time" << std::endl;
     return PimResult(false, kMinSeconds, kMaxSeconds);
   }
 
   const ImuMeasurement from_imu = imu;  // Copy.
 
-  // Assume CONSTANT acceleration between from_time and nearest IMU measurement.
-  // https://github.com/borglab/gtsam/blob/develop/gtsam/navigation/CombinedImuFactor.cpp
-  // NOTE(milo): There is a divide by dt in the source code.
-  if (offset_from_sec > 0) {
-    pim_.integrateMeasurement(imu.a, imu.w, offset_from_sec);
-  }
-
-  // Integrate all measurements <= to_time.
-  seconds_t prev_imu_time_sec = earliest_imu_sec;
+  // Pop all measurements <= to_time.
+  popped_.clear();
+  popped_.emplace_back(imu);
   while (!Empty() && Oldest() <= to_time) {
     imu = Pop();
-    const seconds_t dt = ConvertToSeconds(imu.timestamp) - prev_imu_time_sec;
-    CHECK(dt >= 0);
-    if (dt > 0) { pim_.integrateMeasurement(imu.a, imu.w, dt); }
-    prev_imu_time_sec = ConvertToSeconds(imu.timestamp);
+    popped_.emplace_back(imu);
   }
 
   const seconds_t latest_imu_sec = ConvertToSeconds(imu.timestamp);
-
-  // FAIL: No measurement close to (specified) to_time.
   const seconds_t offset_to_sec = (to_time != kMaxSeconds) ? std::fabs(to_time - latest_imu_sec) : 0.0;
-  if (offset_to_sec > allowed_misalignment_sec) {
+
+  // If there's a measurement after to_time, interpolate one at exactly to_time. It's left in the
+  // queue for the next window. Otherwise, the newest measurement is held until to_time, which FAILS
+  // if it's too far away.
+  ImuMeasurement to_imu = imu;
+  if (latest_imu_sec < to_time && !Empty()) {
+    to_imu = InterpolateImu(imu, PeekOldest(), to_time);
+  } else if (offset_to_sec > allowed_misalignment_sec) {
     LOG(WARNING) << "PimResult invalid: no measurements near to_time" << std::endl;
     return PimResult(false, kMinSeconds, kMaxSeconds);
   }
 
-  const ImuMeasurement to_imu = imu;
+  // If the running preintegration started at from_time, it already contains exactly the popped
+  // measurements, so just take a snapshot after the last one.
+  const size_t N = popped_.size();
+  const bool use_running = params_.incremental &&
+                           running_started_ &&
+                           running_start_time_ == from_time &&
+                           running_history_.size() >= N &&
+                           running_history_.front().time == earliest_imu_sec &&
+                           running_history_.at(N - 1).time == latest_imu_sec;
 
-  // Assume CONSTANT acceleration between to_time and nearest IMU measurement.
+  if (use_running) {
+    pim_ = running_history_.at(N - 1).pim;
+
+  } else {
+    pim_.resetIntegration();
+
+    // Assume CONSTANT acceleration between from_time and nearest IMU measurement.
+    // https://github.com/borglab/gtsam/blob/develop/gtsam/navigation/CombinedImuFactor.cpp
+    // NOTE(milo): There is a divide by dt in the source code.
+    seconds_t prev_imu_time_sec = (from_time != kMinSeconds) ? from_time : earliest_imu_sec;
+    for (const ImuMeasurement& item : popped_) {
+      IntegrateMeasurement(pim_, item, prev_imu_time_sec);
+    }
+  }
+
+  // The last measurement (or the interpolated one) is constant from latest_imu_sec to to_time.
   if (offset_to_sec > 0) {
-    pim_.integrateMeasurement(imu.a, imu.w, offset_to_sec);
+    pim_.integrateMeasurement(to_imu.a, to_imu.w, offset_to_sec);
+  }
+
+  PimResult result(true, from_time, to_time, pim_, from_imu, to_imu);
+  for (const ImuMeasurement& item : popped_) {
+    result.accel.Add(item.a);
   }
 
-  return PimResult(true, from_time, to_time, pim_, from_imu, to_imu);
+  return result;
 }
 
 
@@ -1,11 +1,16 @@
 #pragma once
 
+#include <deque>
+#include <mutex>
+#include <vector>
+
 #include "params/params_base.hpp"
 #include "core/macros.hpp"
 #include "core/imu_measurement.hpp"
 #include "core/uid.hpp"
 #include "core/data_manager.hpp"
 #include "vio/noise_model.hpp"
+#include "vio/sample_average.hpp"
 
 #include <gtsam/navigation/ImuFactor.h>
 #include <gtsam/navigation/CombinedImuFactor.h>
@@ -47,9 +52,13 @@ struct PimResult final
   seconds_t to_time;
   PimC pim;
 
-  // Stores the first and last measurements used during preintegration.
+  // Stores the first and last measurements used during preintegration. The last one is interpolated
+  // at exactly to_time if there was a measurement after it (see ImuManager::Preintegrate()).
   ImuMeasurement from_imu;
   ImuMeasurement to_imu;
+
+  // All of the accelerometer measurements used during preintegration (in the IMU frame).
+  SampleAverage accel;
 };
 
 
@@ -70,6 +79,10 @@ class ImuManager final : public DataManager<ImuMeasurement> {
     double integration_error_sigma = 1e-4;
     bool use_2nd_order_coriolis = false;
 
+    // Keep a running preintegration that is extended as each measurement arrives, so that
+    // Preintegrate() just takes a snapshot instead of integrating the whole window (see below).
+    bool incremental = false;
+
     // Direction of the gravity vector in the world frame.
     // NOTE(milo): Right now, we use a RDF frame for the IMU, so gravity is +y.
     gtsam::Vector3 n_gravity = gtsam::Vector3(0, 9.81, 0); // m/s^2
@@ -86,23 +99,86 @@ class ImuManager final : public DataManager<ImuMeasurement> {
   // Construct with options that control the noise model.
   explicit ImuManager(const Params& params, const std::string& queue_name = "");
 
+  // Add a measurement to the queue. In incremental mode, this also extends the running
+  // preintegration (once Preintegrate() has been called for the first time).
+  void Push(const ImuMeasurement& imu);
+
+  // Same as calling Push() for each of N measurements (oldest first), but under one lock.
+  void PushBatch(const ImuMeasurement* imu, size_t N);
+
   // Preintegrate queued IMU measurements, optionally within a time range [from_time, to_time].
   // If not time range is given, all available result are integrated. Integration is reset inside
   // of this function once all IMU measurements are incorporated. Internally, GTSAM converts raw
   // IMU measurements into body frame measurements using body_P_sensor.
   // NOTE(milo): All measurements up to the to_time are removed from the queue!
+  //
+  // The window ends at exactly to_time: if there's a measurement after it, a pseudo-measurement is
+  // interpolated at to_time, and that always counts as aligned. allowed_misalignment_sec only
+  // limits how far the newest measurement is extrapolated when the IMU hasn't caught up to to_time,
+  // and how far the first measurement can be from from_time. If from_time is the to_time of the
+  // previous call, that window already ended exactly there, so the start is always aligned too.
+  //
+  // In incremental mode, if from_time is the to_time of the previous call, the running
+  // preintegration already covers the window, and it's snapshotted in O(1). The measurements after
+  // to_time are then re-integrated to start the next window. Otherwise, this falls back to
+  // integrating the popped measurements from scratch.
   PimResult Preintegrate(seconds_t from_time = kMinSeconds,
                          seconds_t to_time = kMaxSeconds,
                          seconds_t allowed_misalignment_sec = 0.1);
 
 
   // Call this after getting a new bias estimate from the smoother update.
+  // NOTE(milo): In incremental mode, the window that is currently being integrated keeps its old
+  // bias. The CombinedImuFactor corrects for the difference to first order, so it isn't redone.
   void ResetAndUpdateBias(const ImuBias& bias);
 
+ private:
+  // A measurement, and the running preintegration right after integrating it.
+  struct RunningPim final
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    explicit RunningPim(const ImuMeasurement& imu, const PimC& pim)
+        : time(ConvertToSeconds(imu.timestamp)), imu(imu), pim(pim) {}
+
+    seconds_t time;
+    ImuMeasurement imu;
+    PimC pim;
+  };
+
+  typedef std::deque<RunningPim, Eigen::aligned_allocator<RunningPim>> RunningPimHistory;
+
+  PimResult PreintegrateNoLock(seconds_t from_time,
+                               seconds_t to_time,
+                               seconds_t allowed_misalignment_sec);
+
+  // Integrate imu into the running preintegration, if it's started.
+  void ExtendNoLock(const ImuMeasurement& imu);
+
+  // Start a new running preintegration at start_time, and integrate any measurements after it.
+  void RestartNoLock(seconds_t start_time);
+
  private:
   Params params_;
   PimC::Params pim_params_;
   PimC pim_;
+
+  // End of the last aligned window. The next window can start here even if there's a gap in the
+  // measurements, since the previous one covered up to exactly this time.
+  seconds_t last_to_time_ = kMinSeconds;
+
+  // Measurements popped by the current Preintegrate() call (kept to avoid reallocating).
+  std::vector<ImuMeasurement, Eigen::aligned_allocator<ImuMeasurement>> popped_;
+
+  // Running preintegration state (incremental mode only). The lock is held for all of Push() and
+  // Preintegrate(), so that the queue and the running preintegration always contain the same
+  // measurements.
+  std::mutex running_lock_;
+  bool running_started_ = false;
+  seconds_t running_start_time_ = kMinSeconds;
+  seconds_t running_prev_time_ = kMinSeconds;
+  PimC running_pim_;
+  RunningPimHistory running_history_;
 };
 
 
@@ -1,40 +1,60 @@
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/StdVector>
+
+#include <glog/logging.h>
 
 namespace bm {
 namespace vio {
 
 
 // Stores an ordered "history" of items based on a key (could be a timestamp or an id).
+//
+// NOTE(milo): Items are kept in one contiguous, key-sorted buffer, and lookups are a binary search.
+// Items are almost always added in increasing key order, which is just an append. Discarded items
+// are skipped over (begin_ moves forward), and the buffer is compacted once the dead prefix is as
+// large as the live part, so after warmup nothing gets allocated (see TimeIndexedDataManager).
 template <typename Key, typename Item>
 class ItemHistory final {
  public:
-  typedef std::map<Key, Item> Map;
-
-  ItemHistory() = default;
+  // If max_size > 0, the oldest item is discarded whenever the history grows past max_size.
+  explicit ItemHistory(size_t max_size = 0)
+      : max_size_(max_size)
+  {
+    keys_.reserve(2 * max_size_);
+    items_.reserve(2 * max_size_);
+  }
 
   Key NewestKey() const
   {
     CHECK(!Empty()) << "Cannot get NewestKey() for empty history" << std::endl;
-    return key_to_item_map_.rbegin()->first;
+    return keys_.back();
   }
 
   Key OldestKey() const
   {
     CHECK(!Empty()) << "Cannot get OldestKey() for empty history" << std::endl;
-    return key_to_item_map_.begin()->first;
+    return keys_.at(begin_);
   }
 
-  size_t Size() const { return key_to_item_map_.size(); }
-  bool Empty() const { return key_to_item_map_.empty(); }
-  bool Exists(Key k) const { return key_to_item_map_.count(k) > 0; }
+  size_t Size() const { return keys_.size() - begin_; }
+  bool Empty() const { return Size() == 0; }
+  bool Exists(Key k) const
+  {
+    const size_t i = LowerBound(k);
+    return i < keys_.size() && keys_.at(i) == k;
+  }
 
   // Return the item at key k.
-  Item at(Key k) const
+  const Item& at(Key k) const
   {
-    if (key_to_item_map_.count(k) == 0) {
-      if (key_to_item_map_.size() == 0) {
+    if (!Exists(k)) {
+      if (Empty()) {
         throw std::runtime_error("Tried to at(key) but the map is empty!");
       } else {
         const std::string msg = std::string("Tried to at(key) that doesn't exist.") +
@@ -44,21 +64,70 @@ class ItemHistory final {
         throw std::runtime_error(msg);
       }
     }
-    return key_to_item_map_.at(k);
+    return items_.at(LowerBound(k));
   }
 
-  void Update(Key k, const Item& item) { key_to_item_map_.emplace(k, std::move(item)); }
+  // Add an item at key k. Like std::map::emplace, an existing item at k is NOT replaced.
+  void Update(Key k, const Item& item)
+  {
+    if (begin_ > 0 && begin_ >= Size()) {
+      Compact();
+    }
+
+    if (Empty() || k > keys_.back()) {
+      keys_.emplace_back(k);
+      items_.emplace_back(item);
+    } else {
+      const size_t i = LowerBound(k);
+      if (keys_.at(i) == k) {
+        return;
+      }
+      keys_.insert(keys_.begin() + i, k);
+      items_.insert(items_.begin() + i, item);
+    }
+
+    if (max_size_ > 0 && Size() > max_size_) {
+      ++begin_;
+    }
+  }
 
   // Discard all items *before* (but not equal to) the key k.
   void DiscardBefore(Key k)
   {
-    // https://stackoverflow.com/questions/22874535/dependent-scope-need-typename-in-front
-    typename Map::const_iterator it_first_item_gt_k = key_to_item_map_.lower_bound(k);
-    key_to_item_map_.erase(key_to_item_map_.begin(), it_first_item_gt_k);
+    begin_ = LowerBound(k);
+    if (Empty()) {
+      Clear();
+    }
   }
 
  private:
-  Map key_to_item_map_;
+  // Index of the first live item with key >= k.
+  size_t LowerBound(Key k) const
+  {
+    return std::lower_bound(keys_.begin() + begin_, keys_.end(), k) - keys_.begin();
+  }
+
+  // Remove the dead prefix of the buffer.
+  void Compact()
+  {
+    keys_.erase(keys_.begin(), keys_.begin() + begin_);
+    items_.erase(items_.begin(), items_.begin() + begin_);
+    begin_ = 0;
+  }
+
+  void Clear()
+  {
+    keys_.clear();
+    items_.clear();
+    begin_ = 0;
+  }
+
+ private:
+  size_t max_size_;
+
+  std::vector<Key> keys_;   // Kept separate from items_ so that binary search is cache-friendly.
+  std::vector<Item, Eigen::aligned_allocator<Item>> items_;
+  size_t begin_ = 0;        // Index of the oldest live item.
 };
 
 
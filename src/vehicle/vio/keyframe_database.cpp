@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <climits>
+
+#include <glog/logging.h>
+
+#include <opencv2/features2d.hpp>
+
+#include "core/profiler.hpp"
+#include "core/transform_util.hpp"
+#include "vio/keyframe_database.hpp"
+
+namespace bm {
+namespace vio {
+
+
+static const int kOrbPatchSize = 31;
+
+// Each descriptor is filed under this many words, each made of 16 of its bits. A true match keeps
+// all 16 bits of a word fairly often, while two random descriptors rarely share one.
+static const int kNumWords = 2;
+
+
+static uint32_t DescriptorWord(const cv::Mat& descriptors, int row, int w)
+{
+  const uint8_t* d = descriptors.ptr<uint8_t>(row);
+  return (static_cast<uint32_t>(w) << 16) | (static_cast<uint32_t>(d[2*w]) << 8) | static_cast<uint32_t>(d[2*w + 1]);
+}
+
+
+KeyframeFeatures ExtractKeyframeFeatures(uid_t camera_id,
+                                         timestamp_t timestamp,
+                                         const Image1b& left_image,
+                                         const std::vector<Vector2d>& pixels,
+                                         const std::vector<double>& disps,
+                                         const StereoCamera& stereo_rig)
+{
+  MACRO_PROFILE_SCOPE("ExtractKeyframeFeatures");
+  CHECK_EQ(pixels.size(), disps.size());
+
+  KeyframeFeatures kf;
+  kf.camera_id = camera_id;
+  kf.timestamp = timestamp;
+
+  // The class_id remembers which pixel each keypoint came from, since compute() drops some.
+  std::vector<cv::KeyPoint> keypoints;
+  keypoints.reserve(pixels.size());
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    if (disps.at(i) > 0) {
+      keypoints.emplace_back(cv::Point2f((float)pixels[i].x(), (float)pixels[i].y()), kOrbPatchSize, 0.0f, 0.0f, 0, static_cast<int>(i));
+    }
+  }
+
+  const cv::Ptr<cv::ORB> orb = cv::ORB::create(500, 1.2f, 1, kOrbPatchSize, 0, 2, cv::ORB::HARRIS_SCORE, kOrbPatchSize);
+  orb->compute(left_image, keypoints, kf.descriptors);
+  CHECK_EQ(keypoints.size(), static_cast<size_t>(kf.descriptors.rows));
+
+  kf.pixels.reserve(keypoints.size());
+  kf.points.reserve(keypoints.size());
+  for (const cv::KeyPoint& kp : keypoints) {
+    const int i = kp.class_id;
+    kf.pixels.emplace_back(pixels.at(i));
+    kf.points.emplace_back(stereo_rig.LeftCamera().Backproject(pixels.at(i), stereo_rig.DispToDepth(disps.at(i))));
+  }
+
+  return kf;
+}
+
+
+KeyframeDatabase::KeyframeDatabase(const KeyframeDatabaseParams& params, const StereoCamera& stereo_rig)
+    : params_(params), stereo_rig_(stereo_rig)
+{
+  CHECK_GE(params_.max_keyframes, 1);
+  CHECK_GE(params_.max_candidates, 1);
+  CHECK_GE(params_.min_inliers, 3);
+}
+
+
+void KeyframeDatabase::Add(KeyframeFeatures&& kf)
+{
+  CHECK(keyframes_.empty() || kf.timestamp > keyframes_.back().timestamp)
+      << "Keyframes must be added in time order" << std::endl;
+
+  if ((int)keyframes_.size() >= params_.max_keyframes) {
+    RemoveOldest();
+  }
+
+  const uint64_t k = num_removed_ + keyframes_.size();
+  for (int row = 0; row < kf.descriptors.rows; ++row) {
+    for (int w = 0; w < kNumWords; ++w) {
+      index_[DescriptorWord(kf.descriptors, row, w)].emplace_back(k);
+    }
+  }
+
+  keyframes_.emplace_back(std::move(kf));
+}
+
+
+void KeyframeDatabase::RemoveOldest()
+{
+  const KeyframeFeatures& oldest = keyframes_.front();
+
+  // NOTE(milo): Postings are appended in keyframe order, so the oldest keyframe's are at the front.
+  for (int row = 0; row < oldest.descriptors.rows; ++row) {
+    for (int w = 0; w < kNumWords; ++w) {
+      const auto it = index_.find(DescriptorWord(oldest.descriptors, row, w));
+      if (it == index_.end()) {
+        continue;
+      }
+      std::vector<uint64_t>& postings = it->second;
+      const auto end = std::find_if(postings.begin(), postings.end(), [this](uint64_t k) { return k > num_removed_; });
+      postings.erase(postings.begin(), end);
+      if (postings.empty()) {
+        index_.erase(it);
+      }
+    }
+  }
+
+  keyframes_.pop_front();
+  ++num_removed_;
+}
+
+
+bool KeyframeDatabase::Query(const KeyframeFeatures& frame, Relocalization& reloc)
+{
+  MACRO_PROFILE_SCOPE("KeyframeDatabase::Query");
+
+  if (keyframes_.empty() || (int)frame.points.size() < params_.min_inliers) {
+    return false;
+  }
+
+  // Each descriptor votes once for every keyframe that it shares a word with.
+  std::vector<int> votes(keyframes_.size(), 0);
+  std::vector<int> last_voter(keyframes_.size(), -1);
+  for (int row = 0; row < frame.descriptors.rows; ++row) {
+    for (int w = 0; w < kNumWords; ++w) {
+      const auto it = index_.find(DescriptorWord(frame.descriptors, row, w));
+      if (it == index_.end()) {
+        continue;
+      }
+      for (const uint64_t k : it->second) {
+        const size_t i = static_cast<size_t>(k - num_removed_);
+        if (last_voter[i] != row) {
+          last_voter[i] = row;
+          ++votes[i];
+        }
+      }
+    }
+  }
+
+  std::vector<size_t> candidates;
+  for (size_t i = 0; i < keyframes_.size(); ++i) {
+    if (votes[i] >= params_.min_votes) {
+      candidates.emplace_back(i);
+    }
+  }
+
+  // Most votes first, newest first on a tie.
+  std::sort(candidates.begin(), candidates.end(), [&votes](size_t a, size_t b) {
+    return votes[a] > votes[b] || (votes[a] == votes[b] && a > b);
+  });
+  if ((int)candidates.size() > params_.max_candidates) {
+    candidates.resize(params_.max_candidates);
+  }
+
+  int best_inliers = 0;
+  for (const size_t i : candidates) {
+    const KeyframeFeatures& kf = keyframes_.at(i);
+    Matrix4d cur_T_kf;
+    const int num_inliers = Verify(frame, kf, cur_T_kf);
+    if (num_inliers > best_inliers) {
+      best_inliers = num_inliers;
+      reloc.camera_id_kf = kf.camera_id;
+      reloc.timestamp_kf = kf.timestamp;
+      reloc.kf_T_cam = inverse_se3(cur_T_kf);
+      reloc.num_inliers = num_inliers;
+    }
+  }
+
+  return best_inliers >= params_.min_inliers;
+}
+
+
+int KeyframeDatabase::Verify(const KeyframeFeatures& frame, const KeyframeFeatures& kf, Matrix4d& cur_T_kf)
+{
+  std::vector<Vector3d> P0_list, P1_list;
+  std::vector<Vector2d> p1_obs_list;
+
+  for (int i = 0; i < frame.descriptors.rows; ++i) {
+    int best_dist = INT_MAX, second_dist = INT_MAX;
+    int best_j = -1;
+    for (int j = 0; j < kf.descriptors.rows; ++j) {
+      const int dist = (int)cv::norm(frame.descriptors.row(i), kf.descriptors.row(j), cv::NORM_HAMMING);
+      if (dist < best_dist) {
+        second_dist = best_dist;
+        best_dist = dist;
+        best_j = j;
+      } else if (dist < second_dist) {
+        second_dist = dist;
+      }
+    }
+
+    if (best_j < 0 || best_dist > params_.max_desc_dist || best_dist > params_.max_desc_ratio * second_dist) {
+      continue;
+    }
+
+    P0_list.emplace_back(kf.points.at(best_j));
+    P1_list.emplace_back(frame.points.at(i));
+    p1_obs_list.emplace_back(frame.pixels.at(i));
+  }
+
+  if ((int)P0_list.size() < params_.min_inliers) {
+    return 0;
+  }
+
+  const std::vector<double> p1_sigma_list(P0_list.size(), params_.sigma_px);
+
+  OdometryRansacParams ransac_params;
+  ransac_params.max_error_stdevs = params_.max_error_stdevs;
+  ransac_params.min_inliers = params_.min_inliers;
+
+  std::vector<int> ransac_inliers;
+  if (RansacOdometry(P0_list, P1_list, p1_obs_list, p1_sigma_list, stereo_rig_, nullptr,
+                     ransac_params, cur_T_kf, ransac_inliers, workspace_) < 0) {
+    return 0;
+  }
+
+  // Polish the RANSAC pose (which only aligned 3D points) on the reprojection error of its inliers.
+  std::vector<Vector3d> P0_inliers;
+  std::vector<Vector2d> p1_inliers;
+  for (const int idx : ransac_inliers) {
+    P0_inliers.emplace_back(P0_list.at(idx));
+    p1_inliers.emplace_back(p1_obs_list.at(idx));
+  }
+  const std::vector<double> sigma_inliers(P0_inliers.size(), params_.sigma_px);
+
+  Matrix4d refined_T_kf = cur_T_kf;
+  Matrix6d C_cur_kf;
+  double error;
+  std::vector<int> lm_inliers, lm_outliers;
+  const int iters = OptimizeOdometryIterative(
+      P0_inliers, p1_inliers, sigma_inliers, stereo_rig_, refined_T_kf, C_cur_kf, error,
+      lm_inliers, lm_outliers, 10, 1e-3, 1e-6, params_.max_error_stdevs, workspace_);
+
+  if (iters >= 0 && (int)lm_inliers.size() >= params_.min_inliers) {
+    cur_T_kf = refined_T_kf;
+    return static_cast<int>(lm_inliers.size());
+  }
+
+  return static_cast<int>(ransac_inliers.size());
+}
+
+
+}
+}
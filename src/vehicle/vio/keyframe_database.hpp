@@ -0,0 +1,112 @@
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vio/odometry_ransac.hpp"
+#include "vio/optimize_odometry.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+struct KeyframeDatabaseParams final
+{
+  int max_keyframes = 200;        // Forget the oldest keyframes after this many.
+  int max_candidates = 3;         // Verify (at most) this many keyframes with the most index votes.
+  int min_votes = 10;             // ... and skip ones with fewer votes than this.
+  int max_desc_dist = 64;         // Descriptor matches can differ by this many bits (of 256).
+  double max_desc_ratio = 0.8;    // The best match has to be this much closer than the second best.
+  int min_inliers = 15;           // RANSAC inliers needed to accept a relocalization.
+  double sigma_px = 5.0;          // Observation noise for RANSAC and LM.
+  double max_error_stdevs = 3.0;
+};
+
+
+// The features of one keyframe, in its left camera.
+struct KeyframeFeatures final
+{
+  uid_t camera_id = 0;
+  timestamp_t timestamp = 0;
+  std::vector<Vector2d> pixels;
+  std::vector<Vector3d> points;   // Triangulated from each feature's disparity.
+  cv::Mat descriptors;            // One ORB descriptor (32 bytes) per row, in the same order.
+};
+
+
+// Where a frame is relative to an older keyframe, from KeyframeDatabase::Query().
+struct Relocalization final
+{
+  uid_t camera_id_kf = 0;
+  timestamp_t timestamp_kf = 0;
+  Matrix4d kf_T_cam = Matrix4d::Identity();
+  int num_inliers = 0;
+};
+
+
+// Describes pixels (with their disparities) in a left image. Features that are too close to the
+// border for a descriptor are dropped.
+// NOTE(milo): The descriptors are upright (angle of zero). The vehicle stays close to level, and
+// it's cheaper than estimating an orientation for each feature.
+KeyframeFeatures ExtractKeyframeFeatures(uid_t camera_id,
+                                         timestamp_t timestamp,
+                                         const Image1b& left_image,
+                                         const std::vector<Vector2d>& pixels,
+                                         const std::vector<double>& disps,
+                                         const StereoCamera& stereo_rig);
+
+
+// Remembers the features of recent keyframes, so that a frame that can't be tracked from the last
+// keyframe (e.g after a turbidity blackout) can be matched against the ones before it.
+//
+// Each descriptor is filed under a few "words" (groups of its bits) in an inverted index. A query
+// votes for the keyframes that share words with it, and only the top few candidates get brute
+// force descriptor matching and a stereo RANSAC (see RansacOdometry()).
+//
+// NOTE(milo): Not thread safe. The caller has to make sure that only one thread uses it at a time.
+class KeyframeDatabase final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(KeyframeDatabase)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(KeyframeDatabase)
+
+  KeyframeDatabase(const KeyframeDatabaseParams& params, const StereoCamera& stereo_rig);
+
+  // Add a keyframe (forgetting the oldest one if full). Keyframes must be added in time order.
+  void Add(KeyframeFeatures&& kf);
+
+  // Find the keyframe that best explains this frame. Returns false if none has enough inliers.
+  bool Query(const KeyframeFeatures& frame, Relocalization& reloc);
+
+  size_t Size() const { return keyframes_.size(); }
+
+ private:
+  // Matches a frame to one keyframe and estimates cur_T_kf. Returns the number of inliers.
+  int Verify(const KeyframeFeatures& frame, const KeyframeFeatures& kf, Matrix4d& cur_T_kf);
+
+  void RemoveOldest();
+
+ private:
+  KeyframeDatabaseParams params_;
+  StereoCamera stereo_rig_;
+
+  std::deque<KeyframeFeatures> keyframes_;    // Oldest first.
+  uint64_t num_removed_ = 0;                  // Keyframe k (in the order added) is at k - num_removed_.
+
+  // Map: word => keyframe number (see num_removed_) for each descriptor with that word.
+  std::unordered_map<uint32_t, std::vector<uint64_t>> index_;
+
+  OdometryWorkspace workspace_;
+};
+
+
+}
+}
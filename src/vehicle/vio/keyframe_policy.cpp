@@ -0,0 +1,112 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "vio/keyframe_policy.hpp"
+
+namespace bm {
+namespace vio {
+
+// Weight of the newest sample in the smoothed smoother latency.
+static const double kLatencySmoothing = 0.3;
+
+
+void KeyframePolicy::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("min_sec_btw_keyframes", &min_sec_btw_keyframes);
+  parser.GetParam("max_sec_btw_keyframes", &max_sec_btw_keyframes);
+  parser.GetParam("min_parallax_px", &min_parallax_px);
+  parser.GetParam("min_track_overlap", &min_track_overlap);
+  parser.GetParam("min_translation_m", &min_translation_m);
+  parser.GetParam("min_rotation_rad", &min_rotation_rad);
+  parser.GetParam("smoother_latency_budget_ms", &smoother_latency_budget_ms);
+  parser.GetParam("load_backoff", &load_backoff);
+
+  CHECK_LE(min_sec_btw_keyframes, max_sec_btw_keyframes);
+  CHECK_GT(load_backoff, 1.0);
+}
+
+
+KeyframePolicy::KeyframePolicy(const Params& params)
+    : params_(params),
+      min_sec_btw_keyframes_(params.min_sec_btw_keyframes) {}
+
+
+bool KeyframePolicy::IsKeyframe(const KeyframeCues& cues)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (cues.sec_since_keyframe >= params_.max_sec_btw_keyframes) {
+    return true;
+  }
+
+  if (cues.sec_since_keyframe < min_sec_btw_keyframes_) {
+    return false;
+  }
+
+  const bool moved = has_motion_ &&
+      ((speed_ * cues.sec_since_keyframe) >= params_.min_translation_m ||
+       (angular_speed_ * cues.sec_since_keyframe) >= params_.min_rotation_rad);
+
+  return moved ||
+         cues.median_parallax_px >= params_.min_parallax_px ||
+         cues.track_overlap < params_.min_track_overlap;
+}
+
+
+void KeyframePolicy::ReportMotion(const Vector3d& world_v_body, const Vector3d& body_w)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  has_motion_ = true;
+  speed_ = world_v_body.norm();
+  angular_speed_ = body_w.norm();
+}
+
+
+void KeyframePolicy::ReportSmootherLatency(double latency_ms)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (params_.smoother_latency_budget_ms <= 0) {
+    return;
+  }
+
+  latency_ms_ = kLatencySmoothing * latency_ms + (1.0 - kLatencySmoothing) * latency_ms_;
+
+  // NOTE(milo): Back off quickly when over budget, but only speed up again once there's plenty of
+  // headroom, so that the rate doesn't oscillate around the budget.
+  if (latency_ms_ > params_.smoother_latency_budget_ms) {
+    min_sec_btw_keyframes_ = std::min(params_.max_sec_btw_keyframes, params_.load_backoff * min_sec_btw_keyframes_);
+  } else if (latency_ms_ < 0.5 * params_.smoother_latency_budget_ms) {
+    min_sec_btw_keyframes_ = std::max(params_.min_sec_btw_keyframes, min_sec_btw_keyframes_ / params_.load_backoff);
+  }
+}
+
+
+double KeyframePolicy::MinSecBtwKeyframes()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return min_sec_btw_keyframes_;
+}
+
+
+void KeyframePolicy::SetParams(const Params& params)
+{
+  CHECK_LE(params.min_sec_btw_keyframes, params.max_sec_btw_keyframes);
+  CHECK_GT(params.load_backoff, 1.0);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  params_ = params;
+  min_sec_btw_keyframes_ = std::max(params_.min_sec_btw_keyframes,
+                                    std::min(params_.max_sec_btw_keyframes, min_sec_btw_keyframes_));
+}
+
+
+KeyframePolicy::Params KeyframePolicy::GetParams()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return params_;
+}
+
+
+}
+}
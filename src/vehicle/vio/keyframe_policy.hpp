@@ -0,0 +1,84 @@
+#pragma once
+
+#include <mutex>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "feature_tracking/keyframe_cues.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+using namespace ft;
+
+
+// Decides which frames become keyframes (and so smoother keyposes), using the tracker's parallax
+// and track overlap, motion from the filter, and how far behind the smoother is. Keyframes are
+// triggered as soon as the view has changed enough, but never faster than the current minimum
+// interval. That interval grows while smoother latency is over budget, and shrinks back once it
+// recovers, so that a busy smoother gets fewer keyposes instead of falling further behind.
+//
+// IsKeyframe() is called from the frontend, ReportMotion() from the filter, and
+// ReportSmootherLatency() from the smoother. All of them (and SetParams()) are threadsafe.
+class KeyframePolicy final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double min_sec_btw_keyframes = 0.1;   // Never trigger keyframes faster than this ...
+    double max_sec_btw_keyframes = 0.45;  // ... and always trigger one after this long.
+
+    double min_parallax_px = 20.0;        // Trigger once landmarks moved this far (median) ...
+    double min_track_overlap = 0.6;       // ... or fewer than this fraction are still tracked ...
+    double min_translation_m = 0.25;      // ... or the filter says we moved this far ...
+    double min_rotation_rad = 0.1;        // ... or rotated this much since the last keyframe.
+
+    // Keep the smoother's latency (keyframe tracked -> smoother result) under this. Zero = off.
+    double smoother_latency_budget_ms = 150.0;
+    double load_backoff = 1.25;           // Scales the min interval when over (or well under) budget.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(KeyframePolicy)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(KeyframePolicy)
+
+  explicit KeyframePolicy(const Params& params);
+
+  // Should the frame with these cues be a keyframe?
+  bool IsKeyframe(const KeyframeCues& cues);
+
+  // The latest filter velocity (world frame) and angular velocity (body frame).
+  void ReportMotion(const Vector3d& world_v_body, const Vector3d& body_w);
+
+  // How long the smoother took to produce a result from a keyframe (including any queueing).
+  void ReportSmootherLatency(double latency_ms);
+
+  // The current minimum interval between keyframes, which adapts to smoother load.
+  double MinSecBtwKeyframes();
+
+  // Swap in new thresholds while running (e.g when params are reloaded). The adapted minimum
+  // interval is kept, but clamped to the new [min_sec_btw_keyframes, max_sec_btw_keyframes].
+  void SetParams(const Params& params);
+
+  Params GetParams();
+
+ private:
+  Params params_;
+
+  std::mutex mutex_;
+  bool has_motion_ = false;
+  double speed_ = 0;
+  double angular_speed_ = 0;
+  double latency_ms_ = 0;           // Smoothed over recent keyposes.
+  double min_sec_btw_keyframes_;
+};
+
+
+}
+}
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <utility>
+
+#include "vio/landmark_budget.hpp"
+
+namespace bm {
+namespace vio {
+
+
+std::vector<uid_t> SelectLandmarks(std::vector<LandmarkCandidate> candidates,
+                                   int max_lmks,
+                                   int min_track_length,
+                                   double parallax_weight)
+{
+  candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+      [min_track_length](const LandmarkCandidate& c) { return c.track_length < min_track_length; }),
+      candidates.end());
+
+  const auto score = [parallax_weight](const LandmarkCandidate& c) {
+    return static_cast<double>(c.track_length) + parallax_weight * c.parallax_px;
+  };
+
+  // NOTE(milo): Break ties by id so that the same landmarks are chosen from one keypose to the next.
+  const auto better = [&score](const LandmarkCandidate& a, const LandmarkCandidate& b) {
+    const double sa = score(a);
+    const double sb = score(b);
+    return (sa != sb) ? (sa > sb) : (a.lmk_id < b.lmk_id);
+  };
+
+  const size_t N = (max_lmks > 0) ? std::min(candidates.size(), (size_t)max_lmks) : candidates.size();
+  std::partial_sort(candidates.begin(), candidates.begin() + N, candidates.end(), better);
+
+  std::vector<uid_t> out;
+  out.reserve(N);
+  for (size_t i = 0; i < N; ++i) {
+    out.emplace_back(candidates.at(i).lmk_id);
+  }
+
+  return out;
+}
+
+
+std::vector<int> SelectInformativeLandmarks(const std::vector<Vector3d>& cam_t_lmks,
+                                            double fx,
+                                            double fy,
+                                            int max_lmks,
+                                            double prior_info)
+{
+  typedef Eigen::Matrix<double, 2, 6> Matrix26d;
+
+  const int N = (int)cam_t_lmks.size();
+  const int K = (max_lmks > 0) ? std::min(N, max_lmks) : N;
+
+  // Pixel Jacobian w.r.t a perturbation [rotation, translation] of the camera pose (cam_T_world).
+  std::vector<Matrix26d, Eigen::aligned_allocator<Matrix26d>> J(N);
+  std::vector<bool> valid(N, false);
+  for (int i = 0; i < N; ++i) {
+    const Vector3d& p = cam_t_lmks.at(i);
+    if (p.z() <= 1e-3) {
+      continue;
+    }
+    const double iz = 1.0 / p.z();
+    Eigen::Matrix<double, 2, 3> J_proj;
+    J_proj << fx * iz, 0, -fx * p.x() * iz * iz,
+              0, fy * iz, -fy * p.y() * iz * iz;
+
+    Eigen::Matrix<double, 3, 6> J_point;
+    J_point << 0, p.z(), -p.y(), 1, 0, 0,
+               -p.z(), 0, p.x(), 0, 1, 0,
+               p.y(), -p.x(), 0, 0, 0, 1;
+
+    J.at(i) = J_proj * J_point;
+    valid.at(i) = true;
+  }
+
+  Matrix6d A_inv = Matrix6d::Identity() / prior_info;
+
+  const auto gain = [&](int i) {
+    const Eigen::Matrix2d S = Eigen::Matrix2d::Identity() + J.at(i) * A_inv * J.at(i).transpose();
+    return std::log(S.determinant());
+  };
+
+  // Max-heap of (upper bound on gain, index). Ties go to the lower index, so that the result
+  // doesn't depend on how std::priority_queue breaks them.
+  typedef std::pair<double, int> Entry;
+  const auto lower = [](const Entry& a, const Entry& b) {
+    return (a.first != b.first) ? (a.first < b.first) : (a.second > b.second);
+  };
+  std::priority_queue<Entry, std::vector<Entry>, decltype(lower)> queue(lower);
+  for (int i = 0; i < N; ++i) {
+    if (valid.at(i)) {
+      queue.emplace(gain(i), i);
+    }
+  }
+
+  std::vector<int> out;
+  out.reserve(K);
+
+  while ((int)out.size() < K && !queue.empty()) {
+    const Entry top = queue.top();
+    queue.pop();
+
+    // If the gain is still at least the next best upper bound, nothing else can beat it.
+    const double g = gain(top.second);
+    if (!queue.empty() && lower(Entry(g, top.second), queue.top())) {
+      queue.emplace(g, top.second);
+      continue;
+    }
+
+    const Matrix26d& Ji = J.at(top.second);
+    const Eigen::Matrix<double, 6, 2> AJt = A_inv * Ji.transpose();
+    const Eigen::Matrix2d S = Eigen::Matrix2d::Identity() + Ji * AJt;
+    A_inv -= AJt * S.inverse() * AJt.transpose();
+
+    out.emplace_back(top.second);
+  }
+
+  return out;
+}
+
+
+}
+}
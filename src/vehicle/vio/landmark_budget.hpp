@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// A landmark observed at the newest keypose, which could get a factor in the smoother.
+struct LandmarkCandidate final
+{
+  explicit LandmarkCandidate(uid_t lmk_id, int track_length, double parallax_px)
+      : lmk_id(lmk_id), track_length(track_length), parallax_px(parallax_px) {}
+
+  uid_t lmk_id;
+  int track_length;     // Number of keyposes (still in the smoother lag) that observed it.
+  double parallax_px;   // Pixel distance between its oldest and newest observations.
+};
+
+
+// Chooses which landmarks get a new (or updated) factor, so that the cost of a smoother update
+// doesn't grow with the number of features in the scene. Landmarks seen at fewer than
+// min_track_length keyposes are skipped, and the rest are ranked by:
+//
+//    track_length + parallax_weight * parallax_px
+//
+// Returns at most max_lmks ids (all of them if max_lmks <= 0), best first.
+std::vector<uid_t> SelectLandmarks(std::vector<LandmarkCandidate> candidates,
+                                   int max_lmks,
+                                   int min_track_length,
+                                   double parallax_weight);
+
+
+// Chooses the max_lmks landmarks that constrain a camera pose the most, e.g so that the pose solve
+// and the smoother don't grow with the amount of texture. cam_t_lmks are the landmarks in the
+// camera frame (at the current pose estimate), observed as pixels by a camera with focal lengths
+// fx and fy. Greedily maximizes the log-determinant of the pose information matrix:
+//
+//    A = prior_info * I + sum_i J_i^T J_i    (J_i = 2x6 Jacobian of landmark i's pixel)
+//
+// Adding a landmark is a rank-2 update of A, so the gain is log det(I + J_i A^-1 J_i^T), and A^-1
+// is updated in place (Woodbury). The gains only shrink as landmarks are added (log det is
+// submodular), so each landmark's last gain is an upper bound, and most of them don't have to be
+// re-evaluated (lazy greedy).
+//
+// Returns the indices of at most max_lmks landmarks (all of them if max_lmks <= 0), in the order
+// that they were chosen. Landmarks behind the camera are never chosen.
+std::vector<int> SelectInformativeLandmarks(const std::vector<Vector3d>& cam_t_lmks,
+                                            double fx,
+                                            double fy,
+                                            int max_lmks,
+                                            double prior_info = 1e-3);
+
+
+}
+}
@@ -0,0 +1,87 @@
+#include <algorithm>
+
+#include "vio/landmark_cloud.hpp"
+
+namespace bm {
+namespace vio {
+
+
+void LandmarkCloud::Update(uid_t lmk_id, const Vector3d& t_world_lmk)
+{
+  const cv::Point3f point(static_cast<float>(t_world_lmk.x()),
+                          static_cast<float>(t_world_lmk.y()),
+                          static_cast<float>(t_world_lmk.z()));
+
+  const auto it = index_.find(lmk_id);
+  if (it != index_.end()) {
+    points_[it->second.slot] = point;
+    updated_batch_[it->second.slot] = batch_;
+    lru_.splice(lru_.end(), lru_, it->second.lru);
+    return;
+  }
+
+  Entry entry;
+  entry.slot = ids_.size();
+  entry.lru = lru_.insert(lru_.end(), lmk_id);
+  index_.emplace(lmk_id, entry);
+  ids_.emplace_back(lmk_id);
+  points_.emplace_back(point);
+  updated_batch_.emplace_back(batch_);
+
+  while (ids_.size() > max_landmarks_) {
+    Remove(lru_.front());
+  }
+}
+
+
+void LandmarkCloud::Remove(uid_t lmk_id)
+{
+  const auto it = index_.find(lmk_id);
+  const size_t slot = it->second.slot;
+  const size_t last = ids_.size() - 1;
+
+  if (slot != last) {
+    ids_[slot] = ids_[last];
+    points_[slot] = points_[last];
+    updated_batch_[slot] = updated_batch_[last];
+    index_.at(ids_[slot]).slot = slot;
+  }
+
+  ids_.pop_back();
+  points_.pop_back();
+  updated_batch_.pop_back();
+  lru_.erase(it->second.lru);
+  index_.erase(it);
+}
+
+
+void LandmarkCloud::Split(const Vector3d& t_world_viewer,
+                          const LandmarkLodParams& lod,
+                          CvPoints3f& near_points,
+                          CvPoints3f& far_points) const
+{
+  near_points.clear();
+  far_points.clear();
+
+  const cv::Point3f viewer(static_cast<float>(t_world_viewer.x()),
+                           static_cast<float>(t_world_viewer.y()),
+                           static_cast<float>(t_world_viewer.z()));
+  const float near_distance_sq = static_cast<float>(lod.near_distance * lod.near_distance);
+  const uint64_t far_stride = static_cast<uint64_t>(std::max(1, lod.far_stride));
+
+  for (size_t i = 0; i < ids_.size(); ++i) {
+    const cv::Point3f d = points_[i] - viewer;
+    const bool is_far = (lod.near_distance > 0 && d.dot(d) > near_distance_sq);
+    const bool is_old = (lod.max_age > 0 && (batch_ - updated_batch_[i]) > static_cast<uint64_t>(lod.max_age));
+
+    if (!is_far && !is_old) {
+      near_points.emplace_back(points_[i]);
+    } else if (static_cast<uint64_t>(ids_[i]) % far_stride == 0) {
+      far_points.emplace_back(points_[i]);
+    }
+  }
+}
+
+
+}
+}
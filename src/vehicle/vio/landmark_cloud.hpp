@@ -0,0 +1,80 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+typedef std::vector<cv::Point3f> CvPoints3f;
+
+
+// Which landmarks are drawn at full density. The rest are thinned out to every far_stride-th one.
+struct LandmarkLodParams final
+{
+  double near_distance = 0;   // Farther than this from the viewer is "far" (m, 0 = OFF).
+  int max_age = 0;            // Not updated in this many batches is "far" (0 = OFF).
+  int far_stride = 4;         // Draw one in this many far landmarks (1 = all of them).
+};
+
+
+// Landmark positions for the visualizer, kept in one dense buffer so that they can be drawn as a
+// single point cloud instead of a widget per landmark. Updating a landmark only touches its own slot.
+// Past max_landmarks, the least recently updated landmarks are removed.
+class LandmarkCloud final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(LandmarkCloud)
+
+  explicit LandmarkCloud(size_t max_landmarks) : max_landmarks_(max_landmarks) {}
+
+  // Adds a landmark, or moves it if it already exists.
+  void Update(uid_t lmk_id, const Vector3d& t_world_lmk);
+
+  // Call after each batch of updates. Landmarks "age" by one batch each time they're not updated.
+  void NextBatch() { ++batch_; }
+
+  // Fills near_points with the landmarks that are drawn at full density, and far_points with every
+  // lod.far_stride-th of the rest (picked by id, so the same ones are drawn from frame to frame).
+  void Split(const Vector3d& t_world_viewer,
+             const LandmarkLodParams& lod,
+             CvPoints3f& near_points,
+             CvPoints3f& far_points) const;
+
+  size_t Size() const { return ids_.size(); }
+  bool Contains(uid_t lmk_id) const { return index_.count(lmk_id) != 0; }
+
+ private:
+  struct Entry final
+  {
+    size_t slot;
+    std::list<uid_t>::iterator lru;
+  };
+
+  // Removes the landmark in a slot by moving the last one into it.
+  void Remove(uid_t lmk_id);
+
+ private:
+  size_t max_landmarks_;
+  uint64_t batch_ = 0;
+
+  // Dense, in no particular order.
+  std::vector<uid_t> ids_;
+  std::vector<cv::Point3f> points_;
+  std::vector<uint64_t> updated_batch_;
+
+  std::unordered_map<uid_t, Entry> index_;
+  std::list<uid_t> lru_;    // Least recently updated first.
+};
+
+
+}
+}
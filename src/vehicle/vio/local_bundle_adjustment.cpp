@@ -0,0 +1,228 @@
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include <eigen3/Eigen/Cholesky>
+
+#include "core/profiler.hpp"
+#include "core/transform_util.hpp"
+#include "vio/local_bundle_adjustment.hpp"
+#include "vio/optimize_odometry.hpp"
+
+namespace bm {
+namespace vio {
+
+typedef Eigen::Matrix<double, 3, 6> Matrix36d;
+typedef Eigen::Matrix<double, 6, 3> Matrix63d;
+
+
+// Residual and Jacobians of one stereo observation: (u, v) in the left image and u in the right.
+// Returns false if the point is behind the camera.
+static bool LinearizeObservation(const StereoCamera& stereo_cam,
+                                 const Matrix4d& T_kf_anchor,
+                                 const Vector3d& anchor_t_lmk,
+                                 const BundleObservation& ob,
+                                 Vector3d& r,
+                                 Matrix36d* J_pose,
+                                 Matrix3d* J_lmk)
+{
+  const Matrix3d R = T_kf_anchor.block<3, 3>(0, 0);
+  const Vector3d P = R * anchor_t_lmk + T_kf_anchor.block<3, 1>(0, 3);
+  if (P.z() < 1e-3) {
+    return false;
+  }
+
+  const double fx = stereo_cam.fx(), fy = stereo_cam.fy();
+  const double cx = stereo_cam.cx(), cy = stereo_cam.cy();
+  const double b = stereo_cam.Baseline();
+  const double iz = 1.0 / P.z();
+  const bool use_right = ob.disp > 0;
+
+  r(0) = ob.u - (fx * P.x() * iz + cx);
+  r(1) = ob.v - (fy * P.y() * iz + cy);
+  r(2) = use_right ? ((ob.u - ob.disp) - (fx * (P.x() - b) * iz + cx)) : 0.0;
+
+  if (J_pose == nullptr) {
+    return true;
+  }
+
+  // Derivative of the (negated) residual w.r.t the point in the keyframe.
+  Matrix3d J_proj;
+  J_proj << fx * iz, 0, -fx * P.x() * iz * iz,
+            0, fy * iz, -fy * P.y() * iz * iz,
+            fx * iz, 0, -fx * (P.x() - b) * iz * iz;
+  if (!use_right) {
+    J_proj.row(2).setZero();
+  }
+
+  // Left-multiplied perturbation, same as expmap_se3(): dP/d(t, w) = [I, -skew(P)].
+  Matrix36d dP_dxi;
+  dP_dxi.block<3, 3>(0, 0) = Matrix3d::Identity();
+  dP_dxi.block<3, 3>(0, 3) = -skew(P);
+
+  *J_pose = J_proj * dP_dxi;
+  *J_lmk = J_proj * R;
+  return true;
+}
+
+
+static double ComputeBundleError(const StereoCamera& stereo_cam,
+                                 const VecMatrix4d& kf_T_anchor,
+                                 const std::vector<Vector3d>& anchor_t_lmk,
+                                 const std::vector<BundleObservation>& obs,
+                                 double sigma_px,
+                                 double& avg_err)
+{
+  double cost = 0;
+  avg_err = 0;
+  int num = 0;
+
+  for (const BundleObservation& ob : obs) {
+    Vector3d r;
+    if (!LinearizeObservation(stereo_cam, kf_T_anchor.at(ob.kf), anchor_t_lmk.at(ob.lmk), ob, r, nullptr, nullptr)) {
+      continue;
+    }
+    const double e = r.norm() / sigma_px;
+    cost += std::log(1.0 + e*e);    // Cauchy loss, see RobustWeightCauchy().
+    avg_err += r.head<2>().norm() / sigma_px;
+    ++num;
+  }
+
+  avg_err = (num > 0) ? (avg_err / num) : 0;
+  return cost;
+}
+
+
+double OptimizeLocalBundleAdjustment(const StereoCamera& stereo_cam,
+                                     VecMatrix4d& kf_T_anchor,
+                                     std::vector<Vector3d>& anchor_t_lmk,
+                                     const std::vector<BundleObservation>& obs,
+                                     double sigma_px,
+                                     int max_iters)
+{
+  MACRO_PROFILE_SCOPE("OptimizeLocalBundleAdjustment");
+
+  const int K = (int)kf_T_anchor.size();
+  const int L = (int)anchor_t_lmk.size();
+  const int P = K - 1;     // Number of free poses (the first is fixed).
+
+  if (K < 2 || L == 0 || obs.empty()) {
+    return -1;
+  }
+
+  // Reduced camera system, and per-observation blocks that are reused for back-substitution.
+  Eigen::MatrixXd S(6*P, 6*P);
+  Eigen::VectorXd s(6*P);
+  std::vector<Matrix63d, Eigen::aligned_allocator<Matrix63d>> H_pl(obs.size());
+  std::vector<Matrix3d, Eigen::aligned_allocator<Matrix3d>> H_ll_inv(L);
+  std::vector<Vector3d> b_l(L);
+
+  double avg_err = 0;
+  double cost = ComputeBundleError(stereo_cam, kf_T_anchor, anchor_t_lmk, obs, sigma_px, avg_err);
+  double lambda = 1e-3;
+
+  for (int iter = 0; iter < max_iters; ++iter) {
+    S.setZero();
+    s.setZero();
+
+    // Build the normal equations one landmark at a time, and eliminate it immediately.
+    size_t begin = 0;
+    while (begin < obs.size()) {
+      const int l = obs.at(begin).lmk;
+      size_t end = begin;
+      while (end < obs.size() && obs.at(end).lmk == l) {
+        ++end;
+      }
+
+      Matrix3d H_ll = Matrix3d::Zero();
+      Vector3d bl = Vector3d::Zero();
+
+      for (size_t i = begin; i < end; ++i) {
+        const BundleObservation& ob = obs.at(i);
+        Vector3d r;
+        Matrix36d Jp;
+        Matrix3d Jl;
+        H_pl.at(i).setZero();
+        if (!LinearizeObservation(stereo_cam, kf_T_anchor.at(ob.kf), anchor_t_lmk.at(l), ob, r, &Jp, &Jl)) {
+          continue;
+        }
+
+        const double w = RobustWeightCauchy(r.norm() / sigma_px);
+        H_ll.noalias() += w * Jl.transpose() * Jl;
+        bl.noalias() += w * Jl.transpose() * r;
+
+        if (ob.kf > 0) {
+          const int p = ob.kf - 1;
+          S.block<6, 6>(6*p, 6*p).noalias() += w * Jp.transpose() * Jp;
+          s.segment<6>(6*p).noalias() += w * Jp.transpose() * r;
+          H_pl.at(i).noalias() = w * Jp.transpose() * Jl;
+        }
+      }
+
+      H_ll.diagonal() *= (1.0 + lambda);
+      H_ll.diagonal().array() += 1e-9;
+      H_ll_inv.at(l) = H_ll.inverse();
+      b_l.at(l) = bl;
+
+      // Schur complement: S -= H_pl * H_ll^-1 * H_lp, s -= H_pl * H_ll^-1 * b_l.
+      for (size_t i = begin; i < end; ++i) {
+        if (obs.at(i).kf == 0) { continue; }
+        const int pi = obs.at(i).kf - 1;
+        const Matrix63d HiHinv = H_pl.at(i) * H_ll_inv.at(l);
+        s.segment<6>(6*pi).noalias() -= HiHinv * bl;
+        for (size_t j = begin; j < end; ++j) {
+          if (obs.at(j).kf == 0) { continue; }
+          const int pj = obs.at(j).kf - 1;
+          S.block<6, 6>(6*pi, 6*pj).noalias() -= HiHinv * H_pl.at(j).transpose();
+        }
+      }
+
+      begin = end;
+    }
+
+    // LM damping on the reduced system.
+    S.diagonal() *= (1.0 + lambda);
+    S.diagonal().array() += 1e-9;
+    const Eigen::VectorXd dx_p = S.ldlt().solve(s);
+
+    // Back-substitute for the landmark updates.
+    std::vector<Vector3d> lmk_test = anchor_t_lmk;
+    VecMatrix4d kf_test = kf_T_anchor;
+    for (int p = 0; p < P; ++p) {
+      kf_test.at(p + 1) = expmap_se3(dx_p.segment<6>(6*p)) * kf_T_anchor.at(p + 1);
+    }
+
+    std::vector<Vector3d> rhs_l = b_l;
+    for (size_t i = 0; i < obs.size(); ++i) {
+      if (obs.at(i).kf > 0) {
+        rhs_l.at(obs.at(i).lmk).noalias() -= H_pl.at(i).transpose() * dx_p.segment<6>(6*(obs.at(i).kf - 1));
+      }
+    }
+    for (int l = 0; l < L; ++l) {
+      lmk_test.at(l) += H_ll_inv.at(l) * rhs_l.at(l);
+    }
+
+    double avg_err_test = 0;
+    const double cost_test = ComputeBundleError(stereo_cam, kf_test, lmk_test, obs, sigma_px, avg_err_test);
+
+    if (cost_test < cost) {
+      std::swap(kf_T_anchor, kf_test);
+      std::swap(anchor_t_lmk, lmk_test);
+      const bool converged = (cost - cost_test) < 1e-6 * cost;
+      cost = cost_test;
+      avg_err = avg_err_test;
+      lambda /= 3.0;
+      if (converged) {
+        break;
+      }
+    } else {
+      lambda *= 4.0;
+    }
+  }
+
+  return avg_err;
+}
+
+
+}
+}
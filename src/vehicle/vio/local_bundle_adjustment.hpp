@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+#include <eigen3/Eigen/StdVector>
+
+#include "core/eigen_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+typedef std::vector<Matrix4d, Eigen::aligned_allocator<Matrix4d>> VecMatrix4d;
+
+
+// A stereo observation of landmark "lmk" from keyframe "kf" (indices into the BA problem).
+struct BundleObservation final
+{
+  BundleObservation() = default;
+
+  explicit BundleObservation(int kf, int lmk, double u, double v, double disp)
+      : kf(kf), lmk(lmk), u(u), v(v), disp(disp) {}
+
+  int kf = 0;
+  int lmk = 0;
+  double u = 0;         // Pixel location in the left image.
+  double v = 0;
+  double disp = 0;      // Stereo disparity. If <= 0, only the left image observation is used.
+};
+
+
+/**
+ * Small, dense bundle adjustment over a window of stereo keyframes. The landmarks are eliminated
+ * with 3x3 blocks (Schur complement), so the only linear system solved is 6(K-1) x 6(K-1) for K
+ * keyframes. The first keyframe is held fixed to anchor the gauge.
+ *
+ * @param kf_T_anchor : (in/out) Transform from the anchor (first keyframe) into each keyframe.
+ * @param anchor_t_lmk : (in/out) Landmark positions in the anchor frame.
+ * @param obs : Observations sorted by landmark index.
+ * @param sigma_px : Pixel standard deviation (used for the Cauchy robust loss).
+ * @return The average reprojection error in the left image after optimization, in units of sigma_px
+ *         (same as OptimizeOdometryLM). Returns -1 if there was nothing to optimize.
+ */
+double OptimizeLocalBundleAdjustment(const StereoCamera& stereo_cam,
+                                     VecMatrix4d& kf_T_anchor,
+                                     std::vector<Vector3d>& anchor_t_lmk,
+                                     const std::vector<BundleObservation>& obs,
+                                     double sigma_px,
+                                     int max_iters);
+
+
+}
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "core/macros.hpp"
+#include "core/notifier.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Lets a producer wait until a pipeline of threads has completely finished with everything that it
+// was given, so that data can be fed in one item at a time (lockstep replay).
+//
+// Every input to a stage comes with a "wake" token, which is counted as pending until the stage is
+// done with it. A stage takes all of its tokens at the start of a pass (see LockstepPass), and only
+// finishes them after a pass where it had nothing left to do. Since a stage wakes any downstream
+// stages before finishing its own tokens, the pending count can only reach zero once every stage
+// has seen all of its input and gone idle.
+class Lockstep final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(Lockstep)
+
+  struct Stage final
+  {
+    MACRO_DELETE_COPY_CONSTRUCTORS(Stage)
+    Stage() = default;
+
+    std::atomic<int> tokens{0};
+    Notifier notifier;
+  };
+
+  Lockstep() = default;
+
+  // Give a stage some work (call after its input has been pushed).
+  void Wake(Stage& stage)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++pending_;
+    }
+    stage.tokens.fetch_add(1);
+    stage.notifier.Notify();
+  }
+
+  // Block until a stage has tokens, or until timeout_sec has elapsed (or shutdown is set).
+  // Returns whether the stage has tokens.
+  bool WaitForWake(Stage& stage, const std::atomic_bool& shutdown, double timeout_sec)
+  {
+    return stage.notifier.WaitFor([&stage, &shutdown]() {
+      return stage.tokens.load() > 0 || shutdown.load();
+    }, timeout_sec) && stage.tokens.load() > 0;
+  }
+
+  // Block until every stage is idle, or until shutdown is set.
+  void WaitIdle(const std::atomic_bool& shutdown)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (pending_ > 0 && !shutdown.load()) {
+      cv_idle_.wait_for(lock, std::chrono::milliseconds(100));
+    }
+  }
+
+  // Number of tokens that haven't been finished.
+  int Pending()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_;
+  }
+
+ private:
+  friend class LockstepPass;
+
+  void Finish(int n)
+  {
+    if (n == 0) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ -= n;
+    if (pending_ == 0) {
+      cv_idle_.notify_all();
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_idle_;
+  int pending_ = 0;
+};
+
+
+// One pass through a stage's loop. Takes the stage's tokens when constructed. When it goes out of
+// scope, the tokens are finished if the pass didn't do any work. Otherwise, they're handed back so
+// that the stage makes another pass.
+//
+// NOTE(milo): If nothing ever calls Wake(), the stage has no tokens and this does nothing, so stage
+// loops can use it whether or not they're in lockstep.
+class LockstepPass final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(LockstepPass)
+
+  LockstepPass(Lockstep& lockstep, Lockstep::Stage& stage)
+      : lockstep_(lockstep), stage_(stage), tokens_(stage.tokens.exchange(0)) {}
+
+  ~LockstepPass()
+  {
+    if (did_work_ && tokens_ > 0) {
+      stage_.tokens.fetch_add(tokens_);
+      stage_.notifier.Notify();
+    } else {
+      lockstep_.Finish(tokens_);
+    }
+  }
+
+  void DidWork() { did_work_ = true; }
+
+ private:
+  Lockstep& lockstep_;
+  Lockstep::Stage& stage_;
+  int tokens_;
+  bool did_work_ = false;
+};
+
+
+}
+}
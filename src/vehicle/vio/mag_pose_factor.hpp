@@ -29,8 +29,14 @@ class MagPoseFactor: public NoiseModelFactor1<POSE> {
   static const int PoseDim = traits<POSE>::dimension;
   static const int RotDim = traits<Rot>::dimension;
 
+  typedef Eigen::Matrix<double, MeasDim, RotDim> MeasRotJacobian;
+  typedef Eigen::Matrix<double, RotDim, RotDim> RotRotJacobian;
+
   boost::optional<POSE> body_P_sensor_; ///< The pose of the sensor in the body frame.
 
+  // Takes a rotation perturbation of the body to one of the sensor (identity without body_P_sensor).
+  RotRotJacobian sensor_Ad_body_;
+
  public:
   /**
    * @param pose_key of the unknown pose nav_P_body in the factor graph.
@@ -52,7 +58,9 @@ class MagPoseFactor: public NoiseModelFactor1<POSE> {
         measured_(measured),
         nM_(scale * direction.normalized()),
         bias_(bias),
-        body_P_sensor_(body_P_sensor) {}
+        body_P_sensor_(body_P_sensor),
+        sensor_Ad_body_(body_P_sensor ? RotRotJacobian(body_P_sensor->rotation().inverse().AdjointMap())
+                                      : RotRotJacobian::Identity()) {}
 
   /// @return a deep copy of this factor.
   NonlinearFactor::shared_ptr clone() const override
@@ -62,19 +70,21 @@ class MagPoseFactor: public NoiseModelFactor1<POSE> {
   }
 
   // Return the factor's error h(x) - z, and the optional Jacobian.
+  // NOTE(milo): Runs on every relinearization, so the Jacobian is built in fixed-size blocks. The
+  // only allocation is sizing H, if the caller didn't already.
   Vector evaluateError(const POSE& nPb, boost::optional<Matrix&> H = boost::none) const override
   {
     // Get rotation of the nav frame in the sensor frame.
     const Rot nRs = body_P_sensor_ ? nPb.rotation() * body_P_sensor_->rotation() : nPb.rotation();
 
     // Predict the measured magnetic field h(x) in the sensor frame.
-    Matrix H_rot = Matrix::Zero(MeasDim, RotDim);
+    MeasRotJacobian H_rot;
     const Point hx = nRs.unrotate(nM_, H_rot, boost::none) + bias_;
 
     if (H) {
-      *H = Matrix::Zero(MeasDim, PoseDim);
-      const size_t rot0 = nPb.rotationInterval().first;
-      (*H).block(0, rot0, MeasDim, RotDim) = H_rot;
+      // nRs = nRb * bRs, so perturbing nRb by w perturbs nRs by Ad(bRs^-1) * w.
+      H->setZero(MeasDim, PoseDim);
+      H->block<MeasDim, RotDim>(0, POSE::rotationInterval().first) = H_rot * sensor_Ad_body_;
     }
 
     return (hx - measured_);
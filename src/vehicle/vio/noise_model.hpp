@@ -8,6 +8,7 @@ namespace vio {
 
 typedef gtsam::noiseModel::Isotropic IsoModel;
 typedef gtsam::noiseModel::Diagonal DiagModel;
+typedef gtsam::noiseModel::Gaussian GaussianModel;
 
 
 }
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include <eigen3/Eigen/SVD>
+
+#include <glog/logging.h>
+
+#include "core/profiler.hpp"
+#include "core/task_scheduler.hpp"
+#include "vio/odometry_ransac.hpp"
+
+namespace bm {
+namespace vio {
+
+
+bool AbsoluteOrientation(const Vector3d* P0, const Vector3d* P1, size_t N, Matrix4d& T_10)
+{
+  if (N < 3) {
+    return false;
+  }
+
+  Vector3d c0 = Vector3d::Zero();
+  Vector3d c1 = Vector3d::Zero();
+  for (size_t i = 0; i < N; ++i) {
+    c0 += P0[i];
+    c1 += P1[i];
+  }
+  c0 /= static_cast<double>(N);
+  c1 /= static_cast<double>(N);
+
+  Matrix3d H = Matrix3d::Zero();
+  for (size_t i = 0; i < N; ++i) {
+    H += (P0[i] - c0) * (P1[i] - c1).transpose();
+  }
+
+  const Eigen::JacobiSVD<Matrix3d> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+
+  // Collinear points leave the rotation about their line unconstrained.
+  if (svd.singularValues()(1) < 1e-9 * std::max(1.0, svd.singularValues()(0))) {
+    return false;
+  }
+
+  // Flip the smallest axis if needed, so that we get a rotation and not a reflection.
+  const Matrix3d& U = svd.matrixU();
+  const Matrix3d& V = svd.matrixV();
+  Matrix3d D = Matrix3d::Identity();
+  D(2, 2) = (V * U.transpose()).determinant() < 0 ? -1.0 : 1.0;
+
+  const Matrix3d R_10 = V * D * U.transpose();
+
+  T_10 = Matrix4d::Identity();
+  T_10.block<3, 3>(0, 0) = R_10;
+  T_10.block<3, 1>(0, 3) = c1 - R_10 * c0;
+
+  return true;
+}
+
+
+// Counts the observations that T_10 reprojects within max_error_stdevs of. The reprojection error
+// is scaled by the depth instead of dividing by it, and points behind Camera_1 never count.
+static int CountInliers(const OdometryWorkspace& ws,
+                        const PinholeCamera& cam,
+                        const Matrix4d& T_10,
+                        double max_error_stdevs)
+{
+  const size_t M = ws.Size();
+
+  const double R00 = T_10(0, 0), R01 = T_10(0, 1), R02 = T_10(0, 2), t0 = T_10(0, 3);
+  const double R10 = T_10(1, 0), R11 = T_10(1, 1), R12 = T_10(1, 2), t1 = T_10(1, 3);
+  const double R20 = T_10(2, 0), R21 = T_10(2, 1), R22 = T_10(2, 2), t2 = T_10(2, 3);
+  const double fx = cam.fx(), fy = cam.fy(), cx = cam.cx(), cy = cam.cy();
+  const double k2 = max_error_stdevs * max_error_stdevs;
+
+  const double* x = ws.x.data();
+  const double* y = ws.y.data();
+  const double* z = ws.z.data();
+  const double* u = ws.u.data();
+  const double* v = ws.v.data();
+  const double* sigma = ws.sigma.data();
+
+  // NOTE(milo): No branches or divisions in here, so that the compiler can vectorize this. Every
+  // hypothesis goes through it, so it's most of the RANSAC time.
+  int count = 0;
+  for (size_t i = 0; i < M; ++i) {
+    const double gx = R00*x[i] + R01*y[i] + R02*z[i] + t0;
+    const double gy = R10*x[i] + R11*y[i] + R12*z[i] + t1;
+    const double gz = R20*x[i] + R21*y[i] + R22*z[i] + t2;
+    const double rx = (u[i] - cx)*gz - fx*gx;
+    const double ry = (v[i] - cy)*gz - fy*gy;
+    count += static_cast<int>((gz > 0.0) & ((rx*rx + ry*ry) < (k2*sigma[i]*sigma[i]*gz*gz)));
+  }
+
+  return count;
+}
+
+
+// Same test as CountInliers(), but keeps the indices.
+static void GetInliers(const OdometryWorkspace& ws,
+                       const PinholeCamera& cam,
+                       const Matrix4d& T_10,
+                       double max_error_stdevs,
+                       std::vector<int>& inlier_indices)
+{
+  const double k2 = max_error_stdevs * max_error_stdevs;
+  const double fx = cam.fx(), fy = cam.fy(), cx = cam.cx(), cy = cam.cy();
+
+  inlier_indices.clear();
+  for (size_t i = 0; i < ws.Size(); ++i) {
+    const Vector3d P1 = T_10.block<3, 3>(0, 0) * Vector3d(ws.x[i], ws.y[i], ws.z[i]) + T_10.block<3, 1>(0, 3);
+    const double rx = (ws.u[i] - cx)*P1.z() - fx*P1.x();
+    const double ry = (ws.v[i] - cy)*P1.z() - fy*P1.y();
+    if (P1.z() > 0 && (rx*rx + ry*ry) < (k2*ws.sigma[i]*ws.sigma[i]*P1.z()*P1.z())) {
+      inlier_indices.emplace_back(static_cast<int>(i));
+    }
+  }
+}
+
+
+// Draws 3 distinct points from "usable" that aren't (nearly) collinear, and solves for T_10.
+static bool SampleHypothesis(const std::vector<Vector3d>& P0_list,
+                             const std::vector<Vector3d>& P1_list,
+                             const std::vector<int>& usable,
+                             std::mt19937& rng,
+                             Matrix4d& T_10)
+{
+  std::uniform_int_distribution<int> dist(0, static_cast<int>(usable.size()) - 1);
+
+  for (int attempt = 0; attempt < 10; ++attempt) {
+    const int a = dist(rng), b = dist(rng), c = dist(rng);
+    if (a == b || b == c || a == c) {
+      continue;
+    }
+
+    const Vector3d P0[3] = { P0_list.at(usable[a]), P0_list.at(usable[b]), P0_list.at(usable[c]) };
+    const Vector3d P1[3] = { P1_list.at(usable[a]), P1_list.at(usable[b]), P1_list.at(usable[c]) };
+
+    if ((P0[1] - P0[0]).cross(P0[2] - P0[0]).squaredNorm() < 1e-6) {
+      continue;
+    }
+
+    if (AbsoluteOrientation(P0, P1, 3, T_10)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+int RansacOdometry(const std::vector<Vector3d>& P0_list,
+                   const std::vector<Vector3d>& P1_list,
+                   const std::vector<Vector2d>& p1_obs_list,
+                   const std::vector<double>& p1_sigma_list,
+                   const StereoCamera& stereo_cam,
+                   const Matrix4d* T_10_prior,
+                   const OdometryRansacParams& params,
+                   Matrix4d& T_10,
+                   std::vector<int>& inlier_indices,
+                   OdometryWorkspace& workspace)
+{
+  MACRO_PROFILE_SCOPE("RansacOdometry");
+  CHECK_EQ(P0_list.size(), P1_list.size());
+  CHECK_GT(params.hypotheses_per_round, 0);
+
+  OdometryWorkspace& ws = workspace;
+  ws.Load(P0_list, p1_obs_list, p1_sigma_list);
+  const PinholeCamera& cam = stereo_cam.LeftCamera();
+  const int M = static_cast<int>(ws.Size());
+
+  Matrix4d best_T_10 = Matrix4d::Identity();
+  int best_count = 0;
+
+  // Early exit: if the prior already explains most of the observations, LM can take it from here.
+  if (T_10_prior) {
+    best_T_10 = *T_10_prior;
+    best_count = CountInliers(ws, cam, best_T_10, params.max_error_stdevs);
+    if (best_count >= params.min_inliers && best_count >= params.prior_inlier_ratio * M) {
+      T_10 = best_T_10;
+      GetInliers(ws, cam, T_10, params.max_error_stdevs, inlier_indices);
+      return 0;
+    }
+  }
+
+  std::vector<int> usable;
+  for (size_t i = 0; i < P1_list.size(); ++i) {
+    if (P1_list[i].z() > 0) {
+      usable.emplace_back(static_cast<int>(i));
+    }
+  }
+
+  const int R = params.hypotheses_per_round;
+  std::vector<Matrix4d, Eigen::aligned_allocator<Matrix4d>> round_T_10(R);
+  std::vector<int> round_count(R);
+
+  int num_hypotheses = 0;
+  while (usable.size() >= 3 && num_hypotheses < params.max_hypotheses) {
+    const int num_round = std::min(R, params.max_hypotheses - num_hypotheses);
+
+    // NOTE(milo): Each hypothesis seeds its own generator from its index, so the result doesn't
+    // depend on how the scheduler splits up the round.
+    TaskScheduler::Instance().ParallelFor(TaskPriority::FRONTEND, num_round, [&](int i) {
+      std::mt19937 rng(static_cast<unsigned int>(num_hypotheses + i + 1));
+      round_count[i] = -1;
+      if (SampleHypothesis(P0_list, P1_list, usable, rng, round_T_10[i])) {
+        round_count[i] = CountInliers(ws, cam, round_T_10[i], params.max_error_stdevs);
+      }
+    });
+
+    for (int i = 0; i < num_round; ++i) {
+      if (round_count[i] > best_count) {
+        best_count = round_count[i];
+        best_T_10 = round_T_10[i];
+      }
+    }
+    num_hypotheses += num_round;
+
+    // Standard adaptive stopping: how many samples until one is all inliers with this confidence.
+    const double w = static_cast<double>(best_count) / static_cast<double>(M);
+    const double p_good = w * w * w;
+    if (p_good >= 1.0) {
+      break;
+    }
+    if (p_good > 0.0) {
+      const double needed = std::log(1.0 - params.confidence) / std::log(1.0 - p_good);
+      if (num_hypotheses >= needed) {
+        break;
+      }
+    }
+  }
+
+  if (best_count < params.min_inliers) {
+    inlier_indices.clear();
+    return -1;
+  }
+
+  // Refit on every inlier that was triangulated in both cameras, and keep it if it's no worse.
+  GetInliers(ws, cam, best_T_10, params.max_error_stdevs, inlier_indices);
+
+  std::vector<Vector3d> P0_in, P1_in;
+  for (const int i : inlier_indices) {
+    if (P1_list[i].z() > 0) {
+      P0_in.emplace_back(P0_list[i]);
+      P1_in.emplace_back(P1_list[i]);
+    }
+  }
+
+  Matrix4d refit_T_10;
+  if (AbsoluteOrientation(P0_in.data(), P1_in.data(), P0_in.size(), refit_T_10) &&
+      CountInliers(ws, cam, refit_T_10, params.max_error_stdevs) >= best_count) {
+    best_T_10 = refit_T_10;
+    GetInliers(ws, cam, best_T_10, params.max_error_stdevs, inlier_indices);
+  }
+
+  T_10 = best_T_10;
+  return num_hypotheses;
+}
+
+
+}
+}
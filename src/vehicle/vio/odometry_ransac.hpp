@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vio/optimize_odometry.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+struct OdometryRansacParams final
+{
+  int max_hypotheses = 200;           // Stop after this many hypotheses, even if not confident.
+  int hypotheses_per_round = 16;      // Hypotheses that are scored in parallel between stop checks.
+  double confidence = 0.99;           // Stop once we're this sure that an all-inlier sample was drawn.
+  double max_error_stdevs = 3.0;      // Inlier threshold on the reprojection error.
+  double prior_inlier_ratio = 0.8;    // Skip sampling if the prior pose has this many inliers.
+  int min_inliers = 6;
+};
+
+
+// Closed form rigid transform (Kabsch) that best maps P0 onto P1, i.e P1 ~= R_10 * P0 + t_10.
+// Needs N >= 3 points that aren't all on a line. Returns false if the points are degenerate.
+bool AbsoluteOrientation(const Vector3d* P0, const Vector3d* P1, size_t N, Matrix4d& T_10);
+
+
+/**
+ * Find a rough T_10 and the inlier set before OptimizeOdometryIterative(), so that LM only ever
+ * sees inliers. Hypotheses come from 3 landmarks that were triangulated in both cameras, and are
+ * scored by how many observations in Camera_1 they reproject within max_error_stdevs of.
+ *
+ * @param P1_list : The landmarks triangulated in Camera_1 (z <= 0 if there was no disparity). Only
+ *                  used to sample hypotheses, so this can have fewer valid points than P0_list.
+ * @param T_10_prior : Optional guess (e.g last odometry rotated by the IMU). If it already explains
+ *                     prior_inlier_ratio of the observations, no hypotheses are sampled at all.
+ * @param[out] T_10 : The best hypothesis, refit on its inliers.
+ * @param[out] inlier_indices : The indices of inliers in P0_list and p1_obs_list.
+ *
+ * Returns the number of hypotheses that were scored (0 if the prior was confirmed), or -1 if fewer
+ * than min_inliers were found.
+ */
+int RansacOdometry(const std::vector<Vector3d>& P0_list,
+                   const std::vector<Vector3d>& P1_list,
+                   const std::vector<Vector2d>& p1_obs_list,
+                   const std::vector<double>& p1_sigma_list,
+                   const StereoCamera& stereo_cam,
+                   const Matrix4d* T_10_prior,
+                   const OdometryRansacParams& params,
+                   Matrix4d& T_10,
+                   std::vector<int>& inlier_indices,
+                   OdometryWorkspace& workspace);
+
+
+}
+}
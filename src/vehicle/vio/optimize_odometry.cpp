@@ -1,6 +1,10 @@
+#include <algorithm>
+#include <cmath>
+
 #include <eigen3/Eigen/QR>
 
 #include "core/math_util.hpp"
+#include "core/profiler.hpp"
 #include "core/transform_util.hpp"
 #include "vio/optimize_odometry.hpp"
 
@@ -8,101 +12,160 @@ namespace bm {
 namespace vio {
 
 
-int OptimizeOdometryIterative(const std::vector<Vector3d>& P0_list,
-                              const std::vector<Vector2d>& p1_obs_list,
-                              const std::vector<double>& p1_sigma_list,
-                              const StereoCamera& stereo_cam,
-                              Matrix4d& T_10,
-                              Matrix6d& C_10,
-                              double& error,
-                              std::vector<int>& inlier_indices,
-                              std::vector<int>& outlier_indices,
-                              int max_iters,
-                              double min_error,
-                              double min_error_delta,
-                              double max_error_stdevs)
+static void ResizeResiduals(size_t N, OdometryWorkspace::Residuals& res)
 {
-  // Do the initial pose optimization.
-  OptimizeOdometryLM(
-      P0_list, p1_obs_list, p1_sigma_list, stereo_cam,  // Inputs.
-      T_10, C_10, error,                                // Outputs.
-      max_iters, min_error, min_error_delta);           // Params.
+  res.gx.resize(N);
+  res.gy.resize(N);
+  res.gz.resize(N);
+  res.rx.resize(N);
+  res.ry.resize(N);
+  res.r.resize(N);
+}
 
-  RemovePointOutliers(T_10, P0_list, p1_obs_list, p1_sigma_list, stereo_cam, max_error_stdevs,
-                      inlier_indices, outlier_indices);
 
-  if (inlier_indices.size() < 6) {
-    T_10 = Matrix4d::Identity();
-    C_10 = Matrix6d::Identity();
-    return -1;
+void OdometryWorkspace::Load(const std::vector<Vector3d>& P0_list,
+                             const std::vector<Vector2d>& p1_obs_list,
+                             const std::vector<double>& p1_sigma_list,
+                             const std::vector<int>* indices)
+{
+  assert(P0_list.size() == p1_obs_list.size());
+  assert(p1_obs_list.size() == p1_sigma_list.size());
+
+  const size_t N = (indices != nullptr) ? indices->size() : P0_list.size();
+
+  // NOTE(milo): resize() never gives back capacity, so after the first few frames this is free.
+  x.resize(N);
+  y.resize(N);
+  z.resize(N);
+  u.resize(N);
+  v.resize(N);
+  sigma.resize(N);
+  ResizeResiduals(N, cur);
+  ResizeResiduals(N, test);
+
+  for (size_t i = 0; i < N; ++i) {
+    const size_t j = (indices != nullptr) ? indices->at(i) : i;
+    const Vector3d& P0 = P0_list.at(j);
+    x[i] = P0.x();
+    y[i] = P0.y();
+    z[i] = P0.z();
+    u[i] = p1_obs_list.at(j).x();
+    v[i] = p1_obs_list.at(j).y();
+    sigma[i] = p1_sigma_list.at(j);
   }
+}
 
-  const std::vector<Vector3d>& P0_list_refined = Subset<Vector3d>(P0_list, inlier_indices);
-  const std::vector<Vector2d>& p1_obs_list_refined = Subset<Vector2d>(p1_obs_list, inlier_indices);
-  const std::vector<double>& p1_sigma_list_refined = Subset<double>(p1_sigma_list, inlier_indices);
 
-  const int N2 = OptimizeOdometryLM(
-      P0_list_refined, p1_obs_list_refined,
-      p1_sigma_list_refined, stereo_cam,                // Inputs.
-      T_10, C_10, error,                                // Outputs.
-      max_iters, min_error, min_error_delta);           // Params.
+// Transform and project every point at T_10, and store the residuals in "res". Returns the average
+// (sigma-weighted) projection error.
+static double ComputeResiduals(const OdometryWorkspace& ws,
+                               const PinholeCamera& cam,
+                               const Matrix4d& T_10,
+                               OdometryWorkspace::Residuals& res)
+{
+  const size_t M = ws.Size();
+
+  const double R00 = T_10(0, 0), R01 = T_10(0, 1), R02 = T_10(0, 2), t0 = T_10(0, 3);
+  const double R10 = T_10(1, 0), R11 = T_10(1, 1), R12 = T_10(1, 2), t1 = T_10(1, 3);
+  const double R20 = T_10(2, 0), R21 = T_10(2, 1), R22 = T_10(2, 2), t2 = T_10(2, 3);
+  const double fx = cam.fx(), fy = cam.fy(), cx = cam.cx(), cy = cam.cy();
+
+  const double* x = ws.x.data();
+  const double* y = ws.y.data();
+  const double* z = ws.z.data();
+  const double* u = ws.u.data();
+  const double* v = ws.v.data();
+  const double* sigma = ws.sigma.data();
+  double* gx = res.gx.data();
+  double* gy = res.gy.data();
+  double* gz = res.gz.data();
+  double* rx = res.rx.data();
+  double* ry = res.ry.data();
+  double* r = res.r.data();
+
+  // NOTE(milo): Plain loops over separate arrays, so that the compiler can vectorize this.
+  for (size_t i = 0; i < M; ++i) {
+    gx[i] = R00*x[i] + R01*y[i] + R02*z[i] + t0;
+    gy[i] = R10*x[i] + R11*y[i] + R12*z[i] + t1;
+    gz[i] = R20*x[i] + R21*y[i] + R22*z[i] + t2;
+    rx[i] = u[i] - (fx*gx[i]/gz[i] + cx);
+    ry[i] = v[i] - (fy*gy[i]/gz[i] + cy);
+    r[i] = std::sqrt(rx[i]*rx[i] + ry[i]*ry[i]);
+  }
 
-  return N2;
+  double error = 0.0;
+  for (size_t i = 0; i < M; ++i) {
+    error += r[i] / sigma[i];
+  }
+
+  return error / static_cast<double>(M);
 }
 
 
-static double ComputeProjectionError(const std::vector<Vector3d>& P0_list,
-                                    const std::vector<Vector2d>& p1_obs_list,
-                                    const std::vector<double>& p1_sigma_list,
-                                    const StereoCamera& stereo_cam,
-                                    const Matrix4d& T_10)
+// Build the Gauss-Newton normal equations (H = J^T * J, g = -J^T * R) from residuals that were
+// already computed by ComputeResiduals().
+static void AccumulateNormalEquations(const OdometryWorkspace& ws,
+                                      const OdometryWorkspace::Residuals& res,
+                                      double fx,
+                                      double fy,
+                                      Matrix6d& H,
+                                      Vector6d& g)
 {
-  assert(P0_list.size() == p1_obs_list.size());
-  assert(p1_obs_list.size() == p1_sigma_list.size());
+  H.setZero();
+  g.setZero();
 
-  const int M = P0_list.size();
+  Vector6d Ji;
 
-  double error = 0.0;
+  for (size_t i = 0; i < ws.Size(); ++i) {
+    const double rx = res.rx[i];
+    const double ry = res.ry[i];
+    const double r = res.r[i];
+    const double sigma = ws.sigma[i];
+    const double r_sigma = r / sigma;
+    const double weight = RobustWeightCauchy(r_sigma);
 
-  const PinholeCamera& cam = stereo_cam.LeftCamera();
+    const double chain_rule_terms = -weight / std::max(1e-5, sigma*r);
 
-  // Add up projection errors from all associated points.
-  for (size_t i = 0; i < P0_list.size(); ++i) {
-    const Vector3d P1 = T_10.block<3, 3>(0, 0)*P0_list.at(i) + T_10.col(3).head(3);
-
-    // Project P1 to a pixel location in Camera_1.
-    const Vector2d p = cam.Project(P1);
-    const Vector2d p_hat = p1_obs_list.at(i);
-    const double rx = p_hat.x() - p.x();
-    const double ry = p_hat.y() - p.y();
-    const double r2 = rx*rx + ry*ry;
-    const double r = std::sqrt(r2);
-    const double sigma = p1_sigma_list.at(i);
-    const double r_sigma = r / sigma;
+    // NOTE(milo): See page 54 for derivation of the Jacobian below.
+    // https://jinyongjeong.github.io/Download/SE3/jlblanco2010geometry3d_techrep.pdf
+    const double gx = res.gx[i];
+    const double gy = res.gy[i];
+    const double gz = std::max(1e-5, res.gz[i]);
+    const double gz2 = gz*gz;
 
-    error += r_sigma;
-  }
+    Ji << + rx*fx / gz,
+          + ry*fy / gz,
+          - (rx*fx*gx + ry*fy*gy) / gz2,
+          - rx*fx*gx*gy/gz2 - ry*fy*(1.0 + gy*gy/gz2),
+          + rx*fx*(1.0 + gx*gx/gz2) + ry*fy*gx*gy/gz2,
+          - rx*fx*gy/gz + ry*fy*gx/gz;
+    Ji *= chain_rule_terms;
 
-  return error / static_cast<double>(M);
+    // Fixed-size outer product, so no temporaries and Eigen can vectorize it.
+    H.noalias() += Ji * Ji.transpose();
+    g.noalias() -= (weight * r_sigma) * Ji;
+  }
 }
 
 
-int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
-                                  const std::vector<Vector2d>& p1_obs_list,
-                                  const std::vector<double>& p1_sigma_list,
-                                  const StereoCamera& stereo_cam,
-                                  Matrix4d& T_10,
-                                  Matrix6d& C_10,
-                                  double& error,
-                                  int max_iters,
-                                  double min_error,
-                                  double min_error_delta)
+// LM on a problem that's already loaded into the workspace. On return, ws.cur holds the residuals
+// at T_10.
+static int OptimizeOdometryLM(OdometryWorkspace& ws,
+                              const StereoCamera& stereo_cam,
+                              Matrix4d& T_10,
+                              Matrix6d& C_10,
+                              double& error,
+                              int max_iters,
+                              double min_error,
+                              double min_error_delta)
 {
   // Set the initial guess (if not already set).
   if (T_10(3, 3) != 1.0) {
     T_10 = Matrix4d::Identity();
   }
 
+  const PinholeCamera& cam = stereo_cam.LeftCamera();
+
   Matrix6d H;       // Current estimated Hessian of error w.r.t T_eps.
   Vector6d g;       // Current estimated gradient of error w.r.t T_eps.
   Vector6d T_eps;   // An incremental update to T_10.
@@ -112,7 +175,8 @@ int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
   const double lambda_k_increase = 2.0;
   const double lambda_k_decrease = 3.0;
 
-  LinearizeProjection(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, H, g, err);
+  err = ComputeResiduals(ws, cam, T_10, ws.cur);
+  AccumulateNormalEquations(ws, ws.cur, cam.fx(), cam.fy(), H, g);
   err_prev = err + 1;
 
   // https://arxiv.org/pdf/1201.5885.pdf
@@ -127,7 +191,7 @@ int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
 
     // Check if applying T_eps would improve error.
     const Matrix4d T_10_test = expmap_se3(T_eps) * T_10;
-    err = ComputeProjectionError(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10_test);
+    err = ComputeResiduals(ws, cam, T_10_test, ws.test);
 
     if (err < min_error) {
       break;
@@ -137,19 +201,18 @@ int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
     // See: https://en.wikipedia.org/wiki/Levenberg%E2%80%93Marquardt_algorithm
     if (err >= err_prev) {
       lambda *= lambda_k_increase;
-      // printf("Error increased, increasing lambda (prev=%lf, err=%lf, lambda=%lf)\n", err_prev, err, lambda);
 
     // If error improves, decrease the damping factor (more like Gauss-Newton).
     // See: https://en.wikipedia.org/wiki/Levenberg%E2%80%93Marquardt_algorithm
     } else {
       lambda /= lambda_k_decrease;
-      // printf("Error decreased, decreasing lambda (prev=%lf, err=%lf, lambda=%lf)\n", err_prev, err, lambda);
       err_prev = err;
 
       T_10 = T_10_test;
 
-      // Need to re-linearize because we updated T_10.
-      LinearizeProjection(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, H, g, err);
+      // Need to re-linearize because we updated T_10. The residuals at T_10_test are reused.
+      std::swap(ws.cur, ws.test);
+      AccumulateNormalEquations(ws, ws.cur, cam.fx(), cam.fy(), H, g);
     }
   }
 
@@ -160,78 +223,117 @@ int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
 }
 
 
-void LinearizeProjection(const std::vector<Vector3d>& P0_list,
-                          const std::vector<Vector2d>& p1_obs_list,
-                          const std::vector<double>& p1_sigma_list,
-                          const StereoCamera& stereo_cam,
-                          const Matrix4d& T_10,
-                          Matrix6d& H,
-                          Vector6d& g,
-                          double& error)
+int OptimizeOdometryIterative(const std::vector<Vector3d>& P0_list,
+                              const std::vector<Vector2d>& p1_obs_list,
+                              const std::vector<double>& p1_sigma_list,
+                              const StereoCamera& stereo_cam,
+                              Matrix4d& T_10,
+                              Matrix6d& C_10,
+                              double& error,
+                              std::vector<int>& inlier_indices,
+                              std::vector<int>& outlier_indices,
+                              int max_iters,
+                              double min_error,
+                              double min_error_delta,
+                              double max_error_stdevs)
 {
-  assert(P0_list.size() == p1_obs_list.size());
-  assert(p1_obs_list.size() == p1_sigma_list.size());
-
-  const int M = P0_list.size();
+  OdometryWorkspace workspace;
+  return OptimizeOdometryIterative(
+      P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, C_10, error,
+      inlier_indices, outlier_indices, max_iters, min_error, min_error_delta, max_error_stdevs,
+      workspace);
+}
 
-  // Initialize Jacobian w/ zeros.
-  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(M, 6);
 
-  // Initialize residual error vector R.
-  Eigen::VectorXd R = Eigen::VectorXd::Zero(M);
+int OptimizeOdometryIterative(const std::vector<Vector3d>& P0_list,
+                              const std::vector<Vector2d>& p1_obs_list,
+                              const std::vector<double>& p1_sigma_list,
+                              const StereoCamera& stereo_cam,
+                              Matrix4d& T_10,
+                              Matrix6d& C_10,
+                              double& error,
+                              std::vector<int>& inlier_indices,
+                              std::vector<int>& outlier_indices,
+                              int max_iters,
+                              double min_error,
+                              double min_error_delta,
+                              double max_error_stdevs,
+                              OdometryWorkspace& workspace)
+{
+  MACRO_PROFILE_SCOPE("OptimizeOdometryIterative");
+  OdometryWorkspace& ws = workspace;
 
-  error = 0.0;             // Line projection error.
+  // Do the initial pose optimization.
+  ws.Load(P0_list, p1_obs_list, p1_sigma_list);
+  OptimizeOdometryLM(
+      ws, stereo_cam,                                   // Inputs.
+      T_10, C_10, error,                                // Outputs.
+      max_iters, min_error, min_error_delta);           // Params.
 
-  const PinholeCamera& cam = stereo_cam.LeftCamera();
+  // The residuals at the optimized T_10 are already in ws.cur, so outlier rejection doesn't need to
+  // project anything again.
+  inlier_indices.clear();
+  outlier_indices.clear();
+  for (size_t i = 0; i < ws.Size(); ++i) {
+    if (ws.cur.r[i] < (ws.sigma[i] * max_error_stdevs)) {
+      inlier_indices.emplace_back(i);
+    } else {
+      outlier_indices.emplace_back(i);
+    }
+  }
 
-  // Add up projection errors from all associated points.
-  for (size_t i = 0; i < P0_list.size(); ++i) {
-    const Vector3d P1 = T_10.block<3, 3>(0, 0)*P0_list.at(i) + T_10.col(3).head(3);
+  if (inlier_indices.size() < 6) {
+    T_10 = Matrix4d::Identity();
+    C_10 = Matrix6d::Identity();
+    return -1;
+  }
 
-    // TODO: filter out points that project behind the camera...
+  ws.Load(P0_list, p1_obs_list, p1_sigma_list, &inlier_indices);
 
-    // Project P1 to a pixel location in Camera_1.
-    const Vector2d p = cam.Project(P1);
-    const Vector2d p_hat = p1_obs_list.at(i);
-    const double rx = p_hat.x() - p.x();
-    const double ry = p_hat.y() - p.y();
-    const double r2 = rx*rx + ry*ry;
-    const double r = std::sqrt(r2);
-    const double sigma = p1_sigma_list.at(i);
-    const double r_sigma = r / sigma;
-    const double weight = RobustWeightCauchy(r_sigma);
+  const int N2 = OptimizeOdometryLM(
+      ws, stereo_cam,                                   // Inputs.
+      T_10, C_10, error,                                // Outputs.
+      max_iters, min_error, min_error_delta);           // Params.
 
-    const double chain_rule_terms = -weight / std::max(1e-5, sigma*r);
+  return N2;
+}
 
-    // NOTE(milo): See page 54 for derivation of the Jacobian below.
-    // https://jinyongjeong.github.io/Download/SE3/jlblanco2010geometry3d_techrep.pdf
-    const double gx = P1.x();
-    const double gy = P1.y();
-    const double gz = std::max(1e-5, P1.z());
-    const double gz2 = gz*gz;
-    const double fx = stereo_cam.fx();
-    const double fy = stereo_cam.fy();
 
-    Vector6d Ji;
-    Ji << + rx*fx / gz,
-          + ry*fy / gz,
-          - (rx*fx*gx + ry*fy*gy) / gz2,
-          - rx*fx*gx*gy/gz2 - ry*fy*(1.0 + gy*gy/gz2),
-          + rx*fx*(1.0 + gx*gx/gz2) + ry*fy*gx*gy/gz2,
-          - rx*fx*gy/gz + ry*fy*gx/gz;
+int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
+                       const std::vector<Vector2d>& p1_obs_list,
+                       const std::vector<double>& p1_sigma_list,
+                       const StereoCamera& stereo_cam,
+                       Matrix4d& T_10,
+                       Matrix6d& C_10,
+                       double& error,
+                       int max_iters,
+                       double min_error,
+                       double min_error_delta)
+{
+  OdometryWorkspace ws;
+  ws.Load(P0_list, p1_obs_list, p1_sigma_list);
+  return OptimizeOdometryLM(ws, stereo_cam, T_10, C_10, error, max_iters, min_error, min_error_delta);
+}
 
-    J.row(i) = chain_rule_terms * Ji;
-    R(i) = weight * r_sigma;
-    error += r_sigma;
-  }
 
-  H = J.transpose() * J;
-  g = -J.transpose() * R;
+void LinearizeProjection(const std::vector<Vector3d>& P0_list,
+                         const std::vector<Vector2d>& p1_obs_list,
+                         const std::vector<double>& p1_sigma_list,
+                         const StereoCamera& stereo_cam,
+                         const Matrix4d& T_10,
+                         Matrix6d& H,
+                         Vector6d& g,
+                         double& error)
+{
+  OdometryWorkspace ws;
+  ws.Load(P0_list, p1_obs_list, p1_sigma_list);
 
-  // Compute the AVERAGE error across all points.
-  error /= static_cast<double>(M);
+  const PinholeCamera& cam = stereo_cam.LeftCamera();
+  error = ComputeResiduals(ws, cam, T_10, ws.cur);
+  AccumulateNormalEquations(ws, ws.cur, cam.fx(), cam.fy(), H, g);
 }
 
+
 int RemovePointOutliers(const Matrix4d& T_10,
                         const std::vector<Vector3d>& P0_list,
                         const std::vector<Vector2d>& p1_obs_list,
@@ -248,10 +350,11 @@ int RemovePointOutliers(const Matrix4d& T_10,
   outlier_indices.clear();
 
   const PinholeCamera& cam = stereo_cam.LeftCamera();
+  std::vector<Vector2d> p1_list;
+  cam.Project(SE3(T_10).TransformPoints(P0_list), p1_list);
 
   for (size_t i = 0; i < P0_list.size(); ++i) {
-    const Vector3d P1 = T_10.block<3, 3>(0, 0) * P0_list.at(i) + T_10.col(3).head(3);
-    const Vector2d p1 = cam.Project(P1);
+    const Vector2d& p1 = p1_list.at(i);
 
     // Euclidean reprojection error.
     const double e = (p1 - p1_obs_list.at(i)).norm();
@@ -11,6 +11,35 @@ namespace vio {
 using namespace core;
 
 
+// Structure-of-arrays copy of an odometry problem, plus the residuals at the current and candidate
+// poses. The LM solver works out of one of these so that the error and linearization passes can
+// share residuals. Reuse the same workspace across frames and the pose solve won't allocate.
+struct OdometryWorkspace final
+{
+  // Residuals of each point, at some pose T_10.
+  struct Residuals final
+  {
+    std::vector<double> gx, gy, gz;   // The point in Camera_1.
+    std::vector<double> rx, ry, r;    // Observed minus projected pixel, and its norm.
+  };
+
+  size_t Size() const { return x.size(); }
+
+  // Copy the problem in (or the subset of it at "indices" if non-null).
+  void Load(const std::vector<Vector3d>& P0_list,
+            const std::vector<Vector2d>& p1_obs_list,
+            const std::vector<double>& p1_sigma_list,
+            const std::vector<int>* indices = nullptr);
+
+  std::vector<double> x, y, z;      // Points in Camera_0.
+  std::vector<double> u, v;         // Observations in Camera_1.
+  std::vector<double> sigma;        // Pixel standard deviation of each observation.
+
+  Residuals cur;                    // Residuals at the current estimate of T_10.
+  Residuals test;                   // Residuals at a candidate T_10.
+};
+
+
 // See: https://arxiv.org/pdf/1701.03077.pdf
 inline double RobustWeightCauchy(double residual)
 {
@@ -39,6 +68,23 @@ int OptimizeOdometryIterative(const std::vector<Vector3d>& P0_list,
                               double max_error_stdevs);
 
 
+// Same as above, but uses (and reuses) the memory in "workspace".
+int OptimizeOdometryIterative(const std::vector<Vector3d>& P0_list,
+                              const std::vector<Vector2d>& p1_obs_list,
+                              const std::vector<double>& p1_sigma_list,
+                              const StereoCamera& stereo_cam,
+                              Matrix4d& T_10,
+                              Matrix6d& C_10,
+                              double& error,
+                              std::vector<int>& inlier_indices,
+                              std::vector<int>& outlier_indices,
+                              int max_iters,
+                              double min_error,
+                              double min_error_delta,
+                              double max_error_stdevs,
+                              OdometryWorkspace& workspace);
+
+
 int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
                       const std::vector<Vector2d>& p1_obs_list,
                       const std::vector<double>& p1_sigma_list,
@@ -0,0 +1,118 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "vio/overload_controller.hpp"
+
+namespace bm {
+namespace vio {
+
+
+std::string to_string(OverloadLevel level)
+{
+  switch (level) {
+    case OverloadLevel::NOMINAL:
+      return "NOMINAL";
+    case OverloadLevel::SKIP_FRAMES:
+      return "SKIP_FRAMES";
+    case OverloadLevel::FEWER_FEATURES:
+      return "FEWER_FEATURES";
+    case OverloadLevel::COARSE_KLT:
+      return "COARSE_KLT";
+    case OverloadLevel::FEWER_SMOOTHER_ITERS:
+      return "FEWER_SMOOTHER_ITERS";
+    case OverloadLevel::SKIP_COVARIANCE:
+      return "SKIP_COVARIANCE";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+
+void OverloadController::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("queue_high", &queue_high);
+  parser.GetParam("frontend_budget_ms", &frontend_budget_ms);
+  parser.GetParam("smoother_budget_ms", &smoother_budget_ms);
+  parser.GetParam("queue_low", &queue_low);
+  parser.GetParam("recover_fraction", &recover_fraction);
+  parser.GetParam("escalate_after", &escalate_after);
+  parser.GetParam("recover_after", &recover_after);
+  parser.GetParam("max_level", &max_level);
+  parser.GetParam("skip_frames_k", &skip_frames_k);
+  parser.GetParam("reduced_features_fraction", &reduced_features_fraction);
+  parser.GetParam("reduced_klt_max_level", &reduced_klt_max_level);
+  parser.GetParam("reduced_extra_smoothing_iters", &reduced_extra_smoothing_iters);
+  parser.GetParam("reduced_covariance_every_n", &reduced_covariance_every_n);
+
+  CHECK_LT(queue_low, queue_high);
+  CHECK(recover_fraction > 0 && recover_fraction < 1) << "recover_fraction must be in (0, 1)" << std::endl;
+  CHECK_GE(escalate_after, 1);
+  CHECK_GE(recover_after, 1);
+  CHECK(max_level >= 0 && max_level <= static_cast<int>(OverloadLevel::SKIP_COVARIANCE));
+  CHECK_GE(skip_frames_k, 2);
+  CHECK(reduced_features_fraction > 0 && reduced_features_fraction <= 1);
+  CHECK_GE(reduced_klt_max_level, 0);
+  CHECK_GE(reduced_extra_smoothing_iters, 0);
+  CHECK_GE(reduced_covariance_every_n, 1);
+}
+
+
+OverloadController::OverloadController(const Params& params)
+    : params_(params) {}
+
+
+void OverloadController::ReportFrontend(double queue_fill, double latency_ms)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  frontend_queue_fill_ = queue_fill;
+  frontend_latency_ms_ = latency_ms;
+  Evaluate();
+}
+
+
+void OverloadController::ReportSmoother(double queue_fill, double latency_ms)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  smoother_queue_fill_ = queue_fill;
+  smoother_latency_ms_ = latency_ms;
+  Evaluate();
+}
+
+
+void OverloadController::Evaluate()
+{
+  const bool overloaded = std::max(frontend_queue_fill_, smoother_queue_fill_) > params_.queue_high ||
+                          frontend_latency_ms_ > params_.frontend_budget_ms ||
+                          smoother_latency_ms_ > params_.smoother_budget_ms;
+
+  const bool recovering = std::max(frontend_queue_fill_, smoother_queue_fill_) < params_.queue_low &&
+                          frontend_latency_ms_ < params_.recover_fraction * params_.frontend_budget_ms &&
+                          smoother_latency_ms_ < params_.recover_fraction * params_.smoother_budget_ms;
+
+  // NOTE(milo): Anything in between keeps the current level, and restarts both counts.
+  num_overloaded_ = overloaded ? (num_overloaded_ + 1) : 0;
+  num_recovering_ = recovering ? (num_recovering_ + 1) : 0;
+
+  const int level = level_.load();
+  int new_level = level;
+
+  if (num_overloaded_ >= params_.escalate_after && level < params_.max_level) {
+    new_level = level + 1;
+  } else if (num_recovering_ >= params_.recover_after && level > 0) {
+    new_level = level - 1;
+  }
+
+  if (new_level != level) {
+    num_overloaded_ = 0;
+    num_recovering_ = 0;
+    level_.store(new_level);
+    num_transitions_.fetch_add(1);
+    LOG(WARNING) << "OverloadController: " << to_string(static_cast<OverloadLevel>(level)) << " --> "
+                 << to_string(static_cast<OverloadLevel>(new_level)) << std::endl;
+  }
+}
+
+
+}
+}
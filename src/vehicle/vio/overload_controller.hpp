@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// How much work the StateEstimator is skipping to keep up. Each level also does everything that the
+// levels below it do, and they're ordered so that the cheapest losses in accuracy come first.
+enum class OverloadLevel : int
+{
+  NOMINAL = 0,
+  SKIP_FRAMES = 1,            // Only track every skip_frames_k-th image.
+  FEWER_FEATURES = 2,         // Keep fewer features per frame.
+  COARSE_KLT = 3,             // Track with fewer pyramid levels.
+  FEWER_SMOOTHER_ITERS = 4,   // Cut the smoother's extra iters.
+  SKIP_COVARIANCE = 5         // Only compute marginal covariances every few keyposes.
+};
+
+std::string to_string(OverloadLevel level);
+
+
+// Steps through OverloadLevels when the StateEstimator can't keep up, instead of letting its queues
+// fill up and drop data. The frontend and smoother report their queue fill (0 to 1) and how long
+// they took. If any of those is over its limit for escalate_after reports in a row, the level goes
+// up by one. Once all of them are well under their limits for recover_after reports in a row, it
+// goes back down by one. Recovery is slower than escalation, so that the level doesn't oscillate.
+//
+// ReportFrontend() is called from the frontend, ReportSmoother() from the smoother, and Level() from
+// either. All of them are threadsafe.
+class OverloadController final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double queue_high = 0.5;            // Overloaded if a queue is fuller than this ...
+    double frontend_budget_ms = 50.0;   // ... or a frame takes longer than this to track ...
+    double smoother_budget_ms = 300.0;  // ... or a keypose takes longer than this to smooth.
+
+    // Recovering once every queue is emptier than queue_low, and every stage takes less than
+    // recover_fraction of its budget.
+    double queue_low = 0.1;
+    double recover_fraction = 0.5;
+
+    int escalate_after = 3;
+    int recover_after = 20;
+    int max_level = 5;                  // Don't go past this OverloadLevel.
+
+    // What the levels do.
+    int skip_frames_k = 2;
+    double reduced_features_fraction = 0.5;
+    int reduced_klt_max_level = 2;
+    int reduced_extra_smoothing_iters = 0;
+    int reduced_covariance_every_n = 5;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(OverloadController)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(OverloadController)
+
+  explicit OverloadController(const Params& params);
+
+  // The fill of the raw image queue, and how long the last frame took to track.
+  void ReportFrontend(double queue_fill, double latency_ms);
+
+  // The fill of the keyframe queue, and the latency of the last keypose.
+  void ReportSmoother(double queue_fill, double latency_ms);
+
+  OverloadLevel Level() const { return static_cast<OverloadLevel>(level_.load()); }
+
+  // Number of times that the level has changed.
+  int NumTransitions() const { return num_transitions_.load(); }
+
+  const Params& GetParams() const { return params_; }
+
+ private:
+  // Updates the level using the latest reports from both stages. Call with mutex_ held.
+  void Evaluate();
+
+ private:
+  Params params_;
+
+  std::mutex mutex_;
+  double frontend_queue_fill_ = 0;
+  double frontend_latency_ms_ = 0;
+  double smoother_queue_fill_ = 0;
+  double smoother_latency_ms_ = 0;
+  int num_overloaded_ = 0;    // Reports in a row.
+  int num_recovering_ = 0;
+
+  std::atomic<int> level_{0};
+  std::atomic<int> num_transitions_{0};
+};
+
+
+}
+}
@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "vio/power_governor.hpp"
+
+namespace bm {
+namespace vio {
+
+
+static const double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+
+// Reads the first number in a sysfs file, or NaN if it can't.
+static double ReadSysfsValue(const std::string& path)
+{
+  std::ifstream file(path);
+  double value = kNaN;
+  if (!(file >> value)) {
+    return kNaN;
+  }
+  return value;
+}
+
+
+void PowerGovernor::Params::LoadParams(const YamlParser& parser)
+{
+  const cv::FileNode& temperature_node = parser.GetNode("temperature_paths");
+  CHECK(temperature_node.isSeq()) << "PowerGovernor temperature_paths must be a sequence" << std::endl;
+  temperature_paths.clear();
+  for (cv::FileNodeIterator it = temperature_node.begin(); it != temperature_node.end(); ++it) {
+    temperature_paths.emplace_back(YamlToString(*it));
+  }
+
+  power_path = YamlToString(parser.GetNode("power_path"));
+  parser.GetParam("power_scale", &power_scale);
+  parser.GetParam("poll_hz", &poll_hz);
+  parser.GetParam("max_temp_c", &max_temp_c);
+  parser.GetParam("power_budget_w", &power_budget_w);
+  parser.GetParam("recover_temp_margin_c", &recover_temp_margin_c);
+  parser.GetParam("recover_power_fraction", &recover_power_fraction);
+  parser.GetParam("throttle_after", &throttle_after);
+  parser.GetParam("recover_after", &recover_after);
+
+  const cv::FileNode& ladder_node = parser.GetNode("ladder");
+  CHECK(ladder_node.isSeq()) << "PowerGovernor ladder must be a sequence" << std::endl;
+  ladder.clear();
+  for (cv::FileNodeIterator it = ladder_node.begin(); it != ladder_node.end(); ++it) {
+    const cv::FileNode& rung_node = *it;
+    PerformanceRung rung;
+    rung_node["frontend_skip_k"] >> rung.frontend_skip_k;
+    rung_node["features_fraction"] >> rung.features_fraction;
+    rung_node["dense_stereo_hz"] >> rung.dense_stereo_hz;
+    rung_node["enhancement_hz"] >> rung.enhancement_hz;
+    CHECK_GE(rung.frontend_skip_k, 1) << "Rung " << ladder.size() << std::endl;
+    CHECK(rung.features_fraction > 0 && rung.features_fraction <= 1)
+        << "features_fraction must be in (0, 1] for rung " << ladder.size() << std::endl;
+    CHECK_GE(rung.dense_stereo_hz, 0);
+    CHECK_GE(rung.enhancement_hz, 0);
+    ladder.emplace_back(rung);
+  }
+
+  CHECK(!ladder.empty()) << "PowerGovernor needs at least one rung" << std::endl;
+  CHECK_GT(poll_hz, 0);
+  CHECK_GT(power_scale, 0);
+  CHECK_GE(power_budget_w, 0);
+  CHECK_GE(recover_temp_margin_c, 0);
+  CHECK(recover_power_fraction > 0 && recover_power_fraction < 1) << "recover_power_fraction must be in (0, 1)" << std::endl;
+  CHECK_GE(throttle_after, 1);
+  CHECK_GE(recover_after, 1);
+}
+
+
+PowerGovernor::PowerGovernor(const Params& params)
+    : params_(params),
+      temp_c_(kNaN),
+      power_w_(kNaN)
+{
+  CHECK(!params_.ladder.empty()) << "PowerGovernor needs at least one rung" << std::endl;
+}
+
+
+PowerGovernor::~PowerGovernor()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_shutdown_ = true;
+  }
+  shutdown_cv_.notify_all();
+
+  if (poll_thread_.joinable()) {
+    poll_thread_.join();
+  }
+}
+
+
+void PowerGovernor::Start()
+{
+  CHECK(!poll_thread_.joinable()) << "PowerGovernor was already started" << std::endl;
+  poll_thread_ = std::thread(&PowerGovernor::PollLoop, this);
+}
+
+
+void PowerGovernor::Report(double temp_c, double power_w, double dt_sec)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  temp_c_ = temp_c;
+  power_w_ = power_w;
+  if (!std::isnan(power_w) && dt_sec > 0) {
+    energy_j_ += power_w * dt_sec;
+  }
+
+  // NOTE(milo): An unknown reading doesn't count as over or under its limit, so a governor without
+  // a power monitor only looks at the temperature (and vice versa).
+  const bool has_temp = !std::isnan(temp_c);
+  const bool has_power = !std::isnan(power_w) && params_.power_budget_w > 0;
+
+  const bool is_over = (has_temp && temp_c > params_.max_temp_c) ||
+                       (has_power && power_w > params_.power_budget_w);
+  const bool is_under = (has_temp || has_power) &&
+                        (!has_temp || temp_c < (params_.max_temp_c - params_.recover_temp_margin_c)) &&
+                        (!has_power || power_w < (params_.recover_power_fraction * params_.power_budget_w));
+
+  num_over_ = is_over ? (num_over_ + 1) : 0;
+  num_under_ = is_under ? (num_under_ + 1) : 0;
+
+  const int index = rung_index_.load();
+  int next = index;
+  if (num_over_ >= params_.throttle_after && index < (NumRungs() - 1)) {
+    next = index + 1;
+  } else if (num_under_ >= params_.recover_after && index > 0) {
+    next = index - 1;
+  }
+
+  if (next == index) {
+    return;
+  }
+
+  LOG(INFO) << "PowerGovernor: rung " << index << " --> " << next
+            << " (temp_c=" << temp_c << " power_w=" << power_w << ")" << std::endl;
+  num_over_ = 0;
+  num_under_ = 0;
+  rung_index_.store(next);
+  ++num_transitions_;
+}
+
+
+void PowerGovernor::CountEstimate()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++num_estimates_;
+}
+
+
+double PowerGovernor::EnergyJoules() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return energy_j_;
+}
+
+
+double PowerGovernor::EnergyPerEstimateJ() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return (num_estimates_ > 0) ? (energy_j_ / num_estimates_) : 0.0;
+}
+
+
+double PowerGovernor::TemperatureC() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return temp_c_;
+}
+
+
+double PowerGovernor::PowerW() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return power_w_;
+}
+
+
+void PowerGovernor::PollLoop()
+{
+  LOG(INFO) << "Started up PowerGovernor thread" << std::endl;
+
+  const std::chrono::duration<double> period(1.0 / params_.poll_hz);
+  std::vector<bool> did_warn(params_.temperature_paths.size(), false);
+  bool did_warn_power = false;
+
+  auto last_time = std::chrono::steady_clock::now();
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (shutdown_cv_.wait_for(lock, period, [this]{ return is_shutdown_; })) {
+        break;
+      }
+    }
+
+    double temp_c = kNaN;
+    for (size_t i = 0; i < params_.temperature_paths.size(); ++i) {
+      const double millidegrees = ReadSysfsValue(params_.temperature_paths.at(i));
+      if (std::isnan(millidegrees)) {
+        LOG_IF(WARNING, !did_warn.at(i)) << "PowerGovernor can't read " << params_.temperature_paths.at(i) << std::endl;
+        did_warn.at(i) = true;
+        continue;
+      }
+      temp_c = std::isnan(temp_c) ? (1e-3 * millidegrees) : std::max(temp_c, 1e-3 * millidegrees);
+    }
+
+    double power_w = kNaN;
+    if (!params_.power_path.empty()) {
+      power_w = params_.power_scale * ReadSysfsValue(params_.power_path);
+      LOG_IF(WARNING, std::isnan(power_w) && !did_warn_power) << "PowerGovernor can't read " << params_.power_path << std::endl;
+      did_warn_power |= std::isnan(power_w);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    Report(temp_c, power_w, std::chrono::duration<double>(now - last_time).count());
+    last_time = now;
+  }
+
+  LOG(INFO) << "Shutdown PowerGovernor thread" << std::endl;
+}
+
+
+}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// How much work the perception stack does on one rung of a PowerGovernor's ladder. Rung 0 is full
+// performance, and each rung after it should be cheaper than the one before.
+struct PerformanceRung final
+{
+  int frontend_skip_k = 1;          // Track every k-th image (1 = all of them).
+  double features_fraction = 1.0;   // Of max_features_per_frame.
+
+  // For the nodes that run dense stereo and underwater enhancement (e.g with a DataSubsampler).
+  // Zero means no limit.
+  double dense_stereo_hz = 0;
+  double enhancement_hz = 0;
+};
+
+
+// Moves along a ladder of PerformanceRungs to keep the computer under a temperature limit and a
+// power budget, so that it throttles itself gradually instead of hitting the CPU/GPU's thermal
+// throttling partway through a mission. Temperatures and power are read from sysfs files (e.g
+// /sys/class/thermal/thermal_zone*/temp, or an INA3221 power monitor on a Jetson) at poll_hz.
+//
+// If the hottest zone is over max_temp_c or the power is over power_budget_w for throttle_after polls
+// in a row, it moves down one rung. Once the temperature is recover_temp_margin_c under the limit and
+// the power is under recover_power_fraction of the budget for recover_after polls in a row, it moves
+// back up one. Like the OverloadController, recovering is slower than throttling.
+//
+// The energy used (integrated from the power readings) is divided by the number of estimates that
+// were delivered (see CountEstimate()), to compare the cost of the rungs and missions.
+//
+// NOTE(milo): Everything is threadsafe. Rung() is cheap enough to call on every frame.
+class PowerGovernor final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    std::vector<std::string> temperature_paths;   // Millidegrees C, the hottest one is used.
+    std::string power_path;                       // Empty if there's no power monitor.
+    double power_scale = 1e-6;                    // Multiplies the power_path value to get watts (1e-6 for uW).
+    double poll_hz = 2.0;
+
+    double max_temp_c = 80.0;
+    double power_budget_w = 0.0;                  // Zero = no power budget.
+    double recover_temp_margin_c = 5.0;
+    double recover_power_fraction = 0.8;
+    int throttle_after = 2;
+    int recover_after = 10;
+
+    std::vector<PerformanceRung> ladder = std::vector<PerformanceRung>(1);
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(PowerGovernor)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(PowerGovernor)
+
+  explicit PowerGovernor(const Params& params);
+
+  ~PowerGovernor();
+
+  // Starts polling the sensors on a thread, until this is destroyed.
+  void Start();
+
+  // Moves along the ladder for one reading: the hottest temperature, and the power draw over the
+  // dt_sec since the last reading (NaN if either is unknown). Called by the polling thread, but can
+  // be called directly (e.g in tests, or with readings from somewhere else) if Start() isn't.
+  void Report(double temp_c, double power_w, double dt_sec);
+
+  // Count an estimate that was delivered (e.g a smoother result).
+  void CountEstimate();
+
+  const Params& GetParams() const { return params_; }
+
+  int RungIndex() const { return rung_index_.load(); }
+  const PerformanceRung& Rung() const { return params_.ladder.at(RungIndex()); }
+  int NumRungs() const { return static_cast<int>(params_.ladder.size()); }
+
+  // Energy used since construction (J), and per estimate delivered (zero if there weren't any).
+  double EnergyJoules() const;
+  double EnergyPerEstimateJ() const;
+
+  // Latest readings (NaN if unknown).
+  double TemperatureC() const;
+  double PowerW() const;
+
+  // Number of times that the rung has changed.
+  int NumTransitions() const { return num_transitions_.load(); }
+
+ private:
+  void PollLoop();
+
+ private:
+  Params params_;
+
+  mutable std::mutex mutex_;
+  double temp_c_;
+  double power_w_;
+  double energy_j_ = 0;
+  size_t num_estimates_ = 0;
+  int num_over_ = 0;          // Readings in a row.
+  int num_under_ = 0;
+
+  std::atomic<int> rung_index_{0};
+  std::atomic<int> num_transitions_{0};
+
+  bool is_shutdown_ = false;  // Protected by mutex_.
+  std::condition_variable shutdown_cv_;
+  std::thread poll_thread_;
+};
+
+
+}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <gtsam/nonlinear/NonlinearFactor.h>
+#include <gtsam/geometry/Pose3.h>
+
+namespace gtsam {
+
+
+// Range from a receiver on the body to a beacon at a known point in the world frame (e.g an acoustic
+// range). Unlike gtsam::RangeFactor, the beacon isn't a variable, so each range only adds a factor
+// on the keypose that it belongs to.
+class RangeToPointFactor : public gtsam::NoiseModelFactor1<gtsam::Pose3> {
+ public:
+  explicit RangeToPointFactor(gtsam::Key pose_key,
+                              const gtsam::Point3& world_t_point,
+                              double measured,
+                              const gtsam::SharedNoiseModel& noise_model,
+                              const gtsam::Pose3& body_P_receiver = gtsam::Pose3::identity())
+      : gtsam::NoiseModelFactor1<gtsam::Pose3>(noise_model, pose_key),
+        world_t_point_(world_t_point),
+        measured_(measured),
+        body_t_receiver_(body_P_receiver.translation()) {}
+
+  gtsam::NonlinearFactor::shared_ptr clone() const override
+  {
+    return boost::static_pointer_cast<gtsam::NonlinearFactor>(
+        gtsam::NonlinearFactor::shared_ptr(new RangeToPointFactor(*this)));
+  }
+
+  // Returns the error and Jacobian (1x6) of this factor, linearized at the current world_P_body.
+  gtsam::Vector evaluateError(const gtsam::Pose3& world_P_body,
+                              boost::optional<gtsam::Matrix&> H1 = boost::none) const override
+  {
+    const gtsam::Matrix3 world_R_body = world_P_body.rotation().matrix();
+    const gtsam::Point3 d = world_P_body.translation() + world_R_body * body_t_receiver_ - world_t_point_;
+    const double range = d.norm();
+
+    // NOTE(milo): The receiver moves by world_R_body * [-skew(body_t_receiver) I] for a (body frame)
+    // pose perturbation, and the range by the unit vector along d times that. The range isn't
+    // differentiable at the beacon itself, so the Jacobian is zero there.
+    if (H1) {
+      H1->resize(1, 6);
+      if (range > 1e-9) {
+        const gtsam::RowVector3 u_body = (d / range).transpose() * world_R_body;
+        H1->leftCols<3>() = body_t_receiver_.cross(u_body.transpose()).transpose();
+        H1->rightCols<3>() = u_body;
+      } else {
+        H1->setZero();
+      }
+    }
+
+    return gtsam::Vector1(range - measured_);
+  }
+
+ private:
+  gtsam::Point3 world_t_point_;
+  double measured_;
+  gtsam::Point3 body_t_receiver_;
+};
+
+
+}
@@ -0,0 +1,60 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "vio/relinearization_policy.hpp"
+
+namespace bm {
+namespace vio {
+
+
+void RelinearizationPolicy::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("budget_ms", &budget_ms);
+  parser.GetParam("recover_fraction", &recover_fraction);
+  parser.GetParam("escalate_after", &escalate_after);
+  parser.GetParam("recover_after", &recover_after);
+  parser.GetParam("scale_step", &scale_step);
+  parser.GetParam("max_scale", &max_scale);
+
+  CHECK_GT(budget_ms, 0);
+  CHECK(recover_fraction > 0 && recover_fraction < 1) << "recover_fraction must be in (0, 1)" << std::endl;
+  CHECK_GE(escalate_after, 1);
+  CHECK_GE(recover_after, 1);
+  CHECK_GT(scale_step, 1.0);
+  CHECK_GE(max_scale, 1.0);
+}
+
+
+RelinearizationPolicy::RelinearizationPolicy(const Params& params)
+    : params_(params) {}
+
+
+bool RelinearizationPolicy::Report(double update_ms)
+{
+  // NOTE(milo): Anything in between keeps the current scale, and restarts both counts.
+  num_overloaded_ = (update_ms > params_.budget_ms) ? (num_overloaded_ + 1) : 0;
+  num_recovering_ = (update_ms < params_.recover_fraction * params_.budget_ms) ? (num_recovering_ + 1) : 0;
+
+  double scale = scale_;
+  if (num_overloaded_ >= params_.escalate_after && scale_ < params_.max_scale) {
+    scale = std::min(params_.max_scale, scale_ * params_.scale_step);
+  } else if (num_recovering_ >= params_.recover_after && scale_ > 1.0) {
+    scale = std::max(1.0, scale_ / params_.scale_step);
+  }
+
+  if (scale == scale_) {
+    return false;
+  }
+
+  LOG(INFO) << "RelinearizationPolicy: threshold scale " << scale_ << " --> " << scale << std::endl;
+  num_overloaded_ = 0;
+  num_recovering_ = 0;
+  scale_ = scale;
+  ++num_transitions_;
+  return true;
+}
+
+
+}
+}
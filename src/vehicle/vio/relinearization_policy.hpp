@@ -0,0 +1,64 @@
+#pragma once
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Scales the FixedLagSmoother's relinearization thresholds with how long its iSAM2 updates take.
+// While the vehicle is cruising, most variables barely move between updates, and relinearizing them
+// anyway is where most of the update time goes. If an update takes longer than budget_ms for
+// escalate_after updates in a row, the scale goes up by scale_step (up to max_scale). Once updates
+// take less than recover_fraction of the budget for recover_after updates in a row, it comes back
+// down by scale_step (to 1, the configured thresholds). Like the OverloadController, recovery is
+// slower than escalation so that the scale doesn't oscillate.
+//
+// NOTE(milo): iSAM2 can't change its params after it's constructed, so the smoother is rebuilt
+// (see FixedLagSmoother::CompactSmoother) each time the scale changes. Zero thresholds stay zero.
+class RelinearizationPolicy final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double budget_ms = 100.0;
+    double recover_fraction = 0.5;
+    int escalate_after = 3;
+    int recover_after = 20;
+    double scale_step = 2.0;
+    double max_scale = 16.0;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(RelinearizationPolicy)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(RelinearizationPolicy)
+
+  explicit RelinearizationPolicy(const Params& params);
+
+  // Reports how long the last iSAM2 update took. Returns true if the scale changed.
+  bool Report(double update_ms);
+
+  // Multiplies every relinearization threshold.
+  double Scale() const { return scale_; }
+
+  // Number of times that the scale has changed.
+  int NumTransitions() const { return num_transitions_; }
+
+ private:
+  Params params_;
+  double scale_ = 1.0;
+  int num_overloaded_ = 0;    // Reports in a row.
+  int num_recovering_ = 0;
+  int num_transitions_ = 0;
+};
+
+
+}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Running mean and covariance of 3D samples (Welford's algorithm), e.g to fuse all of the
+// magnetometer or accelerometer samples between two keyposes into one measurement.
+class SampleAverage final {
+ public:
+  SampleAverage() = default;
+
+  void Add(const Vector3d& x)
+  {
+    ++count_;
+    const Vector3d delta = x - mean_;
+    mean_ += delta / count_;
+    m2_ += delta * (x - mean_).transpose();
+  }
+
+  void Reset() { *this = SampleAverage(); }
+
+  int Count() const { return count_; }
+  const Vector3d& Mean() const { return mean_; }
+
+  // Zero if there are fewer than 2 samples.
+  Matrix3d SampleCovariance() const
+  {
+    return (count_ > 1) ? Matrix3d(m2_ / (count_ - 1)) : Matrix3d(Matrix3d::Zero());
+  }
+
+  // Covariance of Mean(), given the noise of one sample. The spread of the samples is added to the
+  // noise, so that if the thing being measured changed (e.g the vehicle turned), the mean is
+  // trusted less.
+  Matrix3d MeanCovariance(const Matrix3d& sample_noise_cov) const
+  {
+    return (count_ > 0) ? Matrix3d((sample_noise_cov + SampleCovariance()) / count_) : sample_noise_cov;
+  }
+
+ private:
+  int count_ = 0;
+  Vector3d mean_ = Vector3d::Zero();
+  Matrix3d m2_ = Matrix3d::Zero();
+};
+
+
+}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <gtsam/geometry/Pose3.h>
+
+#include "core/se3.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// NOTE(milo): gtsam::Rot3 is stored as a 3x3 matrix (unless GTSAM_USE_QUATERNIONS), so these are
+// plain copies.
+inline SE3 ToSE3(const gtsam::Pose3& P)
+{
+  return SE3(P.rotation().matrix(), P.translation());
+}
+
+
+inline gtsam::Pose3 ToPose3(const SE3& T)
+{
+  return gtsam::Pose3(gtsam::Rot3(T.rotation()), gtsam::Point3(T.translation()));
+}
+
+
+}
+}
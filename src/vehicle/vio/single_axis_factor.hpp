@@ -26,15 +26,16 @@ class SingleAxisFactor : public gtsam::NoiseModelFactor1<gtsam::Pose3> {
   gtsam::Vector evaluateError(const gtsam::Pose3& world_P_body,
                               boost::optional<gtsam::Matrix&> H1 = boost::none) const override
   {
-    gtsam::Matrix36 H_world_t_body;
-    const gtsam::Point3 world_t_body = world_P_body.translation(H_world_t_body);
-
+    // NOTE(milo): The Jacobian of the translation is [0 world_R_body] (pose perturbations are in the
+    // body frame), so only one row of the rotation is needed. Written in place, without the 3x6.
     if (H1) {
-      *H1 = H_world_t_body.row(axis_);
+      H1->resize(1, 6);
+      H1->leftCols<3>().setZero();
+      H1->rightCols<3>() = world_P_body.rotation().matrix().row(axis_);
     }
 
-    const double h = world_t_body(axis_);
-    return (Vector(1) << h - measured_).finished();
+    const double h = world_P_body.translation()(axis_);
+    return gtsam::Vector1(h - measured_);
   }
 
  private:
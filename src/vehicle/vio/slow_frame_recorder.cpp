@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <fstream>
+
+#include <glog/logging.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "core/file_utils.hpp"
+#include "core/task_scheduler.hpp"
+#include "vio/slow_frame_recorder.hpp"
+
+namespace bm {
+namespace vio {
+
+
+SlowFrameRecorder::SlowFrameRecorder(const std::string& folder,
+                                     double deadline_ms,
+                                     int history,
+                                     int max_dumps)
+    : folder_(folder),
+      deadline_ms_(deadline_ms),
+      max_dumps_(max_dumps > 0 ? (size_t)max_dumps : 0),
+      ring_(history)
+{
+  CHECK(!folder_.empty()) << "SlowFrameRecorder needs a folder to write to" << std::endl;
+  CHECK_GT(deadline_ms, 0);
+  CHECK_GT(history, 0);
+  mkdir(folder_);
+}
+
+
+SlowFrameRecorder::~SlowFrameRecorder()
+{
+  Flush();
+}
+
+
+bool SlowFrameRecorder::Add(const SlowFrameRecord& record, const StereoImage1b& stereo_pair)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  ring_.at(num_added_ % ring_.size()) = record;
+  ++num_added_;
+
+  if (record.total_ms <= deadline_ms_) {
+    return false;
+  }
+
+  ++num_slow_;
+  if (dump_busy_ || (max_dumps_ > 0 && num_dumps_ >= max_dumps_)) {
+    return false;
+  }
+
+  std::vector<SlowFrameRecord> records;
+  const size_t num = std::min(num_added_, ring_.size());
+  records.reserve(num);
+  for (size_t i = num_added_ - num; i < num_added_; ++i) {
+    records.emplace_back(ring_.at(i % ring_.size()));
+  }
+
+  LOG(WARNING) << "Frame " << record.camera_id << " took " << record.total_ms
+               << " ms (deadline is " << deadline_ms_ << " ms), writing the last "
+               << records.size() << " frames to " << folder_ << std::endl;
+
+  ++num_dumps_;
+  dump_busy_ = true;
+
+  // The Mat headers are copied, not the pixels. The frontend doesn't write to its input images.
+  const StereoImage1b images = stereo_pair;
+  TaskScheduler::Instance().Submit(TaskPriority::VIZ, [this, records, images]() {
+    if (!WriteDump(records, images)) {
+      LOG(WARNING) << "Couldn't write a slow frame dump to " << folder_ << std::endl;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    dump_busy_ = false;
+    cv_dump_.notify_all();
+  });
+
+  return true;
+}
+
+
+void SlowFrameRecorder::Flush()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_dump_.wait(lock, [this]() { return !dump_busy_; });
+}
+
+
+size_t SlowFrameRecorder::NumSlowFrames() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_slow_;
+}
+
+
+size_t SlowFrameRecorder::NumDumps() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_dumps_;
+}
+
+
+bool SlowFrameRecorder::WriteDump(const std::vector<SlowFrameRecord>& records, const StereoImage1b& stereo_pair) const
+{
+  const std::string dump_folder = Join(folder_, "slow_" + std::to_string(stereo_pair.timestamp));
+  mkdir(dump_folder);
+  if (!Exists(dump_folder)) {
+    return false;
+  }
+
+  std::ofstream csv(Join(dump_folder, "frames.csv"));
+  if (!csv.is_open()) {
+    return false;
+  }
+
+  csv << "#timestamp [ns],camera_id,is_keyframe,num_tracked,queue_ms,track_ms,solve_ms,total_ms,"
+         "raw_stereo_queue,smoother_vo_queue,smoother_factor_slots\n";
+  for (const SlowFrameRecord& r : records) {
+    csv << r.timestamp << "," << r.camera_id << "," << (r.is_keyframe ? 1 : 0) << "," << r.num_tracked << ","
+        << r.queue_ms << "," << r.track_ms << "," << r.solve_ms << "," << r.total_ms << ","
+        << r.raw_stereo_queue << "," << r.smoother_vo_queue << "," << r.smoother_factor_slots << "\n";
+  }
+
+  // NOTE(milo): PNG is lossless, so the frame can be fed back through the frontend exactly.
+  bool ok = csv.good();
+  if (!stereo_pair.left_image.empty()) {
+    ok &= cv::imwrite(Join(dump_folder, "left.png"), stereo_pair.left_image);
+  }
+  if (!stereo_pair.right_image.empty()) {
+    ok &= cv::imwrite(Join(dump_folder, "right.png"), stereo_pair.right_image);
+  }
+
+  return ok;
+}
+
+
+}
+}
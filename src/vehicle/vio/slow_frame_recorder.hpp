@@ -0,0 +1,86 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+#include "vision_core/stereo_image.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Where one frontend frame spent its time, and what state the pipeline was in.
+struct SlowFrameRecord final
+{
+  timestamp_t timestamp = 0;
+  uid_t camera_id = 0;
+  bool is_keyframe = false;
+  int num_tracked = 0;          // Landmarks observed in this frame.
+
+  float queue_ms = 0;           // Waiting in the raw stereo queue.
+  float track_ms = 0;
+  float solve_ms = 0;           // Zero if the pose is solved on another thread (pipelined).
+  float total_ms = 0;           // From the images arriving to the frontend being done with them.
+
+  int raw_stereo_queue = 0;     // Queue depths when the frame was done.
+  int smoother_vo_queue = 0;
+  int smoother_factor_slots = 0;
+};
+
+
+// Keeps the last "history" frame records in a ring, which is cheap enough to leave on all the time.
+// When a frame misses its deadline, the ring (oldest first) is written to a CSV along with that
+// frame's images, so that a rare latency spike can be reproduced offline. Each dump goes into its
+// own folder (slow_<timestamp>) under "folder".
+//
+// NOTE(milo): Dumps are written on a TaskScheduler worker, so that the caller never waits on the
+// disk. A frame that misses its deadline while the last dump is still being written is counted,
+// but not dumped.
+class SlowFrameRecorder final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(SlowFrameRecorder)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SlowFrameRecorder)
+
+  // Frames with total_ms > deadline_ms are written out, at most max_dumps times (zero = no limit).
+  SlowFrameRecorder(const std::string& folder, double deadline_ms, int history, int max_dumps);
+
+  // Waits for a dump that is still being written.
+  ~SlowFrameRecorder();
+
+  // Adds a frame record. Returns true if it missed the deadline and a dump was started. Threadsafe.
+  bool Add(const SlowFrameRecord& record, const StereoImage1b& stereo_pair);
+
+  // Blocks until the dump that is being written (if any) is done.
+  void Flush();
+
+  size_t NumSlowFrames() const;
+  size_t NumDumps() const;
+
+ private:
+  // Writes the records and images into a new folder. Returns false if it couldn't.
+  bool WriteDump(const std::vector<SlowFrameRecord>& records, const StereoImage1b& stereo_pair) const;
+
+ private:
+  std::string folder_;
+  double deadline_ms_;
+  size_t max_dumps_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_dump_;
+  std::vector<SlowFrameRecord> ring_;
+  size_t num_added_ = 0;
+  size_t num_slow_ = 0;
+  size_t num_dumps_ = 0;
+  bool dump_busy_ = false;
+};
+
+
+}
+}
@@ -5,11 +5,11 @@
 #include <gtsam/inference/Key.h>
 #include <gtsam/sam/RangeFactor.h>
 // #include <gtsam/slam/PoseTranslationPrior.h>
-#include <gtsam_unstable/slam/MagPoseFactor.h>
 #include <gtsam_unstable/slam/PartialPriorFactor.h>
 
 #include "core/transform_util.hpp"
 #include "vio/smoother.hpp"
+#include "vio/mag_pose_factor.hpp"
 #include "vio/vo_result.hpp"
 #include "vio/single_axis_factor.hpp"
 #include "vio/trilateration.hpp"
@@ -400,7 +400,7 @@ SmootherResult Smoother::UpdateGraphWithVision(
     const MultiRange& maybe_ranges)
 {
   CHECK(odom_result.is_keyframe) << "Smoother shouldn't receive a non-keyframe odometry result" << std::endl;
-  CHECK(odom_result.lmk_obs.size() > 0) << "Smoother shouln't receive a keyframe with no observations" << std::endl;
+  CHECK(!odom_result.lmk_obs.Empty()) << "Smoother shouln't receive a keyframe with no observations" << std::endl;
 
   gtsam::NonlinearFactorGraph new_factors;
   gtsam::Values new_values;
@@ -453,13 +453,15 @@ SmootherResult Smoother::UpdateGraphWithVision(
   // Even if visual odometry didn't line up with the previous keypose, we still want to add stereo
   // landmarks, since they could be observed in future keyframes.
   if (params_.use_smart_stereo_factors) {
-    for (const LandmarkObservation& lmk_obs : odom_result.lmk_obs) {
-      if (lmk_obs.disparity < 0) {
+    const LandmarkObservationBatch& lmk_obs = odom_result.lmk_obs;
+    for (size_t i = 0; i < lmk_obs.Size(); ++i) {
+      const float disp = lmk_obs.disparity[i];
+      if (disp < 0) {
         LOG(WARNING) << "Skipped zero-disparity observation!" << std::endl;
         continue;
       }
 
-      const uid_t lmk_id = lmk_obs.landmark_id;
+      const uid_t lmk_id = lmk_obs.landmark_id[i];
 
       // NEW SMART FACTOR: Creating smart stereo factor for the first time.
       // NOTE(milo): Unfortunately, smart factors do not support robust error functions yet.
@@ -479,10 +481,11 @@ SmootherResult Smoother::UpdateGraphWithVision(
       }
 
       SmartStereoFactor::shared_ptr sfptr = stereo_factors_.at(lmk_id);
+      const cv::Point2f& pt = lmk_obs.pixel_location[i];
       const gtsam::StereoPoint2 stereo_point2(
-          lmk_obs.pixel_location.x,                      // X-coord in left image
-          lmk_obs.pixel_location.x - lmk_obs.disparity,  // x-coord in right image
-          lmk_obs.pixel_location.y);                     // y-coord in both images (rectified)
+          pt.x,           // X-coord in left image
+          pt.x - disp,    // x-coord in right image
+          pt.y);          // y-coord in both images (rectified)
       sfptr->add(stereo_point2, keypose_sym, cal3_stereo_);
     }
   }
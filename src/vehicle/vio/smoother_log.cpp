@@ -0,0 +1,449 @@
+#include <algorithm>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "vio/smoother_log.hpp"
+
+namespace bm {
+namespace vio {
+
+// Flags for the optional parts of a PackedKeypose.
+static const uint32_t kHasVo = 1 << 0;
+static const uint32_t kHasPim = 1 << 1;
+static const uint32_t kHasDepth = 1 << 2;
+static const uint32_t kHasAttitude = 1 << 3;
+static const uint32_t kHasMag = 1 << 4;
+static const uint32_t kHasReloc = 1 << 5;
+
+
+struct PackedInitialize final
+{
+  double timestamp;
+  uint64_t imu_available;
+  PackedSmootherState state;
+};
+
+
+struct PackedVoHeader final
+{
+  uint64_t timestamp;
+  uint64_t timestamp_lkf;
+  uint64_t camera_id;
+  uint64_t camera_id_lkf;
+  double lkf_T_cam[16];     // Column major.
+  uint64_t num_obs;         // Followed by this many PackedLandmarkObs.
+};
+
+
+// Follows the landmark observations if the VO was relocalized (see VoResult::has_reloc).
+struct PackedRelocRecord final
+{
+  uint64_t timestamp_kf;
+  uint64_t camera_id_kf;
+  double kf_T_cam[16];      // Column major.
+};
+
+
+struct PackedImuRecord final
+{
+  uint64_t timestamp;
+  double w[3];
+  double a[3];
+};
+
+
+struct PackedDepthRecord final
+{
+  uint64_t timestamp;
+  double depth;
+};
+
+
+struct PackedAttitudeRecord final
+{
+  double timestamp;
+  double body_nG[3];
+  double sigma;
+};
+
+
+struct PackedRangeRecord final
+{
+  uint64_t timestamp;
+  double range;
+  double point[3];
+};
+
+
+struct PackedMagRecord final
+{
+  uint64_t timestamp;
+  double field[3];
+  double cov[9];
+};
+
+
+template <typename Record>
+static void Append(std::vector<uint8_t>& buf, const Record& r)
+{
+  static_assert(std::is_pod<Record>::value, "Only POD records can be appended");
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(&r);
+  buf.insert(buf.end(), data, data + sizeof(Record));
+}
+
+
+// Reads a record at offset (and advances it). Returns false if there aren't enough bytes left.
+template <typename Record>
+static bool Consume(const std::vector<uint8_t>& buf, size_t& offset, Record& r)
+{
+  static_assert(std::is_pod<Record>::value, "Only POD records can be consumed");
+  if (offset + sizeof(Record) > buf.size()) {
+    return false;
+  }
+  std::memcpy(&r, buf.data() + offset, sizeof(Record));
+  offset += sizeof(Record);
+  return true;
+}
+
+
+static PackedSmootherState PackState(const gtsam::Pose3& world_P_body,
+                                     const gtsam::Vector3& world_v_body,
+                                     const ImuBias& imu_bias)
+{
+  const gtsam::Quaternion q = world_P_body.rotation().toQuaternion();
+  const gtsam::Vector6 bias = imu_bias.vector();
+
+  PackedSmootherState r;
+  r.q[0] = q.w();
+  r.q[1] = q.x();
+  r.q[2] = q.y();
+  r.q[3] = q.z();
+  std::copy(world_P_body.translation().data(), world_P_body.translation().data() + 3, r.t);
+  std::copy(world_v_body.data(), world_v_body.data() + 3, r.v);
+  std::copy(bias.data(), bias.data() + 6, r.bias);
+  return r;
+}
+
+
+static void UnpackState(const PackedSmootherState& r,
+                        gtsam::Pose3& world_P_body,
+                        gtsam::Vector3& world_v_body,
+                        ImuBias& imu_bias)
+{
+  world_P_body = gtsam::Pose3(gtsam::Rot3::Quaternion(r.q[0], r.q[1], r.q[2], r.q[3]),
+                              gtsam::Point3(r.t[0], r.t[1], r.t[2]));
+  world_v_body = gtsam::Vector3(r.v[0], r.v[1], r.v[2]);
+  imu_bias = ImuBias(gtsam::Vector3(r.bias[0], r.bias[1], r.bias[2]),
+                     gtsam::Vector3(r.bias[3], r.bias[4], r.bias[5]));
+}
+
+
+SmootherLogWriter::SmootherLogWriter(const std::string& path)
+    : out_(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+{
+  CHECK(out_.is_open()) << "Could not open file: " << path << std::endl;
+
+  SmootherLogHeader header = {};
+  std::memcpy(header.magic, kSmootherLogMagic, sizeof(kSmootherLogMagic));
+  header.version = kSmootherLogVersion;
+  out_.write(reinterpret_cast<const char*>(&header), sizeof(SmootherLogHeader));
+}
+
+
+void SmootherLogWriter::WriteRecordNoLock(SmootherLogRecordType type)
+{
+  SmootherLogRecordHeader header;
+  header.type = type;
+  header.record_size = static_cast<uint32_t>(buf_.size());
+  out_.write(reinterpret_cast<const char*>(&header), sizeof(SmootherLogRecordHeader));
+  out_.write(reinterpret_cast<const char*>(buf_.data()), buf_.size());
+}
+
+
+void SmootherLogWriter::WriteInitialize(seconds_t timestamp,
+                                        const gtsam::Pose3& world_P_body,
+                                        const gtsam::Vector3& world_v_body,
+                                        const ImuBias& imu_bias,
+                                        bool imu_available)
+{
+  PackedInitialize r;
+  r.timestamp = timestamp;
+  r.imu_available = imu_available ? 1 : 0;
+  r.state = PackState(world_P_body, world_v_body, imu_bias);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  buf_.clear();
+  Append(buf_, r);
+  WriteRecordNoLock(SMOOTHER_LOG_INITIALIZE);
+
+  // Nothing can be re-solved without this record, so make sure it's on disk.
+  out_.flush();
+}
+
+
+void SmootherLogWriter::WriteImu(const ImuMeasurement& data)
+{
+  PackedImuRecord r;
+  r.timestamp = data.timestamp;
+  std::copy(data.w.data(), data.w.data() + 3, r.w);
+  std::copy(data.a.data(), data.a.data() + 3, r.a);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  buf_.clear();
+  Append(buf_, r);
+  WriteRecordNoLock(SMOOTHER_LOG_IMU);
+}
+
+
+void SmootherLogWriter::WriteKeypose(const SmootherResult& result,
+                                     VoResult::ConstPtr maybe_vo_ptr,
+                                     PimResult::ConstPtr maybe_pim_ptr,
+                                     DepthMeasurement::ConstPtr maybe_depth_ptr,
+                                     AttitudeMeasurement::ConstPtr maybe_attitude_ptr,
+                                     const MultiRange& maybe_ranges,
+                                     MagMeasurement::ConstPtr maybe_mag_ptr)
+{
+  PackedKeypose r;
+  r.keypose_id = result.keypose_id;
+  r.timestamp = result.timestamp;
+  r.pim_from_time = maybe_pim_ptr ? maybe_pim_ptr->from_time : 0;
+  r.flags = (maybe_vo_ptr ? kHasVo : 0) |
+            (maybe_pim_ptr ? kHasPim : 0) |
+            (maybe_depth_ptr ? kHasDepth : 0) |
+            (maybe_attitude_ptr ? kHasAttitude : 0) |
+            (maybe_mag_ptr ? kHasMag : 0) |
+            ((maybe_vo_ptr && maybe_vo_ptr->has_reloc) ? kHasReloc : 0);
+  r.num_ranges = static_cast<uint32_t>(maybe_ranges.size());
+  r.estimate = PackState(result.world_P_body, result.world_v_body, result.imu_bias);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  buf_.clear();
+  Append(buf_, r);
+
+  if (maybe_vo_ptr) {
+    PackedVoHeader vo;
+    vo.timestamp = maybe_vo_ptr->timestamp;
+    vo.timestamp_lkf = maybe_vo_ptr->timestamp_lkf;
+    vo.camera_id = maybe_vo_ptr->camera_id;
+    vo.camera_id_lkf = maybe_vo_ptr->camera_id_lkf;
+    std::copy(maybe_vo_ptr->lkf_T_cam.data(), maybe_vo_ptr->lkf_T_cam.data() + 16, vo.lkf_T_cam);
+    const LandmarkObservationBatch& lmk_obs = maybe_vo_ptr->lmk_obs;
+    vo.num_obs = lmk_obs.Size();
+    Append(buf_, vo);
+
+    for (size_t i = 0; i < lmk_obs.Size(); ++i) {
+      PackedLandmarkObs obs;
+      obs.landmark_id = lmk_obs.landmark_id[i];
+      obs.u = lmk_obs.pixel_location[i].x;
+      obs.v = lmk_obs.pixel_location[i].y;
+      obs.disparity = lmk_obs.disparity[i];
+      obs.reserved = 0;
+      Append(buf_, obs);
+    }
+
+    if (maybe_vo_ptr->has_reloc) {
+      PackedRelocRecord reloc;
+      reloc.timestamp_kf = maybe_vo_ptr->reloc_timestamp_kf;
+      reloc.camera_id_kf = maybe_vo_ptr->reloc_camera_id_kf;
+      std::copy(maybe_vo_ptr->reloc_kf_T_cam.data(), maybe_vo_ptr->reloc_kf_T_cam.data() + 16, reloc.kf_T_cam);
+      Append(buf_, reloc);
+    }
+  }
+
+  if (maybe_depth_ptr) {
+    Append(buf_, PackedDepthRecord{ maybe_depth_ptr->timestamp, maybe_depth_ptr->depth });
+  }
+
+  if (maybe_attitude_ptr) {
+    const Vector3d& nG = maybe_attitude_ptr->body_nG;
+    Append(buf_, PackedAttitudeRecord{ maybe_attitude_ptr->timestamp, { nG.x(), nG.y(), nG.z() }, maybe_attitude_ptr->sigma });
+  }
+
+  for (const RangeMeasurement& range : maybe_ranges) {
+    const Vector3d& p = range.point;
+    Append(buf_, PackedRangeRecord{ range.timestamp, range.range, { p.x(), p.y(), p.z() } });
+  }
+
+  if (maybe_mag_ptr) {
+    PackedMagRecord mag;
+    mag.timestamp = maybe_mag_ptr->timestamp;
+    std::copy(maybe_mag_ptr->field.data(), maybe_mag_ptr->field.data() + 3, mag.field);
+    std::copy(maybe_mag_ptr->cov.data(), maybe_mag_ptr->cov.data() + 9, mag.cov);
+    Append(buf_, mag);
+  }
+
+  WriteRecordNoLock(SMOOTHER_LOG_KEYPOSE);
+}
+
+
+void SmootherLogWriter::Flush()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  out_.flush();
+}
+
+
+static bool UnpackKeypose(const std::vector<uint8_t>& buf, SmootherLogKeypose& keypose)
+{
+  size_t offset = 0;
+  PackedKeypose r;
+  if (!Consume(buf, offset, r)) {
+    return false;
+  }
+
+  keypose.keypose_id = r.keypose_id;
+  keypose.timestamp = r.timestamp;
+  keypose.has_pim = (r.flags & kHasPim) != 0;
+  keypose.pim_from_time = r.pim_from_time;
+  UnpackState(r.estimate, keypose.world_P_body, keypose.world_v_body, keypose.imu_bias);
+
+  if (r.flags & kHasVo) {
+    PackedVoHeader vo;
+    if (!Consume(buf, offset, vo)) {
+      return false;
+    }
+    keypose.vo = std::make_shared<VoResult>(vo.timestamp, vo.timestamp_lkf, vo.camera_id, vo.camera_id_lkf);
+    keypose.vo->is_keyframe = true;
+    keypose.vo->lkf_T_cam = Eigen::Map<const Matrix4d>(vo.lkf_T_cam);
+
+    keypose.vo->lmk_obs.Reserve(vo.num_obs);
+    for (uint64_t i = 0; i < vo.num_obs; ++i) {
+      PackedLandmarkObs obs;
+      if (!Consume(buf, offset, obs)) {
+        return false;
+      }
+      keypose.vo->lmk_obs.Add(obs.landmark_id, cv::Point2f(obs.u, obs.v), obs.disparity);
+    }
+
+    if (r.flags & kHasReloc) {
+      PackedRelocRecord reloc;
+      if (!Consume(buf, offset, reloc)) {
+        return false;
+      }
+      keypose.vo->has_reloc = true;
+      keypose.vo->reloc_timestamp_kf = reloc.timestamp_kf;
+      keypose.vo->reloc_camera_id_kf = reloc.camera_id_kf;
+      keypose.vo->reloc_kf_T_cam = Eigen::Map<const Matrix4d>(reloc.kf_T_cam);
+    }
+  }
+
+  if (r.flags & kHasDepth) {
+    PackedDepthRecord depth;
+    if (!Consume(buf, offset, depth)) {
+      return false;
+    }
+    keypose.depth = std::make_shared<DepthMeasurement>(depth.timestamp, depth.depth);
+  }
+
+  if (r.flags & kHasAttitude) {
+    PackedAttitudeRecord attitude;
+    if (!Consume(buf, offset, attitude)) {
+      return false;
+    }
+    keypose.attitude = std::make_shared<AttitudeMeasurement>(
+        attitude.timestamp, Vector3d(attitude.body_nG[0], attitude.body_nG[1], attitude.body_nG[2]));
+    keypose.attitude->sigma = attitude.sigma;
+  }
+
+  for (uint32_t i = 0; i < r.num_ranges; ++i) {
+    PackedRangeRecord range;
+    if (!Consume(buf, offset, range)) {
+      return false;
+    }
+    keypose.ranges.emplace_back(range.timestamp, range.range, Vector3d(range.point[0], range.point[1], range.point[2]));
+  }
+
+  if (r.flags & kHasMag) {
+    PackedMagRecord mag;
+    if (!Consume(buf, offset, mag)) {
+      return false;
+    }
+    keypose.mag = std::make_shared<MagMeasurement>(mag.timestamp, Vector3d(mag.field[0], mag.field[1], mag.field[2]));
+    keypose.mag->cov = Eigen::Map<const Matrix3d>(mag.cov);
+  }
+
+  return offset == buf.size();
+}
+
+
+bool ReadSmootherLog(const std::string& path, SmootherLog& log)
+{
+  log = SmootherLog();
+
+  std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+  if (!in.is_open()) {
+    LOG(WARNING) << "Could not open file: " << path << std::endl;
+    return false;
+  }
+
+  SmootherLogHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(SmootherLogHeader));
+  if (!in || std::memcmp(header.magic, kSmootherLogMagic, sizeof(kSmootherLogMagic)) != 0) {
+    LOG(WARNING) << "Not a smoother log: " << path << std::endl;
+    return false;
+  }
+  if (header.version != kSmootherLogVersion) {
+    LOG(WARNING) << "Unsupported smoother log version " << header.version << ": " << path << std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> buf;
+  SmootherLogRecordHeader record;
+  while (in.read(reinterpret_cast<char*>(&record), sizeof(SmootherLogRecordHeader))) {
+    buf.resize(record.record_size);
+    if (!in.read(reinterpret_cast<char*>(buf.data()), buf.size())) {
+      LOG(WARNING) << "Dropping an incomplete record at the end of " << path << std::endl;
+      break;
+    }
+
+    size_t offset = 0;
+    bool ok = true;
+
+    if (record.type == SMOOTHER_LOG_INITIALIZE) {
+      PackedInitialize r;
+      ok = Consume(buf, offset, r);
+      if (ok) {
+        LOG_IF(WARNING, log.initialized) << "Smoother was re-initialized, only keeping what came after" << std::endl;
+        const std::vector<ImuMeasurement, Eigen::aligned_allocator<ImuMeasurement>> imu = log.imu;
+        log = SmootherLog();
+        log.imu = imu;
+        log.initialized = true;
+        log.t0 = r.timestamp;
+        log.imu_available = (r.imu_available != 0);
+        UnpackState(r.state, log.world_P_body0, log.world_v_body0, log.imu_bias0);
+      }
+
+    } else if (record.type == SMOOTHER_LOG_IMU) {
+      PackedImuRecord r;
+      ok = Consume(buf, offset, r);
+      if (ok) {
+        log.imu.emplace_back(r.timestamp, Vector3d(r.w[0], r.w[1], r.w[2]), Vector3d(r.a[0], r.a[1], r.a[2]));
+      }
+
+    } else if (record.type == SMOOTHER_LOG_KEYPOSE) {
+      SmootherLogKeypose keypose;
+      ok = UnpackKeypose(buf, keypose);
+      if (ok && log.initialized) {
+        log.keyposes.emplace_back(keypose);
+      }
+
+    } else {
+      LOG(WARNING) << "Skipping unknown record type " << record.type << " in " << path << std::endl;
+    }
+
+    if (!ok) {
+      LOG(WARNING) << "Dropping a malformed record (type " << record.type << ") in " << path << std::endl;
+    }
+  }
+
+  // IMU measurements are logged as they're received, which could be slightly out of order.
+  std::stable_sort(log.imu.begin(), log.imu.end(),
+      [](const ImuMeasurement& a, const ImuMeasurement& b) { return a.timestamp < b.timestamp; });
+
+  return log.initialized;
+}
+
+
+}
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+#include "core/imu_measurement.hpp"
+#include "core/depth_measurement.hpp"
+#include "core/range_measurement.hpp"
+#include "core/mag_measurement.hpp"
+#include "vio/attitude_measurement.hpp"
+#include "vio/imu_manager.hpp"
+#include "vio/smoother_result.hpp"
+#include "vio/vo_result.hpp"
+
+#include <gtsam/geometry/Pose3.h>
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+// A log of everything that the StateEstimator gives to its FixedLagSmoother, so that a whole dive
+// can be re-solved offline, as one batch problem (see BatchSmoother).
+//
+// Layout:
+//   SmootherLogHeader
+//   Records, each a SmootherLogRecordHeader followed by record_size bytes
+//
+// Records are appended as they happen, so a log from a run that crashed can still be read up to
+// its last complete record. Raw IMU measurements are logged instead of the preintegrated ones, and
+// are preintegrated again when the log is read (GTSAM's PIM types don't have a stable binary form).
+//
+// NOTE(milo): Numbers are stored in host byte order (little endian on everything we run on).
+static const char kSmootherLogMagic[8] = { 'B', 'M', 'S', 'M', 'L', 'O', 'G', '\0' };
+static const uint32_t kSmootherLogVersion = 2;
+
+enum SmootherLogRecordType : uint32_t
+{
+  SMOOTHER_LOG_INITIALIZE = 0,
+  SMOOTHER_LOG_IMU = 1,
+  SMOOTHER_LOG_KEYPOSE = 2
+};
+
+
+struct SmootherLogHeader final
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+
+struct SmootherLogRecordHeader final
+{
+  uint32_t type;
+  uint32_t record_size;   // Bytes that follow this header.
+};
+
+
+// A smoother state: rotation as a quaternion (w, x, y, z), then translation, velocity, and IMU
+// bias (accelerometer, gyroscope).
+struct PackedSmootherState final
+{
+  double q[4];
+  double t[3];
+  double v[3];
+  double bias[6];
+};
+
+
+struct PackedLandmarkObs final
+{
+  uint64_t landmark_id;
+  float u;
+  float v;
+  float disparity;
+  float reserved;
+};
+
+
+// The fixed-size part of a SMOOTHER_LOG_KEYPOSE record. It's followed by (in order, and only if
+// the flag is set): a VO result, depth, attitude, ranges, and mag.
+struct PackedKeypose final
+{
+  uint64_t keypose_id;
+  double timestamp;
+  double pim_from_time;     // The previous keypose time, if there's preintegrated IMU.
+  uint32_t flags;
+  uint32_t num_ranges;
+  PackedSmootherState estimate;
+};
+
+static_assert(std::is_pod<SmootherLogHeader>::value && sizeof(SmootherLogHeader) % 8 == 0, "SmootherLogHeader");
+static_assert(std::is_pod<SmootherLogRecordHeader>::value && sizeof(SmootherLogRecordHeader) % 8 == 0, "SmootherLogRecordHeader");
+static_assert(std::is_pod<PackedLandmarkObs>::value && sizeof(PackedLandmarkObs) % 8 == 0, "PackedLandmarkObs");
+static_assert(std::is_pod<PackedKeypose>::value && sizeof(PackedKeypose) % 8 == 0, "PackedKeypose");
+
+
+// The inputs to one FixedLagSmoother::Update(), and the estimate that it returned.
+struct SmootherLogKeypose final
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  uid_t keypose_id = 0;
+  seconds_t timestamp = 0;
+
+  bool has_pim = false;
+  seconds_t pim_from_time = 0;
+
+  VoResult::Ptr vo = nullptr;
+  DepthMeasurement::Ptr depth = nullptr;
+  AttitudeMeasurement::Ptr attitude = nullptr;
+  MultiRange ranges;
+  MagMeasurement::Ptr mag = nullptr;
+
+  // The online (fixed-lag) estimate, used as the initial guess for the batch solve.
+  gtsam::Pose3 world_P_body;
+  gtsam::Vector3 world_v_body = kZeroVelocity;
+  ImuBias imu_bias = kZeroImuBias;
+};
+
+
+// Everything in a smoother log, from the last FixedLagSmoother::Initialize().
+struct SmootherLog final
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  bool initialized = false;
+  seconds_t t0 = 0;
+  gtsam::Pose3 world_P_body0;
+  gtsam::Vector3 world_v_body0 = kZeroVelocity;
+  ImuBias imu_bias0 = kZeroImuBias;
+  bool imu_available = false;
+
+  std::vector<ImuMeasurement, Eigen::aligned_allocator<ImuMeasurement>> imu;   // Sorted by time.
+  std::vector<SmootherLogKeypose, Eigen::aligned_allocator<SmootherLogKeypose>> keyposes;
+};
+
+
+// Appends to a smoother log. All of the Write*() functions are threadsafe.
+class SmootherLogWriter final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(SmootherLogWriter);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SmootherLogWriter);
+
+  explicit SmootherLogWriter(const std::string& path);
+
+  // Same arguments as FixedLagSmoother::Initialize().
+  void WriteInitialize(seconds_t timestamp,
+                       const gtsam::Pose3& world_P_body,
+                       const gtsam::Vector3& world_v_body,
+                       const ImuBias& imu_bias,
+                       bool imu_available);
+
+  void WriteImu(const ImuMeasurement& data);
+
+  // The arguments to a FixedLagSmoother::Update(), and its result. Only the time window is kept
+  // from the preintegrated IMU, since the raw measurements are in the log.
+  void WriteKeypose(const SmootherResult& result,
+                    VoResult::ConstPtr maybe_vo_ptr,
+                    PimResult::ConstPtr maybe_pim_ptr,
+                    DepthMeasurement::ConstPtr maybe_depth_ptr,
+                    AttitudeMeasurement::ConstPtr maybe_attitude_ptr,
+                    const MultiRange& maybe_ranges,
+                    MagMeasurement::ConstPtr maybe_mag_ptr);
+
+  // Pushes buffered records to the file.
+  void Flush();
+
+ private:
+  void WriteRecordNoLock(SmootherLogRecordType type);
+
+ private:
+  std::mutex mutex_;
+  std::ofstream out_;
+  std::vector<uint8_t> buf_;
+};
+
+
+// Reads a whole smoother log. Returns false if the file can't be opened or isn't a smoother log.
+// An incomplete record at the end (e.g from a crash) is dropped with a warning.
+bool ReadSmootherLog(const std::string& path, SmootherLog& log);
+
+
+}
+}
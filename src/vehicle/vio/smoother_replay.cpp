@@ -0,0 +1,107 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "core/timer.hpp"
+#include "vio/smoother_replay.hpp"
+
+namespace bm {
+namespace vio {
+
+
+SmootherReplay::SmootherReplay(const SmootherLog& log,
+                               const ImuManager::Params& imu_manager_params,
+                               double allowed_misalignment_imu)
+    : log_(log),
+      imu_manager_params_(imu_manager_params),
+      allowed_misalignment_imu_(allowed_misalignment_imu)
+{
+  CHECK(log_.initialized) << "Smoother log doesn't have an initialization" << std::endl;
+}
+
+
+std::vector<SmootherReplay::KeyposeTiming> SmootherReplay::Run(const FixedLagSmoother::Params& params,
+                                                               int max_keyposes,
+                                                               std::vector<SmootherResult>* trajectory) const
+{
+  // NOTE(milo): Covariance is deferred so that it can be timed on its own. Update() would compute
+  // it at the same point otherwise, so the smoother does the same work either way.
+  FixedLagSmoother::Params replay_params = params;
+  replay_params.defer_marginal_covariance = true;
+  FixedLagSmoother smoother(replay_params);
+
+  ImuManager imu_manager(imu_manager_params_, "smoother_replay_imu_manager");
+  size_t next_imu = 0;
+
+  smoother.Initialize(log_.t0, log_.world_P_body0, log_.world_v_body0, log_.imu_bias0, log_.imu_available);
+  if (trajectory) {
+    trajectory->clear();
+    trajectory->emplace_back(smoother.GetResult());
+  }
+
+  const size_t num_keyposes = (max_keyposes > 0) ?
+      std::min(log_.keyposes.size(), (size_t)max_keyposes) : log_.keyposes.size();
+
+  std::vector<KeyposeTiming> timings;
+  timings.reserve(num_keyposes);
+
+  for (size_t i = 0; i < num_keyposes; ++i) {
+    const SmootherLogKeypose& keypose = log_.keyposes.at(i);
+
+    // Give the IMU manager everything up to (a bit past) this keypose, like it had online.
+    const seconds_t imu_until = keypose.timestamp + allowed_misalignment_imu_;
+    while (next_imu < log_.imu.size() && ConvertToSeconds(log_.imu.at(next_imu).timestamp) <= imu_until) {
+      imu_manager.Push(log_.imu.at(next_imu++));
+    }
+
+    PimResult::ConstPtr maybe_pim_ptr = nullptr;
+    if (keypose.has_pim) {
+      imu_manager.ResetAndUpdateBias(smoother.GetResult().imu_bias);
+      const PimResult pim = imu_manager.Preintegrate(keypose.pim_from_time, keypose.timestamp, allowed_misalignment_imu_);
+      maybe_pim_ptr = pim.timestamps_aligned ? std::make_shared<PimResult>(pim) : nullptr;
+    }
+
+    if (!keypose.vo && !maybe_pim_ptr) {
+      LOG(WARNING) << "Could not preintegrate IMU again for keypose " << keypose.keypose_id << ", skipping it" << std::endl;
+      continue;
+    }
+
+    Timer timer(true);
+    const SmootherResult result = smoother.Update(
+        keypose.vo,
+        maybe_pim_ptr,
+        keypose.depth,
+        keypose.attitude,
+        keypose.ranges,
+        keypose.mag);
+    const double update_ms = timer.Tock().milliseconds();
+
+    const bool covariance_computed = smoother.UpdateMarginalCovariance();
+    const double covariance_ms = timer.Elapsed().milliseconds();
+
+    const FixedLagSmoother::UpdateStats& stats = smoother.GetUpdateStats();
+    KeyposeTiming timing;
+    timing.keypose_id = result.keypose_id;
+    timing.timestamp = result.timestamp;
+    timing.isam_update_ms = stats.isam_update_ms;
+    timing.extra_iters_ms = stats.total_update_ms - stats.isam_update_ms;
+    timing.num_extra_iters = stats.num_extra_iters;
+    timing.estimate_ms = update_ms - stats.total_update_ms;
+    timing.update_ms = update_ms;
+    timing.covariance_ms = covariance_ms;
+    timing.covariance_computed = covariance_computed;
+    timing.num_factors = stats.num_factors;
+    timing.num_lmk_factors = stats.num_lmk_factors;
+    timings.emplace_back(timing);
+
+    if (trajectory) {
+      trajectory->emplace_back(smoother.GetResult());
+    }
+  }
+
+  return timings;
+}
+
+
+}
+}
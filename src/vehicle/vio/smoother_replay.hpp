@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+#include "vio/fixed_lag_smoother.hpp"
+#include "vio/imu_manager.hpp"
+#include "vio/smoother_log.hpp"
+#include "vio/smoother_result.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Feeds the Update() calls from a smoother log (see SmootherLogWriter) to a new FixedLagSmoother,
+// and times each part of them, so that the backend can be benchmarked (and configs like
+// smoother_lag_sec compared) without running the frontend on images.
+//
+// The IMU is preintegrated again for each keypose, with the replayed smoother's latest bias (like
+// the StateEstimator does), and that isn't counted in the timing.
+class SmootherReplay final {
+ public:
+  // Timing (in ms) of one Update(), and the marginal covariance after it.
+  struct KeyposeTiming final
+  {
+    uid_t keypose_id = 0;             // The replayed smoother's id, not the one in the log.
+    seconds_t timestamp = 0;
+    double isam_update_ms = 0;        // The first iSAM2 update, with all of the new factors.
+    double extra_iters_ms = 0;        // Extra smoothing iters (and compaction, if there was one).
+    int num_extra_iters = 0;
+    double estimate_ms = 0;           // Building the factors before, and the estimate after.
+    double update_ms = 0;             // All of Update(), wall time.
+    double covariance_ms = 0;
+    bool covariance_computed = false;
+    int num_factors = 0;
+    int num_lmk_factors = 0;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(SmootherReplay)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SmootherReplay)
+
+  // The log must outlive this. imu_manager_params and allowed_misalignment_imu should come from the
+  // StateEstimator::Params that made it.
+  SmootherReplay(const SmootherLog& log,
+                 const ImuManager::Params& imu_manager_params,
+                 double allowed_misalignment_imu);
+
+  // Replays the log (or its first max_keyposes keyposes, if > 0) through a smoother made with
+  // params. Covariance is always computed right after each Update() (respecting
+  // marginal_covariance_every_n), whether or not params defers it. If trajectory is given, it gets
+  // the result of every Update().
+  std::vector<KeyposeTiming> Run(const FixedLagSmoother::Params& params,
+                                 int max_keyposes = 0,
+                                 std::vector<SmootherResult>* trajectory = nullptr) const;
+
+ private:
+  const SmootherLog& log_;
+  ImuManager::Params imu_manager_params_;
+  double allowed_misalignment_imu_;
+};
+
+
+}
+}
@@ -4,6 +4,7 @@
 
 #include "core/timestamp.hpp"
 #include "core/eigen_types.hpp"
+#include "core/pipeline_latency.hpp"
 #include "vio/imu_manager.hpp"
 
 namespace bm {
@@ -34,7 +35,8 @@ struct SmootherResult final
         imu_bias(imu_bias),
         cov_pose(cov_pose),
         cov_vel(cov_vel),
-        cov_bias(cov_bias) {}
+        cov_bias(cov_bias),
+        cov_keypose_id(keypose_id) {}
 
   SmootherResult() = default;
 
@@ -53,6 +55,13 @@ struct SmootherResult final
   Matrix6d cov_pose;
   Matrix3d cov_vel;
   Matrix6d cov_bias;
+
+  // The keypose that the covariances above were computed at. If the smoother is computing them less
+  // often than every keypose (or deferring them), this can be older than keypose_id.
+  uid_t cov_keypose_id = 0;
+
+  // From the newest measurement in this keypose (the image for vision keyposes) to this result.
+  PipelineLatency latency;
 };
 
 
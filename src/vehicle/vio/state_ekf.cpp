@@ -1,4 +1,8 @@
+#include <type_traits>
+
 #include "vio/state_ekf.hpp"
+#include "core/profiler.hpp"
+#include "core/se3.hpp"
 
 #include <gtsam/geometry/Pose3.h>
 
@@ -6,9 +10,13 @@ namespace bm {
 namespace vio {
 
 typedef Eigen::Matrix<double, 1, 1> Vector1d;
+typedef Eigen::Matrix<double, 1, 3> Matrix1x3;
+typedef Eigen::Matrix<double, 6, 9> Matrix6x9;
+typedef Eigen::Matrix<double, 9, 9> Matrix9d;
 
 
-static bool DiagonalNonnegative(const Eigen::MatrixXd& m)
+template <typename Derived>
+static bool DiagonalNonnegative(const Eigen::MatrixBase<Derived>& m)
 {
   for (int i = 0; i < m.rows(); ++i) {
     CHECK_GT(m(i, i), 0.0f) << "entry: " << i << " value: " << m(i, i) << "\n" << m << std::endl;
@@ -21,19 +29,10 @@ static bool DiagonalNonnegative(const Eigen::MatrixXd& m)
 
 // Ensures that a matrix is symmetric by copy upper triangle into lower triangle.
 // https://apps.dtic.mil/sti/pdfs/AD1078469.pdf
-static void Symmetrize(Matrix15d& m)
-{
-  m.triangularView<Eigen::StrictlyLower>() = m.transpose();
-}
-
-static void Symmetrize(Matrix6d& m)
-{
-  m.triangularView<Eigen::StrictlyLower>() = m.transpose();
-}
-
-static void Symmetrize(Matrix3d& m)
+template <typename Derived>
+static void Symmetrize(Eigen::MatrixBase<Derived>& m)
 {
-  m.triangularView<Eigen::StrictlyLower>() = m.transpose();
+  m.template triangularView<Eigen::StrictlyLower>() = m.transpose();
 }
 
 
@@ -50,6 +49,9 @@ void StateEkf::Params::LoadParams(const YamlParser& parser)
 
   parser.GetParam("sigma_R_depth", &sigma_R_depth);
 
+  parser.GetParam("reapply_full_updates", &reapply_full_updates);
+  parser.GetParam("float_imu_updates", &float_imu_updates);
+
   YamlToVector<Vector3d>(parser.GetNode("/shared/n_gravity"), n_gravity);
   YamlToMatrix<Matrix4d>(parser.GetNode("/shared/imu0/body_T_imu"), body_T_imu);
   YamlToMatrix<Matrix4d>(parser.GetNode("/shared/stereo_forward/camera_left/body_T_cam"), body_T_cam);
@@ -59,12 +61,10 @@ void StateEkf::Params::LoadParams(const YamlParser& parser)
 
 StateEkf::StateEkf(const Params& params)
     : params_(params),
-      state_(0, State())
+      state_(0, State()),
+      imu_history_(params_.stored_imu_max_queue_size, true, "filter_imu_history"),
+      state_history_(2 * params_.stored_imu_max_queue_size)  // Room for IMU plus other updates.
 {
-  ImuManager::Params imu_manager_params;
-  imu_manager_params.max_queue_size = params_.stored_imu_max_queue_size;
-  imu_history_ = std::shared_ptr<ImuManager>(new ImuManager(imu_manager_params, "filter_imu_history"));
-
   // IMU measurement noise: [ wx wy wz ax ay az ]
   R_imu_.block<3, 3>(0, 0) =  Matrix3d::Identity() * std::pow(params_.sigma_R_imu_w, 2.0);
   R_imu_.block<3, 3>(3, 3) =  Matrix3d::Identity() * std::pow(params_.sigma_R_imu_a, 2.0);
@@ -95,24 +95,10 @@ void StateEkf::Rewind(seconds_t timestamp, seconds_t allowed_dt)
     // Use the estimate of velocity, acceleration, and angular velocity from the filter.
     const seconds_t nearest_timestamp = state_history_.OldestKey();
 
-    state_lock_.lock();
-
     // NOTE(milo): Need to reset to timestamp to handle the case where nearest_timestamp > timestamp.
     // In that case, we might end up with a dt < 0 when reapplying measurements.
     state_ = StateStamped(timestamp, state_history_.at(nearest_timestamp));
-    state_lock_.unlock();
-  }
-}
-
-
-void StateEkf::ReapplyImu()
-{
-  imu_history_->DiscardBefore(state_.timestamp);
-
-  while (!imu_history_->Empty()) {
-    // NOTE(milo): Don't store these measurements in PredictAndUpdate()! Endless loop!
-    const ImuMeasurement imu = imu_history_->Pop();
-    PredictAndUpdate(imu, false);
+    published_state_.Store(state_);
   }
 }
 
@@ -120,25 +106,30 @@ void StateEkf::ReapplyImu()
 // [1] https://bicr.atr.jp//~aude/publications/ras99.pdf
 // [2] https://en.wikipedia.org/wiki/Extended_Kalman_filter
 // [3] https://stackoverflow.com/questions/24197182/efficient-quaternion-angular-velocity/24201879#24201879
-static State Predict(const State& x0,
-                     double dt,
-                     const Matrix15d& Q)
+// Simulates the mean forward by dt. The covariance is copied over unchanged.
+static State PredictMean(const State& x0, double dt)
 {
   // Simple linear equations for t, v, a, and w.
   const Vector3d t1 = x0.t + dt*x0.v + 0.5*dt*dt*x0.a;
   const Vector3d v1 = x0.v + dt*x0.a;
-  const Vector3d a1 = x0.a;
-  const Vector3d w1 = x0.w;
 
   // Apply a rotation due to angular velocity over dt using the exponential map.
   // q1 = dq * q0 where dq = exp(dt * w).
   const Vector3d drot = dt * x0.w;
+  const Quaterniond dq = Quaterniond(AngleAxisd(drot.norm(), drot.normalized()));
+
+  return State(t1, v1, x0.a, dq * x0.q, x0.w, x0.S);
+}
+
+
+// Jacobian of PredictMean() with respect to the state, for an angular velocity w.
+static Matrix15d PredictJacobian(const Vector3d& w, double dt)
+{
+  const Vector3d drot = dt * w;
   const double angle = drot.norm();
   const Vector3d axis = drot.normalized(); // NOTE(milo): Eigen takes care of zero angle case.
   const Quaterniond dq = Quaterniond(AngleAxisd(angle, axis));
-  const Quaterniond q1 = dq * x0.q;
 
-  // Update the covariance with 1st-order propagation and additive process noise.
   Matrix15d F = Matrix15d::Identity();
   F.block<3, 3>(t_row, v_row) = dt * Matrix3d::Identity();
   F.block<3, 3>(t_row, a_row) = 0.5*dt*dt * Matrix3d::Identity();
@@ -166,11 +157,23 @@ static State Predict(const State& x0,
     F.block<3, 3>(uq_row, w_row) = G;
   }
 
+  return F;
+}
+
+
+static State Predict(const State& x0,
+                     double dt,
+                     const Matrix15d& Q)
+{
+  State x1 = PredictMean(x0, dt);
+
+  // Update the covariance with 1st-order propagation and additive process noise.
   // Multiply dt*Q to account for different step sizes (uncertainty grows with time).
-  Matrix15d S1 = F*x0.S*F.transpose() + dt*Q;
-  Symmetrize(S1);
+  const Matrix15d F = PredictJacobian(x0.w, dt);
+  x1.S = F*x0.S*F.transpose() + dt*Q;
+  Symmetrize(x1.S);
 
-  return State(t1, v1, a1, q1, w1, S1);
+  return x1;
 }
 
 
@@ -187,58 +190,93 @@ static ImuMeasurement RotateAndRemoveGravity(const Quaterniond& q_world_imu,
 }
 
 
-static State GenericKalmanUpdate(const State& x,
-                                 const Eigen::MatrixXd& H,
-                                 const Eigen::VectorXd& y,
-                                 const Eigen::MatrixXd& R,
-                                 const Vector15d& mask)
+// Computes the Kalman gain and Joseph-form covariance update for a measurement whose Jacobian is
+// only nonzero in the B columns starting at col (i.e H = [ 0 Hb 0 ]). Everything is fixed-size and
+// skips the zero blocks of H, so this costs O(15*15*D) instead of a few dense 15x15 products.
+template <typename Scalar, int D, int B>
+static void SparseKalmanGain(const Eigen::Matrix<Scalar, 15, 15>& P,
+                             int col,
+                             const Eigen::Matrix<Scalar, D, B>& Hb,
+                             const Eigen::Matrix<Scalar, D, D>& R,
+                             Eigen::Matrix<Scalar, 15, D>& K,
+                             Eigen::Matrix<Scalar, 15, 15>& P_new)
 {
-  const size_t d = H.rows();
-  CHECK_EQ(15, H.cols()) << "H must have 15 cols" << std::endl;
-  CHECK_EQ(d, y.rows()) << "H and y must be of the same dimension" << std::endl;
-  CHECK_EQ(d, R.rows()) << "R must have d rows" << std::endl;
-  CHECK_EQ(d, R.cols()) << "R must have d cols" << std::endl;
   CHECK(DiagonalNonnegative(R)) << "Bad measurement noise R:\n" << R << std::endl;
 
   // Follows conventions from: https://en.wikipedia.org/wiki/Extended_Kalman_filter
-  const Matrix15d P = x.S;
-  const Eigen::MatrixXd S = H*P*H.transpose() + R;
-  const Eigen::MatrixXd K = P*H.transpose() * S.inverse();
+  const Eigen::Matrix<Scalar, 15, D> PHt = P.template middleCols<B>(col) * Hb.transpose();
+  const Eigen::Matrix<Scalar, D, D> S = Hb * PHt.template middleRows<B>(col) + R;
+  K = PHt * S.inverse();
 
   // https://stats.stackexchange.com/questions/50487/possible-causes-for-the-state-noise-variance-to-become-negative-in-a-kalman-filt
-  const Matrix15d A = (Matrix15d::Identity() - K*H);
-  const Matrix15d S_new = A*P*A.transpose() + K*R*K.transpose();
+  if (std::is_same<Scalar, double>::value) {
+    // NOTE(milo): This is (I - KH)P(I - KH)' + KRK', expanded so that H only shows up through PH'.
+    P_new = P - K*PHt.transpose() - PHt*K.transpose() + K*S*K.transpose();
+  } else {
+    // NOTE(milo): In float, the expanded form above cancels away most of the digits of a well
+    // observed variance, and can go negative. The factored form is a sum of two PSD terms, so it
+    // stays PSD (up to rounding) at the cost of one more dense product.
+    Eigen::Matrix<Scalar, 15, 15> A = Eigen::Matrix<Scalar, 15, 15>::Identity();
+    A.template middleCols<B>(col) -= K * Hb;
+    P_new = A*P*A.transpose() + K*R*K.transpose();
+  }
+
+  CHECK(DiagonalNonnegative(P_new)) << "New covariance matrix is not PSD!\n" << P_new << std::endl;
+}
 
-  CHECK(DiagonalNonnegative(S_new)) << "New covariance matrix is not PSD!\n" << S_new << std::endl;
 
-  // return State(x.ToVector() + (K*y).cwiseProduct(mask), S_new);
+// Kalman update for a measurement that is linear in the tangent-space state vector.
+template <int D, int B>
+static State SparseKalmanUpdate(const State& x,
+                                int col,
+                                const Eigen::Matrix<double, D, B>& Hb,
+                                const Eigen::Matrix<double, D, 1>& y,
+                                const Eigen::Matrix<double, D, D>& R)
+{
+  Eigen::Matrix<double, 15, D> K;
+  Matrix15d S_new;
+  SparseKalmanGain<double, D, B>(x.S, col, Hb, R, K, S_new);
+
   return State(x.ToVector() + K*y, S_new);
 }
 
 
+// Update with a measurement of pose (and optionally velocity, if D = 9). The residual is
+// [ rx ry rz tx ty tz (vx vy vz) ], using the GTSAM convention for the pose part.
+template <int D>
 static State UpdatePose(const State& x,
                         const Quaterniond& world_q_body,
                         const Vector3d& world_t_body,
-                        const Matrix6d& R_pose)
+                        const Vector3d& world_v_body,
+                        const Eigen::Matrix<double, D, D>& R)
 {
+  static_assert(D == 6 || D == 9, "Pose updates are either 6D (pose) or 9D (pose and velocity)");
+
   const gtsam::Pose3 world_P_body = gtsam::Pose3(gtsam::Rot3(x.q), gtsam::Point3(x.t));
   const gtsam::Pose3 measured = gtsam::Pose3(gtsam::Rot3(world_q_body), gtsam::Point3(world_t_body));
 
   // Manifold equivalent of h(x) - z.
   // NOTE(milo): Using GTSAM convention of [ rx rx rz tx ty tz ].
-  const Vector6d error_tangent = world_P_body.localCoordinates(measured);
-
-  Matrix6x15 H = Matrix6x15::Zero();
-  H.block<3, 3>(0, uq_row) = Matrix3d::Identity();
-  H.block<3, 3>(3, t_row) = Matrix3d::Identity();
+  Eigen::Matrix<double, D, 1> error;
+  error.template head<6>() = world_P_body.localCoordinates(measured);
+  if (D == 9) {
+    error.template tail<3>() = world_v_body - x.v;
+  }
 
-  Matrix15d P = x.S;
+  // The measurement only touches t, v, and uq, which are all in the first 12 columns.
+  Eigen::Matrix<double, D, 12> Hb = Eigen::Matrix<double, D, 12>::Zero();
+  Hb.template block<3, 3>(0, uq_row) = Matrix3d::Identity();
+  Hb.template block<3, 3>(3, t_row) = Matrix3d::Identity();
+  if (D == 9) {
+    Hb.template block<3, 3>(6, v_row) = Matrix3d::Identity();
+  }
 
-  const Matrix6d S = H*P*H.transpose() + R_pose;
-  const Matrix15x6 K = P*H.transpose()*S.inverse();
+  Eigen::Matrix<double, 15, D> K;
+  Matrix15d S_new;
+  SparseKalmanGain<double, D, 12>(x.S, 0, Hb, R, K, S_new);
 
   // Get the update increment to apply to the state vector.
-  const Vector15d dx = K*error_tangent;
+  const Vector15d dx = K*error;
   Vector6d dx_tangent;
   dx_tangent.head(3) = dx.middleRows<3>(uq_row);
   dx_tangent.tail(3) = dx.middleRows<3>(t_row);
@@ -257,13 +295,8 @@ static State UpdatePose(const State& x,
   xu.a += dx.middleRows<3>(a_row);
   xu.w += dx.middleRows<3>(w_row);
 
-  // https://stats.stackexchange.com/questions/50487/possible-causes-for-the-state-noise-variance-to-become-negative-in-a-kalman-filt
-  const Matrix15d A = (Matrix15d::Identity() - K*H);
-
-  xu.S = A*P*A.transpose() + K*R_pose*K.transpose();
-
+  xu.S = S_new;
   Symmetrize(xu.S);
-  CHECK(DiagonalNonnegative(xu.S)) << "New covariance matrix is not PSD!\n" << xu.S << std::endl;
 
   return xu;
 }
@@ -276,26 +309,27 @@ void StateEkf::Initialize(const StateStamped& state, const ImuBias& imu_bias)
   is_initialized_ = true;
   imu_bias_ = imu_bias;
 
-  imu_history_->DiscardBefore(state.timestamp);
+  imu_history_.DiscardBefore(state.timestamp);
   state_history_.DiscardBefore(state.timestamp);
 }
 
 
-StateStamped StateEkf::PredictAndUpdate(const ImuMeasurement& imu, bool store)
+// The measurement [ w a ] only touches the columns from a_row to the end: [ a uq w ].
+static Matrix6x9 ImuJacobian()
 {
-  // PREDICT STEP: Simulate the system forward to the current timestep.
-  const seconds_t t_new = ConvertToSeconds(imu.timestamp);
-  const State& x = PredictIfTimeElapsed(t_new);
+  Matrix6x9 Hb = Matrix6x9::Zero();
+  Hb.block<3, 3>(0, w_row - a_row) = Matrix3d::Identity();
+  Hb.block<3, 3>(3, 0) = Matrix3d::Identity();
+  return Hb;
+}
 
-  // UPDATE STEP: Compute redidual errors, Kalman gain, and apply update.
+
+Vector6d StateEkf::ImuResidual(const State& x, const ImuMeasurement& imu) const
+{
   ImuMeasurement imu_unbiased = imu;
   imu_unbiased.a = imu_bias_.correctAccelerometer(imu.a);
   imu_unbiased.w = imu_bias_.correctGyroscope(imu.w);
 
-  Matrix6x15 H = Matrix6x15::Zero();
-  H.block<3, 3>(0, w_row) = Matrix3d::Identity();
-  H.block<3, 3>(3, a_row) = Matrix3d::Identity();
-
   const Quaterniond& q_world_imu = x.q * q_body_imu_;
   const ImuMeasurement imu_uc = RotateAndRemoveGravity(q_world_imu, params_.n_gravity, imu_unbiased);
 
@@ -306,18 +340,109 @@ StateStamped StateEkf::PredictAndUpdate(const ImuMeasurement& imu, bool store)
   z_imu.tail(3) = imu_uc.a;
 
   // y = z - h(x)
-  const Vector6d y = z_imu - x_imu;
-  Vector15d mask = Vector15d::Zero();
-  mask.block<3, 1>(a_row, 0) = Vector3d::Ones();
-  mask.block<3, 1>(w_row, 0) = Vector3d::Ones();
-  const State xu = GenericKalmanUpdate(x, H, y, R_imu_, mask);
+  return z_imu - x_imu;
+}
+
+
+void StateEkf::ReapplyImu()
+{
+  MACRO_PROFILE_SCOPE("StateEkf::ReapplyImu");
+
+  size_t num_fast = 0;
+  if (params_.reapply_full_updates > 0) {
+    const size_t N = imu_history_.ViewRange(state_.timestamp, kMaxSeconds, [](const ImuMeasurement&) {});
+    num_fast = (N > (size_t)params_.reapply_full_updates) ? (N - params_.reapply_full_updates) : 0;
+  }
+
+  // Mean-only replay state (see reapply_full_updates).
+  const StateStamped x0 = state_;
+  State x = x0.state;
+  seconds_t t = x0.timestamp;
+  Eigen::Matrix<double, 15, 6> K;
+  size_t i = 0;
+
+  // Replay the stored measurements in place, and then throw them all away.
+  // NOTE(milo): Don't store these measurements in PredictAndUpdate()! Endless loop!
+  imu_history_.ViewRange(state_.timestamp, kMaxSeconds, [&](const ImuMeasurement& imu) {
+    const seconds_t t_imu = ConvertToSeconds(imu.timestamp);
+
+    if (i < num_fast) {
+      const seconds_t dt = t_imu - t;
+
+      // Use the gain from the first (full) update for the whole span. The IMU observes a and w
+      // directly, so the gain doesn't change much once the filter has settled.
+      if (i == 0) {
+        Matrix15d unused;
+        SparseKalmanGain<double, 6, 9>(Predict(x, dt, Q_).S, a_row, ImuJacobian(), R_imu_, K, unused);
+      }
+
+      x = PredictMean(x, dt);
+      x = State(x.ToVector() + K*ImuResidual(x, imu), x0.state.S);
+      t = t_imu;
+
+      // NOTE(milo): These states keep the rewound covariance, in case we rewind to one of them.
+      state_history_.Update(t, x);
+
+    } else {
+      // Propagate the covariance over the whole mean-only span at once, with the average angular
+      // velocity over it, before switching back to full updates.
+      if (i == num_fast && num_fast > 0) {
+        const seconds_t T = t - x0.timestamp;
+        const AngleAxisd drot(x.q * x0.state.q.inverse());
+        const Matrix15d F = PredictJacobian((T > 0) ? Vector3d(drot.angle() * drot.axis() / T) : x0.state.w, T);
+        x.S = F*x0.state.S*F.transpose() + T*Q_;
+        Symmetrize(x.S);
+        ThreadsafeSetState(t, x);
+      }
+      PredictAndUpdate(imu, false);
+    }
+    ++i;
+  });
+  imu_history_.DiscardBefore(kMaxSeconds);
+}
+
+
+template <typename Scalar>
+State StateEkf::PredictAndUpdateImu(const ImuMeasurement& imu) const
+{
+  typedef Eigen::Matrix<Scalar, 15, 15> Matrix15;
+
+  // PREDICT STEP: Simulate the system forward to the current timestep.
+  // NOTE(milo): The mean always stays in double. It's only 16 numbers, and positions far from the
+  // origin (or a quaternion integrated over thousands of steps) need the extra digits.
+  const seconds_t dt = ElapsedSince(ConvertToSeconds(imu.timestamp));
+  const State x = (dt > 0) ? PredictMean(state_.state, dt) : state_.state;
+
+  Matrix15 S = state_.state.S.template cast<Scalar>();
+  if (dt > 0) {
+    const Matrix15 F = PredictJacobian(state_.state.w, dt).template cast<Scalar>();
+    S = F*S*F.transpose() + static_cast<Scalar>(dt) * Q_.template cast<Scalar>();
+    Symmetrize(S);
+  }
+
+  // UPDATE STEP: Compute redidual errors, Kalman gain, and apply update.
+  const Vector6d y = ImuResidual(x, imu);
+  Eigen::Matrix<Scalar, 15, 6> K;
+  Matrix15 S_new;
+  SparseKalmanGain<Scalar, 6, 9>(S, a_row, ImuJacobian().template cast<Scalar>(),
+                                 R_imu_.template cast<Scalar>(), K, S_new);
+
+  const Vector15d dx = (K * y.template cast<Scalar>()).template cast<double>();
+  return State(x.ToVector() + dx, S_new.template cast<double>());
+}
+
+
+StateStamped StateEkf::PredictAndUpdate(const ImuMeasurement& imu, bool store)
+{
+  MACRO_PROFILE_SCOPE("StateEkf::PredictAndUpdate(imu)");
+  const State xu = params_.float_imu_updates ? PredictAndUpdateImu<float>(imu) : PredictAndUpdateImu<double>(imu);
 
   // Store IMU measurements so that we can rewind the filter and re-apply them during re-init.
   if (store && params_.reapply_measurements_after_init) {
-    imu_history_->Push(imu);
+    imu_history_.Push(imu);
   }
 
-  return ThreadsafeSetState(t_new, xu);
+  return ThreadsafeSetState(ConvertToSeconds(imu.timestamp), xu);
 }
 
 
@@ -329,18 +454,12 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
   const State& x = PredictIfTimeElapsed(timestamp);
 
   // UPDATE STEP: Compute redidual errors, Kalman gain, and apply update.
-  Matrix3x15 H = Matrix3x15::Zero();
-  H.block<3, 3>(0, v_row) = Matrix3d::Identity();
-
   // y = z - h(x)
   const Vector3d y = world_v_body - x.v;
 
-  Vector15d mask = Vector15d::Zero();
-  mask.block<3, 1>(v_row, 0) = Vector3d::Ones();
-
   Matrix3d R_velocity_safe = R_velocity;
   Symmetrize(R_velocity_safe);
-  const State xu = GenericKalmanUpdate(x, H, y, R_velocity_safe, mask);
+  const State xu = SparseKalmanUpdate<3, 3>(x, v_row, Matrix3d::Identity(), y, R_velocity_safe);
 
   return ThreadsafeSetState(timestamp, xu);
 }
@@ -357,7 +476,29 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
   // UPDATE STEP: Compute redidual errors, Kalman gain, and apply update.
   Matrix6d R_pose_safe = R_pose;
   Symmetrize(R_pose_safe);
-  const State& xu = UpdatePose(xp, world_q_body, world_T_body, R_pose_safe);
+  const State& xu = UpdatePose<6>(xp, world_q_body, world_T_body, Vector3d::Zero(), R_pose_safe);
+
+  return ThreadsafeSetState(timestamp, xu);
+}
+
+
+StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
+                                        const Quaterniond& world_q_body,
+                                        const Vector3d& world_T_body,
+                                        const Matrix6d& R_pose,
+                                        const Vector3d& world_v_body,
+                                        const Matrix3d& R_velocity)
+{
+  // PREDICT STEP: Simulate the system forward to the current timestep.
+  const State& xp = PredictIfTimeElapsed(timestamp);
+
+  // UPDATE STEP: Compute redidual errors, Kalman gain, and apply update.
+  // NOTE(milo): We don't know the cross-covariance between pose and velocity, so R is block diagonal.
+  Matrix9d R = Matrix9d::Zero();
+  R.block<6, 6>(0, 0) = R_pose;
+  R.block<3, 3>(6, 6) = R_velocity;
+  Symmetrize(R);
+  const State& xu = UpdatePose<9>(xp, world_q_body, world_T_body, world_v_body, R);
 
   return ThreadsafeSetState(timestamp, xu);
 }
@@ -374,18 +515,13 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
   // UPDATE STEP: Compute redidual errors, Kalman gain, and apply update.
   CHECK_GT(R_axis_sigma, 0) << "R_axis_sigma (stdev) must be > 0" << std::endl;
 
-  Matrix1x15 H = Matrix1x15::Zero();
-  H(0, t_row + axis) = 1.0;
-
   // Get the translation along desired axis.
   const double pred_world_T_body = x.t(axis);
   const Vector1d y = (Vector1d() << meas_world_T_body - pred_world_T_body).finished();
 
-  Vector15d mask = Vector15d::Zero();
-  mask(t_row + axis, 0) = 1.0;
-
+  // The Jacobian just selects one column of the state.
   const Matrix1d R = Matrix1d::Identity() * R_axis_sigma * R_axis_sigma;
-  const State xu = GenericKalmanUpdate(x, H, y, R, mask);
+  const State xu = SparseKalmanUpdate<1, 1>(x, t_row + axis, Matrix1d::Identity(), y, R);
 
   return ThreadsafeSetState(timestamp, xu);
 }
@@ -402,18 +538,15 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
   // UPDATE STEP: Compute redidual errors, Kalman gain, and apply update.
   CHECK_GT(sigma_R_range, 0) << "sigma_R_range (stdev) must be > 0" << std::endl;
 
-  Matrix1x15 H = Matrix1x15::Zero();
+  Matrix1x3 Hb = Matrix1x3::Zero();
 
   // Need to account for the location of the range receiver on the robot.
-  Matrix4d world_T_body = Matrix4d::Identity();
-  world_T_body.block<3, 3>(0, 0) = x.q.normalized().toRotationMatrix();
-  world_T_body.block<3, 1>(0, 3) = x.t;
-
-  const Matrix4d world_T_receiver = world_T_body * params_.body_T_receiver;
-  const Vector3d world_t_receiver = world_T_receiver.block<3, 1>(0, 3);
+  const SE3 world_T_body(x.q.normalized(), x.t);
+  const Vector3d world_t_receiver = world_T_body * Vector3d(params_.body_T_receiver.block<3, 1>(0, 3));
 
   // Gradient is the unit vector from the point to the robot (direction of increasing range).
-  H.block<1, 3>(0, t_row) = (world_t_receiver - point).normalized().transpose();
+  // The Jacobian is only nonzero for the translation columns.
+  Hb = (world_t_receiver - point).normalized().transpose();
 
   // If predicted range is LESS than observed range, move the robot farther from point.
   // If predicted range is MORE than observed range, move the robot closer to point.
@@ -422,22 +555,28 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
   // y = z - h(x)
   const Vector1d y = (Vector1d() << range - h_range).finished();
   const Matrix1d R = Matrix1d::Identity() * sigma_R_range*sigma_R_range;
-  Vector15d mask = Vector15d::Zero();
-  mask.block<3, 1>(t_row, 0) = Vector3d::Ones();
-  const State xu = GenericKalmanUpdate(x, H, y, R, mask);
+  const State xu = SparseKalmanUpdate<1, 3>(x, t_row, Hb, y, R);
 
   return ThreadsafeSetState(timestamp, xu);
 }
 
 
 
-State StateEkf::PredictIfTimeElapsed(seconds_t timestamp)
+seconds_t StateEkf::ElapsedSince(seconds_t timestamp) const
 {
   CHECK(is_initialized_) << "Must call Initialize() before Predict()" << std::endl;
 
   const seconds_t dt = (timestamp - state_.timestamp);
   CHECK(dt >= 0) << "Tried to call Predict() using a stale measurement" << std::endl;
 
+  return dt;
+}
+
+
+State StateEkf::PredictIfTimeElapsed(seconds_t timestamp)
+{
+  const seconds_t dt = ElapsedSince(timestamp);
+
   // PREDICT STEP: Simulate the system forward to the current timestep.
   return (dt > 0) ? Predict(state_.state, dt, Q_) : state_.state;
 }
@@ -445,11 +584,10 @@ State StateEkf::PredictIfTimeElapsed(seconds_t timestamp)
 
 StateStamped StateEkf::ThreadsafeSetState(seconds_t timestamp, const State& state)
 {
-  state_lock_.lock();
   state_.timestamp = timestamp;
   state_.state = state;
   Symmetrize(state_.state.S);
-  state_lock_.unlock();
+  published_state_.Store(state_);
 
   state_history_.Update(timestamp, state);
 
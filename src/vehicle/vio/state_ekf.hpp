@@ -6,9 +6,12 @@
 #include "core/timestamp.hpp"
 #include "core/uid.hpp"
 #include "core/eigen_types.hpp"
+#include "core/pipeline_latency.hpp"
 #include "core/axis3.hpp"
+#include "core/seqlock.hpp"
 #include "params/params_base.hpp"
 #include "core/thread_safe_queue.hpp"
+#include "core/time_indexed_data_manager.hpp"
 
 #include "vio/imu_manager.hpp"
 #include "vio/item_history.hpp"
@@ -114,6 +117,9 @@ struct StateStamped final
   seconds_t timestamp = 0;
   State state;
 
+  // From the measurement that was just applied to this state. Not valid after a smoother sync.
+  PipelineLatency latency;
+
   void Print() const
   {
     std::cout << "StateStamped (t=" << timestamp << ")" << std::endl;
@@ -132,6 +138,18 @@ class StateEkf final {
     int stored_imu_max_queue_size = 2000;
     double stored_state_lag_sec = 10;                // delete stored states once they're this old
 
+    // When reapplying IMU after a rewind, only the newest reapply_full_updates measurements get a
+    // full EKF update. The older ones only update the mean (with the Kalman gain of the rewound
+    // state), and the covariance is propagated over all of them in one step. Zero does full updates
+    // for every measurement.
+    int reapply_full_updates = 0;
+
+    // Do the covariance math for IMU updates (the per-sample prediction and Kalman update) in
+    // float instead of double. The mean stays in double. This is meant for low-power processors
+    // where float SIMD is about twice as fast, and uses a (slower) factored Joseph-form update so
+    // that the covariance stays PSD with fewer digits.
+    bool float_imu_updates = false;
+
     // Process noise standard deviations.
     double sigma_Q_t = 1e-2;   // translation
     double sigma_Q_v = 1e-3;   // velocity
@@ -163,7 +181,7 @@ class StateEkf final {
   // If no previous state exists within allowed_dt, it will complain but no exception is thrown.
   void Rewind(seconds_t timestamp, seconds_t allowed_dt = 0.1);
 
-  // Re-apply all stored imu measurements on top of the current state.
+  // Re-apply all stored imu measurements on top of the current state (see reapply_full_updates).
   void UpdateImuBias(const ImuBias& imu_bias) { imu_bias_ = imu_bias; }
   void ReapplyImu();
 
@@ -180,6 +198,15 @@ class StateEkf final {
                                 const Vector3d& world_T_body,
                                 const Matrix6d& R_pose);
 
+  // Update with an external pose AND velocity estimate that share a timestamp (e.g from smoother).
+  // This is one batched 9D update, which is cheaper than updating with each of them in turn.
+  StateStamped PredictAndUpdate(seconds_t timestamp,
+                                const Quaterniond& q_world_body,
+                                const Vector3d& world_T_body,
+                                const Matrix6d& R_pose,
+                                const Vector3d& world_v_body,
+                                const Matrix3d& R_velocity);
+
   // Update with an external velocity estimate (e.g from smoother).
   StateStamped PredictAndUpdate(seconds_t timestamp,
                                 const Vector3d& world_v_body,
@@ -198,12 +225,11 @@ class StateEkf final {
                                 const Vector3d point,
                                 double R_range);
 
-  // Retrieve the current state.
-  StateStamped GetState()
+  // Retrieve the current state. Threadsafe, and never waits on the thread that updates the filter.
+  StateStamped GetState() const
   {
-    state_lock_.lock();
-    const StateStamped out = state_;
-    state_lock_.unlock();
+    StateStamped out;
+    published_state_.Load(out);
     return out;
   }
 
@@ -221,14 +247,27 @@ class StateEkf final {
   // no forward simulation happens.
   State PredictIfTimeElapsed(seconds_t timestamp);
 
-  // Call this to update the filter's state.
+  // Time since the current state. Checks that the filter is initialized and timestamp isn't stale.
+  seconds_t ElapsedSince(seconds_t timestamp) const;
+
+  // Predicts the current state to the IMU timestamp and updates with it. The covariance math is
+  // done in Scalar (see float_imu_updates), but the result is stored in double either way.
+  template <typename Scalar>
+  State PredictAndUpdateImu(const ImuMeasurement& imu) const;
+
+  // Residual (z - h(x)) of an IMU measurement, as [ w a ] in the world frame.
+  Vector6d ImuResidual(const State& x, const ImuMeasurement& imu) const;
+
+  // Call this to update the filter's state. Also publishes it to GetState().
   StateStamped ThreadsafeSetState(seconds_t timestamp, const State& state);
 
  private:
   Params params_;
 
-  std::mutex state_lock_;
+  // NOTE(milo): state_ is only touched by the thread that updates the filter. Other threads read
+  // the copy in published_state_, which is updated after every change to state_.
   StateStamped state_;
+  SeqLock<StateStamped> published_state_;
   ImuBias imu_bias_;
   bool is_initialized_ = false;
 
@@ -240,8 +279,9 @@ class StateEkf final {
 
   Quaterniond q_body_imu_;
 
-  std::shared_ptr<ImuManager> imu_history_ = nullptr;
-
+  // Measurements and states for rewinding the filter. Both are contiguous, so replaying after a
+  // smoother update doesn't allocate.
+  TimeIndexedDataManager<ImuMeasurement> imu_history_;
   ItemHistory<seconds_t, State> state_history_;
 };
 
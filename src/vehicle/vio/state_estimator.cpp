@@ -1,14 +1,89 @@
-#include <glog/logging.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
 
-#include <opencv2/highgui.hpp>
+#include <glog/logging.h>
 
+#include "core/alloc_tracker.hpp"
+#include "core/memory_usage.hpp"
+#include "core/task_scheduler.hpp"
 #include "core/timer.hpp"
 #include "core/transform_util.hpp"
+#include "vision_core/debug_viewer.hpp"
+#include "vio/se3_gtsam.hpp"
 #include "vio/state_estimator.hpp"
+#include "vio/trilateration.hpp"
 
 namespace bm {
 namespace vio {
 
+// Max tracked frames waiting for a pose solve when the frontend is pipelined.
+static const size_t kMaxSizeStereoSolveQueue = 2;
+
+// Tag poses come from keyframes only, and are popped at every keypose.
+static const size_t kMaxSizeSmootherTagQueue = 10;
+
+// Gyro measurements for the frontend's rotation priors (a couple of seconds at 200 Hz).
+static const size_t kMaxSizeFrontendGyroQueue = 500;
+
+// The smallest queues and history that a memory budget can shrink things to (see memory_budget_mb).
+static const int kMinSizeStereoQueue = 2;
+static const int kMinSizeVoQueue = 10;
+static const int kMinStoredImu = 200;
+
+
+// Bytes held by one queued stereo pair (both images are 8-bit).
+static size_t StereoImageBytes(const StereoCamera& stereo_rig)
+{
+  return sizeof(StereoImage1b) + 2ul * stereo_rig.Width() * stereo_rig.Height();
+}
+
+
+// Lower the queue sizes and filter history in params to fit params.memory_budget_mb.
+static StateEstimator::Params FitParamsToMemoryBudget(const StateEstimator::Params& params)
+{
+  StateEstimator::Params fitted = params;
+  if (params.memory_budget_mb <= 0) {
+    return fitted;
+  }
+
+  size_t aux_image_bytes = 0;
+  for (const AuxStereoRig& rig : params.aux_stereo_rigs) {
+    aux_image_bytes += StereoImageBytes(rig.stereo_rig) + sizeof(AuxVoMeasurement);
+  }
+
+  // NOTE(milo): The IMU, depth, range, and mag queues are small enough to leave alone, but they
+  // still count against the budget. The smoother and filter each have an IMU queue.
+  std::vector<MemoryKnob> knobs;
+  knobs.emplace_back("max_size_raw_stereo_queue", params.max_size_raw_stereo_queue,
+                     StereoImageBytes(params.stereo_rig), kMinSizeStereoQueue);
+  knobs.emplace_back("max_size_aux_stereo_queue", params.max_size_aux_stereo_queue,
+                     aux_image_bytes, kMinSizeStereoQueue);
+  knobs.emplace_back("max_size_smoother_vo_queue", params.max_size_smoother_vo_queue,
+                     sizeof(VoResult), kMinSizeVoQueue);
+  knobs.emplace_back("stored_imu_max_queue_size", params.filter_params.stored_imu_max_queue_size,
+                     sizeof(ImuMeasurement) + 2 * sizeof(State), kMinStoredImu);
+  knobs.emplace_back("imu_manager_max_queue_size", params.imu_manager_params.max_queue_size,
+                     2 * sizeof(ImuMeasurement), params.imu_manager_params.max_queue_size);
+  const int max_size_depth = std::max(params.max_size_smoother_depth_queue, params.max_size_filter_depth_queue);
+  const int max_size_range = std::max(params.max_size_smoother_range_queue, params.max_size_filter_range_queue);
+  knobs.emplace_back("max_size_depth_queues", max_size_depth, sizeof(DepthMeasurement), max_size_depth);
+  knobs.emplace_back("max_size_range_queues", max_size_range, sizeof(RangeMeasurement), max_size_range);
+  knobs.emplace_back("max_size_smoother_mag_queue", params.max_size_smoother_mag_queue,
+                     sizeof(MagMeasurement), params.max_size_smoother_mag_queue);
+
+  const double scale = FitToMemoryBudget(static_cast<size_t>(params.memory_budget_mb) * 1024ul * 1024ul, knobs);
+  LOG(INFO) << "Fit the StateEstimator queues to " << params.memory_budget_mb << " MB (scale=" << scale << ")" << std::endl;
+
+  fitted.max_size_raw_stereo_queue = knobs.at(0).capacity;
+  fitted.max_size_aux_stereo_queue = knobs.at(1).capacity;
+  fitted.max_size_smoother_vo_queue = knobs.at(2).capacity;
+  fitted.filter_params.stored_imu_max_queue_size = knobs.at(3).capacity;
+
+  return fitted;
+}
+
 
 void StateEstimator::Params::LoadParams(const YamlParser& parser)
 {
@@ -26,21 +101,74 @@ void StateEstimator::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("max_size_filter_vo_queue", &max_size_filter_vo_queue);
   parser.GetParam("max_size_filter_imu_queue", &max_size_filter_imu_queue);
   parser.GetParam("max_size_filter_depth_queue", &max_size_filter_depth_queue);
-  parser.GetParam("max_size_filter_range_queue", &max_size_smoother_range_queue);
+  parser.GetParam("max_size_filter_range_queue", &max_size_filter_range_queue);
+  parser.GetParam("memory_budget_mb", &memory_budget_mb);
+  CHECK_GE(memory_budget_mb, 0);
+  parser.GetParam("smoother_catchup_backlog", &smoother_catchup_backlog);
+  parser.GetParam("smoother_catchup_max_keyposes", &smoother_catchup_max_keyposes);
+  CHECK_GE(smoother_catchup_backlog, 0);
+  CHECK_GT(smoother_catchup_max_keyposes, 0);
   parser.GetParam("reliable_vision_min_lmks", &reliable_vision_min_lmks);
   parser.GetParam("max_sec_btw_keyposes", &max_sec_btw_keyposes);
   parser.GetParam("min_sec_btw_keyposes", &min_sec_btw_keyposes);
+  parser.GetParam("use_keyframe_policy", &use_keyframe_policy);
+  if (use_keyframe_policy) {
+    keyframe_policy_params = KeyframePolicy::Params(parser.Subtree("KeyframePolicy"));
+    CHECK_LT(keyframe_policy_params.max_sec_btw_keyframes, max_sec_btw_keyposes)
+        << "The smoother would give up on vision before the KeyframePolicy triggers a keyframe" << std::endl;
+  }
+  parser.GetParam("use_overload_controller", &use_overload_controller);
+  if (use_overload_controller) {
+    overload_controller_params = OverloadController::Params(parser.Subtree("OverloadController"));
+  }
+  parser.GetParam("use_power_governor", &use_power_governor);
+  if (use_power_governor) {
+    power_governor_params = PowerGovernor::Params(parser.Subtree("PowerGovernor"));
+  }
+  parser.GetParam("use_gyro_rotation_prior", &use_gyro_rotation_prior);
+  parser.GetParam("fast_motion_skip_rad_per_sec", &fast_motion_skip_rad_per_sec);
+  CHECK_GE(fast_motion_skip_rad_per_sec, 0.0);
+  parser.GetParam("estimate_imu_time_offset", &estimate_imu_time_offset);
+  if (estimate_imu_time_offset) {
+    time_offset_params = TimeOffsetEstimator::Params(parser.Subtree("TimeOffsetEstimator"));
+  }
   parser.GetParam("smoother_init_wait_vision_sec", &smoother_init_wait_vision_sec);
   parser.GetParam("allowed_misalignment_depth", &allowed_misalignment_depth);
   parser.GetParam("allowed_misalignment_imu", &allowed_misalignment_imu);
   parser.GetParam("allowed_misalignment_range", &allowed_misalignment_range);
   parser.GetParam("allowed_misalignment_mag", &allowed_misalignment_mag);
+  parser.GetParam("allowed_misalignment_tag", &allowed_misalignment_tag);
   parser.GetParam("max_filter_divergence_position", &max_filter_divergence_position);
   parser.GetParam("max_filter_divergence_rotation", &max_filter_divergence_rotation);
   parser.GetParam("show_feature_tracks", &show_feature_tracks);
+  parser.GetParam("pipeline_stereo_frontend", &pipeline_stereo_frontend);
   parser.GetParam("body_nG_tol", &body_nG_tol);
+  parser.GetParam("average_mag_samples", &average_mag_samples);
+  parser.GetParam("average_attitude_samples", &average_attitude_samples);
+  parser.GetParam("use_tags", &use_tags);
+  if (use_tags) {
+    tag_localizer_params = TagLocalizer::Params(parser.Subtree("TagLocalizer"));
+  }
+  parser.GetParam("tag_max_wait_sec", &tag_max_wait_sec);
   parser.GetParam("filter_use_depth", &filter_use_depth);
   parser.GetParam("filter_use_range", &filter_use_range);
+  parser.GetParam("filter_async_callbacks", &filter_async_callbacks);
+  parser.GetParam("pose_history_size", &pose_history_size);
+  parser.GetParam("pose_history_max_gap_sec", &pose_history_max_gap_sec);
+  parser.GetParam("range_gate_max_mahalanobis_sq", &range_gate_max_mahalanobis_sq);
+  parser.GetParam("range_gate_max_rejects", &range_gate_max_rejects);
+  parser.GetParam("lockstep", &lockstep);
+  smoother_log_path = YamlToString(parser.GetNode("smoother_log_path"));
+  checkpoint_path = YamlToString(parser.GetNode("checkpoint_path"));
+  parser.GetParam("checkpoint_interval_sec", &checkpoint_interval_sec);
+  slow_frame_folder = YamlToString(parser.GetNode("slow_frame_folder"));
+  parser.GetParam("slow_frame_deadline_ms", &slow_frame_deadline_ms);
+  parser.GetParam("slow_frame_history", &slow_frame_history);
+  parser.GetParam("slow_frame_max_dumps", &slow_frame_max_dumps);
+
+  YamlToThreadSchedule(parser.GetNode("FrontendThread"), frontend_thread_schedule);
+  YamlToThreadSchedule(parser.GetNode("SmootherThread"), smoother_thread_schedule);
+  YamlToThreadSchedule(parser.GetNode("FilterThread"), filter_thread_schedule);
 
   YamlToVector<Vector3d>(parser.GetNode("/shared/n_gravity"), n_gravity);
   Matrix4d body_T_left, body_T_right;
@@ -48,179 +176,1279 @@ void StateEstimator::Params::LoadParams(const YamlParser& parser)
 
   body_P_imu = gtsam::Pose3(YamlToTransform(parser.GetNode("/shared/imu0/body_T_imu")));
   body_P_cam = gtsam::Pose3(body_T_left);
+
+  const cv::FileNode& aux_rig_names = parser.GetNode("aux_stereo_rigs");
+  CHECK(aux_rig_names.isSeq()) << "aux_stereo_rigs should be a list of shared params nodes" << std::endl;
+  for (cv::FileNodeIterator it = aux_rig_names.begin(); it != aux_rig_names.end(); ++it) {
+    AuxStereoRig rig;
+    rig.name = YamlToString(*it);
+    Matrix4d aux_body_T_left, aux_body_T_right;
+    YamlToStereoRig(parser.GetNode("/shared/" + rig.name), rig.stereo_rig, aux_body_T_left, aux_body_T_right);
+    rig.body_P_cam = gtsam::Pose3(aux_body_T_left);
+    rig.body_P_right = gtsam::Pose3(aux_body_T_right);
+    aux_stereo_rigs.emplace_back(rig);
+  }
+  parser.GetParam("max_size_aux_stereo_queue", &max_size_aux_stereo_queue);
+  parser.GetParam("allowed_misalignment_aux_vision", &allowed_misalignment_aux_vision);
+  parser.GetParam("aux_rig_max_hz", &aux_rig_max_hz);
+  parser.GetParam("aux_rig_shed_latency_ms", &aux_rig_shed_latency_ms);
+  CHECK_GT(max_size_aux_stereo_queue, 0);
+
+  // The smoother needs the aux rig calibrations for their landmark factors.
+  smoother_params.aux_stereo_rigs = aux_stereo_rigs;
+}
+
+
+StateEstimator::AuxRig::AuxRig(const AuxStereoRig& rig,
+                               const StereoFrontend::Params& frontend_params,
+                               int max_queue_size,
+                               double max_hz)
+    : name(rig.name),
+      frontend(frontend_params),
+      raw_stereo_queue(max_queue_size, true, "aux_stereo_queue_" + rig.name),
+      vo_manager(max_queue_size, true, "aux_vo_manager_" + rig.name),
+      subsampler(max_hz > 0 ? max_hz : 1.0),
+      subsample(max_hz > 0) {}
+
+
+StateEstimator::Tunables::Tunables(const Params& params)
+    : max_size_raw_stereo_queue(params.max_size_raw_stereo_queue),
+      max_size_smoother_vo_queue(params.max_size_smoother_vo_queue),
+      keyframe_policy_params(params.keyframe_policy_params),
+      extra_smoothing_iters(params.smoother_params.extra_smoothing_iters),
+      smoothing_convergence_rel_tol(params.smoother_params.smoothing_convergence_rel_tol),
+      smoothing_time_budget_ms(params.smoother_params.smoothing_time_budget_ms) {}
+
+
+void StateEstimator::Tunables::Update(const YamlParser& parser)
+{
+  parser.TryGetParam("max_size_raw_stereo_queue", &max_size_raw_stereo_queue);
+  parser.TryGetParam("max_size_smoother_vo_queue", &max_size_smoother_vo_queue);
+
+  if (parser.HasParam("KeyframePolicy")) {
+    const YamlParser p = parser.Subtree("KeyframePolicy");
+    KeyframePolicy::Params& kp = keyframe_policy_params;
+    p.TryGetParam("min_sec_btw_keyframes", &kp.min_sec_btw_keyframes);
+    p.TryGetParam("max_sec_btw_keyframes", &kp.max_sec_btw_keyframes);
+    p.TryGetParam("min_parallax_px", &kp.min_parallax_px);
+    p.TryGetParam("min_track_overlap", &kp.min_track_overlap);
+    p.TryGetParam("min_translation_m", &kp.min_translation_m);
+    p.TryGetParam("min_rotation_rad", &kp.min_rotation_rad);
+    p.TryGetParam("smoother_latency_budget_ms", &kp.smoother_latency_budget_ms);
+    p.TryGetParam("load_backoff", &kp.load_backoff);
+  }
+
+  if (parser.HasParam("FixedLagSmoother")) {
+    const YamlParser p = parser.Subtree("FixedLagSmoother");
+    p.TryGetParam("extra_smoothing_iters", &extra_smoothing_iters);
+    p.TryGetParam("smoothing_convergence_rel_tol", &smoothing_convergence_rel_tol);
+    p.TryGetParam("smoothing_time_budget_ms", &smoothing_time_budget_ms);
+  }
+}
+
+
+StateEstimator::StateEstimator(const Params& params)
+    : params_(FitParamsToMemoryBudget(params)),
+      stereo_rig_(params.stereo_rig),
+      is_shutdown_(false),
+      tunables_(Tunables(params_)),
+      keyframe_policy_(params_.keyframe_policy_params),
+      overload_controller_(params_.overload_controller_params),
+      power_governor_(params_.power_governor_params),
+      raw_stereo_queue_(params_.max_size_raw_stereo_queue, true, "raw_stereo_queue"),
+      frontend_gyro_manager_(kMaxSizeFrontendGyroQueue, true, "frontend_gyro_manager"),
+      time_offset_estimator_(params_.time_offset_params),
+      stereo_solve_queue_(kMaxSizeStereoSolveQueue, false, "stereo_solve_queue"),
+      depth_buffer_(std::max(params_.max_size_smoother_depth_queue, params_.max_size_filter_depth_queue), "depth_buffer"),
+      range_buffer_(std::max(params_.max_size_smoother_range_queue, params_.max_size_filter_range_queue), "range_buffer"),
+      smoother_imu_manager_(params_.imu_manager_params, "smoother_imu_manager"),
+      smoother_vo_queue_(params_.max_size_smoother_vo_queue, true, "smoother_vo_queue"),
+      smoother_depth_manager_(depth_buffer_, params_.max_size_smoother_depth_queue, "smoother_depth_manager"),
+      smoother_range_manager_(range_buffer_, params_.max_size_smoother_range_queue, "smoother_range_manager"),
+      smoother_mag_manager_(params_.max_size_smoother_mag_queue, true, "smoother_mag_manager"),
+      smoother_tag_manager_(kMaxSizeSmootherTagQueue, true, "smoother_tag_manager"),
+      filter_imu_manager_(params.imu_manager_params, "filter_imu_manager"),
+      filter_depth_manager_(depth_buffer_, params_.filter_use_depth ? params_.max_size_filter_depth_queue : 0, "filter_depth_manager"),
+      filter_range_manager_(range_buffer_, params_.filter_use_range ? params_.max_size_filter_range_queue : 0, "filter_range_manager"),
+      filter_poses_(params_.pose_history_size, params_.pose_history_max_gap_sec),
+      smoother_poses_(params_.pose_history_size, params_.pose_history_max_gap_sec),
+      stats_("StateEstimator", params_.stats_tracker_k)
+{
+  LOG(INFO) << "Constructed StateEstimator!" << std::endl;
+
+  // Let the smoother and filter threads sleep until any of their inputs have data.
+  smoother_vo_queue_.AttachNotifier(&smoother_notifier_);
+  smoother_imu_manager_.AttachNotifier(&smoother_notifier_);
+  smoother_depth_manager_.AttachNotifier(&smoother_notifier_);
+  smoother_range_manager_.AttachNotifier(&smoother_notifier_);
+  smoother_mag_manager_.AttachNotifier(&smoother_notifier_);
+  smoother_tag_manager_.AttachNotifier(&smoother_notifier_);
+  filter_imu_manager_.AttachNotifier(&filter_notifier_);
+  filter_depth_manager_.AttachNotifier(&filter_notifier_);
+  filter_range_manager_.AttachNotifier(&filter_notifier_);
+
+  // NOTE(milo): The subsystems don't depend on each other, and some of them are slow to construct
+  // (e.g the frontend starts up CUDA, the tag detector builds its code tables), so build them in
+  // parallel. Optional ones are only built if they're used.
+  std::vector<std::function<void()>> init_tasks;
+  init_tasks.emplace_back([this]() {
+    startup_.Time("frontend", [this]() {
+      // NOTE(milo): In lockstep mode, relocalization has to land on the same keyframe every time,
+      // and tracking can't stop at a wall-clock deadline.
+      StereoFrontend::Params frontend_params = params_.stereo_frontend_params;
+      frontend_params.reloc_blocking |= params_.lockstep;
+      if (params_.lockstep) {
+        frontend_params.tracker_params.track_deadline_ms = 0;
+      }
+      stereo_frontend_.reset(new StereoFrontend(frontend_params));
+    });
+  });
+
+  // Each aux rig has its own frontend, which is as slow to construct as the primary one.
+  aux_rigs_.resize(params_.aux_stereo_rigs.size());
+  for (size_t i = 0; i < aux_rigs_.size(); ++i) {
+    init_tasks.emplace_back([this, i]() {
+      const AuxStereoRig& rig = params_.aux_stereo_rigs.at(i);
+      startup_.Time("aux_frontend_" + rig.name, [this, &rig, i]() {
+        StereoFrontend::Params frontend_params = params_.stereo_frontend_params;
+        frontend_params.stereo_rig = rig.stereo_rig;
+        frontend_params.body_T_left = rig.body_P_cam.matrix();
+        frontend_params.body_T_right = rig.body_P_right.matrix();
+        frontend_params.use_keyframe_database = false;   // The smoother only relocalizes the primary rig.
+        aux_rigs_.at(i).reset(new AuxRig(rig, frontend_params, params_.max_size_aux_stereo_queue, params_.aux_rig_max_hz));
+      });
+    });
+  }
+
+  if (params_.use_tags) {
+    init_tasks.emplace_back([this]() {
+      startup_.Time("tag_localizer", [this]() {
+        tag_localizer_.reset(new TagLocalizer(params_.tag_localizer_params));
+      });
+    });
+  }
+
+  if (!params_.smoother_log_path.empty()) {
+    init_tasks.emplace_back([this]() {
+      startup_.Time("smoother_log", [this]() {
+        smoother_log_.reset(new SmootherLogWriter(params_.smoother_log_path));
+      });
+    });
+    LOG(INFO) << "Logging smoother inputs to " << params_.smoother_log_path << std::endl;
+  }
+
+  if (!params_.slow_frame_folder.empty()) {
+    slow_frames_.reset(new SlowFrameRecorder(params_.slow_frame_folder,
+                                             params_.slow_frame_deadline_ms,
+                                             params_.slow_frame_history,
+                                             params_.slow_frame_max_dumps));
+    LOG(INFO) << "Writing slow frames to " << params_.slow_frame_folder << std::endl;
+  }
+
+  TaskScheduler::Instance().ParallelFor(TaskPriority::FRONTEND, (int)init_tasks.size(),
+      [&init_tasks](int i) { init_tasks.at(i)(); });
+
+  if (params_.use_keyframe_policy) {
+    stereo_frontend_->SetKeyframeTrigger([this](const KeyframeCues& cues) {
+      return keyframe_policy_.IsKeyframe(cues);
+    });
+  }
+
+  RegisterStats();
+  RegisterMemoryReports();
+  if (params_.stats_print_interval_sec > 0) {
+    stats_.StartReporter(params_.stats_print_interval_sec);
+  }
+
+  Vector3d n_gravity_unit;
+  depth_axis_ = GetGravityAxis(params_.n_gravity, n_gravity_unit);
+  depth_sign_ = n_gravity_unit(depth_axis_) >= 0 ? 1.0 : -1.0;
+  LOG(INFO) << "Unit GRAVITY/DEPTH axis: " << n_gravity_unit.transpose() << std::endl;
+
+  startup_.Mark("constructed");
+  LOG(INFO) << startup_.Summary() << std::endl;
+}
+
+
+StateEstimator::~StateEstimator()
+{
+  for (const size_t id : memory_report_ids_) {
+    MemoryRegistry::Get().Unregister(id);
+  }
+}
+
+
+void StateEstimator::RegisterMemoryReports()
+{
+  MemoryRegistry& registry = MemoryRegistry::Get();
+  if (params_.memory_budget_mb > 0) {
+    registry.SetBudget(static_cast<size_t>(params_.memory_budget_mb) * 1024ul * 1024ul);
+  }
+
+  const size_t stereo_bytes = StereoImageBytes(stereo_rig_);
+  memory_report_ids_.emplace_back(registry.Register("raw_stereo_queue", [this, stereo_bytes]() {
+    return raw_stereo_queue_.Size() * stereo_bytes;
+  }));
+  memory_report_ids_.emplace_back(registry.Register("smoother_vo_queue", [this]() {
+    return smoother_vo_queue_.Size() * sizeof(VoResult);
+  }));
+  memory_report_ids_.emplace_back(registry.Register("imu_managers", [this]() {
+    return (smoother_imu_manager_.Size() + filter_imu_manager_.Size()) * sizeof(ImuMeasurement);
+  }));
+
+  for (size_t i = 0; i < aux_rigs_.size(); ++i) {
+    const size_t aux_bytes = StereoImageBytes(params_.aux_stereo_rigs.at(i).stereo_rig);
+    AuxRig* aux = aux_rigs_.at(i).get();
+    memory_report_ids_.emplace_back(registry.Register("aux_stereo_queue_" + aux->name, [aux, aux_bytes]() {
+      return aux->raw_stereo_queue.Size() * aux_bytes;
+    }));
+  }
+}
+
+
+void StateEstimator::RegisterStats()
+{
+  stat_ids_.checkpoint_write = stats_.Register("CheckpointWrite", "ms");
+  stat_ids_.overload_frames_skipped = stats_.Register("OverloadFramesSkipped");
+  stat_ids_.low_quality_frames_skipped = stats_.Register("LowQualityFramesSkipped");
+  stat_ids_.frontend_relocalized = stats_.Register("FrontendRelocalized");
+  stat_ids_.fast_motion_frames_skipped = stats_.Register("FastMotionFramesSkipped");
+  stat_ids_.imu_time_offset = stats_.Register("ImuTimeOffsetMs", "ms");
+  stat_ids_.tag_detections_skipped = stats_.Register("TagDetectionsSkipped");
+  stat_ids_.tag_detection = stats_.Register("TagDetection", "ms");
+  stat_ids_.smoother_tag_wait = stats_.Register("SmootherTagWait", "ms");
+  stat_ids_.smoother_attitude_samples = stats_.Register("SmootherAttitudeSamples");
+  stat_ids_.smoother_mag_samples = stats_.Register("SmootherMagSamples");
+  stat_ids_.smoother_ranges_rejected = stats_.Register("SmootherRangesRejected");
+  stat_ids_.filter_ranges_rejected = stats_.Register("FilterRangesRejected");
+  stat_ids_.frontend_wake_latency = stats_.Register("FrontendWakeLatency", "ms");
+  stat_ids_.smoother_wake_latency = stats_.Register("SmootherWakeLatency", "ms");
+  stat_ids_.filter_wake_latency = stats_.Register("FilterWakeLatency", "ms");
+  stat_ids_.smoother_factors = stats_.Register("SmootherFactors");
+  stat_ids_.smoother_lmk_factors = stats_.Register("SmootherLmkFactors");
+  stat_ids_.smoother_lmk_observed = stats_.Register("SmootherLmkObserved");
+  stat_ids_.smoother_aux_lmk_observed = stats_.Register("SmootherAuxLmkObserved");
+  stat_ids_.smoother_lmk_factors_added = stats_.Register("SmootherLmkFactorsAdded");
+  stat_ids_.smoother_lmk_factors_removed = stats_.Register("SmootherLmkFactorsRemoved");
+  stat_ids_.smoother_extra_iters = stats_.Register("SmootherExtraIters");
+  stat_ids_.smoother_isam_update = stats_.Register("SmootherIsamUpdate", "ms");
+  stat_ids_.smoother_keyposes = stats_.Register("SmootherKeyposes");
+  stat_ids_.smoother_values = stats_.Register("SmootherValues");
+  stat_ids_.smoother_factor_slots = stats_.Register("SmootherFactorSlots");
+  stat_ids_.smoother_lmk_tracks = stats_.Register("SmootherLmkTracks");
+  stat_ids_.smoother_lmk_track_obs = stats_.Register("SmootherLmkTrackObs");
+  stat_ids_.process_rss = stats_.Register("ProcessRss", "MB");
+  stat_ids_.smoother_update_no_vision = stats_.Register("SmootherUpdateNoVision", "ms");
+  stat_ids_.smoother_update_with_vision = stats_.Register("SmootherUpdateWithVision", "ms");
+  stat_ids_.smoother_catchup_keyposes = stats_.Register("SmootherCatchupKeyposes");
+  stat_ids_.slow_frames_dumped = stats_.Register("SlowFramesDumped");
+  stat_ids_.overload_level = stats_.Register("OverloadLevel");
+  stat_ids_.power_governor_rung = stats_.Register("PowerGovernorRung");
+  stat_ids_.power_governor_frames_skipped = stats_.Register("PowerGovernorFramesSkipped");
+  stat_ids_.energy_per_estimate = stats_.Register("EnergyPerEstimate", "J");
+  stat_ids_.keyframe_min_interval = stats_.Register("KeyframeMinInterval", "sec");
+  stat_ids_.smoother_marginal_covariance = stats_.Register("SmootherMarginalCovariance", "ms");
+  stat_ids_.filter_callback_states_skipped = stats_.Register("FilterCallbackStatesSkipped");
+
+  for (const std::unique_ptr<AuxRig>& rig : aux_rigs_) {
+    rig->stat_frontend = stats_.Register("AuxFrontend_" + rig->name, "ms");
+    rig->stat_lmk_observed = stats_.Register("AuxLmkObserved_" + rig->name);
+  }
+}
+
+
+void StateEstimator::ReceiveStereo(const StereoImage1b& stereo_pair)
+{
+  LockstepBeginReceive(stereo_pair.timestamp);
+
+  // Images that didn't come through an ImageSubscriber (e.g dataset playback) are tagged here.
+  StereoImage1b tagged = stereo_pair;
+  if (tagged.latency.received == 0) {
+    tagged.latency.received = SteadyNowNs();
+    tagged.latency.decoded = tagged.latency.received;
+  }
+  raw_stereo_queue_.Push(std::move(tagged));
+  frontend_wake_.Signal();
+  LockstepEndReceive(false, true);
+}
+
+
+void StateEstimator::ReceiveAuxStereo(size_t aux_rig, const StereoImage1b& stereo_pair)
+{
+  CHECK_LT(aux_rig, aux_rigs_.size()) << "No aux stereo rig with index " << aux_rig << std::endl;
+  AuxRig& rig = *aux_rigs_.at(aux_rig);
+
+  // NOTE(milo): Shedding depends on smoother latency, so it's off in lockstep mode.
+  if (aux_rigs_shed_.load() ||
+      (rig.subsample && !rig.subsampler.ShouldSample(ConvertToSeconds(stereo_pair.timestamp)))) {
+    rig.num_shed.fetch_add(1);
+    return;
+  }
+
+  LockstepBeginReceive(stereo_pair.timestamp);
+
+  StereoImage1b tagged = stereo_pair;
+  if (tagged.latency.received == 0) {
+    tagged.latency.received = SteadyNowNs();
+    tagged.latency.decoded = tagged.latency.received;
+  }
+
+  // In lockstep mode, track it right here, so that its keyframe is ready before any keypose that it
+  // lines up with.
+  if (params_.lockstep) {
+    TrackAuxStereo(aux_rig, tagged);
+  } else {
+    rig.raw_stereo_queue.Push(std::move(tagged));
+  }
+
+  LockstepEndReceive(false, false);
+}
+
+
+void StateEstimator::ReceiveImu(const ImuMeasurement& imu_data)
+{
+  LockstepBeginReceive(imu_data.timestamp);
+
+  // NOTE(milo): This raw imu_data is expressed in the IMU frame. Internally, the GTSAM IMU
+  // preintegration will account for body_P_sensor and convert measurements to the body frame.
+  // Also, the StateEKf will account for body_T_imu. So no need to "pre-rotate" these measurements.
+  ImuMeasurement tagged = imu_data;
+  tagged.timestamp = CorrectImuTimestamp(imu_data);
+  if (tagged.latency.received == 0) {
+    tagged.latency.received = SteadyNowNs();
+  }
+  newest_imu_received_.store(tagged.latency.received);
+
+  smoother_imu_manager_.Push(tagged);
+  filter_imu_manager_.Push(tagged);
+  if (params_.use_gyro_rotation_prior) {
+    frontend_gyro_manager_.Push(tagged);
+  }
+  if (smoother_log_) {
+    smoother_log_->WriteImu(tagged);
+  }
+  filter_wake_.Signal();
+
+  LockstepEndReceive(true, false);
+}
+
+
+void StateEstimator::ReceiveDepth(const DepthMeasurement& depth_data)
+{
+  LockstepBeginReceive(depth_data.timestamp);
+
+  // NOTE(milo): The filter's reader is empty unless filter_use_depth is set.
+  depth_buffer_.Push(depth_data);
+  if (params_.filter_use_depth) {
+    filter_wake_.Signal();
+  }
+
+  LockstepEndReceive(params_.filter_use_depth, false);
+}
+
+
+void StateEstimator::ReceiveRange(const RangeMeasurement& range_data)
+{
+  LockstepBeginReceive(range_data.timestamp);
+
+  range_buffer_.Push(range_data);
+
+  // NOTE(milo): Don't send range data to the filter for now. Results in jumpy state estimates.
+  if (params_.filter_use_range) {
+    filter_wake_.Signal();
+  }
+
+  LockstepEndReceive(params_.filter_use_range, false);
+}
+
+
+void StateEstimator::ReceiveMag(const MagMeasurement& mag_data)
+{
+  LockstepBeginReceive(mag_data.timestamp);
+  smoother_mag_manager_.Push(mag_data);
+  LockstepEndReceive(false, false);
+}
+
+
+void StateEstimator::ReceiveVo(VoResult&& vo_result)
+{
+  LockstepBeginReceive(vo_result.timestamp);
+
+  // Nothing was decoded or tracked, so all of the latency is in the smoother.
+  if (vo_result.latency.received == 0) {
+    vo_result.latency.received = SteadyNowNs();
+    vo_result.latency.decoded = vo_result.latency.received;
+    vo_result.latency.dequeued = vo_result.latency.received;
+    vo_result.latency.processed = vo_result.latency.received;
+  }
+  HandleVoResult(vo_result);
+  LockstepEndReceive(false, false);
+}
+
+
+void StateEstimator::ReceiveImuBatch(const ImuMeasurement* imu_data, size_t N)
+{
+  if (params_.lockstep) {
+    for (size_t i = 0; i < N; ++i) {
+      ReceiveImu(imu_data[i]);
+    }
+    return;
+  }
+
+  if (N == 0) {
+    return;
+  }
+
+  std::vector<ImuMeasurement, Eigen::aligned_allocator<ImuMeasurement>> tagged(imu_data, imu_data + N);
+  const steady_ns_t received = SteadyNowNs();
+  for (ImuMeasurement& imu : tagged) {
+    imu.timestamp = CorrectImuTimestamp(imu);
+    if (imu.latency.received == 0) {
+      imu.latency.received = received;
+    }
+  }
+  newest_imu_received_.store(tagged.back().latency.received);
+
+  smoother_imu_manager_.PushBatch(tagged.data(), N);
+  filter_imu_manager_.PushBatch(tagged.data(), N);
+  if (params_.use_gyro_rotation_prior) {
+    frontend_gyro_manager_.PushBatch(tagged.data(), N);
+  }
+  if (smoother_log_) {
+    for (size_t i = 0; i < N; ++i) {
+      smoother_log_->WriteImu(tagged.at(i));
+    }
+  }
+  filter_wake_.Signal();
+}
+
+
+void StateEstimator::ReceiveDepthBatch(const DepthMeasurement* depth_data, size_t N)
+{
+  if (params_.lockstep) {
+    for (size_t i = 0; i < N; ++i) {
+      ReceiveDepth(depth_data[i]);
+    }
+    return;
+  }
+
+  depth_buffer_.PushBatch(depth_data, N);
+  if (params_.filter_use_depth && N > 0) {
+    filter_wake_.Signal();
+  }
+}
+
+
+void StateEstimator::ReceiveRangeBatch(const RangeMeasurement* range_data, size_t N)
+{
+  if (params_.lockstep) {
+    for (size_t i = 0; i < N; ++i) {
+      ReceiveRange(range_data[i]);
+    }
+    return;
+  }
+
+  range_buffer_.PushBatch(range_data, N);
+  if (params_.filter_use_range && N > 0) {
+    filter_wake_.Signal();
+  }
+}
+
+
+void StateEstimator::LockstepBeginReceive(timestamp_t t)
+{
+  if (!params_.lockstep) {
+    return;
+  }
+
+  // NOTE(milo): No other thread is running at this point (the last receive waited for them), so
+  // every stage sees the clock change at the same point in the data.
+  sim_time_.store(std::max(sim_time_.load(), ConvertToSeconds(t)));
+}
+
+
+void StateEstimator::LockstepEndReceive(bool filter, bool frontend)
+{
+  if (!params_.lockstep) {
+    return;
+  }
+
+  // NOTE(milo): Stages are run one after another (frontend, then smoother, then filter) so that the
+  // smoother never times out on a VO result that the frontend just hasn't gotten to yet. The smoother
+  // is woken up for every measurement, since its vision timeouts use the simulated clock.
+  if (frontend) {
+    lockstep_.Wake(frontend_stage_);
+    lockstep_.WaitIdle(is_shutdown_);
+  }
+
+  lockstep_.Wake(smoother_stage_);
+  lockstep_.WaitIdle(is_shutdown_);
+
+  if (filter) {
+    lockstep_.Wake(filter_stage_);
+    lockstep_.WaitIdle(is_shutdown_);
+  }
+}
+
+
+void StateEstimator::RegisterSmootherResultCallback(const SmootherResult::Callback& cb)
+{
+  smoother_result_callbacks_.emplace_back(cb);
+}
+
+
+void StateEstimator::RegisterFilterResultCallback(const StateStamped::Callback& cb)
+{
+  filter_result_callbacks_.emplace_back(cb);
+}
+
+
+void StateEstimator::RegisterFeatureTracksCallback(const FeatureTracksCallback& cb)
+{
+  feature_tracks_callbacks_.emplace_back(cb);
+}
+
+
+bool StateEstimator::GetFilterState(StateStamped& state) const
+{
+  return filter_state_.Load(state);
+}
+
+
+PoseSource StateEstimator::GetPose(timestamp_t timestamp, SE3& world_T_body) const
+{
+  if (smoother_poses_.Lookup(timestamp, world_T_body)) {
+    return PoseSource::SMOOTHER;
+  }
+  if (filter_poses_.Lookup(timestamp, world_T_body)) {
+    return PoseSource::FILTER;
+  }
+  return PoseSource::NONE;
+}
+
+
+void StateEstimator::Initialize(seconds_t t0, const gtsam::Pose3 P0_world_body)
+{
+  sim_time_.store(t0);
+  startup_.Mark("initialize");
+
+  async_filter_callbacks_ = params_.filter_async_callbacks && !params_.lockstep;
+  if (async_filter_callbacks_) {
+    filter_callback_thread_ = std::thread(&StateEstimator::FilterCallbackLoop, this);
+  }
+
+  stereo_frontend_thread_ = std::thread(&StateEstimator::StereoFrontendLoop, this);
+  if (params_.pipeline_stereo_frontend) {
+    stereo_solve_thread_ = std::thread(&StateEstimator::StereoSolveLoop, this);
+  }
+  smoother_thread_ = std::thread(&StateEstimator::SmootherLoop, this, t0, P0_world_body);
+  filter_thread_ = std::thread(&StateEstimator::FilterLoop, this, t0, P0_world_body);
+
+  if (!params_.lockstep) {
+    for (size_t i = 0; i < aux_rigs_.size(); ++i) {
+      aux_rigs_.at(i)->thread = std::thread(&StateEstimator::AuxStereoFrontendLoop, this, i);
+    }
+  }
+
+  if (params_.use_power_governor && !params_.lockstep) {
+    power_governor_.Start();
+  }
+}
+
+
+void StateEstimator::Initialize(seconds_t t0, const EstimatorCheckpoint& checkpoint)
+{
+  LOG(INFO) << "Warm restart from checkpoint at keypose " << checkpoint.smoother_result.keypose_id
+            << " (t=" << checkpoint.smoother_result.timestamp << ")" << std::endl;
+
+  // NOTE(milo): Set before the threads start, and never changed after.
+  resume_checkpoint_.reset(new EstimatorCheckpoint(checkpoint));
+  Initialize(t0, checkpoint.smoother_result.world_P_body);
+}
+
+
+bool StateEstimator::SaveCheckpoint(const std::string& path)
+{
+  EstimatorCheckpoint checkpoint;
+  if (!published_smoother_result_.Load(checkpoint.smoother_result)) {
+    return false;
+  }
+
+  MakeCheckpoint(checkpoint.smoother_result, checkpoint);
+  return WriteEstimatorCheckpoint(path, checkpoint);
+}
+
+
+void StateEstimator::MakeCheckpoint(const SmootherResult& result, EstimatorCheckpoint& checkpoint)
+{
+  checkpoint.saved_unix_sec = std::chrono::duration<double>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  checkpoint.smoother_result = result;
+
+  checkpoint.has_filter_state = filter_state_.Load(checkpoint.filter_state);
+}
+
+
+void StateEstimator::MaybeWriteCheckpoint(const SmootherResult& result)
+{
+  if (params_.checkpoint_path.empty() ||
+      (result.timestamp - last_checkpoint_time_) < params_.checkpoint_interval_sec) {
+    return;
+  }
+
+  if (checkpoint_busy_.exchange(true)) {
+    return;
+  }
+
+  last_checkpoint_time_ = result.timestamp;
+
+  // NOTE(milo): Allocated with new (not captured by value) so that the Eigen members are aligned.
+  std::shared_ptr<EstimatorCheckpoint> checkpoint(new EstimatorCheckpoint());
+  MakeCheckpoint(result, *checkpoint);
+
+  const auto write = [this, checkpoint]() {
+    Timer timer(true);
+    WriteEstimatorCheckpoint(params_.checkpoint_path, *checkpoint);
+    stats_.Add(stat_ids_.checkpoint_write, timer.Elapsed().milliseconds());
+    checkpoint_busy_.store(false);
+  };
+
+  // In lockstep mode, write it right here so that writes happen in the same order every time.
+  if (params_.lockstep) {
+    write();
+  } else {
+    TaskScheduler::Instance().Submit(TaskPriority::SMOOTHER, write);
+  }
+}
+
+
+void StateEstimator::BlockUntilFinished()
+{
+  LOG(INFO) << "BlockUntilFinished() called! StateEstimator will wait for last image to be processed" << std::endl;
+
+  // In lockstep mode, everything has been processed once the stages are idle.
+  if (params_.lockstep) {
+    lockstep_.WaitIdle(is_shutdown_);
+    Shutdown();
+    return;
+  }
+
+  while (!is_shutdown_) {
+    while (!smoother_vo_queue_.Empty()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    Shutdown();
+    return;
+  }
+}
+
+
+void StateEstimator::Shutdown()
+{
+  is_shutdown_.store(true);
+
+  // Wake up any threads that are waiting for data so that they see the shutdown.
+  smoother_notifier_.Notify();
+  filter_notifier_.Notify();
+  filter_callback_notifier_.Notify();
+  stereo_solve_notifier_.Notify();
+  frontend_stage_.notifier.Notify();
+  solve_stage_.notifier.Notify();
+  smoother_stage_.notifier.Notify();
+  filter_stage_.notifier.Notify();
+
+  if (stereo_frontend_thread_.joinable()) {
+    stereo_frontend_thread_.join();
+  }
+  if (stereo_solve_thread_.joinable()) {
+    stereo_solve_thread_.join();
+  }
+  if (smoother_thread_.joinable()) {
+    smoother_thread_.join();
+  }
+  if (filter_thread_.joinable()) {
+    filter_thread_.join();
+  }
+  if (filter_callback_thread_.joinable()) {
+    filter_callback_thread_.join();
+  }
+  for (const std::unique_ptr<AuxRig>& rig : aux_rigs_) {
+    if (rig->thread.joinable()) {
+      rig->thread.join();
+    }
+  }
+
+  // A tag detection or checkpoint write could still be running on a TaskScheduler worker, and they
+  // use this object.
+  while (tag_detection_busy_ || checkpoint_busy_) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  if (smoother_log_) {
+    smoother_log_->Flush();
+  }
+}
+
+
+bool StateEstimator::UpdateTunables(const Tunables& tunables)
+{
+  if (params_.lockstep) {
+    LOG(WARNING) << "Ignoring new tunables in lockstep mode" << std::endl;
+    return false;
+  }
+
+  const KeyframePolicy::Params& kp = tunables.keyframe_policy_params;
+  std::string error;
+  if (tunables.max_size_raw_stereo_queue <= 0 || tunables.max_size_smoother_vo_queue <= 0) {
+    error = "queue sizes must be > 0";
+  } else if (kp.min_sec_btw_keyframes > kp.max_sec_btw_keyframes || kp.load_backoff <= 1.0) {
+    error = "KeyframePolicy needs min_sec_btw_keyframes <= max_sec_btw_keyframes and load_backoff > 1";
+  } else if (params_.use_keyframe_policy && kp.max_sec_btw_keyframes >= params_.max_sec_btw_keyposes) {
+    error = "KeyframePolicy max_sec_btw_keyframes must be < max_sec_btw_keyposes";
+  } else if (tunables.extra_smoothing_iters < 0 ||
+             tunables.smoothing_convergence_rel_tol < 0 ||
+             tunables.smoothing_time_budget_ms < 0) {
+    error = "FixedLagSmoother iters, rel_tol, and time budget must be >= 0";
+  }
+
+  if (!error.empty()) {
+    LOG(WARNING) << "Rejected new tunables (" << error << "), keeping the old ones" << std::endl;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_tunables_);
+  // NOTE(milo): With a memory budget, the queues can't grow past the sizes that were fit to it.
+  if (params_.memory_budget_mb > 0) {
+    raw_stereo_queue_.SetCapacity(std::min(tunables.max_size_raw_stereo_queue, params_.max_size_raw_stereo_queue));
+    smoother_vo_queue_.SetCapacity(std::min(tunables.max_size_smoother_vo_queue, params_.max_size_smoother_vo_queue));
+  } else {
+    raw_stereo_queue_.SetCapacity(tunables.max_size_raw_stereo_queue);
+    smoother_vo_queue_.SetCapacity(tunables.max_size_smoother_vo_queue);
+  }
+  keyframe_policy_.SetParams(kp);
+
+  // NOTE(milo): The smoother isn't threadsafe, so SmootherLoop() applies its part of this.
+  tunables_.Set(tunables);
+  smoother_notifier_.Notify();
+
+  LOG(INFO) << "Applied new tunables" << std::endl;
+  return true;
+}
+
+
+void StateEstimator::StereoFrontendLoop()
+{
+  LOG(INFO) << "Started up StereoFrontendLoop() thread" << std::endl;
+  ApplyThreadSchedule(params_.frontend_thread_schedule, "StereoFrontendLoop");
+
+  size_t prev_num_dropped = 0;
+
+  // The tracking effort that the OverloadController and PowerGovernor last asked for.
+  const bool use_overload_controller = params_.use_overload_controller && !params_.lockstep;
+  const bool use_power_governor = params_.use_power_governor && !params_.lockstep;
+  const OverloadController::Params& overload_params = overload_controller_.GetParams();
+  const PowerGovernor::Params& governor_params = power_governor_.GetParams();
+  const StereoTracker::Params& tracker_params = params_.stereo_frontend_params.tracker_params;
+  OverloadLevel frontend_level = OverloadLevel::NOMINAL;
+  int frontend_rung = 0;
+  size_t num_throttled_frames = 0;
+
+  while (!is_shutdown_) {
+    // If no images waiting to be processed, sleep until one arrives. The timeout is just so that we
+    // notice a shutdown. In lockstep mode, sleep until this stage is woken up instead.
+    if (params_.lockstep ? !lockstep_.WaitForWake(frontend_stage_, is_shutdown_, kWaitForShutdownSec) :
+                           !raw_stereo_queue_.WaitNonEmpty(kWaitForShutdownSec)) {
+      continue;
+    }
+
+    LockstepPass pass(lockstep_, frontend_stage_);
+    if (raw_stereo_queue_.Empty()) {
+      continue;
+    }
+    pass.DidWork();
+    RecordWakeLatency(frontend_wake_, stat_ids_.frontend_wake_latency);
+
+    // NOTE(milo): The queue only counts drops, so report them here (off of the ingest thread).
+    const size_t num_dropped = raw_stereo_queue_.Dropped();
+    if (num_dropped > prev_num_dropped) {
+      LOG(WARNING) << "StereoFrontendLoop() is falling behind, dropped "
+                   << (num_dropped - prev_num_dropped) << " images" << std::endl;
+      prev_num_dropped = num_dropped;
+    }
+
+    if (use_overload_controller || use_power_governor) {
+      const OverloadLevel level = use_overload_controller ? overload_controller_.Level() : OverloadLevel::NOMINAL;
+      const int rung_index = use_power_governor ? power_governor_.RungIndex() : 0;
+      const PerformanceRung& rung = governor_params.ladder.at(rung_index);
+
+      if (level != frontend_level || rung_index != frontend_rung) {
+        frontend_level = level;
+        frontend_rung = rung_index;
+        const int max_features = tracker_params.detector_params.max_features_per_frame;
+        const int klt_max_level = tracker_params.tracker_params.klt_max_level;
+        const double features_fraction = std::min(rung.features_fraction,
+            (level >= OverloadLevel::FEWER_FEATURES) ? overload_params.reduced_features_fraction : 1.0);
+        stereo_frontend_->SetTrackingEffort(
+            std::max(1, (int)(features_fraction * max_features)),
+            (level >= OverloadLevel::COARSE_KLT) ?
+                std::min(overload_params.reduced_klt_max_level, klt_max_level) : klt_max_level);
+      }
+
+      // NOTE(milo): KLT needs consecutive frames to track, and keyframes are only decided after
+      // tracking, so whole frames are skipped (rather than just the non-keyframes).
+      const int overload_skip_k = (level >= OverloadLevel::SKIP_FRAMES) ? overload_params.skip_frames_k : 1;
+      const int skip_k = std::max(overload_skip_k, rung.frontend_skip_k);
+      if (skip_k > 1 && (num_throttled_frames++ % skip_k) != 0) {
+        raw_stereo_queue_.Pop();
+        stats_.Add((overload_skip_k >= rung.frontend_skip_k) ? stat_ids_.overload_frames_skipped :
+                                                               stat_ids_.power_governor_frames_skipped, 1);
+        continue;
+      }
+    }
+
+    steady_ns_t frame_dequeued = 0;
+
+    if (params_.pipeline_stereo_frontend) {
+      // Wait for room in the solve queue. Since this is the only producer, the queue can't fill
+      // back up between the wait and the push.
+      stereo_solve_notifier_.WaitFor([this]() {
+        return is_shutdown_ || stereo_solve_queue_.Size() < stereo_solve_queue_.Capacity();
+      }, kWaitForShutdownSec);
+      if (stereo_solve_queue_.Size() >= stereo_solve_queue_.Capacity()) {
+        continue;
+      }
+
+      // KLT tracking and data association only. The pose is solved in StereoSolveLoop().
+      const StereoImage1b stereo_pair = raw_stereo_queue_.Pop();
+      const steady_ns_t dequeued = SteadyNowNs();
+      frame_dequeued = dequeued;
+      Matrix4d prev_T_cur_prior;
+      bool has_prior = false;
+      if (!PrepareFrontendPrior(stereo_pair, prev_T_cur_prior, has_prior)) {
+        continue;
+      }
+      StereoFrontend::TrackingResult tracked = stereo_frontend_->TrackFeatures(
+          stereo_pair, has_prior ? &prev_T_cur_prior : nullptr);
+      tracked.result.latency = stereo_pair.latency;
+      tracked.result.latency.dequeued = dequeued;
+      if (slow_frames_) {
+        RecordSlowFrame(stereo_pair, tracked.result, ElapsedMs(dequeued, SteadyNowNs()), 0);
+      }
+      for (const FeatureTracksCallback& cb : feature_tracks_callbacks_) {
+        cb(tracked.result, stereo_pair.left_image.size());
+      }
+      if (tag_localizer_ && tracked.is_keyframe) {
+        DetectTags(stereo_pair.timestamp, stereo_pair.left_image);
+      }
+      stereo_solve_queue_.Push(std::move(tracked));
+      if (params_.lockstep) {
+        lockstep_.Wake(solve_stage_);
+      }
+
+    } else {
+      // Process a stereo image pair (KLT tracking, odometry estimation, etc.)
+      const StereoImage1b stereo_pair = raw_stereo_queue_.Pop();
+      const steady_ns_t dequeued = SteadyNowNs();
+      frame_dequeued = dequeued;
+      Matrix4d prev_T_cur_prior;
+      bool has_prior = false;
+      if (!PrepareFrontendPrior(stereo_pair, prev_T_cur_prior, has_prior)) {
+        continue;
+      }
+      // Same as StereoFrontend::Track(), but the stages are timed separately.
+      StereoFrontend::TrackingResult tracked = stereo_frontend_->TrackFeatures(
+          stereo_pair, has_prior ? &prev_T_cur_prior : nullptr);
+      const steady_ns_t tracked_ns = SteadyNowNs();
+      VoResult result = stereo_frontend_->SolvePose(tracked, false);
+      result.latency = stereo_pair.latency;
+      result.latency.dequeued = dequeued;
+      result.latency.processed = SteadyNowNs();
+      if (slow_frames_) {
+        RecordSlowFrame(stereo_pair, result, ElapsedMs(dequeued, tracked_ns),
+                        ElapsedMs(tracked_ns, result.latency.processed));
+      }
+      for (const FeatureTracksCallback& cb : feature_tracks_callbacks_) {
+        cb(result, stereo_pair.left_image.size());
+      }
+      if (tag_localizer_ && result.is_keyframe) {
+        DetectTags(stereo_pair.timestamp, stereo_pair.left_image);
+      }
+      HandleVoResult(result);
+    }
+
+    if (use_overload_controller) {
+      overload_controller_.ReportFrontend((double)raw_stereo_queue_.Size() / raw_stereo_queue_.Capacity(),
+                                          ElapsedMs(frame_dequeued, SteadyNowNs()));
+    }
+
+    // NOTE(milo): The frontend reuses its visualization buffer, so the viewer gets a copy.
+    if (params_.show_feature_tracks) {
+      DebugViewer::Instance().Show("StereoTracking", stereo_frontend_->VisualizeFeatureTracks().clone());
+    }
+
+    // Allocations made by every stage (on any thread) since the last frame.
+#ifdef BM_ENABLE_ALLOC_TRACKING
+    ReportAllocStages(stats_);
+#endif
+  }
+
+  LOG(INFO) << "StereoFrontendLoop() exiting" << std::endl;
+}
+
+
+void StateEstimator::RecordSlowFrame(const StereoImage1b& stereo_pair,
+                                     const VoResult& result,
+                                     float track_ms,
+                                     float solve_ms)
+{
+  const LatencyTags& tags = result.latency;
+
+  SlowFrameRecord record;
+  record.timestamp = stereo_pair.timestamp;
+  record.camera_id = stereo_pair.camera_id;
+  record.is_keyframe = result.is_keyframe;
+  record.num_tracked = (int)result.lmk_obs.Size();
+  record.queue_ms = ElapsedMs(tags.decoded, tags.dequeued);
+  record.track_ms = track_ms;
+  record.solve_ms = solve_ms;
+  record.total_ms = (tags.received != 0) ? ElapsedMs(tags.received, SteadyNowNs()) : (track_ms + solve_ms);
+  record.raw_stereo_queue = (int)raw_stereo_queue_.Size();
+  record.smoother_vo_queue = (int)smoother_vo_queue_.Size();
+  record.smoother_factor_slots = smoother_factor_slots_.load();
+
+  if (slow_frames_->Add(record, stereo_pair)) {
+    stats_.Add(stat_ids_.slow_frames_dumped, 1);
+  }
+}
+
+
+bool StateEstimator::PrepareFrontendPrior(const StereoImage1b& stereo_pair,
+                                          Matrix4d& prev_T_cur_prior,
+                                          bool& has_prior)
+{
+  has_prior = false;
+
+  // Images that are too blurry or hazy to track aren't worth the frontend's time. Like the
+  // fast-motion skip below, the next prior covers them.
+  if (!stereo_frontend_->CheckFrameQuality(stereo_pair)) {
+    stats_.Add(stat_ids_.low_quality_frames_skipped, 1);
+    return false;
+  }
+
+  if (!params_.use_gyro_rotation_prior) {
+    return true;
+  }
+
+  const seconds_t time = ConvertToSeconds(stereo_pair.timestamp);
+  const seconds_t prev_time = frontend_prev_time_;
+
+  // Zero-order hold on each gyro sample, back to the previous sample (or the previous image).
+  // NOTE(milo): The gyro bias is ignored, since it's tiny over a few images.
+  Matrix3d imu0_R_imu1 = Matrix3d::Identity();
+  seconds_t t_last = prev_time;
+  Vector3d w_last = Vector3d::Zero();
+  size_t num_gyro = 0;
+  if (prev_time >= 0) {
+    num_gyro = frontend_gyro_manager_.ViewRange(prev_time, time, [&](const ImuMeasurement& imu) {
+      const seconds_t t = ConvertToSeconds(imu.timestamp);
+      const Vector3d dtheta = imu.w * (t - t_last);
+      if (dtheta.norm() > 0) {
+        imu0_R_imu1 = imu0_R_imu1 * AngleAxisd(dtheta.norm(), dtheta.normalized()).toRotationMatrix();
+      }
+      t_last = t;
+      w_last = imu.w;
+    });
+  }
+
+  if (num_gyro > 0) {
+    const Vector3d dtheta = w_last * (time - t_last);
+    if (dtheta.norm() > 0) {
+      imu0_R_imu1 = imu0_R_imu1 * AngleAxisd(dtheta.norm(), dtheta.normalized()).toRotationMatrix();
+    }
+
+    const Matrix3d cam_R_imu = params_.body_P_cam.rotation().matrix().transpose() *
+                               params_.body_P_imu.rotation().matrix();
+    prev_T_cur_prior = Matrix4d::Identity();
+    prev_T_cur_prior.block<3, 3>(0, 0) = cam_R_imu * imu0_R_imu1 * cam_R_imu.transpose();
+    has_prior = true;
+
+    // Skip every other image while rotating fast, unless it's due to be a keyframe. The next prior
+    // covers the skipped image too, since frontend_prev_time_ stays where it is.
+    const double rate = AngleAxisd(imu0_R_imu1).angle() / std::max(1e-6, time - prev_time);
+    if (params_.fast_motion_skip_rad_per_sec > 0 &&
+        rate > params_.fast_motion_skip_rad_per_sec &&
+        !frontend_skipped_prev_ &&
+        !stereo_frontend_->KeyframeDue(stereo_pair.camera_id)) {
+      frontend_skipped_prev_ = true;
+      stats_.Add(stat_ids_.fast_motion_frames_skipped, 1);
+      return false;
+    }
+  }
+
+  frontend_skipped_prev_ = false;
+  frontend_prev_time_ = time;
+  frontend_gyro_manager_.DiscardBefore(time);
+  return true;
 }
 
 
-StateEstimator::StateEstimator(const Params& params)
-    : params_(params),
-      stereo_rig_(params.stereo_rig),
-      is_shutdown_(false),
-      stereo_frontend_(params_.stereo_frontend_params),
-      raw_stereo_queue_(params_.max_size_raw_stereo_queue, true, "raw_stereo_queue"),
-      smoother_imu_manager_(params_.imu_manager_params, "smoother_imu_manager"),
-      smoother_vo_queue_(params_.max_size_smoother_vo_queue, true, "smoother_vo_queue"),
-      smoother_depth_manager_(params_.max_size_smoother_depth_queue, true, "smoother_depth_manager"),
-      smoother_range_manager_(params_.max_size_smoother_range_queue, true, "smoother_range_manager"),
-      smoother_mag_manager_(params_.max_size_smoother_mag_queue, true, "smoother_mag_manager"),
-      filter_imu_manager_(params.imu_manager_params, "filter_imu_manager"),
-      filter_depth_manager_(params_.max_size_filter_depth_queue, true, "filter_depth_manager"),
-      filter_range_manager_(params_.max_size_filter_range_queue, true, "filter_range_manager"),
-      stats_("StateEstimator", params_.stats_tracker_k)
+void StateEstimator::StereoSolveLoop()
 {
-  LOG(INFO) << "Constructed StateEstimator!" << std::endl;
+  LOG(INFO) << "Started up StereoSolveLoop() thread" << std::endl;
+  ApplyThreadSchedule(params_.frontend_thread_schedule, "StereoSolveLoop");
 
-  Vector3d n_gravity_unit;
-  depth_axis_ = GetGravityAxis(params_.n_gravity, n_gravity_unit);
-  depth_sign_ = n_gravity_unit(depth_axis_) >= 0 ? 1.0 : -1.0;
-  LOG(INFO) << "Unit GRAVITY/DEPTH axis: " << n_gravity_unit.transpose() << std::endl;
-}
+  while (!is_shutdown_) {
+    if (params_.lockstep ? !lockstep_.WaitForWake(solve_stage_, is_shutdown_, kWaitForShutdownSec) :
+                           !stereo_solve_queue_.WaitNonEmpty(kWaitForShutdownSec)) {
+      continue;
+    }
 
+    LockstepPass pass(lockstep_, solve_stage_);
+    if (stereo_solve_queue_.Empty()) {
+      continue;
+    }
+    pass.DidWork();
 
-void StateEstimator::ReceiveStereo(const StereoImage1b& stereo_pair)
-{
-  raw_stereo_queue_.Push(stereo_pair);
-}
+    StereoFrontend::TrackingResult tracked = stereo_solve_queue_.Pop();
+    stereo_solve_notifier_.Notify();
 
+    VoResult result = stereo_frontend_->SolvePose(tracked, true);
+    result.latency.processed = SteadyNowNs();
+    HandleVoResult(result);
+  }
 
-void StateEstimator::ReceiveImu(const ImuMeasurement& imu_data)
-{
-  // NOTE(milo): This raw imu_data is expressed in the IMU frame. Internally, the GTSAM IMU
-  // preintegration will account for body_P_sensor and convert measurements to the body frame.
-  // Also, the StateEKf will account for body_T_imu. So no need to "pre-rotate" these measurements.
-  smoother_imu_manager_.Push(imu_data);
-  filter_imu_manager_.Push(imu_data);
+  LOG(INFO) << "StereoSolveLoop() exiting" << std::endl;
 }
 
 
-void StateEstimator::ReceiveDepth(const DepthMeasurement& depth_data)
+void StateEstimator::AuxStereoFrontendLoop(size_t aux_rig)
 {
-  smoother_depth_manager_.Push(depth_data);
-  if (params_.filter_use_depth) {
-    filter_depth_manager_.Push(depth_data);
+  AuxRig& rig = *aux_rigs_.at(aux_rig);
+  LOG(INFO) << "Started up AuxStereoFrontendLoop() thread for " << rig.name << std::endl;
+  ApplyThreadSchedule(params_.frontend_thread_schedule, "AuxStereoFrontendLoop");
+
+  size_t prev_num_dropped = 0;
+  size_t prev_num_shed = 0;
+
+  while (!is_shutdown_) {
+    if (!rig.raw_stereo_queue.WaitNonEmpty(kWaitForShutdownSec)) {
+      continue;
+    }
+
+    const size_t num_dropped = rig.raw_stereo_queue.Dropped();
+    const size_t num_shed = rig.num_shed.load();
+    if (num_dropped > prev_num_dropped || num_shed > prev_num_shed) {
+      LOG(WARNING) << "AuxStereoFrontendLoop() for " << rig.name << " dropped "
+                   << (num_dropped - prev_num_dropped) << " images (queue full), and shed "
+                   << (num_shed - prev_num_shed) << std::endl;
+      prev_num_dropped = num_dropped;
+      prev_num_shed = num_shed;
+    }
+
+    TrackAuxStereo(aux_rig, rig.raw_stereo_queue.Pop());
   }
+
+  LOG(INFO) << "AuxStereoFrontendLoop() for " << rig.name << " exiting" << std::endl;
 }
 
 
-void StateEstimator::ReceiveRange(const RangeMeasurement& range_data)
+void StateEstimator::TrackAuxStereo(size_t aux_rig, const StereoImage1b& stereo_pair)
 {
-  smoother_range_manager_.Push(range_data);
+  AuxRig& rig = *aux_rigs_.at(aux_rig);
 
-  // NOTE(milo): Don't send range data to the filter for now. Results in jumpy state estimates.
-  if (params_.filter_use_range) {
-    filter_range_manager_.Push(range_data);
+  Timer timer(true);
+  VoResult result = rig.frontend.Track(stereo_pair);
+  stats_.Add(rig.stat_frontend, timer.Elapsed().milliseconds());
+
+  const bool tracking_failed = (result.status & StereoFrontend::Status::ODOM_ESTIMATION_FAILED) ||
+                               (result.status & StereoFrontend::Status::FEW_TRACKED_FEATURES);
+  const bool vision_reliable_now = (int)result.lmk_obs.Size() >= params_.reliable_vision_min_lmks;
+
+  // Like the primary rig, only reliable keyframes go to the smoother.
+  if (result.is_keyframe && vision_reliable_now && !tracking_failed) {
+    const timestamp_t timestamp = result.timestamp;
+    rig.vo_manager.Push(AuxVoMeasurement(timestamp, std::make_shared<VoResult>(std::move(result))));
   }
 }
 
 
-void StateEstimator::ReceiveMag(const MagMeasurement& mag_data)
+void StateEstimator::GetAlignedAuxVo(seconds_t to_time, std::vector<VoResult::ConstPtr>& maybe_aux_vo)
 {
-  smoother_mag_manager_.Push(mag_data);
-}
+  maybe_aux_vo.assign(aux_rigs_.size(), nullptr);
 
+  for (size_t i = 0; i < aux_rigs_.size(); ++i) {
+    AuxRig& rig = *aux_rigs_.at(i);
+    if (aux_rigs_shed_.load()) {
+      rig.vo_manager.DiscardBefore(to_time);
+      continue;
+    }
 
-void StateEstimator::RegisterSmootherResultCallback(const SmootherResult::Callback& cb)
-{
-  smoother_result_callbacks_.emplace_back(cb);
+    const std::shared_ptr<AuxVoMeasurement> aux_vo_ptr =
+        rig.vo_manager.PopNearest(to_time, params_.allowed_misalignment_aux_vision);
+    if (aux_vo_ptr) {
+      maybe_aux_vo.at(i) = aux_vo_ptr->vo;
+    }
+
+    stats_.Add(rig.stat_lmk_observed, aux_vo_ptr ? aux_vo_ptr->vo->lmk_obs.Size() : 0);
+  }
 }
 
 
-void StateEstimator::RegisterFilterResultCallback(const StateStamped::Callback& cb)
+void StateEstimator::UpdateAuxRigShedding(double smoother_latency_ms)
 {
-  filter_result_callbacks_.emplace_back(cb);
+  const double threshold_ms = params_.aux_rig_shed_latency_ms;
+  if (aux_rigs_.empty() || threshold_ms <= 0 || params_.lockstep) {
+    return;
+  }
+
+  // NOTE(milo): Stop at half of the threshold, so that it doesn't flip back and forth every keypose.
+  const bool was_shed = aux_rigs_shed_.load();
+  const bool shed = was_shed ? (smoother_latency_ms > 0.5 * threshold_ms) : (smoother_latency_ms > threshold_ms);
+  if (shed != was_shed) {
+    LOG(WARNING) << (shed ? "Shedding" : "Stopped shedding") << " aux stereo rigs (smoother latency "
+                 << smoother_latency_ms << " ms)" << std::endl;
+    aux_rigs_shed_.store(shed);
+  }
 }
 
 
-void StateEstimator::Initialize(seconds_t t0, const gtsam::Pose3 P0_world_body)
+void StateEstimator::HandleVoResult(VoResult& result)
 {
-  stereo_frontend_thread_ = std::thread(&StateEstimator::StereoFrontendLoop, this);
-  smoother_thread_ = std::thread(&StateEstimator::SmootherLoop, this, t0, P0_world_body);
-  filter_thread_ = std::thread(&StateEstimator::FilterLoop, this, t0, P0_world_body);
-}
+  const bool tracking_failed = (result.status & StereoFrontend::Status::ODOM_ESTIMATION_FAILED) ||
+                               (result.status & StereoFrontend::Status::FEW_TRACKED_FEATURES);
 
+  if (result.status & StereoFrontend::Status::RELOCALIZED) {
+    stats_.Add(stat_ids_.frontend_relocalized, 1);
+  }
 
-void StateEstimator::BlockUntilFinished()
-{
-  LOG(INFO) << "BlockUntilFinished() called! StateEstimator will wait for last image to be processed" << std::endl;
-  while (!is_shutdown_) {
-    while (!smoother_vo_queue_.Empty()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  if (tracking_failed) {
+    UpdateSmootherMode(SmootherMode::VISION_UNAVAILABLE);
+    vo_has_prev_ = false;
+  } else if (params_.estimate_imu_time_offset && !params_.lockstep) {
+    AddVisionRotation(result);
+  }
+
+  // If there are observed landmarks in this image, there must be visual texture.
+  const bool vision_reliable_now = (int)result.lmk_obs.Size() >= params_.reliable_vision_min_lmks;
+
+  // CASE 1: If this is a reliable keyframe, send to the smoother.
+  // NOTE: This means that we will NOT send the first result to the smoother!
+  if (result.is_keyframe && vision_reliable_now && !tracking_failed) {
+    smoother_vo_queue_.Push(std::move(result));
+    smoother_wake_.Signal();
+    if (params_.lockstep) {
+      lockstep_.Wake(smoother_stage_);
     }
-    Shutdown();
-    return;
   }
 }
 
 
-void StateEstimator::Shutdown()
+void StateEstimator::AddVisionRotation(const VoResult& result)
 {
-  is_shutdown_.store(true);
-  if (stereo_frontend_thread_.joinable()) {
-    stereo_frontend_thread_.join();
-  }
-  if (smoother_thread_.joinable()) {
-    smoother_thread_.join();
+  // The rotation since the previous frame, from whichever keyframe they share.
+  bool has_rotation = false;
+  Matrix4d prev_T_cur = Matrix4d::Identity();
+  if (vo_has_prev_ && result.timestamp_lkf == vo_prev_timestamp_) {
+    prev_T_cur = result.lkf_T_cam;
+    has_rotation = true;
+  } else if (vo_has_prev_ && result.timestamp_lkf == vo_prev_timestamp_lkf_) {
+    prev_T_cur = inverse_se3(vo_prev_lkf_T_cam_) * result.lkf_T_cam;
+    has_rotation = true;
   }
-  if (filter_thread_.joinable()) {
-    filter_thread_.join();
+
+  if (has_rotation) {
+    const Matrix3d prev_R_cur = prev_T_cur.block<3, 3>(0, 0);
+    time_offset_estimator_.AddVisionRotation(ConvertToSeconds(vo_prev_timestamp_),
+                                             ConvertToSeconds(result.timestamp),
+                                             AngleAxisd(prev_R_cur).angle());
+    if (time_offset_estimator_.NumUpdates() > 0) {
+      stats_.Add(stat_ids_.imu_time_offset, 1e3 * time_offset_estimator_.Offset());
+    }
   }
+
+  vo_has_prev_ = true;
+  vo_prev_timestamp_ = result.timestamp;
+  vo_prev_timestamp_lkf_ = result.timestamp_lkf;
+  vo_prev_lkf_T_cam_ = result.lkf_T_cam;
 }
 
 
-void StateEstimator::StereoFrontendLoop()
+timestamp_t StateEstimator::CorrectImuTimestamp(const ImuMeasurement& imu)
 {
-  LOG(INFO) << "Started up StereoFrontendLoop() thread" << std::endl;
-
-  if (params_.show_feature_tracks) {
-    cv::namedWindow("StereoTracking", cv::WINDOW_AUTOSIZE);
+  if (!params_.estimate_imu_time_offset || params_.lockstep) {
+    return imu.timestamp;
   }
 
-  while (!is_shutdown_) {
-    // If no images waiting to be processed, take a nap.
-    while (raw_stereo_queue_.Empty()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-      if (is_shutdown_) {
-        LOG(INFO) << "StereoFrontendLoop() exiting" << std::endl;
-        return;
-      }
-    }
+  time_offset_estimator_.AddGyro(ConvertToSeconds(imu.timestamp), imu.w);
+
+  // NOTE(milo): The offset changes a little with each estimate, so clamp to keep the IMU queues in
+  // order. Timestamps are unsigned, so don't go below zero either.
+  const int64_t offset_ns = (int64_t)std::round(time_offset_estimator_.Offset() * 1e9);
+  const int64_t corrected = std::max((int64_t)0, (int64_t)imu.timestamp + offset_ns);
+  imu_prev_corrected_ = std::max(imu_prev_corrected_, (timestamp_t)corrected);
+  return imu_prev_corrected_;
+}
 
-    // Process a stereo image pair (KLT tracking, odometry estimation, etc.)
-    // TODO(milo): Use initial odometry estimate other than identity!
-    VoResult result = stereo_frontend_.Track(
-        raw_stereo_queue_.Pop(), Matrix4d::Identity());
 
-    if (params_.show_feature_tracks) {
-      const Image3b& viz = stereo_frontend_.VisualizeFeatureTracks();
-      cv::imshow("StereoTracking", viz);
-      cv::waitKey(1);
+void StateEstimator::DetectTags(timestamp_t timestamp, const Image1b& left_image)
+{
+  // NOTE(milo): In lockstep mode, the smoother has to see the same tag poses every time, so the
+  // detection finishes before the keyframe goes out.
+  if (params_.lockstep) {
+    const TagPoseMeasurement::Ptr tag_pose_ptr = tag_localizer_->Localize(timestamp, left_image);
+    if (tag_pose_ptr) {
+      smoother_tag_manager_.Push(*tag_pose_ptr);
     }
+    return;
+  }
 
-    const bool tracking_failed = (result.status & StereoFrontend::Status::ODOM_ESTIMATION_FAILED) ||
-                                 (result.status & StereoFrontend::Status::FEW_TRACKED_FEATURES);
+  if (tag_detection_busy_.exchange(true)) {
+    stats_.Add(stat_ids_.tag_detections_skipped, 1);
+    return;
+  }
 
-    if (tracking_failed) {
-      UpdateSmootherMode(SmootherMode::VISION_UNAVAILABLE);
-    }
+  tag_detection_timestamp_.store(timestamp);
 
-    // If there are observed landmarks in this image, there must be visual texture.
-    const bool vision_reliable_now = (int)result.lmk_obs.size() >= params_.reliable_vision_min_lmks;
+  // The Mat header is copied, not the pixels. The frontend doesn't write to its input images.
+  const Image1b image = left_image;
+  TaskScheduler::Instance().Submit(TaskPriority::SMOOTHER, [this, timestamp, image]() {
+    Timer timer(true);
+    const TagPoseMeasurement::Ptr tag_pose_ptr = tag_localizer_->Localize(timestamp, image);
+    stats_.Add(stat_ids_.tag_detection, timer.Elapsed().milliseconds());
 
-    // CASE 1: If this is a reliable keyframe, send to the smoother.
-    // NOTE: This means that we will NOT send the first result to the smoother!
-    if (result.is_keyframe && vision_reliable_now && !tracking_failed) {
-      smoother_vo_queue_.Push(std::move(result));
+    if (tag_pose_ptr) {
+      smoother_tag_manager_.Push(*tag_pose_ptr);
     }
+
+    tag_detection_timestamp_.store(0);
+    smoother_notifier_.Notify();
+    tag_detection_busy_.store(false);
+  });
+}
+
+
+void StateEstimator::WaitForTagDetection(timestamp_t timestamp)
+{
+  if (!tag_localizer_ || tag_detection_timestamp_.load() != timestamp) {
+    return;
   }
+
+  Timer timer(true);
+  smoother_notifier_.WaitFor([this, timestamp]() {
+    return is_shutdown_ || tag_detection_timestamp_.load() != timestamp;
+  }, params_.tag_max_wait_sec);
+  stats_.Add(stat_ids_.smoother_tag_wait, timer.Elapsed().milliseconds());
 }
 
 
 void StateEstimator::OnSmootherResult(const SmootherResult& new_result)
 {
-  // Copy the result into the state estimator. Use the mutex to make sure we don't change the result
-  // while some other consumer is using it.
-  mutex_smoother_result_.lock();
+  // Copy the result into the state estimator. Other threads read the published copy, so that they
+  // never wait on the smoother (and it never waits on them).
   smoother_result_ = new_result;
-  mutex_smoother_result_.unlock();
+  published_smoother_result_.Store(new_result);
+  smoother_poses_.Add(ConvertToNanoseconds(new_result.timestamp), ToSE3(new_result.world_P_body));
+  power_governor_.CountEstimate();
 
   // Use the latest bias estimate for the next IMU preintegration.
   smoother_imu_manager_.ResetAndUpdateBias(new_result.imu_bias);
@@ -229,7 +1457,14 @@ void StateEstimator::OnSmootherResult(const SmootherResult& new_result)
     cb(new_result);
   }
 
+  MaybeWriteCheckpoint(new_result);
+
   smoother_update_flag_.store(true); // Tell the filter to sync with this result!
+  filter_notifier_.Notify();
+  filter_wake_.Signal();
+  if (params_.lockstep) {
+    lockstep_.Wake(filter_stage_);
+  }
 }
 
 
@@ -242,10 +1477,12 @@ void StateEstimator::GetKeyposeAlignedMeasurements(
     AttitudeMeasurement::Ptr& maybe_attitude_ptr,
     MultiRange& maybe_ranges,
     MagMeasurement::Ptr& maybe_mag_ptr,
+    TagPoseMeasurement::Ptr& maybe_tag_pose_ptr,
     seconds_t allowed_misalignment_depth,
     seconds_t allowed_misalignment_range,
     seconds_t allowed_misalignment_mag,
-    seconds_t allowed_misalignment_imu)
+    seconds_t allowed_misalignment_imu,
+    seconds_t allowed_misalignment_tag)
 {
   smoother_range_manager_.DiscardBefore(to_time, true);
   const seconds_t range_time_offset = std::fabs(smoother_range_manager_.Oldest() - to_time);
@@ -256,29 +1493,113 @@ void StateEstimator::GetKeyposeAlignedMeasurements(
     smoother_range_manager_.PopUntil(to_time, maybe_ranges);
   }
 
-  // Check if we have a nearby magnetometer measurement.
-  smoother_mag_manager_.DiscardBefore(to_time, true);
-  const seconds_t mag_time_offset = std::fabs(smoother_mag_manager_.Oldest() - to_time);
+  if (!params_.lockstep && !maybe_ranges.empty()) {
+    StateStamped filter_state;
+    if (filter_state_.Load(filter_state)) {
+      GateRangesWithFilter(maybe_ranges, filter_state, smoother_range_rejects_, "SmootherRangesRejected",
+                           stat_ids_.smoother_ranges_rejected);
+    }
+  }
 
-  maybe_mag_ptr = (mag_time_offset < allowed_misalignment_mag) ?
-      std::make_shared<MagMeasurement>(smoother_mag_manager_.Pop()) : nullptr;
+  // Fuse all of the magnetometer samples since the last keypose, or use the one nearest to it.
+  if (params_.average_mag_samples) {
+    maybe_mag_ptr = AverageMagSamples(to_time, allowed_misalignment_mag);
+  } else {
+    maybe_mag_ptr = smoother_mag_manager_.PopNearest(to_time, allowed_misalignment_mag);
+  }
 
   // Check if we have a nearby depth measurement (in time).
-  smoother_depth_manager_.DiscardBefore(to_time, true);
-  const seconds_t depth_time_offset = std::fabs(smoother_depth_manager_.Oldest() - to_time);
+  maybe_depth_ptr = smoother_depth_manager_.PopNearest(to_time, allowed_misalignment_depth);
 
-  maybe_depth_ptr = (depth_time_offset < allowed_misalignment_depth) ?
-      std::make_shared<DepthMeasurement>(smoother_depth_manager_.Pop()) : nullptr;
+  // Tag poses only come from keyframes, so this is usually the VO keypose's own image.
+  maybe_tag_pose_ptr = smoother_tag_manager_.PopNearest(to_time, allowed_misalignment_tag);
 
   // Preintegrate IMU between from_time and to_time.
   const PimResult pim = smoother_imu_manager_.Preintegrate(from_time, to_time, allowed_misalignment_imu);
   maybe_pim_ptr = (pim.timestamps_aligned) ? std::make_shared<PimResult>(pim) : nullptr;
 
-  // Check if the accelerometer is giving a reading of attitude.
+  // Check if the accelerometer is giving a reading of attitude (on average, over the keypose).
+  const bool use_average = params_.average_attitude_samples && pim.accel.Count() > 0;
   Vector3d imu_nG;
-  const bool only_gravity = EstimateAttitude(pim.to_imu.a, imu_nG, params_.n_gravity.norm(), params_.body_nG_tol);
+  const bool only_gravity = EstimateAttitude(use_average ? pim.accel.Mean() : pim.to_imu.a,
+                                             imu_nG, params_.n_gravity.norm(), params_.body_nG_tol);
   maybe_attitude_ptr = (pim.timestamps_aligned && only_gravity) ?
-      std::make_shared<AttitudeMeasurement>(to_time, params_.body_P_imu * imu_nG) : nullptr;
+      std::make_shared<AttitudeMeasurement>(to_time, params_.body_P_imu.rotation() * imu_nG) : nullptr;
+
+  if (maybe_attitude_ptr && use_average) {
+    // One sample has the smoother's attitude noise (rad), i.e (sigma * g) across the gravity vector.
+    const double g = params_.n_gravity.norm();
+    const double sample_sigma = params_.smoother_params.attitude_noise_model->sigma() * g;
+    const Matrix3d mean_cov = pim.accel.MeanCovariance(sample_sigma * sample_sigma * Matrix3d::Identity());
+
+    // Only the part across the gravity direction changes it, and half of that is in each axis.
+    const Matrix3d across = Matrix3d::Identity() - imu_nG * imu_nG.transpose();
+    maybe_attitude_ptr->sigma = std::sqrt(0.5 * (across * mean_cov * across).trace()) / g;
+    stats_.Add(stat_ids_.smoother_attitude_samples, pim.accel.Count());
+  }
+}
+
+
+MagMeasurement::Ptr StateEstimator::AverageMagSamples(seconds_t to_time, seconds_t allowed_misalignment_mag)
+{
+  smoother_mag_samples_.clear();
+  smoother_mag_manager_.PopUntil(to_time, smoother_mag_samples_);
+
+  const bool aligned = !smoother_mag_samples_.empty() &&
+      std::fabs(ConvertToSeconds(smoother_mag_samples_.back().timestamp) - to_time) < allowed_misalignment_mag;
+  if (!aligned) {
+    return nullptr;
+  }
+
+  SampleAverage average;
+  for (const MagMeasurement& mag : smoother_mag_samples_) {
+    average.Add(mag.field);
+  }
+
+  const double sample_sigma = params_.smoother_params.mag_noise_model->sigma();
+  MagMeasurement::Ptr out = std::make_shared<MagMeasurement>(ConvertToNanoseconds(to_time), average.Mean());
+  out->cov = average.MeanCovariance(sample_sigma * sample_sigma * Matrix3d::Identity());
+  stats_.Add(stat_ids_.smoother_mag_samples, average.Count());
+
+  return out;
+}
+
+
+void StateEstimator::GateRangesWithFilter(MultiRange& ranges,
+                                          const StateStamped& state,
+                                          int& num_rejects,
+                                          const std::string& name,
+                                          StatId stat_id)
+{
+  if (params_.range_gate_max_mahalanobis_sq <= 0 || ranges.empty()) {
+    return;
+  }
+
+  // Extrapolate the filter position to the time of the ranges, and grow its covariance to match.
+  const double dt = ConvertToSeconds(ranges.front().timestamp) - state.timestamp;
+  const Vector3d world_t_body = state.state.t + dt * state.state.v;
+  const Matrix3d cov_t = state.state.S.block<3, 3>(t_row, t_row) +
+                         dt * dt * state.state.S.block<3, 3>(v_row, v_row);
+
+  MultiRange inliers;
+  const int num_rejected = GateRanges(
+      ranges, world_t_body, cov_t,
+      params_.filter_params.sigma_R_range,
+      params_.range_gate_max_mahalanobis_sq,
+      inliers);
+
+  num_rejects = inliers.empty() ? (num_rejects + num_rejected) : 0;
+
+  if (num_rejects > params_.range_gate_max_rejects) {
+    LOG(WARNING) << name << ": " << num_rejects << " ranges in a row disagree with the filter, "
+                 << "letting them through" << std::endl;
+    num_rejects = 0;
+    return;
+  }
+
+  stats_.Add(stat_id, num_rejected);
+
+  ranges = std::move(inliers);
 }
 
 
@@ -291,16 +1612,74 @@ void StateEstimator::UpdateSmootherMode(SmootherMode mode)
 }
 
 
+void StateEstimator::RecordWakeLatency(WakeLatency& wake, StatId stat_id)
+{
+  double latency_ms;
+  if (wake.Take(latency_ms)) {
+    stats_.Add(stat_id, latency_ms);
+  }
+}
+
+
+void StateEstimator::RecordSmootherStats(const FixedLagSmoother::UpdateStats& stats)
+{
+  stats_.Add(stat_ids_.smoother_factors, stats.num_factors);
+  stats_.Add(stat_ids_.smoother_lmk_factors, stats.num_lmk_factors);
+  stats_.Add(stat_ids_.smoother_lmk_observed, stats.num_lmk_observed);
+  if (!aux_rigs_.empty()) {
+    stats_.Add(stat_ids_.smoother_aux_lmk_observed, stats.num_aux_lmk_observed);
+  }
+  stats_.Add(stat_ids_.smoother_lmk_factors_added, stats.num_lmk_factors_added);
+  stats_.Add(stat_ids_.smoother_lmk_factors_removed, stats.num_lmk_factors_removed);
+  stats_.Add(stat_ids_.smoother_extra_iters, stats.num_extra_iters);
+  stats_.Add(stat_ids_.smoother_isam_update, stats.isam_update_ms);
+
+  stats_.Add(stat_ids_.smoother_keyposes, stats.num_keyposes);
+  stats_.Add(stat_ids_.smoother_values, stats.num_values);
+  stats_.Add(stat_ids_.smoother_factor_slots, stats.num_factor_slots);
+  smoother_factor_slots_.store((int)stats.num_factor_slots);
+  stats_.Add(stat_ids_.smoother_lmk_tracks, stats.num_lmk_tracks);
+  stats_.Add(stat_ids_.smoother_lmk_track_obs, stats.num_lmk_track_obs);
+  stats_.Add(stat_ids_.process_rss, ResidentSetSizeMb());
+  ReportMemoryUsage(stats_);
+
+  if (stats.compacted) {
+    LOG(INFO) << "Smoother was compacted to " << stats.num_factor_slots << " factor slots" << std::endl;
+  }
+}
+
+
 void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
 {
+  ApplyThreadSchedule(params_.smoother_thread_schedule, "SmootherLoop");
   FixedLagSmoother smoother(params_.smoother_params);
+  startup_.Mark("smoother_constructed");
 
   //====================================== INITIALIZATION ==========================================
   bool initialized = false;
   while (!initialized) {
-    LOG(INFO) << "Will wait " << params_.smoother_init_wait_vision_sec << " seconds for vision" << std::endl;
-    const bool no_vo = WaitForResultOrTimeout<ThreadsafeQueue<VoResult>>(
-        smoother_vo_queue_, params_.smoother_init_wait_vision_sec);
+    if (params_.lockstep && !lockstep_.WaitForWake(smoother_stage_, is_shutdown_, kWaitForShutdownSec)) {
+      if (is_shutdown_) {
+        LOG(INFO) << "SmootherLoop() exiting" << std::endl;
+        return;
+      }
+      continue;
+    }
+
+    LockstepPass pass(lockstep_, smoother_stage_);
+    bool no_vo = true;
+
+    // NOTE(milo): In lockstep mode, the wait for vision is measured on the simulated clock.
+    if (params_.lockstep) {
+      no_vo = smoother_vo_queue_.Empty();
+      if (no_vo && (SimTime() - t0) < params_.smoother_init_wait_vision_sec) {
+        continue;
+      }
+    } else {
+      LOG(INFO) << "Will wait " << params_.smoother_init_wait_vision_sec << " seconds for vision" << std::endl;
+      no_vo = WaitForResultOrTimeout<SpscQueue<VoResult>>(
+          smoother_vo_queue_, params_.smoother_init_wait_vision_sec);
+    }
 
     smoother_imu_manager_.DiscardBefore(t0);
     const bool no_imu = smoother_imu_manager_.Empty();
@@ -310,6 +1689,8 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
       continue;
     }
 
+    pass.DidWork();
+
     LOG(INFO) << "Got data for initialization!" << std::endl;
     LOG(INFO) << "STEREO? " << !no_vo << " " << "IMU? " << !no_imu << std::endl;
 
@@ -320,23 +1701,95 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
     t0 = no_vo ? smoother_imu_manager_.Oldest() :
                  ConvertToSeconds(smoother_vo_queue_.Pop().timestamp);
 
-    smoother.Initialize(t0, P0_world_body, kZeroVelocity, kZeroImuBias, !no_imu);
+    // A warm restart keeps the checkpoint's estimate, but starts it at the new t0. It can only use
+    // the velocity and bias if the IMU is still there.
+    if (resume_checkpoint_) {
+      SmootherResult estimate = resume_checkpoint_->smoother_result;
+      estimate.has_imu_state = estimate.has_imu_state && !no_imu;
+      smoother.Initialize(t0, estimate);
+    } else {
+      smoother.Initialize(t0, P0_world_body, kZeroVelocity, kZeroImuBias, !no_imu);
+    }
     OnSmootherResult(smoother.GetResult());
 
+    // NOTE(milo): The log doesn't store priors, so a warm restart is replayed with the default ones.
+    if (smoother_log_) {
+      const SmootherResult& r = smoother.GetResult();
+      smoother_log_->WriteInitialize(t0, r.world_P_body, r.world_v_body, r.imu_bias, r.has_imu_state);
+    }
+
     smoother_mode_ = no_vo ? SmootherMode::VISION_UNAVAILABLE : SmootherMode::VISION_AVAILABLE;
     initialized = true;
+    startup_.Mark("smoother_ready");
+    LOG(INFO) << startup_.Summary() << std::endl;
     LOG(INFO) << "Smoother initialized at t=" << t0 << "\n" << "P0:" << P0_world_body << std::endl;
     LOG(INFO) << "Smoother mode: " << to_string(smoother_mode_) << std::endl;
   }
   //================================================================================================
 
+  uint64_t smoother_data_generation = smoother_notifier_.Generation();
+  seconds_t vo_wait_start = SimTime();
+  uint64_t tunables_version = 0;
+
+  const bool use_overload_controller = params_.use_overload_controller && !params_.lockstep;
+  const size_t catchup_backlog = params_.lockstep ? 0 : (size_t)params_.smoother_catchup_backlog;
+  const OverloadController::Params& overload_params = overload_controller_.GetParams();
+  OverloadLevel smoother_level = OverloadLevel::NOMINAL;
+
   while (!is_shutdown_) {
+    // Pick up any tunables that changed since the last iteration (see UpdateTunables()), and the
+    // smoothing effort that the OverloadController asks for.
+    const OverloadLevel level = use_overload_controller ? overload_controller_.Level() : OverloadLevel::NOMINAL;
+    if (tunables_.Version() != tunables_version || level != smoother_level) {
+      tunables_version = tunables_.Version();
+      smoother_level = level;
+      const ParamsSnapshot<Tunables>::ConstPtr tunables = tunables_.Get();
+      const int extra_smoothing_iters = (level >= OverloadLevel::FEWER_SMOOTHER_ITERS) ?
+          std::min(overload_params.reduced_extra_smoothing_iters, tunables->extra_smoothing_iters) :
+          tunables->extra_smoothing_iters;
+      smoother.SetSmoothingBudget(extra_smoothing_iters,
+                                  tunables->smoothing_convergence_rel_tol,
+                                  tunables->smoothing_time_budget_ms);
+
+      const int every_n = params_.smoother_params.marginal_covariance_every_n;
+      smoother.SetMarginalCovarianceEveryN((level >= OverloadLevel::SKIP_COVARIANCE) ?
+          std::max(overload_params.reduced_covariance_every_n, every_n) : every_n);
+    }
+
+    if (params_.lockstep && !lockstep_.WaitForWake(smoother_stage_, is_shutdown_, kWaitForShutdownSec)) {
+      continue;
+    }
+
+    LockstepPass pass(lockstep_, smoother_stage_);
+    const SmootherMode prev_mode = smoother_mode_;
+    bool did_update = false;
+    bool did_timeout = true;
+
+    // In lockstep mode, the wait for visual odometry is measured on the simulated clock. Until it
+    // times out, there's nothing to do.
+    if (params_.lockstep) {
+      did_timeout = smoother_vo_queue_.Empty();
+      if (did_timeout && smoother_mode_ == SmootherMode::VISION_AVAILABLE &&
+          (SimTime() - vo_wait_start) < (params_.max_sec_btw_keyposes + 0.1)) {
+        continue;
+      }
+
     // Wait for a visual odometry measurement to arrive, based on the expected time btw keyframes.
-    // If vision hasn't come in recently, don't wait as long, since it is probably unreliable.
-    const double wait_sec = (smoother_mode_ == SmootherMode::VISION_AVAILABLE) ? \
-        params_.max_sec_btw_keyposes + 0.1:       // Add a small epsilon to account for latency.
-        0.005;                                    // This should be a tiny delay to process IMU ASAP.
-    const bool did_timeout = WaitForResultOrTimeout<ThreadsafeQueue<VoResult>>(smoother_vo_queue_, wait_sec);
+    } else if (smoother_mode_ == SmootherMode::VISION_AVAILABLE) {
+      did_timeout = WaitForResultOrTimeout<SpscQueue<VoResult>>(
+          smoother_vo_queue_, params_.max_sec_btw_keyposes + 0.1);  // Add a small epsilon for latency.
+
+    // If vision hasn't come in recently, it is probably unreliable. Wake up as soon as ANY new
+    // sensor data arrives so that IMU/range keyposes get processed ASAP.
+    } else {
+      smoother_notifier_.WaitForNotify(smoother_data_generation, kWaitForShutdownSec);
+      smoother_data_generation = smoother_notifier_.Generation();
+      did_timeout = smoother_vo_queue_.Empty();
+    }
+
+    if (!did_timeout) {
+      RecordWakeLatency(smoother_wake_, stat_ids_.smoother_wake_latency);
+    }
 
     // Update the smoother mode.
     UpdateSmootherMode(did_timeout ? SmootherMode::VISION_UNAVAILABLE : SmootherMode::VISION_AVAILABLE);
@@ -370,6 +1823,7 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
         AttitudeMeasurement::Ptr maybe_attitude_ptr;
         MultiRange maybe_ranges;
         MagMeasurement::Ptr maybe_mag_ptr;
+        TagPoseMeasurement::Ptr maybe_tag_pose_ptr;
         GetKeyposeAlignedMeasurements(
             from_time, to_time,
             maybe_pim_ptr,
@@ -377,55 +1831,155 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
             maybe_attitude_ptr,
             maybe_ranges,
             maybe_mag_ptr,
+            maybe_tag_pose_ptr,
             params_.allowed_misalignment_depth,
             params_.allowed_misalignment_range,
             params_.allowed_misalignment_mag,
-            params_.allowed_misalignment_imu);
+            params_.allowed_misalignment_imu,
+            params_.allowed_misalignment_tag);
 
         CHECK(maybe_pim_ptr) << "Should have gotten a preintegrated IMU measurement, probably a timestamp offset issue" << std::endl;
 
+        // The aux rigs can still see texture when the primary one can't.
+        std::vector<VoResult::ConstPtr> maybe_aux_vo;
+        GetAlignedAuxVo(to_time, maybe_aux_vo);
+
         Timer timer(true);
-        OnSmootherResult(smoother.Update(
+        SmootherResult result = smoother.Update(
             nullptr,
             maybe_pim_ptr,
             maybe_depth_ptr,
             maybe_attitude_ptr,
             maybe_ranges,
-            maybe_mag_ptr));
-        stats_.Add("SmootherUpdateNoVision", timer.Elapsed().milliseconds());
-        stats_.Print("SmootherUpdateNoVision", "ms", params_.stats_print_interval_sec);
+            maybe_mag_ptr,
+            maybe_tag_pose_ptr,
+            maybe_aux_vo);
+
+        if (smoother_log_) {
+          smoother_log_->WriteKeypose(result, nullptr, maybe_pim_ptr, maybe_depth_ptr,
+                                      maybe_attitude_ptr, maybe_ranges, maybe_mag_ptr);
+        }
+
+        // NOTE(milo): Measured from the newest IMU measurement, since it triggered this keypose.
+        result.latency.valid = true;
+        result.latency.smoother_ms = ElapsedMs(newest_imu_received_.load(), SteadyNowNs());
+        result.latency.total_ms = result.latency.smoother_ms;
+        OnSmootherResult(result);
+        stats_.Add(stat_ids_.smoother_update_no_vision, timer.Elapsed().milliseconds());
+        RecordSmootherStats(smoother.GetUpdateStats());
+        did_update = true;
       }
     // VO AVAILABLE ==> Add a keyframe and smooth.
     } else {
-      const VoResult frontend_result = smoother_vo_queue_.Pop();
-      const seconds_t to_time = ConvertToSeconds(frontend_result.timestamp);
-
-      PimResult::Ptr maybe_pim_ptr;
-      DepthMeasurement::Ptr maybe_depth_ptr;
-      AttitudeMeasurement::Ptr maybe_attitude_ptr;
-      MultiRange maybe_ranges;
-      MagMeasurement::Ptr maybe_mag_ptr;
-      GetKeyposeAlignedMeasurements(
-          from_time, to_time,
-          maybe_pim_ptr,
-          maybe_depth_ptr,
-          maybe_attitude_ptr,
-          maybe_ranges,
-          maybe_mag_ptr,
-          params_.allowed_misalignment_depth,
-          params_.allowed_misalignment_range,
-          params_.allowed_misalignment_mag,
-          params_.allowed_misalignment_imu);
+      // If keyframes have piled up, add several of them in one update to catch up.
+      size_t num_keyposes = 1;
+      if (catchup_backlog > 0 && smoother_vo_queue_.Size() >= catchup_backlog) {
+        num_keyposes = std::min(smoother_vo_queue_.Size(), (size_t)params_.smoother_catchup_max_keyposes);
+        stats_.Add(stat_ids_.smoother_catchup_keyposes, num_keyposes);
+      }
+
+      std::vector<FixedLagSmoother::KeyposeMeasurements> keyposes(num_keyposes);
+      seconds_t keypose_from_time = from_time;
+
+      for (FixedLagSmoother::KeyposeMeasurements& keypose : keyposes) {
+        keypose.vo = std::make_shared<VoResult>(smoother_vo_queue_.Pop());
+        const seconds_t to_time = ConvertToSeconds(keypose.vo->timestamp);
+
+        // The keyframe's tag detection started at the same time as its pose solve, so it's usually
+        // done by now.
+        WaitForTagDetection(keypose.vo->timestamp);
+
+        PimResult::Ptr maybe_pim_ptr;
+        DepthMeasurement::Ptr maybe_depth_ptr;
+        AttitudeMeasurement::Ptr maybe_attitude_ptr;
+        MagMeasurement::Ptr maybe_mag_ptr;
+        TagPoseMeasurement::Ptr maybe_tag_pose_ptr;
+        GetKeyposeAlignedMeasurements(
+            keypose_from_time, to_time,
+            maybe_pim_ptr,
+            maybe_depth_ptr,
+            maybe_attitude_ptr,
+            keypose.ranges,
+            maybe_mag_ptr,
+            maybe_tag_pose_ptr,
+            params_.allowed_misalignment_depth,
+            params_.allowed_misalignment_range,
+            params_.allowed_misalignment_mag,
+            params_.allowed_misalignment_imu,
+            params_.allowed_misalignment_tag);
+
+        keypose.pim = maybe_pim_ptr;
+        keypose.depth = maybe_depth_ptr;
+        keypose.attitude = maybe_attitude_ptr;
+        keypose.mag = maybe_mag_ptr;
+        keypose.tag_pose = maybe_tag_pose_ptr;
+        GetAlignedAuxVo(to_time, keypose.aux_vo);
+
+        keypose_from_time = to_time;
+      }
+
+      Timer timer(true);
+      const std::vector<SmootherResult> results = smoother.UpdateBatch(keyposes);
+
+      if (smoother_log_) {
+        for (size_t i = 0; i < keyposes.size(); ++i) {
+          const FixedLagSmoother::KeyposeMeasurements& keypose = keyposes.at(i);
+          smoother_log_->WriteKeypose(results.at(i), keypose.vo, keypose.pim, keypose.depth,
+                                      keypose.attitude, keypose.ranges, keypose.mag);
+        }
+      }
+
+      // Only the newest keypose is handed on, and its latency is measured from its own keyframe.
+      SmootherResult result = results.back();
+      const VoResult& frontend_result = *keyposes.back().vo;
+
+      const LatencyTags& tags = frontend_result.latency;
+      const steady_ns_t now = SteadyNowNs();
+      result.latency.valid = (tags.received != 0);
+      result.latency.decode_ms = ElapsedMs(tags.received, tags.decoded);
+      result.latency.queue_ms = ElapsedMs(tags.decoded, tags.dequeued);
+      result.latency.frontend_ms = ElapsedMs(tags.dequeued, tags.processed);
+      result.latency.smoother_ms = ElapsedMs(tags.processed, now);
+      result.latency.total_ms = ElapsedMs(tags.received, now);
+      OnSmootherResult(result);
+      stats_.Add(stat_ids_.smoother_update_with_vision, timer.Elapsed().milliseconds());
+      RecordSmootherStats(smoother.GetUpdateStats());
+
+      if (result.latency.valid) {
+        UpdateAuxRigShedding(result.latency.smoother_ms);
+      }
+
+      if (use_overload_controller && result.latency.valid) {
+        overload_controller_.ReportSmoother((double)smoother_vo_queue_.Size() / smoother_vo_queue_.Capacity(),
+                                            result.latency.smoother_ms);
+        stats_.Add(stat_ids_.overload_level, static_cast<int>(overload_controller_.Level()));
+      }
+
+      if (params_.use_power_governor && !params_.lockstep) {
+        stats_.Add(stat_ids_.power_governor_rung, power_governor_.RungIndex());
+        stats_.Add(stat_ids_.energy_per_estimate, power_governor_.EnergyPerEstimateJ());
+      }
+
+      // Space out keyframes if the smoother is falling behind.
+      if (params_.use_keyframe_policy && !params_.lockstep && result.latency.valid) {
+        keyframe_policy_.ReportSmootherLatency(result.latency.smoother_ms);
+        stats_.Add(stat_ids_.keyframe_min_interval, keyframe_policy_.MinSecBtwKeyframes());
+      }
+      did_update = true;
+    }
 
+    if (did_update || smoother_mode_ != prev_mode) {
+      pass.DidWork();
+      vo_wait_start = SimTime();
+    }
+
+    // If covariance is deferred, compute it now that the pose has gone out to the filter and
+    // callbacks. It will be included with the next smoother result.
+    if (params_.smoother_params.defer_marginal_covariance) {
       Timer timer(true);
-      OnSmootherResult(smoother.Update(
-          VoResult::ConstPtr(&frontend_result),
-          maybe_pim_ptr,
-          maybe_depth_ptr,
-          maybe_attitude_ptr,
-          maybe_ranges));
-      stats_.Add("SmootherUpdateWithVision", timer.Elapsed().milliseconds());
-      stats_.Print("SmootherUpdateWithVision", "ms", params_.stats_print_interval_sec);
+      if (smoother.UpdateMarginalCovariance()) {
+        stats_.Add(stat_ids_.smoother_marginal_covariance, timer.Elapsed().milliseconds());
+      }
     }
 
   } // end while (!is_shutdown)
@@ -436,21 +1990,52 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
 
 void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
 {
+  ApplyThreadSchedule(params_.filter_thread_schedule, "FilterLoop");
   StateEkf filter(params_.filter_params);
 
   StateCovariance S0 = 0.1*StateCovariance::Identity();
   S0.block<3, 3>(t_row, t_row) = 0.03 * Matrix3d::Identity();
 
+  // A warm restart starts at the smoother's pose (like the smoother does), but keeps the filter's
+  // velocity and covariance, and the smoother's bias.
+  Vector3d v0 = Vector3d::Zero();
+  ImuBias bias0;
+  if (resume_checkpoint_ && resume_checkpoint_->has_filter_state) {
+    v0 = resume_checkpoint_->filter_state.state.v;
+    S0 = resume_checkpoint_->filter_state.state.S;
+    bias0 = resume_checkpoint_->smoother_result.imu_bias;
+  }
+
   filter.Initialize(StateStamped(t0, State(
       P0_world_body.translation(),
-      Vector3d::Zero(),
+      v0,
       Vector3d::Zero(),
       P0_world_body.rotation().toQuaternion().normalized(),
       Vector3d::Zero(),
       S0)),
-      ImuBias());
+      bias0);
+  startup_.Mark("filter_ready");
 
   while (!is_shutdown_) {
+    // Sleep until there is sensor data or a smoother result to sync with. In lockstep mode, sleep
+    // until this stage is woken up instead.
+    if (params_.lockstep) {
+      if (!lockstep_.WaitForWake(filter_stage_, is_shutdown_, kWaitForShutdownSec)) {
+        continue;
+      }
+    } else {
+      filter_notifier_.WaitFor([this]() {
+        return !filter_imu_manager_.Empty() ||
+               !filter_depth_manager_.Empty() ||
+               !filter_range_manager_.Empty() ||
+               smoother_update_flag_.load() ||
+               is_shutdown_.load();
+      }, kWaitForShutdownSec);
+    }
+
+    LockstepPass pass(lockstep_, filter_stage_);
+    RecordWakeLatency(filter_wake_, stat_ids_.filter_wake_latency);
+
     // Clear out any sensor data before the current state.
     filter_imu_manager_.DiscardBefore(filter.GetTimestamp());
     filter_depth_manager_.DiscardBefore(filter.GetTimestamp());
@@ -459,6 +2044,7 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
     if ((!filter_imu_manager_.Empty()) ||
         (!filter_depth_manager_.Empty()) ||
         (!filter_range_manager_.Empty())) {
+      pass.DidWork();
 
       // Figure out which sensor data is next.
       const seconds_t next_imu_timestamp = filter_imu_manager_.Empty() ? kMaxSeconds : filter_imu_manager_.Oldest();
@@ -466,9 +2052,13 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
       const seconds_t next_range_timestamp = filter_range_manager_.Empty() ? kMaxSeconds : filter_range_manager_.Oldest();
       const seconds_t next_timestamp = std::min({next_imu_timestamp, next_depth_timestamp, next_range_timestamp});
 
-      // Update the EKF using one data sample.
+      // Update the EKF using one data sample. Only IMU measurements are tagged for latency.
+      LatencyTags tags;
       if (next_timestamp == next_imu_timestamp) {
-        filter.PredictAndUpdate(filter_imu_manager_.Pop());
+        const ImuMeasurement imu_data = filter_imu_manager_.Pop();
+        tags = imu_data.latency;
+        tags.dequeued = SteadyNowNs();
+        filter.PredictAndUpdate(imu_data);
       } else if (next_timestamp == next_depth_timestamp) {
         const DepthMeasurement depth_data = filter_depth_manager_.Pop();
         filter.PredictAndUpdate(next_depth_timestamp,
@@ -476,37 +2066,52 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
                                 depth_sign_ * depth_data.depth,
                                 params_.filter_params.sigma_R_depth);
       } else if (next_timestamp == next_range_timestamp) {
-        const RangeMeasurement range_data = filter_range_manager_.Pop();
-        filter.PredictAndUpdate(next_range_timestamp,
-                                range_data.range,
-                                range_data.point,
-                                params_.filter_params.sigma_R_range);
+        MultiRange ranges = { filter_range_manager_.Pop() };
+        GateRangesWithFilter(ranges, filter.GetState(), filter_range_rejects_, "FilterRangesRejected",
+                             stat_ids_.filter_ranges_rejected);
+        for (const RangeMeasurement& range_data : ranges) {
+          filter.PredictAndUpdate(next_range_timestamp,
+                                  range_data.range,
+                                  range_data.point,
+                                  params_.filter_params.sigma_R_range);
+        }
       } else {
         LOG(FATAL) << "No sensor was chosen for filter update, something is wrong" << std::endl;
       }
 
-      // Process all callbacks with the updated state. These will block so they should be fast!
-      const StateStamped state = filter.GetState();
-      for (const StateStamped::Callback& cb : filter_result_callbacks_) {
-        cb(state);
+      StateStamped state = filter.GetState();
+      const steady_ns_t now = SteadyNowNs();
+      state.latency.valid = (tags.received != 0);
+      state.latency.queue_ms = ElapsedMs(tags.received, tags.dequeued);
+      state.latency.filter_ms = ElapsedMs(tags.dequeued, now);
+      state.latency.total_ms = ElapsedMs(tags.received, now);
+
+      if (params_.use_keyframe_policy && !params_.lockstep) {
+        keyframe_policy_.ReportMotion(state.state.v, state.state.w);
       }
+
+      PublishFilterState(state);
     }
 
     //================================ SYNCHRONIZE WITH SMOOTHER ===================================
     const bool do_sync_with_smoother = smoother_update_flag_.exchange(false);
 
     if (do_sync_with_smoother) {
+      pass.DidWork();
+
       // Get a copy of the latest smoother state to make sure it doesn't change during the sync.
-      mutex_smoother_result_.lock();
-      const SmootherResult result = smoother_result_;
-      mutex_smoother_result_.unlock();
+      SmootherResult result;
+      published_smoother_result_.Load(result);
 
       filter.Rewind(result.timestamp);
       filter.UpdateImuBias(result.imu_bias);
 
-      const Matrix3d world_R_body = result.world_P_body.rotation().matrix();
-      const double position_err = (result.world_P_body.translation() - filter.GetState().state.t).norm();
-      const double rotation_err = (result.world_P_body.rotation().toQuaternion().angularDistance(filter.GetState().state.q));
+      // Convert the smoother rotation once, instead of for every use below.
+      const SE3 world_T_body = ToSE3(result.world_P_body);
+      const Quaterniond world_q_body = world_T_body.ToQuaternion().normalized();
+      const StateStamped filter_state = filter.GetState();
+      const double position_err = (world_T_body.translation() - filter_state.state.t).norm();
+      const double rotation_err = world_q_body.angularDistance(filter_state.state.q);
 
       const bool filter_has_diverged = (position_err > params_.max_filter_divergence_position ||
                                         rotation_err > params_.max_filter_divergence_rotation);
@@ -521,10 +2126,10 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
         S.block<3, 3>(v_row, v_row) = result.cov_vel;
 
         filter.Initialize(StateStamped(result.timestamp, State(
-            result.world_P_body.translation(),
+            world_T_body.translation(),
             result.world_v_body,
             Vector3d::Zero(),
-            result.world_P_body.rotation().toQuaternion().normalized(),
+            world_q_body,
             Vector3d::Zero(),
             S0)),
             result.imu_bias);
@@ -532,20 +2137,16 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
       // Otherwise, do a "soft" reset by treating the smoother pose as a measurement.
       } else {
         filter.PredictAndUpdate(result.timestamp,
-                                result.world_P_body.rotation().toQuaternion().normalized(),
-                                result.world_P_body.translation(),
-                                result.cov_pose);
-        filter.PredictAndUpdate(result.timestamp,
+                                world_q_body,
+                                world_T_body.translation(),
+                                result.cov_pose,
                                 result.world_v_body,
                                 result.cov_vel);
       }
 
       filter.ReapplyImu();
 
-      const StateStamped state = filter.GetState();
-      for (const StateStamped::Callback& cb : filter_result_callbacks_) {
-        cb(state);
-      }
+      PublishFilterState(filter.GetState());
     } // end if (do_sync_with_smoother)
   } // end while (!is_shutdown)
 
@@ -553,5 +2154,52 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
 }
 
 
+void StateEstimator::PublishFilterState(const StateStamped& state)
+{
+  filter_state_.Store(state);
+  filter_poses_.Add(ConvertToNanoseconds(state.timestamp), SE3(state.state.q.normalized(), state.state.t));
+
+  if (async_filter_callbacks_) {
+    filter_callback_notifier_.Notify();
+    return;
+  }
+
+  // Process all callbacks with the updated state. These will block so they should be fast!
+  for (const StateStamped::Callback& cb : filter_result_callbacks_) {
+    cb(state);
+  }
+}
+
+
+void StateEstimator::FilterCallbackLoop()
+{
+  uint64_t last_version = 0;
+  StateStamped state;
+
+  while (!is_shutdown_) {
+    filter_callback_notifier_.WaitFor([this, &last_version]() {
+      return filter_state_.Version() != last_version || is_shutdown_.load();
+    }, kWaitForShutdownSec);
+
+    uint64_t version = 0;
+    if (!filter_state_.Load(state, &version) || version == last_version) {
+      continue;
+    }
+
+    // States that were published while the callbacks were busy are skipped.
+    if (last_version > 0 && version > (last_version + 1)) {
+      stats_.Add(stat_ids_.filter_callback_states_skipped, static_cast<float>(version - last_version - 1));
+    }
+    last_version = version;
+
+    for (const StateStamped::Callback& cb : filter_result_callbacks_) {
+      cb(state);
+    }
+  }
+
+  LOG(INFO) << "FilterCallbackLoop() exiting" << std::endl;
+}
+
+
 }
 }
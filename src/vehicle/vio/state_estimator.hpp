@@ -2,6 +2,7 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
 
 #include "params/params_base.hpp"
 #include "core/macros.hpp"
@@ -9,13 +10,22 @@
 #include "vision_core/cv_types.hpp"
 #include "core/axis3.hpp"
 #include "core/thread_safe_queue.hpp"
+#include "core/spsc_queue.hpp"
 #include "vision_core/stereo_image.hpp"
 #include "core/imu_measurement.hpp"
 #include "core/depth_measurement.hpp"
 #include "core/range_measurement.hpp"
 #include "core/mag_measurement.hpp"
 #include "core/data_manager.hpp"
+#include "core/time_indexed_data_manager.hpp"
+#include "core/broadcast_buffer.hpp"
+#include "core/seqlock.hpp"
+#include "core/pose_history.hpp"
 #include "core/stats_tracker.hpp"
+#include "core/startup_profile.hpp"
+#include "params/params_snapshot.hpp"
+#include "core/thread_schedule.hpp"
+#include "core/data_subsampler.hpp"
 #include "vio/stereo_frontend.hpp"
 #include "vio/imu_manager.hpp"
 #include "vio/state_estimator_util.hpp"
@@ -23,6 +33,17 @@
 // #include "vio/smoother.hpp"
 #include "vio/smoother_result.hpp"
 #include "vio/fixed_lag_smoother.hpp"
+#include "vio/lockstep.hpp"
+#include "vio/keyframe_policy.hpp"
+#include "vio/overload_controller.hpp"
+#include "vio/power_governor.hpp"
+#include "vio/time_offset_estimator.hpp"
+#include "vio/slow_frame_recorder.hpp"
+#include "vio/smoother_log.hpp"
+#include "vio/estimator_checkpoint.hpp"
+#include "vio/tag_localizer.hpp"
+#include "vio/tag_pose_measurement.hpp"
+#include "vio/aux_stereo_rig.hpp"
 
 #include <gtsam/geometry/Pose3.h>
 
@@ -30,9 +51,30 @@ namespace bm {
 namespace vio {
 
 
-typedef DataManager<DepthMeasurement> DepthManager;
-typedef DataManager<RangeMeasurement> RangeManager;
-typedef DataManager<MagMeasurement> MagManager;
+// NOTE(milo): These are searched by timestamp for every keypose, so use the binary-searchable buffer.
+// Depth and range go to both the smoother and the filter, so each of them reads from one shared
+// buffer instead of getting its own copy.
+typedef BroadcastBuffer<DepthMeasurement> DepthBuffer;
+typedef BroadcastBuffer<RangeMeasurement> RangeBuffer;
+typedef DepthBuffer::Reader DepthManager;
+typedef TimeIndexedDataManager<ImuMeasurement> GyroManager;
+typedef RangeBuffer::Reader RangeManager;
+typedef TimeIndexedDataManager<MagMeasurement> MagManager;
+typedef TimeIndexedDataManager<TagPoseMeasurement> TagPoseManager;
+
+
+// A keyframe from an aux stereo rig, waiting to be added to the nearest keypose.
+// NOTE(milo): VoResult can't be copied, so the manager holds a pointer to it.
+struct AuxVoMeasurement final
+{
+  explicit AuxVoMeasurement(timestamp_t timestamp, const VoResult::ConstPtr& vo)
+      : timestamp(timestamp), vo(vo) {}
+
+  timestamp_t timestamp;
+  VoResult::ConstPtr vo;
+};
+
+typedef TimeIndexedDataManager<AuxVoMeasurement> AuxVoManager;
 
 
 // The smoother changes its behavior depending on whether vision is available/unavailable.
@@ -51,6 +93,10 @@ inline std::string to_string(const SmootherMode& m)
 }
 
 
+// Which history StateEstimator::GetPose() found a pose in. The values are sent over LCM.
+enum class PoseSource { NONE = 0, SMOOTHER = 1, FILTER = 2 };
+
+
 class StateEstimator final {
  public:
   struct Params final : public ParamsBase
@@ -62,6 +108,11 @@ class StateEstimator final {
     // Smoother::Params smoother_params;
     FixedLagSmoother::Params smoother_params;
     StateEkf::Params filter_params;
+    KeyframePolicy::Params keyframe_policy_params;
+    OverloadController::Params overload_controller_params;
+    PowerGovernor::Params power_governor_params;
+    TagLocalizer::Params tag_localizer_params;
+    TimeOffsetEstimator::Params time_offset_params;
 
     int max_size_raw_stereo_queue = 100;      // Images for the stereo frontend to process.
     int max_size_smoother_vo_queue = 100;     // Holds keyframe VO estimates for the smoother to process.
@@ -74,18 +125,65 @@ class StateEstimator final {
     int max_size_filter_depth_queue = 1000;
     int max_size_filter_range_queue = 100;
 
+    // If nonzero, lower the max sizes above, and the filter's stored IMU history, so that they fit
+    // in this many MB when full (see FitToMemoryBudget). Mostly, this shortens the raw stereo queue,
+    // since images are by far the biggest items. Each one keeps a minimum size that the estimator
+    // still works with. The smoother's graph and the frontend aren't counted, only reported (see
+    // MemoryRegistry).
+    int memory_budget_mb = 0;
+
+    // Once this many keyframes (zero = never) are waiting in the smoother VO queue, add up to
+    // smoother_catchup_max_keyposes of them in one smoother update (see FixedLagSmoother::UpdateBatch),
+    // instead of paying for a full update and covariance at each one. Off in lockstep mode, since
+    // it depends on how far the smoother has fallen behind.
+    int smoother_catchup_backlog = 0;
+    int smoother_catchup_max_keyposes = 10;
+
     int stats_tracker_k = 10;                 // Store the last k samples of each scalar.
-    float stats_print_interval_sec = 5.0;     // Print out stats every 5 sec.
+    float stats_print_interval_sec = 5.0;     // Print out stats every 5 sec (0 = never).
 
     int reliable_vision_min_lmks = 12;        // Vision is "unreliable" if not many features can be detected.
 
     double max_sec_btw_keyposes = 2.0;        // If a keypose hasn't been triggered in this long, trigger it!
     double min_sec_btw_keyposes = 0.5;        // Don't trigger a keypose if it hasn't been long since the last one.
 
+    // Let a KeyframePolicy decide when the frontend triggers keyframes (and so VO keyposes), instead
+    // of every trigger_keyframe_k frames. Its max_sec_btw_keyframes must be < max_sec_btw_keyposes.
+    // NOTE(milo): In lockstep mode, it only uses tracking cues, since filter motion and smoother
+    // latency would make replay nondeterministic.
+    bool use_keyframe_policy = false;
+
+    // When the frontend or smoother can't keep up, let an OverloadController turn down how much work
+    // they do (skip frames, fewer features, coarser KLT, fewer smoother iters, fewer covariances),
+    // instead of dropping whatever arrives when a queue is full. Off in lockstep mode, since it
+    // reacts to wall-clock timing.
+    bool use_overload_controller = false;
+
+    // Let a PowerGovernor step the frontend down a ladder of cheaper rungs (skip frames, fewer
+    // features) as the computer gets hot or goes over its power budget. Where it runs along with the
+    // OverloadController, the frontend does the least work that either of them asks for. Off in
+    // lockstep mode, like the OverloadController.
+    bool use_power_governor = false;
+
+    // Integrate the gyro between tracked images, and predict where features will be from that
+    // rotation, so that KLT starts close to them (see FeatureTracker::Params::klt_guess_max_level).
+    // While rotating faster than fast_motion_skip_rad_per_sec (zero = never), every other image is
+    // skipped, since the prediction can cover the bigger motion. Images that are due to be keyframes
+    // are always tracked.
+    bool use_gyro_rotation_prior = false;
+    double fast_motion_skip_rad_per_sec = 0.0;
+
+    // Estimate the offset between the IMU and camera clocks online (see TimeOffsetEstimator), and
+    // shift incoming IMU timestamps onto the camera clock. Then allowed_misalignment_imu only has to
+    // cover jitter, not a drifting offset. Off in lockstep mode, since the estimate depends on when
+    // the frontend runs relative to IMU arrivals.
+    bool estimate_imu_time_offset = false;
+
     double smoother_init_wait_vision_sec = 3.0;   // Wait this long for VO to arrive during initialization.
     double allowed_misalignment_depth = 0.05;     // 50 ms for depth
-    double allowed_misalignment_imu = 0.05;       // 50 ms for IMU
+    double allowed_misalignment_imu = 0.05;       // 50 ms for IMU (only for extrapolation and gaps)
     double allowed_misalignment_mag = 0.05;       // 50 ms for magnetometer
+    double allowed_misalignment_tag = 0.05;       // 50 ms for AprilTag poses
 
     // Range arrives at about 3 Hz. This means we can expect to be at most 0.15 sec away from a
     // range measurement at any given time.
@@ -96,11 +194,87 @@ class StateEstimator final {
 
     int show_feature_tracks = 0;
 
+    // Run the frontend as a two-stage pipeline: frame N's pose solve overlaps frame N+1's tracking.
+    bool pipeline_stereo_frontend = false;
+
     double body_nG_tol = 0.01;  // Treat accelerometer measurements as attitude measurements if they are this close to 1G.
 
+    // Fuse all of the samples since the last keypose into one measurement (with a covariance that
+    // shrinks with the number of samples), instead of using the one nearest to the keypose. For
+    // attitude, the average acceleration over the keypose has to be close to 1G.
+    bool average_mag_samples = true;
+    bool average_attitude_samples = true;
+
+    // Localize from AprilTags with known world poses (see TagLocalizer). Keyframes are searched for
+    // tags on a TaskScheduler worker, while the frontend moves on. The smoother waits up to
+    // tag_max_wait_sec for a keyframe's detection, and adds the keypose without it after that.
+    bool use_tags = false;
+    double tag_max_wait_sec = 0.05;
+
+    // Stereo rigs besides stereo_forward (listed by their names in the shared params). Each one has
+    // its own frontend thread and image queue, and its keyframes add landmarks to the keypose within
+    // allowed_misalignment_aux_vision of them. Aux rigs are limited to aux_rig_max_hz (zero = no
+    // limit), and when the smoother latency goes over aux_rig_shed_latency_ms (zero = never), their
+    // images are dropped until it's back under half of that.
+    AuxStereoRigs aux_stereo_rigs;
+    int max_size_aux_stereo_queue = 10;
+    double allowed_misalignment_aux_vision = 0.05;
+    double aux_rig_max_hz = 0.0;
+    double aux_rig_shed_latency_ms = 0.0;
+
     bool filter_use_range = true;
     bool filter_use_depth = true;
 
+    // Call the filter result callbacks from their own thread, with the latest state, so that a slow
+    // consumer can't hold up the filter. A consumer that falls behind skips to the newest state
+    // instead of getting every one. Ignored in lockstep mode, where callbacks stay on the filter
+    // thread so that replay is deterministic.
+    bool filter_async_callbacks = false;
+
+    // Filter states and smoother keyposes kept for GetPose(). Poses aren't interpolated across a gap
+    // larger than pose_history_max_gap_sec.
+    int pose_history_size = 4000;
+    double pose_history_max_gap_sec = 1.0;
+
+    // Drop ranges whose squared Mahalanobis distance from the range predicted by the filter is more
+    // than this, before the smoother or the filter see them (zero turns it off). If more than
+    // range_gate_max_rejects ranges in a row are dropped, the next ones are let through, since the
+    // filter is probably the one that is wrong.
+    // NOTE(milo): In lockstep mode, only the filter's ranges are gated, since the smoother would see
+    // the filter state at a nondeterministic point.
+    double range_gate_max_mahalanobis_sq = 0.0;
+    int range_gate_max_rejects = 6;
+
+    // Deterministic replay: each Receive*() blocks until every thread is done with the data, and
+    // timeouts are measured on a simulated clock (the latest data timestamp) instead of wall time.
+    // Nothing is dropped, and replaying a dataset gives the same results every time.
+    bool lockstep = false;
+
+    // If set, everything that the smoother is given (and the raw IMU) is logged to this file, so that
+    // the dive can be re-solved offline as one batch problem (see BatchSmoother).
+    std::string smoother_log_path = "";
+
+    // If set, a checkpoint (see EstimatorCheckpoint) is written here in the background every
+    // checkpoint_interval_sec of data time, so that a restarted process can pick up where this one
+    // left off. Measured on data time so that lockstep replays write the same checkpoints.
+    std::string checkpoint_path = "";
+    double checkpoint_interval_sec = 5.0;
+
+    // If set, the frontend keeps stage timings and queue depths for its last slow_frame_history
+    // frames (see SlowFrameRecorder). When a frame takes longer than slow_frame_deadline_ms, they're
+    // written under this folder with that frame's images, at most slow_frame_max_dumps times.
+    std::string slow_frame_folder = "";
+    double slow_frame_deadline_ms = 100.0;
+    int slow_frame_history = 30;
+    int slow_frame_max_dumps = 20;
+
+    // CPU pinning and priorities for each thread (the solve thread of a pipelined frontend uses the
+    // frontend's). Give the filter the highest priority, since its output is used for control and
+    // the smoother's iSAM2 updates can otherwise preempt it.
+    ThreadSchedule frontend_thread_schedule;
+    ThreadSchedule smoother_thread_schedule;
+    ThreadSchedule filter_thread_schedule;
+
     gtsam::Pose3 body_P_imu = gtsam::Pose3::identity();
     gtsam::Pose3 body_P_cam = gtsam::Pose3::identity();
     Vector3d n_gravity = Vector3d(0, 9.81, 0);
@@ -111,35 +285,162 @@ class StateEstimator final {
     void LoadParams(const YamlParser& parser) override;
   };
 
+  // The params that can be changed while running (see UpdateTunables()).
+  // NOTE(milo): Only the queues that are SpscQueues can be resized, and they can't grow past their
+  // original size (rounded up to a power of two).
+  struct Tunables final
+  {
+    Tunables() = default;
+    explicit Tunables(const Params& params);
+
+    // Overwrite any tunables found in a StateEstimator params subtree. Unlike Params, anything that
+    // is missing keeps its current value, and nothing CHECK-fails, so that a bad edit to a params
+    // file can't take down a running process. Validation happens in UpdateTunables().
+    void Update(const YamlParser& parser);
+
+    int max_size_raw_stereo_queue = 100;
+    int max_size_smoother_vo_queue = 100;
+    KeyframePolicy::Params keyframe_policy_params;
+    int extra_smoothing_iters = 2;
+    double smoothing_convergence_rel_tol = 0.0;
+    double smoothing_time_budget_ms = 0.0;
+  };
+
   MACRO_DELETE_COPY_CONSTRUCTORS(StateEstimator)
   MACRO_DELETE_DEFAULT_CONSTRUCTOR(StateEstimator)
 
   StateEstimator(const Params& params);
+  ~StateEstimator();
 
   void ReceiveStereo(const StereoImage1b& stereo_pair);
+
+  // Images from aux_stereo_rigs[aux_rig] (see aux_stereo_rigs).
+  void ReceiveAuxStereo(size_t aux_rig, const StereoImage1b& stereo_pair);
   void ReceiveImu(const ImuMeasurement& imu_data);
   void ReceiveDepth(const DepthMeasurement& depth_data);
   void ReceiveRange(const RangeMeasurement& range_data);
   void ReceiveMag(const MagMeasurement& mag_data);
 
+  // Give a VoResult straight to the smoother, as if the frontend had made it (e.g from a
+  // SyntheticWorld, to benchmark the backend without images). Only keyframes with enough landmarks
+  // are used, like HandleVoResult() does with the frontend's results.
+  // NOTE(milo): The smoother's VO queue only has one producer, so don't mix this with ReceiveStereo().
+  void ReceiveVo(VoResult&& vo_result);
+
+  // Batch versions of the above, for N measurements that arrive together (oldest first). Each queue
+  // is locked, and its consumer woken up, once per batch instead of once per measurement.
+  // NOTE(milo): In lockstep mode, these just call the single versions, so that a replay gives the
+  // same results no matter how its measurements were batched.
+  void ReceiveImuBatch(const ImuMeasurement* imu_data, size_t N);
+  void ReceiveDepthBatch(const DepthMeasurement* depth_data, size_t N);
+  void ReceiveRangeBatch(const RangeMeasurement* range_data, size_t N);
+
   // Add a function that gets called whenever the smoother finished an update.
   // NOTE(milo): Callbacks will block the smoother thread, so keep them fast!
   void RegisterSmootherResultCallback(const SmootherResult::Callback& cb);
   void RegisterFilterResultCallback(const StateStamped::Callback& cb);
 
+  // Called with the landmarks tracked in every stereo pair, before the pose is solved, so that
+  // other modules (e.g the ObjectMesher) can reuse them instead of running their own tracker.
+  // NOTE(milo): Callbacks will block the frontend thread, so keep them fast!
+  typedef std::function<void(const VoResult&, const cv::Size&)> FeatureTracksCallback;
+  void RegisterFeatureTracksCallback(const FeatureTracksCallback& cb);
+
+  // Get the latest filter state, without waiting on the filter thread. Returns false if the filter
+  // hasn't produced a state yet. Threadsafe, and cheap enough to call at controller rates.
+  bool GetFilterState(StateStamped& state) const;
+
+  // Where the body was at timestamp (e.g of an image), interpolated from the smoother's keyposes if
+  // it's between two of them, and otherwise from the filter's states. Returns NONE if it's outside
+  // of both (see pose_history_size). Lock-free, so any thread can call it at any rate.
+  PoseSource GetPose(timestamp_t timestamp, SE3& world_T_body) const;
+
   // Initialize the state estimator pose from an external source of localization.
   void Initialize(seconds_t t0, const gtsam::Pose3 P0_world_body);
 
+  // Warm restart from a checkpoint: the smoother and filter start at the checkpoint's pose, with its
+  // velocity, bias, and covariances as priors (see FixedLagSmoother::Initialize).
+  void Initialize(seconds_t t0, const EstimatorCheckpoint& checkpoint);
+
+  // Writes the latest smoother result and filter state to path (see EstimatorCheckpoint). Returns
+  // false if there's no smoother result yet, or the file couldn't be written. Threadsafe.
+  bool SaveCheckpoint(const std::string& path);
+
   // This call blocks until all queued stereo pairs have been processed.
   void BlockUntilFinished();
 
+  // Apply new tunables without restarting. Queue sizes and keyframe thresholds change right away,
+  // and the smoother picks up its new budget before its next update. Returns false (and changes
+  // nothing) if any of them are invalid, or in lockstep mode, where they'd make replay
+  // nondeterministic. Threadsafe.
+  bool UpdateTunables(const Tunables& tunables);
+
+  // The latest tunables that were applied.
+  Tunables GetTunables() const { return *tunables_.Get(); }
+
+  // How long each phase of startup took: constructing the subsystems (which happens in parallel),
+  // and the time from construction until the filter and smoother are ready.
+  const StartupProfile& Startup() const { return startup_; }
+
+  // The simulated clock used in lockstep mode (timestamp of the latest data received).
+  seconds_t SimTime() const { return sim_time_.load(); }
+
+  // The rung that the PowerGovernor is on (only moves if use_power_governor), e.g for the nodes
+  // that run dense stereo and enhancement to follow its rates too.
+  const PowerGovernor& GetPowerGovernor() const { return power_governor_; }
+
   // Tells all of the threads to exit, joins them, then exits.
   void Shutdown();
 
  private:
-  // Tracks features from stereo images, and decides what to do with the results.
+  // Tracks features from stereo images, and decides what to do with the results. If the frontend
+  // is pipelined, this only does the tracking stage, and sends its results to StereoSolveLoop().
   void StereoFrontendLoop();
 
+  // The pose solve stage of a pipelined frontend.
+  void StereoSolveLoop();
+
+  // Integrates the gyro from the last tracked image to this one (see use_gyro_rotation_prior), and
+  // sets prev_T_cur_prior to the rotation of the left camera. Returns false if this image should be
+  // skipped instead (see fast_motion_skip_rad_per_sec, and StereoFrontend::CheckFrameQuality()).
+  // has_prior is false if there's no prior.
+  // NOTE(milo): Only called from the thread that tracks features.
+  bool PrepareFrontendPrior(const StereoImage1b& stereo_pair, Matrix4d& prev_T_cur_prior, bool& has_prior);
+
+  // Adds a frame to slow_frames_, which writes it out (with the frames before it) if it was slow.
+  // In a pipelined frontend, solve_ms is zero and the total only covers tracking.
+  void RecordSlowFrame(const StereoImage1b& stereo_pair, const VoResult& result, float track_ms, float solve_ms);
+
+  // Tracks features from one aux rig's images (see aux_stereo_rigs). In lockstep mode, there's no
+  // thread, and ReceiveAuxStereo() calls TrackAuxStereo() directly.
+  void AuxStereoFrontendLoop(size_t aux_rig);
+  void TrackAuxStereo(size_t aux_rig, const StereoImage1b& stereo_pair);
+
+  // Pops the keyframe from each aux rig that is nearest to to_time (or nullptr, if none are close
+  // enough). Nothing is used while the aux rigs are being shed.
+  void GetAlignedAuxVo(seconds_t to_time, std::vector<VoResult::ConstPtr>& maybe_aux_vo);
+
+  // Starts or stops shedding the aux rigs, based on the latest smoother latency.
+  void UpdateAuxRigShedding(double smoother_latency_ms);
+
+  // Decides what to do with a VoResult from the frontend (e.g send it to the smoother).
+  void HandleVoResult(VoResult& result);
+
+  // Gives the rotation since the previous VoResult to the TimeOffsetEstimator.
+  void AddVisionRotation(const VoResult& result);
+
+  // Gives a raw IMU measurement to the TimeOffsetEstimator, and returns its timestamp shifted onto
+  // the camera clock (if estimate_imu_time_offset). Only call this from the ingest thread.
+  timestamp_t CorrectImuTimestamp(const ImuMeasurement& imu);
+
+  // Starts looking for tags in a keyframe (see use_tags). Only one detection runs at a time, so if
+  // the last one is still going, this keyframe is skipped. In lockstep mode, it runs right here.
+  void DetectTags(timestamp_t timestamp, const Image1b& left_image);
+
+  // Waits (up to tag_max_wait_sec) for the tag detection of the keyframe at timestamp, if it's the
+  // one that is running.
+  void WaitForTagDetection(timestamp_t timestamp);
+
   void GetKeyposeAlignedMeasurements(seconds_t from_time,
                                      seconds_t to_time,
                                      PimResult::Ptr& pim_result,
@@ -147,57 +448,258 @@ class StateEstimator final {
                                      AttitudeMeasurement::Ptr& maybe_attitude_ptr,
                                      MultiRange& maybe_range_ptr,
                                      MagMeasurement::Ptr& maybe_mag_ptr,
+                                     TagPoseMeasurement::Ptr& maybe_tag_pose_ptr,
                                      seconds_t allowed_misalignment_depth,
                                      seconds_t allowed_misalignment_range,
                                      seconds_t allowed_misalignment_mag,
-                                     seconds_t allowed_misalignment_imu);
+                                     seconds_t allowed_misalignment_imu,
+                                     seconds_t allowed_misalignment_tag);
+
+  // Pops the magnetometer samples up to to_time, and averages them (see average_mag_samples). Returns
+  // nullptr if the newest one isn't close to to_time.
+  MagMeasurement::Ptr AverageMagSamples(seconds_t to_time, seconds_t allowed_misalignment_mag);
 
   // Smart the backend smoother with an initial timestamp and pose.
   void SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_body);
   void FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body);
 
-  // Updates the smoother_result_ (threadsafe), and calls any stored smoother callbacks.
+  // Publish a new filter state to GetFilterState(), and to the filter result callbacks (on this
+  // thread, or on FilterCallbackLoop() if filter_async_callbacks is set).
+  void PublishFilterState(const StateStamped& state);
+
+  // Calls the filter result callbacks with the latest state whenever there is a new one.
+  void FilterCallbackLoop();
+
+  // In lockstep mode, advance the simulated clock before data for time t is pushed.
+  void LockstepBeginReceive(timestamp_t t);
+
+  // In lockstep mode, wake up the stages that were given data, and block until they're all done.
+  void LockstepEndReceive(bool filter, bool frontend);
+
+  // Updates the smoother_result_ (and publishes it to other threads), and calls any stored smoother
+  // callbacks.
   void OnSmootherResult(const SmootherResult& result);
 
+  // Copies the latest filter state (if any) into a checkpoint with the given smoother result.
+  void MakeCheckpoint(const SmootherResult& result, EstimatorCheckpoint& checkpoint);
+
+  // Starts writing a checkpoint to checkpoint_path, if one is due (see checkpoint_interval_sec).
+  // Only one write runs at a time, so if the last one is still going, this result is skipped.
+  void MaybeWriteCheckpoint(const SmootherResult& result);
+
   // Central function to change the state of the smoother. If VISION_AVAILABLE, it will try create
   // new keyposes from vision. If VISION_UNAVAILABLE, it will use IMU preintegration to create new
   // keyposes.
   void UpdateSmootherMode(SmootherMode mode);
 
+  // Registers everything that goes in stats_ (see stat_ids_), once the aux rigs are constructed.
+  void RegisterStats();
+
+  // Reports how much the queues hold to the MemoryRegistry (see memory_report_ids_).
+  void RegisterMemoryReports();
+
+  // If the thread was signalled since it last woke up, adds how long it took to stats_.
+  void RecordWakeLatency(WakeLatency& wake, StatId stat_id);
+
+  // Adds the factor counts and timing from the last smoother update to stats_.
+  void RecordSmootherStats(const FixedLagSmoother::UpdateStats& stats);
+
+  // Removes ranges that disagree with the filter state (see range_gate_max_mahalanobis_sq), and adds
+  // the number removed to stats_. The ranges should all be from about the same time.
+  // num_rejects counts how many were dropped in a row.
+  void GateRangesWithFilter(MultiRange& ranges,
+                            const StateStamped& state,
+                            int& num_rejects,
+                            const std::string& name,
+                            StatId stat_id);
+
  private:
+  StartupProfile startup_{"StateEstimator"};  // First, so that it times the whole constructor.
   Params params_;
   StereoCamera stereo_rig_;
   std::atomic_bool is_shutdown_;  // Set this to trigger a *graceful* shutdown.
 
+  std::mutex mutex_tunables_;     // Only one UpdateTunables() at a time.
+  ParamsSnapshot<Tunables> tunables_;
+
   Axis3 depth_axis_ = Axis3::Y;
   double depth_sign_ = 1.0;
 
-  StereoFrontend stereo_frontend_;
-  ThreadsafeQueue<StereoImage1b> raw_stereo_queue_;
+  std::unique_ptr<StereoFrontend> stereo_frontend_;   // Constructed in parallel with the others.
+  KeyframePolicy keyframe_policy_;
+  OverloadController overload_controller_;
+  PowerGovernor power_governor_;
+  std::vector<FeatureTracksCallback> feature_tracks_callbacks_;
+  SpscQueue<StereoImage1b> raw_stereo_queue_;
+
+  // Gyro measurements for rotation priors (only if use_gyro_rotation_prior). The frontend thread
+  // owns the rest of this.
+  GyroManager frontend_gyro_manager_;
+  seconds_t frontend_prev_time_ = -1;         // Last image that was tracked (-1 = none yet).
+  bool frontend_skipped_prev_ = false;        // Was the last image skipped for fast motion?
+
+  // Only used if estimate_imu_time_offset. The ingest thread owns imu_prev_corrected_, and whichever
+  // thread calls HandleVoResult() owns the vo_prev_* state.
+  TimeOffsetEstimator time_offset_estimator_;
+  timestamp_t imu_prev_corrected_ = 0;        // Corrected timestamps never go backwards.
+  bool vo_has_prev_ = false;
+  timestamp_t vo_prev_timestamp_ = 0;
+  timestamp_t vo_prev_timestamp_lkf_ = 0;
+  Matrix4d vo_prev_lkf_T_cam_ = Matrix4d::Identity();
+
+  // Tracked frames waiting for their pose solve. Every frame has to make it to the solve stage, so
+  // when this is full the tracking stage waits on stereo_solve_notifier_ instead of dropping one.
+  SpscQueue<StereoFrontend::TrackingResult> stereo_solve_queue_;
+  Notifier stereo_solve_notifier_;    // Notified when the solve stage pops a tracked frame.
 
   std::thread stereo_frontend_thread_;
+  std::thread stereo_solve_thread_;
   std::thread smoother_thread_;
   std::thread filter_thread_;
+  std::thread filter_callback_thread_;
+
+  // Shared by the smoother and filter readers below, so they must be constructed first.
+  DepthBuffer depth_buffer_;
+  RangeBuffer range_buffer_;
 
   //================================================================================================
-  std::mutex mutex_smoother_result_;
+  Notifier smoother_notifier_;    // Notified when any of the smoother's inputs get data.
   SmootherMode smoother_mode_ = SmootherMode::VISION_UNAVAILABLE;
-  SmootherResult smoother_result_;
+  SmootherResult smoother_result_;                      // Only used by the smoother thread.
+  SeqLock<SmootherResult> published_smoother_result_;  // Copy of smoother_result_ for other threads.
   std::atomic_bool smoother_update_flag_{false};
   ImuManager smoother_imu_manager_;
-  ThreadsafeQueue<VoResult> smoother_vo_queue_;
+  SpscQueue<VoResult> smoother_vo_queue_;
   DepthManager smoother_depth_manager_;
   RangeManager smoother_range_manager_;
   MagManager smoother_mag_manager_;
+  TagPoseManager smoother_tag_manager_;
+  std::vector<MagMeasurement> smoother_mag_samples_;  // Kept to avoid reallocating.
   std::vector<SmootherResult::Callback> smoother_result_callbacks_;
+  std::unique_ptr<SmootherLogWriter> smoother_log_;   // Only if smoother_log_path is set.
+  std::unique_ptr<SlowFrameRecorder> slow_frames_;    // Only if slow_frame_folder is set.
+  std::atomic<int> smoother_factor_slots_{0};         // For the slow frame records.
+
+  std::unique_ptr<EstimatorCheckpoint> resume_checkpoint_;  // Only for a warm restart.
+  std::atomic_bool checkpoint_busy_{false};
+  seconds_t last_checkpoint_time_ = 0;                      // Only used by the smoother thread.
+
+  std::unique_ptr<TagLocalizer> tag_localizer_;       // Only if use_tags is set.
+
+  // Everything that belongs to one aux stereo rig (see aux_stereo_rigs).
+  struct AuxRig final
+  {
+    MACRO_DELETE_COPY_CONSTRUCTORS(AuxRig)
+    MACRO_DELETE_DEFAULT_CONSTRUCTOR(AuxRig)
+
+    AuxRig(const AuxStereoRig& rig,
+           const StereoFrontend::Params& frontend_params,
+           int max_queue_size,
+           double max_hz);
+
+    std::string name;
+    StereoFrontend frontend;
+    SpscQueue<StereoImage1b> raw_stereo_queue;
+    AuxVoManager vo_manager;            // Reliable keyframes, for the smoother.
+    DataSubsampler subsampler;          // Only used by ReceiveAuxStereo().
+    bool subsample = false;
+    std::atomic<size_t> num_shed{0};    // Images dropped by load shedding.
+    std::thread thread;
+    StatId stat_frontend = 0;
+    StatId stat_lmk_observed = 0;
+  };
+
+  std::vector<std::unique_ptr<AuxRig>> aux_rigs_;     // Constructed in parallel with the others.
+  std::atomic_bool aux_rigs_shed_{false};
+  std::atomic_bool tag_detection_busy_{false};
+  std::atomic<timestamp_t> tag_detection_timestamp_{0}; // Keyframe being searched for tags (0 = none).
   //================================================================================================
+  Notifier filter_notifier_;      // Notified when any of the filter's inputs get data.
   ImuManager filter_imu_manager_;
   DepthManager filter_depth_manager_;
   RangeManager filter_range_manager_;
   std::vector<StateStamped::Callback> filter_result_callbacks_;
+
+  // The latest filter state, for GetFilterState() and gating the smoother's ranges.
+  SeqLock<StateStamped> filter_state_;
+  bool async_filter_callbacks_ = false;   // Set once, before the threads start.
+  Notifier filter_callback_notifier_;     // Notified whenever filter_state_ changes.
+
+  // For GetPose(). Written by the filter and smoother threads (one each).
+  PoseHistory filter_poses_;
+  PoseHistory smoother_poses_;
+
+  int smoother_range_rejects_ = 0;
+  int filter_range_rejects_ = 0;
   //================================================================================================
 
   StatsTracker stats_;
+  std::vector<size_t> memory_report_ids_;   // See MemoryRegistry.
+
+  // NOTE(milo): Every scalar is registered up front, so adding to stats_ from any thread is just
+  // a lock-free write. stats_ prints them all from its own thread.
+  struct StatIds final
+  {
+    StatId checkpoint_write = 0;
+    StatId overload_frames_skipped = 0;
+    StatId low_quality_frames_skipped = 0;
+    StatId frontend_relocalized = 0;
+    StatId fast_motion_frames_skipped = 0;
+    StatId imu_time_offset = 0;
+    StatId tag_detections_skipped = 0;
+    StatId tag_detection = 0;
+    StatId smoother_tag_wait = 0;
+    StatId smoother_attitude_samples = 0;
+    StatId smoother_mag_samples = 0;
+    StatId smoother_ranges_rejected = 0;
+    StatId filter_ranges_rejected = 0;
+    StatId frontend_wake_latency = 0;
+    StatId smoother_wake_latency = 0;
+    StatId filter_wake_latency = 0;
+    StatId smoother_factors = 0;
+    StatId smoother_lmk_factors = 0;
+    StatId smoother_lmk_observed = 0;
+    StatId smoother_aux_lmk_observed = 0;
+    StatId smoother_lmk_factors_added = 0;
+    StatId smoother_lmk_factors_removed = 0;
+    StatId smoother_extra_iters = 0;
+    StatId smoother_isam_update = 0;
+    StatId smoother_keyposes = 0;
+    StatId smoother_values = 0;
+    StatId smoother_factor_slots = 0;
+    StatId smoother_lmk_tracks = 0;
+    StatId smoother_lmk_track_obs = 0;
+    StatId process_rss = 0;
+    StatId smoother_update_no_vision = 0;
+    StatId smoother_update_with_vision = 0;
+    StatId smoother_catchup_keyposes = 0;
+    StatId slow_frames_dumped = 0;
+    StatId overload_level = 0;
+    StatId power_governor_rung = 0;
+    StatId power_governor_frames_skipped = 0;
+    StatId energy_per_estimate = 0;
+    StatId keyframe_min_interval = 0;
+    StatId smoother_marginal_covariance = 0;
+    StatId filter_callback_states_skipped = 0;
+  };
+  StatIds stat_ids_;
+
+  // Time from data arriving to each thread starting on it (see WakeLatency).
+  WakeLatency frontend_wake_;
+  WakeLatency smoother_wake_;
+  WakeLatency filter_wake_;
+
+  // When the newest IMU measurement arrived, for the latency of IMU-only keyposes.
+  std::atomic<steady_ns_t> newest_imu_received_{0};
+
+  //================================================================================================
+  Lockstep lockstep_;
+  Lockstep::Stage frontend_stage_;
+  Lockstep::Stage solve_stage_;
+  Lockstep::Stage smoother_stage_;
+  Lockstep::Stage filter_stage_;
+  std::atomic<seconds_t> sim_time_{0};
+  //================================================================================================
 };
 
 }
@@ -8,23 +8,17 @@
 namespace bm {
 namespace vio {
 
-static const size_t kWaitForDataMilliseconds = 100;
+// Threads that block waiting for data wake up at least this often to check for shutdown.
+static const double kWaitForShutdownSec = 0.1;
 
 using namespace core;
 
-// Waits for a queue item for timeout_sec. Returns whether an item arrived before the timeout.
+// Waits for a queue item for timeout_sec. Returns true if the wait timed out (queue still empty).
+// NOTE(milo): The queue wakes us up as soon as an item is pushed, so there's no polling latency.
 template <typename QueueType>
 bool WaitForResultOrTimeout(QueueType& queue, double timeout_sec)
 {
-  double elapsed = 0;
-  const size_t ms_each_wait = (timeout_sec < kWaitForDataMilliseconds) ?
-                               kWaitForDataMilliseconds / 5 : kWaitForDataMilliseconds;
-  while (queue.Empty() && elapsed < timeout_sec) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(ms_each_wait));
-    elapsed += 1e-3 * static_cast<double>(ms_each_wait);
-  }
-
-  return queue.Empty();
+  return !queue.WaitNonEmpty(timeout_sec);
 }
 
 
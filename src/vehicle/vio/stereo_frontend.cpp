@@ -1,11 +1,18 @@
+#include <algorithm>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <glog/logging.h>
 
 #include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
 
 #include "core/math_util.hpp"
 #include "core/timer.hpp"
+#include "core/transform_util.hpp"
+#include "core/profiler.hpp"
+#include "core/task_scheduler.hpp"
+#include "vio/landmark_budget.hpp"
 #include "vio/optimize_odometry.hpp"
 #include "vio/stereo_frontend.hpp"
 #include "feature_tracking/visualization_2d.hpp"
@@ -18,29 +25,115 @@ void StereoFrontend::Params::LoadParams(const YamlParser& parser)
 {
   // Each sub-module has a subtree in the params.yaml.
   tracker_params = StereoTracker::Params(parser.GetNode("StereoTracker"));
+  parser.GetParam("track_pyramid_level", &track_pyramid_level);
+  parser.GetParam("refine_full_res", &refine_full_res);
+  parser.GetParam("refine_winsize", &refine_winsize);
+  parser.GetParam("track_lines", &track_lines);
+  if (track_lines) {
+    line_tracker_params = StereoLineTracker::Params(parser.GetNode("StereoLineTracker"));
+  }
+  parser.GetParam("gate_frame_quality", &gate_frame_quality);
+  parser.GetParam("quality_pyramid_level", &quality_pyramid_level);
+  parser.GetParam("min_gradient_energy", &min_gradient_energy);
+  parser.GetParam("max_saturated_fraction", &max_saturated_fraction);
+  parser.GetParam("max_haze", &max_haze);
+  parser.GetParam("quality_max_skipped", &quality_max_skipped);
   parser.GetParam("max_avg_reprojection_error", &max_avg_reprojection_error);
   parser.GetParam("sigma_tracked_point", &sigma_tracked_point);
   parser.GetParam("lm_max_iters", &lm_max_iters);
   parser.GetParam("lm_max_error_stdevs", &lm_max_error_stdevs);
   parser.GetParam("kill_nonrigid_lmks", &kill_nonrigid_lmks);
+  parser.GetParam("use_ransac", &use_ransac);
+  parser.GetParam("ransac_max_hypotheses", &ransac_max_hypotheses);
+  parser.GetParam("ransac_confidence", &ransac_confidence);
+  parser.GetParam("ransac_prior_inlier_ratio", &ransac_prior_inlier_ratio);
+  parser.GetParam("pose_solve_max_lmks", &pose_solve_max_lmks);
+  parser.GetParam("local_ba_keyframes", &local_ba_keyframes);
+  parser.GetParam("local_ba_iters", &local_ba_iters);
+  parser.GetParam("use_keyframe_database", &use_keyframe_database);
+  parser.GetParam("reloc_blocking", &reloc_blocking);
+  parser.GetParam("reloc_max_keyframes", &reloc_max_keyframes);
+  parser.GetParam("reloc_min_inliers", &reloc_min_inliers);
 
   YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_left, body_T_right);
 
+  CHECK(track_pyramid_level >= 0 && track_pyramid_level <= 2) << "track_pyramid_level must be 0, 1 or 2" << std::endl;
+  CHECK_GE(refine_winsize, 2);
+  CHECK_GE(quality_pyramid_level, 0);
+  CHECK_GE(quality_max_skipped, 0);
   CHECK_GE(sigma_tracked_point, 1.0);
   CHECK_GE(lm_max_iters, 5);
   CHECK_GE(lm_max_error_stdevs, 1.0);
+  CHECK_GE(ransac_max_hypotheses, 1);
+  CHECK(ransac_confidence > 0 && ransac_confidence < 1);
+  CHECK(pose_solve_max_lmks == 0 || pose_solve_max_lmks > 6) << "LM needs more than 6 landmarks" << std::endl;
+  CHECK_GE(local_ba_keyframes, 0);
+  CHECK_GE(local_ba_iters, 1);
+  CHECK_GE(reloc_max_keyframes, 1);
+  CHECK_GE(reloc_min_inliers, 6);
+}
+
+
+// The stereo rig for images that were cv::pyrDown'd "level" times. Pixel (u, v) at the level is at
+// (scale * u, scale * v) in the full size image, so unlike PinholeCamera::Rescale (which scales by
+// the ratio of the image sizes) this divides by scale exactly, even if the full size is odd.
+static StereoCamera ScaledStereoRig(const StereoCamera& rig, int level)
+{
+  if (level == 0) {
+    return rig;
+  }
+
+  int height = rig.Height();
+  int width = rig.Width();
+  for (int i = 0; i < level; ++i) {
+    height = (height + 1) / 2;
+    width = (width + 1) / 2;
+  }
+
+  const double s = static_cast<double>(1 << level);
+  const auto scaled = [&](const PinholeCamera& cam) {
+    return PinholeCamera(cam.fx() / s, cam.fy() / s, cam.cx() / s, cam.cy() / s, height, width);
+  };
+  return StereoCamera(scaled(rig.LeftCamera()), scaled(rig.RightCamera()), rig.Extrinsics());
 }
 
 
 StereoFrontend::StereoFrontend(const Params& params)
     : params_(params),
-      stereo_rig_(params.stereo_rig),
+      track_scale_(1 << params.track_pyramid_level),
+      stereo_rig_(ScaledStereoRig(params.stereo_rig, params.track_pyramid_level)),
       tracker_(params_.tracker_params, stereo_rig_)
 {
+#ifdef BM_ENABLE_LINE_FEATURES
+  if (params_.track_lines) {
+    line_tracker_.reset(new StereoLineTracker(params_.line_tracker_params, stereo_rig_));
+  }
+#else
+  LOG_IF(WARNING, params_.track_lines) << "StereoFrontend: built without BM_ENABLE_LINE_FEATURES, not tracking lines" << std::endl;
+  params_.track_lines = false;
+#endif
+
+  if (params_.use_keyframe_database) {
+    KeyframeDatabaseParams db_params;
+    db_params.max_keyframes = params_.reloc_max_keyframes;
+    db_params.min_inliers = params_.reloc_min_inliers;
+    db_params.sigma_px = params_.sigma_tracked_point;
+    db_params.max_error_stdevs = params_.lm_max_error_stdevs;
+    kf_database_.reset(new KeyframeDatabase(db_params, stereo_rig_));
+  }
+
   LOG(INFO) << "Constructed StereoFrontend!" << std::endl;
 }
 
 
+StereoFrontend::~StereoFrontend()
+{
+  std::unique_lock<std::mutex> lock(mutex_reloc_);
+  reloc_jobs_.clear();
+  cv_reloc_idle_.wait(lock, [this]() { return !reloc_busy_; });
+}
+
+
 // Helper function to grab an observation that was observed from query_camera_id.
 // Returns whether or not the query was successful.
 static bool FindObservationFromCameraId(const VecLandmarkObservation& lmk_obs,
@@ -60,69 +153,296 @@ static bool FindObservationFromCameraId(const VecLandmarkObservation& lmk_obs,
 }
 
 
+bool StereoFrontend::CheckFrameQuality(const StereoImage1b& stereo_pair, FrameQuality* quality)
+{
+  if (!params_.gate_frame_quality) {
+    return true;
+  }
+
+  // The quality level is relative to full resolution.
+  const FrameQuality q = tracker_.PrepareFrame(*TrackingPair(stereo_pair),
+      std::max(0, params_.quality_pyramid_level - params_.track_pyramid_level));
+  if (quality) {
+    *quality = q;
+  }
+
+  const bool is_good = q.gradient_energy >= params_.min_gradient_energy &&
+                       q.saturated_fraction <= params_.max_saturated_fraction &&
+                       q.haze <= params_.max_haze;
+
+  if (is_good || num_low_quality_skipped_ >= params_.quality_max_skipped) {
+    num_low_quality_skipped_ = 0;
+    return true;
+  }
+
+  ++num_low_quality_skipped_;
+  return false;
+}
+
+
 VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
-                               const Matrix4d& prev_T_cur_prior)
+                               const Matrix4d* prev_T_cur_prior)
+{
+  MACRO_PROFILE_SCOPE("StereoFrontend::Track");
+  TrackingResult tracked = TrackFeatures(stereo_pair, prev_T_cur_prior);
+  return SolvePose(tracked, false);
+}
+
+
+std::shared_ptr<const StereoImage1b> StereoFrontend::TrackingPair(const StereoImage1b& stereo_pair) const
 {
-  VoResult result(stereo_pair.timestamp, timestamp_lkf_, stereo_pair.camera_id, prev_keyframe_id_);
+  typedef std::shared_ptr<const StereoImage1b> PairPtr;
+  if (params_.track_pyramid_level == 0) {
+    return std::make_shared<const StereoImage1b>(stereo_pair);
+  }
+
+  const std::string key = FrameCacheKey("vio::TrackingPair", params_.track_pyramid_level);
+  return *stereo_pair.cache->Get<PairPtr>(key, [this, &stereo_pair](PairPtr& out) {
+    MACRO_PROFILE_SCOPE("StereoFrontend::TrackingPair");
+    Image1b images[2] = { stereo_pair.left_image, stereo_pair.right_image };
+    TaskScheduler::Instance().ParallelFor(TaskPriority::FRONTEND, 2, [&](int i) {
+      for (int level = 0; level < params_.track_pyramid_level; ++level) {
+        Image1b down;
+        cv::pyrDown(images[i], down);
+        images[i] = down;
+      }
+    }, 1);
 
-  const bool is_keyframe = tracker_.TrackAndTriangulate(stereo_pair, false);
+    std::shared_ptr<StereoImage1b> pair = std::make_shared<StereoImage1b>(
+        stereo_pair.timestamp, stereo_pair.camera_id, images[0], images[1]);
+    pair->latency = stereo_pair.latency;
+    out = pair;
+  });
+}
+
+
+void StereoFrontend::ScaleToFullResolution(const StereoImage1b& stereo_pair, VoResult& result) const
+{
+  const float s = static_cast<float>(track_scale_);
+  LandmarkObservationBatch& obs = result.lmk_obs;
+  for (size_t i = 0; i < obs.Size(); ++i) {
+    obs.pixel_location[i] *= s;
+    obs.disparity[i] *= s;
+  }
+  for (LineObservation& line : result.line_obs) {
+    line.p0 *= static_cast<double>(s);
+    line.p1 *= static_cast<double>(s);
+    line.disp_p0 *= s;
+    line.disp_p1 *= s;
+  }
+
+  if (!params_.refine_full_res || obs.Empty()) {
+    return;
+  }
+
+  MACRO_PROFILE_SCOPE("StereoFrontend::RefineFullRes");
+
+  // The right image points come from the disparities (the tracker doesn't keep them).
+  VecPoint2f left = obs.pixel_location;
+  VecPoint2f right(obs.Size());
+  for (size_t i = 0; i < obs.Size(); ++i) {
+    right[i] = left[i] - cv::Point2f(std::max(0.0f, obs.disparity[i]), 0);
+  }
+
+  const cv::Size win(params_.refine_winsize, params_.refine_winsize);
+  const cv::TermCriteria criteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 10, 0.01);
+  TaskScheduler::Instance().ParallelFor(TaskPriority::FRONTEND, 2, [&](int i) {
+    cv::cornerSubPix((i == 0) ? stereo_pair.left_image : stereo_pair.right_image,
+                     (i == 0) ? left : right, win, cv::Size(-1, -1), criteria);
+  }, 1);
+
+  // NOTE(milo): A tracked point is within a pixel of the truth at the tracking level, so anything
+  // that moved further than that slid along an edge (cornerSubPix only converges on corners), and
+  // keeps its tracked location. The left and right points are only refined together, so that the
+  // disparity stays consistent with them.
+  const float max_shift = s;
+  for (size_t i = 0; i < obs.Size(); ++i) {
+    const cv::Point2f right0 = obs.pixel_location[i] - cv::Point2f(obs.disparity[i], 0);
+    if (cv::norm(left[i] - obs.pixel_location[i]) > max_shift) {
+      continue;
+    }
+    if (obs.disparity[i] > 0) {
+      const float disp = left[i].x - right[i].x;
+      if (cv::norm(right[i] - right0) > max_shift || std::fabs(left[i].y - right[i].y) > max_shift || disp <= 0) {
+        continue;
+      }
+      obs.disparity[i] = disp;
+    }
+    obs.pixel_location[i] = left[i];
+  }
+}
+
+
+StereoFrontend::TrackingResult StereoFrontend::TrackFeatures(const StereoImage1b& full_pair,
+                                                             const Matrix4d* prev_T_cur_prior)
+{
+  MACRO_PROFILE_SCOPE("StereoFrontend::TrackFeatures");
+
+  // Everything below is at tracking resolution, until the observations are scaled up at the end.
+  const std::shared_ptr<const StereoImage1b> tracking_pair = TrackingPair(full_pair);
+  const StereoImage1b& stereo_pair = *tracking_pair;
+
+  // Kill any outliers that a pipelined SolvePose() found since the last frame.
+  mutex_kill_lmk_ids_.lock();
+  for (const uid_t lmk_id : kill_lmk_ids_) {
+    tracker_.KillLandmark(lmk_id);
+  }
+  kill_lmk_ids_.clear();
+  mutex_kill_lmk_ids_.unlock();
+
+  Matrix3d prev_R_cur;
+  if (prev_T_cur_prior) {
+    prev_R_cur = prev_T_cur_prior->block<3, 3>(0, 0);
+  }
+  const Matrix3d* prev_R_cur_ptr = prev_T_cur_prior ? &prev_R_cur : nullptr;
+
+  // Lines don't depend on the keyframe decision until they're associated, so they're detected while
+  // the points are tracked.
+  bool is_keyframe = false;
+  if (line_tracker_) {
+    TaskScheduler::Instance().ParallelFor(TaskPriority::FRONTEND, 2, [&](int i) {
+      if (i == 0) {
+        is_keyframe = tracker_.TrackAndTriangulate(stereo_pair, false, prev_R_cur_ptr);
+      } else {
+        line_tracker_->Detect(stereo_pair);
+      }
+    }, 1);
+  } else {
+    is_keyframe = tracker_.TrackAndTriangulate(stereo_pair, false, prev_R_cur_ptr);
+  }
+
+  TrackingResult tracked(
+      VoResult(stereo_pair.timestamp, timestamp_lkf_, stereo_pair.camera_id, prev_keyframe_id_),
+      is_keyframe);
+  VoResult& result = tracked.result;
+  result.is_keyframe = is_keyframe;
+  tracked.has_rotation_prior = prev_T_cur_prior != nullptr;
+  if (prev_T_cur_prior) {
+    tracked.prev_R_cur_prior = prev_R_cur;
+  }
 
   const FeatureTracks& live_tracks = tracker_.GetLiveTracks();
 
   // Get landmarks that were tracked into the current frame.
   std::vector<uid_t> lmk_ids;
   std::vector<cv::Point2f> lmk_points;
-  // std::vector<double> lmk_disps;
-
-  for (auto it = live_tracks.begin(); it != live_tracks.end(); ++it) {
-    const uid_t lmk_id = it->first;
-    const LandmarkObservation& lmk_obs = it->second.back();
+  std::vector<double> lmk_disps;
 
-    const size_t num_obs = it->second.size();
+  for (const FeatureTracks::Track& track : live_tracks) {
+    const uid_t lmk_id = track.lmk_id;
+    const LandmarkObservation& lmk_obs = track.observations.back();
 
     // Skip observations from previous frames.
     if (lmk_obs.camera_id != stereo_pair.camera_id) {
       continue;
     }
     lmk_points.emplace_back(lmk_obs.pixel_location);
-    // lmk_disps.emplace_back(lmk_obs.disparity);
+    lmk_disps.emplace_back(lmk_obs.disparity);
     lmk_ids.emplace_back(lmk_id);
 
-    result.lmk_obs.emplace_back(lmk_obs);
+    result.lmk_obs.Add(lmk_obs);
   }
 
-  if (result.lmk_obs.empty()) {
+  if (line_tracker_) {
+    line_tracker_->Associate(stereo_pair.camera_id, is_keyframe, result.line_obs);
+  }
+
+  if (track_scale_ > 1) {
+    ScaleToFullResolution(full_pair, result);
+  }
+
+  if (result.lmk_obs.Empty()) {
     result.status |= Status::NO_FEATURES_FROM_LAST_KF;
   }
 
   // FAILURE: If too few points for effective odometry estimate, return.
   // NOTE(milo): This flag will be set for the FIRST image, since no features are tracked upon
   // initialization.
-  if (result.lmk_obs.size() < 6) {
+  if (result.lmk_obs.Size() < 6) {
     result.status |= StereoFrontend::Status::FEW_TRACKED_FEATURES;
     if (is_keyframe) { result.status |= Status::FEW_DETECTED_FEATURES; }
   }
 
-  //==================== LEAST-SQUARES ODOMETRY OPTIMIZATION ===================
-  // Get landmarks that were observed in the current frame AND the previous keyframe.
-  std::vector<Vector3d> lmk_pts_prev_kf_3d;
-  std::vector<Vector2d> lmk_pts_curr_f_2d;
-  std::vector<uid_t> lmk_ids_prev_kf;
-
+  // Get landmarks that were observed in the current frame AND the previous keyframe, and
+  // triangulate them all at once.
+  std::vector<Vector2d> lkf_pixels;
+  std::vector<double> lkf_disps;
   for (size_t i = 0; i < lmk_ids.size(); ++i) {
     const uid_t lmk_id = lmk_ids.at(i);
-    const VecLmkObs& lmk_obs = live_tracks.at(lmk_id);
+    const VecLmkObs& lmk_obs = live_tracks.Get(lmk_id);
     cv::Point2f pt;
     double disp;
     if (FindObservationFromCameraId(lmk_obs, prev_keyframe_id_, pt, disp)) {
-      CHECK_GT(disp, 0);
-      const Vector3d p_lkf = stereo_rig_.LeftCamera().Backproject(Vector2d(pt.x, pt.y), stereo_rig_.DispToDepth(disp));
-      lmk_pts_prev_kf_3d.emplace_back(p_lkf);
-      lmk_pts_curr_f_2d.emplace_back(lmk_points.at(i).x, lmk_points.at(i).y);
-      lmk_ids_prev_kf.emplace_back(lmk_id);
+      lkf_pixels.emplace_back(pt.x, pt.y);
+      lkf_disps.emplace_back(disp);
+      tracked.lmk_pts_curr_f_2d.emplace_back(lmk_points.at(i).x, lmk_points.at(i).y);
+      tracked.lmk_ids_prev_kf.emplace_back(lmk_id);
+
+      // RANSAC hypotheses need the landmark in this frame too. Ones without a disparity here can
+      // still be scored, just not sampled.
+      if (params_.use_ransac) {
+        const double curr_disp = lmk_disps.at(i);
+        tracked.lmk_pts_curr_f_3d.emplace_back(curr_disp > 0 ?
+            stereo_rig_.LeftCamera().Backproject(tracked.lmk_pts_curr_f_2d.back(), stereo_rig_.DispToDepth(curr_disp)) :
+            Vector3d::Zero());
+      }
+    }
+  }
+  stereo_rig_.Triangulate(lkf_pixels, lkf_disps, tracked.lmk_pts_prev_kf_3d);
+
+  // Every keyframe goes into the database. One that has too few landmarks from the last keyframe
+  // for odometry (see SolvePose()) is also looked up in it.
+  if (kf_database_ && is_keyframe) {
+    RelocJob job;
+    job.camera_id = stereo_pair.camera_id;
+    job.timestamp = stereo_pair.timestamp;
+    job.left_image = stereo_pair.left_image;
+    job.pixels.reserve(lmk_points.size());
+    for (size_t i = 0; i < lmk_points.size(); ++i) {
+      job.pixels.emplace_back(lmk_points[i].x, lmk_points[i].y);
+    }
+    job.disps = lmk_disps;
+    job.is_lost = tracked.lmk_pts_prev_kf_3d.size() <= 6;
+    QueueRelocJob(std::move(job));
+  }
+
+  // Houskeeping for the tracking stage. The pose solve does its own when it sees this result.
+  if (is_keyframe) {
+    timestamp_lkf_ = stereo_pair.timestamp;
+    prev_keyframe_id_ = stereo_pair.camera_id;
+  }
+
+  // Grab every observation of a live landmark from the recent keyframes, since the pose solve
+  // stage can't look at the tracker.
+  if (is_keyframe && params_.local_ba_keyframes >= 2) {
+    recent_keyframe_ids_.emplace_back(stereo_pair.camera_id);
+    while ((int)recent_keyframe_ids_.size() > params_.local_ba_keyframes) {
+      recent_keyframe_ids_.pop_front();
+    }
+
+    for (const FeatureTracks::Track& track : live_tracks) {
+      for (const LandmarkObservation& lmk_obs : track.observations) {
+        if (std::find(recent_keyframe_ids_.begin(), recent_keyframe_ids_.end(), lmk_obs.camera_id) != recent_keyframe_ids_.end()) {
+          tracked.ba_obs.emplace_back(lmk_obs);
+        }
+      }
     }
   }
 
+  return tracked;
+}
+
+
+VoResult StereoFrontend::SolvePose(TrackingResult& tracked, bool pipelined)
+{
+  MACRO_PROFILE_SCOPE("StereoFrontend::SolvePose");
+  VoResult& result = tracked.result;
+
+  //==================== LEAST-SQUARES ODOMETRY OPTIMIZATION ===================
+  const std::vector<Vector3d>& lmk_pts_prev_kf_3d = tracked.lmk_pts_prev_kf_3d;
+  const std::vector<Vector2d>& lmk_pts_curr_f_2d = tracked.lmk_pts_curr_f_2d;
+  const std::vector<uid_t>& lmk_ids_prev_kf = tracked.lmk_ids_prev_kf;
+
   // Can only do LM odometry estimation if enough points in the prev keframe and cur frame.
   if (lmk_pts_prev_kf_3d.size() > 6) {
     Matrix6d C_cur_lkf = Matrix6d::Identity();
@@ -130,26 +450,152 @@ VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
 
     std::vector<int> lm_inlier_indices, lm_outlier_indices;
 
-    const int iters = OptimizeOdometryIterative(
-        lmk_pts_prev_kf_3d,
-        lmk_pts_curr_f_2d,
-        lmk_pts_sigma,
-        stereo_rig_,
-        cur_T_lkf_,
-        C_cur_lkf,
-        result.avg_reprojection_err,
-        lm_inlier_indices,
-        lm_outlier_indices,
-        params_.lm_max_iters,
-        1e-3,
-        1e-6,
-        params_.lm_max_error_stdevs);
+    // Find the inliers (and a good starting pose) first, so that LM doesn't have to fight the
+    // outliers. If RANSAC fails, LM gets every point like before.
+    std::vector<int> ransac_inlier_indices;
+    bool have_ransac = false;
+    if (params_.use_ransac) {
+      // The last odometry is from the previous frame, so rotating it by the IMU gives a guess for
+      // this one (the translation between two frames is small next to the landmark depths).
+      Matrix4d cur_T_lkf_prior = cur_T_lkf_;
+      if (tracked.has_rotation_prior) {
+        cur_T_lkf_prior.block<3, 3>(0, 0) = tracked.prev_R_cur_prior.transpose() * cur_T_lkf_.block<3, 3>(0, 0);
+        cur_T_lkf_prior.block<3, 1>(0, 3) = tracked.prev_R_cur_prior.transpose() * cur_T_lkf_.block<3, 1>(0, 3);
+      }
+
+      OdometryRansacParams ransac_params;
+      ransac_params.max_hypotheses = params_.ransac_max_hypotheses;
+      ransac_params.confidence = params_.ransac_confidence;
+      ransac_params.max_error_stdevs = params_.lm_max_error_stdevs;
+      ransac_params.prior_inlier_ratio = params_.ransac_prior_inlier_ratio;
+
+      Matrix4d cur_T_lkf_ransac;
+      have_ransac = RansacOdometry(
+          lmk_pts_prev_kf_3d,
+          tracked.lmk_pts_curr_f_3d,
+          lmk_pts_curr_f_2d,
+          lmk_pts_sigma,
+          stereo_rig_,
+          &cur_T_lkf_prior,
+          ransac_params,
+          cur_T_lkf_ransac,
+          ransac_inlier_indices,
+          odom_workspace_) >= 0;
+
+      if (have_ransac) {
+        cur_T_lkf_ = cur_T_lkf_ransac;
+      }
+    }
+
+    // The points that LM runs on: RANSAC's inliers, or all of them.
+    const size_t num_pts = lmk_pts_prev_kf_3d.size();
+    std::vector<int> solve_indices;
+    if (have_ransac) {
+      solve_indices = ransac_inlier_indices;
+    }
+
+    // With a budget, only the most informative points (at the current pose guess) are solved with.
+    // The rest aren't outliers, but they aren't passed on to the smoother for this keyframe either.
+    std::vector<bool> is_unselected(num_pts, false);
+    const size_t num_candidates = have_ransac ? ransac_inlier_indices.size() : num_pts;
+    const bool use_budget = params_.pose_solve_max_lmks > 0 && (int)num_candidates > params_.pose_solve_max_lmks;
+
+    if (use_budget) {
+      if (!have_ransac) {
+        for (size_t i = 0; i < num_pts; ++i) {
+          solve_indices.emplace_back(i);
+        }
+      }
+
+      std::vector<Vector3d> cam_t_lmks;
+      cam_t_lmks.reserve(solve_indices.size());
+      for (const int idx : solve_indices) {
+        cam_t_lmks.emplace_back((cur_T_lkf_ * MakeHomogeneous(lmk_pts_prev_kf_3d.at(idx))).head<3>());
+      }
+
+      const PinholeCamera& cam = stereo_rig_.LeftCamera();
+      std::vector<int> selected = SelectInformativeLandmarks(
+          cam_t_lmks, cam.fx(), cam.fy(), params_.pose_solve_max_lmks);
+      std::sort(selected.begin(), selected.end());
+
+      std::vector<int> budget_indices;
+      budget_indices.reserve(selected.size());
+      for (const int j : selected) {
+        budget_indices.emplace_back(solve_indices.at(j));
+      }
+      for (const int idx : solve_indices) {
+        is_unselected.at(idx) = true;
+      }
+      for (const int idx : budget_indices) {
+        is_unselected.at(idx) = false;
+      }
+      solve_indices.swap(budget_indices);
+    }
+
+    int iters;
+    if (have_ransac || use_budget) {
+      std::vector<Vector3d> P0_inliers;
+      std::vector<Vector2d> p1_inliers;
+      P0_inliers.reserve(solve_indices.size());
+      p1_inliers.reserve(solve_indices.size());
+      for (const int idx : solve_indices) {
+        P0_inliers.emplace_back(lmk_pts_prev_kf_3d.at(idx));
+        p1_inliers.emplace_back(lmk_pts_curr_f_2d.at(idx));
+      }
+      const std::vector<double> sigma_inliers(P0_inliers.size(), params_.sigma_tracked_point);
+
+      std::vector<int> subset_inlier_indices, subset_outlier_indices;
+      iters = OptimizeOdometryIterative(
+          P0_inliers,
+          p1_inliers,
+          sigma_inliers,
+          stereo_rig_,
+          cur_T_lkf_,
+          C_cur_lkf,
+          result.avg_reprojection_err,
+          subset_inlier_indices,
+          subset_outlier_indices,
+          params_.lm_max_iters,
+          1e-3,
+          1e-6,
+          params_.lm_max_error_stdevs,
+          odom_workspace_);
+
+      // Map back to the tracked points. Everything RANSAC rejected is an outlier too.
+      std::vector<bool> is_inlier(num_pts, false);
+      for (const int idx : subset_inlier_indices) {
+        is_inlier.at(solve_indices.at(idx)) = true;
+      }
+      for (size_t i = 0; i < num_pts; ++i) {
+        if (is_inlier[i]) {
+          lm_inlier_indices.emplace_back(i);
+        } else if (!is_unselected[i]) {
+          lm_outlier_indices.emplace_back(i);
+        }
+      }
+    } else {
+      iters = OptimizeOdometryIterative(
+          lmk_pts_prev_kf_3d,
+          lmk_pts_curr_f_2d,
+          lmk_pts_sigma,
+          stereo_rig_,
+          cur_T_lkf_,
+          C_cur_lkf,
+          result.avg_reprojection_err,
+          lm_inlier_indices,
+          lm_outlier_indices,
+          params_.lm_max_iters,
+          1e-3,
+          1e-6,
+          params_.lm_max_error_stdevs,
+          odom_workspace_);
+    }
 
     // Returning -1 indicates an error in LM optimization.
     if (iters < 0 || result.avg_reprojection_err > params_.max_avg_reprojection_error) {
       result.status |= StereoFrontend::Status::ODOM_ESTIMATION_FAILED;
     }
-    result.lkf_T_cam = cur_T_lkf_.inverse();
+    result.lkf_T_cam = inverse_se3(cur_T_lkf_);
 
     //======================== REMOVE OUTLIER POINTS =============================
     std::unordered_set<uid_t> inlier_lmk_ids;
@@ -158,33 +604,231 @@ VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
       inlier_lmk_ids.insert(lmk_id);
     }
 
-    VecLmkObs inlier_obs;
-    for (const LandmarkObservation& lmk_obs : result.lmk_obs) {
-      if (inlier_lmk_ids.count(lmk_obs.landmark_id) != 0) {
-        inlier_obs.emplace_back(lmk_obs);
+    LandmarkObservationBatch inlier_obs;
+    inlier_obs.Reserve(inlier_lmk_ids.size());
+    for (size_t i = 0; i < result.lmk_obs.Size(); ++i) {
+      if (inlier_lmk_ids.count(result.lmk_obs.landmark_id[i]) != 0) {
+        inlier_obs.Add(result.lmk_obs, i);
       }
     }
 
     std::swap(inlier_obs, result.lmk_obs);
 
     if (params_.kill_nonrigid_lmks) {
+      // NOTE(milo): The tracker belongs to the tracking stage, so a pipelined solve hands the
+      // outliers back to it instead of touching the tracker from this thread.
+      if (pipelined) { mutex_kill_lmk_ids_.lock(); }
       for (const int idx : lm_outlier_indices) {
         const uid_t lmk_id = lmk_ids_prev_kf.at(idx);
-        tracker_.KillLandmark(lmk_id);
+        if (pipelined) {
+          kill_lmk_ids_.emplace_back(lmk_id);
+        } else {
+          tracker_.KillLandmark(lmk_id);
+        }
       }
+      if (pipelined) { mutex_kill_lmk_ids_.unlock(); }
     }
   }
 
+  if (tracked.is_keyframe && params_.local_ba_keyframes >= 2) {
+    RefineKeyframeWindow(tracked, result);
+  }
+
+  if (kf_database_ && tracked.is_keyframe) {
+    AttachRelocalization(result);
+  }
+
   // Houskeeping (need to do before early return).
-  if (is_keyframe) {
+  if (tracked.is_keyframe) {
     cur_T_lkf_ = Matrix4d::Identity();
-    timestamp_lkf_ = stereo_pair.timestamp;
-    prev_keyframe_id_ = stereo_pair.camera_id;
   }
 
-  return result;
+  return std::move(result);
+}
+
+
+void StereoFrontend::QueueRelocJob(RelocJob&& job)
+{
+  if (params_.reloc_blocking) {
+    RunRelocJob(job);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_reloc_);
+  reloc_jobs_.emplace_back(std::move(job));
+
+  // NOTE(milo): Keyframes are far apart, so this only fills up if the scheduler is swamped. Then
+  // it's better to lose a few old keyframes than to fall further behind.
+  while (reloc_jobs_.size() > 4) {
+    reloc_jobs_.pop_front();
+  }
+
+  // The tag detector and checkpoints use the same lane, below the frontend's own parallel work.
+  if (!reloc_busy_) {
+    reloc_busy_ = true;
+    TaskScheduler::Instance().Submit(TaskPriority::SMOOTHER, [this]() { DrainRelocJobs(); });
+  }
+}
+
+
+void StereoFrontend::DrainRelocJobs()
+{
+  std::unique_lock<std::mutex> lock(mutex_reloc_);
+  while (!reloc_jobs_.empty()) {
+    const RelocJob job = std::move(reloc_jobs_.front());
+    reloc_jobs_.pop_front();
+    lock.unlock();
+    RunRelocJob(job);
+    lock.lock();
+  }
+
+  reloc_busy_ = false;
+  cv_reloc_idle_.notify_all();
+}
+
+
+void StereoFrontend::RunRelocJob(const RelocJob& job)
+{
+  MACRO_PROFILE_SCOPE("StereoFrontend::RunRelocJob");
+
+  KeyframeFeatures features = ExtractKeyframeFeatures(
+      job.camera_id, job.timestamp, job.left_image, job.pixels, job.disps, stereo_rig_);
+
+  Relocalization reloc;
+  if (job.is_lost && kf_database_->Query(features, reloc)) {
+    LOG(INFO) << "Relocalized keyframe " << job.camera_id << " against keyframe " << reloc.camera_id_kf
+              << " (" << reloc.num_inliers << " inliers)" << std::endl;
+    std::lock_guard<std::mutex> lock(mutex_reloc_);
+    has_reloc_ = true;
+    reloc_camera_id_ = job.camera_id;
+    reloc_ = reloc;
+  }
+
+  kf_database_->Add(std::move(features));
 }
 
 
+void StereoFrontend::AttachRelocalization(VoResult& result)
+{
+  std::lock_guard<std::mutex> lock(mutex_reloc_);
+  if (!has_reloc_) {
+    return;
+  }
+
+  // The relocalized keyframe is either this one (if the query was fast enough), or the one that this
+  // result has odometry from. Otherwise, the chain of keyframes has already moved past it.
+  const bool odom_failed = (result.status & Status::ODOM_ESTIMATION_FAILED) ||
+                           (result.status & Status::FEW_TRACKED_FEATURES);
+  if (result.camera_id == reloc_camera_id_ && reloc_.camera_id_kf == result.camera_id_lkf) {
+    // Matched the keyframe that it couldn't be tracked from, so this is just its odometry.
+    result.lkf_T_cam = reloc_.kf_T_cam;
+    result.status |= Status::RELOCALIZED;
+    has_reloc_ = false;
+    return;
+  } else if (result.camera_id == reloc_camera_id_) {
+    result.reloc_kf_T_cam = reloc_.kf_T_cam;
+  } else if (result.camera_id_lkf == reloc_camera_id_ && !odom_failed) {
+    result.reloc_kf_T_cam = reloc_.kf_T_cam * result.lkf_T_cam;
+  } else {
+    has_reloc_ = result.camera_id < reloc_camera_id_;
+    return;
+  }
+
+  result.has_reloc = true;
+  result.reloc_timestamp_kf = reloc_.timestamp_kf;
+  result.reloc_camera_id_kf = reloc_.camera_id_kf;
+  result.status |= Status::RELOCALIZED;
+  has_reloc_ = false;
+}
+
+
+void StereoFrontend::RefineKeyframeWindow(const TrackingResult& tracked, VoResult& result)
+{
+  MACRO_PROFILE_SCOPE("StereoFrontend::RefineKeyframeWindow");
+
+  // If there's no odometry to the last keyframe, the window can't be connected. Start a new one.
+  const bool have_odom = tracked.lmk_pts_prev_kf_3d.size() > 6 &&
+                         !(result.status & Status::ODOM_ESTIMATION_FAILED);
+
+  if (!have_odom || ba_window_ids_.empty()) {
+    ba_window_ids_.clear();
+    ba_window_poses_.clear();
+    ba_window_ids_.emplace_back(result.camera_id);
+    ba_window_poses_.emplace_back(Matrix4d::Identity());
+    return;
+  }
+
+  ba_window_ids_.emplace_back(result.camera_id);
+  ba_window_poses_.emplace_back(ba_window_poses_.back() * result.lkf_T_cam);
+
+  // Drop the oldest keyframes, and re-anchor the window on the oldest remaining one.
+  if ((int)ba_window_ids_.size() > params_.local_ba_keyframes) {
+    const int num_drop = (int)ba_window_ids_.size() - params_.local_ba_keyframes;
+    ba_window_ids_.erase(ba_window_ids_.begin(), ba_window_ids_.begin() + num_drop);
+    ba_window_poses_.erase(ba_window_poses_.begin(), ba_window_poses_.begin() + num_drop);
+
+    const SE3 new_anchor_T_old_anchor = SE3(ba_window_poses_.front()).Inverse();
+    for (Matrix4d& anchor_T_kf : ba_window_poses_) {
+      anchor_T_kf = (new_anchor_T_old_anchor * SE3(anchor_T_kf)).matrix();
+    }
+  }
+
+  const int K = (int)ba_window_ids_.size();
+  std::unordered_map<uid_t, int> kf_index;
+  for (int k = 0; k < K; ++k) {
+    kf_index.emplace(ba_window_ids_.at(k), k);
+  }
+
+  // Group the observations by landmark. Only landmarks seen by at least two keyframes in the
+  // window help, and each one is initialized from its first stereo observation.
+  std::unordered_map<uid_t, std::vector<const LandmarkObservation*>> obs_by_lmk;
+  for (const LandmarkObservation& lmk_obs : tracked.ba_obs) {
+    if (kf_index.count(lmk_obs.camera_id) != 0) {
+      obs_by_lmk[lmk_obs.landmark_id].emplace_back(&lmk_obs);
+    }
+  }
+
+  std::vector<Vector3d> anchor_t_lmk;
+  std::vector<BundleObservation> ba_obs;
+
+  for (const auto& item : obs_by_lmk) {
+    const std::vector<const LandmarkObservation*>& lmk_obs = item.second;
+    if (lmk_obs.size() < 2 || lmk_obs.front()->disparity <= 0) {
+      continue;
+    }
+
+    const LandmarkObservation& first = *lmk_obs.front();
+    const Vector3d kf_t_lmk = stereo_rig_.LeftCamera().Backproject(
+        Vector2d(first.pixel_location.x, first.pixel_location.y), stereo_rig_.DispToDepth(first.disparity));
+    const SE3 anchor_T_kf(ba_window_poses_.at(kf_index.at(first.camera_id)));
+    anchor_t_lmk.emplace_back(anchor_T_kf * kf_t_lmk);
+
+    const int lmk = (int)anchor_t_lmk.size() - 1;
+    for (const LandmarkObservation* ob : lmk_obs) {
+      ba_obs.emplace_back(kf_index.at(ob->camera_id), lmk, ob->pixel_location.x, ob->pixel_location.y, ob->disparity);
+    }
+  }
+
+  VecMatrix4d kf_T_anchor(K);
+  for (int k = 0; k < K; ++k) {
+    kf_T_anchor.at(k) = inverse_se3(ba_window_poses_.at(k));
+  }
+
+  const double avg_err = OptimizeLocalBundleAdjustment(
+      stereo_rig_, kf_T_anchor, anchor_t_lmk, ba_obs, params_.sigma_tracked_point, params_.local_ba_iters);
+
+  // Keep the VO estimate if the BA didn't run or didn't converge to something reasonable.
+  if (avg_err < 0 || avg_err > params_.max_avg_reprojection_error) {
+    return;
+  }
+
+  for (int k = 0; k < K; ++k) {
+    ba_window_poses_.at(k) = inverse_se3(kf_T_anchor.at(k));
+  }
+
+  // The new keyframe is the last one in the window, and the last keyframe is right before it.
+  result.lkf_T_cam = kf_T_anchor.at(K - 2) * ba_window_poses_.at(K - 1);
+}
+
 }
 }
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <unordered_map>
 
@@ -14,7 +18,12 @@
 #include "vision_core/landmark_observation.hpp"
 
 #include "feature_tracking/stereo_tracker.hpp"
+#include "feature_tracking/line_tracker.hpp"
 
+#include "vio/keyframe_database.hpp"
+#include "vio/local_bundle_adjustment.hpp"
+#include "vio/odometry_ransac.hpp"
+#include "vio/optimize_odometry.hpp"
 #include "vio/vo_result.hpp"
 
 namespace bm {
@@ -33,12 +42,64 @@ class StereoFrontend final {
 
     StereoTracker::Params tracker_params;
 
+    // Track and detect on this level of an image pyramid (0 = full resolution, 1 = half, 2 =
+    // quarter), with a stereo rig that is scaled to match. Tracker params (e.g klt_winsize,
+    // max_disp) and sigma_tracked_point are in pixels at that level. Observations in the VoResult
+    // are scaled back up to full resolution pixels and disparities. If refine_full_res, they're
+    // also refined (cv::cornerSubPix, with a refine_winsize window at full resolution) in both
+    // images, which recovers most of the subpixel accuracy that tracking at a lower level loses.
+    int track_pyramid_level = 0;
+    bool refine_full_res = false;
+    int refine_winsize = 5;
+
+    // Also detect and track stereo line segments, on a scheduler worker while points are tracked on
+    // the calling thread. Needs BM_ENABLE_LINE_FEATURES (otherwise this is turned off).
+    bool track_lines = false;
+    StereoLineTracker::Params line_tracker_params;
+
+    // If set, CheckFrameQuality() rejects images that are too blurry, saturated, or hazy to track,
+    // using a coarse level of the KLT pyramid (see FrameQuality). After quality_max_skipped images
+    // in a row, the next one is tracked anyway so that the tracks aren't all lost.
+    bool gate_frame_quality = false;
+    int quality_pyramid_level = 2;
+    double min_gradient_energy = 4.0;
+    double max_saturated_fraction = 0.5;
+    double max_haze = 0.6;
+    int quality_max_skipped = 3;
+
     double max_avg_reprojection_error = 5.0;
     double sigma_tracked_point = 5.0;
     int lm_max_iters = 20;
     double lm_max_error_stdevs = 3.0;
     bool kill_nonrigid_lmks = true;
 
+    // If set, a stereo RANSAC (3 landmarks triangulated in both frames per hypothesis) picks the
+    // inliers first, and LM only runs on those. The last odometry, rotated by the IMU prior, is
+    // scored first and skips the sampling if ransac_prior_inlier_ratio of the points agree with it.
+    bool use_ransac = false;
+    int ransac_max_hypotheses = 200;
+    double ransac_confidence = 0.99;
+    double ransac_prior_inlier_ratio = 0.8;
+
+    // If > 0, LM only solves with the pose_solve_max_lmks (RANSAC inlier) landmarks that constrain
+    // the pose the most (see SelectInformativeLandmarks()), and only those are passed on to the
+    // smoother. Bounds the cost of the pose solve and of the smoother's factors in rich texture.
+    int pose_solve_max_lmks = 0;
+
+    // If >= 2, keyframe poses are refined with a small bundle adjustment over the last
+    // local_ba_keyframes keyframes, using the landmarks tracked between them.
+    int local_ba_keyframes = 0;
+    int local_ba_iters = 5;
+
+    // If set, keyframes go into a KeyframeDatabase, and a keyframe that couldn't be tracked from
+    // the last one (e.g after a turbidity blackout) is matched against the recent keyframes. A match
+    // re-anchors the next keyframe result to the old keyframe (see VoResult::has_reloc). Queries run
+    // on a scheduler worker, unless reloc_blocking (e.g so that lockstep runs are repeatable).
+    bool use_keyframe_database = false;
+    bool reloc_blocking = false;
+    int reloc_max_keyframes = 200;
+    int reloc_min_inliers = 15;
+
     StereoCamera stereo_rig;
     Matrix4d body_T_left;
     Matrix4d body_T_right;
@@ -53,7 +114,31 @@ class StereoFrontend final {
     FEW_DETECTED_FEATURES =    1 << 0,   // Last keyframe had very few detected keypoints.
     FEW_TRACKED_FEATURES =     1 << 1,   // Couldn't track >= 5 points from last keyframe.
     ODOM_ESTIMATION_FAILED =   1 << 2,   // Couldn't estimate odometry since last keyframe.
-    NO_FEATURES_FROM_LAST_KF = 1 << 3    // Couldn't track because there were no features from the last keyframe (just initialized or vision lost).
+    NO_FEATURES_FROM_LAST_KF = 1 << 3,   // Couldn't track because there were no features from the last keyframe (just initialized or vision lost).
+    RELOCALIZED =              1 << 4    // Matched an older keyframe from the KeyframeDatabase (see VoResult::has_reloc).
+  };
+
+  // Output of the tracking stage (see TrackFeatures()), and everything that the pose solve stage
+  // needs to finish the VoResult.
+  struct TrackingResult final
+  {
+    MACRO_DELETE_COPY_CONSTRUCTORS(TrackingResult)
+    MACRO_DELETE_DEFAULT_CONSTRUCTOR(TrackingResult)
+
+    explicit TrackingResult(VoResult&& result, bool is_keyframe)
+        : result(std::move(result)), is_keyframe(is_keyframe) {}
+
+    TrackingResult(TrackingResult&&) = default;
+
+    VoResult result;                              // Has lmk_obs and status filled in.
+    bool is_keyframe;                             // Did this image trigger a keyframe?
+    std::vector<Vector3d> lmk_pts_prev_kf_3d;     // Landmarks in the last keyframe.
+    std::vector<Vector2d> lmk_pts_curr_f_2d;      // ... and their observations in this frame.
+    std::vector<Vector3d> lmk_pts_curr_f_3d;      // ... triangulated in this frame (z = 0 if not, RANSAC only).
+    std::vector<uid_t> lmk_ids_prev_kf;
+    VecLmkObs ba_obs;                             // Observations from recent keyframes (local BA only).
+    bool has_rotation_prior = false;
+    Matrix3d prev_R_cur_prior;                    // Rotation since the last tracked image (if given).
   };
 
   MACRO_DELETE_COPY_CONSTRUCTORS(StereoFrontend);
@@ -62,23 +147,113 @@ class StereoFrontend final {
   // Construct with params.
   explicit StereoFrontend(const Params& params);
 
-  // Track and estimate odometry for a new stereo pair.
+  // Waits for any relocalization work that's still running on the scheduler.
+  ~StereoFrontend();
+
+  // Track and estimate odometry for a new stereo pair. Equivalent to SolvePose(TrackFeatures()).
+  // If prev_T_cur_prior is given, it's the motion of the left camera since the last image that was
+  // tracked. Only its rotation is used, to predict where features will be.
   VoResult Track(const StereoImage1b& stereo_pair,
-                 const Matrix4d& prev_T_cur_prior);
+                 const Matrix4d* prev_T_cur_prior = nullptr);
+
+  // The two stages of Track(), which can run on different threads: TrackFeatures() for frame N+1
+  // can run while SolvePose() is running for frame N. Each stage must be called from one thread at
+  // a time, and frames must go through SolvePose() in the order they were tracked.
+  //
+  // NOTE(milo): When pipelined, landmarks that SolvePose() rejects as outliers are killed by the
+  // next call to TrackFeatures(), so the tracker keeps them for one extra frame.
+  TrackingResult TrackFeatures(const StereoImage1b& stereo_pair,
+                               const Matrix4d* prev_T_cur_prior = nullptr);
+  VoResult SolvePose(TrackingResult& tracked, bool pipelined = false);
+
+  // Should this image be tracked at all? Always true unless params.gate_frame_quality. Builds the
+  // image's pyramid, which TrackFeatures() then reuses, so call it from the tracking stage right
+  // before TrackFeatures(). If it returns false, skip the image (the motion comes from the IMU).
+  bool CheckFrameQuality(const StereoImage1b& stereo_pair, FrameQuality* quality = nullptr);
+
+  // Let something else decide when to trigger keyframes (see StereoTracker::SetKeyframeTrigger()).
+  // The trigger is called from TrackFeatures().
+  void SetKeyframeTrigger(const StereoTracker::KeyframeTrigger& trigger) { tracker_.SetKeyframeTrigger(trigger); }
+
+  // See StereoTracker::KeyframeDue().
+  bool KeyframeDue(uid_t camera_id) const { return tracker_.KeyframeDue(camera_id); }
+
+  // See StereoTracker::SetTrackingEffort(). Call this from the thread that calls TrackFeatures().
+  void SetTrackingEffort(int max_features_per_frame, int klt_max_level)
+  {
+    tracker_.SetTrackingEffort(max_features_per_frame, klt_max_level);
+  }
+
+ private:
+  // The stereo pair at params_.track_pyramid_level. It's built once per frame (in the full size
+  // pair's FrameCache), so that CheckFrameQuality() and TrackFeatures() share it and its pyramid.
+  std::shared_ptr<const StereoImage1b> TrackingPair(const StereoImage1b& stereo_pair) const;
+
+  // Scales the observations in result from tracking resolution up to full resolution, and refines
+  // the landmarks in the full resolution images if params_.refine_full_res.
+  void ScaleToFullResolution(const StereoImage1b& stereo_pair, VoResult& result) const;
+
+  // Adds this keyframe to the local BA window, refines the window, and updates result.lkf_T_cam.
+  void RefineKeyframeWindow(const TrackingResult& tracked, VoResult& result);
+
+  // A keyframe to describe and add to the KeyframeDatabase, and query it with first if is_lost.
+  struct RelocJob final
+  {
+    uid_t camera_id;
+    timestamp_t timestamp;
+    Image1b left_image;                 // Only the Mat header is copied.
+    std::vector<Vector2d> pixels;
+    std::vector<double> disps;
+    bool is_lost;                       // Not tracked from the last keyframe.
+  };
+
+  // Runs the job right away if params_.reloc_blocking, otherwise on a scheduler worker (one job at
+  // a time, in order).
+  void QueueRelocJob(RelocJob&& job);
+  void RunRelocJob(const RelocJob& job);
+  void DrainRelocJobs();
+
+  // If a relocalization is waiting for this keyframe result, adds it to the result.
+  void AttachRelocalization(VoResult& result);
 
   // Wrapper around StereoTracker::VisualizeFeatureTracks().
   Image3b VisualizeFeatureTracks() const { return tracker_.VisualizeFeatureTracks(); }
 
  private:
   Params params_;
-  StereoCamera stereo_rig_;
+  int track_scale_;               // 2^track_pyramid_level
+  StereoCamera stereo_rig_;       // At tracking resolution.
 
   StereoTracker tracker_;
+  std::unique_ptr<StereoLineTracker> line_tracker_;   // Only set if params_.track_lines.
 
+  // Owned by the tracking stage.
   uid_t prev_keyframe_id_ = 0;
   timestamp_t timestamp_lkf_ = 0;
+  std::deque<uid_t> recent_keyframe_ids_;   // The last local_ba_keyframes keyframes.
+  int num_low_quality_skipped_ = 0;         // Images in a row that CheckFrameQuality() rejected.
 
+  // Owned by the pose solve stage.
   Matrix4d cur_T_lkf_ = Matrix4d::Identity();
+  OdometryWorkspace odom_workspace_;
+  std::vector<uid_t> ba_window_ids_;        // Keyframes in the local BA window (oldest first) ...
+  VecMatrix4d ba_window_poses_;             // ... and their poses in the oldest one.
+
+  // Outlier landmarks from SolvePose() that the tracking stage still needs to kill.
+  std::mutex mutex_kill_lmk_ids_;
+  std::vector<uid_t> kill_lmk_ids_;
+
+  // Only touched by one relocalization job at a time (only set if params_.use_keyframe_database).
+  std::unique_ptr<KeyframeDatabase> kf_database_;
+
+  // Shared between the tracking stage, the relocalization jobs, and the pose solve stage.
+  std::mutex mutex_reloc_;
+  std::condition_variable cv_reloc_idle_;
+  std::deque<RelocJob> reloc_jobs_;
+  bool reloc_busy_ = false;             // Is a DrainRelocJobs() task queued or running?
+  bool has_reloc_ = false;
+  uid_t reloc_camera_id_ = 0;           // The lost keyframe that was relocalized ...
+  Relocalization reloc_;                // ... and where it is relative to an older keyframe.
 };
 
 
@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "core/random.hpp"
+#include "core/timer.hpp"
+#include "core/transform_util.hpp"
+#include "vio/state_estimator.hpp"
+#include "vio/synthetic_world.hpp"
+
+namespace bm {
+namespace vio {
+
+
+// Steps for the finite differences of the trajectory (seconds).
+static const double kHeadingStep = 1e-4;
+static const double kDerivativeStep = 1e-3;
+
+// SyntheticWorld timestamps start here, since a zero timestamp means "none" in some places.
+static const timestamp_t kFirstTimestamp = ConvertToNanoseconds(1.0);
+
+
+void SyntheticWorld::Params::LoadParams(const YamlParser& parser)
+{
+  int seed_int = 0;
+  parser.GetParam("seed", &seed_int);
+  seed = static_cast<unsigned int>(seed_int);
+  parser.GetParam("duration_sec", &duration_sec);
+
+  trajectory = YamlToEnum<SyntheticTrajectory>(parser.GetNode("trajectory"));
+  parser.GetParam("speed", &speed);
+  parser.GetParam("size", &size);
+  parser.GetParam("lawnmower_spacing", &lawnmower_spacing);
+  parser.GetParam("depth", &depth);
+  parser.GetParam("heave_amplitude", &heave_amplitude);
+  parser.GetParam("heave_period_sec", &heave_period_sec);
+
+  parser.GetParam("num_landmarks", &num_landmarks);
+  parser.GetParam("landmark_margin", &landmark_margin);
+  parser.GetParam("landmark_height", &landmark_height);
+  parser.GetParam("max_obs_per_keyframe", &max_obs_per_keyframe);
+  parser.GetParam("max_landmark_range", &max_landmark_range);
+  parser.GetParam("min_disparity", &min_disparity);
+
+  parser.GetParam("keyframe_hz", &keyframe_hz);
+  parser.GetParam("imu_hz", &imu_hz);
+  parser.GetParam("depth_hz", &depth_hz);
+  parser.GetParam("range_hz", &range_hz);
+  parser.GetParam("mag_hz", &mag_hz);
+
+  parser.GetParam("pixel_sigma", &pixel_sigma);
+  parser.GetParam("disp_sigma", &disp_sigma);
+  parser.GetParam("odom_trans_sigma", &odom_trans_sigma);
+  parser.GetParam("odom_rot_sigma", &odom_rot_sigma);
+  parser.GetParam("gyro_sigma", &gyro_sigma);
+  parser.GetParam("accel_sigma", &accel_sigma);
+  parser.GetParam("depth_sigma", &depth_sigma);
+  parser.GetParam("range_sigma", &range_sigma);
+  parser.GetParam("mag_sigma", &mag_sigma);
+
+  beacons.clear();
+  const cv::FileNode& beacons_node = parser.GetNode("beacons");
+  CHECK(beacons_node.isSeq()) << "beacons should be a list of [x, y, z] points" << std::endl;
+  for (cv::FileNodeIterator it = beacons_node.begin(); it != beacons_node.end(); ++it) {
+    beacons.emplace_back(YamlToVector<Vector3d>(*it));
+  }
+
+
+  CHECK_GT(duration_sec, 0);
+  CHECK_GT(speed, 0);
+  CHECK_GT(size, 0);
+  CHECK_GT(keyframe_hz, 0);
+  CHECK_GT(imu_hz, 0);
+}
+
+
+SyntheticWorld::SyntheticWorld(const Params& params, const StereoCamera& stereo_rig, const Matrix4d& body_T_cam)
+    : params_(params),
+      stereo_rig_(stereo_rig),
+      body_T_cam_(body_T_cam),
+      t0_(kFirstTimestamp)
+{
+  CHECK_GT(params_.n_gravity.norm(), 0);
+  CHECK_NEAR(1.0, params_.mag_local_field.norm(), 1e-3);
+  CHECK(params_.trajectory != SyntheticTrajectory::LAWNMOWER || params_.lawnmower_spacing > 0);
+  CHECK(params_.heave_amplitude == 0 || params_.heave_period_sec > 0);
+
+  // The horizontal plane is spanned by the world axis that is furthest from gravity, and one more
+  // that makes (u, v, down) right-handed.
+  down_ = params_.n_gravity.normalized();
+  int furthest = 0;
+  down_.cwiseAbs().minCoeff(&furthest);
+  const Vector3d e = Vector3d::Unit(furthest);
+  plane_u_ = (e - down_.dot(e) * down_).normalized();
+  plane_v_ = plane_u_.cross(down_);
+
+  SeedRandom(params_.seed);
+  GenerateLandmarks();
+  GenerateKeyframes();
+  GenerateImu();
+  GenerateDepthRangeMag();
+
+  LOG(INFO) << "SyntheticWorld: " << landmarks_.size() << " landmarks, " << keyframes_.size()
+            << " keyframes, " << imu_data_.size() << " IMU, " << depth_data_.size() << " depth, "
+            << range_data_.size() << " range, " << mag_data_.size() << " mag" << std::endl;
+}
+
+
+Vector3d SyntheticWorld::Position(seconds_t t) const
+{
+  const double R = params_.size;
+  const double w = params_.speed / R;
+  double a = 0, b = 0;
+
+  switch (params_.trajectory) {
+    case SyntheticTrajectory::CIRCLE:
+      a = R * std::cos(w * t);
+      b = R * std::sin(w * t);
+      break;
+    case SyntheticTrajectory::FIGURE_EIGHT:
+      a = R * std::sin(w * t);
+      b = 0.5 * R * std::sin(2.0 * w * t);
+      break;
+    case SyntheticTrajectory::LAWNMOWER: {
+      // Each cycle is a leg out, a semicircle, a leg back, and a semicircle the other way.
+      const double L = params_.size;
+      const double r = 0.5 * params_.lawnmower_spacing;
+      const double cycle = 2.0*L + 2.0*M_PI*r;
+      const double s_total = params_.speed * t;
+      const double k = std::floor(s_total / cycle);
+      double s = s_total - k * cycle;
+      const double b0 = 4.0 * r * k;
+
+      if (s < L) {
+        a = s;
+        b = b0;
+      } else if ((s -= L) < M_PI*r) {
+        a = L + r*std::sin(s / r);
+        b = b0 + r - r*std::cos(s / r);
+      } else if ((s -= M_PI*r) < L) {
+        a = L - s;
+        b = b0 + 2.0*r;
+      } else {
+        s -= L;
+        a = -r*std::sin(s / r);
+        b = b0 + 3.0*r - r*std::cos(s / r);
+      }
+      break;
+    }
+    default:
+      LOG(FATAL) << "Unknown SyntheticTrajectory" << std::endl;
+  }
+
+  const double heave = (params_.heave_amplitude == 0) ? 0 :
+      params_.heave_amplitude * std::sin(2.0 * M_PI * t / params_.heave_period_sec);
+
+  return a*plane_u_ + b*plane_v_ + (params_.depth + heave)*down_;
+}
+
+
+Matrix3d SyntheticWorld::Rotation(seconds_t t) const
+{
+  // Level, facing along the horizontal velocity. The body is RDF, like the camera.
+  Vector3d forward = Position(t + kHeadingStep) - Position(t - kHeadingStep);
+  forward -= forward.dot(down_) * down_;
+  forward.normalize();
+
+  Matrix3d world_R_body;
+  world_R_body.col(0) = down_.cross(forward);
+  world_R_body.col(1) = down_;
+  world_R_body.col(2) = forward;
+  return world_R_body;
+}
+
+
+Matrix4d SyntheticWorld::WorldTBody(seconds_t t) const
+{
+  Matrix4d world_T_body = Matrix4d::Identity();
+  world_T_body.block<3, 3>(0, 0) = Rotation(t);
+  world_T_body.block<3, 1>(0, 3) = Position(t);
+  return world_T_body;
+}
+
+
+void SyntheticWorld::GenerateLandmarks()
+{
+  // Horizontal bounds of the trajectory.
+  double amin = 1e9, amax = -1e9, bmin = 1e9, bmax = -1e9;
+  for (double t = 0; t <= params_.duration_sec; t += 0.1) {
+    const Vector3d p = Position(t);
+    amin = std::min(amin, p.dot(plane_u_));
+    amax = std::max(amax, p.dot(plane_u_));
+    bmin = std::min(bmin, p.dot(plane_v_));
+    bmax = std::max(bmax, p.dot(plane_v_));
+  }
+
+  const double m = params_.landmark_margin;
+  const double h = params_.landmark_height;
+
+  landmarks_.clear();
+  landmarks_.reserve(params_.num_landmarks);
+  for (int i = 0; i < params_.num_landmarks; ++i) {
+    const double a = RandomUniformd(amin - m, amax + m);
+    const double b = RandomUniformd(bmin - m, bmax + m);
+    const double d = RandomUniformd(params_.depth - h, params_.depth + h);
+    landmarks_.emplace_back(a*plane_u_ + b*plane_v_ + d*down_);
+  }
+}
+
+
+void SyntheticWorld::GenerateKeyframes()
+{
+  const PinholeCamera& cam = stereo_rig_.LeftCamera();
+  const double max_range_sq = params_.max_landmark_range * params_.max_landmark_range;
+
+  // Each time a landmark comes into view, it gets a new track id (like the frontend would give it).
+  std::vector<uid_t> track_id(landmarks_.size(), 0);
+  std::vector<bool> was_observed(landmarks_.size(), false);
+  std::vector<bool> is_observed(landmarks_.size(), false);
+  uid_t next_track_id = 1;
+
+  struct Candidate final
+  {
+    size_t lmk;
+    Vector2d pixel;
+    double disp;
+  };
+  std::vector<Candidate> tracked, fresh;
+
+  // Keyframe 0 is the initial pose, which the estimator is initialized at, so it isn't sent.
+  Matrix4d world_T_lkf = WorldTBody(0) * body_T_cam_;
+  const int num_keyframes = static_cast<int>(params_.duration_sec * params_.keyframe_hz);
+
+  keyframes_.clear();
+  keyframes_.reserve(num_keyframes);
+
+  for (int k = 1; k <= num_keyframes; ++k) {
+    const seconds_t t = k / params_.keyframe_hz;
+    const Matrix4d world_T_cam = WorldTBody(t) * body_T_cam_;
+    const Matrix4d cam_T_world = inverse_se3(world_T_cam);
+    const Matrix3d R = cam_T_world.block<3, 3>(0, 0);
+    const Vector3d trans = cam_T_world.block<3, 1>(0, 3);
+
+    tracked.clear();
+    fresh.clear();
+    for (size_t i = 0; i < landmarks_.size(); ++i) {
+      const Vector3d p_cam = R * landmarks_[i] + trans;
+      if (p_cam.z() <= 0 || p_cam.squaredNorm() > max_range_sq) {
+        continue;
+      }
+      const double disp = stereo_rig_.DepthToDisp(p_cam.z());
+      const Vector2d pixel = cam.Project(p_cam);
+      if (disp < params_.min_disparity || pixel.x() < 0 || pixel.y() < 0 ||
+          pixel.x() >= cam.Width() || pixel.y() >= cam.Height()) {
+        continue;
+      }
+      (was_observed[i] ? tracked : fresh).emplace_back(Candidate{ i, pixel, disp });
+    }
+
+    // Keep tracked landmarks first, and spread new ones evenly over the rest (landmarks are in no
+    // particular order, so this is an even subsample of the view).
+    const size_t max_obs = static_cast<size_t>(params_.max_obs_per_keyframe);
+    if (tracked.size() > max_obs) {
+      tracked.resize(max_obs);
+    }
+    const size_t num_fresh = std::min(fresh.size(), max_obs - tracked.size());
+    for (size_t j = 0; j < num_fresh; ++j) {
+      tracked.emplace_back(fresh.at(j * fresh.size() / num_fresh));
+    }
+
+    Keyframe kf;
+    kf.timestamp = t0_ + ConvertToNanoseconds(t);
+    kf.lmk_obs.Reserve(tracked.size());
+
+    std::fill(is_observed.begin(), is_observed.end(), false);
+    for (const Candidate& c : tracked) {
+      const double disp = c.disp + RandomNormald(0, params_.disp_sigma);
+      if (disp < params_.min_disparity) {
+        continue;
+      }
+      if (!was_observed[c.lmk]) {
+        track_id[c.lmk] = next_track_id++;
+      }
+      is_observed[c.lmk] = true;
+      const Vector2d pixel = c.pixel + RandomNormal2d(0, params_.pixel_sigma);
+      kf.lmk_obs.Add(track_id[c.lmk], cv::Point2f(pixel.x(), pixel.y()), static_cast<float>(disp));
+    }
+    was_observed.swap(is_observed);
+
+    // Noisy odometry from the last keyframe.
+    Matrix4d lkf_T_cam = inverse_se3(world_T_lkf) * world_T_cam;
+    const Vector3d drot = RandomNormal3d(0, params_.odom_rot_sigma);
+    if (drot.norm() > 0) {
+      lkf_T_cam.block<3, 3>(0, 0) = lkf_T_cam.block<3, 3>(0, 0) * AngleAxisd(drot.norm(), drot.normalized()).toRotationMatrix();
+    }
+    lkf_T_cam.block<3, 1>(0, 3) += RandomNormal3d(0, params_.odom_trans_sigma);
+    kf.lkf_T_cam = lkf_T_cam;
+
+    keyframes_.emplace_back(std::move(kf));
+    world_T_lkf = world_T_cam;
+  }
+}
+
+
+void SyntheticWorld::GenerateImu()
+{
+  const double h = kDerivativeStep;
+  const int num_imu = static_cast<int>(params_.duration_sec * params_.imu_hz) + 1;
+
+  imu_data_.clear();
+  imu_data_.reserve(num_imu);
+
+  for (int i = 0; i < num_imu; ++i) {
+    const seconds_t t = i / params_.imu_hz;
+    const Matrix3d world_R_body = Rotation(t);
+
+    // Specific force: the acceleration of the body, minus gravity (in the body frame).
+    const Vector3d world_a = (Position(t + h) - 2.0*Position(t) + Position(t - h)) / (h*h);
+    const Vector3d a = world_R_body.transpose() * (world_a - params_.n_gravity);
+
+    // Angular velocity in the body frame, from the rotation over [t - h, t + h].
+    const AngleAxisd dR(Rotation(t - h).transpose() * Rotation(t + h));
+    const Vector3d w = dR.axis() * dR.angle() / (2.0*h);
+
+    imu_data_.emplace_back(t0_ + ConvertToNanoseconds(t),
+                           w + RandomNormal3d(0, params_.gyro_sigma),
+                           a + RandomNormal3d(0, params_.accel_sigma));
+  }
+}
+
+
+void SyntheticWorld::GenerateDepthRangeMag()
+{
+  depth_data_.clear();
+  range_data_.clear();
+  mag_data_.clear();
+
+  // NOTE(milo): Depth is the position along gravity, which is what the smoother expects when gravity
+  // is along one of the world axes.
+  if (params_.depth_hz > 0) {
+    const int N = static_cast<int>(params_.duration_sec * params_.depth_hz) + 1;
+    for (int i = 0; i < N; ++i) {
+      const seconds_t t = i / params_.depth_hz;
+      depth_data_.emplace_back(t0_ + ConvertToNanoseconds(t),
+                               Position(t).dot(down_) + RandomNormald(0, params_.depth_sigma));
+    }
+  }
+
+  if (params_.range_hz > 0) {
+    const int N = static_cast<int>(params_.duration_sec * params_.range_hz) + 1;
+    for (int i = 0; i < N; ++i) {
+      const seconds_t t = i / params_.range_hz;
+      const Vector3d p = Position(t);
+      for (const Vector3d& beacon : params_.beacons) {
+        range_data_.emplace_back(t0_ + ConvertToNanoseconds(t),
+                                 (p - beacon).norm() + RandomNormald(0, params_.range_sigma),
+                                 beacon);
+      }
+    }
+  }
+
+  // Same model as the smoother's MagFactor (with no sensor bias).
+  if (params_.mag_hz > 0) {
+    const Vector3d world_field = params_.mag_scale_factor * params_.mag_local_field;
+    const int N = static_cast<int>(params_.duration_sec * params_.mag_hz) + 1;
+    for (int i = 0; i < N; ++i) {
+      const seconds_t t = i / params_.mag_hz;
+      mag_data_.emplace_back(t0_ + ConvertToNanoseconds(t),
+                             Rotation(t).transpose() * world_field + RandomNormal3d(0, params_.mag_sigma));
+    }
+  }
+}
+
+
+VoResult SyntheticWorld::MakeVoResult(size_t k) const
+{
+  const Keyframe& kf = keyframes_.at(k);
+  const timestamp_t timestamp_lkf = (k == 0) ? t0_ : keyframes_.at(k - 1).timestamp;
+
+  // Camera ids only need to be unique (and increasing), so use the keyframe index.
+  VoResult result(kf.timestamp, timestamp_lkf, k + 1, k);
+  result.is_keyframe = true;
+  result.lmk_obs = kf.lmk_obs;
+  result.lkf_T_cam = kf.lkf_T_cam;
+  result.avg_reprojection_err = params_.pixel_sigma;
+  return result;
+}
+
+
+void SyntheticWorld::Playback(StateEstimator& estimator, const KeyframeCallback& keyframe_cb) const
+{
+  estimator.Initialize(ConvertToSeconds(t0_), gtsam::Pose3(WorldTBody(0)));
+
+  size_t next_imu = 0, next_depth = 0, next_range = 0, next_mag = 0, next_kf = 0;
+
+  while (true) {
+    // Whichever stream is next, with ties going to the one that is checked first.
+    timestamp_t next_time = kMaxTimestamp;
+    int source = -1;
+    if (next_imu < imu_data_.size() && imu_data_[next_imu].timestamp < next_time) {
+      next_time = imu_data_[next_imu].timestamp;
+      source = 0;
+    }
+    if (next_depth < depth_data_.size() && depth_data_[next_depth].timestamp < next_time) {
+      next_time = depth_data_[next_depth].timestamp;
+      source = 1;
+    }
+    if (next_range < range_data_.size() && range_data_[next_range].timestamp < next_time) {
+      next_time = range_data_[next_range].timestamp;
+      source = 2;
+    }
+    if (next_mag < mag_data_.size() && mag_data_[next_mag].timestamp < next_time) {
+      next_time = mag_data_[next_mag].timestamp;
+      source = 3;
+    }
+    if (next_kf < keyframes_.size() && keyframes_[next_kf].timestamp < next_time) {
+      next_time = keyframes_[next_kf].timestamp;
+      source = 4;
+    }
+
+    switch (source) {
+      case 0:
+        estimator.ReceiveImu(imu_data_[next_imu++]);
+        break;
+      case 1:
+        estimator.ReceiveDepth(depth_data_[next_depth++]);
+        break;
+      case 2:
+        estimator.ReceiveRange(range_data_[next_range++]);
+        break;
+      case 3:
+        estimator.ReceiveMag(mag_data_[next_mag++]);
+        break;
+      case 4: {
+        Timer timer(true);
+        estimator.ReceiveVo(MakeVoResult(next_kf));
+        if (keyframe_cb) {
+          keyframe_cb(next_kf, timer.Elapsed().milliseconds());
+        }
+        ++next_kf;
+        break;
+      }
+      default:
+        return;
+    }
+  }
+}
+
+
+}
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+#include "core/imu_measurement.hpp"
+#include "core/depth_measurement.hpp"
+#include "core/range_measurement.hpp"
+#include "core/mag_measurement.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/landmark_observation.hpp"
+#include "vio/vo_result.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+class StateEstimator;
+
+
+// Paths that the vehicle can follow, all at a constant depth (plus heave) and speed. The vehicle
+// stays level, and always faces the way that it's moving.
+enum class SyntheticTrajectory
+{
+  CIRCLE = 0,         // Circle with a radius of size.
+  FIGURE_EIGHT = 1,   // Lemniscate that is 2*size long, and size wide.
+  LAWNMOWER = 2       // Legs that are size long, lawnmower_spacing apart, joined by semicircles.
+};
+
+
+// A deterministic synthetic world: landmarks scattered around a trajectory, and the stereo landmark
+// observations, IMU, depth, range and magnetometer measurements that a vehicle following it would
+// get. Keyframes are made straight from the landmarks (no images, and no frontend), so that the
+// smoother and filter can be benchmarked on their own, against the number of landmarks, the lag,
+// and the keypose rate.
+//
+// Everything is generated in the constructor, from core/random.hpp seeded with seed, so the same
+// params always give the same data. All of the sensors besides the camera are at the body origin,
+// and have no bias, so the estimator should be configured with identity extrinsics for them.
+class SyntheticWorld final {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    unsigned int seed = 0;
+    double duration_sec = 60.0;
+
+    SyntheticTrajectory trajectory = SyntheticTrajectory::CIRCLE;
+    double speed = 0.5;                 // m/s along the path.
+    double size = 10.0;                 // m (see SyntheticTrajectory).
+    double lawnmower_spacing = 4.0;     // m between lawnmower legs.
+    double depth = 5.0;                 // m along gravity.
+    double heave_amplitude = 0.2;       // m of vertical oscillation ...
+    double heave_period_sec = 10.0;     // ... with this period.
+
+    // Landmarks are uniformly spread over the trajectory's horizontal bounds (grown by
+    // landmark_margin), and landmark_height above and below it.
+    int num_landmarks = 2000;
+    double landmark_margin = 6.0;
+    double landmark_height = 4.0;
+
+    // At most this many landmarks are observed in each keyframe (like the frontend's feature limit).
+    // Landmarks that were observed in the last keyframe are kept first, so tracks are long.
+    int max_obs_per_keyframe = 150;
+    double max_landmark_range = 12.0;   // m from the camera.
+    double min_disparity = 1.0;         // px
+
+    // Sensor rates in Hz (zero = none of that sensor).
+    double keyframe_hz = 2.0;
+    double imu_hz = 100.0;
+    double depth_hz = 10.0;
+    double range_hz = 0.5;
+    double mag_hz = 10.0;
+
+    // Measurement noise (standard deviations).
+    double pixel_sigma = 0.5;           // px
+    double disp_sigma = 0.5;            // px
+    double odom_trans_sigma = 0.01;     // m, of each keyframe's lkf_T_cam ...
+    double odom_rot_sigma = 0.005;      // rad
+    double gyro_sigma = 0.002;          // rad/s
+    double accel_sigma = 0.02;          // m/s^2
+    double depth_sigma = 0.02;          // m
+    double range_sigma = 0.1;           // m
+    double mag_sigma = 0.01;            // field units
+
+    // Range beacons (world frame). Every range sample has a range to each of them.
+    std::vector<Vector3d> beacons = { Vector3d(0, 0, 0) };
+
+    // NOTE(milo): These aren't loaded from YAML, since they have to match the estimator's (so copy
+    // them from its params).
+    Vector3d mag_local_field = Vector3d(0, 0, 1);   // Unit direction in the world frame.
+    double mag_scale_factor = 1.0;
+    Vector3d n_gravity = Vector3d(0, 9.81, 0);
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  // The landmarks observed in a keyframe, and the odometry from the keyframe before it.
+  struct Keyframe final
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    timestamp_t timestamp;
+    Matrix4d lkf_T_cam;               // Noisy relative pose from the previous keyframe.
+    LandmarkObservationBatch lmk_obs;
+  };
+
+  // Called after each keyframe has been given to the estimator, with how long that took. In
+  // lockstep mode, that includes the smoother update for its keypose.
+  typedef std::function<void(size_t k, double receive_ms)> KeyframeCallback;
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(SyntheticWorld)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SyntheticWorld)
+
+  // Generates all of the data. Landmarks are observed with stereo_rig, at body_T_cam.
+  SyntheticWorld(const Params& params, const StereoCamera& stereo_rig, const Matrix4d& body_T_cam);
+
+  // Groundtruth pose of the body, t seconds after FirstTimestamp().
+  Matrix4d WorldTBody(seconds_t t) const;
+
+  timestamp_t FirstTimestamp() const { return t0_; }
+  timestamp_t LastTimestamp() const { return t0_ + ConvertToNanoseconds(params_.duration_sec); }
+
+  const std::vector<Vector3d>& Landmarks() const { return landmarks_; }
+  const std::vector<Keyframe>& Keyframes() const { return keyframes_; }
+  const std::vector<ImuMeasurement>& ImuMeasurements() const { return imu_data_; }
+  const std::vector<DepthMeasurement>& DepthMeasurements() const { return depth_data_; }
+  const std::vector<RangeMeasurement>& RangeMeasurements() const { return range_data_; }
+  const std::vector<MagMeasurement>& MagMeasurements() const { return mag_data_; }
+
+  // Keyframe k as a VoResult, ready for StateEstimator::ReceiveVo().
+  VoResult MakeVoResult(size_t k) const;
+
+  // Initializes the estimator at the groundtruth pose, then gives it every measurement in time
+  // order (ties go to IMU, depth, range, mag, then keyframes). Doesn't wait for it to finish.
+  void Playback(StateEstimator& estimator, const KeyframeCallback& keyframe_cb = nullptr) const;
+
+ private:
+  // Position of the body at time t, and its rotation (facing along the velocity).
+  Vector3d Position(seconds_t t) const;
+  Matrix3d Rotation(seconds_t t) const;
+
+  void GenerateLandmarks();
+  void GenerateKeyframes();
+  void GenerateImu();
+  void GenerateDepthRangeMag();
+
+ private:
+  Params params_;
+  StereoCamera stereo_rig_;
+  Matrix4d body_T_cam_;
+  timestamp_t t0_;
+
+  Vector3d down_, plane_u_, plane_v_;   // World axes: along gravity, and the horizontal plane.
+
+  std::vector<Vector3d> landmarks_;
+  std::vector<Keyframe> keyframes_;
+  std::vector<ImuMeasurement> imu_data_;
+  std::vector<DepthMeasurement> depth_data_;
+  std::vector<RangeMeasurement> range_data_;
+  std::vector<MagMeasurement> mag_data_;
+};
+
+
+}
+}
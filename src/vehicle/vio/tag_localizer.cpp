@@ -0,0 +1,150 @@
+#include <cmath>
+
+#include <glog/logging.h>
+
+// NOTE(milo): The tag code headers don't include anything, so TagDetector.h has to come first.
+#include "AprilTags/TagDetector.h"
+#include "AprilTags/Tag16h5.h"
+#include "AprilTags/Tag25h7.h"
+#include "AprilTags/Tag25h9.h"
+#include "AprilTags/Tag36h9.h"
+#include "AprilTags/Tag36h11.h"
+
+#include "vision_core/stereo_camera.hpp"
+#include "vio/tag_localizer.hpp"
+
+namespace bm {
+namespace vio {
+
+
+static const AprilTags::TagCodes& GetTagCodes(const std::string& tag_family)
+{
+  if (tag_family == "16h5") { return AprilTags::tagCodes16h5; }
+  if (tag_family == "25h7") { return AprilTags::tagCodes25h7; }
+  if (tag_family == "25h9") { return AprilTags::tagCodes25h9; }
+  if (tag_family == "36h9") { return AprilTags::tagCodes36h9; }
+  CHECK_EQ("36h11", tag_family) << "Unknown tag_family" << std::endl;
+  return AprilTags::tagCodes36h11;
+}
+
+
+void TagLocalizer::Params::LoadParams(const YamlParser& parser)
+{
+  tag_family = YamlToString(parser.GetNode("tag_family"));
+  GetTagCodes(tag_family);
+
+  parser.GetParam("tag_size", &tag_size);
+  parser.GetParam("quad_decimate", &quad_decimate);
+  parser.GetParam("max_hamming_distance", &max_hamming_distance);
+  parser.GetParam("min_perimeter_px", &min_perimeter_px);
+  parser.GetParam("max_reprojection_err", &max_reprojection_err);
+  parser.GetParam("max_range", &max_range);
+  CHECK_GT(tag_size, 0);
+  CHECK_GE(quad_decimate, 1);
+  CHECK_GE(max_hamming_distance, 0);
+
+  // NOTE(milo): YamlToTransform() only takes symmetric rotations, so check these here instead.
+  const cv::FileNode& tags_node = parser.GetNode("tags");
+  CHECK(tags_node.isSeq()) << "TagLocalizer tags must be a sequence" << std::endl;
+  world_P_tag.clear();
+  for (cv::FileNodeIterator it = tags_node.begin(); it != tags_node.end(); ++it) {
+    const cv::FileNode& tag_node = *it;
+    CHECK(tag_node["id"].type() != cv::FileNode::NONE) << "Tag is missing an id" << std::endl;
+    const int id = (int)tag_node["id"];
+
+    Matrix4d world_T_tag;
+    YamlToMatrix(tag_node["world_T_tag"], world_T_tag);
+    const Matrix3d R = world_T_tag.block<3, 3>(0, 0);
+    CHECK(world_T_tag.row(3).isApprox(Vector4d(0, 0, 0, 1).transpose()))
+        << "world_T_tag for tag " << id << " should have [0 0 0 1] as its last row" << std::endl;
+    CHECK((R * R.transpose()).isIdentity(1e-3) && R.determinant() > 0)
+        << "world_T_tag for tag " << id << " doesn't have a valid rotation" << std::endl;
+    CHECK_EQ(0ul, world_P_tag.count(id)) << "Tag " << id << " is listed twice" << std::endl;
+
+    world_P_tag.emplace(id, gtsam::Pose3(world_T_tag));
+  }
+
+  StereoCamera stereo_rig;
+  Matrix4d body_T_left, body_T_right;
+  YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_left, body_T_right);
+  camera = stereo_rig.LeftCamera();
+  body_P_cam = gtsam::Pose3(body_T_left);
+}
+
+
+TagLocalizer::TagLocalizer(const Params& params)
+    : params_(params),
+      detector_(new AprilTags::TagDetector(GetTagCodes(params.tag_family)))
+{
+  detector_->setQuadDecimate(params_.quad_decimate);
+  LOG_IF(WARNING, params_.world_P_tag.empty()) << "TagLocalizer doesn't know any tags" << std::endl;
+}
+
+
+// NOTE(milo): Out of line, since TagDetector is only forward declared in the header.
+TagLocalizer::~TagLocalizer() = default;
+
+
+TagPoseMeasurement::Ptr TagLocalizer::Localize(timestamp_t timestamp, const Image1b& left_image)
+{
+  CHECK(!left_image.empty()) << "Empty image given to TagLocalizer" << std::endl;
+
+  const std::vector<AprilTags::TagDetection> detections = detector_->extractTags(left_image);
+
+  // The biggest tag in the image has the most accurate corners (relative to its size).
+  const AprilTags::TagDetection* best = nullptr;
+  for (const AprilTags::TagDetection& det : detections) {
+    if (!det.good ||
+        det.hammingDistance > params_.max_hamming_distance ||
+        det.observedPerimeter < params_.min_perimeter_px ||
+        params_.world_P_tag.count(det.id) == 0) {
+      continue;
+    }
+    if (!best || det.observedPerimeter > best->observedPerimeter) {
+      best = &det;
+    }
+  }
+
+  if (!best) {
+    return nullptr;
+  }
+
+  const PinholeCamera& cam = params_.camera;
+  const Matrix4d cam_T_tag = best->getRelativeTransform(params_.tag_size, cam.fx(), cam.fy(), cam.cx(), cam.cy());
+  const Matrix3d cam_R_tag = cam_T_tag.block<3, 3>(0, 0);
+  const Vector3d cam_t_tag = cam_T_tag.block<3, 1>(0, 3);
+
+  if (params_.max_range > 0 && cam_t_tag.norm() > params_.max_range) {
+    return nullptr;
+  }
+
+  // Same corners (in the tag frame) that getRelativeTransform() fits to.
+  const double s = 0.5 * params_.tag_size;
+  const Vector3d tag_corners[4] = {
+    Vector3d(-s, -s, 0), Vector3d(s, -s, 0), Vector3d(s, s, 0), Vector3d(-s, s, 0)
+  };
+
+  double sum_sq_err = 0;
+  for (int i = 0; i < 4; ++i) {
+    const Vector3d p_cam = cam_R_tag * tag_corners[i] + cam_t_tag;
+    if (p_cam.z() <= 0) {
+      return nullptr;
+    }
+    const Vector2d observed(best->p[i].first, best->p[i].second);
+    sum_sq_err += (cam.Project(p_cam) - observed).squaredNorm();
+  }
+
+  const double reprojection_err = std::sqrt(0.25 * sum_sq_err);
+  if (reprojection_err > params_.max_reprojection_err) {
+    return nullptr;
+  }
+
+  const gtsam::Pose3 cam_P_tag(cam_T_tag);
+  const gtsam::Pose3 world_P_body = params_.world_P_tag.at(best->id) * cam_P_tag.inverse() * params_.body_P_cam.inverse();
+
+  return std::make_shared<TagPoseMeasurement>(timestamp, world_P_body, best->id, reprojection_err);
+}
+
+
+}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/timestamp.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vio/tag_pose_measurement.hpp"
+
+#include <gtsam/geometry/Pose3.h>
+
+namespace AprilTags {
+class TagDetector;
+}
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Localizes the body from AprilTags that have a known pose in the world (e.g docking station or
+// survey markers). Tags are detected in the left image, and the pose of the best one (the biggest
+// in the image, with a good enough fit) is turned into a body pose.
+//
+// NOTE(milo): The detector keeps its buffers between calls, so Localize() isn't threadsafe. Use one
+// TagLocalizer per thread, or make sure that calls don't overlap.
+class TagLocalizer final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    std::string tag_family = "36h11";   // One of 16h5, 25h7, 25h9, 36h9, 36h11.
+    double tag_size = 0.16;             // Side length (m) of the black square.
+
+    // Look for quads in an image this many times smaller, then refine the corners and decode the
+    // bits at full resolution. 2 is about 5x faster than 1, but loses tags under ~20px a side.
+    int quad_decimate = 2;
+
+    int max_hamming_distance = 0;       // Bits that a detection's code can differ by.
+    double min_perimeter_px = 80.0;     // Smaller tags give poses that are too noisy to use.
+    double max_reprojection_err = 1.5;  // RMS (px) of the tag corners, reprojected with the pose.
+    double max_range = 5.0;             // Ignore tags farther than this (m), zero turns it off.
+
+    // Only tags in here are used. YAML: a list of { id, world_T_tag } (world_T_tag is a 4x4 matrix).
+    std::map<int, gtsam::Pose3> world_P_tag;
+
+    gtsam::Pose3 body_P_cam = gtsam::Pose3::identity();
+    PinholeCamera camera;               // Left camera of the stereo rig (rectified).
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(TagLocalizer)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(TagLocalizer)
+
+  explicit TagLocalizer(const Params& params);
+  ~TagLocalizer();
+
+  // Returns the world pose of the body from the tags in left_image, or nullptr if no known tag
+  // was found (or its pose was rejected).
+  TagPoseMeasurement::Ptr Localize(timestamp_t timestamp, const Image1b& left_image);
+
+ private:
+  Params params_;
+  std::unique_ptr<AprilTags::TagDetector> detector_;
+};
+
+
+}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/eigen_types.hpp"
+
+#include <gtsam/geometry/Pose3.h>
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// An absolute pose of the body, from an AprilTag with a known pose in the world (see TagLocalizer).
+struct TagPoseMeasurement final
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  MACRO_SHARED_POINTER_TYPEDEFS(TagPoseMeasurement)
+
+  explicit TagPoseMeasurement(timestamp_t timestamp,
+                              const gtsam::Pose3& world_P_body,
+                              int tag_id,
+                              double reprojection_err)
+      : timestamp(timestamp),
+        world_P_body(world_P_body),
+        tag_id(tag_id),
+        reprojection_err(reprojection_err) {}
+
+  timestamp_t timestamp;
+  gtsam::Pose3 world_P_body;
+  int tag_id;
+  double reprojection_err;    // RMS (px) of the tag corners, reprojected with the solved pose.
+};
+
+
+}
+}
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "vio/time_offset_estimator.hpp"
+
+namespace bm {
+namespace vio {
+
+
+void TimeOffsetEstimator::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("window_sec", &window_sec);
+  parser.GetParam("max_offset_sec", &max_offset_sec);
+  parser.GetParam("resolution_sec", &resolution_sec);
+  parser.GetParam("update_every_sec", &update_every_sec);
+  parser.GetParam("min_vision_samples", &min_vision_samples);
+  parser.GetParam("min_rate_stddev", &min_rate_stddev);
+  parser.GetParam("min_correlation", &min_correlation);
+  parser.GetParam("smoothing", &smoothing);
+
+  CHECK_GT(window_sec, 0);
+  CHECK_GT(max_offset_sec, 0);
+  CHECK(resolution_sec > 0 && resolution_sec <= max_offset_sec);
+  CHECK_GT(update_every_sec, 0);
+  CHECK_GE(min_vision_samples, 3);
+  CHECK(smoothing > 0 && smoothing <= 1) << "smoothing must be in (0, 1]" << std::endl;
+}
+
+
+TimeOffsetEstimator::TimeOffsetEstimator(const Params& params)
+    : params_(params) {}
+
+
+void TimeOffsetEstimator::AddGyro(seconds_t t, const Vector3d& w)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const double rate = w.norm();
+  if (gyro_angle_.empty()) {
+    gyro_angle_.emplace_back(t, 0.0);
+    prev_gyro_rate_ = rate;
+    return;
+  }
+
+  // NOTE(milo): Trapezoidal, since holding each measurement constant (like the preintegration does)
+  // would shift the estimate by half of the IMU period. Out of order measurements are ignored.
+  const std::pair<seconds_t, double>& prev = gyro_angle_.back();
+  const double dt = t - prev.first;
+  if (dt <= 0) {
+    return;
+  }
+  gyro_angle_.emplace_back(t, prev.second + 0.5 * (prev_gyro_rate_ + rate) * dt);
+  prev_gyro_rate_ = rate;
+
+  // Keep enough to cover the window at any candidate offset.
+  const seconds_t keep_after = t - params_.window_sec - 4 * params_.max_offset_sec - params_.update_every_sec;
+  while (gyro_angle_.size() > 2 && gyro_angle_.front().first < keep_after) {
+    gyro_angle_.pop_front();
+  }
+}
+
+
+void TimeOffsetEstimator::AddVisionRotation(seconds_t t0, seconds_t t1, double angle)
+{
+  if (t1 <= t0) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  vision_.emplace_back(VisionRate{t0, t1, std::fabs(angle) / (t1 - t0)});
+
+  while (!vision_.empty() && vision_.front().t0 < (t1 - params_.window_sec)) {
+    vision_.pop_front();
+  }
+
+  if ((t1 - last_update_time_) >= params_.update_every_sec) {
+    last_update_time_ = t1;
+    Update();
+  }
+}
+
+
+double TimeOffsetEstimator::GyroAngleAt(seconds_t t) const
+{
+  const auto it = std::lower_bound(gyro_angle_.begin(), gyro_angle_.end(), t,
+      [](const std::pair<seconds_t, double>& a, seconds_t value) { return a.first < value; });
+
+  if (it == gyro_angle_.begin()) {
+    return it->second;
+  }
+  const auto prev = std::prev(it);
+  const double alpha = (t - prev->first) / (it->first - prev->first);
+  return prev->second + alpha * (it->second - prev->second);
+}
+
+
+void TimeOffsetEstimator::Update()
+{
+  if (gyro_angle_.size() < 2) {
+    return;
+  }
+
+  // Only use VO intervals that the gyro covers at every candidate offset, so that all of them are
+  // compared on the same samples.
+  const seconds_t gyro_begin = gyro_angle_.front().first + params_.max_offset_sec;
+  const seconds_t gyro_end = gyro_angle_.back().first - params_.max_offset_sec;
+  std::vector<VisionRate> vision;
+  vision.reserve(vision_.size());
+  for (const VisionRate& v : vision_) {
+    if (v.t0 >= gyro_begin && v.t1 <= gyro_end) {
+      vision.emplace_back(v);
+    }
+  }
+
+  const size_t N = vision.size();
+  if ((int)N < params_.min_vision_samples) {
+    return;
+  }
+
+  // Not enough rotation for the correlation to mean anything.
+  double sum = 0;
+  double sum_sq = 0;
+  for (const VisionRate& v : vision) {
+    sum += v.rate;
+    sum_sq += v.rate * v.rate;
+  }
+  const double mean_v = sum / N;
+  const double var_v = std::max(0.0, sum_sq / N - mean_v * mean_v);
+  if (std::sqrt(var_v) < params_.min_rate_stddev) {
+    return;
+  }
+
+  const int num_steps = (int)std::round(params_.max_offset_sec / params_.resolution_sec);
+  std::vector<double> correlation(2 * num_steps + 1, -1.0);
+  std::vector<double> g(N);
+
+  int best = -1;
+  for (int i = 0; i <= 2 * num_steps; ++i) {
+    const double d = (i - num_steps) * params_.resolution_sec;
+
+    double sum_g = 0;
+    for (size_t j = 0; j < N; ++j) {
+      const VisionRate& v = vision.at(j);
+      g.at(j) = (GyroAngleAt(v.t1 - d) - GyroAngleAt(v.t0 - d)) / (v.t1 - v.t0);
+      sum_g += g.at(j);
+    }
+    const double mean_g = sum_g / N;
+
+    double cov = 0;
+    double var_g = 0;
+    for (size_t j = 0; j < N; ++j) {
+      cov += (vision.at(j).rate - mean_v) * (g.at(j) - mean_g);
+      var_g += (g.at(j) - mean_g) * (g.at(j) - mean_g);
+    }
+    if (var_g <= 0) {
+      continue;
+    }
+
+    correlation.at(i) = cov / std::sqrt(var_g * var_v * N);
+    if (best < 0 || correlation.at(i) > correlation.at(best)) {
+      best = i;
+    }
+  }
+
+  if (best < 0 || correlation.at(best) < params_.min_correlation) {
+    return;
+  }
+
+  // Fit a parabola through the peak and its neighbors to get below resolution_sec.
+  double estimate = (best - num_steps) * params_.resolution_sec;
+  if (best > 0 && best < 2 * num_steps && correlation.at(best - 1) > -1.0 && correlation.at(best + 1) > -1.0) {
+    const double c0 = correlation.at(best - 1);
+    const double c1 = correlation.at(best);
+    const double c2 = correlation.at(best + 1);
+    const double denom = c0 - 2 * c1 + c2;
+    if (denom < 0) {
+      estimate += 0.5 * (c0 - c2) / denom * params_.resolution_sec;
+    }
+  }
+
+  const double offset = (num_updates_.load() == 0) ?
+      estimate : (1.0 - params_.smoothing) * offset_.load() + params_.smoothing * estimate;
+  offset_.store(offset);
+  num_updates_.fetch_add(1);
+
+  LOG(INFO) << "TimeOffsetEstimator: estimate=" << estimate << " correlation=" << correlation.at(best)
+            << " offset=" << offset << std::endl;
+}
+
+
+}
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Estimates the offset between the IMU and camera clocks online, so that IMU timestamps can be
+// corrected before they're aligned with keyposes: t_camera = t_imu + Offset().
+//
+// The gyro's rotation rate and the rotation rate from VO (between consecutive frames) should look
+// the same once they're on the same clock. Every update_every_sec, the mean rate over each VO
+// interval is compared with the mean gyro rate over the same interval shifted by each candidate
+// offset, and the offset with the highest (normalized) correlation wins. Only rotation magnitudes
+// are compared, so the camera-IMU extrinsics don't matter. New estimates are blended into the
+// running one, and are only accepted while the vehicle is rotating enough for them to mean anything.
+//
+// AddGyro() and AddVisionRotation() can be called from different threads. Offset() is lock-free.
+class TimeOffsetEstimator final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double window_sec = 10.0;         // Correlate over this much history.
+    double max_offset_sec = 0.1;      // Search offsets in [-max_offset_sec, max_offset_sec] ...
+    double resolution_sec = 0.002;    // ... in steps of this.
+    double update_every_sec = 2.0;    // Re-estimate this often (in camera time).
+    int min_vision_samples = 30;      // Need this many VO intervals in the window.
+    double min_rate_stddev = 0.05;    // rad/s: Not enough excitation below this.
+    double min_correlation = 0.8;     // Reject estimates with a weaker peak than this.
+    double smoothing = 0.3;           // Weight of each new estimate in the running offset.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(TimeOffsetEstimator)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(TimeOffsetEstimator)
+
+  explicit TimeOffsetEstimator(const Params& params);
+
+  // A raw gyro measurement (rad/s), on the IMU clock.
+  void AddGyro(seconds_t t, const Vector3d& w);
+
+  // The angle (rad) that the camera rotated between two frames, on the camera clock. Every
+  // update_every_sec, this also updates the estimate.
+  void AddVisionRotation(seconds_t t0, seconds_t t1, double angle);
+
+  // Current estimate of t_camera - t_imu (zero until the first accepted estimate).
+  double Offset() const { return offset_.load(); }
+
+  // Number of estimates that were accepted so far.
+  int NumUpdates() const { return num_updates_.load(); }
+
+  const Params& GetParams() const { return params_; }
+
+ private:
+  // The integrated gyro angle at IMU time t, from interpolating the cumulative sum.
+  double GyroAngleAt(seconds_t t) const;
+
+  // Runs the correlation over the current window. Call with mutex_ held.
+  void Update();
+
+ private:
+  Params params_;
+
+  std::mutex mutex_;
+
+  // Cumulative integral of |w| over time, starting at the first gyro measurement.
+  std::deque<std::pair<seconds_t, double>> gyro_angle_;
+  double prev_gyro_rate_ = 0;
+
+  // Each VO interval as (t0, t1, mean rate).
+  struct VisionRate final
+  {
+    seconds_t t0;
+    seconds_t t1;
+    double rate;
+  };
+  std::deque<VisionRate> vision_;
+  seconds_t last_update_time_ = kMinSeconds;
+
+  std::atomic<double> offset_{0.0};
+  std::atomic<int> num_updates_{0};
+};
+
+
+}
+}
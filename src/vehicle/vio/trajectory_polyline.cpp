@@ -0,0 +1,44 @@
+#include "vio/trajectory_polyline.hpp"
+
+namespace bm {
+namespace vio {
+
+
+bool TrajectoryPolyline::Add(const Matrix4d& world_T_body)
+{
+  const Vector3d t_world_body = world_T_body.block<3, 1>(0, 3);
+
+  // NOTE(milo): The first pose is always drawn, with its axes.
+  if (num_added_++ == 0) {
+    points_.emplace_back(t_world_body);
+    if (params_.axes_spacing > 0) {
+      axes_.emplace_back(world_T_body);
+    }
+    t_world_prev_ = t_world_body;
+    return true;
+  }
+
+  bool changed = false;
+
+  // Spacing is measured along the path, so that a trajectory that goes back and forth still gets
+  // axes along each pass.
+  path_since_axes_ += (t_world_body - t_world_prev_).norm();
+  t_world_prev_ = t_world_body;
+
+  if (params_.axes_spacing > 0 && path_since_axes_ >= params_.axes_spacing) {
+    axes_.emplace_back(world_T_body);
+    path_since_axes_ = 0;
+    changed = true;
+  }
+
+  if ((t_world_body - points_.back()).norm() >= params_.min_spacing) {
+    points_.emplace_back(t_world_body);
+    changed = true;
+  }
+
+  return changed;
+}
+
+
+}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+typedef std::vector<Matrix4d, Eigen::aligned_allocator<Matrix4d>> VecMatrix4d;
+
+
+// How a trajectory is thinned out for drawing.
+struct TrajectoryParams final
+{
+  double min_spacing = 0.05;  // Skip poses closer than this to the last point drawn (m, 0 = draw all).
+  double axes_spacing = 5.0;  // Draw a pose's axes once every this far along the path (m, 0 = OFF).
+};
+
+
+// A trajectory for the visualizer, drawn as one polyline (plus a few sparse axes) instead of a widget
+// per pose. At 200 Hz a groundtruth trajectory has tens of thousands of poses, which VTK can't redraw
+// as separate widgets, but only a fraction of them are far enough apart to see.
+class TrajectoryPolyline final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(TrajectoryPolyline)
+
+  explicit TrajectoryPolyline(const TrajectoryParams& params) : params_(params) {}
+
+  // Appends the next pose. Returns true if it changed what's drawn (a new point or axes).
+  bool Add(const Matrix4d& world_T_body);
+
+  // The points and axes to draw.
+  const std::vector<Vector3d>& Points() const { return points_; }
+  const VecMatrix4d& Axes() const { return axes_; }
+
+  // Number of poses added, including the ones that aren't drawn.
+  size_t NumAdded() const { return num_added_; }
+
+ private:
+  TrajectoryParams params_;
+
+  std::vector<Vector3d> points_;
+  VecMatrix4d axes_;
+
+  Vector3d t_world_prev_ = Vector3d::Zero();
+  double path_since_axes_ = 0;    // Distance traveled since the last axes were drawn.
+  size_t num_added_ = 0;
+};
+
+
+}
+}
@@ -1,5 +1,7 @@
+#include <algorithm>
+#include <cmath>
+
 #include <glog/logging.h>
-#include <iostream>
 
 #include "vio/trilateration.hpp"
 
@@ -44,33 +46,34 @@ static double ComputeRangeError(const MultiRange& ranges,
 }
 
 
-// Computes the Jacobian of the range observation function: J = df / dX.
-// In this case, each row J(i) is simply the unit vector from range beacon i to the robot position.
+// Computes the Gauss-Newton normal equations H * dX = g for the range observation function. Each
+// Jacobian row J(i) is simply the unit vector from range beacon i to the robot position, so H and g
+// are accumulated one beacon at a time with fixed-size blocks (no M x 3 Jacobian or M x M weights).
 static void LinearizeRange(const MultiRange& ranges,
-                          const Vector3d& world_t_body,
-                          Eigen::MatrixXd& J,
-                          Eigen::VectorXd& R)
+                           const std::vector<double>& sigmas,
+                           const Vector3d& world_t_body,
+                           Matrix3d& H,
+                           Vector3d& g)
 {
-  const size_t M = ranges.size();
-  CHECK_EQ(3, J.cols());
-  CHECK_EQ(M, J.rows());
-  CHECK_EQ(M, R.rows());
+  H.setZero();
+  g.setZero();
 
-  for (size_t i = 0; i < M; ++i) {
+  for (size_t i = 0; i < ranges.size(); ++i) {
     const RangeMeasurement& meas = ranges[i];
-    const double r_pred = (world_t_body - meas.point).norm();
+    const Vector3d d = world_t_body - meas.point;
+    const double r_pred = d.norm();
     const double e = r_pred - meas.range;
+    const double w = 1.0 / (sigmas[i]*sigmas[i]);
 
-    R(i) = 0.5*e*e;
+    // Direction of INCREASING range. If the robot is right on a beacon any direction works.
+    const Vector3d j = (r_pred > 1e-9) ? Vector3d(d / r_pred) : Vector3d::UnitX();
 
-    // Direction of INCREASING range.
-    const Vector3d unit_range_direction = (world_t_body - meas.point).normalized();
-    J.row(i) = unit_range_direction;
+    H.noalias() += w * j * j.transpose();
+    g.noalias() -= w * e * j;
   }
 }
 
 
-
 double TrilateratePosition(const MultiRange& ranges,
                           const std::vector<double>& sigmas,
                           Vector3d& world_t_body,
@@ -81,79 +84,163 @@ double TrilateratePosition(const MultiRange& ranges,
   CHECK_GE(ranges.size(), 3ul) << "Need at least 3 range measurements for trilateration" << std::endl;
   CHECK_EQ(ranges.size(), sigmas.size()) << "Must pass in a measurement noise for each range" << std::endl;
 
-  const size_t M = ranges.size();
-
-  // Each Jacobian row corresponds to a range observation, and each column corresponds to x, y, z variables.
-  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(M, 3);
-
-  // Each residual entry corresponds to a range observation.
-  Eigen::VectorXd R = Eigen::VectorXd::Zero(M);
-
-  // Inverse variance matrix: http://people.duke.edu/~hpgavin/ce281/lm.pdf
-  Eigen::MatrixXd W = Eigen::MatrixXd::Zero(M, M);
-  for (size_t i = 0; i < M; ++i) {
-    W(i, i) = 1.0 / (sigmas[i]*sigmas[i]);
-  }
+  Matrix3d H;
+  Vector3d g;
 
   double err;
-  LinearizeRange(ranges, world_t_body, J, R);
+  LinearizeRange(ranges, sigmas, world_t_body, H, g);
   double err_prev = ComputeRangeError(ranges, sigmas, world_t_body);
-  Matrix3d H = J.transpose() * W * J;
   double lambda = 1e-3 * MaxDiagonal(H);
 
   const double lambda_k_increase = 2.0;
   const double lambda_k_decrease = 3.0;
-  const double step_size = 0.5f;
 
   for (int iter = 0; iter < max_iters; ++iter) {
-    H = J.transpose() * W * J;
-    const Vector3d g = -J.transpose() * W * R;
+    if (err_prev < min_error) {
+      break;
+    }
 
     // Levenberg-Marquardt diagonal damping thing.
     // Equation (13): http://people.duke.edu/~hpgavin/ce281/lm.pdf
-    H.diagonal() += lambda * H.diagonal();
-
-    Eigen::ColPivHouseholderQR<Matrix3d> solver(H);
-    const Vector3d dX = step_size * solver.solve(g);
+    Matrix3d H_damped = H;
+    H_damped.diagonal() += lambda * H.diagonal();
+
+    // NOTE(milo): H is symmetric, and positive definite unless the beacons are collinear with the
+    // robot, so try Cholesky first.
+    Vector3d dX;
+    const Eigen::LDLT<Matrix3d> ldlt(H_damped);
+    if (ldlt.info() == Eigen::Success && ldlt.isPositive()) {
+      dX = ldlt.solve(g);
+    } else {
+      dX = Eigen::ColPivHouseholderQR<Matrix3d>(H_damped).solve(g);
+    }
 
     // Compute the error if we were to take the step dX.
     const Vector3d world_t_body_test = world_t_body + dX;
     err = ComputeRangeError(ranges, sigmas, world_t_body_test);
 
-    if (err < min_error || err_prev < min_error) {
-      break;
-    }
-
     // If error gets worse, want to increase the damping factor (more like gradient descent).
     // See: https://en.wikipedia.org/wiki/Levenberg%E2%80%93Marquardt_algorithm
     if (err > err_prev) {
       lambda *= lambda_k_increase;
-      // printf("Error increased, lambda = %f\n", lambda);
 
     // If error improves, decrease the damping factor (more like Gauss-Newton).
     // See: https://en.wikipedia.org/wiki/Levenberg%E2%80%93Marquardt_algorithm
     } else {
       lambda /= lambda_k_decrease;
-      // printf("Error decreased, err = %f lambda = %f\n", err, lambda);
 
       // Gauss-Newton update: https://en.wikipedia.org/wiki/Gauss%E2%80%93Newton_algorithm.
       world_t_body = world_t_body_test;
 
-      // Because we changed X, need to re-linearize the image formation model.
-      LinearizeRange(ranges, world_t_body, J, R);
-      err_prev = ComputeRangeError(ranges, sigmas, world_t_body);
+      // Because we changed X, need to re-linearize the range observation model.
+      LinearizeRange(ranges, sigmas, world_t_body, H, g);
+      err_prev = err;
     }
   }
 
-  LinearizeRange(ranges, world_t_body, J, R);
+  LinearizeRange(ranges, sigmas, world_t_body, H, g);
   err = ComputeRangeError(ranges, sigmas, world_t_body);
 
   // Equation (21): http://people.duke.edu/~hpgavin/ce281/lm.pdf
-  solution_cov = (J.transpose() * W * J).inverse();
+  solution_cov = H.inverse();
 
   return err;
 }
 
 
+bool TrilaterateClosedForm(const MultiRange& ranges, Vector3d& world_t_body)
+{
+  CHECK_GE(ranges.size(), 3ul) << "Need at least 3 range measurements for trilateration" << std::endl;
+
+  // Subtracting the sphere equation of beacon 0 from the others gives a linear system:
+  //    q_i^T x = 0.5 * (|q_i|^2 - r_i^2 + r_0^2)
+  // where q_i = p_i - p_0 and x = world_t_body - p_0. Solve it with the 3x3 normal equations.
+  const Vector3d& p0 = ranges.at(0).point;
+  const double r0_sq = ranges.at(0).range * ranges.at(0).range;
+
+  Matrix3d A = Matrix3d::Zero();
+  Vector3d c = Vector3d::Zero();
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    const Vector3d q = ranges[i].point - p0;
+    const double b = 0.5 * (q.squaredNorm() - ranges[i].range*ranges[i].range + r0_sq);
+    A.noalias() += q * q.transpose();
+    c.noalias() += b * q;
+  }
+
+  // Eigenvalues are sorted in increasing order.
+  const Eigen::SelfAdjointEigenSolver<Matrix3d> eig(A);
+  const Vector3d& lambda = eig.eigenvalues();
+  const Matrix3d& V = eig.eigenvectors();
+
+  const double tol = 1e-6 * lambda(2);
+
+  // Collinear (or coincident) beacons: the position could be anywhere on a circle.
+  if (lambda(2) <= 0 || lambda(1) <= tol) {
+    return false;
+  }
+
+  // The beacons span 3D, so the system has a unique solution.
+  if (lambda(0) > tol) {
+    world_t_body = p0 + V * (V.transpose() * c).cwiseQuotient(lambda);
+    return true;
+  }
+
+  // Coplanar beacons: solve within the plane, then get the distance from the plane from the ranges.
+  const Vector3d n = V.col(0);
+  const Vector3d x_plane = (V.col(1).dot(c) / lambda(1)) * V.col(1) +
+                           (V.col(2).dot(c) / lambda(2)) * V.col(2);
+
+  double s_sq = 0;
+  for (const RangeMeasurement& meas : ranges) {
+    s_sq += meas.range*meas.range - (x_plane - (meas.point - p0)).squaredNorm();
+  }
+  s_sq /= static_cast<double>(ranges.size());
+
+  // NOTE(milo): With noisy ranges s_sq can come out slightly negative, and then the closest solution
+  // is in the plane.
+  const double s = std::sqrt(std::max(0.0, s_sq));
+  const double side = (n.dot(world_t_body - p0) < 0) ? -1.0 : 1.0;
+
+  world_t_body = p0 + x_plane + side * s * n;
+  return true;
+}
+
+
+double RangeMahalanobisSq(const RangeMeasurement& range,
+                          const Vector3d& world_t_body,
+                          const Matrix3d& cov_t,
+                          double sigma_range)
+{
+  const Vector3d d = world_t_body - range.point;
+  const double r_pred = d.norm();
+  const double e = range.range - r_pred;
+
+  // Innovation covariance S = J * cov_t * J^T + sigma^2, where J is the unit range direction.
+  const Vector3d j = (r_pred > 1e-9) ? Vector3d(d / r_pred) : Vector3d::UnitX();
+  const double S = j.dot(cov_t * j) + sigma_range*sigma_range;
+
+  return e*e / S;
+}
+
+
+int GateRanges(const MultiRange& ranges,
+               const Vector3d& world_t_body,
+               const Matrix3d& cov_t,
+               double sigma_range,
+               double max_mahalanobis_sq,
+               MultiRange& inliers)
+{
+  int num_rejected = 0;
+  for (const RangeMeasurement& meas : ranges) {
+    if (RangeMahalanobisSq(meas, world_t_body, cov_t, sigma_range) <= max_mahalanobis_sq) {
+      inliers.emplace_back(meas);
+    } else {
+      ++num_rejected;
+    }
+  }
+  return num_rejected;
+}
+
+
 }
 }
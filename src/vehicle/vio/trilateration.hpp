@@ -19,5 +19,30 @@ double TrilateratePosition(const MultiRange& ranges,
                           int max_iters,
                           double min_error = 1e-3);
 
+
+// Closed-form (linear least squares) position from 3 or more ranges, e.g to initialize
+// TrilateratePosition(). If the beacons are coplanar (e.g all at the water surface), the ranges
+// can't tell which side of the plane the robot is on, so it's taken from world_t_body (the guess).
+// Returns false (and leaves world_t_body alone) if the beacons are collinear.
+bool TrilaterateClosedForm(const MultiRange& ranges, Vector3d& world_t_body);
+
+
+// Squared Mahalanobis distance of a range from the one predicted at world_t_body, where cov_t is
+// the covariance of world_t_body and sigma_range is the range measurement noise.
+double RangeMahalanobisSq(const RangeMeasurement& range,
+                          const Vector3d& world_t_body,
+                          const Matrix3d& cov_t,
+                          double sigma_range);
+
+
+// Puts the ranges with a squared Mahalanobis distance <= max_mahalanobis_sq in "inliers", and
+// returns the number that were rejected.
+int GateRanges(const MultiRange& ranges,
+               const Vector3d& world_t_body,
+               const Matrix3d& cov_t,
+               double sigma_range,
+               double max_mahalanobis_sq,
+               MultiRange& inliers);
+
 }
 }
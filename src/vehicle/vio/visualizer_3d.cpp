@@ -11,8 +11,38 @@ namespace bm {
 namespace vio {
 
 
+void Visualizer3D::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("show_uncertainty", &show_uncertainty);
+  parser.GetParam("uncertainty_update_threshold", &uncertainty_update_threshold);
+  parser.GetParam("show_frustums", &show_frustums);
+  parser.GetParam("max_stored_poses", &max_stored_poses);
+  parser.GetParam("max_stored_landmarks", &max_stored_landmarks);
+  parser.GetParam("landmark_lod_near_distance", &landmark_lod.near_distance);
+  parser.GetParam("landmark_lod_max_age", &landmark_lod.max_age);
+  parser.GetParam("landmark_lod_far_stride", &landmark_lod.far_stride);
+  parser.GetParam("trajectory_min_spacing", &trajectory.min_spacing);
+  parser.GetParam("trajectory_axes_spacing", &trajectory.axes_spacing);
+  parser.GetParam("render_hz", &render_hz);
+  parser.GetParam("max_camera_pose_queue", &max_camera_pose_queue);
+
+  YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_left, body_T_right);
+}
+
+
+#ifdef BM_ENABLE_VIZ
+
 static const std::string kWidgetNameRealtime = "CAM_REALTIME_WIDGET";
-static const double kLandmarkSphereRadius = 0.01;
+static const std::string kWidgetNameNearLandmarks = "lmks_near";
+static const std::string kWidgetNameFarLandmarks = "lmks_far";
+static const double kNearLandmarkPointSize = 3.0;
+static const std::string kWidgetNameMesh = "mesh";
+static const std::string kWidgetNameGroundtruthTrajectory = "gt_trajectory";
+static const std::string kWidgetNameEstimatedTrajectory = "est_trajectory";
+static const double kTrajectoryAxesScale = 0.5;
+
+// Redo the LOD split once the viewer has moved this fraction of the near distance.
+static const double kLodResplitFraction = 0.1;
 
 
 static std::string GetCameraPoseWidgetName(uid_t cam_id)
@@ -21,16 +51,13 @@ static std::string GetCameraPoseWidgetName(uid_t cam_id)
 }
 
 
-static std::string GetLandmarkWidgetName(uid_t lmk_id)
+static std::string GetTrajectoryAxesWidgetName(const std::string& trajectory_name, size_t i)
 {
-  return "lmk_" + std::to_string(lmk_id);
+  return trajectory_name + "_axes_" + std::to_string(i);
 }
 
 
-static std::string GetGroundtruthPoseWidgetName(uid_t pose_id)
-{
-  return "gt_" + std::to_string(pose_id);
-}
+static const std::string kWidgetNamePositionCov = "position_cov";
 
 
 static cv::Affine3d EigenMatrix4dToCvAffine3d(const Matrix4d& world_T_cam)
@@ -45,17 +72,6 @@ static cv::Affine3d EigenMatrix4dToCvAffine3d(const Matrix4d& world_T_cam)
 }
 
 
-void Visualizer3D::Params::LoadParams(const YamlParser& parser)
-{
-  parser.GetParam("show_uncertainty", &show_uncertainty);
-  parser.GetParam("show_frustums", &show_frustums);
-  parser.GetParam("max_stored_poses", &max_stored_poses);
-  parser.GetParam("max_stored_landmarks", &max_stored_landmarks);
-
-  YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_left, body_T_right);
-}
-
-
 void Visualizer3D::AddCameraPose(uid_t cam_id,
                                  const Image1b& left_image,
                                  const Matrix4d& world_T_cam,
@@ -85,24 +101,23 @@ void Visualizer3D::AddCameraPose(const CameraPoseData& data)
 
   viz_.showWidget(widget_name, widget_keyframe, world_T_cam_cv);
   widget_names_.insert(widget_name);
+  t_world_viewer_ = data.world_T_cam.block<3, 1>(0, 3);
+  estimated_trajectory_changed_ |= estimated_trajectory_.Add(data.world_T_cam);
 
-  // Show the position covariance as a 3D ellipsoid.
+  // Show the position covariance as a 3D ellipsoid: a unit sphere, scaled and rotated by its pose.
   if (params_.show_uncertainty && data.position_cov) {
-    if (widget_names_.count("position_cov") != 0) {
-      viz_.removeWidget("position_cov");
+    if (widget_names_.count(kWidgetNamePositionCov) == 0) {
+      const cv::viz::WCloud sphere_widget(ToCvPoints3d(sphere_points_.Points()), cv::viz::Color::yellow());
+      viz_.showWidget(kWidgetNamePositionCov, sphere_widget);
+      widget_names_.insert(kWidgetNamePositionCov);
     }
 
-    const EllipsoidParameters ellipsoid_params = ComputeCovarianceEllipsoid(*data.position_cov, 1.0);
-    const CvPoints3 ellipsoid_points = ToCvPoints3d(GetEllipsoidPoints(ellipsoid_params.scales, sphere_points_));
-
-    const Matrix3d world_R_ellipsoid = EllipsoidRotationInWorld(ellipsoid_params);
-    const cv::viz::WCloud ellipsoid_widget(ellipsoid_points, cv::viz::Color::yellow());
+    position_cov_ellipsoid_.Update(*data.position_cov);
 
     Matrix4d world_T_ellipsoid = Matrix4d::Identity();
-    world_T_ellipsoid.block<3, 3>(0, 0) = world_R_ellipsoid;
+    world_T_ellipsoid.block<3, 3>(0, 0) = position_cov_ellipsoid_.Transform();
     world_T_ellipsoid.block<3, 1>(0, 3) = data.world_T_cam.block<3, 1>(0, 3);
-    const cv::Affine3d world_T_ellipsoid_cv = EigenMatrix4dToCvAffine3d(world_T_ellipsoid);
-    viz_.showWidget("position_cov", ellipsoid_widget, world_T_ellipsoid_cv);
+    viz_.setWidgetPose(kWidgetNamePositionCov, EigenMatrix4dToCvAffine3d(world_T_ellipsoid));
   }
 
   viz_lock_.unlock();
@@ -111,14 +126,25 @@ void Visualizer3D::AddCameraPose(const CameraPoseData& data)
 
 void Visualizer3D::UpdateCameraPose(uid_t cam_id, const Matrix4d& world_T_cam)
 {
-  update_camera_pose_queue_.Push(CameraPoseData(cam_id, Image1b(), world_T_cam, false, nullptr));
+  std::lock_guard<std::mutex> lock(mailbox_lock_);
+  for (CameraPoseData& data : pending_camera_poses_) {
+    if (data.cam_id == cam_id) {
+      data.world_T_cam = world_T_cam;
+      return;
+    }
+  }
+  pending_camera_poses_.emplace_back(cam_id, Image1b(), world_T_cam, false, nullptr);
 }
 
 
 void Visualizer3D::UpdateCameraPose(const CameraPoseData& data)
 {
+  // NOTE(milo): The camera might never have been added, if it was dropped from a full queue.
   const std::string widget_name = GetCameraPoseWidgetName(data.cam_id);
-  CHECK(widget_names_.count(widget_name) != 0) << "Tried to update camera pose that doesn't exist yet: " << data.cam_id << std::endl;
+  if (widget_names_.count(widget_name) == 0) {
+    LOG(WARNING) << "Tried to update camera pose that doesn't exist: " << data.cam_id << std::endl;
+    return;
+  }
 
   const cv::Affine3d world_T_cam_cv = EigenMatrix4dToCvAffine3d(data.world_T_cam);
 
@@ -130,7 +156,14 @@ void Visualizer3D::UpdateCameraPose(const CameraPoseData& data)
 
 void Visualizer3D::UpdateBodyPose(const std::string& name, const Matrix4d& world_T_body)
 {
-  update_body_pose_queue_.Push(BodyPoseData(name, world_T_body));
+  std::lock_guard<std::mutex> lock(mailbox_lock_);
+  for (BodyPoseData& data : pending_body_poses_) {
+    if (data.name == name) {
+      data.world_T_body = world_T_body;
+      return;
+    }
+  }
+  pending_body_poses_.emplace_back(name, world_T_body);
 }
 
 
@@ -142,6 +175,7 @@ void Visualizer3D::UpdateBodyPose(const BodyPoseData& data)
     viz_lock_.lock();
     viz_.showWidget(data.name, cv::viz::WCameraPosition(), world_T_body_cv);
     viz_lock_.unlock();
+    widget_names_.insert(data.name);
   }
 
   viz_lock_.lock();
@@ -152,46 +186,139 @@ void Visualizer3D::UpdateBodyPose(const BodyPoseData& data)
 
 void Visualizer3D::AddOrUpdateLandmark(const std::vector<uid_t>& lmk_ids, const std::vector<Vector3d>& t_world_lmks)
 {
-  viz_lock_.lock();
+  CHECK_EQ(lmk_ids.size(), t_world_lmks.size());
 
+  std::lock_guard<std::mutex> lock(mailbox_lock_);
   for (size_t i = 0; i < lmk_ids.size(); ++i) {
-    const uid_t lmk_id = lmk_ids.at(i);
-    const Vector3d& t_world_lmk = t_world_lmks.at(i);
-    const std::string widget_name = GetLandmarkWidgetName(lmk_id);
-
-    Matrix4d world_T_lmk = Matrix4d::Identity();
-    world_T_lmk.block<3, 1>(0, 3) = t_world_lmk;
-    const cv::Affine3d world_T_lmk_cv = EigenMatrix4dToCvAffine3d(world_T_lmk);
-
-    if (set_live_lmk_ids_.count(lmk_id) == 0) {
-      const cv::viz::WSphere widget_lmk(cv::Point3d(0, 0, 0), kLandmarkSphereRadius, 5, cv::viz::Color::white());
-      viz_.showWidget(widget_name, widget_lmk, world_T_lmk_cv);
-      set_live_lmk_ids_.insert(lmk_id);
-      queue_live_lmk_ids_.push(lmk_id);
-    } else {
-      viz_.setWidgetPose(widget_name, world_T_lmk_cv);
+    // NOTE(milo): Can't draw more than max_stored_landmarks anyways, so ignore new ones past that.
+    if ((int)pending_lmks_.size() >= params_.max_stored_landmarks && pending_lmks_.count(lmk_ids.at(i)) == 0) {
+      continue;
     }
+    pending_lmks_[lmk_ids.at(i)] = t_world_lmks.at(i);
   }
+}
+
+
+void Visualizer3D::AddOrUpdateLandmarks(const std::unordered_map<uid_t, Vector3d>& t_world_lmks)
+{
+  for (const auto& item : t_world_lmks) {
+    lmk_cloud_.Update(item.first, item.second);
+  }
+  lmk_cloud_.NextBatch();
+}
+
 
-  RemoveOldLandmarks();
+void Visualizer3D::RedrawLandmarks()
+{
+  // NOTE(milo): Only the upload to VTK happens under viz_lock_. Thousands of separate widgets used
+  // to hold it for most of each redraw.
+  lmk_cloud_.Split(t_world_viewer_, params_.landmark_lod, near_lmk_points_, far_lmk_points_);
+  t_world_viewer_at_split_ = t_world_viewer_;
+
+  const std::string names[2] = { kWidgetNameNearLandmarks, kWidgetNameFarLandmarks };
+  const CvPoints3f* points[2] = { &near_lmk_points_, &far_lmk_points_ };
+  const cv::viz::Color colors[2] = { cv::viz::Color::white(), cv::viz::Color::gray() };
 
+  viz_lock_.lock();
+  for (int i = 0; i < 2; ++i) {
+    if (points[i]->empty()) {
+      if (widget_names_.erase(names[i]) > 0) {
+        viz_.removeWidget(names[i]);
+      }
+      continue;
+    }
+
+    // Replaces the old cloud, if there is one.
+    viz_.showWidget(names[i], cv::viz::WCloud(*points[i], colors[i]));
+    if (i == 0) {
+      viz_.setRenderingProperty(names[i], cv::viz::POINT_SIZE, kNearLandmarkPointSize);
+    }
+    widget_names_.insert(names[i]);
+  }
   viz_lock_.unlock();
 }
 
 
+void Visualizer3D::UpdateMesh(const std::vector<Vector3d>& vertices, const std::vector<Vector3i>& triangles)
+{
+  std::lock_guard<std::mutex> lock(mailbox_lock_);
+  pending_has_mesh_ = true;
+  pending_mesh_vertices_ = vertices;
+  pending_mesh_triangles_ = triangles;
+}
+
+
+void Visualizer3D::RedrawMesh(const std::vector<Vector3d>& vertices, const std::vector<Vector3i>& triangles)
+{
+  std::lock_guard<std::mutex> lock(viz_lock_);
+  if (vertices.empty() || triangles.empty()) {
+    if (widget_names_.erase(kWidgetNameMesh) > 0) {
+      viz_.removeWidget(kWidgetNameMesh);
+    }
+    return;
+  }
+
+  // NOTE(milo): WMesh polygons are a flat list of [num_vertices, v0, v1, v2, ...].
+  cv::Mat cloud(1, (int)vertices.size(), CV_32FC3);
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    cloud.at<cv::Vec3f>(0, (int)i) = cv::Vec3f(vertices[i].x(), vertices[i].y(), vertices[i].z());
+  }
+  cv::Mat polygons(1, 4 * (int)triangles.size(), CV_32SC1);
+  for (size_t i = 0; i < triangles.size(); ++i) {
+    int* polygon = polygons.ptr<int>(0) + 4 * i;
+    polygon[0] = 3;
+    polygon[1] = triangles[i].x();
+    polygon[2] = triangles[i].y();
+    polygon[3] = triangles[i].z();
+  }
+
+  cv::viz::WMesh widget_mesh(cloud, polygons);
+  widget_mesh.setColor(cv::viz::Color::cyan());
+  viz_.showWidget(kWidgetNameMesh, widget_mesh);
+  viz_.setRenderingProperty(kWidgetNameMesh, cv::viz::REPRESENTATION, cv::viz::REPRESENTATION_WIREFRAME);
+  widget_names_.insert(kWidgetNameMesh);
+}
+
+
 void Visualizer3D::AddLandmarkObservation(uid_t cam_id, uid_t lmk_id, const LandmarkObservation& lmk_obs)
 {
 }
 
 
-void Visualizer3D::AddGroundtruthPose(uid_t pose_id, const Matrix4d& world_T_body)
+void Visualizer3D::AddGroundtruthPose(const Matrix4d& world_T_body)
 {
-  const cv::Affine3d& world_T_body_cv = EigenMatrix4dToCvAffine3d(world_T_body);
-  const std::string& name = GetGroundtruthPoseWidgetName(pose_id);
+  std::lock_guard<std::mutex> lock(mailbox_lock_);
+  pending_groundtruth_poses_.emplace_back(world_T_body);
+}
 
-  viz_lock_.lock();
-  viz_.showWidget(name, cv::viz::WCameraPosition(0.5), world_T_body_cv);
-  viz_lock_.unlock();
+
+void Visualizer3D::RedrawTrajectory(const std::string& name,
+                                    const TrajectoryPolyline& trajectory,
+                                    size_t& num_axes_drawn)
+{
+  const std::vector<Vector3d>& points = trajectory.Points();
+  const VecMatrix4d& axes = trajectory.Axes();
+
+  cv::Mat polyline(1, (int)points.size(), CV_64FC3);
+  for (size_t i = 0; i < points.size(); ++i) {
+    polyline.at<cv::Vec3d>(0, (int)i) = cv::Vec3d(points[i].x(), points[i].y(), points[i].z());
+  }
+
+  const cv::viz::Color color = (name == kWidgetNameGroundtruthTrajectory) ? cv::viz::Color::green() : cv::viz::Color::blue();
+
+  std::lock_guard<std::mutex> lock(viz_lock_);
+
+  // Replaces the old polyline, if there is one. Axes are never moved, so only new ones are sent.
+  if (points.size() >= 2) {
+    viz_.showWidget(name, cv::viz::WPolyLine(polyline, color));
+    widget_names_.insert(name);
+  }
+
+  for (; num_axes_drawn < axes.size(); ++num_axes_drawn) {
+    const std::string axes_name = GetTrajectoryAxesWidgetName(name, num_axes_drawn);
+    viz_.showWidget(axes_name, cv::viz::WCameraPosition(kTrajectoryAxesScale), EigenMatrix4dToCvAffine3d(axes.at(num_axes_drawn)));
+    widget_names_.insert(axes_name);
+  }
 }
 
 
@@ -217,43 +344,98 @@ void Visualizer3D::SetViewerPose(const Matrix4d& world_T_body)
 }
 
 
-void Visualizer3D::RemoveOldLandmarks()
+void Visualizer3D::ApplyPendingUpdates()
 {
-  // If too many landmarks, remove the oldest ones.
-  if ((int)set_live_lmk_ids_.size() > params_.max_stored_landmarks) {
-    const int num_to_erase = set_live_lmk_ids_.size() - params_.max_stored_landmarks;
-
-    for (int i = 0; i < num_to_erase; ++i) {
-      const uid_t lmk_id_to_erase = queue_live_lmk_ids_.front();
-      viz_.removeWidget(GetLandmarkWidgetName(lmk_id_to_erase));
-      queue_live_lmk_ids_.pop();
-      set_live_lmk_ids_.erase(lmk_id_to_erase);
-    }
+  std::vector<CameraPoseData> camera_poses;
+  std::vector<BodyPoseData> body_poses;
+  std::unordered_map<uid_t, Vector3d> lmks;
+  bool has_mesh = false;
+  std::vector<Vector3d> mesh_vertices;
+  std::vector<Vector3i> mesh_triangles;
+  VecMatrix4d groundtruth_poses;
+
+  // Swap the mailboxes out so that producers can keep going while we draw.
+  mailbox_lock_.lock();
+  std::swap(camera_poses, pending_camera_poses_);
+  std::swap(body_poses, pending_body_poses_);
+  std::swap(lmks, pending_lmks_);
+  std::swap(has_mesh, pending_has_mesh_);
+  std::swap(mesh_vertices, pending_mesh_vertices_);
+  std::swap(mesh_triangles, pending_mesh_triangles_);
+  std::swap(groundtruth_poses, pending_groundtruth_poses_);
+  mailbox_lock_.unlock();
+
+  // NOTE(milo): Add new cameras first, since the updates might refer to them.
+  while (!add_camera_pose_queue_.Empty()) {
+    AddCameraPose(add_camera_pose_queue_.Pop());
+  }
+
+  for (const CameraPoseData& data : camera_poses) {
+    UpdateCameraPose(data);
+  }
+
+  for (const BodyPoseData& data : body_poses) {
+    UpdateBodyPose(data);
+  }
+
+  if (!lmks.empty()) {
+    AddOrUpdateLandmarks(lmks);
+  }
+
+  // Distant landmarks only change LOD when the viewer moves, so they don't need a redraw otherwise.
+  const double near_distance = params_.landmark_lod.near_distance;
+  const bool viewer_moved = near_distance > 0 &&
+      (t_world_viewer_ - t_world_viewer_at_split_).norm() > (kLodResplitFraction * near_distance);
+  if (!lmks.empty() || viewer_moved) {
+    RedrawLandmarks();
+  }
+
+  if (has_mesh) {
+    RedrawMesh(mesh_vertices, mesh_triangles);
+  }
+
+  bool groundtruth_changed = false;
+  for (const Matrix4d& world_T_body : groundtruth_poses) {
+    groundtruth_changed |= groundtruth_trajectory_.Add(world_T_body);
+  }
+  if (groundtruth_changed) {
+    RedrawTrajectory(kWidgetNameGroundtruthTrajectory, groundtruth_trajectory_, num_groundtruth_axes_drawn_);
+  }
+
+  if (estimated_trajectory_changed_) {
+    RedrawTrajectory(kWidgetNameEstimatedTrajectory, estimated_trajectory_, num_estimated_axes_drawn_);
+    estimated_trajectory_changed_ = false;
   }
 }
 
 
 void Visualizer3D::RedrawThread()
 {
+  const std::chrono::microseconds period(static_cast<int64_t>(1e6 / std::max(0.1f, params_.render_hz)));
+  std::chrono::steady_clock::time_point next_redraw = std::chrono::steady_clock::now();
+  size_t prev_num_dropped = 0;
+
   while (!viz_.wasStopped()) {
+    ApplyPendingUpdates();
+
     viz_lock_.lock();
     viz_.spinOnce(1, false);
     viz_lock_.unlock();
 
-    while (!add_camera_pose_queue_.Empty()) {
-      AddCameraPose(add_camera_pose_queue_.Pop());
-    }
-
-    while (!update_camera_pose_queue_.Empty()) {
-      UpdateCameraPose(update_camera_pose_queue_.Pop());
+    const size_t num_dropped = add_camera_pose_queue_.Dropped();
+    if (num_dropped > prev_num_dropped) {
+      LOG(WARNING) << "Visualizer3D is falling behind, dropped "
+                   << (num_dropped - prev_num_dropped) << " camera poses" << std::endl;
+      prev_num_dropped = num_dropped;
     }
 
-    while (!update_body_pose_queue_.Empty()) {
-      UpdateBodyPose(update_body_pose_queue_.Pop());
+    // NOTE(milo): Sleep until the next frame, which also lets other functions get the mutex.
+    next_redraw += period;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (next_redraw < now) {
+      next_redraw = now;
     }
-
-    // NOTE(milo): Need to sleep for a bit to let other functions get the mutex.
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::this_thread::sleep_until(next_redraw);
   }
 
   LOG(INFO) << "Shutting down RedrawThread ..." << std::endl;
@@ -262,8 +444,10 @@ void Visualizer3D::RedrawThread()
 
 Visualizer3D::~Visualizer3D()
 {
-  redraw_thread_.join();
-  LOG(INFO) << "Joined Visualizer3D redraw thread" << std::endl;
+  if (redraw_thread_.joinable()) {
+    redraw_thread_.join();
+    LOG(INFO) << "Joined Visualizer3D redraw thread" << std::endl;
+  }
 }
 
 
@@ -274,6 +458,28 @@ void Visualizer3D::BlockUntilKeypress()
   cv::destroyWindow("tmp");
 }
 
+#else // BM_ENABLE_VIZ
+
+// Headless build: everything is a no-op.
+void Visualizer3D::AddCameraPose(uid_t, const Image1b&, const Matrix4d&, bool, const Cov3Ptr&) {}
+void Visualizer3D::UpdateCameraPose(uid_t, const Matrix4d&) {}
+void Visualizer3D::UpdateBodyPose(const std::string&, const Matrix4d&) {}
+void Visualizer3D::AddOrUpdateLandmark(const std::vector<uid_t>&, const std::vector<Vector3d>&) {}
+void Visualizer3D::UpdateMesh(const std::vector<Vector3d>&, const std::vector<Vector3i>&) {}
+void Visualizer3D::AddLandmarkObservation(uid_t, uid_t, const LandmarkObservation&) {}
+void Visualizer3D::AddGroundtruthPose(const Matrix4d&) {}
+void Visualizer3D::SetViewerPose(const Matrix4d&) {}
+void Visualizer3D::BlockUntilKeypress() {}
+Visualizer3D::~Visualizer3D() {}
+
+
+void Visualizer3D::Start()
+{
+  LOG(INFO) << "Visualizer3D was compiled out (BM_ENABLE_VIZ=OFF), not starting" << std::endl;
+}
+
+#endif // BM_ENABLE_VIZ
+
 
 }
 }
@@ -1,12 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <thread>
 #include <mutex>
-#include <queue>
 
+// NOTE(milo): Build with -DBM_ENABLE_VIZ=OFF for a headless build. The Visualizer3D API is still
+// there, but does nothing, and nothing depends on OpenCV's viz module.
+#ifdef BM_ENABLE_VIZ
 #include <opencv2/viz.hpp>
+#endif
 
 #include "params/params_base.hpp"
 #include "core/macros.hpp"
@@ -18,6 +23,8 @@
 #include "core/thread_safe_queue.hpp"
 #include "vision_core/landmark_observation.hpp"
 #include "vio/ellipsoid.hpp"
+#include "vio/landmark_cloud.hpp"
+#include "vio/trajectory_polyline.hpp"
 
 namespace bm {
 namespace vio {
@@ -74,9 +81,14 @@ class Visualizer3D final {
     MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
 
     bool show_uncertainty = true;
+    double uncertainty_update_threshold = 0.05;   // Only reshape the ellipsoid if the covariance changes by this fraction.
     bool show_frustums = false;       // Show camera frustums instead of pose axes.
     int max_stored_poses = 100;
-    int max_stored_landmarks = 1000;
+    int max_stored_landmarks = 50000;
+    LandmarkLodParams landmark_lod;   // Thin out distant and old landmarks.
+    TrajectoryParams trajectory;      // Thin out the groundtruth and estimated trajectories.
+    float render_hz = 20.0;           // Redraw (and apply queued updates) at this rate.
+    int max_camera_pose_queue = 100;  // Drop the oldest new camera poses if the renderer falls behind.
 
     StereoCamera stereo_rig;
     Matrix4d body_T_left = Matrix4d::Identity();
@@ -92,7 +104,11 @@ class Visualizer3D final {
 
   explicit Visualizer3D(const Params& params)
       : params_(params),
-        stereo_rig_(params.stereo_rig) {}
+        stereo_rig_(params.stereo_rig),
+        add_camera_pose_queue_(params.max_camera_pose_queue, true, "add_camera_pose_queue"),
+        lmk_cloud_(static_cast<size_t>(std::max(0, params.max_stored_landmarks))),
+        groundtruth_trajectory_(params.trajectory),
+        estimated_trajectory_(params.trajectory) {}
 
   ~Visualizer3D();
 
@@ -107,15 +123,24 @@ class Visualizer3D final {
   // Update the pose associated with a cam_id (must correspond to a keyframe).
   void UpdateCameraPose(uid_t cam_id, const Matrix4d& world_T_cam);
 
+  // Never blocks on rendering: only the latest pose for each name is kept until the next redraw.
   void UpdateBodyPose(const std::string& name, const Matrix4d& world_T_body);
 
   // Adds a 3D landmark at a point in the world. If the lmk_id already exists, updates its location.
+  // Updates are batched until the next redraw, and only the latest location of each is kept. All of
+  // the landmarks are drawn as two point clouds (near and far, see LandmarkLodParams).
   void AddOrUpdateLandmark(const std::vector<uid_t>& lmk_ids, const std::vector<Vector3d>& t_world_lmks);
 
+  // Replaces the mesh (e.g from the ObjectMesher). Only the latest one is kept until the next redraw.
+  void UpdateMesh(const std::vector<Vector3d>& vertices, const std::vector<Vector3i>& triangles);
+
   // Adds an observation of a point landmark from a camera image.
   void AddLandmarkObservation(uid_t cam_id, uid_t lmk_id, const LandmarkObservation& lmk_obs);
 
-  void AddGroundtruthPose(uid_t pose_id, const Matrix4d& world_T_body);
+  // Appends a pose to the groundtruth trajectory. Poses are batched until the next redraw, and the
+  // whole trajectory is drawn as one polyline with sparse axes (see TrajectoryParams). Every new
+  // camera pose is also appended to the estimated trajectory, which is drawn the same way.
+  void AddGroundtruthPose(const Matrix4d& world_T_body);
 
   // Starts thread that continuously redraws the 3D visualizer window.
   // The thread is joined when this instance's destructor is called.
@@ -129,31 +154,64 @@ class Visualizer3D final {
   void AddCameraPose(const CameraPoseData& data);
   void UpdateCameraPose(const CameraPoseData& data);
   void UpdateBodyPose(const BodyPoseData& data);
+  void AddOrUpdateLandmarks(const std::unordered_map<uid_t, Vector3d>& t_world_lmks);
+
+  // Take everything out of the queues and mailboxes, and apply it to the visualizer.
+  void ApplyPendingUpdates();
+
+  // Re-sends the landmark point clouds to the renderer.
+  void RedrawLandmarks();
+
+  void RedrawMesh(const std::vector<Vector3d>& vertices, const std::vector<Vector3i>& triangles);
+
+  // Re-sends a trajectory's polyline, and shows any axes that haven't been drawn yet.
+  void RedrawTrajectory(const std::string& name, const TrajectoryPolyline& trajectory, size_t& num_axes_drawn);
 
-  void RemoveOldLandmarks();  // Ensures that max number of landmarks isn't exceeded.
   void RedrawThread();        // Main thread that handles the Viz3D window.
 
  private:
   Params params_;
   StereoCamera stereo_rig_;
 
+#ifdef BM_ENABLE_VIZ
   cv::viz::Viz3d viz_;
+#endif
   std::mutex viz_lock_;
-  bool viz_needs_redraw_;
   std::thread redraw_thread_;
 
-  // NOTE(milo): These queues are allowed to grow unbounded!
-  ThreadsafeQueue<CameraPoseData> add_camera_pose_queue_{0, true};
-  ThreadsafeQueue<CameraPoseData> update_camera_pose_queue_{0, true};
-  ThreadsafeQueue<BodyPoseData> update_body_pose_queue_{0, true};
+  // New camera poses are queued (up to max_camera_pose_queue). Everything else is a "latest value"
+  // mailbox, so its size is bounded by the number of things being drawn. Producers only hold
+  // mailbox_lock_ long enough to copy in their data, so they never wait on a redraw.
+  ThreadsafeQueue<CameraPoseData> add_camera_pose_queue_;
+  std::mutex mailbox_lock_;
+  std::vector<CameraPoseData> pending_camera_poses_;
+  std::vector<BodyPoseData> pending_body_poses_;
+  std::unordered_map<uid_t, Vector3d> pending_lmks_;
+  bool pending_has_mesh_ = false;
+  std::vector<Vector3d> pending_mesh_vertices_;
+  std::vector<Vector3i> pending_mesh_triangles_;
+  VecMatrix4d pending_groundtruth_poses_;
 
   std::unordered_set<std::string> widget_names_;
 
-  // TODO(milo): Make a more elegant solution for landmark bookkeeping.
-  std::queue<uid_t> queue_live_lmk_ids_;
-  std::unordered_set<uid_t> set_live_lmk_ids_;
-
+  // Only touched by the redraw thread. The LOD split is redone when landmarks change, or when the
+  // viewer (the latest camera) moves.
+  LandmarkCloud lmk_cloud_;
+  Vector3d t_world_viewer_ = Vector3d::Zero();
+  Vector3d t_world_viewer_at_split_ = Vector3d::Zero();
+  CvPoints3f near_lmk_points_;
+  CvPoints3f far_lmk_points_;
+
+  TrajectoryPolyline groundtruth_trajectory_;
+  TrajectoryPolyline estimated_trajectory_;
+  bool estimated_trajectory_changed_ = false;
+  size_t num_groundtruth_axes_drawn_ = 0;
+  size_t num_estimated_axes_drawn_ = 0;
+
+  // NOTE(milo): The sphere points are only sent to the renderer once. After that the ellipsoid is
+  // reshaped and moved by changing the widget pose.
   PrecomputedSpherePoints sphere_points_{40, 16};
+  CachedCovarianceEllipsoid position_cov_ellipsoid_{1.0, params_.uncertainty_update_threshold};
 };
 
 }
@@ -6,8 +6,10 @@
 #include "core/timestamp.hpp"
 #include "core/uid.hpp"
 #include "core/eigen_types.hpp"
+#include "core/pipeline_latency.hpp"
 
 #include "vision_core/landmark_observation.hpp"
+#include "vision_core/line_observation.hpp"
 
 namespace bm {
 namespace vio {
@@ -32,7 +34,9 @@ struct VoResult final
         camera_id(camera_id),
         camera_id_lkf(camera_id_lkf) {}
 
-  VoResult(VoResult&&) = default; // Default move constructor.
+  // NOTE(milo): Only moved, never copied, on the way from the frontend to the smoother.
+  VoResult(VoResult&&) = default;
+  VoResult& operator=(VoResult&&) = default;
 
   bool is_keyframe = false;                         // Did this image trigger a keyframe?
   int status = 0;                                   // Contains several flags about parts of the VO pipeline.
@@ -40,9 +44,19 @@ struct VoResult final
   timestamp_t timestamp_lkf;
   uid_t camera_id;
   uid_t camera_id_lkf;
-  std::vector<LandmarkObservation> lmk_obs;         // List of landmarks observed in this image.
+  LandmarkObservationBatch lmk_obs;                 // Landmarks observed in this image.
+  VecLineObservation line_obs;                      // Lines observed in this image (if track_lines).
   Matrix4d lkf_T_cam = Matrix4d::Identity();        // Pose of the camera in the last kf frame.
   double avg_reprojection_err = -1.0;               // Avg. error after LM pose optimization.
+
+  // If set, the frontend also matched an older keyframe (e.g after vision was lost), and this is
+  // the pose of the camera in that keyframe.
+  bool has_reloc = false;
+  timestamp_t reloc_timestamp_kf = 0;
+  uid_t reloc_camera_id_kf = 0;
+  Matrix4d reloc_kf_T_cam = Matrix4d::Identity();
+
+  LatencyTags latency;                              // Copied from the image, then set by the frontend.
 };
 
 
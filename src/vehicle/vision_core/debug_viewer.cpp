@@ -0,0 +1,117 @@
+#include <glog/logging.h>
+
+#include <opencv2/highgui.hpp>
+
+#include "vision_core/debug_viewer.hpp"
+
+namespace bm {
+namespace core {
+
+
+static const double kWaitForShutdownSec = 0.5;
+
+
+DebugViewer::DebugViewer()
+{
+  render_thread_ = std::thread(&DebugViewer::RenderLoop, this);
+}
+
+
+DebugViewer::~DebugViewer()
+{
+  is_shutdown_.store(true);
+  notifier_.Notify();
+  if (render_thread_.joinable()) {
+    render_thread_.join();
+  }
+}
+
+
+DebugViewer& DebugViewer::Instance()
+{
+  static DebugViewer instance;
+  return instance;
+}
+
+
+void DebugViewer::Show(const std::string& window, const cv::Mat& image)
+{
+  if (image.empty()) {
+    return;
+  }
+
+  mutex_.lock();
+  cv::Mat& pending = pending_[window];
+  if (!pending.empty()) {
+    num_dropped_.fetch_add(1);
+  }
+  pending = image;
+  mutex_.unlock();
+
+  notifier_.Notify();
+}
+
+
+void DebugViewer::RegisterFrameCallback(const FrameCallback& cb)
+{
+  std::lock_guard<std::mutex> lock(callbacks_mutex_);
+  callbacks_.emplace_back(cb);
+}
+
+
+void DebugViewer::ClearFrameCallbacks()
+{
+  std::lock_guard<std::mutex> lock(callbacks_mutex_);
+  callbacks_.clear();
+}
+
+
+void DebugViewer::RenderLoop()
+{
+  LOG(INFO) << "Started up DebugViewer::RenderLoop() thread" << std::endl;
+
+  std::map<std::string, cv::Mat> frames;
+
+  while (!is_shutdown_) {
+    const uint64_t generation = notifier_.Generation();
+    mutex_.lock();
+    for (auto& item : pending_) {
+      if (!item.second.empty()) {
+        frames[item.first] = item.second;
+        item.second.release();
+      }
+    }
+    mutex_.unlock();
+
+    const bool show_windows = show_windows_.load();
+    if (show_windows) {
+      for (const auto& frame : frames) {
+        cv::imshow(frame.first, frame.second);
+      }
+    }
+
+    callbacks_mutex_.lock();
+    for (const auto& frame : frames) {
+      for (const FrameCallback& cb : callbacks_) {
+        cb(frame.first, frame.second);
+      }
+    }
+    callbacks_mutex_.unlock();
+
+    const bool had_frames = !frames.empty();
+    frames.clear();
+
+    // NOTE(milo): HighGUI only draws the new images once waitKey() runs its event loop.
+    if (show_windows && had_frames) {
+      cv::waitKey(1);
+    }
+
+    notifier_.WaitForNotify(generation, kWaitForShutdownSec);
+  }
+
+  LOG(INFO) << "DebugViewer::RenderLoop() exiting" << std::endl;
+}
+
+
+}
+}
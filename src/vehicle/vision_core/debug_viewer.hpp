@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/notifier.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Shows debug images (e.g feature tracks) on its own thread, so that cv::imshow() and
+// cv::waitKey() don't add GUI latency to the threads that draw them. Each window only holds the
+// newest image: if the render thread falls behind, older images are dropped instead of queued.
+//
+// NOTE(milo): Show() doesn't copy pixels. Pass an image that nobody will write to again (clone any
+// buffer that gets reused for the next frame).
+class DebugViewer final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(DebugViewer)
+
+  // Called on the render thread with every image that gets shown (e.g to publish it over LCM).
+  typedef std::function<void(const std::string& window, const cv::Mat& image)> FrameCallback;
+
+  DebugViewer();
+
+  // Stops and joins the render thread. Pending images are dropped.
+  ~DebugViewer();
+
+  // The process-wide viewer, which is started on first use.
+  static DebugViewer& Instance();
+
+  // Replace the pending image for this window. Cheap enough to call from any thread.
+  void Show(const std::string& window, const cv::Mat& image);
+
+  // With show_windows = false, images only go to the frame callbacks (e.g on a headless vehicle).
+  void SetShowWindows(bool show_windows) { show_windows_.store(show_windows); }
+
+  void RegisterFrameCallback(const FrameCallback& cb);
+
+  // Once this returns, no frame callbacks are running or will be called. Call it before destroying
+  // anything that a callback uses, since Instance() lives until the process exits.
+  void ClearFrameCallbacks();
+
+  // Number of images that were replaced before the render thread got to them.
+  size_t NumDropped() const { return num_dropped_.load(); }
+
+ private:
+  void RenderLoop();
+
+  std::atomic_bool is_shutdown_{false};
+  std::atomic_bool show_windows_{true};
+  std::atomic<size_t> num_dropped_{0};
+
+  std::mutex mutex_;
+  std::map<std::string, cv::Mat> pending_;      // Newest image for each window.
+
+  std::mutex callbacks_mutex_;                  // Held while the callbacks run.
+  std::vector<FrameCallback> callbacks_;
+  Notifier notifier_;
+
+  std::thread render_thread_;
+};
+
+
+}
+}
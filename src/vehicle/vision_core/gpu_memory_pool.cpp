@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <climits>
+
+#include <glog/logging.h>
+
+#include "vision_core/gpu_memory_pool.hpp"
+
+namespace bm {
+namespace core {
+
+namespace cu = cv::cuda;
+
+
+// Block addresses and row steps are aligned to this (cudaMallocPitch uses 512 bytes too), which
+// is enough for texture objects with pitch2D.
+static const size_t kAlignment = 512;
+
+static const char* kOtherModule = "Other";
+
+static thread_local const char* tl_module = nullptr;
+
+
+static size_t AlignUp(size_t bytes, size_t alignment)
+{
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+
+GpuMemoryPool& GpuMemoryPool::Get()
+{
+  // NOTE(milo): Never destroyed, since static GpuMats can be released after main() returns.
+  static GpuMemoryPool* pool = new GpuMemoryPool();
+  return *pool;
+}
+
+
+void GpuMemoryPool::Install(size_t reserve_bytes, size_t grow_bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(!installed_) << "GpuMemoryPool was already installed" << std::endl;
+  CHECK_GT(grow_bytes, 0ul);
+
+  fallback_ = cu::GpuMat::defaultAllocator();
+  grow_bytes_ = grow_bytes;
+  if (reserve_bytes > 0) {
+    Grow(AlignUp(reserve_bytes, kAlignment));
+  }
+
+  cu::GpuMat::setDefaultAllocator(this);
+  installed_ = true;
+}
+
+
+bool GpuMemoryPool::Installed() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return installed_;
+}
+
+
+void GpuMemoryPool::SetBudget(const std::string& module, size_t max_bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  budgets_.at(BudgetId(module)).max_bytes = max_bytes;
+}
+
+
+std::vector<GpuBudgetUsage> GpuMemoryPool::GetUsage() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return budgets_;
+}
+
+
+size_t GpuMemoryPool::ReservedBytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t bytes = 0;
+  for (const cu::GpuMat& chunk : chunks_) {
+    bytes += static_cast<size_t>(chunk.cols);
+  }
+  return bytes;
+}
+
+
+size_t GpuMemoryPool::NumGrowths() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_growths_;
+}
+
+
+bool GpuMemoryPool::allocate(cu::GpuMat* mat, int rows, int cols, size_t elemSize)
+{
+  // Single rows are packed like cudaMalloc, and images are pitched like cudaMallocPitch.
+  const size_t row_bytes = static_cast<size_t>(cols) * elemSize;
+  const size_t step = (rows > 1) ? AlignUp(row_bytes, kAlignment) : row_bytes;
+  const size_t size = AlignUp(std::max<size_t>(1, step * static_cast<size_t>(rows)), kAlignment);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  uchar* ptr = FindFree(size);
+  if (ptr == nullptr && !pending_.empty()) {
+    ReclaimPending(true);
+    ptr = FindFree(size);
+  }
+  if (ptr == nullptr) {
+    ++num_growths_;
+    LOG(WARNING) << "GpuMemoryPool is full, growing it (reserve more to avoid this)" << std::endl;
+    Grow(std::max(grow_bytes_, size));
+    ptr = FindFree(size);
+  }
+  CHECK_NOTNULL(ptr);
+
+  const int budget = BudgetId((tl_module != nullptr) ? tl_module : kOtherModule);
+  blocks_.at(ptr).budget = budget;
+
+  GpuBudgetUsage& usage = budgets_.at(budget);
+  usage.bytes += size;
+  usage.peak_bytes = std::max(usage.peak_bytes, usage.bytes);
+  if (usage.max_bytes > 0 && usage.bytes > usage.max_bytes && usage.num_over++ == 0) {
+    LOG(WARNING) << usage.module << " is over its GPU budget: " << usage.bytes << " of "
+                 << usage.max_bytes << " bytes" << std::endl;
+  }
+
+  mat->data = ptr;
+  mat->step = step;
+  mat->refcount = static_cast<int*>(cv::fastMalloc(sizeof(int)));
+
+  return true;
+}
+
+
+void GpuMemoryPool::free(cu::GpuMat* mat)
+{
+  cv::fastFree(mat->refcount);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const auto it = blocks_.find(mat->datastart);
+  CHECK(it != blocks_.end() && it->second.budget >= 0) << "Freeing a GpuMat that isn't from this pool" << std::endl;
+
+  GpuBudgetUsage& usage = budgets_.at(it->second.budget);
+  usage.bytes -= it->second.size;
+
+  // Keep the block (and its budget, so it isn't handed out) until the device is done with it.
+  if (spare_events_.empty()) {
+    spare_events_.emplace_back(cu::Event::DISABLE_TIMING);
+  }
+  pending_.push_back(PendingFree{ mat->datastart, spare_events_.back() });
+  spare_events_.pop_back();
+  pending_.back().done.record(cu::Stream::Null());
+}
+
+
+uchar* GpuMemoryPool::FindFree(size_t size)
+{
+  ReclaimPending(false);
+
+  // Best fit, so that big blocks are kept for big buffers.
+  auto best = blocks_.end();
+  for (auto it = blocks_.begin(); it != blocks_.end(); ++it) {
+    if (it->second.budget < 0 && it->second.size >= size &&
+        (best == blocks_.end() || it->second.size < best->second.size)) {
+      best = it;
+    }
+  }
+  if (best == blocks_.end()) {
+    return nullptr;
+  }
+
+  uchar* ptr = best->first;
+  Block& block = best->second;
+  if (block.size > size) {
+    Block rest;
+    rest.size = block.size - size;
+    rest.chunk = block.chunk;
+    blocks_.emplace(ptr + size, rest);
+    block.size = size;
+  }
+
+  return ptr;
+}
+
+
+void GpuMemoryPool::ReclaimPending(bool wait)
+{
+  // Events on the default stream complete in order, so only the newest one needs to be waited on.
+  if (wait && !pending_.empty()) {
+    pending_.back().done.waitForCompletion();
+  }
+
+  while (!pending_.empty() && (wait || pending_.front().done.queryIfComplete())) {
+    MarkFree(pending_.front().ptr);
+    spare_events_.emplace_back(pending_.front().done);
+    pending_.pop_front();
+  }
+}
+
+
+void GpuMemoryPool::Grow(size_t bytes)
+{
+  CHECK_LE(bytes, static_cast<size_t>(INT_MAX)) << "GpuMemoryPool chunks are limited to 2 GB" << std::endl;
+
+  chunks_.emplace_back(1, static_cast<int>(bytes), CV_8UC1, fallback_);
+
+  Block block;
+  block.size = bytes;
+  block.chunk = static_cast<int>(chunks_.size()) - 1;
+  blocks_.emplace(chunks_.back().data, block);
+}
+
+
+void GpuMemoryPool::MarkFree(uchar* ptr)
+{
+  auto it = blocks_.find(ptr);
+  CHECK(it != blocks_.end());
+  it->second.budget = -1;
+
+  const auto next = std::next(it);
+  if (next != blocks_.end() && next->second.budget < 0 && next->second.chunk == it->second.chunk) {
+    it->second.size += next->second.size;
+    blocks_.erase(next);
+  }
+
+  if (it != blocks_.begin()) {
+    const auto prev = std::prev(it);
+    if (prev->second.budget < 0 && prev->second.chunk == it->second.chunk) {
+      prev->second.size += it->second.size;
+      blocks_.erase(it);
+    }
+  }
+}
+
+
+int GpuMemoryPool::BudgetId(const std::string& module)
+{
+  const auto it = budget_ids_.find(module);
+  if (it != budget_ids_.end()) {
+    return it->second;
+  }
+
+  GpuBudgetUsage usage;
+  usage.module = module;
+  budgets_.emplace_back(usage);
+  budget_ids_.emplace(module, static_cast<int>(budgets_.size()) - 1);
+
+  return static_cast<int>(budgets_.size()) - 1;
+}
+
+
+ScopedGpuBudget::ScopedGpuBudget(const char* module)
+    : prev_module_(tl_module)
+{
+  tl_module = module;
+}
+
+
+ScopedGpuBudget::~ScopedGpuBudget()
+{
+  tl_module = prev_module_;
+}
+
+
+}
+}
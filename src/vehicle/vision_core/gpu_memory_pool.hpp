@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/core/cuda.hpp>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Device memory that one module (see ScopedGpuBudget) is using, and its budget.
+struct GpuBudgetUsage final
+{
+  std::string module;
+  size_t max_bytes = 0;       // Zero if this module has no budget.
+  size_t bytes = 0;
+  size_t peak_bytes = 0;
+  uint64_t num_over = 0;      // Allocations that took this module over its budget.
+};
+
+
+// A process-wide arena for GpuMat buffers, so that CUDA modules don't call cudaMalloc/cudaFree while
+// they run. Both stall the device (cudaFree synchronizes it), which shows up as periodic hiccups on
+// the Jetson when buffers are resized.
+//
+// Once installed, this is the default cv::cuda::GpuMat allocator, so every GpuMat constructed after
+// that (including OpenCV's temporaries) is carved out of a few big chunks of device memory. Freed
+// blocks are coalesced with their neighbors, and the arena only grows (by cudaMalloc) if nothing
+// fits. Each allocation is charged to the calling thread's module, which can have a budget.
+//
+// NOTE(milo): A freed block isn't reused until the work queued before the free is done, since a
+// kernel on any stream could still be using it. An event is recorded on the legacy default stream
+// at the free, which waits for all of the (blocking) cv::cuda::Streams. Frees should be rare, since
+// modules keep their buffers between calls.
+class GpuMemoryPool final : public cv::cuda::GpuMat::Allocator {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(GpuMemoryPool)
+
+  // The process-wide pool. It isn't used for anything until Install() is called.
+  static GpuMemoryPool& Get();
+
+  // Reserve reserve_bytes of device memory now, and make this the default GpuMat allocator. If the
+  // arena fills up, it grows by at least grow_bytes at a time. Call this at startup, before any
+  // CUDA module is constructed (GpuMats keep the allocator that was the default when they were).
+  void Install(size_t reserve_bytes, size_t grow_bytes = 32ul << 20);
+
+  bool Installed() const;
+
+  // Warn when a module is using more than max_bytes. Budgets are soft: allocations over budget
+  // still succeed, so that a module doesn't fail partway through a frame.
+  void SetBudget(const std::string& module, size_t max_bytes);
+
+  // Usage of every module that has allocated or has a budget. "Other" is everything that was
+  // allocated outside of a ScopedGpuBudget.
+  std::vector<GpuBudgetUsage> GetUsage() const;
+
+  // Device memory held by the arena (used or not).
+  size_t ReservedBytes() const;
+
+  // Number of times the arena had to grow after Install().
+  size_t NumGrowths() const;
+
+  bool allocate(cv::cuda::GpuMat* mat, int rows, int cols, size_t elemSize) override;
+  void free(cv::cuda::GpuMat* mat) override;
+
+ private:
+  GpuMemoryPool() = default;
+
+  struct Block final
+  {
+    size_t size = 0;
+    int chunk = 0;      // Blocks are only coalesced within a chunk.
+    int budget = -1;    // Module that is using this block, or -1 if it's free.
+  };
+
+  struct PendingFree final
+  {
+    uchar* ptr;
+    cv::cuda::Event done;
+  };
+
+  // Returns a block of at least size bytes, or nullptr if none is free.
+  uchar* FindFree(size_t size);
+
+  // Frees blocks once the work queued before their free has finished. If wait is true, waits for
+  // all of them.
+  void ReclaimPending(bool wait);
+
+  // Adds a chunk of device memory to the arena.
+  void Grow(size_t bytes);
+
+  void MarkFree(uchar* ptr);
+
+  int BudgetId(const std::string& module);
+
+ private:
+  mutable std::mutex mutex_;
+
+  bool installed_ = false;
+  size_t grow_bytes_ = 0;
+  size_t num_growths_ = 0;
+  cv::cuda::GpuMat::Allocator* fallback_ = nullptr;   // Allocates the chunks (cudaMalloc).
+
+  std::vector<cv::cuda::GpuMat> chunks_;
+  std::map<uchar*, Block> blocks_;                    // Every block (used or free) by address.
+  std::deque<PendingFree> pending_;                   // Oldest first.
+  std::vector<cv::cuda::Event> spare_events_;
+
+  std::vector<GpuBudgetUsage> budgets_;
+  std::unordered_map<std::string, int> budget_ids_;
+};
+
+
+// Charge GpuMat allocations on this thread to a named module, until the end of the enclosing
+// scope. Scopes nest, and an allocation is only charged to the innermost one. Put one at the top
+// of every entry point of a CUDA module (including worker threads that it starts).
+// NOTE(milo): The name must be a string literal (it's stored as a pointer, not copied).
+class ScopedGpuBudget final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ScopedGpuBudget)
+  MACRO_DELETE_COPY_CONSTRUCTORS(ScopedGpuBudget)
+
+  explicit ScopedGpuBudget(const char* module);
+  ~ScopedGpuBudget();
+
+ private:
+  const char* prev_module_;
+};
+
+
+}
+}
@@ -0,0 +1,88 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "vision_core/image_pool.hpp"
+
+namespace bm {
+namespace core {
+
+
+// True if only the pool holds a reference to this buffer.
+// NOTE(milo): The refcount is read with an atomic add of zero, since other threads can be releasing
+// their headers at the same time. Nobody else can add a reference (that takes a header from the
+// pool), so the buffer can't be taken between here and the caller using it.
+static bool IsFree(Image1b& buffer)
+{
+  return (buffer.u != nullptr) && (CV_XADD(&buffer.u->refcount, 0) == 1);
+}
+
+
+ImagePool::ImagePool(size_t max_buffers, const std::string& name)
+    : name_(name),
+      max_buffers_(max_buffers)
+{
+  CHECK_GT(max_buffers, 0ul);
+  buffers_.reserve(max_buffers);
+}
+
+
+void ImagePool::Reserve(size_t n, int rows, int cols)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (buffers_.size() < std::min(n, max_buffers_)) {
+    buffers_.emplace_back(rows, cols);
+  }
+}
+
+
+Image1b ImagePool::Acquire(int rows, int cols)
+{
+  if (rows <= 0 || cols <= 0) {
+    return Image1b();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Prefer a buffer that's already the right size, otherwise reallocate one of the wrong size.
+    Image1b* resize = nullptr;
+    for (Image1b& buffer : buffers_) {
+      if (!IsFree(buffer)) {
+        continue;
+      }
+      if (buffer.rows == rows && buffer.cols == cols) {
+        return buffer;
+      }
+      resize = &buffer;
+    }
+
+    if (resize != nullptr) {
+      *resize = Image1b(rows, cols);
+      return *resize;
+    }
+
+    if (buffers_.size() < max_buffers_) {
+      buffers_.emplace_back(rows, cols);
+      return buffers_.back();
+    }
+  }
+
+  if (num_misses_.fetch_add(1) == 0) {
+    LOG(WARNING) << "All " << max_buffers_ << " buffers in " << name_
+                 << " are in use, allocating images outside of it" << std::endl;
+  }
+
+  return Image1b(rows, cols);
+}
+
+
+size_t ImagePool::NumBuffers() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return buffers_.size();
+}
+
+
+}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A set of image buffers that get reused from frame to frame. Decoding a stream of large images
+// (about 2 MB per frame) into new allocations fragments the heap over a long mission.
+//
+// Acquire() returns an Image1b that shares a buffer with the pool. cv::Mat headers are reference
+// counted, so the image can be copied and passed between threads as usual. The buffer goes back to
+// the pool once the last header is destroyed. A buffer is only handed out again when the pool holds
+// the only reference to it, so nobody's pixels get overwritten.
+//
+// NOTE(milo): Whoever acquires an image should fill it in before sharing it, and nobody should
+// write to it after that (see StereoImage).
+class ImagePool final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ImagePool)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ImagePool)
+
+  // Holds up to max_buffers buffers. If they're all in use, Acquire() falls back to allocating an
+  // image that isn't pooled.
+  explicit ImagePool(size_t max_buffers, const std::string& name = "image_pool");
+
+  // Allocate n buffers now (e.g once the image size is known), instead of in the first Acquire()s.
+  void Reserve(size_t n, int rows, int cols);
+
+  // Returns a free rows x cols image (with uninitialized pixels), or an empty one if either is zero.
+  // Free buffers of a different size are reallocated, so a change in resolution only costs one
+  // allocation per buffer. Threadsafe.
+  Image1b Acquire(int rows, int cols);
+
+  size_t NumBuffers() const;
+
+  // Number of Acquire() calls that had to allocate outside of the pool.
+  size_t NumMisses() const { return num_misses_.load(); }
+
+ private:
+  std::string name_;
+  size_t max_buffers_;
+
+  mutable std::mutex mutex_;
+  std::vector<Image1b> buffers_;
+  std::atomic<size_t> num_misses_{0};
+};
+
+
+}
+}
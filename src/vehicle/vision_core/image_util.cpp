@@ -15,49 +15,84 @@ static const float kFloatToUint8 = 255.0;
 Image3d CastImage3bTo3d(const Image3b& im)
 {
   Image3d out;
-  im.convertTo(out, CV_64FC3, kUint8ToFloat);
-
+  CastImage3bTo3d(im, out);
   return out;
 }
 
 
+void CastImage3bTo3d(const Image3b& im, Image3d& out)
+{
+  im.convertTo(out, CV_64FC3, kUint8ToFloat);
+}
+
+
 // Convert a uint8 image [0, 255] to a 32-bit floating point image.
 Image3f CastImage3bTo3f(const Image3b& im)
 {
   Image3f out;
-  im.convertTo(out, CV_32FC3, kUint8ToFloat);
-
+  CastImage3bTo3f(im, out);
   return out;
 }
 
 
+void CastImage3bTo3f(const Image3b& im, Image3f& out)
+{
+  im.convertTo(out, CV_32FC3, kUint8ToFloat);
+}
+
+
 Image3b CastImage3fTo3b(const Image3f& im)
 {
   Image3b out;
+  CastImage3fTo3b(im, out);
+  return out;
+}
+
+
+void CastImage3fTo3b(const Image3f& im, Image3b& out)
+{
   im.convertTo(out, CV_8UC3, kFloatToUint8);
+}
 
-  return out;
+
+void CastImage1bTo1f(const Image1b& im, Image1f& out, float scale, float offset)
+{
+  im.convertTo(out, CV_32FC1, scale, offset);
 }
 
 
 Image1b ReadAndConvertToGrayScale(const std::string& img_path) {
-  cv::Mat img = cv::imread(img_path, cv::IMREAD_ANYCOLOR);
-  if (img.channels() > 1) {
-    cv::cvtColor(img, img, cv::COLOR_BGR2GRAY);
-  }
-  return img;
+  return cv::imread(img_path, cv::IMREAD_GRAYSCALE);
 }
 
 
 Image1b MaybeConvertToGray(const cv::Mat& im)
+{
+  Image1b out;
+  MaybeConvertToGray(im, out);
+  return out;
+}
+
+
+void MaybeConvertToGray(const cv::Mat& im, Image1b& out)
 {
   if (im.channels() == 1) {
-    return im;
+    out = im;
   } else {
-    Image1b im_gray;
-    cv::cvtColor(im, im_gray, cv::COLOR_BGR2GRAY);
-    return im_gray;
+    cv::cvtColor(im, out, cv::COLOR_BGR2GRAY);
+  }
+}
+
+
+Image1b MaybeConvertToGray(const cv::Mat& im, ImagePool& pool)
+{
+  if (im.channels() == 1) {
+    return im;
   }
+
+  Image1b out = pool.Acquire(im.rows, im.cols);
+  cv::cvtColor(im, out, cv::COLOR_BGR2GRAY);
+  return out;
 }
 
 
@@ -68,6 +103,13 @@ StereoImage1b ConvertToGray(const StereoImage3b& pair)
 }
 
 
+StereoImage1b ConvertToGray(const StereoImage3b& pair, ImagePool& pool)
+{
+  return StereoImage1b(pair.timestamp, pair.camera_id,
+      MaybeConvertToGray(pair.left_image, pool), MaybeConvertToGray(pair.right_image, pool));
+}
+
+
 // https://stackoverflow.com/questions/10167534/how-to-find-out-what-type-of-a-mat-object-is-with-mattype-in-opencv
 std::string CvReadableType(int type)
 {
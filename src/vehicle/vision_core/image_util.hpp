@@ -1,30 +1,50 @@
 #pragma once
 
 #include "vision_core/cv_types.hpp"
+#include "vision_core/image_pool.hpp"
 #include "vision_core/stereo_image.hpp"
 
 namespace bm {
 namespace core {
 
+// NOTE(milo): The versions that take an "out" image write into it, and only allocate if it isn't
+// already the right size and type. Reuse the same "out" every frame (or take it from an ImagePool)
+// so that conversions don't allocate. The conversions themselves are OpenCV's vectorized kernels,
+// and each one is a single pass over the pixels.
+
 
 // Convert a uint8 image [0, 255] to a 64-bit floating point image.
 Image3d CastImage3bTo3d(const Image3b& im);
+void CastImage3bTo3d(const Image3b& im, Image3d& out);
 
 
 // Convert a uint8 image [0, 255] to a 32-bit floating point image.
 Image3f CastImage3bTo3f(const Image3b& im);
+void CastImage3bTo3f(const Image3b& im, Image3f& out);
 
 
 Image3b CastImage3fTo3b(const Image3f& im);
+void CastImage3fTo3b(const Image3f& im, Image3b& out);
+
+
+// Convert a uint8 image to floating point and normalize it (out = scale * im + offset) in one pass.
+// The default scale maps [0, 255] to [0, 1].
+void CastImage1bTo1f(const Image1b& im, Image1f& out, float scale = 1.0f / 255.0f, float offset = 0.0f);
 
 
+// NOTE(milo): The image is decoded straight to grayscale (for a JPG, the decoder skips the color
+// conversion entirely), rather than decoded in color and then converted.
 Image1b ReadAndConvertToGrayScale(const std::string& img_path);
 
 
+// A gray image is returned as is (sharing its pixels), and a BGR image is converted.
 Image1b MaybeConvertToGray(const cv::Mat& im);
+void MaybeConvertToGray(const cv::Mat& im, Image1b& out);
+Image1b MaybeConvertToGray(const cv::Mat& im, ImagePool& pool);
 
 
 StereoImage1b ConvertToGray(const StereoImage3b& pair);
+StereoImage1b ConvertToGray(const StereoImage3b& pair, ImagePool& pool);
 
 
 // https://stackoverflow.com/questions/10167534/how-to-find-out-what-type-of-a-mat-object-is-with-mattype-in-opencv
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
 #include "core/timestamp.hpp"
 #include "core/uid.hpp"
 #include "vision_core/cv_types.hpp"
@@ -9,6 +12,10 @@ namespace core {
 
 
 // A 2D observation of a landmark in an image.
+// NOTE(milo): These get copied into every feature track and VoResult, so they're kept small (28
+// bytes instead of 48). The ids are stored in 32 bits: landmark ids are allocated in 32 bits (see
+// StereoTracker) and only have to be unique among live tracks, and camera ids would take years to
+// overflow at camera rates.
 struct LandmarkObservation final
 {
   LandmarkObservation() = delete;
@@ -19,26 +26,76 @@ struct LandmarkObservation final
                                double disparity,
                                double mono_track_score,
                                double stereo_match_score)
-      : landmark_id(landmark_id),
-        camera_id(camera_id),
+      : landmark_id(static_cast<uint32_t>(landmark_id)),
+        camera_id(static_cast<uint32_t>(camera_id)),
         pixel_location(pixel_location),
-        disparity(disparity),
-        mono_track_score(mono_track_score),
-        stereo_match_score(stereo_match_score) {}
+        disparity(static_cast<float>(disparity)),
+        mono_track_score(static_cast<float>(mono_track_score)),
+        stereo_match_score(static_cast<float>(stereo_match_score)) {}
 
   // Member fields.
-  uid_t landmark_id;
-  uid_t camera_id;
+  uint32_t landmark_id;
+  uint32_t camera_id;
   cv::Point2f pixel_location;
-  double disparity;
-  double mono_track_score;
-  double stereo_match_score;
+  float disparity;
+  float mono_track_score;
+  float stereo_match_score;
 };
 
+static_assert(sizeof(LandmarkObservation) == 28, "LandmarkObservation should be packed into 28 bytes");
+
 
 // Convience vector typedef.
 typedef std::vector<LandmarkObservation> VecLandmarkObservation;
 
 
+// The landmark observations from one image, with one array per field. This is what the frontend
+// hands to the smoother (see VoResult): every observation has the same camera id, so it isn't
+// repeated, and the tracking scores aren't needed past the frontend. That's 16 bytes per
+// observation, and the smoother reads the arrays front to back.
+struct LandmarkObservationBatch final
+{
+  void Reserve(size_t n)
+  {
+    landmark_id.reserve(n);
+    pixel_location.reserve(n);
+    disparity.reserve(n);
+  }
+
+  void Clear()
+  {
+    landmark_id.clear();
+    pixel_location.clear();
+    disparity.clear();
+  }
+
+  void Add(uid_t id, const cv::Point2f& pixel, float disp)
+  {
+    landmark_id.emplace_back(static_cast<uint32_t>(id));
+    pixel_location.emplace_back(pixel);
+    disparity.emplace_back(disp);
+  }
+
+  void Add(const LandmarkObservation& lmk_obs)
+  {
+    Add(lmk_obs.landmark_id, lmk_obs.pixel_location, lmk_obs.disparity);
+  }
+
+  // Adds observation i of another batch.
+  void Add(const LandmarkObservationBatch& other, size_t i)
+  {
+    Add(other.landmark_id[i], other.pixel_location[i], other.disparity[i]);
+  }
+
+  size_t Size() const { return landmark_id.size(); }
+  bool Empty() const { return landmark_id.empty(); }
+
+  // Member fields (all the same length).
+  std::vector<uint32_t> landmark_id;
+  VecPoint2f pixel_location;
+  std::vector<float> disparity;
+};
+
+
 }
 }
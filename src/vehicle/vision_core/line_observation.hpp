@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A 2D observation of a line landmark in the left image, with the disparity at each endpoint.
+// NOTE(milo): The endpoints aren't repeatable across frames (only the infinite line is), so they
+// shouldn't be used as point correspondences.
+struct LineObservation final
+{
+  LineObservation() = delete;
+
+  explicit LineObservation(uid_t line_id,
+                           uid_t camera_id,
+                           const Vector2d& p0,
+                           const Vector2d& p1,
+                           double disp_p0,
+                           double disp_p1)
+      : line_id(line_id),
+        camera_id(camera_id),
+        p0(p0),
+        p1(p1),
+        disp_p0(disp_p0),
+        disp_p1(disp_p1) {}
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  // Member fields.
+  uid_t line_id;
+  uid_t camera_id;
+  Vector2d p0;
+  Vector2d p1;
+  double disp_p0;
+  double disp_p1;
+};
+
+
+// Convience vector typedef (aligned, since the endpoints are fixed-size Eigen types).
+typedef std::vector<LineObservation, Eigen::aligned_allocator<LineObservation>> VecLineObservation;
+
+
+}
+}
@@ -1,3 +1,5 @@
+#include <glog/logging.h>
+
 #include "vision_core/pinhole_camera.hpp"
 
 namespace bm {
@@ -5,7 +7,7 @@ namespace core {
 
 
 PinholeCamera::PinholeCamera(double fx, double fy, double cx, double cy, double h, double w)
-    : fx_(fx), fy_(fy), cx_(cx), cy_(cy), height_(h), width_(w)
+    : fx_(fx), fy_(fy), cx_(cx), cy_(cy), fx_inv_(1.0 / fx), fy_inv_(1.0 / fy), height_(h), width_(w)
 {
   // Set up intrinsics matrices for later.
   K_ << fx_, 0, cx_, 0, fy_, cy_, 0, 0, 1;
@@ -29,19 +31,44 @@ PinholeCamera PinholeCamera::Rescale(int new_height, int new_width) const
 }
 
 
-// Project 3D point in the camera's RDF frame.
-Vector2d PinholeCamera::Project(const Vector3d& p_cam) const
+void PinholeCamera::Project(const double* x, const double* y, const double* z, size_t N, double* u, double* v) const
+{
+  for (size_t i = 0; i < N; ++i) {
+    u[i] = fx_ * x[i] / z[i] + cx_;
+    v[i] = fy_ * y[i] / z[i] + cy_;
+  }
+}
+
+
+void PinholeCamera::Backproject(const double* u, const double* v, const double* depth, size_t N,
+                                double* x, double* y, double* z) const
+{
+  for (size_t i = 0; i < N; ++i) {
+    x[i] = depth[i] * ((u[i] - cx_) * fx_inv_);
+    y[i] = depth[i] * ((v[i] - cy_) * fy_inv_);
+    z[i] = depth[i];
+  }
+}
+
+
+void PinholeCamera::Project(const std::vector<Vector3d>& p_cam, std::vector<Vector2d>& xy) const
 {
-  const Vector3d xy_h = K_ * p_cam;
-  return xy_h.head<2>() / xy_h(2);
+  xy.resize(p_cam.size());
+  for (size_t i = 0; i < p_cam.size(); ++i) {
+    xy[i] = Project(p_cam[i]);
+  }
 }
 
 
-// Backproject a pixel location to a 3D point in the camera's RDF frame.
-Vector3d PinholeCamera::Backproject(const Vector2d& xy, double depth) const
+void PinholeCamera::Backproject(const std::vector<Vector2d>& xy,
+                                const std::vector<double>& depth,
+                                std::vector<Vector3d>& p_cam) const
 {
-  const Vector3d xy_h(xy.x(), xy.y(), 1);
-  return depth * K_inv_ * xy_h;
+  CHECK_EQ(xy.size(), depth.size());
+  p_cam.resize(xy.size());
+  for (size_t i = 0; i < xy.size(); ++i) {
+    p_cam[i] = Backproject(xy[i], depth[i]);
+  }
 }
 
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "core/eigen_types.hpp"
 
 namespace bm {
@@ -26,13 +28,32 @@ class PinholeCamera final {
   Matrix3d Kinv() const { return K_inv_; }
 
   // Project 3D point in the camera's RDF frame.
-  Vector2d Project(const Vector3d& p_cam) const;
+  Vector2d Project(const Vector3d& p_cam) const
+  {
+    return Vector2d(fx_ * p_cam.x() / p_cam.z() + cx_, fy_ * p_cam.y() / p_cam.z() + cy_);
+  }
 
   // Backproject a pixel location to a 3D point in the camera's RDF frame.
-  Vector3d Backproject(const Vector2d& xy, double depth) const;
+  Vector3d Backproject(const Vector2d& xy, double depth) const
+  {
+    return Vector3d(depth * ((xy.x() - cx_) * fx_inv_), depth * ((xy.y() - cy_) * fy_inv_), depth);
+  }
+
+  // Batch versions of Project() and Backproject(), for N points stored as separate arrays (e.g
+  // x[i], y[i], z[i] is point i). These are branch-free loops, so the compiler vectorizes them.
+  void Project(const double* x, const double* y, const double* z, size_t N, double* u, double* v) const;
+  void Backproject(const double* u, const double* v, const double* depth, size_t N,
+                   double* x, double* y, double* z) const;
+
+  // Same, for vectors of points. The outputs are resized to match.
+  void Project(const std::vector<Vector3d>& p_cam, std::vector<Vector2d>& xy) const;
+  void Backproject(const std::vector<Vector2d>& xy,
+                   const std::vector<double>& depth,
+                   std::vector<Vector3d>& p_cam) const;
 
  private:
   double fx_, fy_, cx_, cy_;
+  double fx_inv_, fy_inv_;
 
   // Nominal width and height for an image captured by this camera.
   int height_, width_;
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "vision_core/static_mask.hpp"
+
+namespace bm {
+namespace core {
+
+
+StaticMask::StaticMask(int height, int width, const std::vector<cv::Rect>& blocked)
+    : height_(height),
+      width_(width),
+      cache_(std::make_shared<Cache>())
+{
+  CHECK_GT(height_, 0);
+  CHECK_GT(width_, 0);
+
+  const cv::Rect image_rect(0, 0, width_, height_);
+  for (const cv::Rect& rect : blocked) {
+    const cv::Rect clipped = rect & image_rect;
+    if (clipped.area() > 0) {
+      blocked_.emplace_back(clipped);
+    }
+  }
+}
+
+
+Image1b StaticMask::Valid(int rows, int cols) const
+{
+  if (blocked_.empty()) {
+    return Image1b();
+  }
+
+  std::lock_guard<std::mutex> lock(cache_->mutex);
+  for (const Image1b& mask : cache_->masks) {
+    if (mask.rows == rows && mask.cols == cols) {
+      return mask;
+    }
+  }
+
+  const double sx = (double)cols / (double)width_;
+  const double sy = (double)rows / (double)height_;
+
+  Image1b mask(rows, cols, 255);
+  const cv::Rect image_rect(0, 0, cols, rows);
+  for (const cv::Rect& rect : blocked_) {
+    const int x0 = (int)std::floor(rect.x * sx);
+    const int y0 = (int)std::floor(rect.y * sy);
+    const int x1 = (int)std::ceil((rect.x + rect.width) * sx);
+    const int y1 = (int)std::ceil((rect.y + rect.height) * sy);
+    mask(cv::Rect(x0, y0, x1 - x0, y1 - y0) & image_rect).setTo(0);
+  }
+
+  cache_->masks.emplace_back(mask);
+  return mask;
+}
+
+
+double StaticMask::BlockedFraction() const
+{
+  if (blocked_.empty()) {
+    return 0.0;
+  }
+  const Image1b mask = Valid(height_, width_);
+  return 1.0 - (double)cv::countNonZero(mask) / (double)mask.total();
+}
+
+
+}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace core {
+
+
+// The parts of a camera's view that are always blocked (e.g by the vehicle frame or its lights).
+// They're stored as rectangles at the camera's nominal resolution (see StereoCamera), and rasterized
+// once for each image size that's asked for (e.g a decode_scale or a pyramid level), so that nobody
+// rebuilds a mask per frame.
+//
+// NOTE(milo): Copies share their rasterized masks. All methods are threadsafe.
+class StaticMask final {
+ public:
+  // Nothing is blocked.
+  StaticMask() = default;
+
+  StaticMask(int height, int width, const std::vector<cv::Rect>& blocked);
+
+  bool Empty() const { return blocked_.empty(); }
+  const std::vector<cv::Rect>& Blocked() const { return blocked_; }
+
+  // The mask for a rows x cols image (255 = usable, 0 = blocked). The rectangles are scaled from
+  // the nominal resolution, rounding outwards. Returns an empty image if nothing is blocked, and
+  // shares its pixels with every other caller, so don't write to it.
+  Image1b Valid(int rows, int cols) const;
+
+  // Fraction of the image that's blocked.
+  double BlockedFraction() const;
+
+ private:
+  int height_ = 0;
+  int width_ = 0;
+  std::vector<cv::Rect> blocked_;
+
+  struct Cache final
+  {
+    std::mutex mutex;
+    std::vector<Image1b> masks;     // One per image size.
+  };
+  std::shared_ptr<Cache> cache_;
+};
+
+
+// Is pt in the image, and not blocked in valid (a StaticMask::Valid(), which can be empty)?
+inline bool NotBlocked(const Image1b& valid, const cv::Point2f& pt)
+{
+  if (valid.empty()) {
+    return true;
+  }
+  const int x = (int)std::round(pt.x);
+  const int y = (int)std::round(pt.y);
+  return x >= 0 && y >= 0 && x < valid.cols && y < valid.rows && valid(y, x) > 0;
+}
+
+
+}
+}
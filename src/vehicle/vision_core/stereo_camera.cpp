@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <limits>
+
 #include <glog/logging.h>
 
 #include "vision_core/stereo_camera.hpp"
@@ -60,5 +63,47 @@ double StereoCamera::DepthToDisp(double depth) const
 }
 
 
+// NOTE(milo): Checks all of the disparities first, so that the main loop doesn't branch.
+static void CheckDisparities(const double* disp, size_t N)
+{
+  double min_disp = std::numeric_limits<double>::max();
+  for (size_t i = 0; i < N; ++i) {
+    min_disp = std::min(min_disp, disp[i]);
+  }
+  CHECK(N == 0 || min_disp > 0) << "Cannot convert zero disparity to depth (inf)!" << std::endl;
+}
+
+
+void StereoCamera::Triangulate(const double* u, const double* v, const double* disp, size_t N,
+                               double* x, double* y, double* z) const
+{
+  CheckDisparities(disp, N);
+
+  const double fx_b = fx() * Baseline();
+  for (size_t i = 0; i < N; ++i) {
+    z[i] = fx_b / disp[i];
+  }
+
+  cam_left_.Backproject(u, v, z, N, x, y, z);
+}
+
+
+void StereoCamera::Triangulate(const std::vector<Vector2d>& xy,
+                               const std::vector<double>& disp,
+                               std::vector<Vector3d>& p_cam) const
+{
+  CHECK_EQ(xy.size(), disp.size());
+  CheckDisparities(disp.data(), disp.size());
+
+  p_cam.resize(xy.size());
+  const double fx_b = fx() * Baseline();
+  const PinholeCamera& cam = cam_left_;
+
+  for (size_t i = 0; i < xy.size(); ++i) {
+    p_cam[i] = cam.Backproject(xy[i], fx_b / disp[i]);
+  }
+}
+
+
 }
 }
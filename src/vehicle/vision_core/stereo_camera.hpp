@@ -1,7 +1,10 @@
 #pragma once
 
+#include <vector>
+
 #include "core/eigen_types.hpp"
 #include "vision_core/pinhole_camera.hpp"
+#include "vision_core/static_mask.hpp"
 
 namespace bm {
 namespace core {
@@ -33,14 +36,34 @@ class StereoCamera final {
   double cy() const { return cam_left_.cy(); }
   Transform3d Extrinsics() const { return T_left_right_; }
 
+  // Pixels of each camera that are always blocked by the vehicle (see StaticMask). Loaded with the
+  // calibration (see YamlToStereoRig), and empty by default.
+  const StaticMask& LeftMask() const { return mask_left_; }
+  const StaticMask& RightMask() const { return mask_right_; }
+  void SetStaticMasks(const StaticMask& left, const StaticMask& right)
+  {
+    mask_left_ = left;
+    mask_right_ = right;
+  }
+
   double DispToDepth(double disp) const;
   double DepthToDisp(double depth) const;
 
+  // Backprojects N left camera pixels with disparities (all must be > 0) to 3D points in the left
+  // camera frame. Same as LeftCamera().Backproject(xy, DispToDepth(disp)) for each point.
+  void Triangulate(const double* u, const double* v, const double* disp, size_t N,
+                   double* x, double* y, double* z) const;
+  void Triangulate(const std::vector<Vector2d>& xy,
+                   const std::vector<double>& disp,
+                   std::vector<Vector3d>& p_cam) const;
+
  private:
   PinholeCamera cam_left_;
   PinholeCamera cam_right_;
   double baseline_;              // Baseline in meters.
   Transform3d T_left_right_;     // Transform of the right camera in the left frame.
+  StaticMask mask_left_;
+  StaticMask mask_right_;
 };
 
 }
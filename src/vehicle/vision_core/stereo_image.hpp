@@ -1,6 +1,11 @@
 #pragma once
 
+#include <memory>
+#include <utility>
+
+#include "core/frame_cache.hpp"
 #include "core/macros.hpp"
+#include "core/pipeline_latency.hpp"
 #include "core/timestamp.hpp"
 #include "core/uid.hpp"
 #include "vision_core/cv_types.hpp"
@@ -9,6 +14,14 @@ namespace bm {
 namespace core {
 
 
+// A rectified stereo pair. Copying one only copies the cv::Mat headers, so the copies share pixels
+// with the original (which may belong to an ImagePool). The pixels are written once, by whoever
+// builds the pair, and are read-only after that in every thread that they're passed to. Move the
+// pair through queues to avoid touching the Mat refcounts at all.
+//
+// Copies also share the cache, so a derived image (e.g a pyramid or a foreground mask) that one
+// module computed from this pair is reused by every other module that gets a copy of it. Build a
+// new pair (instead of assigning new images to a copy) if the pixels change.
 template <typename ImageT>
 struct StereoImage final
 {
@@ -16,17 +29,24 @@ struct StereoImage final
 
   explicit StereoImage(timestamp_t timestamp,
                        uid_t camera_id,
-                       const ImageT& l,
-                       const ImageT& r)
+                       ImageT l,
+                       ImageT r)
     : timestamp(timestamp),
       camera_id(camera_id),
-      left_image(l),
-      right_image(r) {}
+      left_image(std::move(l)),
+      right_image(std::move(r)) {}
+
+  StereoImage(const StereoImage&) = default;
+  StereoImage& operator=(const StereoImage&) = default;
+  StereoImage(StereoImage&&) = default;
+  StereoImage& operator=(StereoImage&&) = default;
 
   timestamp_t timestamp;
   uid_t camera_id;
   ImageT left_image;
   ImageT right_image;
+  LatencyTags latency;
+  std::shared_ptr<FrameCache> cache = std::make_shared<FrameCache>();
 };
 
 typedef StereoImage<Image1b> StereoImage1b;
@@ -0,0 +1,94 @@
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core/eigen.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/stereo_rectifier.hpp"
+
+namespace bm {
+namespace core {
+
+
+static cv::Mat DistortionToCv(const std::vector<double>& distortion)
+{
+  CHECK(distortion.empty() || distortion.size() == 4 || distortion.size() == 5 || distortion.size() == 8)
+      << "Expected 4, 5 or 8 radial-tangential distortion coefficients" << std::endl;
+  return distortion.empty() ? cv::Mat::zeros(1, 4, CV_64F) : cv::Mat(distortion, true).reshape(1, 1);
+}
+
+
+StereoRectifier::StereoRectifier(const RawStereoCalibration& raw, const StereoCamera& rectified)
+    : rectified_(rectified),
+      raw_size_(raw.left.width, raw.left.height),
+      rectified_size_(static_cast<int>(rectified.Width()), static_cast<int>(rectified.Height()))
+{
+  CHECK(raw_size_.width > 0 && raw_size_.height > 0) << "Raw calibration needs an image size" << std::endl;
+  CHECK(raw.right.width == raw.left.width && raw.right.height == raw.left.height)
+      << "Left and right raw images must be the same size" << std::endl;
+  CHECK(rectified_size_.width > 0 && rectified_size_.height > 0);
+
+  cv::Mat K[2], D[2];
+  cv::eigen2cv(raw.left.K, K[0]);
+  cv::eigen2cv(raw.right.K, K[1]);
+  D[0] = DistortionToCv(raw.left.distortion);
+  D[1] = DistortionToCv(raw.right.distortion);
+
+  // NOTE(milo): OpenCV wants the transform that takes points from the left camera to the right one.
+  const Matrix4d right_T_left = raw.left_T_right.inverse();
+  const Matrix3d R_eig = right_T_left.block<3, 3>(0, 0);
+  const Vector3d t_eig = right_T_left.block<3, 1>(0, 3);
+  cv::Mat R, t;
+  cv::eigen2cv(R_eig, R);
+  cv::eigen2cv(t_eig, t);
+
+  cv::Mat R_rect[2], P[2], Q;
+  cv::stereoRectify(K[0], D[0], K[1], D[1], raw_size_, R, t,
+                    R_rect[0], R_rect[1], P[0], P[1], Q,
+                    cv::CALIB_ZERO_DISPARITY, -1, rectified_size_);
+
+  const Matrix3d K_rect_eig[2] = { rectified.LeftCamera().K(), rectified.RightCamera().K() };
+  for (int i = 0; i < 2; ++i) {
+    cv::Mat K_rect;
+    cv::eigen2cv(K_rect_eig[i], K_rect);
+    cv::initUndistortRectifyMap(K[i], D[i], R_rect[i], K_rect, rectified_size_, CV_16SC2,
+                                map_xy_[i], map_interp_[i]);
+  }
+
+  const double raw_baseline = t_eig.norm();
+  LOG_IF(WARNING, std::fabs(raw_baseline - rectified.Baseline()) > 0.01 * raw_baseline)
+      << "Raw stereo baseline (" << raw_baseline << " m) doesn't match the rectified rig ("
+      << rectified.Baseline() << " m)" << std::endl;
+
+  LOG(INFO) << "Built rectification maps from " << raw_size_ << " to " << rectified_size_ << std::endl;
+}
+
+
+void StereoRectifier::Rectify(int i, const Image1b& raw, Image1b& out) const
+{
+  CHECK(i == 0 || i == 1);
+  CHECK(raw.size() == raw_size_) << "Expected a raw image of size " << raw_size_
+                                 << ", got " << raw.size() << std::endl;
+
+  cv::remap(raw, out, map_xy_[i], map_interp_[i], cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0));
+}
+
+
+StereoImage1b StereoRectifier::Rectify(const StereoImage1b& raw, ImagePool& pool) const
+{
+  StereoImage1b out(raw.timestamp, raw.camera_id,
+                    pool.Acquire(rectified_size_.height, rectified_size_.width),
+                    pool.Acquire(rectified_size_.height, rectified_size_.width));
+  out.latency = raw.latency;
+
+  Rectify(0, raw.left_image, out.left_image);
+  Rectify(1, raw.right_image, out.right_image);
+
+  return out;
+}
+
+
+}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/image_pool.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/stereo_image.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Calibration of one camera, before rectification. The distortion model is radial-tangential, with
+// 4, 5 or 8 coefficients (k1, k2, p1, p2[, k3[, k4, k5, k6]]) as in OpenCV. Empty means none.
+struct RawCameraCalibration final
+{
+  Matrix3d K = Matrix3d::Identity();
+  std::vector<double> distortion;
+  int height = 0;
+  int width = 0;
+};
+
+
+struct RawStereoCalibration final
+{
+  RawCameraCalibration left;
+  RawCameraCalibration right;
+  Matrix4d left_T_right = Matrix4d::Identity();
+};
+
+
+// Rectifies raw stereo pairs, so that they match the StereoCamera that everything downstream
+// (StereoMatcher, the smoother's stereo factors, Patchmatch) is configured with. The remap tables
+// are computed once, in fixed point, which is the fastest path through cv::remap().
+//
+// The rectified rig can have a lower resolution than the raw images. The resize is folded into the
+// remap tables, so it costs nothing extra (and the raw pixels are only read once).
+//
+// NOTE(milo): The rectifying rotations come from the raw extrinsics, but the intrinsics come from
+// the rectified rig, so that the images always match what the pipeline expects.
+class StereoRectifier final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(StereoRectifier)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(StereoRectifier)
+
+  StereoRectifier(const RawStereoCalibration& raw, const StereoCamera& rectified);
+
+  // Rectify one raw image (i = 0 for the left camera, 1 for the right) into "out". If "out" is
+  // already the rectified size (e.g a buffer from an ImagePool), it's written in place. Threadsafe.
+  void Rectify(int i, const Image1b& raw, Image1b& out) const;
+
+  // Rectify both images into buffers from the pool. The timestamp, camera id and latency tags are
+  // kept.
+  StereoImage1b Rectify(const StereoImage1b& raw, ImagePool& pool) const;
+
+  const StereoCamera& RectifiedRig() const { return rectified_; }
+  const cv::Size& RawSize() const { return raw_size_; }
+  const cv::Size& RectifiedSize() const { return rectified_size_; }
+
+ private:
+  StereoCamera rectified_;
+  cv::Size raw_size_;
+  cv::Size rectified_size_;
+
+  // Fixed-point remap tables for each camera: integer pixel coordinates (CV_16SC2), and the index
+  // into OpenCV's bilinear interpolation table (CV_16UC1).
+  cv::Mat map_xy_[2];
+  cv::Mat map_interp_[2];
+};
+
+
+}
+}
@@ -0,0 +1,93 @@
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/alloc_tracker.hpp"
+#include "core/stats_tracker.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static AllocStageCounts GetStage(const std::string& name)
+{
+  for (const AllocStageCounts& counts : GetAllocStageCounts()) {
+    if (counts.name == name) {
+      return counts;
+    }
+  }
+  return AllocStageCounts();
+}
+
+
+// Keeps the compiler from optimizing out an allocation.
+static void Touch(volatile char* ptr) { ptr[0] = 1; }
+
+
+TEST(AllocTrackerTest, CountsByStage)
+{
+  if (!AllocTrackingEnabled()) {
+    LOG(WARNING) << "Built without BM_ENABLE_ALLOC_TRACKING, skipping" << std::endl;
+    return;
+  }
+
+  // Use ScopedAllocStage directly so that this test doesn't depend on MACRO_ALLOC_STAGE.
+  {
+    ScopedAllocStage outer("AllocTrackerTest::Outer");
+    std::vector<char> a(1000);
+    Touch(a.data());
+
+    {
+      ScopedAllocStage inner("AllocTrackerTest::Inner");
+      for (int i = 0; i < 10; ++i) {
+        std::vector<char> b(100);
+        Touch(b.data());
+      }
+    }
+
+    // Back to the outer stage.
+    std::unique_ptr<char[]> c(new char[500]);
+    Touch(c.get());
+  }
+
+  const AllocStageCounts outer = GetStage("AllocTrackerTest::Outer");
+  const AllocStageCounts inner = GetStage("AllocTrackerTest::Inner");
+  EXPECT_EQ(2ul, outer.allocs);
+  EXPECT_EQ(1500ul, outer.bytes);
+  EXPECT_EQ(10ul, inner.allocs);
+  EXPECT_EQ(1000ul, inner.bytes);
+
+  // Stages are per thread, so the worker's allocations aren't charged to the main thread's stage.
+  std::thread worker([]() {
+    ScopedAllocStage stage("AllocTrackerTest::Worker");
+    std::vector<char> d(100);
+    Touch(d.data());
+  });
+  worker.join();
+  EXPECT_EQ(1ul, GetStage("AllocTrackerTest::Worker").allocs);
+  EXPECT_EQ(10ul, GetStage("AllocTrackerTest::Inner").allocs);
+}
+
+
+TEST(AllocTrackerTest, ReportsSinceLastCall)
+{
+  StatsTracker stats("AllocTrackerTest", 10);
+  ReportAllocStages(stats);
+
+  {
+    ScopedAllocStage stage("AllocTrackerTest::Report");
+    std::vector<char> a(64);
+    Touch(a.data());
+  }
+  ReportAllocStages(stats);
+  ReportAllocStages(stats);
+
+  if (AllocTrackingEnabled()) {
+    EXPECT_EQ(1ul, GetStage("AllocTrackerTest::Report").allocs);
+  } else {
+    EXPECT_TRUE(GetAllocStageCounts().empty());
+  }
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include "core/depth_measurement.hpp"
+#include "core/range_measurement.hpp"
+#include "core/broadcast_buffer.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(BroadcastBufferTest, TestIndependentReaders)
+{
+  BroadcastBuffer<DepthMeasurement> buffer(4);
+  BroadcastBuffer<DepthMeasurement>::Reader a(buffer, 4);
+  BroadcastBuffer<DepthMeasurement>::Reader b(buffer, 2);
+  BroadcastBuffer<DepthMeasurement>::Reader off(buffer, 0);
+
+  EXPECT_TRUE(a.Empty());
+  EXPECT_EQ(kMaxSeconds, a.Newest());
+  EXPECT_EQ(kMinSeconds, a.Oldest());
+
+  for (timestamp_t t = 100; t <= 102; ++t) {
+    buffer.Push(DepthMeasurement(t, 0.1 * t));
+  }
+
+  // The smaller reader only keeps its two newest items.
+  EXPECT_EQ(3ul, a.Size());
+  EXPECT_EQ(2ul, b.Size());
+  EXPECT_EQ(1ul, b.Dropped());
+  EXPECT_EQ(0ul, a.Dropped());
+  EXPECT_TRUE(off.Empty());
+  EXPECT_EQ(0ul, off.Dropped());
+
+  // Popping from one reader doesn't affect the other.
+  EXPECT_EQ(100ul, a.Pop().timestamp);
+  EXPECT_EQ(2ul, a.Size());
+  EXPECT_EQ(2ul, b.Size());
+  EXPECT_EQ(ConvertToSeconds(101), b.Oldest());
+
+  b.DiscardBefore(ConvertToSeconds(200), true);
+  EXPECT_EQ(1ul, b.Size());
+  EXPECT_EQ(102ul, b.Pop().timestamp);
+  EXPECT_TRUE(b.Empty());
+  EXPECT_EQ(2ul, a.Size());
+
+  // Overwrite the whole ring. Reader "a" lost the two items that it never read.
+  for (timestamp_t t = 103; t <= 106; ++t) {
+    buffer.Push(DepthMeasurement(t, 0.1 * t));
+  }
+  EXPECT_EQ(4ul, a.Size());
+  EXPECT_EQ(2ul, a.Dropped());
+  EXPECT_EQ(ConvertToSeconds(103), a.Oldest());
+  EXPECT_EQ(ConvertToSeconds(106), a.Newest());
+  EXPECT_EQ(2ul, b.Size());
+  EXPECT_EQ(3ul, b.Dropped());
+
+  std::vector<DepthMeasurement> out;
+  a.PopUntil(ConvertToSeconds(104), out);
+  ASSERT_EQ(2ul, out.size());
+  EXPECT_EQ(103ul, out.at(0).timestamp);
+  EXPECT_EQ(104ul, out.at(1).timestamp);
+  EXPECT_EQ(2ul, a.Size());
+
+  EXPECT_EQ(106ul, b.PopNewest().timestamp);
+  EXPECT_TRUE(b.Empty());
+  EXPECT_EQ(7ul, buffer.NumPushed());
+}
+
+
+TEST(BroadcastBufferTest, TestPopNearestAndView)
+{
+  BroadcastBuffer<RangeMeasurement> buffer(10);
+  BroadcastBuffer<RangeMeasurement>::Reader r(buffer, 10);
+
+  std::vector<RangeMeasurement> batch;
+  for (timestamp_t t = 0; t < 5; ++t) {
+    batch.emplace_back(RangeMeasurement(ConvertToNanoseconds(t), 1.0 + t, Vector3d::Zero()));
+  }
+  buffer.PushBatch(batch.data(), batch.size());
+  EXPECT_EQ(5ul, r.Size());
+
+  size_t visited = 0;
+  EXPECT_EQ(3ul, r.ViewRange(1.0, 3.0, [&visited](const RangeMeasurement&) { ++visited; }));
+  EXPECT_EQ(3ul, visited);
+  EXPECT_EQ(5ul, r.Size());
+
+  // Pops the item at 2 sec, and everything before it.
+  std::shared_ptr<RangeMeasurement> nearest = r.PopNearest(2.2, 0.5);
+  ASSERT_NE(nullptr, nearest);
+  EXPECT_EQ(3.0, nearest->range);
+  EXPECT_EQ(2ul, r.Size());
+
+  // Too far from anything, so this only keeps the newest item.
+  EXPECT_EQ(nullptr, r.PopNearest(10.0, 0.5));
+  EXPECT_EQ(1ul, r.Size());
+  EXPECT_EQ(4.0, r.Oldest());
+}
@@ -87,3 +87,19 @@ TEST(DataManagerTest, TestAll)
   EXPECT_EQ(15ul, out.at(1).timestamp);
   EXPECT_EQ(15ul, out.at(2).timestamp);
 }
+
+
+TEST(DataManagerTest, PushBatch)
+{
+  DataManager<DepthMeasurement> m(3, true);
+
+  const std::vector<DepthMeasurement> batch = {
+    DepthMeasurement(10, 0.1), DepthMeasurement(11, 0.2), DepthMeasurement(12, 0.3), DepthMeasurement(13, 0.4)
+  };
+  m.PushBatch(batch.data(), batch.size());
+
+  EXPECT_EQ(3ul, m.Size());
+  EXPECT_EQ(ConvertToSeconds(11), m.Oldest(true));
+  EXPECT_EQ(ConvertToSeconds(13), m.Newest());
+  EXPECT_EQ(11ul, m.Pop().timestamp);
+}
@@ -0,0 +1,91 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/frame_cache.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(FrameCacheTest, Key)
+{
+  EXPECT_EQ("ft::Pyramid", FrameCacheKey("ft::Pyramid"));
+  EXPECT_EQ("ft::Pyramid/left/21/4", FrameCacheKey("ft::Pyramid", "left", 21, 4));
+}
+
+
+TEST(FrameCacheTest, ComputedOnce)
+{
+  FrameCache cache;
+  int num_computed = 0;
+
+  const std::function<void(std::vector<int>&)> compute = [&num_computed](std::vector<int>& v) {
+    ++num_computed;
+    v = { 1, 2, 3 };
+  };
+
+  EXPECT_FALSE(cache.Contains("a"));
+  const std::shared_ptr<const std::vector<int>> a0 = cache.Get<std::vector<int>>("a", compute);
+  const std::shared_ptr<const std::vector<int>> a1 = cache.Get<std::vector<int>>("a", compute);
+  EXPECT_TRUE(cache.Contains("a"));
+  EXPECT_EQ(1, num_computed);
+  EXPECT_EQ(a0.get(), a1.get());
+  EXPECT_EQ(3ul, a1->size());
+
+  cache.Get<std::vector<int>>("b", compute);
+  EXPECT_EQ(2, num_computed);
+  EXPECT_EQ(2ul, cache.Size());
+}
+
+
+TEST(FrameCacheTest, OutlivesCache)
+{
+  std::shared_ptr<const int> value;
+  {
+    FrameCache cache;
+    value = cache.Get<int>("x", [](int& x) { x = 7; });
+  }
+  EXPECT_EQ(7, *value);
+}
+
+
+TEST(FrameCacheTest, NestedGet)
+{
+  FrameCache cache;
+  const std::shared_ptr<const int> twice = cache.Get<int>("twice", [&cache](int& x) {
+    x = 2 * *cache.Get<int>("base", [](int& b) { b = 21; });
+  });
+  EXPECT_EQ(42, *twice);
+  EXPECT_EQ(2ul, cache.Size());
+}
+
+
+TEST(FrameCacheTest, ConcurrentGet)
+{
+  FrameCache cache;
+  std::atomic<int> num_computed{0};
+
+  std::vector<std::thread> threads;
+  std::vector<int> values(8, 0);
+  for (size_t i = 0; i < values.size(); ++i) {
+    threads.emplace_back([&cache, &num_computed, &values, i]() {
+      values.at(i) = *cache.Get<int>("x", [&num_computed](int& x) {
+        ++num_computed;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        x = 5;
+      });
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+
+  EXPECT_EQ(1, num_computed.load());
+  for (int v : values) {
+    EXPECT_EQ(5, v);
+  }
+}
@@ -12,20 +12,61 @@ TEST(GridLookupTest, TestIndexLookupGrid)
   GridLookup<int> grid(rows, cols);
 
   // Each grid cell should start out empty.
-  std::list<int> idx0 = grid.GetCell(12, 13);
+  const auto idx0 = grid.GetCell(12, 13);
   ASSERT_EQ(0ul, idx0.size());
 
-  // Add something at grid cell.
-  std::list<int>& idx1 = grid.GetCellMutable(12, 13);
-  idx1.emplace_back(123);
+  // Add something at grid cell (row 12, col 13).
+  grid.Build({ Vector2i(13, 12) }, { 123 });
+  const auto idx1 = grid.GetCell(12, 13);
   ASSERT_EQ(1ul, idx1.size());
+  ASSERT_EQ(123, idx1[0]);
 
   // Get everything within an roi.
   Box2i roi(Vector2i(10, 10), Vector2i(100, 100));
-  const auto idx2 = grid.GetRoi(roi);
+  std::vector<int> idx2;
+  grid.GetRoi(roi, idx2);
   ASSERT_EQ(1ul, idx2.size());
 
   Box2i roi_empty(Vector2i(0, 0), Vector2i(0, 0));
-  const auto idx3 = grid.GetRoi(roi_empty);
-  ASSERT_EQ(0ul, idx3.size());
+  ASSERT_EQ(0ul, grid.CountInRoi(roi_empty));
+}
+
+
+TEST(GridLookupTest, TestBuild)
+{
+  GridLookup<int> grid(4, 5);
+
+  // Cells are (col, row).
+  const std::vector<Vector2i> cells = {
+    Vector2i(0, 0), Vector2i(4, 3), Vector2i(1, 1), Vector2i(2, 1), Vector2i(4, 3), Vector2i(1, 2)
+  };
+  grid.Build(cells);
+  EXPECT_EQ(6ul, grid.Size());
+
+  // Indices keep their original order within a cell.
+  const auto corner = grid.GetCell(3, 4);
+  ASSERT_EQ(2ul, corner.size());
+  EXPECT_EQ(1, corner[0]);
+  EXPECT_EQ(4, corner[1]);
+
+  // Columns 1-2 of row 1 are one contiguous span.
+  const auto row_span = grid.GetRowSpan(1, 1, 2);
+  ASSERT_EQ(2ul, row_span.size());
+  EXPECT_EQ(2, row_span[0]);
+  EXPECT_EQ(3, row_span[1]);
+
+  // The roi is clipped to the grid.
+  std::vector<int> seen;
+  grid.ForEachInRoi(Box2i(Vector2i(-1, -1), Vector2i(1, 1)), [&seen](int i) { seen.emplace_back(i); });
+  EXPECT_EQ(std::vector<int>({ 0, 2 }), seen);
+  EXPECT_EQ(3ul, grid.CountInRoi(Box2i(Vector2i(1, 0), Vector2i(2, 2))));
+
+  // Rebuilding replaces everything.
+  grid.Build({ Vector2i(2, 2) });
+  EXPECT_EQ(1ul, grid.Size());
+  EXPECT_EQ(0ul, grid.GetCell(3, 4).size());
+  EXPECT_EQ(1ul, grid.GetCell(2, 2).size());
+
+  grid.Clear();
+  EXPECT_EQ(0ul, grid.GetCell(2, 2).size());
 }
@@ -0,0 +1,68 @@
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/memory_usage.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(MemoryUsageTest, ResidentSetSize)
+{
+  const double rss0 = ResidentSetSizeMb();
+  ASSERT_GT(rss0, 0);
+
+  // Touch 64 MB, which should all be resident.
+  std::vector<char> buffer(64 * 1024 * 1024, 1);
+  const double rss1 = ResidentSetSizeMb();
+  EXPECT_GT(rss1, rss0 + 32.0);
+  EXPECT_EQ(1, buffer.back());
+}
+
+
+TEST(MemoryUsageTest, Registry)
+{
+  MemoryRegistry& registry = MemoryRegistry::Get();
+
+  size_t queue_bytes = 1000;
+  const size_t id_queue = registry.Register("queue", [&queue_bytes]() { return queue_bytes; });
+  const size_t id_cache = registry.Register("cache", []() { return 24ul; });
+
+  EXPECT_EQ(1024ul, registry.Poll());
+  queue_bytes = 10;
+  EXPECT_EQ(34ul, registry.Poll());
+
+  const std::vector<SubsystemMemory> usage = registry.Usage();
+  ASSERT_EQ(2ul, usage.size());
+  EXPECT_EQ("queue", usage.at(0).name);
+  EXPECT_EQ(10ul, usage.at(0).bytes);
+  EXPECT_EQ(1000ul, usage.at(0).peak_bytes);
+
+  registry.Unregister(id_queue);
+  EXPECT_EQ(24ul, registry.Poll());
+  registry.Unregister(id_cache);
+  EXPECT_TRUE(registry.Usage().empty());
+}
+
+
+TEST(MemoryUsageTest, FitToMemoryBudget)
+{
+  std::vector<MemoryKnob> knobs;
+  knobs.emplace_back("images", 100, 1000, 10);
+  knobs.emplace_back("imu", 1000, 10, 1000);     // Fixed.
+
+  // Already fits.
+  EXPECT_EQ(1.0, FitToMemoryBudget(1000000, knobs));
+  EXPECT_EQ(100, knobs.at(0).capacity);
+
+  // The fixed 10000 bytes and the 10 images take 20000, and the other 90 images get half of theirs.
+  EXPECT_DOUBLE_EQ(0.5, FitToMemoryBudget(65000, knobs));
+  EXPECT_EQ(55, knobs.at(0).capacity);
+  EXPECT_EQ(1000, knobs.at(1).capacity);
+
+  // Not even the min capacities fit.
+  EXPECT_EQ(0.0, FitToMemoryBudget(1000, knobs));
+  EXPECT_EQ(10, knobs.at(0).capacity);
+  EXPECT_EQ(1000, knobs.at(1).capacity);
+}
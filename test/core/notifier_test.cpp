@@ -0,0 +1,71 @@
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/notifier.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "core/spsc_queue.hpp"
+#include "core/timer.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(NotifierTest, WaitNonEmptyTimeout)
+{
+  ThreadsafeQueue<int> q(10, true);
+
+  Timer timer(true);
+  EXPECT_FALSE(q.WaitNonEmpty(0.05));
+  EXPECT_GE(timer.Elapsed().seconds(), 0.04);
+
+  int item = 0;
+  EXPECT_FALSE(q.PopBlocking(item, 0.01));
+
+  // Items that are already in the queue should return immediately.
+  q.Push(3);
+  EXPECT_TRUE(q.WaitNonEmpty(10.0));
+  EXPECT_TRUE(q.PopBlocking(item, 10.0));
+  EXPECT_EQ(3, item);
+}
+
+
+TEST(NotifierTest, PopBlocking)
+{
+  SpscQueue<int> q(10, true);
+
+  std::thread producer([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.Push(7);
+  });
+
+  int item = 0;
+  EXPECT_TRUE(q.PopBlocking(item, 10.0));
+  EXPECT_EQ(7, item);
+  producer.join();
+}
+
+
+TEST(NotifierTest, MultiQueue)
+{
+  Notifier notifier;
+  ThreadsafeQueue<int> q1(10, true);
+  SpscQueue<double> q2(10, true);
+  q1.AttachNotifier(&notifier);
+  q2.AttachNotifier(&notifier);
+
+  const uint64_t generation = notifier.Generation();
+  EXPECT_FALSE(notifier.WaitForNotify(generation, 0.01));
+
+  std::thread producer([&q2]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q2.Push(1.0);
+  });
+
+  // A push to either queue should wake up the waiter.
+  EXPECT_TRUE(notifier.WaitFor([&]() { return !q1.Empty() || !q2.Empty(); }, 10.0));
+  EXPECT_TRUE(q1.Empty());
+  EXPECT_FALSE(q2.Empty());
+  EXPECT_NE(generation, notifier.Generation());
+  producer.join();
+}
@@ -0,0 +1,156 @@
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "params/param_tree.hpp"
+#include "params/params_watcher.hpp"
+#include "params/yaml_parser.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static const std::string kFilepath = "./resources/test_struct_params.yaml";
+
+
+TEST(ParamTreeTest, Find)
+{
+  const ParamTree tree(kFilepath);
+
+  EXPECT_EQ(456, (int)tree.Find("a"));
+  EXPECT_DOUBLE_EQ(2.0, (double)tree.Find("SubtreeStruct/KEY2"));
+  EXPECT_EQ(0, (int)tree.Find("SubtreeStruct/subsubtree/c"));
+  EXPECT_TRUE(tree.Find("SubtreeStruct").isMap());
+  EXPECT_TRUE(tree.Find("v").isSeq());
+
+  // Missing ids, and ids that go through a leaf.
+  EXPECT_EQ(cv::FileNode::NONE, tree.Find("c").type());
+  EXPECT_EQ(cv::FileNode::NONE, tree.Find("a/b").type());
+  EXPECT_EQ(cv::FileNode::NONE, tree.Find("SubtreeStruct/").type());
+
+  // a, b, v, SubtreeStruct, key1, KEY2, subsubtree, c
+  EXPECT_EQ(8ul, tree.Size());
+}
+
+
+TEST(ParamTreeTest, TryLoad)
+{
+  std::string error;
+  EXPECT_TRUE(ParamTree::TryLoad("./resources/does_not_exist.yaml", "", error) == nullptr);
+  EXPECT_FALSE(error.empty());
+
+  error.clear();
+  EXPECT_TRUE(ParamTree::TryLoad(kFilepath, "", error) != nullptr);
+  EXPECT_TRUE(error.empty());
+}
+
+
+TEST(ParamTreeTest, ParserWithTree)
+{
+  const YamlParser parser(kFilepath, kFilepath);
+
+  EXPECT_EQ(789, parser.GetParam<int>("b"));
+  EXPECT_DOUBLE_EQ(3.14159, parser.GetParam<double>("SubtreeStruct/key1"));
+  EXPECT_EQ(456, parser.GetParam<int>("/shared/a"));
+
+  // Subtrees look up relative ids, but shared ids are still relative to the shared root.
+  const YamlParser subtree = parser.Subtree("SubtreeStruct");
+  EXPECT_DOUBLE_EQ(2.0, subtree.GetParam<double>("KEY2"));
+  EXPECT_FALSE(subtree.GetParam<bool>("subsubtree/c"));
+  EXPECT_DOUBLE_EQ(3.14159, subtree.GetParam<double>("/shared/SubtreeStruct/key1"));
+  EXPECT_EQ(0, subtree.Subtree("subsubtree").GetParam<int>("c"));
+  EXPECT_FALSE(subtree.HasParam("a"));
+}
+
+
+TEST(ParamTreeTest, TryGetParam)
+{
+  const YamlParser tree_parser(kFilepath);
+  const ParamTree tree(kFilepath);
+  const YamlParser node_parser(tree.Root(), cv::FileNode());
+
+  for (const YamlParser* parser : { &tree_parser, &node_parser }) {
+    int a = 0;
+    EXPECT_TRUE(parser->TryGetParam("a", &a));
+    EXPECT_EQ(456, a);
+
+    double key1 = 0;
+    EXPECT_TRUE(parser->TryGetParam("SubtreeStruct/key1", &key1));
+    EXPECT_DOUBLE_EQ(3.14159, key1);
+
+    // Missing params leave the output alone.
+    int missing = 123;
+    EXPECT_FALSE(parser->TryGetParam("missing", &missing));
+    EXPECT_FALSE(parser->TryGetParam("SubtreeStruct/missing", &missing));
+    EXPECT_FALSE(parser->TryGetParam("a/b", &missing));
+    EXPECT_FALSE(parser->TryGetParam("/shared/a", &missing));
+    EXPECT_EQ(123, missing);
+
+    EXPECT_TRUE(parser->HasParam("SubtreeStruct/subsubtree"));
+    EXPECT_FALSE(parser->HasParam(""));
+  }
+}
+
+
+static void WriteParams(const std::string& filepath, int a)
+{
+  std::ofstream f(filepath);
+  f << "%YAML:1.0\n\na: " << a << "\nSubtree:\n  b: " << (2 * a) << "\n";
+}
+
+
+// Waits up to 2 sec for the watcher to reload n times.
+static bool WaitForReloads(const ParamsWatcher& watcher, size_t n)
+{
+  for (int i = 0; i < 200 && watcher.NumReloads() < n; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return watcher.NumReloads() >= n;
+}
+
+
+TEST(ParamTreeTest, Watcher)
+{
+  const std::string filepath = "/tmp/param_tree_test_watcher.yaml";
+  WriteParams(filepath, 1);
+
+  std::mutex mutex;
+  int a = 0, b = 0;
+
+  ParamsWatcher watcher(filepath, "", [&](const ParamTree::ConstPtr& tree) {
+    const YamlParser parser(tree);
+    std::lock_guard<std::mutex> lock(mutex);
+    parser.GetParam("a", &a);
+    parser.Subtree("Subtree").GetParam("b", &b);
+  }, 0.01);
+
+  // Nothing changed yet.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(0ul, watcher.NumReloads());
+
+  // NOTE(milo): Change the size too, in case the filesystem has coarse mtimes.
+  WriteParams(filepath, 25);
+  ASSERT_TRUE(WaitForReloads(watcher, 1));
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(25, a);
+    EXPECT_EQ(50, b);
+  }
+
+  // A broken file is skipped, and the next good one is picked up.
+  {
+    std::ofstream f(filepath);
+    f << "%YAML:1.0\n\na: [1, 2\n";
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(1ul, watcher.NumReloads());
+
+  WriteParams(filepath, 300);
+  ASSERT_TRUE(WaitForReloads(watcher, 2));
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_EQ(300, a);
+  EXPECT_EQ(600, b);
+}
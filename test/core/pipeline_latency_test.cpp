@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+
+#include "core/pipeline_latency.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(PipelineLatencyTest, Histogram)
+{
+  LatencyHistogram h;
+  EXPECT_EQ(0, h.Count());
+  EXPECT_EQ(0, h.Percentile(0.5));
+
+  // 90 fast samples and 10 slow ones.
+  for (int i = 0; i < 90; ++i) { h.Add(1.5); }
+  for (int i = 0; i < 10; ++i) { h.Add(300.0); }
+
+  EXPECT_EQ(100, h.Count());
+  EXPECT_FLOAT_EQ(300.0, h.Max());
+
+  const float p50 = h.Percentile(0.5);
+  EXPECT_GT(p50, 1.0);
+  EXPECT_LE(p50, 2.0);
+
+  const float p99 = h.Percentile(0.99);
+  EXPECT_GT(p99, 200.0);
+  EXPECT_LE(p99, 300.0);
+
+  // Bins are (1, 2] and (200, 500].
+  EXPECT_EQ(90, h.BinCounts().at(4));
+  EXPECT_EQ(10, h.BinCounts().at(11));
+
+  // Anything huge goes in the last bin.
+  h.Add(1e6);
+  EXPECT_EQ(1, h.BinCounts().back());
+  EXPECT_FLOAT_EQ(1e6, h.Percentile(1.0));
+}
+
+
+TEST(PipelineLatencyTest, Stats)
+{
+  PipelineLatencyStats stats;
+
+  PipelineLatency invalid;
+  stats.Add("filter", invalid);
+  EXPECT_TRUE(stats.Summarize().empty());
+
+  PipelineLatency latency;
+  latency.valid = true;
+  latency.queue_ms = 0.5;
+  latency.filter_ms = 2.0;
+  latency.total_ms = 2.5;
+  stats.Add("filter", latency);
+  stats.Add("filter", latency);
+
+  const std::vector<LatencyStageSummary> summaries = stats.Summarize(false);
+  ASSERT_EQ(3ul, summaries.size());
+  EXPECT_EQ("filter/filter", summaries.at(0).name);
+  EXPECT_EQ("filter/queue", summaries.at(1).name);
+  EXPECT_EQ("filter/total", summaries.at(2).name);
+  EXPECT_EQ(2, summaries.at(2).count);
+  EXPECT_FLOAT_EQ(2.5, summaries.at(2).max_ms);
+
+  // Resets after summarizing.
+  EXPECT_EQ(3ul, stats.Summarize().size());
+  EXPECT_TRUE(stats.Summarize().empty());
+}
+
+
+TEST(PipelineLatencyTest, ElapsedMs)
+{
+  EXPECT_FLOAT_EQ(0, ElapsedMs(0, 5000000));
+  EXPECT_FLOAT_EQ(4, ElapsedMs(1000000, 5000000));
+}
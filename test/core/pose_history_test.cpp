@@ -0,0 +1,108 @@
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/pose_history.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Moving along x at 1 m/sec, and turning about z at 0.1 rad/sec.
+static SE3 PoseAt(timestamp_t timestamp)
+{
+  const double t = ConvertToSeconds(timestamp);
+  return SE3(Quaterniond(AngleAxisd(0.1 * t, Vector3d::UnitZ())), Vector3d(t, 0, 0));
+}
+
+
+TEST(PoseHistoryTest, Interpolate)
+{
+  PoseHistory history(10, 0.5);
+
+  SE3 pose;
+  EXPECT_FALSE(history.Lookup(0, pose));
+
+  // Every 100 ms, with a 1 sec gap after 0.3 sec.
+  for (const timestamp_t t_ms : { 0, 100, 200, 300, 1300, 1400 }) {
+    history.Add(t_ms * 1000000ul, PoseAt(t_ms * 1000000ul));
+  }
+  EXPECT_EQ(6ul, history.Size());
+
+  timestamp_t oldest, newest;
+  ASSERT_TRUE(history.Span(oldest, newest));
+  EXPECT_EQ(0ul, oldest);
+  EXPECT_EQ(1400000000ul, newest);
+
+  for (const timestamp_t t_ms : { 0, 50, 100, 125, 290, 1300, 1377, 1400 }) {
+    const timestamp_t t = t_ms * 1000000ul;
+    ASSERT_TRUE(history.Lookup(t, pose)) << "t_ms=" << t_ms;
+    EXPECT_TRUE(pose.matrix().isApprox(PoseAt(t).matrix(), 1e-9)) << "t_ms=" << t_ms;
+  }
+
+  // Nothing before the first pose, after the last one, or in the gap.
+  EXPECT_FALSE(history.Lookup(1500000000ul, pose));
+  EXPECT_FALSE(history.Lookup(800000000ul, pose));
+}
+
+
+TEST(PoseHistoryTest, ReplaceAndForget)
+{
+  PoseHistory history(4, 1.0);
+  for (timestamp_t t = 1; t <= 6; ++t) {
+    history.Add(t, SE3(Matrix3d::Identity(), Vector3d(t, 0, 0)));
+  }
+
+  // Only the newest 4 are kept.
+  timestamp_t oldest, newest;
+  ASSERT_TRUE(history.Span(oldest, newest));
+  EXPECT_EQ(4ul, history.Size());
+  EXPECT_EQ(3ul, oldest);
+  EXPECT_EQ(6ul, newest);
+
+  SE3 pose;
+  EXPECT_FALSE(history.Lookup(2, pose));
+  ASSERT_TRUE(history.Lookup(3, pose));
+  EXPECT_EQ(3.0, pose.translation().x());
+
+  // A pose at or before the newest one replaces everything from there on.
+  history.Add(5, SE3(Matrix3d::Identity(), Vector3d(50, 0, 0)));
+  ASSERT_TRUE(history.Span(oldest, newest));
+  EXPECT_EQ(3ul, history.Size());
+  EXPECT_EQ(5ul, newest);
+  ASSERT_TRUE(history.Lookup(5, pose));
+  EXPECT_EQ(50.0, pose.translation().x());
+  EXPECT_FALSE(history.Lookup(6, pose));
+}
+
+
+TEST(PoseHistoryTest, Threaded)
+{
+  PoseHistory history(100, 1.0);
+  const timestamp_t N = 200000;
+  std::atomic_bool done{false};
+
+  // Translation is always the timestamp, so an interpolated pose should be at its timestamp too.
+  std::thread reader([&]() {
+    SE3 pose;
+    while (!done) {
+      timestamp_t oldest, newest;
+      if (!history.Span(oldest, newest) || newest == oldest) {
+        continue;
+      }
+      const timestamp_t t = oldest + (newest - oldest) / 2;
+      if (history.Lookup(t, pose)) {
+        ASSERT_NEAR(static_cast<double>(t), pose.translation().x(), 1e-6);
+      }
+    }
+  });
+
+  for (timestamp_t t = 1; t <= N; ++t) {
+    history.Add(10 * t, SE3(Matrix3d::Identity(), Vector3d(10 * t, 0, 0)));
+  }
+  done = true;
+  reader.join();
+
+  EXPECT_EQ(100ul, history.Size());
+}
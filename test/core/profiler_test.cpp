@@ -0,0 +1,65 @@
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/profiler.hpp"
+#include "core/stats_tracker.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(ProfilerTest, Percentiles)
+{
+  StatsBuffer<float> buf(1000);
+  for (int i = 1; i <= 100; ++i) {
+    buf.Add(static_cast<float>(i));
+  }
+
+  int N;
+  float p50, p95, p99;
+  buf.Percentiles(N, p50, p95, p99);
+  EXPECT_EQ(100, N);
+  EXPECT_NEAR(50.0f, p50, 1.0f);
+  EXPECT_NEAR(95.0f, p95, 1.0f);
+  EXPECT_NEAR(99.0f, p99, 1.0f);
+}
+
+
+TEST(ProfilerTest, SummarizeAndExport)
+{
+  Profiler& profiler = Profiler::Instance();
+  profiler.Clear();
+
+  // Use ScopedProfile directly so that this test doesn't depend on BM_ENABLE_PROFILING.
+  for (int i = 0; i < 5; ++i) {
+    ScopedProfile outer("outer");
+    ScopedProfile inner("inner");
+  }
+
+  std::thread worker([]() { ScopedProfile span("worker"); });
+  worker.join();
+
+  const std::vector<ProfileSummary> summaries = profiler.Summarize();
+  ASSERT_EQ(3ul, summaries.size());
+  for (const ProfileSummary& s : summaries) {
+    EXPECT_EQ(s.name == "worker" ? 1 : 5, s.count);
+    EXPECT_GE(s.max_ms, s.p50_ms);
+  }
+
+  const std::string path = "/tmp/profiler_test_trace.json";
+  ASSERT_TRUE(profiler.ExportChromeTrace(path));
+
+  std::ifstream in(path);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  const std::string trace = ss.str();
+  EXPECT_NE(std::string::npos, trace.find("\"traceEvents\""));
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"inner\""));
+  EXPECT_NE(std::string::npos, trace.find("\"depth\":1"));
+
+  profiler.Clear();
+  EXPECT_TRUE(profiler.Summarize().empty());
+}
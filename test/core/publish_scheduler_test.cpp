@@ -0,0 +1,85 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/publish_scheduler.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(PublishSchedulerTest, Coalesce)
+{
+  std::vector<int> published;
+  PublishScheduler scheduler;
+  const PublishScheduler::ChannelId id = scheduler.AddChannel<int>(
+      "ints", 10.0, [&published](const int& value) { published.emplace_back(value); });
+  scheduler.Start();
+
+  // The first update is due right away (the channel hasn't published yet), the rest arrive well
+  // within one period and only the latest of them is published.
+  std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  for (int i = 0; i < 10; ++i) {
+    scheduler.Update(id, i);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  for (int i = 10; i < 20; ++i) {
+    scheduler.Update(id, i);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  scheduler.Stop();
+
+  ASSERT_EQ(2ul, published.size());
+  EXPECT_EQ(19, published.back());
+  EXPECT_EQ(2ul, scheduler.NumPublished(id));
+  EXPECT_EQ(18ul, scheduler.NumCoalesced(id));
+}
+
+
+TEST(PublishSchedulerTest, FlushOnStop)
+{
+  std::vector<int> published;
+  PublishScheduler scheduler;
+  const PublishScheduler::ChannelId id = scheduler.AddChannel<int>(
+      "ints", 0.01, [&published](const int& value) { published.emplace_back(value); });
+  scheduler.Start();
+
+  scheduler.Update(id, 1);
+  scheduler.Update(id, 2);
+  scheduler.Stop();
+
+  ASSERT_EQ(1ul, published.size());
+  EXPECT_EQ(2, published.front());
+}
+
+
+TEST(PublishSchedulerTest, Periodic)
+{
+  std::atomic<int> num_stats{0};
+  std::atomic<int> num_poses{0};
+  PublishScheduler scheduler;
+  scheduler.AddPeriodic("stats", 50.0, [&num_stats]() { ++num_stats; });
+
+  // A slow consumer on one channel doesn't hold up the producer.
+  const PublishScheduler::ChannelId id = scheduler.AddChannel<double>("poses", 0.0, [&num_poses](const double&) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ++num_poses;
+  });
+  scheduler.Start();
+
+  const auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < 100; ++i) {
+    scheduler.Update(id, 1.0 * i);
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - t0, std::chrono::milliseconds(20));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  scheduler.SetTargetHz(id, 1.0);
+  scheduler.Stop();
+
+  EXPECT_GE(num_stats.load(), 3);
+  EXPECT_GE(num_poses.load(), 1);
+  EXPECT_LT(num_poses.load(), 100);
+}
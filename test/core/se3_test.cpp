@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include "core/se3.hpp"
+#include "core/transform_util.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static Matrix4d MakeTransform(const Vector3d& axis, double angle, const Vector3d& t)
+{
+  Matrix4d T = Matrix4d::Identity();
+  T.block<3, 3>(0, 0) = AngleAxisd(angle, axis.normalized()).toRotationMatrix();
+  T.block<3, 1>(0, 3) = t;
+  return T;
+}
+
+
+TEST(SE3Test, TestMatchesMatrix4d)
+{
+  const Matrix4d a_T_b = MakeTransform(Vector3d(1, 2, 3), 0.7, Vector3d(1, -2, 0.5));
+  const Matrix4d b_T_c = MakeTransform(Vector3d(-1, 0, 1), -1.2, Vector3d(0.3, 0.1, 4));
+
+  const SE3 A(a_T_b), B(b_T_c);
+  EXPECT_TRUE(A.matrix().isApprox(a_T_b));
+  EXPECT_TRUE((A * B).matrix().isApprox(a_T_b * b_T_c));
+  EXPECT_TRUE(A.Inverse().matrix().isApprox(a_T_b.inverse()));
+  EXPECT_TRUE(inverse_se3(a_T_b).isApprox(a_T_b.inverse()));
+  EXPECT_TRUE((A * A.Inverse()).matrix().isApprox(Matrix4d::Identity()));
+
+  const Vector3d b_t_p(3, 4, 5);
+  const Vector4d a_t_p = a_T_b * Vector4d(3, 4, 5, 1);
+  EXPECT_TRUE((A * b_t_p).isApprox(a_t_p.head(3)));
+  EXPECT_TRUE(A.InverseTransform(A * b_t_p).isApprox(b_t_p));
+  EXPECT_TRUE(A.Rotate(b_t_p).isApprox(a_T_b.block<3, 3>(0, 0) * b_t_p));
+
+  // Round trip through a quaternion.
+  const SE3 Aq(A.ToQuaternion(), A.translation());
+  EXPECT_TRUE(Aq.matrix().isApprox(a_T_b));
+  EXPECT_TRUE((A.so3() * B.so3()).matrix().isApprox((A * B).rotation()));
+  EXPECT_TRUE(A.so3().InverseRotate(A.so3() * b_t_p).isApprox(b_t_p));
+}
+
+
+TEST(SE3Test, TestTransformPoints)
+{
+  const SE3 T(MakeTransform(Vector3d(0, 1, 1), 2.0, Vector3d(-1, 5, 2)));
+
+  std::vector<Vector3d> points;
+  for (int i = 0; i < 17; ++i) {
+    points.emplace_back(0.1 * i, -0.2 * i, 3.0 + i);
+  }
+
+  const std::vector<Vector3d> out = T.TransformPoints(points);
+  ASSERT_EQ(points.size(), out.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    EXPECT_TRUE(out.at(i).isApprox(T * points.at(i)));
+  }
+
+  std::vector<Vector3d> empty_out(3);
+  T.TransformPoints(std::vector<Vector3d>(), empty_out);
+  EXPECT_TRUE(empty_out.empty());
+}
@@ -0,0 +1,74 @@
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/seqlock.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+struct Pair final
+{
+  int a = 0;
+  int b = 0;
+};
+
+
+TEST(SeqLockTest, StoreLoad)
+{
+  SeqLock<Pair> s;
+
+  Pair p;
+  EXPECT_FALSE(s.Load(p));
+  EXPECT_EQ(0ul, s.Version());
+
+  p.a = 1;
+  p.b = 2;
+  s.Store(p);
+  EXPECT_EQ(1ul, s.Version());
+
+  Pair out;
+  uint64_t version = 0;
+  EXPECT_TRUE(s.Load(out, &version));
+  EXPECT_EQ(1, out.a);
+  EXPECT_EQ(2, out.b);
+  EXPECT_EQ(1ul, version);
+}
+
+
+TEST(SeqLockTest, Threaded)
+{
+  SeqLock<Pair> s;
+  const int N = 200000;
+  std::atomic_bool done{false};
+
+  // The reader should never see a half-written value.
+  std::thread reader([&]() {
+    Pair p;
+    uint64_t last_version = 0;
+    while (!done) {
+      uint64_t version = 0;
+      if (s.Load(p, &version)) {
+        ASSERT_EQ(p.a, p.b);
+        ASSERT_GE(version, last_version);
+        last_version = version;
+      }
+    }
+  });
+
+  for (int i = 1; i <= N; ++i) {
+    Pair p;
+    p.a = i;
+    p.b = i;
+    s.Store(p);
+  }
+  done = true;
+  reader.join();
+
+  Pair p;
+  EXPECT_TRUE(s.Load(p));
+  EXPECT_EQ(N, p.a);
+  EXPECT_EQ((uint64_t)N, s.Version());
+}
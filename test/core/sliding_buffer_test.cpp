@@ -41,3 +41,27 @@ TEST(SlidingBuffer, Test01)
   EXPECT_EQ(3, sb.Get(1));
   EXPECT_EQ(2, sb.Get(2));
 }
+
+
+TEST(SlidingBuffer, Swap)
+{
+  SlidingBuffer<std::vector<int>> sb(2);
+
+  // Until the buffer is full, we get default items back.
+  std::vector<int> item = { 1 };
+  sb.Swap(item);
+  EXPECT_TRUE(item.empty());
+
+  item = { 2, 2 };
+  sb.Swap(item);
+  EXPECT_TRUE(item.empty());
+  EXPECT_EQ(2ul, sb.Head().size());
+  EXPECT_EQ(1ul, sb.Get(1).size());
+
+  // Now the oldest item is swapped out.
+  item = { 3, 3, 3 };
+  sb.Swap(item);
+  EXPECT_EQ(std::vector<int>({ 1 }), item);
+  EXPECT_EQ(3ul, sb.Head().size());
+  EXPECT_EQ(2ul, sb.Get(1).size());
+}
@@ -0,0 +1,154 @@
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/spsc_queue.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(SpscQueueTest, PushPop)
+{
+  SpscQueue<int> q(3, true, "test_queue");
+  EXPECT_TRUE(q.Empty());
+  EXPECT_EQ(3ul, q.Capacity());
+
+  EXPECT_TRUE(q.Push(1));
+  EXPECT_TRUE(q.Push(2));
+  EXPECT_EQ(2ul, q.Size());
+
+  EXPECT_EQ(1, q.Pop());
+
+  int item = 0;
+  EXPECT_TRUE(q.PopIfNonEmpty(item));
+  EXPECT_EQ(2, item);
+  EXPECT_FALSE(q.PopIfNonEmpty(item));
+  EXPECT_TRUE(q.Empty());
+}
+
+
+TEST(SpscQueueTest, DropOldest)
+{
+  SpscQueue<int> q(3, true);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_TRUE(q.Push(i));
+  }
+
+  // The two oldest items should be dropped and counted.
+  EXPECT_EQ(3ul, q.Size());
+  EXPECT_EQ(2ul, q.Dropped());
+  EXPECT_EQ(2, q.Pop());
+  EXPECT_EQ(3, q.Pop());
+  EXPECT_EQ(4, q.Pop());
+}
+
+
+TEST(SpscQueueTest, DropNewest)
+{
+  SpscQueue<int> q(2, false);
+  EXPECT_TRUE(q.Push(0));
+  EXPECT_TRUE(q.Push(1));
+  EXPECT_FALSE(q.Push(2));
+  EXPECT_EQ(0ul, q.Dropped());
+  EXPECT_EQ(0, q.Pop());
+  EXPECT_EQ(1, q.Pop());
+}
+
+
+TEST(SpscQueueTest, SetCapacity)
+{
+  SpscQueue<int> q(3, true);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(q.Push(i));
+  }
+
+  // Shrinking drops the oldest items on the next push.
+  EXPECT_EQ(1ul, q.SetCapacity(1));
+  EXPECT_TRUE(q.Push(3));
+  EXPECT_EQ(1ul, q.Size());
+  EXPECT_EQ(3ul, q.Dropped());
+  EXPECT_EQ(3, q.Pop());
+
+  // Can only grow up to the number of slots (3 rounds up to 4), and never below 1.
+  EXPECT_EQ(4ul, q.SetCapacity(100));
+  EXPECT_EQ(4ul, q.Capacity());
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_TRUE(q.Push(i));
+  }
+  EXPECT_EQ(4ul, q.Size());
+  EXPECT_EQ(1, q.Pop());
+  EXPECT_EQ(1ul, q.SetCapacity(0));
+}
+
+
+TEST(SpscQueueTest, MoveOnly)
+{
+  SpscQueue<std::unique_ptr<int>> q(2, true);
+  q.Push(std::unique_ptr<int>(new int(7)));
+  q.Push(std::unique_ptr<int>(new int(8)));
+  q.Push(std::unique_ptr<int>(new int(9)));
+
+  EXPECT_EQ(8, *q.Pop());
+  EXPECT_EQ(9, *q.Pop());
+}
+
+
+TEST(SpscQueueTest, Threaded)
+{
+  const int N = 200000;
+  SpscQueue<int> q(64, false);
+
+  std::thread producer([&]() {
+    for (int i = 0; i < N; ++i) {
+      while (!q.Push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  // With no drops, the consumer should see every item in order.
+  int expected = 0;
+  int item;
+  while (expected < N) {
+    if (q.PopIfNonEmpty(item)) {
+      ASSERT_EQ(expected, item);
+      ++expected;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  producer.join();
+  EXPECT_TRUE(q.Empty());
+}
+
+
+TEST(SpscQueueTest, ThreadedDropOldest)
+{
+  const int N = 200000;
+  SpscQueue<int> q(8, true);
+
+  std::thread producer([&]() {
+    for (int i = 0; i < N; ++i) {
+      q.Push(i);
+    }
+  });
+
+  // Items can be dropped, but the ones that arrive must still be in order.
+  int prev = -1;
+  int item;
+  size_t popped = 0;
+  while (prev < (N - 1)) {
+    if (q.PopIfNonEmpty(item)) {
+      ASSERT_GT(item, prev);
+      prev = item;
+      ++popped;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  producer.join();
+  EXPECT_EQ(static_cast<size_t>(N), popped + q.Dropped());
+}
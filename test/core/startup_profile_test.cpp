@@ -0,0 +1,54 @@
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/startup_profile.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(StartupProfileTest, Phases)
+{
+  StartupProfile profile("Test");
+
+  profile.Time("sleep", []() { std::this_thread::sleep_for(std::chrono::milliseconds(20)); });
+  profile.Add("given", 5.0);
+  profile.Mark("done");
+
+  const std::vector<std::pair<std::string, double>> phases = profile.Phases();
+  ASSERT_EQ(3ul, phases.size());
+  EXPECT_EQ("sleep", phases.at(0).first);
+  EXPECT_GE(phases.at(0).second, 20.0);
+  EXPECT_EQ(5.0, phases.at(1).second);
+
+  // Marks are measured from construction, so they include the earlier phases.
+  EXPECT_GE(phases.at(2).second, phases.at(0).second);
+  EXPECT_GE(profile.ElapsedMs(), phases.at(2).second);
+
+  EXPECT_EQ(0ul, profile.Summary().find("Test startup: sleep="));
+  EXPECT_NE(std::string::npos, profile.Summary().find(" given=5.0ms done="));
+}
+
+
+TEST(StartupProfileTest, Parallel)
+{
+  StartupProfile profile("Test");
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&profile, i]() {
+      profile.Time("phase" + std::to_string(i), []() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      });
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+
+  EXPECT_EQ(4ul, profile.Phases().size());
+}
@@ -0,0 +1,68 @@
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/stats_tracker.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(StatsTrackerTest, RegisterAndSummarize)
+{
+  StatsTracker stats("StatsTrackerTest", 4);
+
+  const StatId a = stats.Register("A", "ms");
+  const StatId b = stats.Register("B");
+  EXPECT_NE(a, b);
+  EXPECT_EQ(a, stats.Register("A"));
+
+  EXPECT_EQ(0, stats.Summarize(a).N);
+
+  // Only the last k = 4 values are kept.
+  for (int i = 1; i <= 6; ++i) {
+    stats.Add(a, static_cast<float>(i));
+  }
+  const StatsSummary s = stats.Summarize(a);
+  EXPECT_EQ(4, s.N);
+  EXPECT_FLOAT_EQ(3.0f, s.min);
+  EXPECT_FLOAT_EQ(6.0f, s.max);
+  EXPECT_FLOAT_EQ(4.5f, s.mean);
+  EXPECT_FLOAT_EQ(6.0f, s.p99);
+
+  // The string version goes to the same scalar.
+  stats.Add("B", 2.0f);
+  EXPECT_EQ(1, stats.Summarize(b).N);
+  EXPECT_FLOAT_EQ(2.0f, stats.Summarize(b).mean);
+
+  stats.PrintAll();
+  stats.Print("A", "ms");
+  stats.Print("DoesNotExist");
+}
+
+
+TEST(StatsTrackerTest, AddFromManyThreads)
+{
+  StatsTracker stats("StatsTrackerTest", 1000);
+  const StatId id = stats.Register("Shared");
+  stats.StartReporter(0.001f);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&stats, id]() {
+      for (int i = 0; i < 250; ++i) {
+        stats.Add(id, 1.0f);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  // Every value got its own slot.
+  const StatsSummary s = stats.Summarize(id);
+  EXPECT_EQ(1000, s.N);
+  EXPECT_FLOAT_EQ(1.0f, s.min);
+  EXPECT_FLOAT_EQ(1.0f, s.max);
+}
@@ -39,3 +39,52 @@ TEST(StereoCamera, TestProject)
   const Vector2d pr = stereo_cam.RightCamera().Project(Vector3d(-3, 4, 10));
   ASSERT_EQ(Pr, stereo_cam.RightCamera().Backproject(pr, 10));
 }
+
+TEST(StereoCamera, TestBatch)
+{
+  const PinholeCamera cam(415.876509, 410.0, 376.0, 240.0, 480, 752);
+  const StereoCamera stereo_cam(cam, cam, 0.2);
+
+  std::vector<Vector3d> P;
+  for (int i = 0; i < 13; ++i) {
+    P.emplace_back(-1.0 + 0.2 * i, 0.5 - 0.1 * i, 2.0 + i);
+  }
+
+  // Vector versions match the single-point ones.
+  std::vector<Vector2d> p;
+  cam.Project(P, p);
+  ASSERT_EQ(P.size(), p.size());
+
+  std::vector<double> depth, disp;
+  for (size_t i = 0; i < P.size(); ++i) {
+    EXPECT_TRUE(p.at(i).isApprox(cam.Project(P.at(i))));
+    depth.emplace_back(P.at(i).z());
+    disp.emplace_back(stereo_cam.DepthToDisp(P.at(i).z()));
+  }
+
+  std::vector<Vector3d> P_back, P_tri;
+  cam.Backproject(p, depth, P_back);
+  stereo_cam.Triangulate(p, disp, P_tri);
+  ASSERT_EQ(P.size(), P_back.size());
+  ASSERT_EQ(P.size(), P_tri.size());
+  for (size_t i = 0; i < P.size(); ++i) {
+    EXPECT_TRUE(P_back.at(i).isApprox(P.at(i)));
+    EXPECT_TRUE(P_tri.at(i).isApprox(P.at(i)));
+  }
+
+  // Structure-of-arrays versions.
+  const size_t N = P.size();
+  std::vector<double> x(N), y(N), z(N), u(N), v(N);
+  for (size_t i = 0; i < N; ++i) {
+    x[i] = P[i].x(); y[i] = P[i].y(); z[i] = P[i].z();
+  }
+  cam.Project(x.data(), y.data(), z.data(), N, u.data(), v.data());
+
+  std::vector<double> xt(N), yt(N), zt(N);
+  stereo_cam.Triangulate(u.data(), v.data(), disp.data(), N, xt.data(), yt.data(), zt.data());
+  for (size_t i = 0; i < N; ++i) {
+    EXPECT_NEAR(p[i].x(), u[i], 1e-9);
+    EXPECT_NEAR(p[i].y(), v[i], 1e-9);
+    EXPECT_TRUE(Vector3d(xt[i], yt[i], zt[i]).isApprox(P[i]));
+  }
+}
@@ -0,0 +1,97 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/task_scheduler.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static TaskScheduler::Params MakeParams(int num_threads)
+{
+  TaskScheduler::Params params;
+  params.num_threads = num_threads;
+  return params;
+}
+
+
+TEST(TaskSchedulerTest, ParallelFor)
+{
+  for (int num_threads = 1; num_threads <= 3; ++num_threads) {
+    TaskScheduler scheduler(MakeParams(num_threads));
+    EXPECT_EQ(num_threads, scheduler.NumThreads());
+
+    // Every index should be visited exactly once.
+    std::vector<int> visits(100, 0);
+    scheduler.ParallelFor(TaskPriority::FRONTEND, visits.size(), [&](int i) { ++visits.at(i); });
+    for (const int v : visits) {
+      EXPECT_EQ(1, v);
+    }
+
+    // With no helpers, everything runs on the caller.
+    const std::thread::id caller = std::this_thread::get_id();
+    scheduler.ParallelFor(TaskPriority::FRONTEND, 10, [&](int) {
+      EXPECT_EQ(caller, std::this_thread::get_id());
+    }, 0);
+
+    // Nothing to do.
+    scheduler.ParallelFor(TaskPriority::FRONTEND, 0, [&](int) { FAIL(); });
+  }
+}
+
+
+TEST(TaskSchedulerTest, NestedParallelFor)
+{
+  TaskScheduler scheduler(MakeParams(2));
+  std::atomic<int> sum{0};
+
+  // Every worker is busy with an outer task, which shouldn't deadlock the inner batches.
+  scheduler.ParallelFor(TaskPriority::SMOOTHER, 4, [&](int) {
+    scheduler.ParallelFor(TaskPriority::FRONTEND, 5, [&](int j) { sum.fetch_add(j); });
+  });
+
+  EXPECT_EQ(4 * 10, sum.load());
+}
+
+
+TEST(TaskSchedulerTest, Priority)
+{
+  TaskScheduler scheduler(MakeParams(1));
+
+  std::mutex mutex;
+  std::vector<int> order;
+  std::atomic<int> num_done{0};
+
+  // Keep the only worker busy while the other tasks are queued up.
+  std::atomic_bool release{false};
+  scheduler.Submit(TaskPriority::FILTER, [&]() {
+    while (!release) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ++num_done;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  const std::vector<TaskPriority> lanes = {
+      TaskPriority::VIZ, TaskPriority::SMOOTHER, TaskPriority::FILTER, TaskPriority::FRONTEND };
+  for (const TaskPriority lane : lanes) {
+    scheduler.Submit(lane, [&, lane]() {
+      mutex.lock();
+      order.emplace_back(static_cast<int>(lane));
+      mutex.unlock();
+      ++num_done;
+    });
+  }
+
+  release.store(true);
+  while (num_done.load() < 5) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  const std::vector<int> expected = { 0, 1, 2, 4 };
+  EXPECT_EQ(expected, order);
+}
@@ -0,0 +1,48 @@
+#include <chrono>
+#include <thread>
+
+#include <sched.h>
+
+#include <gtest/gtest.h>
+
+#include "core/thread_schedule.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(ThreadScheduleTest, WakeLatency)
+{
+  WakeLatency wake;
+  double latency_ms = -1;
+
+  // Nothing signalled yet.
+  EXPECT_FALSE(wake.Take(latency_ms));
+
+  // Only the first signal counts.
+  wake.Signal();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  wake.Signal();
+  EXPECT_TRUE(wake.Take(latency_ms));
+  EXPECT_GE(latency_ms, 19.0);
+
+  EXPECT_FALSE(wake.Take(latency_ms));
+}
+
+
+TEST(ThreadScheduleTest, ApplyThreadSchedule)
+{
+  // The defaults don't change anything, so they always work.
+  std::thread t([]() { EXPECT_TRUE(ApplyThreadSchedule(ThreadSchedule(), "default")); });
+  t.join();
+
+  // Pinning to cpu 0 and lowering priority don't need any special permissions.
+  ThreadSchedule schedule;
+  schedule.cpu = 0;
+  schedule.nice = 5;
+  std::thread t2([&schedule]() {
+    EXPECT_TRUE(ApplyThreadSchedule(schedule, "pinned"));
+    EXPECT_EQ(0, sched_getcpu());
+  });
+  t2.join();
+}
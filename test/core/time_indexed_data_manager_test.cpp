@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+
+#include "core/depth_measurement.hpp"
+#include "core/time_indexed_data_manager.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(TimeIndexedDataManagerTest, TestAll)
+{
+  // Buffer holds 3 items, drop oldest.
+  TimeIndexedDataManager<DepthMeasurement> m(3, true);
+
+  EXPECT_EQ(0ul, m.Size());
+  EXPECT_TRUE(m.Empty());
+  EXPECT_EQ(kMaxSeconds, m.Newest());
+  EXPECT_EQ(kMinSeconds, m.Oldest());
+
+  m.Push(DepthMeasurement(123, 0.3));
+  EXPECT_EQ(1ul, m.Size());
+  EXPECT_EQ(ConvertToSeconds(123), m.Newest());
+  EXPECT_EQ(ConvertToSeconds(123), m.Oldest());
+
+  // Shouldn't drop the data at 123.
+  m.DiscardBefore(ConvertToSeconds(123));
+  EXPECT_EQ(1ul, m.Size());
+
+  // This one should.
+  m.DiscardBefore(ConvertToSeconds(124));
+  EXPECT_TRUE(m.Empty());
+
+  // Should drop the first measurement.
+  for (timestamp_t t = 123; t <= 126; ++t) {
+    m.Push(DepthMeasurement(t, 0.3));
+  }
+  EXPECT_EQ(3ul, m.Size());
+  EXPECT_EQ(1ul, m.Dropped());
+  EXPECT_EQ(ConvertToSeconds(126), m.Newest());
+  EXPECT_EQ(ConvertToSeconds(124), m.Oldest());
+
+  // Make sure it saves at least one measurement when we require it.
+  m.DiscardBefore(ConvertToSeconds(130), true);
+  EXPECT_EQ(1ul, m.Size());
+  EXPECT_EQ(126ul, m.Pop().timestamp);
+
+  // Check that PopNewest works.
+  for (timestamp_t t = 127; t <= 129; ++t) {
+    m.Push(DepthMeasurement(t, 0.3));
+  }
+  EXPECT_EQ(129ul, m.PopNewest().timestamp);
+  EXPECT_TRUE(m.Empty());
+}
+
+
+TEST(TimeIndexedDataManagerTest, PopUntil)
+{
+  TimeIndexedDataManager<DepthMeasurement> m(4, true);
+  m.Push(DepthMeasurement(14, 0.3));
+  m.Push(DepthMeasurement(15, 0.3));
+  m.Push(DepthMeasurement(15, 0.3));
+  m.Push(DepthMeasurement(19, 0.3));
+
+  std::vector<DepthMeasurement> out;
+  m.PopUntil(ConvertToSeconds(15), out);
+  EXPECT_EQ(1ul, m.Size());
+  ASSERT_EQ(3ul, out.size());
+  EXPECT_EQ(14ul, out.at(0).timestamp);
+  EXPECT_EQ(15ul, out.at(1).timestamp);
+  EXPECT_EQ(15ul, out.at(2).timestamp);
+}
+
+
+TEST(TimeIndexedDataManagerTest, PopNearest)
+{
+  TimeIndexedDataManager<DepthMeasurement> m(10, true);
+  m.Push(DepthMeasurement(10, 1.0));
+  m.Push(DepthMeasurement(20, 2.0));
+  m.Push(DepthMeasurement(30, 3.0));
+
+  // Nothing within the allowed misalignment.
+  EXPECT_EQ(nullptr, m.PopNearest(ConvertToSeconds(25), ConvertToSeconds(2)));
+  EXPECT_EQ(1ul, m.Size());
+
+  m.Push(DepthMeasurement(40, 4.0));
+  m.Push(DepthMeasurement(50, 5.0));
+
+  // The nearest item can come BEFORE the query time.
+  const DepthMeasurement::Ptr nearest = m.PopNearest(ConvertToSeconds(42), ConvertToSeconds(5));
+  ASSERT_NE(nullptr, nearest);
+  EXPECT_EQ(40ul, nearest->timestamp);
+  EXPECT_EQ(1ul, m.Size());
+  EXPECT_EQ(ConvertToSeconds(50), m.Oldest());
+}
+
+
+TEST(TimeIndexedDataManagerTest, ViewRange)
+{
+  TimeIndexedDataManager<DepthMeasurement> m(4, true);
+
+  // Push enough to force the buffer to compact a few times.
+  for (timestamp_t t = 0; t < 20; ++t) {
+    m.Push(DepthMeasurement(t, static_cast<double>(t)));
+  }
+  EXPECT_EQ(4ul, m.Size());
+
+  double sum = 0;
+  const size_t N = m.ViewRange(ConvertToSeconds(17), ConvertToSeconds(18),
+                               [&sum](const DepthMeasurement& d) { sum += d.depth; });
+  EXPECT_EQ(2ul, N);
+  EXPECT_EQ(35.0, sum);
+
+  // Viewing doesn't remove anything.
+  EXPECT_EQ(4ul, m.Size());
+  EXPECT_EQ(16ul, m.Pop().timestamp);
+}
+
+
+TEST(TimeIndexedDataManagerTest, PushBatch)
+{
+  TimeIndexedDataManager<DepthMeasurement> m(3, true);
+  Notifier notifier;
+  m.AttachNotifier(&notifier);
+
+  const std::vector<DepthMeasurement> batch = {
+    DepthMeasurement(10, 0.1), DepthMeasurement(11, 0.2), DepthMeasurement(12, 0.3), DepthMeasurement(13, 0.4)
+  };
+  m.PushBatch(batch.data(), batch.size());
+
+  // Drops the oldest, just like Push() would.
+  EXPECT_EQ(3ul, m.Size());
+  EXPECT_EQ(1ul, m.Dropped());
+  EXPECT_EQ(ConvertToSeconds(11), m.Oldest());
+  EXPECT_EQ(ConvertToSeconds(13), m.Newest());
+
+  m.PushBatch(batch.data(), 0);
+  EXPECT_EQ(3ul, m.Size());
+}
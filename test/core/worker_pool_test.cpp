@@ -0,0 +1,41 @@
+#include <atomic>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/worker_pool.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(WorkerPoolTest, ParallelFor)
+{
+  for (int num_threads = 0; num_threads <= 3; ++num_threads) {
+    WorkerPool pool(num_threads);
+    EXPECT_EQ(num_threads, pool.NumThreads());
+
+    // Every index should be visited exactly once.
+    std::vector<int> visits(100, 0);
+    pool.ParallelFor(visits.size(), [&](int i) { ++visits.at(i); });
+    for (const int v : visits) {
+      EXPECT_EQ(1, v);
+    }
+
+    // Nothing to do.
+    pool.ParallelFor(0, [&](int) { FAIL(); });
+  }
+}
+
+
+TEST(WorkerPoolTest, RepeatedBatches)
+{
+  WorkerPool pool(2);
+  std::atomic<int> sum{0};
+
+  for (int batch = 0; batch < 200; ++batch) {
+    pool.ParallelFor(3, [&](int i) { sum.fetch_add(i + 1); });
+  }
+
+  EXPECT_EQ(200 * 6, sum.load());
+}
@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/csv_parser.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static bool ParseDouble(const std::string& s, double& out)
+{
+  const char* p = s.data();
+  return ParseCsvDouble(p, s.data() + s.size(), out) && p == s.data() + s.size();
+}
+
+
+TEST(CsvParserTest, TestParseDoubleMatchesStod)
+{
+  const std::vector<std::string> cases = {
+    "0", "-0", "0.0", "1", "-1", "+2.5", "3.14159265358979", "-0.000123", "1e5", "1E-5", "6.02214076e23",
+    "0.1", "0.2", "0.3", "9.81", "123456789012345", "1234567890123456789012", "0.30000000000000004",
+    "2.2250738585072014e-308", "1.7976931348623157e308", ".5", "5.", "-9.8066499999999994"
+  };
+
+  for (const std::string& s : cases) {
+    double value = 0;
+    ASSERT_TRUE(ParseDouble(s, value)) << s;
+    const double expected = std::stod(s);
+    EXPECT_EQ(0, std::memcmp(&expected, &value, sizeof(double))) << s << " " << expected << " " << value;
+  }
+
+  // Whatever printf writes should come back exactly.
+  std::mt19937 rng(123);
+  std::uniform_real_distribution<double> dist(-100.0, 100.0);
+  char buf[64];
+  for (int i = 0; i < 10000; ++i) {
+    const double x = dist(rng);
+    for (const char* fmt : { "%.6f", "%.9g", "%.17g" }) {
+      std::snprintf(buf, sizeof(buf), fmt, x);
+      double value = 0;
+      ASSERT_TRUE(ParseDouble(buf, value)) << buf;
+      EXPECT_EQ(std::stod(buf), value) << buf;
+    }
+  }
+
+  double value = 0;
+  EXPECT_FALSE(ParseDouble("", value));
+  EXPECT_FALSE(ParseDouble("-", value));
+  EXPECT_FALSE(ParseDouble("abc", value));
+}
+
+
+TEST(CsvParserTest, TestParseLine)
+{
+  const std::string line = "1403636579758555392, -0.099, 0.1429,0.0258,8.16,-1.3,-0.53";
+  timestamp_t timestamp = 0;
+  double v[6];
+  ASSERT_TRUE(ParseCsvLine(line.data(), line.data() + line.size(), timestamp, v, 6));
+  EXPECT_EQ(1403636579758555392ul, timestamp);
+  EXPECT_EQ(-0.099, v[0]);
+  EXPECT_EQ(-0.53, v[5]);
+
+  // Extra fields are ignored, missing or bad ones aren't.
+  ASSERT_TRUE(ParseCsvLine(line.data(), line.data() + line.size(), timestamp, v, 2));
+  EXPECT_FALSE(ParseCsvLine(line.data(), line.data() + line.size(), timestamp, v, 7));
+  const std::string bad = "100,1.0x,2.0";
+  EXPECT_FALSE(ParseCsvLine(bad.data(), bad.data() + bad.size(), timestamp, v, 2));
+}
+
+
+TEST(CsvParserTest, TestParseFile)
+{
+  const std::string path = "/tmp/csv_parser_test.csv";
+
+  // Big enough to be split into chunks, with Windows line endings and a blank line at the end.
+  const int N = 200000;
+  {
+    std::ofstream out(path);
+    out << "#timestamp [ns],value\r\n";
+    for (int i = 0; i < N; ++i) {
+      out << (1000 + i) << "," << (0.5 * i) << "\r\n";
+    }
+    out << "\r\n";
+  }
+
+  typedef std::pair<timestamp_t, double> Item;
+  const std::vector<Item> items = ParseCsvFile<Item>(path, 1,
+      [](const char* begin, const char* end, std::vector<Item>& out)
+  {
+    timestamp_t timestamp = 0;
+    double value = 0;
+    if (!ParseCsvLine(begin, end, timestamp, &value, 1)) {
+      return false;
+    }
+    out.emplace_back(timestamp, value);
+    return true;
+  });
+
+  ASSERT_EQ((size_t)N, items.size());
+  for (int i = 0; i < N; ++i) {
+    ASSERT_EQ((timestamp_t)(1000 + i), items.at(i).first);
+    ASSERT_EQ(0.5 * i, items.at(i).second);
+  }
+
+  // An empty file (or just a header) has no items.
+  { std::ofstream out(path); }
+  EXPECT_TRUE((ParseCsvFile<Item>(path, 1, [](const char*, const char*, std::vector<Item>&) { return false; }).empty()));
+}
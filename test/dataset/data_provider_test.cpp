@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/transform_util.hpp"
+#include "dataset/data_provider.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+// IMU every 10ns and depth every 25ns from 100 to 190, and groundtruth at 100 and 200.
+class TestDataProvider : public DataProvider {
+ public:
+  TestDataProvider()
+  {
+    for (int i = 0; i < 10; ++i) {
+      imu_data.emplace_back(ImuMeasurement(100 + 10*i, Vector3d::Zero(), Vector3d(0, 9.81, 0)));
+    }
+    for (int i = 0; i < 4; ++i) {
+      depth_data.emplace_back(DepthMeasurement(100 + 25*i, 1.0 + i));
+    }
+
+    Matrix4d world_T_body0 = Matrix4d::Identity();
+    Matrix4d world_T_body1 = Matrix4d::Identity();
+    world_T_body1.block<3, 3>(0, 0) = AngleAxisd(1.0, Vector3d::UnitZ()).toRotationMatrix();
+    world_T_body1.block<3, 1>(0, 3) = Vector3d(10, 0, 0);
+    pose_data.emplace_back(100, world_T_body0);
+    pose_data.emplace_back(200, world_T_body1);
+  }
+};
+
+
+TEST(DataProviderTest, TestPlaybackTimeRange)
+{
+  TestDataProvider dataset;
+
+  std::vector<timestamp_t> imu_times, depth_times;
+  dataset.RegisterImuCallback([&imu_times](const ImuMeasurement& imu) { imu_times.emplace_back(imu.timestamp); });
+  dataset.RegisterDepthCallback([&depth_times](const DepthMeasurement& d) { depth_times.emplace_back(d.timestamp); });
+
+  // Both ends are inclusive.
+  dataset.Playback(125, 150, -1.0f);
+  EXPECT_EQ(std::vector<timestamp_t>({ 130, 140, 150 }), imu_times);
+  EXPECT_EQ(std::vector<timestamp_t>({ 125, 150 }), depth_times);
+
+  // Going back in time works too.
+  imu_times.clear();
+  depth_times.clear();
+  dataset.Playback(100, 115, -1.0f);
+  EXPECT_EQ(std::vector<timestamp_t>({ 100, 110 }), imu_times);
+  EXPECT_EQ(std::vector<timestamp_t>({ 100 }), depth_times);
+
+  // And the rest of the data is still there.
+  imu_times.clear();
+  while (dataset.Step()) {}
+  EXPECT_EQ(8ul, imu_times.size());
+}
+
+
+TEST(DataProviderTest, TestGroundtruthPose)
+{
+  const TestDataProvider dataset;
+  Matrix4d world_T_body;
+
+  ASSERT_TRUE(dataset.GroundtruthPose(100, world_T_body));
+  EXPECT_TRUE(world_T_body.isApprox(Matrix4d::Identity()));
+
+  ASSERT_TRUE(dataset.GroundtruthPose(150, world_T_body));
+  EXPECT_TRUE(world_T_body.block<3, 1>(0, 3).isApprox(Vector3d(5, 0, 0)));
+  EXPECT_NEAR(0.5, AngleAxisd(Matrix3d(world_T_body.block<3, 3>(0, 0))).angle(), 1e-9);
+
+  ASSERT_TRUE(dataset.GroundtruthPose(200, world_T_body));
+  EXPECT_TRUE(world_T_body.block<3, 1>(0, 3).isApprox(Vector3d(10, 0, 0)));
+
+  // Outside of the groundtruth, or too far from it.
+  EXPECT_FALSE(dataset.GroundtruthPose(99, world_T_body));
+  EXPECT_FALSE(dataset.GroundtruthPose(201, world_T_body));
+  EXPECT_FALSE(dataset.GroundtruthPose(150, world_T_body, 1e-8));
+}
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <opencv2/highgui.hpp>
+
+#include "dataset/euroc_data_writer.hpp"
+#include "dataset/euroc_dataset.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+TEST(EurocDataWriterTest, TestRoundTrip)
+{
+  for (const auto format : { EurocDataWriter::ImageFormat::PNG, EurocDataWriter::ImageFormat::PPM }) {
+    const std::string folder = "/tmp/euroc_data_writer_test";
+    const size_t N = 20;
+
+    {
+      // Enough room in the queue for every pair, so that none are dropped.
+      EurocDataWriter writer(folder, format, 1, 3, N);
+
+      for (int i = 0; i < 10; ++i) {
+        writer.WriteImu(ImuMeasurement(100 + 10*i, Vector3d(0.1, 0.2, 0.3), Vector3d(0, 0, 9.81)));
+      }
+      writer.WriteDepth(DepthMeasurement(105, 1.5));
+
+      for (size_t i = 0; i < N; ++i) {
+        const Image3b left(24, 32, cv::Vec3b(i, 2*i, 3*i));
+        const Image3b right(24, 32, cv::Vec3b(100 + i, 0, 0));
+        EXPECT_TRUE(writer.WriteStereo(StereoImage3b(110 + 20*i, i, left, right)));
+      }
+
+      writer.Flush();
+      const EurocDataWriter::Stats stats = writer.GetStats();
+      EXPECT_EQ(N, stats.written);
+      EXPECT_EQ(0ul, stats.dropped);
+      EXPECT_EQ(0ul, stats.queued);
+      EXPECT_LE(stats.max_queued, N);
+    }
+
+    EurocDataset dataset(folder);
+    ASSERT_EQ(10ul, dataset.ImuMeasurements().size());
+    EXPECT_EQ(100ul, dataset.ImuMeasurements().front().timestamp);
+    ASSERT_EQ(1ul, dataset.DepthMeasurements().size());
+    EXPECT_EQ(1.5, dataset.DepthMeasurements().front().depth);
+
+    // Rows should be in the order that the pairs were written, even with several encoders.
+    ASSERT_EQ(N, dataset.StereoItems().size());
+    for (size_t i = 0; i < N; ++i) {
+      const StereoDatasetItem& item = dataset.StereoItems().at(i);
+      EXPECT_EQ(110ul + 20*i, item.timestamp);
+      const Image3b left = cv::imread(item.path_left, cv::IMREAD_COLOR);
+      ASSERT_FALSE(left.empty());
+      EXPECT_EQ(cv::Vec3b(i, 2*i, 3*i), left(5, 5));
+    }
+  }
+}
+
+
+TEST(EurocDataWriterTest, TestDropsWhenFull)
+{
+  EurocDataWriter writer("/tmp/euroc_data_writer_test", EurocDataWriter::ImageFormat::PNG, 9, 1, 2);
+
+  const Image3b big(720, 1280, cv::Vec3b(1, 2, 3));
+  size_t num_queued = 0;
+  for (int i = 0; i < 50; ++i) {
+    num_queued += writer.WriteStereo(StereoImage3b(100 + i, i, big, big)) ? 1 : 0;
+  }
+  writer.Flush();
+
+  const EurocDataWriter::Stats stats = writer.GetStats();
+  EXPECT_EQ(num_queued, stats.written);
+  EXPECT_EQ(50ul, stats.written + stats.dropped);
+  EXPECT_LE(stats.max_queued, 2ul);
+}
@@ -0,0 +1,87 @@
+#include <fstream>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/file_utils.hpp"
+#include "dataset/image_manifest.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static void Touch(const std::string& path)
+{
+  std::ofstream out(path);
+  out << "x";
+}
+
+
+TEST(ImageManifestTest, TestCachedListing)
+{
+  const std::string dir = "/tmp/image_manifest_test";
+  rmdir(dir);
+  std::remove(ImageManifestPath(dir).c_str());
+  mkdir(dir);
+
+  Touch(Join(dir, "002.png"));
+  Touch(Join(dir, "000.png"));
+  Touch(Join(dir, "001.png"));
+
+  // No manifest yet.
+  std::vector<std::string> cached;
+  EXPECT_FALSE(ReadImageManifest(dir, cached));
+  EXPECT_TRUE(cached.empty());
+
+  // First load lists the directory and writes the manifest.
+  EXPECT_EQ(3, CachedFilenamesInDirectory(dir, cached));
+  EXPECT_TRUE(Exists(ImageManifestPath(dir)));
+
+  std::vector<std::string> listed;
+  FilenamesInDirectory(dir, listed, true);
+  EXPECT_EQ(listed, cached);
+
+  // Second load uses it, and appends like FilenamesInDirectory.
+  std::vector<std::string> from_manifest = { "other.png" };
+  EXPECT_TRUE(ReadImageManifest(dir, from_manifest));
+  ASSERT_EQ(4ul, from_manifest.size());
+  EXPECT_EQ("other.png", from_manifest.at(0));
+  EXPECT_EQ(listed, std::vector<std::string>(from_manifest.begin() + 1, from_manifest.end()));
+
+  // Adding an image makes the manifest out of date.
+  Touch(Join(dir, "003.png"));
+  std::vector<std::string> stale;
+  EXPECT_FALSE(ReadImageManifest(dir, stale));
+
+  std::vector<std::string> updated;
+  EXPECT_EQ(4, CachedFilenamesInDirectory(dir, updated));
+  EXPECT_EQ(Join(dir, "003.png"), updated.back());
+  EXPECT_TRUE(ReadImageManifest(dir, stale));
+  EXPECT_EQ(updated, stale);
+
+  rmdir(dir);
+  std::remove(ImageManifestPath(dir).c_str());
+}
+
+
+TEST(ImageManifestTest, TestCorruptManifest)
+{
+  const std::string dir = "/tmp/image_manifest_corrupt_test";
+  rmdir(dir);
+  mkdir(dir);
+  Touch(Join(dir, "000.png"));
+
+  {
+    std::ofstream out(ImageManifestPath(dir), std::ios_base::binary);
+    out << "not a manifest";
+  }
+
+  std::vector<std::string> out;
+  EXPECT_FALSE(ReadImageManifest(dir, out));
+  EXPECT_EQ(1, CachedFilenamesInDirectory(dir, out));
+  EXPECT_EQ(Join(dir, "000.png"), out.at(0));
+
+  rmdir(dir);
+  std::remove(ImageManifestPath(dir).c_str());
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <opencv2/highgui.hpp>
+
+#include "dataset/image_prefetcher.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+// Writes a few small stereo pairs to /tmp, where every pixel of image i is i (left) or 100+i (right).
+static std::vector<StereoDatasetItem> WriteTestImages(int n)
+{
+  std::vector<StereoDatasetItem> items;
+  for (int i = 0; i < n; ++i) {
+    const std::string path_left = "/tmp/image_prefetcher_test_l" + std::to_string(i) + ".png";
+    const std::string path_right = "/tmp/image_prefetcher_test_r" + std::to_string(i) + ".png";
+    cv::imwrite(path_left, Image1b(48, 64, static_cast<uint8_t>(i)));
+    cv::imwrite(path_right, Image1b(48, 64, static_cast<uint8_t>(100 + i)));
+    items.emplace_back(static_cast<timestamp_t>(i), path_left, path_right);
+  }
+  return items;
+}
+
+
+static StereoReadFunction ReadFiles(const std::vector<StereoDatasetItem>& items)
+{
+  return [&items](size_t i, cv::Mat& left, cv::Mat& right) { ReadStereoImageFiles(items.at(i), left, right); };
+}
+
+
+TEST(ImagePrefetcherTest, TestInOrder)
+{
+  const std::vector<StereoDatasetItem> items = WriteTestImages(10);
+
+  // Start partway through, and only let workers read 2 images ahead.
+  ImagePrefetcher prefetcher(ReadFiles(items), 3, items.size(), 3, 2, 1000000);
+
+  for (int i = 3; i < 10; ++i) {
+    cv::Mat left, right;
+    prefetcher.Get(i, left, right);
+    ASSERT_EQ(48, left.rows);
+    ASSERT_EQ(64, right.cols);
+    EXPECT_EQ(i, left.at<uint8_t>(10, 10));
+    EXPECT_EQ(100 + i, right.at<uint8_t>(10, 10));
+    EXPECT_LE(prefetcher.BufferedBytes(), 2ul * 2ul * 48ul * 64ul);
+  }
+
+  EXPECT_EQ(0ul, prefetcher.BufferedBytes());
+}
+
+
+TEST(ImagePrefetcherTest, TestMemoryBudget)
+{
+  const std::vector<StereoDatasetItem> items = WriteTestImages(5);
+
+  // With no memory budget, images are only read when they're needed.
+  ImagePrefetcher prefetcher(ReadFiles(items), 0, items.size(), 2, 4, 0);
+
+  for (int i = 0; i < 5; ++i) {
+    cv::Mat left, right;
+    prefetcher.Get(i, left, right);
+    EXPECT_EQ(i, left.at<uint8_t>(0, 0));
+  }
+}
+
+
+TEST(ImagePrefetcherTest, TestMissingImage)
+{
+  std::vector<StereoDatasetItem> items = WriteTestImages(2);
+  items.emplace_back(2, "/tmp/image_prefetcher_test_missing.png", items.at(0).path_right);
+
+  ImagePrefetcher prefetcher(ReadFiles(items), 0, items.size(), 2, 4, 1000000);
+
+  cv::Mat left, right;
+  prefetcher.Get(0, left, right);
+  prefetcher.Get(1, left, right);
+  EXPECT_THROW(prefetcher.Get(2, left, right), std::runtime_error);
+}
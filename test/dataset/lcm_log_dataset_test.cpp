@@ -0,0 +1,152 @@
+#include <cstdio>
+#include <fstream>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "dataset/lcm_log_dataset.hpp"
+#include "lcm_util/decode_image.hpp"
+
+#include "vehicle/depth_measurement_t.hpp"
+#include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/range_measurement_t.hpp"
+#include "vehicle/stereo_image_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+template <typename Msg>
+static void WriteEvent(lcm::LogFile& log, const std::string& channel, int64_t utime, const Msg& msg)
+{
+  static int64_t eventnum = 0;
+  std::vector<uint8_t> buf(msg.getEncodedSize());
+  msg.encode(buf.data(), 0, static_cast<int>(buf.size()));
+
+  lcm::LogEvent event;
+  event.eventnum = eventnum++;
+  event.timestamp = utime;
+  event.channel = channel;
+  event.datalen = static_cast<int32_t>(buf.size());
+  event.data = buf.data();
+  ASSERT_EQ(0, log.writeEvent(&event));
+}
+
+
+// IMU every 10ms, depth every 50ms and stereo every 100ms for 1 sec, plus a channel that isn't
+// read. The stereo messages are logged out of order.
+static void WriteTestLog(const std::string& path)
+{
+  std::remove((path + ".idx").c_str());
+  lcm::LogFile log(path, "w");
+  ASSERT_TRUE(log.good());
+
+  for (int i = 0; i < 100; ++i) {
+    vehicle::imu_measurement_t msg;
+    msg.header.timestamp = 1000000000ll + 10000000ll * i;
+    msg.linear_acc.x = 0;
+    msg.linear_acc.y = 9.81;
+    msg.linear_acc.z = 0;
+    msg.angular_vel.x = 0.01 * i;
+    msg.angular_vel.y = 0;
+    msg.angular_vel.z = 0;
+    WriteEvent(log, "sim/auv/imu", msg.header.timestamp / 1000, msg);
+  }
+
+  for (int i = 0; i < 20; ++i) {
+    vehicle::depth_measurement_t msg;
+    msg.header.timestamp = 1000000000ll + 50000000ll * i;
+    msg.depth = 1.0 + 0.1 * i;
+    WriteEvent(log, "sim/auv/depth", msg.header.timestamp / 1000, msg);
+  }
+
+  vehicle::range_measurement_t range;
+  range.header.timestamp = 1500000000ll;
+  range.range = 12.0;
+  range.point.x = 1;
+  range.point.y = 2;
+  range.point.z = 3;
+  WriteEvent(log, "sim/auv/range", 1500000, range);
+  WriteEvent(log, "other/channel", 1500000, range);
+
+  for (const int i : { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8 }) {
+    vehicle::stereo_image_t msg;
+    msg.header.timestamp = 1000000000ll + 100000000ll * i;
+    EncodeJPG(cv::Mat(24, 32, CV_8UC1, cv::Scalar(10 * i)), 100, msg.img_left);
+    EncodeJPG(cv::Mat(24, 32, CV_8UC1, cv::Scalar(10 * i + 5)), 100, msg.img_right);
+    WriteEvent(log, "sim/auv/stereo", msg.header.timestamp / 1000, msg);
+  }
+}
+
+
+TEST(LcmLogDatasetTest, TestIndex)
+{
+  const std::string path = "/tmp/lcm_log_dataset_test_index.lcm";
+  WriteTestLog(path);
+
+  const LcmLogIndex index = IndexLcmLog(path);
+  EXPECT_EQ(5ul, index.size());
+  EXPECT_EQ(100ul, index.at("sim/auv/imu").size());
+  EXPECT_EQ(20ul, index.at("sim/auv/depth").size());
+  EXPECT_EQ(1ul, index.at("other/channel").size());
+  EXPECT_EQ(10ul, index.at("sim/auv/stereo").size());
+  EXPECT_EQ(1500000, index.at("sim/auv/range").front().utime);
+
+  // The second time comes from the cache, and matches.
+  std::ifstream cache(path + ".idx");
+  ASSERT_TRUE(cache.good());
+  const LcmLogIndex cached = IndexLcmLog(path);
+  ASSERT_EQ(index.size(), cached.size());
+  for (const auto& it : index) {
+    ASSERT_EQ(it.second.size(), cached.at(it.first).size());
+    for (size_t i = 0; i < it.second.size(); ++i) {
+      EXPECT_EQ(it.second.at(i).offset, cached.at(it.first).at(i).offset);
+      EXPECT_EQ(it.second.at(i).size, cached.at(it.first).at(i).size);
+    }
+  }
+
+  // A log that was cut off part way through an event still opens, without the partial event.
+  {
+    std::ofstream os(path, std::ios::out | std::ios::app | std::ios::binary);
+    const char partial[] = { '\xED', '\xA1', '\xDA', '\x01', 0, 0, 0 };
+    os.write(partial, sizeof(partial));
+  }
+  EXPECT_EQ(100ul, IndexLcmLog(path).at("sim/auv/imu").size());
+}
+
+
+TEST(LcmLogDatasetTest, TestPlayback)
+{
+  const std::string path = "/tmp/lcm_log_dataset_test_playback.lcm";
+  WriteTestLog(path);
+
+  for (const int prefetch_threads : { 0, 2 }) {
+    LcmLogDataset dataset(path, LcmLogChannels(), prefetch_threads);
+    EXPECT_EQ(100ul, dataset.ImuMeasurements().size());
+    EXPECT_EQ(20ul, dataset.DepthMeasurements().size());
+    ASSERT_EQ(1ul, dataset.RangeMeasurements().size());
+    EXPECT_EQ(12.0, dataset.RangeMeasurements().front().range);
+    EXPECT_EQ(Vector3d(1, 2, 3), dataset.RangeMeasurements().front().point);
+    EXPECT_EQ(Vector3d(0, 9.81, 0), dataset.ImuMeasurements().front().a);
+    ASSERT_EQ(10ul, dataset.StereoItems().size());
+
+    std::vector<timestamp_t> stereo_times;
+    std::vector<int> left_values;
+    dataset.RegisterStereoCallback([&](const StereoImage1b& stereo) {
+      stereo_times.emplace_back(stereo.timestamp);
+      left_values.emplace_back(static_cast<int>(stereo.left_image.at<uint8_t>(12, 16)));
+    });
+
+    dataset.Playback(-1.0f);
+
+    // Stereo comes back in header timestamp order, not the order it was logged in.
+    ASSERT_EQ(10ul, stereo_times.size());
+    for (int i = 0; i < 10; ++i) {
+      EXPECT_EQ(1000000000ull + 100000000ull * i, stereo_times.at(i));
+      EXPECT_NEAR(10 * i, left_values.at(i), 2);
+    }
+  }
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include "dataset/packed_log_recorder.hpp"
+#include "dataset/packed_log_dataset.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+TEST(PackedLogRecorderTest, TestRoundTrip)
+{
+  for (const bool png_raw_images : { false, true }) {
+    const std::string path = "/tmp/packed_log_recorder_test.bmlog";
+
+    // Each chunk holds 4 raw pairs, so the 10 pairs below are written in 3 chunks. There are enough
+    // chunks that none of them have to wait for the disk.
+    PackedLogRecorderOptions options;
+    options.chunk_bytes = 4 * 2 * (24 * 32 * 3);
+    options.num_chunks = 4;
+    options.max_chunk_sec = 100.0;
+    options.png_raw_images = png_raw_images;
+
+    PackedLogRecorder recorder(path, options);
+
+    for (int i = 0; i < 10; ++i) {
+      recorder.RecordImu(ImuMeasurement(100 + 10*i, Vector3d(0.1, 0.2, i), Vector3d(0, 0, 9.81)));
+
+      const Image3b left(24, 32, cv::Vec3b(i, 2*i, 3*i));
+      const Image3b right(24, 32, cv::Vec3b(100 + i, 0, 0));
+
+      // Every other pair arrives already encoded, and is stored as-is.
+      if (i % 2 == 0) {
+        EXPECT_TRUE(recorder.RecordStereo(110 + 20*i, left, right));
+      } else {
+        std::vector<uint8_t> left_png, right_png;
+        cv::imencode(".png", left, left_png);
+        cv::imencode(".png", right, right_png);
+        EXPECT_TRUE(recorder.RecordStereoEncoded(110 + 20*i,
+                                                 left_png.data(), left_png.size(),
+                                                 right_png.data(), right_png.size(),
+                                                 PackedImageEncoding::PNG));
+      }
+    }
+    recorder.RecordDepth(DepthMeasurement(105, 1.5));
+    recorder.RecordRange(RangeMeasurement(107, 12.0, Vector3d(1, 2, 3)));
+
+    // Doesn't fit in a chunk.
+    const Image3b big(200, 200, cv::Vec3b(0, 0, 0));
+    EXPECT_FALSE(recorder.RecordStereo(500, big, big));
+
+    recorder.Close();
+    EXPECT_EQ(10ul, recorder.NumStereoRecorded());
+    EXPECT_EQ(1ul, recorder.NumStereoDropped());
+
+    PackedLogDataset dataset(path);
+
+    ASSERT_EQ(10ul, dataset.ImuMeasurements().size());
+    EXPECT_EQ(100ul, dataset.ImuMeasurements().front().timestamp);
+    EXPECT_EQ(9.0, dataset.ImuMeasurements().back().w.z());
+    ASSERT_EQ(1ul, dataset.DepthMeasurements().size());
+    EXPECT_EQ(1.5, dataset.DepthMeasurements().front().depth);
+    ASSERT_EQ(1ul, dataset.RangeMeasurements().size());
+    EXPECT_EQ(Vector3d(1, 2, 3), dataset.RangeMeasurements().front().point);
+
+    std::vector<StereoImage3b> images;
+    dataset.RegisterStereoCallback([&images](const StereoImage3b& stereo) { images.emplace_back(stereo); });
+    while (dataset.Step()) {}
+
+    ASSERT_EQ(10ul, images.size());
+    for (int i = 0; i < 10; ++i) {
+      EXPECT_EQ(110ul + 20*i, images.at(i).timestamp);
+      EXPECT_EQ(cv::Vec3b(i, 2*i, 3*i), images.at(i).left_image(5, 5));
+      EXPECT_EQ(cv::Vec3b(100 + i, 0, 0), images.at(i).right_image(5, 5));
+    }
+  }
+}
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/packed_log.hpp"
+#include "dataset/packed_log_dataset.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static void WriteTestLog(const std::string& path, PackedImageEncoding encoding)
+{
+  PackedLogWriter writer(path, encoding);
+
+  // Write out of order, the writer should sort each stream.
+  for (int i = 9; i >= 0; --i) {
+    writer.WriteImu(ImuMeasurement(100 + 10*i, Vector3d(0.1, 0.2, i), Vector3d(0, 0, 9.81)));
+  }
+  writer.WriteDepth(DepthMeasurement(105, 1.5));
+  writer.WriteRange(RangeMeasurement(107, 12.0, Vector3d(1, 2, 3)));
+
+  Matrix4d world_T_body = Matrix4d::Identity();
+  world_T_body.block<3, 1>(0, 3) = Vector3d(4, 5, 6);
+  writer.WriteGroundtruth(100, world_T_body);
+
+  for (int i = 0; i < 3; ++i) {
+    const Image3b left(24, 32, cv::Vec3b(i, 2*i, 3*i));
+    const Image3b right(24, 32, cv::Vec3b(100 + i, 0, 0));
+    writer.WriteStereo(110 + 20*i, left, right);
+  }
+
+  writer.Close();
+}
+
+
+TEST(PackedLogTest, TestRoundTrip)
+{
+  for (const PackedImageEncoding encoding : { PackedImageEncoding::RAW, PackedImageEncoding::PNG }) {
+    const std::string path = "/tmp/packed_log_test.bmlog";
+    WriteTestLog(path, encoding);
+
+    PackedLogDataset dataset(path);
+
+    ASSERT_EQ(10ul, dataset.ImuMeasurements().size());
+    EXPECT_EQ(100ul, dataset.ImuMeasurements().front().timestamp);
+    EXPECT_EQ(9.0, dataset.ImuMeasurements().back().w.z());
+    ASSERT_EQ(1ul, dataset.DepthMeasurements().size());
+    EXPECT_EQ(1.5, dataset.DepthMeasurements().front().depth);
+    ASSERT_EQ(1ul, dataset.RangeMeasurements().size());
+    EXPECT_EQ(Vector3d(1, 2, 3), dataset.RangeMeasurements().front().point);
+    ASSERT_EQ(1ul, dataset.GroundtruthPoses().size());
+    EXPECT_EQ(Vector3d(4, 5, 6), dataset.InitialPose().block<3, 1>(0, 3));
+
+    std::vector<StereoImage3b> images;
+    dataset.RegisterStereoCallback([&images](const StereoImage3b& stereo) { images.emplace_back(stereo); });
+    while (dataset.Step()) {}
+
+    ASSERT_EQ(3ul, images.size());
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_EQ(110ul + 20*i, images.at(i).timestamp);
+      EXPECT_EQ(cv::Vec3b(i, 2*i, 3*i), images.at(i).left_image(5, 5));
+      EXPECT_EQ(cv::Vec3b(100 + i, 0, 0), images.at(i).right_image(5, 5));
+    }
+
+    // Seek to the second image, and play it back with prefetching.
+    images.clear();
+    dataset.SetImagePrefetch(2, 2);
+    dataset.Seek(125);
+    while (dataset.Step()) {}
+
+    ASSERT_EQ(2ul, images.size());
+    EXPECT_EQ(130ul, images.front().timestamp);
+  }
+}
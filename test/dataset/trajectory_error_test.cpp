@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/trajectory_error.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+// A trajectory moving along +x at 1 m/s and yawing at 0.1 rad/s, sampled at 10 Hz.
+static std::vector<GroundtruthItem> MakeTrajectory(int n, timestamp_t offset_ns = 0)
+{
+  std::vector<GroundtruthItem> poses;
+  for (int i = 0; i < n; ++i) {
+    const double t = 0.1 * static_cast<double>(i);
+    Matrix4d world_T_body = Matrix4d::Identity();
+    world_T_body.block<3, 3>(0, 0) = Eigen::AngleAxisd(0.1 * t, Vector3d::UnitZ()).toRotationMatrix();
+    world_T_body.block<3, 1>(0, 3) = Vector3d(t, 0, 0);
+    poses.emplace_back(ConvertToNanoseconds(t) + offset_ns, world_T_body);
+  }
+  return poses;
+}
+
+
+TEST(TrajectoryErrorTest, TestPerfectEstimate)
+{
+  const std::vector<GroundtruthItem> groundtruth = MakeTrajectory(50);
+
+  // Offset the estimate by a few milliseconds, it should still get matched.
+  const TrajectoryError err = ComputeTrajectoryError(groundtruth, MakeTrajectory(50, 3000000), 1.0, 0.01);
+
+  EXPECT_EQ(50, err.num_poses);
+  EXPECT_NEAR(0, err.ate_rmse, 1e-9);
+  EXPECT_NEAR(0, err.ate_max, 1e-9);
+  EXPECT_EQ(40, err.num_rpe_pairs);
+  EXPECT_NEAR(0, err.rpe_trans_rmse, 1e-9);
+  EXPECT_NEAR(0, err.rpe_rot_rmse, 1e-9);
+}
+
+
+TEST(TrajectoryErrorTest, TestAlignment)
+{
+  const std::vector<GroundtruthItem> groundtruth = MakeTrajectory(50);
+
+  // Estimate is in a different world frame. Alignment should remove this entirely.
+  Matrix4d other_T_world = Matrix4d::Identity();
+  other_T_world.block<3, 3>(0, 0) = Eigen::AngleAxisd(0.5, Vector3d::UnitY()).toRotationMatrix();
+  other_T_world.block<3, 1>(0, 3) = Vector3d(1, 2, 3);
+
+  std::vector<GroundtruthItem> estimate = MakeTrajectory(50);
+  for (GroundtruthItem& item : estimate) {
+    item.world_T_body = other_T_world * item.world_T_body;
+  }
+
+  const TrajectoryError aligned = ComputeTrajectoryError(groundtruth, estimate, 1.0, 0.01, true);
+  EXPECT_NEAR(0, aligned.ate_rmse, 1e-6);
+  EXPECT_NEAR(0, aligned.rpe_trans_rmse, 1e-9);
+
+  const TrajectoryError unaligned = ComputeTrajectoryError(groundtruth, estimate, 1.0, 0.01, false);
+  EXPECT_GT(unaligned.ate_rmse, 1.0);
+  EXPECT_NEAR(0, unaligned.rpe_trans_rmse, 1e-9);
+}
+
+
+TEST(TrajectoryErrorTest, TestDrift)
+{
+  const std::vector<GroundtruthItem> groundtruth = MakeTrajectory(50);
+
+  // Estimate drifts 0.1 m along y every second.
+  std::vector<GroundtruthItem> estimate = MakeTrajectory(50);
+  for (size_t i = 0; i < estimate.size(); ++i) {
+    estimate.at(i).world_T_body(1, 3) += 0.01 * static_cast<double>(i);
+  }
+
+  const TrajectoryError err = ComputeTrajectoryError(groundtruth, estimate, 1.0, 0.01, false);
+  EXPECT_NEAR(0.49, err.ate_max, 1e-9);
+  EXPECT_GT(err.rpe_trans_rmse, 0.09);
+  EXPECT_LT(err.rpe_trans_rmse, 0.11);
+
+  // Nothing within the time tolerance.
+  const TrajectoryError empty = ComputeTrajectoryError(groundtruth, MakeTrajectory(10, 50000000), 1.0, 0.01);
+  EXPECT_EQ(0, empty.num_poses);
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
 #include <gtest/gtest.h>
 #include <glog/logging.h>
 
@@ -50,6 +54,78 @@ TEST(DetectorTest, TestDetectSingle)
 }
 
 
+TEST(DetectorTest, TestDetectGrid)
+{
+  const Image1b iml = cv::imread("./resources/caddy_32_left.jpg", cv::IMREAD_GRAYSCALE);
+
+  FeatureDetector::Params params;
+  params.grid_rows = 4;
+  params.grid_cols = 4;
+  FeatureDetector detector(params);
+
+  VecPoint2f tracked_kp, new_kp;
+  detector.Detect(iml, tracked_kp, new_kp);
+  EXPECT_GT(new_kp.size(), 0u);
+  EXPECT_LE((int)new_kp.size(), params.max_features_per_frame);
+
+  // Fill up the top-left cell with tracked keypoints. Nothing new should be detected there.
+  const int target_per_cell = (params.max_features_per_frame + 15) / 16;
+  const float cell_w = std::ceil(iml.cols / 4.0f);
+  const float cell_h = std::ceil(iml.rows / 4.0f);
+  for (int i = 0; i < target_per_cell; ++i) {
+    tracked_kp.emplace_back(0.5f * cell_w, 0.5f * cell_h);
+  }
+
+  VecPoint2f new_kp2;
+  detector.Detect(iml, tracked_kp, new_kp2);
+  EXPECT_LE(new_kp2.size() + tracked_kp.size(), (size_t)params.max_features_per_frame);
+
+  for (const cv::Point2f& kp : new_kp2) {
+    EXPECT_FALSE(kp.x < cell_w && kp.y < cell_h);
+  }
+}
+
+
+TEST(DetectorTest, TestSuppressSsc)
+{
+  // A dense grid of keypoints, with the strongest ones in the top-left corner. Keeping only the
+  // strongest would bunch them up there, but SSC should spread them over the whole image.
+  const int cols = 640;
+  const int rows = 480;
+  std::vector<cv::KeyPoint> keypoints;
+  for (int y = 0; y < rows; y += 8) {
+    for (int x = 0; x < cols; x += 8) {
+      keypoints.emplace_back(cv::Point2f(x, y), 1.0f, -1.0f, (float)(cols + rows - x - y));
+    }
+  }
+
+  std::vector<int> sorted_idx(keypoints.size());
+  std::iota(sorted_idx.begin(), sorted_idx.end(), 0);
+  std::sort(sorted_idx.begin(), sorted_idx.end(), [&](int a, int b) {
+    return keypoints[a].response > keypoints[b].response;
+  });
+
+  std::vector<uint8_t> covered;
+  std::vector<int> keep;
+  SuppressSsc(keypoints, sorted_idx, 100, 0.1f, cols, rows, covered, keep);
+  EXPECT_GE(keep.size(), 90u);
+  EXPECT_LE(keep.size(), 100u);
+
+  // The strongest keypoint is always kept, and the rest are spread out.
+  EXPECT_EQ(sorted_idx.at(0), keep.at(0));
+  bool any_bottom_right = false;
+  for (const int i : keep) {
+    any_bottom_right |= (keypoints[i].pt.x > cols / 2 && keypoints[i].pt.y > rows / 2);
+  }
+  EXPECT_TRUE(any_bottom_right);
+
+  // Fewer keypoints than requested are all kept.
+  SuppressSsc(keypoints, std::vector<int>(sorted_idx.begin(), sorted_idx.begin() + 50), 100, 0.1f,
+              cols, rows, covered, keep);
+  EXPECT_EQ(50u, keep.size());
+}
+
+
 TEST(DetectorTest, TestDetectSequence)
 {
   FeatureDetector::Params params;
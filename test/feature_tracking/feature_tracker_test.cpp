@@ -2,6 +2,7 @@
 #include <glog/logging.h>
 
 #include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
 
 #include "vision_core/cv_types.hpp"
 #include "core/timer.hpp"
@@ -38,3 +39,97 @@ TEST(TrackerTest, TestTrackLR)
   cv::imshow("Tracker", viz);
   cv::waitKey(0);
 }
+
+
+// Blurred noise shifted right by shift_px, so every point moves by exactly that much.
+static void MakeShiftedPair(int shift_px, Image1b& ref, Image1b& cur)
+{
+  cv::Mat noise(240, 320 + shift_px, CV_8UC1);
+  cv::RNG rng(123);
+  rng.fill(noise, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(noise, noise, cv::Size(7, 7), 2.0);
+  noise(cv::Rect(shift_px, 0, 320, 240)).copyTo(ref);
+  noise(cv::Rect(0, 0, 320, 240)).copyTo(cur);
+}
+
+
+TEST(TrackerTest, TestInitialGuess)
+{
+  const int kShiftPx = 40;
+  Image1b ref, cur;
+  MakeShiftedPair(kShiftPx, ref, cur);
+
+  const VecPoint2f px_ref = { cv::Point2f(100, 100), cv::Point2f(150, 120), cv::Point2f(200, 80) };
+
+  // Without pyramid levels, KLT can't find a 40px shift on its own.
+  FeatureTracker::Params params;
+  params.klt_max_level = 0;
+  params.klt_guess_max_level = 0;
+  FeatureTracker tracker(params);
+
+  VecPoint2f px_cur;
+  std::vector<uchar> status;
+  std::vector<float> error;
+  tracker.Track(ref, cur, px_ref, px_cur, status, error);
+  int num_unguided = 0;
+  for (size_t i = 0; i < px_ref.size(); ++i) {
+    num_unguided += (status.at(i) && std::fabs(px_cur.at(i).x - px_ref.at(i).x - kShiftPx) < 0.5) ? 1 : 0;
+  }
+  EXPECT_EQ(0, num_unguided);
+
+  // Starting a few pixels away from the answer, it only has to correct the guess.
+  px_cur.clear();
+  for (const cv::Point2f& pt : px_ref) {
+    px_cur.emplace_back(pt.x + kShiftPx - 2, pt.y + 1);
+  }
+  tracker.Track(ref, cur, px_ref, px_cur, status, error, true, 1.0);
+  for (size_t i = 0; i < px_ref.size(); ++i) {
+    EXPECT_EQ(1, status.at(i));
+    EXPECT_NEAR(px_ref.at(i).x + kShiftPx, px_cur.at(i).x, 0.1);
+    EXPECT_NEAR(px_ref.at(i).y, px_cur.at(i).y, 0.1);
+  }
+}
+
+
+TEST(TrackerTest, TestCheckModes)
+{
+  const int kShiftPx = 3;
+  Image1b ref, cur;
+  MakeShiftedPair(kShiftPx, ref, cur);
+
+  const VecPoint2f px_ref = { cv::Point2f(100, 100), cv::Point2f(150, 120), cv::Point2f(200, 80) };
+
+  // A different texture, that nothing should be tracked into.
+  Image1b other(ref.size());
+  cv::RNG rng(456);
+  rng.fill(other, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(other, other, cv::Size(7, 7), 2.0);
+
+  std::vector<FeatureTracker::Params> variants(4);
+  variants.at(1).fwd_bkw_min_error = 4.0;
+  variants.at(2).fwd_bkw_level = 1;
+  variants.at(3).check_mode = FeatureTracker::CheckMode::NCC;
+
+  for (size_t v = 0; v < variants.size(); ++v) {
+    FeatureTracker tracker(variants.at(v));
+
+    VecPoint2f px_cur;
+    std::vector<uchar> status;
+    std::vector<float> error;
+    tracker.Track(ref, cur, px_ref, px_cur, status, error, true, 1.0);
+    for (size_t i = 0; i < px_ref.size(); ++i) {
+      EXPECT_EQ(1, status.at(i)) << "variant " << v;
+      EXPECT_NEAR(px_ref.at(i).x + kShiftPx, px_cur.at(i).x, 0.1) << "variant " << v;
+    }
+  }
+
+  // The patches don't match anywhere in the other image, so NCC rejects everything.
+  FeatureTracker tracker(variants.at(3));
+  VecPoint2f px_cur;
+  std::vector<uchar> status;
+  std::vector<float> error;
+  tracker.Track(ref, other, px_ref, px_cur, status, error, true, 1.0);
+  for (size_t i = 0; i < px_ref.size(); ++i) {
+    EXPECT_EQ(0, status.at(i));
+  }
+}
@@ -0,0 +1,106 @@
+#include <unordered_set>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "feature_tracking/feature_tracks.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+static LandmarkObservation MakeObs(core::uid_t lmk_id, core::uid_t camera_id)
+{
+  return LandmarkObservation(lmk_id, camera_id, cv::Point2f(camera_id, lmk_id), 1.0, 0.0, 0.0);
+}
+
+
+TEST(FeatureTracksTest, AddAndKill)
+{
+  FeatureTracks tracks(8);
+  EXPECT_TRUE(tracks.Empty());
+
+  for (core::uid_t lmk_id = 0; lmk_id < 5; ++lmk_id) {
+    tracks.AddTrack(MakeObs(lmk_id, 0));
+  }
+  tracks.AddObservation(MakeObs(3, 1));
+
+  EXPECT_EQ(5ul, tracks.Size());
+  EXPECT_EQ(2ul, tracks.Get(3).size());
+  EXPECT_EQ(1ul, tracks.Get(3).back().camera_id);
+
+  // Killing from the middle moves another track into its slot.
+  EXPECT_TRUE(tracks.Kill(1));
+  EXPECT_FALSE(tracks.Kill(1));
+  EXPECT_FALSE(tracks.Has(1));
+  EXPECT_EQ(4ul, tracks.Size());
+
+  std::unordered_set<core::uid_t> seen;
+  for (const FeatureTracks::Track& track : tracks) {
+    EXPECT_EQ(track.lmk_id, track.observations.back().landmark_id);
+    seen.insert(track.lmk_id);
+  }
+  EXPECT_EQ(std::unordered_set<core::uid_t>({0, 2, 3, 4}), seen);
+  EXPECT_EQ(2ul, tracks.Get(3).size());
+
+  // Only landmark 3 was seen in camera 1.
+  tracks.KillIf([](const FeatureTracks::Track& track) { return track.observations.back().camera_id < 1; });
+  EXPECT_EQ(1ul, tracks.Size());
+  EXPECT_TRUE(tracks.Has(3));
+
+  // A recycled slot should start over with one observation.
+  tracks.AddTrack(MakeObs(7, 2));
+  EXPECT_EQ(1ul, tracks.Get(7).size());
+  EXPECT_EQ(2ul, tracks.Get(7).front().camera_id);
+}
+
+
+TEST(FeatureTracksTest, ObservationWindow)
+{
+  FeatureTracks tracks(8);
+  tracks.AddTrack(MakeObs(0, 0));
+
+  for (core::uid_t camera_id = 1; camera_id < 100; ++camera_id) {
+    tracks.AddObservation(MakeObs(0, camera_id));
+
+    const VecLmkObs& obs = tracks.Get(0);
+    EXPECT_LE(obs.size(), 8ul);
+    EXPECT_GE(obs.size(), std::min(4ul, (size_t)camera_id + 1));
+    EXPECT_EQ(camera_id, obs.back().camera_id);
+
+    // The window should always be the most recent observations, in order.
+    for (size_t i = 1; i < obs.size(); ++i) {
+      EXPECT_EQ(obs.at(i - 1).camera_id + 1, obs.at(i).camera_id);
+    }
+  }
+}
+
+
+TEST(FeatureTracksTest, DepthFilter)
+{
+  FeatureTracks tracks(8);
+  tracks.AddTrack(MakeObs(7, 0));
+  DepthFilter& depth = tracks.GetDepthFilter(7);
+  depth.Init(20.0f, 0.25f);
+
+  // Consistent matches shrink the variance.
+  depth.Predict(0.04f);
+  EXPECT_EQ(1, depth.frames_since_update);
+  EXPECT_TRUE(depth.Update(20.4f, 0.25f, 3.0f));
+  EXPECT_EQ(0, depth.frames_since_update);
+  EXPECT_GT(depth.disp, 20.0f);
+  EXPECT_LT(depth.disp, 20.4f);
+  EXPECT_LT(depth.var, 0.25f);
+
+  // A match way outside of the gate restarts the filter from it.
+  depth.Predict(0.04f);
+  EXPECT_FALSE(depth.Update(30.0f, 0.25f, 3.0f));
+  EXPECT_FLOAT_EQ(30.0f, depth.disp);
+  EXPECT_FLOAT_EQ(0.25f, depth.var);
+
+  // A recycled track starts with a fresh filter.
+  tracks.Kill(7);
+  tracks.AddTrack(MakeObs(8, 1));
+  EXPECT_EQ(0.0f, tracks.GetDepthFilter(8).var);
+}
@@ -0,0 +1,68 @@
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "vision_core/cv_types.hpp"
+#include "feature_tracking/frame_quality.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+// Checkerboard with "contrast" between dark and light squares, lifted by "offset".
+static Image1b MakeCheckerboard(int contrast, int offset, int square_px = 4)
+{
+  Image1b img(120, 160);
+  for (int r = 0; r < img.rows; ++r) {
+    for (int c = 0; c < img.cols; ++c) {
+      const bool light = ((r / square_px) + (c / square_px)) % 2 == 0;
+      img.at<uint8_t>(r, c) = static_cast<uint8_t>(std::min(255, offset + (light ? contrast : 0)));
+    }
+  }
+  return img;
+}
+
+
+TEST(FrameQualityTest, TestEstimate)
+{
+  const FrameQuality sharp = EstimateFrameQuality(MakeCheckerboard(200, 0));
+  EXPECT_GT(sharp.gradient_energy, 1000.0f);
+  EXPECT_FLOAT_EQ(0.0f, sharp.saturated_fraction);
+  EXPECT_FLOAT_EQ(0.0f, sharp.haze);
+
+  // Low contrast (e.g blur or murk) has much less gradient energy.
+  const FrameQuality murky = EstimateFrameQuality(MakeCheckerboard(10, 0));
+  EXPECT_LT(murky.gradient_energy, sharp.gradient_energy / 100.0f);
+
+  // Backscatter lifts the darkest pixels.
+  const FrameQuality hazy = EstimateFrameQuality(MakeCheckerboard(20, 180));
+  EXPECT_NEAR(180.0f / 255.0f, hazy.haze, 1e-3);
+  EXPECT_FLOAT_EQ(0.0f, hazy.saturated_fraction);
+
+  // Half of the squares are blown out.
+  const FrameQuality saturated = EstimateFrameQuality(MakeCheckerboard(200, 100));
+  EXPECT_NEAR(0.5f, saturated.saturated_fraction, 0.01f);
+
+  const FrameQuality flat = EstimateFrameQuality(Image1b(120, 160, static_cast<uint8_t>(50)));
+  EXPECT_FLOAT_EQ(0.0f, flat.gradient_energy);
+}
+
+
+TEST(FrameQualityTest, TestPyramidLevel)
+{
+  const Image1b level0(120, 160, static_cast<uint8_t>(0));
+  const Image1b level1(60, 80, static_cast<uint8_t>(0));
+  const cv::Mat deriv0(120, 160, CV_16SC2);
+  const cv::Mat deriv1(60, 80, CV_16SC2);
+
+  // Interleaved with derivatives, like FeatureTracker::BuildPyramid().
+  const ImagePyramid with_derivs = { level0, deriv0, level1, deriv1 };
+  EXPECT_EQ(160, PyramidLevel(with_derivs, 0).cols);
+  EXPECT_EQ(80, PyramidLevel(with_derivs, 1).cols);
+  EXPECT_EQ(80, PyramidLevel(with_derivs, 5).cols);
+
+  // The GPU tracker only keeps the image.
+  const ImagePyramid image_only = { level0 };
+  EXPECT_EQ(160, PyramidLevel(image_only, 2).cols);
+}
@@ -0,0 +1,67 @@
+#include <algorithm>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "feature_tracking/line_tracker.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+// Draws bright bars with different slopes, shifted left by disp in the right image.
+static Image1b DrawBars(int disp)
+{
+  Image1b im(480, 640, (uchar)30);
+  for (int i = 0; i < 4; ++i) {
+    const cv::Point p0(120 + 120 * i - disp, 60);
+    const cv::Point p1(120 + 120 * i + 25 * (i - 1) - disp, 420);
+    cv::line(im, p0, p1, cv::Scalar(220), 18);
+  }
+  return im;
+}
+
+
+TEST(LineTrackerTest, TestStereoAndAssociate)
+{
+  const PinholeCamera camera_model(400, 400, 320, 240, 480, 640);
+  const StereoCamera stereo_rig(camera_model, 0.2);
+
+  StereoLineTracker::Params params;
+  params.stereo_min_depth = 2.0;   // Max disparity of 40px, less than the spacing of the bars.
+  StereoLineTracker tracker(params, stereo_rig);
+
+  const int disp = 20;
+  const StereoImage1b pair0(0, 0, DrawBars(0), DrawBars(disp));
+
+  VecLineObservation obs0;
+  tracker.Track(pair0, true, obs0);
+  ASSERT_GE(obs0.size(), 4u);
+  EXPECT_LE((int)obs0.size(), params.max_lines_per_frame);
+
+  for (const LineObservation& obs : obs0) {
+    EXPECT_EQ(0u, obs.camera_id);
+    EXPECT_NEAR(disp, obs.disp_p0, 2.0);
+    EXPECT_NEAR(disp, obs.disp_p1, 2.0);
+  }
+
+  // The same pair again shouldn't create any new lines, and every line is associated.
+  const StereoImage1b pair1(1, 1, DrawBars(0), DrawBars(disp));
+  VecLineObservation obs1;
+  tracker.Track(pair1, false, obs1);
+  ASSERT_EQ(obs0.size(), obs1.size());
+
+  std::vector<uid_t> ids0, ids1;
+  for (size_t i = 0; i < obs0.size(); ++i) {
+    ids0.emplace_back(obs0[i].line_id);
+    ids1.emplace_back(obs1[i].line_id);
+  }
+  std::sort(ids0.begin(), ids0.end());
+  std::sort(ids1.begin(), ids1.end());
+  EXPECT_EQ(ids0, ids1);
+}
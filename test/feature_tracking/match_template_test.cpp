@@ -0,0 +1,127 @@
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "feature_tracking/match_template.hpp"
+
+using namespace bm;
+using namespace ft;
+
+
+// Straightforward version of CV_TM_SQDIFF_NORMED to check against.
+static float SqDiffNormedReference(const std::vector<uint8_t>& templ, int templ_rows, int templ_cols,
+                                   const std::vector<uint8_t>& stripe, int stripe_cols,
+                                   int dx, int dy)
+{
+  double ssd = 0, templ_sq = 0, window_sq = 0;
+  for (int r = 0; r < templ_rows; ++r) {
+    for (int c = 0; c < templ_cols; ++c) {
+      const double t = templ.at(r * templ_cols + c);
+      const double s = stripe.at((dy + r) * stripe_cols + dx + c);
+      ssd += (t - s) * (t - s);
+      templ_sq += t * t;
+      window_sq += s * s;
+    }
+  }
+  const double denom = std::sqrt(templ_sq * window_sq);
+  return (ssd < denom) ? (float)(ssd / denom) : 1.0f;
+}
+
+
+TEST(MatchTemplateTest, MatchesReference)
+{
+  std::mt19937 rng(123);
+  std::uniform_int_distribution<int> pixel(0, 255);
+
+  const int templ_rows = 11, templ_cols = 31;
+  const int stripe_rows = 13, stripe_cols = 128;
+
+  std::vector<uint8_t> stripe(stripe_rows * stripe_cols);
+  for (uint8_t& v : stripe) { v = pixel(rng); }
+
+  // Cut the template out of the stripe (plus a little noise), so there's a clear best match.
+  const int true_dx = 57, true_dy = 1;
+  std::vector<uint8_t> templ(templ_rows * templ_cols);
+  for (int r = 0; r < templ_rows; ++r) {
+    for (int c = 0; c < templ_cols; ++c) {
+      const int v = stripe.at((true_dy + r) * stripe_cols + true_dx + c) + (pixel(rng) % 5) - 2;
+      templ.at(r * templ_cols + c) = (uint8_t)std::max(0, std::min(255, v));
+    }
+  }
+
+  MatchTemplateWorkspace workspace;
+  int best_x = -1, best_y = -1;
+  const float cost = MatchTemplateSqDiffNormed(
+      templ.data(), templ_cols, templ_rows, templ_cols,
+      stripe.data(), stripe_cols, stripe_rows, stripe_cols,
+      workspace, best_x, best_y);
+
+  EXPECT_EQ(true_dx, best_x);
+  EXPECT_EQ(true_dy, best_y);
+  EXPECT_NEAR(SqDiffNormedReference(templ, templ_rows, templ_cols, stripe, stripe_cols, best_x, best_y), cost, 1e-6);
+
+  // Every other offset should cost at least as much as the best one.
+  for (int dy = 0; dy <= stripe_rows - templ_rows; ++dy) {
+    for (int dx = 0; dx <= stripe_cols - templ_cols; ++dx) {
+      EXPECT_GE(SqDiffNormedReference(templ, templ_rows, templ_cols, stripe, stripe_cols, dx, dy), cost - 1e-6);
+    }
+  }
+}
+
+
+TEST(MatchTemplateTest, BlackImage)
+{
+  // The cost is undefined when everything is zero. Like OpenCV, this should give the worst cost.
+  const std::vector<uint8_t> templ(3 * 5, 0);
+  const std::vector<uint8_t> stripe(4 * 20, 0);
+
+  MatchTemplateWorkspace workspace;
+  int best_x, best_y;
+  EXPECT_EQ(1.0f, MatchTemplateSqDiffNormed(templ.data(), 5, 3, 5, stripe.data(), 20, 4, 20,
+                                            workspace, best_x, best_y));
+  EXPECT_EQ(0, best_x);
+  EXPECT_EQ(0, best_y);
+}
+
+
+TEST(MatchTemplateTest, SpecializedKernels)
+{
+  std::mt19937 rng(123);
+  std::uniform_int_distribution<int> pixel(0, 255);
+
+  // Sizes with a specialized kernel, and one without (which gets the generic one).
+  const std::vector<std::pair<int, int>> sizes = { {11, 31}, {21, 21}, {31, 31}, {7, 13} };
+
+  for (const auto& size : sizes) {
+    const int templ_rows = size.first, templ_cols = size.second;
+    const int stripe_rows = templ_rows + 2, stripe_cols = 128;
+
+    // The template is a window of a bigger image, so its step is bigger than its width.
+    const int templ_step = templ_cols + 9;
+    std::vector<uint8_t> templ(templ_rows * templ_step);
+    std::vector<uint8_t> stripe(stripe_rows * stripe_cols);
+    for (uint8_t& v : templ) { v = pixel(rng); }
+    for (uint8_t& v : stripe) { v = pixel(rng); }
+
+    MatchTemplateWorkspace workspace;
+    int generic_x, generic_y, x, y;
+    const float generic_cost = MatchTemplateSqDiffNormed(
+        templ.data(), templ_step, templ_rows, templ_cols,
+        stripe.data(), stripe_cols, stripe_rows, stripe_cols,
+        workspace, generic_x, generic_y);
+
+    const MatchTemplateFn fn = SelectMatchTemplateKernel(templ_rows, templ_cols);
+    const float cost = fn(templ.data(), templ_step, templ_rows, templ_cols,
+                          stripe.data(), stripe_cols, stripe_rows, stripe_cols,
+                          workspace, x, y);
+
+    EXPECT_EQ(generic_cost, cost) << templ_rows << "x" << templ_cols;
+    EXPECT_EQ(generic_x, x);
+    EXPECT_EQ(generic_y, y);
+  }
+
+  EXPECT_EQ(&MatchTemplateSqDiffNormed, SelectMatchTemplateKernel(7, 13));
+  EXPECT_NE(&MatchTemplateSqDiffNormed, SelectMatchTemplateKernel(11, 31));
+}
@@ -2,10 +2,13 @@
 #include <glog/logging.h>
 
 #include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
 
 #include "feature_tracking/visualization_2d.hpp"
 #include "feature_tracking/feature_detector.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
+#include "feature_tracking/feature_tracker.hpp"
+#include "core/timer.hpp"
 #include "dataset/euroc_dataset.hpp"
 
 using namespace bm;
@@ -68,3 +71,112 @@ TEST(MatcherTest, TestSequence)
   dataset.Playback(5.0f, false);
   LOG(INFO) << "DONE" << std::endl;
 }
+
+
+TEST(MatcherTest, TestPrior)
+{
+  StereoMatcher::Params opt;
+  opt.prior_band_px = 6;
+  StereoMatcher matcher(opt);
+
+  // Random texture, with the right image shifted so that every point has a disparity of 20.
+  const int true_disp = 20;
+  Image1b iml(120, 240);
+  cv::randu(iml, cv::Scalar(0), cv::Scalar(255));
+  cv::GaussianBlur(iml, iml, cv::Size(3, 3), 0);
+  Image1b imr(iml.size(), 0);
+  iml(cv::Rect(true_disp, 0, iml.cols - true_disp, iml.rows)).copyTo(imr(cv::Rect(0, 0, iml.cols - true_disp, iml.rows)));
+
+  const VecPoint2f left_keypoints = { cv::Point2f(120, 60), cv::Point2f(160, 40), cv::Point2f(200, 80) };
+
+  // A good prior finds the same match as the full search.
+  const std::vector<double> full = matcher.MatchRectified(iml, imr, left_keypoints);
+  const std::vector<double> good = matcher.MatchRectifiedWithPrior(iml, imr, left_keypoints, { 22.0, 18.0, 20.0 });
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    EXPECT_NEAR(true_disp, full.at(i), 1.0);
+    EXPECT_NEAR(full.at(i), good.at(i), 1e-3);
+  }
+  EXPECT_EQ(0, matcher.NumPriorFallbacks());
+
+  // A wrong prior falls back to the full search.
+  const std::vector<double> bad = matcher.MatchRectifiedWithPrior(iml, imr, left_keypoints, { 60.0, 60.0, 60.0 });
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    EXPECT_NEAR(full.at(i), bad.at(i), 1e-3);
+  }
+  EXPECT_EQ(3, matcher.NumPriorFallbacks());
+}
+
+
+TEST(MatcherTest, TestKltVsTemplate)
+{
+  // Smooth random texture, with the right image shifted by a subpixel disparity.
+  const double true_disp = 20.5;
+  Image1b iml(240, 320);
+  cv::randu(iml, cv::Scalar(0), cv::Scalar(255));
+  cv::GaussianBlur(iml, iml, cv::Size(7, 7), 1.5);
+  const cv::Matx23d shift(1, 0, -true_disp, 0, 1, 0);
+  Image1b imr;
+  cv::warpAffine(iml, imr, shift, iml.size(), cv::INTER_LINEAR, cv::BORDER_REFLECT_101);
+
+  VecPoint2f left_keypoints;
+  for (int y = 40; y <= 200; y += 20) {
+    for (int x = 80; x <= 280; x += 20) {
+      left_keypoints.emplace_back(x, y);
+    }
+  }
+
+  StereoMatcher::Params template_params;
+  StereoMatcher template_matcher(template_params);
+
+  StereoMatcher::Params klt_params;
+  klt_params.mode = StereoMatcher::Mode::KLT;
+  klt_params.bidirectional = true;
+  klt_params.klt_init_disp = 16.0;
+  StereoMatcher klt_matcher(klt_params);
+
+  Timer timer(true);
+  const std::vector<double> template_disps = template_matcher.MatchRectified(iml, imr, left_keypoints);
+  const double template_ms = timer.Tock().milliseconds();
+  const std::vector<double> klt_disps = klt_matcher.MatchRectified(iml, imr, left_keypoints);
+  const double klt_ms = timer.Tock().milliseconds();
+
+  double template_err = 0, klt_err = 0;
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    ASSERT_GT(template_disps.at(i), 0);
+    ASSERT_GT(klt_disps.at(i), 0);
+    template_err += std::fabs(template_disps.at(i) - true_disp);
+    klt_err += std::fabs(klt_disps.at(i) - true_disp);
+  }
+  template_err /= left_keypoints.size();
+  klt_err /= left_keypoints.size();
+
+  LOG(INFO) << "TEMPLATE: mean error " << template_err << " px in " << template_ms << " ms" << std::endl;
+  LOG(INFO) << "KLT: mean error " << klt_err << " px in " << klt_ms << " ms" << std::endl;
+
+  // Template matching is only accurate to the pixel, KLT is subpixel.
+  EXPECT_NEAR(0.5, template_err, 0.1);
+  EXPECT_LT(klt_err, 0.1);
+
+  // A disparity prior, and pyramids from a FeatureTracker (with the same window size).
+  FeatureTracker::Params tracker_params;
+  tracker_params.klt_winsize = klt_params.klt_winsize;
+  FeatureTracker tracker(tracker_params);
+  ImagePyramid left_pyramid, right_pyramid;
+  tracker.BuildPyramid(iml, left_pyramid);
+  tracker.BuildPyramid(imr, right_pyramid);
+
+  const std::vector<double> priors(left_keypoints.size(), 22.0);
+  const std::vector<double> pyramid_disps = klt_matcher.MatchRectifiedWithPrior(left_pyramid, right_pyramid, left_keypoints, priors);
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    EXPECT_NEAR(true_disp, pyramid_disps.at(i), 0.1);
+  }
+
+  // A match that drifts off of the row is rejected.
+  Image1b imr_up;
+  const cv::Matx23d shift_up(1, 0, -true_disp, 0, 1, 3.0);
+  cv::warpAffine(iml, imr_up, shift_up, iml.size(), cv::INTER_LINEAR, cv::BORDER_REFLECT_101);
+  const std::vector<double> off_row = klt_matcher.MatchRectified(iml, imr_up, left_keypoints);
+  for (const double disp : off_row) {
+    EXPECT_LT(disp, 0);
+  }
+}
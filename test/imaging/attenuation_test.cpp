@@ -0,0 +1,58 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+
+#include "opencv2/imgproc.hpp"
+
+#include "imaging/attenuation.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+TEST(AttenuationTest, TestCorrector)
+{
+  cv::RNG rng(123);
+
+  Image1f range(240, 320);
+  rng.fill(range, cv::RNG::UNIFORM, 0.5f, 12.0f);
+  range(0, 0) = 0;   // Missing range should be treated as the max range.
+
+  Image3f bgr(range.size());
+  rng.fill(bgr, cv::RNG::UNIFORM, 0.0f, 0.5f);
+
+  const Vector12f X = BetaInitialGuess2();
+
+  double rmin, rmax;
+  cv::minMaxLoc(range, &rmin, &rmax);
+
+  AttenuationCorrector corrector;
+  Image3f out;
+  corrector.Correct(bgr, range, X, out);
+  EXPECT_FALSE(corrector.LastCallWasCached());
+
+  for (int r = 0; r < bgr.rows; r += 7) {
+    for (int c = 0; c < bgr.cols; c += 7) {
+      const float z = (range(r, c) > 0) ? range(r, c) : static_cast<float>(rmax);
+      for (int ch = 0; ch < 3; ++ch) {
+        const float beta_c = X(ch) * std::exp(X(3 + ch) * z) + X(6 + ch) * std::exp(X(9 + ch) * z);
+        const float expected = bgr(r, c)[ch] * std::exp(beta_c * z);
+        EXPECT_NEAR(expected, out(r, c)[ch], 1e-4 * expected + 1e-6);
+      }
+    }
+  }
+
+  // Same range and model, so the gains should be reused.
+  const Image3f bgr2 = 0.5f * bgr;
+  Image3f out2;
+  corrector.Correct(bgr2, range, X, out2);
+  EXPECT_TRUE(corrector.LastCallWasCached());
+  EXPECT_LT(cv::norm(out2, 0.5f * out, cv::NORM_INF), 1e-4);
+
+  // A new model invalidates them.
+  Vector12f X2 = X;
+  X2(0) += 0.01;
+  corrector.Correct(bgr, range, X2, out2);
+  EXPECT_FALSE(corrector.LastCallWasCached());
+}
@@ -0,0 +1,92 @@
+#include "gtest/gtest.h"
+
+#include "imaging/io.hpp"
+#include "imaging/depth_cache.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+static Image1f RandomRange(int rows, int cols)
+{
+  cv::RNG rng(123);
+  Image1f range(rows, cols);
+  rng.fill(range, cv::RNG::UNIFORM, 0.5f, 12.0f);
+  range(0, 0) = 0;    // Missing.
+  return range;
+}
+
+
+TEST(DepthCacheTest, TestMillimeters)
+{
+  const Image1f range = RandomRange(48, 64);
+  const Image1w range_mm = DepthToMillimeters(range);
+  EXPECT_EQ(0, range_mm(0, 0));
+
+  const Image1f back = DepthFromMillimeters(range_mm);
+  EXPECT_LE(cv::norm(range, back, cv::NORM_INF), 0.5e-3 + 1e-6);
+}
+
+
+TEST(DepthCacheTest, TestRawFormat)
+{
+  const Image1f range = RandomRange(48, 64);
+
+  const std::string path_f = std::string("/tmp/depth_cache_test_f") + kDepthRawExtension;
+  SaveDepthRaw(path_f, range);
+  const DepthMap map_f = LoadDepth(path_f);
+  EXPECT_FALSE(map_f.IsMillimeters());
+  EXPECT_TRUE(map_f.mapping != nullptr);
+  EXPECT_EQ(0, cv::norm(range, map_f.Meters(), cv::NORM_INF));
+
+  // Copy-on-write, so changing the map doesn't change the file.
+  map_f.Meters()(1, 1) = 100.0f;
+  EXPECT_EQ(range(1, 1), MapDepthRaw(path_f).Meters()(1, 1));
+
+  const std::string path_mm = std::string("/tmp/depth_cache_test_mm") + kDepthRawExtension;
+  SaveDepthRaw(path_mm, range, true);
+  const DepthMap map_mm = LoadDepth(path_mm);
+  EXPECT_TRUE(map_mm.IsMillimeters());
+  EXPECT_EQ(map_f.Bytes() / 2, map_mm.Bytes());
+  EXPECT_LE(cv::norm(range, map_mm.Meters(), cv::NORM_INF), 0.5e-3 + 1e-6);
+
+  EXPECT_THROW(MapDepthRaw("/tmp/depth_cache_test_missing.bmrange"), std::exception);
+}
+
+
+TEST(DepthCacheTest, TestLru)
+{
+  const Image1f range = RandomRange(48, 64);
+  const size_t bytes = range.total() * sizeof(float);
+
+  std::vector<std::string> paths;
+  for (int i = 0; i < 3; ++i) {
+    paths.emplace_back("/tmp/depth_cache_test_" + std::to_string(i) + kDepthRawExtension);
+    SaveDepthRaw(paths.back(), range);
+  }
+
+  // Room for two maps.
+  DepthCache cache(2 * bytes);
+
+  const std::shared_ptr<const DepthMap> first = cache.Get(paths.at(0));
+  EXPECT_EQ(first, cache.Get(paths.at(0)));
+  EXPECT_EQ(1ul, cache.NumHits());
+  EXPECT_EQ(1ul, cache.NumMisses());
+
+  cache.Get(paths.at(1));
+  cache.Get(paths.at(0));   // Now 1 is the least recently used.
+  cache.Get(paths.at(2));
+  EXPECT_EQ(2ul, cache.Size());
+  EXPECT_EQ(2 * bytes, cache.Bytes());
+
+  EXPECT_EQ(first, cache.Get(paths.at(0)));
+  EXPECT_EQ(3ul, cache.NumMisses());
+  cache.Get(paths.at(1));
+  EXPECT_EQ(4ul, cache.NumMisses());
+
+  // An evicted map is still usable by whoever has it.
+  cache.Clear();
+  EXPECT_EQ(0ul, cache.Size());
+  EXPECT_EQ(0, cv::norm(range, first->Meters(), cv::NORM_INF));
+}
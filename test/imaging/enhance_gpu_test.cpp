@@ -0,0 +1,109 @@
+#include "gtest/gtest.h"
+
+#include <glog/logging.h>
+
+#include "opencv2/imgproc.hpp"
+
+#include "core/timer.hpp"
+#include "imaging/attenuation.hpp"
+#include "imaging/backscatter.hpp"
+#include "imaging/guided_filter.hpp"
+#include "imaging/enhance_gpu.h"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+static float MaxAbsDiff(const cv::Mat& a, const cv::Mat& b)
+{
+  double max_val = 0;
+  cv::minMaxLoc(cv::abs(a - b).reshape(1), nullptr, &max_val);
+  return static_cast<float>(max_val);
+}
+
+
+TEST(EnhanceGpuTest, TestSameAsCpu)
+{
+  cv::RNG rng(123);
+
+  Image1f range(480, 640);
+  rng.fill(range, cv::RNG::UNIFORM, 1.0f, 10.0f);
+  cv::GaussianBlur(range, range, cv::Size(15, 15), 5.0);
+  range(0, 0) = 0;   // Missing range.
+
+  Image3f bgr(range.size());
+  rng.fill(bgr, cv::RNG::UNIFORM, 0.0f, 1.0f);
+
+  const Vector3f B(0.132, 0.115, 0.0559);
+  const Vector3f beta_B(0.358, 0.695, 1.11);
+  const Vector12f X = BetaInitialGuess2();
+
+  cu::GpuMat d_bgr, d_range, d_D, d_il, d_J;
+  d_bgr.upload(bgr);
+  d_range.upload(range);
+
+  // Backscatter removal.
+  Image3f D;
+  RemoveBackscatter(bgr, range, B, beta_B, D);
+  RemoveBackscatter(d_bgr, d_range, B, beta_B, d_D);
+  Image3f D_gpu;
+  d_D.download(D_gpu);
+  EXPECT_LT(MaxAbsDiff(D, D_gpu), 1e-4);
+
+  // The illuminant (the GPU version fuses the factor of 2).
+  const int r = 640 / 3;
+  const double eps = 0.01;
+  const int s = 8;
+
+  GuidedFilter filter;
+  cv::Mat il;
+  filter.SetGuide(range, r, eps, s);
+  filter.Filter(D, il);
+  il *= 2.0f;
+
+  Timer timer(true);
+  GuidedFilterGpu filter_gpu;
+  filter_gpu.SetGuide(d_range, r, eps, s);
+  filter_gpu.Filter(d_D, d_il, 2.0f);
+  cu::Stream::Null().waitForCompletion();
+  LOG(INFO) << "GuidedFilterGpu: " << timer.Tock().milliseconds() << " ms" << std::endl;
+
+  Image3f il_gpu;
+  d_il.download(il_gpu);
+  EXPECT_LT(MaxAbsDiff(il, il_gpu), 1e-3);
+
+  // Attenuation correction (the CPU version interpolates its gains from a table).
+  double rmin, rmax;
+  cv::minMaxLoc(range, &rmin, &rmax);
+  Image3f J;
+  CorrectAttenuation(D, range, X, J);
+  CorrectAttenuation(d_D, d_range, X, static_cast<float>(rmax), d_J);
+  Image3f J_gpu;
+  d_J.download(J_gpu);
+  EXPECT_LT(MaxAbsDiff(J, J_gpu), 1e-3);
+}
+
+
+TEST(EnhanceGpuTest, TestEnhancer)
+{
+  cv::RNG rng(123);
+
+  Image1f range(240, 320);
+  rng.fill(range, cv::RNG::UNIFORM, 1.0f, 10.0f);
+
+  Image3f bgr(range.size());
+  rng.fill(bgr, cv::RNG::UNIFORM, 0.0f, 1.0f);
+
+  UnderwaterEnhancer::Params params;
+  params.refit_every_n_frames = 3;
+  params.refit_error_ratio = 0;
+  UnderwaterEnhancerGpu enhancer(params);
+
+  Image3f out;
+  for (int i = 0; i < 4; ++i) {
+    enhancer.Enhance(bgr, range, out);
+    EXPECT_EQ(i == 0 || i == 3, enhancer.LastFrameWasRefit());
+    EXPECT_EQ(bgr.size(), out.size());
+  }
+}
@@ -164,3 +164,30 @@ TEST(EnhanceTest, TestSeathruDataset)
     cv::waitKey(0);
   }
 }
+
+
+TEST(EnhanceTest, TestReducedResolution)
+{
+  cv::RNG rng(123);
+
+  // A smooth range with a step in it.
+  Image1f range(480, 640);
+  rng.fill(range, cv::RNG::UNIFORM, 2.0f, 4.0f);
+  cv::GaussianBlur(range, range, cv::Size(31, 31), 15.0);
+  range.colRange(320, 640) += 1.0f;
+
+  Image3f bgr(range.size());
+  rng.fill(bgr, cv::RNG::UNIFORM, 0.0f, 0.5f);
+
+  // With no optimizer iterations, both runs use the same (initial guess) model, so they should only
+  // differ by the upsampling of the correction fields.
+  Image3f J_full, J_reduced;
+  EnhanceUnderwater(bgr, range, 256, 0, 256, 0, BetaInitialGuess2(), J_full);
+
+  Timer timer(true);
+  EnhanceUnderwater(bgr, range, 256, 0, 256, 0, BetaInitialGuess2(), J_reduced, 4);
+  printf("Took %lf ms to enhance at 1/4 scale\n", timer.Tock().milliseconds());
+
+  ASSERT_EQ(J_full.size(), J_reduced.size());
+  EXPECT_LT(cv::norm(J_full, J_reduced, cv::NORM_L1) / cv::norm(J_full, cv::NORM_L1), 0.02);
+}
@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+
+#include <glog/logging.h>
+
+#include "opencv2/imgproc.hpp"
+
+#include "core/timer.hpp"
+#include "imaging/fast_guided_filter.hpp"
+#include "imaging/guided_filter.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+static float MaxAbsDiff(const cv::Mat& a, const cv::Mat& b)
+{
+  double max_val = 0;
+  cv::minMaxLoc(cv::abs(a - b).reshape(1), nullptr, &max_val);
+  return static_cast<float>(max_val);
+}
+
+
+TEST(GuidedFilterTest, TestBoxFilter)
+{
+  cv::RNG rng(123);
+
+  for (const int cn : { 1, 3, 6 }) {
+    for (const int ksize : { 1, 5, 31 }) {
+      cv::Mat src(47, 63, CV_32FC(cn));
+      rng.fill(src, cv::RNG::UNIFORM, 0.0f, 1.0f);
+
+      cv::Mat expected;
+      cv::blur(src, expected, cv::Size(ksize, ksize));
+
+      cv::Mat tmp, dst;
+      std::vector<double> col_sums;
+      BoxFilter(src, ksize, tmp, col_sums, dst);
+
+      EXPECT_LT(MaxAbsDiff(expected, dst), 1e-5) << "cn=" << cn << " ksize=" << ksize;
+    }
+  }
+}
+
+
+TEST(GuidedFilterTest, TestSameAsFastGuidedFilter)
+{
+  cv::RNG rng(123);
+
+  Image1f range(480, 640);
+  rng.fill(range, cv::RNG::UNIFORM, 1.0f, 10.0f);
+  cv::GaussianBlur(range, range, cv::Size(15, 15), 5.0);
+
+  Image3f bgr(range.size());
+  rng.fill(bgr, cv::RNG::UNIFORM, 0.0f, 1.0f);
+
+  const int r = 640 / 3;
+  const double eps = 0.01;
+  const int s = 8;
+
+  Timer timer(true);
+  const Image3f expected = fastGuidedFilter(range, bgr, r, eps, s);
+  LOG(INFO) << "fastGuidedFilter: " << timer.Tock().milliseconds() << " ms" << std::endl;
+
+  GuidedFilter filter;
+  cv::Mat q;
+  EXPECT_TRUE(filter.SetGuide(range, r, eps, s));
+  filter.Filter(bgr, q);
+  LOG(INFO) << "GuidedFilter (new guide): " << timer.Tock().milliseconds() << " ms" << std::endl;
+
+  EXPECT_LT(MaxAbsDiff(expected, q), 1e-3);
+
+  // The same guide again should keep the cached statistics.
+  EXPECT_FALSE(filter.SetGuide(range, r, eps, s));
+  filter.Filter(bgr, q);
+  LOG(INFO) << "GuidedFilter (same guide): " << timer.Tock().milliseconds() << " ms" << std::endl;
+  EXPECT_LT(MaxAbsDiff(expected, q), 1e-3);
+
+  // Any change to the guide or params recomputes them.
+  range(10, 10) += 1.0f;
+  EXPECT_TRUE(filter.SetGuide(range, r, eps, s));
+  EXPECT_TRUE(filter.SetGuide(range, r, 2*eps, s));
+}
@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+
+#include <glog/logging.h>
+
+#include "opencv2/imgproc.hpp"
+
+#include "core/timer.hpp"
+#include "imaging/normalization.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+// A smooth, dim image with a blue-green cast, like an underwater frame.
+static Image3f MakeTestImage()
+{
+  Image3f bgr(480, 640);
+  for (int r = 0; r < bgr.rows; ++r) {
+    for (int c = 0; c < bgr.cols; ++c) {
+      const float t = static_cast<float>(c) / bgr.cols;
+      const float u = static_cast<float>(r) / bgr.rows;
+      bgr(r, c) = cv::Vec3f(0.2f + 0.3f*t, 0.15f + 0.25f*u, 0.05f + 0.1f*t*u);
+    }
+  }
+  return bgr;
+}
+
+
+TEST(NormalizationTest, TestGammaLut)
+{
+  const GammaLut lut(0.4545f);
+  for (int i = 0; i <= 1000; ++i) {
+    const float v = static_cast<float>(i) / 1000.0f;
+    EXPECT_NEAR(std::pow(v, 0.4545f), lut(v), (v < 1e-3f) ? 1e-2 : 1e-4);
+  }
+
+  EXPECT_EQ(0.0f, lut(-1.0f));
+  EXPECT_EQ(1.0f, lut(2.0f));
+}
+
+
+TEST(NormalizationTest, TestColorPipeline)
+{
+  const Image3f bgr = MakeTestImage();
+
+  Timer timer(true);
+  const Image3f expected = LinearToGamma(Normalize(WhiteBalanceSimple(bgr)));
+  LOG(INFO) << "Separate stages: " << timer.Tock().milliseconds() << " ms" << std::endl;
+
+  ColorPipeline::Params params;
+  params.white_balance = true;
+  params.normalize = true;
+  params.output_gamma = 0.4545f;
+  ColorPipeline pipeline(params);
+
+  Image3f out = bgr.clone();
+  timer.Tock();
+  pipeline.Apply(out);
+  LOG(INFO) << "ColorPipeline: " << timer.Tock().milliseconds() << " ms" << std::endl;
+
+  // NOTE(milo): Normalize() takes the min/max value from a downsampled V channel, and the pipeline
+  // from the V of a downsampled image, so they aren't exactly the same.
+  Image3f diff = cv::abs(cv::max(cv::min(expected, 1.0f), 0.0f) - out);
+  const cv::Scalar mean_diff = cv::mean(diff);
+  for (int ch = 0; ch < 3; ++ch) {
+    EXPECT_LT(mean_diff(ch), 0.02);
+  }
+
+  // The 8-bit path should match converting to float first.
+  Image3b bgr8;
+  bgr.convertTo(bgr8, CV_8UC3, 255.0);
+  Image3f from8, expected8;
+  bgr8.convertTo(expected8, CV_32FC3, 1.0 / 255.0);
+  pipeline.Apply(expected8);
+  pipeline.Apply(bgr8, from8);
+
+  diff = cv::abs(expected8 - from8);
+  const cv::Scalar mean_diff8 = cv::mean(diff);
+  for (int ch = 0; ch < 3; ++ch) {
+    EXPECT_LT(mean_diff8(ch), 0.01);
+  }
+}
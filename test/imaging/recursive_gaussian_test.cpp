@@ -0,0 +1,70 @@
+#include "gtest/gtest.h"
+
+#include <glog/logging.h>
+
+#include "opencv2/imgproc.hpp"
+
+#include "core/timer.hpp"
+#include "imaging/recursive_gaussian.hpp"
+#include "imaging/illuminant.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+static float MaxAbsDiff(const cv::Mat& a, const cv::Mat& b)
+{
+  double max_val = 0;
+  cv::minMaxLoc(cv::abs(a - b).reshape(1), nullptr, &max_val);
+  return static_cast<float>(max_val);
+}
+
+
+TEST(RecursiveGaussianTest, TestSameAsGaussianBlur)
+{
+  cv::RNG rng(123);
+
+  for (const int cn : { 1, 3 }) {
+    for (const double sigma : { 3.0, 10.0, 40.0 }) {
+      cv::Mat src(120, 160, CV_32FC(cn));
+      rng.fill(src, cv::RNG::UNIFORM, 0.0f, 1.0f);
+      cv::GaussianBlur(src, src, cv::Size(0, 0), 2.0);
+
+      // A kernel big enough that truncating it doesn't matter.
+      const int ksize = 2 * static_cast<int>(5 * sigma) + 1;
+      cv::Mat expected, dst;
+      cv::GaussianBlur(src, expected, cv::Size(ksize, ksize), sigma, sigma, cv::BORDER_REPLICATE);
+      RecursiveGaussian(src, sigma, sigma, dst);
+
+      EXPECT_LT(MaxAbsDiff(expected, dst), 5e-3) << "cn=" << cn << " sigma=" << sigma;
+    }
+  }
+}
+
+
+TEST(RecursiveGaussianTest, TestConstantImage)
+{
+  // The border is replicated, so a constant image stays constant all the way to the edges.
+  const cv::Mat src(31, 17, CV_32FC3, cv::Scalar(0.25, 0.5, 0.75));
+  cv::Mat dst;
+  RecursiveGaussian(src, 20.0, 7.0, dst);
+  EXPECT_LT(MaxAbsDiff(src, dst), 1e-5);
+}
+
+
+TEST(RecursiveGaussianTest, TestIlluminantTiming)
+{
+  cv::RNG rng(123);
+  Image3f bgr(1080, 1920);
+  rng.fill(bgr, cv::RNG::UNIFORM, 0.0f, 1.0f);
+
+  const int ksize = 1920 / 3 + 1;
+  const double sigma = ksize / 4.0;
+
+  Timer timer(true);
+  EstimateIlluminantGaussian(bgr, ksize, ksize, sigma, sigma, GaussianBackend::OPENCV);
+  LOG(INFO) << "cv::GaussianBlur: " << timer.Tock().milliseconds() << " ms" << std::endl;
+  EstimateIlluminantGaussian(bgr, ksize, ksize, sigma, sigma, GaussianBackend::RECURSIVE);
+  LOG(INFO) << "RecursiveGaussian: " << timer.Tock().milliseconds() << " ms" << std::endl;
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "lcm_util/imu_batch_publisher.hpp"
+#include "lcm_util/util_imu_measurement_t.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static ImuMeasurement MakeImu(timestamp_t t)
+{
+  return ImuMeasurement(t, Vector3d(0.1, 0.2, 0.001 * t), Vector3d(1.0, -9.81, 0.5));
+}
+
+
+TEST(ImuBatchPublisherTest, PackDecode)
+{
+  ImuMeasurementVec imu;
+  for (timestamp_t t = 1000000000; t < 1050000000; t += 5000000) {
+    imu.emplace_back(MakeImu(t));
+  }
+
+  vehicle::imu_measurement_batch_t msg;
+  pack_imu_measurement_batch_t(imu.data(), imu.size(), msg);
+  EXPECT_EQ(10, msg.num_samples);
+  EXPECT_EQ(1000000000, msg.header.timestamp);
+  EXPECT_EQ(0, msg.dt_ns.front());
+  EXPECT_EQ(45000000, msg.dt_ns.back());
+
+  ImuMeasurementVec out;
+  decode_imu_measurement_batch_t(msg, out);
+  ASSERT_EQ(imu.size(), out.size());
+  for (size_t i = 0; i < imu.size(); ++i) {
+    EXPECT_EQ(imu.at(i).timestamp, out.at(i).timestamp);
+    EXPECT_EQ(imu.at(i).a, out.at(i).a);
+    EXPECT_EQ(imu.at(i).w, out.at(i).w);
+  }
+}
+
+
+struct BatchHandler final
+{
+  void Handle(const lcm::ReceiveBuffer*, const std::string&, const vehicle::imu_measurement_batch_t* msg)
+  {
+    ImuMeasurementVec imu;
+    decode_imu_measurement_batch_t(*msg, imu);
+    batches.emplace_back(imu);
+  }
+
+  std::vector<ImuMeasurementVec> batches;
+};
+
+
+TEST(ImuBatchPublisherTest, MaxSamplesAndLatency)
+{
+  lcm::LCM lcm("memq://");
+  ASSERT_TRUE(lcm.good());
+
+  BatchHandler handler;
+  lcm.subscribe("imu_batch", &BatchHandler::Handle, &handler);
+
+  // 200 Hz, so the 20 ms latency bound goes first.
+  ImuBatchPublisher pub(lcm, "imu_batch", "imu", 10, 0.02);
+  for (int i = 0; i < 10; ++i) {
+    pub.Push(MakeImu(5000000 * i));
+  }
+  while (lcm.handleTimeout(0) > 0);
+  ASSERT_EQ(2ul, handler.batches.size());
+  EXPECT_EQ(5ul, handler.batches.at(0).size());
+  EXPECT_EQ(5ul, handler.batches.at(1).size());
+  EXPECT_EQ(20000000ul, handler.batches.at(0).back().timestamp);
+
+  // With a looser latency bound, batches are limited by max_samples.
+  handler.batches.clear();
+  ImuBatchPublisher pub_slow(lcm, "imu_batch", "imu", 4, 1.0);
+  for (int i = 0; i < 10; ++i) {
+    pub_slow.Push(MakeImu(5000000 * i));
+  }
+  pub_slow.Flush();
+  while (lcm.handleTimeout(0) > 0);
+  ASSERT_EQ(3ul, handler.batches.size());
+  EXPECT_EQ(4ul, handler.batches.at(0).size());
+  EXPECT_EQ(2ul, handler.batches.at(2).size());
+  EXPECT_EQ(3, pub_slow.NumPublished());
+
+  // An out of order measurement starts a new batch.
+  handler.batches.clear();
+  pub_slow.Push(MakeImu(100));
+  pub_slow.Push(MakeImu(50));
+  pub_slow.Flush();
+  while (lcm.handleTimeout(0) > 0);
+  ASSERT_EQ(2ul, handler.batches.size());
+  EXPECT_EQ(50ul, handler.batches.at(1).front().timestamp);
+}
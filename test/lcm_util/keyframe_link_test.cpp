@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include "lcm_util/keyframe_link.hpp"
+
+using namespace bm;
+
+typedef KeyframeSender<int> Sender;
+
+
+static Sender::ItemPtr Item(int i) { return std::make_shared<const int>(i); }
+
+
+TEST(KeyframeLinkTest, TestFlowControl)
+{
+  KeyframeLinkParams params;
+  params.max_in_flight = 2;
+  params.retransmit_sec = 1.0;
+  params.max_retries = 1;
+  params.worker_timeout_sec = 5.0;
+  Sender sender(params);
+
+  // No workers yet.
+  Sender::Outgoing out;
+  EXPECT_FALSE(sender.Send(0, Item(0), 0.0, out));
+  EXPECT_EQ(1ul, sender.NumDropped());
+
+  // A worker with room for 3, but only 2 can be in flight.
+  sender.HandleAck("a", -1, 3, 0.0);
+  EXPECT_TRUE(sender.Send(0, Item(1), 0.1, out));
+  EXPECT_EQ("a", out.worker);
+  EXPECT_EQ(1, *out.item);
+  const int32_t seq1 = out.seq;
+  EXPECT_TRUE(sender.Send(0, Item(2), 0.2, out));
+  const int32_t seq2 = out.seq;
+  EXPECT_NE(seq1, seq2);
+  EXPECT_FALSE(sender.Send(0, Item(3), 0.3, out));
+  EXPECT_EQ(2ul, sender.NumPending());
+
+  // The first one is queued, and now the worker only has room for 1 more. The second one is still
+  // on its way, so nothing else fits.
+  sender.HandleAck("a", seq1, 1, 0.4);
+  EXPECT_EQ(1ul, sender.NumAcked());
+  EXPECT_FALSE(sender.Send(0, Item(4), 0.5, out));
+
+  // The second one is lost, resent once, then given up on.
+  std::vector<Sender::Outgoing> resend;
+  sender.Retransmits(1.0, resend);
+  EXPECT_TRUE(resend.empty());
+  sender.Retransmits(1.2, resend);
+  ASSERT_EQ(1ul, resend.size());
+  EXPECT_EQ(seq2, resend.at(0).seq);
+  EXPECT_EQ(2, *resend.at(0).item);
+  sender.Retransmits(2.3, resend);
+  EXPECT_TRUE(resend.empty());
+  EXPECT_EQ(1ul, sender.NumLost());
+  EXPECT_EQ(0ul, sender.NumPending());
+
+  // Nothing goes to that worker until it's heard from again.
+  EXPECT_FALSE(sender.Send(0, Item(5), 2.4, out));
+  sender.HandleAck("a", -1, 4, 2.5);
+  EXPECT_TRUE(sender.Send(0, Item(6), 2.6, out));
+
+  // Or once it times out.
+  EXPECT_EQ(1ul, sender.NumAliveWorkers(7.0));
+  EXPECT_EQ(0ul, sender.NumAliveWorkers(8.0));
+  sender.HandleAck("a", out.seq, 4, 2.7);
+  EXPECT_FALSE(sender.Send(0, Item(7), 8.0, out));
+}
+
+
+TEST(KeyframeLinkTest, TestAffinity)
+{
+  KeyframeLinkParams params;
+  params.max_in_flight = 4;
+  Sender sender(params);
+
+  sender.HandleAck("a", -1, 4, 0.0);
+  sender.HandleAck("b", -1, 4, 0.0);
+
+  // Key 0 goes to a (tie), then key 1 goes to b (more room), and they stick.
+  Sender::Outgoing out;
+  ASSERT_TRUE(sender.Send(0, Item(0), 0.0, out));
+  EXPECT_EQ("a", out.worker);
+  ASSERT_TRUE(sender.Send(1, Item(1), 0.0, out));
+  EXPECT_EQ("b", out.worker);
+  ASSERT_TRUE(sender.Send(1, Item(2), 0.0, out));
+  EXPECT_EQ("b", out.worker);
+  ASSERT_TRUE(sender.Send(0, Item(3), 0.0, out));
+  EXPECT_EQ("a", out.worker);
+
+  // When b is full, key 1 spills over to a, but b still owns it.
+  ASSERT_TRUE(sender.Send(1, Item(4), 0.0, out));
+  ASSERT_TRUE(sender.Send(1, Item(5), 0.0, out));
+  EXPECT_EQ("b", out.worker);
+  ASSERT_TRUE(sender.Send(1, Item(6), 0.0, out));
+  EXPECT_EQ("a", out.worker);
+  sender.HandleAck("b", out.seq - 1, 4, 0.1);
+  ASSERT_TRUE(sender.Send(1, Item(7), 0.2, out));
+  EXPECT_EQ("b", out.worker);
+}
+
+
+TEST(KeyframeLinkTest, TestReceiver)
+{
+  KeyframeReceiver receiver(3);
+  EXPECT_TRUE(receiver.Accept(0));
+  EXPECT_TRUE(receiver.Accept(1));
+  EXPECT_FALSE(receiver.Accept(0));
+  EXPECT_TRUE(receiver.Accept(2));
+  EXPECT_TRUE(receiver.Accept(3));
+  EXPECT_EQ(1ul, receiver.NumDuplicates());
+  EXPECT_TRUE(receiver.Seen(1));
+  EXPECT_FALSE(receiver.Seen(0));
+
+  // Old enough to be forgotten.
+  EXPECT_TRUE(receiver.Accept(0));
+}
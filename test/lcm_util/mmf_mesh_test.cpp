@@ -0,0 +1,111 @@
+#include <cstdio>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "lcm_util/mmf_mesh.hpp"
+
+using namespace bm;
+using namespace core;
+
+namespace ipc = boost::interprocess;
+
+
+static void MakeMesh(int n, std::vector<Vector3d>& vertices, std::vector<Vector3i>& triangles)
+{
+  vertices.clear();
+  triangles.clear();
+  for (int i = 0; i < n; ++i) {
+    vertices.emplace_back(i, 2*i, -0.5*i);
+  }
+  for (int i = 0; i + 2 < n; ++i) {
+    triangles.emplace_back(i, i + 1, i + 2);
+  }
+}
+
+
+TEST(MmfMeshTest, TestWriteRead)
+{
+  const std::string mm_filename = "/tmp/mmf_mesh_test.bin";
+  MmfMeshWriter writer(mm_filename, 2, MmfMeshBytes(10, 8));
+
+  ipc::file_mapping file(mm_filename.c_str(), ipc::read_only);
+  ipc::mapped_region region(file, ipc::read_only);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(region.get_address());
+
+  std::vector<Vector3d> vertices, vertices_out;
+  std::vector<Vector3i> triangles, triangles_out;
+  MakeMesh(10, vertices, triangles);
+
+  vehicle::mmf_mesh_stamped_t msg0;
+  ASSERT_TRUE(writer.Write(vertices, triangles, msg0));
+  EXPECT_EQ(0, msg0.slot);
+  EXPECT_EQ(10, msg0.num_vertices);
+  EXPECT_EQ(8, msg0.num_triangles);
+
+  ASSERT_TRUE(ReadMmfMesh(msg0, data + msg0.offset, vertices_out, triangles_out));
+  EXPECT_EQ(vertices, vertices_out);
+  EXPECT_EQ(triangles, triangles_out);
+
+  // The second mesh goes in the other slot, so the first one is still readable.
+  MakeMesh(5, vertices, triangles);
+  vehicle::mmf_mesh_stamped_t msg1;
+  ASSERT_TRUE(writer.Write(vertices, triangles, msg1));
+  EXPECT_EQ(1, msg1.slot);
+  EXPECT_TRUE(ReadMmfMesh(msg0, data + msg0.offset, vertices_out, triangles_out));
+
+  // Once the ring wraps around, the first message is stale.
+  vehicle::mmf_mesh_stamped_t msg2;
+  ASSERT_TRUE(writer.Write(vertices, triangles, msg2));
+  EXPECT_EQ(0, msg2.slot);
+  EXPECT_FALSE(ReadMmfMesh(msg0, data + msg0.offset, vertices_out, triangles_out));
+  ASSERT_TRUE(ReadMmfMesh(msg2, data + msg2.offset, vertices_out, triangles_out));
+  EXPECT_EQ(vertices, vertices_out);
+
+  // Too big for a slot.
+  MakeMesh(11, vertices, triangles);
+  vehicle::mmf_mesh_stamped_t msg3;
+  EXPECT_FALSE(writer.Write(vertices, triangles, msg3));
+
+  std::remove(mm_filename.c_str());
+}
+
+
+TEST(MmfMeshTest, TestFloatVertices)
+{
+  const std::string mm_filename = "/tmp/mmf_mesh_float_test.bin";
+  MmfMeshWriter writer(mm_filename, 2, MmfMeshBytes(10, 8, true), true);
+
+  // Doubles would need more room.
+  EXPECT_LT(MmfMeshBytes(10, 8, true), MmfMeshBytes(10, 8));
+
+  ipc::file_mapping file(mm_filename.c_str(), ipc::read_only);
+  ipc::mapped_region region(file, ipc::read_only);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(region.get_address());
+
+  std::vector<Vector3d> vertices, vertices_out;
+  std::vector<Vector3i> triangles, triangles_out;
+  MakeMesh(10, vertices, triangles);
+
+  vehicle::mmf_mesh_stamped_t msg;
+  ASSERT_TRUE(writer.Write(vertices, triangles, msg));
+  EXPECT_TRUE(msg.float_vertices);
+
+  // The test vertices are exact in float32.
+  ASSERT_TRUE(ReadMmfMesh(msg, data + msg.offset, vertices_out, triangles_out));
+  EXPECT_EQ(vertices, vertices_out);
+  EXPECT_EQ(triangles, triangles_out);
+
+  std::vector<float> vertices_f;
+  std::vector<int32_t> triangles_f;
+  ASSERT_TRUE(ReadMmfMesh(msg, data + msg.offset, vertices_f, triangles_f));
+  ASSERT_EQ(30ul, vertices_f.size());
+  ASSERT_EQ(24ul, triangles_f.size());
+  EXPECT_EQ(2.0f, vertices_f.at(3 * 1 + 1));
+  EXPECT_EQ(9, triangles_f.back());
+
+  std::remove(mm_filename.c_str());
+}
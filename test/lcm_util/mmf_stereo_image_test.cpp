@@ -0,0 +1,203 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "lcm_util/decode_image.hpp"
+#include "lcm_util/mmf_stereo_image.hpp"
+
+using namespace bm;
+using namespace core;
+
+namespace ipc = boost::interprocess;
+
+
+static bool SameImage(const cv::Mat& a, const cv::Mat& b)
+{
+  return a.size() == b.size() && a.type() == b.type() && cv::countNonZero(a != b) == 0;
+}
+
+
+TEST(MmfStereoImageTest, TestWriteDecode)
+{
+  const std::string mm_filename = "/tmp/mmf_stereo_image_test.bin";
+  const int height = 31;
+  const int width = 45;   // Odd sizes, so the right block has to be padded.
+  MmfStereoImageWriter writer(mm_filename, height, width, 3);
+
+  ipc::file_mapping file(mm_filename.c_str(), ipc::read_only);
+  ipc::mapped_region region(file, ipc::read_only);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(region.get_address());
+
+  Image3b left(height, width), right(height, width);
+  cv::randu(left, cv::Scalar::all(0), cv::Scalar::all(255));
+  cv::randu(right, cv::Scalar::all(0), cv::Scalar::all(255));
+
+  vehicle::mmf_stereo_image_t msg;
+  writer.Write(left, right, msg);
+
+  EXPECT_EQ(mm_filename, msg.img_left.mm_filename);
+  EXPECT_EQ("bgr8", msg.img_left.format);
+  EXPECT_EQ("raw", msg.img_right.encoding);
+  EXPECT_EQ(0, msg.img_left.offset);
+  EXPECT_EQ(0, msg.img_right.offset % 8);
+
+  Image1b left_gray, right_gray, expected;
+  ASSERT_TRUE(DecodeToGray(msg.img_left, data + msg.img_left.offset, left_gray));
+  ASSERT_TRUE(DecodeToGray(msg.img_right, data + msg.img_right.offset, right_gray));
+
+  cv::cvtColor(left, expected, cv::COLOR_BGR2GRAY);
+  EXPECT_TRUE(SameImage(expected, left_gray));
+  cv::cvtColor(right, expected, cv::COLOR_BGR2GRAY);
+  EXPECT_TRUE(SameImage(expected, right_gray));
+}
+
+
+TEST(MmfStereoImageTest, TestMonoROI)
+{
+  const std::string mm_filename = "/tmp/mmf_stereo_image_test_mono.bin";
+  MmfStereoImageWriter writer(mm_filename, 20, 30, 1);
+
+  ipc::file_mapping file(mm_filename.c_str(), ipc::read_only);
+  ipc::mapped_region region(file, ipc::read_only);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(region.get_address());
+
+  // A ROI has a step that's larger than the row, which the writer has to skip over.
+  Image1b full(40, 50);
+  cv::randu(full, cv::Scalar::all(0), cv::Scalar::all(255));
+  const Image1b left = full(cv::Rect(3, 5, 30, 20));
+  const Image1b right = full(cv::Rect(10, 15, 30, 20));
+
+  vehicle::mmf_stereo_image_t msg;
+  writer.Write(left, right, msg);
+  EXPECT_EQ("mono8", msg.img_left.format);
+
+  Image1b left_out, right_out;
+  ASSERT_TRUE(DecodeToGray(msg.img_left, data + msg.img_left.offset, left_out));
+  ASSERT_TRUE(DecodeToGray(msg.img_right, data + msg.img_right.offset, right_out));
+  EXPECT_TRUE(SameImage(left, left_out));
+  EXPECT_TRUE(SameImage(right, right_out));
+}
+
+
+TEST(MmfStereoImageTest, TestSlots)
+{
+  const std::string mm_filename = "/tmp/mmf_stereo_image_test_slots.bin";
+  MmfStereoImageWriter writer(mm_filename, 8, 16, 1, 3);
+  EXPECT_EQ(3, writer.NumSlots());
+
+  ipc::file_mapping file(mm_filename.c_str(), ipc::read_only);
+  ipc::mapped_region region(file, ipc::read_only);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(region.get_address());
+
+  // Each pair goes in the next slot, so the older ones can still be read until the ring wraps.
+  std::vector<vehicle::mmf_stereo_image_t> msgs(4);
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(writer.Write(Image1b(8, 16, 10 * i), Image1b(8, 16, 10 * i + 1), msgs.at(i)));
+  }
+  EXPECT_EQ(0, msgs.at(0).img_left.offset);
+  EXPECT_EQ(msgs.at(0).img_left.offset, msgs.at(3).img_left.offset);
+  EXPECT_NE(msgs.at(0).img_left.offset, msgs.at(1).img_left.offset);
+  EXPECT_NE(msgs.at(1).img_right.offset, msgs.at(2).img_right.offset);
+
+  Image1b out;
+  ASSERT_TRUE(DecodeToGray(msgs.at(1).img_left, data + msgs.at(1).img_left.offset, out));
+  EXPECT_EQ(10, out(0, 0));
+  ASSERT_TRUE(DecodeToGray(msgs.at(2).img_right, data + msgs.at(2).img_right.offset, out));
+  EXPECT_EQ(21, out(0, 0));
+  ASSERT_TRUE(DecodeToGray(msgs.at(3).img_left, data + msgs.at(3).img_left.offset, out));
+  EXPECT_EQ(30, out(0, 0));
+}
+
+
+TEST(MmfStereoImageTest, TestJpg)
+{
+  const std::string mm_filename = "/tmp/mmf_stereo_image_test_jpg.bin";
+  MmfStereoImageWriter writer(mm_filename, 24, 32, 1, 2, "jpg", 100);
+
+  ipc::file_mapping file(mm_filename.c_str(), ipc::read_only);
+  ipc::mapped_region region(file, ipc::read_only);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(region.get_address());
+
+  const Image1b left(24, 32, 100), right(24, 32, 200);
+  vehicle::mmf_stereo_image_t msg;
+  ASSERT_TRUE(writer.Write(left, right, msg));
+  EXPECT_EQ("jpg", msg.img_left.encoding);
+  EXPECT_LT(msg.img_left.size, 24 * 32);
+
+  Image1b out;
+  ASSERT_TRUE(DecodeToGray(msg.img_left, data + msg.img_left.offset, out));
+  EXPECT_NEAR(100, out(10, 10), 2);
+  ASSERT_TRUE(DecodeToGray(msg.img_right, data + msg.img_right.offset, out));
+  EXPECT_NEAR(200, out(10, 10), 2);
+}
+
+
+TEST(MmfStereoImageTest, TestDecodeReduced)
+{
+  const std::string mm_filename = "/tmp/mmf_stereo_image_test_reduced.bin";
+  MmfStereoImageWriter raw_writer(mm_filename, 32, 48, 3);
+  MmfStereoImageWriter jpg_writer(mm_filename + ".jpg", 32, 48, 1, 1, "jpg", 100);
+
+  ipc::file_mapping raw_file(mm_filename.c_str(), ipc::read_only);
+  ipc::mapped_region raw_region(raw_file, ipc::read_only);
+  const uint8_t* raw_data = reinterpret_cast<const uint8_t*>(raw_region.get_address());
+
+  ipc::file_mapping jpg_file((mm_filename + ".jpg").c_str(), ipc::read_only);
+  ipc::mapped_region jpg_region(jpg_file, ipc::read_only);
+  const uint8_t* jpg_data = reinterpret_cast<const uint8_t*>(jpg_region.get_address());
+
+  Image3b left(32, 48, cv::Vec3b(10, 20, 30));
+  vehicle::mmf_stereo_image_t msg;
+  ASSERT_TRUE(raw_writer.Write(left, left, msg));
+
+  cv::Mat out;
+  ASSERT_TRUE(DecodeReduced(msg.img_left, raw_data + msg.img_left.offset, 4, out));
+  EXPECT_EQ(cv::Size(12, 8), out.size());
+  EXPECT_EQ(CV_8UC3, out.type());
+  EXPECT_EQ(cv::Vec3b(10, 20, 30), out.at<cv::Vec3b>(4, 4));
+
+  ASSERT_TRUE(jpg_writer.Write(Image1b(32, 48, 100), Image1b(32, 48, 200), msg));
+  ASSERT_TRUE(DecodeReduced(msg.img_right, jpg_data + msg.img_right.offset, 2, out));
+  EXPECT_EQ(cv::Size(24, 16), out.size());
+  EXPECT_EQ(CV_8UC1, out.type());
+  EXPECT_NEAR(200, out.at<uint8_t>(8, 8), 2);
+}
+
+
+TEST(MmfStereoImageTest, TestDecodeToGrayScaled)
+{
+  const std::string mm_filename = "/tmp/mmf_stereo_image_test_gray_scaled.bin";
+  MmfStereoImageWriter raw_writer(mm_filename, 30, 44, 3);
+  MmfStereoImageWriter jpg_writer(mm_filename + ".jpg", 30, 44, 1, 1, "jpg", 100);
+
+  ipc::file_mapping raw_file(mm_filename.c_str(), ipc::read_only);
+  ipc::mapped_region raw_region(raw_file, ipc::read_only);
+  const uint8_t* raw_data = reinterpret_cast<const uint8_t*>(raw_region.get_address());
+
+  ipc::file_mapping jpg_file((mm_filename + ".jpg").c_str(), ipc::read_only);
+  ipc::mapped_region jpg_region(jpg_file, ipc::read_only);
+  const uint8_t* jpg_data = reinterpret_cast<const uint8_t*>(jpg_region.get_address());
+
+  // Odd sizes round up, so that raw and JPG images come out the same size.
+  EXPECT_EQ(cv::Size(11, 8), DecodedSize(44, 30, 4));
+  EXPECT_EQ(cv::Size(22, 15), DecodedSize(44, 30, 2));
+
+  const Image3b left(30, 44, cv::Vec3b(10, 20, 30));
+  vehicle::mmf_stereo_image_t msg;
+  ASSERT_TRUE(raw_writer.Write(left, left, msg));
+
+  Image1b out, expected;
+  ASSERT_TRUE(DecodeToGray(msg.img_left, raw_data + msg.img_left.offset, out, 4));
+  cv::cvtColor(left, expected, cv::COLOR_BGR2GRAY);
+  EXPECT_EQ(cv::Size(11, 8), out.size());
+  EXPECT_EQ(expected(0, 0), out(4, 4));
+
+  ASSERT_TRUE(jpg_writer.Write(Image1b(30, 44, 100), Image1b(30, 44, 200), msg));
+  ASSERT_TRUE(DecodeToGray(msg.img_right, jpg_data + msg.img_right.offset, out, 2));
+  EXPECT_EQ(cv::Size(22, 15), out.size());
+  EXPECT_NEAR(200, out(8, 8), 2);
+}
@@ -0,0 +1,41 @@
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "lcm_util/image_subscriber.hpp"
+#include "lcm_util/mmf_stereo_publisher.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(MmfStereoPublisherTest, ToImageSubscriber)
+{
+  lcm::LCM lcm("memq://");
+  ASSERT_TRUE(lcm.good());
+
+  // Decode synchronously, so that the callback has run once the message is handled.
+  ImageSubscriber sub(lcm, "stereo", true, false);
+  std::vector<StereoImage1b> received;
+  sub.RegisterCallback([&received](const StereoImage1b& stereo_pair) {
+    received.emplace_back(stereo_pair.timestamp, stereo_pair.camera_id,
+                          stereo_pair.left_image.clone(), stereo_pair.right_image.clone());
+  });
+
+  MmfStereoPublisher pub(lcm, "stereo", "test", "/tmp/mmf_stereo_publisher_test.bin", 12, 20, 1, 2);
+  // NOTE(milo): Handle each message before the ring wraps around to its slot.
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(pub.Publish(1000 + i, Image1b(12, 20, 50 + i), Image1b(12, 20, 150 + i)));
+    while (lcm.handleTimeout(0) > 0);
+  }
+  EXPECT_EQ(3, pub.NumPublished());
+  ASSERT_EQ(3ul, received.size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(1000ul + i, received.at(i).timestamp);
+    EXPECT_EQ((uid_t)i, received.at(i).camera_id);
+    EXPECT_EQ(50 + i, received.at(i).left_image(5, 5));
+    EXPECT_EQ(150 + i, received.at(i).right_image(5, 5));
+  }
+}
@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+
+#include "lcm_util/util_mesh_t.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(UtilMeshTest, PackDecode)
+{
+  std::vector<Vector3d> vertices;
+  for (int i = 0; i < 5; ++i) {
+    vertices.emplace_back(0.1 * i, -2.0 * i, 3.0 + i);
+  }
+  const std::vector<Vector3i> triangles = { Vector3i(0, 1, 2), Vector3i(2, 3, 4) };
+
+  vehicle::mesh_t msg;
+  pack_mesh_t(vertices, triangles, msg);
+  EXPECT_EQ(5, msg.num_vertices);
+  EXPECT_EQ(15, msg.num_vertex_coords);
+  EXPECT_EQ(2, msg.num_triangles);
+  EXPECT_EQ(6, msg.num_triangle_indices);
+
+  // The flat arrays are x0 y0 z0 x1 ...
+  EXPECT_EQ(-2.0, msg.vertices.at(4));
+  EXPECT_EQ(3, msg.triangles.at(4));
+
+  EXPECT_EQ(vertices.at(3), view_mesh_t_vertices(msg).col(3));
+  EXPECT_EQ(triangles.at(1), view_mesh_t_triangles(msg).col(1));
+
+  // Decoding into buffers from a bigger mesh shrinks them.
+  std::vector<Vector3d> vertices_out(10);
+  std::vector<Vector3i> triangles_out(10);
+  decode_mesh_t(msg, vertices_out, triangles_out);
+  EXPECT_EQ(vertices, vertices_out);
+  EXPECT_EQ(triangles, triangles_out);
+
+  // An empty mesh has empty arrays.
+  pack_mesh_t({}, {}, msg);
+  EXPECT_EQ(0, msg.num_vertices);
+  EXPECT_TRUE(msg.vertices.empty());
+  EXPECT_TRUE(msg.triangles.empty());
+  decode_mesh_t(msg, vertices_out, triangles_out);
+  EXPECT_TRUE(vertices_out.empty());
+}
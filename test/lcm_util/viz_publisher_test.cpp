@@ -0,0 +1,144 @@
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "lcm_util/util_pose3_t.hpp"
+#include "lcm_util/viz_publisher.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static Matrix4d MakePose(double x)
+{
+  Matrix4d T = Matrix4d::Identity();
+  T.block<3, 3>(0, 0) = Eigen::AngleAxisd(0.1 * x, Vector3d::UnitZ()).toRotationMatrix();
+  T(0, 3) = x;
+  return T;
+}
+
+
+TEST(VizPublisherTest, Deltas)
+{
+  lcm::LCM lcm("memq://");
+  ASSERT_TRUE(lcm.good());
+
+  VizPublisher::Params params;
+  params.max_landmarks_per_msg = 3;
+  params.landmark_move_tolerance = 0.1;
+  params.full_resend_interval = 0;
+  VizPublisher pub(lcm, "viz", params);
+
+  vehicle::viz_update_t msg;
+  EXPECT_FALSE(pub.Pack(msg));
+
+  const Matrix3d cov = Vector3d(1, 2, 3).asDiagonal();
+  pub.AddOrUpdateKeypose(7, MakePose(1), cov);
+  pub.UpdateBodyPose(123, MakePose(2));
+  pub.UpdateBodyPose(456, MakePose(3));
+  pub.AddOrUpdateLandmarks({ 1, 2, 3, 4 }, { Vector3d(1, 0, 0), Vector3d(2, 0, 0), Vector3d(3, 0, 0), Vector3d(4, 0, 0) });
+
+  // Only the latest body pose goes out, and the newest landmarks go first.
+  ASSERT_TRUE(pub.Pack(msg));
+  EXPECT_EQ(0, msg.header.seq);
+  EXPECT_EQ(456, msg.header.timestamp);
+  EXPECT_TRUE(msg.has_body_pose);
+  Matrix4d world_T_body;
+  decode_pose3_t(msg.world_T_body, world_T_body);
+  EXPECT_TRUE(world_T_body.isApprox(MakePose(3), 1e-9));
+
+  ASSERT_EQ(1, msg.num_keyposes);
+  EXPECT_EQ(7, msg.keypose_ids.at(0));
+  EXPECT_EQ(std::vector<float>({ 1, 0, 0, 2, 0, 3 }), msg.cov_position.at(0));
+  Matrix4d world_T_keypose;
+  decode_pose3_t(msg.world_T_keyposes.at(0), world_T_keypose);
+  EXPECT_TRUE(world_T_keypose.isApprox(MakePose(1), 1e-9));
+
+  EXPECT_EQ(std::vector<int32_t>({ 4, 3, 2 }), msg.lmk_ids);
+
+  // The rest of the landmarks go in the next message, which doesn't repeat anything else.
+  ASSERT_TRUE(pub.Pack(msg));
+  EXPECT_FALSE(msg.has_body_pose);
+  EXPECT_EQ(0, msg.num_keyposes);
+  EXPECT_EQ(std::vector<int32_t>({ 1 }), msg.lmk_ids);
+  EXPECT_FALSE(pub.Pack(msg));
+
+  // Landmarks are only resent if they move more than the tolerance.
+  pub.AddOrUpdateLandmarks({ 1, 2 }, { Vector3d(1.05, 0, 0), Vector3d(2.5, 0, 0) });
+  ASSERT_TRUE(pub.Pack(msg));
+  ASSERT_EQ(std::vector<int32_t>({ 2 }), msg.lmk_ids);
+  EXPECT_FLOAT_EQ(2.5, msg.t_world_lmks.at(0).at(0));
+  EXPECT_EQ(3, pub.NumPublished());
+}
+
+
+TEST(VizPublisherTest, FullResend)
+{
+  lcm::LCM lcm("memq://");
+  ASSERT_TRUE(lcm.good());
+
+  VizPublisher::Params params;
+  params.max_keyposes = 2;
+  params.full_resend_interval = 2;
+  VizPublisher pub(lcm, "viz", params);
+
+  for (core::uid_t id = 0; id < 3; ++id) {
+    pub.AddOrUpdateKeypose(id, MakePose(id), Matrix3d::Zero());
+  }
+  pub.AddOrUpdateLandmarks({ 5 }, { Vector3d(5, 0, 0) });
+
+  // Only the newest keyposes are kept.
+  vehicle::viz_update_t msg;
+  ASSERT_TRUE(pub.Pack(msg));
+  EXPECT_EQ(std::vector<int64_t>({ 1, 2 }), msg.keypose_ids);
+
+  pub.UpdateBodyPose(1, MakePose(0));
+  ASSERT_TRUE(pub.Pack(msg));
+  EXPECT_EQ(0, msg.num_keyposes);
+  EXPECT_EQ(0, msg.num_landmarks);
+
+  // Every other message resends everything.
+  ASSERT_TRUE(pub.Pack(msg));
+  EXPECT_TRUE(msg.has_body_pose);
+  EXPECT_EQ(std::vector<int64_t>({ 1, 2 }), msg.keypose_ids);
+  EXPECT_EQ(std::vector<int32_t>({ 5 }), msg.lmk_ids);
+}
+
+
+struct VizHandler final
+{
+  void Handle(const lcm::ReceiveBuffer*, const std::string&, const vehicle::viz_update_t* msg)
+  {
+    seqs.emplace_back(msg->header.seq);
+  }
+
+  std::vector<int64_t> seqs;
+};
+
+
+TEST(VizPublisherTest, PublishThread)
+{
+  lcm::LCM lcm("memq://");
+  ASSERT_TRUE(lcm.good());
+
+  VizHandler handler;
+  lcm.subscribe("viz", &VizHandler::Handle, &handler);
+
+  VizPublisher::Params params;
+  params.publish_hz = 100.0;
+  {
+    VizPublisher pub(lcm, "viz", params);
+    pub.Start();
+    pub.UpdateBodyPose(1, MakePose(0));
+    for (int i = 0; i < 100 && pub.NumPublished() == 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  // Nothing else changed, so only one message went out.
+  while (lcm.handleTimeout(0) > 0);
+  EXPECT_EQ(std::vector<int64_t>({ 0 }), handler.seqs);
+}
@@ -0,0 +1,70 @@
+#include <stdexcept>
+#include <unordered_map>
+
+#include <gtest/gtest.h>
+
+#include "mesher/coordinate_map.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+TEST(CoordinateMapTest, InsertAndFind)
+{
+  CoordinateMap<int> map;
+  EXPECT_EQ(0ul, map.Size());
+  EXPECT_EQ(nullptr, map.Find(0, 0));
+  EXPECT_THROW(map.At(0, 0), std::out_of_range);
+
+  map.Insert(3, 4, 10);
+  map.Insert(4, 3, 20);
+  map.Insert(Vector2i(-1, -7), 30);
+  EXPECT_EQ(3ul, map.Size());
+
+  EXPECT_EQ(10, map.At(3, 4));
+  EXPECT_EQ(20, map.At(4, 3));
+  EXPECT_EQ(30, map.At(Vector2i(-1, -7)));
+  EXPECT_FALSE(map.Contains(3, 3));
+  EXPECT_FALSE(map.Contains(-7, -1));
+
+  // Insert doesn't replace data that's already there, but At() can.
+  EXPECT_EQ(10, map.Insert(3, 4, 11));
+  EXPECT_EQ(10, map.At(3, 4));
+  map.At(3, 4) = 12;
+  EXPECT_EQ(12, *map.Find(3, 4));
+  EXPECT_EQ(3ul, map.Size());
+
+  map.Clear();
+  EXPECT_EQ(0ul, map.Size());
+  EXPECT_FALSE(map.Contains(3, 4));
+}
+
+
+TEST(CoordinateMapTest, ManyCoordinates)
+{
+  // Compare against a nested std::unordered_map, through a few rounds of growing.
+  CoordinateMap<int> map;
+  std::unordered_map<int, std::unordered_map<int, int>> expected;
+
+  for (int x = -50; x < 50; ++x) {
+    for (int y = -30; y < 70; y += 3) {
+      map.Insert(x, y, 1000 * x + y);
+      expected[x][y] = 1000 * x + y;
+    }
+  }
+
+  size_t n = 0;
+  for (const auto& col : expected) {
+    for (const auto& item : col.second) {
+      ASSERT_TRUE(map.Contains(col.first, item.first));
+      EXPECT_EQ(item.second, map.At(col.first, item.first));
+      ++n;
+    }
+  }
+  EXPECT_EQ(n, map.Size());
+
+  for (int x = -50; x < 50; ++x) {
+    EXPECT_FALSE(map.Contains(x, -29));
+  }
+}
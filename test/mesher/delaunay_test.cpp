@@ -0,0 +1,120 @@
+#include <random>
+#include <set>
+
+#include <gtest/gtest.h>
+
+#include "core/uid.hpp"
+#include "mesher/delaunay.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+// Returns the number of (triangle, landmark) pairs where the landmark is inside of the circumcircle.
+static int CountDelaunayViolations(const IncrementalDelaunay& dt, const std::set<core::uid_t>& lmk_ids)
+{
+  std::vector<LmkTriangle> triangles;
+  dt.GetTriangles(triangles);
+
+  int violations = 0;
+  for (const LmkTriangle& t : triangles) {
+    const Vector2d& a = dt.Point(t[0]);
+    const Vector2d& b = dt.Point(t[1]);
+    const Vector2d& c = dt.Point(t[2]);
+
+    // Triangles should be CCW.
+    EXPECT_GT((b - a).x() * (c - a).y() - (b - a).y() * (c - a).x(), 0);
+
+    for (const core::uid_t lmk_id : lmk_ids) {
+      if (lmk_id == t[0] || lmk_id == t[1] || lmk_id == t[2]) {
+        continue;
+      }
+      const Vector2d ad = a - dt.Point(lmk_id);
+      const Vector2d bd = b - dt.Point(lmk_id);
+      const Vector2d cd = c - dt.Point(lmk_id);
+      const double det = ad.squaredNorm() * (bd.x() * cd.y() - cd.x() * bd.y()) -
+                         bd.squaredNorm() * (ad.x() * cd.y() - cd.x() * ad.y()) +
+                         cd.squaredNorm() * (ad.x() * bd.y() - bd.x() * ad.y());
+      violations += (det > 1e-6) ? 1 : 0;
+    }
+  }
+
+  return violations;
+}
+
+
+TEST(IncrementalDelaunay, Square)
+{
+  IncrementalDelaunay dt(640, 480);
+  EXPECT_TRUE(dt.Insert(0, Vector2d(100, 100)));
+  EXPECT_TRUE(dt.Insert(1, Vector2d(200, 100)));
+  EXPECT_TRUE(dt.Insert(2, Vector2d(200, 200)));
+  EXPECT_TRUE(dt.Insert(3, Vector2d(100, 200)));
+
+  // Duplicate points can't be added.
+  EXPECT_FALSE(dt.Insert(4, Vector2d(100, 100)));
+  EXPECT_FALSE(dt.Has(4));
+  EXPECT_EQ(4ul, dt.Size());
+
+  std::vector<LmkTriangle> triangles;
+  dt.GetTriangles(triangles);
+  EXPECT_EQ(2ul, triangles.size());
+
+  // Adding the center point splits the square into 4 triangles.
+  EXPECT_TRUE(dt.Insert(5, Vector2d(150, 150)));
+  dt.GetTriangles(triangles);
+  EXPECT_EQ(4ul, triangles.size());
+
+  dt.Remove(5);
+  dt.GetTriangles(triangles);
+  EXPECT_EQ(2ul, triangles.size());
+
+  dt.Remove(0);
+  dt.GetTriangles(triangles);
+  EXPECT_EQ(1ul, triangles.size());
+  EXPECT_EQ(3ul, dt.Size());
+}
+
+
+TEST(IncrementalDelaunay, RandomUpdates)
+{
+  IncrementalDelaunay dt(640, 480);
+
+  std::mt19937 rng(123);
+  std::uniform_real_distribution<double> u(0, 640);
+  std::uniform_real_distribution<double> v(0, 480);
+
+  std::set<core::uid_t> lmk_ids;
+  core::uid_t next_id = 0;
+
+  for (int iter = 0; iter < 2000; ++iter) {
+    const int op = rng() % 3;
+
+    // Snap some of the points to a coarse grid to get lots of collinear and cocircular points.
+    const bool snap = (iter % 2) == 0;
+    const Vector2d p = snap ? Vector2d(20.0 * std::floor(u(rng) / 20.0), 20.0 * std::floor(v(rng) / 20.0)) :
+                              Vector2d(u(rng), v(rng));
+
+    if (op == 0 || lmk_ids.size() < 20) {
+      if (dt.Insert(next_id, p)) {
+        lmk_ids.insert(next_id);
+      }
+      ++next_id;
+    } else {
+      auto it = lmk_ids.begin();
+      std::advance(it, rng() % lmk_ids.size());
+      if (op == 1) {
+        dt.Remove(*it);
+        lmk_ids.erase(it);
+      } else if (!dt.Move(*it, p)) {
+        lmk_ids.erase(it);
+      }
+    }
+
+    if (iter % 100 == 0) {
+      ASSERT_EQ(lmk_ids.size(), dt.Size());
+      ASSERT_EQ(0, CountDelaunayViolations(dt, lmk_ids));
+    }
+  }
+}
@@ -0,0 +1,105 @@
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "mesher/depth_completion.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+static const PinholeCamera kCameraModel(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+static const StereoCamera kStereoRig(kCameraModel, 0.2);
+
+// A bright box (the object) on a dark background, and the ground truth disparity of each.
+static const cv::Rect kBox(160, 120, 320, 240);
+
+static double TrueDisp(int x, int y)
+{
+  return kBox.contains(cv::Point(x, y)) ? (20.0 + 0.01 * x) : 5.0;
+}
+
+
+TEST(DepthCompletionTest, TestCompleteDisparity)
+{
+  Image1b iml(480, 640, 50);
+  iml(kBox).setTo(200);
+
+  std::mt19937 rng(123);
+  std::uniform_real_distribution<float> x(0, 639), y(0, 479);
+  std::vector<cv::Point2f> points;
+  std::vector<double> disps;
+  for (int i = 0; i < 2000; ++i) {
+    points.emplace_back(x(rng), y(rng));
+    disps.emplace_back(TrueDisp((int)points.back().x, (int)points.back().y));
+  }
+
+  const int downsize = 4;
+  Image1f disp;
+  CompleteDisparity(iml, Image1b(), points, disps, downsize, 6, 0.01, 2, disp);
+  ASSERT_EQ(120, disp.rows);
+  ASSERT_EQ(160, disp.cols);
+
+  const cv::Rect box_small(kBox.x / downsize, kBox.y / downsize, kBox.width / downsize, kBox.height / downsize);
+
+  for (int v = 0; v < disp.rows; ++v) {
+    for (int u = 0; u < disp.cols; ++u) {
+      const cv::Point px(u, v);
+      const double truth = TrueDisp(downsize * u + downsize / 2, downsize * v + downsize / 2) / downsize;
+
+      // Away from the edge of the box (by more than the two box filters in the guided filter), the
+      // disparity is a local average of the landmarks.
+      const cv::Rect inner(box_small.x + 13, box_small.y + 13, box_small.width - 26, box_small.height - 26);
+      const cv::Rect outer(box_small.x - 13, box_small.y - 13, box_small.width + 26, box_small.height + 26);
+      if (inner.contains(px) || !outer.contains(px)) {
+        ASSERT_NEAR(truth, disp(v, u), 0.1) << "at " << px;
+      }
+    }
+  }
+
+  // Just inside of the box, the guide keeps the background from bleeding in.
+  EXPECT_GT(disp(box_small.y + box_small.height / 2, box_small.x + 1), 4.0f);
+  EXPECT_LT(disp(box_small.y + box_small.height / 2, box_small.x - 2), 2.0f);
+
+  // Only the foreground is filled in.
+  Image1b mask(iml.size(), 0);
+  mask(kBox).setTo(1);
+  CompleteDisparity(iml, mask, points, disps, downsize, 6, 0.01, 2, disp);
+  EXPECT_EQ(0.0f, disp(5, 5));
+  EXPECT_GT(disp(box_small.y + 10, box_small.x + 10), 4.0f);
+
+  // Without landmarks, there's nothing to fill in.
+  CompleteDisparity(iml, Image1b(), {}, {}, downsize, 6, 0.01, 2, disp);
+  EXPECT_EQ(0, cv::countNonZero(disp));
+}
+
+
+TEST(DepthCompletionTest, TestMeshFromDisparity)
+{
+  // A plane on the left half, and something much farther away on the right.
+  Image1f disp(40, 60, 10.0f);
+  disp(cv::Rect(30, 0, 30, 40)).setTo(2.0f);
+
+  TriangleMesh mesh;
+  MeshFromDisparity(disp, kStereoRig, 2, 1e-3, 100.0, 1.0, mesh);
+
+  // A 30 x 20 grid of vertices, and two triangles per cell except for the column of cells across
+  // the discontinuity.
+  EXPECT_EQ(600ul, mesh.vertices.size());
+  EXPECT_EQ(2ul * 29 * 19 - 2 * 19, mesh.triangles.size());
+  EXPECT_TRUE(mesh.vertex_ids.empty());
+
+  const PinholeCamera cam = kStereoRig.LeftCamera().Rescale(40, 60);
+  EXPECT_NEAR(cam.fx() * 0.2 / 10.0, mesh.vertices.front().z(), 1e-9);
+  EXPECT_NEAR(cam.fx() * 0.2 / 2.0, mesh.vertices.back().z(), 1e-9);
+
+  // Vertices beyond the max depth are dropped (taking their triangles with them).
+  MeshFromDisparity(disp, kStereoRig, 2, 1e-3, cam.fx() * 0.2 / 5.0, 1.0, mesh);
+  EXPECT_EQ(300ul, mesh.vertices.size());
+  EXPECT_EQ(2ul * 14 * 19, mesh.triangles.size());
+}
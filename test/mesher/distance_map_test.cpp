@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include "mesher/distance_map.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+// A square plane at depth z in front of the camera, with two triangles per cell.
+static TriangleMesh MakePlaneMesh(double z, double half_width, int cells)
+{
+  TriangleMesh mesh;
+  const double step = 2.0 * half_width / cells;
+  for (int r = 0; r <= cells; ++r) {
+    for (int c = 0; c <= cells; ++c) {
+      mesh.vertices.emplace_back(-half_width + step * c, -half_width + step * r, z);
+    }
+  }
+  for (int r = 0; r < cells; ++r) {
+    for (int c = 0; c < cells; ++c) {
+      const int i = r * (cells + 1) + c;
+      mesh.triangles.emplace_back(i, i + 1, i + cells + 1);
+      mesh.triangles.emplace_back(i + 1, i + cells + 2, i + cells + 1);
+    }
+  }
+  return mesh;
+}
+
+
+static DistanceMap::Params MakeParams()
+{
+  DistanceMap::Params params;
+  params.voxel_size = 0.1;
+  params.truncation_dist = 0.5;
+  return params;
+}
+
+
+TEST(DistanceMapTest, TestSignedDistance)
+{
+  DistanceMap map(MakeParams());
+  map.Integrate(MakePlaneMesh(5.0, 2.0, 4), SE3::Identity());
+  EXPECT_GT(map.NumBlocks(), 0ul);
+
+  // The camera is at the origin, so the near side of the plane is positive.
+  double dist = 0;
+  ASSERT_TRUE(map.Distance(Vector3d(0.25, 0.25, 4.75), dist));
+  EXPECT_NEAR(0.25, dist, 1e-6);
+  ASSERT_TRUE(map.Distance(Vector3d(0.25, 0.25, 5.25), dist));
+  EXPECT_NEAR(-0.25, dist, 1e-6);
+
+  // Farther than the truncation distance, or past the edge of the plane.
+  EXPECT_FALSE(map.Distance(Vector3d(0.25, 0.25, 3.0), dist));
+  EXPECT_FALSE(map.Distance(Vector3d(3.0, 0.25, 5.0), dist));
+}
+
+
+TEST(DistanceMapTest, TestWorldPose)
+{
+  DistanceMap map(MakeParams());
+
+  // Camera 10m up, looking down the world -z axis, so the plane ends up at world z = 5.
+  const Matrix3d world_R_cam = AngleAxisd(M_PI, Vector3d::UnitX()).toRotationMatrix();
+  map.Integrate(MakePlaneMesh(5.0, 2.0, 4), SE3(world_R_cam, Vector3d(0, 0, 10)));
+
+  double dist = 0;
+  ASSERT_TRUE(map.Distance(Vector3d(0.25, 0.25, 5.25), dist));
+  EXPECT_NEAR(0.25, dist, 1e-6);
+  ASSERT_TRUE(map.Distance(Vector3d(-0.25, -0.25, 4.75), dist));
+  EXPECT_NEAR(-0.25, dist, 1e-6);
+}
+
+
+TEST(DistanceMapTest, TestFusion)
+{
+  DistanceMap map(MakeParams());
+  map.Integrate(MakePlaneMesh(5.0, 2.0, 4), SE3::Identity());
+  map.Integrate(MakePlaneMesh(5.2, 2.0, 4), SE3::Identity());
+
+  // Averages the two observations, as if the plane were at 5.1.
+  double dist = 0;
+  ASSERT_TRUE(map.Distance(Vector3d(0.25, 0.25, 4.75), dist));
+  EXPECT_NEAR(0.35, dist, 1e-6);
+}
+
+
+TEST(DistanceMapTest, TestAsyncAndCollisionChecker)
+{
+  DistanceMap map(MakeParams());
+  map.IntegrateAsync(MakePlaneMesh(5.0, 2.0, 4), SE3::Identity());
+  map.Flush();
+  EXPECT_GT(map.NumBlocks(), 0ul);
+
+  const auto is_free = MakeCollisionChecker(map, 0.2);
+  const auto is_free_known = MakeCollisionChecker(map, 0.2, false);
+
+  // Through the plane.
+  EXPECT_FALSE(is_free(Vector3d(0, 0, 3), Vector3d(0, 0, 7)));
+
+  // Parallel to the plane, inside and outside of the clearance.
+  EXPECT_FALSE(is_free(Vector3d(-1, 0, 4.85), Vector3d(1, 0, 4.85)));
+  EXPECT_TRUE(is_free(Vector3d(-1, 0, 4.65), Vector3d(1, 0, 4.65)));
+  EXPECT_TRUE(is_free_known(Vector3d(-1, 0, 4.65), Vector3d(1, 0, 4.65)));
+
+  // Unobserved space.
+  EXPECT_TRUE(is_free(Vector3d(-1, 0, 2), Vector3d(1, 0, 2)));
+  EXPECT_FALSE(is_free_known(Vector3d(-1, 0, 2), Vector3d(1, 0, 2)));
+}
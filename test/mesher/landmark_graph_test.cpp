@@ -50,3 +50,115 @@ TEST(LandmarkGraph, All)
   EXPECT_EQ(1ul, clusters3.at(0).count(123));
   EXPECT_EQ(1ul, clusters3.at(0).count(456));
 }
+
+
+// Returns the index of the cluster that has lmk_id, or -1.
+static int FindCluster(const LmkClusters& clusters, core::uid_t lmk_id)
+{
+  for (size_t i = 0; i < clusters.size(); ++i) {
+    if (clusters.at(i).count(lmk_id) != 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+
+TEST(LandmarkGraph, IncrementalClusters)
+{
+  LandmarkGraph g;
+  for (core::uid_t lmk_id = 0; lmk_id < 6; ++lmk_id) {
+    g.AddLandmark(lmk_id);
+  }
+  EXPECT_EQ(6ul, g.GetClusters(1.0).size());
+
+  // Connect 0-1-2 and 3-4.
+  g.UpdateEdge(0, 1, 1.0, 0.0, 2.0);
+  g.UpdateEdge(1, 2, 1.0, 0.0, 2.0);
+  g.UpdateEdge(3, 4, 1.0, 0.0, 2.0);
+  g.UpdateEdge(4, 5, 0.5, 0.0, 2.0);   // Below the subgraph weight.
+
+  const LmkClusters& clusters = g.GetClusters(1.0);
+  EXPECT_EQ(3ul, clusters.size());
+  EXPECT_EQ(3ul, clusters.at(FindCluster(clusters, 0)).size());
+  EXPECT_EQ(FindCluster(clusters, 3), FindCluster(clusters, 4));
+  EXPECT_NE(FindCluster(clusters, 4), FindCluster(clusters, 5));
+
+  // Weakening the middle edge splits the first cluster.
+  g.UpdateEdge(1, 2, -1.0, 0.0, 2.0);
+  const LmkClusters& clusters2 = g.GetClusters(1.0);
+  EXPECT_EQ(4ul, clusters2.size());
+  EXPECT_EQ(FindCluster(clusters2, 0), FindCluster(clusters2, 1));
+  EXPECT_NE(FindCluster(clusters2, 1), FindCluster(clusters2, 2));
+
+  // Removing a landmark removes its edges too.
+  g.UpdateEdge(2, 3, 1.0, 0.0, 2.0);
+  EXPECT_EQ(3ul, g.GetClusters(1.0).size());
+  g.RemoveLandmark(3);
+  const LmkClusters& clusters3 = g.GetClusters(1.0);
+  EXPECT_EQ(4ul, clusters3.size());
+  EXPECT_EQ(-1, FindCluster(clusters3, 3));
+  EXPECT_NE(FindCluster(clusters3, 2), FindCluster(clusters3, 4));
+
+  // A recycled vertex starts off unconnected.
+  g.AddLandmark(10);
+  EXPECT_EQ(1ul, g.GetClusters(1.0).at(FindCluster(g.GetClusters(1.0), 10)).size());
+
+  // Changing the weight threshold puts 4 and 5 together.
+  EXPECT_EQ(FindCluster(g.GetClusters(0.5), 4), FindCluster(g.GetClusters(0.5), 5));
+}
+
+
+TEST(LandmarkGraph, ManyEdges)
+{
+  LandmarkGraph g;
+
+  // A long chain, to make the edge table grow and shift items around when they're erased.
+  const core::uid_t N = 500;
+  for (core::uid_t i = 0; i + 1 < N; ++i) {
+    g.UpdateEdge(i, i + 1, 1.0, 0.0, 1.0);
+  }
+  EXPECT_EQ(1ul, g.GetClusters(1.0).size());
+
+  // Remove every 10th landmark to break the chain.
+  for (core::uid_t i = 5; i < N; i += 10) {
+    g.RemoveLandmark(i);
+  }
+  EXPECT_EQ(N / 10 + 1, g.GetClusters(1.0).size());
+
+  for (core::uid_t i = 0; i + 1 < N; ++i) {
+    if (i % 10 != 5 && (i + 1) % 10 != 5) {
+      g.UpdateEdge(i, i + 1, 0.0, 0.0, 1.0);
+    }
+  }
+  EXPECT_EQ(N / 10 + 1, g.GetClusters(1.0).size());
+}
+
+
+TEST(LandmarkGraph, UpdateEdges)
+{
+  // A batch of updates gives the same graph as applying them one at a time.
+  std::vector<LandmarkGraph::EdgeUpdate> updates;
+  for (core::uid_t i = 0; i < 200; ++i) {
+    updates.push_back({ i, (i * 7 + 3) % 200, (i % 3 == 0) ? -1.0f : 1.0f });
+  }
+  updates.push_back({ 1, 10, 1.0f });
+
+  LandmarkGraph g1, g2;
+  g1.GetClusters(1.0);
+  g2.GetClusters(1.0);
+  for (const LandmarkGraph::EdgeUpdate& u : updates) {
+    g1.UpdateEdge(u.lmk1, u.lmk2, u.increment, 0.0, 2.0);
+  }
+  g2.UpdateEdges(updates, 0.0, 2.0);
+
+  EXPECT_EQ(g1.GraphSize(), g2.GraphSize());
+  const LmkClusters& c1 = g1.GetClusters(1.0);
+  const LmkClusters& c2 = g2.GetClusters(1.0);
+  ASSERT_EQ(c1.size(), c2.size());
+  for (const LmkSet& cluster : c1) {
+    const int k = FindCluster(c2, *cluster.begin());
+    ASSERT_GE(k, 0);
+    EXPECT_EQ(cluster, c2.at(k));
+  }
+}
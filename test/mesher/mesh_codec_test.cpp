@@ -0,0 +1,153 @@
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "mesher/mesh_codec.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+// A grid of vertices (one per landmark) with two triangles per cell.
+static TriangleMesh MakeGridMesh(int rows, int cols, core::uid_t first_id, double z)
+{
+  TriangleMesh mesh;
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < cols; ++c) {
+      mesh.vertices.emplace_back(0.1 * c, 0.1 * r, z);
+      mesh.vertex_ids.emplace_back(first_id + r * cols + c);
+    }
+  }
+  for (int r = 0; r < (rows - 1); ++r) {
+    for (int c = 0; c < (cols - 1); ++c) {
+      const int i = r * cols + c;
+      mesh.triangles.emplace_back(i, i + 1, i + cols);
+      mesh.triangles.emplace_back(i + 1, i + cols + 1, i + cols);
+    }
+  }
+  return mesh;
+}
+
+
+// Compares meshes by landmark id, since the decoder reorders vertices.
+static void ExpectMeshesNear(const TriangleMesh& expected, const TriangleMesh& actual, double tol)
+{
+  ASSERT_EQ(expected.vertices.size(), actual.vertices.size());
+  ASSERT_EQ(expected.triangles.size(), actual.triangles.size());
+
+  std::map<core::uid_t, Vector3d> actual_vertices;
+  for (size_t i = 0; i < actual.vertices.size(); ++i) {
+    actual_vertices.emplace(actual.vertex_ids.at(i), actual.vertices.at(i));
+  }
+
+  for (size_t i = 0; i < expected.vertices.size(); ++i) {
+    const Vector3d& v = actual_vertices.at(expected.vertex_ids.at(i));
+    EXPECT_LT((v - expected.vertices.at(i)).norm(), tol);
+  }
+
+  std::set<TriangleKey> expected_triangles, actual_triangles;
+  for (const Vector3i& t : expected.triangles) {
+    const core::uid_t a = expected.vertex_ids.at(t(0));
+    const core::uid_t b = expected.vertex_ids.at(t(1));
+    const core::uid_t c = expected.vertex_ids.at(t(2));
+    expected_triangles.emplace((a < b && a < c) ? TriangleKey{{a, b, c}} :
+                               (b < c) ? TriangleKey{{b, c, a}} : TriangleKey{{c, a, b}});
+  }
+  for (const Vector3i& t : actual.triangles) {
+    actual_triangles.emplace(TriangleKey{{ actual.vertex_ids.at(t(0)),
+                                           actual.vertex_ids.at(t(1)),
+                                           actual.vertex_ids.at(t(2)) }});
+  }
+  EXPECT_EQ(expected_triangles, actual_triangles);
+}
+
+
+TEST(MeshCodecTest, RoundTrip)
+{
+  MeshEncoder::Params params;
+  MeshEncoder encoder(params);
+  MeshDecoder decoder;
+
+  std::default_random_engine rng(123);
+  std::normal_distribution<double> noise(0.0, 0.01);
+
+  // Steps are less than 0.1 mm across the ~5 m box, so even vertices that weren't resent (because
+  // they moved less than move_tolerance_steps) should be within a millimeter.
+  const double tol = 1e-3;
+
+  for (int i = 0; i < 10; ++i) {
+    // Landmarks come and go, and the existing ones move around a bit.
+    TriangleMesh mesh = MakeGridMesh(8, 8 + i, 100 + 5 * i, 1.0);
+    for (Vector3d& v : mesh.vertices) {
+      v.z() += noise(rng);
+    }
+
+    const MeshDelta delta = encoder.Encode(mesh);
+    EXPECT_EQ(i == 0, delta.IsFullMesh());
+    ASSERT_TRUE(decoder.Apply(delta));
+    ExpectMeshesNear(mesh, decoder.Mesh(), tol);
+  }
+}
+
+
+TEST(MeshCodecTest, DeltaIsSmall)
+{
+  MeshEncoder::Params params;
+  MeshEncoder encoder(params);
+
+  const TriangleMesh mesh0 = MakeGridMesh(20, 20, 0, 1.0);
+  const MeshDelta full = encoder.Encode(mesh0);
+  EXPECT_TRUE(full.IsFullMesh());
+
+  // Vertices are 6 bytes + about 1 byte of id, triangles about 3 bytes each.
+  EXPECT_LT(full.data.size(), 8 * mesh0.vertices.size() + 4 * mesh0.triangles.size());
+
+  // Nothing changed.
+  const MeshDelta same = encoder.Encode(mesh0);
+  EXPECT_FALSE(same.IsFullMesh());
+  EXPECT_EQ(0ul, same.data.size());
+
+  // Add one row of landmarks, which should only send the new part.
+  const TriangleMesh mesh1 = MakeGridMesh(21, 20, 0, 1.0);
+  const MeshDelta grow = encoder.Encode(mesh1);
+  EXPECT_FALSE(grow.IsFullMesh());
+  EXPECT_EQ(20, grow.num_upserted_vertices);
+  EXPECT_EQ(0, grow.num_removed_vertices);
+  EXPECT_EQ(38, grow.num_added_triangles);
+  EXPECT_LT(10 * grow.data.size(), full.data.size());
+
+  // Moving outside of the bounding box forces a full mesh.
+  const MeshDelta moved = encoder.Encode(MakeGridMesh(21, 20, 0, 10.0));
+  EXPECT_TRUE(moved.IsFullMesh());
+}
+
+
+TEST(MeshCodecTest, MissedDelta)
+{
+  MeshEncoder::Params params;
+  params.full_mesh_interval = 4;
+  MeshEncoder encoder(params);
+  MeshDecoder decoder;
+
+  ASSERT_TRUE(decoder.Apply(encoder.Encode(MakeGridMesh(5, 5, 0, 1.0))));
+  const TriangleMesh mesh1 = MakeGridMesh(6, 5, 0, 1.0);
+  encoder.Encode(mesh1);  // Lost.
+
+  // Everything is rejected until the next full mesh.
+  EXPECT_FALSE(decoder.Apply(encoder.Encode(MakeGridMesh(7, 5, 0, 1.0))));
+  EXPECT_FALSE(decoder.Apply(encoder.Encode(MakeGridMesh(8, 5, 0, 1.0))));
+  EXPECT_EQ(25ul, decoder.Mesh().vertices.size());
+
+  const TriangleMesh mesh4 = MakeGridMesh(9, 5, 0, 1.0);
+  const MeshDelta delta4 = encoder.Encode(mesh4);
+  EXPECT_TRUE(delta4.IsFullMesh());
+  ASSERT_TRUE(decoder.Apply(delta4));
+  ExpectMeshesNear(mesh4, decoder.Mesh(), 2e-3);
+
+  // Garbage data is rejected too.
+  MeshDelta bad = encoder.Encode(MakeGridMesh(10, 5, 0, 1.0));
+  bad.num_upserted_vertices += 1;
+  EXPECT_FALSE(decoder.Apply(bad));
+  EXPECT_EQ(45ul, decoder.Mesh().vertices.size());
+}
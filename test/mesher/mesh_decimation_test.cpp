@@ -0,0 +1,125 @@
+#include <cmath>
+#include <set>
+
+#include <gtest/gtest.h>
+
+#include "mesher/mesh_decimation.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+// A wavy square surface at depth z, with two triangles per cell, and a landmark id for each vertex.
+static TriangleMesh MakeSurfaceMesh(double z, double half_width, int cells)
+{
+  TriangleMesh mesh;
+  const double step = 2.0 * half_width / cells;
+  for (int r = 0; r <= cells; ++r) {
+    for (int c = 0; c <= cells; ++c) {
+      const double x = -half_width + step * c;
+      const double y = -half_width + step * r;
+      mesh.vertices.emplace_back(x, y, z + 0.1 * std::sin(x) * std::cos(y));
+      mesh.vertex_ids.emplace_back(1000 + mesh.vertices.size());
+    }
+  }
+  for (int r = 0; r < cells; ++r) {
+    for (int c = 0; c < cells; ++c) {
+      const int i = r * (cells + 1) + c;
+      mesh.triangles.emplace_back(i, i + 1, i + cells + 1);
+      mesh.triangles.emplace_back(i + 1, i + cells + 2, i + cells + 1);
+    }
+  }
+  return mesh;
+}
+
+
+static void ExpectValidMesh(const TriangleMesh& mesh)
+{
+  ASSERT_EQ(mesh.vertices.size(), mesh.vertex_ids.size());
+  std::vector<int> used(mesh.vertices.size(), 0);
+  for (const Vector3i& t : mesh.triangles) {
+    for (int k = 0; k < 3; ++k) {
+      ASSERT_GE(t(k), 0);
+      ASSERT_LT(t(k), (int)mesh.vertices.size());
+      used.at(t(k)) = 1;
+    }
+    EXPECT_TRUE(t.x() != t.y() && t.y() != t.z() && t.x() != t.z());
+  }
+  for (const int u : used) {
+    EXPECT_EQ(1, u);
+  }
+
+  const std::set<core::uid_t> ids(mesh.vertex_ids.begin(), mesh.vertex_ids.end());
+  EXPECT_EQ(mesh.vertex_ids.size(), ids.size());
+}
+
+
+TEST(MeshDecimationTest, ClusterVertices)
+{
+  const TriangleMesh mesh = MakeSurfaceMesh(5.0, 2.0, 40);
+
+  // Cells smaller than the grid step keep every vertex.
+  TriangleMesh same;
+  ClusterVertices(mesh, 0.01, same);
+  EXPECT_EQ(mesh.vertices.size(), same.vertices.size());
+  EXPECT_EQ(mesh.triangles.size(), same.triangles.size());
+  ExpectValidMesh(same);
+
+  // Cells of 4 grid steps leave about 1/16 of them, which stay close to the surface.
+  TriangleMesh coarse;
+  ClusterVertices(mesh, 0.4, coarse);
+  ExpectValidMesh(coarse);
+  EXPECT_LT(coarse.triangles.size(), mesh.triangles.size() / 8);
+  EXPECT_GT(coarse.triangles.size(), mesh.triangles.size() / 32);
+  for (const Vector3d& v : coarse.vertices) {
+    EXPECT_NEAR(5.0 + 0.1 * std::sin(v.x()) * std::cos(v.y()), v.z(), 0.02);
+  }
+
+  // Ids come from the input.
+  const std::set<core::uid_t> ids(mesh.vertex_ids.begin(), mesh.vertex_ids.end());
+  for (const core::uid_t id : coarse.vertex_ids) {
+    EXPECT_EQ(1ul, ids.count(id));
+  }
+}
+
+
+TEST(MeshDecimationTest, DecimateToBudget)
+{
+  const TriangleMesh mesh = MakeSurfaceMesh(5.0, 2.0, 100);
+  ASSERT_EQ(20000ul, mesh.triangles.size());
+
+  TriangleMesh out;
+  const double cell_size = DecimateMesh(mesh, 2000, out);
+  EXPECT_GT(cell_size, 0);
+  EXPECT_LE(out.triangles.size(), 2000ul);
+  EXPECT_GT(out.triangles.size(), 500ul);
+  ExpectValidMesh(out);
+
+  // Already within the budget.
+  EXPECT_EQ(0, DecimateMesh(mesh, 20000, out));
+  EXPECT_EQ(mesh.triangles, out.triangles);
+}
+
+
+TEST(MeshDecimationTest, ToFloatMesh)
+{
+  const TriangleMesh mesh = MakeSurfaceMesh(5.0, 1.0, 4);
+
+  TriangleMeshf meshf;
+  ToFloatMesh(mesh, meshf);
+  ASSERT_EQ(mesh.vertices.size(), meshf.NumVertices());
+  ASSERT_EQ(mesh.triangles.size(), meshf.NumTriangles());
+  EXPECT_EQ(mesh.vertex_ids, meshf.vertex_ids);
+
+  for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+    for (int k = 0; k < 3; ++k) {
+      EXPECT_FLOAT_EQ((float)mesh.vertices[i](k), meshf.vertices[3*i + k]);
+    }
+  }
+  for (size_t j = 0; j < mesh.triangles.size(); ++j) {
+    for (int k = 0; k < 3; ++k) {
+      EXPECT_EQ(mesh.triangles[j](k), meshf.triangles[3*j + k]);
+    }
+  }
+}
@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "mesher/mesh_map.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+// A square plane at depth z in front of the camera, with two triangles per cell. If with_ids, each
+// vertex gets a landmark id (its index).
+static TriangleMesh MakePlaneMesh(double z, double half_width, int cells, bool with_ids)
+{
+  TriangleMesh mesh;
+  const double step = 2.0 * half_width / cells;
+  for (int r = 0; r <= cells; ++r) {
+    for (int c = 0; c <= cells; ++c) {
+      mesh.vertices.emplace_back(-half_width + step * c, -half_width + step * r, z);
+      if (with_ids) {
+        mesh.vertex_ids.emplace_back(mesh.vertices.size() - 1);
+      }
+    }
+  }
+  for (int r = 0; r < cells; ++r) {
+    for (int c = 0; c < cells; ++c) {
+      const int i = r * (cells + 1) + c;
+      mesh.triangles.emplace_back(i, i + 1, i + cells + 1);
+      mesh.triangles.emplace_back(i + 1, i + cells + 2, i + cells + 1);
+    }
+  }
+  return mesh;
+}
+
+
+TEST(MeshMapTest, TestLandmarkIds)
+{
+  MeshMap map{MeshMap::Params()};
+  map.Integrate(MakePlaneMesh(5.0, 1.0, 4, true), SE3::Identity());
+  EXPECT_EQ(25ul, map.NumVertices());
+  EXPECT_EQ(32ul, map.NumTriangles());
+
+  // The same landmarks seen again (a little off) update the vertices instead of adding new ones.
+  map.Integrate(MakePlaneMesh(5.2, 1.0, 4, true), SE3::Identity());
+  EXPECT_EQ(25ul, map.NumVertices());
+  EXPECT_EQ(32ul, map.NumTriangles());
+
+  const TriangleMesh mesh = map.GetMesh();
+  ASSERT_EQ(25ul, mesh.vertex_ids.size());
+  for (const Vector3d& v : mesh.vertices) {
+    EXPECT_NEAR(5.1, v.z(), 1e-9);
+  }
+}
+
+
+TEST(MeshMapTest, TestWorldFrameMerge)
+{
+  MeshMap map{MeshMap::Params()};
+
+  // Without landmark ids, vertices merge when they land in the same world voxel. The second mesh is
+  // seen from a camera 1m to the left, so it lines up with the first one in the world.
+  const TriangleMesh mesh = MakePlaneMesh(5.0, 1.0, 4, false);
+  map.Integrate(mesh, SE3::Identity());
+  const SE3 world_T_cam(Quaterniond::Identity(), Vector3d(-1.0, 0, 0));
+  TriangleMesh shifted = mesh;
+  for (Vector3d& v : shifted.vertices) {
+    v.x() += 1.0;
+  }
+  map.Integrate(shifted, world_T_cam);
+
+  EXPECT_EQ(25ul, map.NumVertices());
+  EXPECT_EQ(32ul, map.NumTriangles());
+
+  const TriangleMesh out = map.GetMesh();
+  EXPECT_EQ(MeshMap::kNoLandmarkId, out.vertex_ids.at(0));
+
+  // Slot ids are unique, and don't change when the map is integrated into again.
+  const TriangleMesh slots = map.GetMesh(true);
+  ASSERT_EQ(25ul, slots.vertex_ids.size());
+  EXPECT_EQ(25ul, std::set<core::uid_t>(slots.vertex_ids.begin(), slots.vertex_ids.end()).size());
+  map.Integrate(mesh, SE3::Identity());
+  EXPECT_EQ(slots.vertex_ids, map.GetMesh(true).vertex_ids);
+}
+
+
+TEST(MeshMapTest, TestDecimateFarCells)
+{
+  MeshMap::Params params;
+  params.cell_size = 4.0;
+  params.lod_dist = 10.0;
+  params.lod_voxel_size = 0.5;
+  MeshMap map(params);
+
+  // A dense plane (10cm spacing) right in front of the camera keeps its detail.
+  const TriangleMesh mesh = MakePlaneMesh(5.0, 1.0, 20, false);
+  map.Integrate(mesh, SE3::Identity());
+  EXPECT_EQ(441ul, map.NumVertices());
+
+  // Once the camera is far away, each 0.5m voxel collapses to one vertex.
+  const SE3 far_away(Quaterniond::Identity(), Vector3d(0, 0, -50.0));
+  map.Integrate(TriangleMesh(), far_away);
+  EXPECT_LE(map.NumVertices(), 36ul);
+  EXPECT_GT(map.NumTriangles(), 0ul);
+  EXPECT_LT(map.NumTriangles(), 800ul);
+
+  // Every triangle still has three distinct, live vertices.
+  const TriangleMesh out = map.GetMesh();
+  for (const Vector3i& t : out.triangles) {
+    EXPECT_TRUE(t(0) != t(1) && t(1) != t(2) && t(0) != t(2));
+    EXPECT_LT(t.maxCoeff(), (int)out.vertices.size());
+  }
+}
+
+
+TEST(MeshMapTest, TestMaxVertices)
+{
+  MeshMap::Params params;
+  params.lod_dist = 100.0;
+  params.max_vertices = 100;
+  MeshMap map(params);
+
+  map.Integrate(MakePlaneMesh(5.0, 1.0, 20, false), SE3::Identity());
+  EXPECT_LE(map.NumVertices(), 100ul);
+}
+
+
+TEST(MeshMapTest, TestWritePly)
+{
+  MeshMap map{MeshMap::Params()};
+  map.Integrate(MakePlaneMesh(5.0, 1.0, 4, true), SE3::Identity());
+
+  // A tiny chunk size, so that the file is written in a lot of pieces.
+  const std::string path = "/tmp/mesh_map_test.ply";
+  ASSERT_TRUE(map.WritePly(path, 7));
+
+  std::ifstream in(path, std::ios::binary);
+  ASSERT_TRUE(in.is_open());
+  std::string line, header;
+  while (std::getline(in, line) && line != "end_header") {
+    header += line + "\n";
+  }
+  EXPECT_NE(std::string::npos, header.find("element vertex 25\n"));
+  EXPECT_NE(std::string::npos, header.find("element face 32\n"));
+
+  // The rest is 25 * (3 floats) + 32 * (uchar + 3 ints).
+  const std::streampos body_start = in.tellg();
+  in.seekg(0, std::ios::end);
+  EXPECT_EQ(25 * 12 + 32 * 13, (int)(in.tellg() - body_start));
+
+  // The first face's indices are in range.
+  in.seekg(body_start + std::streamoff(25 * 12));
+  unsigned char count = 0;
+  int32_t ids[3];
+  in.read(reinterpret_cast<char*>(&count), 1);
+  in.read(reinterpret_cast<char*>(ids), sizeof(ids));
+  EXPECT_EQ(3, count);
+  for (int j = 0; j < 3; ++j) {
+    EXPECT_GE(ids[j], 0);
+    EXPECT_LT(ids[j], 25);
+  }
+
+  std::remove(path.c_str());
+}
@@ -0,0 +1,64 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "perf/perf_harness.hpp"
+
+// NOTE(milo): Replacing the global operator new counts every allocation in the process, including
+// the ones made by OpenCV and the standard library. This file is only linked into perf_gtest_all.
+static std::atomic<uint64_t> g_num_allocations(0);
+
+
+void* operator new(std::size_t size)
+{
+  g_num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+
+void operator delete[](void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+
+namespace bm {
+namespace perf {
+
+
+uint64_t NumAllocations()
+{
+  return g_num_allocations.load(std::memory_order_relaxed);
+}
+
+
+}
+}
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/timer.hpp"
+#include "perf/perf_harness.hpp"
+
+namespace bm {
+namespace perf {
+
+
+static bool UpdateBaselines()
+{
+  const char* env = std::getenv("BM_PERF_UPDATE_BASELINES");
+  return env != nullptr && std::string(env) == "1";
+}
+
+
+PerfResult RunScenario(const std::string& name,
+                       int num_runs,
+                       const std::function<void()>& fn,
+                       int num_warmup)
+{
+  CHECK_GT(num_runs, 0);
+
+  for (int i = 0; i < num_warmup; ++i) {
+    fn();
+  }
+
+  std::vector<double> times_ms(num_runs);
+  uint64_t min_allocs = std::numeric_limits<uint64_t>::max();
+
+  for (int i = 0; i < num_runs; ++i) {
+    const uint64_t allocs0 = NumAllocations();
+    core::Timer timer(true);
+    fn();
+    times_ms.at(i) = timer.Elapsed().milliseconds();
+    min_allocs = std::min(min_allocs, NumAllocations() - allocs0);
+  }
+
+  std::nth_element(times_ms.begin(), times_ms.begin() + num_runs / 2, times_ms.end());
+
+  PerfResult result;
+  result.name = name;
+  result.median_ms = times_ms.at(num_runs / 2);
+  result.allocs_per_run = min_allocs;
+
+  LOG(INFO) << name << ": median " << result.median_ms << " ms, " << result.allocs_per_run
+            << " allocs/run (" << num_runs << " runs)" << std::endl;
+
+  return result;
+}
+
+
+std::string PerfBaselines::MachineClass()
+{
+  const char* env = std::getenv("BM_PERF_MACHINE");
+  return (env != nullptr && env[0] != '\0') ? std::string(env) : std::string("default");
+}
+
+
+PerfBaselines::PerfBaselines(const std::string& folder)
+    : filepath_(folder + "/" + MachineClass() + ".txt")
+{
+  std::ifstream file(filepath_);
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream ss(line);
+    PerfResult b;
+    if (ss >> b.name >> b.median_ms >> b.allocs_per_run) {
+      baselines_[b.name] = b;
+    } else {
+      LOG(WARNING) << "Skipping bad baseline line in " << filepath_ << ": " << line << std::endl;
+    }
+  }
+}
+
+
+bool PerfBaselines::Get(const std::string& name, PerfResult& baseline) const
+{
+  const auto it = baselines_.find(name);
+  if (it == baselines_.end()) {
+    return false;
+  }
+  baseline = it->second;
+  return true;
+}
+
+
+bool PerfBaselines::Save() const
+{
+  std::ofstream file(filepath_);
+  if (!file.is_open()) {
+    LOG(WARNING) << "Could not write baselines to " << filepath_ << std::endl;
+    return false;
+  }
+  file << "# name median_ms allocs_per_run (machine class: " << MachineClass() << ")\n";
+  for (const auto& it : baselines_) {
+    file << it.second.name << " " << it.second.median_ms << " " << it.second.allocs_per_run << "\n";
+  }
+  return true;
+}
+
+
+void ExpectNoRegression(const PerfResult& result, double time_tolerance)
+{
+  PerfBaselines baselines;
+
+  if (UpdateBaselines()) {
+    baselines.Set(result);
+    baselines.Save();
+    LOG(INFO) << "Updated the baseline for " << result.name << std::endl;
+    return;
+  }
+
+  PerfResult baseline;
+  if (!baselines.Get(result.name, baseline)) {
+    LOG(WARNING) << "No baseline for " << result.name << " on machine class "
+                 << PerfBaselines::MachineClass() << std::endl;
+    return;
+  }
+
+  EXPECT_LE(result.median_ms, baseline.median_ms * (1.0 + time_tolerance))
+      << result.name << " is slower than its baseline (" << baseline.median_ms << " ms)";
+  EXPECT_LE(result.allocs_per_run, baseline.allocs_per_run)
+      << result.name << " allocates more than its baseline";
+}
+
+
+}
+}
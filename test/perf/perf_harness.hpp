@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace bm {
+namespace perf {
+
+
+// Number of calls to operator new so far (see alloc_counter.cpp, which replaces the global one in
+// the perf test executable only).
+uint64_t NumAllocations();
+
+
+struct PerfResult final
+{
+  std::string name;
+  double median_ms = 0;
+  uint64_t allocs_per_run = 0;    // Fewest allocations over all of the timed runs.
+};
+
+
+// Runs fn num_warmup times (untimed, so that caches and lazily allocated buffers are warm), then
+// num_runs times, and returns the median wall time and allocation count per run.
+PerfResult RunScenario(const std::string& name,
+                       int num_runs,
+                       const std::function<void()>& fn,
+                       int num_warmup = 1);
+
+
+// Baselines for one machine class, stored as one "name median_ms allocs_per_run" line per
+// scenario in ./resources/perf_baselines/<machine class>.txt. The machine class comes from the
+// BM_PERF_MACHINE environment variable, and is "default" if it isn't set.
+class PerfBaselines final {
+ public:
+  static std::string MachineClass();
+
+  // Loads the baselines for the current machine class (a missing file means no baselines).
+  explicit PerfBaselines(const std::string& folder = "./resources/perf_baselines");
+
+  bool Get(const std::string& name, PerfResult& baseline) const;
+  void Set(const PerfResult& result) { baselines_[result.name] = result; }
+
+  // Writes all of the baselines back to the file they were loaded from.
+  bool Save() const;
+
+ private:
+  std::string filepath_;
+  std::map<std::string, PerfResult> baselines_;
+};
+
+
+// Fails the current test if result is more than time_tolerance slower than its baseline, or makes
+// more allocations per run. Scenarios without a baseline only log a warning. If the environment
+// variable BM_PERF_UPDATE_BASELINES=1 is set, nothing fails, and the baseline is replaced with
+// result instead. Run the perf target that way on the reference machine, then copy the file from
+// build/test/resources back into test/resources and check it in.
+void ExpectNoRegression(const PerfResult& result, double time_tolerance = 0.25);
+
+
+}
+}
@@ -0,0 +1,142 @@
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/match_template.hpp"
+#include "feature_tracking/stereo_matcher.hpp"
+#include "stereo_matching/patchmatch.hpp"
+#include "patchmatch_gpu/patchmatch_gpu.h"
+#include "perf/perf_harness.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace perf;
+
+// NOTE(milo): Baselines are per machine class (see PerfBaselines), so these only mean something
+// on a machine that matches one. Keep the run counts high enough that the median is stable.
+static const int kNumRuns = 21;
+
+
+TEST(PerfTest, MatchTemplate)
+{
+  std::mt19937 rng(123);
+  std::uniform_int_distribution<int> pixel(0, 255);
+
+  const int templ_rows = 11, templ_cols = 31;
+  const int stripe_rows = 13, stripe_cols = 128;
+
+  std::vector<uint8_t> templ(templ_rows * templ_cols), stripe(stripe_rows * stripe_cols);
+  for (uint8_t& v : templ) { v = pixel(rng); }
+  for (uint8_t& v : stripe) { v = pixel(rng); }
+
+  const ft::MatchTemplateFn match_fn = ft::SelectMatchTemplateKernel(templ_rows, templ_cols);
+  ft::MatchTemplateWorkspace workspace;
+  int best_x = 0, best_y = 0;
+
+  // A single match is only a few microseconds, so time a batch of them.
+  const PerfResult result = RunScenario("MatchTemplate_11x31_x1000", kNumRuns, [&]() {
+    for (int i = 0; i < 1000; ++i) {
+      match_fn(templ.data(), templ_cols, templ_rows, templ_cols,
+               stripe.data(), stripe_cols, stripe_rows, stripe_cols,
+               workspace, best_x, best_y);
+    }
+  });
+  ExpectNoRegression(result);
+}
+
+
+TEST(PerfTest, StereoMatcher)
+{
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(iml.empty());
+
+  ft::FeatureDetector::Params dparams;
+  ft::FeatureDetector detector(dparams);
+  VecPoint2f empty_kp, left_keypoints;
+  detector.Detect(iml, empty_kp, left_keypoints);
+
+  ft::StereoMatcher::Params mparams;
+  ft::StereoMatcher matcher(mparams);
+
+  const PerfResult result = RunScenario("StereoMatcher_MatchRectified", kNumRuns, [&]() {
+    matcher.MatchRectified(iml, imr, left_keypoints);
+  });
+  ExpectNoRegression(result);
+}
+
+
+TEST(PerfTest, FeatureDetector)
+{
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(iml.empty());
+
+  ft::FeatureDetector::Params params;
+  ft::FeatureDetector detector(params);
+  VecPoint2f empty_kp, new_kp;
+
+  const PerfResult result = RunScenario("FeatureDetector_Detect", kNumRuns, [&]() {
+    new_kp.clear();
+    detector.Detect(iml, empty_kp, new_kp);
+  });
+  ExpectNoRegression(result);
+}
+
+
+TEST(PerfTest, Patchmatch)
+{
+  Image1b iml = cv::imread("./resources/images/fsl1.png", cv::IMREAD_GRAYSCALE);
+  Image1b imr = cv::imread("./resources/images/fsr1.png", cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(iml.empty());
+  cv::resize(iml, iml, iml.size() / 2);
+  cv::resize(imr, imr, imr.size() / 2);
+
+  stereo::Patchmatch::Params params;
+  stereo::Patchmatch pm(params);
+
+  const PerfResult result = RunScenario("Patchmatch_EstimateDisparity", kNumRuns / 2, [&]() {
+    pm.EstimateDisparity(iml, imr);
+  });
+  ExpectNoRegression(result);
+}
+
+
+TEST(PerfTest, PatchmatchGpu)
+{
+  if (cv::cuda::getCudaEnabledDeviceCount() == 0) {
+    LOG(WARNING) << "No CUDA device, skipping PatchmatchGpu" << std::endl;
+    return;
+  }
+
+  Image1b iml = cv::imread("./resources/images/fsl1.png", cv::IMREAD_GRAYSCALE);
+  Image1b imr = cv::imread("./resources/images/fsr1.png", cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(iml.empty());
+  cv::resize(iml, iml, iml.size() / 2);
+  cv::resize(imr, imr, imr.size() / 2);
+
+  pm::PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+  params.cost_alpha = 0.9;
+  params.patchmatch_iters = 3;
+
+  pm::PatchmatchGpu pm(params);
+  Image1f disp, dispr;
+
+  const PerfResult result = RunScenario("PatchmatchGpu_Match", kNumRuns, [&]() {
+    pm.Match(iml, imr, disp, dispr);
+  });
+  ExpectNoRegression(result);
+}
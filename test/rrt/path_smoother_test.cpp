@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#include "core/worker_pool.hpp"
+#include "rrt/path_smoother.hpp"
+#include "rrt/rrt_planner.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+// Blocks segments that cross the plane x = 0 while |y| < 10 (a wall with gaps on both sides).
+static bool CrossesWall(const Vector3d& a, const Vector3d& b)
+{
+  if ((a.x() < 0) == (b.x() < 0) || a.x() == b.x()) {
+    return false;
+  }
+  const double t = a.x() / (a.x() - b.x());
+  const double y = a.y() + t * (b.y() - a.y());
+  return std::fabs(y) < 10;
+}
+
+
+static void ExpectValidTrajectory(const SmoothResult& r, const PathSmoother::Params& params)
+{
+  const Trajectory& traj = r.trajectory;
+  ASSERT_GE(traj.size(), 2ul);
+  EXPECT_TRUE(traj.front().position.isApprox(r.path.front()));
+  EXPECT_TRUE(traj.back().position.isApprox(r.path.back()));
+  EXPECT_EQ(0, traj.front().velocity.norm());
+  EXPECT_EQ(0, traj.back().velocity.norm());
+
+  for (size_t i = 1; i < traj.size(); ++i) {
+    const TrajectoryPoint& p0 = traj.at(i - 1);
+    const TrajectoryPoint& p1 = traj.at(i);
+    EXPECT_FALSE(CrossesWall(p0.position, p1.position));
+    EXPECT_GT(p1.t, p0.t);
+    EXPECT_LE(p1.s - p0.s, params.sample_spacing + 1e-9);
+    EXPECT_LE(p1.velocity.norm(), params.max_speed + 1e-9);
+
+    // Tangential acceleration, with constant acceleration between samples.
+    const double v0 = p0.velocity.norm(), v1 = p1.velocity.norm();
+    EXPECT_LE(std::fabs(v1 * v1 - v0 * v0) / (2 * (p1.s - p0.s)), params.max_accel + 1e-6);
+  }
+
+  // A curve is never longer than the corners it cuts.
+  EXPECT_LE(traj.back().s, r.cost + 1e-6);
+}
+
+
+TEST(PathSmootherTest, ShortcutZigzag)
+{
+  // Zigzag through open space, which shortcuts down to the straight line.
+  VecVector3d path;
+  for (int i = 0; i <= 10; ++i) {
+    path.emplace_back(2.0 * i, (i % 2 == 0) ? 0 : 1.5, 0);
+  }
+  const BatchCollisionChecker open = MakeBatchCollisionChecker([](const Vector3d&, const Vector3d&) { return true; });
+
+  PathSmoother::Params params;
+  params.max_shortcut_iters = 50;
+  PathSmoother smoother(params);
+
+  const SmoothResult r = smoother.Smooth(path, open);
+  EXPECT_FALSE(r.hit_deadline);
+  EXPECT_EQ(50, r.shortcut_iters);
+  ASSERT_EQ(2ul, r.path.size());
+  EXPECT_NEAR(20.0, r.cost, 1e-6);
+  ExpectValidTrajectory(r, params);
+
+  // Straight, so it only slows down at the ends. Accelerating to max_speed takes v^2 / (2 a) = 1 m.
+  EXPECT_NEAR(20.0 / params.max_speed + params.max_speed / params.max_accel, r.trajectory.back().t, 1e-6);
+
+  // The same seed gives the same trajectory.
+  const SmoothResult r2 = smoother.Smooth(path, open);
+  EXPECT_EQ(r.trajectory.size(), r2.trajectory.size());
+  EXPECT_EQ(r.trajectory.back().t, r2.trajectory.back().t);
+}
+
+
+TEST(PathSmootherTest, SmoothPlannedPath)
+{
+  const Vector3d start(-20, 0, 0), goal(20, 0, 0);
+  const Vector3d pmin(-30, -30, -2), pmax(30, 30, 2);
+
+  WorkerPool pool(3);
+  const BatchCollisionChecker checker = MakeBatchCollisionChecker(
+      [](const Vector3d& a, const Vector3d& b) { return !CrossesWall(a, b); }, &pool);
+
+  // A small tree, so that its path is far from the shortest.
+  RrtPlanner::Params planner_params;
+  planner_params.max_iters = 300;
+  planner_params.goal_radius = 5.0;
+  RrtPlanner planner(planner_params);
+  const PlanResult plan = planner.Plan(start, goal, pmin, pmax, checker);
+  ASSERT_TRUE(plan.found);
+
+  PathSmoother::Params params;
+  PathSmoother smoother(params);
+  const SmoothResult r = smoother.Smooth(plan.path, checker);
+
+  ASSERT_GE(r.path.size(), 3ul);
+  EXPECT_TRUE(r.path.front().isApprox(start));
+  EXPECT_TRUE(r.path.back().isApprox(goal));
+  for (size_t i = 1; i < r.path.size(); ++i) {
+    EXPECT_FALSE(CrossesWall(r.path.at(i - 1), r.path.at(i)));
+  }
+  EXPECT_NEAR(PathLength(r.path), r.cost, 1e-9);
+  EXPECT_LE(r.cost, plan.cost);
+
+  // Around the end of the wall is the shortest path.
+  const double around = 2.0 * Vector3d(20, 10, 0).norm();
+  EXPECT_GE(r.cost, around - 1e-6);
+  EXPECT_LT(r.cost, 1.05 * around);
+  std::cout << "Planned: " << plan.cost << " Smoothed: " << r.cost << " Shortest: " << around << std::endl;
+
+  ExpectValidTrajectory(r, params);
+}
+
+
+TEST(PathSmootherTest, Deadline)
+{
+  VecVector3d path;
+  for (int i = 0; i <= 100; ++i) {
+    path.emplace_back(0.5 * i, (i % 2 == 0) ? 0 : 0.5, 0);
+  }
+
+  // A slow collision checker, so that the deadline is hit before the path is straight.
+  const BatchCollisionChecker slow = [](const std::vector<Segment>& segments, std::vector<uint8_t>& is_free) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    is_free.assign(segments.size(), 1);
+  };
+
+  PathSmoother::Params params;
+  params.max_shortcut_iters = 1000;
+  params.shortcut_batch_size = 1;
+  PathSmoother smoother(params);
+
+  const SmoothResult r = smoother.Smooth(path, slow, 0.02);
+  EXPECT_TRUE(r.hit_deadline);
+  EXPECT_LT(r.shortcut_iters, 1000);
+  EXPECT_LE(r.cost, PathLength(path));
+  ExpectValidTrajectory(r, params);
+}
@@ -0,0 +1,75 @@
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "core/random.hpp"
+#include "rrt/point_hash_grid.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+TEST(PointHashGridTest, TestMatchesBruteForce)
+{
+  PointHashGrid grid(2.0);
+
+  std::vector<Vector3d> points;
+  for (size_t i = 0; i < 500; ++i) {
+    points.emplace_back(RandomUniformd(-20, 20), RandomUniformd(-20, 20), RandomUniformd(-5, 5));
+    grid.Insert(points.back(), i);
+  }
+  ASSERT_EQ(500ul, grid.Size());
+
+  for (int q = 0; q < 200; ++q) {
+    // Some of the queries are far outside of the points.
+    const Vector3d query(RandomUniformd(-40, 40), RandomUniformd(-40, 40), RandomUniformd(-10, 10));
+    const double radius = RandomUniformd(0.5, 4.0);
+
+    size_t nearest = 0;
+    std::vector<size_t> nearby;
+    for (size_t i = 0; i < points.size(); ++i) {
+      const double d = (points.at(i) - query).norm();
+      if (d < (points.at(nearest) - query).norm()) {
+        nearest = i;
+      }
+      if (d <= radius) {
+        nearby.emplace_back(i);
+      }
+    }
+
+    EXPECT_EQ(nearest, grid.Nearest(query));
+
+    std::vector<PointHashGrid::index_t> out;
+    EXPECT_EQ(nearby.size(), grid.Nearby(query, radius, out));
+    ASSERT_EQ(nearby.size(), out.size());
+
+    // Sorted by increasing distance.
+    for (size_t i = 1; i < out.size(); ++i) {
+      EXPECT_LE((points.at(out.at(i - 1)) - query).norm(), (points.at(out.at(i)) - query).norm());
+    }
+    std::sort(out.begin(), out.end());
+    EXPECT_TRUE(std::equal(nearby.begin(), nearby.end(), out.begin()));
+  }
+}
+
+
+TEST(PointHashGridTest, TestClear)
+{
+  PointHashGrid grid(1.0);
+  grid.Insert(Vector3d(0.5, 0.5, 0.5), 7);
+  EXPECT_EQ(7ul, grid.Nearest(Vector3d(100, 100, 100)));
+
+  std::vector<PointHashGrid::index_t> out;
+  EXPECT_EQ(0ul, grid.Nearby(Vector3d(10, 10, 10), 1.0, out));
+
+  grid.Clear(3.0);
+  EXPECT_EQ(0ul, grid.Size());
+  EXPECT_EQ(3.0, grid.CellSize());
+  EXPECT_EQ(0ul, grid.Nearby(Vector3d(0.5, 0.5, 0.5), 1.0, out));
+
+  grid.Insert(Vector3d(-4, 0, 0), 1);
+  grid.Insert(Vector3d(4, 0, 0), 2);
+  EXPECT_EQ(1ul, grid.Nearest(Vector3d(-0.1, 0, 0)));
+  EXPECT_EQ(2ul, grid.Nearest(Vector3d(0.1, 0, 0)));
+}
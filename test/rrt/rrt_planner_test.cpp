@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+#include <cmath>
+
+#include "rrt/rrt_planner.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+// Blocks segments that cross the plane x = 0 while |y| < 10 (a wall with gaps on both sides).
+static bool CrossesWall(const Vector3d& a, const Vector3d& b)
+{
+  if ((a.x() < 0) == (b.x() < 0) || a.x() == b.x()) {
+    return false;
+  }
+  const double t = a.x() / (a.x() - b.x());
+  const double y = a.y() + t * (b.y() - a.y());
+  return std::fabs(y) < 10;
+}
+
+
+static const BatchCollisionChecker kWallChecker = MakeBatchCollisionChecker(
+    [](const Vector3d& a, const Vector3d& b) { return !CrossesWall(a, b); });
+
+
+static void ExpectValidPath(const PlanResult& r, const Vector3d& start, const Vector3d& goal)
+{
+  ASSERT_TRUE(r.found);
+  ASSERT_GE(r.path.size(), 2ul);
+  EXPECT_TRUE(r.path.front().isApprox(start));
+  EXPECT_TRUE(r.path.back().isApprox(goal));
+
+  double cost = 0;
+  for (size_t i = 1; i < r.path.size(); ++i) {
+    EXPECT_FALSE(CrossesWall(r.path.at(i - 1), r.path.at(i)));
+    cost += (r.path.at(i) - r.path.at(i - 1)).norm();
+  }
+  EXPECT_NEAR(cost, r.cost, 1e-6);
+}
+
+
+TEST(RrtPlannerTest, SampleInformed)
+{
+  std::default_random_engine rng(0);
+  const Vector3d start(-3, 1, 2), goal(5, -2, 0);
+  const double c_best = 1.3 * (goal - start).norm();
+
+  Vector3d mean = Vector3d::Zero();
+  for (int i = 0; i < 2000; ++i) {
+    const Vector3d x = SampleInformed(start, goal, c_best, rng);
+    EXPECT_LE((x - start).norm() + (x - goal).norm(), c_best + 1e-9);
+    mean += x / 2000.0;
+  }
+
+  // Centered between the foci.
+  EXPECT_LT((mean - 0.5 * (start + goal)).norm(), 0.3);
+}
+
+
+TEST(RrtPlannerTest, PlanAroundWall)
+{
+  const Vector3d start(-20, 0, 0), goal(20, 0, 0);
+  const Vector3d pmin(-30, -30, -2), pmax(30, 30, 2);
+
+  RrtPlanner::Params params;
+  params.max_iters = 2000;
+  params.goal_radius = 5.0;
+  RrtPlanner planner(params);
+
+  const PlanResult r = planner.Plan(start, goal, pmin, pmax, kWallChecker);
+  ExpectValidPath(r, start, goal);
+  EXPECT_EQ(2000, r.iters);
+  EXPECT_FALSE(r.hit_deadline);
+
+  // Has to go around the end of the wall.
+  const double around = 2.0 * Vector3d(20, 10, 0).norm();
+  EXPECT_GE(r.cost, around - 1e-6);
+  EXPECT_LT(r.cost, 1.5 * around);
+}
+
+
+TEST(RrtPlannerTest, ParallelTreesAndDeadline)
+{
+  const Vector3d start(-20, 0, 0), goal(20, 0, 0);
+  const Vector3d pmin(-30, -30, -2), pmax(30, 30, 2);
+
+  RrtPlanner::Params params;
+  params.max_iters = 1500;
+  params.goal_radius = 5.0;
+  params.num_trees = 4;
+  params.num_threads = 3;
+  RrtPlanner planner(params);
+
+  const PlanResult r = planner.Plan(start, goal, pmin, pmax, kWallChecker);
+  ExpectValidPath(r, start, goal);
+  EXPECT_EQ(4 * 1500, r.iters);
+  EXPECT_GE(r.tree_index, 0);
+  EXPECT_LT(r.tree_index, 4);
+
+  // With a (very) short deadline, the planner stops early.
+  params.max_iters = 1000000;
+  RrtPlanner anytime(params);
+  const PlanResult r_deadline = anytime.Plan(start, goal, pmin, pmax, kWallChecker, 0.05);
+  EXPECT_TRUE(r_deadline.hit_deadline);
+  EXPECT_LT(r_deadline.iters, 4 * 1000000);
+  if (r_deadline.found) {
+    ExpectValidPath(r_deadline, start, goal);
+  }
+}
+
+
+TEST(RrtPlannerTest, ReuseTrees)
+{
+  const Vector3d goal(20, 0, 0);
+  const Vector3d pmin(-30, -30, -2), pmax(30, 30, 2);
+
+  RrtPlanner::Params params;
+  params.max_iters = 2000;
+  params.goal_radius = 5.0;
+  params.reuse_trees = true;
+  RrtPlanner planner(params);
+
+  const Vector3d start0(-20, 0, 0);
+  const PlanResult r0 = planner.Plan(start0, goal, pmin, pmax, kWallChecker);
+  ExpectValidPath(r0, start0, goal);
+  EXPECT_EQ(0, r0.reused_nodes);
+
+  // Move partway along the first edge of the path, and replan.
+  const Vector3d start1 = r0.path.at(0) + 0.5 * (r0.path.at(1) - r0.path.at(0));
+  const PlanResult r1 = planner.Plan(start1, goal, pmin, pmax, kWallChecker);
+  ExpectValidPath(r1, start1, goal);
+  EXPECT_GT(r1.reused_nodes, 1000);
+
+  // The rest of the old path is still in the tree, so the new one can only be shorter.
+  EXPECT_LE(r1.cost, r0.cost - (start1 - start0).norm() + 1e-6);
+
+  // Without the old tree, nothing is reused.
+  planner.ResetTrees();
+  const PlanResult r2 = planner.Plan(start1, goal, pmin, pmax, kWallChecker);
+  EXPECT_EQ(0, r2.reused_nodes);
+}
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
+#include <cmath>
 #include <iostream>
+#include <memory>
 
 #include "rrt/rrt.hpp"
 #include "rrt/nanoflann_adaptor.hpp"
@@ -94,3 +96,192 @@ TEST(TreeTest, Nearby)
   tree.Nearby(kd, Vector3d(0, 0, 0), r + 0.01, out);
   EXPECT_EQ(3ul, out.size());
 }
+
+
+TEST(TreeTest, RewireUpdatesDescendants)
+{
+  // 0 -> 1 -> 2 -> 3, and 0 -> 4.
+  Tree tree;
+  tree.AddNode(Node(Vector3d(0, 0, 0), -1, 0));
+  tree.AddNode(Node(Vector3d(0, 2, 0), 0, 2));
+  tree.AddNode(Node(Vector3d(1, 2, 0), 1, 3));
+  tree.AddNode(Node(Vector3d(2, 2, 0), 2, 4));
+  tree.AddNode(Node(Vector3d(1, 0, 0), 0, 1));
+
+  EXPECT_EQ(4, tree.FirstChild(0));
+  EXPECT_EQ(1, tree.NextSibling(4));
+  EXPECT_EQ(-1, tree.NextSibling(1));
+  EXPECT_EQ(-1, tree.FirstChild(3));
+
+  // Moving a subtree between parents.
+  tree.Rewire(2, 4, 3);
+  EXPECT_EQ(-1, tree.FirstChild(1));
+  EXPECT_EQ(2, tree.FirstChild(4));
+  EXPECT_DOUBLE_EQ(4, tree.GetCost(3));
+
+  tree.Rewire(3, 4, 1 + std::sqrt(5));
+  EXPECT_EQ(3, tree.FirstChild(4));
+  EXPECT_EQ(2, tree.NextSibling(3));
+  EXPECT_EQ(-1, tree.FirstChild(2));
+
+  // Every node below 4 changes by as much as 4 does.
+  tree.Rewire(4, 1, 2 + std::sqrt(5));
+  const double delta = 1 + std::sqrt(5);
+  EXPECT_EQ(4, tree.FirstChild(1));
+  EXPECT_EQ(1, tree.FirstChild(0));
+  EXPECT_EQ(1, tree.GetParent(4));
+  EXPECT_DOUBLE_EQ(3 + delta, tree.GetCost(2));
+  EXPECT_DOUBLE_EQ(1 + std::sqrt(5) + delta, tree.GetCost(3));
+  EXPECT_DOUBLE_EQ(2, tree.GetCost(1));
+}
+
+
+TEST(TreeTest, CostsStayExact)
+{
+  const Vector3d pmin(-30, -30, -5), pmax(30, 30, 5);
+  const BatchCollisionChecker open = MakeBatchCollisionChecker([](const Vector3d&, const Vector3d&) { return true; });
+
+  Tree tree;
+  BuildTree(tree, Vector3d(-20, 0, 0), Vector3d(20, 0, 0),
+            [&pmin, &pmax]() { return SampleBoxPoint(pmin, pmax); }, open, 8.0, 2000);
+  ASSERT_GT(tree.Size(), 1000ul);
+
+  // Every node's cost is the length of its path from the root, and it's in its parent's child list.
+  size_t num_children = 0;
+  for (size_t i = 1; i < tree.Size(); ++i) {
+    const int parent = tree.GetParent(i);
+    ASSERT_GE(parent, 0);
+    EXPECT_NEAR(tree.GetCost(parent) + (tree.GetPoint(i) - tree.GetPoint(parent)).norm(), tree.GetCost(i), 1e-9);
+
+    bool found = false;
+    for (int c = tree.FirstChild(i); c >= 0; c = tree.NextSibling(c)) {
+      EXPECT_EQ((int)i, tree.GetParent(c));
+      ++num_children;
+    }
+    for (int c = tree.FirstChild(parent); c >= 0 && !found; c = tree.NextSibling(c)) {
+      found = (c == (int)i);
+    }
+    EXPECT_TRUE(found);
+  }
+  for (int c = tree.FirstChild(0); c >= 0; c = tree.NextSibling(c)) {
+    ++num_children;
+  }
+  EXPECT_EQ(tree.Size() - 1, num_children);
+}
+
+
+// Blocks segments that cross the plane x = 0 while |y| < 10.
+static bool CrossesWall(const Vector3d& a, const Vector3d& b)
+{
+  if ((a.x() < 0) == (b.x() < 0) || a.x() == b.x()) {
+    return false;
+  }
+  const double t = a.x() / (a.x() - b.x());
+  const double y = a.y() + t * (b.y() - a.y());
+  return std::fabs(y) < 10;
+}
+
+
+TEST(TreeTest, BatchCollisionChecker)
+{
+  const CollisionChecker checker = [](const Vector3d& a, const Vector3d& b) { return !CrossesWall(a, b); };
+  WorkerPool pool(2);
+  const BatchCollisionChecker batch = MakeBatchCollisionChecker(checker, &pool);
+
+  std::vector<Segment> segments;
+  for (int i = 0; i < 50; ++i) {
+    segments.emplace_back(Vector3d(-5 + 0.2 * i, 0.5 * i - 12, 0), Vector3d(3, 0.3 * i - 8, 1));
+  }
+
+  std::vector<uint8_t> is_free;
+  batch(segments, is_free);
+  ASSERT_EQ(segments.size(), is_free.size());
+  for (size_t i = 0; i < segments.size(); ++i) {
+    EXPECT_EQ(checker(segments.at(i).a, segments.at(i).b), is_free.at(i) == 1);
+  }
+}
+
+
+TEST(TreeTest, BuildTreeBatchedMatchesSerial)
+{
+  VecVector3d samples;
+  for (int i = 0; i < 300; ++i) {
+    samples.emplace_back(SampleBoxPoint(Vector3d(-30, -30, -5), Vector3d(30, 30, 5)));
+  }
+
+  const auto make_sampler = [&samples]() {
+    std::shared_ptr<size_t> next = std::make_shared<size_t>(0);
+    return [&samples, next]() { return samples.at((*next)++ % samples.size()); };
+  };
+
+  // Serial, one segment at a time.
+  int num_serial_checks = 0;
+  const CollisionChecker checker = [](const Vector3d& a, const Vector3d& b) { return !CrossesWall(a, b); };
+  const CollisionChecker counted = [&](const Vector3d& a, const Vector3d& b) {
+    ++num_serial_checks;
+    return checker(a, b);
+  };
+  Tree serial;
+  BuildTree(serial, Vector3d(-20, 0, 0), Vector3d(20, 0, 0), make_sampler(), counted, 8.0, (int)samples.size());
+
+  // Batched, in parallel.
+  WorkerPool pool(3);
+  Tree batched;
+  BuildTree(batched, Vector3d(-20, 0, 0), Vector3d(20, 0, 0), make_sampler(),
+            MakeBatchCollisionChecker(checker, &pool), 8.0, (int)samples.size());
+
+  ASSERT_EQ(serial.Size(), batched.Size());
+  for (size_t i = 0; i < serial.Size(); ++i) {
+    EXPECT_EQ(serial.GetNode(i).parent, batched.GetNode(i).parent);
+    EXPECT_NEAR(serial.GetNode(i).cost_so_far, batched.GetNode(i).cost_so_far, 1e-9);
+  }
+
+  // The wall is in the way, so some edges must have been checked.
+  EXPECT_GT(num_serial_checks, 0);
+  std::cout << "Serial collision checks: " << num_serial_checks << std::endl;
+}
+
+
+TEST(TreeTest, RerootTree)
+{
+  const Vector3d pmin(-30, -30, -5), pmax(30, 30, 5);
+  const BatchCollisionChecker open = MakeBatchCollisionChecker([](const Vector3d&, const Vector3d&) { return true; });
+  const BatchCollisionChecker wall = MakeBatchCollisionChecker(
+      [](const Vector3d& a, const Vector3d& b) { return !CrossesWall(a, b); });
+
+  // Grow a tree through open space, then a wall shows up.
+  Tree tree;
+  BuildTree(tree, Vector3d(-20, 0, 0), Vector3d(20, 0, 0),
+            [&pmin, &pmax]() { return SampleBoxPoint(pmin, pmax); }, open, 8.0, 1000);
+  const size_t size_before = tree.Size();
+
+  // Move the root, and shrink the box so that it cuts off some nodes too.
+  const Vector3d root(-15, 3, 0);
+  const Vector3d pmin_new(-30, -30, -5), pmax_new(25, 30, 5);
+  const size_t kept = RerootTree(tree, root, pmin_new, pmax_new, wall, 8.0);
+
+  ASSERT_EQ(kept + 1, tree.Size());
+  EXPECT_GT(kept, 0ul);
+  EXPECT_LT(kept, size_before);
+  EXPECT_DOUBLE_EQ(8.0, tree.IndexCellSize());
+
+  EXPECT_TRUE(tree.GetPoint(0).isApprox(root));
+  EXPECT_EQ(-1, tree.GetNode(0).parent);
+  EXPECT_EQ(0, tree.GetNode(0).cost_so_far);
+
+  // Parents come first, every edge is free, and the costs are exact.
+  for (size_t i = 1; i < tree.Size(); ++i) {
+    const Node node = tree.GetNode(i);
+    ASSERT_GE(node.parent, 0);
+    ASSERT_LT(node.parent, (int)i);
+    EXPECT_FALSE(CrossesWall(tree.GetPoint(node.parent), node.point));
+    EXPECT_TRUE((node.point.array() <= pmax_new.array()).all());
+    EXPECT_NEAR(tree.GetNode(node.parent).cost_so_far + (node.point - tree.GetPoint(node.parent)).norm(),
+                node.cost_so_far, 1e-9);
+  }
+
+  // The tree can keep growing from there.
+  Tree::index_t z_new;
+  EXPECT_TRUE(ExtendTree(tree, Vector3d(-10, 5, 0), wall, 8.0, z_new));
+  EXPECT_EQ(kept + 1, z_new);
+}
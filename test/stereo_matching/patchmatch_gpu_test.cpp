@@ -11,6 +11,9 @@
 #include "core/file_utils.hpp"
 #include "vision_core/image_util.hpp"
 #include "patchmatch_gpu/patchmatch_gpu.h"
+#include "patchmatch_gpu/sgm_gpu.h"
+#include "patchmatch_gpu/disparity_mesher_gpu.h"
+#include "stereo_matching/stereo_matching.hpp"
 #include "dataset/euroc_dataset.hpp"
 
 using namespace bm;
@@ -92,6 +95,432 @@ TEST(PatchmatchGpuTest, Test01)
 }
 
 
+TEST(PatchmatchGpuTest, MatchAsync)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+
+  const int downsample_factor = 2;
+  cv::resize(il, il, il.size() / downsample_factor);
+  cv::resize(ir, ir, ir.size() / downsample_factor);
+
+  PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+  params.cost_alpha = 0.9;
+  params.patchmatch_iters = 3;
+
+  PatchmatchGpu pm(params);
+  Image1f disp, dispr;
+  pm.Match(il, ir, disp, dispr);
+
+  const int num_frames = 10;
+
+  Timer timer(true);
+  for (int i = 0; i < num_frames; ++i) {
+    pm.Match(il, ir, disp, dispr);
+  }
+  LOG(INFO) << "Blocking: " << timer.Elapsed().milliseconds() / num_frames << " ms/frame" << std::endl;
+
+  // Keep one pair in flight while the next one is submitted.
+  std::vector<std::shared_future<PatchmatchGpu::MatchResult>> futures;
+  timer.Reset();
+  for (int i = 0; i < num_frames; ++i) {
+    futures.emplace_back(pm.MatchAsync(il, ir));
+    if (i > 0) {
+      futures.at(i - 1).wait();
+    }
+  }
+  futures.back().wait();
+  LOG(INFO) << "Pipelined: " << timer.Elapsed().milliseconds() / num_frames << " ms/frame" << std::endl;
+
+  // The same pair should give the same disparity, no matter how the work was overlapped.
+  for (const auto& f : futures) {
+    EXPECT_EQ(0, cv::norm(disp, f.get().disp, cv::NORM_INF));
+    EXPECT_EQ(0, cv::norm(dispr, f.get().dispr, cv::NORM_INF));
+  }
+}
+
+
+// Fraction of foreground pixels in a where b is within tol px.
+static double Agreement(const Image1f& a, const Image1f& b, float tol)
+{
+  int fg = 0, agree = 0;
+  for (int y = 0; y < a.rows; ++y) {
+    for (int x = 0; x < a.cols; ++x) {
+      if (a(y, x) <= 0) { continue; }
+      ++fg;
+      agree += (std::fabs(a(y, x) - b(y, x)) <= tol) ? 1 : 0;
+    }
+  }
+  return fg > 0 ? (double)agree / (double)fg : 0.0;
+}
+
+
+TEST(PatchmatchGpuTest, PyramidAndWarmStart)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+
+  const int downsample_factor = 2;
+  cv::resize(il, il, il.size() / downsample_factor);
+  cv::resize(ir, ir, ir.size() / downsample_factor);
+
+  PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+  params.cost_alpha = 0.9;
+  params.patchmatch_iters = 3;
+
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(cam, 0.2);
+
+  Image1f disp_ref, dispr_ref;
+  PatchmatchGpu pm_ref(params);
+  pm_ref.Match(il, ir, disp_ref, dispr_ref);
+
+  params.pyramid_levels = 3;
+  params.patchmatch_iters = 1;
+  params.warm_start = true;
+  PatchmatchGpu pm(params, stereo_rig);
+
+  // The first pair is a cold start, and the rest warm start from it (the camera doesn't move).
+  const Transform3d T_cur_prev = Transform3d::Identity();
+  Image1f disp, dispr;
+  pm.Match(il, ir, disp, dispr);
+  LOG(INFO) << "Pyramid agreement: " << Agreement(disp_ref, disp, 2.0f) << std::endl;
+
+  Timer timer(true);
+  const int num_frames = 10;
+  for (int i = 0; i < num_frames; ++i) {
+    const PatchmatchGpu::MatchResult result = pm.MatchAsync(il, ir, &T_cur_prev).get();
+    disp = result.disp;
+    dispr = result.dispr;
+  }
+  LOG(INFO) << "Warm start: " << timer.Elapsed().milliseconds() / num_frames << " ms/frame" << std::endl;
+  LOG(INFO) << "Warm start agreement: " << Agreement(disp_ref, disp, 2.0f) << std::endl;
+
+  EXPECT_EQ(il.size(), disp.size());
+  EXPECT_EQ(il.size(), dispr.size());
+
+  cv::imshow("Reference", VisualizeDisp(disp_ref, 128, downsample_factor));
+  cv::imshow("Warm start", VisualizeDisp(disp, 128, downsample_factor));
+  cv::waitKey(0);
+}
+
+
+TEST(PatchmatchGpuTest, BenchmarkTiledPropagation)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+
+  for (const int downsample_factor : { 1, 2, 4 }) {
+    Image1b iml, imr;
+    cv::resize(il, iml, il.size() / downsample_factor);
+    cv::resize(ir, imr, ir.size() / downsample_factor);
+
+    PatchmatchGpu::Params params;
+    params.matcher_params.templ_cols = 31;
+    params.matcher_params.templ_rows = 11;
+    params.matcher_params.max_disp = 128 / downsample_factor;
+    params.matcher_params.max_matching_cost = 0.15;
+    params.matcher_params.bidirectional = true;
+    params.matcher_params.subpixel_refinement = false;
+
+    PatchmatchGpu pm(params);
+    const Image1f init = pm.SparseInit(iml, imr, params.init_dilate_factor);
+
+    cv::cuda::GpuMat tmp, iml_gpu, imr_gpu, Gx, Gy, Gl, Gr, disp_init, disp;
+    tmp.upload(iml);
+    tmp.convertTo(iml_gpu, CV_32FC1);
+    tmp.upload(imr);
+    tmp.convertTo(imr_gpu, CV_32FC1);
+
+    const cv::Ptr<cv::cuda::Filter> sobel_x = cv::cuda::createSobelFilter(CV_32FC1, CV_32FC1, 1, 0, 3);
+    const cv::Ptr<cv::cuda::Filter> sobel_y = cv::cuda::createSobelFilter(CV_32FC1, CV_32FC1, 0, 1, 3);
+    GradientMagnitude(sobel_x, sobel_y, iml_gpu, Gx, Gy, Gl);
+    GradientMagnitude(sobel_x, sobel_y, imr_gpu, Gx, Gy, Gr);
+    disp_init.upload(init);
+
+    const int num_sweeps = 50;
+    Image1f result_global, result_tiled;
+    TextureCache textures;
+
+    for (TextureCache* tex : { (TextureCache*)nullptr, &textures }) {
+      cv::cuda::Stream stream;
+
+      // Warm up (and create the textures) outside of the timing.
+      disp_init.copyTo(disp, stream);
+      PropagateSweep(iml_gpu, imr_gpu, Gl, Gr, disp, 0.9, tex, stream);
+      stream.waitForCompletion();
+
+      Timer timer(true);
+      for (int i = 0; i < num_sweeps; ++i) {
+        disp_init.copyTo(disp, stream);
+        PropagateSweep(iml_gpu, imr_gpu, Gl, Gr, disp, 0.9, tex, stream);
+      }
+      stream.waitForCompletion();
+
+      LOG(INFO) << iml.size() << (tex ? " tiled: " : " global: ")
+                << timer.Elapsed().milliseconds() / num_sweeps << " ms/sweep" << std::endl;
+
+      disp.download(tex ? result_tiled : result_global);
+    }
+
+    // Texture interpolation is slightly coarser, which can flip a few near-ties.
+    const double agreement = Agreement(result_global, result_tiled, 1.0f);
+    LOG(INFO) << iml.size() << " agreement: " << agreement << std::endl;
+    EXPECT_GT(agreement, 0.9);
+  }
+}
+
+
+// 8-bit images and __half gradients should give about the same disparity as float storage.
+TEST(PatchmatchGpuTest, CompactStorage)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+
+  const int downsample_factor = 2;
+  cv::resize(il, il, il.size() / downsample_factor);
+  cv::resize(ir, ir, ir.size() / downsample_factor);
+
+  PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+
+  for (const bool tiled : { false, true }) {
+    params.tiled_propagation = tiled;
+
+    params.compact_storage = false;
+    PatchmatchGpu pm_float(params);
+    params.compact_storage = true;
+    PatchmatchGpu pm_compact(params);
+
+    Image1f disp_float, disp_compact, dispr;
+    pm_float.Match(il, ir, disp_float, dispr);
+    pm_compact.Match(il, ir, disp_compact, dispr);
+
+    const int num_frames = 10;
+    Timer timer(true);
+    for (int i = 0; i < num_frames; ++i) { pm_float.Match(il, ir, disp_float, dispr); }
+    const double ms_float = timer.Tock().milliseconds() / num_frames;
+    for (int i = 0; i < num_frames; ++i) { pm_compact.Match(il, ir, disp_compact, dispr); }
+    const double ms_compact = timer.Tock().milliseconds() / num_frames;
+
+    const double agreement = Agreement(disp_float, disp_compact, 2.0f);
+    LOG(INFO) << (tiled ? "tiled" : "global") << " float: " << ms_float << " ms  compact: "
+              << ms_compact << " ms  agreement: " << agreement << std::endl;
+    EXPECT_EQ(il.size(), disp_compact.size());
+    EXPECT_GT(agreement, 0.9);
+  }
+}
+
+
+// A batch should give the same disparity as matching each pair on its own, in fewer launches.
+TEST(PatchmatchGpuTest, MatchBatch)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+
+  const int downsample_factor = 2;
+  cv::resize(il, il, il.size() / downsample_factor);
+  cv::resize(ir, ir, ir.size() / downsample_factor);
+
+  PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+
+  // The second pair is brighter, so that a mixup between pairs would show up.
+  const int K = 4;
+  std::vector<Image1b> imls, imrs;
+  for (int k = 0; k < K; ++k) {
+    Image1b l, r;
+    il.convertTo(l, CV_8UC1, 1.0, (k == 1) ? 30.0 : 0.0);
+    ir.convertTo(r, CV_8UC1, 1.0, (k == 1) ? 30.0 : 0.0);
+    imls.emplace_back(l);
+    imrs.emplace_back(r);
+  }
+
+  for (const bool graph : { false, true }) {
+    params.batch_cuda_graph = graph;
+    PatchmatchGpu pm(params);
+
+    Image1f disp_ref, dispr_ref;
+    pm.Match(imls.at(1), imrs.at(1), disp_ref, dispr_ref);
+
+    // The first batch allocates, and with graphs the second one is captured.
+    std::vector<Image1f> disps, disprs;
+    pm.MatchBatch(imls, imrs, disps, disprs);
+    pm.MatchBatch(imls, imrs, disps, disprs);
+
+    const int num_batches = 5;
+    Timer timer(true);
+    for (int i = 0; i < num_batches; ++i) { pm.MatchBatch(imls, imrs, disps, disprs); }
+    const double ms_batch = timer.Tock().milliseconds() / (num_batches * K);
+    for (int i = 0; i < num_batches * K; ++i) { pm.Match(imls.at(1), imrs.at(1), disp_ref, dispr_ref); }
+    const double ms_single = timer.Tock().milliseconds() / (num_batches * K);
+
+    ASSERT_EQ(K, (int)disps.size());
+    ASSERT_EQ(K, (int)disprs.size());
+    const double agreement = Agreement(disp_ref, disps.at(1), 2.0f);
+    LOG(INFO) << (graph ? "graph" : "no graph") << " batch: " << ms_batch << " ms/pair  single: "
+              << ms_single << " ms/pair  agreement: " << agreement << std::endl;
+    EXPECT_EQ(il.size(), disps.at(1).size());
+    EXPECT_GT(agreement, 0.9);
+  }
+}
+
+
+// Head to head timing of patchmatch and semi-global matching (GPU, and OpenCV on the CPU).
+TEST(PatchmatchGpuTest, BenchmarkSgm)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+
+  for (const int downsample_factor : { 1, 2 }) {
+    Image1b iml, imr;
+    cv::resize(il, iml, il.size() / downsample_factor);
+    cv::resize(ir, imr, ir.size() / downsample_factor);
+    const int num_disp = 128 / downsample_factor;
+
+    PatchmatchGpu::Params params;
+    params.matcher_params.templ_cols = 31;
+    params.matcher_params.templ_rows = 11;
+    params.matcher_params.max_disp = num_disp;
+    params.matcher_params.max_matching_cost = 0.15;
+    params.matcher_params.bidirectional = true;
+    params.matcher_params.subpixel_refinement = false;
+
+    PatchmatchGpu::Params sgm_params = params;
+    sgm_params.use_sgm = true;
+    sgm_params.sgm_params.num_disp = num_disp;
+
+    stereo::SgbmMatcher::Params sgbm_params;
+    sgbm_params.num_disp = num_disp;
+    sgbm_params.block_size = 5;
+    sgbm_params.mode = "HH4";
+    sgbm_params.P1 = 8 * 5 * 5;
+    sgbm_params.P2 = 32 * 5 * 5;
+    stereo::SgbmMatcher sgbm(sgbm_params);
+
+    PatchmatchGpu pm(params);
+    PatchmatchGpu sgm(sgm_params);
+
+    const int num_frames = 10;
+    Image1f disp_pm, disp_sgm, disp_sgbm, dispr;
+
+    // Warm up (and allocate) outside of the timing.
+    pm.Match(iml, imr, disp_pm, dispr);
+    sgm.Match(iml, imr, disp_sgm, dispr);
+    sgbm.Match(iml, imr, disp_sgbm);
+
+    Timer timer(true);
+    for (int i = 0; i < num_frames; ++i) { pm.Match(iml, imr, disp_pm, dispr); }
+    const double ms_pm = timer.Tock().milliseconds() / num_frames;
+
+    for (int i = 0; i < num_frames; ++i) { sgm.Match(iml, imr, disp_sgm, dispr); }
+    const double ms_sgm = timer.Tock().milliseconds() / num_frames;
+
+    for (int i = 0; i < num_frames; ++i) { sgbm.Match(iml, imr, disp_sgbm); }
+    const double ms_sgbm = timer.Tock().milliseconds() / num_frames;
+
+    LOG(INFO) << iml.size() << " patchmatch: " << ms_pm << " ms  sgm (gpu): " << ms_sgm
+              << " ms  sgbm (cpu, HH4): " << ms_sgbm << " ms" << std::endl;
+    LOG(INFO) << iml.size() << " sgm agreement with patchmatch: "
+              << Agreement(disp_pm, disp_sgm, 2.0f) << std::endl;
+
+    EXPECT_GT(cv::countNonZero(disp_sgm > 0), 0);
+  }
+}
+
+
+TEST(PatchmatchGpuTest, DisparityMesherPlane)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(cam, 0.2);
+
+  DisparityMesherGpu::Params params;
+  params.grid_step = 4;
+  DisparityMesherGpu mesher(params, stereo_rig);
+
+  // A fronto-parallel plane, so every grid node is valid and every cell has both triangles.
+  const Image1f disp(480, 752, 20.0f);
+  mesher::TriangleMesh mesh;
+  mesher.Triangulate(disp, Image1b(), mesh);
+
+  const int grid_cols = (752 - 1) / 4 + 1;
+  const int grid_rows = (480 - 1) / 4 + 1;
+  EXPECT_EQ(grid_cols * grid_rows, (int)mesh.vertices.size());
+  EXPECT_EQ(2 * (grid_cols - 1) * (grid_rows - 1), (int)mesh.triangles.size());
+
+  const double depth = stereo_rig.DispToDepth(20.0);
+  for (const Vector3d& v : mesh.vertices) {
+    EXPECT_NEAR(depth, v.z(), 1e-3);
+  }
+  for (const Vector3i& t : mesh.triangles) {
+    EXPECT_GE(t.minCoeff(), 0);
+    EXPECT_LT(t.maxCoeff(), (int)mesh.vertices.size());
+  }
+
+  // Masking out the left half removes its vertices.
+  Image1b mask(480, 752, (uchar)0);
+  mask(cv::Rect(376, 0, 376, 480)).setTo(255);
+  mesher.Triangulate(disp, mask, mesh);
+  EXPECT_EQ(grid_rows * (grid_cols - 376 / 4), (int)mesh.vertices.size());
+}
+
+
+TEST(PatchmatchGpuTest, DisparityMesherDiscontinuity)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(cam, 0.2);
+
+  DisparityMesherGpu::Params params;
+  params.grid_step = 8;
+  params.edge_max_depth_change = 1.0;
+  DisparityMesherGpu mesher(params, stereo_rig);
+
+  // An object at ~2m in front of a background at ~8m. No triangle should span the two.
+  Image1f disp(480, 752, (float)stereo_rig.DepthToDisp(8.0));
+  disp(cv::Rect(200, 120, 320, 240)).setTo((float)stereo_rig.DepthToDisp(2.0));
+
+  mesher::TriangleMesh mesh;
+  mesher.Triangulate(disp, Image1b(), mesh);
+
+  const int grid_cols = (752 - 1) / 8 + 1;
+  const int grid_rows = (480 - 1) / 8 + 1;
+  EXPECT_EQ(grid_cols * grid_rows, (int)mesh.vertices.size());
+  EXPECT_LT((int)mesh.triangles.size(), 2 * (grid_cols - 1) * (grid_rows - 1));
+  EXPECT_GT(mesh.triangles.size(), 0ul);
+
+  for (const Vector3i& t : mesh.triangles) {
+    const double z0 = mesh.vertices.at(t(0)).z();
+    const double z1 = mesh.vertices.at(t(1)).z();
+    const double z2 = mesh.vertices.at(t(2)).z();
+    EXPECT_LE(std::fabs(z0 - z1), params.edge_max_depth_change);
+    EXPECT_LE(std::fabs(z1 - z2), params.edge_max_depth_change);
+    EXPECT_LE(std::fabs(z0 - z2), params.edge_max_depth_change);
+  }
+}
+
+
 TEST(PatchmatchGpuTest, Sequence)
 {
   // const std::string folder = "/home/milo/datasets/Unity3D/farmsim/waypoints1";
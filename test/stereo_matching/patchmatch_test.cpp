@@ -186,3 +186,150 @@ TEST(PatchmatchTest, Test01)
 
   cv::waitKey(0);
 }
+
+
+TEST(PatchmatchTest, RedBlackPropagation)
+{
+  const int w = 320;
+  const int h = 240;
+  const float true_disp = 8.0f;
+
+  // The right image is the left image shifted by true_disp.
+  Image1f texture(h, w + (int)true_disp);
+  cv::RNG rng(123);
+  rng.fill(texture, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(texture, texture, cv::Size(3, 3), 0);
+
+  const Image1f iml = texture(cv::Rect(0, 0, w, h)).clone();
+  const Image1f imr = texture(cv::Rect((int)true_disp, 0, w, h)).clone();
+
+  Image1b iml_1b, imr_1b;
+  iml.convertTo(iml_1b, CV_8UC1);
+  imr.convertTo(imr_1b, CV_8UC1);
+  Image1f Gl, Gr;
+  ComputeGradient(iml_1b, Gl);
+  ComputeGradient(imr_1b, Gr);
+
+  Image1f disp_init(h, w);
+  rng.fill(disp_init, cv::RNG::UNIFORM, 0, 2 * true_disp);
+
+  const L1GradientCost cost;
+  Image1f disp_1t, disp_4t;
+
+  for (const int num_threads : { 1, 4 }) {
+    Patchmatch::Params params;
+    params.num_threads = num_threads;
+    Patchmatch pm(params);
+
+    Image1f disp = disp_init.clone();
+    Timer timer(true);
+    for (int iter = 0; iter < 4; ++iter) {
+      pm.PropagateRedBlack(iml, imr, Gl, Gr, disp, cost, 3, 3);
+    }
+    LOG(INFO) << "PropagateRedBlack with " << num_threads << " threads took: "
+              << timer.Elapsed().milliseconds() << " ms" << std::endl;
+
+    (num_threads == 1 ? disp_1t : disp_4t) = disp;
+  }
+
+  // Red-black updates don't depend on how the rows are split up between threads.
+  EXPECT_EQ(0, cv::norm(disp_1t, disp_4t, cv::NORM_INF));
+
+  // Away from the left edge (where true_disp isn't possible), almost every pixel should converge.
+  int num_good = 0, num_total = 0;
+  for (int y = 2; y < h - 2; ++y) {
+    for (int x = 2 * (int)true_disp; x < w - 2; ++x) {
+      ++num_total;
+      num_good += (std::fabs(disp_1t(y, x) - true_disp) < 1.0f) ? 1 : 0;
+    }
+  }
+  EXPECT_GT((double)num_good / (double)num_total, 0.9);
+}
+
+
+TEST(PatchmatchTest, ForegroundTiles)
+{
+  Image1b mask(100, 130, (uchar)0);
+  mask(cv::Rect(60, 40, 10, 10)).setTo(255);
+
+  // The blob straddles two tiles.
+  const std::vector<cv::Rect> tiles = ForegroundTiles(mask, 32, 0);
+  ASSERT_EQ(2ul, tiles.size());
+  EXPECT_EQ(cv::Rect(32, 32, 32, 32), tiles.at(0));
+  EXPECT_EQ(cv::Rect(64, 32, 32, 32), tiles.at(1));
+
+  // Plus one ring of tiles around them.
+  const std::vector<cv::Rect> dilated = ForegroundTiles(mask, 32, 1);
+  EXPECT_EQ(12ul, dilated.size());
+
+  mask(cv::Rect(120, 98, 2, 2)).setTo(255);
+  const std::vector<cv::Rect> corner = ForegroundTiles(mask, 32, 0);
+  ASSERT_EQ(3ul, corner.size());
+  EXPECT_EQ(cv::Rect(96, 96, 32, 4), corner.at(2));
+
+  // The first two tiles share rows, and the corner tile is separate.
+  const std::vector<cv::Rect> bands = TileRowBands(corner, mask.cols);
+  ASSERT_EQ(2ul, bands.size());
+  EXPECT_EQ(cv::Rect(0, 32, 130, 32), bands.at(0));
+  EXPECT_EQ(cv::Rect(0, 96, 130, 4), bands.at(1));
+
+  EXPECT_TRUE(ForegroundTiles(Image1b(100, 130, (uchar)0), 32, 1).empty());
+}
+
+
+TEST(PatchmatchTest, RedBlackTiles)
+{
+  const int w = 320;
+  const int h = 240;
+  const float true_disp = 8.0f;
+
+  Image1f texture(h, w + (int)true_disp);
+  cv::RNG rng(123);
+  rng.fill(texture, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(texture, texture, cv::Size(3, 3), 0);
+
+  const Image1f iml = texture(cv::Rect(0, 0, w, h)).clone();
+  const Image1f imr = texture(cv::Rect((int)true_disp, 0, w, h)).clone();
+
+  Image1b iml_1b, imr_1b;
+  iml.convertTo(iml_1b, CV_8UC1);
+  imr.convertTo(imr_1b, CV_8UC1);
+  Image1f Gl, Gr;
+  ComputeGradient(iml_1b, Gl);
+  ComputeGradient(imr_1b, Gr);
+
+  Image1f disp_init(h, w);
+  rng.fill(disp_init, cv::RNG::UNIFORM, 0, 2 * true_disp);
+
+  Image1b mask(h, w, (uchar)0);
+  mask(cv::Rect(100, 80, 60, 50)).setTo(255);
+  const std::vector<cv::Rect> tiles = ForegroundTiles(mask, 32, 0);
+
+  Image1b in_tiles(h, w, (uchar)0);
+  for (const cv::Rect& tile : tiles) {
+    in_tiles(tile).setTo(255);
+  }
+
+  Patchmatch::Params params;
+  Patchmatch pm(params);
+
+  const L1GradientCost cost;
+  Image1f disp = disp_init.clone();
+  for (int iter = 0; iter < 4; ++iter) {
+    pm.PropagateRedBlack(iml, imr, Gl, Gr, disp, cost, 3, 3, &tiles);
+  }
+
+  // Pixels outside of the tiles are never touched, and the ones inside still converge.
+  int num_good = 0, num_total = 0;
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      if (in_tiles(y, x) == 0) {
+        ASSERT_EQ(disp_init(y, x), disp(y, x));
+      } else {
+        ++num_total;
+        num_good += (std::fabs(disp(y, x) - true_disp) < 1.0f) ? 1 : 0;
+      }
+    }
+  }
+  EXPECT_GT((double)num_good / (double)num_total, 0.9);
+}
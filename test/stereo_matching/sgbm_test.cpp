@@ -1,3 +1,5 @@
+#include <random>
+
 #include "gtest/gtest.h"
 
 #include <opencv2/core.hpp>
@@ -117,3 +119,47 @@ TEST(SGBM, Caddy)
 
   cv::waitKey(0);
 }
+
+
+// Random texture, with the right image shifted so that every pixel has the same disparity.
+TEST(SGBM, ModesOnTexture)
+{
+  const int true_disp = 8;
+  Image1b il(120, 160);
+  std::default_random_engine rng(0);
+  std::uniform_int_distribution<int> dist(0, 255);
+  for (int y = 0; y < il.rows; ++y) {
+    for (int x = 0; x < il.cols; ++x) {
+      il(y, x) = static_cast<uchar>(dist(rng));
+    }
+  }
+
+  Image1b ir(il.size(), 0);
+  il(cv::Rect(true_disp, 0, il.cols - true_disp, il.rows)).copyTo(ir(cv::Rect(0, 0, il.cols - true_disp, il.rows)));
+
+  // Away from the border and the unmatched columns on the left.
+  const cv::Rect interior(32, 8, il.cols - 48, il.rows - 16);
+
+  for (const std::string& mode : { "SGBM", "SGBM_3WAY", "HH", "HH4" }) {
+    SgbmMatcher::Params params;
+    params.num_disp = 32;
+    params.block_size = 5;
+    params.mode = mode;
+    SgbmMatcher matcher(params);
+
+    // Matching twice reuses the buffers, and should give the same result.
+    Image1f disp1, disp2;
+    matcher.Match(il, ir, disp1);
+    matcher.Match(il, ir, disp2);
+    EXPECT_EQ(0, cv::countNonZero(disp1 != disp2)) << mode;
+
+    const Image1f inner = disp1(interior);
+    const int num_correct = cv::countNonZero(cv::abs(inner - true_disp) < 0.5);
+    EXPECT_GT(num_correct, 0.9 * inner.total()) << mode;
+  }
+
+  // EstimateDisparity() makes its own matcher (with the default penalties).
+  const Image1f disp = EstimateDisparity(il, ir, 32, 5);
+  const int num_correct = cv::countNonZero(cv::abs(disp(interior) - true_disp) < 0.5);
+  EXPECT_GT(num_correct, 0.9 * interior.area());
+}
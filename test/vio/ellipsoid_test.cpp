@@ -66,3 +66,29 @@ TEST(EllipsoidTest, Visualize)
   viz.showWidget("origin", cv::viz::WCoordinateSystem());
   viz.spin();
 }
+
+
+TEST(EllipsoidTest, CachedCovarianceEllipsoid)
+{
+  Matrix3d C;
+  C << 2.5,  0.75, 0.1,
+       0.75, 1.2,  0.6,
+       0.1,  0.6,  5.3;
+
+  CachedCovarianceEllipsoid ellipsoid(2.0, 0.05);
+  EXPECT_FALSE(ellipsoid.Valid());
+  EXPECT_TRUE(ellipsoid.Update(C));
+  EXPECT_TRUE(ellipsoid.Valid());
+
+  // The transform maps the unit sphere onto the ellipsoid, so A * A^T = d^2 * C.
+  const Matrix3d A = ellipsoid.Transform();
+  EXPECT_TRUE((A * A.transpose()).isApprox(4.0 * C, 1e-9));
+
+  // Small changes keep the cached transform.
+  EXPECT_FALSE(ellipsoid.Update(1.01 * C));
+  EXPECT_TRUE(A == ellipsoid.Transform());
+
+  // Big ones don't.
+  EXPECT_TRUE(ellipsoid.Update(2.0 * C));
+  EXPECT_TRUE((ellipsoid.Transform() * ellipsoid.Transform().transpose()).isApprox(8.0 * C, 1e-9));
+}
@@ -0,0 +1,137 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "vio/estimator_checkpoint.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static EstimatorCheckpoint MakeCheckpoint()
+{
+  EstimatorCheckpoint checkpoint;
+  checkpoint.saved_unix_sec = 1700000000.25;
+
+  const gtsam::Pose3 world_P_body(gtsam::Rot3::Ypr(0.1, 0.2, 0.3), gtsam::Point3(1, 2, 3));
+  const ImuBias bias(gtsam::Vector3(0.01, 0.02, 0.03), gtsam::Vector3(0.001, 0.002, 0.003));
+
+  // Non-symmetric, so that a transposed copy would be caught.
+  Matrix6d cov_pose = Matrix6d::Identity();
+  cov_pose(0, 5) = 0.5;
+  Matrix3d cov_vel = 0.1 * Matrix3d::Identity();
+  cov_vel(2, 0) = 0.02;
+
+  checkpoint.smoother_result = SmootherResult(42, 12.5, world_P_body, true, gtsam::Vector3(0.5, -0.1, 0),
+                                              bias, cov_pose, cov_vel, 0.01 * Matrix6d::Identity());
+
+  Matrix15d S = 1e-2 * Matrix15d::Identity();
+  S(3, 14) = 0.003;
+  checkpoint.has_filter_state = true;
+  checkpoint.filter_state = StateStamped(12.75, State(
+      Vector3d(1.1, 2, 3), Vector3d(0.5, 0, 0), Vector3d(0, 0.1, 0),
+      Quaterniond(world_P_body.rotation().toQuaternion()), Vector3d(0, 0, 0.2), S));
+
+  return checkpoint;
+}
+
+
+TEST(EstimatorCheckpointTest, RoundTrip)
+{
+  const std::string path = "/tmp/estimator_checkpoint_test.bmckpt";
+  const EstimatorCheckpoint expected = MakeCheckpoint();
+  ASSERT_TRUE(WriteEstimatorCheckpoint(path, expected));
+
+  EstimatorCheckpoint checkpoint;
+  ASSERT_TRUE(ReadEstimatorCheckpoint(path, checkpoint));
+
+  EXPECT_EQ(expected.saved_unix_sec, checkpoint.saved_unix_sec);
+
+  const SmootherResult& r = checkpoint.smoother_result;
+  const SmootherResult& er = expected.smoother_result;
+  EXPECT_EQ(42ul, r.keypose_id);
+  EXPECT_EQ(42ul, r.cov_keypose_id);
+  EXPECT_EQ(12.5, r.timestamp);
+  EXPECT_TRUE(r.world_P_body.equals(er.world_P_body, 1e-12));
+  EXPECT_TRUE(r.has_imu_state);
+  EXPECT_TRUE(r.world_v_body.isApprox(er.world_v_body));
+  EXPECT_TRUE(r.imu_bias.equals(er.imu_bias, 1e-12));
+  EXPECT_EQ(er.cov_pose, r.cov_pose);
+  EXPECT_EQ(er.cov_vel, r.cov_vel);
+  EXPECT_EQ(er.cov_bias, r.cov_bias);
+
+  ASSERT_TRUE(checkpoint.has_filter_state);
+  const State& s = checkpoint.filter_state.state;
+  const State& es = expected.filter_state.state;
+  EXPECT_EQ(12.75, checkpoint.filter_state.timestamp);
+  EXPECT_EQ(es.t, s.t);
+  EXPECT_EQ(es.v, s.v);
+  EXPECT_EQ(es.a, s.a);
+  EXPECT_TRUE(s.q.isApprox(es.q, 1e-12));
+  EXPECT_EQ(es.w, s.w);
+  EXPECT_EQ(es.S, s.S);
+}
+
+
+TEST(EstimatorCheckpointTest, NoFilterState)
+{
+  const std::string path = "/tmp/estimator_checkpoint_test_nofilter.bmckpt";
+  EstimatorCheckpoint expected = MakeCheckpoint();
+  expected.has_filter_state = false;
+  expected.smoother_result.has_imu_state = false;
+  ASSERT_TRUE(WriteEstimatorCheckpoint(path, expected));
+
+  EstimatorCheckpoint checkpoint;
+  ASSERT_TRUE(ReadEstimatorCheckpoint(path, checkpoint));
+  EXPECT_FALSE(checkpoint.has_filter_state);
+  EXPECT_FALSE(checkpoint.smoother_result.has_imu_state);
+}
+
+
+TEST(EstimatorCheckpointTest, RejectsBadFiles)
+{
+  EstimatorCheckpoint checkpoint;
+  EXPECT_FALSE(ReadEstimatorCheckpoint("/tmp/estimator_checkpoint_test_missing.bmckpt", checkpoint));
+
+  // Truncated (e.g a crash halfway through writing, without the rename).
+  const std::string path = "/tmp/estimator_checkpoint_test_bad.bmckpt";
+  ASSERT_TRUE(WriteEstimatorCheckpoint(path, MakeCheckpoint()));
+  {
+    std::ifstream in(path, std::ios_base::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream out(path, std::ios_base::binary | std::ios_base::trunc);
+    out.write(bytes.data(), bytes.size() / 2);
+  }
+  EXPECT_FALSE(ReadEstimatorCheckpoint(path, checkpoint));
+
+  // Wrong magic.
+  {
+    std::ofstream out(path, std::ios_base::binary | std::ios_base::trunc);
+    const std::string junk(4096, 'x');
+    out.write(junk.data(), junk.size());
+  }
+  EXPECT_FALSE(ReadEstimatorCheckpoint(path, checkpoint));
+}
+
+
+TEST(EstimatorCheckpointTest, ReplacesOldCheckpoint)
+{
+  const std::string path = "/tmp/estimator_checkpoint_test_replace.bmckpt";
+  EstimatorCheckpoint first = MakeCheckpoint();
+  ASSERT_TRUE(WriteEstimatorCheckpoint(path, first));
+
+  EstimatorCheckpoint second = MakeCheckpoint();
+  second.smoother_result.keypose_id = 43;
+  ASSERT_TRUE(WriteEstimatorCheckpoint(path, second));
+
+  EstimatorCheckpoint checkpoint;
+  ASSERT_TRUE(ReadEstimatorCheckpoint(path, checkpoint));
+  EXPECT_EQ(43ul, checkpoint.smoother_result.keypose_id);
+
+  // The temporary file was renamed into place.
+  EXPECT_FALSE(std::ifstream(path + ".tmp").good());
+}
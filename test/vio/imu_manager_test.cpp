@@ -77,3 +77,71 @@ TEST(ImuManagerTest, TestAll)
   EXPECT_TRUE(pim4.timestamps_aligned);
   EXPECT_TRUE(m.Empty());
 }
+
+
+TEST(ImuManagerTest, TestIncremental)
+{
+  const std::string filepath_params = "./resources/config/ImuManager.yaml";
+  const std::string filepath_shared = config_path("shared/Farmsim.yaml");
+  ImuManager::Params params(filepath_params, filepath_shared);
+
+  ImuManager batch(params);
+  params.incremental = true;
+  ImuManager incremental(params);
+
+  // Push measurements at 100Hz, with some keypose windows in between. Only the first incremental
+  // window falls back to integrating from scratch.
+  const std::vector<std::pair<double, double>> windows = {{0.0, 1.0}, {1.0, 1.505}, {1.505, 2.0}};
+
+  int i = 0;
+  for (const auto& window : windows) {
+    for (; (0.01 * i) <= (window.second + 0.2); ++i) {
+      const double t = 0.01 * i;
+      const ImuMeasurement imu(ConvertToNanoseconds(t),
+                               Vector3d(0.1 * std::sin(t), 0.2, -0.1 * t),
+                               Vector3d(std::cos(t), -9.81, 0.5 * t));
+      batch.Push(imu);
+      incremental.Push(imu);
+    }
+
+    const PimResult pim_batch = batch.Preintegrate(window.first, window.second);
+    const PimResult pim_incremental = incremental.Preintegrate(window.first, window.second);
+
+    EXPECT_TRUE(pim_batch.timestamps_aligned);
+    EXPECT_TRUE(pim_incremental.timestamps_aligned);
+    EXPECT_TRUE(pim_batch.pim.equals(pim_incremental.pim, 1e-9));
+    EXPECT_EQ(pim_batch.to_imu.timestamp, pim_incremental.to_imu.timestamp);
+    EXPECT_EQ(batch.Size(), incremental.Size());
+  }
+}
+
+
+TEST(ImuManagerTest, TestInterpolateToTime)
+{
+  const std::string filepath_params = "./resources/config/ImuManager.yaml";
+  const std::string filepath_shared = config_path("shared/Farmsim.yaml");
+  ImuManager::Params params(filepath_params, filepath_shared);
+
+  ImuManager m(params);
+  m.Push(ImuMeasurement(ConvertToNanoseconds(10), Vector3d(0, 0, 0), Vector3d(0, -9.81, 0)));
+  m.Push(ImuMeasurement(ConvertToNanoseconds(11), Vector3d(0, 0, 0.2), Vector3d(1, -9.81, 0)));
+
+  // Neither measurement is within 10ms of to_time, but it's bracketed, so it gets interpolated.
+  const PimResult pim1 = m.Preintegrate(9.99, 10.5, 0.01);
+  EXPECT_TRUE(pim1.timestamps_aligned);
+  EXPECT_EQ(ConvertToNanoseconds(10.5), pim1.to_imu.timestamp);
+  EXPECT_NEAR(0.5, pim1.to_imu.a.x(), 1e-9);
+  EXPECT_NEAR(0.1, pim1.to_imu.w.z(), 1e-9);
+  EXPECT_NEAR(0.5, pim1.pim.deltaTij(), 1e-9);
+
+  // The measurement after to_time is kept for the next window.
+  EXPECT_EQ(1ul, m.Size());
+  EXPECT_EQ(11, m.Oldest());
+
+  // This window continues the last one, so the start is aligned even though the first measurement
+  // is 0.5 sec after from_time.
+  const PimResult pim2 = m.Preintegrate(10.5, 11.0, 0.01);
+  EXPECT_TRUE(pim2.timestamps_aligned);
+  EXPECT_NEAR(0.5, pim2.pim.deltaTij(), 1e-9);
+  EXPECT_TRUE(m.Empty());
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include "vio/item_history.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+TEST(ItemHistoryTest, TestAll)
+{
+  ItemHistory<double, int> h;
+  EXPECT_TRUE(h.Empty());
+  EXPECT_THROW(h.at(1.0), std::runtime_error);
+
+  for (int i = 0; i < 10; ++i) {
+    h.Update(0.1 * i, i);
+  }
+
+  EXPECT_EQ(10ul, h.Size());
+  EXPECT_EQ(0.0, h.OldestKey());
+  EXPECT_EQ(0.1 * 9, h.NewestKey());
+  EXPECT_EQ(4, h.at(0.1 * 4));
+  EXPECT_FALSE(h.Exists(0.45));
+  EXPECT_THROW(h.at(0.45), std::runtime_error);
+
+  // Existing items are not replaced.
+  h.Update(0.1 * 4, 100);
+  EXPECT_EQ(4, h.at(0.1 * 4));
+  EXPECT_EQ(10ul, h.Size());
+
+  // Out of order items are inserted in the right place.
+  h.Update(0.45, 45);
+  EXPECT_EQ(45, h.at(0.45));
+  EXPECT_EQ(11ul, h.Size());
+
+  // Discard everything before (but not equal to) a key.
+  h.DiscardBefore(0.1 * 4);
+  EXPECT_EQ(0.1 * 4, h.OldestKey());
+  EXPECT_EQ(7ul, h.Size());
+  EXPECT_FALSE(h.Exists(0.1 * 3));
+
+  // Keep adding items, which should compact the buffer along the way.
+  for (int i = 10; i < 100; ++i) {
+    h.Update(0.1 * i, i);
+    h.DiscardBefore(0.1 * (i - 5));
+    EXPECT_EQ(6ul, h.Size());
+    EXPECT_EQ(i - 5, h.at(h.OldestKey()));
+    EXPECT_EQ(i, h.at(h.NewestKey()));
+  }
+
+  h.DiscardBefore(1000.0);
+  EXPECT_TRUE(h.Empty());
+}
+
+
+TEST(ItemHistoryTest, TestMaxSize)
+{
+  ItemHistory<int, int> h(3);
+
+  for (int i = 0; i < 10; ++i) {
+    h.Update(i, 10 * i);
+    EXPECT_LE(h.Size(), 3ul);
+    EXPECT_EQ(10 * i, h.at(i));
+  }
+
+  EXPECT_EQ(7, h.OldestKey());
+  EXPECT_EQ(9, h.NewestKey());
+}
@@ -0,0 +1,135 @@
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "core/eigen_types.hpp"
+#include "core/transform_util.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vio/keyframe_database.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static const PinholeCamera kCameraModel(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+static const StereoCamera kStereoRig(kCameraModel, 0.2);
+
+
+// Landmarks in front of a keyframe, each with its own random descriptor.
+static void MakeLandmarks(int N, std::mt19937& rng, std::vector<Vector3d>& points, cv::Mat& descriptors)
+{
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  std::uniform_int_distribution<int> byte(0, 255);
+
+  descriptors = cv::Mat(N, 32, CV_8U);
+  points.clear();
+  for (int i = 0; i < N; ++i) {
+    points.emplace_back(3.0 * uniform(rng), 2.0 * uniform(rng), 9.0 + 3.0 * uniform(rng));
+    for (int b = 0; b < 32; ++b) {
+      descriptors.ptr<uint8_t>(i)[b] = static_cast<uint8_t>(byte(rng));
+    }
+  }
+}
+
+
+// What a camera at cam_T_kf sees: the same landmarks, with a few bits of each descriptor flipped.
+static KeyframeFeatures Observe(core::uid_t camera_id,
+                                timestamp_t timestamp,
+                                const Matrix4d& cam_T_kf,
+                                const std::vector<Vector3d>& kf_points,
+                                const cv::Mat& descriptors,
+                                int flipped_bits,
+                                std::mt19937& rng)
+{
+  std::uniform_int_distribution<int> bit(0, 255);
+
+  KeyframeFeatures f;
+  f.camera_id = camera_id;
+  f.timestamp = timestamp;
+  f.descriptors = cv::Mat(descriptors.rows, 32, CV_8U);
+  for (size_t i = 0; i < kf_points.size(); ++i) {
+    const Vector3d P = cam_T_kf.block<3, 3>(0, 0) * kf_points[i] + cam_T_kf.block<3, 1>(0, 3);
+    f.points.emplace_back(P);
+    f.pixels.emplace_back(kStereoRig.LeftCamera().Project(P));
+
+    uint8_t* d = f.descriptors.ptr<uint8_t>((int)i);
+    std::copy(descriptors.ptr<uint8_t>((int)i), descriptors.ptr<uint8_t>((int)i) + 32, d);
+    for (int k = 0; k < flipped_bits; ++k) {
+      const int b = bit(rng);
+      d[b / 8] ^= static_cast<uint8_t>(1 << (b % 8));
+    }
+  }
+
+  return f;
+}
+
+
+TEST(KeyframeDatabaseTest, TestRelocalize)
+{
+  std::mt19937 rng(123);
+
+  KeyframeDatabaseParams params;
+  KeyframeDatabase database(params, kStereoRig);
+
+  // The keyframe that we'll come back to, and then some unrelated ones.
+  std::vector<Vector3d> points;
+  cv::Mat descriptors;
+  MakeLandmarks(100, rng, points, descriptors);
+  database.Add(Observe(10, 1000, Matrix4d::Identity(), points, descriptors, 0, rng));
+
+  for (int k = 1; k <= 5; ++k) {
+    std::vector<Vector3d> other_points;
+    cv::Mat other_descriptors;
+    MakeLandmarks(100, rng, other_points, other_descriptors);
+    database.Add(Observe(10 + k, 1000 + k, Matrix4d::Identity(), other_points, other_descriptors, 0, rng));
+  }
+  EXPECT_EQ(6ul, database.Size());
+
+  Matrix4d cam_T_kf = Matrix4d::Identity();
+  cam_T_kf.block<3, 3>(0, 0) = AngleAxisd(0.1, Vector3d(0.1, 1.0, 0.2).normalized()).toRotationMatrix();
+  cam_T_kf.block<3, 1>(0, 3) = Vector3d(0.3, -0.1, 0.4);
+
+  const KeyframeFeatures frame = Observe(50, 5000, cam_T_kf, points, descriptors, 8, rng);
+
+  Relocalization reloc;
+  ASSERT_TRUE(database.Query(frame, reloc));
+  EXPECT_EQ(10ul, reloc.camera_id_kf);
+  EXPECT_EQ(1000ul, reloc.timestamp_kf);
+  EXPECT_GE(reloc.num_inliers, params.min_inliers);
+  EXPECT_TRUE(reloc.kf_T_cam.isApprox(inverse_se3(cam_T_kf), 1e-6));
+
+  // Nothing like this has been seen before.
+  std::vector<Vector3d> new_points;
+  cv::Mat new_descriptors;
+  MakeLandmarks(100, rng, new_points, new_descriptors);
+  EXPECT_FALSE(database.Query(Observe(51, 5001, Matrix4d::Identity(), new_points, new_descriptors, 0, rng), reloc));
+}
+
+
+TEST(KeyframeDatabaseTest, TestForgetOldest)
+{
+  std::mt19937 rng(123);
+
+  KeyframeDatabaseParams params;
+  params.max_keyframes = 3;
+  KeyframeDatabase database(params, kStereoRig);
+
+  std::vector<std::vector<Vector3d>> points(5);
+  std::vector<cv::Mat> descriptors(5);
+  for (int k = 0; k < 5; ++k) {
+    MakeLandmarks(60, rng, points[k], descriptors[k]);
+    database.Add(Observe(k, 1000 + k, Matrix4d::Identity(), points[k], descriptors[k], 0, rng));
+  }
+  EXPECT_EQ(3ul, database.Size());
+
+  Relocalization reloc;
+  EXPECT_FALSE(database.Query(Observe(100, 5000, Matrix4d::Identity(), points[0], descriptors[0], 4, rng), reloc));
+  EXPECT_FALSE(database.Query(Observe(100, 5000, Matrix4d::Identity(), points[1], descriptors[1], 4, rng), reloc));
+
+  for (int k = 2; k < 5; ++k) {
+    ASSERT_TRUE(database.Query(Observe(100, 5000, Matrix4d::Identity(), points[k], descriptors[k], 4, rng), reloc));
+    EXPECT_EQ((core::uid_t)k, reloc.camera_id_kf);
+  }
+}
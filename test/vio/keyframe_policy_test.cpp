@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include "vio/keyframe_policy.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+static KeyframeCues MakeCues(double sec_since_keyframe, double parallax_px, double overlap)
+{
+  KeyframeCues cues;
+  cues.sec_since_keyframe = sec_since_keyframe;
+  cues.median_parallax_px = parallax_px;
+  cues.track_overlap = overlap;
+  return cues;
+}
+
+
+TEST(KeyframePolicyTest, IsKeyframe)
+{
+  KeyframePolicy::Params params;
+  KeyframePolicy policy(params);
+
+  // Not enough time, even though the view changed a lot.
+  EXPECT_FALSE(policy.IsKeyframe(MakeCues(0.05, 100.0, 0.0)));
+
+  // Easy scene, nothing changed.
+  EXPECT_FALSE(policy.IsKeyframe(MakeCues(0.2, 1.0, 1.0)));
+  EXPECT_TRUE(policy.IsKeyframe(MakeCues(params.max_sec_btw_keyframes, 1.0, 1.0)));
+
+  // Parallax or lost tracks.
+  EXPECT_TRUE(policy.IsKeyframe(MakeCues(0.2, params.min_parallax_px, 1.0)));
+  EXPECT_TRUE(policy.IsKeyframe(MakeCues(0.2, 1.0, 0.5 * params.min_track_overlap)));
+
+  // Motion from the filter (0.2 sec at 2 m/s = 0.4 m).
+  policy.ReportMotion(Vector3d(2.0, 0, 0), Vector3d::Zero());
+  EXPECT_TRUE(policy.IsKeyframe(MakeCues(0.2, 1.0, 1.0)));
+  policy.ReportMotion(Vector3d::Zero(), Vector3d(0, 0, 1.0));
+  EXPECT_TRUE(policy.IsKeyframe(MakeCues(0.2, 1.0, 1.0)));
+  policy.ReportMotion(Vector3d::Zero(), Vector3d::Zero());
+  EXPECT_FALSE(policy.IsKeyframe(MakeCues(0.2, 1.0, 1.0)));
+}
+
+
+TEST(KeyframePolicyTest, SmootherLoad)
+{
+  KeyframePolicy::Params params;
+  params.smoother_latency_budget_ms = 100.0;
+  KeyframePolicy policy(params);
+  EXPECT_EQ(params.min_sec_btw_keyframes, policy.MinSecBtwKeyframes());
+
+  // Over budget: keyframes get spaced out, up to the max interval.
+  for (int i = 0; i < 50; ++i) {
+    policy.ReportSmootherLatency(300.0);
+  }
+  EXPECT_EQ(params.max_sec_btw_keyframes, policy.MinSecBtwKeyframes());
+  EXPECT_FALSE(policy.IsKeyframe(MakeCues(0.3, 100.0, 0.0)));
+  EXPECT_TRUE(policy.IsKeyframe(MakeCues(params.max_sec_btw_keyframes, 1.0, 1.0)));
+
+  // Between half of the budget and the budget, the interval holds steady.
+  for (int i = 0; i < 50; ++i) {
+    policy.ReportSmootherLatency(80.0);
+  }
+  EXPECT_EQ(params.max_sec_btw_keyframes, policy.MinSecBtwKeyframes());
+
+  // Lots of headroom: back to the fastest rate.
+  for (int i = 0; i < 50; ++i) {
+    policy.ReportSmootherLatency(10.0);
+  }
+  EXPECT_EQ(params.min_sec_btw_keyframes, policy.MinSecBtwKeyframes());
+  EXPECT_TRUE(policy.IsKeyframe(MakeCues(0.2, 100.0, 0.0)));
+}
+
+
+TEST(KeyframePolicyTest, SetParams)
+{
+  KeyframePolicy::Params params;
+  params.smoother_latency_budget_ms = 100.0;
+  KeyframePolicy policy(params);
+
+  for (int i = 0; i < 50; ++i) {
+    policy.ReportSmootherLatency(300.0);
+  }
+  EXPECT_EQ(params.max_sec_btw_keyframes, policy.MinSecBtwKeyframes());
+
+  // The adapted interval is clamped to the new max.
+  params.max_sec_btw_keyframes = 0.3;
+  params.min_parallax_px = 5.0;
+  policy.SetParams(params);
+  EXPECT_EQ(0.3, policy.MinSecBtwKeyframes());
+  EXPECT_EQ(5.0, policy.GetParams().min_parallax_px);
+  EXPECT_TRUE(policy.IsKeyframe(MakeCues(0.3, 1.0, 1.0)));
+
+  // Turning off the budget stops any further adaptation.
+  params.smoother_latency_budget_ms = 0;
+  policy.SetParams(params);
+  for (int i = 0; i < 50; ++i) {
+    policy.ReportSmootherLatency(10.0);
+  }
+  EXPECT_EQ(0.3, policy.MinSecBtwKeyframes());
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+#include <gtest/gtest.h>
+
+#include "vio/landmark_budget.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+TEST(LandmarkBudgetTest, SelectLandmarks)
+{
+  const std::vector<LandmarkCandidate> candidates = {
+    LandmarkCandidate(0, 1, 50.0),    // Too short.
+    LandmarkCandidate(1, 2, 0.0),
+    LandmarkCandidate(2, 5, 0.0),
+    LandmarkCandidate(3, 2, 40.0),    // Lots of parallax makes up for a short track.
+    LandmarkCandidate(4, 3, 0.0),
+    LandmarkCandidate(5, 3, 0.0),     // Ties with 4.
+  };
+
+  const std::vector<core::uid_t> all = SelectLandmarks(candidates, 0, 2, 0.1);
+  const std::vector<core::uid_t> expected_all = { 3, 2, 4, 5, 1 };
+  EXPECT_EQ(expected_all, all);
+
+  const std::vector<core::uid_t> top3 = SelectLandmarks(candidates, 3, 2, 0.1);
+  const std::vector<core::uid_t> expected_top3 = { 3, 2, 4 };
+  EXPECT_EQ(expected_top3, top3);
+
+  // Without the parallax term, only track length matters.
+  const std::vector<core::uid_t> no_parallax = SelectLandmarks(candidates, 2, 2, 0.0);
+  const std::vector<core::uid_t> expected_no_parallax = { 2, 4 };
+  EXPECT_EQ(expected_no_parallax, no_parallax);
+
+  EXPECT_TRUE(SelectLandmarks(candidates, 10, 6, 0.1).empty());
+}
+
+
+TEST(LandmarkBudgetTest, SelectInformativeLandmarks)
+{
+  // A tight cluster in the middle of the image, and four landmarks spread out at different depths.
+  std::vector<Vector3d> cam_t_lmks;
+  for (int i = 0; i < 10; ++i) {
+    cam_t_lmks.emplace_back(0.01 * i, 0.01 * i, 10.0);
+  }
+  cam_t_lmks.emplace_back(-3.0, -2.0, 5.0);
+  cam_t_lmks.emplace_back(3.0, -2.0, 8.0);
+  cam_t_lmks.emplace_back(-3.0, 2.0, 12.0);
+  cam_t_lmks.emplace_back(3.0, 2.0, 6.0);
+  cam_t_lmks.emplace_back(0.0, 0.0, -5.0);   // Behind the camera.
+
+  const std::vector<int> selected = SelectInformativeLandmarks(cam_t_lmks, 400.0, 400.0, 5);
+  ASSERT_EQ(5ul, selected.size());
+
+  // The spread out landmarks are worth more than any more of the cluster.
+  std::vector<int> sorted = selected;
+  std::sort(sorted.begin(), sorted.end());
+  int num_spread = 0;
+  for (const int i : sorted) {
+    num_spread += (i >= 10 && i < 14) ? 1 : 0;
+    EXPECT_NE(14, i);
+  }
+  EXPECT_EQ(4, num_spread);
+
+  // Every valid landmark is returned without a budget, and never one twice.
+  const std::vector<int> all = SelectInformativeLandmarks(cam_t_lmks, 400.0, 400.0, 0);
+  EXPECT_EQ(14ul, all.size());
+  EXPECT_EQ(14ul, std::set<int>(all.begin(), all.end()).size());
+
+  // The chosen subset gives more information than a naive one of the same size.
+  const auto log_det = [&](const std::vector<int>& idx) {
+    Matrix6d A = 1e-3 * Matrix6d::Identity();
+    for (const int i : idx) {
+      const Vector3d& p = cam_t_lmks.at(i);
+      Eigen::Matrix<double, 2, 3> J_proj;
+      J_proj << 400.0 / p.z(), 0, -400.0 * p.x() / (p.z() * p.z()),
+                0, 400.0 / p.z(), -400.0 * p.y() / (p.z() * p.z());
+      Eigen::Matrix<double, 3, 6> J_point;
+      J_point << 0, p.z(), -p.y(), 1, 0, 0,
+                 -p.z(), 0, p.x(), 0, 1, 0,
+                 p.y(), -p.x(), 0, 0, 0, 1;
+      const Eigen::Matrix<double, 2, 6> J = J_proj * J_point;
+      A += J.transpose() * J;
+    }
+    return std::log(A.determinant());
+  };
+  EXPECT_GT(log_det(selected), log_det({ 0, 1, 2, 3, 4 }));
+}
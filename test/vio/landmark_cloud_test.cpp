@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+
+#include "vio/landmark_cloud.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+TEST(LandmarkCloudTest, TestUpdateAndEvict)
+{
+  LandmarkCloud cloud(3);
+  cloud.Update(0, Vector3d(0, 0, 0));
+  cloud.Update(1, Vector3d(1, 0, 0));
+  cloud.Update(2, Vector3d(2, 0, 0));
+  EXPECT_EQ(3ul, cloud.Size());
+
+  // Moving landmark 0 makes landmark 1 the least recently updated, so it's dropped next.
+  cloud.Update(0, Vector3d(0, 5, 0));
+  cloud.Update(3, Vector3d(3, 0, 0));
+  EXPECT_EQ(3ul, cloud.Size());
+  EXPECT_TRUE(cloud.Contains(0));
+  EXPECT_FALSE(cloud.Contains(1));
+  EXPECT_TRUE(cloud.Contains(2));
+  EXPECT_TRUE(cloud.Contains(3));
+
+  CvPoints3f near_points, far_points;
+  cloud.Split(Vector3d::Zero(), LandmarkLodParams(), near_points, far_points);
+  ASSERT_EQ(3ul, near_points.size());
+  EXPECT_TRUE(far_points.empty());
+
+  // The moved landmark is drawn where it moved to.
+  bool found = false;
+  for (const cv::Point3f& p : near_points) {
+    found |= (p == cv::Point3f(0, 5, 0));
+  }
+  EXPECT_TRUE(found);
+}
+
+
+TEST(LandmarkCloudTest, TestLod)
+{
+  LandmarkCloud cloud(1000);
+  for (int i = 0; i < 100; ++i) {
+    cloud.Update(i, Vector3d(i, 0, 0));
+  }
+  cloud.NextBatch();
+
+  LandmarkLodParams lod;
+  lod.near_distance = 49.5;
+  lod.far_stride = 10;
+
+  CvPoints3f near_points, far_points;
+  cloud.Split(Vector3d::Zero(), lod, near_points, far_points);
+  EXPECT_EQ(50ul, near_points.size());
+  EXPECT_EQ(5ul, far_points.size());    // 50, 60, 70, 80, 90
+
+  // Landmarks that haven't been updated recently are thinned out too.
+  lod.near_distance = 0;
+  lod.max_age = 2;
+  for (int batch = 0; batch < 3; ++batch) {
+    for (int i = 0; i < 10; ++i) {
+      cloud.Update(i, Vector3d(i, 1, 0));
+    }
+    cloud.NextBatch();
+  }
+  cloud.Split(Vector3d::Zero(), lod, near_points, far_points);
+  EXPECT_EQ(10ul, near_points.size());
+  EXPECT_EQ(9ul, far_points.size());    // 10, 20, ..., 90
+}
@@ -0,0 +1,84 @@
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "core/eigen_types.hpp"
+#include "core/transform_util.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vio/local_bundle_adjustment.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+TEST(LocalBundleAdjustmentTest, TestRefineWindow)
+{
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(camera_model, 0.2);
+
+  std::mt19937 rng(123);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  std::normal_distribution<double> pixel_noise(0.0, 0.5);
+
+  // The camera moves forward and turns slightly between each keyframe.
+  const int K = 4;
+  VecMatrix4d kf_T_anchor_true(K, Matrix4d::Identity());
+  for (int k = 1; k < K; ++k) {
+    Matrix4d T_step = Matrix4d::Identity();
+    T_step.block<3, 3>(0, 0) = AngleAxisd(0.03, Vector3d::UnitY()).toRotationMatrix();
+    T_step.block<3, 1>(0, 3) = Vector3d(0.05, 0.0, -0.3);
+    kf_T_anchor_true.at(k) = T_step * kf_T_anchor_true.at(k - 1);
+  }
+
+  std::vector<Vector3d> lmk_true;
+  std::vector<BundleObservation> obs;
+  for (int l = 0; l < 80; ++l) {
+    const Vector3d p(3.0 * uniform(rng), 2.0 * uniform(rng), 7.0 + 3.0 * uniform(rng));
+    lmk_true.emplace_back(p);
+
+    for (int k = 0; k < K; ++k) {
+      const Vector3d P = kf_T_anchor_true.at(k).block<3, 3>(0, 0) * p + kf_T_anchor_true.at(k).block<3, 1>(0, 3);
+      const Vector2d uv = camera_model.Project(P);
+      const double disp = stereo_rig.DepthToDisp(P.z());
+      obs.emplace_back(k, l, uv.x() + pixel_noise(rng), uv.y() + pixel_noise(rng), disp + pixel_noise(rng));
+    }
+  }
+
+  // Start from a perturbed guess, like chained VO would give.
+  VecMatrix4d kf_T_anchor = kf_T_anchor_true;
+  std::vector<Vector3d> lmk = lmk_true;
+  for (int k = 1; k < K; ++k) {
+    Vector6d noise;
+    noise << 0.02*k, -0.01*k, 0.03*k, 0.005, -0.005, 0.002*k;
+    kf_T_anchor.at(k) = expmap_se3(noise) * kf_T_anchor.at(k);
+  }
+  for (Vector3d& p : lmk) {
+    p += Vector3d(0.05 * uniform(rng), 0.05 * uniform(rng), 0.1 * uniform(rng));
+  }
+
+  const double avg_err = OptimizeLocalBundleAdjustment(stereo_rig, kf_T_anchor, lmk, obs, 1.0, 10);
+  EXPECT_GT(avg_err, 0);
+  EXPECT_LT(avg_err, 1.5);
+
+  // The first keyframe is fixed, and the others should get back close to the truth.
+  EXPECT_TRUE(kf_T_anchor.at(0).isApprox(Matrix4d::Identity()));
+  for (int k = 1; k < K; ++k) {
+    const Vector3d t_err = kf_T_anchor.at(k).block<3, 1>(0, 3) - kf_T_anchor_true.at(k).block<3, 1>(0, 3);
+    EXPECT_LT(t_err.norm(), 0.02) << "k=" << k;
+  }
+}
+
+
+TEST(LocalBundleAdjustmentTest, TestNothingToDo)
+{
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(camera_model, 0.2);
+
+  VecMatrix4d kf_T_anchor(1, Matrix4d::Identity());
+  std::vector<Vector3d> lmk(1, Vector3d(0, 0, 5));
+  std::vector<BundleObservation> obs(1, BundleObservation(0, 0, 375.5, 239.5, 16.6));
+
+  EXPECT_EQ(-1, OptimizeLocalBundleAdjustment(stereo_rig, kf_T_anchor, lmk, obs, 1.0, 5));
+}
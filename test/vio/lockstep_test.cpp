@@ -0,0 +1,94 @@
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/thread_safe_queue.hpp"
+#include "vio/lockstep.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// Producer -> stage A (doubles each item) -> stage B (appends to an output vector).
+TEST(LockstepTest, TestTwoStages)
+{
+  Lockstep lockstep;
+  Lockstep::Stage stage_a, stage_b;
+  std::atomic_bool shutdown(false);
+
+  ThreadsafeQueue<int> queue_a(10, false);
+  ThreadsafeQueue<int> queue_b(10, false);
+  std::vector<int> output;
+
+  std::thread thread_a([&]() {
+    while (!shutdown) {
+      if (!lockstep.WaitForWake(stage_a, shutdown, 0.1)) {
+        continue;
+      }
+      LockstepPass pass(lockstep, stage_a);
+      if (queue_a.Empty()) {
+        continue;
+      }
+      pass.DidWork();
+
+      // Make stage B slow, to check that the producer waits for it.
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      queue_b.Push(2 * queue_a.Pop());
+      lockstep.Wake(stage_b);
+    }
+  });
+
+  std::thread thread_b([&]() {
+    while (!shutdown) {
+      if (!lockstep.WaitForWake(stage_b, shutdown, 0.1)) {
+        continue;
+      }
+      LockstepPass pass(lockstep, stage_b);
+      if (queue_b.Empty()) {
+        continue;
+      }
+      pass.DidWork();
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      output.emplace_back(queue_b.Pop());
+    }
+  });
+
+  for (int i = 0; i < 20; ++i) {
+    queue_a.Push(i);
+    lockstep.Wake(stage_a);
+    lockstep.WaitIdle(shutdown);
+
+    // Everything downstream should be finished with item i.
+    ASSERT_EQ(static_cast<size_t>(i + 1), output.size());
+    EXPECT_EQ(2 * i, output.back());
+    EXPECT_EQ(0, lockstep.Pending());
+  }
+
+  shutdown.store(true);
+  stage_a.notifier.Notify();
+  stage_b.notifier.Notify();
+  thread_a.join();
+  thread_b.join();
+}
+
+
+TEST(LockstepTest, TestShutdown)
+{
+  Lockstep lockstep;
+  Lockstep::Stage stage;
+  std::atomic_bool shutdown(false);
+
+  // Nothing is running this stage, so only a shutdown will end the wait.
+  lockstep.Wake(stage);
+  std::thread thread([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    shutdown.store(true);
+  });
+
+  lockstep.WaitIdle(shutdown);
+  EXPECT_EQ(1, lockstep.Pending());
+  thread.join();
+}
@@ -72,6 +72,53 @@ TEST(MagPoseFactor, Jacobians)
       (boost::bind(&MagPoseFactor<Pose3>::evaluateError, &f3, _1, boost::none), n_P3_b), H3, 1e-7));
 }
 
+//******************************************************************************
+// The original (dynamic-size) Pose3 version, to check the fixed-size one against.
+static Vector ReferenceError(const Pose3& nPb, const Point3& measured, const Point3& nav_field,
+                             const Point3& bias, Matrix& H)
+{
+  const Rot3 nRs = nPb.rotation();
+  Matrix H_rot = Matrix::Zero(3, 3);
+  const Point3 hx = nRs.unrotate(nav_field, H_rot, boost::none) + bias;
+  H = Matrix::Zero(3, 6);
+  H.block(0, nPb.rotationInterval().first, 3, 3) = H_rot;
+  return (hx - measured);
+}
+
+//******************************************************************************
+TEST(MagPoseFactor, MatchesReference)
+{
+  MagPoseFactor<Pose3> f3(Symbol('X', 0), measured3, scale, dir3, bias3, model3, boost::none);
+
+  for (const Pose3& pose : { n_P3_b, Pose3(Rot3::RzRyRx(0.3, -0.2, 1.1), Point3(1, 2, 3)), Pose3::identity() }) {
+    Matrix H, H_expected;
+    const Vector error = f3.evaluateError(pose, H);
+    const Vector error_expected = ReferenceError(pose, measured3, scale * dir3, bias3, H_expected);
+    EXPECT_TRUE(gtsam::assert_equal(error_expected, error, 1e-12));
+    EXPECT_TRUE(gtsam::assert_equal(H_expected, H, 1e-12));
+  }
+}
+
+//******************************************************************************
+TEST(MagPoseFactor, JacobiansWithSensorRotation)
+{
+  Matrix H2, H3;
+  const Pose3 body_P_sensor3(Rot3::RzRyRx(0.2, 0.5, -0.4), Point3(0.1, -0.2, 0.3));
+  const Pose2 body_P_sensor2(Rot2(0.7), Point2(0.1, -0.2));
+  const Pose3 pose3(Rot3::RzRyRx(0.3, -0.2, 1.1), Point3(1, 2, 3));
+  const Pose2 pose2(Rot2(0.4), Point2(1, 2));
+
+  MagPoseFactor<Pose2> f2(Symbol('X', 0), measured2, scale, dir2, bias2, model2, body_P_sensor2);
+  f2.evaluateError(pose2, H2);
+  EXPECT_TRUE(gtsam::assert_equal(gtsam::numericalDerivative11<Vector, Pose2> //
+      (boost::bind(&MagPoseFactor<Pose2>::evaluateError, &f2, _1, boost::none), pose2), H2, 1e-7));
+
+  MagPoseFactor<Pose3> f3(Symbol('X', 0), measured3, scale, dir3, bias3, model3, body_P_sensor3);
+  f3.evaluateError(pose3, H3);
+  EXPECT_TRUE(gtsam::assert_equal(gtsam::numericalDerivative11<Vector, Pose3> //
+      (boost::bind(&MagPoseFactor<Pose3>::evaluateError, &f3, _1, boost::none), pose3), H3, 1e-7));
+}
+
 // *************************************************************************
 // int main() {
 //   TestResult tr;
@@ -0,0 +1,149 @@
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "core/eigen_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vio/odometry_ransac.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static const PinholeCamera kCameraModel(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+static const StereoCamera kStereoRig(kCameraModel, 0.2);
+
+
+static Matrix4d MakeMotion()
+{
+  Matrix4d T_10 = Matrix4d::Identity();
+  T_10.block<3, 3>(0, 0) = AngleAxisd(0.1, Vector3d(0.2, 1.0, 0.1).normalized()).toRotationMatrix();
+  T_10.block<3, 1>(0, 3) = Vector3d(0.3, -0.1, 0.5);
+  return T_10;
+}
+
+
+// Landmarks seen from two poses. The first num_outliers are moved in Camera_1 (like a fish or a
+// bad track), so both their triangulation and their observation disagree with T_10.
+static void MakeProblem(const Matrix4d& T_10,
+                        int num_landmarks,
+                        int num_outliers,
+                        std::vector<Vector3d>& P0_list,
+                        std::vector<Vector3d>& P1_list,
+                        std::vector<Vector2d>& p1_obs_list,
+                        std::vector<double>& p1_sigma_list)
+{
+  std::mt19937 rng(123);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  std::normal_distribution<double> pixel_noise(0.0, 0.5);
+
+  while ((int)P0_list.size() < num_landmarks) {
+    const Vector3d P0(4.0 * uniform(rng), 3.0 * uniform(rng), 8.0 + 4.0 * uniform(rng));
+    Vector3d P1 = T_10.block<3, 3>(0, 0) * P0 + T_10.block<3, 1>(0, 3);
+
+    if ((int)P0_list.size() < num_outliers) {
+      P1 += Vector3d(uniform(rng), uniform(rng), 0.5 * uniform(rng));
+    }
+
+    P0_list.emplace_back(P0);
+    P1_list.emplace_back(P1);
+    p1_obs_list.emplace_back(kStereoRig.LeftCamera().Project(P1) + Vector2d(pixel_noise(rng), pixel_noise(rng)));
+    p1_sigma_list.emplace_back(1.0);
+  }
+}
+
+
+TEST(OdometryRansacTest, TestAbsoluteOrientation)
+{
+  const Matrix4d T_10_true = MakeMotion();
+
+  const Vector3d P0[4] = { Vector3d(0, 0, 5), Vector3d(1, 0, 6), Vector3d(0, 1, 7), Vector3d(1, 1, 4) };
+  Vector3d P1[4];
+  for (int i = 0; i < 4; ++i) {
+    P1[i] = T_10_true.block<3, 3>(0, 0) * P0[i] + T_10_true.block<3, 1>(0, 3);
+  }
+
+  Matrix4d T_10;
+  ASSERT_TRUE(AbsoluteOrientation(P0, P1, 3, T_10));
+  EXPECT_TRUE(T_10.isApprox(T_10_true, 1e-9));
+
+  ASSERT_TRUE(AbsoluteOrientation(P0, P1, 4, T_10));
+  EXPECT_TRUE(T_10.isApprox(T_10_true, 1e-9));
+
+  // Collinear points are degenerate.
+  const Vector3d Q0[3] = { Vector3d(0, 0, 5), Vector3d(1, 0, 5), Vector3d(2, 0, 5) };
+  EXPECT_FALSE(AbsoluteOrientation(Q0, Q0, 3, T_10));
+}
+
+
+TEST(OdometryRansacTest, TestManyOutliers)
+{
+  const Matrix4d T_10_true = MakeMotion();
+
+  std::vector<Vector3d> P0_list, P1_list;
+  std::vector<Vector2d> p1_obs_list;
+  std::vector<double> p1_sigma_list;
+  MakeProblem(T_10_true, 100, 40, P0_list, P1_list, p1_obs_list, p1_sigma_list);
+
+  // Some landmarks weren't triangulated in Camera_1, but can still be inliers.
+  P1_list.at(90) = Vector3d::Zero();
+  P1_list.at(91) = Vector3d::Zero();
+
+  OdometryRansacParams params;
+  OdometryWorkspace workspace;
+  Matrix4d T_10;
+  std::vector<int> inliers;
+
+  const int hypotheses = RansacOdometry(
+      P0_list, P1_list, p1_obs_list, p1_sigma_list, kStereoRig, nullptr, params, T_10, inliers, workspace);
+
+  EXPECT_GT(hypotheses, 0);
+  EXPECT_LE(hypotheses, params.max_hypotheses);
+  EXPECT_LT((T_10.block<3, 1>(0, 3) - T_10_true.block<3, 1>(0, 3)).norm(), 0.05);
+  EXPECT_LT((T_10.block<3, 3>(0, 0) - T_10_true.block<3, 3>(0, 0)).norm(), 0.01);
+
+  // Every real inlier is found, and only a few outliers happen to agree.
+  int num_true_inliers = 0;
+  for (const int i : inliers) {
+    num_true_inliers += (i >= 40) ? 1 : 0;
+  }
+  EXPECT_EQ(60, num_true_inliers);
+  EXPECT_LE(inliers.size(), 65ul);
+
+  // Same answer every time, no matter how the scheduler split up the hypotheses.
+  Matrix4d T_10_again;
+  std::vector<int> inliers_again;
+  RansacOdometry(P0_list, P1_list, p1_obs_list, p1_sigma_list, kStereoRig, nullptr, params, T_10_again, inliers_again, workspace);
+  EXPECT_EQ(inliers, inliers_again);
+  EXPECT_TRUE(T_10.isApprox(T_10_again));
+}
+
+
+TEST(OdometryRansacTest, TestPriorEarlyExit)
+{
+  const Matrix4d T_10_true = MakeMotion();
+
+  std::vector<Vector3d> P0_list, P1_list;
+  std::vector<Vector2d> p1_obs_list;
+  std::vector<double> p1_sigma_list;
+  MakeProblem(T_10_true, 100, 10, P0_list, P1_list, p1_obs_list, p1_sigma_list);
+
+  OdometryRansacParams params;
+  OdometryWorkspace workspace;
+  Matrix4d T_10;
+  std::vector<int> inliers;
+
+  // A good prior is confirmed without sampling anything.
+  Matrix4d T_10_prior = T_10_true;
+  T_10_prior(0, 3) += 0.01;
+  EXPECT_EQ(0, RansacOdometry(P0_list, P1_list, p1_obs_list, p1_sigma_list, kStereoRig, &T_10_prior, params, T_10, inliers, workspace));
+  EXPECT_TRUE(T_10.isApprox(T_10_prior));
+  EXPECT_GE(inliers.size(), 90ul);
+
+  // A bad one isn't.
+  T_10_prior = Matrix4d::Identity();
+  EXPECT_GT(RansacOdometry(P0_list, P1_list, p1_obs_list, p1_sigma_list, kStereoRig, &T_10_prior, params, T_10, inliers, workspace), 0);
+  EXPECT_LT((T_10.block<3, 1>(0, 3) - T_10_true.block<3, 1>(0, 3)).norm(), 0.05);
+}
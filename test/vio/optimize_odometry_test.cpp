@@ -0,0 +1,118 @@
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "core/eigen_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vio/optimize_odometry.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// Random landmarks seen from two poses, with pixel noise and a few gross outliers.
+static void MakeProblem(const StereoCamera& stereo_rig,
+                        const Matrix4d& T_10,
+                        int num_landmarks,
+                        int num_outliers,
+                        std::vector<Vector3d>& P0_list,
+                        std::vector<Vector2d>& p1_obs_list,
+                        std::vector<double>& p1_sigma_list)
+{
+  std::mt19937 rng(123);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  std::normal_distribution<double> pixel_noise(0.0, 0.5);
+
+  while ((int)P0_list.size() < num_landmarks) {
+    const Vector3d P0(4.0 * uniform(rng), 3.0 * uniform(rng), 8.0 + 4.0 * uniform(rng));
+    const Vector3d P1 = T_10.block<3, 3>(0, 0) * P0 + T_10.block<3, 1>(0, 3);
+    Vector2d p1 = stereo_rig.LeftCamera().Project(P1) + Vector2d(pixel_noise(rng), pixel_noise(rng));
+
+    if ((int)P0_list.size() < num_outliers) {
+      p1 += Vector2d(40.0, -30.0);
+    }
+
+    P0_list.emplace_back(P0);
+    p1_obs_list.emplace_back(p1);
+    p1_sigma_list.emplace_back(1.0);
+  }
+}
+
+
+TEST(OptimizeOdometryTest, TestRecoverMotion)
+{
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(camera_model, 0.2);
+
+  Matrix4d T_10_true = Matrix4d::Identity();
+  T_10_true.block<3, 3>(0, 0) = AngleAxisd(0.05, Vector3d(0.2, 1.0, 0.1).normalized()).toRotationMatrix();
+  T_10_true.block<3, 1>(0, 3) = Vector3d(0.1, -0.05, 0.3);
+
+  std::vector<Vector3d> P0_list;
+  std::vector<Vector2d> p1_obs_list;
+  std::vector<double> p1_sigma_list;
+  MakeProblem(stereo_rig, T_10_true, 100, 5, P0_list, p1_obs_list, p1_sigma_list);
+
+  Matrix4d T_10 = Matrix4d::Identity();
+  Matrix6d C_10;
+  double error = 0;
+  std::vector<int> inliers, outliers;
+
+  const int iters = OptimizeOdometryIterative(
+      P0_list, p1_obs_list, p1_sigma_list, stereo_rig, T_10, C_10, error,
+      inliers, outliers, 20, 1e-3, 1e-6, 3.0);
+
+  EXPECT_GE(iters, 0);
+  EXPECT_LT(error, 2.0);
+  EXPECT_LT((T_10.block<3, 1>(0, 3) - T_10_true.block<3, 1>(0, 3)).norm(), 0.02);
+  EXPECT_LT((T_10.block<3, 3>(0, 0) - T_10_true.block<3, 3>(0, 0)).norm(), 0.01);
+
+  // The first 5 observations were corrupted.
+  ASSERT_GE(outliers.size(), 5ul);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(i, outliers.at(i));
+  }
+  EXPECT_EQ(100ul, inliers.size() + outliers.size());
+}
+
+
+TEST(OptimizeOdometryTest, TestReuseWorkspace)
+{
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(camera_model, 0.2);
+
+  Matrix4d T_10_true = Matrix4d::Identity();
+  T_10_true.block<3, 1>(0, 3) = Vector3d(-0.2, 0.0, 0.1);
+
+  std::vector<Vector3d> P0_list;
+  std::vector<Vector2d> p1_obs_list;
+  std::vector<double> p1_sigma_list;
+  MakeProblem(stereo_rig, T_10_true, 60, 0, P0_list, p1_obs_list, p1_sigma_list);
+
+  // A workspace that was sized for a bigger problem should give the same answer as a fresh one.
+  OdometryWorkspace workspace;
+  std::vector<Vector3d> big_P0(200, Vector3d(0, 0, 10));
+  std::vector<Vector2d> big_p1(200, Vector2d(375.5, 239.5));
+  std::vector<double> big_sigma(200, 1.0);
+  workspace.Load(big_P0, big_p1, big_sigma);
+
+  Matrix4d T_10_a = Matrix4d::Identity(), T_10_b = Matrix4d::Identity();
+  Matrix6d C_10_a, C_10_b;
+  double error_a = 0, error_b = 0;
+  std::vector<int> inliers_a, outliers_a, inliers_b, outliers_b;
+
+  const int iters_a = OptimizeOdometryIterative(
+      P0_list, p1_obs_list, p1_sigma_list, stereo_rig, T_10_a, C_10_a, error_a,
+      inliers_a, outliers_a, 20, 1e-3, 1e-6, 3.0);
+  const int iters_b = OptimizeOdometryIterative(
+      P0_list, p1_obs_list, p1_sigma_list, stereo_rig, T_10_b, C_10_b, error_b,
+      inliers_b, outliers_b, 20, 1e-3, 1e-6, 3.0, workspace);
+
+  EXPECT_EQ(iters_a, iters_b);
+  EXPECT_EQ(error_a, error_b);
+  EXPECT_TRUE(T_10_a.isApprox(T_10_b));
+  EXPECT_EQ(inliers_a, inliers_b);
+  EXPECT_EQ(60ul, workspace.Size());
+}
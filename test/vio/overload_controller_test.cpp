@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+
+#include "vio/overload_controller.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+TEST(OverloadControllerTest, Escalate)
+{
+  OverloadController::Params params;
+  params.escalate_after = 3;
+  params.max_level = 3;
+  OverloadController controller(params);
+  EXPECT_EQ(OverloadLevel::NOMINAL, controller.Level());
+
+  // Fine, or in between the high and low marks: nothing changes.
+  for (int i = 0; i < 10; ++i) {
+    controller.ReportFrontend(0.0, 10.0);
+    controller.ReportSmoother(0.3, 200.0);
+  }
+  EXPECT_EQ(OverloadLevel::NOMINAL, controller.Level());
+
+  // A full queue steps up one level every escalate_after reports.
+  controller.ReportFrontend(0.9, 10.0);
+  controller.ReportFrontend(0.9, 10.0);
+  EXPECT_EQ(OverloadLevel::NOMINAL, controller.Level());
+  controller.ReportFrontend(0.9, 10.0);
+  EXPECT_EQ(OverloadLevel::SKIP_FRAMES, controller.Level());
+
+  // So does a slow smoother (the frontend queue is still full, too).
+  for (int i = 0; i < 3; ++i) {
+    controller.ReportSmoother(0.0, 500.0);
+  }
+  EXPECT_EQ(OverloadLevel::FEWER_FEATURES, controller.Level());
+
+  // Never past max_level.
+  for (int i = 0; i < 20; ++i) {
+    controller.ReportFrontend(0.9, 100.0);
+  }
+  EXPECT_EQ(OverloadLevel::COARSE_KLT, controller.Level());
+  EXPECT_EQ(3, controller.NumTransitions());
+}
+
+
+TEST(OverloadControllerTest, Hysteresis)
+{
+  OverloadController::Params params;
+  params.escalate_after = 2;
+  params.recover_after = 5;
+  OverloadController controller(params);
+
+  controller.ReportFrontend(1.0, 100.0);
+  controller.ReportFrontend(1.0, 100.0);
+  EXPECT_EQ(OverloadLevel::SKIP_FRAMES, controller.Level());
+
+  // Under budget, but not by enough to recover.
+  for (int i = 0; i < 20; ++i) {
+    controller.ReportFrontend(0.0, 0.75 * params.frontend_budget_ms);
+  }
+  EXPECT_EQ(OverloadLevel::SKIP_FRAMES, controller.Level());
+
+  // Overloaded reports in between restart the count.
+  for (int i = 0; i < 20; ++i) {
+    controller.ReportFrontend(0.0, 1.0);
+    controller.ReportFrontend(0.0, 1.0);
+    controller.ReportFrontend(0.0, 1.0);
+    controller.ReportFrontend(0.0, 2.0 * params.frontend_budget_ms);
+  }
+  EXPECT_EQ(OverloadLevel::SKIP_FRAMES, controller.Level());
+}
+
+
+TEST(OverloadControllerTest, Recover)
+{
+  OverloadController::Params params;
+  params.escalate_after = 1;
+  params.recover_after = 4;
+  OverloadController controller(params);
+
+  for (int i = 0; i < 10; ++i) {
+    controller.ReportSmoother(0.0, 1000.0);
+  }
+  EXPECT_EQ(OverloadLevel::SKIP_COVARIANCE, controller.Level());
+
+  // Only recovers once both stages are well under budget, one level at a time.
+  for (int i = 0; i < 10; ++i) {
+    controller.ReportFrontend(0.0, 1.0);
+  }
+  EXPECT_EQ(OverloadLevel::SKIP_COVARIANCE, controller.Level());
+
+  controller.ReportSmoother(0.0, 10.0);
+  for (int i = 0; i < 3; ++i) {
+    controller.ReportFrontend(0.0, 1.0);
+  }
+  EXPECT_EQ(OverloadLevel::FEWER_SMOOTHER_ITERS, controller.Level());
+
+  for (int i = 0; i < 4 * 4; ++i) {
+    controller.ReportFrontend(0.0, 1.0);
+  }
+  EXPECT_EQ(OverloadLevel::NOMINAL, controller.Level());
+  EXPECT_EQ("NOMINAL", to_string(controller.Level()));
+}
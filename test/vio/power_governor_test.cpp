@@ -0,0 +1,141 @@
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "vio/power_governor.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+static const double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+
+static PowerGovernor::Params MakeParams()
+{
+  PowerGovernor::Params params;
+  params.max_temp_c = 80.0;
+  params.recover_temp_margin_c = 5.0;
+  params.power_budget_w = 10.0;
+  params.recover_power_fraction = 0.8;
+  params.throttle_after = 2;
+  params.recover_after = 3;
+  params.ladder.resize(3);
+  params.ladder.at(1).features_fraction = 0.5;
+  params.ladder.at(2).frontend_skip_k = 2;
+  return params;
+}
+
+
+TEST(PowerGovernorTest, Throttle)
+{
+  PowerGovernor governor(MakeParams());
+  EXPECT_EQ(0, governor.RungIndex());
+
+  // Under the limits, but not by enough to recover: nothing changes.
+  for (int i = 0; i < 10; ++i) {
+    governor.Report(78.0, 9.0, 0.5);
+  }
+  EXPECT_EQ(0, governor.RungIndex());
+
+  // Too hot steps down one rung every throttle_after readings, to the bottom of the ladder.
+  governor.Report(85.0, 5.0, 0.5);
+  EXPECT_EQ(0, governor.RungIndex());
+  governor.Report(85.0, 5.0, 0.5);
+  EXPECT_EQ(1, governor.RungIndex());
+  EXPECT_EQ(0.5, governor.Rung().features_fraction);
+
+  // So does going over the power budget.
+  governor.Report(60.0, 12.0, 0.5);
+  governor.Report(60.0, 12.0, 0.5);
+  EXPECT_EQ(2, governor.RungIndex());
+  EXPECT_EQ(2, governor.Rung().frontend_skip_k);
+
+  for (int i = 0; i < 10; ++i) {
+    governor.Report(90.0, 12.0, 0.5);
+  }
+  EXPECT_EQ(2, governor.RungIndex());
+  EXPECT_EQ(2, governor.NumTransitions());
+}
+
+
+TEST(PowerGovernorTest, Recover)
+{
+  PowerGovernor governor(MakeParams());
+  for (int i = 0; i < 4; ++i) {
+    governor.Report(85.0, kNaN, 0.5);
+  }
+  EXPECT_EQ(2, governor.RungIndex());
+
+  // Cool enough, but still drawing too much power to recover.
+  for (int i = 0; i < 10; ++i) {
+    governor.Report(60.0, 9.0, 0.5);
+  }
+  EXPECT_EQ(2, governor.RungIndex());
+
+  // An unknown power reading only looks at the temperature.
+  governor.Report(60.0, kNaN, 0.5);
+  governor.Report(60.0, kNaN, 0.5);
+  EXPECT_EQ(2, governor.RungIndex());
+  governor.Report(60.0, kNaN, 0.5);
+  EXPECT_EQ(1, governor.RungIndex());
+
+  for (int i = 0; i < 10; ++i) {
+    governor.Report(60.0, 5.0, 0.5);
+  }
+  EXPECT_EQ(0, governor.RungIndex());
+
+  // With no readings at all, it stays where it is.
+  for (int i = 0; i < 4; ++i) {
+    governor.Report(85.0, kNaN, 0.5);
+  }
+  for (int i = 0; i < 10; ++i) {
+    governor.Report(kNaN, kNaN, 0.5);
+  }
+  EXPECT_EQ(2, governor.RungIndex());
+}
+
+
+TEST(PowerGovernorTest, EnergyPerEstimate)
+{
+  PowerGovernor governor(MakeParams());
+  EXPECT_EQ(0.0, governor.EnergyPerEstimateJ());
+
+  governor.Report(50.0, 4.0, 0.5);
+  governor.Report(50.0, 6.0, 1.0);
+  governor.Report(50.0, kNaN, 1.0);
+  EXPECT_DOUBLE_EQ(8.0, governor.EnergyJoules());
+  EXPECT_TRUE(std::isnan(governor.PowerW()));
+
+  for (int i = 0; i < 4; ++i) {
+    governor.CountEstimate();
+  }
+  EXPECT_DOUBLE_EQ(2.0, governor.EnergyPerEstimateJ());
+}
+
+
+TEST(PowerGovernorTest, PollSysfs)
+{
+  const std::string temp_path = "/tmp/power_governor_test_temp";
+  const std::string power_path = "/tmp/power_governor_test_power";
+  std::ofstream(temp_path) << "91500\n";
+  std::ofstream(power_path) << "3000000\n";
+
+  PowerGovernor::Params params = MakeParams();
+  params.temperature_paths = { temp_path, "/tmp/power_governor_test_missing" };
+  params.power_path = power_path;
+  params.power_scale = 1e-6;
+  params.poll_hz = 100.0;
+
+  PowerGovernor governor(params);
+  governor.Start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  EXPECT_DOUBLE_EQ(91.5, governor.TemperatureC());
+  EXPECT_DOUBLE_EQ(3.0, governor.PowerW());
+  EXPECT_EQ(2, governor.RungIndex());
+  EXPECT_GT(governor.EnergyJoules(), 0.0);
+}
@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/base/numericalDerivative.h>
+#include <gtsam/sam/RangeFactor.h>
+
+#include "vio/noise_model.hpp"
+#include "vio/range_to_point_factor.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+TEST(RangeToPointFactor, Jacobian)
+{
+  const gtsam::Pose3 body_P_receiver(gtsam::Rot3::RzRyRx(0.1, 0.2, -0.3), gtsam::Point3(0.4, -0.2, 0.7));
+  const gtsam::Point3 world_t_beacon(3.0, -1.0, 12.0);
+  const gtsam::RangeToPointFactor factor(1, world_t_beacon, 9.0, IsoModel::Sigma(1, 0.1), body_P_receiver);
+
+  const gtsam::Pose3 pose(gtsam::Rot3::RzRyRx(0.15, -0.30, 0.45), gtsam::Point3(-5.0, 8.0, -11.0));
+
+  const gtsam::Matrix expected_H = gtsam::numericalDerivative11<gtsam::Vector, gtsam::Pose3>(
+      boost::bind(&gtsam::RangeToPointFactor::evaluateError, &factor, _1, boost::none), pose);
+
+  gtsam::Matrix H;
+  factor.evaluateError(pose, H);
+  EXPECT_TRUE(gtsam::assert_equal(expected_H, H, 1e-5));
+}
+
+
+// Should be the same as a RangeFactor to a beacon variable that doesn't move.
+TEST(RangeToPointFactor, MatchesRangeFactor)
+{
+  const gtsam::Pose3 body_P_receiver(gtsam::Rot3::identity(), gtsam::Point3(0.4, -0.2, 0.7));
+  const gtsam::Point3 world_t_beacon(3.0, -1.0, 12.0);
+  const gtsam::Pose3 pose(gtsam::Rot3::RzRyRx(0.15, -0.30, 0.45), gtsam::Point3(-5.0, 8.0, -11.0));
+
+  const gtsam::RangeToPointFactor unary(1, world_t_beacon, 25.0, IsoModel::Sigma(1, 0.1), body_P_receiver);
+  const gtsam::RangeFactorWithTransform<gtsam::Pose3, gtsam::Point3> binary(
+      1, 2, 25.0, IsoModel::Sigma(1, 0.1), body_P_receiver);
+
+  gtsam::Matrix H, H_pose, H_beacon;
+  const gtsam::Vector error = unary.evaluateError(pose, H);
+  const gtsam::Vector expected_error = binary.evaluateError(pose, world_t_beacon, H_pose, H_beacon);
+
+  EXPECT_TRUE(gtsam::assert_equal(expected_error, error, 1e-9));
+  EXPECT_TRUE(gtsam::assert_equal(H_pose, H, 1e-9));
+}
@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include "vio/relinearization_policy.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+TEST(RelinearizationPolicyTest, Escalate)
+{
+  RelinearizationPolicy::Params params;
+  params.budget_ms = 100.0;
+  params.escalate_after = 3;
+  params.scale_step = 2.0;
+  params.max_scale = 4.0;
+  RelinearizationPolicy policy(params);
+  EXPECT_EQ(1.0, policy.Scale());
+
+  // Within budget (but not by enough to recover): nothing changes.
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_FALSE(policy.Report(80.0));
+  }
+  EXPECT_EQ(1.0, policy.Scale());
+
+  // Slow updates double the scale every escalate_after reports, up to max_scale.
+  EXPECT_FALSE(policy.Report(150.0));
+  EXPECT_FALSE(policy.Report(150.0));
+  EXPECT_TRUE(policy.Report(150.0));
+  EXPECT_EQ(2.0, policy.Scale());
+
+  for (int i = 0; i < 20; ++i) {
+    policy.Report(150.0);
+  }
+  EXPECT_EQ(4.0, policy.Scale());
+  EXPECT_EQ(2, policy.NumTransitions());
+}
+
+
+TEST(RelinearizationPolicyTest, Hysteresis)
+{
+  RelinearizationPolicy::Params params;
+  params.budget_ms = 100.0;
+  params.recover_fraction = 0.5;
+  params.escalate_after = 2;
+  params.recover_after = 5;
+  RelinearizationPolicy policy(params);
+
+  policy.Report(150.0);
+  policy.Report(150.0);
+  policy.Report(150.0);
+  policy.Report(150.0);
+  EXPECT_EQ(4.0, policy.Scale());
+
+  // A fast update in the middle restarts the count.
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_FALSE(policy.Report(10.0));
+  }
+  EXPECT_FALSE(policy.Report(70.0));
+  EXPECT_EQ(4.0, policy.Scale());
+
+  // Headroom steps back down, but never below the configured thresholds.
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_FALSE(policy.Report(10.0));
+  }
+  EXPECT_TRUE(policy.Report(10.0));
+  EXPECT_EQ(2.0, policy.Scale());
+
+  for (int i = 0; i < 50; ++i) {
+    policy.Report(10.0);
+  }
+  EXPECT_EQ(1.0, policy.Scale());
+  EXPECT_EQ(4, policy.NumTransitions());
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include "vio/sample_average.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+TEST(SampleAverageTest, TestMatchesBatch)
+{
+  std::vector<Vector3d> samples = {
+    Vector3d(1, 2, 3), Vector3d(-1, 0.5, 2), Vector3d(0.3, 4, -1), Vector3d(2, 2, 2), Vector3d(0, -3, 1)
+  };
+
+  SampleAverage avg;
+  for (const Vector3d& x : samples) {
+    avg.Add(x);
+  }
+  ASSERT_EQ(5, avg.Count());
+
+  Vector3d mean = Vector3d::Zero();
+  for (const Vector3d& x : samples) { mean += x; }
+  mean /= samples.size();
+
+  Matrix3d cov = Matrix3d::Zero();
+  for (const Vector3d& x : samples) { cov += (x - mean) * (x - mean).transpose(); }
+  cov /= (samples.size() - 1);
+
+  EXPECT_TRUE(avg.Mean().isApprox(mean, 1e-12));
+  EXPECT_TRUE(avg.SampleCovariance().isApprox(cov, 1e-12));
+
+  // The covariance of the mean shrinks with the number of samples.
+  const Matrix3d noise = 0.1 * Matrix3d::Identity();
+  EXPECT_TRUE(avg.MeanCovariance(noise).isApprox((noise + cov) / 5.0, 1e-12));
+
+  avg.Reset();
+  EXPECT_EQ(0, avg.Count());
+  EXPECT_TRUE(avg.Mean().isZero());
+}
+
+
+TEST(SampleAverageTest, TestFewSamples)
+{
+  const Matrix3d noise = 0.1 * Matrix3d::Identity();
+
+  // With no samples, the mean is as good as one.
+  SampleAverage avg;
+  EXPECT_TRUE(avg.SampleCovariance().isZero());
+  EXPECT_TRUE(avg.MeanCovariance(noise).isApprox(noise));
+
+  // One sample has no spread.
+  avg.Add(Vector3d(1, 2, 3));
+  EXPECT_TRUE(avg.Mean().isApprox(Vector3d(1, 2, 3)));
+  EXPECT_TRUE(avg.SampleCovariance().isZero());
+  EXPECT_TRUE(avg.MeanCovariance(noise).isApprox(noise));
+
+  // Identical samples only shrink the noise.
+  for (int i = 0; i < 9; ++i) {
+    avg.Add(Vector3d(1, 2, 3));
+  }
+  EXPECT_TRUE(avg.SampleCovariance().isZero());
+  EXPECT_TRUE(avg.MeanCovariance(noise).isApprox(noise / 10.0));
+}
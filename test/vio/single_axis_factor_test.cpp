@@ -44,6 +44,24 @@ TEST(SingleAxisFactor, Jacobian) {
 }
 
 
+TEST(SingleAxisFactor, MatchesReference)
+{
+  const gtsam::SharedNoiseModel model = gtsam::noiseModel::Isotropic::Sigma(1, 0.25);
+  const gtsam::SingleAxisFactor factor(1, core::Axis3::Y, 3.0, model);
+  const gtsam::Pose3 pose(gtsam::Rot3::RzRyRx(0.15, -0.30, 0.45), gtsam::Point3(-5.0, 8.0, -11.0));
+
+  // The original version took a row of the full translation Jacobian.
+  gtsam::Matrix36 H_world_t_body;
+  const gtsam::Point3 world_t_body = pose.translation(H_world_t_body);
+  const gtsam::Matrix expected_H = H_world_t_body.row(core::Axis3::Y);
+
+  gtsam::Matrix H;
+  const gtsam::Vector error = factor.evaluateError(pose, H);
+  EXPECT_TRUE(gtsam::assert_equal(gtsam::Vector1(world_t_body.y() - 3.0), error, 1e-12));
+  EXPECT_TRUE(gtsam::assert_equal(expected_H, H, 1e-12));
+}
+
+
 // TEST(SingleAxisFactor, GtsamCompare)
 // {
 //   gtsam::Key poseKey(1);
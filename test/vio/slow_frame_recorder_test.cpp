@@ -0,0 +1,67 @@
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "core/file_utils.hpp"
+#include "vio/slow_frame_recorder.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static SlowFrameRecord MakeRecord(uid_t camera_id, float total_ms)
+{
+  SlowFrameRecord record;
+  record.timestamp = 1000 + camera_id;
+  record.camera_id = camera_id;
+  record.num_tracked = 50;
+  record.total_ms = total_ms;
+  return record;
+}
+
+
+static int CountLines(const std::string& path)
+{
+  std::ifstream file(path);
+  int lines = 0;
+  std::string line;
+  while (std::getline(file, line)) {
+    ++lines;
+  }
+  return lines;
+}
+
+
+TEST(SlowFrameRecorderTest, DumpsHistoryOnDeadlineMiss)
+{
+  const std::string folder = "/tmp/slow_frame_recorder_test";
+  rmdir(folder);
+
+  const Image1b image(8, 8, (uchar)127);
+  SlowFrameRecorder recorder(folder, 50.0, 4, 1);
+
+  // Fast frames are only kept in the ring.
+  for (uid_t i = 0; i < 6; ++i) {
+    EXPECT_FALSE(recorder.Add(MakeRecord(i, 20.0), StereoImage1b(1000 + i, i, image, image)));
+  }
+  EXPECT_EQ(0ul, recorder.NumSlowFrames());
+
+  EXPECT_TRUE(recorder.Add(MakeRecord(6, 200.0), StereoImage1b(1006, 6, image, image)));
+  recorder.Flush();
+
+  const std::string dump_folder = Join(folder, "slow_1006");
+  EXPECT_TRUE(Exists(Join(dump_folder, "left.png")));
+  EXPECT_TRUE(Exists(Join(dump_folder, "right.png")));
+  EXPECT_EQ(1 + 4, CountLines(Join(dump_folder, "frames.csv")));   // Header + the last 4 frames.
+
+  // Past max_dumps, slow frames are only counted.
+  EXPECT_FALSE(recorder.Add(MakeRecord(7, 200.0), StereoImage1b(1007, 7, image, image)));
+  recorder.Flush();
+  EXPECT_FALSE(Exists(Join(folder, "slow_1007")));
+  EXPECT_EQ(2ul, recorder.NumSlowFrames());
+  EXPECT_EQ(1ul, recorder.NumDumps());
+
+  rmdir(folder);
+}
@@ -0,0 +1,139 @@
+#include <fstream>
+#include <iterator>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "vio/smoother_log.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static SmootherResult MakeResult(core::uid_t keypose_id, seconds_t timestamp)
+{
+  const gtsam::Pose3 world_P_body(gtsam::Rot3::Ypr(0.1 * keypose_id, 0.2, 0.3), gtsam::Point3(keypose_id, 2, 3));
+  const ImuBias bias(gtsam::Vector3(0.01, 0.02, 0.03), gtsam::Vector3(0.001, 0.002, 0.003));
+  return SmootherResult(keypose_id, timestamp, world_P_body, true, gtsam::Vector3(0.5, 0, 0), bias,
+                        Matrix6d::Identity(), Matrix3d::Identity(), Matrix6d::Identity());
+}
+
+
+TEST(SmootherLogTest, TestRoundTrip)
+{
+  const std::string path = "/tmp/smoother_log_test.bmsmlog";
+
+  {
+    SmootherLogWriter writer(path);
+    writer.WriteInitialize(1.0, gtsam::Pose3::identity(), kZeroVelocity, kZeroImuBias, true);
+
+    // Out of order, the reader should sort them.
+    for (int i = 9; i >= 0; --i) {
+      writer.WriteImu(ImuMeasurement(ConvertToNanoseconds(1.0 + 0.01*i), Vector3d(0.1, 0.2, i), Vector3d(0, 9.81, 0)));
+    }
+
+    // A keypose with everything.
+    VoResult::Ptr vo = std::make_shared<VoResult>(ConvertToNanoseconds(1.5), ConvertToNanoseconds(1.0), 7, 3);
+    vo->is_keyframe = true;
+    vo->lkf_T_cam.block<3, 1>(0, 3) = Vector3d(0.1, 0.2, 0.3);
+    vo->lmk_obs.Add(42, cv::Point2f(10.5, 20.25), 4.5);
+    vo->lmk_obs.Add(43, cv::Point2f(30.0, 40.0), 2.0);
+
+    const PimResult::Ptr pim = std::make_shared<PimResult>(true, 1.0, 1.5);
+    const DepthMeasurement::Ptr depth = std::make_shared<DepthMeasurement>(ConvertToNanoseconds(1.49), 3.5);
+    const AttitudeMeasurement::Ptr attitude = std::make_shared<AttitudeMeasurement>(1.5, Vector3d(0, 1, 0));
+    attitude->sigma = 0.05;
+    const MultiRange ranges = { RangeMeasurement(ConvertToNanoseconds(1.45), 12.0, Vector3d(1, 2, 3)),
+                                RangeMeasurement(ConvertToNanoseconds(1.46), 13.0, Vector3d(4, 5, 6)) };
+    const MagMeasurement::Ptr mag = std::make_shared<MagMeasurement>(ConvertToNanoseconds(1.5), Vector3d(0.2, 0.3, 0.4));
+    mag->cov = 0.01 * Matrix3d::Identity();
+    mag->cov(0, 2) = 0.002;
+    writer.WriteKeypose(MakeResult(1, 1.5), vo, pim, depth, attitude, ranges, mag);
+
+    // A keypose with nothing but the result.
+    writer.WriteKeypose(MakeResult(2, 2.0), nullptr, nullptr, nullptr, nullptr, MultiRange(), nullptr);
+  }
+
+  SmootherLog log;
+  ASSERT_TRUE(ReadSmootherLog(path, log));
+
+  EXPECT_TRUE(log.initialized);
+  EXPECT_EQ(1.0, log.t0);
+  EXPECT_TRUE(log.imu_available);
+
+  ASSERT_EQ(10ul, log.imu.size());
+  EXPECT_EQ(ConvertToNanoseconds(1.0), log.imu.front().timestamp);
+  EXPECT_EQ(9.0, log.imu.back().w.z());
+
+  ASSERT_EQ(2ul, log.keyposes.size());
+  const SmootherLogKeypose& k1 = log.keyposes.at(0);
+  EXPECT_EQ(1ul, k1.keypose_id);
+  EXPECT_EQ(1.5, k1.timestamp);
+  EXPECT_TRUE(k1.has_pim);
+  EXPECT_EQ(1.0, k1.pim_from_time);
+  EXPECT_TRUE(MakeResult(1, 1.5).world_P_body.equals(k1.world_P_body, 1e-9));
+  EXPECT_TRUE(k1.world_v_body.isApprox(gtsam::Vector3(0.5, 0, 0)));
+  EXPECT_TRUE(MakeResult(1, 1.5).imu_bias.equals(k1.imu_bias, 1e-12));
+
+  ASSERT_TRUE(k1.vo != nullptr);
+  EXPECT_EQ(ConvertToNanoseconds(1.0), k1.vo->timestamp_lkf);
+  EXPECT_EQ(7ul, k1.vo->camera_id);
+  EXPECT_TRUE(k1.vo->lkf_T_cam.block<3, 1>(0, 3).isApprox(Vector3d(0.1, 0.2, 0.3)));
+  ASSERT_EQ(2ul, k1.vo->lmk_obs.Size());
+  EXPECT_EQ(42u, k1.vo->lmk_obs.landmark_id.at(0));
+  EXPECT_EQ(20.25, k1.vo->lmk_obs.pixel_location.at(0).y);
+  EXPECT_EQ(4.5, k1.vo->lmk_obs.disparity.at(0));
+
+  ASSERT_TRUE(k1.depth != nullptr);
+  EXPECT_EQ(3.5, k1.depth->depth);
+  ASSERT_TRUE(k1.attitude != nullptr);
+  EXPECT_TRUE(k1.attitude->body_nG.isApprox(Vector3d(0, 1, 0)));
+  EXPECT_EQ(0.05, k1.attitude->sigma);
+  ASSERT_EQ(2ul, k1.ranges.size());
+  EXPECT_EQ(13.0, k1.ranges.at(1).range);
+  EXPECT_TRUE(k1.ranges.at(1).point.isApprox(Vector3d(4, 5, 6)));
+  ASSERT_TRUE(k1.mag != nullptr);
+  EXPECT_TRUE(k1.mag->field.isApprox(Vector3d(0.2, 0.3, 0.4)));
+  EXPECT_EQ(0.002, k1.mag->cov(0, 2));
+  EXPECT_EQ(0.0, k1.mag->cov(2, 0));
+  EXPECT_EQ(0.01, k1.mag->cov(1, 1));
+
+  const SmootherLogKeypose& k2 = log.keyposes.at(1);
+  EXPECT_EQ(2ul, k2.keypose_id);
+  EXPECT_FALSE(k2.has_pim);
+  EXPECT_TRUE(k2.vo == nullptr);
+  EXPECT_TRUE(k2.depth == nullptr);
+  EXPECT_TRUE(k2.attitude == nullptr);
+  EXPECT_TRUE(k2.ranges.empty());
+  EXPECT_TRUE(k2.mag == nullptr);
+}
+
+
+TEST(SmootherLogTest, TestTruncated)
+{
+  const std::string path = "/tmp/smoother_log_test_truncated.bmsmlog";
+
+  {
+    SmootherLogWriter writer(path);
+    writer.WriteInitialize(0.0, gtsam::Pose3::identity(), kZeroVelocity, kZeroImuBias, false);
+    writer.WriteKeypose(MakeResult(1, 0.5), nullptr, nullptr, nullptr, nullptr, MultiRange(), nullptr);
+    writer.WriteKeypose(MakeResult(2, 1.0), nullptr, nullptr, nullptr, nullptr, MultiRange(), nullptr);
+  }
+
+  // Chop off part of the last record, like a crash would.
+  std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+  const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  std::ofstream out(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+  out.write(data.data(), data.size() - 10);
+  out.close();
+
+  SmootherLog log;
+  ASSERT_TRUE(ReadSmootherLog(path, log));
+  ASSERT_EQ(1ul, log.keyposes.size());
+  EXPECT_EQ(1ul, log.keyposes.front().keypose_id);
+
+  // A log that does not exist.
+  EXPECT_FALSE(ReadSmootherLog("/tmp/does_not_exist.bmsmlog", log));
+}
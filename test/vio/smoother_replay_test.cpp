@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "vio/smoother_log.hpp"
+#include "vio/smoother_replay.hpp"
+#include "vio/synthetic_world.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// Writes the smoother log that a StateEstimator would have, if it had seen the synthetic world.
+static void WriteSyntheticLog(const SyntheticWorld& world, const std::string& path)
+{
+  SmootherLogWriter writer(path);
+  const seconds_t t0 = ConvertToSeconds(world.FirstTimestamp());
+  writer.WriteInitialize(t0, gtsam::Pose3(world.WorldTBody(0)), kZeroVelocity, kZeroImuBias, true);
+
+  for (const ImuMeasurement& imu : world.ImuMeasurements()) {
+    writer.WriteImu(imu);
+  }
+
+  for (size_t k = 0; k < world.Keyframes().size(); ++k) {
+    const VoResult::Ptr vo = std::make_shared<VoResult>(world.MakeVoResult(k));
+    const seconds_t from_time = ConvertToSeconds(vo->timestamp_lkf);
+    const seconds_t to_time = ConvertToSeconds(vo->timestamp);
+    const PimResult::Ptr pim = std::make_shared<PimResult>(true, from_time, to_time);
+
+    const SmootherResult result(k + 1, to_time, gtsam::Pose3(world.WorldTBody(to_time - t0)), true,
+                                kZeroVelocity, kZeroImuBias,
+                                Matrix6d::Identity(), Matrix3d::Identity(), Matrix6d::Identity());
+    writer.WriteKeypose(result, vo, pim, nullptr, nullptr, MultiRange(), nullptr);
+  }
+}
+
+
+TEST(SmootherReplayTest, TestReplaySyntheticLog)
+{
+  SyntheticWorld::Params world_params;
+  world_params.duration_sec = 10.0;
+  world_params.num_landmarks = 500;
+
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera rig(cam, 0.2);
+  const SyntheticWorld world(world_params, rig, Matrix4d::Identity());
+
+  const std::string path = "/tmp/smoother_replay_test.bmsmlog";
+  WriteSyntheticLog(world, path);
+
+  SmootherLog log;
+  ASSERT_TRUE(ReadSmootherLog(path, log));
+  ASSERT_EQ(world.Keyframes().size(), log.keyposes.size());
+
+  FixedLagSmoother::Params params;
+  params.stereo_rig = rig;
+  params.smoother_lag_sec = 5.0;
+
+  const SmootherReplay replay(log, ImuManager::Params(), 0.05);
+
+  std::vector<SmootherResult> trajectory;
+  const std::vector<SmootherReplay::KeyposeTiming> timings = replay.Run(params, 0, &trajectory);
+  ASSERT_EQ(log.keyposes.size(), timings.size());
+  ASSERT_EQ(log.keyposes.size() + 1, trajectory.size());
+
+  for (const SmootherReplay::KeyposeTiming& t : timings) {
+    EXPECT_GE(t.update_ms, t.isam_update_ms);
+    EXPECT_GE(t.extra_iters_ms, 0);
+    EXPECT_LE(t.num_extra_iters, params.extra_smoothing_iters);
+    EXPECT_TRUE(t.covariance_computed);
+  }
+
+  // The replay should track the groundtruth, since it's the same data the log was made from.
+  const SmootherResult& last = trajectory.back();
+  const Vector3d t_gt = world.WorldTBody(last.timestamp - ConvertToSeconds(world.FirstTimestamp())).block<3, 1>(0, 3);
+  EXPECT_LT((last.world_P_body.translation() - t_gt).norm(), 1.0);
+
+  // Only the first few keyposes.
+  EXPECT_EQ(5ul, replay.Run(params, 5).size());
+}
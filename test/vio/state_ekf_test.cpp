@@ -51,6 +51,131 @@ TEST(VioTest, TestState)
 }
 
 
+TEST(StateEkfTest, BatchedPoseVelocityUpdate)
+{
+  StateEkf::Params params;
+  params.reapply_measurements_after_init = false;
+  StateEkf ekf_batch(params);
+  StateEkf ekf_sequential(params);
+
+  Matrix15d S0 = Matrix15d::Identity() * 0.1;
+  S0(t_row, v_row) = S0(v_row, t_row) = 0.02;
+  const StateStamped ss0(5.0, State(Vector3d(1, 2, 3),
+                                    Vector3d(0.5, 0, 0),
+                                    Vector3d::Zero(),
+                                    Quaterniond::Identity(),
+                                    Vector3d::Zero(),
+                                    S0));
+  ekf_batch.Initialize(ss0, ImuBias());
+  ekf_sequential.Initialize(ss0, ImuBias());
+
+  const Quaterniond q(AngleAxisd(0.01, Vector3d(0, 0, 1)));
+  const Vector3d t(1.01, 2.0, 2.99);
+  const Vector3d v(0.49, 0.01, 0);
+  const Matrix6d R_pose = Matrix6d::Identity() * 0.05;
+  const Matrix3d R_vel = Matrix3d::Identity() * 0.01;
+
+  const StateStamped sb = ekf_batch.PredictAndUpdate(5.1, q, t, R_pose, v, R_vel);
+  ekf_sequential.PredictAndUpdate(5.1, q, t, R_pose);
+  const StateStamped ss = ekf_sequential.PredictAndUpdate(5.1, v, R_vel);
+
+  // The measurements are independent and (almost) linear, so doing them at once should be the
+  // same as doing them one after the other.
+  EXPECT_EQ(5.1, sb.timestamp);
+  EXPECT_LT((sb.state.ToVector() - ss.state.ToVector()).norm(), 1e-4);
+  EXPECT_LT((sb.state.S - ss.state.S).norm(), 1e-9);
+}
+
+TEST(StateEkfTest, FastReapplyImu)
+{
+  StateEkf::Params params_full;
+  StateEkf::Params params_fast;
+  params_fast.reapply_full_updates = 10;
+  StateEkf ekf_full(params_full);
+  StateEkf ekf_fast(params_fast);
+
+  const StateStamped ss0(0.0, State(Vector3d::Zero(),
+                                    Vector3d::Zero(),
+                                    Vector3d::Zero(),
+                                    Quaterniond::Identity(),
+                                    Vector3d::Zero(),
+                                    Matrix15d::Identity() * 0.1));
+  ekf_full.Initialize(ss0, ImuBias());
+  ekf_fast.Initialize(ss0, ImuBias());
+
+  // Accelerating along x and turning slowly about z, at 100 Hz.
+  const Vector3d a_imu = Vector3d(0.1, 0, 0) - params_full.n_gravity;
+  const Vector3d w_imu(0, 0, 0.2);
+  for (int i = 1; i <= 300; ++i) {
+    const ImuMeasurement imu(ConvertToNanoseconds(0.01 * i), w_imu, a_imu);
+    ekf_full.PredictAndUpdate(imu);
+    ekf_fast.PredictAndUpdate(imu);
+  }
+
+  ekf_full.Rewind(1.0);
+  ekf_fast.Rewind(1.0);
+  ekf_full.ReapplyImu();
+  ekf_fast.ReapplyImu();
+
+  // Only the newest 10 measurements got full updates, but the result should be about the same.
+  const StateStamped full = ekf_full.GetState();
+  const StateStamped fast = ekf_fast.GetState();
+  EXPECT_EQ(full.timestamp, fast.timestamp);
+  EXPECT_LT((full.state.t - fast.state.t).norm(), 0.05);
+  EXPECT_LT((full.state.v - fast.state.v).norm(), 0.05);
+  EXPECT_LT(full.state.q.angularDistance(fast.state.q), 1e-2);
+  for (int i = 0; i < 15; ++i) {
+    EXPECT_GT(fast.state.S(i, i), 0);
+  }
+}
+
+TEST(StateEkfTest, FloatMatchesDouble)
+{
+  StateEkf::Params params_double;
+  StateEkf::Params params_float;
+  params_float.float_imu_updates = true;
+  StateEkf ekf_double(params_double);
+  StateEkf ekf_float(params_float);
+
+  const StateStamped ss0(0.0, State(Vector3d(120, -40, 3),
+                                    Vector3d::Zero(),
+                                    Vector3d::Zero(),
+                                    Quaterniond::Identity(),
+                                    Vector3d::Zero(),
+                                    Matrix15d::Identity() * 0.1));
+  ekf_double.Initialize(ss0, ImuBias());
+  ekf_float.Initialize(ss0, ImuBias());
+
+  // A minute of swerving at 200 Hz, with a pose update from the "smoother" every second. The IMU
+  // noise is tiny, so the a and w variances get small enough that float would lose them in the
+  // expanded Joseph form.
+  for (int i = 1; i <= 12000; ++i) {
+    const double t = 0.005 * i;
+    const Vector3d a_imu = Vector3d(0.2 * std::sin(t), 0.1 * std::cos(0.5 * t), 0) - params_double.n_gravity;
+    const Vector3d w_imu(0.02 * std::cos(t), 0, 0.3 * std::sin(0.2 * t));
+    const ImuMeasurement imu(ConvertToNanoseconds(t), w_imu, a_imu);
+    const StateStamped sd = ekf_double.PredictAndUpdate(imu);
+    ekf_float.PredictAndUpdate(imu);
+
+    if (i % 200 == 0) {
+      const Matrix6d R_pose = Matrix6d::Identity() * 1e-3;
+      ekf_double.PredictAndUpdate(sd.timestamp, sd.state.q, sd.state.t, R_pose);
+      ekf_float.PredictAndUpdate(sd.timestamp, sd.state.q, sd.state.t, R_pose);
+    }
+  }
+
+  const StateStamped d = ekf_double.GetState();
+  const StateStamped f = ekf_float.GetState();
+  EXPECT_EQ(d.timestamp, f.timestamp);
+  EXPECT_LT((d.state.t - f.state.t).norm(), 1e-3);
+  EXPECT_LT((d.state.v - f.state.v).norm(), 1e-3);
+  EXPECT_LT(d.state.q.angularDistance(f.state.q), 1e-4);
+  for (int i = 0; i < 15; ++i) {
+    EXPECT_GT(f.state.S(i, i), 0);
+    EXPECT_NEAR(d.state.S(i, i), f.state.S(i, i), 1e-2 * d.state.S(i, i)) << "i=" << i;
+  }
+}
+
 // TEST(VioTest, TestEkf_01)
 // {
 //   StateEkf::Params params;
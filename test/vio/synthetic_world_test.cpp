@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <map>
+
+#include <gtest/gtest.h>
+
+#include "core/transform_util.hpp"
+#include "dataset/data_provider.hpp"
+#include "vio/synthetic_world.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static StereoCamera MakeStereoRig()
+{
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  return StereoCamera(cam, 0.2);
+}
+
+
+// Sensor noise off, so that measurements can be checked against the groundtruth exactly.
+static SyntheticWorld::Params NoiselessParams()
+{
+  SyntheticWorld::Params params;
+  params.duration_sec = 20.0;
+  params.num_landmarks = 500;
+  params.pixel_sigma = 0;
+  params.disp_sigma = 0;
+  params.odom_trans_sigma = 0;
+  params.odom_rot_sigma = 0;
+  params.gyro_sigma = 0;
+  params.accel_sigma = 0;
+  params.depth_sigma = 0;
+  params.range_sigma = 0;
+  params.mag_sigma = 0;
+  return params;
+}
+
+
+TEST(SyntheticWorldTest, Deterministic)
+{
+  SyntheticWorld::Params params;
+  params.duration_sec = 10.0;
+  params.num_landmarks = 500;
+
+  const StereoCamera rig = MakeStereoRig();
+  const SyntheticWorld a(params, rig, Matrix4d::Identity());
+  const SyntheticWorld b(params, rig, Matrix4d::Identity());
+
+  ASSERT_EQ(a.ImuMeasurements().size(), b.ImuMeasurements().size());
+  for (size_t i = 0; i < a.ImuMeasurements().size(); ++i) {
+    EXPECT_EQ(a.ImuMeasurements()[i].a, b.ImuMeasurements()[i].a);
+    EXPECT_EQ(a.ImuMeasurements()[i].w, b.ImuMeasurements()[i].w);
+  }
+
+  ASSERT_EQ(a.Keyframes().size(), b.Keyframes().size());
+  for (size_t k = 0; k < a.Keyframes().size(); ++k) {
+    EXPECT_EQ(a.Keyframes()[k].lmk_obs.landmark_id, b.Keyframes()[k].lmk_obs.landmark_id);
+    EXPECT_EQ(a.Keyframes()[k].lmk_obs.disparity, b.Keyframes()[k].lmk_obs.disparity);
+  }
+
+  params.seed = 1;
+  const SyntheticWorld c(params, rig, Matrix4d::Identity());
+  EXPECT_NE(a.Landmarks().front(), c.Landmarks().front());
+}
+
+
+TEST(SyntheticWorldTest, MeasurementsMatchGroundtruth)
+{
+  const SyntheticWorld::Params params = NoiselessParams();
+  const StereoCamera rig = MakeStereoRig();
+
+  for (const SyntheticTrajectory trajectory : { SyntheticTrajectory::CIRCLE,
+                                                SyntheticTrajectory::FIGURE_EIGHT,
+                                                SyntheticTrajectory::LAWNMOWER }) {
+    SyntheticWorld::Params traj_params = params;
+    traj_params.trajectory = trajectory;
+    const SyntheticWorld world(traj_params, rig, Matrix4d::Identity());
+
+    const std::vector<ImuMeasurement>& imu = world.ImuMeasurements();
+    EXPECT_TRUE(dataset::TimestampsInOrder(imu, true));
+    EXPECT_TRUE(dataset::TimestampsInOrder(world.DepthMeasurements()));
+    EXPECT_TRUE(dataset::TimestampsInOrder(world.RangeMeasurements()));
+    EXPECT_TRUE(dataset::TimestampsInOrder(world.MagMeasurements()));
+
+    // Integrating the gyro should follow the groundtruth rotation.
+    const double dt = 1.0 / params.imu_hz;
+    Matrix3d world_R_body = world.WorldTBody(0).block<3, 3>(0, 0);
+    for (size_t i = 1; i < imu.size(); ++i) {
+      const Vector3d w = 0.5 * (imu[i - 1].w + imu[i].w);
+      if (w.norm() > 0) {
+        world_R_body = world_R_body * AngleAxisd(w.norm() * dt, w.normalized()).toRotationMatrix();
+      }
+    }
+    const Matrix3d world_R_body_gt = world.WorldTBody(params.duration_sec).block<3, 3>(0, 0);
+    EXPECT_LT(AngleAxisd(world_R_body.transpose() * world_R_body_gt).angle(), 2e-3);
+
+    // The vehicle stays level, so the accelerometer is mostly gravity.
+    for (const ImuMeasurement& m : imu) {
+      EXPECT_NEAR(-params.n_gravity.y(), m.a.y(), 0.1);
+    }
+
+    // Every observation should triangulate to a landmark.
+    const std::vector<Vector3d>& landmarks = world.Landmarks();
+    for (const SyntheticWorld::Keyframe& kf : world.Keyframes()) {
+      ASSERT_LE(kf.lmk_obs.Size(), (size_t)params.max_obs_per_keyframe);
+      const Matrix4d world_T_cam = world.WorldTBody(ConvertToSeconds(kf.timestamp - world.FirstTimestamp()));
+      for (size_t i = 0; i < kf.lmk_obs.Size(); ++i) {
+        const cv::Point2f& px = kf.lmk_obs.pixel_location[i];
+        const double depth = rig.DispToDepth(kf.lmk_obs.disparity[i]);
+        const Vector3d p_cam = rig.LeftCamera().Backproject(Vector2d(px.x, px.y), depth);
+        const Vector3d p_world = world_T_cam.block<3, 3>(0, 0) * p_cam + world_T_cam.block<3, 1>(0, 3);
+
+        double min_dist = 1e9;
+        for (const Vector3d& lmk : landmarks) {
+          min_dist = std::min(min_dist, (lmk - p_world).norm());
+        }
+        EXPECT_LT(min_dist, 1e-3);
+      }
+    }
+  }
+}
+
+
+TEST(SyntheticWorldTest, TracksAreContinuous)
+{
+  const SyntheticWorld::Params params = NoiselessParams();
+  const SyntheticWorld world(params, MakeStereoRig(), Matrix4d::Identity());
+
+  // A track id is only ever used in consecutive keyframes (a landmark that comes back into view
+  // gets a new one).
+  std::map<uint32_t, size_t> last_seen;
+  size_t num_continued = 0, num_obs = 0;
+  for (size_t k = 0; k < world.Keyframes().size(); ++k) {
+    for (const uint32_t id : world.Keyframes()[k].lmk_obs.landmark_id) {
+      const auto it = last_seen.find(id);
+      if (it != last_seen.end()) {
+        EXPECT_EQ(k - 1, it->second);
+        ++num_continued;
+      }
+      last_seen[id] = k;
+      ++num_obs;
+    }
+  }
+
+  // Most observations should continue a track, like a real frontend's would.
+  EXPECT_GT((double)num_continued / (double)num_obs, 0.8);
+}
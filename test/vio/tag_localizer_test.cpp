@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include "vio/tag_localizer.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+// Code of tag 7 in the 36h11 family.
+static const unsigned long long kTag36h11Id7 = 0x10652e1d4ULL;
+
+
+// Draws a 36h11 tag (6x6 data cells and a 1 cell black border) centered at (cx, cy), with cells
+// that are cell_px wide. Each pixel is supersampled 4x4, so that the edges are antialiased.
+static void DrawTag36h11(Image1b& im, unsigned long long code, float cx, float cy, float cell_px)
+{
+  const int kDataCells = 6;
+  const int kCells = kDataCells + 2;
+
+  for (int v = 0; v < im.rows; ++v) {
+    for (int u = 0; u < im.cols; ++u) {
+      int sum = 0;
+      for (int sy = 0; sy < 4; ++sy) {
+        for (int sx = 0; sx < 4; ++sx) {
+          const float tx = (u + (sx + 0.5f) / 4 - 0.5f - cx) / cell_px + 0.5f * kCells;
+          const float ty = (v + (sy + 0.5f) / 4 - 0.5f - cy) / cell_px + 0.5f * kCells;
+          int value = 220;
+          if (tx >= 0 && tx < kCells && ty >= 0 && ty < kCells) {
+            const int c = (int)tx;
+            const int r = (int)ty;
+            if (c == 0 || r == 0 || c == (kCells - 1) || r == (kCells - 1)) {
+              value = 30;
+            } else {
+              const int bit = (r - 1) * kDataCells + (c - 1);
+              value = ((code >> (kDataCells * kDataCells - 1 - bit)) & 1) ? 220 : 30;
+            }
+          }
+          sum += value;
+        }
+      }
+      im(v, u) = (uchar)(sum / 16);
+    }
+  }
+}
+
+
+static TagLocalizer::Params MakeParams(int quad_decimate)
+{
+  TagLocalizer::Params params;
+  params.tag_size = 0.16;
+  params.quad_decimate = quad_decimate;
+  params.camera = PinholeCamera(400, 400, 320, 240, 480, 640);
+  params.world_P_tag.emplace(7, gtsam::Pose3::identity());
+  return params;
+}
+
+
+TEST(TagLocalizerTest, FrontoParallel)
+{
+  // 64px across at fx = 400 puts the 0.16m tag 1m away.
+  Image1b im(480, 640);
+  DrawTag36h11(im, kTag36h11Id7, 350.0f, 220.0f, 8.0f);
+
+  for (int quad_decimate = 1; quad_decimate <= 2; ++quad_decimate) {
+    TagLocalizer localizer(MakeParams(quad_decimate));
+    const TagPoseMeasurement::Ptr tag_pose_ptr = localizer.Localize(123, im);
+    ASSERT_TRUE(tag_pose_ptr != nullptr) << "quad_decimate=" << quad_decimate;
+    EXPECT_EQ(123ul, tag_pose_ptr->timestamp);
+    EXPECT_EQ(7, tag_pose_ptr->tag_id);
+    EXPECT_LT(tag_pose_ptr->reprojection_err, 0.5);
+
+    // The tag is at the world origin, and the camera is the body, so this is cam_P_tag.
+    const gtsam::Pose3 cam_P_tag = tag_pose_ptr->world_P_body.inverse();
+    EXPECT_NEAR(0.075, cam_P_tag.translation().x(), 0.01);
+    EXPECT_NEAR(-0.05, cam_P_tag.translation().y(), 0.01);
+    EXPECT_NEAR(1.0, cam_P_tag.translation().z(), 0.01);
+
+    // Facing the camera, so the tag normal is along the optical axis.
+    EXPECT_NEAR(1.0, std::fabs(cam_P_tag.rotation().matrix()(2, 2)), 1e-3);
+  }
+}
+
+
+TEST(TagLocalizerTest, IgnoresUnknownTags)
+{
+  Image1b im(480, 640);
+  DrawTag36h11(im, kTag36h11Id7, 350.0f, 220.0f, 8.0f);
+
+  TagLocalizer::Params params = MakeParams(2);
+  params.world_P_tag.clear();
+  params.world_P_tag.emplace(3, gtsam::Pose3::identity());
+
+  TagLocalizer localizer(params);
+  EXPECT_TRUE(localizer.Localize(123, im) == nullptr);
+}
+
+
+TEST(TagLocalizerTest, MaxRange)
+{
+  Image1b im(480, 640);
+  DrawTag36h11(im, kTag36h11Id7, 350.0f, 220.0f, 8.0f);
+
+  TagLocalizer::Params params = MakeParams(2);
+  params.max_range = 0.5;
+
+  TagLocalizer localizer(params);
+  EXPECT_TRUE(localizer.Localize(123, im) == nullptr);
+}
@@ -0,0 +1,87 @@
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+#include "vio/time_offset_estimator.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+// Rotation rate (rad/s) about a fixed axis, on the camera clock.
+static double TrueRate(double t)
+{
+  return 0.5 + 0.3 * std::sin(2 * M_PI * 0.5 * t) + 0.2 * std::sin(2 * M_PI * 1.3 * t);
+}
+
+
+// Integrates TrueRate() from t0 to t1.
+static double TrueAngle(double t0, double t1)
+{
+  const int N = 100;
+  const double dt = (t1 - t0) / N;
+  double angle = 0;
+  for (int i = 0; i < N; ++i) {
+    angle += TrueRate(t0 + (i + 0.5) * dt) * dt;
+  }
+  return angle;
+}
+
+
+static void Simulate(TimeOffsetEstimator& estimator, double offset, double duration)
+{
+  const double imu_dt = 1.0 / 200.0;
+  const double cam_dt = 1.0 / 20.0;
+
+  double t_cam = 0;
+  for (double t_imu = 0; t_imu < duration; t_imu += imu_dt) {
+    // The gyro measures the true rate at t_camera = t_imu + offset.
+    estimator.AddGyro(t_imu, Vector3d(0, 0, TrueRate(t_imu + offset)));
+
+    // VO results show up a while after the IMU measurements from the same time.
+    while ((t_cam + cam_dt) < (t_imu - 0.2)) {
+      estimator.AddVisionRotation(t_cam, t_cam + cam_dt, TrueAngle(t_cam, t_cam + cam_dt));
+      t_cam += cam_dt;
+    }
+  }
+}
+
+
+TEST(TimeOffsetEstimatorTest, FindsOffset)
+{
+  TimeOffsetEstimator::Params params;
+  TimeOffsetEstimator estimator(params);
+  EXPECT_EQ(0.0, estimator.Offset());
+
+  Simulate(estimator, 0.025, 15.0);
+  EXPECT_GT(estimator.NumUpdates(), 0);
+  EXPECT_NEAR(0.025, estimator.Offset(), 0.002);
+}
+
+
+TEST(TimeOffsetEstimatorTest, NegativeOffset)
+{
+  TimeOffsetEstimator::Params params;
+  TimeOffsetEstimator estimator(params);
+
+  Simulate(estimator, -0.04, 15.0);
+  EXPECT_GT(estimator.NumUpdates(), 0);
+  EXPECT_NEAR(-0.04, estimator.Offset(), 0.002);
+}
+
+
+TEST(TimeOffsetEstimatorTest, NoExcitation)
+{
+  TimeOffsetEstimator::Params params;
+  TimeOffsetEstimator estimator(params);
+
+  // Rotating at a constant rate doesn't say anything about the offset.
+  for (int i = 0; i < 3000; ++i) {
+    estimator.AddGyro(0.005 * i, Vector3d(0, 0, 0.3));
+  }
+  for (int i = 0; i < 140; ++i) {
+    estimator.AddVisionRotation(0.1 * i, 0.1 * (i + 1), 0.03);
+  }
+  EXPECT_EQ(0, estimator.NumUpdates());
+  EXPECT_EQ(0.0, estimator.Offset());
+}
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include "vio/trajectory_polyline.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static Matrix4d PoseAt(double x, double y)
+{
+  Matrix4d world_T_body = Matrix4d::Identity();
+  world_T_body.block<3, 1>(0, 3) = Vector3d(x, y, 0);
+  return world_T_body;
+}
+
+
+TEST(TrajectoryPolylineTest, TestDecimate)
+{
+  TrajectoryParams params;
+  params.min_spacing = 0.125;
+  params.axes_spacing = 1.0;
+  TrajectoryPolyline trajectory(params);
+
+  // 128 Hz groundtruth moving at 1 m/s for 16 sec (steps that add up exactly in floating point).
+  size_t num_changed = 0;
+  for (int i = 0; i <= 2048; ++i) {
+    num_changed += trajectory.Add(PoseAt(i / 128.0, 0)) ? 1 : 0;
+  }
+
+  EXPECT_EQ(2049ul, trajectory.NumAdded());
+
+  // A point every 12.5cm, and axes every meter (plus the first pose for both).
+  EXPECT_EQ(129ul, trajectory.Points().size());
+  EXPECT_EQ(17ul, trajectory.Axes().size());
+  EXPECT_EQ(trajectory.Points().size(), num_changed);
+
+  for (size_t i = 1; i < trajectory.Points().size(); ++i) {
+    EXPECT_GE((trajectory.Points().at(i) - trajectory.Points().at(i - 1)).norm(), params.min_spacing - 1e-9);
+  }
+}
+
+
+TEST(TrajectoryPolylineTest, TestAxesAlongPath)
+{
+  TrajectoryParams params;
+  params.min_spacing = 0;
+  params.axes_spacing = 1.0;
+  TrajectoryPolyline trajectory(params);
+
+  // Back and forth over the same 0.5m: the spacing is along the path, so it still gets axes.
+  for (int i = 0; i < 10; ++i) {
+    trajectory.Add(PoseAt((i % 2 == 0) ? 0 : 0.5, 0));
+  }
+
+  EXPECT_EQ(10ul, trajectory.Points().size());
+  EXPECT_EQ(5ul, trajectory.Axes().size());
+
+  // No axes at all.
+  params.axes_spacing = 0;
+  TrajectoryPolyline no_axes(params);
+  EXPECT_TRUE(no_axes.Add(PoseAt(0, 0)));
+  no_axes.Add(PoseAt(10, 0));
+  EXPECT_TRUE(no_axes.Axes().empty());
+  EXPECT_EQ(2ul, no_axes.Points().size());
+}
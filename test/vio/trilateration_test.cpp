@@ -66,3 +66,90 @@ TEST(Trilateration, Noisy)
   std::cout << "Optimized world_t_body: " << world_t_body.transpose() << std::endl;
   std::cout << "Solution covariance:\n" << solution_cov << std::endl;
 }
+
+
+TEST(Trilateration, ClosedForm)
+{
+  const Vector3d world_t_body(3, -12, 7);
+
+  // Coplanar beacons on the y=0 plane, so the guess decides which side of the plane it's on.
+  MultiRange ranges;
+  for (const Vector3d& p : { Vector3d(5, 0, 0), Vector3d(-5, 0, 0), Vector3d(0, 0, 5), Vector3d(1, 0, -3) }) {
+    ranges.emplace_back(RangeMeasurement(0, (world_t_body - p).norm(), p));
+  }
+
+  Vector3d below(0, -1, 0);
+  EXPECT_TRUE(TrilaterateClosedForm(ranges, below));
+  EXPECT_LT((below - world_t_body).norm(), 1e-6);
+
+  Vector3d above(0, 1, 0);
+  EXPECT_TRUE(TrilaterateClosedForm(ranges, above));
+  EXPECT_LT((above - Vector3d(3, 12, 7)).norm(), 1e-6);
+
+  // Beacons that span 3D don't need a guess.
+  ranges.emplace_back(RangeMeasurement(0, (world_t_body - Vector3d(0, -20, 0)).norm(), Vector3d(0, -20, 0)));
+  Vector3d unique = Vector3d::Zero();
+  EXPECT_TRUE(TrilaterateClosedForm(ranges, unique));
+  EXPECT_LT((unique - world_t_body).norm(), 1e-6);
+
+  // Collinear beacons can't be solved.
+  MultiRange collinear;
+  for (const Vector3d& p : { Vector3d(-5, 0, 0), Vector3d(0, 0, 0), Vector3d(5, 0, 0) }) {
+    collinear.emplace_back(RangeMeasurement(0, (world_t_body - p).norm(), p));
+  }
+  Vector3d unchanged(1, 2, 3);
+  EXPECT_FALSE(TrilaterateClosedForm(collinear, unchanged));
+  EXPECT_EQ(Vector3d(1, 2, 3), unchanged);
+}
+
+
+TEST(Trilateration, ClosedFormThenRefine)
+{
+  const Vector3d world_t_body(17, -15, 4);
+
+  MultiRange ranges;
+  ranges.emplace_back(RangeMeasurement(0, (world_t_body - Vector3d(4, 0, 0)).norm() + 0.3, Vector3d(4, 0, 0)));
+  ranges.emplace_back(RangeMeasurement(0, (world_t_body - Vector3d(-4, 0, 0)).norm() - 0.1, Vector3d(-4, 0, 0)));
+  ranges.emplace_back(RangeMeasurement(0, (world_t_body - Vector3d(0, 0, 4)).norm() - 0.2, Vector3d(0, 0, 4)));
+  const std::vector<double> sigmas(3, 0.5);
+
+  Vector3d estimate(0, -1, 0);
+  ASSERT_TRUE(TrilaterateClosedForm(ranges, estimate));
+
+  Matrix3d solution_cov;
+  const double err = TrilateratePosition(ranges, sigmas, estimate, solution_cov, 20);
+
+  // Three ranges can be fit exactly.
+  EXPECT_LT(err, 1e-3);
+  EXPECT_LT(estimate.y(), 0.0);
+  EXPECT_LT((estimate - world_t_body).norm(), 2.5);
+  std::cout << "Refined world_t_body: " << estimate.transpose() << std::endl;
+}
+
+
+TEST(Trilateration, GateRanges)
+{
+  const Vector3d world_t_body(2, -10, 3);
+  const Matrix3d cov_t = 0.25 * Matrix3d::Identity();
+  const double sigma_range = 0.1;
+
+  const Vector3d p0(5, 0, 0);
+  const Vector3d p1(-5, 0, 0);
+
+  MultiRange ranges;
+  ranges.emplace_back(RangeMeasurement(0, (world_t_body - p0).norm() + 0.3, p0));   // ~0.6 sigma
+  ranges.emplace_back(RangeMeasurement(0, (world_t_body - p1).norm() + 4.0, p1));   // Multipath.
+
+  EXPECT_LT(RangeMahalanobisSq(ranges.at(0), world_t_body, cov_t, sigma_range), 1.0);
+  EXPECT_GT(RangeMahalanobisSq(ranges.at(1), world_t_body, cov_t, sigma_range), 9.0);
+
+  MultiRange inliers;
+  EXPECT_EQ(1, GateRanges(ranges, world_t_body, cov_t, sigma_range, 9.0, inliers));
+  ASSERT_EQ(1ul, inliers.size());
+  EXPECT_EQ(p0, inliers.at(0).point);
+
+  // With enough position uncertainty, the same range is plausible.
+  inliers.clear();
+  EXPECT_EQ(0, GateRanges(ranges, world_t_body, 4.0 * Matrix3d::Identity(), sigma_range, 9.0, inliers));
+  EXPECT_EQ(2ul, inliers.size());
+}
@@ -0,0 +1,51 @@
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "vision_core/debug_viewer.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(DebugViewerTest, Headless)
+{
+  DebugViewer viewer;
+  viewer.SetShowWindows(false);
+
+  std::mutex mutex;
+  std::map<std::string, int> shown;
+  viewer.RegisterFrameCallback([&](const std::string& window, const cv::Mat& image) {
+    std::lock_guard<std::mutex> lock(mutex);
+    shown[window] = image.at<uint8_t>(0, 0);
+  });
+
+  viewer.Show("a", Image1b(4, 4, (uint8_t)1));
+  viewer.Show("b", Image1b(4, 4, (uint8_t)2));
+  viewer.Show("empty", Image1b());
+
+  for (int i = 0; i < 100; ++i) {
+    mutex.lock();
+    const size_t n = shown.size();
+    mutex.unlock();
+    if (n == 2) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  // Empty images are ignored.
+  viewer.ClearFrameCallbacks();
+  ASSERT_EQ(2ul, shown.size());
+  EXPECT_EQ(1, shown.at("a"));
+  EXPECT_EQ(2, shown.at("b"));
+
+  // No callbacks run after ClearFrameCallbacks().
+  viewer.Show("c", Image1b(4, 4, (uint8_t)3));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(0ul, shown.count("c"));
+}
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <opencv2/core/cuda.hpp>
+
+#include "vision_core/gpu_memory_pool.hpp"
+
+using namespace bm;
+using namespace core;
+
+namespace cu = cv::cuda;
+
+
+static GpuBudgetUsage FindUsage(const std::vector<GpuBudgetUsage>& usage, const std::string& module)
+{
+  for (const GpuBudgetUsage& u : usage) {
+    if (u.module == module) {
+      return u;
+    }
+  }
+  return GpuBudgetUsage();
+}
+
+
+// NOTE(milo): The pool is process-wide and can't be uninstalled, so this is the only test of it.
+TEST(GpuMemoryPoolTest, TestArena)
+{
+  if (cu::getCudaEnabledDeviceCount() == 0) {
+    LOG(WARNING) << "No CUDA device, skipping GpuMemoryPoolTest" << std::endl;
+    return;
+  }
+
+  GpuMemoryPool& pool = GpuMemoryPool::Get();
+  pool.Install(1 << 20, 1 << 20);
+  ASSERT_TRUE(pool.Installed());
+  EXPECT_EQ(1ul << 20, pool.ReservedBytes());
+
+  pool.SetBudget("TestA", 4096);
+
+  {
+    ScopedGpuBudget budget("TestA");
+
+    // Images are pitched, and blocks are packed one after another.
+    cu::GpuMat im(100, 100, CV_8UC1);
+    EXPECT_EQ(512ul, im.step);
+    cu::GpuMat row(1, 100, CV_8UC1);
+    EXPECT_EQ(im.datastart + 100 * 512, row.datastart);
+
+    // Nested scopes charge the innermost module.
+    {
+      ScopedGpuBudget inner("TestB");
+      cu::GpuMat other(1, 10, CV_32FC1);
+      EXPECT_EQ(512ul, FindUsage(pool.GetUsage(), "TestB").bytes);
+    }
+    EXPECT_EQ(0ul, FindUsage(pool.GetUsage(), "TestB").bytes);
+    EXPECT_EQ(512ul, FindUsage(pool.GetUsage(), "TestB").peak_bytes);
+
+    const GpuBudgetUsage a = FindUsage(pool.GetUsage(), "TestA");
+    EXPECT_EQ(100ul * 512 + 512, a.bytes);
+    EXPECT_EQ(2ul, a.num_over);
+
+    // The freed image is reused (once the device is done with it).
+    im.release();
+    cu::GpuMat smaller(10, 10, CV_8UC1);
+    EXPECT_EQ(row.datastart - 100 * 512, smaller.datastart);
+
+    uchar* data = smaller.datastart;
+    smaller.upload(cv::Mat(10, 10, CV_8UC1, cv::Scalar(7)));
+    cv::Mat downloaded;
+    smaller.download(downloaded);
+    EXPECT_EQ(7, downloaded.at<uchar>(9, 9));
+    EXPECT_EQ(data, smaller.datastart);
+  }
+
+  // Too big for the reserve, so the arena grows.
+  cu::GpuMat big(1, 3 << 20, CV_8UC1);
+  EXPECT_EQ(1ul, pool.NumGrowths());
+  big.release();
+
+  // Everything is free again, so the whole first chunk fits without growing.
+  cu::GpuMat whole(1, 1 << 20, CV_8UC1);
+  EXPECT_EQ(1ul, pool.NumGrowths());
+  EXPECT_EQ((1ul << 20) + (3ul << 20), pool.ReservedBytes());
+}
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include "vision_core/image_pool.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(ImagePoolTest, Reuse)
+{
+  ImagePool pool(2);
+  EXPECT_EQ(0ul, pool.NumBuffers());
+
+  const uchar* data = nullptr;
+  {
+    const Image1b im = pool.Acquire(480, 640);
+    EXPECT_EQ(480, im.rows);
+    EXPECT_EQ(640, im.cols);
+    data = im.data;
+  }
+  EXPECT_EQ(1ul, pool.NumBuffers());
+
+  // The first image was released, so its buffer comes back.
+  Image1b a = pool.Acquire(480, 640);
+  EXPECT_EQ(data, a.data);
+
+  // A copy of the header keeps the buffer in use.
+  const Image1b a_copy = a;
+  a.release();
+  const Image1b b = pool.Acquire(480, 640);
+  EXPECT_NE(data, b.data);
+  EXPECT_EQ(2ul, pool.NumBuffers());
+  EXPECT_EQ(0ul, pool.NumMisses());
+
+  // Both buffers are in use, so this one isn't pooled.
+  const Image1b c = pool.Acquire(480, 640);
+  EXPECT_NE(a_copy.data, c.data);
+  EXPECT_NE(b.data, c.data);
+  EXPECT_EQ(2ul, pool.NumBuffers());
+  EXPECT_EQ(1ul, pool.NumMisses());
+
+  EXPECT_TRUE(pool.Acquire(0, 640).empty());
+}
+
+
+TEST(ImagePoolTest, Resize)
+{
+  ImagePool pool(1);
+  pool.Reserve(4, 240, 320);
+  EXPECT_EQ(1ul, pool.NumBuffers());
+
+  const Image1b im = pool.Acquire(480, 640);
+  EXPECT_EQ(480, im.rows);
+  EXPECT_EQ(640, im.cols);
+  EXPECT_EQ(1ul, pool.NumBuffers());
+  EXPECT_EQ(0ul, pool.NumMisses());
+}
@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/image_util.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(ImageUtilTest, ConvertIntoBuffer)
+{
+  Image3b bgr(48, 64);
+  cv::randu(bgr, cv::Scalar::all(0), cv::Scalar::all(255));
+
+  Image1b expected;
+  cv::cvtColor(bgr, expected, cv::COLOR_BGR2GRAY);
+
+  // The output buffer is reused when it's already the right size.
+  Image1b gray(48, 64);
+  const uchar* data = gray.data;
+  MaybeConvertToGray(bgr, gray);
+  EXPECT_EQ(data, gray.data);
+  EXPECT_EQ(0, cv::norm(expected, gray, cv::NORM_INF));
+
+  // Gray images are shared, not copied.
+  const Image1b shared = MaybeConvertToGray(expected);
+  EXPECT_EQ(expected.data, shared.data);
+
+  // From a pool.
+  ImagePool pool(2);
+  const Image1b pooled = MaybeConvertToGray(bgr, pool);
+  EXPECT_EQ(1ul, pool.NumBuffers());
+  EXPECT_EQ(0, cv::norm(expected, pooled, cv::NORM_INF));
+}
+
+
+TEST(ImageUtilTest, CastImage1bTo1f)
+{
+  Image1b im(4, 5, (uchar)51);
+  Image1f out(4, 5);
+  const float* data = out.ptr<float>();
+
+  CastImage1bTo1f(im, out);
+  EXPECT_EQ(data, out.ptr<float>());
+  EXPECT_FLOAT_EQ(0.2f, out(2, 3));
+
+  // Normalized to zero mean.
+  CastImage1bTo1f(im, out, 1.0f / 255.0f, -0.2f);
+  EXPECT_NEAR(0.0f, out(1, 1), 1e-6);
+}
@@ -0,0 +1,36 @@
+#include <gtest/gtest.h>
+
+#include "vision_core/landmark_observation.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(LandmarkObservationTest, Batch)
+{
+  LandmarkObservationBatch batch;
+  EXPECT_TRUE(batch.Empty());
+
+  batch.Add(LandmarkObservation(42, 7, cv::Point2f(10.5, 20.25), 4.5, 1.0, 1.0));
+  batch.Add(43, cv::Point2f(30.0, 40.0), 2.0);
+  ASSERT_EQ(2ul, batch.Size());
+  EXPECT_EQ(42u, batch.landmark_id.at(0));
+  EXPECT_EQ(20.25, batch.pixel_location.at(0).y);
+  EXPECT_EQ(4.5, batch.disparity.at(0));
+
+  // Copying one observation from another batch.
+  LandmarkObservationBatch other;
+  other.Add(batch, 1);
+  ASSERT_EQ(1ul, other.Size());
+  EXPECT_EQ(43u, other.landmark_id.at(0));
+  EXPECT_EQ(30.0, other.pixel_location.at(0).x);
+  EXPECT_EQ(2.0, other.disparity.at(0));
+
+  // Moving leaves the old batch empty.
+  const LandmarkObservationBatch moved(std::move(batch));
+  EXPECT_EQ(2ul, moved.Size());
+  EXPECT_TRUE(batch.Empty());
+
+  other.Clear();
+  EXPECT_TRUE(other.Empty());
+}
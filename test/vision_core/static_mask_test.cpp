@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include "vision_core/static_mask.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(StaticMaskTest, TestRasterize)
+{
+  // Nothing blocked.
+  const StaticMask none;
+  EXPECT_TRUE(none.Empty());
+  EXPECT_TRUE(none.Valid(48, 64).empty());
+  EXPECT_EQ(0.0, none.BlockedFraction());
+  EXPECT_TRUE(NotBlocked(none.Valid(48, 64), cv::Point2f(10, 10)));
+
+  // The bottom quarter, plus a box that's partly outside of the image (and clipped).
+  const StaticMask mask(48, 64, { cv::Rect(0, 36, 64, 12), cv::Rect(60, 0, 10, 4) });
+  ASSERT_FALSE(mask.Empty());
+  EXPECT_EQ(cv::Rect(60, 0, 4, 4), mask.Blocked().at(1));
+
+  const Image1b valid = mask.Valid(48, 64);
+  ASSERT_EQ(48, valid.rows);
+  ASSERT_EQ(64, valid.cols);
+  EXPECT_EQ(255, valid(35, 0));
+  EXPECT_EQ(0, valid(36, 0));
+  EXPECT_EQ(0, valid(0, 63));
+  EXPECT_EQ(255, valid(4, 63));
+  EXPECT_NEAR((64*12 + 16) / (48.0 * 64.0), mask.BlockedFraction(), 1e-9);
+
+  EXPECT_TRUE(NotBlocked(valid, cv::Point2f(10.2f, 20.4f)));
+  EXPECT_FALSE(NotBlocked(valid, cv::Point2f(10.0f, 40.0f)));
+  EXPECT_FALSE(NotBlocked(valid, cv::Point2f(-1.0f, 10.0f)));
+
+  // Rasterized once per size, and shared with copies.
+  const StaticMask copy = mask;
+  EXPECT_EQ(valid.data, copy.Valid(48, 64).data);
+
+  // Half size rounds outwards: 36 / 2 = 18, and the corner box is 2x2.
+  const Image1b half = mask.Valid(24, 32);
+  EXPECT_EQ(255, half(17, 0));
+  EXPECT_EQ(0, half(18, 0));
+  EXPECT_EQ(0, half(1, 30));
+  EXPECT_EQ(255, half(2, 30));
+  EXPECT_EQ(255, half(0, 29));
+}
@@ -0,0 +1,103 @@
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+#include "vision_core/stereo_rectifier.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static RawStereoCalibration MakeRawRig(const PinholeCamera& cam, double baseline)
+{
+  RawStereoCalibration raw;
+  raw.left.K = cam.K();
+  raw.left.height = cam.Height();
+  raw.left.width = cam.Width();
+  raw.right = raw.left;
+  raw.left_T_right(0, 3) = baseline;
+  return raw;
+}
+
+
+// Brightness goes up by one every 4 pixels to the right, so it's easy to check where a pixel came from.
+static Image1b MakeGradient(int rows, int cols)
+{
+  Image1b im(rows, cols);
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < cols; ++c) {
+      im(r, c) = static_cast<uint8_t>(c / 4);
+    }
+  }
+  return im;
+}
+
+
+TEST(StereoRectifierTest, AlreadyRectified)
+{
+  const PinholeCamera cam(400, 400, 320, 240, 480, 640);
+  const StereoCamera rig(cam, 0.1);
+  const StereoRectifier rectifier(MakeRawRig(cam, 0.1), rig);
+  EXPECT_EQ(cv::Size(640, 480), rectifier.RectifiedSize());
+
+  // With no distortion or rotation, the images come out the same (away from the border).
+  const Image1b raw = MakeGradient(480, 640);
+  Image1b out;
+  rectifier.Rectify(0, raw, out);
+  ASSERT_EQ(raw.size(), out.size());
+
+  const cv::Rect interior(8, 8, 640 - 16, 480 - 16);
+  Image1b diff;
+  cv::absdiff(raw(interior), out(interior), diff);
+  double max_diff = 0;
+  cv::minMaxLoc(diff, nullptr, &max_diff);
+  EXPECT_LE(max_diff, 1.0);
+}
+
+
+TEST(StereoRectifierTest, Downsize)
+{
+  const PinholeCamera cam(400, 400, 320, 240, 480, 640);
+  const PinholeCamera cam_half = cam.Rescale(240, 320);
+  const StereoRectifier rectifier(MakeRawRig(cam, 0.1), StereoCamera(cam_half, 0.1));
+
+  ImagePool pool(4);
+  const Image1b raw = MakeGradient(480, 640);
+  StereoImage1b pair(123, 7, raw, raw);
+  pair.latency.received = 42;
+
+  const StereoImage1b out = rectifier.Rectify(pair, pool);
+  EXPECT_EQ(123ul, out.timestamp);
+  EXPECT_EQ(7ul, out.camera_id);
+  EXPECT_EQ(42, out.latency.received);
+  ASSERT_EQ(240, out.left_image.rows);
+  ASSERT_EQ(320, out.left_image.cols);
+  ASSERT_EQ(240, out.right_image.rows);
+  EXPECT_EQ(2ul, pool.NumBuffers());
+
+  // Each output pixel samples the raw image at the same ray.
+  for (int c = 10; c < 310; c += 20) {
+    const double u_raw = (c - cam_half.cx()) / cam_half.fx() * cam.fx() + cam.cx();
+    EXPECT_NEAR(u_raw / 4.0, out.left_image(120, c), 1.0) << "column " << c;
+  }
+}
+
+
+TEST(StereoRectifierTest, Undistort)
+{
+  const PinholeCamera cam(400, 400, 320, 240, 480, 640);
+  RawStereoCalibration raw_rig = MakeRawRig(cam, 0.1);
+  raw_rig.left.distortion = { -0.2, 0.05, 0.0, 0.0 };
+  raw_rig.right.distortion = raw_rig.left.distortion;
+  const StereoRectifier rectifier(raw_rig, StereoCamera(cam, 0.1));
+
+  const Image1b raw = MakeGradient(480, 640);
+  Image1b out;
+  rectifier.Rectify(1, raw, out);
+
+  // The principal point doesn't move. Barrel distortion squeezed the edges towards the center, so
+  // pixels near the edges get their brightness from closer to the center.
+  EXPECT_NEAR(raw(240, 320), out(240, 320), 1.0);
+  EXPECT_GT(out(240, 40), raw(240, 40) + 3);
+  EXPECT_LT(out(240, 600) + 3, raw(240, 600));
+}